@@ -11,12 +11,126 @@
 
 #include "io_client.h"
 
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/port.h"
+
 namespace pdlfs {
 namespace ioclient {
 
 Dir::~Dir() {}
 
-IOClient::~IOClient() {}
+struct IOClient::AsyncState {
+  explicit AsyncState(int depth)
+      : pool(ThreadPool::NewFixed(depth)),
+        depth(depth),
+        outstanding(0),
+        cv(&mu) {}
+  ~AsyncState() { delete pool; }
+  ThreadPool* const pool;
+  const int depth;
+  port::Mutex mu;
+  // State below is protected by mu
+  int outstanding;
+  port::CondVar cv;
+  Status error;  // First error since the last WaitForAppends()
+};
+
+struct IOClient::AsyncBatch {
+  IOClient* cli;
+  Dir* dir;
+  std::vector<std::string> files;
+  std::string buf;  // Copy of the data of all appends
+  std::vector<size_t> sizes;
+};
+
+IOClient::~IOClient() {
+  if (async_ != NULL) {
+    WaitForAppends();
+    delete async_;
+  }
+}
+
+Status IOClient::BatchAppendAt(Dir* dir, const std::vector<std::string>& files,
+                               const std::vector<Slice>& data) {
+  Status s;
+  for (size_t i = 0; s.ok() && i < files.size(); i++) {
+    s = AppendAt(dir, files[i], data[i].data(), data[i].size());
+  }
+  return s;
+}
+
+void IOClient::DoAsyncBatch(void* arg) {
+  AsyncBatch* const batch = reinterpret_cast<AsyncBatch*>(arg);
+  std::vector<Slice> data;
+  const char* p = batch->buf.data();
+  for (size_t i = 0; i < batch->sizes.size(); i++) {
+    data.push_back(Slice(p, batch->sizes[i]));
+    p += batch->sizes[i];
+  }
+  IOClient* const cli = batch->cli;
+  Status s = cli->BatchAppendAt(batch->dir, batch->files, data);
+  delete batch;
+  AsyncState* const async = cli->async_;
+  async->mu.Lock();
+  if (!s.ok() && async->error.ok()) {
+    async->error = s;
+  }
+  async->outstanding--;
+  async->cv.SignalAll();
+  async->mu.Unlock();
+}
+
+Status IOClient::BatchAppendAtAsync(Dir* dir,
+                                    const std::vector<std::string>& files,
+                                    const std::vector<Slice>& data) {
+  if (async_ == NULL) {
+    return BatchAppendAt(dir, files, data);
+  }
+  AsyncBatch* const batch = new AsyncBatch;
+  batch->cli = this;
+  batch->dir = dir;
+  batch->files = files;
+  for (size_t i = 0; i < data.size(); i++) {
+    batch->buf.append(data[i].data(), data[i].size());
+    batch->sizes.push_back(data[i].size());
+  }
+  Status s;
+  async_->mu.Lock();
+  while (async_->outstanding >= async_->depth) {
+    async_->cv.Wait();
+  }
+  s = async_->error;
+  if (s.ok()) {
+    async_->outstanding++;
+  }
+  async_->mu.Unlock();
+  if (s.ok()) {
+    async_->pool->Schedule(DoAsyncBatch, batch);
+  } else {
+    delete batch;
+  }
+  return s;
+}
+
+Status IOClient::AppendAtAsync(Dir* dir, const std::string& file,
+                               const char* data, size_t size) {
+  return BatchAppendAtAsync(dir, std::vector<std::string>(1, file),
+                            std::vector<Slice>(1, Slice(data, size)));
+}
+
+Status IOClient::WaitForAppends() {
+  if (async_ == NULL) {
+    return Status::OK();
+  }
+  async_->mu.Lock();
+  while (async_->outstanding != 0) {
+    async_->cv.Wait();
+  }
+  Status s = async_->error;
+  async_->error = Status::OK();
+  async_->mu.Unlock();
+  return s;
+}
 
 IOClient* IOClient::Factory(const IOClientOptions& raw_options) {
   IOClientOptions options = raw_options;
@@ -27,11 +141,16 @@ IOClient* IOClient::Factory(const IOClientOptions& raw_options) {
   if (options.argc >= 2) {
     fs = options.argv[1];
   }
+  IOClient* cli;
   if (fs == "deltafs") {
-    return IOClient::Deltafs(options);
+    cli = IOClient::Deltafs(options);
   } else {
-    return IOClient::Default(options);
+    cli = IOClient::Default(options);
+  }
+  if (cli != NULL && options.queue_depth > 0) {
+    cli->async_ = new AsyncState(options.queue_depth);
   }
+  return cli;
 }
 
 }  // namespace ioclient
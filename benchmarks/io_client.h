@@ -11,8 +11,12 @@
  * found in the LICENSE file. See the AUTHORS file for names of contributors.
  */
 
+#include "pdlfs-common/slice.h"
 #include "pdlfs-common/status.h"
 
+#include <string>
+#include <vector>
+
 namespace pdlfs {
 namespace ioclient {
 
@@ -27,6 +31,9 @@ struct IOClientOptions {
   int rank;
   // Total number of clients
   int comm_sz;
+  // Max number of outstanding asynchronous appends, or 0 to make
+  // asynchronous appends synchronous
+  int queue_depth;
 };
 
 // Abstract dir handle;
@@ -44,7 +51,7 @@ class IOClient {
   // Open a client backed by Deltafs
   static IOClient* Deltafs(const IOClientOptions&);
 
-  IOClient() {}
+  IOClient() : async_(NULL) {}
   virtual ~IOClient();
   virtual Status Init() = 0;
   virtual Status Dispose() = 0;
@@ -60,7 +67,32 @@ class IOClient {
   virtual Status CloseDir(Dir* dir) = 0;
   virtual Status MakeDir(const std::string& path) = 0;
 
+  // Append data[i] to files[i] for each file in a batch. Return the first
+  // error. The default implementation calls AppendAt() on each file.
+  virtual Status BatchAppendAt(Dir* dir, const std::vector<std::string>& files,
+                               const std::vector<Slice>& data);
+
+  // Queue a batch of appends and return without waiting for it. Blocks
+  // while queue_depth batches are outstanding. Data is copied before the
+  // call returns. Errors are reported by a later call or by
+  // WaitForAppends(). Same as BatchAppendAt() if queue_depth is 0.
+  // Queued appends are done through BatchAppendAt() so all clients get the
+  // same pipelining.
+  Status BatchAppendAtAsync(Dir* dir, const std::vector<std::string>& files,
+                            const std::vector<Slice>& data);
+  Status AppendAtAsync(Dir* dir, const std::string& file, const char* data,
+                       size_t size);
+  // Wait for all queued appends to complete. Return the first error met by
+  // them since the last call. Must be called before a dir is closed and
+  // before the client is disposed.
+  Status WaitForAppends();
+
  private:
+  struct AsyncState;
+  struct AsyncBatch;
+  static void DoAsyncBatch(void* arg);
+  AsyncState* async_;  // NULL if queue_depth is 0
+
   // No copying allowed
   void operator=(const IOClient&);
   IOClient(const IOClient&);
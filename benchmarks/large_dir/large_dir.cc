@@ -285,6 +285,7 @@ static pdlfs::LDbenchOptions ParseOptions(int argc, char** argv) {
   pdlfs::LDbenchOptions result;
   result.rank = 0;
   result.comm_sz = 1;
+  result.queue_depth = 0;
   result.relaxed_consistency = false;
   result.ignore_errors = false;
   result.skip_inserts = false;
@@ -9,6 +9,7 @@
  * found in the LICENSE file. See the AUTHORS file for names of contributors.
  */
 
+#include <algorithm>
 #include <getopt.h>
 #include <mpi.h>
 #include <stdio.h>
@@ -17,6 +18,7 @@
 
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/hash.h"
+#include "pdlfs-common/histogram.h"
 #include "pdlfs-common/random.h"
 
 // Abstract FS interface
@@ -39,6 +41,8 @@ struct VPICbenchOptions : public ioclient::IOClientOptions {
   int x, y, z;
   // Number of particles per cell
   int ppc;
+  // Number of particles written by each append call
+  int batch_size;
 };
 
 // REQUIRES: callers are required to initialize all fields
@@ -51,6 +55,22 @@ struct VPICbenchReport {
   int ops;
   // Total number of errors
   int errors;
+  // Total number of bytes written
+  double bytes;
+  // Latency of each op in microseconds
+  Histogram latency;
+};
+
+// Reports of all ranks merged at rank 0.
+struct VPICbenchAggregate {
+  // Ops, errors, bytes, and latencies of all ranks. The duration is that of
+  // the slowest rank.
+  VPICbenchReport total;
+  // Per-rank durations
+  double min_duration;
+  double median_duration;
+  // Rank with the longest duration
+  int straggler;
 };
 
 // A simple benchmark that simulates the write pattern of a VPIC app
@@ -64,6 +84,7 @@ class VPICbench {
 
   ~VPICbench() {
     if (io_ != NULL) {
+      io_->WaitForAppends();
       if (dir_ != NULL) {
         io_->CloseDir(dir_);
       }
@@ -85,7 +106,15 @@ class VPICbench {
   }
 
   Status MkStep(int step_id) {
-    Status s = io_->FlushEpoch(dir_);
+    Status s;
+    // Ranks that did not create the root open it on their first dump, by
+    // which time rank 0 is done preparing
+    if (dir_ == NULL) {
+      s = io_->OpenDir("/particles", &dir_);
+    }
+    if (s.ok()) {
+      s = io_->FlushEpoch(dir_);
+    }
     if (options_.ignore_errors) {
       return Status::OK();
     } else {
@@ -93,24 +122,48 @@ class VPICbench {
     }
   }
 
-  Status WriteParticle(int step_id, long long particle_id) {
-    Status s;
+  static const size_t kParticleBytes = 32;
+
+  // Add a particle to the current batch.
+  void AddParticle(int step_id, long long particle_id) {
     char tmp[256];
     snprintf(tmp, sizeof(tmp), "p_%lld", particle_id);
-    char data[32];  // possibly eight 32-bit float numbers
-    {
-      char* p = data;
-      for (int i = 0; i < sizeof(data) / 8; i++) {
-        uint64_t r = rnd_.Next64();
-        EncodeFixed64(p, r);
-        p += 8;
-      }
+    batch_files_.push_back(tmp);
+    // Possibly eight 32-bit float numbers
+    for (size_t i = 0; i < kParticleBytes / 8; i++) {
+      PutFixed64(&batch_buf_, rnd_.Next64());
     }
+  }
+
+  // Write all particles of the current batch. The write is queued if a
+  // queue depth is set, in which case its errors are reported by a later
+  // write or by WaitForParticles().
+  Status WriteParticles() {
+    Status s;
     if (dir_ == NULL) {
       s = Status::AssertionFailed("dir not opened");
+    } else if (batch_files_.size() == 1) {
+      s = io_->AppendAtAsync(dir_, batch_files_[0], batch_buf_.data(),
+                             batch_buf_.size());
+    } else {
+      std::vector<Slice> data;
+      for (size_t i = 0; i < batch_files_.size(); i++) {
+        data.push_back(Slice(batch_buf_.data() + i * kParticleBytes,
+                             kParticleBytes));
+      }
+      s = io_->BatchAppendAtAsync(dir_, batch_files_, data);
+    }
+    batch_files_.clear();
+    batch_buf_.clear();
+    if (options_.ignore_errors) {
+      return Status::OK();
     } else {
-      s = io_->AppendAt(dir_, tmp, data, sizeof(data));
+      return s;
     }
+  }
+
+  Status WaitForParticles() {
+    Status s = io_->WaitForAppends();
     if (options_.ignore_errors) {
       return Status::OK();
     } else {
@@ -140,6 +193,8 @@ class VPICbench {
     VPICbenchReport report;
     report.errors = 0;
     report.ops = 0;
+    report.bytes = 0;
+    report.latency.Clear();
     Status s = io_->Init();
     if (s.ok()) {
       report.ops++;
@@ -163,13 +218,21 @@ class VPICbench {
   }
 
   // In each dump, every client writes a random disjoint subset of particles.
+  // Particles are written in batches of batch_size, and are written
+  // asynchronously if a queue depth is set. In the latter case, op latency
+  // is the time to queue a write and the dump waits for all queued writes
+  // before it ends.
   // Return a status report with local timing and error counts.
   VPICbenchReport Dump() {
     double start = MPI_Wtime();
     VPICbenchReport report;
     report.errors = 0;
     report.ops = 0;
+    report.bytes = 0;
+    report.latency.Clear();
+    double op_start = MPI_Wtime();
     Status s = MkStep(dump_seq_);
+    report.latency.Add((MPI_Wtime() - op_start) * 1000 * 1000);
     if (!s.ok()) {
       report.errors++;
     } else {
@@ -180,15 +243,24 @@ class VPICbench {
       for (uint64_t i = 0; i < num_particles; i++) {
         int r = Rank(dump_seq_, i) % options_.comm_sz;
         if (r == options_.rank) {
-          s = WriteParticle(dump_seq_, i);
-          if (!s.ok()) {
-            report.errors++;
-            break;
-          } else {
-            report.ops++;
+          AddParticle(dump_seq_, i);
+          if (batch_files_.size() >= size_t(options_.batch_size)) {
+            s = WriteBatch(&report);
+            if (!s.ok()) {
+              break;
+            }
           }
         }
       }
+      if (s.ok() && !batch_files_.empty()) {
+        s = WriteBatch(&report);
+      }
+      if (s.ok()) {
+        s = WaitForParticles();
+        if (!s.ok()) {
+          report.errors++;
+        }
+      }
     }
 
     dump_seq_++;
@@ -200,6 +272,22 @@ class VPICbench {
   }
 
  private:
+  Status WriteBatch(VPICbenchReport* report) {
+    const size_t n = batch_files_.size();
+    double op_start = MPI_Wtime();
+    Status s = WriteParticles();
+    report->latency.Add((MPI_Wtime() - op_start) * 1000 * 1000);
+    if (!s.ok()) {
+      report->errors++;
+    } else {
+      report->ops += n;
+      report->bytes += n * kParticleBytes;
+    }
+    return s;
+  }
+
+  std::vector<std::string> batch_files_;
+  std::string batch_buf_;
   int dump_seq_;
   const VPICbenchOptions options_;
   ioclient::IOClient* io_;
@@ -209,26 +297,81 @@ class VPICbench {
 
 }  // namespace pdlfs
 
-static pdlfs::VPICbenchReport Merge(const pdlfs::VPICbenchReport& report) {
+// Collect the reports of all ranks at rank 0. Per-rank durations are
+// gathered to find stragglers, and per-rank latency histograms are gathered
+// and merged so tail latencies cover all ops.
+static pdlfs::VPICbenchAggregate Merge(const pdlfs::VPICbenchReport& report,
+                                       int rank, int size) {
   if (!report.message.empty()) {
     printf("E: %s\n", report.message.c_str());
   }
 
-  pdlfs::VPICbenchReport result;
+  pdlfs::VPICbenchAggregate result;
+  pdlfs::VPICbenchReport* const total = &result.total;
+  total->latency.Clear();
 
-  MPI_Reduce(&report.duration, &result.duration, 1, MPI_DOUBLE, MPI_MAX, 0,
+  MPI_Reduce(&report.duration, &total->duration, 1, MPI_DOUBLE, MPI_MAX, 0,
              MPI_COMM_WORLD);
-  MPI_Reduce(&report.errors, &result.errors, 1, MPI_INT, MPI_SUM, 0,
+  // All ranks need the error count to agree on whether to abort
+  MPI_Allreduce(const_cast<int*>(&report.errors), &total->errors, 1, MPI_INT,
+                MPI_SUM, MPI_COMM_WORLD);
+  MPI_Reduce(&report.ops, &total->ops, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&report.bytes, &total->bytes, 1, MPI_DOUBLE, MPI_SUM, 0,
+             MPI_COMM_WORLD);
+
+  std::vector<double> durations(rank == 0 ? size : 0);
+  MPI_Gather(const_cast<double*>(&report.duration), 1, MPI_DOUBLE,
+             rank == 0 ? &durations[0] : NULL, 1, MPI_DOUBLE, 0,
              MPI_COMM_WORLD);
-  MPI_Reduce(&report.ops, &result.ops, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+  const int n = pdlfs::Histogram::kFlatLength;
+  std::vector<double> flat(n);
+  report.latency.EncodeTo(&flat[0]);
+  std::vector<double> hists(rank == 0 ? size * n : 0);
+  MPI_Gather(&flat[0], n, MPI_DOUBLE, rank == 0 ? &hists[0] : NULL, n,
+             MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+  if (rank == 0) {
+    pdlfs::Histogram hist;
+    for (int i = 0; i < size; i++) {
+      hist.DecodeFrom(&hists[i * n]);
+      total->latency.Merge(hist);
+    }
+    result.straggler = static_cast<int>(
+        std::max_element(durations.begin(), durations.end()) -
+        durations.begin());
+    std::sort(durations.begin(), durations.end());
+    result.min_duration = durations[0];
+    result.median_duration = durations[size / 2];
+  }
 
   return result;
 }
 
-static void Print(const pdlfs::VPICbenchReport& report) {
+static void Print(const pdlfs::VPICbenchAggregate& aggr, const char* io_type) {
+  const pdlfs::VPICbenchReport& report = aggr.total;
   printf("-- Performed %d ops in %.3f seconds: %d succ, %d fail\n",
          report.ops + report.errors, report.duration, report.ops,
          report.errors);
+  if (report.duration > 0) {
+    printf("-- [%s] Aggregate bandwidth: %.3f MiB/s, %.1f ops/s\n", io_type,
+           report.bytes / report.duration / 1024 / 1024,
+           report.ops / report.duration);
+  }
+  printf(
+      "-- Rank time: min %.3f s, median %.3f s, max %.3f s (straggler: rank "
+      "%d, %+.1f%% over median)\n",
+      aggr.min_duration, aggr.median_duration, report.duration,
+      aggr.straggler,
+      aggr.median_duration > 0
+          ? (report.duration / aggr.median_duration - 1) * 100
+          : 0.0);
+  const pdlfs::Histogram& lat = report.latency;
+  if (lat.Count() == 0) return;
+  printf(
+      "-- Op latency: avg %.3f us, p50 %.3f us, p90 %.3f us, p99 %.3f us, "
+      "p99.9 %.3f us, max %.3f us\n",
+      lat.Average(), lat.Percentile(50), lat.Percentile(90),
+      lat.Percentile(99), lat.Percentile(99.9), lat.Percentile(100));
 }
 
 static void Print(const char* msg) {
@@ -257,7 +400,12 @@ static void Help(const char* prog, FILE* out) {
           "  --ppc=n                :  "
           "Number of particles per grid cell (default: 2)\n"
           "  --x/y/z=n              :  "
-          "3d grid dimensions (default: 2)\n\n"
+          "3d grid dimensions (default: 2)\n"
+          "  --batch-size=n         :  "
+          "Number of particles written per append call (default: 1)\n"
+          "  --queue-depth=n        :  "
+          "Max number of outstanding async appends, 0 for sync appends "
+          "(default: 0)\n\n"
           "Deltafs VPIC IO benchmark\n",
           prog);
 }
@@ -272,6 +420,8 @@ static pdlfs::VPICbenchOptions ParseOptions(int argc, char** argv) {
   result.ignore_errors = false;
   result.x = result.y = result.z = 2;
   result.ppc = 2;
+  result.batch_size = 1;
+  result.queue_depth = 0;
   result.argv = NULL;
   result.argc = 0;
 
@@ -285,6 +435,8 @@ static pdlfs::VPICbenchOptions ParseOptions(int argc, char** argv) {
     optinfo.push_back({"x", 1, NULL, 'x'});
     optinfo.push_back({"y", 1, NULL, 'y'});
     optinfo.push_back({"z", 1, NULL, 'z'});
+    optinfo.push_back({"batch-size", 1, NULL, 'b'});
+    optinfo.push_back({"queue-depth", 1, NULL, 'q'});
     optinfo.push_back({"help", 0, NULL, 'H'});
     optinfo.push_back({NULL, 0, NULL, 0});
 
@@ -317,6 +469,12 @@ static pdlfs::VPICbenchOptions ParseOptions(int argc, char** argv) {
           case 'z':
             result.z = atoi(optarg);
             break;
+          case 'b':
+            result.batch_size = std::max(1, atoi(optarg));
+            break;
+          case 'q':
+            result.queue_depth = std::max(0, atoi(optarg));
+            break;
           case 'H':
           case 'h':
             Help(argv[0], stdout);
@@ -353,8 +511,10 @@ int main(int argc, char** argv) {
   pdlfs::VPICbenchOptions options = ParseOptions(argc, argv);
   options.rank = rank;
   options.comm_sz = size;
+  const char* const io_type = options.argc >= 2 ? options.argv[1] : "posix";
   pdlfs::VPICbench bench(options);
-  pdlfs::VPICbenchReport report;
+  pdlfs::VPICbenchAggregate aggr;
+  pdlfs::VPICbenchReport& report = aggr.total;
   int num_dumps = options.num_dumps;
   report.errors = 0;
 
@@ -363,9 +523,9 @@ int main(int argc, char** argv) {
       Print("Prepare ... ");
     }
     MPI_Barrier(MPI_COMM_WORLD);
-    report = Merge(bench.Prepare());
+    aggr = Merge(bench.Prepare(), rank, size);
     if (rank == 0) {
-      Print(report);
+      Print(aggr, io_type);
     }
   } else {
     if (rank == 0) {
@@ -380,9 +540,9 @@ int main(int argc, char** argv) {
         Print("Dump ... ");
       }
       MPI_Barrier(MPI_COMM_WORLD);
-      report = Merge(bench.Dump());
+      aggr = Merge(bench.Dump(), rank, size);
       if (rank == 0) {
-        Print(report);
+        Print(aggr, io_type);
       }
     } else {
       if (rank == 0) {
@@ -78,4 +78,96 @@ inline char* Arena::Allocate(size_t bytes) {
   return AllocateFallback(bytes);
 }
 
+// A thread-safe arena. Each thread allocates from a chunk cached in one of
+// a fixed number of shards, so threads rarely contend with each other. A
+// thread is assigned its shard on its first allocation and keeps using it
+// afterwards. New chunks are carved out of a shared backing arena. Memory is
+// only released when the arena is destroyed.
+class ConcurrentArena {
+ public:
+  // Chunks of chunk_size bytes are handed to the shards. Allocations larger
+  // than a quarter of a chunk go directly to the backing arena.
+  explicit ConcurrentArena(size_t chunk_size = 16 << 10);
+  ~ConcurrentArena();
+
+  // Same as Arena::Allocate() but may be called concurrently.
+  char* Allocate(size_t bytes) { return AllocateImpl(bytes, false); }
+
+  // Same as Arena::AllocateAligned() but may be called concurrently.
+  char* AllocateAligned(size_t bytes) { return AllocateImpl(bytes, true); }
+
+  // Returns an estimate of the total memory usage of the arena. May be called
+  // concurrently with allocations.
+  size_t MemoryUsage() const;
+
+  // Return the shard used by the calling thread.
+  static int MyShard();
+  static const int kNumShards = 16;
+
+ private:
+  struct Shard {
+    Shard() : alloc_ptr(NULL), alloc_bytes_remaining(0) {}
+    port::Mutex mu;
+    char* alloc_ptr;
+    size_t alloc_bytes_remaining;
+    // Keep shards in separate cache lines
+    char padding[64];
+  };
+  char* AllocateImpl(size_t bytes, bool aligned);
+  char* AllocateFromBacking(size_t bytes);
+
+  const size_t chunk_size_;
+  Shard shards_[kNumShards];
+  mutable port::Mutex mu_;
+  Arena arena_;  // Backing storage, protected by mu_
+
+  // No copying allowed
+  ConcurrentArena(const ConcurrentArena&);
+  void operator=(const ConcurrentArena&);
+};
+
+// A thread-safe pool of small objects grouped into size classes. Freed
+// objects are kept in per-shard free lists and are handed out again to
+// later allocations of the same size class, preferably from the same
+// thread. Memory of pooled objects is obtained from a ConcurrentArena and
+// is only returned to the system when the pool is destroyed. Allocations
+// larger than kMaxPooledSize bypass the pool and use the system allocator.
+class SizeClassPool {
+ public:
+  SizeClassPool();
+  ~SizeClassPool();
+
+  // Return a block of at least "bytes" bytes with the alignment guarantees
+  // of Arena::AllocateAligned(). The block must be returned with Free().
+  void* Allocate(size_t bytes);
+  // Return a block obtained from Allocate() to the pool.
+  // REQUIRES: p was allocated by this pool or is NULL.
+  static void Free(void* p);
+
+  // Returns an estimate of the total memory usage of the pool.
+  size_t MemoryUsage() const { return arena_.MemoryUsage(); }
+
+  // Return a process-wide pool that is never deleted.
+  static SizeClassPool* Default();
+
+  static const size_t kMaxPooledSize = 4096;
+
+ private:
+  struct Header;
+  struct FreeList;
+  // Size classes are multiples of 16 bytes up to 256 bytes,
+  // and powers of 2 up to kMaxPooledSize afterwards.
+  static const int kNumClasses = 20;
+  static int SizeClass(size_t bytes);
+  static size_t ClassSize(int c);
+  void Release(Header* h);
+
+  FreeList* lists_;  // One for each arena shard
+  ConcurrentArena arena_;
+
+  // No copying allowed
+  SizeClassPool(const SizeClassPool&);
+  void operator=(const SizeClassPool&);
+};
+
 }  // namespace pdlfs
@@ -145,6 +145,11 @@ class AtomicPointer {
     MemoryBarrier();
     rep_ = v;
   }
+  // Store "v" only if the current value is "old_v". Return true on success.
+  // Acts as a full memory barrier.
+  inline bool CompareAndSwap(void* old_v, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, old_v, v);
+  }
 };
 
 // AtomicPointer based on <cstdatomic>
@@ -172,6 +177,11 @@ class AtomicPointer {
   inline void NoBarrier_Store(void* v) {
     rep_.store(v, std::memory_order_relaxed);
   }
+  // Store "v" only if the current value is "old_v". Return true on success.
+  // Acts as a full memory barrier.
+  inline bool CompareAndSwap(void* old_v, void* v) {
+    return rep_.compare_exchange_strong(old_v, v);
+  }
 };
 
 // Atomic pointer based on sparc memory barriers
@@ -208,6 +218,11 @@ class AtomicPointer {
   inline void* NoBarrier_Load() const { return rep_; }
 
   inline void NoBarrier_Store(void* v) { rep_ = v; }
+  // Store "v" only if the current value is "old_v". Return true on success.
+  // Acts as a full memory barrier.
+  inline bool CompareAndSwap(void* old_v, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, old_v, v);
+  }
 };
 
 // Atomic pointer based on ia64 acq/rel
@@ -240,6 +255,11 @@ class AtomicPointer {
   inline void* NoBarrier_Load() const { return rep_; }
 
   inline void NoBarrier_Store(void* v) { rep_ = v; }
+  // Store "v" only if the current value is "old_v". Return true on success.
+  // Acts as a full memory barrier.
+  inline bool CompareAndSwap(void* old_v, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, old_v, v);
+  }
 };
 
 // We have neither MemoryBarrier(), nor <atomic>
@@ -41,6 +41,13 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// Create a new cache with a fixed size capacity that is resistant to large
+// scans. This implementation uses a segmented LRU policy: new entries are
+// admitted on probation and become protected once they are looked up again.
+// Entries that are never looked up after their insertion, such as blocks read
+// once by a full scan, are evicted before protected entries.
+extern Cache* NewScanResistantCache(size_t capacity);
+
 class Cache {
  public:
   Cache() {}
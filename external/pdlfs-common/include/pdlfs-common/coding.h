@@ -112,6 +112,26 @@ inline uint64_t DecodeFixed64(const char* ptr) {
   }
 }
 
+// Load 8 bytes as a big-endian integer so that integer order matches the
+// bytewise order of the bytes.
+inline uint64_t DecodeBigEndian64(const char* ptr) {
+#if defined(__GNUC__)
+  if (port::kLittleEndian) {
+    uint64_t result;
+    memcpy(&result, ptr, sizeof(result));
+    return __builtin_bswap64(result);
+  }
+#endif
+  const unsigned char* const u = reinterpret_cast<const unsigned char*>(ptr);
+  return (static_cast<uint64_t>(u[0]) << 56) |
+         (static_cast<uint64_t>(u[1]) << 48) |
+         (static_cast<uint64_t>(u[2]) << 40) |
+         (static_cast<uint64_t>(u[3]) << 32) |
+         (static_cast<uint64_t>(u[4]) << 24) |
+         (static_cast<uint64_t>(u[5]) << 16) |
+         (static_cast<uint64_t>(u[6]) << 8) | static_cast<uint64_t>(u[7]);
+}
+
 // Internal routine for use by fallback path of GetVarint32Ptr
 extern const char* GetVarint32PtrFallback(const char* p, const char* limit,
                                           uint32_t* value);
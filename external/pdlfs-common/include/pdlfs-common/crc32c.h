@@ -25,8 +25,8 @@ namespace crc32c {
 // Return the crc32c of concat(A, data[0,n-1]) where init_crc is the
 // crc32c of some string A.  Extend() is often used to maintain the
 // crc32c of a stream of data.
-// If hardware acceleration (via SSE4_2) is possible during runtime, crc32c
-// calculation will be dynamically switched to a hardware-assisted
+// If hardware acceleration (via SSE4.2 or ARMv8 CRC) is possible at runtime,
+// crc32c calculation will be dynamically switched to a hardware-assisted
 // implementation. Otherwise, a pure software-based implementation will be used.
 extern uint32_t Extend(uint32_t init_crc, const char* data, size_t n);
 
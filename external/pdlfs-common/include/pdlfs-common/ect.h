@@ -15,12 +15,22 @@
 
 #include "pdlfs-common/slice.h"
 
+#include <string>
+
 namespace pdlfs {
 
 class ECT {
  public:
   static ECT* Default(size_t key_len, size_t n, const Slice* keys);
 
+  // Recreate an index from an encoding produced by EncodeTo(). key_len and n
+  // must match those of the original index. Return NULL if the encoding is
+  // malformed.
+  static ECT* Decode(size_t key_len, size_t n, const Slice& encoding);
+
+  // Append a compact encoding of the index to *dst.
+  virtual void EncodeTo(std::string* dst) const = 0;
+
   // Return the internal memory usage in bits.
   virtual size_t MemUsage() const = 0;
 
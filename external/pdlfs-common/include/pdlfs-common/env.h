@@ -246,6 +246,14 @@ class RandomAccessFile {
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
 
+  // Read up to sizes[0] + ... + sizes[n-1] bytes from the file starting at
+  // "offset" directly into bufs[0..n-1], filling each buffer in turn. Sets
+  // "*result" to the total number of bytes read, which is less than requested
+  // only at the end of the file. The default implementation issues one Read()
+  // per buffer. Safe for concurrent use by multiple threads.
+  virtual Status ReadV(uint64_t offset, char* const* bufs, const size_t* sizes,
+                       size_t n, size_t* result) const;
+
  private:
   // No copying allowed
   RandomAccessFile(const RandomAccessFile&);
@@ -265,6 +273,10 @@ class WritableFile {
   virtual Status Flush() = 0;
   virtual Status Sync() = 0;
 
+  // Append data[0..n-1] as if they were a single contiguous piece of data.
+  // The default implementation issues one Append() per piece.
+  virtual Status AppendV(const Slice* data, size_t n);
+
  private:
   // No copying allowed
   void operator=(const WritableFile&);
@@ -391,6 +403,15 @@ extern uint64_t CurrentMicros();
 extern void SleepForMicroseconds(int micros);
 
 // Background execution service.
+// Queue depth and throughput statistics of a thread pool.
+struct ThreadPoolStats {
+  ThreadPoolStats() : queued(0), queued_urgent(0), completed(0), stolen(0) {}
+  uint64_t queued;         // Tasks waiting to run, including urgent ones
+  uint64_t queued_urgent;  // Tasks waiting in the urgent lane
+  uint64_t completed;      // Tasks run so far
+  uint64_t stolen;  // Tasks taken from the queue of another pool thread
+};
+
 class ThreadPool {
  public:
   ThreadPool() {}
@@ -403,6 +424,13 @@ class ThreadPool {
   static ThreadPool* NewFixed(int num_threads, bool eager_init = false,
                               void* attr = NULL);
 
+  // Instantiate a new thread pool with a fixed number of threads each owning
+  // a private task queue. Idle threads steal tasks from the queues of busy
+  // threads. Tasks scheduled through ScheduleUrgent() run ahead of all tasks
+  // scheduled through Schedule(). Arguments are the same as NewFixed().
+  static ThreadPool* NewWorkStealing(int num_threads, bool eager_init = false,
+                                     void* attr = NULL);
+
   // Arrange to run "(*function)(arg)" once in one of a pool of
   // background threads.
   //
@@ -412,6 +440,15 @@ class ThreadPool {
   // serialized.
   virtual void Schedule(void (*function)(void*), void* arg) = 0;
 
+  // Same as Schedule(), but for latency-sensitive tasks such as foreground
+  // reads. Pools supporting priorities run such tasks ahead of those added
+  // through Schedule(). The default implementation calls Schedule().
+  virtual void ScheduleUrgent(void (*function)(void*), void* arg);
+
+  // Store the current statistics of the pool in *stats. The default
+  // implementation reports all zeros.
+  virtual void GetStats(ThreadPoolStats* stats);
+
   // Return a description of the pool implementation.
   virtual std::string ToDebugString() = 0;
 
@@ -12,6 +12,8 @@
 #pragma once
 
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/lru.h"
+#include "pdlfs-common/port.h"
 
 #include <assert.h>
 #include <string>
@@ -412,4 +414,52 @@ class WholeFileBufferedRandomAccessFile : public RandomAccessFile {
   char* buf_;
 };
 
+// Buffer a random access file in fixed-size segments that are fetched on
+// their first access, instead of pre-fetching all file contents like
+// WholeFileBufferedRandomAccessFile. At most "max_buf_size" worth of segments
+// are kept in memory, evicting the least recently used ones. If "pool" is not
+// NULL, fetching a segment on demand also schedules the fetch of up to
+// "readahead" following segments in the pool. Since segments may be evicted
+// at any time, reads copy data into the caller's scratch buffer.
+class SegmentedBufferedRandomAccessFile : public RandomAccessFile {
+ public:
+  SegmentedBufferedRandomAccessFile(RandomAccessFile* base, uint64_t file_size,
+                                    size_t segment_size, size_t max_buf_size,
+                                    ThreadPool* pool = NULL,
+                                    int readahead = 0);
+
+  // Wait for pending segment fetches before deleting the base file.
+  virtual ~SegmentedBufferedRandomAccessFile();
+
+  // Safe for concurrent use by multiple threads.
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const;
+
+ private:
+  typedef LRUEntry<std::string> Segment;
+  struct Prefetch;
+  static void DoPrefetch(void* arg);
+  // Return a referenced segment in *result, fetching it from the base file if
+  // it is not buffered. Set *fetched to true if the segment was fetched.
+  Status GetSegment(uint64_t i, Segment** result, bool* fetched) const;
+  void ReleaseSegment(Segment* s) const;
+  bool IsBuffered(uint64_t i) const;
+  void MaybeScheduleReadahead(uint64_t i) const;
+
+  RandomAccessFile* const base_;
+  const uint64_t file_size_;
+  const size_t segment_size_;
+  ThreadPool* const pool_;
+  const int readahead_;
+  mutable port::Mutex mu_;
+  mutable port::CondVar cv_;
+  // State below is protected by mu_
+  mutable LRUCache<Segment> segments_;
+  mutable int num_pending_;  // Number of scheduled segment fetches
+
+  // No copying allowed
+  void operator=(const SegmentedBufferedRandomAccessFile&);
+  SegmentedBufferedRandomAccessFile(const SegmentedBufferedRandomAccessFile&);
+};
+
 }  // namespace pdlfs
@@ -141,6 +141,15 @@ class MXDB {
 
   typedef std::vector<std::string> NameList;
   typedef std::vector<Stat> StatList;
+  // Read up to "n" entries from an open directory in a single call. Names
+  // are copied back to back into *arena, which is owned by the caller and
+  // cleared first, and are returned as slices into it so that no string is
+  // allocated per entry. Stats are decoded only if "stats" is not NULL.
+  // Name slices remain valid until *arena is modified. Entries read before an
+  // error are still returned. Return NotFound if no entries remain.
+  template <typename Iter>
+  Status READDIRS(Dir<Iter>* dir, size_t n, StatList* stats,
+                  std::vector<Slice>* names, std::string* arena);
   template <typename Iter, typename KX, typename TX, typename OPT>
   size_t LIST(const DirId& id, StatList* stats, NameList* names, OPT* opt,
               TX* tx, size_t limit);
@@ -310,7 +319,10 @@ MXDB<DX, xslice, xstatus, fmt>::OPENDIR(  ////
   if (tx != NULL) {
     opt->snapshot = tx->snap;
   }
-  xslice prefix = xslice(key_prefix.data(), key_prefix.size());
+  // Keys with hashed suffixes have a fixed size so the full key encoding
+  // includes an all-zero suffix. Only the prefix identifies the directory.
+  Slice prefix_encoding = key_prefix.prefix();
+  xslice prefix = xslice(prefix_encoding.data(), prefix_encoding.size());
   Iter* const iter = dx_->NewIterator(*opt);
   if (iter == NULL) {
     return NULL;
@@ -368,6 +380,76 @@ Status MXDB<DX, xslice, xstatus, fmt>::READDIR(  ////
   return Status::OK();
 }
 
+MXDBTEMDECL(DX, xslice, xstatus, fmt)
+template <typename Iter>
+Status MXDB<DX, xslice, xstatus, fmt>::READDIRS(  ////
+    Dir<Iter>* dir, size_t n, StatList* stats, std::vector<Slice>* names,
+    std::string* arena) {
+  names->clear();
+  arena->clear();
+  if (stats != NULL) stats->clear();
+  if (dir == NULL) return Status::NotFound(Slice());
+  Iter* const iter = dir->iter;
+  // Name ends within the arena. Slices are only formed once all names have
+  // been copied as the arena may be reallocated while growing.
+  std::vector<size_t> ends;
+  ends.reserve(n);
+  Status s;
+  for (; iter->Valid() && ends.size() < n; iter->Next()) {
+    xslice xinput = iter->value();
+    xslice xkey = iter->key();
+
+    Slice input = Slice(xinput.data(), xinput.size());
+    Slice key = Slice(xkey.data(), xkey.size());
+    if (!key.starts_with(dir->key_prefix))  // Hitting the end of directory
+      break;
+    if (stats != NULL) {
+      stats->resize(stats->size() + 1);
+      if (!stats->back().DecodeFrom(&input)) {
+        stats->pop_back();
+        s = Status::Corruption("Cannot parse Stat");
+        break;
+      }
+    } else if (fmt != kNameInKey && !Stat::SkipEncoding(&input)) {
+      s = Status::Corruption("Cannot parse Stat");
+      break;
+    }
+
+    Slice filename;
+
+    if (fmt == kNameInKey) {
+      key.remove_prefix(dir->key_prefix.length());
+      filename = key;
+    } else if (!GetLengthPrefixedSlice(&input, &filename)) {
+      if (stats != NULL) stats->pop_back();
+      s = Status::Corruption("Cannot parse filename");
+      break;
+    }
+
+    arena->append(filename.data(), filename.size());
+    ends.push_back(arena->size());
+    dir->n++;  // +1 entries scanned
+  }
+
+  if (s.ok() && ends.empty()) {
+    xstatus st = iter->status();
+    if (st.ok()) {
+      s = Status::NotFound(Slice());
+    } else {
+      s = XSTATUS(st);
+    }
+  }
+
+  names->reserve(ends.size());
+  size_t start = 0;
+  for (size_t i = 0; i < ends.size(); i++) {
+    names->push_back(Slice(arena->data() + start, ends[i] - start));
+    start = ends[i];
+  }
+
+  return s;
+}
+
 MXDBTEMDECL(DX, xslice, xstatus, fmt)
 template <typename Iter>
 void MXDB<DX, xslice, xstatus, fmt>::CLOSEDIR(  ////
@@ -401,7 +483,11 @@ size_t MXDB<DX, xslice, xstatus, fmt>::LIST(  ////
     Slice key = Slice(xkey.data(), xkey.size());
     if (!key.starts_with(prefix))  // Hitting end of directory
       break;
-    if (!stat.DecodeFrom(&input)) {
+    if (stats != NULL) {
+      if (!stat.DecodeFrom(&input)) {
+        break;  // Error
+      }
+    } else if (fmt != kNameInKey && !Stat::SkipEncoding(&input)) {
       break;  // Error
     }
 
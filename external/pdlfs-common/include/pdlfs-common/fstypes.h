@@ -170,6 +170,9 @@ class Stat {
   // Return true if success, false otherwise.
   bool DecodeFrom(const Slice& encoding);
   bool DecodeFrom(Slice* input);
+  // Advance *input past a Stat encoding without decoding it.
+  // Return true if success, false otherwise.
+  static bool SkipEncoding(Slice* input);
   // Intentionally not initialized for performance.
   Stat() {}
 
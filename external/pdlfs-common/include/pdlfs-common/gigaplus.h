@@ -13,6 +13,7 @@
 #include "pdlfs-common/slice.h"
 
 #include <stdint.h>
+#include <string>
 #include <utility>
 
 // We currently do not support dynamic changes of the total number of metadata
@@ -61,6 +62,7 @@ class DirIndex {
   bool TEST_Reset(const Slice& other);
 
   // Update the index by merging another index of the same directory.
+  // The other index may be given either by Encode() or by EncodeTo().
   bool Update(const Slice& other);
 
   // Update the index by merging another index of the same directory.
@@ -81,6 +83,12 @@ class DirIndex {
   // Return the server responsible for the given file name hash.
   int HashToServer(const Slice& hash) const;
 
+  // Store the server responsible for hashes[i] in servers[i] for each of the
+  // "n" name hashes. Same as calling HashToServer() on each hash, but index
+  // state is loaded once per batch, and large batches resolve partitions
+  // through a table built once instead of walking the bitmap per hash.
+  void HashesToServers(const Slice* hashes, size_t n, int* servers) const;
+
   // Return true iff the bit of a partition is set.
   bool IsSet(int index) const;
 
@@ -111,6 +119,17 @@ class DirIndex {
   // Return the in-memory representation of this index.
   Slice Encode() const;
 
+  // Append a compact encoding of this index to *dst. The bitmap is stored as
+  // the lengths of its alternating runs of set and unset bits, so indices of
+  // directories that have been split across many servers stay small.
+  void EncodeTo(std::string* dst) const;
+
+  // Append a compact encoding of the partitions of this index missing from
+  // "base" to *dst. Merging the result into "base" through Update() makes it
+  // equal to this index.
+  // REQUIRES: both indices are of the same directory.
+  void EncodeDiffTo(const DirIndex& base, std::string* dst) const;
+
   // Return true if the given hash will belong to the given child partition.
   static bool ToBeMigrated(int index, const char* hash);
 
@@ -120,6 +139,10 @@ class DirIndex {
   // Return the hash value of the specified name string.
   static Slice Hash(const Slice& name, char* scratch);
 
+  // Store the 8-byte hash value of names[i] at scratch + 8 * i for each of
+  // the "n" names.
+  static void HashBatch(const Slice* names, size_t n, char* scratch);
+
   // Return the server responsible for a given index.
   static int MapIndexToServer(int index, int zeroth_server, int num_servers);
 
@@ -133,9 +156,12 @@ class DirIndex {
 
  private:
   struct View;
-  static bool ParseDirIndex(const Slice& input, bool checks, View*);
+  static bool ParseDirIndex(const Slice& input, bool checks, View*,
+                            std::string* scratch);
+  static bool ExpandCompact(const Slice& input, std::string* result);
   const DirIndexOptions* options_;
   struct Rep;
+  void EncodeRuns(const Rep* base, std::string* dst) const;
   Rep* rep_;
 
   // No copying allowed
@@ -19,9 +19,14 @@
 #include "pdlfs-common/hash.h"
 #include "pdlfs-common/slice.h"
 
+#include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace pdlfs {
 
@@ -163,11 +168,226 @@ class HashTable {
   }
 };
 
+// An open-addressing alternative to HashTable with the same interface. Entries
+// are kept in a flat array of slots instead of per-bucket linked lists, so a
+// lookup does not chase a pointer per colliding entry. Each slot has a control
+// byte that is either empty, deleted, or holds 7 bits of the entry's hash.
+// Slots are probed in groups of 16: control bytes of a group are compared
+// against the hash bits all at once (using SSE2 when available) so that only
+// slots whose hash bits match are checked further. Entries' next_hash fields
+// are not used. Removed entries leave tombstones behind which are cleared
+// when the table is rehashed. Pointers returned by FindPointer() are
+// invalidated by the next insertion or removal.
+template <typename E>
+class FlatHashTable {
+ public:
+  FlatHashTable()
+      : capacity_(0), elems_(0), tombstones_(0), ctrl_(NULL), slots_(NULL) {
+    Rehash(kGroupSize);
+  }
+
+  ~FlatHashTable() {
+    delete[] ctrl_;
+    delete[] slots_;
+  }
+
+  // Return a pointer to the slot that points to an entry that matches the key
+  // and hash. If there is no such entry, return a pointer to an empty slot
+  // where such an entry would be inserted.
+  E** FindPointer(const Slice& key, uint32_t hash) const {
+    const uint8_t h2 = H2(hash);
+    const uint32_t mask = capacity_ - 1;
+    uint32_t pos = H1(hash) & mask;
+    E** free_slot = NULL;
+    for (uint32_t i = kGroupSize;; i += kGroupSize) {
+      const uint8_t* const g = &ctrl_[pos];
+      for (uint32_t m = Match(g, h2); m != 0; m &= m - 1) {
+        E** const slot = &slots_[(pos + LowestBit(m)) & mask];
+        if ((*slot)->hash == hash && key == (*slot)->key()) {
+          return slot;
+        }
+      }
+      if (free_slot == NULL) {
+        const uint32_t m = MatchFree(g);
+        if (m != 0) {
+          free_slot = &slots_[(pos + LowestBit(m)) & mask];
+        }
+      }
+      if (Match(g, kEmpty) != 0) {
+        return free_slot;  // Not found
+      }
+      pos = (pos + i) & mask;  // Triangular probing visits all groups
+    }
+  }
+
+  // Insert entry to a given slot. If the slot points to an existing entry, the
+  // entry is removed and returned to the caller. Otherwise, NULL is returned.
+  E* Inject(E* e, E** ptr) {
+    E* const old = *ptr;
+    const uint32_t i = static_cast<uint32_t>(ptr - slots_);
+    if (old == NULL && ctrl_[i] == kDeleted) {
+      tombstones_--;
+    }
+    SetCtrl(i, H2(e->hash));
+    *ptr = e;
+    if (old == NULL) {
+      ++elems_;
+      // Keep the load factor, including tombstones, below 7/8
+      if (uint64_t(elems_ + tombstones_) * 8 > uint64_t(capacity_) * 7) {
+        // Only grow the table if it is not mostly tombstones
+        const bool grow = uint64_t(elems_) * 8 > uint64_t(capacity_) * 3;
+        Rehash(grow ? capacity_ * 2 : capacity_);
+      }
+    }
+    return old;
+  }
+
+  // Add a new entry to the hash table. If an entry with the same key and
+  // hash exists, it will be removed and returned to the caller.
+  // Otherwise, NULL is returned.
+  E* Insert(E* e) {
+    E** const ptr = FindPointer(e->key(), e->hash);
+    return Inject(e, ptr);
+  }
+
+  // Remove a specific entry from the table. No effect when the entry is not in
+  // the table. Return the entry if it has been removed. Return NULL otherwise.
+  E* Remove(E* e) {
+    E** const ptr = FindPointer(e->key(), e->hash);
+    if (*ptr == e) {
+      Erase(ptr);
+      return e;
+    }
+    return NULL;
+  }
+
+  // Return the removed entry if one exists, NULL otherwise.
+  E* Remove(const Slice& key, uint32_t hash) {
+    E** const ptr = FindPointer(key, hash);
+    E* const e = *ptr;
+    if (e != NULL) {
+      Erase(ptr);
+    }
+    return e;
+  }
+
+  bool Empty() const { return elems_ == 0; }
+  uint32_t Size() const {  ///
+    return elems_;
+  }
+
+ private:
+  enum { kGroupSize = 16 };
+  static const uint8_t kEmpty = 0x80;
+  static const uint8_t kDeleted = 0xFE;
+
+  // Number of slots. Always a power of 2 and no less than kGroupSize.
+  uint32_t capacity_;
+  uint32_t elems_;  // Total number of elements
+  uint32_t tombstones_;
+  // capacity_ + kGroupSize control bytes. The last group mirrors the first
+  // so that a group starting at any slot can be read without wrapping.
+  uint8_t* ctrl_;
+  E** slots_;
+
+  // No copying allowed
+  void operator=(const FlatHashTable&);
+  FlatHashTable(const FlatHashTable&);
+
+  static uint32_t H1(uint32_t hash) { return (hash >> 7) ^ (hash << 25); }
+  static uint8_t H2(uint32_t hash) { return hash & 0x7F; }
+
+  static uint32_t LowestBit(uint32_t m) {
+#if defined(__GNUC__)
+    return __builtin_ctz(m);
+#else
+    uint32_t n = 0;
+    while ((m & 1) == 0) {
+      m >>= 1;
+      n++;
+    }
+    return n;
+#endif
+  }
+
+  // Return a bitmask of the control bytes of a group equal to c.
+  static uint32_t Match(const uint8_t* g, uint8_t c) {
+#if defined(__SSE2__)
+    const __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(c), group));
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < kGroupSize; i++) {
+      if (g[i] == c) m |= 1u << i;
+    }
+    return m;
+#endif
+  }
+
+  // Return a bitmask of the empty or deleted control bytes of a group.
+  static uint32_t MatchFree(const uint8_t* g) {
+#if defined(__SSE2__)
+    // Only free control bytes have their top bit set
+    const __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g));
+    return _mm_movemask_epi8(group);
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < kGroupSize; i++) {
+      if (g[i] & 0x80) m |= 1u << i;
+    }
+    return m;
+#endif
+  }
+
+  void SetCtrl(uint32_t i, uint8_t c) {
+    ctrl_[i] = c;
+    if (i < kGroupSize) {
+      ctrl_[capacity_ + i] = c;
+    }
+  }
+
+  void Erase(E** ptr) {
+    const uint32_t i = static_cast<uint32_t>(ptr - slots_);
+    *ptr = NULL;
+    SetCtrl(i, kDeleted);
+    tombstones_++;
+    --elems_;
+  }
+
+  void Rehash(uint32_t new_capacity) {
+    uint8_t* const old_ctrl = ctrl_;
+    E** const old_slots = slots_;
+    const uint32_t old_capacity = capacity_;
+    ctrl_ = new uint8_t[new_capacity + kGroupSize];
+    memset(ctrl_, kEmpty, new_capacity + kGroupSize);
+    slots_ = new E*[new_capacity];
+    memset(slots_, 0, sizeof(slots_[0]) * new_capacity);
+    capacity_ = new_capacity;
+    tombstones_ = 0;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+      E* const e = old_slots[i];
+      if (e != NULL) {
+        E** const ptr = FindPointer(e->key(), e->hash);
+        assert(*ptr == NULL);
+        SetCtrl(static_cast<uint32_t>(ptr - slots_), H2(e->hash));
+        *ptr = e;
+        count++;
+      }
+    }
+    assert(elems_ == count);
+    (void)count;
+    delete[] old_ctrl;
+    delete[] old_slots;
+  }
+};
+
 // All values stored in the table are weak referenced and are owned by external
 // entities. Removing values from the table or deleting the table itself will
 // not release the memory of those values. This data structure requires external
-// synchronization when accessed by multiple threads.
-template <typename T = void>
+// synchronization when accessed by multiple threads. Entries are indexed by
+// a HashTable by default, or by a FlatHashTable if specified.
+template <typename T = void, typename Table = HashTable<HashEntry<T> > >
 class HashMap {
  private:
   typedef HashEntry<T> E;
@@ -175,7 +395,7 @@ class HashMap {
   // list_.next is the first entry.
   E list_;
 
-  HashTable<E> table_;
+  Table table_;
 
   void operator=(const HashMap& hashmap);  // No copying allowed
   HashMap(const HashMap&);
@@ -271,7 +491,7 @@ class HashMap {
 };
 
 // This data structure requires external synchronization when accessed by
-// multiple threads.
+// multiple threads. Keys are indexed by a FlatHashTable.
 class HashSet {
  public:
   void Erase(const Slice& key) { map_.Erase(key); }
@@ -285,7 +505,7 @@ class HashSet {
     virtual ~Visitor() {}
   };
   void VisitAll(Visitor* v) const {
-    struct Adaptor : public HashMap<>::Visitor {
+    struct Adaptor : public Map::Visitor {
       HashSet::Visitor* v;
       virtual void visit(const Slice& key, void* value) {
         assert(value == NULL);
@@ -305,7 +525,8 @@ class HashSet {
   void operator=(const HashSet& hashset);
   HashSet(const HashSet&);
 
-  HashMap<> map_;
+  typedef HashMap<void, FlatHashTable<HashEntry<> > > Map;
+  Map map_;
 };
 
 }  // namespace pdlfs
@@ -16,6 +16,8 @@
  */
 #pragma once
 
+#include "pdlfs-common/port.h"
+
 #include <string>
 
 namespace pdlfs {
@@ -31,11 +33,20 @@ class Histogram {
 
   std::string ToString() const;
 
+  double Count() const { return num_; }
   double Median() const;
   double Percentile(double p) const;
   double Average() const;
   double StandardDeviation() const;
 
+  enum { kNumBuckets = 154 };
+  // Number of doubles in the flat form of a histogram. Histograms are
+  // flattened to be shipped to other processes, such as through MPI, and
+  // merged there.
+  enum { kFlatLength = kNumBuckets + 5 };
+  void EncodeTo(double* dst) const;
+  void DecodeFrom(const double* src);
+
  private:
   double min_;
   double max_;
@@ -43,9 +54,38 @@ class Histogram {
   double sum_;
   double sum_squares_;
 
-  enum { kNumBuckets = 154 };
   static const double kBucketLimit[kNumBuckets];
   double buckets_[kNumBuckets];
 };
 
+// A histogram that may be updated by many threads concurrently. Samples are
+// spread across a fixed set of stripes by thread id so that concurrent
+// threads seldom contend on the same lock or cache line. Stripes are merged
+// when the histogram is read.
+class ConcurrentHistogram {
+ public:
+  ConcurrentHistogram();
+  ~ConcurrentHistogram() {}
+
+  void Clear();
+  void Add(double value);
+
+  // Store a merged view of all samples in *result.
+  void Snapshot(Histogram* result) const;
+  std::string ToString() const;
+
+ private:
+  enum { kNumStripes = 16 };
+  struct Stripe {
+    port::Mutex mu;
+    Histogram hist;
+    char pad[64];  // Keep adjacent stripes off each other's cache lines
+  };
+  mutable Stripe stripes_[kNumStripes];
+
+  // No copying allowed
+  void operator=(const ConcurrentHistogram&);
+  ConcurrentHistogram(const ConcurrentHistogram&);
+};
+
 }  // namespace pdlfs
@@ -28,26 +28,38 @@ class Iterator;
 
 class Block {
  public:
-  // Initialize the block with the specified contents.
-  explicit Block(const BlockContents& contents);
+  // Initialize the block with the specified contents. Set "hash_index" if
+  // the block was built with BlockBuilder::EnableHashIndex().
+  explicit Block(const BlockContents& contents, bool hash_index = false);
 
   ~Block();
 
   size_t size() const { return size_; }
   Iterator* NewIterator(const Comparator* comparator);
 
+  // Return an iterator for point lookups of internal keys. Seek(target) may
+  // leave the iterator invalid, or positioned at a key with a different user
+  // key, when the user key of target is not in the block. Uses the block's
+  // hash index if there is one, and binary search otherwise.
+  Iterator* NewPointIterator(const Comparator* comparator);
+
  private:
   uint32_t NumRestarts() const;
+  Iterator* NewIterator(const Comparator* comparator, bool point_lookup);
 
   const char* data_;
   size_t size_;
+  size_t limit_;             // End of the restart array and its length
   uint32_t restart_offset_;  // Offset in data_ of restart array
-  bool owned_;               // Block owns data_[]
+  const char* buckets_;      // Hash index buckets, or NULL
+  uint32_t num_buckets_;
+  bool owned_;  // Block owns data_[]
 
   // No copying allowed
   void operator=(const Block&);
   Block(const Block&);
 
+  template <typename Cmp>
   class Iter;
 };
 
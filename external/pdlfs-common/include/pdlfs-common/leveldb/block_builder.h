@@ -110,6 +110,15 @@ class BlockBuilder : public AbstractBlockBuilder {
   // Set a new restart interval.
   void ChangeRestartInterval(int interval) { restart_interval_ = interval; }
 
+  // Append a hash index mapping user keys to restart points to every block
+  // built from now on. Keys must be internal keys. Blocks built this way can
+  // only be read by a Block told to expect the index.
+  // REQUIRES: no entries have been added since the last Reset().
+  void EnableHashIndex() { hash_index_ = true; }
+
+  // Hash function used by block hash indexes.
+  static uint32_t HashKey(const Slice& user_key);
+
   // Reset the contents as if the BlockBuilder was just constructed.
   void Reset();
 
@@ -129,6 +138,12 @@ class BlockBuilder : public AbstractBlockBuilder {
   int counter_;                     // Number of entries emitted since restart
   std::string last_key_;
 
+  // Hashes of the user keys added so far, paired with the index of the
+  // restart point each key falls under. Empty if hash_index_ is false.
+  bool hash_index_;
+  std::vector<std::pair<uint32_t, uint32_t> > hashes_;
+  void AppendHashIndex();
+
   // No copying allowed
   void operator=(const BlockBuilder&);
   BlockBuilder(const BlockBuilder&);
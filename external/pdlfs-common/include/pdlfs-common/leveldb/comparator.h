@@ -16,11 +16,13 @@
  */
 #pragma once
 
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/slice.h"
+
 #include <string>
 
 namespace pdlfs {
 
-class Slice;
 class Comparator;
 
 // Return a builtin comparator that uses lexicographic byte-wise
@@ -69,4 +71,34 @@ class Comparator {
   virtual const char* Name() const = 0;
 };
 
+// Compile-time comparators for loops that compare keys many times, such as
+// block seeks and merges. Code templated on one of them has its comparisons
+// inlined instead of going through a virtual Comparator::Compare() per key.
+
+// Same order as BytewiseComparator(). Keys of 8 or 16 bytes, typically fixed
+// width integers, are compared a word at a time.
+struct BytewiseCompare {
+  int operator()(const Slice& a, const Slice& b) const {
+    if (a.size() == b.size() && (a.size() == 8 || a.size() == 16)) {
+      uint64_t x = DecodeBigEndian64(a.data());
+      uint64_t y = DecodeBigEndian64(b.data());
+      if (x == y && a.size() == 16) {
+        x = DecodeBigEndian64(a.data() + 8);
+        y = DecodeBigEndian64(b.data() + 8);
+      }
+      return x < y ? -1 : (x > y ? +1 : 0);
+    }
+    return a.compare(b);
+  }
+};
+
+// Any other comparator.
+struct VirtualCompare {
+  explicit VirtualCompare(const Comparator* cmp) : cmp(cmp) {}
+  int operator()(const Slice& a, const Slice& b) const {
+    return cmp->Compare(a, b);
+  }
+  const Comparator* cmp;
+};
+
 }  // namespace pdlfs
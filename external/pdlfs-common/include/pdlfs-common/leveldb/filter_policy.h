@@ -76,4 +76,26 @@ class FilterPolicy {
   virtual const char* Name() const = 0;
 };
 
+// A database can be configured with a PrefixExtractor to have each table
+// store a bloom filter over the key prefixes it contains.  Iterators
+// created with a ReadOptions::prefix skip tables whose filter shows that
+// they have no keys with that prefix.  All keys that share a prefix must be
+// adjacent in the order of the comparator, as is the case for the
+// BytewiseComparator.
+class PrefixExtractor {
+ public:
+  virtual ~PrefixExtractor();
+
+  // Return true iff "key" has a prefix to add to prefix filters.
+  virtual bool InDomain(const Slice& key) const = 0;
+
+  // Return the prefix of "key", which must be a leading part of "key".
+  // REQUIRES: InDomain(key) is true
+  virtual Slice Transform(const Slice& key) const = 0;
+
+  // Return the name of this extractor.  Prefix filters written with an
+  // extractor of a different name are ignored.
+  virtual const char* Name() const = 0;
+};
+
 }  // namespace pdlfs
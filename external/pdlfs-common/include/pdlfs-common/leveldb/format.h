@@ -58,7 +58,7 @@ class BlockHandle {
 // end of every table file.
 class Footer {
  public:
-  Footer() {}
+  Footer() : partitioned_index_(false) {}
 
   // The block handle for the metaindex block of the table
   const BlockHandle& metaindex_handle() const { return metaindex_handle_; }
@@ -68,6 +68,10 @@ class Footer {
   const BlockHandle& index_handle() const { return index_handle_; }
   void set_index_handle(const BlockHandle& h) { index_handle_ = h; }
 
+  // True iff the index block is a top-level index over index partitions
+  bool partitioned_index() const { return partitioned_index_; }
+  void set_partitioned_index(bool p) { partitioned_index_ = p; }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(Slice* input);
 
@@ -79,6 +83,7 @@ class Footer {
  private:
   BlockHandle metaindex_handle_;
   BlockHandle index_handle_;
+  bool partitioned_index_;
 };
 
 // kTableMagicNumber was picked by running
@@ -86,9 +91,21 @@ class Footer {
 // and taking the leading 64 bits.
 static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
 
+// Tables with a partitioned index use a different magic number so they
+// are rejected, instead of misread, by code that does not understand them.
+static const uint64_t kPartitionedIndexTableMagicNumber = 0xdb4775248b80fb58ull;
+
 // 1-byte type + 32-bit crc
 static const size_t kBlockTrailerSize = 5;
 
+// Each bucket of a data block hash index holds the index of the restart point
+// under which all keys hashed to the bucket are found, or one of the markers
+// below. Blocks with more restart points than kMaxHashIndexRestarts are left
+// without an index.
+static const uint8_t kHashIndexNoEntry = 255;
+static const uint8_t kHashIndexCollision = 254;
+static const uint32_t kMaxHashIndexRestarts = 253;
+
 struct BlockContents {
   Slice data;           // Actual contents of data
   bool cachable;        // True iff data can be cached
@@ -119,6 +119,27 @@ class InternalKeyComparator : public Comparator {
   int Compare(const InternalKey& a, const InternalKey& b) const;
 };
 
+// Compile-time counterpart of an InternalKeyComparator over
+// BytewiseComparator(). See BytewiseCompare.
+struct InternalBytewiseCompare {
+  int operator()(const Slice& akey, const Slice& bkey) const {
+    int r = BytewiseCompare()(ExtractUserKey(akey), ExtractUserKey(bkey));
+    if (r == 0) {
+      const uint64_t anum = DecodeFixed64(akey.data() + akey.size() - 8);
+      const uint64_t bnum = DecodeFixed64(bkey.data() + bkey.size() - 8);
+      if (anum > bnum) {
+        r = -1;
+      } else if (anum < bnum) {
+        r = +1;
+      }
+    }
+    return r;
+  }
+};
+
+// Return true iff "cmp" is an InternalKeyComparator over BytewiseComparator().
+extern bool IsInternalBytewiseComparator(const Comparator* cmp);
+
 // Filter policy wrapper that converts from internal keys to user keys
 class InternalFilterPolicy : public FilterPolicy {
  private:
@@ -131,6 +152,19 @@ class InternalFilterPolicy : public FilterPolicy {
   virtual bool KeyMayMatch(const Slice& key, const Slice& filter) const;
 };
 
+// Prefix extractor wrapper that converts from internal keys to user keys
+class InternalPrefixExtractor : public PrefixExtractor {
+ private:
+  const PrefixExtractor* const user_extractor_;
+
+ public:
+  explicit InternalPrefixExtractor(const PrefixExtractor* e)
+      : user_extractor_(e) {}
+  virtual bool InDomain(const Slice& key) const;
+  virtual Slice Transform(const Slice& key) const;
+  virtual const char* Name() const;
+};
+
 // Modules in this directory should keep internal keys wrapped inside
 // the following class instead of plain strings so that we do not
 // incorrectly use string comparisons instead of an InternalKeyComparator.
@@ -28,6 +28,8 @@ class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class PrefixExtractor;
+class RateLimiter;
 class Snapshot;
 class ThreadPool;
 
@@ -80,6 +82,35 @@ struct DBOptions {
   // Default: NULL
   ThreadPool* compaction_pool;
 
+  // Thread pool for running sub-compactions.  A compaction job may be split
+  // into up to max_subcompactions key ranges that are compacted in parallel
+  // and installed together as a single version edit.  Ranges not picked up
+  // by the pool are processed by the compaction thread itself, so the pool
+  // may be shared with other dbs or be the same as compaction_pool.
+  // If NULL, compaction jobs are not split.
+  // Default: NULL
+  ThreadPool* subcompaction_pool;
+
+  // Max number of key ranges a compaction job may be split into.
+  // Ignored if subcompaction_pool is NULL.
+  // Default: 1
+  int max_subcompactions;
+
+  // Thread pool for replaying write-ahead logs at db open.  Logs are read
+  // into memtables in parallel and the memtables are then written to
+  // Level-0 tables in parallel.  Memtables of all logs are kept in memory
+  // until their tables are written.  Work not picked up by the pool is
+  // done by the thread opening the db.
+  // If NULL, logs are replayed one after another.
+  // Default: NULL
+  ThreadPool* recovery_pool;
+
+  // If not NULL, writes of table files are charged to this rate limiter,
+  // which may be shared with other dbs and directories. Memtable flushes are
+  // charged at high priority and compactions at low priority.
+  // Default: NULL
+  RateLimiter* rate_limiter;
+
   // -------------------
   // Parameters that affect performance
 
@@ -105,6 +136,17 @@ struct DBOptions {
   // Default: NULL
   Cache* table_cache;
 
+  // If true, open tables are cached under the name of the db instead of under
+  // the db instance. Instances opened on the same db image with the same
+  // table_cache, such as readonly instances for reading different snapshots,
+  // then share their open tables and the blocks cached for those tables.
+  //
+  // REQUIRES: instances sharing tables are opened with the same name, env,
+  // comparator, filter policy, and block cache, and all of these outlive
+  // table_cache.
+  // Default: false
+  bool share_tables;
+
   // Control over blocks (user data is stored in a set of blocks, and
   // a block is the unit of reading from disk).
 
@@ -113,6 +155,12 @@ struct DBOptions {
   // Default: NULL
   Cache* block_cache;
 
+  // If true and block_cache is NULL, the internal cache uses a scan-resistant
+  // eviction policy (see NewScanResistantCache()) so blocks read by large
+  // scans do not flush blocks that are read repeatedly.
+  // Default: false
+  bool scan_resistant_block_cache;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -136,6 +184,28 @@ struct DBOptions {
   // Default: 1
   int index_block_restart_interval;
 
+  // If non-zero, the index of a table is split into partitions of about
+  // this many bytes, each paired with a filter covering only the data
+  // blocks it indexes.  Opening a table then only reads a small top-level
+  // index.  Partitions are loaded on first use and stay pinned in memory
+  // with the table, so once warm a point lookup costs at most one data
+  // block read regardless of block cache pressure.  Tables written with
+  // this option cannot be read by older versions of the code.
+  //
+  // Default: 0 (a single index block and filter block per table)
+  size_t index_partition_size;
+
+  // If true, each data block is written with a small hash index mapping the
+  // user keys in the block to their restart points.  Point lookups then go
+  // straight to the right restart point instead of binary searching the
+  // restart array, and skip blocks not having the key without parsing any
+  // entry.  Costs about one byte per key.  Tables written without this
+  // option remain readable.  Tables written with it cannot be read by older
+  // versions of the code.
+  //
+  // Default: false
+  bool data_block_hash_index;
+
   // Compress blocks using the specified compression algorithm.  This
   // parameter can be changed dynamically.
   //
@@ -159,6 +229,14 @@ struct DBOptions {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // If non-NULL, each table also stores a bloom filter over the prefixes of
+  // its keys as returned by this extractor, allowing iterators restricted
+  // to a prefix (see ReadOptions::prefix) to skip tables that do not have
+  // any key with that prefix.
+  //
+  // Default: NULL
+  const PrefixExtractor* prefix_extractor;
+
   // -------------------
   // Dangerous zone - parameters for experts
 
@@ -194,6 +272,23 @@ struct DBOptions {
   // Default: false
   bool disable_write_ahead_log;
 
+  // If true, writers whose updates have been committed to the write-ahead log
+  // insert them into the memtable in parallel instead of having a single
+  // group leader insert everything.  The next write group may be logged
+  // while the previous one is still being applied.
+  // Ignored when no_memtable is true.
+  // Default: false
+  bool concurrent_memtable_inserts;
+
+  // If true, sync writes append their updates to an in-memory log buffer and
+  // the next write group may be logged while the previous ones are still
+  // being synced. A single log sync then commits all groups logged before it
+  // started, cutting the latency of concurrent sync writes.
+  // Ignored when no_memtable, disable_write_ahead_log, or
+  // concurrent_memtable_inserts is true.
+  // Default: false
+  bool pipelined_wal_sync;
+
   // If true, no background compaction will be performed except for
   // those triggered by MemTable dumps.
   // All Tables will stay in Level-0 forever.
@@ -284,6 +379,15 @@ struct ReadOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // If non-empty, iterators only return keys starting with "prefix" and
+  // become invalid once they move past them.  If the db has a
+  // prefix_extractor, "prefix" should be what it returns for the keys
+  // sought, and tables whose prefix filter excludes "prefix" are skipped.
+  // The data referenced by "prefix" must remain live while any iterator
+  // created with these options is in use.  Ignored by point lookups.
+  // Default: empty
+  Slice prefix;
+
   ReadOptions();
 };
 
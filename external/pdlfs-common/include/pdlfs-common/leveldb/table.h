@@ -81,6 +81,20 @@ class Table {
   explicit Table(Rep* rep) { rep_ = rep; }
   static Iterator* BlockReader(void* table, const ReadOptions& options,
                                const Slice& block_handle);
+  static Iterator* BlockReader(void* table, const ReadOptions& options,
+                               const Slice& block_handle, bool point_lookup);
+
+  // Return an iterator over the index entries of all data blocks.
+  Iterator* NewIndexIterator(const ReadOptions& options) const;
+
+  // Index partitions are loaded on first use and then pinned with the
+  // table until it is deleted.
+  struct IndexPartition;
+  static Iterator* IndexPartitionReader(void* table,
+                                        const ReadOptions& options,
+                                        const Slice& partition_handles);
+  Status LoadIndexPartition(const Slice& partition_handles,
+                            IndexPartition** result);
 
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
@@ -93,6 +107,7 @@ class Table {
   void ReadMeta(const Footer& footer);
   void ReadProperties(const Slice& props_handle_value);
   void ReadFilter(const Slice& filter_handle_value);
+  void ReadPrefixFilter(const Slice& filter_handle_value);
 
   // No copying allowed
   void operator=(const Table&);
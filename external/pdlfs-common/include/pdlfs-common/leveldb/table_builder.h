@@ -102,6 +102,7 @@ class TableBuilder {
   bool ok() const { return status().ok(); }
 
   void AddBlock(BlockBuilder* builder, BlockHandle* handle);
+  void FlushIndexPartition();
 
   struct Rep;
   Rep* rep_;
@@ -17,8 +17,11 @@
 #pragma once
 
 #include "pdlfs-common/log_format.h"
+#include "pdlfs-common/port.h"
 #include "pdlfs-common/status.h"
 
+#include <string>
+
 #include <stddef.h>
 #include <stdint.h>
 
@@ -40,20 +43,46 @@ class Writer {
   // "*dest" must remain live while this Writer is in use.
   explicit Writer(WritableFile* dest, uint64_t dest_length);
 
+  // Create a pipelined writer that will append data to "*dest".
+  // Records added to a pipelined writer are framed into an in-memory
+  // buffer and only reach "*dest" on the next Flush() or Sync(). While
+  // one thread is flushing and syncing a buffer, other threads may
+  // continue adding records into the next one. All records added before
+  // a Sync() starts are durable once that Sync() returns.
+  // "*dest" must have initial length "dest_length".
+  // "*dest" must remain live while this Writer is in use.
+  Writer(WritableFile* dest, uint64_t dest_length, bool pipelined);
+
+  // Flush any buffered records before returning.
   ~Writer();
 
   // Return the position of the writing cursor.
   uint64_t CurrentOffset() const { return offset_; }
 
+  // Return true iff records are buffered until the next Flush() or Sync().
+  bool IsPipelined() const { return pipelined_; }
+
   Status AddRecord(const Slice& slice);
 
-  // Call Sync() on the destination file.
+  // Write all records added so far to the destination file. A no-op for
+  // writers that are not pipelined.
+  Status Flush();
+
+  // Flush all records added so far and call Sync() on the destination file.
   Status Sync();
 
  private:
   WritableFile* dest_;
+  const bool pipelined_;
   int block_offset_;  // Offset in the block currently being written
-  int offset_;        // Current offset in file
+  uint64_t offset_;   // Current offset in file
+
+  // State below is only used by pipelined writers.
+  port::Mutex mu_;     // Protects buf_, the framing state, and offset_
+  port::Mutex io_mu_;  // Serializes writes to dest_, always acquired first
+  std::string buf_;    // Records not yet written to dest_
+  Status FlushBuffer();
+  Status Write(const Slice& data);
 
   // crc32c values for all supported record types.  These are
   // pre-computed to reduce the overhead of computing the crc of the
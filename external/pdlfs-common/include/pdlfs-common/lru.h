@@ -21,6 +21,8 @@
 #include "pdlfs-common/slice.h"
 
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 // The following code implements an LRU cache of KV pairs. KV pairs are placed
 // in a reference-counted handle. A user-supplied delete function is invoked
@@ -123,7 +125,10 @@ struct LRUEntry {
 //
 // To keep *overall* capacity consumption below a certain limit, the client code
 // must take action to achieve that rather than completely relying on the cache.
-template <typename E>
+//
+// Entries are indexed by a HashTable<E> by default. FlatHashTable<E> may be
+// used instead for cheaper lookups in large, frequently accessed caches.
+template <typename E, typename Table = HashTable<E> >
 class LRUCache {
  private:
   // Max cache size.
@@ -148,7 +153,7 @@ class LRUCache {
 
   // In addition to one of the two lists above, each entry currently "in"
   // the cache is put here for fast lookups and presence checks.
-  HashTable<E> table_;
+  Table table_;
 
   // No copying allowed
   void operator=(const LRUCache&);
@@ -367,6 +372,23 @@ class LRUCache {
     return (table_.Empty());
   }
 
+  // Append the keys of up to "n" entries in the cache to *keys, hottest first.
+  // Entries in use by clients come first, followed by the rest from the most
+  // recently used to the least. This operation does not change the LRU order
+  // of any entry in the cache.
+  void GetKeys(std::vector<std::string>* keys, size_t n) const {
+    for (const E* e = in_use_.next; e != &in_use_ && n != 0; e = e->next) {
+      if (e->in_cache) {
+        keys->push_back(e->key().ToString());
+        n--;
+      }
+    }
+    for (const E* e = lru_.prev; e != &lru_ && n != 0; e = e->prev) {
+      keys->push_back(e->key().ToString());
+      n--;
+    }
+  }
+
   // Return True if key is present in the cache. This operation does not change
   // the LRU order of the entry in the cache.
   bool Exists(const Slice& key, uint32_t hash) const {
@@ -395,6 +417,257 @@ class LRUCache {
   }
 };
 
+// Entries of a segmented LRU cache. Same as LRUEntry except for an extra flag
+// recording the segment of the cache that currently holds the entry.
+template <typename T = void>
+struct SLRUEntry {
+  T* value;
+  void (*deleter)(const Slice&, T* value);
+  SLRUEntry<T>* next_hash;
+  SLRUEntry<T>* next;
+  SLRUEntry<T>* prev;
+  size_t charge;
+  size_t key_length;
+  uint32_t refs;
+  uint32_t hash;  // Hash of key(); used for fast partitioning and comparisons
+  bool in_cache;  // True iff entry has a reference from the cache
+  bool in_protected;  // True iff entry is in the protected segment
+  char key_data[1];   // Beginning of the key
+
+  Slice key() const { return Slice(key_data, key_length); }
+};
+
+// A scan-resistant variant of LRUCache using a segmented LRU policy. Entries
+// are first admitted into a "probation" segment. An entry found by a Lookup()
+// while in the probation segment is promoted to a "protected" segment, which
+// may take up to a certain fraction of the cache's capacity. When the
+// protected segment grows beyond that, its least recently used idle entries
+// are demoted back to the probation segment. Eviction always takes from the
+// probation segment first. Entries accessed only once, such as those read by
+// a large sequential scan, therefore never displace entries that have been
+// accessed repeatedly. Like LRUCache, this cache requires external
+// synchronization, and entries in use by clients are never evicted.
+template <typename E>
+class SLRUCache {
+ private:
+  size_t capacity_;
+  size_t protected_capacity_;
+  size_t total_usage_;
+  size_t usage_;
+  size_t protected_usage_;  // Usage of entries in the protected segment
+
+  // Dummy head of the "in-use" list. Same as LRUCache::in_use_.
+  E in_use_;
+  // Dummy heads of the idle lists of the two segments. Entries are ordered
+  // from the oldest (list.next) to the newest (list.prev).
+  E probation_;
+  E protected_;
+
+  HashTable<E> table_;
+
+  // No copying allowed
+  void operator=(const SLRUCache&);
+  SLRUCache(const SLRUCache&);
+
+  E* IdleList(E* const e) {
+    return e->in_protected ? &protected_ : &probation_;
+  }
+
+  void Unref(E* const e) {
+    assert(e->refs > 0);
+    e->refs--;
+    if (e->refs == 0) {
+      List_Remove(e);
+      total_usage_ -= e->charge;
+      assert(!e->in_cache);
+      (*e->deleter)(e->key(), e->value);
+      free(e);
+    } else if (e->in_cache && e->refs == 1) {
+      // No longer in use; move to the idle list of its segment
+      List_Remove(e);
+      List_Append(IdleList(e), e);
+    }
+  }
+
+  void List_Remove(E* const e) {
+    e->next->prev = e->prev;
+    e->prev->next = e->next;
+  }
+
+  void List_Append(E* list, E* const e) {
+    e->next = list;
+    e->prev = list->prev;
+    e->prev->next = e;
+    e->next->prev = e;
+  }
+
+  // REQUIRES: *e has been removed from table_.
+  void Remove(E* const e) {
+    assert(e && e->in_cache);
+    e->in_cache = false;
+    usage_ -= e->charge;
+    if (e->in_protected) {
+      e->in_protected = false;
+      protected_usage_ -= e->charge;
+    }
+    Unref(e);
+  }
+
+  // Demote idle protected entries until the protected segment fits
+  // its share of the capacity.
+  void MaybeDemote() {
+    while (protected_usage_ > protected_capacity_ &&
+           protected_.next != &protected_) {
+      E* const e = protected_.next;
+      assert(e->refs == 1 && e->in_protected);
+      List_Remove(e);
+      e->in_protected = false;
+      protected_usage_ -= e->charge;
+      List_Append(&probation_, e);  // Newest of the probation segment
+    }
+  }
+
+  void Evict(E* const e) {
+    E* const victim = table_.Remove(e->key(), e->hash);
+    assert(e == victim);
+    Remove(victim);
+  }
+
+ public:
+  // Setting capacity to 0 disables caching effectively. Up to
+  // protected_ratio of the capacity is reserved for protected entries.
+  explicit SLRUCache(size_t capacity = 0, double protected_ratio = 0.8)
+      : total_usage_(0), usage_(0), protected_usage_(0) {
+    in_use_.next = &in_use_;
+    in_use_.prev = &in_use_;
+    probation_.next = &probation_;
+    probation_.prev = &probation_;
+    protected_.next = &protected_;
+    protected_.prev = &protected_;
+    SetCapacity(capacity, protected_ratio);
+  }
+
+  ~SLRUCache() {
+    assert(in_use_.next == &in_use_);  // Error if caller has unreleased handle
+    E* const lists[2] = {&probation_, &protected_};
+    for (int i = 0; i < 2; i++) {
+      for (E* e = lists[i]->next; e != lists[i];) {
+        E* const next = e->next;
+        assert(e->refs == 1);
+        assert(e->in_cache);
+        e->in_cache = false;
+        Unref(e);
+        e = next;
+      }
+    }
+  }
+
+  size_t total_usage() const { return total_usage_; }
+  size_t usage() const { return usage_; }
+  size_t protected_usage() const { return protected_usage_; }
+  size_t capacity() const { return capacity_; }
+
+  void SetCapacity(size_t c, double protected_ratio = 0.8) {
+    capacity_ = c;
+    protected_capacity_ = static_cast<size_t>(c * protected_ratio);
+  }
+
+  // Add a KV entry into the probation segment of the cache. Same as
+  // LRUCache::Insert() otherwise.
+  template <typename T>
+  E* Insert(const Slice& key, uint32_t hash, T* value, size_t charge,
+            void (*deleter)(const Slice& key, T* value)) {
+    E* const e = static_cast<E*>(malloc(sizeof(E) - 1 + key.size()));
+    e->value = value;
+    e->deleter = deleter;
+    e->charge = charge;
+    e->key_length = key.size();
+    e->hash = hash;
+    e->in_cache = false;
+    e->in_protected = false;
+    e->refs = 1;  // This is for the handle to be returned to the client
+    memcpy(e->key_data, key.data(), key.size());
+    List_Append(&in_use_, e);
+    total_usage_ += charge;
+    if (!capacity_) {
+      return e;
+    }
+    e->refs++;  // This is for the cache itself
+    e->in_cache = true;
+    usage_ += charge;
+    E* const old = table_.Insert(e);
+    if (old) {
+      Remove(old);
+    }
+    // Make room for the incoming entry, probation first
+    while (usage_ > capacity_) {
+      if (probation_.next != &probation_) {
+        Evict(probation_.next);
+      } else if (protected_.next != &protected_) {
+        Evict(protected_.next);
+      } else {
+        break;
+      }
+    }
+    if (usage_ > capacity_) {
+      Evict(e);
+    }
+
+    assert(usage_ <= capacity_);
+    return e;
+  }
+
+  // Retrieve a key from the cache incrementing its reference count. An entry
+  // in the probation segment is promoted to the protected segment. Return
+  // NULL if the specified key is not present in the cache.
+  E* Lookup(const Slice& key, uint32_t hash) {
+    E* const e = *table_.FindPointer(key, hash);
+    if (e != NULL) {
+      if (e->refs == 1) {  // Idle, move to the in-use list
+        List_Remove(e);
+        List_Append(&in_use_, e);
+      }
+      e->refs++;
+      if (!e->in_protected) {
+        e->in_protected = true;
+        protected_usage_ += e->charge;
+        MaybeDemote();
+      }
+    }
+    return e;
+  }
+
+  // Remove an external reference on a given entry.
+  void Release(E* e) { Unref(e); }
+
+  // Kick out a key from the cache. Same as LRUCache::Erase().
+  E* Erase(const Slice& key, uint32_t hash) {
+    E* const e = table_.Remove(key, hash);
+    if (e != NULL) {
+      Remove(e);
+    }
+    return e;
+  }
+
+  // Evict all idle entries from the cache.
+  void Prune() {
+    while (probation_.next != &probation_) {
+      Evict(probation_.next);
+    }
+    while (protected_.next != &protected_) {
+      Evict(protected_.next);
+    }
+  }
+
+  bool Empty() const { return table_.Empty(); }
+
+  // Return True if key is present in the cache. This operation does not
+  // change the segment or the LRU order of the entry.
+  bool Exists(const Slice& key, uint32_t hash) const {
+    return *table_.FindPointer(key, hash) != NULL;
+  }
+};
+
 template <typename T>
 void LRUValueDeleter(const Slice& key, T* value) {
   delete value;  // T is not of void type
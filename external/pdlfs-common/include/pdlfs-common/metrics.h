@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/status.h"
+
+#include <map>
+#include <string>
+#if __cplusplus >= 201103L
+#include <atomic>
+#endif
+
+namespace pdlfs {
+
+class ConcurrentHistogram;
+
+// A monotonically increasing counter that may be bumped by many threads
+// concurrently.
+class MetricsCounter {
+ public:
+  MetricsCounter() : value_(0) {}
+
+#if __cplusplus >= 201103L
+  void Add(uint64_t n = 1) { value_ += n; }
+  uint64_t Value() const { return value_; }
+#else
+  void Add(uint64_t n = 1) {
+    MutexLock ml(&mu_);
+    value_ += n;
+  }
+  uint64_t Value() const {
+    MutexLock ml(&mu_);
+    return value_;
+  }
+#endif
+
+ private:
+#if __cplusplus >= 201103L
+  std::atomic<uint64_t> value_;
+#else
+  mutable port::Mutex mu_;
+  uint64_t value_;
+#endif
+  // No copying allowed
+  void operator=(const MetricsCounter&);
+  MetricsCounter(const MetricsCounter&);
+};
+
+// A set of named metrics. Names are hierarchical with components separated by
+// dots, such as "plfsdir.write.num_keys". Three types of metrics are
+// supported: counters owned by the registry, gauges whose values are read
+// through a callback each time the registry is read, and latency histograms
+// owned by the caller. All metrics may be read in a single call and exported
+// as JSON or as Prometheus text. Implementation is thread-safe.
+class MetricsRegistry {
+ public:
+  MetricsRegistry();
+  ~MetricsRegistry();
+
+  enum Format { kJson, kPrometheus };
+
+  // Return the counter of the given name, creating it if it does not exist.
+  // The returned counter remains valid until it is removed from the registry.
+  MetricsCounter* GetCounter(const std::string& name);
+
+  // Register a gauge whose value is obtained through "(*probe)(arg)".
+  // Replace any existing metric of the same name.
+  // REQUIRES: "arg" remains valid until the gauge is removed.
+  typedef uint64_t (*Probe)(void* arg);
+  void AddGauge(const std::string& name, Probe probe, void* arg);
+
+  // Register a histogram. Replace any existing metric of the same name.
+  // REQUIRES: *hist remains alive until it is removed.
+  void AddHistogram(const std::string& name, ConcurrentHistogram* hist);
+
+  // Remove all metrics whose names are either equal to prefix or start with
+  // prefix followed by a dot.
+  void Remove(const std::string& prefix);
+
+  // Store the current value of a named counter or gauge in *value.
+  // Return false if no such counter or gauge exists.
+  bool GetValue(const std::string& name, uint64_t* value) const;
+
+  // Return the current values of all metrics in the specified format.
+  std::string Dump(Format fmt) const;
+
+ private:
+  struct Metric;
+  typedef std::map<std::string, Metric*> MetricMap;
+  mutable port::Mutex mu_;
+  MetricMap metrics_;
+
+  void DumpJson(std::string* dst) const;
+  void DumpPrometheus(std::string* dst) const;
+
+  // No copying allowed
+  void operator=(const MetricsRegistry&);
+  MetricsRegistry(const MetricsRegistry&);
+};
+
+// Periodically write the contents of a metrics registry to a file in the
+// background. Each dump replaces the previous contents of the file.
+class MetricsDumper {
+ public:
+  // REQUIRES: *registry and *env remain alive until the dumper is deleted.
+  MetricsDumper(const MetricsRegistry* registry, Env* env,
+                const std::string& fname, MetricsRegistry::Format fmt,
+                uint64_t interval_micros);
+  // Stop the background thread after a final dump.
+  ~MetricsDumper();
+
+  void Start();
+
+  // Write the metrics out immediately.
+  Status DumpNow();
+
+ private:
+  static void BGWork(void* arg);
+  void BGLoop();
+
+  const MetricsRegistry* const registry_;
+  Env* const env_;
+  const std::string fname_;
+  const MetricsRegistry::Format fmt_;
+  const uint64_t interval_micros_;
+  port::Mutex mu_;
+  port::CondVar cv_;
+  bool started_;
+  bool shutting_down_;
+  bool bg_running_;
+
+  // No copying allowed
+  void operator=(const MetricsDumper&);
+  MetricsDumper(const MetricsDumper&);
+};
+
+}  // namespace pdlfs
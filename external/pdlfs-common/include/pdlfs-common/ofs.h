@@ -94,6 +94,11 @@ struct OfsOptions {
   // Sync log when unmounting a directory.
   // Default: false
   bool sync_log_on_close;
+  // Max number of file sizes cached in memory. Cached sizes are invalidated
+  // by local mutations. Sizes of files currently open for writing are never
+  // cached. Set to 0 to disable caching.
+  // Default: 4096
+  size_t size_cache_size;
   // Logger for ofs internal/error information.
   // Default: NULL
   Logger* info_log;
@@ -138,6 +143,13 @@ class Ofs {
   // Return the size of the named file.
   Status GetFileSize(const char* fname, uint64_t* size);
 
+  // Retrieve all files within a mounted file set along with their sizes.
+  // Sizes not found in cache are fetched from the osd in a single batch.
+  // Return OK on success, and a non-OK status on errors.
+  Status GetChildrenWithSizes(const char* dirname,
+                              std::vector<std::string>* names,
+                              std::vector<uint64_t>* sizes);
+
   // Read contents of the named file into *data in a single I/O operation.
   Status ReadFileToString(const char* fname, std::string* data);
 
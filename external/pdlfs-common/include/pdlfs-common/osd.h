@@ -79,6 +79,12 @@ class Osd {
   // Store the size of a named object in *obj_size.
   virtual Status Size(const char* name, uint64_t* obj_size) = 0;
 
+  // Store the sizes of n named objects in sizes[] and the outcome of each
+  // lookup in statuses[]. Implementations may overlap the lookups to amortize
+  // round trips. The default implementation calls Size() one object at a time.
+  virtual void BatchSize(size_t n, const char* const* names, uint64_t* sizes,
+                         Status* statuses);
+
   // Delete the named object.
   virtual Status Delete(const char* name) = 0;
 
@@ -61,6 +61,12 @@
 #ifdef PDLFS_SNAPPY
 #include <snappy.h>
 #endif
+#ifdef PDLFS_ZSTD
+#include <zstd.h>
+#endif
+#ifdef PDLFS_LZ4
+#include <lz4.h>
+#endif
 #include "pdlfs-common/atomic_pointer.h"  // Platform-specific atomic pointer
 
 #include <limits.h>
@@ -185,6 +191,103 @@ inline bool Snappy_Uncompress(const char* input, size_t length, char* output) {
 #endif
 }
 
+inline bool Zstd_Compress(const char* input, size_t length,
+                          ::std::string* output) {
+#ifdef PDLFS_ZSTD
+  output->resize(ZSTD_compressBound(length));
+  size_t outlen = ZSTD_compress(&(*output)[0], output->size(), input, length,
+                                3 /* default level */);
+  if (ZSTD_isError(outlen)) {
+    return false;
+  }
+  output->resize(outlen);
+  return true;
+#endif
+
+  return false;
+}
+
+inline bool Zstd_GetUncompressedLength(const char* input, size_t length,
+                                       size_t* result) {
+#ifdef PDLFS_ZSTD
+  // Frames written by ZSTD_compress() always carry their content size
+  unsigned long long n = ZSTD_getFrameContentSize(input, length);
+  if (n == ZSTD_CONTENTSIZE_ERROR || n == ZSTD_CONTENTSIZE_UNKNOWN) {
+    return false;
+  }
+  *result = static_cast<size_t>(n);
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline bool Zstd_Uncompress(const char* input, size_t length, char* output,
+                            size_t output_length) {
+#ifdef PDLFS_ZSTD
+  size_t n = ZSTD_decompress(output, output_length, input, length);
+  return !ZSTD_isError(n) && n == output_length;
+#else
+  return false;
+#endif
+}
+
+// LZ4 raw blocks do not record their uncompressed length. We prepend it to
+// the compressed output as a 4-byte little-endian integer.
+inline bool Lz4_Compress(const char* input, size_t length,
+                         ::std::string* output) {
+#ifdef PDLFS_LZ4
+  if (length > static_cast<size_t>(LZ4_MAX_INPUT_SIZE)) {
+    return false;
+  }
+  const int n = static_cast<int>(length);
+  output->resize(4 + LZ4_compressBound(n));
+  char* const p = &(*output)[0];
+  p[0] = static_cast<char>(n & 0xff);
+  p[1] = static_cast<char>((n >> 8) & 0xff);
+  p[2] = static_cast<char>((n >> 16) & 0xff);
+  p[3] = static_cast<char>((n >> 24) & 0xff);
+  int outlen = LZ4_compress_default(input, p + 4, n, LZ4_compressBound(n));
+  if (outlen <= 0) {
+    return false;
+  }
+  output->resize(4 + outlen);
+  return true;
+#endif
+
+  return false;
+}
+
+inline bool Lz4_GetUncompressedLength(const char* input, size_t length,
+                                      size_t* result) {
+#ifdef PDLFS_LZ4
+  if (length < 4) {
+    return false;
+  }
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(input);
+  *result = static_cast<size_t>(p[0]) | (static_cast<size_t>(p[1]) << 8) |
+            (static_cast<size_t>(p[2]) << 16) |
+            (static_cast<size_t>(p[3]) << 24);
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline bool Lz4_Uncompress(const char* input, size_t length, char* output,
+                           size_t output_length) {
+#ifdef PDLFS_LZ4
+  if (length < 4) {
+    return false;
+  }
+  int n = LZ4_decompress_safe(input + 4, output, static_cast<int>(length - 4),
+                              static_cast<int>(output_length));
+  return n >= 0 && static_cast<size_t>(n) == output_length;
+#else
+  return false;
+#endif
+}
+
 inline bool GetHeapProfile(void (*)(void*, const char*, int), void*) {
   return false;
 }
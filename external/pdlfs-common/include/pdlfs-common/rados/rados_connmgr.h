@@ -34,6 +34,12 @@ struct RadosConnOptions {
   // Timeouts (in seconds) excised when communicating with ceph osd.
   // Default: -1
   int osd_op_timeout;
+
+  // Reuse a connection already opened through the same connection manager
+  // to the same cluster with the same user, conf file, and options instead
+  // of opening a new one. Set to false to always open a new connection.
+  // Default: true
+  bool share_conn;
 };
 
 // Options for constructing a RadosConnMgr.
@@ -42,6 +48,11 @@ struct RadosConnMgrOptions {
   // Logger object for information.
   // Default: NULL
   Logger* info_log;
+
+  // Max number of idle ioctxs kept for each pool of each connection. Object
+  // writers take ioctxs from this cache instead of creating new ones.
+  // Default: 16
+  int max_idle_ioctxs;
 };
 
 // Options for creating a rados db env wrapper.
@@ -86,6 +97,20 @@ struct RadosOptions {
   // Disable async i/o. All write operations are done synchronously.
   // Default: false
   bool force_syncio;
+  // Max number of async i/o operations that may be outstanding for each object
+  // being written or read. Writers block when the window is full. Large
+  // objects are read as 1MB chunks fetched in parallel up to this depth.
+  // Default: 8
+  int aio_depth;
+  // Stripe each newly written object across this many rados objects in
+  // round-robin units of stripe_unit bytes so that a single large file, such
+  // as a plfsio data log, is served by many placement groups and osds in
+  // parallel. Striped objects are always read correctly regardless of this
+  // setting. Set to 1 to disable striping.
+  // Default: 1
+  int stripe_count;
+  // Default: 4MB
+  uint64_t stripe_unit;
 };
 
 // The primary interface an external user uses to obtain rados env objects.
@@ -97,9 +122,16 @@ class RadosConnMgr {
   explicit RadosConnMgr(const RadosConnMgrOptions& options);
   ~RadosConnMgr();
 
+  // Return a process-wide connection manager created with default options.
+  // Envs and osd instances opened through it share connections and ioctxs.
+  // The result belongs to the library and must not be deleted.
+  static RadosConnMgr* Default();
+
   // Open a rados connection. Return OK on success, or a non-OK status on
   // errors. The returned rados connection instance shall be released through
-  // the connection manager when it is no longer needed.
+  // the connection manager when it is no longer needed. If options.share_conn
+  // is true, an open connection with the same configuration is returned with
+  // an extra reference instead of opening a new one.
   //
   // REQUIRES: user_name must be specified if ceph auth (cephx) is enabled; not
   // sure about cluster_name (it can be NULL or even be randomly set sometimes)
@@ -119,7 +151,8 @@ class RadosConnMgr {
 
   // Create a rados osd instance backed by an open rados connection. Return OK
   // on success, or a non-OK status on errors. The returned osd instance shall
-  // be deleted when it is no longer needed.
+  // be deleted when it is no longer needed. All osd instances opened on the
+  // same connection and pool share a cache of ioctxs.
   Status OpenOsd(RadosConn* conn, const char* pool_name,
                  const RadosOptions& options, Osd** osd);
 
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/port.h"
+
+#include <deque>
+
+namespace pdlfs {
+
+// Limit the total rate of writes issued by a set of writers sharing the same
+// storage, such as multiple directories and db compactions in one process.
+// Writers obtain bytes from a token bucket that is refilled once every refill
+// period and block when the bucket is empty. Bytes refilled are granted to
+// blocked high priority writers before low priority ones, except that low
+// priority writers are served first once every few refills so that they are
+// never starved. Implementation is thread-safe.
+class RateLimiter {
+ public:
+  enum Priority { kLow = 0, kHigh = 1, kNumPriorities = 2 };
+
+  // REQUIRES: bytes_per_sec and refill_period_micros are not 0.
+  explicit RateLimiter(uint64_t bytes_per_sec,
+                       uint64_t refill_period_micros = 100000);
+  // REQUIRES: No writer is blocked.
+  ~RateLimiter();
+
+  // Change the rate limit. Takes effect on the next refill.
+  void SetBytesPerSecond(uint64_t bytes_per_sec);
+  uint64_t GetBytesPerSecond() const;
+
+  // Block until "n" bytes may be written. Requests for more bytes than a
+  // single refill adds are served in pieces.
+  void Request(size_t n, Priority pri);
+
+  // Total number of bytes requested.
+  uint64_t TotalBytes(Priority pri) const;
+  // Total number of requests made, and those that had to block.
+  uint64_t TotalRequests(Priority pri) const;
+  uint64_t TotalThrottledRequests(Priority pri) const;
+  // Total time writers spent blocked.
+  uint64_t TotalThrottledMicros(Priority pri) const;
+
+ private:
+  struct Waiter;
+  void Refill(uint64_t now);
+
+  const uint64_t refill_period_micros_;
+  mutable port::Mutex mu_;
+  // State below is protected by mu_
+  uint64_t bytes_per_sec_;
+  uint64_t refill_bytes_;  // Bucket size, as well as bytes per refill
+  uint64_t available_;     // Bytes in the bucket
+  uint64_t next_refill_;   // Time of the next refill
+  uint64_t num_refills_;
+  bool leader_;  // True if a blocked writer is waiting for the next refill
+  std::deque<Waiter*> queues_[kNumPriorities];
+  uint64_t total_bytes_[kNumPriorities];
+  uint64_t total_requests_[kNumPriorities];
+  uint64_t total_throttled_requests_[kNumPriorities];
+  uint64_t total_throttled_micros_[kNumPriorities];
+
+  // No copying allowed
+  void operator=(const RateLimiter&);
+  RateLimiter(const RateLimiter&);
+};
+
+// A WritableFile wrapper implementation that obtains bytes from a rate limiter
+// before appending them to *base. *base is deleted when the wrapper is
+// deleted. Implementation is not thread safe. External synchronization is
+// needed for use by multiple threads.
+class RateLimitedWritableFile : public WritableFile {
+ public:
+  // REQUIRES: *limiter must remain alive during the lifetime of this object.
+  RateLimitedWritableFile(WritableFile* base, RateLimiter* limiter,
+                          RateLimiter::Priority pri)
+      : base_(base), limiter_(limiter), pri_(pri) {}
+  virtual ~RateLimitedWritableFile() { delete base_; }
+
+  virtual Status Append(const Slice& data) {
+    limiter_->Request(data.size(), pri_);
+    return base_->Append(data);
+  }
+
+  virtual Status AppendV(const Slice* data, size_t n) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+      bytes += data[i].size();
+    }
+    limiter_->Request(bytes, pri_);
+    return base_->AppendV(data, n);
+  }
+
+  virtual Status Flush() { return base_->Flush(); }
+  virtual Status Sync() { return base_->Sync(); }
+  virtual Status Close() { return base_->Close(); }
+
+ private:
+  // No copying allowed
+  void operator=(const RateLimitedWritableFile&);
+  RateLimitedWritableFile(const RateLimitedWritableFile&);
+
+  WritableFile* const base_;
+  RateLimiter* const limiter_;
+  const RateLimiter::Priority pri_;
+};
+
+}  // namespace pdlfs
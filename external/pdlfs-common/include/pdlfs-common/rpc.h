@@ -25,6 +25,7 @@
  * them.
  */
 namespace pdlfs {
+class ConcurrentHistogram;
 #if __cplusplus >= 201103
 #define RPCNOEXCEPT noexcept
 #else
@@ -77,11 +78,33 @@ struct RPCOptions {
   // Not needed for clients.
   rpc::If* fs;
 
+  // If not NULL, the time in microseconds spent by the server callback on each
+  // incoming message is recorded here. Not needed for clients.
+  ConcurrentHistogram* latency_hist;  // Default: NULL
+
   // Options specific to the Mercury rpc engine
 
   // Max number of server addrs that may be cached locally
   size_t addr_cache_size;  //  Default: 128
 
+  // Message contents larger than this many bytes are moved through bulk
+  // (RDMA) transfers instead of being copied inline into rpc payloads. A large
+  // reply is written straight into the caller's out.extra_buf if the caller has
+  // reserved enough room there before the call, and is sent inline otherwise.
+  size_t bulk_threshold;  // Default: 3072
+
+  // Number of Mercury contexts. Each context is driven by its own progress
+  // thread and outgoing calls are hashed onto contexts (and onto the same
+  // context ids at the server). Values above 1 require a transport with
+  // multiple endpoint support (such as ofi) and must match between clients
+  // and servers. num_rpc_threads is raised to at least this number.
+  int num_contexts;  // Default: 1
+
+  // If true, progress threads poll their contexts without ever blocking for
+  // lower latency at the cost of keeping cores busy. Otherwise, they block in
+  // the rpc framework when idle.
+  bool busy_poll;  // Default: false
+
   // Options specific to the socket rpc engine
 
   // Max unexpected message size in bytes for UDP communication.
@@ -100,6 +123,26 @@ struct RPCOptions {
   // Per-socket UDP server-side sender buffer size.
   // Default: -1
   int udp_srv_sndbuf;
+
+  // Max number of datagrams each UDP server thread receives with a single
+  // recvmmsg() call. Replies to the calls handled inline by that thread are
+  // then sent with a single sendmmsg() call. Set to 1 to receive and send one
+  // datagram at a time. Ignored on platforms without recvmmsg().
+  // Default: 16
+  int udp_srv_batchsz;
+
+  // If true, each UDP server thread binds its own socket to the server's
+  // port through SO_REUSEPORT so that the kernel shards incoming datagrams
+  // across threads instead of having all threads contend on one socket.
+  // Default: false
+  bool udp_srv_reuseport;
+
+  // Max number of persistent connections each TCP client stub keeps to its
+  // server. Concurrent calls through a stub are spread over these
+  // connections, and each connection may carry any number of outstanding
+  // calls.
+  // Default: 4
+  int tcp_cli_conns;
 };
 
 // Each RPC* is a reference to an RPC instance. This instance either acts as a
@@ -168,7 +211,12 @@ class RPCServer {
   Status Start();
   Status Stop();
 
-  void AddChannel(const std::string& uri, int workers);
+  // If hist is not NULL, the latency of each incoming call is recorded in it.
+  // If fs is not NULL, calls arriving at the channel are served by it instead
+  // of the server's default callback, so that several channels may each
+  // serve a different callback with their own workers.
+  void AddChannel(const std::string& uri, int workers,
+                  ConcurrentHistogram* hist = NULL, rpc::If* fs = NULL);
   RPCServer(rpc::If* fs, Env* env = NULL) : fs_(fs), env_(env) {}
   ~RPCServer();
 
@@ -16,6 +16,11 @@
  */
 
 #include "pdlfs-common/arena.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <algorithm>
 
 namespace pdlfs {
 
@@ -77,4 +82,176 @@ char* Arena::AllocateNewBlock(size_t block_bytes) {
   return result;
 }
 
+ConcurrentArena::ConcurrentArena(size_t chunk_size)
+    : chunk_size_(std::max<size_t>(chunk_size, 64)) {}
+
+ConcurrentArena::~ConcurrentArena() {}
+
+static port::OnceType shard_once = PDLFS_ONCE_INIT;
+static pthread_key_t shard_key;
+static port::Mutex* shard_mu = NULL;
+static int next_shard = 0;
+
+static void InitShardKey() {
+  pthread_key_create(&shard_key, NULL);
+  shard_mu = new port::Mutex;
+}
+
+// Threads are assigned shards in a round-robin manner on their first call.
+// The assignment is stored as a thread-specific value and is shared by all
+// arenas so each thread consistently uses the same shard of each arena.
+int ConcurrentArena::MyShard() {
+  port::InitOnce(&shard_once, InitShardKey);
+  void* const v = pthread_getspecific(shard_key);
+  if (v != NULL) {
+    return static_cast<int>(reinterpret_cast<intptr_t>(v) - 1);
+  }
+  int shard;
+  {
+    MutexLock ml(shard_mu);
+    shard = next_shard;
+    next_shard = (next_shard + 1) % kNumShards;
+  }
+  pthread_setspecific(shard_key, reinterpret_cast<void*>(intptr_t(shard) + 1));
+  return shard;
+}
+
+char* ConcurrentArena::AllocateFromBacking(size_t bytes) {
+  MutexLock ml(&mu_);
+  return arena_.AllocateAligned(bytes);
+}
+
+char* ConcurrentArena::AllocateImpl(size_t bytes, bool aligned) {
+  assert(bytes > 0);
+  if (bytes > chunk_size_ / 4) {
+    // Allocate large objects separately to avoid wasting too much space
+    // in leftover bytes of the shard's chunk
+    return AllocateFromBacking(bytes);
+  }
+  Shard* const s = &shards_[MyShard()];
+  MutexLock ml(&s->mu);
+  size_t slop = 0;
+  if (aligned) {
+    const size_t align = (sizeof(void*) > 8) ? sizeof(void*) : 8;
+    size_t mod = reinterpret_cast<uintptr_t>(s->alloc_ptr) & (align - 1);
+    slop = (mod == 0 ? 0 : align - mod);
+  }
+  if (bytes + slop > s->alloc_bytes_remaining) {
+    // We waste the remaining space in the current chunk.
+    // New chunks are always aligned.
+    s->alloc_ptr = AllocateFromBacking(chunk_size_);
+    s->alloc_bytes_remaining = chunk_size_;
+    slop = 0;
+  }
+  char* const result = s->alloc_ptr + slop;
+  s->alloc_ptr += bytes + slop;
+  s->alloc_bytes_remaining -= bytes + slop;
+  return result;
+}
+
+size_t ConcurrentArena::MemoryUsage() const {
+  MutexLock ml(&mu_);
+  return arena_.MemoryUsage();
+}
+
+// Each pooled block is preceded by a header identifying its pool and size
+// class. The first word of a free block links it to the next free block of
+// the same size class.
+struct SizeClassPool::Header {
+  SizeClassPool* pool;
+  size_t size_class;  // kNumClasses if not pooled
+};
+
+struct SizeClassPool::FreeList {
+  FreeList() {
+    for (int i = 0; i < kNumClasses; i++) {
+      heads[i] = NULL;
+    }
+  }
+  port::Mutex mu;
+  Header* heads[kNumClasses];
+  // Keep lists in separate cache lines
+  char padding[64];
+};
+
+SizeClassPool::SizeClassPool()
+    : lists_(new FreeList[ConcurrentArena::kNumShards]) {}
+
+SizeClassPool::~SizeClassPool() {
+  delete[] lists_;  // Pooled memory is released by arena_
+}
+
+int SizeClassPool::SizeClass(size_t bytes) {
+  if (bytes <= 256) {
+    return static_cast<int>((std::max<size_t>(bytes, 1) + 15) / 16) - 1;
+  }
+  int c = 16;
+  size_t size = 512;
+  while (size < bytes) {
+    size <<= 1;
+    c++;
+  }
+  return c;
+}
+
+size_t SizeClassPool::ClassSize(int c) {
+  return c < 16 ? size_t(c + 1) * 16 : size_t(512) << (c - 16);
+}
+
+void* SizeClassPool::Allocate(size_t bytes) {
+  Header* h;
+  if (bytes > kMaxPooledSize) {
+    h = static_cast<Header*>(malloc(sizeof(Header) + bytes));
+    h->pool = this;
+    h->size_class = kNumClasses;
+    return h + 1;
+  }
+  const int c = SizeClass(bytes);
+  assert(c < kNumClasses);
+  FreeList* const l = &lists_[ConcurrentArena::MyShard()];
+  {
+    MutexLock ml(&l->mu);
+    h = l->heads[c];
+    if (h != NULL) {
+      l->heads[c] = *reinterpret_cast<Header**>(h + 1);
+      return h + 1;
+    }
+  }
+  h = reinterpret_cast<Header*>(
+      arena_.AllocateAligned(sizeof(Header) + ClassSize(c)));
+  h->pool = this;
+  h->size_class = c;
+  return h + 1;
+}
+
+void SizeClassPool::Free(void* p) {
+  if (p != NULL) {
+    Header* const h = static_cast<Header*>(p) - 1;
+    if (h->size_class == kNumClasses) {
+      free(h);
+    } else {
+      h->pool->Release(h);
+    }
+  }
+}
+
+// Blocks are returned to the free list of the calling thread's shard
+// regardless of the shard they were allocated from.
+void SizeClassPool::Release(Header* h) {
+  FreeList* const l = &lists_[ConcurrentArena::MyShard()];
+  MutexLock ml(&l->mu);
+  *reinterpret_cast<Header**>(h + 1) = l->heads[h->size_class];
+  l->heads[h->size_class] = h;
+}
+
+static port::OnceType pool_once = PDLFS_ONCE_INIT;
+static SizeClassPool* default_pool = NULL;
+
+static void InitDefaultPool() { default_pool = new SizeClassPool; }
+
+SizeClassPool* SizeClassPool::Default() {
+  port::InitOnce(&pool_once, InitDefaultPool);
+  return default_pool;
+}
+
 }  // namespace pdlfs
@@ -15,9 +15,13 @@
  * found at https://github.com/google/leveldb.
  */
 #include "pdlfs-common/arena.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/random.h"
 #include "pdlfs-common/testharness.h"
 
+#include <string.h>
+
 namespace pdlfs {
 
 class ArenaTest {};
@@ -73,6 +77,103 @@ TEST(ArenaTest, Simple) {
   }
 }
 
+struct ConcurrentState {
+  ConcurrentState() : cv(&mu), num_running(0), num_errors(0) {}
+  ConcurrentArena arena;
+  SizeClassPool pool;
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_running;
+  int num_errors;
+};
+
+static void ConcurrentAllocations(void* arg) {
+  ConcurrentState* const state = reinterpret_cast<ConcurrentState*>(arg);
+  int seed;
+  {
+    MutexLock ml(&state->mu);
+    seed = state->num_running;
+  }
+  Random rnd(301 + seed);
+  std::vector<std::pair<size_t, char*> > allocated;
+  std::vector<std::pair<size_t, char*> > pooled;
+  int errors = 0;
+  for (int i = 0; i < 10000; i++) {
+    const size_t s = 1 + (rnd.OneIn(100) ? rnd.Uniform(6000) : rnd.Uniform(64));
+    char* r = rnd.OneIn(2) ? state->arena.AllocateAligned(s)
+                           : state->arena.Allocate(s);
+    memset(r, seed, s);
+    allocated.push_back(std::make_pair(s, r));
+    r = static_cast<char*>(state->pool.Allocate(s));
+    memset(r, seed, s);
+    pooled.push_back(std::make_pair(s, r));
+    if (rnd.OneIn(2)) {  // Return a random block to the pool
+      const size_t k = rnd.Uniform(static_cast<int>(pooled.size()));
+      SizeClassPool::Free(pooled[k].second);
+      pooled[k] = pooled.back();
+      pooled.pop_back();
+    }
+  }
+  allocated.insert(allocated.end(), pooled.begin(), pooled.end());
+  for (size_t i = 0; i < allocated.size(); i++) {
+    for (size_t b = 0; b < allocated[i].first; b++) {
+      if (allocated[i].second[b] != char(seed)) {
+        errors++;
+        break;
+      }
+    }
+  }
+  for (size_t i = 0; i < pooled.size(); i++) {
+    SizeClassPool::Free(pooled[i].second);
+  }
+  MutexLock ml(&state->mu);
+  state->num_errors += errors;
+  state->num_running--;
+  state->cv.SignalAll();
+}
+
+TEST(ArenaTest, Concurrent) {
+  ConcurrentState state;
+  ThreadPool* const pool = ThreadPool::NewFixed(4, true);
+  for (int i = 0; i < 8; i++) {
+    MutexLock ml(&state.mu);
+    state.num_running++;
+    pool->Schedule(ConcurrentAllocations, &state);
+  }
+  {
+    MutexLock ml(&state.mu);
+    while (state.num_running != 0) {
+      state.cv.Wait();
+    }
+  }
+  delete pool;
+  ASSERT_EQ(state.num_errors, 0);
+  ASSERT_GT(state.arena.MemoryUsage(), size_t(0));
+}
+
+TEST(ArenaTest, SizeClassPoolReuse) {
+  SizeClassPool pool;
+  void* const p = pool.Allocate(100);
+  SizeClassPool::Free(p);
+  // Blocks of the same size class are reused
+  ASSERT_EQ(pool.Allocate(112), p);
+  void* const q = pool.Allocate(100);
+  ASSERT_NE(q, p);
+  const size_t usage = pool.MemoryUsage();
+  for (int i = 0; i < 1000; i++) {
+    SizeClassPool::Free(q);
+    ASSERT_EQ(pool.Allocate(97), q);
+  }
+  ASSERT_EQ(pool.MemoryUsage(), usage);
+  SizeClassPool::Free(p);
+  SizeClassPool::Free(q);
+  // Large blocks bypass the pool
+  void* const big = pool.Allocate(SizeClassPool::kMaxPooledSize + 1);
+  memset(big, 0, SizeClassPool::kMaxPooledSize + 1);
+  SizeClassPool::Free(big);
+  ASSERT_EQ(pool.MemoryUsage(), usage);
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -67,7 +67,10 @@ namespace pdlfs {
 
 Cache::~Cache() {}
 
-class ShardedLRUCache : public Cache {
+// A cache statically partitioned into 16 shards, each protected by a separate
+// mutex. C is the type of each shard, such as LRUCache<E> or SLRUCache<E>.
+template <typename C, typename E>
+class ShardedCache : public Cache {
  private:
   port::Mutex id_mu_;
   uint64_t id_;  // The last allocated id number
@@ -81,19 +84,18 @@ class ShardedLRUCache : public Cache {
   enum { kNumShardBits = 4 };
   enum { kNumShards = 1 << kNumShardBits };
 
-  typedef LRUEntry<> E;
-  LRUCache<E> sh_[kNumShards];
+  C sh_[kNumShards];
   port::Mutex mu_[kNumShards];
 
  public:
-  explicit ShardedLRUCache(size_t capacity) : id_(0) {
+  explicit ShardedCache(size_t capacity) : id_(0) {
     const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
     for (int s = 0; s < kNumShards; s++) {
       sh_[s].SetCapacity(per_shard);
     }
   }
 
-  virtual ~ShardedLRUCache() {}
+  virtual ~ShardedCache() {}
 
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) {
@@ -138,7 +140,11 @@ class ShardedLRUCache : public Cache {
 };
 
 Cache* NewLRUCache(size_t capacity) {
-  return new ShardedLRUCache(capacity);  // Statically partitioned
+  return new ShardedCache<LRUCache<LRUEntry<> >, LRUEntry<> >(capacity);
+}
+
+Cache* NewScanResistantCache(size_t capacity) {
+  return new ShardedCache<SLRUCache<SLRUEntry<> >, SLRUEntry<> >(capacity);
 }
 
 }  // namespace pdlfs
@@ -179,6 +179,59 @@ TEST(CacheTest, HeavyEntries) {
   ASSERT_LE(cached_weight, kCacheSize + kCacheSize / 10);
 }
 
+TEST(CacheTest, ScanResistance) {
+  for (int r = 0; r < 2; r++) {
+    const bool scan_resistant = (r != 0);
+    delete cache_;
+    cache_ = scan_resistant ? NewScanResistantCache(kCacheSize)
+                            : NewLRUCache(kCacheSize);
+    // Hot entries are looked up repeatedly
+    for (int i = 0; i < 50; i++) {
+      Insert(i, 1000 + i);
+      ASSERT_EQ(1000 + i, Lookup(i));
+    }
+    // A large scan inserts entries that are never looked up again
+    for (int i = 0; i < 5 * kCacheSize; i++) {
+      Insert(10000 + i, i);
+    }
+    int hits = 0;
+    for (int i = 0; i < 50; i++) {
+      if (Lookup(i) == 1000 + i) {
+        hits++;
+      }
+    }
+    if (scan_resistant) {
+      ASSERT_EQ(hits, 50);
+    } else {
+      ASSERT_EQ(hits, 0);
+    }
+  }
+}
+
+TEST(CacheTest, ScanResistantEviction) {
+  delete cache_;
+  cache_ = NewScanResistantCache(kCacheSize);
+  // Without lookups the cache is plain LRU
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(i, 1000 + i);
+  }
+  ASSERT_EQ(-1, Lookup(0));
+  ASSERT_EQ(1000 + 2 * kCacheSize - 1, Lookup(2 * kCacheSize - 1));
+  // Entries looked up too many to all be protected are still bounded
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(i, 1000 + i);
+    Lookup(i);
+  }
+  int hits = 0;
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    if (Lookup(i) >= 0) {
+      hits++;
+    }
+  }
+  ASSERT_LE(hits, kCacheSize + kCacheSize / 10);
+  ASSERT_GT(hits, kCacheSize / 2);
+}
+
 TEST(CacheTest, NewId) {
   uint64_t a = cache_->NewId();
   uint64_t b = cache_->NewId();
@@ -14,8 +14,8 @@
 namespace pdlfs {
 namespace crc32c {
 
-// If hardware acceleration (via SSE4_2) is possible during runtime, crc32c
-// calculation will be dynamically switched to a hardware-assisted
+// If hardware acceleration (via SSE4.2 or ARMv8 CRC) is possible at runtime,
+// crc32c calculation will be dynamically switched to a hardware-assisted
 // implementation. Otherwise, a pure software-based implementation will be used.
 uint32_t Extend(uint32_t crc, const char* data, size_t n) {
   static const int hw = CanAccelerateCrc32c();
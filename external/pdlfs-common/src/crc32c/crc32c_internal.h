@@ -25,11 +25,11 @@ inline uint32_t ValueSW(const char* data, size_t n) {
   return ExtendSW(0, data, n);
 }
 
-// Return 0 if SSE4.2 instructions are not available.
+// Return 0 if SSE4.2 or ARMv8 crc32 instructions are not available.
 extern int CanAccelerateCrc32c();
 
-// A faster crc32c implementation with optimizations that use special Intel
-// SSE4.2 hardware instructions if they are available at runtime.
+// A faster crc32c implementation with optimizations that use special
+// SSE4.2 or ARMv8 crc32 instructions if they are available at runtime.
 extern uint32_t ExtendHW(uint32_t init_crc, const char* data, size_t n);
 
 // Return the crc32c of data[0,n-1].
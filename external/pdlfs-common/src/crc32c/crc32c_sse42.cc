@@ -47,15 +47,21 @@
 #include "crc32c_internal.h"
 
 #include <stdint.h>
+#include <string.h>
 #include "pdlfs-common/pdlfs_platform.h"
-#ifdef PDLFS_PLATFORM_POSIX
+#if defined(PDLFS_PLATFORM_POSIX) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+#define CRC32C_HW 1
 #include <pthread.h>
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
 #endif
 
 namespace pdlfs {
 namespace crc32c {
 
-#ifdef PDLFS_PLATFORM_POSIX
+#ifdef CRC32C_HW
 /* CRC-32C (iSCSI) polynomial in reversed bit order. */
 #define POLY 0x82f63b78
 
@@ -147,11 +153,54 @@ static inline uint32_t crc32c_shift(uint32_t zeros[][256], uint32_t crc) {
    both be powers of two.  The associated string constants must be set
    accordingly, for use in constructing the assembler instructions. */
 #define LONG 8192
-#define LONGx1 "8192"
-#define LONGx2 "16384"
 #define SHORT 256
-#define SHORTx1 "256"
-#define SHORTx2 "512"
+
+#if defined(__x86_64__)
+/* Apply the SSE 4.2 crc32 instruction to one byte or to eight bytes. */
+static inline uint64_t crc32c_u8(uint64_t crc, const unsigned char* next) {
+  __asm__(
+      "crc32b\t"
+      "(%1), %0"
+      : "=r"(crc)
+      : "r"(next), "0"(crc));
+  return crc;
+}
+
+static inline uint64_t crc32c_u64(uint64_t crc, const unsigned char* next) {
+  __asm__(
+      "crc32q\t"
+      "(%1), %0"
+      : "=r"(crc)
+      : "r"(next), "0"(crc));
+  return crc;
+}
+#else
+/* Apply the ARMv8 crc32c instructions to one byte or to eight bytes.  The
+   crc extension is enabled for these instructions only, so the rest of the
+   code can run on processors without it. */
+static inline uint64_t crc32c_u8(uint64_t crc, const unsigned char* next) {
+  uint32_t c = static_cast<uint32_t>(crc);
+  const uint32_t v = *next;
+  __asm__(
+      ".arch_extension crc\n\t"
+      "crc32cb\t%w0, %w0, %w1"
+      : "+r"(c)
+      : "r"(v));
+  return c;
+}
+
+static inline uint64_t crc32c_u64(uint64_t crc, const unsigned char* next) {
+  uint32_t c = static_cast<uint32_t>(crc);
+  uint64_t v;
+  memcpy(&v, next, sizeof(v));
+  __asm__(
+      ".arch_extension crc\n\t"
+      "crc32cx\t%w0, %w0, %x1"
+      : "+r"(c)
+      : "r"(v));
+  return c;
+}
+#endif
 
 /* Tables for hardware crc that shift a crc by LONG and SHORT zeros. */
 static pthread_once_t crc32c_once_hw = PTHREAD_ONCE_INIT;
@@ -164,7 +213,7 @@ static void crc32c_init_hw(void) {
   crc32c_zeros(crc32c_short, SHORT);
 }
 
-/* Compute CRC-32C using the Intel hardware instruction. */
+/* Compute CRC-32C using the hardware instructions. */
 static uint32_t crc32c_hw(uint32_t crc, const void* buf, size_t len) {
   const unsigned char* next = static_cast<const unsigned char*>(buf);
   const unsigned char* end;
@@ -179,11 +228,7 @@ static uint32_t crc32c_hw(uint32_t crc, const void* buf, size_t len) {
   /* compute the crc for up to seven leading bytes to bring the data pointer
      to an eight-byte boundary */
   while (len && ((uintptr_t)next & 7) != 0) {
-    __asm__(
-        "crc32b\t"
-        "(%1), %0"
-        : "=r"(crc0)
-        : "r"(next), "0"(crc0));
+    crc0 = crc32c_u8(crc0, next);
     next++;
     len--;
   }
@@ -197,14 +242,9 @@ static uint32_t crc32c_hw(uint32_t crc, const void* buf, size_t len) {
     crc2 = 0;
     end = next + LONG;
     do {
-      __asm__(
-          "crc32q\t"
-          "(%3), %0\n\t"
-          "crc32q\t" LONGx1
-          "(%3), %1\n\t"
-          "crc32q\t" LONGx2 "(%3), %2"
-          : "=r"(crc0), "=r"(crc1), "=r"(crc2)
-          : "r"(next), "0"(crc0), "1"(crc1), "2"(crc2));
+      crc0 = crc32c_u64(crc0, next);
+      crc1 = crc32c_u64(crc1, next + LONG);
+      crc2 = crc32c_u64(crc2, next + LONG * 2);
       next += 8;
     } while (next < end);
     crc0 = crc32c_shift(crc32c_long, crc0) ^ crc1;
@@ -220,14 +260,9 @@ static uint32_t crc32c_hw(uint32_t crc, const void* buf, size_t len) {
     crc2 = 0;
     end = next + SHORT;
     do {
-      __asm__(
-          "crc32q\t"
-          "(%3), %0\n\t"
-          "crc32q\t" SHORTx1
-          "(%3), %1\n\t"
-          "crc32q\t" SHORTx2 "(%3), %2"
-          : "=r"(crc0), "=r"(crc1), "=r"(crc2)
-          : "r"(next), "0"(crc0), "1"(crc1), "2"(crc2));
+      crc0 = crc32c_u64(crc0, next);
+      crc1 = crc32c_u64(crc1, next + SHORT);
+      crc2 = crc32c_u64(crc2, next + SHORT * 2);
       next += 8;
     } while (next < end);
     crc0 = crc32c_shift(crc32c_short, crc0) ^ crc1;
@@ -240,22 +275,14 @@ static uint32_t crc32c_hw(uint32_t crc, const void* buf, size_t len) {
      block */
   end = next + (len - (len & 7));
   while (next < end) {
-    __asm__(
-        "crc32q\t"
-        "(%1), %0"
-        : "=r"(crc0)
-        : "r"(next), "0"(crc0));
+    crc0 = crc32c_u64(crc0, next);
     next += 8;
   }
   len &= 7;
 
   /* compute the crc for up to seven trailing bytes */
   while (len) {
-    __asm__(
-        "crc32b\t"
-        "(%1), %0"
-        : "=r"(crc0)
-        : "r"(next), "0"(crc0));
+    crc0 = crc32c_u8(crc0, next);
     next++;
     len--;
   }
@@ -264,6 +291,7 @@ static uint32_t crc32c_hw(uint32_t crc, const void* buf, size_t len) {
   return (uint32_t)crc0 ^ 0xffffffff;
 }
 
+#if defined(__x86_64__)
 /* Check for SSE 4.2.  SSE 4.2 was first supported in Nehalem processors
    introduced in November, 2008.  This does not check for the existence of the
    cpuid instruction itself, which was introduced on the 486SL in 1992, so this
@@ -277,11 +305,6 @@ static uint32_t crc32c_hw(uint32_t crc, const void* buf, size_t len) {
     (have) = (ecx >> 20) & 1;                                 \
   } while (0)
 
-/* Compute a CRC-32C using SSE4.2 */
-uint32_t ExtendHW(uint32_t crc, const char* buf, size_t len) {
-  return crc32c_hw(crc, buf, len);  // CanAccelerateCrc32c() must hold
-}
-
 /* Check if SSE4.2 instruction is present. */
 int CanAccelerateCrc32c() {
   int sse42;
@@ -289,7 +312,24 @@ int CanAccelerateCrc32c() {
   return sse42;
 }
 #else
-// Not supported in non-POSIX platforms.
+/* Check if the ARMv8 crc32 instructions are present. */
+int CanAccelerateCrc32c() {
+#if defined(__linux__)
+  return (getauxval(AT_HWCAP) & (1 << 7 /* HWCAP_CRC32 */)) != 0;
+#elif defined(__APPLE__)
+  return 1; /* All 64-bit Apple processors implement them */
+#else
+  return 0;
+#endif
+}
+#endif
+
+/* Compute a CRC-32C using SSE4.2 or ARMv8 crc32 instructions */
+uint32_t ExtendHW(uint32_t crc, const char* buf, size_t len) {
+  return crc32c_hw(crc, buf, len);  // CanAccelerateCrc32c() must hold
+}
+#else
+// Not supported in non-POSIX platforms or other processors.
 int CanAccelerateCrc32c() { return 0; }
 uint32_t ExtendHW(uint32_t crc, const char* buf, size_t len) {
   return ExtendSW(crc, buf, len);
@@ -98,6 +98,23 @@ TEST(CRC, Extend) {
             CRCExtend(CRCValue("hello ", 6), "world", 5));
 }
 
+TEST(CRC, LongBuffers) {
+  // Cover the three-way parallel paths of the hardware implementation
+  // along with unaligned heads and tails
+  std::string buf(3 * 8192 * 2 + 3 * 256 + 64, 0);
+  for (size_t i = 0; i < buf.size(); i++) {
+    buf[i] = static_cast<char>(i * 131 + (i >> 8));
+  }
+  const size_t lens[] = {3 * 256, 3 * 256 + 13, 3 * 8192, 3 * 8192 + 777,
+                         buf.size() - 7};
+  for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+    for (size_t off = 0; off < 8; off++) {
+      CRCValue(buf.data() + off, lens[i]);
+      CRCExtend(0x12345678, buf.data() + off, lens[i]);
+    }
+  }
+}
+
 TEST(CRC, Mask) {
   uint32_t crc = CRCValue("foo", 3);
   ASSERT_NE(crc, Mask(crc));
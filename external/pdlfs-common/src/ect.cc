@@ -11,8 +11,10 @@
 #include "ectrie/bit_vector.h"
 #include "ectrie/trie.h"
 
+#include "pdlfs-common/coding.h"
 #include "pdlfs-common/ect.h"
 
+#include <algorithm>
 #include <vector>
 
 namespace pdlfs {
@@ -73,6 +75,33 @@ class ECTIndex : public ECT {
     n_ = n;
   }
 
+  // The encoding is the number of bits followed by the bits themselves in
+  // 32-bit words.
+  virtual void EncodeTo(std::string* dst) const {
+    const size_t bits = bitvec_.size();
+    PutVarint64(dst, bits);
+    for (size_t i = 0; i < bits; i += 32) {
+      const size_t len = std::min<size_t>(32, bits - i);
+      PutFixed32(dst, bitvec_.get<uint32_t>(i, len));
+    }
+  }
+
+  bool DecodeFrom(size_t n, Slice input) {
+    assert(n_ == 0);
+    uint64_t bits;
+    if (!GetVarint64(&input, &bits) || input.size() != (bits + 31) / 32 * 4) {
+      return false;
+    }
+    for (uint64_t i = 0; i < bits; i += 32) {
+      const size_t len = static_cast<size_t>(std::min<uint64_t>(32, bits - i));
+      bitvec_.append(DecodeFixed32(input.data()), len);
+      input.remove_prefix(4);
+    }
+    bitvec_.compact();
+    n_ = n;
+    return true;
+  }
+
  private:
   typedef ectrie::bit_vector<> bitvec_t;
   bitvec_t bitvec_;
@@ -97,4 +126,13 @@ ECT* ECT::Default(size_t key_len, size_t n, const Slice* keys) {
   return ect;
 }
 
+ECT* ECT::Decode(size_t key_len, size_t n, const Slice& encoding) {
+  ECTIndex* ect = new ECTIndex(key_len);
+  if (!ect->DecodeFrom(n, encoding)) {
+    delete ect;
+    return NULL;
+  }
+  return ect;
+}
+
 }  // namespace pdlfs
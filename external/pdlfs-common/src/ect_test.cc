@@ -18,7 +18,7 @@
 #include "pdlfs-common/slice.h"
 #include "pdlfs-common/testharness.h"
 
-#include "spooky_impl.h"
+#include "spooky/SpookyV2.h"
 
 namespace pdlfs {
 
@@ -41,6 +41,15 @@ class TrieWrapper {
 
   size_t MemUsage() const { return ect_->MemUsage(); }
 
+  // Replace the index with one decoded from its encoding.
+  void Reload(size_t n) {
+    std::string encoding;
+    ect_->EncodeTo(&encoding);
+    delete ect_;
+    ect_ = ECT::Decode(k_len_, n, encoding);
+    ASSERT_TRUE(ect_ != NULL);
+  }
+
   void Insert(const Slice& key) {
     k_offs_.push_back(k_buffer_.size());
     k_buffer_.append(key.data(), key.size());
@@ -149,6 +158,29 @@ static std::string RandomKey(Random* rnd, int k_len) {
 }
 #endif
 
+TEST(ECTTest, EncodeDecode) {
+  const int k_len = 8;
+  const size_t num_k = 1000;
+  Random rnd(301);
+  std::set<std::string> keys;
+  while (keys.size() < num_k) keys.insert(RandomKey(&rnd, k_len));
+  TrieWrapper trie(k_len);
+  std::set<std::string>::const_iterator iter;
+  for (iter = keys.begin(); iter != keys.end(); ++iter) {
+    trie.Insert(*iter);
+  }
+  trie.Flush();
+  const size_t bits = trie.MemUsage();
+  trie.Reload(num_k);
+  ASSERT_EQ(trie.MemUsage(), bits);
+  size_t rank = 0;
+  for (iter = keys.begin(); iter != keys.end(); ++iter) {
+    ASSERT_EQ(trie.Locate(*iter), rank);
+    rank++;
+  }
+  ASSERT_TRUE(ECT::Decode(k_len, num_k, Slice("\x80", 1)) == NULL);
+}
+
 TEST(ECTTest, ECTBench) {
   for (int k_len = 4; k_len <= 16; k_len += 4) {
     for (int num_k = 16; num_k <= 8192; num_k *= 2) {
@@ -19,6 +19,7 @@
 #include "pdlfs-common/port.h"  // Also includes pdlfs_config.h
 
 #include <stdio.h>
+#include <string.h>
 
 #if defined(PDLFS_RADOS)
 #include "pdlfs-common/rados/rados_connmgr.h"
@@ -42,8 +43,39 @@ SequentialFile::~SequentialFile() {}
 
 RandomAccessFile::~RandomAccessFile() {}
 
+Status RandomAccessFile::ReadV(uint64_t offset, char* const* bufs,
+                               const size_t* sizes, size_t n,
+                               size_t* result) const {
+  Status s;
+  *result = 0;
+  for (size_t i = 0; i < n; i++) {
+    Slice r;
+    s = Read(offset, sizes[i], &r, bufs[i]);
+    if (!s.ok()) {
+      break;
+    }
+    if (r.size() != 0 && r.data() != bufs[i]) {
+      memmove(bufs[i], r.data(), r.size());
+    }
+    *result += r.size();
+    offset += r.size();
+    if (r.size() < sizes[i]) {  // EOF
+      break;
+    }
+  }
+  return s;
+}
+
 WritableFile::~WritableFile() {}
 
+Status WritableFile::AppendV(const Slice* data, size_t n) {
+  Status s;
+  for (size_t i = 0; i < n && s.ok(); i++) {
+    s = Append(data[i]);
+  }
+  return s;
+}
+
 WritableFileWrapper::~WritableFileWrapper() {}
 
 Logger::~Logger() {}
@@ -56,6 +88,14 @@ UDPSocket::~UDPSocket() {}
 
 ThreadPool::~ThreadPool() {}
 
+void ThreadPool::ScheduleUrgent(void (*function)(void*), void* arg) {
+  Schedule(function, arg);
+}
+
+void ThreadPool::GetStats(ThreadPoolStats* stats) {
+  *stats = ThreadPoolStats();
+}
+
 EnvWrapper::~EnvWrapper() {}
 
 Env* Env::Open(const char* name, const char* conf, bool* is_system) {
@@ -9,6 +9,12 @@
  * found in the LICENSE file. See the AUTHORS file for names of contributors.
  */
 #include "pdlfs-common/env_files.h"
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <string.h>
+#include <algorithm>
+
 // If c++11 or newer, directly use c++ std atomic counters.
 #if __cplusplus >= 201103L
 #include <atomic>
@@ -105,4 +111,165 @@ Status WholeFileBufferedRandomAccessFile::Load() {
   return status;
 }
 
+SegmentedBufferedRandomAccessFile::SegmentedBufferedRandomAccessFile(
+    RandomAccessFile* base, uint64_t file_size, size_t segment_size,
+    size_t max_buf_size, ThreadPool* pool, int readahead)
+    : base_(base),
+      file_size_(file_size),
+      segment_size_(std::max<size_t>(segment_size, 1)),
+      pool_(pool),
+      readahead_(readahead),
+      cv_(&mu_),
+      segments_(max_buf_size),
+      num_pending_(0) {}
+
+SegmentedBufferedRandomAccessFile::~SegmentedBufferedRandomAccessFile() {
+  {
+    MutexLock ml(&mu_);
+    while (num_pending_ != 0) {
+      cv_.Wait();
+    }
+  }
+  delete base_;
+}
+
+static Slice SegmentKey(uint64_t i, char* scratch) {
+  EncodeFixed64(scratch, i);
+  return Slice(scratch, 8);
+}
+
+static uint32_t SegmentHash(uint64_t i) {
+  return static_cast<uint32_t>(i) ^ static_cast<uint32_t>(i >> 32);
+}
+
+bool SegmentedBufferedRandomAccessFile::IsBuffered(uint64_t i) const {
+  char tmp[8];
+  MutexLock ml(&mu_);
+  Segment* const s = segments_.Lookup(SegmentKey(i, tmp), SegmentHash(i));
+  if (s != NULL) {
+    segments_.Release(s);
+  }
+  return s != NULL;
+}
+
+void SegmentedBufferedRandomAccessFile::ReleaseSegment(Segment* s) const {
+  MutexLock ml(&mu_);
+  segments_.Release(s);
+}
+
+Status SegmentedBufferedRandomAccessFile::GetSegment(uint64_t i,
+                                                     Segment** result,
+                                                     bool* fetched) const {
+  char tmp[8];
+  const Slice key = SegmentKey(i, tmp);
+  *fetched = false;
+  {
+    MutexLock ml(&mu_);
+    *result = segments_.Lookup(key, SegmentHash(i));
+    if (*result != NULL) {
+      return Status::OK();
+    }
+  }
+  // Fetch without holding the lock. Concurrent fetches of the same segment
+  // are harmless as the last one replaces the others in the cache.
+  const uint64_t off = i * segment_size_;
+  assert(off < file_size_);
+  const size_t n =
+      static_cast<size_t>(std::min<uint64_t>(segment_size_, file_size_ - off));
+  std::string* const buf = new std::string(n, 0);
+  Slice contents;
+  Status status = base_->Read(off, n, &contents, &(*buf)[0]);
+  if (status.ok() && contents.size() != n) {
+    status = Status::IOError("Truncated segment read");
+  }
+  if (!status.ok()) {
+    delete buf;
+    return status;
+  }
+  if (contents.data() != buf->data()) {
+    memcpy(&(*buf)[0], contents.data(), n);
+  }
+  MutexLock ml(&mu_);
+  *result = segments_.Insert(key, SegmentHash(i), buf, n,
+                             LRUValueDeleter<std::string>);
+  *fetched = true;
+  return status;
+}
+
+struct SegmentedBufferedRandomAccessFile::Prefetch {
+  const SegmentedBufferedRandomAccessFile* file;
+  uint64_t segment;
+};
+
+void SegmentedBufferedRandomAccessFile::DoPrefetch(void* arg) {
+  Prefetch* const p = reinterpret_cast<Prefetch*>(arg);
+  const SegmentedBufferedRandomAccessFile* const f = p->file;
+  Segment* s;
+  bool fetched;
+  if (f->GetSegment(p->segment, &s, &fetched).ok()) {
+    f->ReleaseSegment(s);
+  }
+  delete p;
+  MutexLock ml(&f->mu_);
+  assert(f->num_pending_ > 0);
+  f->num_pending_--;
+  f->cv_.SignalAll();
+}
+
+void SegmentedBufferedRandomAccessFile::MaybeScheduleReadahead(
+    uint64_t i) const {
+  if (pool_ == NULL) {
+    return;
+  }
+  for (int k = 1; k <= readahead_; k++) {
+    const uint64_t j = i + k;
+    if (j * segment_size_ >= file_size_) {
+      break;
+    } else if (IsBuffered(j)) {
+      continue;
+    }
+    Prefetch* const p = new Prefetch;
+    p->file = this;
+    p->segment = j;
+    {
+      MutexLock ml(&mu_);
+      num_pending_++;
+    }
+    pool_->Schedule(DoPrefetch, p);
+  }
+}
+
+Status SegmentedBufferedRandomAccessFile::Read(uint64_t offset, size_t n,
+                                               Slice* result,
+                                               char* scratch) const {
+  *result = Slice();
+  if (offset >= file_size_) {
+    return Status::OK();
+  }
+  n = static_cast<size_t>(std::min<uint64_t>(n, file_size_ - offset));
+  Status status;
+  size_t done = 0;
+  while (done < n) {
+    const uint64_t off = offset + done;
+    const uint64_t i = off / segment_size_;
+    Segment* s;
+    bool fetched;
+    status = GetSegment(i, &s, &fetched);
+    if (!status.ok()) {
+      return status;
+    }
+    if (fetched) {
+      MaybeScheduleReadahead(i);
+    }
+    const std::string* const seg = s->value;
+    const size_t seg_off = static_cast<size_t>(off - i * segment_size_);
+    const size_t m = std::min(n - done, seg->size() - seg_off);
+    memcpy(scratch + done, seg->data() + seg_off, m);
+    ReleaseSegment(s);
+    done += m;
+  }
+  *result = Slice(scratch, n);
+  return status;
+}
+
 }  // namespace pdlfs
@@ -14,9 +14,17 @@
  * Use of this source code is governed by a BSD-style license that can be
  * found at https://github.com/google/leveldb.
  */
+#include "posix/posix_fastcopy.h"
+
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/env_files.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
+#include "pdlfs-common/random.h"
 #include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
+
+#include <vector>
 
 namespace pdlfs {
 
@@ -108,6 +116,168 @@ TEST(EnvPosixTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+struct PoolTask {
+  port::Mutex* mu;
+  std::string* trace;
+  char tag;
+};
+
+static void RunPoolTask(void* arg) {
+  PoolTask* t = reinterpret_cast<PoolTask*>(arg);
+  MutexLock ml(t->mu);
+  t->trace->push_back(t->tag);
+}
+
+static void WaitForPool(ThreadPool* pool, uint64_t completed) {
+  ThreadPoolStats stats;
+  while (true) {
+    pool->GetStats(&stats);
+    if (stats.completed >= completed) {
+      break;
+    }
+    SleepForMicroseconds(1000);
+  }
+  ASSERT_EQ(stats.queued, 0);
+  ASSERT_EQ(stats.completed, completed);
+}
+
+TEST(EnvPosixTest, WorkStealingPool) {
+  ThreadPool* const pool = ThreadPool::NewWorkStealing(4, true);
+  port::Mutex mu;
+  std::string trace;
+  const int n = 1000;
+  std::vector<PoolTask> tasks(n);
+  for (int i = 0; i < n; i++) {
+    tasks[i].mu = &mu;
+    tasks[i].trace = &trace;
+    tasks[i].tag = 'a';
+    pool->Schedule(RunPoolTask, &tasks[i]);
+  }
+  WaitForPool(pool, n);
+  ASSERT_EQ(trace.size(), n);
+  delete pool;
+}
+
+TEST(EnvPosixTest, WorkStealingPoolWakeups) {
+  ThreadPool* const pool = ThreadPool::NewWorkStealing(4, true);
+  port::Mutex mu;
+  std::string trace;
+  const int n = 500;
+  std::vector<PoolTask> tasks(n);
+  for (int i = 0; i < n; i++) {  // Each task finds all threads idle
+    tasks[i].mu = &mu;
+    tasks[i].trace = &trace;
+    tasks[i].tag = 'a';
+    pool->Schedule(RunPoolTask, &tasks[i]);
+    WaitForPool(pool, i + 1);
+  }
+  ASSERT_EQ(trace.size(), n);
+  delete pool;
+}
+
+TEST(EnvPosixTest, FixedPoolStats) {
+  ThreadPool* const pool = ThreadPool::NewFixed(4, true);
+  port::Mutex mu;
+  std::string trace;
+  const int n = 1000;
+  std::vector<PoolTask> tasks(n);
+  for (int i = 0; i < n; i++) {
+    tasks[i].mu = &mu;
+    tasks[i].trace = &trace;
+    tasks[i].tag = 'a';
+    pool->Schedule(RunPoolTask, &tasks[i]);
+  }
+  WaitForPool(pool, n);
+  ASSERT_EQ(trace.size(), n);
+  delete pool;
+}
+
+TEST(EnvPosixTest, UrgentTasksFirst) {
+  ThreadPool* const pool = ThreadPool::NewWorkStealing(2, true);
+  port::Mutex mu;
+  std::string trace;
+  PoolTask tasks[4];
+  const char tags[] = "nnuu";
+  SleepForMicroseconds(kDelayMicros);  // Let pool threads go idle
+  pool->Pause();
+  for (int i = 0; i < 4; i++) {
+    tasks[i].mu = &mu;
+    tasks[i].trace = &trace;
+    tasks[i].tag = tags[i];
+    if (tags[i] == 'u') {
+      pool->ScheduleUrgent(RunPoolTask, &tasks[i]);
+    } else {
+      pool->Schedule(RunPoolTask, &tasks[i]);
+    }
+  }
+  ThreadPoolStats stats;
+  pool->GetStats(&stats);
+  ASSERT_EQ(stats.queued, 4);
+  ASSERT_EQ(stats.queued_urgent, 2);
+  pool->Resume();
+  WaitForPool(pool, 4);
+  // No normal task is taken until all urgent tasks have been taken
+  ASSERT_EQ(trace[0], 'u');
+  delete pool;
+}
+
+TEST(EnvPosixTest, CopyFile) {
+  const std::string dir = test::PrepareTmpDir("env_test");
+  const std::string src = dir + "/src";
+  const std::string dst = dir + "/dst";
+  Random rnd(301);
+  std::string data;
+  test::RandomString(&rnd, 100003, &data);
+  ASSERT_OK(WriteStringToFile(env_, data, src.c_str()));
+  std::string result;
+  ASSERT_OK(env_->CopyFile(src.c_str(), dst.c_str()));
+  ASSERT_OK(ReadFileToString(env_, dst.c_str(), &result));
+  ASSERT_TRUE(result == data);
+#if defined(PDLFS_OS_LINUX)
+  ASSERT_OK(ParallelCopy(src.c_str(), dst.c_str(), 4, 4096));
+  ASSERT_OK(ReadFileToString(env_, dst.c_str(), &result));
+  ASSERT_TRUE(result == data);
+#endif
+  ASSERT_OK(WriteStringToFile(env_, Slice(), src.c_str()));
+  ASSERT_OK(env_->CopyFile(src.c_str(), dst.c_str()));
+  ASSERT_OK(ReadFileToString(env_, dst.c_str(), &result));
+  ASSERT_TRUE(result.empty());
+}
+
+TEST(EnvPosixTest, SegmentedBufferedFile) {
+  const std::string fname = test::PrepareTmpDir("env_test") + "/segs";
+  Random rnd(301);
+  std::string data;
+  test::RandomString(&rnd, 100003, &data);
+  ASSERT_OK(WriteStringToFile(env_, data, fname.c_str()));
+  ThreadPool* const pool = ThreadPool::NewFixed(2);
+  for (int with_pool = 0; with_pool < 2; with_pool++) {
+    RandomAccessFile* base;
+    ASSERT_OK(env_->NewRandomAccessFile(fname.c_str(), &base));
+    RandomAccessFileStats stats;
+    SegmentedBufferedRandomAccessFile file(
+        new MonitoredRandomAccessFile(&stats, base), data.size(), 4096,
+        8 * 4096, with_pool ? pool : NULL, 2);
+    char scratch[10000];
+    Slice result;
+    for (int i = 0; i < 200; i++) {
+      const uint64_t off = rnd.Uniform(data.size() + 100);
+      const size_t n = rnd.Uniform(sizeof(scratch));
+      ASSERT_OK(file.Read(off, n, &result, scratch));
+      const size_t start = static_cast<size_t>(
+          std::min<uint64_t>(off, data.size()));
+      ASSERT_EQ(result.ToString(), data.substr(start, n));
+    }
+    if (!with_pool) {
+      ASSERT_OK(file.Read(10, 100, &result, scratch));
+      const uint64_t ops = stats.TotalOps();
+      ASSERT_OK(file.Read(20, 100, &result, scratch));
+      ASSERT_EQ(stats.TotalOps(), ops);  // Served from the buffered segment
+    }
+  }
+  delete pool;
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -14,6 +14,8 @@
 #include "pdlfs-common/port.h"
 #include "pdlfs-common/strutil.h"
 
+#include "striped_fio.h"
+
 #if defined(PDLFS_PLATFORM_POSIX)
 #include "posix/posix_fio.h"
 #endif
@@ -41,6 +43,51 @@ static std::string FetchRoot(const char* input) {
   return root;
 }
 
+#if defined(PDLFS_PLATFORM_POSIX)
+// Conf is a list of "root=<dir>", one per backend, optionally followed by
+// "stripe_size=<bytes>" (default 1MB) and "io_threads=<num>" (default one
+// per backend, 0 to disable parallel backend access).
+static Fio* OpenStripedPosixFio(const char* input) {
+  std::vector<std::string> roots;
+  uint64_t stripe_size = 1 << 20;
+  uint64_t io_threads = ~static_cast<uint64_t>(0);
+  std::vector<std::string> confs;
+  SplitString(&confs, input);
+  for (size_t i = 0; i < confs.size(); i++) {
+    Slice input = confs[i];
+    if (input.starts_with("root=")) {
+      input.remove_prefix(5);
+      roots.push_back(input.ToString());
+    } else if (input.starts_with("stripe_size=")) {
+      input.remove_prefix(12);
+      if (!ParsePrettyNumber(input, &stripe_size) || stripe_size == 0) {
+        return NULL;
+      }
+    } else if (input.starts_with("io_threads=")) {
+      input.remove_prefix(11);
+      if (!ParsePrettyNumber(input, &io_threads)) {
+        return NULL;
+      }
+    }
+  }
+  if (roots.empty()) {
+    return NULL;
+  }
+  if (io_threads == ~static_cast<uint64_t>(0)) {
+    io_threads = roots.size();
+  }
+  std::vector<Fio*> backends;
+  for (size_t i = 0; i < roots.size(); i++) {
+    backends.push_back(new PosixFio(roots[i].c_str()));
+  }
+  ThreadPool* pool = NULL;
+  if (io_threads != 0) {
+    pool = ThreadPool::NewFixed(static_cast<int>(io_threads));
+  }
+  return new StripedFio(backends, stripe_size, pool, true);
+}
+#endif
+
 Fio* Fio::Open(const char* name, const char* conf) {
   if (name == NULL) name = "";
   if (conf == NULL) conf = "";
@@ -55,6 +102,12 @@ Fio* Fio::Open(const char* name, const char* conf) {
     return new PosixFio(root.c_str());
 #else
     return NULL;
+#endif
+  } else if (fio_name == "striped") {
+#if defined(PDLFS_PLATFORM_POSIX)
+    return OpenStripedPosixFio(fio_conf.c_str());
+#else
+    return NULL;
 #endif
   } else {
     return NULL;
@@ -9,7 +9,16 @@
  * found in the LICENSE file. See the AUTHORS file for names of contributors.
  */
 #include "pdlfs-common/fio.h"
+
+#include "striped_fio.h"
+
+#include "pdlfs-common/random.h"
 #include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
+
+#if defined(PDLFS_PLATFORM_POSIX)
+#include "posix/posix_fio.h"
+#endif
 
 namespace pdlfs {
 
@@ -48,6 +57,104 @@ TEST(FioTest, EncodeDecode) {
   ASSERT_EQ(encoding1, encoding2);
 }
 
+#if defined(PDLFS_PLATFORM_POSIX)
+class StripedFioTest {
+ public:
+  StripedFioTest() {
+    std::string root = test::TmpDir() + "/striped_fio_test";
+    Env::Default()->CreateDir(root.c_str());
+    std::vector<Fio*> backends;
+    for (int i = 0; i < 3; i++) {
+      char tmp[20];
+      snprintf(tmp, sizeof(tmp), "/%d", i);
+      backends.push_back(new PosixFio((root + tmp).c_str()));
+    }
+    fio_ = new StripedFio(backends, 4096, ThreadPool::NewFixed(2), true);
+#if defined(DELTAFS)
+    fentry_.pid = DirId(0, 0, 0);
+    fentry_.stat.SetRegId(0);
+    fentry_.stat.SetSnapId(0);
+#else
+    fentry_.pid = DirId(0);
+#endif
+    fentry_.nhash = "xyz";
+    fentry_.zserver = 0;
+    fentry_.stat.SetInodeNo(1);
+  }
+
+  ~StripedFioTest() {
+    fio_->Drop(fentry_);
+    delete fio_;
+  }
+
+  std::string Pread(Fio::Handle* fh, uint64_t off, uint64_t size) {
+    std::string scratch(size, 'x');
+    Slice result;
+    ASSERT_OK(fio_->Pread(fentry_, fh, &result, off, size, &scratch[0]));
+    return result.ToString();
+  }
+
+  StripedFio* fio_;
+  Fentry fentry_;
+};
+
+TEST(StripedFioTest, Sizes) {
+  for (uint64_t size = 0; size < 5 * 3 * 4096; size += 511) {
+    uint64_t result = 0;
+    for (size_t b = 0; b < 3; b++) {
+      result = std::max(result, fio_->LogicalSize(b, fio_->LocalSize(b, size)));
+    }
+    ASSERT_EQ(result, size);
+  }
+}
+
+TEST(StripedFioTest, ReadWrite) {
+  Random rnd(301);
+  std::string data;
+  test::RandomString(&rnd, 50000, &data);
+  Fio::Handle* fh;
+  ASSERT_OK(fio_->Creat(fentry_, false, &fh));
+  ASSERT_OK(fio_->Pwrite(fentry_, fh, data, 1000));
+  ASSERT_EQ(Pread(fh, 1000, data.size()), data);
+  ASSERT_EQ(Pread(fh, 0, 100000), std::string(1000, 0) + data);
+  uint64_t mtime;
+  uint64_t size;
+  ASSERT_OK(fio_->Fstat(fentry_, fh, &mtime, &size));
+  ASSERT_EQ(size, 51000);
+  // Leave a hole
+  ASSERT_OK(fio_->Pwrite(fentry_, fh, "abc", 60000));
+  ASSERT_EQ(Pread(fh, 50000, 10003),
+            data.substr(49000) + std::string(9000, 0) + "abc");
+  ASSERT_OK(fio_->Ftrunc(fentry_, fh, 10000));
+  ASSERT_OK(fio_->Fstat(fentry_, fh, &mtime, &size));
+  ASSERT_EQ(size, 10000);
+  ASSERT_EQ(Pread(fh, 0, 100000), std::string(1000, 0) + data.substr(0, 9000));
+  ASSERT_OK(fio_->Close(fentry_, fh));
+}
+
+TEST(StripedFioTest, Append) {
+  Fio::Handle* fh;
+  ASSERT_OK(fio_->Creat(fentry_, false, &fh));
+  ASSERT_OK(fio_->Write(fentry_, fh, std::string(5000, 'a')));
+  ASSERT_OK(fio_->Close(fentry_, fh));
+  uint64_t mtime;
+  uint64_t size;
+  ASSERT_OK(fio_->Open(fentry_, false, false, true, &mtime, &size, &fh));
+  ASSERT_EQ(size, 5000);
+  ASSERT_OK(fio_->Write(fentry_, fh, std::string(5000, 'b')));
+  ASSERT_OK(fio_->Close(fentry_, fh));
+  ASSERT_OK(fio_->Stat(fentry_, &mtime, &size));
+  ASSERT_EQ(size, 10000);
+  ASSERT_OK(fio_->Open(fentry_, false, false, false, &mtime, &size, &fh));
+  std::string scratch(20000, 'x');
+  Slice result;
+  ASSERT_OK(fio_->Read(fentry_, fh, &result, 20000, &scratch[0]));
+  ASSERT_EQ(result.ToString(),
+            std::string(5000, 'a') + std::string(5000, 'b'));
+  ASSERT_OK(fio_->Close(fentry_, fh));
+}
+#endif
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -10,8 +10,12 @@
  */
 
 #include "pdlfs-common/fsdbx.h"
+#include "pdlfs-common/leveldb/db.h"
+#include "pdlfs-common/leveldb/write_batch.h"
 #include "pdlfs-common/testharness.h"
 
+#include <stdio.h>
+
 namespace pdlfs {
 
 class DirIdTest {
@@ -77,6 +81,120 @@ TEST(DirIdTest, DirIdEnc3) {
 #endif
 }
 
+class MXDBTest {
+ public:
+  struct Tx {
+    const Snapshot* snap;
+    WriteBatch bat;
+  };
+
+  struct Perf {
+    Perf() : putkeybytes(0), putbytes(0), puts(0) {}
+    uint64_t putkeybytes;
+    uint64_t putbytes;
+    uint64_t puts;
+  };
+
+  MXDBTest() : db_(NULL) {
+    dbname_ = test::PrepareTmpDir("fsdbx_test");
+    DestroyDB(dbname_, DBOptions());
+    DBOptions options;
+    options.create_if_missing = true;
+    ASSERT_OK(DB::Open(options, dbname_, &db_));
+  }
+
+  ~MXDBTest() {
+    delete db_;
+    DestroyDB(dbname_, DBOptions());
+  }
+
+  static Stat MakeStat(uint64_t ino) {
+    Stat stat;
+#if defined(DELTAFS_PROTO)
+    stat.SetDnodeNo(0);
+#endif
+#if defined(DELTAFS)
+    stat.SetRegId(0);
+    stat.SetSnapId(0);
+#endif
+    stat.SetInodeNo(ino);
+    stat.SetFileSize(ino * 100);
+    stat.SetFileMode(0644);
+#if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
+    stat.SetZerothServer(0);
+#endif
+    stat.SetUserId(1);
+    stat.SetGroupId(2);
+    stat.SetModifyTime(3);
+    stat.SetChangeTime(4);
+    return stat;
+  }
+
+  // Use 8-byte big-endian suffixes so entries are listed in insertion order
+  static std::string Suffix(uint64_t i) {
+    char tmp[8];
+    for (int j = 0; j < 8; j++) tmp[j] = char(i >> (56 - 8 * j));
+    return std::string(tmp, sizeof(tmp));
+  }
+
+  static std::string Name(uint64_t i) {
+    char tmp[20];
+    snprintf(tmp, sizeof(tmp), "f%llu", static_cast<unsigned long long>(i));
+    return tmp;
+  }
+
+  void Populate(const DirId& dir, int n) {
+    MXDB<> mx(db_);
+    WriteOptions options;
+    Perf perf;
+    for (int i = 0; i < n; i++) {
+      ASSERT_OK(mx.PUT<Key>(dir, Suffix(i), MakeStat(i + 1), Name(i),
+                            &options, static_cast<Tx*>(NULL), &perf));
+    }
+    ASSERT_EQ(perf.puts, n);
+  }
+
+  std::string dbname_;
+  DB* db_;
+};
+
+TEST(MXDBTest, ReaddirBatches) {
+  const int n = 100;
+  Populate(DirId(7), n);
+  Populate(DirId(8), 3);  // Entries of another directory
+  MXDB<> mx(db_);
+  for (int with_stats = 0; with_stats < 2; with_stats++) {
+    ReadOptions options;
+    MXDB<>::Dir<Iterator>* dir = mx.OPENDIR<Iterator, Key>(
+        DirId(7), &options, static_cast<Tx*>(NULL));
+    ASSERT_TRUE(dir != NULL);
+    MXDB<>::StatList stats;
+    std::vector<Slice> names;
+    std::string arena;
+    int i = 0;
+    for (;;) {
+      Status s = mx.READDIRS(dir, 16, with_stats ? &stats : NULL, &names,
+                             &arena);
+      if (!s.ok()) {
+        ASSERT_TRUE(s.IsNotFound());
+        break;
+      }
+      ASSERT_TRUE(names.size() <= 16);
+      ASSERT_EQ(stats.size(), with_stats ? names.size() : 0);
+      for (size_t j = 0; j < names.size(); j++, i++) {
+        ASSERT_EQ(names[j], Name(i));
+        if (with_stats) {
+          ASSERT_EQ(stats[j].InodeNo(), i + 1);
+          ASSERT_EQ(stats[j].FileSize(), (i + 1) * 100);
+        }
+      }
+    }
+    ASSERT_EQ(i, n);
+    ASSERT_EQ(dir->n, n);
+    mx.CLOSEDIR(dir);
+  }
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -418,6 +418,27 @@ bool Stat::DecodeFrom(Slice* input) {
   return true;
 }
 
+bool Stat::SkipEncoding(Slice* input) {
+  // Must match the number of varints written by EncodeTo()
+  int n = 7;  // ino, size, mode, uid, gid, mtime, and ctime
+#if defined(DELTAFS_PROTO)
+  n += 1;  // dno
+#endif
+#if defined(DELTAFS)
+  n += 2;  // reg and snap
+#endif
+#if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
+  n += 1;  // zeroth_server
+#endif
+  uint64_t ignored;
+  for (int i = 0; i < n; i++) {
+    if (!GetVarint64(input, &ignored)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 #if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
 Slice LookupStat::EncodeTo(char* scratch) const {
   char* p = scratch;
@@ -17,6 +17,7 @@
 #include <math.h>
 #include <string.h>
 #include <algorithm>
+#include <vector>
 
 namespace pdlfs {
 
@@ -146,6 +147,11 @@ static int ComputeIndexFromHash(const char* hash, int n) {
 //     radix: uint16_t
 static const size_t kHeadSize = 4;
 
+// Set in the radix field of compact encodings, which are followed by the
+// varint lengths of alternating runs of set and unset bits, starting with a
+// run of set bits. The final run of unset bits is omitted.
+static const uint16_t kCompactEncoding = 0x8000;
+
 // Read-only view to an existing directory index.
 struct DirIndex::View {
   uint16_t zeroth_server() const { return DecodeFixed16(rep_); }
@@ -197,10 +203,46 @@ struct DirIndex::View {
   Slice bitmap_;
 };
 
+// Convert a compact encoding into a regular one.
+bool DirIndex::ExpandCompact(const Slice& input, std::string* result) {
+  assert(input.size() >= kHeadSize);
+  const int r = DecodeFixed16(input.data() + 2) & ~kCompactEncoding;
+  if (r > kMaxRadix) {
+    return false;
+  }
+  const uint32_t num_bits = 1u << r;
+  result->assign(input.data(), kHeadSize);
+  EncodeFixed16(&(*result)[2], static_cast<uint16_t>(r));
+  result->resize(kHeadSize + (num_bits + 7) / 8, 0);
+  char* const bitmap = &(*result)[kHeadSize];
+  Slice runs(input.data() + kHeadSize, input.size() - kHeadSize);
+  uint32_t i = 0;
+  bool set = true;
+  while (!runs.empty()) {
+    uint32_t run;
+    if (!GetVarint32(&runs, &run) || run > num_bits - i) {
+      return false;
+    }
+    if (set) {
+      for (uint32_t j = i; j < i + run; j++) {
+        bitmap[j / 8] |= kBits[j % 8];
+      }
+    }
+    i += run;
+    set = !set;
+  }
+  return true;
+}
+
 bool DirIndex::ParseDirIndex(const Slice& input, bool paranoid_checks,
-                             View* view) {
+                             View* view, std::string* scratch) {
   if (input.size() < kHeadSize) {
     return false;
+  } else if (DecodeFixed16(input.data() + 2) & kCompactEncoding) {
+    if (!ExpandCompact(input, scratch)) {
+      return false;
+    }
+    return ParseDirIndex(*scratch, paranoid_checks, view, scratch);
   } else {
     view->rep_ = input.data();
     int r = view->radix();
@@ -399,6 +441,42 @@ Slice DirIndex::Encode() const {
   return rep_->ToSlice();
 }
 
+void DirIndex::EncodeTo(std::string* dst) const { EncodeRuns(NULL, dst); }
+
+void DirIndex::EncodeDiffTo(const DirIndex& base, std::string* dst) const {
+  assert(base.rep_ != NULL);
+  assert(base.rep_->zeroth_server() == rep_->zeroth_server());
+  EncodeRuns(base.rep_, dst);
+}
+
+// Encode the bits of this index that are not in base. Bit 0 and the highest
+// bit are always kept so that the result is a valid index on its own.
+void DirIndex::EncodeRuns(const Rep* base, std::string* dst) const {
+  assert(rep_ != NULL);
+  const int r = rep_->radix();
+  const size_t highest = rep_->HighestBit();
+  char head[kHeadSize];
+  EncodeFixed16(head, rep_->zeroth_server());
+  EncodeFixed16(head + 2, static_cast<uint16_t>(r) | kCompactEncoding);
+  dst->append(head, sizeof(head));
+  bool set = true;
+  uint32_t run = 0;
+  for (size_t i = 0; i <= highest; i++) {
+    bool b = rep_->bit(i);
+    if (b && base != NULL && i != 0 && i != highest) {
+      b = !base->bit(i);
+    }
+    if (b != set) {
+      PutVarint32(dst, run);
+      set = b;
+      run = 0;
+    }
+    run++;
+  }
+  assert(set);
+  PutVarint32(dst, run);
+}
+
 int DirIndex::ZerothServer() const {
   assert(rep_ != NULL);
   return rep_->zeroth_server();
@@ -424,8 +502,9 @@ bool DirIndex::Update(const Slice& other) {
     return TEST_Reset(other);
   } else {
     View view;
+    std::string scratch;
     bool checks = options_->paranoid_checks;
-    if (!ParseDirIndex(other, checks, &view)) {
+    if (!ParseDirIndex(other, checks, &view, &scratch)) {
       return false;
     } else if (rep_->zeroth_server() != view.zeroth_server()) {
       return false;
@@ -452,8 +531,9 @@ void DirIndex::Update(const DirIndex& other) {
 // Reset index states.
 bool DirIndex::TEST_Reset(const Slice& other) {
   View view;
+  std::string scratch;
   bool checks = options_->paranoid_checks;
-  if (!ParseDirIndex(other, checks, &view)) {
+  if (!ParseDirIndex(other, checks, &view, &scratch)) {
     return false;
   } else {
     Rep* new_rep = new Rep(view.zeroth_server());
@@ -564,6 +644,42 @@ int DirIndex::HashToServer(const Slice& hash) const {
   return GetServerForIndex(HashToIndex(hash));
 }
 
+// Pickup servers for a batch of hashes. If the batch is at least as large as
+// the number of raw indices the radix allows, map each raw index to its
+// server up front. Each parent index is smaller than its child so a single
+// forward pass over the table resolves all partitions.
+void DirIndex::HashesToServers(const Slice* hashes, size_t n,
+                               int* servers) const {
+  assert(rep_ != NULL);
+  assert(rep_->bit(0));
+  const int radix = rep_->radix();
+  const int zeroth_server = rep_->zeroth_server();
+  const int num_servers = options_->num_servers;
+  const size_t num_indices = size_t(1) << radix;
+  if (n >= num_indices) {
+    std::vector<int> owners(num_indices);
+    owners[0] = 0;
+    for (size_t i = 1; i < num_indices; i++) {
+      const int j = static_cast<int>(i);
+      owners[i] = rep_->bit(j) ? j : owners[ToParentIndex(j)];
+    }
+    for (size_t i = 0; i < num_indices; i++) {
+      owners[i] = MapIndexToServer(owners[i], zeroth_server, num_servers);
+    }
+    for (size_t k = 0; k < n; k++) {
+      servers[k] = owners[ComputeIndexFromHash(hashes[k].data(), radix)];
+    }
+  } else {
+    for (size_t k = 0; k < n; k++) {
+      int i = ComputeIndexFromHash(hashes[k].data(), radix);
+      while (!rep_->bit(i)) {
+        i = ToParentIndex(i);
+      }
+      servers[k] = MapIndexToServer(i, zeroth_server, num_servers);
+    }
+  }
+}
+
 // Return true if a file represented by the specified hash will be
 // migrated to the given child partition once its parent partition splits.
 // The given index marks this child partition. It is easy to deduce the
@@ -585,6 +701,13 @@ Slice DirIndex::Hash(const Slice& name, char* scratch) {
   return Slice(scratch, 8);
 }
 
+// Calculate the hashes for a batch of strings.
+void DirIndex::HashBatch(const Slice* names, size_t n, char* scratch) {
+  for (size_t i = 0; i < n; i++) {
+    GIGAHash(names[i], scratch + 8 * i);
+  }
+}
+
 // Return the server responsible for a specific partition.
 int DirIndex::GetServerForIndex(int index) const {
   assert(rep_ != NULL);
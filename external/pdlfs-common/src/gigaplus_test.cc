@@ -527,6 +527,71 @@ TEST(DirIndexTest, RandomServer2) {
   }
 }
 
+TEST(DirIndexTest, BatchSelect) {
+  for (int i = 0; i < 50; i++) {
+    idx_->Set(i);
+  }
+  const int n = 20000;  // Large enough to resolve through a table
+  std::vector<std::string> files;
+  for (int i = 0; i < n; i++) {
+    files.push_back(File(i));
+  }
+  std::vector<Slice> names(files.begin(), files.end());
+  std::string scratch(8 * n, 0);
+  DirIndex::HashBatch(&names[0], n, &scratch[0]);
+  std::vector<Slice> hashes;
+  for (int i = 0; i < n; i++) {
+    hashes.push_back(Slice(&scratch[8 * i], 8));
+  }
+  std::vector<int> servers(n);
+  for (int k = 1; k <= n; k *= 10) {  // Both small and large batches
+    idx_->HashesToServers(&hashes[0], k, &servers[0]);
+    for (int i = 0; i < k; i++) {
+      char tmp[8];
+      ASSERT_EQ(DirIndex::Hash(names[i], tmp), hashes[i]);
+      ASSERT_EQ(servers[i], idx_->SelectServer(names[i]));
+    }
+  }
+  idx_->HashesToServers(&hashes[0], n, &servers[0]);
+  for (int i = 0; i < n; i++) {
+    ASSERT_EQ(servers[i], idx_->HashToServer(hashes[i]));
+  }
+}
+
+TEST(DirIndexTest, CompactEncoding) {
+  std::string encoding;
+  idx_->EncodeTo(&encoding);
+  DirIndex* idx = NewIndex();
+  ASSERT_TRUE(idx->TEST_Reset(encoding));
+  ASSERT_EQ(idx->Encode(), idx_->Encode());
+  delete idx;
+  idx_->SetAll();
+  encoding.clear();
+  idx_->EncodeTo(&encoding);
+  ASSERT_LT(encoding.size(), 8);
+  idx = NewIndex();
+  ASSERT_TRUE(idx->TEST_Reset(encoding));
+  ASSERT_EQ(idx->Encode(), idx_->Encode());
+  idx->TEST_RevertAll();
+  delete idx;
+}
+
+TEST(DirIndexTest, DiffEncoding) {
+  for (int i = 0; i < 300; i++) {
+    idx_->Set(i);
+  }
+  DirIndex* base = Recover();
+  for (int i = 300; i < 600; i += 7) {
+    idx_->Set(i);
+  }
+  std::string diff;
+  idx_->EncodeDiffTo(*base, &diff);
+  ASSERT_TRUE(base->Update(diff));
+  ASSERT_EQ(base->Encode(), idx_->Encode());
+  base->TEST_RevertAll();
+  delete base;
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
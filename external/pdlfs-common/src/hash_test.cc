@@ -15,8 +15,13 @@
  * found at https://github.com/google/leveldb.
  */
 #include "pdlfs-common/hash.h"
+#include "pdlfs-common/hashmap.h"
+#include "pdlfs-common/random.h"
 #include "pdlfs-common/testharness.h"
 
+#include <map>
+#include <stdio.h>
+
 namespace pdlfs {
 
 class HASH {};
@@ -61,6 +66,67 @@ TEST(HASH, SignedUnsignedIssue) {
 }
 /* clang-format on */
 
+class FlatHashTableTest {};
+
+TEST(FlatHashTableTest, RandomOps) {
+  typedef HashEntry<> E;
+  FlatHashTable<E> table;
+  std::map<std::string, E*> ref;
+  Random rnd(301);
+  char tmp[20];
+  for (int i = 0; i < 100000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%d", int(rnd.Uniform(5000)));
+    const Slice key(tmp);
+    const uint32_t hash = Hash(key.data(), key.size(), 0);
+    std::map<std::string, E*>::iterator it = ref.find(key.ToString());
+    E* const found = *table.FindPointer(key, hash);
+    ASSERT_TRUE(found == (it != ref.end() ? it->second : NULL));
+    if (rnd.OneIn(3)) {  // Remove
+      ASSERT_TRUE(table.Remove(key, hash) == found);
+      if (found != NULL) {
+        free(found);
+        ref.erase(it);
+      }
+    } else {  // Insert or replace
+      E* const e = static_cast<E*>(malloc(sizeof(E) - 1 + key.size()));
+      e->value = NULL;
+      e->next = NULL;
+      e->key_length = key.size();
+      e->hash = hash;
+      memcpy(e->key_data, key.data(), key.size());
+      ASSERT_TRUE(table.Insert(e) == found);
+      free(found);
+      ref[key.ToString()] = e;
+    }
+    ASSERT_EQ(table.Size(), ref.size());
+  }
+  for (std::map<std::string, E*>::iterator it = ref.begin(); it != ref.end();
+       ++it) {
+    E* const e = it->second;
+    ASSERT_TRUE(table.Remove(e) == e);
+    ASSERT_TRUE(table.Remove(e) == NULL);
+    free(e);
+  }
+  ASSERT_TRUE(table.Empty());
+}
+
+TEST(FlatHashTableTest, HashSet) {
+  HashSet set;
+  char tmp[20];
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%d", i);
+    set.Insert(tmp);
+  }
+  for (int i = 0; i < 1000; i += 2) {
+    snprintf(tmp, sizeof(tmp), "k%d", i);
+    set.Erase(tmp);
+  }
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%d", i);
+    ASSERT_EQ(set.Contains(tmp), (i % 2) != 0);
+  }
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
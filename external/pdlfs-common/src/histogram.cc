@@ -15,8 +15,11 @@
  * found at https://github.com/google/leveldb.
  */
 #include "pdlfs-common/histogram.h"
+#include "pdlfs-common/hash.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
 
+#include <algorithm>
 #include <math.h>
 #include <stdio.h>
 
@@ -57,11 +60,11 @@ void Histogram::Clear() {
 }
 
 void Histogram::Add(double value) {
-  // Linear search is fast enough for our usage in db_bench
-  int b = 0;
-  while (b < kNumBuckets - 1 && kBucketLimit[b] <= value) {
-    b++;
-  }
+  // Find the first bucket whose limit is above the value. The last bucket
+  // catches everything else.
+  int b = static_cast<int>(
+      std::upper_bound(kBucketLimit, kBucketLimit + kNumBuckets - 1, value) -
+      kBucketLimit);
   buckets_[b] += 1.0;
   if (min_ > value) min_ = value;
   if (max_ < value) max_ = value;
@@ -81,6 +84,28 @@ void Histogram::Merge(const Histogram& other) {
   }
 }
 
+void Histogram::EncodeTo(double* dst) const {
+  dst[0] = min_;
+  dst[1] = max_;
+  dst[2] = num_;
+  dst[3] = sum_;
+  dst[4] = sum_squares_;
+  for (int b = 0; b < kNumBuckets; b++) {
+    dst[5 + b] = buckets_[b];
+  }
+}
+
+void Histogram::DecodeFrom(const double* src) {
+  min_ = src[0];
+  max_ = src[1];
+  num_ = src[2];
+  sum_ = src[3];
+  sum_squares_ = src[4];
+  for (int b = 0; b < kNumBuckets; b++) {
+    buckets_[b] = src[5 + b];
+  }
+}
+
 double Histogram::Median() const { return Percentile(50.0); }
 
 double Histogram::Percentile(double p) const {
@@ -151,4 +176,35 @@ std::string Histogram::ToString() const {
 }
 /* clang-format on */
 
+ConcurrentHistogram::ConcurrentHistogram() { Clear(); }
+
+void ConcurrentHistogram::Clear() {
+  for (int i = 0; i < kNumStripes; i++) {
+    MutexLock ml(&stripes_[i].mu);
+    stripes_[i].hist.Clear();
+  }
+}
+
+void ConcurrentHistogram::Add(double value) {
+  const uint64_t tid = port::PthreadId();
+  const uint32_t i =
+      Hash(reinterpret_cast<const char*>(&tid), sizeof(tid), 0) % kNumStripes;
+  MutexLock ml(&stripes_[i].mu);
+  stripes_[i].hist.Add(value);
+}
+
+void ConcurrentHistogram::Snapshot(Histogram* result) const {
+  result->Clear();
+  for (int i = 0; i < kNumStripes; i++) {
+    MutexLock ml(&stripes_[i].mu);
+    result->Merge(stripes_[i].hist);
+  }
+}
+
+std::string ConcurrentHistogram::ToString() const {
+  Histogram hist;
+  Snapshot(&hist);
+  return hist.ToString();
+}
+
 }  // namespace pdlfs
@@ -15,8 +15,10 @@
  * found at https://github.com/google/leveldb.
  */
 #include "pdlfs-common/leveldb/block.h"
+#include "pdlfs-common/leveldb/block_builder.h"
 #include "pdlfs-common/leveldb/comparator.h"
 #include "pdlfs-common/leveldb/format.h"
+#include "pdlfs-common/leveldb/internal_types.h"
 #include "pdlfs-common/leveldb/iterator.h"
 
 #include "pdlfs-common/coding.h"
@@ -29,23 +31,44 @@
 namespace pdlfs {
 
 inline uint32_t Block::NumRestarts() const {
-  assert(size_ >= sizeof(uint32_t));
-  return DecodeFixed32(data_ + size_ - sizeof(uint32_t));
+  assert(limit_ >= sizeof(uint32_t));
+  return DecodeFixed32(data_ + limit_ - sizeof(uint32_t));
 }
 
-Block::Block(const BlockContents& contents)
+Block::Block(const BlockContents& contents, bool hash_index)
     : data_(contents.data.data()),
       size_(contents.data.size()),
+      limit_(size_),
+      buckets_(NULL),
+      num_buckets_(0),
       owned_(contents.heap_allocated) {
-  if (size_ < sizeof(uint32_t)) {
+  if (hash_index) {
+    if (limit_ < sizeof(uint32_t)) {
+      limit_ = 0;
+    } else {
+      num_buckets_ = DecodeFixed32(data_ + limit_ - sizeof(uint32_t));
+      if (num_buckets_ > limit_ - sizeof(uint32_t)) {
+        // The size is too small for the hash index
+        limit_ = 0;
+        num_buckets_ = 0;
+      } else {
+        limit_ -= sizeof(uint32_t) + num_buckets_;
+        if (num_buckets_ != 0) {
+          buckets_ = data_ + limit_;
+        }
+      }
+    }
+  }
+  if (limit_ < sizeof(uint32_t)) {
     size_ = 0;  // Error marker
   } else {
-    size_t max_restarts_allowed = (size_ - sizeof(uint32_t)) / sizeof(uint32_t);
+    size_t max_restarts_allowed =
+        (limit_ - sizeof(uint32_t)) / sizeof(uint32_t);
     if (NumRestarts() > max_restarts_allowed) {
       // The size is too small for NumRestarts()
       size_ = 0;
     } else {
-      restart_offset_ = size_ - (1 + NumRestarts()) * sizeof(uint32_t);
+      restart_offset_ = limit_ - (1 + NumRestarts()) * sizeof(uint32_t);
     }
   }
 }
@@ -85,13 +108,19 @@ static inline const char* DecodeEntry(const char* p, const char* limit,
   return p;
 }
 
+template <typename Cmp>
 class Block::Iter : public Iterator {
  private:
-  const Comparator* const comparator_;
+  const Cmp cmp_;
   const char* const data_;       // underlying block contents
   uint32_t const restarts_;      // Offset of restart array (list of fixed32)
   uint32_t const num_restarts_;  // Number of uint32_t entries in restart array
 
+  // Hash index buckets for point lookups. NULL if Seek() is to do a binary
+  // search.
+  const char* const buckets_;
+  uint32_t const num_buckets_;
+
   // current_ is offset in data_ of current entry.  >= restarts_ if !Valid
   uint32_t current_;
   uint32_t restart_index_;  // Index of restart block in which current_ falls
@@ -100,7 +129,7 @@ class Block::Iter : public Iterator {
   Status status_;
 
   inline int Compare(const Slice& a, const Slice& b) const {
-    return comparator_->Compare(a, b);
+    return cmp_(a, b);
   }
 
   // Return the offset in data_ just past the end of the current entry.
@@ -124,12 +153,14 @@ class Block::Iter : public Iterator {
   }
 
  public:
-  Iter(const Comparator* comparator, const char* data, uint32_t restarts,
-       uint32_t num_restarts)
-      : comparator_(comparator),
+  Iter(const Cmp& cmp, const char* data, uint32_t restarts,
+       uint32_t num_restarts, const char* buckets, uint32_t num_buckets)
+      : cmp_(cmp),
         data_(data),
         restarts_(restarts),
         num_restarts_(num_restarts),
+        buckets_(buckets),
+        num_buckets_(num_buckets),
         current_(restarts_),
         restart_index_(num_restarts_) {
     assert(num_restarts_ > 0);
@@ -173,6 +204,24 @@ class Block::Iter : public Iterator {
   }
 
   virtual void Seek(const Slice& target) {
+    if (buckets_ != NULL && target.size() >= 8) {
+      const uint8_t b = static_cast<uint8_t>(
+          buckets_[BlockBuilder::HashKey(ExtractUserKey(target)) %
+                   num_buckets_]);
+      if (b == kHashIndexNoEntry) {
+        // The user key of target is not in the block
+        current_ = restarts_;
+        restart_index_ = num_restarts_;
+        return;
+      } else if (b < num_restarts_) {
+        // All keys with the user key of target are under restart point "b"
+        // and keys under earlier restart points are all smaller
+        ScanFrom(b, target);
+        return;
+      }
+      // Fall back to binary search on collisions
+    }
+
     // Binary search in restart array to find the last restart point
     // with a key < target
     uint32_t left = 0;
@@ -200,16 +249,7 @@ class Block::Iter : public Iterator {
       }
     }
 
-    // Linear search (within restart block) for first key >= target
-    SeekToRestartPoint(left);
-    while (true) {
-      if (!ParseNextKey()) {
-        return;
-      }
-      if (Compare(key_, target) >= 0) {
-        return;
-      }
-    }
+    ScanFrom(left, target);
   }
 
   virtual void SeekToFirst() {
@@ -225,6 +265,19 @@ class Block::Iter : public Iterator {
   }
 
  private:
+  // Linear search (within restart block) for first key >= target
+  void ScanFrom(uint32_t restart_index, const Slice& target) {
+    SeekToRestartPoint(restart_index);
+    while (true) {
+      if (!ParseNextKey()) {
+        return;
+      }
+      if (Compare(key_, target) >= 0) {
+        return;
+      }
+    }
+  }
+
   void CorruptionError() {
     current_ = restarts_;
     restart_index_ = num_restarts_;
@@ -264,14 +317,36 @@ class Block::Iter : public Iterator {
 };
 
 Iterator* Block::NewIterator(const Comparator* cmp) {
+  return NewIterator(cmp, false);
+}
+
+Iterator* Block::NewPointIterator(const Comparator* cmp) {
+  return NewIterator(cmp, true);
+}
+
+Iterator* Block::NewIterator(const Comparator* cmp, bool point_lookup) {
   if (size_ < sizeof(uint32_t)) {
     return NewErrorIterator(Status::Corruption("bad block contents"));
   }
   const uint32_t num_restarts = NumRestarts();
   if (num_restarts == 0) {
     return NewEmptyIterator();
+  }
+  const char* const buckets = point_lookup ? buckets_ : NULL;
+  const uint32_t num_buckets = (buckets != NULL) ? num_buckets_ : 0;
+  // Pick an iterator with inlined key comparisons for common comparators
+  if (cmp == BytewiseComparator()) {
+    return new Iter<BytewiseCompare>(BytewiseCompare(), data_,
+                                     restart_offset_, num_restarts, buckets,
+                                     num_buckets);
+  } else if (IsInternalBytewiseComparator(cmp)) {
+    return new Iter<InternalBytewiseCompare>(InternalBytewiseCompare(), data_,
+                                             restart_offset_, num_restarts,
+                                             buckets, num_buckets);
   } else {
-    return new Iter(cmp, data_, restart_offset_, num_restarts);
+    return new Iter<VirtualCompare>(VirtualCompare(cmp), data_,
+                                    restart_offset_, num_restarts, buckets,
+                                    num_buckets);
   }
 }
 
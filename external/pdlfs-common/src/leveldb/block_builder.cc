@@ -17,9 +17,11 @@
 #include "pdlfs-common/leveldb/block_builder.h"
 #include "pdlfs-common/leveldb/comparator.h"
 #include "pdlfs-common/leveldb/format.h"
+#include "pdlfs-common/leveldb/internal_types.h"
 
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/crc32c.h"
+#include "pdlfs-common/hash.h"
 #include "pdlfs-common/port.h"
 
 #include <assert.h>
@@ -48,6 +50,15 @@
 //     restarts: uint32[num_restarts]
 //     num_restarts: uint32
 // restarts[i] contains the offset within the block of the ith restart point.
+//
+// If the hash index is enabled, the trailer is followed by:
+//     buckets: uint8[num_buckets]
+//     num_buckets: uint32
+// Each user key is hashed to a bucket, which holds the index of the restart
+// point the key falls under, kHashIndexNoEntry if no key is hashed to it, or
+// kHashIndexCollision if keys under different restart points are hashed to
+// it. num_buckets is 0 if the block has too many restart points to be
+// indexed.
 namespace pdlfs {
 
 AbstractBlockBuilder::AbstractBlockBuilder(const Comparator* cmp)
@@ -61,7 +72,8 @@ AbstractBlockBuilder::AbstractBlockBuilder(const Comparator* cmp)
 BlockBuilder::BlockBuilder(int restart_interval)
     : AbstractBlockBuilder(BytewiseComparator()),
       restart_interval_(restart_interval),
-      counter_(0) {
+      counter_(0),
+      hash_index_(false) {
   restarts_.push_back(0);  // First restart point is at offset 0
   if (restart_interval_ < 1) {
     restart_interval_ = 1;
@@ -73,7 +85,8 @@ BlockBuilder::BlockBuilder(int restart_interval)
 BlockBuilder::BlockBuilder(int restart_interval, const Comparator* cmp)
     : AbstractBlockBuilder(cmp),
       restart_interval_(restart_interval),
-      counter_(0) {
+      counter_(0),
+      hash_index_(false) {
   restarts_.push_back(0);  // First restart point is at offset 0
   if (restart_interval_ < 1) {
     restart_interval_ = 1;
@@ -116,6 +129,20 @@ Slice AbstractBlockBuilder::Finish(CompressionType compression, bool force) {
         compressed.clear();
       }
       break;
+    case kZstdCompression:
+      if (!port::Zstd_Compress(contents.data(), sz, &compressed) ||
+          (compressed.size() >= (sz - sz / 8u) && !force)) {
+        compression = kNoCompression;
+        compressed.clear();
+      }
+      break;
+    case kLz4Compression:
+      if (!port::Lz4_Compress(contents.data(), sz, &compressed) ||
+          (compressed.size() >= (sz - sz / 8u) && !force)) {
+        compression = kNoCompression;
+        compressed.clear();
+      }
+      break;
   }
 
   if (!compressed.empty()) {
@@ -135,13 +162,19 @@ void BlockBuilder::Reset() {
   restarts_.clear();
   restarts_.push_back(0);  // First restart point is at offset 0
   counter_ = 0;
+  hashes_.clear();
 }
 
 size_t BlockBuilder::CurrentSizeEstimate() const {
   size_t result = buffer_.size() - buffer_start_;
   if (!finished_) {
     // Plus restart array contents and its length
-    return result + restarts_.size() * sizeof(uint32_t) + sizeof(uint32_t);
+    result += restarts_.size() * sizeof(uint32_t) + sizeof(uint32_t);
+    if (hash_index_) {
+      // Plus hash buckets and their count
+      result += hashes_.size() * 4 / 3 + 1 + sizeof(uint32_t);
+    }
+    return result;
   } else {
     return result;
   }
@@ -157,9 +190,37 @@ Slice BlockBuilder::Finish(CompressionType compression,
   uint32_t num_restarts = static_cast<uint32_t>(restarts_.size());
   // Remember the array size
   PutFixed32(&buffer_, num_restarts);
+  if (hash_index_) {
+    AppendHashIndex();
+  }
   return AbstractBlockBuilder::Finish(compression, force_compression);
 }
 
+uint32_t BlockBuilder::HashKey(const Slice& user_key) {
+  return Hash(user_key.data(), user_key.size(), 0x6b9d3c21);
+}
+
+// Buckets are sized for a load factor of about 0.75.
+void BlockBuilder::AppendHashIndex() {
+  uint32_t num_buckets = 0;
+  if (restarts_.size() <= kMaxHashIndexRestarts) {
+    num_buckets = static_cast<uint32_t>(hashes_.size() * 4 / 3 + 1);
+  }
+  const size_t start = buffer_.size();
+  buffer_.resize(start + num_buckets, static_cast<char>(kHashIndexNoEntry));
+  char* const buckets = &buffer_[start];
+  for (size_t i = 0; i < hashes_.size() && num_buckets != 0; i++) {
+    char* const b = &buckets[hashes_[i].first % num_buckets];
+    const uint8_t restart = static_cast<uint8_t>(hashes_[i].second);
+    if (static_cast<uint8_t>(*b) == kHashIndexNoEntry) {
+      *b = static_cast<char>(restart);
+    } else if (static_cast<uint8_t>(*b) != restart) {
+      *b = static_cast<char>(kHashIndexCollision);
+    }
+  }
+  PutFixed32(&buffer_, num_buckets);
+}
+
 Slice AbstractBlockBuilder::Finalize(bool crc32c, uint32_t padding_target,
                                      char padding_char) {
   assert(finished_);
@@ -214,6 +275,11 @@ void BlockBuilder::Add(const Slice& key, const Slice& value) {
   buffer_.append(key.data() + shared, non_shared);
   buffer_.append(value.data(), value.size());
 
+  if (hash_index_) {
+    const uint32_t restart = static_cast<uint32_t>(restarts_.size() - 1);
+    hashes_.push_back(std::make_pair(HashKey(ExtractUserKey(key)), restart));
+  }
+
   // Update state
   last_key_.resize(shared);
   last_key_.append(key.data() + shared, non_shared);
@@ -24,6 +24,7 @@
 #include "pdlfs-common/leveldb/table_properties.h"
 
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/rate_limiter.h"
 
 namespace pdlfs {
 
@@ -44,6 +45,10 @@ Status BuildTable(const std::string& dbname, Env* env, const DBOptions& options,
     if (!s.ok()) {
       return s;
     }
+    if (options.rate_limiter != NULL) {
+      file = new RateLimitedWritableFile(file, options.rate_limiter,
+                                         RateLimiter::kHigh);
+    }
 
     TableBuilder* builder = new TableBuilder(options, file);
     for (; iter->Valid(); iter->Next()) {
@@ -38,6 +38,7 @@
 #include "pdlfs-common/log_writer.h"
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
+#include "pdlfs-common/rate_limiter.h"
 #include "pdlfs-common/status.h"
 #include "pdlfs-common/strutil.h"
 
@@ -57,8 +58,20 @@ struct DBImpl::Writer {
   bool sync;
   bool done;
   port::CondVar cv;
+  // Set when the writer must insert its own batch into the memtable
+  WriteGroup* group;
 
-  explicit Writer(port::Mutex* mu) : cv(mu) {}
+  explicit Writer(port::Mutex* mu) : cv(mu), group(NULL) {}
+};
+
+// A group of writers whose batches have been logged together and are being
+// inserted into the memtable concurrently by the writers themselves.
+struct DBImpl::WriteGroup {
+  std::vector<Writer*> writers;
+  MemTable* mem;
+  SequenceNumber last_sequence;  // Last sequence number used by the group
+  Status status;                 // Result of logging the group
+  size_t pending;  // Number of writers that have not finished their insertion
 };
 
 struct DBImpl::CompactionState {
@@ -84,10 +97,30 @@ struct DBImpl::CompactionState {
 
   uint64_t total_bytes;
 
+  // User key range (begin, end] covered by a sub-compaction.  The range is
+  // unbounded on a side whose has_ flag is false.
+  bool has_begin;
+  std::string begin;
+  bool has_end;
+  std::string end;
+  Compaction::ScanState scan;
+  Status status;  // Result of a sub-compaction
+
+  // Micros spent by the compaction thread paused or doing imm_ compactions
+  int64_t paused_micros;
+  int64_t imm_micros;
+
   Output* current_output() { return &outputs[outputs.size() - 1]; }
 
   explicit CompactionState(Compaction* c)
-      : compaction(c), outfile(NULL), builder(NULL), total_bytes(0) {}
+      : compaction(c),
+        outfile(NULL),
+        builder(NULL),
+        total_bytes(0),
+        has_begin(false),
+        has_end(false),
+        paused_micros(0),
+        imm_micros(0) {}
 };
 
 struct DBImpl::InsertionState {
@@ -116,8 +149,10 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
     : env_(raw_options.env),
       internal_comparator_(raw_options.comparator),
       internal_filter_policy_(raw_options.filter_policy),
+      internal_prefix_extractor_(raw_options.prefix_extractor),
       options_(SanitizeOptions(dbname, &internal_comparator_,
-                               &internal_filter_policy_, raw_options, true)),
+                               &internal_filter_policy_,
+                               &internal_prefix_extractor_, raw_options, true)),
       owns_info_log_(options_.info_log != raw_options.info_log),
       owns_cache_(options_.block_cache != raw_options.block_cache),
       owns_table_cache_(options_.table_cache != raw_options.table_cache),
@@ -131,13 +166,14 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       logfile_number_(0),
       log_(NULL),
       seed_(0),
+      wal_syncing_(false),
       l0_soft_limits_(0),
       l0_hard_limits_(0),
       l0_waits_(0),
       bg_compaction_disabled_(0),
       bg_compaction_paused_(0),
       bg_compaction_scheduled_(false),
-      bg_compaction_in_progress_(false),
+      bg_compaction_in_progress_(0),
       bulk_insert_in_progress_(false),
       manual_compaction_(NULL) {
   if (!options_.no_memtable) {
@@ -444,13 +480,21 @@ Status DBImpl::Recover(VersionEdit* edit) {
 
     // Recover in the order in which the logs were generated
     std::sort(logs.begin(), logs.end());
-    for (size_t i = 0; i < logs.size(); i++) {
-      s = RecoverLogFile(logs[i], edit, &max_sequence);
-
+    if (options_.recovery_pool != NULL && !logs.empty()) {
       // The previous incarnation may not have written any MANIFEST
-      // records after allocating this log number.  So we manually
+      // records after allocating these log numbers.  So we manually
       // update the file number allocation counter in VersionSet.
-      versions_->MarkFileNumberUsed(logs[i]);
+      versions_->MarkFileNumberUsed(logs.back());
+      s = RecoverLogFiles(logs, edit, &max_sequence);
+    } else {
+      for (size_t i = 0; i < logs.size(); i++) {
+        s = RecoverLogFile(logs[i], edit, &max_sequence);
+
+        // The previous incarnation may not have written any MANIFEST
+        // records after allocating this log number.  So we manually
+        // update the file number allocation counter in VersionSet.
+        versions_->MarkFileNumberUsed(logs[i]);
+      }
     }
 
     if (s.ok()) {
@@ -467,7 +511,8 @@ Status DBImpl::Recover(VersionEdit* edit) {
 }
 
 Status DBImpl::RecoverLogFile(uint64_t log_number, VersionEdit* edit,
-                              SequenceNumber* max_sequence) {
+                              SequenceNumber* max_sequence,
+                              std::vector<MemTable*>* mems) {
   struct LogReporter : public log::Reader::Reporter {
     Env* env;
     Logger* info_log;
@@ -485,7 +530,9 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, VersionEdit* edit,
     }
   };
 
-  mutex_.AssertHeld();
+  if (mems == NULL) {
+    mutex_.AssertHeld();
+  }
 
   // Open the log file
   const std::string fname = LogFileName(dbname_, log_number);
@@ -540,6 +587,11 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, VersionEdit* edit,
     }
 
     if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
+      if (mems != NULL) {
+        mems->push_back(mem);
+        mem = NULL;
+        continue;
+      }
       status = DumpMemTable(mem, edit, NULL);
       if (!status.ok()) {
         // Reflect errors immediately so that conditions like full
@@ -552,9 +604,14 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, VersionEdit* edit,
   }
 
   if (status.ok() && mem != NULL) {
-    status = DumpMemTable(mem, edit, NULL);
-    // Reflect errors immediately so that conditions like full
-    // file-systems cause the DB::Open() to fail.
+    if (mems != NULL) {
+      mems->push_back(mem);
+      mem = NULL;
+    } else {
+      status = DumpMemTable(mem, edit, NULL);
+      // Reflect errors immediately so that conditions like full
+      // file-systems cause the DB::Open() to fail.
+    }
   }
 
   if (mem != NULL) mem->Unref();
@@ -562,6 +619,181 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, VersionEdit* edit,
   return status;
 }
 
+// Shared state of a parallel replay of write-ahead logs. Owned jointly by the
+// thread opening the db and the pool tasks scheduled for the replay. The
+// replay reads all logs into memtables and then writes all memtables to
+// tables whose numbers have been allocated in log order beforehand.
+struct DBImpl::LogReplayJob {
+  struct Log {
+    uint64_t number;
+    SequenceNumber max_sequence;
+    std::vector<MemTable*> mems;
+    Status status;
+  };
+  struct Table {
+    MemTable* mem;
+    FileMetaData meta;
+    Status status;
+  };
+  DBImpl* db;
+  std::vector<Log> logs;
+  std::vector<Table> tables;  // Set once all logs have been read
+  bool building;              // Logs have been read
+  size_t next;                // Index of the next log or table to be picked up
+  size_t num_done;            // Number of logs or tables finished
+  int refs;
+  port::Mutex mu;
+  port::CondVar cv;
+
+  explicit LogReplayJob(DBImpl* d)
+      : db(d), building(false), next(0), num_done(0), refs(0), cv(&mu) {}
+
+  void Unref() {
+    mu.Lock();
+    const int r = --refs;
+    mu.Unlock();
+    if (r == 0) {
+      delete this;
+    }
+  }
+};
+
+void DBImpl::BGLogReplay(void* arg) {
+  LogReplayJob* const job = reinterpret_cast<LogReplayJob*>(arg);
+  RunLogReplay(job);
+  job->Unref();
+}
+
+// Read logs or write tables until there is nothing left to pick up. Pool
+// tasks scheduled for reading logs may end up writing tables.
+void DBImpl::RunLogReplay(LogReplayJob* job) {
+  DBImpl* const db = job->db;
+  while (true) {
+    job->mu.Lock();
+    const bool building = job->building;
+    const size_t n = building ? job->tables.size() : job->logs.size();
+    if (job->next >= n) {
+      job->mu.Unlock();
+      break;
+    }
+    const size_t i = job->next++;
+    job->mu.Unlock();
+    if (!building) {
+      LogReplayJob::Log* const log = &job->logs[i];
+      log->status = db->RecoverLogFile(log->number, NULL, &log->max_sequence,
+                                       &log->mems);
+    } else {
+      LogReplayJob::Table* const t = &job->tables[i];
+      SequenceNumber ignored_min_seq;
+      SequenceNumber ignored_max_seq;
+      Iterator* const iter = t->mem->NewIterator();
+      t->status =
+          BuildTable(db->dbname_, db->env_, db->options_, db->table_cache_,
+                     iter, &ignored_min_seq, &ignored_max_seq, &t->meta);
+      delete iter;
+    }
+    job->mu.Lock();
+    job->num_done++;
+    job->cv.SignalAll();
+    job->mu.Unlock();
+  }
+}
+
+// Replay "logs" in parallel using the recovery pool. Tables written are
+// added to Level-0 in log order so that newer tables keep larger numbers.
+// REQUIRES: mutex_ has been locked.
+Status DBImpl::RecoverLogFiles(const std::vector<uint64_t>& logs,
+                               VersionEdit* edit,
+                               SequenceNumber* max_sequence) {
+  mutex_.AssertHeld();
+  const uint64_t start_micros = CurrentMicros();
+  LogReplayJob* const job = new LogReplayJob(this);
+  job->logs.resize(logs.size());
+  for (size_t i = 0; i < logs.size(); i++) {
+    job->logs[i].number = logs[i];
+    job->logs[i].max_sequence = 0;
+  }
+  // One reference for us and one for each pool task
+  job->refs = static_cast<int>(logs.size());
+  mutex_.Unlock();
+  for (size_t i = 1; i < logs.size(); i++) {
+    options_.recovery_pool->Schedule(&DBImpl::BGLogReplay, job);
+  }
+  RunLogReplay(job);
+  job->mu.Lock();
+  while (job->num_done < job->logs.size()) {
+    job->cv.Wait();
+  }
+  job->mu.Unlock();
+  mutex_.Lock();
+
+  Status s;
+  std::vector<MemTable*> mems;
+  for (size_t i = 0; i < job->logs.size(); i++) {
+    LogReplayJob::Log* const log = &job->logs[i];
+    if (s.ok()) {
+      s = log->status;
+    }
+    if (s.ok() && log->max_sequence > *max_sequence) {
+      *max_sequence = log->max_sequence;
+    }
+    mems.insert(mems.end(), log->mems.begin(), log->mems.end());
+  }
+
+  if (s.ok() && !mems.empty()) {
+    job->mu.Lock();
+    job->tables.resize(mems.size());
+    for (size_t i = 0; i < mems.size(); i++) {
+      LogReplayJob::Table* const t = &job->tables[i];
+      t->mem = mems[i];
+      t->meta.number = versions_->NewFileNumber();
+      pending_outputs_.insert(t->meta.number);
+    }
+    job->building = true;
+    job->next = 0;
+    job->num_done = 0;
+    job->refs += static_cast<int>(mems.size()) - 1;
+    job->mu.Unlock();
+    mutex_.Unlock();
+    for (size_t i = 1; i < mems.size(); i++) {
+      options_.recovery_pool->Schedule(&DBImpl::BGLogReplay, job);
+    }
+    RunLogReplay(job);
+    job->mu.Lock();
+    while (job->num_done < job->tables.size()) {
+      job->cv.Wait();
+    }
+    job->mu.Unlock();
+    mutex_.Lock();
+
+    CompactionStats stats;
+    for (size_t i = 0; i < job->tables.size(); i++) {
+      LogReplayJob::Table* const t = &job->tables[i];
+      pending_outputs_.erase(t->meta.number);
+      if (s.ok()) {
+        s = t->status;
+      }
+      // Note that if file_size is zero, the file has been deleted and
+      // should not be added to the manifest.
+      if (s.ok() && t->meta.file_size > 0) {
+        edit->AddFile(0, t->meta.number, t->meta.file_size, t->meta.seq_off,
+                      t->meta.smallest, t->meta.largest);
+        stats.bytes_written += t->meta.file_size;
+        stats.files++;
+      }
+    }
+    stats.n = static_cast<int64_t>(job->tables.size());
+    stats.micros = CurrentMicros() - start_micros;
+    stats_[0].Add(stats);
+  }
+
+  for (size_t i = 0; i < mems.size(); i++) {
+    mems[i]->Unref();
+  }
+  job->Unref();
+  return s;
+}
+
 // REQUIRES: mutex_ has been locked.
 Status DBImpl::DumpMemTable(MemTable* mem, VersionEdit* edit, Version* base) {
   mutex_.AssertHeld();
@@ -820,10 +1052,10 @@ void DBImpl::BackgroundCall() {
 }
 
 void DBImpl::BackgroundCompactionWrapper() {
-  assert(!bg_compaction_in_progress_);
-  bg_compaction_in_progress_ = true;
+  assert(bg_compaction_in_progress_ == 0);
+  bg_compaction_in_progress_++;
   BackgroundCompaction();
-  bg_compaction_in_progress_ = false;
+  bg_compaction_in_progress_--;
 }
 
 void DBImpl::BackgroundCompaction() {
@@ -954,6 +1186,10 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   // Make the output file
   std::string fname = TableFileName(dbname_, file_number);
   Status s = env_->NewWritableFile(fname.c_str(), &compact->outfile);
+  if (s.ok() && options_.rate_limiter != NULL) {
+    compact->outfile = new RateLimitedWritableFile(
+        compact->outfile, options_.rate_limiter, RateLimiter::kLow);
+  }
   if (s.ok()) {
     compact->builder = new TableBuilder(options_, compact->outfile);
   }
@@ -1040,38 +1276,159 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
   return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
 }
 
-Status DBImpl::DoCompactionWork(CompactionState* compact) {
-  const uint64_t start_micros = CurrentMicros();
-  int64_t paused_micros = 0;
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
-#if VERBOSE >= 4
-  Log(options_.info_log, 4, "Compacting %d@%d + %d@%d files ...",
-      compact->compaction->num_input_files(0), compact->compaction->level(),
-      compact->compaction->num_input_files(1),
-      compact->compaction->level() + 1);
-#endif
-  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
-  assert(compact->builder == NULL);
-  assert(compact->outfile == NULL);
-  if (snapshots_.empty()) {
-    compact->smallest_snapshot = versions_->LastSequence();
-  } else {
-    compact->smallest_snapshot = snapshots_.oldest()->number_;
+// Shared state of the sub-compactions of a single compaction job. Owned
+// jointly by the compaction thread and the pool tasks scheduled for the job.
+struct DBImpl::SubCompactionJob {
+  DBImpl* db;
+  std::vector<CompactionState*> subs;
+  size_t next;      // Index of the next sub-compaction to be picked up
+  size_t num_done;  // Number of sub-compactions finished
+  int refs;
+  port::Mutex mu;
+  port::CondVar cv;
+
+  explicit SubCompactionJob(DBImpl* d)
+      : db(d), next(0), num_done(0), refs(0), cv(&mu) {}
+
+  void Unref() {
+    mu.Lock();
+    const int r = --refs;
+    mu.Unlock();
+    if (r == 0) {
+      delete this;
+    }
   }
+};
 
-  // Release mutex while we're actually doing the compaction work
+void DBImpl::BGSubCompaction(void* arg) {
+  SubCompactionJob* const job = reinterpret_cast<SubCompactionJob*>(arg);
+  RunSubCompactions(job, false);
+  job->Unref();
+}
+
+// Process sub-compactions of a job until there is nothing left to pick up.
+// The db is only accessed after a sub-compaction has been picked up, so pool
+// tasks that run after the job has completed are harmless.
+void DBImpl::RunSubCompactions(SubCompactionJob* job, bool is_main) {
+  while (true) {
+    job->mu.Lock();
+    if (job->next >= job->subs.size()) {
+      job->mu.Unlock();
+      break;
+    }
+    CompactionState* const sub = job->subs[job->next++];
+    job->mu.Unlock();
+    sub->status = job->db->DoCompactionRange(sub, is_main);
+    job->mu.Lock();
+    job->num_done++;
+    job->cv.SignalAll();
+    job->mu.Unlock();
+  }
+}
+
+// Compact the key ranges separated by "splits" in parallel and gather their
+// outputs into *compact.
+// REQUIRES: mutex_ is not held
+Status DBImpl::DoSubCompactions(CompactionState* compact,
+                                const std::vector<std::string>& splits) {
+  SubCompactionJob* const job = new SubCompactionJob(this);
+  for (size_t i = 0; i <= splits.size(); i++) {
+    CompactionState* const sub = new CompactionState(compact->compaction);
+    sub->smallest_snapshot = compact->smallest_snapshot;
+    if (i > 0) {
+      sub->has_begin = true;
+      sub->begin = splits[i - 1];
+    }
+    if (i < splits.size()) {
+      sub->has_end = true;
+      sub->end = splits[i];
+    }
+    job->subs.push_back(sub);
+  }
+  // One reference for us and one for each pool task
+  job->refs = static_cast<int>(job->subs.size());
+  for (size_t i = 1; i < job->subs.size(); i++) {
+    options_.subcompaction_pool->Schedule(&DBImpl::BGSubCompaction, job);
+  }
+  RunSubCompactions(job, true);
+  // We are no longer doing compaction work while waiting for the pool, so
+  // do not block those that want to pause compaction
+  mutex_.Lock();
+  assert(bg_compaction_in_progress_ > 0);
+  bg_compaction_in_progress_--;
+  bg_cv_.SignalAll();
   mutex_.Unlock();
+  job->mu.Lock();
+  while (job->num_done < job->subs.size()) {
+    job->cv.Wait();
+  }
+  job->mu.Unlock();
+
+  Status status;
+  for (size_t i = 0; i < job->subs.size(); i++) {
+    if (!job->subs[i]->status.ok()) {
+      status = job->subs[i]->status;
+      break;
+    }
+  }
+  mutex_.Lock();
+  while (bg_compaction_paused_) {
+    bg_cv_.Wait();
+  }
+  bg_compaction_in_progress_++;
+  for (size_t i = 0; i < job->subs.size(); i++) {
+    CompactionState* const sub = job->subs[i];
+    if (status.ok()) {
+      // Outputs of sub-compactions are disjoint and ordered by key range
+      compact->outputs.insert(compact->outputs.end(), sub->outputs.begin(),
+                              sub->outputs.end());
+      compact->total_bytes += sub->total_bytes;
+      sub->outputs.clear();
+    }
+    compact->paused_micros += sub->paused_micros;
+    compact->imm_micros += sub->imm_micros;
+    CleanupCompaction(sub);
+  }
+  mutex_.Unlock();
+  job->Unref();
+  return status;
+}
 
+// Compact the portion of the compaction input that falls into the key range
+// of *compact.  Only the main compaction thread performs memtable
+// compactions in the middle of the work.
+// REQUIRES: mutex_ is not held
+Status DBImpl::DoCompactionRange(CompactionState* compact, bool is_main) {
+  if (!is_main) {
+    mutex_.Lock();
+    while (bg_compaction_paused_) {
+      bg_cv_.Wait();
+    }
+    bg_compaction_in_progress_++;
+    mutex_.Unlock();
+  }
+
+  const Comparator* const ucmp = user_comparator();
   Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
   Status status;
   ParsedInternalKey ikey;
+  if (compact->has_begin) {
+    // Skip all entries of the begin key which belong to the previous range
+    InternalKey start(compact->begin, 0, kTypeDeletion);
+    input->Seek(start.Encode());
+    while (input->Valid() && ParseInternalKey(input->key(), &ikey) &&
+           ucmp->Compare(ikey.user_key, compact->begin) == 0) {
+      input->Next();
+    }
+  } else {
+    input->SeekToFirst();
+  }
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   for (; input->Valid() && !shutting_down_.Acquire_Load();) {
     // Prioritize memtable compactions and bulk insertion work
-    if (has_imm_.NoBarrier_Load() != NULL) {
+    if (is_main && has_imm_.NoBarrier_Load() != NULL) {
       const uint64_t imm_start = CurrentMicros();
       mutex_.Lock();
       if (imm_ != NULL) {
@@ -1079,24 +1436,31 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
       }
       mutex_.Unlock();
-      imm_micros += (CurrentMicros() - imm_start);
+      compact->imm_micros += (CurrentMicros() - imm_start);
     }
     if (bg_compaction_paused_) {
       const uint64_t pause_start = CurrentMicros();
       mutex_.Lock();
-      assert(bg_compaction_in_progress_);
-      bg_compaction_in_progress_ = false;
+      assert(bg_compaction_in_progress_ > 0);
+      bg_compaction_in_progress_--;
       bg_cv_.SignalAll();
       while (bg_compaction_paused_) {
         bg_cv_.Wait();
       }
-      bg_compaction_in_progress_ = true;
+      bg_compaction_in_progress_++;
       mutex_.Unlock();
-      paused_micros += (CurrentMicros() - pause_start);
+      if (is_main) {
+        compact->paused_micros += (CurrentMicros() - pause_start);
+      }
     }
 
     Slice key = input->key();
-    if (compact->compaction->ShouldStopBefore(key) &&
+    if (compact->has_end && ParseInternalKey(key, &ikey) &&
+        ucmp->Compare(ikey.user_key, compact->end) > 0) {
+      // Reached the end of our key range
+      break;
+    }
+    if (compact->compaction->ShouldStopBefore(key, &compact->scan) &&
         compact->builder != NULL) {
       status = FinishCompactionOutputFile(compact, input);
       if (!status.ok()) {
@@ -1113,8 +1477,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       last_sequence_for_key = kMaxSequenceNumber;
     } else {
       if (!has_current_user_key ||
-          user_comparator()->Compare(ikey.user_key, Slice(current_user_key)) !=
-              0) {
+          ucmp->Compare(ikey.user_key, Slice(current_user_key)) != 0) {
         // First occurrence of this user key
         current_user_key.assign(ikey.user_key.data(), ikey.user_key.size());
         has_current_user_key = true;
@@ -1126,7 +1489,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         drop = true;  // (A)
       } else if (ikey.type == kTypeDeletion &&
                  ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                        &compact->scan)) {
         // For this user key:
         // (1) there is no data in higher levels
         // (2) data in lower levels will have larger sequence numbers
@@ -1185,8 +1549,50 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   delete input;
   input = NULL;
 
+  if (!is_main) {
+    mutex_.Lock();
+    assert(bg_compaction_in_progress_ > 0);
+    bg_compaction_in_progress_--;
+    bg_cv_.SignalAll();
+    mutex_.Unlock();
+  }
+  return status;
+}
+
+Status DBImpl::DoCompactionWork(CompactionState* compact) {
+  const uint64_t start_micros = CurrentMicros();
+#if VERBOSE >= 4
+  Log(options_.info_log, 4, "Compacting %d@%d + %d@%d files ...",
+      compact->compaction->num_input_files(0), compact->compaction->level(),
+      compact->compaction->num_input_files(1),
+      compact->compaction->level() + 1);
+#endif
+  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
+  assert(compact->builder == NULL);
+  assert(compact->outfile == NULL);
+  if (snapshots_.empty()) {
+    compact->smallest_snapshot = versions_->LastSequence();
+  } else {
+    compact->smallest_snapshot = snapshots_.oldest()->number_;
+  }
+  std::vector<std::string> splits;
+  if (options_.subcompaction_pool != NULL && options_.max_subcompactions > 1) {
+    compact->compaction->GetSplitPoints(options_.max_subcompactions, &splits);
+  }
+
+  // Release mutex while we're actually doing the compaction work
+  mutex_.Unlock();
+
+  Status status;
+  if (splits.empty()) {
+    status = DoCompactionRange(compact, true);
+  } else {
+    status = DoSubCompactions(compact, splits);
+  }
+
   CompactionStats stats;
-  stats.micros = CurrentMicros() - start_micros - paused_micros - imm_micros;
+  stats.micros = CurrentMicros() - start_micros - compact->paused_micros -
+                 compact->imm_micros;
   stats.in0 = compact->compaction->num_input_files(0);
   stats.in1 = compact->compaction->num_input_files(1);
   for (int which = 0; which < 2; which++) {
@@ -1398,6 +1804,7 @@ Iterator* DBImpl::NewIterator(const ReadOptions& options) {
       (options.snapshot != NULL
            ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
            : latest_snapshot),
+      options.prefix,
       seed);
 }
 
@@ -1446,11 +1853,24 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   // commit all writes in the queue making writing more efficient.
   MutexLock l(&mutex_);
   writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
+  while (!w.done && w.group == NULL && &w != writers_.front()) {
     w.cv.Wait();
   }
   if (w.done) {
     return w.status;
+  } else if (w.group != NULL) {
+    return ApplyWriteGroup(&w);
+  }
+
+  // Sync writes of a pipelined write ahead log are appended to the log and
+  // inserted into mem_ while earlier groups are still being synced. All other
+  // writes must wait for those groups to be published first.
+  const bool pipelined = options_.pipelined_wal_sync && w.sync &&
+                         my_batch != &sync_wal_ && my_batch != &flush_memtable_;
+  if (!pipelined) {
+    while (!syncing_groups_.empty()) {
+      bg_cv_.Wait();
+    }
   }
 
   Status status;
@@ -1466,10 +1886,31 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
       // current batch. If we do so we will update last_writer accordingly.
       WriteBatch* const final_batch = BuildBatchGroup(&last_writer);
       uint64_t last_sequence = versions_->LastSequence();
+      if (!applying_groups_.empty()) {
+        // Sequence numbers already handed out to groups still being applied
+        last_sequence = applying_groups_.back()->last_sequence;
+      } else if (!syncing_groups_.empty()) {
+        // Sequence numbers already handed out to groups still being synced
+        last_sequence = syncing_groups_.back()->last_sequence;
+      }
       WriteBatchInternal::SetSequence(final_batch, last_sequence + 1);
       last_sequence += WriteBatchInternal::Count(final_batch);
 
       if (!options_.no_memtable) {
+        const bool concurrent = options_.concurrent_memtable_inserts;
+        if (concurrent && final_batch != w.batch) {
+          // Each writer will insert its own batch so each batch must carry
+          // its own starting sequence number.
+          SequenceNumber seq = WriteBatchInternal::Sequence(final_batch);
+          for (std::deque<Writer*>::iterator it = writers_.begin();; ++it) {
+            WriteBatchInternal::SetSequence((*it)->batch, seq);
+            seq += WriteBatchInternal::Count((*it)->batch);
+            if (*it == last_writer) {
+              break;
+            }
+          }
+          assert(seq == last_sequence + 1);
+        }
         bool sync_error = false;
         // Add to log and apply to memtable. We can release the lock during
         // this phase since &w is currently responsible for logging and
@@ -1478,14 +1919,18 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
         mutex_.Unlock();
         if (!options_.disable_write_ahead_log) {
           status = log_->AddRecord(WriteBatchInternal::Contents(final_batch));
-          if (status.ok() && options.sync) {
-            status = logfile_->Sync();
-            if (!status.ok()) {
-              sync_error = true;
+          if (status.ok() && !pipelined) {
+            if (options.sync) {
+              status = log_->Sync();
+              if (!status.ok()) {
+                sync_error = true;
+              }
+            } else {
+              status = log_->Flush();
             }
           }
         }
-        if (status.ok()) {
+        if (status.ok() && !concurrent) {
           status = WriteBatchInternal::InsertInto(final_batch, mem_);
         }
         mutex_.Lock();
@@ -1496,6 +1941,64 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
           RecordBackgroundError(status);
         }
 
+        if (concurrent) {
+          if (final_batch == &tmp_batch_) {
+            final_batch->Clear();
+          }
+          // Hand the group over to its writers and let the next writer start
+          // logging while the group is being inserted into the memtable.
+          // mem_ cannot be switched until all applying groups are published.
+          WriteGroup group;
+          group.mem = mem_;
+          group.last_sequence = last_sequence;
+          group.status = status;
+          while (true) {
+            Writer* ready = writers_.front();
+            writers_.pop_front();
+            group.writers.push_back(ready);
+            ready->group = &group;
+            if (ready != &w) {
+              ready->cv.Signal();
+            }
+            if (ready == last_writer) {
+              break;
+            }
+          }
+          group.pending = group.writers.size();
+          applying_groups_.push_back(&group);
+          if (!writers_.empty()) {
+            writers_.front()->cv.Signal();
+          }
+          // Returns only after the group has been published, so group
+          // outlives all its uses.
+          return ApplyWriteGroup(&w);
+        } else if (pipelined) {
+          if (final_batch == &tmp_batch_) {
+            final_batch->Clear();
+          }
+          // Queue the group for the next log sync and let the next writer
+          // start logging while the sync is in progress. Followers stay
+          // blocked until the group is published.
+          WriteGroup group;
+          group.mem = mem_;
+          group.last_sequence = last_sequence;
+          group.status = status;
+          group.pending = 1;  // Cleared once the group is synced
+          while (true) {
+            Writer* ready = writers_.front();
+            writers_.pop_front();
+            group.writers.push_back(ready);
+            if (ready == last_writer) {
+              break;
+            }
+          }
+          syncing_groups_.push_back(&group);
+          if (!writers_.empty()) {
+            writers_.front()->cv.Signal();
+          }
+          return SyncWriteGroup(&w, &group);
+        }
+
         versions_->SetLastSequence(last_sequence);
       } else {
         // If there are no memtables, we directly generate an L0 table for the
@@ -1540,7 +2043,7 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
     if (!options_.disable_write_ahead_log) {
       bool sync_error = false;
       mutex_.Unlock();
-      status = logfile_->Sync();
+      status = log_->Sync();
       if (!status.ok()) {
         sync_error = true;
       }
@@ -1572,6 +2075,102 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   return status;
 }
 
+// Insert the batch of a writer into the memtable of its write group. Waits
+// until the group is published before returning.
+// REQUIRES: mutex_ is held
+// REQUIRES: w->group is not NULL
+Status DBImpl::ApplyWriteGroup(Writer* w) {
+  mutex_.AssertHeld();
+  WriteGroup* const group = w->group;
+  assert(group != NULL);
+  if (group->status.ok()) {
+    mutex_.Unlock();
+    Status s = WriteBatchInternal::InsertInto(w->batch, group->mem, true);
+    mutex_.Lock();
+    w->status = s;
+  } else {
+    w->status = group->status;
+  }
+
+  assert(group->pending > 0);
+  group->pending--;
+  if (group->pending == 0) {
+    PublishWriteGroups();
+  }
+  while (!w->done) {
+    w->cv.Wait();
+  }
+  return w->status;
+}
+
+// Make the updates of all fully applied write groups at the front of the
+// applying queue visible to readers, in sequence number order.
+// REQUIRES: mutex_ is held
+void DBImpl::PublishWriteGroups() {
+  mutex_.AssertHeld();
+  while (!applying_groups_.empty() && applying_groups_.front()->pending == 0) {
+    WriteGroup* const group = applying_groups_.front();
+    applying_groups_.pop_front();
+    versions_->SetLastSequence(group->last_sequence);
+    for (size_t i = 0; i < group->writers.size(); i++) {
+      Writer* const ready = group->writers[i];
+      ready->done = true;
+      ready->cv.Signal();
+    }
+  }
+  if (applying_groups_.empty()) {
+    bg_cv_.SignalAll();
+  }
+}
+
+// Wait until a write group logged to a pipelined write ahead log is synced
+// and published. The first waiter to find no sync in progress syncs the log
+// on behalf of all groups logged so far, so a single fsync commits many
+// groups while the next groups are being logged.
+// REQUIRES: mutex_ is held
+// REQUIRES: group has been added to syncing_groups_ by w
+Status DBImpl::SyncWriteGroup(Writer* w, WriteGroup* group) {
+  mutex_.AssertHeld();
+  while (group->pending != 0) {
+    if (!wal_syncing_) {
+      wal_syncing_ = true;
+      // All groups queued so far have their records in the log buffer
+      const size_t n = syncing_groups_.size();
+      mutex_.Unlock();
+      Status s = log_->Sync();
+      mutex_.Lock();
+      if (!s.ok()) {
+        // The state of the log file is unclear (see DBImpl::Write)
+        RecordBackgroundError(s);
+      }
+      for (size_t i = 0; i < n; i++) {
+        WriteGroup* const synced = syncing_groups_.front();
+        syncing_groups_.pop_front();
+        versions_->SetLastSequence(synced->last_sequence);
+        if (synced->status.ok()) {
+          synced->status = s;
+        }
+        synced->pending = 0;
+      }
+      wal_syncing_ = false;
+      bg_cv_.SignalAll();
+    } else {
+      bg_cv_.Wait();
+    }
+  }
+
+  for (size_t i = 0; i < group->writers.size(); i++) {
+    Writer* const ready = group->writers[i];
+    if (ready != w) {
+      ready->status = group->status;
+      ready->done = true;
+      ready->cv.Signal();
+    }
+  }
+
+  return group->status;
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-NULL batch
 WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
@@ -1673,6 +2272,12 @@ Status DBImpl::MakeRoomForWrite(bool force) {
 #endif
       bg_cv_.Wait();
       l0_hard_limits_++;
+    } else if (!applying_groups_.empty()) {
+      // Earlier write groups are still being inserted into mem_
+      bg_cv_.Wait();
+    } else if (!syncing_groups_.empty()) {
+      // Earlier write groups are still waiting for their log sync
+      bg_cv_.Wait();
     } else if (!options_.no_memtable) {
       // Close the current log file and open a new one
       if (!options_.disable_write_ahead_log) {
@@ -1693,7 +2298,7 @@ Status DBImpl::MakeRoomForWrite(bool force) {
         delete logfile_;  // This closes the file
         logfile_ = file;
         logfile_number_ = new_log_number;
-        log_ = new log::Writer(file);
+        log_ = new log::Writer(file, 0, options_.pipelined_wal_sync);
       }
 
       // Attempt to switch to a new memtable and
@@ -1719,7 +2324,8 @@ Status DBImpl::BulkInsert(Iterator* iter) {
   MutexLock l(&mutex_);
   // Temporarily block any background compaction
   bg_compaction_paused_++;
-  while (bg_compaction_in_progress_ || bulk_insert_in_progress_) {
+  while (bg_compaction_in_progress_ || bulk_insert_in_progress_ ||
+         !applying_groups_.empty() || !syncing_groups_.empty()) {
     bg_cv_.Wait();
   }
 
@@ -2077,7 +2683,8 @@ Status DBImpl::AddL0Tables(const InsertOptions& options,
     MutexLock l(&mutex_);
     // Temporarily block any background compaction
     bg_compaction_paused_++;
-    while (bg_compaction_in_progress_ || bulk_insert_in_progress_) {
+    while (bg_compaction_in_progress_ || bulk_insert_in_progress_ ||
+           !applying_groups_.empty() || !syncing_groups_.empty()) {
       bg_cv_.Wait();
     }
 
@@ -2219,7 +2826,8 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
         edit.SetLogNumber(new_log_number);
         impl->logfile_ = file;
         impl->logfile_number_ = new_log_number;
-        impl->log_ = new log::Writer(file);
+        impl->log_ =
+            new log::Writer(file, 0, impl->options_.pipelined_wal_sync);
       }
     }
     if (s.ok()) {
@@ -38,6 +38,7 @@ namespace pdlfs {
 extern DBOptions SanitizeOptions(const std::string& dbname,
                                  const InternalKeyComparator* icmp,
                                  const InternalFilterPolicy* ipolicy,
+                                 const InternalPrefixExtractor* iprefix,
                                  const DBOptions& raw_options,
                                  bool create_infolog);
 class MemTable;
@@ -100,8 +101,11 @@ class DBImpl : public DB {
  protected:
   friend class DB;
   struct CompactionState;
+  struct SubCompactionJob;
+  struct LogReplayJob;
   struct InsertionState;
   struct Writer;
+  struct WriteGroup;
 
   Status Get(const ReadOptions&, const Slice& key, Buffer* buf);
   // The snapshots specified in read options are ignored by the following calls
@@ -129,8 +133,16 @@ class DBImpl : public DB {
   // log-file/memtable and writes a new descriptor iff successful.
   // Errors are recorded in bg_error_.
   void CompactMemTable();
+  // Replay a log into memtables. Full memtables are written to Level-0
+  // tables and added to *edit if mems is NULL. Otherwise, they are
+  // appended to *mems without writing them and mutex_ is not required.
   Status RecoverLogFile(uint64_t log_number, VersionEdit* edit,
-                        SequenceNumber* max_sequence);
+                        SequenceNumber* max_sequence,
+                        std::vector<MemTable*>* mems = NULL);
+  Status RecoverLogFiles(const std::vector<uint64_t>& logs, VersionEdit* edit,
+                         SequenceNumber* max_sequence);
+  static void RunLogReplay(LogReplayJob* job);
+  static void BGLogReplay(void* job);
 
   Status DumpMemTable(MemTable* mem, VersionEdit* edit, Version* base);
   Status WriteLevel0Table(Iterator* iter, VersionEdit* edit, Version* base,
@@ -138,6 +150,9 @@ class DBImpl : public DB {
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
+  Status ApplyWriteGroup(Writer* w);
+  Status SyncWriteGroup(Writer* w, WriteGroup* group);
+  void PublishWriteGroups();
 
   void RecordBackgroundError(const Status& s);
 
@@ -149,6 +164,11 @@ class DBImpl : public DB {
   void BackgroundCompaction();
   void CleanupCompaction(CompactionState* compact);
   Status DoCompactionWork(CompactionState* compact);
+  Status DoCompactionRange(CompactionState* compact, bool is_main);
+  Status DoSubCompactions(CompactionState* compact,
+                          const std::vector<std::string>& splits);
+  static void RunSubCompactions(SubCompactionJob* job, bool is_main);
+  static void BGSubCompaction(void* job);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
@@ -162,6 +182,7 @@ class DBImpl : public DB {
   Env* const env_;
   const InternalKeyComparator internal_comparator_;
   const InternalFilterPolicy internal_filter_policy_;
+  const InternalPrefixExtractor internal_prefix_extractor_;
   const Options options_;  // options_.comparator == &internal_comparator_
   bool owns_info_log_;
   bool owns_cache_;
@@ -192,6 +213,15 @@ class DBImpl : public DB {
   WriteBatch sync_wal_;        // Dummy batch representing a WAL sync request
   // Temporary storage for grouping write batches
   WriteBatch tmp_batch_;
+  // Write groups that have been logged and are being inserted into mem_
+  // concurrently by their writers, oldest first.  Only used when
+  // options_.concurrent_memtable_inserts is true.
+  std::deque<WriteGroup*> applying_groups_;
+  // Write groups that have been logged and inserted into mem_ but are still
+  // waiting for a log sync, oldest first. Only used when
+  // options_.pipelined_wal_sync is true.
+  std::deque<WriteGroup*> syncing_groups_;
+  bool wal_syncing_;  // Is a log sync in progress on behalf of syncing groups?
   // Number of time a writer is soft limited, hard limited, or waits for buffer
   // room
   uint64_t l0_soft_limits_;
@@ -212,9 +242,10 @@ class DBImpl : public DB {
   unsigned int bg_compaction_paused_;
   // Has a background compaction been scheduled and not yet completed?
   bool bg_compaction_scheduled_;
-  // Is there an active background compaction job? Background compaction work
-  // may be paused (inactive) in the middle
-  bool bg_compaction_in_progress_;
+  // Number of threads actively doing background compaction work (a
+  // compaction job may run sub-compactions in parallel). Background
+  // compaction work may be paused (inactive) in the middle
+  int bg_compaction_in_progress_;
   // Is there an active foreground bulk insertion job?
   bool bulk_insert_in_progress_;
 
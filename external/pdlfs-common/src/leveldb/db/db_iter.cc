@@ -59,11 +59,12 @@ class DBIter : public Iterator {
   enum Direction { kForward, kReverse };
 
   DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
-         uint32_t seed)
+         const Slice& prefix, uint32_t seed)
       : db_(db),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        prefix_(prefix.data(), prefix.size()),
         direction_(kForward),
         valid_(false),
         rnd_(seed),
@@ -97,6 +98,16 @@ class DBIter : public Iterator {
   void FindPrevUserEntry();
   bool ParseKey(ParsedInternalKey* key);
 
+  // Return <0, 0, or >0 if "user_key" sorts before, starts with, or sorts
+  // after all keys with prefix_.  Always 0 when there is no prefix.
+  int ComparePrefix(const Slice& user_key) const {
+    if (prefix_.empty() || user_key.starts_with(prefix_)) {
+      return 0;
+    } else {
+      return user_comparator_->Compare(user_key, prefix_);
+    }
+  }
+
   inline void SaveKey(const Slice& k, std::string* dst) {
     dst->assign(k.data(), k.size());
   }
@@ -117,6 +128,8 @@ class DBIter : public Iterator {
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
+  // If non-empty, only keys starting with prefix_ are yielded
+  const std::string prefix_;
 
   Status status_;
   std::string saved_key_;    // == current key when direction_==kReverse
@@ -184,6 +197,13 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   do {
     ParsedInternalKey ikey;
     if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+      const int r = ComparePrefix(ikey.user_key);
+      if (r > 0) {
+        break;  // Past all keys with the prefix
+      } else if (r < 0) {
+        iter_->Next();
+        continue;
+      }
       switch (ikey.type) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
@@ -244,6 +264,13 @@ void DBIter::FindPrevUserEntry() {
     do {
       ParsedInternalKey ikey;
       if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+        const int r = ComparePrefix(ikey.user_key);
+        if (r < 0) {
+          break;  // Before all keys with the prefix
+        } else if (r > 0) {
+          iter_->Prev();
+          continue;
+        }
         if ((value_type != kTypeDeletion) &&
             user_comparator_->Compare(ikey.user_key, saved_key_) < 0) {
           // We encountered a non-deleted value in entries for previous keys,
@@ -319,8 +346,10 @@ Iterator* NewDBIterator(
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
     SequenceNumber sequence,
+    const Slice& prefix,
     uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+  return new DBIter(db, user_key_comparator, internal_iter, sequence, prefix,
+                    seed);
 }
 
 /* clang-format on */
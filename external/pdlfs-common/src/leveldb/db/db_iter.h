@@ -27,9 +27,10 @@ class DBImpl;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number into
-// appropriate user keys.
+// appropriate user keys.  If "prefix" is non-empty, only user keys starting
+// with it are returned.
 extern Iterator* NewDBIterator(  ///
     DBImpl* db, const Comparator* user_key_comparator, Iterator* internal_iter,
-    SequenceNumber sequence, uint32_t seed);
+    SequenceNumber sequence, const Slice& prefix, uint32_t seed);
 
 }  // namespace pdlfs
@@ -208,17 +208,30 @@ class DBTest {
   const FilterPolicy* filter_policy_;
 
   // Sequence of option configurations to try
-  enum OptionConfig { kDefault, kFilter, kUncompressed, kEnd };
+  enum OptionConfig {
+    kDefault,
+    kFilter,
+    kUncompressed,
+    kConcurrentMemTable,
+    kSubCompactions,
+    kPartitionedIndex,
+    kPipelinedWal,
+    kDataBlockHashIndex,
+    kRecoveryPool,
+    kEnd
+  };
   int option_config_;
 
  public:
   std::string dbname_;
   SpecialEnv* env_;
+  ThreadPool* subcompaction_pool_;
   DB* db_;
 
   Options last_options_;
 
   DBTest() : option_config_(kDefault), env_(new SpecialEnv(Env::Default())) {
+    subcompaction_pool_ = ThreadPool::NewFixed(2);
     filter_policy_ = NewBloomFilterPolicy(10);
     dbname_ = test::TmpDir() + "/db_test";
     DestroyDB(dbname_, Options());
@@ -231,6 +244,7 @@ class DBTest {
     DestroyDB(dbname_, Options());
     delete env_;
     delete filter_policy_;
+    delete subcompaction_pool_;
   }
 
   // Switch to a fresh database with the next option configuration to
@@ -255,6 +269,26 @@ class DBTest {
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kConcurrentMemTable:
+        options.concurrent_memtable_inserts = true;
+        break;
+      case kSubCompactions:
+        options.subcompaction_pool = subcompaction_pool_;
+        options.max_subcompactions = 4;
+        break;
+      case kPartitionedIndex:
+        options.filter_policy = filter_policy_;
+        options.index_partition_size = 64;
+        break;
+      case kPipelinedWal:
+        options.pipelined_wal_sync = true;
+        break;
+      case kDataBlockHashIndex:
+        options.data_block_hash_index = true;
+        break;
+      case kRecoveryPool:
+        options.recovery_pool = subcompaction_pool_;
+        break;
       default:
         break;
     }
@@ -616,6 +650,42 @@ TEST(DBTest, GetSnapshot) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, GetWithDataBlockHashIndex) {
+  Options options = CurrentOptions();
+  options.block_restart_interval = 2;  // Spread versions over restart points
+  options.data_block_hash_index = false;
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+  // Tables written without the index remain readable
+  ASSERT_OK(Put("old", "v0"));
+  dbfull()->TEST_CompactMemTable();
+  options.data_block_hash_index = true;
+  Reopen(&options);
+  char key[20];
+  std::vector<const Snapshot*> snapshots;
+  for (int v = 0; v < 5; v++) {
+    for (int i = 0; i < 200; i++) {
+      snprintf(key, sizeof(key), "key%06d", i);
+      ASSERT_OK(Put(key, std::string(1, 'a' + v)));
+    }
+    snapshots.push_back(db_->GetSnapshot());
+  }
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("v0", Get("old"));
+  for (int i = 0; i < 200; i++) {
+    snprintf(key, sizeof(key), "key%06d", i);
+    ASSERT_EQ("e", Get(key));
+    for (size_t v = 0; v < snapshots.size(); v++) {
+      ASSERT_EQ(std::string(1, 'a' + v), Get(key, snapshots[v]));
+    }
+    snprintf(key, sizeof(key), "key%06dx", i);
+    ASSERT_EQ("NOT_FOUND", Get(key));
+  }
+  for (size_t v = 0; v < snapshots.size(); v++) {
+    db_->ReleaseSnapshot(snapshots[v]);
+  }
+}
+
 TEST(DBTest, GetLevel0Ordering) {
   do {
     // Check that we process level-0 files in correct order.  The code
@@ -999,6 +1069,28 @@ TEST(DBTest, RecoverWithLargeLog) {
   ASSERT_GT(NumTableFilesAtLevel(0), 1);
 }
 
+TEST(DBTest, RecoverWithLargeLogInParallel) {
+  {
+    Options options = CurrentOptions();
+    Reopen(&options);
+    ASSERT_OK(Put("big1", std::string(200000, '1')));
+    ASSERT_OK(Put("big2", std::string(200000, '2')));
+    ASSERT_OK(Put("small3", std::string(10, '3')));
+    ASSERT_OK(Put("big1", std::string(200000, '4')));
+    ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  }
+
+  // Tables written in parallel must keep the order of the updates
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;
+  options.recovery_pool = subcompaction_pool_;
+  Reopen(&options);
+  ASSERT_EQ(NumTableFilesAtLevel(0), 3);
+  ASSERT_EQ(std::string(200000, '4'), Get("big1"));
+  ASSERT_EQ(std::string(200000, '2'), Get("big2"));
+  ASSERT_EQ(std::string(10, '3'), Get("small3"));
+}
+
 TEST(DBTest, NoMemTable) {
   Options options = CurrentOptions();
   options.no_memtable = true;
@@ -1157,6 +1249,45 @@ TEST(DBTest, CompactionsGenerateMultipleFiles) {
   }
 }
 
+TEST(DBTest, SubCompactions) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000000;  // Large write buffer
+  options.subcompaction_pool = subcompaction_pool_;
+  options.max_subcompactions = 3;
+  Reopen(&options);
+
+  Random rnd(301);
+
+  // Write 8MB (80 values, each 100K) and push them to level-1
+  std::vector<std::string> values;
+  for (int i = 0; i < 80; i++) {
+    values.push_back(RandomString(&rnd, 100000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  Reopen(&options);
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_GT(NumTableFilesAtLevel(1), 1);
+
+  // Overwrite or delete every third key and merge with level-1 again
+  for (int i = 0; i < 80; i += 3) {
+    if (i % 2 == 0) {
+      values[i] = RandomString(&rnd, 100000);
+      ASSERT_OK(Put(Key(i), values[i]));
+    } else {
+      values[i] = "NOT_FOUND";
+      ASSERT_OK(Delete(Key(i)));
+    }
+  }
+  Reopen(&options);
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  ASSERT_GT(NumTableFilesAtLevel(1), 1);
+  for (int i = 0; i < 80; i++) {
+    ASSERT_EQ(Get(Key(i)), values[i]);
+  }
+}
+
 TEST(DBTest, RepeatedWritesToSameKey) {
   Options options = CurrentOptions();
   options.env = env_;
@@ -1903,6 +2034,92 @@ TEST(DBTest, BloomFilter) {
   delete options.filter_policy;
 }
 
+namespace {
+// Treat the first 4 bytes of each key as its prefix
+class FixedPrefixExtractor : public PrefixExtractor {
+ public:
+  virtual bool InDomain(const Slice& key) const { return key.size() >= 4; }
+  virtual Slice Transform(const Slice& key) const {
+    return Slice(key.data(), 4);
+  }
+  virtual const char* Name() const { return "test.FixedPrefixExtractor"; }
+};
+
+std::string PrefixKey(int p, int i) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "%04d/%06d", p, i);
+  return buf;
+}
+
+std::string PrefixScan(DB* db, const Slice& prefix, bool reverse) {
+  ReadOptions options;
+  options.prefix = prefix;
+  Iterator* iter = db->NewIterator(options);
+  std::string result;
+  if (!reverse) {
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      result += iter->key().ToString() + ";";
+    }
+  } else {
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+      result = iter->key().ToString() + ";" + result;
+    }
+  }
+  delete iter;
+  return result;
+}
+}  // namespace
+
+TEST(DBTest, PrefixScan) {
+  env_->count_random_reads_ = true;
+  FixedPrefixExtractor prefix_extractor;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  options.prefix_extractor = &prefix_extractor;
+  options.disable_compaction = true;  // Keep all tables at level-0
+  Reopen(&options);
+
+  // Spread every prefix over overlapping tables so that key ranges alone
+  // cannot rule out any of them
+  const int kTables = 10;
+  const int kKeys = 20;
+  for (int t = 0; t < kTables; t++) {
+    for (int p = t; p < 10 * kTables; p += kTables) {
+      for (int i = 0; i < kKeys; i++) {
+        ASSERT_OK(Put(PrefixKey(p, i), std::string(100, 'x')));
+      }
+    }
+    dbfull()->TEST_CompactMemTable();
+  }
+  ASSERT_OK(Delete(PrefixKey(42, 0)));
+  ASSERT_OK(Put("0042", "v"));  // The prefix itself
+  ASSERT_EQ(kTables, NumTableFilesAtLevel(0));
+
+  std::string expected = "0042;";
+  for (int i = 1; i < kKeys; i++) {
+    expected += PrefixKey(42, i) + ";";
+  }
+  env_->random_read_counter_.Reset();
+  ASSERT_EQ(expected, PrefixScan(db_, "0042", false));
+  int reads = env_->random_read_counter_.Read();
+  fprintf(stderr, "%d tables => %d reads\n", kTables, reads);
+  ASSERT_LE(reads, 4);
+  ASSERT_EQ(expected, PrefixScan(db_, "0042", true));
+  ASSERT_EQ("", PrefixScan(db_, "0100", false));
+  ASSERT_EQ("", PrefixScan(db_, "0100", true));
+
+  options.disable_compaction = false;
+  Reopen(&options);
+  Compact("0000", "9999");
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  ASSERT_EQ(expected, PrefixScan(db_, "0042", false));
+  ASSERT_EQ(expected, PrefixScan(db_, "0042", true));
+
+  Close();
+  delete options.block_cache;
+}
+
 // Multi-threaded test:
 namespace {
 
@@ -1928,6 +2145,8 @@ static void MTThreadBody(void* arg) {
   DB* db = t->state->test->db_;
   uintptr_t counter = 0;
   fprintf(stderr, "... starting thread %d\n", id);
+  WriteOptions write_options;
+  write_options.sync = t->state->test->last_options_.pipelined_wal_sync;
   Random rnd(1000 + id);
   std::string value;
   char valbuf[1500];
@@ -1943,7 +2162,7 @@ static void MTThreadBody(void* arg) {
       // We add some padding for force compactions.
       snprintf(valbuf, sizeof(valbuf), "%d.%d.%-1000d", key, id,
                static_cast<int>(counter));
-      ASSERT_OK(db->Put(WriteOptions(), Slice(keybuf), Slice(valbuf)));
+      ASSERT_OK(db->Put(write_options, Slice(keybuf), Slice(valbuf)));
     } else {
       // Read a value and verify that it matches the pattern written above.
       Status s = db->Get(ReadOptions(), Slice(keybuf), &value);
@@ -2002,6 +2221,59 @@ TEST(DBTest, MultiThreaded) {
   } while (ChangeOptions());
 }
 
+namespace {
+
+struct SyncWriterState {
+  DB* db;
+  int id;
+  int num_keys;
+  port::AtomicPointer done;
+};
+
+static void SyncWriterBody(void* arg) {
+  SyncWriterState* t = reinterpret_cast<SyncWriterState*>(arg);
+  WriteOptions options;
+  options.sync = true;
+  char keybuf[20];
+  for (int i = 0; i < t->num_keys; i++) {
+    snprintf(keybuf, sizeof(keybuf), "%02d.%08d", t->id, i);
+    ASSERT_OK(t->db->Put(options, Slice(keybuf), Slice(keybuf)));
+  }
+  t->done.Release_Store(t);
+}
+
+}  // namespace
+
+TEST(DBTest, PipelinedWalSync) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.pipelined_wal_sync = true;
+  options.write_buffer_size = 100000;  // Force log switches
+  DestroyAndReopen(&options);
+  SyncWriterState state[kNumThreads];
+  for (int id = 0; id < kNumThreads; id++) {
+    state[id].db = db_;
+    state[id].id = id;
+    state[id].num_keys = 2000;
+    state[id].done.Release_Store(NULL);
+    env_->StartThread(SyncWriterBody, &state[id]);
+  }
+  for (int id = 0; id < kNumThreads; id++) {
+    while (state[id].done.Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+  }
+  // Updates must survive recovery from the write ahead log
+  Reopen(&options);
+  char keybuf[20];
+  for (int id = 0; id < kNumThreads; id++) {
+    for (int i = 0; i < state[id].num_keys; i++) {
+      snprintf(keybuf, sizeof(keybuf), "%02d.%08d", id, i);
+      ASSERT_EQ(keybuf, Get(keybuf));
+    }
+  }
+}
+
 namespace {
 typedef std::map<std::string, std::string> KVMap;
 }
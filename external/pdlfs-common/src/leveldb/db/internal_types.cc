@@ -87,6 +87,12 @@ int InternalKeyComparator::Compare(const Slice& akey, const Slice& bkey) const {
   return r;
 }
 
+bool IsInternalBytewiseComparator(const Comparator* cmp) {
+  const InternalKeyComparator* const icmp =
+      dynamic_cast<const InternalKeyComparator*>(cmp);
+  return icmp != NULL && icmp->user_comparator() == BytewiseComparator();
+}
+
 void InternalKeyComparator::FindShortestSeparator(std::string* start,
                                                   const Slice& limit) const {
   // Attempt to shorten the user portion of the key
@@ -139,6 +145,18 @@ bool InternalFilterPolicy::KeyMayMatch(const Slice& key, const Slice& f) const {
   return user_policy_->KeyMayMatch(ExtractUserKey(key), f);
 }
 
+bool InternalPrefixExtractor::InDomain(const Slice& key) const {
+  return user_extractor_->InDomain(ExtractUserKey(key));
+}
+
+Slice InternalPrefixExtractor::Transform(const Slice& key) const {
+  return user_extractor_->Transform(ExtractUserKey(key));
+}
+
+const char* InternalPrefixExtractor::Name() const {
+  return user_extractor_->Name();
+}
+
 LookupKey::LookupKey(const Slice& user_key, SequenceNumber s) {
   size_t usize = user_key.size();
   size_t needed = usize + 13;  // A conservative estimate
@@ -119,6 +119,34 @@ TEST(FormatTest, InternalKeyShortestSuccessor) {
             ShortSuccessor(IKey("\xff\xff", 100, kTypeValue)));
 }
 
+static int Sign(int r) {
+  return (r > 0) - (r < 0);
+}
+
+TEST(FormatTest, InlinedCompares) {
+  const InternalKeyComparator icmp(BytewiseComparator());
+  ASSERT_TRUE(IsInternalBytewiseComparator(&icmp));
+  ASSERT_TRUE(!IsInternalBytewiseComparator(BytewiseComparator()));
+  const char* keys[] = {
+      "", "a", "ab", "b", "\xff",
+      "12345678", "12345679", "\x80" "2345678", "1234567\xff",
+      "1234567812345678", "1234567812345679", "123456781234567"};
+  const int n = sizeof(keys) / sizeof(keys[0]);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      const Slice a(keys[i]), b(keys[j]);
+      ASSERT_EQ(Sign(BytewiseComparator()->Compare(a, b)),
+                Sign(BytewiseCompare()(a, b)));
+      for (uint64_t s = 99; s <= 101; s++) {
+        const std::string x = IKey(keys[i], 100, kTypeValue);
+        const std::string y = IKey(keys[j], s, kTypeValue);
+        ASSERT_EQ(Sign(icmp.Compare(x, y)),
+                  Sign(InternalBytewiseCompare()(x, y)));
+      }
+    }
+  }
+}
+
 }  // namespace pdlfs
 
 /* clang-format on */
@@ -18,6 +18,7 @@
 
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
 
 #include <algorithm>
 
@@ -35,7 +36,10 @@ MemTable::MemTable(const InternalKeyComparator& cmp)
 
 MemTable::~MemTable() { assert(refs_ == 0); }
 
-size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
+size_t MemTable::ApproximateMemoryUsage() {
+  MutexLock ml(&arena_mu_);
+  return arena_.MemoryUsage();
+}
 
 int MemTable::KeyComparator::operator()(const char* aptr,
                                         const char* bptr) const {
@@ -85,7 +89,7 @@ class MemTableIterator : public Iterator {
 Iterator* MemTable::NewIterator() { return new MemTableIterator(&table_); }
 
 void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
-                   const Slice& value) {
+                   const Slice& value, bool concurrent) {
   // Format of an entry is concatenation of:
   //  key_size     : varint32 of internal_key.size()
   //  key bytes    : char[internal_key.size()]
@@ -97,7 +101,13 @@ void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
   const size_t encoded_len = VarintLength(internal_key_size) +
                              internal_key_size + VarintLength(val_size) +
                              val_size;
-  char* buf = arena_.Allocate(encoded_len);
+  char* buf;
+  if (concurrent) {
+    MutexLock ml(&arena_mu_);
+    buf = arena_.Allocate(encoded_len);
+  } else {
+    buf = arena_.Allocate(encoded_len);
+  }
   char* p = EncodeVarint32(buf, internal_key_size);
   memcpy(p, key.data(), key_size);
   p += key_size;
@@ -106,7 +116,11 @@ void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
   p = EncodeVarint32(p, val_size);
   memcpy(p, value.data(), val_size);
   assert((p + val_size) - buf == encoded_len);
-  table_.Insert(buf);
+  if (concurrent) {
+    table_.InsertConcurrently(buf, &arena_mu_);
+  } else {
+    table_.Insert(buf);
+  }
 }
 
 bool MemTable::Get(const LookupKey& key, Buffer* buf, size_t limit, Status* s) {
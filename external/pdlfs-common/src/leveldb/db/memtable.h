@@ -51,7 +51,7 @@ class MemTable {
   // data structure.
   //
   // REQUIRES: external synchronization to prevent simultaneous
-  // operations on the same MemTable.
+  // operations on the same MemTable, except for concurrent Add() calls.
   size_t ApproximateMemoryUsage();
 
   // Return an iterator that yields the contents of the memtable.
@@ -65,8 +65,10 @@ class MemTable {
   // Add an entry into memtable that maps key to value at the
   // specified sequence number and with the specified type.
   // Typically value will be empty if type==kTypeDeletion.
+  // If "concurrent" is true, the call may run concurrently with other
+  // concurrent calls. Concurrent and non-concurrent calls may not overlap.
   void Add(SequenceNumber seq, ValueType type, const Slice& key,
-           const Slice& value);
+           const Slice& value, bool concurrent = false);
 
   // If memtable contains a value for key, store a prefix of it in *value
   // and return true. If memtable contains a deletion for key,
@@ -88,6 +90,7 @@ class MemTable {
 
   KeyComparator comparator_;
   int refs_;
+  port::Mutex arena_mu_;  // Guards arena_ during concurrent Add() calls
   Arena arena_;
   Table table_;
 
@@ -34,20 +34,31 @@ DBOptions::DBOptions()
       env(Env::Default()),
       info_log(NULL),
       compaction_pool(NULL),
+      subcompaction_pool(NULL),
+      max_subcompactions(1),
+      recovery_pool(NULL),
+      rate_limiter(NULL),
       write_buffer_size(4 * 1048576),
       table_cache(NULL),
+      share_tables(false),
       block_cache(NULL),
+      scan_resistant_block_cache(false),
       block_size(4 * 1024),
       block_restart_interval(16),
       index_block_restart_interval(1),
+      index_partition_size(0),
+      data_block_hash_index(false),
       compression(kSnappyCompression),
       filter_policy(NULL),
+      prefix_extractor(NULL),
       no_memtable(false),
       gc_skip_deletion(false),
       skip_lock_file(false),
       rotating_manifest(false),
       sync_log_on_close(false),
       disable_write_ahead_log(false),
+      concurrent_memtable_inserts(false),
+      pipelined_wal_sync(false),
       disable_compaction(false),
       disable_seek_compaction(false),
       table_builder_skip_verification(false),
@@ -99,10 +110,12 @@ static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
 DBOptions SanitizeOptions(const std::string& dbname,
                           const InternalKeyComparator* icmp,
                           const InternalFilterPolicy* ipolicy,
+                          const InternalPrefixExtractor* iprefix,
                           const DBOptions& src, bool create_infolog) {
   DBOptions result = src;
   result.comparator = icmp;
   result.filter_policy = (src.filter_policy != NULL) ? ipolicy : NULL;
+  result.prefix_extractor = (src.prefix_extractor != NULL) ? iprefix : NULL;
   ClipToRange(&result.block_restart_interval, 1, 1024);
   ClipToRange(&result.index_block_restart_interval, 1, 1024);
   ClipToRange(&result.write_buffer_size, 64 << 10, 1 << 30);
@@ -122,8 +135,14 @@ DBOptions SanitizeOptions(const std::string& dbname,
   if (result.disable_compaction) {
     result.disable_seek_compaction = true;
   }
+  if (result.no_memtable || result.disable_write_ahead_log ||
+      result.concurrent_memtable_inserts) {
+    result.pipelined_wal_sync = false;
+  }
   if (result.block_cache == NULL) {
-    result.block_cache = NewLRUCache(8 << 20);
+    result.block_cache = result.scan_resistant_block_cache
+                             ? NewScanResistantCache(8 << 20)
+                             : NewLRUCache(8 << 20);
   }
   if (result.table_cache == NULL) {
     result.table_cache = NewLRUCache(1000);
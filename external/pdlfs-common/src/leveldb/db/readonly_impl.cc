@@ -33,8 +33,11 @@ ReadonlyDBImpl::ReadonlyDBImpl(const Options& raw_options,
     : env_(raw_options.env),
       internal_comparator_(raw_options.comparator),
       internal_filter_policy_(raw_options.filter_policy),
+      internal_prefix_extractor_(raw_options.prefix_extractor),
       options_(SanitizeOptions(dbname, &internal_comparator_,
-                               &internal_filter_policy_, raw_options, false)),
+                               &internal_filter_policy_,
+                               &internal_prefix_extractor_, raw_options,
+                               false)),
       owns_cache_(options_.block_cache != raw_options.block_cache),
       owns_table_cache_(options_.table_cache != raw_options.table_cache),
       dbname_(dbname),
@@ -61,9 +64,19 @@ ReadonlyDBImpl::~ReadonlyDBImpl() {
 }
 
 Status ReadonlyDBImpl::Load() {
+  MutexLock ml(&mutex_);
+  return LoadLocked();
+}
+
+Status ReadonlyDBImpl::Reload() {
+  MutexLock ml(&mutex_);
+  return ReloadLocked();
+}
+
+Status ReadonlyDBImpl::LoadLocked() {
   mutex_.AssertHeld();
   if (log_ != NULL) {
-    return Reload();
+    return ReloadLocked();
   }
 
   env_->AttachDir(dbname_.c_str());
@@ -112,10 +125,10 @@ Status ReadonlyDBImpl::Load() {
   }
 }
 
-Status ReadonlyDBImpl::Reload() {
+Status ReadonlyDBImpl::ReloadLocked() {
   mutex_.AssertHeld();
   if (log_ == NULL) {
-    return Load();
+    return LoadLocked();
   }
 
   env_->DetachDir(dbname_.c_str());
@@ -227,6 +240,7 @@ Iterator* ReadonlyDBImpl::NewIterator(const ReadOptions& options) {
       (options.snapshot != NULL
            ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
            : latest_snapshot),
+      options.prefix,
       0);
 }
 
@@ -282,7 +296,7 @@ Status ReadonlyDB::Open(const Options& options, const std::string& dbname,
   Log(options.info_log, 1, "Opening db at %s ...", dbname.c_str());
 #endif
   impl->mutex_.Lock();
-  Status s = impl->Load();
+  Status s = impl->LoadLocked();
   impl->mutex_.Unlock();
   if (s.ok()) {
     *dbptr = impl;
@@ -50,6 +50,9 @@ class ReadonlyDBImpl : public ReadonlyDB {
  private:
   friend class ReadonlyDB;
 
+  Status LoadLocked();
+  Status ReloadLocked();
+
   Status InternalGet(const ReadOptions&, const Slice& key, Buffer* buf);
   Iterator* NewInternalIterator(const ReadOptions&,
                                 SequenceNumber* latest_snapshot);
@@ -58,6 +61,7 @@ class ReadonlyDBImpl : public ReadonlyDB {
   Env* const env_;
   const InternalKeyComparator internal_comparator_;
   const InternalFilterPolicy internal_filter_policy_;
+  const InternalPrefixExtractor internal_prefix_extractor_;
   const Options options_;  // options_.comparator == &internal_comparator_
   bool owns_cache_;
   bool owns_table_cache_;
@@ -121,6 +121,46 @@ TEST(ReadonlyTest, Readonly) {
   delete db;
 }
 
+// Count the number of table files opened for random access.
+class TableOpenCounter : public EnvWrapper {
+ public:
+  TableOpenCounter() : EnvWrapper(Env::Default()), num_opens(0) {}
+  virtual Status NewRandomAccessFile(const char* f, RandomAccessFile** r) {
+    if (Slice(f).ends_with(".ldb") || Slice(f).ends_with(".sst")) {
+      num_opens++;
+    }
+    return EnvWrapper::NewRandomAccessFile(f, r);
+  }
+  int num_opens;
+};
+
+TEST(ReadonlyTest, SharedTables) {
+  DB* db;
+  ASSERT_OK(DB::Open(options_, dbname_, &db));
+  BuildImage(db, 0, 10000);
+  dbfull(db)->TEST_CompactMemTable();
+  delete db;
+  TableOpenCounter env;
+  Cache* const tbl_cache = NewLRUCache(1000);
+  DBOptions options = options_;
+  options.env = &env;
+  options.table_cache = tbl_cache;
+  options.share_tables = true;
+  DB* db1;
+  ASSERT_OK(ReadonlyDB::Open(options, dbname_, &db1));
+  Check(db1, 10000, 10000);
+  const int num_opens = env.num_opens;
+  ASSERT_GT(num_opens, 0);
+  DB* db2;
+  ASSERT_OK(ReadonlyDB::Open(options, dbname_, &db2));
+  Check(db2, 10000, 10000);
+  ASSERT_EQ(env.num_opens, num_opens);
+  delete db1;
+  Check(db2, 10000, 10000);
+  delete db2;
+  delete tbl_cache;
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -103,10 +103,9 @@ void DeleteEntry(const Slice& key, void* value) {
 Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
                              SequenceOff seq_off, Cache::Handle** handle) {
   Status s;
-  char buf[16];
-  EncodeFixed64(buf, id_);
-  EncodeFixed64(buf + 8, file_number);
-  Slice key(buf, 16);
+  char scratch[16];
+  std::string buf;
+  Slice key = CacheKey(file_number, scratch, &buf);
 
   *handle = cache_->Lookup(key);
   if (*handle == NULL) {
@@ -404,11 +403,22 @@ Status TableCache::Get(const ReadOptions& options, uint64_t fnum,
 }
 
 void TableCache::Evict(uint64_t fnum) {
-  char buf[16];
-  EncodeFixed64(buf, id_);
-  EncodeFixed64(buf + 8, fnum);
-  Slice key(buf, 16);
-  cache_->Erase(key);
+  char scratch[16];
+  std::string buf;
+  cache_->Erase(CacheKey(fnum, scratch, &buf));
+}
+
+Slice TableCache::CacheKey(uint64_t file_number, char* scratch,
+                           std::string* buf) const {
+  if (options_->share_tables) {
+    PutFixed64(buf, file_number);
+    buf->append(dbname_);
+    return *buf;
+  } else {
+    EncodeFixed64(scratch, id_);
+    EncodeFixed64(scratch + 8, file_number);
+    return Slice(scratch, 16);
+  }
 }
 
 }  // namespace pdlfs
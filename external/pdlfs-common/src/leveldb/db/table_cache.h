@@ -76,6 +76,10 @@ class TableCache {
   Status FindTable(uint64_t file_number, uint64_t file_size,
                    SequenceOff seq_off, Cache::Handle**);
 
+  // Return the key of the specified file number in the cache. The key is
+  // stored in either the 16-byte scratch or *buf.
+  Slice CacheKey(uint64_t file_number, char* scratch, std::string* buf) const;
+
   // No copying allowed
   TableCache(const TableCache&);
   void operator=(const TableCache&);
@@ -168,28 +168,47 @@ bool SomeFileOverlapsRange(const InternalKeyComparator& icmp,
   return !BeforeFile(ucmp, largest_user_key, files[index]);
 }
 
+// Return true iff "user_key" and all user keys after it sort after every
+// key starting with "prefix".
+static bool PastPrefix(const Comparator* ucmp, const Slice& prefix,
+                       const Slice& user_key) {
+  return ucmp->Compare(user_key, prefix) > 0 &&
+         !user_key.starts_with(prefix);
+}
+
 // An internal iterator.  For a given version/level pair, yields
 // information about the files in the level.  For a given entry, key()
 // is the largest key that occurs in the file, and value() is an
 // 24-byte value containing the file number, file size, and sequence offset,
-// all encoded using EncodeFixed64.
+// all encoded using EncodeFixed64.  If "prefix" is non-empty, the iterator
+// becomes invalid once it reaches files past all keys that start with
+// "prefix" so that those files are never opened.
 class Version::LevelFileNumIterator : public Iterator {
  public:
   LevelFileNumIterator(const InternalKeyComparator& icmp,
-                       const std::vector<FileMetaData*>* flist)
-      : icmp_(icmp), flist_(flist), index_(flist->size()) {  // Marks as invalid
+                       const std::vector<FileMetaData*>* flist,
+                       const Slice& prefix = Slice())
+      : icmp_(icmp),
+        flist_(flist),
+        prefix_(prefix),
+        index_(flist->size()) {  // Marks as invalid
   }
   virtual bool Valid() const { return index_ < flist_->size(); }
   virtual void Seek(const Slice& target) {
     index_ = FindFile(icmp_, *flist_, target);
+    CheckPrefix();
+  }
+  virtual void SeekToFirst() {
+    index_ = 0;
+    CheckPrefix();
   }
-  virtual void SeekToFirst() { index_ = 0; }
   virtual void SeekToLast() {
     index_ = flist_->empty() ? 0 : flist_->size() - 1;
   }
   virtual void Next() {
     assert(Valid());
     index_++;
+    CheckPrefix();
   }
   virtual void Prev() {
     assert(Valid());
@@ -213,8 +232,17 @@ class Version::LevelFileNumIterator : public Iterator {
   virtual Status status() const { return Status::OK(); }
 
  private:
+  void CheckPrefix() {
+    if (!prefix_.empty() && Valid() &&
+        PastPrefix(icmp_.user_comparator(), prefix_,
+                   (*flist_)[index_]->smallest.user_key())) {
+      index_ = flist_->size();  // Marks as invalid
+    }
+  }
+
   const InternalKeyComparator icmp_;
   const std::vector<FileMetaData*>* const flist_;
+  const Slice prefix_;
   uint32_t index_;
 
   // Backing store for value().  Holds the file number and size.
@@ -252,14 +280,23 @@ Iterator* GetFileIterator(void* arg, const ReadOptions& options,
 Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
                                             int level) const {
   return NewTwoLevelIterator(
-      new LevelFileNumIterator(vset_->icmp_, &files_[level]), &GetFileIterator,
-      vset_->table_cache_, options);
+      new LevelFileNumIterator(vset_->icmp_, &files_[level], options.prefix),
+      &GetFileIterator, vset_->table_cache_, options);
 }
 
 void Version::AddIterators(const ReadOptions& options,
                            std::vector<Iterator*>* iters) {
+  const Comparator* const ucmp = vset_->icmp_.user_comparator();
   // Merge all level zero files together since they may overlap
   for (size_t i = 0; i < files_[0].size(); i++) {
+    if (!options.prefix.empty()) {
+      // Skip files whose key range has no key with the prefix
+      if (PastPrefix(ucmp, options.prefix, files_[0][i]->smallest.user_key()) ||
+          ucmp->Compare(files_[0][i]->largest.user_key(), options.prefix) <
+              0) {
+        continue;
+      }
+    }
     iters->push_back(vset_->table_cache_->NewIterator(
         options, files_[0][i]->number, files_[0][i]->file_size,
         files_[0][i]->seq_off));
@@ -1586,12 +1623,12 @@ Compaction::Compaction(const Options* options, int level)
     : level_(level),
       max_output_file_size_(MaxFileSizeForLevel(options, level)),
       max_grand_parent_overlap_bytes_(MaxGrandParentOverlapBytes(options)),
-      input_version_(NULL),
-      grandparent_index_(0),
-      seen_key_(false),
-      overlapped_bytes_(0) {
+      input_version_(NULL) {}
+
+Compaction::ScanState::ScanState()
+    : grandparent_index(0), seen_key(false), overlapped_bytes(0) {
   for (int i = 0; i < config::kNumLevels; i++) {
-    level_ptrs_[i] = 0;
+    level_ptrs[i] = 0;
   }
 }
 
@@ -1617,13 +1654,14 @@ void Compaction::AddInputDeletions(VersionEdit* edit) {
   }
 }
 
-bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
+bool Compaction::IsBaseLevelForKey(const Slice& user_key, ScanState* state) {
   // Maybe use binary search to find right entry instead of linear search?
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
+  size_t* const level_ptrs = state->level_ptrs;
   for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
     const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    for (; level_ptrs_[lvl] < files.size();) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
+    for (; level_ptrs[lvl] < files.size();) {
+      FileMetaData* f = files[level_ptrs[lvl]];
       if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
         // We've advanced far enough
         if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
@@ -1632,35 +1670,82 @@ bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
         }
         break;
       }
-      level_ptrs_[lvl]++;
+      level_ptrs[lvl]++;
     }
   }
   return true;
 }
 
-bool Compaction::ShouldStopBefore(const Slice& internal_key) {
+bool Compaction::ShouldStopBefore(const Slice& internal_key,
+                                  ScanState* state) {
   // Scan to find earliest grandparent file that contains key.
   const InternalKeyComparator* icmp = &input_version_->vset_->icmp_;
-  while (grandparent_index_ < grandparents_.size() &&
-         icmp->Compare(internal_key,
-                       grandparents_[grandparent_index_]->largest.Encode()) >
-             0) {
-    if (seen_key_) {
-      overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
+  while (state->grandparent_index < grandparents_.size() &&
+         icmp->Compare(
+             internal_key,
+             grandparents_[state->grandparent_index]->largest.Encode()) > 0) {
+    if (state->seen_key) {
+      state->overlapped_bytes +=
+          grandparents_[state->grandparent_index]->file_size;
     }
-    grandparent_index_++;
+    state->grandparent_index++;
   }
-  seen_key_ = true;
+  state->seen_key = true;
 
-  if (overlapped_bytes_ > max_grand_parent_overlap_bytes_) {
+  if (state->overlapped_bytes > max_grand_parent_overlap_bytes_) {
     // Too much overlap for current output; start new output
-    overlapped_bytes_ = 0;
+    state->overlapped_bytes = 0;
     return true;
   } else {
     return false;
   }
 }
 
+namespace {
+struct UserKeyLess {
+  const Comparator* ucmp;
+  bool operator()(const Slice& a, const Slice& b) const {
+    return ucmp->Compare(a, b) < 0;
+  }
+};
+}  // namespace
+
+void Compaction::GetSplitPoints(int n,
+                                std::vector<std::string>* user_keys) const {
+  user_keys->clear();
+  if (n <= 1) {
+    return;
+  }
+  UserKeyLess less;
+  less.ucmp = input_version_->vset_->icmp_.user_comparator();
+  std::vector<Slice> candidates;
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < inputs_[which].size(); i++) {
+      candidates.push_back(inputs_[which][i]->largest.user_key());
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), less);
+  std::vector<Slice> uniq;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (uniq.empty() || less(uniq.back(), candidates[i])) {
+      uniq.push_back(candidates[i]);
+    }
+  }
+  // The largest key cannot split anything
+  if (!uniq.empty()) {
+    uniq.pop_back();
+  }
+  const size_t k = uniq.size();
+  size_t last = k;
+  for (int i = 1; i < n; i++) {
+    const size_t idx = (k * i) / n;
+    if (idx < k && idx != last) {
+      user_keys->push_back(uniq[idx].ToString());
+      last = idx;
+    }
+  }
+}
+
 void Compaction::ReleaseInputs() {
   if (input_version_ != NULL) {
     input_version_->Unref();
@@ -370,14 +370,46 @@ class Compaction {
   // Add all inputs to this compaction as delete operations to *edit.
   void AddInputDeletions(VersionEdit* edit);
 
+  // State used by IsBaseLevelForKey() and ShouldStopBefore() while the
+  // compaction input is being scanned in key order.  Each sub-compaction
+  // scanning a disjoint key range keeps a separate instance.
+  struct ScanState {
+    ScanState();
+
+    // State used to check for number of of overlapping grandparent files
+    // (parent == level_ + 1, grandparent == level_ + 2)
+    size_t grandparent_index;  // Index in grandparent_starts_
+    bool seen_key;             // Some output key has been seen
+    int64_t overlapped_bytes;  // Bytes of overlap between current output
+                               // and grandparent files
+
+    // level_ptrs holds indices into input_version_->levels_: our state
+    // is that we are positioned at one of the file ranges for each
+    // higher level than the ones involved in this compaction (i.e. for
+    // all L >= level_ + 2).
+    size_t level_ptrs[config::kNumLevels];
+  };
+
   // Returns true if the information we have available guarantees that
   // the compaction is producing data in "level+1" for which no data exists
   // in levels greater than "level+1".
-  bool IsBaseLevelForKey(const Slice& user_key);
+  bool IsBaseLevelForKey(const Slice& user_key) {
+    return IsBaseLevelForKey(user_key, &scan_);
+  }
+  bool IsBaseLevelForKey(const Slice& user_key, ScanState* state);
 
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
-  bool ShouldStopBefore(const Slice& internal_key);
+  bool ShouldStopBefore(const Slice& internal_key) {
+    return ShouldStopBefore(internal_key, &scan_);
+  }
+  bool ShouldStopBefore(const Slice& internal_key, ScanState* state);
+
+  // Pick at most "n - 1" user keys that split the input of this compaction
+  // into at most "n" key ranges of similar size.  Keys are taken from the
+  // boundaries of the input files and stored in *user_keys in sorted order.
+  // Each range (prev key, key] may be compacted independently of the others.
+  void GetSplitPoints(int n, std::vector<std::string>* user_keys) const;
 
   // Release the input version for the compaction, once the compaction
   // is successful.
@@ -398,21 +430,11 @@ class Compaction {
   // Each compaction reads inputs from "level_" and "level_+1"
   std::vector<FileMetaData*> inputs_[2];  // The two sets of inputs
 
-  // State used to check for number of of overlapping grandparent files
-  // (parent == level_ + 1, grandparent == level_ + 2)
+  // Grandparent files (parent == level_ + 1, grandparent == level_ + 2)
   std::vector<FileMetaData*> grandparents_;
-  size_t grandparent_index_;  // Index in grandparent_starts_
-  bool seen_key_;             // Some output key has been seen
-  int64_t overlapped_bytes_;  // Bytes of overlap between current output
-                              // and grandparent files
-
-  // State for implementing IsBaseLevelForKey
-
-  // level_ptrs_ holds indices into input_version_->levels_: our state
-  // is that we are positioned at one of the file ranges for each
-  // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
-  size_t level_ptrs_[config::kNumLevels];
+
+  // Scan state used when compacting the entire input in one pass
+  ScanState scan_;
 };
 
 }  // namespace pdlfs
@@ -31,6 +31,9 @@ namespace pdlfs {
 
 class FilterPolicy;
 
+// Bits per key of the bloom filters that tables keep over their key prefixes
+static const int kPrefixFilterBitsPerKey = 10;
+
 // A FilterBlockBuilder is used to construct all of the filters for a
 // particular Table.  It generates a single string which is stored as
 // a special block in the Table.
@@ -60,6 +63,33 @@ class FilterBlockBuilder {
   void operator=(const FilterBlockBuilder&);
 };
 
+// A FilterPartitionBuilder is used to construct the filter partitions of a
+// Table with a partitioned index.  Each partition is a single filter over
+// the keys of all data blocks indexed by an index partition.
+//
+// The sequence of calls to FilterPartitionBuilder must match the regexp:
+//      (AddKey* Finish)*
+class FilterPartitionBuilder {
+ public:
+  explicit FilterPartitionBuilder(const FilterPolicy*);
+
+  void AddKey(const Slice& key);
+  // Return a filter over all keys added since the previous call.
+  // The result remains valid until the next call to AddKey().
+  Slice Finish();
+
+ private:
+  const FilterPolicy* policy_;
+  std::string keys_;             // Flattened key contents
+  std::vector<size_t> start_;    // Starting index in keys_ of each key
+  std::string result_;           // Filter data of the last partition
+  std::vector<Slice> tmp_keys_;  // policy_->CreateFilter() argument
+
+  // No copying allowed
+  FilterPartitionBuilder(const FilterPartitionBuilder&);
+  void operator=(const FilterPartitionBuilder&);
+};
+
 class FilterBlockReader {
  public:
   // REQUIRES: "contents" and *policy must stay live while *this is live.
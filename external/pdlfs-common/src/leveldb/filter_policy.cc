@@ -22,4 +22,8 @@ FilterPolicy::~FilterPolicy() {
   // Empty
 }
 
+PrefixExtractor::~PrefixExtractor() {
+  // Empty
+}
+
 }  // namespace pdlfs
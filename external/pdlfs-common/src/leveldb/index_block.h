@@ -28,6 +28,10 @@ class IndexBlockBuilder {
 
   Slice Finish() { return builder_.Finish(); }
 
+  void Reset() { builder_.Reset(); }
+
+  bool empty() const { return builder_.empty(); }
+
   size_t CurrentSizeEstimate() const { return builder_.CurrentSizeEstimate(); }
 
   void ChangeRestartInterval(int interval) {
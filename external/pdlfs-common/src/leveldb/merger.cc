@@ -17,16 +17,18 @@
 #include "merger.h"
 
 #include "pdlfs-common/leveldb/comparator.h"
+#include "pdlfs-common/leveldb/internal_types.h"
 #include "pdlfs-common/leveldb/iterator.h"
 #include "pdlfs-common/leveldb/iterator_wrapper.h"
 
 namespace pdlfs {
 
 namespace {
+template <typename Cmp>
 class MergingIterator : public Iterator {
  public:
-  MergingIterator(const Comparator* comparator, Iterator** children, int n)
-      : comparator_(comparator),
+  MergingIterator(const Cmp& cmp, Iterator** children, int n)
+      : cmp_(cmp),
         children_(new IteratorWrapper[n]),
         n_(n),
         current_(NULL),
@@ -77,8 +79,7 @@ class MergingIterator : public Iterator {
         IteratorWrapper* child = &children_[i];
         if (child != current_) {
           child->Seek(key());
-          if (child->Valid() &&
-              comparator_->Compare(key(), child->key()) == 0) {
+          if (child->Valid() && cmp_(key(), child->key()) == 0) {
             child->Next();
           }
         }
@@ -147,7 +148,7 @@ class MergingIterator : public Iterator {
   // We might want to use a heap in case there are lots of children.
   // For now we use a simple array since we expect a very small number
   // of children in leveldb.
-  const Comparator* comparator_;
+  const Cmp cmp_;
   IteratorWrapper* children_;
   int n_;
   IteratorWrapper* current_;
@@ -157,14 +158,15 @@ class MergingIterator : public Iterator {
   Direction direction_;
 };
 
-void MergingIterator::FindSmallest() {
+template <typename Cmp>
+void MergingIterator<Cmp>::FindSmallest() {
   IteratorWrapper* smallest = NULL;
   for (int i = 0; i < n_; i++) {
     IteratorWrapper* child = &children_[i];
     if (child->Valid()) {
       if (smallest == NULL) {
         smallest = child;
-      } else if (comparator_->Compare(child->key(), smallest->key()) < 0) {
+      } else if (cmp_(child->key(), smallest->key()) < 0) {
         smallest = child;
       }
     }
@@ -172,14 +174,15 @@ void MergingIterator::FindSmallest() {
   current_ = smallest;
 }
 
-void MergingIterator::FindLargest() {
+template <typename Cmp>
+void MergingIterator<Cmp>::FindLargest() {
   IteratorWrapper* largest = NULL;
   for (int i = n_ - 1; i >= 0; i--) {
     IteratorWrapper* child = &children_[i];
     if (child->Valid()) {
       if (largest == NULL) {
         largest = child;
-      } else if (comparator_->Compare(child->key(), largest->key()) > 0) {
+      } else if (cmp_(child->key(), largest->key()) > 0) {
         largest = child;
       }
     }
@@ -194,8 +197,13 @@ Iterator* NewMergingIterator(const Comparator* cmp, Iterator** list, int n) {
     return NewEmptyIterator();
   } else if (n == 1) {
     return list[0];
+  } else if (cmp == BytewiseComparator()) {
+    return new MergingIterator<BytewiseCompare>(BytewiseCompare(), list, n);
+  } else if (IsInternalBytewiseComparator(cmp)) {
+    return new MergingIterator<InternalBytewiseCompare>(
+        InternalBytewiseCompare(), list, n);
   } else {
-    return new MergingIterator(cmp, list, n);
+    return new MergingIterator<VirtualCompare>(VirtualCompare(cmp), list, n);
   }
 }
 
@@ -26,10 +26,12 @@
 // Thread safety
 // -------------
 //
-// Writes require external synchronization, most likely a mutex.
-// Reads require a guarantee that the SkipList will not be destroyed
-// while the read is in progress.  Apart from that, reads progress
-// without any internal locking or synchronization.
+// Writes require external synchronization, most likely a mutex, unless
+// they are all made through InsertConcurrently(), which links new nodes
+// with compare-and-swap. Insert() and InsertConcurrently() may not be
+// mixed concurrently. Reads require a guarantee that the SkipList will not
+// be destroyed while the read is in progress.  Apart from that, reads
+// progress without any internal locking or synchronization.
 //
 // Invariants:
 //
@@ -63,6 +65,13 @@ class SkipList {
   // REQUIRES: nothing that compares equal to key is currently in the list.
   void Insert(const Key& key);
 
+  // Insert key into the list. Safe to call concurrently with other
+  // InsertConcurrently() calls and with reads. Allocations from the
+  // arena are made under "*arena_mu", which must also be held by anyone
+  // else allocating from the same arena during the insertion.
+  // REQUIRES: nothing that compares equal to key is currently in the list.
+  void InsertConcurrently(const Key& key, port::Mutex* arena_mu);
+
   // Returns true iff an entry that compares equal to key is in the list.
   bool Contains(const Key& key) const;
 
@@ -114,8 +123,8 @@ class SkipList {
 
   Node* const head_;
 
-  // Modified only by Insert().  Read racily by readers, but stale
-  // values are ok.
+  // Modified only by Insert() and InsertConcurrently().  Read racily by
+  // readers, but stale values are ok.
   port::AtomicPointer max_height_;  // Height of the entire list
 
   inline int GetMaxHeight() const {
@@ -123,7 +132,8 @@ class SkipList {
         reinterpret_cast<intptr_t>(max_height_.NoBarrier_Load()));
   }
 
-  // Read/written only by Insert().
+  // Read/written only by Insert(), or under the arena mutex by
+  // InsertConcurrently().
   Random rnd_;
 
   Node* NewNode(const Key& key, int height);
@@ -140,6 +150,12 @@ class SkipList {
   // node at "level" for every level in [0..max_height_-1].
   Node* FindGreaterOrEqual(const Key& key, Node** prev) const;
 
+  // Starting from "before", find the nodes at "level" between which
+  // key should be inserted.
+  // REQUIRES: "before" is head_ or a node with a key < key.
+  void FindSpliceForLevel(const Key& key, Node* before, int level,
+                          Node** prev, Node** next) const;
+
   // Return the latest node with a key < key.
   // Return head_ if there is no such node.
   Node* FindLessThan(const Key& key) const;
@@ -185,6 +201,12 @@ struct SkipList<Key, Comparator>::Node {
     next_[n].NoBarrier_Store(x);
   }
 
+  // Set the link to "x" only if it still points to "expected".
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return next_[n].CompareAndSwap(expected, x);
+  }
+
  private:
   // Array of length equal to the node height.  next_[0] is lowest level link.
   port::AtomicPointer next_[1];
@@ -292,6 +314,23 @@ SkipList<Key, Comparator>::FindGreaterOrEqual(const Key& key,
   }
 }
 
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::FindSpliceForLevel(const Key& key,
+                                                   Node* before, int level,
+                                                   Node** prev,
+                                                   Node** next) const {
+  Node* x = before;
+  while (true) {
+    Node* n = x->Next(level);
+    if (!KeyIsAfterNode(key, n)) {
+      *prev = x;
+      *next = n;
+      return;
+    }
+    x = n;
+  }
+}
+
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node*
 SkipList<Key, Comparator>::FindLessThan(const Key& key) const {
@@ -381,6 +420,49 @@ void SkipList<Key, Comparator>::Insert(const Key& key) {
   }
 }
 
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::InsertConcurrently(const Key& key,
+                                                   port::Mutex* arena_mu) {
+  arena_mu->Lock();
+  const int height = RandomHeight();
+  Node* x = NewNode(key, height);
+  arena_mu->Unlock();
+
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    if (max_height_.CompareAndSwap(reinterpret_cast<void*>(max_height),
+                                   reinterpret_cast<void*>(height))) {
+      max_height = height;
+      break;
+    }
+    max_height = GetMaxHeight();
+  }
+
+  Node* prev[kMaxHeight];
+  Node* next[kMaxHeight];
+  Node* before = head_;
+  for (int i = max_height - 1; i >= 0; i--) {
+    FindSpliceForLevel(key, before, i, &prev[i], &next[i]);
+    before = prev[i];
+  }
+
+  // Our data structure does not allow duplicate insertion
+  assert(next[0] == NULL || !Equal(key, next[0]->key));
+
+  // Link bottom-up so that a node is always reachable at level 0 before it
+  // is reachable at any higher level. Neighbors are searched again from
+  // the previous node whenever a concurrent insertion wins the race.
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CASNext(i, next[i], x)) {
+        break;
+      }
+      FindSpliceForLevel(key, prev[i], i, &prev[i], &next[i]);
+    }
+  }
+}
+
 template <typename Key, class Comparator>
 bool SkipList<Key, Comparator>::Contains(const Key& key) const {
   Node* x = FindGreaterOrEqual(key, NULL);
@@ -374,6 +374,62 @@ TEST(SkipTest, Concurrent3) { RunConcurrent(3); }
 TEST(SkipTest, Concurrent4) { RunConcurrent(4); }
 TEST(SkipTest, Concurrent5) { RunConcurrent(5); }
 
+// Multiple writers insert disjoint sets of keys at the same time.
+class ConcurrentInsertState {
+ public:
+  static const int kThreads = 4;
+  static const int kKeysPerThread = 20000;
+
+  ConcurrentInsertState()
+      : list_(Comparator(), &arena_), done_(0), cv_(&mu_), next_id_(0) {}
+
+  Arena arena_;
+  port::Mutex arena_mu_;
+  SkipList<Key, Comparator> list_;
+  port::Mutex mu_;
+  int done_;
+  port::CondVar cv_;
+  int next_id_;
+};
+
+static void ConcurrentInserter(void* arg) {
+  ConcurrentInsertState* state = reinterpret_cast<ConcurrentInsertState*>(arg);
+  state->mu_.Lock();
+  const int id = state->next_id_++;
+  state->mu_.Unlock();
+  for (int i = 0; i < ConcurrentInsertState::kKeysPerThread; i++) {
+    const Key k = static_cast<Key>(i) * ConcurrentInsertState::kThreads + id;
+    state->list_.InsertConcurrently(k, &state->arena_mu_);
+  }
+  state->mu_.Lock();
+  state->done_++;
+  state->cv_.SignalAll();
+  state->mu_.Unlock();
+}
+
+TEST(SkipTest, ConcurrentInserts) {
+  ConcurrentInsertState state;
+  for (int i = 0; i < ConcurrentInsertState::kThreads; i++) {
+    Env::Default()->StartThread(ConcurrentInserter, &state);
+  }
+  state.mu_.Lock();
+  while (state.done_ < ConcurrentInsertState::kThreads) {
+    state.cv_.Wait();
+  }
+  state.mu_.Unlock();
+
+  const Key n = static_cast<Key>(ConcurrentInsertState::kThreads) *
+                ConcurrentInsertState::kKeysPerThread;
+  SkipList<Key, Comparator>::Iterator iter(&state.list_);
+  iter.SeekToFirst();
+  for (Key k = 0; k < n; k++) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, iter.key());
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
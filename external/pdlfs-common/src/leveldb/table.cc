@@ -30,9 +30,26 @@
 #include "pdlfs-common/cache.h"
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+
+#include <map>
 
 namespace pdlfs {
 
+struct Table::IndexPartition {
+  IndexBlockReader* index;
+  Slice filter;  // Empty if there is no filter for the partition
+  const char* filter_data;
+
+  IndexPartition() : index(NULL), filter_data(NULL) {}
+
+  ~IndexPartition() {
+    delete index;
+    delete[] filter_data;
+  }
+};
+
 struct Table::Rep {
   Options options;
   Status status;
@@ -42,15 +59,34 @@ struct Table::Rep {
   const char* filter_data;
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
+  // Top-level index over index partitions if partitioned_index is true
   IndexBlockReader* index_block;
+  bool partitioned_index;
+  bool partitioned_filter;  // Index partitions are paired with our filters
+  bool hash_index;          // Data blocks carry a hash index
+
+  // Bloom filter over the key prefixes of the table
+  const FilterPolicy* prefix_policy;
+  Slice prefix_filter;  // Valid only if prefix_policy is non-NULL
+  const char* prefix_filter_data;
+
+  // Index partitions loaded so far, keyed by their offsets in the file
+  port::Mutex mutex;
+  std::map<uint64_t, IndexPartition*> partitions;  // Protected by mutex
 
   TableProperties props;  // All properties embedded in the table
   bool props_valid;
   Rep() {}
 
   ~Rep() {
+    std::map<uint64_t, IndexPartition*>::iterator it;
+    for (it = partitions.begin(); it != partitions.end(); ++it) {
+      delete it->second;
+    }
     delete filter;
     delete[] filter_data;
+    delete prefix_policy;
+    delete[] prefix_filter_data;
     delete index_block;
   }
 };
@@ -92,6 +128,11 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
     rep->metaindex_handle = footer.metaindex_handle();
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
     rep->index_block = new IndexBlockReader(contents);
+    rep->partitioned_index = footer.partitioned_index();
+    rep->partitioned_filter = false;
+    rep->hash_index = false;
+    rep->prefix_policy = NULL;
+    rep->prefix_filter_data = NULL;
     rep->filter_data = NULL;
     rep->filter = NULL;
     rep->props_valid = false;
@@ -125,6 +166,12 @@ void Table::ReadMeta(const Footer& footer) {
     ReadProperties(iter->value());
   }
 
+  Slice hash_index_key("datablock.hashindex");
+  iter->Seek(hash_index_key);
+  if (iter->Valid() && iter->key() == hash_index_key) {
+    r->hash_index = true;
+  }
+
   if (r->options.filter_policy != NULL) {
     std::string key = "filter.";
     key.append(r->options.filter_policy->Name());
@@ -132,6 +179,21 @@ void Table::ReadMeta(const Footer& footer) {
     if (iter->Valid() && iter->key() == Slice(key)) {
       ReadFilter(iter->value());
     }
+    key = "partitionedfilter.";
+    key.append(r->options.filter_policy->Name());
+    iter->Seek(key);
+    if (iter->Valid() && iter->key() == Slice(key)) {
+      r->partitioned_filter = true;
+    }
+  }
+
+  if (r->options.prefix_extractor != NULL) {
+    std::string key = "prefixfilter.";
+    key.append(r->options.prefix_extractor->Name());
+    iter->Seek(key);
+    if (iter->Valid() && iter->key() == Slice(key)) {
+      ReadPrefixFilter(iter->value());
+    }
   }
 
   delete iter;
@@ -162,6 +224,29 @@ void Table::ReadFilter(const Slice& handle_value) {
   }
 }
 
+void Table::ReadPrefixFilter(const Slice& handle_value) {
+  Rep* r = rep_;
+  Slice v = handle_value;
+  BlockHandle handle;
+  if (!handle.DecodeFrom(&v).ok()) {
+    return;
+  }
+
+  ReadOptions opt;
+  if (r->options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
+  BlockContents block;
+  if (!ReadBlock(r->file, opt, handle, &block).ok()) {
+    return;
+  }
+  r->prefix_policy = NewBloomFilterPolicy(kPrefixFilterBitsPerKey);
+  r->prefix_filter = block.data;
+  if (block.heap_allocated) {
+    r->prefix_filter_data = block.data.data();  // Will need to delete later
+  }
+}
+
 void Table::ReadProperties(const Slice& props_handle_value) {
   Rep* r = rep_;
   Slice v = props_handle_value;
@@ -205,6 +290,13 @@ static void ReleaseBlock(void* arg, void* h) {
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
                              const Slice& index_value) {
+  return BlockReader(arg, options, index_value, false);
+}
+
+// Same as above, but return an iterator for point lookups if
+// "point_lookup" is true.
+Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
+                             const Slice& index_value, bool point_lookup) {
   Table* table = reinterpret_cast<Table*>(arg);
   Cache* block_cache = table->rep_->options.block_cache;
   Block* block = NULL;
@@ -229,7 +321,7 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
       } else {
         s = ReadBlock(table->rep_->file, options, handle, &contents);
         if (s.ok()) {
-          block = new Block(contents);
+          block = new Block(contents, table->rep_->hash_index);
           if (contents.cachable && options.fill_cache) {
             cache_handle = block_cache->Insert(key, block, block->size(),
                                                &DeleteCachedBlock);
@@ -239,14 +331,16 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
     } else {
       s = ReadBlock(table->rep_->file, options, handle, &contents);
       if (s.ok()) {
-        block = new Block(contents);
+        block = new Block(contents, table->rep_->hash_index);
       }
     }
   }
 
   Iterator* iter;
   if (block != NULL) {
-    iter = block->NewIterator(table->rep_->options.comparator);
+    const Comparator* const cmp = table->rep_->options.comparator;
+    iter = point_lookup ? block->NewPointIterator(cmp)
+                        : block->NewIterator(cmp);
     if (cache_handle == NULL) {
       iter->RegisterCleanup(&DeleteBlock, block, NULL);
     } else {
@@ -258,16 +352,125 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
   return iter;
 }
 
+// Decode the handles of an index partition and its filter from a top-level
+// index value and return the partition, reading it from the file if it is
+// not yet loaded.
+Status Table::LoadIndexPartition(const Slice& partition_handles,
+                                 IndexPartition** result) {
+  Rep* const r = rep_;
+  Slice input = partition_handles;
+  BlockHandle index_handle;
+  BlockHandle filter_handle;
+  Status s = index_handle.DecodeFrom(&input);
+  if (s.ok()) {
+    s = filter_handle.DecodeFrom(&input);
+  }
+  if (!s.ok()) {
+    return s;
+  }
+
+  {
+    MutexLock l(&r->mutex);
+    std::map<uint64_t, IndexPartition*>::iterator it =
+        r->partitions.find(index_handle.offset());
+    if (it != r->partitions.end()) {
+      *result = it->second;
+      return s;
+    }
+  }
+
+  // Read without holding the mutex; a racing reader of the same partition
+  // will find ours already installed and drop its copy
+  ReadOptions opt;
+  if (r->options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
+  BlockContents contents;
+  s = ReadBlock(r->file, opt, index_handle, &contents);
+  if (!s.ok()) {
+    return s;
+  }
+  IndexPartition* partition = new IndexPartition;
+  partition->index = new IndexBlockReader(contents);
+  if (r->partitioned_filter && filter_handle.size() != 0) {
+    BlockContents block;
+    // Filter errors are not fatal, the partition just goes without a filter
+    if (ReadBlock(r->file, opt, filter_handle, &block).ok()) {
+      partition->filter = block.data;
+      if (block.heap_allocated) {
+        partition->filter_data = block.data.data();  // Deleted later
+      }
+    }
+  }
+
+  MutexLock l(&r->mutex);
+  std::pair<std::map<uint64_t, IndexPartition*>::iterator, bool> ins =
+      r->partitions.insert(std::make_pair(index_handle.offset(), partition));
+  if (!ins.second) {
+    delete partition;
+  }
+  *result = ins.first->second;
+  return s;
+}
+
+// Convert a top-level index value into an iterator over the contents of
+// the corresponding index partition.
+Iterator* Table::IndexPartitionReader(void* arg, const ReadOptions& options,
+                                      const Slice& partition_handles) {
+  Table* table = reinterpret_cast<Table*>(arg);
+  IndexPartition* partition;
+  Status s = table->LoadIndexPartition(partition_handles, &partition);
+  if (s.ok()) {
+    return partition->index->NewIterator(table->rep_->options.comparator);
+  } else {
+    return NewErrorIterator(s);
+  }
+}
+
+Iterator* Table::NewIndexIterator(const ReadOptions& options) const {
+  Iterator* iter = rep_->index_block->NewIterator(rep_->options.comparator);
+  if (rep_->partitioned_index) {
+    iter = NewTwoLevelIterator(iter, &Table::IndexPartitionReader,
+                               const_cast<Table*>(this), options);
+  }
+  return iter;
+}
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+  if (!options.prefix.empty() && rep_->prefix_policy != NULL &&
+      !rep_->prefix_policy->KeyMayMatch(options.prefix, rep_->prefix_filter)) {
+    return NewEmptyIterator();  // No keys with the prefix
+  }
+  return NewTwoLevelIterator(NewIndexIterator(options), &Table::BlockReader,
+                             const_cast<Table*>(this), options);
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
                           void (*saver)(void*, const Slice&, const Slice&)) {
   Status s;
-  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* iiter;
+  if (rep_->partitioned_index) {
+    // Locate the index partition of the key and consult its filter
+    Iterator* titer = rep_->index_block->NewIterator(rep_->options.comparator);
+    titer->Seek(k);
+    IndexPartition* partition = NULL;
+    if (titer->Valid()) {
+      s = LoadIndexPartition(titer->value(), &partition);
+    } else {
+      s = titer->status();
+    }
+    delete titer;
+    if (partition == NULL) {
+      return s;  // Not found or error
+    } else if (!partition->filter.empty() &&
+               !rep_->options.filter_policy->KeyMayMatch(k,
+                                                         partition->filter)) {
+      return s;  // Not found
+    }
+    iiter = partition->index->NewIterator(rep_->options.comparator);
+  } else {
+    iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  }
   iiter->Seek(k);
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
@@ -277,7 +480,7 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
         !filter->KeyMayMatch(handle.offset(), k)) {
       // Not found
     } else {
-      Iterator* block_iter = BlockReader(this, options, iiter->value());
+      Iterator* block_iter = BlockReader(this, options, iiter->value(), true);
       block_iter->Seek(k);
       if (block_iter->Valid()) {
         Slice v = (options.limit != 0) ? block_iter->value() : Slice();
@@ -295,8 +498,7 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
 }
 
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
-  Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* index_iter = NewIndexIterator(ReadOptions());
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
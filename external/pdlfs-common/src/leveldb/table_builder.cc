@@ -48,6 +48,21 @@ struct TableBuilder::Rep {
   FilterBlockBuilder* filter_block;
   TableProperties props_;
 
+  // If the index is partitioned, index_block holds the current index
+  // partition and partition_index maps the last key of each written index
+  // partition to the handles of that partition and its filter.
+  bool partitioned_index;
+  BlockBuilder partition_index;
+  FilterPartitionBuilder* filter_partition;
+  std::string last_index_key;  // Key of the last entry in index_block
+
+  // A bloom filter over the distinct key prefixes of the table if the
+  // options have a prefix extractor
+  const FilterPolicy* prefix_policy;
+  FilterPartitionBuilder* prefix_filter;
+  std::string last_prefix;
+  bool has_prefix;  // last_prefix is valid
+
   // We do not emit the index entry for a block until we have seen the
   // first key for the next data block.  This allows us to use shorter
   // keys in the index block.  For example, consider a block boundary
@@ -71,10 +86,29 @@ struct TableBuilder::Rep {
         num_entries(0),
         num_blocks(0),
         closed(false),
-        filter_block(options.filter_policy != NULL
-                         ? new FilterBlockBuilder(options.filter_policy)
-                         : NULL),
+        filter_block(NULL),
+        partitioned_index(options.index_partition_size != 0),
+        partition_index(options.index_block_restart_interval,
+                        options.comparator),
+        filter_partition(NULL),
+        prefix_policy(NULL),
+        prefix_filter(NULL),
+        has_prefix(false),
         pending_index_entry(false) {
+    if (options.data_block_hash_index) {
+      data_block.EnableHashIndex();
+    }
+    if (options.prefix_extractor != NULL) {
+      prefix_policy = NewBloomFilterPolicy(kPrefixFilterBitsPerKey);
+      prefix_filter = new FilterPartitionBuilder(prefix_policy);
+    }
+    if (options.filter_policy != NULL) {
+      if (partitioned_index) {
+        filter_partition = new FilterPartitionBuilder(options.filter_policy);
+      } else {
+        filter_block = new FilterBlockBuilder(options.filter_policy);
+      }
+    }
     assert(options.comparator != NULL);
   }
 };
@@ -101,6 +135,9 @@ TableBuilder::TableBuilder(const Options& options, WritableFile* file)
 TableBuilder::~TableBuilder() {
   assert(rep_->closed);  // Catch errors where caller forgot to call Finish()
   delete rep_->filter_block;
+  delete rep_->filter_partition;
+  delete rep_->prefix_filter;
+  delete rep_->prefix_policy;
   delete rep_;
 }
 
@@ -111,11 +148,21 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if ((options.index_partition_size != 0) != rep_->partitioned_index) {
+    return Status::InvalidArgument(
+        "changing index partitioning while building table");
+  }
+  if (options.data_block_hash_index != rep_->options.data_block_hash_index) {
+    return Status::InvalidArgument(
+        "changing data block hash index while building table");
+  }
 
   rep_->options = options;
   rep_->data_block.ChangeRestartInterval(rep_->options.block_restart_interval);
   rep_->index_block.ChangeRestartInterval(
       rep_->options.index_block_restart_interval);
+  rep_->partition_index.ChangeRestartInterval(
+      rep_->options.index_block_restart_interval);
   return Status::OK();
 }
 
@@ -140,10 +187,31 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
     assert(r->data_block.empty());
     r->index_block.AddIndexEntry(&r->last_key, &key, r->pending_handle);
     r->pending_index_entry = false;
+    if (r->partitioned_index) {
+      r->last_index_key.swap(r->last_key);
+      if (r->index_block.CurrentSizeEstimate() >=
+          r->options.index_partition_size) {
+        FlushIndexPartition();
+        if (!ok()) return;
+      }
+    }
   }
 
   if (r->filter_block != NULL) {
     r->filter_block->AddKey(key);
+  } else if (r->filter_partition != NULL) {
+    r->filter_partition->AddKey(key);
+  }
+
+  if (r->prefix_filter != NULL &&
+      r->options.prefix_extractor->InDomain(key)) {
+    Slice prefix = r->options.prefix_extractor->Transform(key);
+    // Keys sharing a prefix are adjacent so only check the last one
+    if (!r->has_prefix || prefix != Slice(r->last_prefix)) {
+      r->prefix_filter->AddKey(prefix);
+      r->last_prefix.assign(prefix.data(), prefix.size());
+      r->has_prefix = true;
+    }
   }
 
   r->last_key.assign(key.data(), key.size());
@@ -176,6 +244,32 @@ void TableBuilder::Flush() {
   }
 }
 
+// Write the current index partition along with a filter over the keys of
+// the data blocks it indexes, and point the top-level index at them.
+void TableBuilder::FlushIndexPartition() {
+  Rep* r = rep_;
+  assert(r->partitioned_index);
+  if (r->index_block.empty()) return;
+  BlockHandle filter_handle;
+  filter_handle.set_offset(0);
+  filter_handle.set_size(0);
+  if (r->filter_partition != NULL) {
+    WriteRawBlock(r->filter_partition->Finish(), kNoCompression,
+                  &filter_handle);
+  }
+  BlockHandle index_handle;
+  if (ok()) {
+    WriteBlock(r->index_block.Finish(), &index_handle);
+    r->index_block.Reset();
+  }
+  if (ok()) {
+    std::string handle_encoding;
+    index_handle.EncodeTo(&handle_encoding);
+    filter_handle.EncodeTo(&handle_encoding);
+    r->partition_index.Add(r->last_index_key, handle_encoding);
+  }
+}
+
 void TableBuilder::AddBlock(BlockBuilder* builder, BlockHandle* handle) {
   WriteBlock(builder->Finish(), handle);
   builder->Reset();
@@ -211,6 +305,24 @@ void TableBuilder::WriteBlock(const Slice& block_contents,
       }
       break;
     }
+
+    case kZstdCompression:
+    case kLz4Compression: {
+      std::string* compressed = &r->compressed_output;
+      bool ok = (type == kZstdCompression)
+                    ? port::Zstd_Compress(block_contents.data(),
+                                          block_contents.size(), compressed)
+                    : port::Lz4_Compress(block_contents.data(),
+                                         block_contents.size(), compressed);
+      if (ok && compressed->size() <
+                    block_contents.size() - (block_contents.size() / 8u)) {
+        raw_block_contents = *compressed;
+      } else {
+        raw_block_contents = block_contents;
+        type = kNoCompression;
+      }
+      break;
+    }
   }
   WriteRawBlock(raw_block_contents, type, handle);
   r->compressed_output.clear();
@@ -242,10 +354,23 @@ Status TableBuilder::Finish() {
   assert(!r->closed);
   r->closed = true;
   BlockHandle filter_block_handle;
+  BlockHandle prefix_filter_handle;
   BlockHandle props_block_handle;
   BlockHandle metaindex_block_handle;
   BlockHandle index_block_handle;
 
+  // Write the last index partition
+  if (ok() && r->partitioned_index) {
+    if (r->pending_index_entry) {
+      // Keep last_key intact for the table properties
+      r->last_index_key = r->last_key;
+      r->index_block.AddIndexEntry(&r->last_index_key, NULL,
+                                   r->pending_handle);
+      r->pending_index_entry = false;
+    }
+    FlushIndexPartition();
+  }
+
   // Write filter block
   if (ok()) {
     if (r->filter_block != NULL) {
@@ -254,6 +379,14 @@ Status TableBuilder::Finish() {
     }
   }
 
+  // Write prefix filter block
+  if (ok()) {
+    if (r->prefix_filter != NULL) {
+      WriteRawBlock(r->prefix_filter->Finish(), kNoCompression,
+                    &prefix_filter_handle);
+    }
+  }
+
   // Write stats
   if (ok()) {
     r->props_.SetLastKey(r->last_key);
@@ -275,6 +408,27 @@ Status TableBuilder::Finish() {
       meta_index_block.Add(key, handle_encoding);
     }
 
+    if (r->filter_partition != NULL) {
+      // Mark that index partitions are paired with filters built by "Name"
+      std::string key = "partitionedfilter.";
+      key.append(r->options.filter_policy->Name());
+      meta_index_block.Add(key, Slice());
+    }
+
+    if (r->prefix_filter != NULL) {
+      // Add mapping from "prefixfilter.Name" to location of prefix filter
+      std::string key = "prefixfilter.";
+      key.append(r->options.prefix_extractor->Name());
+      std::string handle_encoding;
+      prefix_filter_handle.EncodeTo(&handle_encoding);
+      meta_index_block.Add(key, handle_encoding);
+    }
+
+    if (r->options.data_block_hash_index) {
+      // Mark that data blocks carry a hash index
+      meta_index_block.Add("datablock.hashindex", Slice());
+    }
+
     std::string key = "table.properties";
     std::string handle_encoding;
     props_block_handle.EncodeTo(&handle_encoding);
@@ -286,11 +440,15 @@ Status TableBuilder::Finish() {
 
   // Write index block
   if (ok()) {
-    if (r->pending_index_entry) {
-      r->index_block.AddIndexEntry(&r->last_key, NULL, r->pending_handle);
-      r->pending_index_entry = false;
+    if (r->partitioned_index) {
+      WriteBlock(r->partition_index.Finish(), &index_block_handle);
+    } else {
+      if (r->pending_index_entry) {
+        r->index_block.AddIndexEntry(&r->last_key, NULL, r->pending_handle);
+        r->pending_index_entry = false;
+      }
+      WriteBlock(r->index_block.Finish(), &index_block_handle);
     }
-    WriteBlock(r->index_block.Finish(), &index_block_handle);
   }
 
   // Write footer
@@ -298,6 +456,7 @@ Status TableBuilder::Finish() {
     Footer footer;
     footer.set_metaindex_handle(metaindex_block_handle);
     footer.set_index_handle(index_block_handle);
+    footer.set_partitioned_index(r->partitioned_index);
     std::string footer_encoding;
     footer.EncodeTo(&footer_encoding);
     r->status = r->file->Append(footer_encoding);
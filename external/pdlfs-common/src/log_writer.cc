@@ -18,6 +18,7 @@
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/crc32c.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
 
 namespace pdlfs {
 namespace log {
@@ -29,20 +30,71 @@ static void InitTypeCrc(uint32_t* type_crc) {
   }
 }
 
-Writer::Writer(WritableFile* dest) : dest_(dest), block_offset_(0) {
+Writer::Writer(WritableFile* dest)
+    : dest_(dest), pipelined_(false), block_offset_(0), offset_(0) {
   InitTypeCrc(type_crc_);
 }
 
 Writer::Writer(WritableFile* dest, uint64_t dest_length)
     : dest_(dest),
+      pipelined_(false),
       block_offset_(dest_length % kBlockSize),
       offset_(dest_length) {
   InitTypeCrc(type_crc_);
 }
 
-Writer::~Writer() {}
+Writer::Writer(WritableFile* dest, uint64_t dest_length, bool pipelined)
+    : dest_(dest),
+      pipelined_(pipelined),
+      block_offset_(dest_length % kBlockSize),
+      offset_(dest_length) {
+  InitTypeCrc(type_crc_);
+}
+
+Writer::~Writer() {
+  if (pipelined_) {
+    FlushBuffer();
+  }
+}
+
+Status Writer::Write(const Slice& data) {
+  if (pipelined_) {
+    buf_.append(data.data(), data.size());
+    return Status::OK();
+  } else {
+    return dest_->Append(data);
+  }
+}
+
+Status Writer::FlushBuffer() {
+  assert(pipelined_);
+  MutexLock io(&io_mu_);
+  std::string data;
+  {
+    MutexLock l(&mu_);
+    data.swap(buf_);
+  }
+  // New records may be added to buf_ while we are writing
+  Status s;
+  if (!data.empty()) {
+    s = dest_->Append(data);
+    if (s.ok()) {
+      s = dest_->Flush();
+    }
+  }
+  return s;
+}
+
+Status Writer::Flush() {
+  if (pipelined_) {
+    return FlushBuffer();
+  } else {
+    return Status::OK();
+  }
+}
 
 Status Writer::AddRecord(const Slice& slice) {
+  if (pipelined_) mu_.Lock();
   const char* ptr = slice.data();
   size_t left = slice.size();
 
@@ -59,7 +111,7 @@ Status Writer::AddRecord(const Slice& slice) {
       if (leftover > 0) {
         // Fill the trailer (literal below relies on kHeaderSize being 7)
         assert(kHeaderSize == 7);
-        s = dest_->Append(Slice("\x00\x00\x00\x00\x00\x00", leftover));
+        s = Write(Slice("\x00\x00\x00\x00\x00\x00", leftover));
         offset_ += leftover;
       }
       block_offset_ = 0;
@@ -90,6 +142,7 @@ Status Writer::AddRecord(const Slice& slice) {
       begin = false;
     }
   } while (s.ok() && left > 0);
+  if (pipelined_) mu_.Unlock();
   return s;
 }
 
@@ -109,10 +162,10 @@ Status Writer::EmitPhysicalRecord(RecordType t, const char* ptr, size_t n) {
   EncodeFixed32(buf, crc);
 
   // Write the header and the payload
-  Status s = dest_->Append(Slice(buf, kHeaderSize));
+  Status s = Write(Slice(buf, kHeaderSize));
   if (s.ok()) {
-    s = dest_->Append(Slice(ptr, n));
-    if (s.ok()) {
+    s = Write(Slice(ptr, n));
+    if (s.ok() && !pipelined_) {
       s = dest_->Flush();
     }
   }
@@ -122,7 +175,15 @@ Status Writer::EmitPhysicalRecord(RecordType t, const char* ptr, size_t n) {
 }
 
 Status Writer::Sync() {
-  Status s = dest_->Sync();
+  Status s;
+  if (pipelined_) {
+    // Records added after the buffer is swapped out will be covered by
+    // the next Sync()
+    s = FlushBuffer();
+  }
+  if (s.ok()) {
+    s = dest_->Sync();
+  }
   return s;
 }
 
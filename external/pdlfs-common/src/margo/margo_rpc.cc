@@ -106,13 +106,22 @@ Status MargoRPC::Client::Call(Message& in, Message& out) RPCNOEXCEPT {
   if (ret != HG_SUCCESS) return Status::Disconnected(Slice());
   assert(entry != NULL);
   hg_addr_t addr = entry->value->rep;
+  MercuryRPC::Envelope req(&in);
+  MercuryRPC::Envelope rep(&out);
+  // Large payloads are moved by the server through bulk transfers
+  // driven by the same margo progress loop
+  ret = rpc_->hg_->ExposeBulk(in, out, &req);
+  if (ret != HG_SUCCESS) {
+    rpc_->Release(entry);
+    return Status::Disconnected(Slice());
+  }
   hg_handle_t handle;
   ret = HG_Create(rpc_->hg_->hg_context_, addr, rpc_->hg_rpc_id_, &handle);
   if (ret == HG_SUCCESS) {
-    ret = margo_forward_timed(rpc_->margo_id_, handle, &in,
+    ret = margo_forward_timed(rpc_->margo_id_, handle, &req,
                               rpc_->rpc_timeout_ / 1000);
     if (ret == HG_SUCCESS) {
-      ret = HG_Get_output(handle, &out);
+      ret = HG_Get_output(handle, &rep);
       if (ret == HG_SUCCESS) {
         /*
          * XXX: HG_Get_output() adds a reference to the handle.
@@ -123,18 +132,20 @@ Status MargoRPC::Client::Call(Message& in, Message& out) RPCNOEXCEPT {
          * state->out yet), but we know that our proc function does
          * not malloc anything (see RPCMessageCoder() above here).
          * instead it copies all the data out of the handle into state->out.
-         * in fact, HG_FREE doesn't do anything in RPCMessageCoder().
+         * in fact, HG_FREE only releases bulk handles in RPCMessageCoder(),
+         * and replies never carry any.
          * so for this special case, it is safe to call HG_Free_output()
          * directly after calling HG_Get_output().  (longer term
          * our RPC framework may need an additional call for clients
          * to indicate they are done so anything malloc'd on the out
          * structure can be freed...)
          */
-        HG_Free_output(handle, &out);
+        HG_Free_output(handle, &rep);
       }
     }
     HG_Destroy(handle);
   }
+  MercuryRPC::ReleaseBulk(&req);
   rpc_->Release(entry);
   if (ret != HG_SUCCESS) {
     return Status::Disconnected(Slice());
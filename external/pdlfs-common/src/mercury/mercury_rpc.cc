@@ -10,14 +10,24 @@
  */
 #include "mercury_rpc.h"
 
+#include "pdlfs-common/histogram.h"
+
+#include <algorithm>
 #include <stdio.h>
 
 namespace pdlfs {
 namespace rpc {
 
+enum EnvelopeFlags {
+  kBulkContents = 0x1,    // Contents are exposed through a bulk handle
+  kReplyBuffer = 0x2,     // A handle to the caller's reply buffer follows
+  kPushedContents = 0x4,  // Contents were pushed into the reply buffer
+};
+
 hg_return_t MercuryRPC::RPCMessageCoder(hg_proc_t proc, void* data) {
   hg_return_t ret;
-  If::Message* msg = reinterpret_cast<If::Message*>(data);
+  Envelope* env = reinterpret_cast<Envelope*>(data);
+  If::Message* msg = env->msg;
   hg_proc_op_t op = hg_proc_get_op(proc);
 
   switch (op) {
@@ -28,12 +38,24 @@ hg_return_t MercuryRPC::RPCMessageCoder(hg_proc_t proc, void* data) {
         hg_int8_t err_code = static_cast<int8_t>(msg->err);
         ret = hg_proc_hg_int8_t(proc, &err_code);
         if (ret == HG_SUCCESS) {
-          hg_uint16_t len = static_cast<uint16_t>(msg->contents.size());
-          ret = hg_proc_hg_uint16_t(proc, &len);
+          hg_uint32_t len = static_cast<uint32_t>(msg->contents.size());
+          ret = hg_proc_hg_uint32_t(proc, &len);
           if (ret == HG_SUCCESS) {
-            if (len > 0) {
-              char* p = const_cast<char*>(&msg->contents[0]);
-              ret = hg_proc_memcpy(proc, p, len);
+            hg_uint8_t flags = 0;
+            if (env->bulk != HG_BULK_NULL) flags |= kBulkContents;
+            if (env->reply_bulk != HG_BULK_NULL) flags |= kReplyBuffer;
+            if (env->pushed) flags |= kPushedContents;
+            ret = hg_proc_hg_uint8_t(proc, &flags);
+            if (ret == HG_SUCCESS) {
+              if (env->bulk != HG_BULK_NULL) {
+                ret = hg_proc_hg_bulk_t(proc, &env->bulk);
+              } else if (!env->pushed && len > 0) {
+                char* p = const_cast<char*>(&msg->contents[0]);
+                ret = hg_proc_memcpy(proc, p, len);
+              }
+            }
+            if (ret == HG_SUCCESS && env->reply_bulk != HG_BULK_NULL) {
+              ret = hg_proc_hg_bulk_t(proc, &env->reply_bulk);
             }
           }
         }
@@ -50,10 +72,24 @@ hg_return_t MercuryRPC::RPCMessageCoder(hg_proc_t proc, void* data) {
         ret = hg_proc_hg_int8_t(proc, &err);
         if (ret == HG_SUCCESS) {
           msg->err = err;
-          hg_uint16_t len;
-          ret = hg_proc_hg_uint16_t(proc, &len);
+          hg_uint32_t len;
+          ret = hg_proc_hg_uint32_t(proc, &len);
+          hg_uint8_t flags = 0;
           if (ret == HG_SUCCESS) {
-            if (len > 0) {
+            ret = hg_proc_hg_uint8_t(proc, &flags);
+          }
+          if (ret == HG_SUCCESS) {
+            if ((flags & kBulkContents) != 0) {
+              // Contents are pulled by the receiver later
+              ret = hg_proc_hg_bulk_t(proc, &env->bulk);
+            } else if ((flags & kPushedContents) != 0) {
+              if (len <= msg->extra_buf.size()) {
+                env->pushed = true;
+                msg->contents = Slice(msg->extra_buf.data(), len);
+              } else {
+                ret = HG_OTHER_ERROR;
+              }
+            } else if (len > 0) {
               char* p;
               if (len <= sizeof(msg->buf)) {
                 p = &msg->buf[0];
@@ -67,11 +103,26 @@ hg_return_t MercuryRPC::RPCMessageCoder(hg_proc_t proc, void* data) {
               msg->contents = Slice(p, len);
             }
           }
+          if (ret == HG_SUCCESS && (flags & kReplyBuffer) != 0) {
+            ret = hg_proc_hg_bulk_t(proc, &env->reply_bulk);
+          }
         }
       }
       break;
     }
 
+    case HG_FREE: {
+      // Only handles decoded from the wire are ever freed here
+      ret = HG_SUCCESS;
+      if (env->bulk != HG_BULK_NULL) {
+        ret = hg_proc_hg_bulk_t(proc, &env->bulk);
+      }
+      if (ret == HG_SUCCESS && env->reply_bulk != HG_BULK_NULL) {
+        ret = hg_proc_hg_bulk_t(proc, &env->reply_bulk);
+      }
+      break;
+    }
+
     default:
       ret = HG_SUCCESS;
   }
@@ -92,19 +143,163 @@ hg_return_t MercuryRPC::RPCCallbackDecorator(hg_handle_t handle) {
   return HG_SUCCESS;
 }
 
-hg_return_t MercuryRPC::RPCCallback(hg_handle_t handle) {
+struct MercuryRPC::ServerCall {
+  ServerCall(MercuryRPC* r, hg_handle_t h)
+      : rpc(r), handle(h), in(&input), out(&output), local(HG_BULK_NULL) {}
+
+  MercuryRPC* rpc;
+  hg_handle_t handle;
   If::Message input;
   If::Message output;
-  hg_return_t ret = HG_Get_input(handle, &input);
+  Envelope in;
+  Envelope out;
+  hg_bulk_t local;  // Local end of the bulk transfer in progress
+};
+
+hg_return_t MercuryRPC::RPCCallback(hg_handle_t handle) {
+  ServerCall* call = new ServerCall(registered_data(handle), handle);
+  hg_return_t ret = HG_Get_input(handle, &call->in);
+  if (ret != HG_SUCCESS) {
+    HG_Destroy(handle);
+    delete call;
+    return ret;
+  }
+
+  if (call->in.bulk == HG_BULK_NULL) {
+    Execute(call);
+    return HG_SUCCESS;
+  }
+
+  // Pull large request contents from the client before executing the call
+  hg_size_t size = HG_Bulk_get_size(call->in.bulk);
+  call->input.extra_buf.resize(size);
+  ret = call->rpc->StartTransfer(call, HG_BULK_PULL, call->in.bulk,
+                                 &call->input.extra_buf[0], size, PullDone);
+  if (ret != HG_SUCCESS) {
+    // XXX: The client will see a timeout
+    HG_Free_input(handle, &call->in);
+    HG_Destroy(handle);
+    delete call;
+  }
+  return ret;
+}
+
+hg_return_t MercuryRPC::StartTransfer(ServerCall* call, hg_bulk_op_t op,
+                                      hg_bulk_t remote, void* buf,
+                                      hg_size_t size, hg_cb_t cb) {
+  assert(call->local == HG_BULK_NULL);
+  hg_return_t ret = HG_Bulk_create(
+      hg_class_, 1, &buf, &size,
+      op == HG_BULK_PULL ? HG_BULK_WRITE_ONLY : HG_BULK_READ_ONLY,
+      &call->local);
   if (ret == HG_SUCCESS) {
-    registered_data(handle)->fs_->Call(input, output);  // Execute callback
-    ret = HG_Respond(handle, NULL, NULL, &output);
-    HG_Free_input(handle, &input);
+    const hg_info* info = HG_Get_info(call->handle);
+    ret = HG_Bulk_transfer(info->context, cb, call, op, info->addr, remote, 0,
+                           call->local, 0, size, HG_OP_ID_IGNORE);
+    if (ret != HG_SUCCESS) {
+      HG_Bulk_free(call->local);
+      call->local = HG_BULK_NULL;
+    }
+  }
+  return ret;
+}
+
+hg_return_t MercuryRPC::PullDone(const hg_cb_info* info) {
+  ServerCall* call = reinterpret_cast<ServerCall*>(info->arg);
+  HG_Bulk_free(call->local);
+  call->local = HG_BULK_NULL;
+  if (info->ret != HG_SUCCESS) {
+    // XXX: The client will see a timeout
+    HG_Free_input(call->handle, &call->in);
+    HG_Destroy(call->handle);
+    delete call;
+  } else {
+    call->input.contents = Slice(call->input.extra_buf);
+    // Bulk callbacks run in the progress loop, so we move the
+    // actual work to the thread pool if there is one
+    MercuryRPC* rpc = call->rpc;
+    if (rpc->pool_ != NULL) {
+      rpc->pool_->Schedule(ExecuteWrapper, call);
+    } else {
+      Execute(call);
+    }
+  }
+  return HG_SUCCESS;
+}
+
+void MercuryRPC::Execute(ServerCall* call) {
+  MercuryRPC* rpc = call->rpc;
+  const uint64_t start = CurrentMicros();
+  rpc->fs_->Call(call->input, call->output);  // Execute callback
+  if (rpc->latency_hist_ != NULL) {
+    rpc->latency_hist_->Add(CurrentMicros() - start);
+  }
+  Slice contents = call->output.contents;
+  // Push a large reply directly into the client's buffer if there is room
+  if (contents.size() > rpc->bulk_threshold_ &&
+      call->in.reply_bulk != HG_BULK_NULL &&
+      contents.size() <= HG_Bulk_get_size(call->in.reply_bulk)) {
+    hg_return_t ret = rpc->StartTransfer(
+        call, HG_BULK_PUSH, call->in.reply_bulk,
+        const_cast<char*>(contents.data()), contents.size(), PushDone);
+    if (ret == HG_SUCCESS) {
+      return;
+    }
+  }
+
+  Respond(call);
+}
+
+hg_return_t MercuryRPC::PushDone(const hg_cb_info* info) {
+  ServerCall* call = reinterpret_cast<ServerCall*>(info->arg);
+  HG_Bulk_free(call->local);
+  call->local = HG_BULK_NULL;
+  // Fall back to an inline reply if the push failed
+  call->out.pushed = (info->ret == HG_SUCCESS);
+  Respond(call);
+  return HG_SUCCESS;
+}
+
+void MercuryRPC::Respond(ServerCall* call) {
+  HG_Respond(call->handle, NULL, NULL, &call->out);
+  HG_Free_input(call->handle, &call->in);
+  HG_Destroy(call->handle);
+  delete call;
+}
+
+hg_return_t MercuryRPC::ExposeBulk(If::Message& in, If::Message& out,
+                                   Envelope* env) {
+  hg_return_t ret = HG_SUCCESS;
+  if (in.contents.size() > bulk_threshold_) {
+    void* p = const_cast<char*>(in.contents.data());
+    hg_size_t size = in.contents.size();
+    ret = HG_Bulk_create(hg_class_, 1, &p, &size, HG_BULK_READ_ONLY,
+                         &env->bulk);
+  }
+  if (ret == HG_SUCCESS && out.extra_buf.capacity() > bulk_threshold_) {
+    out.extra_buf.resize(out.extra_buf.capacity());
+    void* p = &out.extra_buf[0];
+    hg_size_t size = out.extra_buf.size();
+    ret = HG_Bulk_create(hg_class_, 1, &p, &size, HG_BULK_WRITE_ONLY,
+                         &env->reply_bulk);
+  }
+  if (ret != HG_SUCCESS) {
+    ReleaseBulk(env);
   }
-  HG_Destroy(handle);
   return ret;
 }
 
+void MercuryRPC::ReleaseBulk(Envelope* env) {
+  if (env->bulk != HG_BULK_NULL) {
+    HG_Bulk_free(env->bulk);
+    env->bulk = HG_BULK_NULL;
+  }
+  if (env->reply_bulk != HG_BULK_NULL) {
+    HG_Bulk_free(env->reply_bulk);
+    env->reply_bulk = HG_BULK_NULL;
+  }
+}
+
 void MercuryRPC::Append(Timer* t) {
   t->next = &timers_;
   t->prev = timers_.prev;
@@ -172,7 +367,8 @@ static hg_return_t SaveReply(const hg_cb_info* info) {
        * state->out yet), but we know that our proc function does
        * not malloc anything (see RPCMessageCoder() above here).
        * instead it copies all the data out of the handle into state->out.
-       * in fact, HG_FREE doesn't do anything in RPCMessageCoder().
+       * in fact, HG_FREE only releases bulk handles in RPCMessageCoder(),
+       * and replies never carry any.
        * so for this special case, it is safe to call HG_Free_output()
        * directly after calling HG_Get_output().  (longer term
        * our RPC framework may need an additional call for clients
@@ -196,17 +392,41 @@ Status MercuryRPC::Client::Call(Message& in, Message& out) RPCNOEXCEPT {
   if (ret != HG_SUCCESS) return Status::Disconnected(Slice());
   assert(addr_entry != NULL);
   hg_addr_t addr = addr_entry->value->rep;
+  Envelope req(&in);
+  Envelope rep(&out);
+  ret = rpc_->ExposeBulk(in, out, &req);
+  if (ret != HG_SUCCESS) {
+    rpc_->Release(addr_entry);
+    return Status::Disconnected(Slice());
+  }
+  // Spread calls across contexts. The same context id is targeted at
+  // the server so that calls are also processed by different contexts there.
+  hg_context_t* ctx = rpc_->hg_context_;
+  hg_uint8_t target = 0;
+  const size_t num_contexts = rpc_->hg_contexts_.size();
+  if (num_contexts > 1) {
+    mu_.Lock();
+    target = static_cast<hg_uint8_t>(next_context_++ % num_contexts);
+    mu_.Unlock();
+    ctx = rpc_->hg_contexts_[target];
+  }
   hg_handle_t handle;
-  ret = HG_Create(rpc_->hg_context_, addr, rpc_->hg_rpc_id_, &handle);
+  ret = HG_Create(ctx, addr, rpc_->hg_rpc_id_, &handle);
+  if (ret == HG_SUCCESS && num_contexts > 1) {
+    ret = HG_Set_target_id(handle, target);
+    if (ret != HG_SUCCESS) {
+      HG_Destroy(handle);
+    }
+  }
   if (ret == HG_SUCCESS) {
     RPCState state;
     state.rpc_done = false;
     state.rpc_mu = &mu_;
     state.rpc_cv = &cv_;
-    state.out = &out;
+    state.out = &rep;
     Timer timer;
     // XXX: HG_Forward is non-blocking so we wait on the callback
-    ret = HG_Forward(handle, SaveReply, &state, &in);
+    ret = HG_Forward(handle, SaveReply, &state, &req);
     if (ret == HG_SUCCESS) {
       rpc_->AddTimerFor(handle, &timer);
       MutexLock ml(&mu_);
@@ -223,6 +443,7 @@ Status MercuryRPC::Client::Call(Message& in, Message& out) RPCNOEXCEPT {
 
     HG_Destroy(handle);
   }
+  ReleaseBulk(&req);
   rpc_->Release(addr_entry);
   if (ret != HG_SUCCESS) {
     return Status::Disconnected(Slice());
@@ -247,13 +468,32 @@ MercuryRPC::MercuryRPC(bool listen, const RPCOptions& options)
       lookup_cv_(&mutex_),
       addr_cache_(options.addr_cache_size),
       refs_(0),
+      bulk_threshold_(options.bulk_threshold),
       rpc_timeout_(options.rpc_timeout),
       pool_(options.extra_workers),
       env_(options.env),
-      fs_(options.fs) {
+      fs_(options.fs),
+      latency_hist_(options.latency_hist) {
   hg_class_ = HG_Init(options.uri.c_str(), (listen) ? HG_TRUE : HG_FALSE);
-  if (hg_class_) hg_context_ = HG_Context_create(hg_class_);
-  if (hg_class_ == NULL || hg_context_ == NULL) {
+  hg_context_ = NULL;
+  const int num_contexts = std::max(options.num_contexts, 1);
+  if (hg_class_ != NULL) {
+    for (int i = 0; i < num_contexts; i++) {
+      hg_context_t* ctx;
+      if (num_contexts == 1) {
+        ctx = HG_Context_create(hg_class_);
+      } else {
+        ctx = HG_Context_create_id(hg_class_, static_cast<hg_uint8_t>(i));
+      }
+      if (ctx == NULL) break;
+      hg_contexts_.push_back(ctx);
+    }
+    if (!hg_contexts_.empty()) {
+      hg_context_ = hg_contexts_[0];
+    }
+  }
+  if (hg_class_ == NULL ||
+      hg_contexts_.size() != static_cast<size_t>(num_contexts)) {
     char msg[] = "Cannot init hg\n";
     fwrite(msg, 1, sizeof(msg), stderr);
     abort();
@@ -271,7 +511,9 @@ MercuryRPC::~MercuryRPC() {
   assert(addr_cache_.Empty());
   mutex_.Unlock();
 
-  HG_Context_destroy(hg_context_);
+  for (size_t i = hg_contexts_.size(); i != 0; i--) {
+    HG_Context_destroy(hg_contexts_[i - 1]);
+  }
   HG_Finalize(hg_class_);
 }
 
@@ -369,18 +611,26 @@ std::string MercuryRPC::ToString(hg_addr_t addr) {
   return tmp;
 }
 
-// If there is a single looping thread, both HG_Progress and HG_Trigger
-// are called within that thread. If there are more than 1 threads,
-// the first thread only calls HG_Progress and the rest threads
-// call HG_Trigger.
+// Looping threads are assigned to contexts in a round-robin manner. If a
+// context is served by a single thread, both HG_Progress and HG_Trigger
+// are called within that thread. Otherwise, the first thread of the context
+// only calls HG_Progress and the rest of its threads call HG_Trigger.
+// In busy-polling mode, neither call ever blocks.
 void MercuryRPC::LocalLooper::BGLoop() {
   mutex_.Lock();
   int id = bg_id_++;
   mutex_.Unlock();
-  const int timeout = 200;  // in milliseconds
-  hg_context_t* ctx = rpc_->hg_context_;
+  const int timeout = busy_poll_ ? 0 : 200;  // in milliseconds
+  const int num_contexts = static_cast<int>(rpc_->hg_contexts_.size());
+  const int cid = id % num_contexts;
+  hg_context_t* ctx = rpc_->hg_contexts_[cid];
   hg_return_t ret = HG_SUCCESS;
-  int size = max_bg_loops_;
+  // Total number of threads serving the context
+  int size = max_bg_loops_ / num_contexts;
+  if (cid < max_bg_loops_ % num_contexts) {
+    size++;
+  }
+  const bool progress = (id < num_contexts);
 
   while (true) {
     if (shutting_down_.Acquire_Load() || ret != HG_SUCCESS) {
@@ -395,15 +645,15 @@ void MercuryRPC::LocalLooper::BGLoop() {
       return;
     }
 
-    if (id == 0) {
+    if (progress) {
       ret = HG_Progress(ctx, timeout);
     }
 
     if (ret == HG_SUCCESS) {
-      if (size <= 1 || id > 0) {
+      if (size <= 1 || !progress) {
         unsigned int actual_count = 1;
         while (actual_count != 0 && !shutting_down_.Acquire_Load()) {
-          if (id != 0) {
+          if (!progress) {
             ret = HG_Trigger(ctx, timeout, 1, &actual_count);
           } else {
             ret = HG_Trigger(ctx, 0, 1, &actual_count);
@@ -18,6 +18,7 @@
 #include <mercury_proc.h>
 #include <map>
 #include <string>
+#include <vector>
 
 namespace pdlfs {
 namespace rpc {
@@ -45,11 +46,13 @@ class MercuryRPC {
   void Ref();
 
   hg_class_t* hg_class_;
-  hg_context_t* hg_context_;
+  hg_context_t* hg_context_;  // Same as hg_contexts_[0]
+  std::vector<hg_context_t*> hg_contexts_;
   bool listen_;
 
   class LocalLooper;
   class Client;
+  struct Envelope;
 
   static hg_return_t RPCMessageCoder(hg_proc_t proc, void* data);
   static hg_return_t RPCCallbackDecorator(hg_handle_t handle);
@@ -59,6 +62,11 @@ class MercuryRPC {
     RPCCallback(handle);
   }
 
+  // Expose large request contents and the caller's reply buffer to the
+  // server through bulk handles. Handles are released via ReleaseBulk().
+  hg_return_t ExposeBulk(If::Message& in, If::Message& out, Envelope* env);
+  static void ReleaseBulk(Envelope* env);
+
   hg_id_t hg_rpc_id_;
 
   void RegisterRPC() {
@@ -90,6 +98,19 @@ class MercuryRPC {
     uint64_t due;
   };
 
+  // Server-side state of an incoming call that outlives its rpc callback
+  // while bulk transfers are in progress.
+  struct ServerCall;
+  hg_return_t StartTransfer(ServerCall* call, hg_bulk_op_t op, hg_bulk_t remote,
+                            void* buf, hg_size_t size, hg_cb_t cb);
+  static hg_return_t PullDone(const hg_cb_info* info);
+  static hg_return_t PushDone(const hg_cb_info* info);
+  static void Execute(ServerCall* call);
+  static void ExecuteWrapper(void* arg) {
+    Execute(reinterpret_cast<ServerCall*>(arg));
+  }
+  static void Respond(ServerCall* call);
+
   friend class Client;
   friend class LocalLooper;
   void AddTimerFor(hg_handle_t handle, Timer*);
@@ -107,10 +128,12 @@ class MercuryRPC {
   int refs_;
 
   // Constant after construction
+  size_t bulk_threshold_;
   uint64_t rpc_timeout_;
   ThreadPool* pool_;
   Env* env_;
   If* fs_;
+  ConcurrentHistogram* latency_hist_;
 };
 
 // ====================
@@ -127,6 +150,24 @@ struct MercuryRPC::Addr {
   }
 };
 
+// ====================
+// Mercury envelope
+// ====================
+
+// Wire representation of an rpc message. Small contents travel inline. Large
+// contents are left in the sender's memory and exposed through a bulk handle
+// for the receiver to pull. A request may additionally carry a handle to the
+// caller's reply buffer so that the server can push a large reply into it.
+struct MercuryRPC::Envelope {
+  explicit Envelope(If::Message* m)
+      : msg(m), bulk(HG_BULK_NULL), reply_bulk(HG_BULK_NULL), pushed(false) {}
+
+  If::Message* msg;
+  hg_bulk_t bulk;        // Contents, if not inline
+  hg_bulk_t reply_bulk;  // Caller's reply buffer, if exposed
+  bool pushed;           // Contents already written to msg->extra_buf
+};
+
 // ====================
 // Mercury looper
 // ====================
@@ -142,6 +183,7 @@ class MercuryRPC::LocalLooper {
 
   // Constant after construction
   bool ignore_rpc_error_;  // Keep looping even if we receive errors
+  bool busy_poll_;
   int max_bg_loops_;
   MercuryRPC* rpc_;
 
@@ -158,8 +200,14 @@ class MercuryRPC::LocalLooper {
         bg_loops_(0),
         bg_id_(0),
         ignore_rpc_error_(false),
+        busy_poll_(options.busy_poll),
         max_bg_loops_(options.num_rpc_threads),
         rpc_(rpc) {
+    // Each context needs at least one thread to drive its progress
+    const int num_contexts = static_cast<int>(rpc_->hg_contexts_.size());
+    if (max_bg_loops_ < num_contexts) {
+      max_bg_loops_ = num_contexts;
+    }
     rpc_->Ref();
   }
 
@@ -198,7 +246,10 @@ class MercuryRPC::LocalLooper {
 class MercuryRPC::Client : public If {
  public:
   explicit Client(MercuryRPC* rpc, const std::string& addr)
-      : rpc_(rpc), addr_(addr), cv_(&mu_) {
+      : rpc_(rpc),
+        addr_(addr),
+        next_context_(Hash(addr.data(), addr.size(), 0)),
+        cv_(&mu_) {
     rpc_->Ref();
   }
 
@@ -214,6 +265,8 @@ class MercuryRPC::Client : public If {
  private:
   MercuryRPC* rpc_;
   std::string addr_;  // Unresolved target address
+  // Calls rotate through contexts starting from a hash of the target
+  uint32_t next_context_;  // Protected by mu_
 
   port::Mutex mu_;
   port::CondVar cv_;
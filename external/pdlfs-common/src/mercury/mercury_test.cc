@@ -128,6 +128,21 @@ TEST(MercuryTest, SendReceive) {
   RunTasks(8);
 }
 
+TEST(MercuryTest, LargeMessage) {
+  Random rnd(301);
+  for (int i = 0; i < 3; ++i) {
+    std::string buf;
+    If::Message input;
+    input.contents = test::RandomString(&rnd, 100 << 10, &buf);
+    If::Message output;
+    if (i != 0) {  // Let the server push the reply into our buffer
+      output.extra_buf.reserve(128 << 10);
+    }
+    ASSERT_OK(server_->self_->Call(input, output));
+    ASSERT_EQ(input.contents, output.contents);
+  }
+}
+
 }  // namespace rpc
 }  // namespace pdlfs
 
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/metrics.h"
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/strutil.h"
+
+#include <ctype.h>
+#include <stdio.h>
+
+namespace pdlfs {
+
+struct MetricsRegistry::Metric {
+  enum Type { kCounter, kGauge, kHistogram };
+  explicit Metric(Type t)
+      : type(t), counter(NULL), probe(NULL), arg(NULL), hist(NULL) {}
+  ~Metric() { delete counter; }
+
+  Type type;
+  MetricsCounter* counter;  // Owned by us
+  Probe probe;
+  void* arg;
+  ConcurrentHistogram* hist;
+};
+
+MetricsRegistry::MetricsRegistry() {}
+
+MetricsRegistry::~MetricsRegistry() {
+  for (MetricMap::iterator it = metrics_.begin(); it != metrics_.end(); ++it) {
+    delete it->second;
+  }
+}
+
+MetricsCounter* MetricsRegistry::GetCounter(const std::string& name) {
+  MutexLock ml(&mu_);
+  Metric*& m = metrics_[name];
+  if (m != NULL && m->type != Metric::kCounter) {
+    delete m;
+    m = NULL;
+  }
+  if (m == NULL) {
+    m = new Metric(Metric::kCounter);
+    m->counter = new MetricsCounter;
+  }
+  return m->counter;
+}
+
+void MetricsRegistry::AddGauge(const std::string& name, Probe probe,
+                               void* arg) {
+  MutexLock ml(&mu_);
+  Metric*& m = metrics_[name];
+  delete m;
+  m = new Metric(Metric::kGauge);
+  m->probe = probe;
+  m->arg = arg;
+}
+
+void MetricsRegistry::AddHistogram(const std::string& name,
+                                   ConcurrentHistogram* hist) {
+  MutexLock ml(&mu_);
+  Metric*& m = metrics_[name];
+  delete m;
+  m = new Metric(Metric::kHistogram);
+  m->hist = hist;
+}
+
+void MetricsRegistry::Remove(const std::string& prefix) {
+  MutexLock ml(&mu_);
+  MetricMap::iterator it = metrics_.lower_bound(prefix);
+  while (it != metrics_.end()) {
+    const Slice name(it->first);
+    if (!name.starts_with(prefix)) {
+      break;
+    } else if (name.size() == prefix.size() || name[prefix.size()] == '.') {
+      delete it->second;
+      metrics_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool MetricsRegistry::GetValue(const std::string& name,
+                               uint64_t* value) const {
+  MutexLock ml(&mu_);
+  MetricMap::const_iterator it = metrics_.find(name);
+  if (it == metrics_.end()) {
+    return false;
+  }
+  const Metric* const m = it->second;
+  if (m->type == Metric::kCounter) {
+    *value = m->counter->Value();
+    return true;
+  } else if (m->type == Metric::kGauge) {
+    *value = m->probe(m->arg);
+    return true;
+  } else {
+    return false;
+  }
+}
+
+std::string MetricsRegistry::Dump(Format fmt) const {
+  std::string result;
+  MutexLock ml(&mu_);
+  if (fmt == kPrometheus) {
+    DumpPrometheus(&result);
+  } else {
+    DumpJson(&result);
+  }
+  return result;
+}
+
+namespace {
+// Percentiles reported for histograms
+const double kQuantiles[] = {50, 90, 99, 99.9};
+
+void AppendDouble(std::string* dst, double d) {
+  char tmp[50];
+  snprintf(tmp, sizeof(tmp), "%.3f", d);
+  dst->append(tmp);
+}
+
+// Prometheus metric names may only contain [a-zA-Z0-9_:]
+std::string PrometheusName(const std::string& name) {
+  std::string result = name;
+  for (size_t i = 0; i < result.size(); i++) {
+    const char c = result[i];
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '_' && c != ':') {
+      result[i] = '_';
+    }
+  }
+  return result;
+}
+}  // namespace
+
+void MetricsRegistry::DumpJson(std::string* dst) const {
+  mu_.AssertHeld();
+  dst->push_back('{');
+  for (MetricMap::const_iterator it = metrics_.begin(); it != metrics_.end();
+       ++it) {
+    if (it != metrics_.begin()) dst->push_back(',');
+    dst->push_back('"');
+    dst->append(it->first);
+    dst->append("\":");
+    const Metric* const m = it->second;
+    if (m->type == Metric::kCounter) {
+      AppendNumberTo(dst, m->counter->Value());
+    } else if (m->type == Metric::kGauge) {
+      AppendNumberTo(dst, m->probe(m->arg));
+    } else {
+      Histogram hist;
+      m->hist->Snapshot(&hist);
+      dst->append("{\"count\":");
+      AppendNumberTo(dst, static_cast<uint64_t>(hist.Count()));
+      dst->append(",\"avg\":");
+      AppendDouble(dst, hist.Average());
+      for (size_t i = 0; i < sizeof(kQuantiles) / sizeof(double); i++) {
+        char tmp[20];
+        snprintf(tmp, sizeof(tmp), ",\"p%g\":", kQuantiles[i]);
+        dst->append(tmp);
+        AppendDouble(dst, hist.Count() != 0 ? hist.Percentile(kQuantiles[i])
+                                            : 0.0);
+      }
+      dst->push_back('}');
+    }
+  }
+  dst->push_back('}');
+}
+
+// Counters and gauges are exported as untyped samples and histograms as
+// summaries.
+void MetricsRegistry::DumpPrometheus(std::string* dst) const {
+  mu_.AssertHeld();
+  for (MetricMap::const_iterator it = metrics_.begin(); it != metrics_.end();
+       ++it) {
+    const std::string name = PrometheusName(it->first);
+    const Metric* const m = it->second;
+    if (m->type == Metric::kCounter) {
+      dst->append("# TYPE " + name + " counter\n" + name + " ");
+      AppendNumberTo(dst, m->counter->Value());
+      dst->push_back('\n');
+    } else if (m->type == Metric::kGauge) {
+      dst->append("# TYPE " + name + " gauge\n" + name + " ");
+      AppendNumberTo(dst, m->probe(m->arg));
+      dst->push_back('\n');
+    } else {
+      Histogram hist;
+      m->hist->Snapshot(&hist);
+      dst->append("# TYPE " + name + " summary\n");
+      for (size_t i = 0; i < sizeof(kQuantiles) / sizeof(double); i++) {
+        char tmp[50];
+        snprintf(tmp, sizeof(tmp), "{quantile=\"%g\"} ",
+                 kQuantiles[i] / 100.0);
+        dst->append(name + tmp);
+        AppendDouble(dst, hist.Count() != 0 ? hist.Percentile(kQuantiles[i])
+                                            : 0.0);
+        dst->push_back('\n');
+      }
+      dst->append(name + "_sum ");
+      AppendDouble(dst, hist.Average() * hist.Count());
+      dst->append("\n" + name + "_count ");
+      AppendNumberTo(dst, static_cast<uint64_t>(hist.Count()));
+      dst->push_back('\n');
+    }
+  }
+}
+
+MetricsDumper::MetricsDumper(const MetricsRegistry* registry, Env* env,
+                             const std::string& fname,
+                             MetricsRegistry::Format fmt,
+                             uint64_t interval_micros)
+    : registry_(registry),
+      env_(env),
+      fname_(fname),
+      fmt_(fmt),
+      interval_micros_(interval_micros),
+      cv_(&mu_),
+      started_(false),
+      shutting_down_(false),
+      bg_running_(false) {}
+
+MetricsDumper::~MetricsDumper() {
+  MutexLock ml(&mu_);
+  shutting_down_ = true;
+  cv_.SignalAll();
+  while (bg_running_) {
+    cv_.Wait();
+  }
+}
+
+void MetricsDumper::Start() {
+  MutexLock ml(&mu_);
+  if (!started_) {
+    started_ = true;
+    bg_running_ = true;
+    env_->StartThread(BGWork, this);
+  }
+}
+
+Status MetricsDumper::DumpNow() {
+  const std::string contents = registry_->Dump(fmt_);
+  // Write to a temporary file first so that readers never see partial dumps
+  const std::string tmp = fname_ + ".tmp";
+  Status s = WriteStringToFile(env_, contents, tmp.c_str());
+  if (s.ok()) {
+    s = env_->RenameFile(tmp.c_str(), fname_.c_str());
+  }
+  return s;
+}
+
+void MetricsDumper::BGWork(void* arg) {
+  reinterpret_cast<MetricsDumper*>(arg)->BGLoop();
+}
+
+void MetricsDumper::BGLoop() {
+  MutexLock ml(&mu_);
+  while (!shutting_down_) {
+    cv_.TimedWait(interval_micros_);
+    mu_.Unlock();
+    DumpNow();  // Errors are ignored; the next round may succeed
+    mu_.Lock();
+  }
+  bg_running_ = false;
+  cv_.SignalAll();
+}
+
+}  // namespace pdlfs
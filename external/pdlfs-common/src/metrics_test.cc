@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/metrics.h"
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/testharness.h"
+
+namespace pdlfs {
+
+class MetricsTest {
+ public:
+  static uint64_t Probe(void* arg) { return *reinterpret_cast<uint64_t*>(arg); }
+
+  bool Has(const std::string& dump, const std::string& s) {
+    return dump.find(s) != std::string::npos;
+  }
+
+  MetricsRegistry registry_;
+};
+
+TEST(MetricsTest, CountersAndGauges) {
+  uint64_t gauge = 7;
+  registry_.GetCounter("a.ops")->Add();
+  registry_.GetCounter("a.ops")->Add(2);
+  registry_.AddGauge("a.size", Probe, &gauge);
+  uint64_t v;
+  ASSERT_TRUE(registry_.GetValue("a.ops", &v));
+  ASSERT_EQ(v, 3);
+  ASSERT_TRUE(registry_.GetValue("a.size", &v));
+  ASSERT_EQ(v, 7);
+  gauge = 9;
+  ASSERT_TRUE(registry_.GetValue("a.size", &v));
+  ASSERT_EQ(v, 9);
+  ASSERT_TRUE(!registry_.GetValue("a", &v));
+}
+
+TEST(MetricsTest, Remove) {
+  uint64_t gauge = 1;
+  registry_.AddGauge("a.x", Probe, &gauge);
+  registry_.AddGauge("a.y.z", Probe, &gauge);
+  registry_.AddGauge("ab", Probe, &gauge);
+  registry_.Remove("a");
+  uint64_t v;
+  ASSERT_TRUE(!registry_.GetValue("a.x", &v));
+  ASSERT_TRUE(!registry_.GetValue("a.y.z", &v));
+  ASSERT_TRUE(registry_.GetValue("ab", &v));
+}
+
+TEST(MetricsTest, Dump) {
+  uint64_t gauge = 5;
+  ConcurrentHistogram hist;
+  hist.Add(10);
+  hist.Add(20);
+  registry_.GetCounter("rpc.calls")->Add(4);
+  registry_.AddGauge("dir.bytes", Probe, &gauge);
+  registry_.AddHistogram("rpc.latency", &hist);
+  std::string json = registry_.Dump(MetricsRegistry::kJson);
+  ASSERT_TRUE(Has(json, "\"rpc.calls\":4"));
+  ASSERT_TRUE(Has(json, "\"dir.bytes\":5"));
+  ASSERT_TRUE(Has(json, "\"rpc.latency\":{\"count\":2"));
+  std::string text = registry_.Dump(MetricsRegistry::kPrometheus);
+  ASSERT_TRUE(Has(text, "rpc_calls 4\n"));
+  ASSERT_TRUE(Has(text, "dir_bytes 5\n"));
+  ASSERT_TRUE(Has(text, "rpc_latency_count 2\n"));
+}
+
+TEST(MetricsTest, Dumper) {
+  Env* const env = Env::Default();
+  const std::string fname = test::TmpDir() + "/metrics_test.json";
+  registry_.GetCounter("x")->Add(1);
+  {
+    MetricsDumper dumper(&registry_, env, fname, MetricsRegistry::kJson,
+                         1000 * 1000);
+    ASSERT_OK(dumper.DumpNow());
+  }
+  std::string contents;
+  ASSERT_OK(ReadFileToString(env, fname.c_str(), &contents));
+  ASSERT_EQ(contents, "{\"x\":1}");
+  env->DeleteFile(fname.c_str());
+}
+
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  return ::pdlfs::test::RunAllTests(&argc, &argv);
+}
@@ -13,7 +13,10 @@
 namespace pdlfs {
 
 OfsOptions::OfsOptions()
-    : deferred_gc(false), sync_log_on_close(false), info_log(NULL) {}
+    : deferred_gc(false),
+      sync_log_on_close(false),
+      size_cache_size(4096),
+      info_log(NULL) {}
 
 Ofs::Ofs(const OfsOptions& options, Osd* osd) {
   impl_ = new Impl(options, osd);
@@ -134,6 +137,12 @@ Status Ofs::GetChildren(const char* dirname, std::vector<std::string>* names) {
   return impl_->ListFileSet(dirname, names);
 }
 
+Status Ofs::GetChildrenWithSizes(const char* dirname,
+                                 std::vector<std::string>* names,
+                                 std::vector<uint64_t>* sizes) {
+  return impl_->ListFileSet(dirname, names, sizes);
+}
+
 Status Ofs::SynFileSet(const char* dirname) {
   return impl_->SynFileSet(dirname);
 }
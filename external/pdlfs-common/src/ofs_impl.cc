@@ -10,6 +10,7 @@
  */
 #include "ofs_impl.h"
 
+#include "pdlfs-common/hash.h"
 #include "pdlfs-common/log_scanner.h"
 #include "pdlfs-common/mutexlock.h"
 
@@ -345,6 +346,56 @@ Status Ofs::Impl::ListFileSet(  ///
   }
 }
 
+Status Ofs::Impl::ListFileSet(  ///
+    const Slice& mntptr, std::vector<std::string>* names,
+    std::vector<uint64_t>* sizes) {
+  MutexLock l(&mutex_);
+  FileSet* fset = mtable_.Lookup(mntptr);
+  if (fset == NULL) {
+    return Status::NotFound("Dir not mounted", mntptr);
+  }
+  struct Visitor : public FileSet::Visitor {
+    std::vector<std::string>* names;
+    std::vector<std::string> objs;
+    virtual void visit(const Slice& key, char* const c) {
+      names->push_back(key.ToString());
+      objs.push_back(c);
+    }
+  };
+  Visitor v;
+  v.names = names;
+  const size_t base = names->size();
+  fset->files.VisitAll(&v);
+  sizes->resize(names->size(), 0);
+  // Serve cached sizes first and fetch the rest in a single batch
+  std::vector<const char*> misses;
+  std::vector<size_t> idx;
+  for (size_t i = 0; i < v.objs.size(); i++) {
+    if (!LookupSize(v.objs[i], &(*sizes)[base + i])) {
+      misses.push_back(v.objs[i].c_str());
+      idx.push_back(base + i);
+    }
+  }
+  if (misses.empty()) {
+    return Status::OK();
+  }
+  std::vector<uint64_t> results(misses.size());
+  std::vector<Status> statuses(misses.size());
+  osd_->BatchSize(misses.size(), &misses[0], &results[0], &statuses[0]);
+  Status s;
+  for (size_t j = 0; j < misses.size(); j++) {
+    if (statuses[j].ok()) {
+      (*sizes)[idx[j]] = results[j];
+      if (!writers_.Contains(misses[j])) {
+        CacheSize(misses[j], results[j]);
+      }
+    } else if (s.ok()) {
+      s = statuses[j];
+    }
+  }
+  return s;
+}
+
 Status Ofs::Impl::LinkFileSet(const Slice& mntptr, FileSet* fset) {
   MutexLock l(&mutex_);
   if (mtable_.Contains(mntptr)) {
@@ -414,6 +465,65 @@ Status Ofs::Impl::UnlinkFileSet(const Slice& mntptr, bool deletion) {
   }
 }
 
+bool Ofs::Impl::LookupSize(const std::string& objname, uint64_t* size) {
+  mutex_.AssertHeld();
+  if (writers_.Contains(objname)) {
+    return false;
+  }
+  const uint32_t hash = Hash(objname.data(), objname.size(), 0);
+  SizeEntry* const e = size_cache_.Lookup(objname, hash);
+  if (e == NULL) {
+    return false;
+  } else {
+    *size = *e->value;
+    size_cache_.Release(e);
+    return true;
+  }
+}
+
+void Ofs::Impl::CacheSize(const std::string& objname, uint64_t size) {
+  mutex_.AssertHeld();
+  const uint32_t hash = Hash(objname.data(), objname.size(), 0);
+  SizeEntry* const e = size_cache_.Insert(objname, hash, new uint64_t(size), 1,
+                                          LRUValueDeleter<uint64_t>);
+  size_cache_.Release(e);
+}
+
+void Ofs::Impl::ForgetSize(const std::string& objname) {
+  mutex_.AssertHeld();
+  const uint32_t hash = Hash(objname.data(), objname.size(), 0);
+  size_cache_.Erase(objname, hash);
+}
+
+void Ofs::Impl::CloseWriter(const std::string& objname) {
+  MutexLock l(&mutex_);
+  writers_.Erase(objname);
+  ForgetSize(objname);
+}
+
+// Tracks an object open for writing so that its size is never served from
+// the cache while it may still grow.
+class Ofs::Impl::Writer : public WritableFile {
+ public:
+  Writer(Impl* impl, const std::string& objname, WritableFile* base)
+      : impl_(impl), objname_(objname), base_(base) {}
+
+  virtual ~Writer() {
+    delete base_;  // This will close the file
+    impl_->CloseWriter(objname_);
+  }
+
+  virtual Status Append(const Slice& data) { return base_->Append(data); }
+  virtual Status Close() { return base_->Close(); }
+  virtual Status Flush() { return base_->Flush(); }
+  virtual Status Sync() { return base_->Sync(); }
+
+ private:
+  Impl* const impl_;
+  std::string objname_;
+  WritableFile* const base_;
+};
+
 // Atomically insert a named file into an underlying object store. Return OK on
 // success, or a non-OK status on errors.
 Status Ofs::Impl::PutFile(const OfsPath& fp, const Slice& data) {
@@ -429,11 +539,15 @@ Status Ofs::Impl::PutFile(const OfsPath& fp, const Slice& data) {
     } else {
       objname = c;
     }
+    ForgetSize(objname);
     Status s = fset->TryCreateObject(objname);
     if (s.ok()) {
       s = osd_->Put(objname.c_str(), data);
       if (s.ok()) {
         s = fset->Link(fp.base, objname);
+        if (s.ok() && !writers_.Contains(objname)) {
+          CacheSize(objname, data.size());
+        }
         if (!s.ok()) {
           Log(options_.info_log, 0,
               "Cannot commit the mapping of a newly created file %s->%s: %s",
@@ -464,6 +578,7 @@ Status Ofs::Impl::DeleteFile(const OfsPath& fp) {
     }
     Status s = fset->UnlinkAndDelete(fp.base, objname);
     if (s.ok()) {
+      ForgetSize(objname);
       // It's okay if we fail the deletion or the logging of it as we can
       // redo these operations the next time the fileset is mounted.
       s = osd_->Delete(objname.c_str());
@@ -497,8 +612,12 @@ Status Ofs::Impl::NewWritableFile(const OfsPath& fp, WritableFile** r) {
     if (s.ok()) {
       s = osd_->NewWritableObj(objname.c_str(), r);
       if (s.ok()) {
+        ForgetSize(objname);
         s = fset->Link(fp.base, objname);
-        if (!s.ok()) {
+        if (s.ok()) {
+          writers_.Insert(objname);
+          *r = new Writer(this, objname, *r);
+        } else {
           Log(options_.info_log, 0,
               "Cannot commit the object mapping of a newly created file "
               "%s->%s: %s",
@@ -532,7 +651,15 @@ Status Ofs::Impl::FileSize(const OfsPath& fp, uint64_t* result) {
   if (!fset) return Status::NotFound("Parent dir not mounted", fp.mntptr);
   char* const c = fset->files.Lookup(fp.base);
   if (!c) return Status::NotFound("No such file", fp.base);
-  return osd_->Size(c, result);
+  const std::string objname = c;
+  if (LookupSize(objname, result)) {
+    return Status::OK();
+  }
+  Status s = osd_->Size(objname.c_str(), result);
+  if (s.ok() && !writers_.Contains(objname)) {
+    CacheSize(objname, *result);
+  }
+  return s;
 }
 
 Status Ofs::Impl::NewSequentialFile(const OfsPath& fp, SequentialFile** r) {
@@ -598,6 +725,7 @@ Status Ofs::Impl::CopyFile(const OfsPath& sp, const OfsPath& dp) {
   }
   Status s = dset->TryCreateObject(dname);
   if (s.ok()) {
+    ForgetSize(dname);
     s = osd_->Copy(sname.c_str(), dname.c_str());
     if (s.ok()) {
       s = dset->Link(dp.base, dname);
@@ -15,6 +15,7 @@
 #include "pdlfs-common/hashmap.h"
 #include "pdlfs-common/log_reader.h"
 #include "pdlfs-common/log_writer.h"
+#include "pdlfs-common/lru.h"
 #include "pdlfs-common/ofs.h"
 #include "pdlfs-common/osd.h"
 #include "pdlfs-common/port.h"
@@ -184,7 +185,8 @@ class FileSet {
 class Ofs::Impl {
  public:
   typedef ResolvedPath OfsPath;
-  Impl(const OfsOptions& options, Osd* osd) : options_(options), osd_(osd) {
+  Impl(const OfsOptions& options, Osd* osd)
+      : size_cache_(options.size_cache_size), options_(options), osd_(osd) {
     if (options_.info_log == NULL) {
       options_.info_log = Logger::Default();
     }
@@ -194,12 +196,16 @@ class Ofs::Impl {
     // All file sets should have be unmounted
     // at this point
     assert(mtable_.Empty());
+    size_cache_.Prune();
+    assert(size_cache_.Empty());
   }
 
   bool HasFileSet(const Slice& mntptr);
   Status LinkFileSet(const Slice& mntptr, FileSet* fset);
   Status UnlinkFileSet(const Slice& mntptr, bool deletion);
   Status ListFileSet(const Slice& mntptr, std::vector<std::string>* names);
+  Status ListFileSet(const Slice& mntptr, std::vector<std::string>* names,
+                     std::vector<uint64_t>* sizes);
   Status SynFileSet(const Slice& mntptr);
 
   bool HasFile(const OfsPath& fp);
@@ -215,8 +221,20 @@ class Ofs::Impl {
   Status Rename(const OfsPath& sp, const OfsPath& dp);
 
  private:
+  class Writer;
+  // Object sizes are cached by object name so that they survive renames.
+  // REQUIRES: mutex_ has been locked.
+  bool LookupSize(const std::string& objname, uint64_t* size);
+  void CacheSize(const std::string& objname, uint64_t size);
+  void ForgetSize(const std::string& objname);
+  void CloseWriter(const std::string& objname);
+
   port::Mutex mutex_;
   HashMap<FileSet> mtable_;
+  typedef LRUEntry<uint64_t> SizeEntry;
+  LRUCache<SizeEntry> size_cache_;
+  // Objects currently open for writing. Their sizes are never cached.
+  HashSet writers_;
   // No copying allowed
   void operator=(const Impl&);
   Impl(const Impl&);
@@ -89,6 +89,19 @@ class OFS {
     return ofs_->DeleteFile(f.c_str());
   }
 
+  Status Put(const char* fname, const Slice& data) {
+    std::string f = fsetpath_ + "/" + fname;
+    return ofs_->WriteStringToFile(f.c_str(), data);
+  }
+
+  uint64_t Size(const char* fname) {
+    uint64_t size = 0;
+    std::string f = fsetpath_ + "/" + fname;
+    Status s = ofs_->GetFileSize(f.c_str(), &size);
+    ASSERT_OK(s);
+    return size;
+  }
+
   bool Exists(const char* fname) {
     std::string f = fsetpath_ + "/" + fname;
     return ofs_->FileExists(f.c_str());
@@ -225,6 +238,43 @@ TEST(OFS, Rename) {
   ASSERT_OK(Unmount());
 }
 
+TEST(OFS, FileSizes) {
+  ASSERT_OK(Mount());
+  ASSERT_OK(Create("a"));
+  ASSERT_EQ(Size("a"), 3);
+  ASSERT_OK(Put("b", "12345"));
+  ASSERT_EQ(Size("b"), 5);
+  ASSERT_OK(Put("b", "1"));
+  ASSERT_EQ(Size("b"), 1);
+  ASSERT_OK(Copy("b", "a"));
+  ASSERT_EQ(Size("a"), 1);
+  ASSERT_OK(Rename("b", "c"));
+  ASSERT_EQ(Size("c"), 1);
+  // Sizes of files open for writing are always fresh
+  WritableFile* file;
+  std::string f = fsetpath_ + "/d";
+  ASSERT_OK(ofs_->NewWritableFile(f.c_str(), &file));
+  ASSERT_EQ(Size("d"), 0);
+  ASSERT_OK(file->Append("xy"));
+  ASSERT_OK(file->Flush());
+  ASSERT_EQ(Size("d"), 2);
+  delete file;
+  ASSERT_EQ(Size("d"), 2);
+  std::vector<std::string> names;
+  std::vector<uint64_t> sizes;
+  ASSERT_OK(ofs_->GetChildrenWithSizes(fsetpath_.c_str(), &names, &sizes));
+  ASSERT_EQ(names.size(), 3);
+  ASSERT_EQ(sizes.size(), 3);
+  for (size_t i = 0; i < names.size(); i++) {
+    ASSERT_EQ(sizes[i], Size(names[i].c_str()));
+  }
+  ASSERT_OK(Delete("a"));
+  ASSERT_OK(Delete("c"));
+  ASSERT_OK(Delete("d"));
+  unmount_opts_.deletion = true;
+  ASSERT_OK(Unmount());
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
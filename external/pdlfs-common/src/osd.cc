@@ -16,6 +16,13 @@ namespace pdlfs {
 
 Osd::~Osd() {}
 
+void Osd::BatchSize(size_t n, const char* const* names, uint64_t* sizes,
+                    Status* statuses) {
+  for (size_t i = 0; i < n; i++) {
+    statuses[i] = Size(names[i], &sizes[i]);
+  }
+}
+
 namespace {
 // A simple OSD wrapper implementation that routes everything to an Env
 // instance. The caller specifies a path prefix so that all data objects will
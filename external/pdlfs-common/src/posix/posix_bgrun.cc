@@ -10,6 +10,7 @@
  */
 #include "posix_bgrun.h"
 
+#include <stdint.h>
 #include <stdio.h>
 
 namespace pdlfs {
@@ -70,6 +71,11 @@ void PosixThreadPool::BGThread() {
   while (true) {
     {
       MutexLock l(&mu_);
+      // Count the last item here so that each item costs one lock round trip
+      if (function != NULL) {
+        completed_++;
+        function = NULL;
+      }
       // Wait until there is an item that is ready to run
       while (!shutting_down_ && (paused_ || queue_.empty())) {
         bg_cv_.Wait();
@@ -92,6 +98,13 @@ void PosixThreadPool::BGThread() {
   }
 }
 
+void PosixThreadPool::GetStats(ThreadPoolStats* stats) {
+  MutexLock ml(&mu_);
+  *stats = ThreadPoolStats();
+  stats->queued = queue_.size();
+  stats->completed = completed_;
+}
+
 void PosixThreadPool::Resume() {
   MutexLock ml(&mu_);
   paused_ = false;
@@ -110,8 +123,217 @@ void PosixThreadPool::StartThread(void (*function)(void*), void* arg) {
   Pthread(StartThreadWrapper, state, NULL);
 }
 
+PosixWorkStealingPool::PosixWorkStealingPool(int num_threads, bool eager_init,
+                                             void* attr)
+    : max_threads_(num_threads > 0 ? num_threads : 1),
+      bg_cv_(&mu_),
+      num_pool_threads_(0),
+      started_(NULL),
+      num_idle_(NULL),
+      shutting_down_(NULL),
+      paused_(NULL),
+      next_(NULL) {
+  workers_ = new Worker[max_threads_];
+  for (int i = 0; i < max_threads_; i++) {
+    workers_[i].completed = 0;
+    workers_[i].stolen = 0;
+  }
+  if (eager_init) {
+    MutexLock ml(&mu_);
+    InitPool(attr);
+  }
+}
+
+PosixWorkStealingPool::~PosixWorkStealingPool() {
+  mu_.Lock();
+  shutting_down_.Release_Store(this);
+  bg_cv_.SignalAll();
+  while (num_pool_threads_ != 0) {
+    bg_cv_.Wait();
+  }
+  mu_.Unlock();
+  delete[] workers_;
+}
+
+std::string PosixWorkStealingPool::ToDebugString() {
+  ThreadPoolStats stats;
+  GetStats(&stats);
+  char tmp[200];
+  snprintf(tmp, sizeof(tmp),
+           "Tpool: work_stealing, max_threads=%d, queued=%llu (urgent=%llu), "
+           "completed=%llu, stolen=%llu",
+           max_threads_, static_cast<unsigned long long>(stats.queued),
+           static_cast<unsigned long long>(stats.queued_urgent),
+           static_cast<unsigned long long>(stats.completed),
+           static_cast<unsigned long long>(stats.stolen));
+  return tmp;
+}
+
+void PosixWorkStealingPool::InitPool(void* attr) {
+  mu_.AssertHeld();
+  while (num_pool_threads_ < max_threads_) {
+    BGThreadArg* const a = new BGThreadArg;
+    a->pool = this;
+    a->id = num_pool_threads_;
+    Pthread(BGWrapper, a, attr);
+    num_pool_threads_++;
+  }
+  started_.Release_Store(this);
+}
+
+void PosixWorkStealingPool::Schedule(void (*function)(void*), void* arg) {
+  Enqueue(function, arg, false);
+}
+
+void PosixWorkStealingPool::ScheduleUrgent(void (*function)(void*),
+                                           void* arg) {
+  Enqueue(function, arg, true);
+}
+
+// Spread tasks round-robin across workers without locking mu_.
+PosixWorkStealingPool::Worker* PosixWorkStealingPool::NextWorker() {
+  while (true) {
+    void* const n = next_.NoBarrier_Load();
+    const uintptr_t i = reinterpret_cast<uintptr_t>(n);
+    if (next_.CompareAndSwap(n, reinterpret_cast<void*>(i + 1))) {
+      return &workers_[i % max_threads_];
+    }
+  }
+}
+
+// REQUIRES: mu_ has been locked.
+void PosixWorkStealingPool::AddIdle(int delta) {
+  mu_.AssertHeld();
+  const intptr_t n = reinterpret_cast<intptr_t>(num_idle_.NoBarrier_Load());
+  num_idle_.Release_Store(reinterpret_cast<void*>(n + delta));
+}
+
+// mu_ is only locked to start the pool and to wake up idle threads. A thread
+// counts itself idle before its last scan of all queues, which locks the
+// queue we push to. So either that scan finds our task, or our read of
+// num_idle_ after pushing sees the thread idle and signals it. The signal
+// is sent with mu_ held, which the thread keeps until it waits.
+void PosixWorkStealingPool::Enqueue(void (*function)(void*), void* arg,
+                                    bool urgent) {
+  if (shutting_down_.Acquire_Load()) return;
+  if (!started_.Acquire_Load()) {
+    MutexLock ml(&mu_);
+    if (shutting_down_.NoBarrier_Load()) return;
+    InitPool(NULL);  // Start background threads if necessary
+  }
+  Worker* const w = NextWorker();
+  {
+    MutexLock l(&w->mu);
+    BGQueue* const q = urgent ? &w->urgent : &w->normal;
+    q->push_back(BGItem());
+    q->back().function = function;
+    q->back().arg = arg;
+  }
+  if (num_idle_.Acquire_Load() != NULL) {
+    MutexLock ml(&mu_);
+    bg_cv_.Signal();
+  }
+}
+
+// Owners take the oldest task from their queues while thieves take the
+// newest one to stay away from the owner's end of the queue.
+bool PosixWorkStealingPool::Pop(Worker* w, bool urgent, bool steal,
+                                BGItem* item) {
+  MutexLock l(&w->mu);
+  BGQueue* const q = urgent ? &w->urgent : &w->normal;
+  if (q->empty()) {
+    return false;
+  } else if (steal) {
+    *item = q->back();
+    q->pop_back();
+    w->stolen++;
+  } else {
+    *item = q->front();
+    q->pop_front();
+  }
+  return true;
+}
+
+// Urgent tasks, ours or others', are always preferred over normal tasks.
+bool PosixWorkStealingPool::TryGet(int id, BGItem* item) {
+  for (int lane = 0; lane < 2; lane++) {
+    const bool urgent = (lane == 0);
+    if (Pop(&workers_[id], urgent, false, item)) {
+      return true;
+    }
+    for (int i = 1; i < max_threads_; i++) {
+      if (Pop(&workers_[(id + i) % max_threads_], urgent, true, item)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void PosixWorkStealingPool::BGThread(int id) {
+  BGItem item;
+  while (true) {
+    bool found = false;
+    if (!shutting_down_.Acquire_Load() && !paused_.Acquire_Load()) {
+      found = TryGet(id, &item);
+    }
+    if (!found) {
+      MutexLock l(&mu_);
+      while (!shutting_down_.NoBarrier_Load()) {
+        AddIdle(1);  // Must precede the scan; see Enqueue()
+        if (!paused_.NoBarrier_Load() && TryGet(id, &item)) {
+          AddIdle(-1);
+          found = true;
+          break;
+        }
+        bg_cv_.Wait();
+        AddIdle(-1);
+      }
+      if (!found) {
+        assert(num_pool_threads_ > 0);
+        num_pool_threads_--;
+        bg_cv_.SignalAll();
+        return;
+      }
+    }
+
+    assert(item.function != NULL);
+    item.function(item.arg);
+    MutexLock l(&workers_[id].mu);
+    workers_[id].completed++;
+  }
+}
+
+void PosixWorkStealingPool::GetStats(ThreadPoolStats* stats) {
+  *stats = ThreadPoolStats();
+  for (int i = 0; i < max_threads_; i++) {
+    Worker* const w = &workers_[i];
+    MutexLock l(&w->mu);
+    stats->queued += w->urgent.size() + w->normal.size();
+    stats->queued_urgent += w->urgent.size();
+    stats->completed += w->completed;
+    stats->stolen += w->stolen;
+  }
+}
+
+void PosixWorkStealingPool::Resume() {
+  MutexLock ml(&mu_);
+  paused_.Release_Store(NULL);
+  bg_cv_.SignalAll();
+}
+
+void PosixWorkStealingPool::Pause() {
+  MutexLock ml(&mu_);
+  paused_.Release_Store(this);
+}
+
 ThreadPool* ThreadPool::NewFixed(int num_threads, bool eager_init, void* attr) {
   return new PosixThreadPool(num_threads, eager_init, attr);
 }
 
+ThreadPool* ThreadPool::NewWorkStealing(int num_threads, bool eager_init,
+                                        void* attr) {
+  return new PosixWorkStealingPool(num_threads, eager_init, attr);
+}
+
 }  // namespace pdlfs
@@ -32,6 +32,7 @@ class PosixThreadPool : public ThreadPool {
       : bg_cv_(&mu_),
         num_pool_threads_(0),
         max_threads_(max_threads),
+        completed_(0),
         shutting_down_(false),
         paused_(false) {
     if (eager_init) {
@@ -43,6 +44,7 @@ class PosixThreadPool : public ThreadPool {
 
   virtual ~PosixThreadPool();
   virtual void Schedule(void (*function)(void*), void* arg);
+  virtual void GetStats(ThreadPoolStats* stats);
   virtual std::string ToDebugString();
   virtual void Resume();
   virtual void Pause();
@@ -63,6 +65,7 @@ class PosixThreadPool : public ThreadPool {
   port::CondVar bg_cv_;
   int num_pool_threads_;
   int max_threads_;
+  uint64_t completed_;
 
   bool shutting_down_;
   bool paused_;
@@ -88,4 +91,73 @@ class PosixThreadPool : public ThreadPool {
   }
 };
 
+// A thread pool in which each thread owns a private pair of task queues, one
+// for urgent tasks and one for the rest. New tasks are spread round-robin
+// across the threads. A thread runs tasks from its own queues first and steals
+// from the other threads when its own queues are empty, so threads mostly
+// touch their own locks rather than a single shared one. A pool-wide lock is
+// only used to park idle threads and to wake them up.
+class PosixWorkStealingPool : public ThreadPool {
+ public:
+  PosixWorkStealingPool(int num_threads, bool eager_init = false,
+                        void* attr = NULL);
+  virtual ~PosixWorkStealingPool();
+  virtual void Schedule(void (*function)(void*), void* arg);
+  virtual void ScheduleUrgent(void (*function)(void*), void* arg);
+  virtual void GetStats(ThreadPoolStats* stats);
+  virtual std::string ToDebugString();
+  virtual void Resume();
+  virtual void Pause();
+
+ private:
+  struct BGItem {
+    void* arg;
+    void (*function)(void*);
+  };
+  typedef std::deque<BGItem> BGQueue;
+  struct Worker {
+    port::Mutex mu;
+    BGQueue urgent;
+    BGQueue normal;
+    uint64_t completed;
+    uint64_t stolen;
+  };
+
+  void Enqueue(void (*function)(void*), void* arg, bool urgent);
+  Worker* NextWorker();
+  void AddIdle(int delta);
+  bool TryGet(int id, BGItem* item);
+  static bool Pop(Worker* w, bool urgent, bool steal, BGItem* item);
+  void InitPool(void* attr);
+  void BGThread(int id);
+
+  struct BGThreadArg {
+    PosixWorkStealingPool* pool;
+    int id;
+  };
+
+  static void* BGWrapper(void* arg) {
+    BGThreadArg* a = reinterpret_cast<BGThreadArg*>(arg);
+    PosixWorkStealingPool* const pool = a->pool;
+    const int id = a->id;
+    delete a;
+    pool->BGThread(id);
+    return NULL;
+  }
+
+  Worker* workers_;  // Array of max_threads_ workers
+  int max_threads_;
+  port::Mutex mu_;
+  port::CondVar bg_cv_;
+  // State below is protected by mu_
+  int num_pool_threads_;
+  // Readable without locking mu_, written with mu_ held
+  port::AtomicPointer started_;  // Non-NULL once all threads are started
+  port::AtomicPointer num_idle_;  // Number of threads waiting for tasks
+  port::AtomicPointer shutting_down_;
+  port::AtomicPointer paused_;
+  // Updated with compare-and-swaps
+  port::AtomicPointer next_;  // Worker to receive the next task
+};
+
 }  // namespace pdlfs
@@ -23,10 +23,14 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <algorithm>
+#include <vector>
 
 namespace pdlfs {
 
@@ -174,6 +178,37 @@ class PosixRandomAccessFile : public RandomAccessFile {
     }
     return s;
   }
+
+#if defined(__linux__)
+  virtual Status ReadV(uint64_t offset, char* const* bufs, const size_t* sizes,
+                       size_t n, size_t* result) const {
+    Status s;
+    *result = 0;
+    std::vector<struct iovec> iov(n);
+    for (size_t i = 0; i < n; i++) {
+      iov[i].iov_base = bufs[i];
+      iov[i].iov_len = sizes[i];
+    }
+    size_t i = 0;
+    while (i < n) {  // Read at most IOV_MAX buffers at a time
+      const int cnt = static_cast<int>(std::min<size_t>(n - i, IOV_MAX));
+      size_t want = 0;
+      for (int j = 0; j < cnt; j++) want += iov[i + j].iov_len;
+      ssize_t r = preadv(fd_, &iov[i], cnt, static_cast<off_t>(offset));
+      if (r < 0) {
+        s = PosixError(filename_, errno);
+        break;
+      }
+      *result += r;
+      offset += r;
+      if (static_cast<size_t>(r) < want) {  // EOF
+        break;
+      }
+      i += cnt;
+    }
+    return s;
+  }
+#endif
 };
 
 class PosixBufferedWritableFile : public WritableFile {
@@ -280,6 +315,37 @@ class PosixWritableFile : public WritableFile {
     }
   }
 
+  virtual Status AppendV(const Slice* data, size_t n) {
+    std::vector<struct iovec> iov;
+    iov.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      if (data[i].empty()) continue;
+      struct iovec v;
+      v.iov_base = const_cast<char*>(data[i].data());
+      v.iov_len = data[i].size();
+      iov.push_back(v);
+    }
+    size_t i = 0;
+    while (i < iov.size()) {  // Resume after short writes
+      const int cnt =
+          static_cast<int>(std::min<size_t>(iov.size() - i, IOV_MAX));
+      ssize_t nw = writev(fd_, &iov[i], cnt);
+      if (nw < 0) {
+        return PosixError(filename_, errno);
+      }
+      size_t left = static_cast<size_t>(nw);
+      while (i < iov.size() && left >= iov[i].iov_len) {
+        left -= iov[i].iov_len;
+        i++;
+      }
+      if (left != 0) {
+        iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + left;
+        iov[i].iov_len -= left;
+      }
+    }
+    return Status::OK();
+  }
+
   virtual Status Close() {
     close(fd_);
     fd_ = -1;
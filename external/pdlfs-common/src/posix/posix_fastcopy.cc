@@ -12,34 +12,176 @@
 
 #include "posix_env.h"
 
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
 namespace pdlfs {
 
-// Faster file copy without using user-space buffers. Return OK on success,
-// or a non-OK status on errors.
 #if defined(PDLFS_OS_LINUX)
-Status FastCopy(const char* src, const char* dst) {
+namespace {
+// Move data between two files through a pipe. Return the number of bytes
+// moved, 0 at the end of the source file, or -1 on errors.
+ssize_t SpliceRange(int r, loff_t* off_in, int w, loff_t* off_out, size_t n,
+                    int* p) {
+  ssize_t nin = splice(r, off_in, p[1], NULL, n, 0);
+  if (nin <= 0) {
+    return nin;
+  }
+  ssize_t left = nin;
+  while (left > 0) {
+    ssize_t nout = splice(p[0], NULL, w, off_out, left, 0);
+    if (nout <= 0) {
+      if (nout == -1 && errno == EINTR) continue;
+      return -1;
+    }
+    left -= nout;
+  }
+  return nin;
+}
+
+// Copy bytes [off, off + n) of one file to the same offsets of another
+// file. Data moves in the kernel through copy_file_range() when possible and
+// through splice() otherwise.
+Status CopyRange(const char* src, int r, int w, uint64_t off, uint64_t n) {
+#if defined(__NR_copy_file_range)
+  while (n > 0) {
+    loff_t in = off;
+    loff_t out = off;
+    ssize_t k = syscall(__NR_copy_file_range, r, &in, w, &out, n, 0);
+    if (k > 0) {
+      off += k;
+      n -= k;
+    } else if (k == 0) {
+      return Status::IOError(src, "unexpected end of file");
+    } else if (errno != EINTR) {
+      if (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+          errno == EOPNOTSUPP) {
+        break;  // Fall back to splice()
+      }
+      return PosixError(src, errno);
+    }
+  }
+  if (n == 0) {
+    return Status::OK();
+  }
+#endif
+  int p[2];
+  if (pipe(p) == -1) {
+    return PosixError("pipe", errno);
+  }
+  Status status;
+  loff_t in = off;
+  loff_t out = off;
+  while (n > 0) {
+    const size_t batch_size = std::min<uint64_t>(n, 1 << 16);
+    ssize_t k = SpliceRange(r, &in, w, &out, batch_size, p);
+    if (k > 0) {
+      n -= k;
+    } else if (k == 0) {
+      status = Status::IOError(src, "unexpected end of file");
+      break;
+    } else if (errno != EINTR) {
+      status = PosixError(src, errno);
+      break;
+    }
+  }
+  close(p[0]);
+  close(p[1]);
+  return status;
+}
+
+// Files of at least this many bytes are copied by multiple threads.
+const uint64_t kParallelCopyThreshold = 64 << 20;
+const uint64_t kCopyChunkSize = 16 << 20;
+const int kCopyThreads = 4;
+
+struct ParallelCopyState {
+  ParallelCopyState() : cv(&mu) {}
+  const char* src;
+  int r;
+  int w;
+  uint64_t size;
+  uint64_t chunk_size;
+  port::Mutex mu;
+  port::CondVar cv;
+  // State below is protected by mu
+  uint64_t next;  // Offset of the next chunk to copy
+  int num_running;
+  Status status;
+};
+
+// Repeatedly claim and copy the next chunk until all chunks are copied or
+// an error occurs.
+void CopyChunks(void* arg) {
+  ParallelCopyState* const state = reinterpret_cast<ParallelCopyState*>(arg);
+  MutexLock ml(&state->mu);
+  while (state->status.ok() && state->next < state->size) {
+    const uint64_t off = state->next;
+    const uint64_t n = std::min(state->chunk_size, state->size - off);
+    state->next += n;
+    state->mu.Unlock();
+    Status s = CopyRange(state->src, state->r, state->w, off, n);
+    state->mu.Lock();
+    if (!s.ok() && state->status.ok()) {
+      state->status = s;
+    }
+  }
+  assert(state->num_running > 0);
+  state->num_running--;
+  state->cv.SignalAll();
+}
+}  // namespace
+
+Status ParallelCopy(const char* src, const char* dst, int num_threads,
+                    uint64_t chunk_size) {
   Status status;
   int r = -1;
   int w = -1;
+  struct stat sbuf;
   if ((r = open(src, O_RDONLY)) == -1) {
     status = PosixError(src, errno);
+  } else if (fstat(r, &sbuf) == -1) {
+    status = PosixError(src, errno);
   }
   if (status.ok()) {
     if ((w = open(dst, O_CREAT | O_TRUNC | O_WRONLY, 0644)) == -1) {
       status = PosixError(dst, errno);
     }
   }
-  if (status.ok()) {
-    int p[2];
-    if (pipe(p) == -1) {
-      status = PosixError("pipe", errno);
-    } else {
-      const size_t batch_size = 4096;
-      while (splice(p[0], 0, w, 0, splice(r, 0, p[1], 0, batch_size, 0), 0) > 0)
-        ;
-      close(p[0]);
-      close(p[1]);
+  if (status.ok() && sbuf.st_size > 0) {
+    const uint64_t size = static_cast<uint64_t>(sbuf.st_size);
+    // Reserve space up front so that concurrent chunk writes do not
+    // fragment the file. Not all file systems support this, in which case
+    // the file is left to grow as chunks are written.
+    fallocate(w, 0, 0, size);
+    ParallelCopyState state;
+    state.src = src;
+    state.r = r;
+    state.w = w;
+    state.size = size;
+    state.chunk_size = std::max<uint64_t>(chunk_size, 1);
+    state.next = 0;
+    const uint64_t num_chunks =
+        (size + state.chunk_size - 1) / state.chunk_size;
+    num_threads = static_cast<int>(
+        std::min<uint64_t>(std::max(num_threads, 1), num_chunks));
+    state.num_running = num_threads;
+    ThreadPool* pool = NULL;
+    if (num_threads > 1) {
+      pool = ThreadPool::NewFixed(num_threads - 1);
+      for (int i = 1; i < num_threads; i++) {
+        pool->Schedule(CopyChunks, &state);
+      }
+    }
+    CopyChunks(&state);
+    {
+      MutexLock ml(&state.mu);
+      while (state.num_running != 0) {
+        state.cv.Wait();
+      }
+      status = state.status;
     }
+    delete pool;
   }
   if (r != -1) {
     close(r);
@@ -49,6 +191,18 @@ Status FastCopy(const char* src, const char* dst) {
   }
   return status;
 }
+
+// Faster file copy without using user-space buffers. Return OK on success,
+// or a non-OK status on errors.
+Status FastCopy(const char* src, const char* dst) {
+  struct stat sbuf;
+  if (stat(src, &sbuf) == 0 &&
+      static_cast<uint64_t>(sbuf.st_size) >= kParallelCopyThreshold) {
+    return ParallelCopy(src, dst, kCopyThreads, kCopyChunkSize);
+  } else {
+    return ParallelCopy(src, dst, 1, kCopyChunkSize);
+  }
+}
 #endif
 
 }  // namespace pdlfs
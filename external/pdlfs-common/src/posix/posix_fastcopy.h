@@ -13,11 +13,20 @@
 #include "pdlfs-common/pdlfs_platform.h"
 #include "pdlfs-common/status.h"
 
+#include <stdint.h>
+
 namespace pdlfs {
 
-// Faster file copy bypassing user-space buffers.
+// Faster file copy bypassing user-space buffers. Large files are copied
+// through ParallelCopy() by multiple threads.
 #if defined(PDLFS_OS_LINUX)
 extern Status FastCopy(const char* src, const char* dst);
+
+// Copy a file in chunks of "chunk_size" bytes using up to "num_threads"
+// threads, including the calling thread. The destination file is
+// preallocated when the underlying file system supports it.
+extern Status ParallelCopy(const char* src, const char* dst, int num_threads,
+                           uint64_t chunk_size);
 #endif
 
 }  // namespace pdlfs
@@ -217,7 +217,8 @@ rpc::If* PosixRPC::OpenStubFor(const std::string& uri) {
     cli->Open(uri);
     return cli;
   } else {
-    PosixTCPCli* const cli = new PosixTCPCli(options_.rpc_timeout);
+    PosixTCPCli* const cli =
+        new PosixTCPCli(options_.rpc_timeout, options_.tcp_cli_conns);
     cli->SetTarget(uri);
     return cli;
   }
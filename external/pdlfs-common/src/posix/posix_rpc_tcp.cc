@@ -10,17 +10,22 @@
  */
 #include "posix_rpc_tcp.h"
 
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/histogram.h"
 #include "pdlfs-common/mutexlock.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <map>
+
 namespace pdlfs {
-PosixTCPServer::PosixTCPServer(const RPCOptions& opts, uint64_t t, size_t s)
-    : PosixSocketServer(opts), rpc_timeout_(t), buf_sz_(s) {}
+PosixTCPServer::PosixTCPServer(const RPCOptions& opts, uint64_t t)
+    : PosixSocketServer(opts), rpc_timeout_(t) {}
 
 Status PosixTCPServer::OpenAndBind(const std::string& uri) {
   MutexLock ml(&mutex_);
@@ -38,6 +43,10 @@ Status PosixTCPServer::OpenAndBind(const std::string& uri) {
   if (fd_ == -1) {
     status = Status::IOError(strerror(errno));
   } else {
+    // Allow a restarted server to bind while old connections are still in
+    // TIME_WAIT
+    int one = 1;
+    setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
     int rv = bind(fd_, reinterpret_cast<struct sockaddr*>(addr_->rep()),
                   sizeof(struct sockaddr_in));
     if (rv != -1) {
@@ -62,41 +71,202 @@ Status PosixTCPServer::OpenAndBind(const std::string& uri) {
 }
 
 namespace {
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
 // Set or unset the O_NONBLOCK flag on a given file.
 inline void SET_O_NONBLOCK(int fd, bool non_blocking) {
   int flags = fcntl(fd, F_GETFL, 0);
   flags = non_blocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
   fcntl(fd, F_SETFL, flags);
 }
+
+inline bool WouldBlock(int err) {
+  return err == EWOULDBLOCK || err == EAGAIN || err == EINTR;
+}
+
+// Each frame starts with a fixed32 payload size and a fixed32 request id.
+const size_t kFrameHeaderSize = 8;
+// Larger frames are treated as a corrupted stream.
+const uint32_t kMaxFrameSize = 1u << 30;
+
+// Incrementally reads framed messages from a socket. The payload of each
+// frame is received directly into "body" so that it can be decoded in place
+// or swapped into a reply message without any copies.
+struct FrameReader {
+  FrameReader() : hdr_len(0), body_len(0) {}
+  char hdr[kFrameHeaderSize];
+  size_t hdr_len;
+  std::string body;
+  size_t body_len;
+
+  uint32_t size() const { return DecodeFixed32(hdr); }
+  uint32_t id() const { return DecodeFixed32(hdr + 4); }
+  void Clear() { hdr_len = body_len = 0; }
+
+  // Read as much of the current frame as is available without blocking.
+  // Return 1 once the frame is complete, 0 if more data is needed, or an
+  // errno otherwise. ECONNRESET is returned when the peer has closed the
+  // connection.
+  int Read(int fd) {
+    while (hdr_len < kFrameHeaderSize) {
+      ssize_t rv =
+          recv(fd, hdr + hdr_len, kFrameHeaderSize - hdr_len, MSG_DONTWAIT);
+      if (rv <= 0) {
+        return Error(rv);
+      }
+      hdr_len += rv;
+      if (hdr_len == kFrameHeaderSize) {
+        if (size() > kMaxFrameSize) {
+          return EMSGSIZE;
+        }
+        body.resize(size());
+        body_len = 0;
+      }
+    }
+    while (body_len < body.size()) {
+      ssize_t rv =
+          recv(fd, &body[body_len], body.size() - body_len, MSG_DONTWAIT);
+      if (rv <= 0) {
+        return Error(rv);
+      }
+      body_len += rv;
+    }
+    return 1;
+  }
+
+ private:
+  static int Error(ssize_t rv) {
+    if (rv == 0) {
+      return ECONNRESET;
+    } else if (WouldBlock(errno)) {
+      return 0;
+    } else {
+      return errno;
+    }
+  }
+};
+
+// Send a frame through a non-blocking socket, waiting for the socket to
+// drain as needed until "deadline". The header and the payload go out
+// through a single sendmsg() without being copied together. Return 0 on
+// success or an errno otherwise.
+int WriteFrame(int fd, uint32_t id, const Slice& payload, uint64_t deadline) {
+  char hdr[kFrameHeaderSize];
+  EncodeFixed32(hdr, static_cast<uint32_t>(payload.size()));
+  EncodeFixed32(hdr + 4, id);
+  struct iovec iov[2];
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = const_cast<char*>(payload.data());
+  iov[1].iov_len = payload.size();
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  struct pollfd po;
+  memset(&po, 0, sizeof(struct pollfd));
+  po.events = POLLOUT;
+  po.fd = fd;
+  while (true) {
+    while (msg.msg_iovlen != 0 && msg.msg_iov->iov_len == 0) {
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen == 0) {
+      return 0;
+    }
+    ssize_t rv = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (rv > 0) {
+      size_t n = rv;
+      while (n != 0) {
+        if (n >= msg.msg_iov->iov_len) {
+          n -= msg.msg_iov->iov_len;
+          msg.msg_iov->iov_len = 0;
+          msg.msg_iov++;
+          msg.msg_iovlen--;
+        } else {
+          msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + n;
+          msg.msg_iov->iov_len -= n;
+          n = 0;
+        }
+      }
+    } else if (!WouldBlock(errno)) {
+      return errno;
+    } else if (CurrentMicros() >= deadline) {
+      return ETIMEDOUT;
+    } else if (poll(&po, 1, 200) == -1 && errno != EINTR) {
+      return errno;
+    }
+  }
+}
+
 }  // namespace
 
+struct PosixTCPServer::Connection {
+  int fd;
+  FrameReader reader;
+};
+
 Status PosixTCPServer::BGLoop(int myid) {
   SET_O_NONBLOCK(fd_, true);
-  struct pollfd po;
-  po.events = POLLIN;
-  po.fd = fd_;
-  CallState call;
+  // pos[0] is for accepting new connections, pos[i] for conns[i - 1]
+  std::vector<struct pollfd> pos(1);
+  pos[0].events = POLLIN;
+  pos[0].fd = fd_;
+  std::vector<Connection*> conns;
 
   int err = 0;
   while (!err && !shutting_down_.Acquire_Load()) {
-    call.addrlen = sizeof(call.addr);
-    int rv = accept(fd_, reinterpret_cast<struct sockaddr*>(&call.addr),
-                    &call.addrlen);
-    if (rv != -1) {
-      call.fd = rv;
-      HandleIncomingCall(&call);
-      close(rv);
+    int rv = poll(&pos[0], pos.size(), 200);
+    if (rv == -1) {
+      if (errno != EINTR) err = errno;
+      continue;
+    } else if (rv == 0) {
       continue;
-    } else if (errno == EWOULDBLOCK) {
-      rv = poll(&po, 1, 200);
     }
 
-    // Either poll() or accept() may have returned error
-    if (rv == -1) {
-      err = errno;
+    for (size_t i = conns.size(); i != 0; i--) {
+      if (pos[i].revents != 0 && !HandleIncomingCalls(conns[i - 1])) {
+        close(conns[i - 1]->fd);
+        delete conns[i - 1];
+        conns.erase(conns.begin() + (i - 1));
+        pos.erase(pos.begin() + i);
+      }
+    }
+
+    if (pos[0].revents != 0) {
+      // Accept one connection at a time so that connections are spread
+      // across all threads polling the server socket
+      int fd = accept(fd_, NULL, NULL);
+      if (fd != -1) {
+        SET_O_NONBLOCK(fd, true);
+        Connection* const conn = new Connection;
+        conn->fd = fd;
+        conns.push_back(conn);
+        struct pollfd po;
+        memset(&po, 0, sizeof(struct pollfd));
+        po.events = POLLIN;
+        po.fd = fd;
+        pos.push_back(po);
+      } else if (!WouldBlock(errno) && errno != ECONNABORTED) {
+        err = errno;
+      }
     }
   }
 
+  for (size_t i = 0; i < conns.size(); i++) {
+    // Reset connections still open when the server stops so that they do not
+    // linger in TIME_WAIT at our side and block the server from restarting
+    struct linger lo;
+    lo.l_onoff = 1;
+    lo.l_linger = 0;
+    setsockopt(conns[i]->fd, SOL_SOCKET, SO_LINGER, &lo, sizeof(lo));
+    close(conns[i]->fd);
+    delete conns[i];
+  }
+
   Status status;
   if (err) {
     status = Status::IOError(strerror(err));
@@ -104,70 +274,87 @@ Status PosixTCPServer::BGLoop(int myid) {
   return status;
 }
 
-void PosixTCPServer::HandleIncomingCall(CallState* const call) {
-  int err = 0;
-  rpc::If::Message in, out;
-  const uint64_t start = CurrentMicros();
-  struct pollfd po;
-  memset(&po, 0, sizeof(struct pollfd));
-  po.events = POLLIN;
-  po.fd = call->fd;
-  char* const buf = new char[buf_sz_];
+bool PosixTCPServer::HandleIncomingCalls(Connection* const conn) {
   while (true) {
-    ssize_t rv = recv(call->fd, buf, buf_sz_, MSG_DONTWAIT);
-    if (rv > 0) {
-      in.extra_buf.append(buf, rv);
-      continue;
-    } else if (rv == 0) {  // End of message
-      in.contents = in.extra_buf;
-      break;
-    } else if (errno == EWOULDBLOCK) {
-      // We wait for 0.2 second and therefore timeouts are only checked
-      // roughly every that amount of time.
-      rv = poll(&po, 1, 200);
+    int rv = conn->reader.Read(conn->fd);
+    if (rv == 0) {  // Waiting for more data
+      return true;
+    } else if (rv != 1) {
+      if (rv != ECONNRESET) {
+        Log(options_.info_log, 0, "Error receiving data from client: %s",
+            strerror(rv));
+      }
+      return false;
     }
 
-    // Either recv or poll may have returned errors
-    if (rv == -1) {
-      err = errno;
-      break;
-    } else if (rv == 1) {
-      continue;
-    } else if (CurrentMicros() - start >= rpc_timeout_) {
-      err = -1;
-      break;
+    rpc::If::Message in, out;
+    // Decode the request straight from the receive buffer
+    in.contents = conn->reader.body;
+    const uint64_t start = CurrentMicros();
+    options_.fs->Call(in, out);
+    if (options_.latency_hist != NULL) {
+      options_.latency_hist->Add(CurrentMicros() - start);
     }
-  }
-
-  delete[] buf;
-  if (err) {
-    //
-    return;
-  }
-
-  options_.fs->Call(in, out);
-  Slice remaining_out = out.contents;
-  SET_O_NONBLOCK(call->fd, false);  // Force blocking semantics
-  while (!remaining_out.empty()) {
-    ssize_t nbytes =
-        send(call->fd, remaining_out.data(), remaining_out.size(), 0);
-    if (nbytes > 0) {
-      remaining_out.remove_prefix(nbytes);
-    } else {
-      //
-      return;
+    const uint32_t id = conn->reader.id();
+    conn->reader.Clear();
+    rv = WriteFrame(conn->fd, id, out.contents, CurrentMicros() + rpc_timeout_);
+    if (rv != 0) {
+      Log(options_.info_log, 0, "Error sending data to client: %s",
+          strerror(rv));
+      return false;
     }
   }
-
-  shutdown(call->fd, SHUT_WR);
 }
 
 std::string PosixTCPServer::GetUri() {
   return std::string("tcp://") + GetBaseUri();
 }
 
-PosixTCPCli::PosixTCPCli(uint64_t timeout, size_t buf_sz)
-    : rpc_timeout_(timeout), buf_sz_(buf_sz) {}
+// A persistent connection shared by concurrent callers. Each caller sends
+// its request and then waits for its reply. At any time, one of the waiting
+// callers reads replies from the socket and hands them to their callers.
+struct PosixTCPCli::Connection {
+  Connection() : cv(&mu), fd(-1), next_id(1), reading(false), refs(0) {}
+  port::Mutex wmu;  // Serializes writes to the socket
+  port::Mutex mu;   // Protects the state below
+  port::CondVar cv;
+  int fd;  // -1 if not connected
+  uint32_t next_id;
+  bool reading;  // True iff a caller is reading replies
+  FrameReader reader;  // Only accessed by the reading caller
+  std::map<uint32_t, Waiter*> waiters;  // Calls awaiting replies
+  // Sockets that have been shut down after errors but may still be in use by
+  // callers. They are closed once no callers remain.
+  std::vector<int> dead_fds;
+  int refs;  // Number of callers using the connection
+};
+
+struct PosixTCPCli::Waiter {
+  std::string* buf;  // Receives the reply payload
+  Status status;
+  bool done;
+};
+
+PosixTCPCli::PosixTCPCli(uint64_t timeout, int max_conns)
+    : rpc_timeout_(timeout), next_conn_(0) {
+  for (int i = 0; i < std::max(max_conns, 1); i++) {
+    conns_.push_back(new Connection);
+  }
+}
+
+PosixTCPCli::~PosixTCPCli() {
+  for (size_t i = 0; i < conns_.size(); i++) {
+    Connection* const conn = conns_[i];
+    assert(conn->refs == 0);
+    if (conn->fd != -1) {
+      close(conn->fd);
+    }
+    for (size_t j = 0; j < conn->dead_fds.size(); j++) {
+      close(conn->dead_fds[j]);
+    }
+    delete conn;
+  }
+}
 
 void PosixTCPCli::SetTarget(const std::string& uri) {
   status_ = addr_.ResolvUri(uri);
@@ -184,6 +371,8 @@ Status PosixTCPCli::OpenAndConnect(int* result) {
   if (rv == -1) {
     status = Status::IOError(strerror(errno));
     close(fd);
+  } else {
+    SET_O_NONBLOCK(fd, true);
   }
   return status;
 }
@@ -192,59 +381,127 @@ Status PosixTCPCli::Call(Message& in, Message& out) RPCNOEXCEPT {
   if (!status_.ok()) {
     return status_;
   }
-  int fd;
-  Status status = OpenAndConnect(&fd);
-  if (!status.ok()) {
-    return status;
+  Connection* conn;
+  {
+    MutexLock ml(&mutex_);
+    conn = conns_[next_conn_++ % conns_.size()];
   }
-  Slice remaining_in = in.contents;
-  SET_O_NONBLOCK(fd, false);  // Force blocking semantics
-  while (!remaining_in.empty()) {
-    ssize_t nbytes = send(fd, remaining_in.data(), remaining_in.size(), 0);
-    if (nbytes > 0) {
-      remaining_in.remove_prefix(nbytes);
-    } else {
-      status = Status::IOError(strerror(errno));
-      close(fd);
-      return status;
+  return CallOn(conn, in, out);
+}
+
+// Fail all pending calls of a connection and retire its socket. The next
+// caller will reconnect. REQUIRES: conn->mu has been locked.
+void PosixTCPCli::Break(Connection* const conn, const Status& status) {
+  conn->mu.AssertHeld();
+  if (conn->fd != -1) {
+    shutdown(conn->fd, SHUT_RDWR);  // Wakes up any caller blocked on it
+    conn->dead_fds.push_back(conn->fd);
+    conn->fd = -1;
+  }
+  std::map<uint32_t, Waiter*>::iterator it = conn->waiters.begin();
+  for (; it != conn->waiters.end(); ++it) {
+    it->second->status = status;
+    it->second->done = true;
+  }
+  conn->waiters.clear();
+  conn->cv.SignalAll();
+}
+
+Status PosixTCPCli::CallOn(Connection* const conn, Message& in, Message& out) {
+  const uint64_t deadline = CurrentMicros() + rpc_timeout_;
+  Waiter w;
+  w.buf = &out.extra_buf;
+  w.done = false;
+  MutexLock ml(&conn->mu);
+  if (conn->fd == -1) {
+    // Wait for any caller still reading from a broken socket to give up
+    while (conn->reading) {
+      conn->cv.Wait();
     }
   }
-  shutdown(fd, SHUT_WR);
-  const uint64_t start = CurrentMicros();
-  struct pollfd po;
-  memset(&po, 0, sizeof(struct pollfd));
-  po.events = POLLIN;
-  po.fd = fd;
-  char* const buf = new char[buf_sz_];
-  while (true) {
-    ssize_t rv = recv(fd, buf, buf_sz_, MSG_DONTWAIT);
-    if (rv > 0) {
-      out.extra_buf.append(buf, rv);
-      continue;
-    } else if (rv == 0) {  // End of message
-      out.contents = out.extra_buf;
+  if (conn->fd == -1) {
+    int fd;
+    Status s = OpenAndConnect(&fd);
+    if (!s.ok()) {
+      return s;
+    }
+    conn->reader.Clear();
+    conn->fd = fd;
+  }
+  const int fd = conn->fd;
+  const uint32_t id = conn->next_id++;
+  conn->waiters[id] = &w;
+  conn->refs++;
+  conn->mu.Unlock();
+  conn->wmu.Lock();
+  int err = WriteFrame(fd, id, in.contents, deadline);
+  conn->wmu.Unlock();
+  conn->mu.Lock();
+  if (err != 0 && !w.done) {
+    Break(conn, err == ETIMEDOUT ? Status::Disconnected("timeout")
+                                 : Status::IOError(strerror(err)));
+  }
+
+  while (!w.done) {
+    const uint64_t now = CurrentMicros();
+    if (now >= deadline) {
+      conn->waiters.erase(id);  // A late reply will be dropped
+      w.status = Status::Disconnected("timeout");
       break;
-    } else if (errno == EWOULDBLOCK) {
+    } else if (conn->reading) {
+      conn->cv.TimedWait(deadline - now);
+      continue;
+    }
+
+    // Read replies on behalf of all callers until we get ours
+    conn->reading = true;
+    conn->mu.Unlock();
+    struct pollfd po;
+    memset(&po, 0, sizeof(struct pollfd));
+    po.events = POLLIN;
+    po.fd = fd;
+    int rv = conn->reader.Read(fd);
+    while (rv == 0 && CurrentMicros() < deadline) {
       // We wait for 0.2 second and therefore timeouts are only checked
       // roughly every that amount of time.
-      rv = poll(&po, 1, 200);
+      if (poll(&po, 1, 200) == -1 && errno != EINTR) {
+        rv = errno;
+      } else {
+        rv = conn->reader.Read(fd);
+      }
     }
-
-    // Either recv or poll may have returned errors
-    if (rv == -1) {
-      status = Status::IOError(strerror(errno));
-      break;
+    conn->mu.Lock();
+    conn->reading = false;
+    if (conn->fd != fd) {
+      // The socket has been broken by another caller, which has failed our
+      // call as well
+      conn->reader.Clear();
     } else if (rv == 1) {
-      continue;
-    } else if (CurrentMicros() - start >= rpc_timeout_) {
-      status = Status::Disconnected("timeout");
-      break;
+      std::map<uint32_t, Waiter*>::iterator it =
+          conn->waiters.find(conn->reader.id());
+      if (it != conn->waiters.end()) {
+        it->second->buf->swap(conn->reader.body);
+        it->second->done = true;
+        conn->waiters.erase(it);
+      }
+      conn->reader.Clear();
+    } else if (rv != 0) {
+      conn->reader.Clear();
+      Break(conn, Status::IOError(strerror(rv)));
     }
+    conn->cv.SignalAll();
   }
 
-  delete[] buf;
-  close(fd);
-  return status;
+  if (--conn->refs == 0) {
+    for (size_t i = 0; i < conn->dead_fds.size(); i++) {
+      close(conn->dead_fds[i]);
+    }
+    conn->dead_fds.clear();
+  }
+  if (w.status.ok()) {
+    out.contents = out.extra_buf;
+  }
+  return w.status;
 }
 
 }  // namespace pdlfs
@@ -16,11 +16,13 @@
 #include <sys/socket.h>
 
 namespace pdlfs {
-// RPC srv impl using TCP.
+// RPC srv impl using TCP. Clients keep their connections open across calls
+// and may have many calls outstanding on each connection. Every message sent
+// on a connection is framed by a fixed32 payload size followed by a fixed32
+// request id, and the reply to a request carries the id of that request.
 class PosixTCPServer : public PosixSocketServer {
  public:
-  PosixTCPServer(const RPCOptions& options, uint64_t timeout,
-                 size_t buf_sz = 4000);
+  PosixTCPServer(const RPCOptions& options, uint64_t timeout);
   virtual ~PosixTCPServer() {
     BGStop();
   }  // More resources to be released by parent
@@ -31,26 +33,25 @@ class PosixTCPServer : public PosixSocketServer {
   virtual std::string GetUri();
 
  private:
-  // State for each incoming procedure call.
-  struct CallState {
-    struct sockaddr_storage addr;  // Location of the caller
-    socklen_t addrlen;
-    int fd;
-  };
-  void HandleIncomingCall(CallState* call);
+  // State for each client connection.
+  struct Connection;
+  // Handle all complete requests received from a connection. Return false if
+  // the connection should be closed.
+  bool HandleIncomingCalls(Connection* conn);
   virtual Status BGLoop(int myid);
   const uint64_t rpc_timeout_;  // In microseconds
-  const size_t buf_sz_;         // Buffer size for reading peer data
 };
 
 // TCP client.
 class PosixTCPCli : public rpc::If {
  public:
-  explicit PosixTCPCli(uint64_t timeout, size_t buf_sz = 4000);
-  virtual ~PosixTCPCli() {}
+  PosixTCPCli(uint64_t timeout, int max_conns = 1);
+  virtual ~PosixTCPCli();
 
-  // Each call creates a new socket, followed by a connection operation, a send,
-  // and a receive.
+  // Calls are spread over up to max_conns persistent connections to the
+  // target, which are opened on first use and reopened after errors. Each
+  // connection is shared by all concurrent callers, with replies matched to
+  // calls through request ids.
   virtual Status Call(Message& in, Message& out) RPCNOEXCEPT;
 
   // If we fail to resolve the uri, we will record the error and return it at
@@ -61,11 +62,17 @@ class PosixTCPCli : public rpc::If {
   // No copying allowed
   void operator=(const PosixTCPCli&);
   PosixTCPCli(const PosixTCPCli& other);
+  struct Connection;
+  struct Waiter;
+  Status CallOn(Connection* conn, Message& in, Message& out);
+  void Break(Connection* conn, const Status& status);
   Status OpenAndConnect(int* fd);
   const uint64_t rpc_timeout_;  // In microseconds
-  const size_t buf_sz_;
   PosixSocketAddr addr_;
   Status status_;
+  port::Mutex mutex_;
+  std::vector<Connection*> conns_;
+  size_t next_conn_;  // Protected by mutex_
 };
 
 }  // namespace pdlfs
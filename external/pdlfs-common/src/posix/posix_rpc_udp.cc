@@ -11,6 +11,7 @@
 #include "posix_rpc_udp.h"
 
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/histogram.h"
 #include "pdlfs-common/mutexlock.h"
 
 #include <errno.h>
@@ -20,6 +21,10 @@
 #include <unistd.h>
 
 namespace pdlfs {
+namespace {
+// Max number of call states kept for reuse by a server.
+const size_t kMaxFreeCalls = 128;
+}  // namespace
 
 PosixUDPServer::PosixUDPServer(const RPCOptions& options)
     : PosixSocketServer(options),
@@ -32,6 +37,12 @@ PosixUDPServer::~PosixUDPServer() {
   while (bg_count_ != 0) {  // Wait until all bg work items have been processed
     bg_cv_.Wait();
   }
+  for (size_t i = 0; i < free_calls_.size(); i++) {
+    free(free_calls_[i]);
+  }
+  for (size_t i = 0; i < bg_fds_.size(); i++) {
+    close(bg_fds_[i]);
+  }
   // More resources will be released by parent
 }
 
@@ -47,21 +58,41 @@ Status PosixUDPServer::OpenAndBind(const std::string& uri) {
 
   // Try opening the server. If we fail we will clean up so that we can try
   // again later.
-  fd_ = socket(AF_INET, SOCK_DGRAM, 0);
-  if (fd_ == -1) {
-    status = Status::IOError("Cannot create UDP socket", strerror(errno));
-  } else {
-    int rv = bind(fd_, reinterpret_cast<struct sockaddr*>(addr_->rep()),
-                  sizeof(struct sockaddr_in));
-    if (rv == -1) {
-      status = Status::IOError("UDP bind", strerror(errno));
-      close(fd_);
-      fd_ = -1;
+  status = OpenSocket(addr_, &fd_);
+
+  if (status.ok()) {
+    // Fetch the port that we have just bound to in case we have decided to have
+    // the OS choose the port
+    socklen_t tmp = sizeof(struct sockaddr_in);
+    getsockname(fd_, reinterpret_cast<struct sockaddr*>(actual_addr_->rep()),
+                &tmp);
+  }
+
+  return status;
+}
+
+Status PosixUDPServer::OpenSocket(PosixSocketAddr* addr, int* result) {
+  Status status;
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd == -1) {
+    return Status::IOError("Cannot create UDP socket", strerror(errno));
+  }
+
+  if (options_.udp_srv_reuseport) {
+#if defined(SO_REUSEPORT)
+    int one = 1;
+    int rv = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    if (rv != 0) {
+      Log(options_.info_log, 0, "Cannot set SO_REUSEPORT: %s",
+          strerror(errno));
     }
+#else
+    Log(options_.info_log, 0, "SO_REUSEPORT not supported");
+#endif
   }
 
   if (options_.udp_srv_rcvbuf != -1) {
-    int rv = setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &options_.udp_srv_rcvbuf,
+    int rv = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options_.udp_srv_rcvbuf,
                         sizeof(options_.udp_srv_rcvbuf));
     if (rv != 0) {
       Log(options_.info_log, 0, "Cannot set SO_RCVBUF=%d: %s",
@@ -70,7 +101,7 @@ Status PosixUDPServer::OpenAndBind(const std::string& uri) {
   }
 
   if (options_.udp_srv_sndbuf != -1) {
-    int rv = setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &options_.udp_srv_sndbuf,
+    int rv = setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options_.udp_srv_sndbuf,
                         sizeof(options_.udp_srv_sndbuf));
     if (rv != 0) {
       Log(options_.info_log, 0, "Cannot set SO_SNDBUF=%d: %s",
@@ -78,12 +109,13 @@ Status PosixUDPServer::OpenAndBind(const std::string& uri) {
     }
   }
 
-  if (status.ok()) {
-    // Fetch the port that we have just bound to in case we have decided to have
-    // the OS choose the port
-    socklen_t tmp = sizeof(struct sockaddr_in);
-    getsockname(fd_, reinterpret_cast<struct sockaddr*>(actual_addr_->rep()),
-                &tmp);
+  int rv = bind(fd, reinterpret_cast<struct sockaddr*>(addr->rep()),
+                sizeof(struct sockaddr_in));
+  if (rv == -1) {
+    status = Status::IOError("UDP bind", strerror(errno));
+    close(fd);
+  } else {
+    *result = fd;
   }
 
   return status;
@@ -93,21 +125,38 @@ inline PosixUDPServer::CallState* PosixUDPServer::CreateCallState() {
   CallState* const call = static_cast<CallState*>(
       malloc(sizeof(struct CallState) - 1 + max_msgsz_));
   call->parent_srv = this;
+  call->fd = -1;
   return call;
 }
 
 Status PosixUDPServer::BGLoop(int myid) {
+  int fd = fd_;
+  if (options_.udp_srv_reuseport && myid != 0) {
+    // Have the kernel shard incoming datagrams to a socket of our own
+    Status s = OpenSocket(actual_addr_, &fd);
+    if (!s.ok()) {
+      return s;
+    }
+    MutexLock ml(&mutex_);
+    bg_fds_.push_back(fd);
+  }
+#if defined(PDLFS_OS_LINUX)
+  if (options_.udp_srv_batchsz > 1) {
+    return BGLoopBatched(fd, options_.udp_srv_batchsz);
+  }
+#endif
   CallState* call = CreateCallState();
+  call->fd = fd;
   struct pollfd po;
   po.events = POLLIN;
-  po.fd = fd_;
+  po.fd = fd;
 
   int err = 0;
   while (!err && !shutting_down_.Acquire_Load()) {
     call->addrlen = sizeof(call->addrstor);
     // Try performing a quick non-blocking receive from peers before sinking
     // into poll.
-    ssize_t rv = recvfrom(fd_, call->msg, max_msgsz_, MSG_DONTWAIT,
+    ssize_t rv = recvfrom(fd, call->msg, max_msgsz_, MSG_DONTWAIT,
                           call->addrbuf(), &call->addrlen);
     if (rv > 0) {
       call->msgsz = rv;
@@ -134,8 +183,103 @@ Status PosixUDPServer::BGLoop(int myid) {
   return status;
 }
 
+#if defined(PDLFS_OS_LINUX)
+// Same as BGLoop() except that up to "n" datagrams are received per
+// recvmmsg() call, and the replies to those handled by this thread are sent
+// back together through a single sendmmsg() call.
+Status PosixUDPServer::BGLoopBatched(int fd, int n) {
+  std::vector<CallState*> calls(n);
+  std::vector<struct mmsghdr> msgs(n);
+  std::vector<struct iovec> iovs(n);
+  std::vector<rpc::If::Message> outs(n);
+  std::vector<struct mmsghdr> replies(n);
+  std::vector<struct iovec> reply_iovs(n);
+  for (int i = 0; i < n; i++) {
+    calls[i] = CreateCallState();
+    calls[i]->fd = fd;
+  }
+  struct pollfd po;
+  po.events = POLLIN;
+  po.fd = fd;
+
+  int err = 0;
+  while (!err && !shutting_down_.Acquire_Load()) {
+    memset(&msgs[0], 0, n * sizeof(struct mmsghdr));
+    for (int i = 0; i < n; i++) {
+      iovs[i].iov_base = calls[i]->msg;
+      iovs[i].iov_len = max_msgsz_;
+      msgs[i].msg_hdr.msg_name = calls[i]->addrbuf();
+      msgs[i].msg_hdr.msg_namelen = sizeof(calls[i]->addrstor);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    // Try performing a quick non-blocking receive from peers before sinking
+    // into poll.
+    int rv = recvmmsg(fd, &msgs[0], n, MSG_DONTWAIT, NULL);
+    if (rv > 0) {
+      int k = 0;  // Number of replies to send
+      for (int i = 0; i < rv; i++) {
+        CallState* const call = calls[i];
+        call->addrlen = msgs[i].msg_hdr.msg_namelen;
+        call->msgsz = msgs[i].msg_len;
+        if (call->msgsz == 0) {  // Empty message
+          continue;
+        } else if (options_.extra_workers) {
+          HandleIncomingCall(&calls[i]);
+        } else if (HandleCall(call, &outs[k])) {
+          memset(&replies[k], 0, sizeof(struct mmsghdr));
+          reply_iovs[k].iov_base = const_cast<char*>(outs[k].contents.data());
+          reply_iovs[k].iov_len = outs[k].contents.size();
+          replies[k].msg_hdr.msg_name = call->addrbuf();
+          replies[k].msg_hdr.msg_namelen = call->addrlen;
+          replies[k].msg_hdr.msg_iov = &reply_iovs[k];
+          replies[k].msg_hdr.msg_iovlen = 1;
+          k++;
+        }
+      }
+      int sent = 0;
+      while (sent < k) {
+        int r = sendmmsg(fd, &replies[sent], k - sent, 0);
+        if (r > 0) {
+          sent += r;
+        } else {  // Skip the reply we fail to send
+          Log(options_.info_log, 0, "Error sending data to client: %s",
+              strerror(errno));
+          sent++;
+        }
+      }
+      for (int i = 0; i < rv; i++) {
+        outs[i].contents = Slice();
+        outs[i].extra_buf.clear();
+      }
+      continue;
+    } else if (rv == 0) {
+      continue;
+    } else if (errno == EWOULDBLOCK) {
+      rv = poll(&po, 1, 200);
+    }
+
+    // Either poll() or recvmmsg() may have returned error
+    if (rv == -1) {
+      err = errno;
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    free(calls[i]);
+  }
+
+  Status status;
+  if (err) {
+    status = Status::IOError("UDP recvmmsg/poll", strerror(err));
+  }
+  return status;
+}
+#endif
+
 void PosixUDPServer::HandleIncomingCall(CallState** call) {
   if (options_.extra_workers) {
+    const int fd = (*call)->fd;
     mutex_.Lock();
     ++bg_count_;
     // XXX: senders/callers are implicitly rate-limited by not sending them
@@ -144,8 +288,14 @@ void PosixUDPServer::HandleIncomingCall(CallState** call) {
     // rejected with a special reply. This special reply is understood by
     // PosixUDPCli, which in turn returns a special Status to the caller.
     options_.extra_workers->Schedule(ProcessCallWrapper, *call);
+    CallState* next = NULL;
+    if (!free_calls_.empty()) {
+      next = free_calls_.back();
+      free_calls_.pop_back();
+    }
     mutex_.Unlock();
-    *call = CreateCallState();
+    *call = next != NULL ? next : CreateCallState();
+    (*call)->fd = fd;
   } else {
     ProcessCall(*call);
   }
@@ -155,8 +305,12 @@ void PosixUDPServer::ProcessCallWrapper(void* arg) {
   CallState* const call = reinterpret_cast<CallState*>(arg);
   PosixUDPServer* const srv = call->parent_srv;
   srv->ProcessCall(call);
-  free(call);
   MutexLock ml(&srv->mutex_);
+  if (srv->free_calls_.size() < kMaxFreeCalls) {
+    srv->free_calls_.push_back(call);
+  } else {
+    free(call);
+  }
   assert(srv->bg_count_ > 0);
   --srv->bg_count_;
   if (!srv->bg_count_) {
@@ -164,18 +318,34 @@ void PosixUDPServer::ProcessCallWrapper(void* arg) {
   }
 }
 
-void PosixUDPServer::ProcessCall(CallState* const call) {
-  rpc::If::Message in, out;
+bool PosixUDPServer::HandleCall(CallState* const call,
+                                rpc::If::Message* const out) {
+  rpc::If::Message in;
   in.contents = Slice(call->msg, call->msgsz);
-  Status s = options_.fs->Call(in, out);
+  const uint64_t start = CurrentMicros();
+  Status s = options_.fs->Call(in, *out);
+  if (options_.latency_hist != NULL) {
+    options_.latency_hist->Add(CurrentMicros() - start);
+  }
   if (!s.ok()) {
     Log(options_.info_log, 0, "Fail to handle incoming call: %s",
         s.ToString().c_str());
-    return;
+    return false;
+  }
+  return true;
+}
+
+void PosixUDPServer::ProcessCall(CallState* const call) {
+  rpc::If::Message out;
+  if (HandleCall(call, &out)) {
+    SendReply(call, out.contents);
   }
-  ssize_t nbytes = sendto(fd_, out.contents.data(), out.contents.size(), 0,
+}
+
+void PosixUDPServer::SendReply(CallState* const call, const Slice& reply) {
+  ssize_t nbytes = sendto(call->fd, reply.data(), reply.size(), 0,
                           call->addrbuf(), call->addrlen);
-  if (nbytes != out.contents.size()) {
+  if (nbytes != reply.size()) {
 #if VERBOSE >= 1
     const int errno_copy = errno;  // Store a copy before calling getnameinfo()
     char host[NI_MAXHOST];
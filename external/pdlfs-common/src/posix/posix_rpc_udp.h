@@ -31,6 +31,7 @@ class PosixUDPServer : public PosixSocketServer {
   // State for each incoming procedure call.
   struct CallState {
     PosixUDPServer* parent_srv;  // Back pointer to the server
+    int fd;  // Socket the call was received from and its reply goes to
     // Location of the caller
     struct sockaddr_storage addrstor;
     struct sockaddr* addrbuf() {
@@ -42,12 +43,22 @@ class PosixUDPServer : public PosixSocketServer {
   };
   CallState* CreateCallState();
   void HandleIncomingCall(CallState** call);  // May send call to bg worker pool
+  // Run a call and store its reply in *out. Return false if there is no
+  // reply to send.
+  bool HandleCall(CallState* call, rpc::If::Message* out);
+  void SendReply(CallState* call, const Slice& reply);
   void ProcessCall(CallState* call);
   static void ProcessCallWrapper(void* arg);
+  Status OpenSocket(PosixSocketAddr* addr, int* result);
   virtual Status BGLoop(int myid);
+  Status BGLoopBatched(int fd, int batchsz);
   const size_t max_msgsz_;  // Buffer size for incoming rpc messages
   // State below protected by mutex_
+  std::vector<int> bg_fds_;  // Extra sockets opened for SO_REUSEPORT threads
   int bg_count_;  // Total number of bg work items pending
+  // Call states released by bg workers for reuse so that handing a call off
+  // to a worker does not require a new message buffer each time
+  std::vector<CallState*> free_calls_;
 };
 
 // UDP client.
@@ -21,9 +21,55 @@ void RadosOpCtx::IO_safe(rados_completion_t comp, void* arg) {
     if (ctx->err_ == 0 && err != 0) {
       ctx->err_ = err;
     }
+    ctx->cv_.SignalAll();
     ctx->Unref();
   }
 }
 
+RadosIoCtxCache::~RadosIoCtxCache() {
+  for (size_t i = 0; i < idle_.size(); i++) {
+    rados_ioctx_destroy(idle_[i].ioctx);
+  }
+}
+
+Status RadosIoCtxCache::Get(rados_ioctx_t* result) {
+  {
+    MutexLock ml(&mu_);
+    if (!idle_.empty()) {
+      // Prefer the most recent ioctx returned by the calling thread
+      size_t i = idle_.size() - 1;
+      const pthread_t self = pthread_self();
+      for (size_t j = idle_.size(); j != 0; j--) {
+        if (pthread_equal(idle_[j - 1].owner, self)) {
+          i = j - 1;
+          break;
+        }
+      }
+      *result = idle_[i].ioctx;
+      idle_.erase(idle_.begin() + i);
+      return Status::OK();
+    }
+  }
+  int r = rados_ioctx_create(cluster_, pool_name_.c_str(), result);
+  if (r != 0) {
+    return RadosError("rados_ioctx_create", r);
+  } else {
+    return Status::OK();
+  }
+}
+
+void RadosIoCtxCache::Put(rados_ioctx_t ioctx) {
+  rados_aio_flush(ioctx);  // Wait for all async IO ops to finish
+  MutexLock ml(&mu_);
+  if (idle_.size() < max_idle_) {
+    Idle idle;
+    idle.ioctx = ioctx;
+    idle.owner = pthread_self();
+    idle_.push_back(idle);
+  } else {
+    rados_ioctx_destroy(ioctx);
+  }
+}
+
 }  // namespace rados
 }  // namespace pdlfs
@@ -17,25 +17,92 @@
 
 #include <rados/librados.h>
 
+#include <pthread.h>
+#include <string>
+#include <vector>
+
 namespace pdlfs {
 namespace rados {
 
-// Handle to an open rados cluster connection.
+class RadosIoCtxCache;
+
+// Handle to an open rados cluster connection. A connection may be shared by
+// multiple users opening the same cluster with the same configuration.
 struct RadosConn {
   char cluster_fsid[37];
   RadosConn* prev;
   RadosConn* next;
+  std::string key;  // Encodes the cluster, user, conf, and options
   rados_t cluster;
+  // Idle ioctxs of each pool opened on the connection
+  std::vector<RadosIoCtxCache*> ioctxs;
   int nrefs;
 };
 
-// Async I/O operation context.
+// A cache of idle ioctxs of a rados pool shared by all osd instances opened
+// on the same connection. Each ioctx taken from the cache is used by a single
+// object writer at a time. Writers return their ioctxs to the cache when they
+// are deleted so that later writers skip creating new ones. An ioctx is
+// preferably handed back to the thread that last returned it. At most
+// max_idle ioctxs are kept; excess ones are destroyed.
+class RadosIoCtxCache {
+ public:
+  RadosIoCtxCache(rados_t cluster, const std::string& pool_name,
+                  size_t max_idle)
+      : cluster_(cluster), pool_name_(pool_name), max_idle_(max_idle) {}
+  ~RadosIoCtxCache();
+
+  const std::string& pool_name() const { return pool_name_; }
+
+  // Obtain an ioctx from the cache or create a new one.
+  Status Get(rados_ioctx_t* result);
+
+  // Return an ioctx obtained through Get(). Waits for all outstanding async
+  // operations of the ioctx to finish.
+  void Put(rados_ioctx_t ioctx);
+
+ private:
+  struct Idle {
+    rados_ioctx_t ioctx;
+    pthread_t owner;  // Thread that returned the ioctx
+  };
+  // No copying allowed
+  void operator=(const RadosIoCtxCache&);
+  RadosIoCtxCache(const RadosIoCtxCache&);
+  rados_t cluster_;
+  const std::string pool_name_;
+  const size_t max_idle_;
+  port::Mutex mu_;
+  std::vector<Idle> idle_;  // Protected by mu_
+};
+
+// Return an ioctx owned by a file to its cache, or destroy it if it does not
+// come from a cache.
+inline void ReleaseIoCtx(rados_ioctx_t ioctx, RadosIoCtxCache* cache) {
+  if (cache != NULL) {
+    cache->Put(ioctx);
+  } else {
+    rados_ioctx_destroy(ioctx);
+  }
+}
+
+// Async I/O operation context. Each outstanding operation holds a reference
+// in addition to the one held by the owner of the context.
 class RadosOpCtx {
  public:
-  RadosOpCtx(port::Mutex* mu) : mu_(mu), nrefs_(1), err_(0) {}
+  RadosOpCtx(port::Mutex* mu) : mu_(mu), cv_(mu), nrefs_(1), err_(0) {}
   bool ok() const { return err_ == 0; }
   int err() const { return err_; }
 
+  // Wait until no more than n operations are outstanding.
+  // REQUIRES: the caller holds a reference to the context.
+  void WaitForOps(int n) {
+    mu_->AssertHeld();
+    while (nrefs_ - 1 > n) {
+      cv_.Wait();
+    }
+  }
+
   void Ref() {
     mu_->AssertHeld();
     nrefs_++;
@@ -58,6 +125,7 @@ class RadosOpCtx {
   void operator=(const RadosOpCtx&);
   RadosOpCtx(const RadosOpCtx&);
   port::Mutex* mu_;
+  port::CondVar cv_;
   int nrefs_;
   int err_;
 };
@@ -165,19 +233,23 @@ class RadosWritableFile : public WritableFile {
   std::string oid_;
   rados_ioctx_t rados_ioctx_;
   bool owns_ioctx_;
+  RadosIoCtxCache* ioctx_cache_;  // Where an owned ioctx is returned
   int err_;
 
  public:
   RadosWritableFile(const Slice& fname, rados_ioctx_t ioctx,
-                    bool owns_ioctx = true)
-      : rados_ioctx_(ioctx), owns_ioctx_(owns_ioctx), err_(0) {
+                    bool owns_ioctx = true, RadosIoCtxCache* cache = NULL)
+      : rados_ioctx_(ioctx),
+        owns_ioctx_(owns_ioctx),
+        ioctx_cache_(cache),
+        err_(0) {
     oid_ = fname.ToString();
     Truncate();
   }
 
   virtual ~RadosWritableFile() {
     if (owns_ioctx_) {
-      rados_ioctx_destroy(rados_ioctx_);
+      ReleaseIoCtx(rados_ioctx_, ioctx_cache_);
     }
   }
 
@@ -229,9 +301,13 @@ class RadosAsyncWritableFile : public WritableFile {
   std::string oid_;
   rados_ioctx_t rados_ioctx_;
   bool owns_ioctx_;
+  RadosIoCtxCache* ioctx_cache_;  // Where an owned ioctx is returned
+  int max_ops_;                   // Max number of outstanding writes
 
   Status Ref() {
     MutexLock ml(mu_);
+    // Block until there is room in the window
+    async_op_->WaitForOps(max_ops_ - 1);
     if (!async_op_->ok()) {
       return RadosError("rados_bg_io", async_op_->err());
     } else {
@@ -242,8 +318,14 @@ class RadosAsyncWritableFile : public WritableFile {
 
  public:
   RadosAsyncWritableFile(const Slice& fname, port::Mutex* mu,
-                         rados_ioctx_t ioctx, bool owns_ioctx = true)
-      : mu_(mu), rados_ioctx_(ioctx), owns_ioctx_(owns_ioctx) {
+                         rados_ioctx_t ioctx, int max_ops,
+                         bool owns_ioctx = true,
+                         RadosIoCtxCache* cache = NULL)
+      : mu_(mu),
+        rados_ioctx_(ioctx),
+        owns_ioctx_(owns_ioctx),
+        ioctx_cache_(cache),
+        max_ops_(max_ops > 0 ? max_ops : 1) {
     async_op_ = new RadosOpCtx(mu_);
     oid_ = fname.ToString();
     Truncate();
@@ -254,7 +336,7 @@ class RadosAsyncWritableFile : public WritableFile {
     async_op_->Unref();
     mu_->Unlock();
     if (owns_ioctx_) {
-      rados_ioctx_destroy(rados_ioctx_);
+      ReleaseIoCtx(rados_ioctx_, ioctx_cache_);
     }
   }
 
@@ -16,13 +16,19 @@
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
 
+#include <algorithm>
+
 namespace pdlfs {
 namespace rados {
 
 RadosConnOptions::RadosConnOptions()
-    : client_mount_timeout(5), mon_op_timeout(5), osd_op_timeout(5) {}
+    : client_mount_timeout(5),
+      mon_op_timeout(5),
+      osd_op_timeout(5),
+      share_conn(true) {}
 
-RadosConnMgrOptions::RadosConnMgrOptions() : info_log(NULL) {}
+RadosConnMgrOptions::RadosConnMgrOptions()
+    : info_log(NULL), max_idle_ioctxs(16) {}
 
 RadosDbEnvOptions::RadosDbEnvOptions()
     : write_ahead_log_buf_size(1 << 17),
@@ -32,7 +38,11 @@ RadosDbEnvOptions::RadosDbEnvOptions()
 RadosEnvOptions::RadosEnvOptions()
     : rados_root("/"), sync_directory_log_on_unmount(false), info_log(NULL) {}
 
-RadosOptions::RadosOptions() : force_syncio(false) {}
+RadosOptions::RadosOptions()
+    : force_syncio(false),
+      aio_depth(8),
+      stripe_count(1),
+      stripe_unit(4 << 20) {}
 
 class RadosConnMgr::Rep {
  public:
@@ -49,11 +59,36 @@ class RadosConnMgr::Rep {
       this->options.info_log = Logger::Default();
     }
   }
+
+  // Return an open connection with a given key, or NULL if there is none.
+  // REQUIRES: mutex_ has been locked.
+  RadosConn* Find(const std::string& key) {
+    mutex_.AssertHeld();
+    for (RadosConn* c = list.next; c != &list; c = c->next) {
+      if (c->key == key) {
+        return c;
+      }
+    }
+    return NULL;
+  }
 };
 
 RadosConnMgr::RadosConnMgr(const RadosConnMgrOptions& options)
     : rep_(new Rep(options)) {}
 
+namespace {
+port::OnceType once = PDLFS_ONCE_INIT;
+RadosConnMgr* default_connmgr = NULL;
+void InitDefaultConnMgr() {
+  default_connmgr = new RadosConnMgr(RadosConnMgrOptions());
+}
+}  // namespace
+
+RadosConnMgr* RadosConnMgr::Default() {
+  port::InitOnce(&once, InitDefaultConnMgr);
+  return default_connmgr;
+}
+
 RadosConnMgr::~RadosConnMgr() {
   {
     MutexLock ml(&rep_->mutex_);
@@ -89,11 +124,37 @@ Status RadosConfAndConnect(  ///
     return Status::OK();
   }
 }
+
+// Return a key identifying connections of a given configuration.
+std::string ConnKey(const char* cluster_name, const char* user_name,
+                    const char* conf_file, const RadosConnOptions& options) {
+  std::string result;
+  const char* const names[] = {cluster_name, user_name, conf_file};
+  for (size_t i = 0; i < 3; i++) {
+    if (names[i] != NULL) result += names[i];
+    result.push_back('\0');
+  }
+  char tmp[50];
+  snprintf(tmp, sizeof(tmp), "%d/%d/%d", options.client_mount_timeout,
+           options.mon_op_timeout, options.osd_op_timeout);
+  result += tmp;
+  return result;
+}
 }  // namespace
 
 Status RadosConnMgr::OpenConn(  ///
     const char* cluster_name, const char* user_name, const char* conf_file,
     const RadosConnOptions& options, RadosConn** conn) {
+  const std::string key = ConnKey(cluster_name, user_name, conf_file, options);
+  if (options.share_conn) {
+    MutexLock ml(&rep_->mutex_);
+    RadosConn* const c = rep_->Find(key);
+    if (c != NULL) {
+      ++c->nrefs;
+      *conn = c;
+      return Status::OK();
+    }
+  }
   rados_t cluster;
   int rv = rados_create2(&cluster, cluster_name, user_name, 0);
   if (rv < 0) {
@@ -105,8 +166,19 @@ Status RadosConnMgr::OpenConn(  ///
     return status;
   }
   MutexLock ml(&rep_->mutex_);
-  RadosConn* const new_conn =
-      static_cast<RadosConn*>(malloc(sizeof(RadosConn)));
+  if (options.share_conn) {
+    // Another thread may have connected while we were connecting
+    RadosConn* const c = rep_->Find(key);
+    if (c != NULL) {
+      rados_shutdown(cluster);
+      ++c->nrefs;
+      *conn = c;
+      return status;
+    }
+  }
+  RadosConn* const new_conn = new RadosConn;
+  // Connections that are not shared are never found by others
+  if (options.share_conn) new_conn->key = key;
   RadosConn* list = &rep_->list;
   new_conn->next = list;
   new_conn->prev = list->prev;
@@ -135,8 +207,11 @@ void RadosConnMgr::Unref(RadosConn* const conn) {
     Log(rep_->options.info_log, 1, "Closing connection to cluster %s ...",
         conn->cluster_fsid);
 #endif
+    for (size_t i = 0; i < conn->ioctxs.size(); i++) {
+      delete conn->ioctxs[i];
+    }
     rados_shutdown(conn->cluster);
-    free(conn);
+    delete conn;
   }
 }
 
@@ -150,19 +225,38 @@ void RadosConnMgr::Release(RadosConn* conn) {
 Status RadosConnMgr::OpenOsd(  ///
     RadosConn* conn, const char* pool_name, const RadosOptions& options,
     Osd** result) {
-  Status status;
+  RadosIoCtxCache* ioctxs = NULL;
+  {
+    MutexLock ml(&rep_->mutex_);
+    for (size_t i = 0; i < conn->ioctxs.size(); i++) {
+      if (conn->ioctxs[i]->pool_name() == pool_name) {
+        ioctxs = conn->ioctxs[i];
+        break;
+      }
+    }
+    if (ioctxs == NULL) {
+      ioctxs = new RadosIoCtxCache(
+          conn->cluster, pool_name,
+          static_cast<size_t>(std::max(rep_->options.max_idle_ioctxs, 0)));
+      conn->ioctxs.push_back(ioctxs);
+    }
+  }
   rados_ioctx_t ioctx;
-  int rv = rados_ioctx_create(conn->cluster, pool_name, &ioctx);
-  if (rv < 0) {
-    status = RadosError("Cannot create ioctx", rv);
-  } else {
+  Status status = ioctxs->Get(&ioctx);
+  if (status.ok()) {
     MutexLock ml(&rep_->mutex_);
     RadosOsd* const osd = new RadosOsd;
     osd->connmgr_ = this;
     osd->conn_ = conn;
+    osd->ioctxs_ = ioctxs;
     ++conn->nrefs;
     osd->pool_name_ = pool_name;
     osd->force_syncio_ = options.force_syncio;
+    osd->aio_depth_ = std::max(options.aio_depth, 1);
+    if (options.stripe_count > 1 && options.stripe_unit != 0) {
+      osd->stripe_layout_.stripe_count = options.stripe_count;
+      osd->stripe_layout_.stripe_unit = options.stripe_unit;
+    }
     osd->ioctx_ = ioctx;
     *result = osd;
   }
@@ -19,6 +19,7 @@
 namespace {
 const char* FLAGS_user_name = "client.admin";
 const char* FLAGS_rados_cluster_name = "ceph";
+const char* FLAGS_pool_name = "test";
 const char* FLAGS_conf = NULL;  // Use ceph defaults
 }  // namespace
 
@@ -39,12 +40,46 @@ TEST(RadosConnMgrTest, OpenAndClose) {
   delete mgr;
 }
 
+TEST(RadosConnMgrTest, SharedConns) {
+  RadosConnMgrOptions options;
+  RadosConnMgr* const mgr = new RadosConnMgr(options);
+  RadosConnOptions conn_options;
+  RadosConn* conn[3];
+  ASSERT_OK(mgr->OpenConn(FLAGS_rados_cluster_name, FLAGS_user_name, FLAGS_conf,
+                          conn_options, &conn[0]));
+  ASSERT_OK(mgr->OpenConn(FLAGS_rados_cluster_name, FLAGS_user_name, FLAGS_conf,
+                          conn_options, &conn[1]));
+  ASSERT_TRUE(conn[0] == conn[1]);
+  conn_options.share_conn = false;
+  ASSERT_OK(mgr->OpenConn(FLAGS_rados_cluster_name, FLAGS_user_name, FLAGS_conf,
+                          conn_options, &conn[2]));
+  ASSERT_TRUE(conn[0] != conn[2]);
+  Osd* osd[2];
+  ASSERT_OK(mgr->OpenOsd(conn[0], FLAGS_pool_name, RadosOptions(), &osd[0]));
+  ASSERT_OK(mgr->OpenOsd(conn[1], FLAGS_pool_name, RadosOptions(), &osd[1]));
+  for (int i = 0; i < 3; i++) {
+    mgr->Release(conn[i]);
+  }
+  // Writers of both osd instances share the same ioctxs
+  for (int i = 0; i < 4; i++) {
+    WritableFile* file;
+    ASSERT_OK(osd[i % 2]->NewWritableObj("a", &file));
+    ASSERT_OK(file->Append("x"));
+    ASSERT_OK(file->Close());
+    delete file;
+  }
+  ASSERT_OK(osd[0]->Delete("a"));
+  delete osd[0];
+  delete osd[1];
+  delete mgr;
+}
+
 }  // namespace rados
 }  // namespace pdlfs
 
 namespace {
 inline void PrintUsage() {
-  fprintf(stderr, "Use --cluster, --user, and --conf to conf test.\n");
+  fprintf(stderr, "Use --cluster, --user, --conf, and --pool to conf test.\n");
   exit(1);
 }
 
@@ -57,6 +92,8 @@ void ParseArgs(int argc, char* argv[]) {
       FLAGS_user_name = argv[i] + strlen("--user=");
     } else if (a.starts_with("--conf=")) {
       FLAGS_conf = argv[i] + strlen("--conf=");
+    } else if (a.starts_with("--pool=")) {
+      FLAGS_pool_name = argv[i] + strlen("--pool=");
     } else {
       PrintUsage();
     }
@@ -64,6 +101,7 @@ void ParseArgs(int argc, char* argv[]) {
 
   printf("Cluster name: %s\n", FLAGS_rados_cluster_name);
   printf("User name: %s\n", FLAGS_user_name);
+  printf("Storage pool: %s\n", FLAGS_pool_name);
   printf("Conf: %s\n", FLAGS_conf);
 }
 
@@ -10,22 +10,24 @@
  */
 #include "rados_osd.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace pdlfs {
 namespace rados {
 
+// Size of each async read issued for large objects.
+static const size_t kChunkSize = 1 << 20;  // 1MB
+
 RadosOsd::~RadosOsd() {
-  rados_aio_flush(ioctx_);  // Wait for all async IO ops to finish
-  rados_ioctx_destroy(ioctx_);
+  ioctxs_->Put(ioctx_);  // Waits for all async IO ops to finish
   connmgr_->Release(conn_);
 }
 
+// Obtain an ioctx for an object writer. The ioctx is returned to the cache of
+// the pool when the writer is deleted.
 Status RadosOsd::CreateIoCtx(rados_ioctx_t* result) {
-  int r = rados_ioctx_create(conn_->cluster, pool_name_.c_str(), result);
-  if (r != 0) {
-    return RadosError("rados_ioctx_create", r);
-  } else {
-    return Status::OK();
-  }
+  return ioctxs_->Get(result);
 }
 
 // Return true iff the named object exists.
@@ -40,25 +42,90 @@ bool RadosOsd::Exists(const char* name) {
   }
 }
 
-Status RadosOsd::Size(const char* name, uint64_t* obj_size) {
+// Obtain the logical size of a named object. If the object is striped, store
+// its layout in *layout and set *striped to true.
+Status RadosOsd::Stat(const char* name, uint64_t* size,
+                      RadosStripeLayout* layout, bool* striped) {
   time_t ignored_mtime;
-  int r = rados_stat(ioctx_, name, obj_size, &ignored_mtime);
+  *striped = false;
+  int r = rados_stat(ioctx_, name, size, &ignored_mtime);
   if (r != 0) {
     return RadosError("rados_stat", r);
-  } else {
-    return Status::OK();
+  }
+  Status s = ReadStripeLayout(ioctx_, name, *size, layout, striped);
+  if (s.ok() && *striped) {
+    *size = layout->size;
+  }
+  return s;
+}
+
+Status RadosOsd::Size(const char* name, uint64_t* obj_size) {
+  RadosStripeLayout layout;
+  bool striped;
+  return Stat(name, obj_size, &layout, &striped);
+}
+
+// Keep up to aio_depth_ stats in flight at a time. Objects that may be
+// striped manifests are resolved with an extra synchronous read.
+void RadosOsd::BatchSize(size_t n, const char* const* names, uint64_t* sizes,
+                         Status* statuses) {
+  const size_t window = static_cast<size_t>(aio_depth_ > 0 ? aio_depth_ : 1);
+  std::vector<rados_completion_t> comps;
+  std::vector<time_t> mtimes(window);
+  size_t i = 0;
+  while (i < n) {
+    const size_t start = i;
+    for (; i < n && comps.size() < window; i++) {
+      rados_completion_t comp;
+      int r = rados_aio_create_completion(NULL, NULL, NULL, &comp);
+      if (r == 0) {
+        r = rados_aio_stat(ioctx_, names[i], comp, &sizes[i],
+                           &mtimes[i - start]);
+        if (r != 0) {
+          rados_aio_release(comp);
+        }
+      }
+      if (r != 0) {
+        statuses[i] = RadosError("rados_aio_stat", r);
+        comp = NULL;
+      }
+      comps.push_back(comp);
+    }
+    for (size_t j = 0; j < comps.size(); j++) {
+      if (comps[j] == NULL) continue;
+      rados_aio_wait_for_complete(comps[j]);
+      int r = rados_aio_get_return_value(comps[j]);
+      rados_aio_release(comps[j]);
+      const size_t k = start + j;
+      if (r != 0) {
+        statuses[k] = RadosError("rados_aio_stat", r);
+      } else {
+        RadosStripeLayout layout;
+        bool striped;
+        statuses[k] =
+            ReadStripeLayout(ioctx_, names[k], sizes[k], &layout, &striped);
+        if (statuses[k].ok() && striped) {
+          sizes[k] = layout.size;
+        }
+      }
+    }
+    comps.clear();
   }
 }
 
 Status RadosOsd::NewSequentialObj(const char* name, SequentialFile** r) {
   const bool owns_ioctx = false;
+  RadosStripeLayout layout;
+  bool striped;
   uint64_t obj_size;
-  Status s = Size(name, &obj_size);
+  Status s = Stat(name, &obj_size, &layout, &striped);
   if (s.ok()) {
-    if (obj_size != 0) {
-      *r = new RadosSequentialFile(name, ioctx_, owns_ioctx);
-    } else {
+    if (obj_size == 0) {
       *r = new RadosEmptyFile();
+    } else if (striped) {
+      *r = new RadosStripedFile(name, ioctx_, layout, aio_depth_);
+    } else {
+      *r = new RadosSequentialFile(name, ioctx_, owns_ioctx);
     }
   } else {
     *r = NULL;
@@ -69,13 +136,17 @@ Status RadosOsd::NewSequentialObj(const char* name, SequentialFile** r) {
 
 Status RadosOsd::NewRandomAccessObj(const char* name, RandomAccessFile** r) {
   const bool owns_ioctx = false;
+  RadosStripeLayout layout;
+  bool striped;
   uint64_t obj_size;
-  Status s = Size(name, &obj_size);
+  Status s = Stat(name, &obj_size, &layout, &striped);
   if (s.ok()) {
-    if (obj_size != 0) {
-      *r = new RadosRandomAccessFile(name, ioctx_, owns_ioctx);
-    } else {
+    if (obj_size == 0) {
       *r = new RadosEmptyFile();
+    } else if (striped) {
+      *r = new RadosStripedFile(name, ioctx_, layout, aio_depth_);
+    } else {
+      *r = new RadosRandomAccessFile(name, ioctx_, owns_ioctx);
     }
   } else {
     *r = NULL;
@@ -85,13 +156,18 @@ Status RadosOsd::NewRandomAccessObj(const char* name, RandomAccessFile** r) {
 }
 
 Status RadosOsd::NewWritableObj(const char* name, WritableFile** r) {
+  const bool owns_ioctx = true;
   rados_ioctx_t ioctx;
   Status s = CreateIoCtx(&ioctx);
   if (s.ok()) {
-    if (!force_syncio_) {
-      *r = new RadosAsyncWritableFile(name, &mutex_, ioctx);
+    if (stripe_layout_.stripe_count > 1) {
+      *r = new RadosStripedWritableFile(name, &mutex_, ioctx, stripe_layout_,
+                                        aio_depth_, ioctxs_);
+    } else if (!force_syncio_) {
+      *r = new RadosAsyncWritableFile(name, &mutex_, ioctx, aio_depth_,
+                                      owns_ioctx, ioctxs_);
     } else {
-      *r = new RadosWritableFile(name, ioctx);
+      *r = new RadosWritableFile(name, ioctx, owns_ioctx, ioctxs_);
     }
   } else {
     *r = NULL;
@@ -101,6 +177,21 @@ Status RadosOsd::NewWritableObj(const char* name, WritableFile** r) {
 }
 
 Status RadosOsd::Delete(const char* name) {
+  RadosStripeLayout layout;
+  bool striped;
+  uint64_t ignored_size;
+  Status s = Stat(name, &ignored_size, &layout, &striped);
+  if (s.ok() && striped) {
+    // Remove stripes before the manifest so that a failed deletion
+    // can be retried
+    for (uint32_t i = 0; i < layout.stripe_count; i++) {
+      std::string stripe = StripeName(name, i);
+      int r = rados_remove(ioctx_, stripe.c_str());
+      if (r != 0 && r != -ENOENT) {
+        return RadosError("rados_remove", r);
+      }
+    }
+  }
   int r = rados_remove(ioctx_, name);  // Synchronous removal
   if (r != 0) {
     return RadosError("rados_remove", r);
@@ -110,40 +201,49 @@ Status RadosOsd::Delete(const char* name) {
 }
 
 Status RadosOsd::Copy(const char* src, const char* dst) {
+  RadosStripeLayout layout;
+  bool striped;
   uint64_t obj_size;
-  Status s = Size(src, &obj_size);
+  Status s = Stat(src, &obj_size, &layout, &striped);
   if (s.ok()) {
     rados_ioctx_t ioctx;
     s = CreateIoCtx(&ioctx);
     if (s.ok()) {
+      const bool owns_ioctx = true;
       WritableFile* target;
-      if (!force_syncio_) {
-        target = new RadosAsyncWritableFile(dst, &mutex_, ioctx);
+      if (stripe_layout_.stripe_count > 1) {
+        target = new RadosStripedWritableFile(
+            dst, &mutex_, ioctx, stripe_layout_, aio_depth_, ioctxs_);
+      } else if (!force_syncio_) {
+        target = new RadosAsyncWritableFile(dst, &mutex_, ioctx, aio_depth_,
+                                            owns_ioctx, ioctxs_);
       } else {
-        target = new RadosWritableFile(dst, ioctx);
+        target = new RadosWritableFile(dst, ioctx, owns_ioctx, ioctxs_);
       }
-      const size_t io_size = 1024 * 1024;  // 1MB
+      // Read a full window of chunks at a time
+      const size_t io_size = kChunkSize * aio_depth_;
       char* buf = new char[io_size];
       uint64_t off = 0;
       while (s.ok() && obj_size != 0) {
-        int nbytes = rados_read(ioctx_, src, buf, io_size, off);
-        if (nbytes > 0) {
-          size_t n = static_cast<size_t>(nbytes);
+        size_t n = 0;
+        s = ReadAt(src, striped ? &layout : NULL, off, buf,
+                   std::min<uint64_t>(io_size, obj_size), &n);
+        if (s.ok() && n != 0) {
           s = target->Append(Slice(buf, n));
-        } else if (nbytes < 0) {
-          s = RadosError("rados_read", nbytes);
+          // Async writers copy data before returning so buf may be reused
         } else {
           break;
         }
         if (s.ok()) {
-          assert(obj_size >= nbytes);
-          obj_size -= nbytes;
-          off += nbytes;
+          assert(obj_size >= n);
+          obj_size -= n;
+          off += n;
         }
       }
       if (s.ok()) {
         s = target->Sync();
       }
+      delete[] buf;
       delete target;
     }
   }
@@ -161,27 +261,84 @@ Status RadosOsd::Put(const char* name, const Slice& buf) {
 }
 
 Status RadosOsd::Get(const char* name, std::string* data) {
+  RadosStripeLayout layout;
+  bool striped;
   uint64_t obj_size;
-  Status s = Size(name, &obj_size);
+  Status s = Stat(name, &obj_size, &layout, &striped);
   if (s.ok() && obj_size != 0) {
-    char* buf = new char[obj_size];
-    uint64_t off = 0;
-    while (s.ok() && obj_size != 0) {
-      int nbytes = rados_read(ioctx_, name, buf, obj_size, off);
-      if (nbytes > 0) {
-        size_t n = static_cast<size_t>(nbytes);
-        data->append(buf, n);
-      } else if (nbytes < 0) {
-        s = RadosError("rados_read", nbytes);
-      } else {
+    const size_t base = data->size();
+    data->resize(base + obj_size);
+    size_t n = 0;
+    s = ReadAt(name, striped ? &layout : NULL, 0, &(*data)[base], obj_size,
+               &n);
+    data->resize(base + n);  // In case the object has shrunk
+  }
+
+  return s;
+}
+
+// Read up to n bytes starting at off. Reads are split into fixed-sized chunks
+// that are fetched in parallel through rados async I/O with up to aio_depth_
+// chunks in flight at a time. Stores the number of bytes read in *nread, which
+// is less than n only if the object ends early. Striped objects are read
+// according to their layout, which is passed in through *layout.
+Status RadosOsd::ReadAt(const char* name, const RadosStripeLayout* layout,
+                        uint64_t off, char* buf, size_t n, size_t* nread) {
+  Status s;
+  *nread = 0;
+  if (layout != NULL) {
+    RadosStripedFile file(name, ioctx_, *layout, aio_depth_);
+    Slice result;
+    s = file.Read(off, n, &result, buf);
+    if (s.ok()) {
+      *nread = result.size();
+    }
+    return s;
+  }
+  std::vector<rados_completion_t> comps;
+  comps.reserve(aio_depth_);
+  while (s.ok() && *nread < n) {
+    // Issue a window of chunk reads
+    size_t issued = *nread;
+    while (issued < n && comps.size() < static_cast<size_t>(aio_depth_)) {
+      const size_t len = std::min(kChunkSize, n - issued);
+      rados_completion_t comp;
+      int r = rados_aio_create_completion(NULL, NULL, NULL, &comp);
+      if (r == 0) {
+        r = rados_aio_read(ioctx_, name, comp, buf + issued, len, off + issued);
+        if (r != 0) {
+          rados_aio_release(comp);
+        }
+      }
+      if (r != 0) {
+        s = RadosError("rados_aio_read", r);
         break;
       }
-      if (s.ok()) {
-        assert(obj_size >= nbytes);
-        obj_size -= nbytes;
-        off += nbytes;
+      comps.push_back(comp);
+      issued += len;
+    }
+    // Collect results in order. A short chunk marks the end of the object.
+    bool eof = false;
+    for (size_t i = 0; i < comps.size(); i++) {
+      rados_aio_wait_for_complete(comps[i]);
+      int nbytes = rados_aio_get_return_value(comps[i]);
+      rados_aio_release(comps[i]);
+      if (!s.ok() || eof) {
+        continue;  // Drain the rest
+      } else if (nbytes < 0) {
+        s = RadosError("rados_aio_read", nbytes);
+      } else {
+        const size_t len = std::min(kChunkSize, n - *nread);
+        *nread += nbytes;
+        if (static_cast<size_t>(nbytes) < len) {
+          eof = true;
+        }
       }
     }
+    comps.clear();
+    if (eof) {
+      break;
+    }
   }
 
   return s;
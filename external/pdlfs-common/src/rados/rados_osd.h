@@ -11,6 +11,7 @@
 #pragma once
 
 #include "rados_comm.h"
+#include "rados_striper.h"
 
 #include "pdlfs-common/rados/rados_connmgr.h"
 
@@ -21,7 +22,9 @@ namespace pdlfs {
 namespace rados {
 
 // An osd implementation on top of rados. rados async I/O is utilized by default
-// unless explicitly disabled by the caller.
+// unless explicitly disabled by the caller. Newly written objects may
+// optionally be striped across multiple rados objects (see rados_striper.h).
+// Striped objects are always read transparently.
 class RadosOsd : public Osd {
  public:
   virtual ~RadosOsd();
@@ -30,6 +33,8 @@ class RadosOsd : public Osd {
   virtual Status NewWritableObj(const char* name, WritableFile** r);
   virtual bool Exists(const char* name);
   virtual Status Size(const char* name, uint64_t* obj_size);
+  virtual void BatchSize(size_t n, const char* const* names, uint64_t* sizes,
+                         Status* statuses);
   virtual Status Delete(const char* name);
   virtual Status Copy(const char* src, const char* dst);
   virtual Status Put(const char* name, const Slice& data);
@@ -39,11 +44,18 @@ class RadosOsd : public Osd {
   RadosOsd() {}  // Construction is done through RadosConnMgr
   friend class RadosConnMgr;
   Status CreateIoCtx(rados_ioctx_t* result);
+  Status Stat(const char* name, uint64_t* size, RadosStripeLayout* layout,
+              bool* striped);
+  Status ReadAt(const char* name, const RadosStripeLayout* layout,
+                uint64_t off, char* buf, size_t n, size_t* nread);
   // Constant after construction
   std::string pool_name_;
   bool force_syncio_;  // If async I/O is off
+  int aio_depth_;      // Max number of outstanding async ops per object
+  RadosStripeLayout stripe_layout_;  // For writing new objects
   RadosConnMgr* connmgr_;
   RadosConn* conn_;
+  RadosIoCtxCache* ioctxs_;  // Shared by all osd instances of the pool
   // State beblow protected by *mutex_
   port::Mutex mutex_;
   rados_ioctx_t ioctx_;
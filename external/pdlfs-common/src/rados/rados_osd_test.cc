@@ -11,6 +11,7 @@
 #include "rados_osd.h"
 
 #include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -34,11 +35,11 @@ class RadosOsdTest {
     osd_ = NULL;
   }
 
-  void Open() {
+  void Open(const RadosOptions& options = RadosOptions()) {
     RadosConn* conn;
     ASSERT_OK(mgr_->OpenConn(FLAGS_rados_cluster_name, FLAGS_user_name,
                              FLAGS_conf, RadosConnOptions(), &conn));
-    ASSERT_OK(mgr_->OpenOsd(conn, FLAGS_pool_name, RadosOptions(), &osd_));
+    ASSERT_OK(mgr_->OpenOsd(conn, FLAGS_pool_name, options, &osd_));
     mgr_->Release(conn);
   }
 
@@ -92,6 +93,61 @@ TEST(RadosOsdTest, PutGetCopy) {
   osd_->Delete(dst);
 }
 
+TEST(RadosOsdTest, LargeObjects) {
+  Open();
+  const char* src = "a";
+  const char* dst = "b";
+  Random rnd(301);
+  std::string data;
+  test::RandomString(&rnd, (5 << 20) + 17, &data);  // Spans multiple chunks
+  osd_->Delete(src);
+  osd_->Delete(dst);
+  ASSERT_OK(WriteStringToFileSync(osd_, data, src));
+  ASSERT_OK(osd_->Copy(src, dst));
+  std::string tmp;
+  ASSERT_OK(osd_->Get(dst, &tmp));
+  ASSERT_TRUE(tmp == data);
+  osd_->Delete(src);
+  osd_->Delete(dst);
+}
+
+TEST(RadosOsdTest, StripedObjects) {
+  RadosOptions options;
+  options.stripe_count = 4;
+  options.stripe_unit = 64 << 10;
+  Open(options);
+  const char* src = "a";
+  const char* dst = "b";
+  Random rnd(301);
+  std::string data;
+  test::RandomString(&rnd, (1 << 20) + 17, &data);
+  osd_->Delete(src);
+  osd_->Delete(dst);
+  ASSERT_OK(WriteStringToFileSync(osd_, data, src));
+  ASSERT_TRUE(osd_->Exists("a.3"));
+  uint64_t size;
+  ASSERT_OK(osd_->Size(src, &size));
+  ASSERT_EQ(size, data.size());
+  std::string tmp;
+  ASSERT_OK(ReadFileToString(osd_, src, &tmp));
+  ASSERT_TRUE(tmp == data);
+  RandomAccessFile* file;
+  ASSERT_OK(osd_->NewRandomAccessObj(src, &file));
+  std::string scratch(200 << 10, 0);
+  Slice result;
+  ASSERT_OK(file->Read(60 << 10, 200 << 10, &result, &scratch[0]));
+  ASSERT_EQ(result, Slice(data.data() + (60 << 10), 200 << 10));
+  delete file;
+  ASSERT_OK(osd_->Copy(src, dst));
+  tmp.clear();
+  ASSERT_OK(osd_->Get(dst, &tmp));
+  ASSERT_TRUE(tmp == data);
+  osd_->Delete(src);
+  osd_->Delete(dst);
+  ASSERT_TRUE(!osd_->Exists("a.0"));
+  ASSERT_TRUE(!osd_->Exists(src));
+}
+
 }  // namespace rados
 }  // namespace pdlfs
 
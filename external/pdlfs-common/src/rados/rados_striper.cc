@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "rados_striper.h"
+
+#include "pdlfs-common/crc32c.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace pdlfs {
+namespace rados {
+
+// "striped!"
+static const uint64_t kStripeMagic = 0x2164657069727473ull;
+
+void RadosStripeLayout::EncodeTo(char* dst) const {
+  EncodeFixed64(dst, kStripeMagic);
+  EncodeFixed32(dst + 8, stripe_count);
+  EncodeFixed64(dst + 12, stripe_unit);
+  EncodeFixed64(dst + 20, size);
+  EncodeFixed32(dst + 28, crc32c::Mask(crc32c::Value(dst, 28)));
+}
+
+bool RadosStripeLayout::DecodeFrom(const Slice& input) {
+  if (input.size() != kEncodedLength) return false;
+  const char* p = input.data();
+  if (DecodeFixed64(p) != kStripeMagic) return false;
+  if (crc32c::Unmask(DecodeFixed32(p + 28)) != crc32c::Value(p, 28)) {
+    return false;
+  }
+  stripe_count = DecodeFixed32(p + 8);
+  stripe_unit = DecodeFixed64(p + 12);
+  size = DecodeFixed64(p + 20);
+  return stripe_count != 0 && stripe_unit != 0;
+}
+
+uint32_t RadosStripeLayout::Locate(uint64_t off, uint64_t* stripe_off) const {
+  const uint64_t unit_no = off / stripe_unit;
+  *stripe_off = (unit_no / stripe_count) * stripe_unit + off % stripe_unit;
+  return static_cast<uint32_t>(unit_no % stripe_count);
+}
+
+std::string StripeName(const std::string& name, uint32_t i) {
+  char tmp[20];
+  snprintf(tmp, sizeof(tmp), ".%u", static_cast<unsigned>(i));
+  return name + tmp;
+}
+
+Status ReadStripeLayout(rados_ioctx_t ioctx, const char* name,
+                        uint64_t obj_size, RadosStripeLayout* layout,
+                        bool* striped) {
+  *striped = false;
+  if (obj_size != RadosStripeLayout::kEncodedLength) {
+    return Status::OK();
+  }
+  char buf[RadosStripeLayout::kEncodedLength];
+  int nbytes = rados_read(ioctx, name, buf, sizeof(buf), 0);
+  if (nbytes < 0) {
+    return RadosError("rados_read", nbytes);
+  } else {
+    *striped = layout->DecodeFrom(Slice(buf, nbytes));
+    return Status::OK();
+  }
+}
+
+RadosStripedWritableFile::RadosStripedWritableFile(
+    const Slice& fname, port::Mutex* mu, rados_ioctx_t ioctx,
+    const RadosStripeLayout& layout, int max_ops, RadosIoCtxCache* cache)
+    : mu_(mu),
+      layout_(layout),
+      rados_ioctx_(ioctx),
+      ioctx_cache_(cache),
+      max_ops_(max_ops > 0 ? max_ops : 1),
+      dirty_(false) {
+  async_op_ = new RadosOpCtx(mu_);
+  oid_ = fname.ToString();
+  layout_.size = 0;
+  for (uint32_t i = 0; i < layout_.stripe_count; i++) {
+    stripes_.push_back(StripeName(oid_, i));
+  }
+  // Truncate all stripes and install an empty manifest
+  for (size_t i = 0; i <= stripes_.size(); i++) {
+    if (Ref().ok()) {
+      rados_completion_t comp;
+      rados_aio_create_completion(async_op_, NULL, RadosOpCtx::IO_safe, &comp);
+      if (i < stripes_.size()) {
+        rados_aio_write_full(rados_ioctx_, stripes_[i].c_str(), comp, "", 0);
+      } else {
+        char buf[RadosStripeLayout::kEncodedLength];
+        layout_.EncodeTo(buf);
+        rados_aio_write_full(rados_ioctx_, oid_.c_str(), comp, buf,
+                             sizeof(buf));
+      }
+      rados_aio_release(comp);
+    }
+  }
+}
+
+RadosStripedWritableFile::~RadosStripedWritableFile() {
+  if (dirty_) {
+    Commit();
+  }
+  rados_aio_flush(rados_ioctx_);
+  mu_->Lock();
+  async_op_->Unref();
+  mu_->Unlock();
+  ReleaseIoCtx(rados_ioctx_, ioctx_cache_);
+}
+
+Status RadosStripedWritableFile::Ref() {
+  MutexLock ml(mu_);
+  // Block until there is room in the window
+  async_op_->WaitForOps(max_ops_ - 1);
+  if (!async_op_->ok()) {
+    return RadosError("rados_bg_io", async_op_->err());
+  } else {
+    async_op_->Ref();
+    return Status::OK();
+  }
+}
+
+Status RadosStripedWritableFile::Append(const Slice& data) {
+  Status s;
+  Slice input = data;
+  while (s.ok() && !input.empty()) {
+    uint64_t stripe_off;
+    const uint32_t i = layout_.Locate(layout_.size, &stripe_off);
+    const uint64_t room =
+        layout_.stripe_unit - layout_.size % layout_.stripe_unit;
+    const size_t n =
+        static_cast<size_t>(std::min<uint64_t>(room, input.size()));
+    s = Ref();
+    if (s.ok()) {
+      rados_completion_t comp;
+      rados_aio_create_completion(async_op_, NULL, RadosOpCtx::IO_safe, &comp);
+      rados_aio_write(rados_ioctx_, stripes_[i].c_str(), comp, input.data(), n,
+                      stripe_off);
+      rados_aio_release(comp);
+      layout_.size += n;
+      input.remove_prefix(n);
+      dirty_ = true;
+    }
+  }
+  return s;
+}
+
+// Wait for all outstanding writes and then publish the current size through
+// the manifest.
+Status RadosStripedWritableFile::Commit() {
+  rados_aio_flush(rados_ioctx_);
+  Status s = Flush();
+  if (s.ok()) {
+    char buf[RadosStripeLayout::kEncodedLength];
+    layout_.EncodeTo(buf);
+    int r = rados_write_full(rados_ioctx_, oid_.c_str(), buf, sizeof(buf));
+    if (r != 0) {
+      s = RadosError("rados_write_full", r);
+    } else {
+      dirty_ = false;
+    }
+  }
+  return s;
+}
+
+Status RadosStripedWritableFile::Close() {
+  if (dirty_) {
+    return Commit();
+  } else {
+    return Flush();
+  }
+}
+
+Status RadosStripedWritableFile::Flush() {
+  MutexLock ml(mu_);
+  if (!async_op_->ok()) {
+    return RadosError("rados_bg_io", async_op_->err());
+  } else {
+    return Status::OK();
+  }
+}
+
+Status RadosStripedWritableFile::Sync() { return Commit(); }
+
+RadosStripedFile::RadosStripedFile(const Slice& fname, rados_ioctx_t ioctx,
+                                   const RadosStripeLayout& layout, int max_ops)
+    : layout_(layout),
+      rados_ioctx_(ioctx),
+      max_ops_(max_ops > 0 ? max_ops : 1),
+      off_(0) {
+  const std::string oid = fname.ToString();
+  for (uint32_t i = 0; i < layout_.stripe_count; i++) {
+    stripes_.push_back(StripeName(oid, i));
+  }
+}
+
+RadosStripedFile::~RadosStripedFile() {}
+
+Status RadosStripedFile::Read(uint64_t off, size_t n, Slice* result,
+                              char* scratch) const {
+  *result = Slice();
+  if (off >= layout_.size) {
+    return Status::OK();
+  }
+  n = static_cast<size_t>(std::min<uint64_t>(n, layout_.size - off));
+  Status s;
+  std::vector<rados_completion_t> comps;
+  std::vector<size_t> lens;
+  size_t done = 0;
+  while (s.ok() && done < n) {
+    // Issue a window of piece reads
+    size_t issued = done;
+    while (issued < n && comps.size() < static_cast<size_t>(max_ops_)) {
+      uint64_t stripe_off;
+      const uint64_t pos = off + issued;
+      const uint32_t i = layout_.Locate(pos, &stripe_off);
+      const uint64_t room = layout_.stripe_unit - pos % layout_.stripe_unit;
+      const size_t len =
+          static_cast<size_t>(std::min<uint64_t>(room, n - issued));
+      rados_completion_t comp;
+      int r = rados_aio_create_completion(NULL, NULL, NULL, &comp);
+      if (r == 0) {
+        r = rados_aio_read(rados_ioctx_, stripes_[i].c_str(), comp,
+                           scratch + issued, len, stripe_off);
+        if (r != 0) {
+          rados_aio_release(comp);
+        }
+      }
+      if (r != 0) {
+        s = RadosError("rados_aio_read", r);
+        break;
+      }
+      comps.push_back(comp);
+      lens.push_back(len);
+      issued += len;
+    }
+    for (size_t j = 0; j < comps.size(); j++) {
+      rados_aio_wait_for_complete(comps[j]);
+      int nbytes = rados_aio_get_return_value(comps[j]);
+      rados_aio_release(comps[j]);
+      if (!s.ok()) {
+        continue;  // Drain the rest
+      } else if (nbytes < 0) {
+        s = RadosError("rados_aio_read", nbytes);
+      } else if (static_cast<size_t>(nbytes) != lens[j]) {
+        // Committed data should never be missing from its stripe
+        s = Status::Corruption("Short stripe read", stripes_[0]);
+      } else {
+        done += nbytes;
+      }
+    }
+    comps.clear();
+    lens.clear();
+  }
+  if (s.ok()) {
+    *result = Slice(scratch, done);
+  }
+  return s;
+}
+
+Status RadosStripedFile::Read(size_t n, Slice* result, char* scratch) {
+  Status s = Read(off_, n, result, scratch);
+  if (s.ok()) {
+    off_ += result->size();
+  }
+  return s;
+}
+
+Status RadosStripedFile::Skip(uint64_t n) {
+  off_ += n;
+  return Status::OK();
+}
+
+}  // namespace rados
+}  // namespace pdlfs
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "rados_comm.h"
+
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+namespace rados {
+
+// A striped object spreads its data round-robin across a set of stripe
+// objects named "<name>.<i>" in units of a fixed size. The object "<name>"
+// itself only stores a small, fixed-sized manifest describing the layout and
+// the logical size of the data. Manifests are recognized by their size, a
+// magic number, and a checksum so that striped objects and plain objects may
+// coexist in a single pool.
+struct RadosStripeLayout {
+  RadosStripeLayout() : stripe_count(1), stripe_unit(0), size(0) {}
+  uint32_t stripe_count;
+  uint64_t stripe_unit;
+  uint64_t size;  // Logical size of the striped object
+
+  enum { kEncodedLength = 32 };
+  void EncodeTo(char* dst) const;
+  bool DecodeFrom(const Slice& input);
+
+  // Return the index of the stripe holding the byte at the given logical
+  // offset and store its offset within that stripe in *stripe_off.
+  uint32_t Locate(uint64_t off, uint64_t* stripe_off) const;
+};
+
+// Return the name of the i-th stripe of a named object.
+extern std::string StripeName(const std::string& name, uint32_t i);
+
+// Load the layout of a named object given its physical size. Set *striped to
+// false if the object is a plain object.
+extern Status ReadStripeLayout(rados_ioctx_t ioctx, const char* name,
+                               uint64_t obj_size, RadosStripeLayout* layout,
+                               bool* striped);
+
+// A write-only striped object. Appends are cut at stripe unit boundaries and
+// the pieces are written to their stripe objects asynchronously, so writes to
+// different stripes proceed in parallel. The manifest is rewritten with the
+// latest size on each Sync(), on Close(), and on deletion if the file is
+// dirty.
+class RadosStripedWritableFile : public WritableFile {
+ public:
+  RadosStripedWritableFile(const Slice& fname, port::Mutex* mu,
+                           rados_ioctx_t ioctx, const RadosStripeLayout& layout,
+                           int max_ops, RadosIoCtxCache* cache = NULL);
+  virtual ~RadosStripedWritableFile();
+
+  virtual Status Append(const Slice& data);
+  virtual Status Close();
+  virtual Status Flush();
+  virtual Status Sync();
+
+ private:
+  Status Ref();
+  Status Commit();
+  // No copying allowed
+  void operator=(const RadosStripedWritableFile&);
+  RadosStripedWritableFile(const RadosStripedWritableFile&);
+
+  port::Mutex* mu_;
+  RadosOpCtx* async_op_;
+  std::string oid_;
+  std::vector<std::string> stripes_;
+  RadosStripeLayout layout_;
+  rados_ioctx_t rados_ioctx_;
+  RadosIoCtxCache* ioctx_cache_;  // Where the ioctx is returned
+  int max_ops_;                   // Max number of outstanding writes
+  bool dirty_;                    // If the manifest is behind
+};
+
+// Read-only access to a striped object. Each read is split at stripe unit
+// boundaries and the pieces are fetched in parallel through rados async I/O.
+class RadosStripedFile : public RandomAccessFile, public SequentialFile {
+ public:
+  RadosStripedFile(const Slice& fname, rados_ioctx_t ioctx,
+                   const RadosStripeLayout& layout, int max_ops);
+  virtual ~RadosStripedFile();
+
+  virtual Status Read(uint64_t off, size_t n, Slice* result,
+                      char* scratch) const;
+  virtual Status Read(size_t n, Slice* result, char* scratch);
+  virtual Status Skip(uint64_t n);
+
+ private:
+  // No copying allowed
+  void operator=(const RadosStripedFile&);
+  RadosStripedFile(const RadosStripedFile&);
+
+  std::vector<std::string> stripes_;
+  RadosStripeLayout layout_;
+  mutable rados_ioctx_t rados_ioctx_;
+  int max_ops_;  // Max number of outstanding reads
+  uint64_t off_;
+};
+
+}  // namespace rados
+}  // namespace pdlfs
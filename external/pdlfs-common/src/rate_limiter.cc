@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/rate_limiter.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <algorithm>
+#include <assert.h>
+
+namespace pdlfs {
+
+// Low priority writers are served first once every this many refills.
+static const uint64_t kFairness = 10;
+
+struct RateLimiter::Waiter {
+  Waiter(uint64_t n, port::Mutex* mu) : bytes(n), granted(false), cv(mu) {}
+  uint64_t bytes;
+  bool granted;
+  port::CondVar cv;
+};
+
+static uint64_t RefillBytes(uint64_t bytes_per_sec, uint64_t period_micros) {
+  const uint64_t b = bytes_per_sec * period_micros / 1000000;
+  return std::max<uint64_t>(b, 1);
+}
+
+RateLimiter::RateLimiter(uint64_t bytes_per_sec, uint64_t refill_period_micros)
+    : refill_period_micros_(std::max<uint64_t>(refill_period_micros, 1)),
+      bytes_per_sec_(bytes_per_sec),
+      refill_bytes_(RefillBytes(bytes_per_sec, refill_period_micros_)),
+      available_(refill_bytes_),
+      next_refill_(CurrentMicros() + refill_period_micros_),
+      num_refills_(0),
+      leader_(false) {
+  for (int i = 0; i < kNumPriorities; i++) {
+    total_bytes_[i] = 0;
+    total_requests_[i] = 0;
+    total_throttled_requests_[i] = 0;
+    total_throttled_micros_[i] = 0;
+  }
+}
+
+RateLimiter::~RateLimiter() {
+  MutexLock ml(&mu_);
+  assert(queues_[kLow].empty() && queues_[kHigh].empty());
+}
+
+void RateLimiter::SetBytesPerSecond(uint64_t bytes_per_sec) {
+  MutexLock ml(&mu_);
+  bytes_per_sec_ = bytes_per_sec;
+  refill_bytes_ = RefillBytes(bytes_per_sec, refill_period_micros_);
+}
+
+uint64_t RateLimiter::GetBytesPerSecond() const {
+  MutexLock ml(&mu_);
+  return bytes_per_sec_;
+}
+
+// Add bytes to the bucket and grant them to blocked writers in order.
+// REQUIRES: mu_ has been locked.
+void RateLimiter::Refill(uint64_t now) {
+  mu_.AssertHeld();
+  next_refill_ = now + refill_period_micros_;
+  available_ = std::min(available_ + refill_bytes_, refill_bytes_);
+  num_refills_++;
+  const bool low_first = num_refills_ % kFairness == 0;
+  for (int i = 0; i < kNumPriorities; i++) {
+    std::deque<Waiter*>* const q =
+        &queues_[(i == 0) != low_first ? kHigh : kLow];
+    while (!q->empty() && q->front()->bytes <= available_) {
+      Waiter* const r = q->front();
+      q->pop_front();
+      available_ -= r->bytes;
+      r->granted = true;
+      r->cv.Signal();
+    }
+    if (!q->empty()) {
+      break;  // Writers in the other queue must not pass this one
+    }
+  }
+}
+
+void RateLimiter::Request(size_t n, Priority pri) {
+  MutexLock ml(&mu_);
+  total_requests_[pri]++;
+  total_bytes_[pri] += n;
+  bool throttled = false;
+  while (n != 0) {
+    // A request never exceeds the bucket size so it can always be granted
+    // once the bucket is full
+    const uint64_t m = std::min<uint64_t>(n, refill_bytes_);
+    n -= static_cast<size_t>(m);
+    if (queues_[kLow].empty() && queues_[kHigh].empty() && available_ >= m) {
+      available_ -= m;
+      continue;
+    }
+    const uint64_t start = CurrentMicros();
+    Waiter r(m, &mu_);
+    queues_[pri].push_back(&r);
+    while (!r.granted) {
+      if (leader_) {
+        r.cv.Wait();
+        continue;
+      }
+      // Wait for the next refill on behalf of all blocked writers
+      leader_ = true;
+      uint64_t now = CurrentMicros();
+      if (now < next_refill_) {
+        r.cv.TimedWait(next_refill_ - now);
+        now = CurrentMicros();
+      }
+      if (now >= next_refill_) {
+        Refill(now);
+      }
+      leader_ = false;
+    }
+    // Let another blocked writer wait for the next refill
+    for (int i = kNumPriorities - 1; i >= 0; i--) {
+      if (!queues_[i].empty()) {
+        queues_[i].front()->cv.Signal();
+        break;
+      }
+    }
+    total_throttled_micros_[pri] += CurrentMicros() - start;
+    throttled = true;
+  }
+  if (throttled) {
+    total_throttled_requests_[pri]++;
+  }
+}
+
+uint64_t RateLimiter::TotalBytes(Priority pri) const {
+  MutexLock ml(&mu_);
+  return total_bytes_[pri];
+}
+
+uint64_t RateLimiter::TotalRequests(Priority pri) const {
+  MutexLock ml(&mu_);
+  return total_requests_[pri];
+}
+
+uint64_t RateLimiter::TotalThrottledRequests(Priority pri) const {
+  MutexLock ml(&mu_);
+  return total_throttled_requests_[pri];
+}
+
+uint64_t RateLimiter::TotalThrottledMicros(Priority pri) const {
+  MutexLock ml(&mu_);
+  return total_throttled_micros_[pri];
+}
+
+}  // namespace pdlfs
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/rate_limiter.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/testharness.h"
+
+namespace pdlfs {
+
+class RateLimiterTest {
+ public:
+  RateLimiterTest() : cv_(&mu_), num_running_(0) {}
+
+  struct WriterState {
+    RateLimiterTest* test;
+    RateLimiter* limiter;
+    RateLimiter::Priority pri;
+    uint64_t finish_micros;
+  };
+
+  // Write 64 pieces of 4KB each.
+  static void WriterBody(void* arg) {
+    WriterState* const state = reinterpret_cast<WriterState*>(arg);
+    for (int i = 0; i < 64; i++) {
+      state->limiter->Request(4 << 10, state->pri);
+    }
+    state->finish_micros = CurrentMicros();
+    RateLimiterTest* const t = state->test;
+    MutexLock ml(&t->mu_);
+    t->num_running_--;
+    t->cv_.SignalAll();
+  }
+
+  port::Mutex mu_;
+  port::CondVar cv_;
+  int num_running_;
+};
+
+TEST(RateLimiterTest, Rate) {
+  // 1MB/s with 10KB added every 10ms
+  RateLimiter limiter(1000 << 10, 10000);
+  const uint64_t start = CurrentMicros();
+  for (int i = 0; i < 50; i++) {
+    limiter.Request(4 << 10, RateLimiter::kHigh);
+  }
+  // 200KB minus an initial burst of 10KB
+  const uint64_t elapsed = CurrentMicros() - start;
+  ASSERT_GE(elapsed, 150000);
+  ASSERT_EQ(limiter.TotalBytes(RateLimiter::kHigh), 200 << 10);
+  ASSERT_EQ(limiter.TotalRequests(RateLimiter::kHigh), 50);
+  ASSERT_GT(limiter.TotalThrottledRequests(RateLimiter::kHigh), 0);
+  ASSERT_GT(limiter.TotalThrottledMicros(RateLimiter::kHigh), 0);
+  ASSERT_EQ(limiter.TotalBytes(RateLimiter::kLow), 0);
+}
+
+TEST(RateLimiterTest, LargeRequests) {
+  RateLimiter limiter(1000 << 10, 10000);
+  const uint64_t start = CurrentMicros();
+  // Served in pieces of at most 10KB
+  limiter.Request(100 << 10, RateLimiter::kLow);
+  ASSERT_GE(CurrentMicros() - start, 60000);
+  ASSERT_EQ(limiter.TotalRequests(RateLimiter::kLow), 1);
+  ASSERT_EQ(limiter.TotalThrottledRequests(RateLimiter::kLow), 1);
+}
+
+TEST(RateLimiterTest, Priorities) {
+  // Each refill adds just enough bytes for one write
+  RateLimiter limiter(400 << 10, 10000);
+  WriterState states[RateLimiter::kNumPriorities];
+  num_running_ = RateLimiter::kNumPriorities;
+  for (int i = 0; i < RateLimiter::kNumPriorities; i++) {
+    states[i].test = this;
+    states[i].limiter = &limiter;
+    states[i].pri = static_cast<RateLimiter::Priority>(i);
+    states[i].finish_micros = 0;
+    Env::Default()->StartThread(WriterBody, &states[i]);
+  }
+  {
+    MutexLock ml(&mu_);
+    while (num_running_ != 0) {
+      cv_.Wait();
+    }
+  }
+  ASSERT_LT(states[RateLimiter::kHigh].finish_micros,
+            states[RateLimiter::kLow].finish_micros);
+  ASSERT_LT(limiter.TotalThrottledMicros(RateLimiter::kHigh),
+            limiter.TotalThrottledMicros(RateLimiter::kLow));
+}
+
+}  // namespace pdlfs
+
+int main(int argc, char* argv[]) {
+  return pdlfs::test::RunAllTests(&argc, &argv);
+}
@@ -38,11 +38,18 @@ RPCOptions::RPCOptions()
       env(NULL),
       info_log(NULL),
       fs(NULL),
+      latency_hist(NULL),
       addr_cache_size(128),
+      bulk_threshold(3072),
+      num_contexts(1),
+      busy_poll(false),
       udp_max_unexpected_msgsz(1432),
       udp_max_expected_msgsz(1432),
       udp_srv_rcvbuf(-1),
-      udp_srv_sndbuf(-1) {}
+      udp_srv_sndbuf(-1),
+      udp_srv_batchsz(16),
+      udp_srv_reuseport(false),
+      tcp_cli_conns(4) {}
 
 int RPC::GetPort() { return -1; }
 
@@ -62,14 +69,16 @@ RPCServer::~RPCServer() {
   }
 }
 
-void RPCServer::AddChannel(const std::string& listening_uri, int workers) {
+void RPCServer::AddChannel(const std::string& listening_uri, int workers,
+                           ConcurrentHistogram* hist, rpc::If* fs) {
   RPCInfo info;
   RPCOptions options;
   options.env = env_;
   info.pool = ThreadPool::NewFixed(workers);
   options.extra_workers = info.pool;
-  options.fs = fs_;
+  options.fs = fs != NULL ? fs : fs_;
   options.uri = listening_uri;
+  options.latency_hist = hist;
   info.rpc = RPC::Open(options);
   rpcs_.push_back(info);
 }
@@ -10,6 +10,7 @@
  */
 #include "pdlfs-common/rpc.h"
 
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
 #include "pdlfs-common/testharness.h"
 
@@ -93,6 +94,124 @@ TEST(RPCTest, SendAndRecv) {
   delete extra_worker;
 }
 
+TEST(RPCTest, UDPReusePortAndBatching) {
+  const char* uri = "udp://127.0.0.1:22222";
+  for (int batchsz = 1; batchsz <= 16; batchsz *= 16) {
+    fprintf(stderr, "Batch size: %d\n", batchsz);
+    RPCOptions options;
+    options.num_rpc_threads = 4;
+    options.udp_srv_batchsz = batchsz;
+    options.udp_srv_reuseport = true;
+    options.uri = uri;
+    options.fs = this;
+    RPC* rpc = RPC::Open(options);
+    ASSERT_TRUE(rpc != NULL);
+    ASSERT_OK(rpc->Start());
+    SleepForMicroseconds(1000);
+    ASSERT_OK(rpc->status());
+    for (int i = 0; i < 8; i++) {  // Each client has a different source port
+      rpc::If* client = rpc->OpenStubFor(uri);
+      ASSERT_TRUE(client != NULL);
+      rpc::If::Message in, out;
+      char tmp[20];
+      snprintf(tmp, sizeof(tmp), "msg%d", i);
+      in.contents = Slice(tmp);
+      ASSERT_OK(client->Call(in, out));
+      ASSERT_TRUE(out.contents == in.contents);
+      delete client;
+    }
+    ASSERT_OK(rpc->Stop());
+    delete rpc;
+  }
+}
+
+TEST(RPCTest, LargeTCPMessage) {
+  const char* uri = "tcp://127.0.0.1:22222";
+  RPC* rpc = Open(uri);
+  ASSERT_TRUE(rpc != NULL);
+  ASSERT_OK(rpc->Start());
+  SleepForMicroseconds(1000);
+  ASSERT_OK(rpc->status());
+  rpc::If* client = rpc->OpenStubFor(uri);
+  ASSERT_TRUE(client != NULL);
+  std::string msg;
+  for (int i = 0; i < 100000; i++) {
+    msg.push_back(static_cast<char>('a' + i % 26));
+  }
+  for (int i = 0; i < 3; i++) {
+    rpc::If::Message in, out;
+    in.contents = msg;
+    ASSERT_OK(client->Call(in, out));
+    ASSERT_TRUE(out.contents == in.contents);
+  }
+  ASSERT_OK(rpc->Stop());
+  delete client;
+  delete rpc;
+}
+
+namespace {
+struct CallerState {
+  rpc::If* client;
+  port::Mutex mu;
+  port::CondVar cv;
+  int next_id;  // Protected by mu
+  int done;
+  int failures;
+  CallerState() : cv(&mu), next_id(0), done(0), failures(0) {}
+};
+
+void CallerBody(void* arg) {
+  CallerState* const state = reinterpret_cast<CallerState*>(arg);
+  state->mu.Lock();
+  const int me = state->next_id++;
+  state->mu.Unlock();
+  int failures = 0;
+  for (int i = 0; i < 200; i++) {
+    // Vary message sizes so that calls are in different stages at a time
+    std::string msg(1 + (me * 7919 + i * 104729) % 20000, 'a' + me);
+    char tmp[30];
+    snprintf(tmp, sizeof(tmp), "%d.%d", me, i);
+    msg.append(tmp);
+    rpc::If::Message in, out;
+    in.contents = msg;
+    Status s = state->client->Call(in, out);
+    if (!s.ok() || out.contents != in.contents) {
+      failures++;
+    }
+  }
+  MutexLock ml(&state->mu);
+  state->failures += failures;
+  state->done++;
+  state->cv.SignalAll();
+}
+}  // namespace
+
+TEST(RPCTest, ConcurrentTCPCalls) {
+  const char* uri = "tcp://127.0.0.1:22222";
+  RPC* rpc = Open(uri, 2);
+  ASSERT_TRUE(rpc != NULL);
+  ASSERT_OK(rpc->Start());
+  SleepForMicroseconds(1000);
+  ASSERT_OK(rpc->status());
+  CallerState state;
+  state.client = rpc->OpenStubFor(uri);
+  ASSERT_TRUE(state.client != NULL);
+  const int kThreads = 8;  // More than the number of connections per stub
+  for (int i = 0; i < kThreads; i++) {
+    Env::Default()->StartThread(CallerBody, &state);
+  }
+  {
+    MutexLock ml(&state.mu);
+    while (state.done < kThreads) {
+      state.cv.Wait();
+    }
+  }
+  ASSERT_EQ(state.failures, 0);
+  ASSERT_OK(rpc->Stop());
+  delete state.client;
+  delete rpc;
+}
+
 namespace {
 int GetOptionFromEnv(const char* key, int def) {
   const char* env = getenv(key);
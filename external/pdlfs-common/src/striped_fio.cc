@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "striped_fio.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+namespace pdlfs {
+
+// An open file. Holds one handle per backend.
+struct StripedFio::File : public Fio::Handle {
+  std::vector<Handle*> fhs;
+  port::Mutex mu;
+  uint64_t off;  // Current read/write position, protected by mu
+};
+
+// A part of a request that falls within a single stripe unit.
+struct StripedFio::Piece {
+  uint64_t off;     // Offset at the backend
+  uint64_t n;       // Number of bytes
+  uint64_t buf_off;  // Offset in the caller's buffer
+};
+
+struct StripedFio::IoContext {
+  IoContext() : cv(&mu), num_running(0) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  // State below is protected by mu
+  int num_running;
+};
+
+// All pieces of a request falling at a single backend.
+struct StripedFio::BackendIo {
+  Fio* fio;
+  const Fentry* fentry;
+  Handle* fh;
+  bool is_write;
+  char* buf;
+  std::vector<Piece> pieces;
+  uint64_t end;  // End of the data read, relative to buf
+  Status status;
+  IoContext* ctx;
+};
+
+StripedFio::StripedFio(const std::vector<Fio*>& backends, uint64_t stripe_size,
+                       ThreadPool* pool, bool owns_pool)
+    : backends_(backends),
+      stripe_size_(stripe_size),
+      pool_(pool),
+      owns_pool_(owns_pool) {
+  assert(!backends_.empty());
+  assert(stripe_size_ != 0);
+}
+
+StripedFio::~StripedFio() {
+  if (owns_pool_) {
+    delete pool_;
+  }
+  for (size_t i = 0; i < backends_.size(); i++) {
+    delete backends_[i];
+  }
+}
+
+uint64_t StripedFio::LogicalSize(size_t b, uint64_t local) const {
+  if (local == 0) {
+    return 0;
+  }
+  const uint64_t last = local - 1;
+  const uint64_t unit = (last / stripe_size_) * backends_.size() + b;
+  return unit * stripe_size_ + last % stripe_size_ + 1;
+}
+
+uint64_t StripedFio::LocalSize(size_t b, uint64_t size) const {
+  const uint64_t row = stripe_size_ * backends_.size();
+  uint64_t local = (size / row) * stripe_size_;
+  const uint64_t rem = size % row;
+  const uint64_t begin = b * stripe_size_;
+  if (rem > begin) {
+    local += std::min(rem - begin, stripe_size_);
+  }
+  return local;
+}
+
+Status StripedFio::RunBackendIo(BackendIo* io) {
+  Status s;
+  io->end = 0;
+  for (size_t i = 0; s.ok() && i < io->pieces.size(); i++) {
+    const Piece& piece = io->pieces[i];
+    char* const dst = io->buf + piece.buf_off;
+    if (io->is_write) {
+      s = io->fio->Pwrite(*io->fentry, io->fh, Slice(dst, piece.n), piece.off);
+    } else {
+      Slice r;
+      s = io->fio->Pread(*io->fentry, io->fh, &r, piece.off, piece.n, dst);
+      if (s.ok()) {
+        if (r.data() != dst) {
+          memmove(dst, r.data(), r.size());
+        }
+        // Short reads are either holes or the end of the file
+        if (r.size() < piece.n) {
+          memset(dst + r.size(), 0, piece.n - r.size());
+        }
+        if (r.size() != 0) {
+          io->end = std::max(io->end, piece.buf_off + r.size());
+        }
+      }
+    }
+  }
+  return s;
+}
+
+void StripedFio::BGBackendIo(void* arg) {
+  BackendIo* const io = reinterpret_cast<BackendIo*>(arg);
+  io->status = RunBackendIo(io);
+  IoContext* const ctx = io->ctx;
+  ctx->mu.Lock();
+  ctx->num_running--;
+  ctx->cv.SignalAll();
+  ctx->mu.Unlock();
+}
+
+// Read or write [off, off + size) by splitting it into stripe units and
+// accessing the backends of the units in parallel. For reads, *nread is
+// set to the end of the last byte read relative to off.
+Status StripedFio::DoIo(const Fentry& fentry, File* file, bool is_write,
+                        uint64_t off, uint64_t size, char* buf,
+                        uint64_t* nread) {
+  const size_t n = backends_.size();
+  std::vector<BackendIo> ios(n);
+  for (size_t b = 0; b < n; b++) {
+    BackendIo* const io = &ios[b];
+    io->fio = backends_[b];
+    io->fentry = &fentry;
+    io->fh = file->fhs[b];
+    io->is_write = is_write;
+    io->buf = buf;
+    io->end = 0;
+    io->ctx = NULL;
+  }
+  const uint64_t end = off + size;
+  for (uint64_t p = off; p < end;) {
+    const uint64_t unit = p / stripe_size_;
+    const uint64_t unit_end = std::min(end, (unit + 1) * stripe_size_);
+    Piece piece;
+    piece.off = (unit / n) * stripe_size_ + p % stripe_size_;
+    piece.n = unit_end - p;
+    piece.buf_off = p - off;
+    ios[unit % n].pieces.push_back(piece);
+    p = unit_end;
+  }
+
+  std::vector<BackendIo*> busy;
+  for (size_t b = 0; b < n; b++) {
+    if (!ios[b].pieces.empty()) {
+      busy.push_back(&ios[b]);
+    }
+  }
+  if (pool_ == NULL || busy.size() < 2) {
+    for (size_t i = 0; i < busy.size(); i++) {
+      busy[i]->status = RunBackendIo(busy[i]);
+    }
+  } else {
+    IoContext ctx;
+    ctx.mu.Lock();
+    ctx.num_running = static_cast<int>(busy.size() - 1);
+    ctx.mu.Unlock();
+    for (size_t i = 1; i < busy.size(); i++) {
+      busy[i]->ctx = &ctx;
+      pool_->Schedule(BGBackendIo, busy[i]);
+    }
+    busy[0]->status = RunBackendIo(busy[0]);
+    ctx.mu.Lock();
+    while (ctx.num_running > 0) {
+      ctx.cv.Wait();
+    }
+    ctx.mu.Unlock();
+  }
+
+  uint64_t max_end = 0;
+  for (size_t i = 0; i < busy.size(); i++) {
+    if (!busy[i]->status.ok()) {
+      return busy[i]->status;
+    }
+    max_end = std::max(max_end, busy[i]->end);
+  }
+  if (nread != NULL) {
+    *nread = max_end;
+  }
+  return Status::OK();
+}
+
+Status StripedFio::Creat(const Fentry& fentry, bool append_only, Handle** fh) {
+  Status s;
+  File* const file = new File;
+  file->off = 0;
+  for (size_t b = 0; s.ok() && b < backends_.size(); b++) {
+    Handle* h;
+    // Backends are written at explicit offsets, so they are never opened
+    // for appending
+    s = backends_[b]->Creat(fentry, false, &h);
+    if (s.ok()) {
+      file->fhs.push_back(h);
+    }
+  }
+  if (s.ok()) {
+    *fh = file;
+  } else {
+    for (size_t b = 0; b < file->fhs.size(); b++) {
+      backends_[b]->Close(fentry, file->fhs[b]);
+    }
+    delete file;
+  }
+  return s;
+}
+
+Status StripedFio::Open(const Fentry& fentry, bool create_if_missing,
+                        bool truncate_if_exists, bool append_only,
+                        uint64_t* mtime, uint64_t* size, Handle** fh) {
+  Status s;
+  File* const file = new File;
+  *mtime = 0;
+  *size = 0;
+  for (size_t b = 0; s.ok() && b < backends_.size(); b++) {
+    Handle* h;
+    uint64_t m;
+    uint64_t local;
+    s = backends_[b]->Open(fentry, create_if_missing, truncate_if_exists,
+                           false, &m, &local, &h);
+    if (s.ok()) {
+      file->fhs.push_back(h);
+      *mtime = std::max(*mtime, m);
+      *size = std::max(*size, LogicalSize(b, local));
+    }
+  }
+  if (s.ok()) {
+    file->off = append_only ? *size : 0;
+    *fh = file;
+  } else {
+    for (size_t b = 0; b < file->fhs.size(); b++) {
+      backends_[b]->Close(fentry, file->fhs[b]);
+    }
+    delete file;
+  }
+  return s;
+}
+
+Status StripedFio::Fstat(const Fentry& fentry, Handle* fh, uint64_t* mtime,
+                         uint64_t* size, bool skip_cache) {
+  Status s;
+  File* const file = static_cast<File*>(fh);
+  *mtime = 0;
+  *size = 0;
+  for (size_t b = 0; s.ok() && b < backends_.size(); b++) {
+    uint64_t m;
+    uint64_t local;
+    s = backends_[b]->Fstat(fentry, file->fhs[b], &m, &local, skip_cache);
+    if (s.ok()) {
+      *mtime = std::max(*mtime, m);
+      *size = std::max(*size, LogicalSize(b, local));
+    }
+  }
+  return s;
+}
+
+Status StripedFio::Write(const Fentry& fentry, Handle* fh, const Slice& data) {
+  File* const file = static_cast<File*>(fh);
+  file->mu.Lock();
+  const uint64_t off = file->off;
+  file->off += data.size();
+  file->mu.Unlock();
+  return DoIo(fentry, file, true, off, data.size(),
+              const_cast<char*>(data.data()), NULL);
+}
+
+Status StripedFio::Pwrite(const Fentry& fentry, Handle* fh, const Slice& data,
+                          uint64_t off) {
+  File* const file = static_cast<File*>(fh);
+  return DoIo(fentry, file, true, off, data.size(),
+              const_cast<char*>(data.data()), NULL);
+}
+
+Status StripedFio::Read(const Fentry& fentry, Handle* fh, Slice* result,
+                        uint64_t size, char* scratch) {
+  File* const file = static_cast<File*>(fh);
+  file->mu.Lock();
+  const uint64_t off = file->off;
+  file->mu.Unlock();
+  Status s = Pread(fentry, fh, result, off, size, scratch);
+  if (s.ok()) {
+    file->mu.Lock();
+    file->off = off + result->size();
+    file->mu.Unlock();
+  }
+  return s;
+}
+
+Status StripedFio::Pread(const Fentry& fentry, Handle* fh, Slice* result,
+                         uint64_t off, uint64_t size, char* scratch) {
+  File* const file = static_cast<File*>(fh);
+  *result = Slice();
+  uint64_t n;
+  Status s = DoIo(fentry, file, false, off, size, scratch, &n);
+  if (s.ok()) {
+    *result = Slice(scratch, n);
+  }
+  return s;
+}
+
+Status StripedFio::Ftrunc(const Fentry& fentry, Handle* fh, uint64_t size) {
+  Status s;
+  File* const file = static_cast<File*>(fh);
+  for (size_t b = 0; s.ok() && b < backends_.size(); b++) {
+    s = backends_[b]->Ftrunc(fentry, file->fhs[b], LocalSize(b, size));
+  }
+  return s;
+}
+
+Status StripedFio::Flush(const Fentry& fentry, Handle* fh, bool force_sync) {
+  Status s;
+  File* const file = static_cast<File*>(fh);
+  for (size_t b = 0; s.ok() && b < backends_.size(); b++) {
+    s = backends_[b]->Flush(fentry, file->fhs[b], force_sync);
+  }
+  return s;
+}
+
+Status StripedFio::Close(const Fentry& fentry, Handle* fh) {
+  Status s;
+  File* const file = static_cast<File*>(fh);
+  for (size_t b = 0; b < backends_.size(); b++) {
+    Status c = backends_[b]->Close(fentry, file->fhs[b]);
+    if (s.ok()) {
+      s = c;
+    }
+  }
+  delete file;
+  return s;
+}
+
+Status StripedFio::Trunc(const Fentry& fentry, uint64_t size) {
+  Status s;
+  for (size_t b = 0; s.ok() && b < backends_.size(); b++) {
+    s = backends_[b]->Trunc(fentry, LocalSize(b, size));
+  }
+  return s;
+}
+
+Status StripedFio::Stat(const Fentry& fentry, uint64_t* mtime,
+                        uint64_t* size) {
+  Status s;
+  *mtime = 0;
+  *size = 0;
+  for (size_t b = 0; s.ok() && b < backends_.size(); b++) {
+    uint64_t m;
+    uint64_t local;
+    s = backends_[b]->Stat(fentry, &m, &local);
+    if (s.ok()) {
+      *mtime = std::max(*mtime, m);
+      *size = std::max(*size, LogicalSize(b, local));
+    }
+  }
+  return s;
+}
+
+Status StripedFio::Drop(const Fentry& fentry) {
+  Status s;
+  for (size_t b = 0; b < backends_.size(); b++) {
+    Status d = backends_[b]->Drop(fentry);
+    if (s.ok()) {
+      s = d;
+    }
+  }
+  return s;
+}
+
+}  // namespace pdlfs
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/fio.h"
+#include "pdlfs-common/port.h"
+
+#include <vector>
+
+namespace pdlfs {
+
+// Stripes file data across a set of Fio backends. Each file is cut into
+// stripe_size units assigned to backends in a round-robin fashion by
+// offset: unit i is kept by backend i % n at offset (i / n) * stripe_size.
+// Reads and writes touching more than one backend are issued to the
+// backends in parallel using the io pool, if one is given.
+//
+// Backends are always written at explicit offsets, so appends through a
+// handle opened as append_only go to the end of the file as seen when the
+// handle was opened. Concurrent appenders are not supported.
+class StripedFio : public Fio {
+ public:
+  // Takes ownership of the backends. The pool is owned if "owns_pool" is
+  // set. The pool may be NULL, in which case backends are accessed one
+  // after another by the caller's thread.
+  StripedFio(const std::vector<Fio*>& backends, uint64_t stripe_size,
+             ThreadPool* pool, bool owns_pool);
+  virtual ~StripedFio();
+
+  virtual Status Creat(const Fentry& fentry, bool append_only, Handle** fh);
+  virtual Status Open(const Fentry& fentry, bool create_if_missing,
+                      bool truncate_if_exists, bool append_only,
+                      uint64_t* mtime, uint64_t* size, Handle** fh);
+  virtual Status Fstat(const Fentry& fentry, Handle* fh, uint64_t* mtime,
+                       uint64_t* size, bool skip_cache = false);
+  virtual Status Write(const Fentry& fentry, Handle* fh, const Slice& data);
+  virtual Status Pwrite(const Fentry& fentry, Handle* fh, const Slice& data,
+                        uint64_t off);
+  virtual Status Read(const Fentry& fentry, Handle* fh, Slice* result,
+                      uint64_t size, char* scratch);
+  virtual Status Pread(const Fentry& fentry, Handle* fh, Slice* result,
+                       uint64_t off, uint64_t size, char* scratch);
+  virtual Status Ftrunc(const Fentry& fentry, Handle* fh, uint64_t size);
+  virtual Status Flush(const Fentry& fentry, Handle* fh,
+                       bool force_sync = false);
+  virtual Status Close(const Fentry& fentry, Handle* fh);
+
+  virtual Status Trunc(const Fentry& fentry, uint64_t size);
+  virtual Status Stat(const Fentry& fentry, uint64_t* mtime, uint64_t* size);
+  virtual Status Drop(const Fentry& fentry);
+
+  // Size of a file whose backend "b" keeps "local" bytes of it.
+  uint64_t LogicalSize(size_t b, uint64_t local) const;
+  // Number of bytes backend "b" keeps of a file "size" bytes long.
+  uint64_t LocalSize(size_t b, uint64_t size) const;
+
+ private:
+  struct File;
+  struct Piece;
+  struct IoContext;
+  struct BackendIo;
+  Status DoIo(const Fentry& fentry, File* file, bool is_write, uint64_t off,
+              uint64_t size, char* buf, uint64_t* nread);
+  static Status RunBackendIo(BackendIo* io);
+  static void BGBackendIo(void* arg);
+
+  // No copying allowed
+  void operator=(const StripedFio&);
+  StripedFio(const StripedFio&);
+
+  // Constant after construction
+  std::vector<Fio*> backends_;
+  const uint64_t stripe_size_;
+  ThreadPool* const pool_;
+  const bool owns_pool_;
+};
+
+}  // namespace pdlfs
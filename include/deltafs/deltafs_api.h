@@ -13,6 +13,7 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <stddef.h>
 #include <stdint.h>
@@ -47,6 +48,14 @@ int deltafs_openstat(const char* __path, int __oflags, mode_t, struct stat*);
 int deltafs_openat(int fd, const char* __path, int __oflags, mode_t __mode);
 int deltafs_getattr(const char* __path, struct stat* __stbuf);
 int deltafs_mkfile(const char* __path, mode_t __mode);
+/*
+ * Create a batch of files under a single directory in as few metadata rpcs as
+ * possible. Return 0 if all files are created, or -1 on errors, in which case
+ * errno is set to that of the first failed name. If __errs is not NULL, it is
+ * set to the errno of each name, or 0 for those created.
+ */
+int deltafs_mkfile_batch(const char* __dir, const char** __names, size_t __n,
+                         mode_t __mode, int* __errs);
 int deltafs_mkdirs(const char* __path, mode_t __mode);
 int deltafs_mkdir(const char* __path, mode_t __mode);
 int deltafs_chmod(const char* __path, mode_t __mode);
@@ -58,6 +67,13 @@ int deltafs_accessdir(const char* __path, int __mode);
 int deltafs_unlink(const char* __path);
 typedef int (*deltafs_filler_t)(const char* __name, void* __arg);
 int deltafs_listdir(const char* __path, deltafs_filler_t, void* __arg);
+/*
+ * Same as deltafs_listdir() but also returns the attributes of each entry,
+ * avoiding a separate deltafs_stat() call per entry.
+ */
+typedef int (*deltafs_statfiller_t)(const char* __name,
+                                    const struct stat* __stbuf, void* __arg);
+int deltafs_listdirplus(const char* __path, deltafs_statfiller_t, void* __arg);
 ssize_t deltafs_pread(int __fd, void* __buf, size_t __sz, off_t __off);
 ssize_t deltafs_read(int __fd, void* __buf, size_t __sz);
 ssize_t deltafs_pwrite(int __fd, const void* __buf, size_t __sz, off_t __off);
@@ -79,6 +95,20 @@ typedef struct deltafs_env deltafs_env_t;
    The returned object should be deleted via deltafs_env_close(). */
 deltafs_env_t* deltafs_env_init(int __argc, void** __argv);
 int deltafs_env_is_system(deltafs_env_t* __env);
+/* Limit the total write rate of all plfsdirs set to use the env, including
+   the compactions of plfsdirs opened as leveldb, to __bytes_per_sec. Writes
+   of plfsdir logs and memtable flushes are served before compaction writes.
+   The limit may be changed at any time by calling this again.
+   Returns 0 on success, or -1 on errors. */
+int deltafs_env_set_rate_limit(deltafs_env_t* __env,
+                               long long __bytes_per_sec);
+/* Share a single memtable budget of __bytes among all plfsdirs set to use the
+   env and opened for writing, replacing their own memtable budgets. The
+   budget is divided according to how fast each plfsdir is written, so busy
+   plfsdirs get more memory than idle ones. Must be set before any plfsdir is
+   set to use the env, and may only be set once.
+   Returns 0 on success, or -1 on errors. */
+int deltafs_env_set_memory_budget(deltafs_env_t* __env, long long __bytes);
 int deltafs_env_close(deltafs_env_t* __env);
 
 /*
@@ -91,12 +121,36 @@ typedef struct deltafs_tp deltafs_tp_t;
 /* Returns NULL on errors. A heap-allocated thread pool instance otherwise.
    The returned object should be deleted via deltafs_tp_close(). */
 deltafs_tp_t* deltafs_tp_init(int __size);
+/* Same as deltafs_tp_init(), but with all threads pinned to the cpus of NUMA
+   node __node. Returns NULL if the node cannot be found or pinning is not
+   supported on this platform. */
+deltafs_tp_t* deltafs_tp_init_on_node(int __size, int __node);
+/* Same as deltafs_tp_init(), but each thread owns a private task queue and
+   idle threads steal work from busy ones. Latency-sensitive reads are run
+   ahead of compaction work, so a single pool may serve as both the reader
+   and the compaction pool of a directory. */
+deltafs_tp_t* deltafs_tp_init_ws(int __size);
+/* Returns the number of tasks waiting to run, or -1 on errors */
+long long deltafs_tp_queue_depth(deltafs_tp_t* __tp);
 /* Pause executing queued tasks or tasks submitted in future */
 int deltafs_tp_pause(deltafs_tp_t* __tp);
 /* Resume executing tasks */
 int deltafs_tp_rerun(deltafs_tp_t* __tp);
 int deltafs_tp_close(deltafs_tp_t* __tp);
 
+/*
+ * Index cache
+ * -----------
+ */
+struct deltafs_cache; /* Opaque handle for a deltafs index cache */
+typedef struct deltafs_cache deltafs_cache_t;
+/* Returns NULL on errors. A heap-allocated cache instance holding up to
+   __size bytes of index and filter blocks otherwise. A single cache may be
+   shared by all plfsdir readers of a process. The returned object should be
+   deleted via deltafs_cache_close() after all readers using it are freed. */
+deltafs_cache_t* deltafs_cache_init(size_t __size);
+int deltafs_cache_close(deltafs_cache_t* __cache);
+
 /*
  * ------------------------
  * Light-weight plfsdir api
@@ -127,12 +181,30 @@ int deltafs_plfsdir_set_env(deltafs_plfsdir_t* __dir, deltafs_env_t* __env);
 /* Set background thread pool. */
 int deltafs_plfsdir_set_thread_pool(deltafs_plfsdir_t* __dir,
                                     deltafs_tp_t* __tp);
+/* Set one compaction thread pool per NUMA node. Memtable partition k is then
+   compacted by __tps[k % __n], and its write buffers are placed on the node
+   of that pool. Pools should come from deltafs_tp_init_on_node(). */
+int deltafs_plfsdir_set_numa_thread_pools(deltafs_plfsdir_t* __dir,
+                                          deltafs_tp_t** __tps, int __n);
+/* Set index cache. Index and filter blocks are then read on demand and
+   kept in the cache instead of being loaded into memory in their entirety. */
+int deltafs_plfsdir_set_index_cache(deltafs_plfsdir_t* __dir,
+                                    deltafs_cache_t* __cache);
 int deltafs_plfsdir_set_rank(deltafs_plfsdir_t* __dir, int __rank);
 int deltafs_plfsdir_force_leveldb_fmt(deltafs_plfsdir_t* __dir, int __flag);
 int deltafs_plfsdir_enable_io_measurement(deltafs_plfsdir_t* __dir, int __flag);
 int deltafs_plfsdir_set_fixed_kv(deltafs_plfsdir_t* __dir, int __flag);
 int deltafs_plfsdir_set_side_io_buf_size(deltafs_plfsdir_t* __dir, size_t __sz);
 int deltafs_plfsdir_set_side_filter_size(deltafs_plfsdir_t* __dir, size_t __sz);
+/* Record the duration of each write pipeline stage, keeping up to
+   __max_spans of the most recent spans. Must be called before open. */
+int deltafs_plfsdir_enable_tracing(deltafs_plfsdir_t* __dir, int __max_spans);
+/* Collect cpu counters (cycles, instructions, last level cache misses, and
+   branch misses) of each compaction and read stage. Counters are exported
+   as "plfsdir.perf.<stage>.<counter>" metrics. Hardware counters are only
+   collected on Linux when perf events are permitted. Must be called before
+   open. */
+int deltafs_plfsdir_enable_perf_counters(deltafs_plfsdir_t* __dir);
 /* Error printer type */
 typedef void (*deltafs_printer_t)(const char* __err, void* __arg);
 int deltafs_plfsdir_set_err_printer(deltafs_plfsdir_t* __dir,
@@ -142,6 +214,18 @@ int deltafs_plfsdir_set_err_printer(deltafs_plfsdir_t* __dir,
 int deltafs_plfsdir_get_memparts(deltafs_plfsdir_t* __dir);
 int deltafs_plfsdir_destroy(deltafs_plfsdir_t* __dir, const char* __name);
 int deltafs_plfsdir_open(deltafs_plfsdir_t* __dir, const char* __name);
+/* Open a set of __n plfsdirs for reading as a single dir, where __names[i]
+   has been written by rank __ranks[i]. Keys are routed to the dirs that may
+   store them using their filters, and these dirs are read in parallel using
+   the handle's thread pool. Only a bounded number of dirs (the
+   "max_open_dirs" conf) are kept open at a time. Only supported by the
+   default storage engine in O_RDONLY mode. Once opened, the handle can only
+   be used by deltafs_plfsdir_get(), which then appends the values found in
+   all dirs in dir order and does not report __table_seeks or __seeks.
+   Return 0 on success, or -1 on errors. */
+int deltafs_plfsdir_open_multi(deltafs_plfsdir_t* __dir,
+                               const char* const* __names, const int* __ranks,
+                               int __n);
 int deltafs_plfsdir_filter_open(deltafs_plfsdir_t* __dir, const char* __name);
 int deltafs_plfsdir_filter_put(deltafs_plfsdir_t* __dir, const char* __key,
                                size_t __keylen, int __rank);
@@ -150,6 +234,10 @@ int deltafs_plfsdir_filter_finish(deltafs_plfsdir_t* __dir);
 int deltafs_plfsdir_io_open(deltafs_plfsdir_t* __dir, const char* __name);
 ssize_t deltafs_plfsdir_io_append(deltafs_plfsdir_t* __dir, const void* __buf,
                                   size_t __sz);
+/* Append __iovcnt buffers as a single piece of data. Large writes bypass the
+   side io write buffer. Return -1 on errors, or num bytes written. */
+ssize_t deltafs_plfsdir_io_appendv(deltafs_plfsdir_t* __dir,
+                                   const struct iovec* __iov, int __iovcnt);
 int deltafs_plfsdir_io_flush(deltafs_plfsdir_t* __dir);
 int deltafs_plfsdir_io_wait(deltafs_plfsdir_t* __dir);
 int deltafs_plfsdir_io_sync(deltafs_plfsdir_t* __dir);
@@ -159,6 +247,30 @@ int deltafs_plfsdir_io_finish(deltafs_plfsdir_t* __dir);
 ssize_t deltafs_plfsdir_put(deltafs_plfsdir_t* __dir, const char* __key,
                             size_t __keylen, int __epoch, const char* __value,
                             size_t __sz);
+/* Put __n pieces of data into their corresponding keys, all at the same
+   epoch. Key i is __keys[i] with length __keylens[i], and its data is
+   __values[i] with size __sizes[i]. Cheaper than calling
+   deltafs_plfsdir_put() repeatedly. Stops at the first error.
+   Return -1 on errors, or total num bytes written. */
+ssize_t deltafs_plfsdir_put_batch(deltafs_plfsdir_t* __dir,
+                                  const char* const* __keys,
+                                  const size_t* __keylens, int __epoch,
+                                  const char* const* __values,
+                                  const size_t* __sizes, size_t __n);
+/* Put __n fixed-sized key-value pairs packed in __buf into the directory,
+   all at the same epoch. Each pair consists of a __keylen-byte key
+   immediately followed by a __valuelen-byte value.
+   Return -1 on errors, or total num bytes written. */
+ssize_t deltafs_plfsdir_put_packed(deltafs_plfsdir_t* __dir, const char* __buf,
+                                   size_t __keylen, size_t __valuelen,
+                                   int __epoch, size_t __n);
+/* Put a piece of data into a 64-bit integer key, such as a particle id.
+   The key is stored as 8 big-endian bytes so keys are ordered as integers.
+   Combined with fixed_kv_length and key_size=8, keys are sorted by their
+   integer values alone and packed into array blocks.
+   Return -1 on errors, or num bytes written. */
+ssize_t deltafs_plfsdir_put_u64(deltafs_plfsdir_t* __dir, uint64_t __key,
+                                int __epoch, const char* __value, size_t __sz);
 /* Appends a piece of data into a given file.
    __fname will be hashed to become a fixed-sized key.
    Return -1 on errors, or num bytes written. */
@@ -171,6 +283,40 @@ ssize_t deltafs_plfsdir_append(deltafs_plfsdir_t* __dir, const char* __fname,
 char* deltafs_plfsdir_get(deltafs_plfsdir_t* __dir, const char* __key,
                           size_t __keylen, int __epoch, size_t* __sz,
                           size_t* __table_seeks, size_t* __seeks);
+/* Same as deltafs_plfsdir_get(), but for a key written by
+   deltafs_plfsdir_put_u64(). */
+char* deltafs_plfsdir_get_u64(deltafs_plfsdir_t* __dir, uint64_t __key,
+                              int __epoch, size_t* __sz,
+                              size_t* __table_seeks, size_t* __seeks);
+/* Per-query cost breakdown reported by deltafs_plfsdir_get_with_stats(). */
+typedef struct deltafs_plfsdir_read_stats {
+  size_t table_seeks;              /* Num tables touched */
+  size_t seeks;                    /* Num data blocks fetched */
+  uint64_t bytes_read;             /* Data block bytes fetched from storage */
+  uint64_t filter_probes;          /* Num filter probes */
+  uint64_t filter_false_positives; /* Num probes passed for absent keys */
+  uint64_t cache_hits;             /* Num data blocks served by cache */
+  uint64_t cache_misses;           /* Num data blocks missed by cache */
+  uint64_t io_micros;              /* Time spent fetching data blocks */
+  uint64_t decode_micros;          /* Time spent searching data blocks */
+  uint64_t epochs_skipped;         /* Num epochs pruned without any seeks */
+} deltafs_plfsdir_read_stats_t;
+/* Same as deltafs_plfsdir_get(), but also reports the cost breakdown of
+   the query in *__stats if __stats is not NULL. Only supported by the
+   default storage engine. */
+char* deltafs_plfsdir_get_with_stats(deltafs_plfsdir_t* __dir,
+                                     const char* __key, size_t __keylen,
+                                     int __epoch, size_t* __sz,
+                                     deltafs_plfsdir_read_stats_t* __stats);
+/* Retrieve data from a set of __n keys at a specific epoch, or all
+   epochs if __epoch is -1. For each key, stores a malloc()ed array in
+   __values[i] and its size in __sizes[i], or NULL and 0 if no such key is
+   found. Each result should be deleted by free(). Return -1 on errors,
+   or 0 on success. */
+int deltafs_plfsdir_multiget(deltafs_plfsdir_t* __dir, const char** __keys,
+                             const size_t* __keylens, size_t __n, int __epoch,
+                             char** __values, size_t* __sizes,
+                             size_t* __table_seeks, size_t* __seeks);
 /* Retrieve data from a given filename at a specific epoch, or all
    epochs if __epoch is -1. Returns NULL if no such file is found.
    A malloc()ed array otherwise. Stores the length of the array in *__sz.
@@ -178,6 +324,33 @@ char* deltafs_plfsdir_get(deltafs_plfsdir_t* __dir, const char* __key,
 void* deltafs_plfsdir_read(deltafs_plfsdir_t* __dir, const char* __fname,
                            int __epoch, size_t* __sz, size_t* __table_seeks,
                            size_t* __seeks);
+/* Same as deltafs_plfsdir_get(), but copies the value into the caller-supplied
+   __buf of __bufsz bytes instead of a malloc()ed array. Return -1 on errors.
+   Otherwise, return the full size of the value, which is 0 if no such key is
+   found. If the size exceeds __bufsz, only the first __bufsz bytes are stored
+   and the caller may retry with a buffer of the returned size. __buf may be
+   NULL if __bufsz is 0 to probe the size alone. */
+ssize_t deltafs_plfsdir_get_into(deltafs_plfsdir_t* __dir, const char* __key,
+                                 size_t __keylen, int __epoch, void* __buf,
+                                 size_t __bufsz, size_t* __table_seeks,
+                                 size_t* __seeks);
+/* Same as deltafs_plfsdir_read(), but copies the data into a caller-supplied
+   buffer following the protocol of deltafs_plfsdir_get_into(). */
+ssize_t deltafs_plfsdir_read_into(deltafs_plfsdir_t* __dir,
+                                  const char* __fname, int __epoch,
+                                  void* __buf, size_t __bufsz,
+                                  size_t* __table_seeks, size_t* __seeks);
+/* Retrieve the values of a given key at a specific epoch, or all epochs if
+   __epoch is -1, one value at a time. Each value is passed to *saver together
+   with its epoch, in epoch order, and is only valid during the call. Stops
+   early if *saver returns non-zero. Engines other than the default one report
+   a single value holding the data of all epochs. Return -1 on errors.
+   Otherwise, return the number of values reported. */
+ssize_t deltafs_plfsdir_get_each(deltafs_plfsdir_t* __dir, const char* __key,
+                                 size_t __keylen, int __epoch,
+                                 int (*saver)(void* arg, int __epoch,
+                                              const char* __value, size_t sz),
+                                 void* arg);
 /* Scan directory contents at a specific epoch, or all
    epochs if __epoch is -1. Report results to *saver. Return -1 on errors.
    Otherwise, return the total number of entries scanned. */
@@ -186,11 +359,41 @@ ssize_t deltafs_plfsdir_scan(deltafs_plfsdir_t* __dir, int __epoch,
                                           size_t __keylen, const char* __value,
                                           size_t sz),
                              void* arg);
+/* Scan keys within [__start, __end) at a specific epoch, or all epochs if
+   __epoch is -1. An empty (zero-length) bound is treated as unbounded.
+   Tables and data blocks outside the range are skipped. Report results to
+   *saver. Return -1 on errors. Otherwise, return the total number of entries
+   scanned. */
+ssize_t deltafs_plfsdir_range_scan(
+    deltafs_plfsdir_t* __dir, int __epoch, const char* __start,
+    size_t __startlen, const char* __end, size_t __endlen,
+    int (*saver)(void* arg, const char* __key, size_t __keylen,
+                 const char* __value, size_t sz),
+    void* arg);
+/* Same as deltafs_plfsdir_range_scan(), but reports results to *saver in
+   batches of up to __batch_size entries (256 if __batch_size is 0) to cut the
+   per-call overhead of language bindings. Entries are reported in the same
+   order as deltafs_plfsdir_range_scan(). Batch arrays and the data they point
+   to are only valid during the call. Stops early if *saver returns non-zero.
+   Return -1 on errors. Otherwise, return the total number of entries
+   reported. */
+ssize_t deltafs_plfsdir_batch_scan(
+    deltafs_plfsdir_t* __dir, int __epoch, const char* __start,
+    size_t __startlen, const char* __end, size_t __endlen, size_t __batch_size,
+    int (*saver)(void* arg, size_t __n, const char* const* __keys,
+                 const size_t* __keylens, const char* const* __values,
+                 const size_t* __sizes),
+    void* arg);
 /* Count the number of keys at a specified epoch, or all epochs if
    __epoch is -1. Return the number of keys found. Return -1 on error. */
 ssize_t deltafs_plfsdir_count(deltafs_plfsdir_t* __dir, int __epoch);
 ssize_t deltafs_plfsdir_io_pread(deltafs_plfsdir_t* __dir, void* __buf,
                                  size_t __sz, off_t __off);
+/* Read into __iovcnt buffers starting at __off. Return -1 on errors, or num
+   bytes read. */
+ssize_t deltafs_plfsdir_io_preadv(deltafs_plfsdir_t* __dir,
+                                  const struct iovec* __iov, int __iovcnt,
+                                  off_t __off);
 int* deltafs_plfsdir_filter_get(deltafs_plfsdir_t* __dir, const char* __key,
                                 size_t __keylen, size_t* __sz);
 /* Returns NULL if not found. A malloc()ed array otherwise.
@@ -200,12 +403,44 @@ char* deltafs_plfsdir_get_property(deltafs_plfsdir_t* __dir, const char* __key);
    Used when the property is known to be an integer. */
 long long deltafs_plfsdir_get_integer_property(deltafs_plfsdir_t* __dir,
                                                const char* __key);
+/* Periodically write all metrics of an opened directory to a file, in JSON or,
+   if __prometheus is non-zero, in Prometheus text format. The same output is
+   available on demand through the "metrics.json" and "metrics.prometheus"
+   properties. Dumping stops when the directory handle is freed. */
+int deltafs_plfsdir_dump_metrics(deltafs_plfsdir_t* __dir, const char* __path,
+                                 int __prometheus, int __interval_secs);
+/* Write the spans recorded so far to a file in the Chrome trace event format.
+   Spans are tagged with the rank of the caller so that the traces of all
+   ranks can be loaded together by chrome://tracing or Perfetto. */
+int deltafs_plfsdir_dump_trace(deltafs_plfsdir_t* __dir, const char* __path);
 int deltafs_plfsdir_epoch_flush(deltafs_plfsdir_t* __dir, int __epoch);
+/* Start a new epoch like deltafs_plfsdir_epoch_flush() and return a
+   non-negative ticket identifying the flush of __epoch, or -1 on errors.
+   The caller may keep writing the next epoch while the flush proceeds in
+   the background and use the ticket to check on it later. */
+long long deltafs_plfsdir_epoch_flush_async(deltafs_plfsdir_t* __dir,
+                                            int __epoch);
+/* Return 1 if the flush identified by __ticket and all flushes before it have
+   completed, 0 if they are still in progress, or -1 on errors. */
+int deltafs_plfsdir_poll_flush(deltafs_plfsdir_t* __dir, long long __ticket);
+/* Wait for the flush identified by __ticket and all flushes before it to
+   complete, but not for flushes started after it. */
+int deltafs_plfsdir_wait_flush(deltafs_plfsdir_t* __dir, long long __ticket);
 int deltafs_plfsdir_flush(deltafs_plfsdir_t* __dir, int __epoch);
 int deltafs_plfsdir_sync(deltafs_plfsdir_t* __dir);
 /* Wait for on-going memtable compactions to finish */
 int deltafs_plfsdir_wait(deltafs_plfsdir_t* __dir);
 int deltafs_plfsdir_finish(deltafs_plfsdir_t* __dir);
+/* Rewrite the finished plfsdir at __src into a new plfsdir at __dst that
+   stores all keys as a single epoch. Each key is written once with a value
+   listing every (epoch, value) pair found for it across all epochs, each
+   encoded as a varint32 epoch followed by a varint32 length and the value
+   bytes. Filters of __dst are rebuilt. Up to __parallelism source partitions
+   are merged at a time, with a default of 4 used if __parallelism is not
+   positive. Must be called on a handle that has not been opened. The handle
+   cannot be opened afterwards. Return 0 on success, or -1 on errors. */
+int deltafs_plfsdir_compact(deltafs_plfsdir_t* __dir, const char* __src,
+                            const char* __dst, int __parallelism);
 int deltafs_plfsdir_free_handle(deltafs_plfsdir_t* __dir);
 
 /*
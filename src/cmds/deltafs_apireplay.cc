@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+/*
+ * deltafs-apireplay re-issues the deltafs API calls captured in one or more
+ * trace files (see DELTAFS_ApiTraceDir) against the current build and
+ * configuration. Each thread of the original run gets its own replay thread,
+ * and calls are paced to start at their original offsets from the beginning
+ * of the trace unless -s is used to speed them up or -s 0 to drop pacing.
+ * Each trace file is replayed as a separate process would have, so traces of
+ * all ranks of a job can be replayed together.
+ */
+#include "../libdeltafs/api_trace.h"
+
+#include "deltafs/deltafs_api.h"
+#include "deltafs/deltafs_config.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/pdlfs_config.h"
+#include "pdlfs-common/strutil.h"
+
+#if defined(PDLFS_GFLAGS)
+#include <gflags/gflags.h>
+#endif
+
+#if defined(PDLFS_GLOG)
+#include <glog/logging.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+
+struct OpStats {
+  OpStats() : calls(0), orig_micros(0), micros(0), mismatches(0) {}
+  uint64_t calls;
+  uint64_t orig_micros;  // Total latency in the original run
+  uint64_t micros;       // Total latency during the replay
+  // Calls that failed in only one of the original run and the replay
+  uint64_t mismatches;
+};
+
+// Per-trace replay state. Fds and plfsdir handles returned by the replay are
+// mapped from those of the original run and shared by all threads of the
+// trace.
+struct Replay {
+  std::vector<pdlfs::ApiTraceRecord> records;
+  std::vector<int> ops;  // Trace op codes to our op codes
+  pdlfs::port::Mutex mu;
+  std::map<uint64_t, int> fds;
+  std::map<uint64_t, deltafs_plfsdir_t*> dirs;
+};
+
+double FLAGS_speed = 1.0;  // Default: use the original pacing
+std::string FLAGS_root;    // Prefix of plfsdir names. Default: none
+uint64_t start_micros = 0;
+
+class Worker {
+ public:
+  explicit Worker(Replay* r) : replay_(r), stats_(pdlfs::kNumApiTraceOps) {}
+
+  void AddCall(const pdlfs::ApiTraceRecord* rec) { calls_.push_back(rec); }
+
+  const std::vector<OpStats>& stats() const { return stats_; }
+
+  static void* Run(void* arg) {
+    reinterpret_cast<Worker*>(arg)->RunCalls();
+    return NULL;
+  }
+
+ private:
+  void RunCalls() {
+    for (size_t i = 0; i < calls_.size(); i++) {
+      const pdlfs::ApiTraceRecord& rec = *calls_[i];
+      const int op = replay_->ops[rec.op];
+      if (op < 0) continue;  // Op unknown to this build
+      if (FLAGS_speed > 0) {
+        const uint64_t target = static_cast<uint64_t>(rec.micros / FLAGS_speed);
+        const uint64_t now = pdlfs::CurrentMicros() - start_micros;
+        if (target > now) {
+          pdlfs::SleepForMicroseconds(static_cast<int>(target - now));
+        }
+      }
+      const uint64_t start = pdlfs::CurrentMicros();
+      const bool ok = Issue(op, rec);
+      OpStats* const s = &stats_[op];
+      s->micros += pdlfs::CurrentMicros() - start;
+      s->orig_micros += rec.latency_micros;
+      s->calls++;
+      if (ok != (rec.result >= 0)) {
+        s->mismatches++;
+      }
+    }
+  }
+
+  int Fd(uint64_t handle) {
+    pdlfs::MutexLock ml(&replay_->mu);
+    std::map<uint64_t, int>::iterator it = replay_->fds.find(handle);
+    if (it != replay_->fds.end()) return it->second;
+    return static_cast<int>(handle);  // Such as AT_FDCWD
+  }
+
+  void MapFd(const pdlfs::ApiTraceRecord& rec, int fd) {
+    if (fd >= 0 && rec.result >= 0) {
+      pdlfs::MutexLock ml(&replay_->mu);
+      replay_->fds[static_cast<uint64_t>(rec.result)] = fd;
+    }
+  }
+
+  deltafs_plfsdir_t* Dir(uint64_t handle) {
+    pdlfs::MutexLock ml(&replay_->mu);
+    std::map<uint64_t, deltafs_plfsdir_t*>::iterator it =
+        replay_->dirs.find(handle);
+    if (it != replay_->dirs.end()) return it->second;
+    return NULL;
+  }
+
+  char* Data(size_t n) {
+    if (buf_.size() < n) buf_.resize(n, 'x');
+    return &buf_[0];
+  }
+
+  static int Filler(const char* name, void* arg) { return 0; }
+
+  // Re-issue a call. Return true if the call succeeds.
+  bool Issue(int op, const pdlfs::ApiTraceRecord& rec) {
+    const char* const path = rec.path.c_str();
+    const int fd = Fd(rec.handle);
+    deltafs_plfsdir_t* const dir = Dir(rec.handle);
+    const int epoch = static_cast<int>(rec.offset);
+    struct stat buf;
+    size_t sz;
+    int r = 0;
+    switch (op) {
+      case pdlfs::kApiOpenat:
+        r = deltafs_openat(fd, path, rec.flags, rec.mode);
+        MapFd(rec, r);
+        return r >= 0;
+      case pdlfs::kApiOpenstat:
+        r = deltafs_openstat(path, rec.flags, rec.mode, NULL);
+        MapFd(rec, r);
+        return r >= 0;
+      case pdlfs::kApiPread:
+        return deltafs_pread(fd, Data(rec.size), rec.size, rec.offset) >= 0;
+      case pdlfs::kApiRead:
+        return deltafs_read(fd, Data(rec.size), rec.size) >= 0;
+      case pdlfs::kApiPwrite:
+        return deltafs_pwrite(fd, Data(rec.size), rec.size, rec.offset) >= 0;
+      case pdlfs::kApiWrite:
+        return deltafs_write(fd, Data(rec.size), rec.size) >= 0;
+      case pdlfs::kApiFstat:
+        return deltafs_fstat(fd, &buf) == 0;
+      case pdlfs::kApiFtruncate:
+        return deltafs_ftruncate(fd, rec.size) == 0;
+      case pdlfs::kApiFdatasync:
+        return deltafs_fdatasync(fd) == 0;
+      case pdlfs::kApiEpochFlush:
+        return deltafs_epoch_flush(fd, NULL) == 0;
+      case pdlfs::kApiClose:
+        r = deltafs_close(fd);
+        if (r == 0) {
+          pdlfs::MutexLock ml(&replay_->mu);
+          replay_->fds.erase(rec.handle);
+        }
+        return r == 0;
+      case pdlfs::kApiAccess:
+        return deltafs_access(path, rec.mode) == 0;
+      case pdlfs::kApiAccessdir:
+        return deltafs_accessdir(path, rec.mode) == 0;
+      case pdlfs::kApiListdir:
+        return deltafs_listdir(path, Filler, NULL) == 0;
+      case pdlfs::kApiGetattr:
+        return deltafs_getattr(path, &buf) == 0;
+      case pdlfs::kApiStat:
+        return deltafs_stat(path, &buf) == 0;
+      case pdlfs::kApiMkfile:
+        return deltafs_mkfile(path, rec.mode) == 0;
+      case pdlfs::kApiMkdirs:
+        return deltafs_mkdirs(path, rec.mode) == 0;
+      case pdlfs::kApiMkdir:
+        return deltafs_mkdir(path, rec.mode) == 0;
+      case pdlfs::kApiChmod:
+        return deltafs_chmod(path, rec.mode) == 0;
+      case pdlfs::kApiChown:
+        return deltafs_chown(path, rec.mode, rec.flags) == 0;
+      case pdlfs::kApiUnlink:
+        return deltafs_unlink(path) == 0;
+      case pdlfs::kApiTruncate:
+        return deltafs_truncate(path, rec.size) == 0;
+      case pdlfs::kApiPlfsdirCreateHandle:
+        return CreateDir(rec);
+      case pdlfs::kApiPlfsdirOpen:
+        return OpenDir(dir, rec);
+      case pdlfs::kApiPlfsdirPut:
+        return deltafs_plfsdir_put(dir, rec.key.data(), rec.key.size(), epoch,
+                                   Data(rec.size), rec.size) >= 0;
+      case pdlfs::kApiPlfsdirAppend:
+        return deltafs_plfsdir_append(dir, rec.key.c_str(), epoch,
+                                      Data(rec.size), rec.size) >= 0;
+      case pdlfs::kApiPlfsdirEpochFlush:
+        return deltafs_plfsdir_epoch_flush(dir, epoch) == 0;
+      case pdlfs::kApiPlfsdirFlush:
+        return deltafs_plfsdir_flush(dir, epoch) == 0;
+      case pdlfs::kApiPlfsdirWait:
+        return deltafs_plfsdir_wait(dir) == 0;
+      case pdlfs::kApiPlfsdirEpochFlushAsync:
+        return deltafs_plfsdir_epoch_flush_async(dir, epoch) >= 0;
+      case pdlfs::kApiPlfsdirPollFlush:
+        return deltafs_plfsdir_poll_flush(dir, rec.size) >= 0;
+      case pdlfs::kApiPlfsdirWaitFlush:
+        return deltafs_plfsdir_wait_flush(dir, rec.size) == 0;
+      case pdlfs::kApiPlfsdirSync:
+        return deltafs_plfsdir_sync(dir) == 0;
+      case pdlfs::kApiPlfsdirFinish:
+        return deltafs_plfsdir_finish(dir) == 0;
+      case pdlfs::kApiPlfsdirGet:
+        return Free(deltafs_plfsdir_get(dir, rec.key.data(), rec.key.size(),
+                                        epoch, &sz, NULL, NULL));
+      case pdlfs::kApiPlfsdirRead:
+        return Free(
+            deltafs_plfsdir_read(dir, rec.key.c_str(), epoch, &sz, NULL, NULL));
+      case pdlfs::kApiPlfsdirFreeHandle:
+        if (dir != NULL) {
+          pdlfs::MutexLock ml(&replay_->mu);
+          replay_->dirs.erase(rec.handle);
+        }
+        return deltafs_plfsdir_free_handle(dir) == 0;
+      default:
+        return false;
+    }
+  }
+
+  static bool Free(void* data) {
+    free(data);
+    return data != NULL;
+  }
+
+  bool CreateDir(const pdlfs::ApiTraceRecord& rec) {
+    deltafs_plfsdir_t* const dir = deltafs_plfsdir_create_handle(
+        rec.path.c_str(), rec.mode, static_cast<int>(rec.flags));
+    if (dir != NULL) {
+      pdlfs::MutexLock ml(&replay_->mu);
+      replay_->dirs[rec.handle] = dir;
+    }
+    return dir != NULL;
+  }
+
+  bool OpenDir(deltafs_plfsdir_t* dir, const pdlfs::ApiTraceRecord& rec) {
+    if (dir != NULL) {
+      deltafs_plfsdir_set_key_size(dir, rec.size);
+      deltafs_plfsdir_set_val_size(dir, rec.offset);
+      deltafs_plfsdir_set_rank(dir, static_cast<int>(rec.mode));
+      deltafs_plfsdir_set_fixed_kv(dir, rec.flags & pdlfs::kApiTraceFixedKv);
+      deltafs_plfsdir_set_unordered(dir,
+                                    rec.flags & pdlfs::kApiTraceUnordered);
+      deltafs_plfsdir_set_multimap(dir, rec.flags & pdlfs::kApiTraceMultimap);
+      deltafs_plfsdir_force_leveldb_fmt(
+          dir, rec.flags & pdlfs::kApiTraceLevelDbFmt);
+    }
+    const std::string name = FLAGS_root + rec.path;
+    if (!FLAGS_root.empty()) {
+      CreateParentDirs(name);
+    }
+    return deltafs_plfsdir_open(dir, name.c_str()) == 0;
+  }
+
+  // Recreate the directory tree of the original run under the new root.
+  static void CreateParentDirs(const std::string& name) {
+    pdlfs::Env* const env = pdlfs::Env::Default();
+    size_t p = name.find('/', 1);
+    while (p != std::string::npos) {
+      env->CreateDir(name.substr(0, p).c_str());  // Errors are ignored
+      p = name.find('/', p + 1);
+    }
+  }
+
+  Replay* const replay_;
+  std::vector<const pdlfs::ApiTraceRecord*> calls_;
+  std::vector<OpStats> stats_;
+  std::string buf_;
+};
+
+void PrintRecords(const Replay& r, const std::vector<std::string>& names) {
+  for (size_t i = 0; i < r.records.size(); i++) {
+    const pdlfs::ApiTraceRecord& rec = r.records[i];
+    const int op = r.ops[rec.op];
+    printf("%llu t%u %s h=%lld sz=%llu off=%llu mode=%o flags=%x",
+           static_cast<unsigned long long>(rec.micros),
+           static_cast<unsigned>(rec.thread),
+           op >= 0 ? names[op].c_str() : "?",
+           static_cast<long long>(rec.handle),
+           static_cast<unsigned long long>(rec.size),
+           static_cast<unsigned long long>(rec.offset),
+           static_cast<unsigned>(rec.mode), static_cast<unsigned>(rec.flags));
+    if (!rec.path.empty()) printf(" path=%s", rec.path.c_str());
+    if (!rec.key.empty()) printf(" keylen=%d", int(rec.key.size()));
+    printf(" lat=%llu ret=%lld err=%u\n",
+           static_cast<unsigned long long>(rec.latency_micros),
+           static_cast<long long>(rec.result), static_cast<unsigned>(rec.err));
+  }
+}
+
+void Usage(const char* prog) {
+  fprintf(stderr,
+          "usage: %s [-n] [-s speed] [-r root] <trace_file>...\n"
+          "  -n        print records instead of replaying them\n"
+          "  -s speed  replay calls speed times as fast as the original "
+          "run,\n"
+          "            or as fast as possible if speed is 0 (default 1)\n"
+          "  -r root   prefix plfsdir names with root\n",
+          prog);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+#if defined(PDLFS_GLOG)
+  FLAGS_logtostderr = true;
+#endif
+#if defined(PDLFS_GFLAGS)
+  std::string usage("Sample usage: ");
+  usage += argv[0];
+  usage += " [-n] [-s speed] [-r root] <trace_file>...";
+  google::SetUsageMessage(usage);
+  google::SetVersionString(PDLFS_COMMON_VERSION);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+#endif
+#if defined(PDLFS_GLOG)
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+#endif
+  bool print_only = false;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "-n") == 0) {
+      print_only = true;
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      FLAGS_speed = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      FLAGS_root = argv[++i];
+    } else {
+      Usage(argv[0]);
+      return -1;
+    }
+  }
+  if (i >= argc) {
+    Usage(argv[0]);
+    return -1;
+  }
+
+  std::vector<std::string> names;
+  pdlfs::SplitString(&names, pdlfs::ApiTraceOpNames(), ',');
+  pdlfs::Env* const env = pdlfs::Env::Default();
+  std::vector<Replay*> replays;
+  std::vector<Worker*> workers;
+  uint64_t orig_micros = 0;
+  for (; i < argc; i++) {
+    Replay* const r = new Replay;
+    replays.push_back(r);
+    std::vector<std::string> ops;
+    pdlfs::Status s = pdlfs::ReadApiTrace(env, argv[i], &ops, &r->records);
+    if (!s.ok()) {
+      fprintf(stderr, "apireplay: %s\n", s.ToString().c_str());
+      return -1;
+    }
+    // Ops are matched by name so traces survive op code changes
+    r->ops.assign(256, -1);
+    for (size_t j = 0; j < ops.size() && j < r->ops.size(); j++) {
+      for (size_t k = 0; k < names.size(); k++) {
+        if (ops[j] == names[k]) r->ops[j] = static_cast<int>(k);
+      }
+    }
+    if (print_only) {
+      PrintRecords(*r, names);
+      continue;
+    }
+    std::map<uint32_t, Worker*> threads;
+    for (size_t j = 0; j < r->records.size(); j++) {
+      const pdlfs::ApiTraceRecord* const rec = &r->records[j];
+      Worker*& w = threads[rec->thread];
+      if (w == NULL) {
+        w = new Worker(r);
+        workers.push_back(w);
+      }
+      w->AddCall(rec);
+      orig_micros = std::max(orig_micros, rec->micros + rec->latency_micros);
+    }
+  }
+
+  if (!print_only) {
+    fprintf(stderr, "Replaying %d threads...\n", int(workers.size()));
+    std::vector<pthread_t> tids(workers.size());
+    start_micros = pdlfs::CurrentMicros();
+    for (size_t j = 0; j < workers.size(); j++) {
+      pthread_create(&tids[j], NULL, Worker::Run, workers[j]);
+    }
+    for (size_t j = 0; j < workers.size(); j++) {
+      pthread_join(tids[j], NULL);
+    }
+    const uint64_t micros = pdlfs::CurrentMicros() - start_micros;
+    printf("%-22s %10s %12s %12s %10s\n", "op", "calls", "orig us",
+           "replay us", "mismatch");
+    for (size_t k = 0; k < names.size(); k++) {
+      OpStats total;
+      for (size_t j = 0; j < workers.size(); j++) {
+        const OpStats& s = workers[j]->stats()[k];
+        total.calls += s.calls;
+        total.orig_micros += s.orig_micros;
+        total.micros += s.micros;
+        total.mismatches += s.mismatches;
+      }
+      if (total.calls != 0) {
+        printf("%-22s %10llu %12.1f %12.1f %10llu\n", names[k].c_str(),
+               static_cast<unsigned long long>(total.calls),
+               double(total.orig_micros) / total.calls,
+               double(total.micros) / total.calls,
+               static_cast<unsigned long long>(total.mismatches));
+      }
+    }
+    printf("Original run: %.3f s, replay: %.3f s\n", orig_micros / 1e6,
+           micros / 1e6);
+  }
+
+  for (size_t j = 0; j < workers.size(); j++) {
+    delete workers[j];
+  }
+  for (size_t j = 0; j < replays.size(); j++) {
+    delete replays[j];
+  }
+  return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "../libdeltafs/mds_trace.h"
+
+#include "deltafs/deltafs_config.h"
+#include "pdlfs-common/pdlfs_config.h"
+#include "pdlfs-common/strutil.h"
+
+#if defined(PDLFS_GFLAGS)
+#include <gflags/gflags.h>
+#endif
+
+#if defined(PDLFS_GLOG)
+#include <glog/logging.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct PathStats {
+  PathStats() : calls(0), micros(0) {}
+  uint64_t calls;
+  uint64_t micros;
+};
+
+bool ByCalls(const std::pair<uint64_t, PathStats>& a,
+             const std::pair<uint64_t, PathStats>& b) {
+  return a.second.calls > b.second.calls;
+}
+
+// Print the number of sampled calls and their mean latency per op, followed
+// by the paths receiving the most calls.
+void PrintSummary(const std::vector<pdlfs::MDSTraceRecord>& records,
+                  const std::vector<std::string>& ops, size_t top) {
+  std::vector<PathStats> per_op(ops.size());
+  std::map<uint64_t, PathStats> per_path;
+  uint64_t redirects = 0;
+  for (size_t i = 0; i < records.size(); i++) {
+    const pdlfs::MDSTraceRecord& r = records[i];
+    if (r.op < per_op.size()) {
+      per_op[r.op].calls++;
+      per_op[r.op].micros += r.latency_micros;
+    }
+    PathStats* const p = &per_path[r.path_hash];
+    p->calls++;
+    p->micros += r.latency_micros;
+    redirects += r.redirected;
+  }
+  printf("%llu sampled calls, %llu redirected\n",
+         static_cast<unsigned long long>(records.size()),
+         static_cast<unsigned long long>(redirects));
+  for (size_t i = 0; i < per_op.size(); i++) {
+    if (per_op[i].calls != 0) {
+      printf("%-12s %10llu calls %10.1f us\n", ops[i].c_str(),
+             static_cast<unsigned long long>(per_op[i].calls),
+             double(per_op[i].micros) / per_op[i].calls);
+    }
+  }
+  std::vector<std::pair<uint64_t, PathStats> > paths(per_path.begin(),
+                                                     per_path.end());
+  std::sort(paths.begin(), paths.end(), ByCalls);
+  printf("Hottest paths:\n");
+  for (size_t i = 0; i < paths.size() && i < top; i++) {
+    printf("%016llx %10llu calls %10.1f us\n",
+           static_cast<unsigned long long>(paths[i].first),
+           static_cast<unsigned long long>(paths[i].second.calls),
+           double(paths[i].second.micros) / paths[i].second.calls);
+  }
+}
+
+void PrintRecords(const std::vector<pdlfs::MDSTraceRecord>& records,
+                  const std::vector<std::string>& ops) {
+  for (size_t i = 0; i < records.size(); i++) {
+    const pdlfs::MDSTraceRecord& r = records[i];
+    printf("%llu %s srv=%u path=%016llx lat=%u%s st=%d\n",
+           static_cast<unsigned long long>(r.micros),
+           r.op < ops.size() ? ops[r.op].c_str() : "?",
+           static_cast<unsigned>(r.server),
+           static_cast<unsigned long long>(r.path_hash),
+           static_cast<unsigned>(r.latency_micros),
+           r.redirected ? " redirected" : "", int(r.status));
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+#if defined(PDLFS_GLOG)
+  FLAGS_logtostderr = true;
+#endif
+#if defined(PDLFS_GFLAGS)
+  std::string usage("Sample usage: ");
+  usage += argv[0];
+  usage += " [-s] <trace_file>...";
+  google::SetUsageMessage(usage);
+  google::SetVersionString(PDLFS_COMMON_VERSION);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+#endif
+#if defined(PDLFS_GLOG)
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+#endif
+  int i = 1;
+  const bool summary = (argc > 1 && strcmp(argv[1], "-s") == 0);
+  if (summary) i++;
+  if (i >= argc) {
+    fprintf(stderr, "usage: %s [-s] <trace_file>...\n", argv[0]);
+    return -1;
+  }
+  pdlfs::Env* const env = pdlfs::Env::Default();
+  std::vector<pdlfs::MDSTraceRecord> records;
+  std::vector<std::string> ops;
+  for (; i < argc; i++) {
+    std::string contents;
+    pdlfs::Status s = pdlfs::ReadFileToString(env, argv[i], &contents);
+    if (!s.ok()) {
+      fprintf(stderr, "mdstrace: %s\n", s.ToString().c_str());
+      return -1;
+    }
+    // Header: the magic line followed by op names
+    pdlfs::Slice input(contents);
+    const size_t l1 = contents.find('\n');
+    const size_t l2 =
+        l1 == std::string::npos ? l1 : contents.find('\n', l1 + 1);
+    if (l2 == std::string::npos ||
+        contents.compare(0, l1, pdlfs::kMDSTraceMagic) != 0) {
+      fprintf(stderr, "mdstrace: %s is not a trace file\n", argv[i]);
+      return -1;
+    }
+    std::vector<std::string> names;
+    pdlfs::SplitString(&names, contents.substr(l1 + 1, l2 - l1 - 1).c_str(),
+                       ',');
+    if (ops.empty()) {
+      ops.swap(names);
+    } else if (names != ops) {
+      fprintf(stderr, "mdstrace: %s has a different set of ops\n", argv[i]);
+      return -1;
+    }
+    input.remove_prefix(l2 + 1);
+    pdlfs::MDSTraceRecord rec;
+    while (input.size() >= pdlfs::MDSTraceRecord::kEncodedLength) {
+      if (rec.DecodeFrom(input)) {
+        records.push_back(rec);
+      } else {
+        fprintf(stderr, "mdstrace: skipping a corrupted record in %s\n",
+                argv[i]);
+      }
+      input.remove_prefix(pdlfs::MDSTraceRecord::kEncodedLength);
+    }
+  }
+  if (summary) {
+    PrintSummary(records, ops, 20);
+  } else {
+    PrintRecords(records, ops);
+  }
+
+  return 0;
+}
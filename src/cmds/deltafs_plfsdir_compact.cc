@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "deltafs/deltafs_api.h"
+#include "deltafs/deltafs_config.h"
+#include "pdlfs-common/pdlfs_config.h"
+
+#if defined(PDLFS_GFLAGS)
+#include <gflags/gflags.h>
+#endif
+
+#if defined(PDLFS_GLOG)
+#include <glog/logging.h>
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+static void PrintErr(const char* err, void* arg) {
+  fprintf(stderr, "compact: %s\n", err);
+}
+
+int main(int argc, char* argv[]) {
+#if defined(PDLFS_GLOG)
+  FLAGS_logtostderr = true;
+#endif
+#if defined(PDLFS_GFLAGS)
+  std::string usage("Sample usage: ");
+  usage += argv[0];
+  usage += " <src_dir> <dst_dir> [conf] [num_threads]";
+  google::SetUsageMessage(usage);
+  google::SetVersionString(PDLFS_COMMON_VERSION);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+#endif
+#if defined(PDLFS_GLOG)
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+#endif
+  if (argc < 3 || argc > 5) {
+    fprintf(stderr, "usage: %s <src_dir> <dst_dir> [conf] [num_threads]\n",
+            argv[0]);
+    return -1;
+  }
+  const char* const conf = argc > 3 ? argv[3] : "";
+  const int num_threads = argc > 4 ? atoi(argv[4]) : 4;
+  deltafs_plfsdir_t* const dir =
+      deltafs_plfsdir_create_handle(conf, O_RDONLY, DELTAFS_PLFSDIR_DEFAULT);
+  if (dir == NULL) {
+    fprintf(stderr, "compact: cannot create dir handle\n");
+    return -1;
+  }
+  deltafs_plfsdir_set_err_printer(dir, PrintErr, NULL);
+  // Background threads for building the new dir and prefetching blocks
+  deltafs_tp_t* const tp = deltafs_tp_init(num_threads > 0 ? num_threads : 1);
+  if (tp != NULL) {
+    deltafs_plfsdir_set_thread_pool(dir, tp);
+  }
+  int r = deltafs_plfsdir_compact(dir, argv[1], argv[2], num_threads);
+  if (r != 0) {
+    fprintf(stderr, "compact: cannot compact '%s' into '%s'\n", argv[1],
+            argv[2]);
+  }
+  deltafs_plfsdir_free_handle(dir);
+  if (tp != NULL) {
+    deltafs_tp_close(tp);
+  }
+
+  return r;
+}
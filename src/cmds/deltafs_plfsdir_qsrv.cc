@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "../libdeltafs/plfsio/v1/qsrv.h"
+#include "deltafs/deltafs_config.h"
+
+#include "pdlfs-common/cache.h"
+#include "pdlfs-common/pdlfs_config.h"
+
+#if defined(PDLFS_GFLAGS)
+#include <gflags/gflags.h>
+#endif
+
+#if defined(PDLFS_GLOG)
+#include <glog/logging.h>
+#endif
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+// Serve plfsdir queries over rpc until interrupted. Directories stay open
+// across queries, sharing a block cache and an index cache, so that clients
+// using DirQuery::RPC::CLI skip the cost of opening them.
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void HandleSignal(int signal) { interrupted = 1; }
+
+int main(int argc, char* argv[]) {
+#if defined(PDLFS_GLOG)
+  FLAGS_logtostderr = true;
+#endif
+#if defined(PDLFS_GFLAGS)
+  std::string usage("Sample usage: ");
+  usage += argv[0];
+  usage += " <uri> [conf] [num_workers] [cache_mb]";
+  google::SetUsageMessage(usage);
+  google::SetVersionString(PDLFS_COMMON_VERSION);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+#endif
+#if defined(PDLFS_GLOG)
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+#endif
+  if (argc < 2 || argc > 5) {
+    fprintf(stderr, "usage: %s <uri> [conf] [num_workers] [cache_mb]\n",
+            argv[0]);
+    return -1;
+  }
+  const char* const conf = argc > 2 ? argv[2] : "";
+  const int num_workers = argc > 3 ? atoi(argv[3]) : 4;
+  const size_t cache_size =
+      static_cast<size_t>(argc > 4 ? atoi(argv[4]) : 256) << 20;
+  pdlfs::plfsio::DirOptions options = pdlfs::plfsio::ParseDirOptions(conf);
+  // Caches are shared by all open directories
+  pdlfs::Cache* const block_cache = pdlfs::NewLRUCache(cache_size);
+  pdlfs::Cache* const index_cache = pdlfs::NewLRUCache(cache_size);
+  options.block_cache = block_cache;
+  options.index_cache = index_cache;
+  pdlfs::plfsio::DirQuery* query;
+  pdlfs::Status s = pdlfs::plfsio::DirQuery::Open(options, &query);
+  if (!s.ok()) {
+    fprintf(stderr, "qsrv: %s\n", s.ToString().c_str());
+    return -1;
+  }
+  pdlfs::plfsio::DirQuery::RPC::SRV srv(query);
+  pdlfs::RPCServer* const rpc = new pdlfs::RPCServer(&srv);
+  rpc->AddChannel(argv[1], num_workers > 0 ? num_workers : 1);
+  s = rpc->status();
+  if (s.ok()) {
+    s = rpc->Start();
+  }
+  if (s.ok()) {
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+    fprintf(stderr, "qsrv: serving queries at %s\n", argv[1]);
+    while (!interrupted) {
+      pause();
+    }
+    s = rpc->Stop();
+  }
+  if (!s.ok()) {
+    fprintf(stderr, "qsrv: %s\n", s.ToString().c_str());
+  }
+  delete rpc;
+  delete query;
+  delete index_cache;
+  delete block_cache;
+
+  return s.ok() ? 0 : -1;
+}
@@ -26,6 +26,7 @@
 #include <pwd.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <string>
 int main(int argc, char* argv[]) {
 #if defined(PDLFS_GLOG)
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "api_trace.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/crc32c.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/strutil.h"
+
+#include <stdint.h>
+#include <string.h>
+
+namespace pdlfs {
+
+const char kApiTraceMagic[] = "deltafs-apitrace-v1";
+
+const char* ApiTraceOpNames() {
+  return "openat,openstat,pread,read,pwrite,write,fstat,ftruncate,"
+         "fdatasync,epoch_flush,close,access,accessdir,listdir,getattr,"
+         "stat,mkfile,mkdirs,mkdir,chmod,chown,unlink,truncate,"
+         "plfsdir_create_handle,plfsdir_open,plfsdir_put,plfsdir_append,"
+         "plfsdir_epoch_flush,plfsdir_flush,plfsdir_wait,plfsdir_sync,"
+         "plfsdir_finish,plfsdir_get,plfsdir_read,plfsdir_free_handle,"
+         "plfsdir_epoch_flush_async,plfsdir_poll_flush,plfsdir_wait_flush";
+}
+
+ApiTraceRecord::ApiTraceRecord()
+    : micros(0),
+      latency_micros(0),
+      thread(0),
+      op(0),
+      result(0),
+      err(0),
+      handle(0),
+      size(0),
+      offset(0),
+      mode(0),
+      flags(0) {}
+
+// Each record is stored as a varint32 length, followed by the record
+// contents and a masked crc32c of the contents.
+void ApiTraceRecord::EncodeTo(std::string* dst) const {
+  std::string body;
+  body.push_back(static_cast<char>(op));
+  PutVarint32(&body, thread);
+  PutVarint64(&body, micros);
+  PutVarint64(&body, latency_micros);
+  PutVarint64(&body, static_cast<uint64_t>(result));
+  PutVarint32(&body, err);
+  PutVarint64(&body, handle);
+  PutVarint64(&body, size);
+  PutVarint64(&body, offset);
+  PutVarint32(&body, mode);
+  PutVarint32(&body, flags);
+  PutLengthPrefixedSlice(&body, path);
+  PutLengthPrefixedSlice(&body, key);
+  PutVarint32(dst, static_cast<uint32_t>(body.size()));
+  dst->append(body);
+  PutFixed32(dst, crc32c::Mask(crc32c::Value(body.data(), body.size())));
+}
+
+bool ApiTraceRecord::DecodeFrom(Slice* input) {
+  uint32_t len;
+  if (!GetVarint32(input, &len) || input->size() < len + 4) {
+    return false;
+  }
+  Slice body(input->data(), len);
+  if (crc32c::Unmask(DecodeFixed32(input->data() + len)) !=
+      crc32c::Value(body.data(), body.size())) {
+    return false;
+  }
+  input->remove_prefix(len + 4);
+  if (body.empty()) return false;
+  op = static_cast<unsigned char>(body[0]);
+  body.remove_prefix(1);
+  uint64_t res;
+  Slice p, k;
+  if (!GetVarint32(&body, &thread) || !GetVarint64(&body, &micros) ||
+      !GetVarint64(&body, &latency_micros) || !GetVarint64(&body, &res) ||
+      !GetVarint32(&body, &err) || !GetVarint64(&body, &handle) ||
+      !GetVarint64(&body, &size) || !GetVarint64(&body, &offset) ||
+      !GetVarint32(&body, &mode) || !GetVarint32(&body, &flags) ||
+      !GetLengthPrefixedSlice(&body, &p) ||
+      !GetLengthPrefixedSlice(&body, &k)) {
+    return false;
+  }
+  result = static_cast<int64_t>(res);
+  path = p.ToString();
+  key = k.ToString();
+  return true;
+}
+
+Status ReadApiTrace(Env* env, const std::string& fname,
+                    std::vector<std::string>* ops,
+                    std::vector<ApiTraceRecord>* records) {
+  std::string contents;
+  Status s = ReadFileToString(env, fname.c_str(), &contents);
+  if (!s.ok()) {
+    return s;
+  }
+  Slice input(contents);
+  const Slice magic(kApiTraceMagic);
+  if (!input.starts_with(magic) || input.size() <= magic.size() ||
+      input[magic.size()] != '\n') {
+    return Status::Corruption(fname, "bad trace header");
+  }
+  input.remove_prefix(magic.size() + 1);
+  const char* const eol =
+      static_cast<const char*>(memchr(input.data(), '\n', input.size()));
+  if (eol == NULL) {
+    return Status::Corruption(fname, "bad trace header");
+  }
+  ops->clear();
+  SplitString(ops, std::string(input.data(), eol - input.data()).c_str(), ',');
+  input.remove_prefix(eol - input.data() + 1);
+  ApiTraceRecord rec;
+  while (!input.empty() && rec.DecodeFrom(&input)) {
+    records->push_back(rec);
+  }
+  return s;
+}
+
+ApiTraceLog::ApiTraceLog(Env* env, const std::string& fname,
+                         size_t max_buffer)
+    : env_(env),
+      fname_(fname),
+      max_buffer_(max_buffer),
+      start_micros_(CurrentMicros()),
+      file_(NULL),
+      cv_(&mu_),
+      num_threads_(0),
+      dropped_(0),
+      shutting_down_(false),
+      bg_running_(false) {
+  pthread_key_create(&thread_key_, NULL);
+}
+
+ApiTraceLog::~ApiTraceLog() {
+  {
+    MutexLock ml(&mu_);
+    shutting_down_ = true;
+    cv_.SignalAll();
+    while (bg_running_) {
+      cv_.Wait();
+    }
+  }
+  if (file_ != NULL) {
+    file_->Close();
+    delete file_;
+  }
+  pthread_key_delete(thread_key_);
+}
+
+Status ApiTraceLog::Open() {
+  Status s = env_->NewWritableFile(fname_.c_str(), &file_);
+  if (s.ok()) {
+    std::string header = kApiTraceMagic;
+    header += "\n";
+    header += ApiTraceOpNames();
+    header += "\n";
+    s = file_->Append(header);
+  }
+  if (s.ok()) {
+    MutexLock ml(&mu_);
+    bg_running_ = true;
+    env_->StartThread(BGWork, this);
+  }
+  return s;
+}
+
+uint64_t ApiTraceLog::NowMicros() const {
+  return CurrentMicros() - start_micros_;
+}
+
+uint32_t ApiTraceLog::ThreadId() {
+  // Ids are stored off by one since a NULL value means unassigned
+  void* const v = pthread_getspecific(thread_key_);
+  if (v != NULL) {
+    return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(v) - 1);
+  }
+  uint32_t id;
+  {
+    MutexLock ml(&mu_);
+    id = num_threads_++;
+  }
+  pthread_setspecific(thread_key_, reinterpret_cast<void*>(uintptr_t(id) + 1));
+  return id;
+}
+
+void ApiTraceLog::Add(const ApiTraceRecord& record) {
+  std::string encoding;
+  record.EncodeTo(&encoding);
+  MutexLock ml(&mu_);
+  if (buf_.size() + encoding.size() > max_buffer_) {
+    dropped_++;
+    return;
+  }
+  buf_.append(encoding);
+  // Wake up the writer once the buffer is half full
+  if (buf_.size() >= max_buffer_ / 2 &&
+      buf_.size() - encoding.size() < max_buffer_ / 2) {
+    cv_.SignalAll();
+  }
+}
+
+uint64_t ApiTraceLog::NumDropped() const {
+  MutexLock ml(&mu_);
+  return dropped_;
+}
+
+void ApiTraceLog::BGWork(void* arg) {
+  reinterpret_cast<ApiTraceLog*>(arg)->BGLoop();
+}
+
+void ApiTraceLog::BGLoop() {
+  MutexLock ml(&mu_);
+  while (!shutting_down_) {
+    const uint64_t seconds = 1;
+    cv_.TimedWait(seconds * 1000 * 1000);
+    WritePending();
+  }
+  WritePending();
+  bg_running_ = false;
+  cv_.SignalAll();
+}
+
+// Swap out all buffered records and write them without holding mu_.
+// REQUIRES: mu_ has been locked.
+void ApiTraceLog::WritePending() {
+  mu_.AssertHeld();
+  if (buf_.empty()) return;
+  std::string pending;
+  pending.swap(buf_);
+  mu_.Unlock();
+  Status s = file_->Append(pending);
+  if (s.ok()) {
+    s = file_->Flush();
+  }
+  mu_.Lock();  // Records are discarded on errors
+}
+
+}  // namespace pdlfs
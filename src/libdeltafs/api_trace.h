@@ -0,0 +1,163 @@
+#pragma once
+
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/status.h"
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+
+// Calls of the deltafs C API that can be captured and replayed.
+enum ApiTraceOp {
+  kApiOpenat,
+  kApiOpenstat,
+  kApiPread,
+  kApiRead,
+  kApiPwrite,
+  kApiWrite,
+  kApiFstat,
+  kApiFtruncate,
+  kApiFdatasync,
+  kApiEpochFlush,
+  kApiClose,
+  kApiAccess,
+  kApiAccessdir,
+  kApiListdir,
+  kApiGetattr,
+  kApiStat,
+  kApiMkfile,
+  kApiMkdirs,
+  kApiMkdir,
+  kApiChmod,
+  kApiChown,
+  kApiUnlink,
+  kApiTruncate,
+  kApiPlfsdirCreateHandle,
+  kApiPlfsdirOpen,
+  kApiPlfsdirPut,
+  kApiPlfsdirAppend,
+  kApiPlfsdirEpochFlush,
+  kApiPlfsdirFlush,
+  kApiPlfsdirWait,
+  kApiPlfsdirSync,
+  kApiPlfsdirFinish,
+  kApiPlfsdirGet,
+  kApiPlfsdirRead,
+  kApiPlfsdirFreeHandle,
+  kApiPlfsdirEpochFlushAsync,
+  kApiPlfsdirPollFlush,
+  kApiPlfsdirWaitFlush,
+  kNumApiTraceOps
+};
+
+// Plfsdir options recorded in the flags of kApiPlfsdirOpen records.
+enum ApiTracePlfsdirFlags {
+  kApiTraceFixedKv = 1,
+  kApiTraceUnordered = 2,
+  kApiTraceMultimap = 4,
+  kApiTraceLevelDbFmt = 8
+};
+
+// Names of all ops in op code order, separated by ','.
+extern const char* ApiTraceOpNames();
+
+// A captured API call. Only the sizes of data buffers are kept, while paths,
+// plfsdir conf strings, and plfsdir keys are stored in full so the call can
+// be re-issued. Records are variable-sized and stored behind a short text
+// header: kApiTraceMagic followed by the op names.
+struct ApiTraceRecord {
+  ApiTraceRecord();
+
+  uint64_t micros;          // Time the call started since the trace opened
+  uint64_t latency_micros;  // Time the call took
+  uint32_t thread;          // Id of the calling thread within the trace
+  unsigned char op;         // Index into the op names of the file header
+  int64_t result;           // Return value, or the data size for gets
+  uint32_t err;             // errno if the call failed
+  uint64_t handle;          // The fd, or the id of the plfsdir handle
+  uint64_t size;            // Number of data bytes, or the plfsdir key size
+  uint64_t offset;          // File offset, epoch, or plfsdir value size
+  uint32_t mode;            // Permission bits, or plfsdir rank
+  uint32_t flags;           // Open flags, or plfsdir options
+  std::string path;         // Path, plfsdir name, or plfsdir conf string
+  std::string key;          // Plfsdir key or file name
+
+  void EncodeTo(std::string* dst) const;
+  // Consume a record from the front of the input. Return false if the input
+  // does not start with a valid record.
+  bool DecodeFrom(Slice* input);
+};
+
+extern const char kApiTraceMagic[];
+
+// Read all records of a trace file. The op names of the file are stored in
+// *ops. Records following a corrupted record are ignored.
+extern Status ReadApiTrace(Env* env, const std::string& fname,
+                           std::vector<std::string>* ops,
+                           std::vector<ApiTraceRecord>* records);
+
+// A per-process log of API calls. Callers add records to an in-memory buffer
+// and a background thread writes them out, so tracing never blocks on I/O.
+// Records added while the buffer is full are dropped and counted.
+// Implementation is thread-safe.
+class ApiTraceLog {
+ public:
+  ApiTraceLog(Env* env, const std::string& fname,
+              size_t max_buffer = 4 << 20);
+  // Write out all buffered records and stop the background thread.
+  ~ApiTraceLog();
+
+  // Create the trace file and start the background thread.
+  Status Open();
+
+  // Return micros elapsed since the log was created.
+  uint64_t NowMicros() const;
+
+  // Return a small integer identifying the calling thread.
+  uint32_t ThreadId();
+
+  void Add(const ApiTraceRecord& record);
+
+  // Total number of records dropped due to a full buffer.
+  uint64_t NumDropped() const;
+
+ private:
+  static void BGWork(void* arg);
+  void BGLoop();
+  void WritePending();
+
+  Env* const env_;
+  const std::string fname_;
+  const size_t max_buffer_;
+  const uint64_t start_micros_;
+  pthread_key_t thread_key_;
+  WritableFile* file_;
+  mutable port::Mutex mu_;
+  port::CondVar cv_;
+  // State below is protected by mu_
+  std::string buf_;
+  uint32_t num_threads_;
+  uint64_t dropped_;
+  bool shutting_down_;
+  bool bg_running_;
+
+  // No copying allowed
+  void operator=(const ApiTraceLog&);
+  ApiTraceLog(const ApiTraceLog&);
+};
+
+}  // namespace pdlfs
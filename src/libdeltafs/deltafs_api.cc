@@ -12,33 +12,46 @@
 #include "deltafs/deltafs_api.h"
 
 #include "deltafs/deltafs_config.h"
+#include "api_trace.h"
 #include "deltafs_client.h"
 #include "deltafs_envs.h"
 #include "plfsio/v1/bufio.h"
 #include "plfsio/v1/cuckoo.h"
+#include "plfsio/v1/memory.h"
 #include "plfsio/v1/pdb.h"
+#include "plfsio/v1/perf.h"
+#include "plfsio/v1/trace.h"
 #include "plfsio/v1/types.h"
 #include "plfsio/v1/v1.h"
 #include "util/logging.h"
 
+#include "pdlfs-common/cache.h"
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/env_files.h"
 #include "pdlfs-common/leveldb/db.h"
 #include "pdlfs-common/leveldb/filter_policy.h"
 #include "pdlfs-common/leveldb/options.h"
+#include "pdlfs-common/metrics.h"
 #include "pdlfs-common/murmur.h"
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/pdlfs_config.h"
 #include "pdlfs-common/port.h"
+#include "pdlfs-common/rate_limiter.h"
 #include "pdlfs-common/spooky.h"
 #include "pdlfs-common/status.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <unistd.h>
+#include <vector>
 
 #ifndef EHOSTUNREACH
 #define EHOSTUNREACH ENODEV
@@ -126,6 +139,95 @@ static void SetErrno(const pdlfs::Status& s) {
   }
 }
 
+static pdlfs::port::OnceType trace_once = PDLFS_ONCE_INIT;
+static pdlfs::ApiTraceLog* api_trace = NULL;  // NULL if tracing is off
+
+static void CloseApiTrace() {
+  pdlfs::ApiTraceLog* const log = api_trace;
+  api_trace = NULL;
+  delete log;
+}
+
+// Calls are captured into <dir>/apitrace-<pid>.bin when DELTAFS_ApiTraceDir
+// is set to <dir>. The trace is written out at process exit.
+static void InitApiTrace() {
+  const char* const dir = getenv("DELTAFS_ApiTraceDir");
+  if (dir == NULL || dir[0] == 0) {
+    return;
+  }
+  char tmp[50];
+  snprintf(tmp, sizeof(tmp), "/apitrace-%d.bin", static_cast<int>(getpid()));
+  pdlfs::ApiTraceLog* const log =
+      new pdlfs::ApiTraceLog(pdlfs::Env::Default(), std::string(dir) + tmp);
+  pdlfs::Status s = log->Open();
+  if (!s.ok()) {
+    Error(__LOG_ARGS__, "Fail to open api trace: %s", s.ToString().c_str());
+    delete log;
+  } else {
+    api_trace = log;
+    atexit(CloseApiTrace);
+  }
+}
+
+namespace {
+// Capture a single API call into the trace, if tracing is on. Callers fill
+// in the arguments of the call and pass its return value through Done().
+class ApiCall {
+ public:
+  explicit ApiCall(pdlfs::ApiTraceOp op) {
+    pdlfs::port::InitOnce(&trace_once, InitApiTrace);
+    log_ = api_trace;
+    if (log_ != NULL) {
+      rec.op = static_cast<unsigned char>(op);
+      rec.micros = log_->NowMicros();
+    }
+  }
+
+  bool tracing() const { return log_ != NULL; }
+
+  void SetPath(const char* path) {
+    if (log_ != NULL && path != NULL) rec.path = path;
+  }
+
+  void SetKey(const char* key, size_t n) {
+    if (log_ != NULL && key != NULL) rec.key.assign(key, n);
+  }
+
+  template <typename T>
+  T Done(T result) {
+    if (log_ != NULL) {
+      Finish(static_cast<int64_t>(result), result < 0);
+    }
+    return result;
+  }
+
+  // For calls returning data buffers, record the size of the data.
+  template <typename T>
+  T* Done(T* result, size_t size) {
+    if (log_ != NULL) {
+      Finish(result != NULL ? static_cast<int64_t>(size) : -1,
+             result == NULL);
+    }
+    return result;
+  }
+
+  pdlfs::ApiTraceRecord rec;
+
+ private:
+  void Finish(int64_t result, bool failed) {
+    const int err = errno;  // Tracing must not clobber errno
+    rec.latency_micros = log_->NowMicros() - rec.micros;
+    rec.thread = log_->ThreadId();
+    rec.result = result;
+    rec.err = failed ? static_cast<uint32_t>(err) : 0;
+    log_->Add(rec);
+    errno = err;
+  }
+
+  pdlfs::ApiTraceLog* log_;
+};
+}  // namespace
+
 extern "C" {
 char* deltafs_getcwd(char* __buf, size_t __sz) {
   if (client == NULL) {
@@ -191,7 +293,7 @@ mode_t deltafs_umask(mode_t __mode) {
   return client->Umask(__mode);
 }
 
-int deltafs_openat(int fd, const char* __path, int __oflags, mode_t __mode) {
+static int DoOpenat(int fd, const char* __path, int __oflags, mode_t __mode) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -210,8 +312,17 @@ int deltafs_openat(int fd, const char* __path, int __oflags, mode_t __mode) {
   }
 }
 
-int deltafs_openstat(const char* __path, int __oflags, mode_t __mode,
-                     struct stat* __buf) {
+int deltafs_openat(int fd, const char* __path, int __oflags, mode_t __mode) {
+  ApiCall call(pdlfs::kApiOpenat);
+  call.rec.handle = static_cast<uint64_t>(fd);
+  call.SetPath(__path);
+  call.rec.flags = static_cast<uint32_t>(__oflags);
+  call.rec.mode = __mode;
+  return call.Done(DoOpenat(fd, __path, __oflags, __mode));
+}
+
+static int DoOpenstat(const char* __path, int __oflags, mode_t __mode,
+                      struct stat* __buf) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -233,7 +344,16 @@ int deltafs_openstat(const char* __path, int __oflags, mode_t __mode,
   }
 }
 
-ssize_t deltafs_pread(int __fd, void* __buf, size_t __sz, off_t __off) {
+int deltafs_openstat(const char* __path, int __oflags, mode_t __mode,
+                     struct stat* __buf) {
+  ApiCall call(pdlfs::kApiOpenstat);
+  call.SetPath(__path);
+  call.rec.flags = static_cast<uint32_t>(__oflags);
+  call.rec.mode = __mode;
+  return call.Done(DoOpenstat(__path, __oflags, __mode, __buf));
+}
+
+static ssize_t DoPread(int __fd, void* __buf, size_t __sz, off_t __off) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -252,7 +372,15 @@ ssize_t deltafs_pread(int __fd, void* __buf, size_t __sz, off_t __off) {
   }
 }
 
-ssize_t deltafs_read(int __fd, void* __buf, size_t __sz) {
+ssize_t deltafs_pread(int __fd, void* __buf, size_t __sz, off_t __off) {
+  ApiCall call(pdlfs::kApiPread);
+  call.rec.handle = static_cast<uint64_t>(__fd);
+  call.rec.size = __sz;
+  call.rec.offset = static_cast<uint64_t>(__off);
+  return call.Done(DoPread(__fd, __buf, __sz, __off));
+}
+
+static ssize_t DoRead(int __fd, void* __buf, size_t __sz) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -271,7 +399,14 @@ ssize_t deltafs_read(int __fd, void* __buf, size_t __sz) {
   }
 }
 
-ssize_t deltafs_pwrite(int __fd, const void* __buf, size_t __sz, off_t __off) {
+ssize_t deltafs_read(int __fd, void* __buf, size_t __sz) {
+  ApiCall call(pdlfs::kApiRead);
+  call.rec.handle = static_cast<uint64_t>(__fd);
+  call.rec.size = __sz;
+  return call.Done(DoRead(__fd, __buf, __sz));
+}
+
+static ssize_t DoPwrite(int __fd, const void* __buf, size_t __sz, off_t __off) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -289,7 +424,15 @@ ssize_t deltafs_pwrite(int __fd, const void* __buf, size_t __sz, off_t __off) {
   }
 }
 
-ssize_t deltafs_write(int __fd, const void* __buf, size_t __sz) {
+ssize_t deltafs_pwrite(int __fd, const void* __buf, size_t __sz, off_t __off) {
+  ApiCall call(pdlfs::kApiPwrite);
+  call.rec.handle = static_cast<uint64_t>(__fd);
+  call.rec.size = __sz;
+  call.rec.offset = static_cast<uint64_t>(__off);
+  return call.Done(DoPwrite(__fd, __buf, __sz, __off));
+}
+
+static ssize_t DoWrite(int __fd, const void* __buf, size_t __sz) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -307,7 +450,14 @@ ssize_t deltafs_write(int __fd, const void* __buf, size_t __sz) {
   }
 }
 
-int deltafs_fstat(int __fd, struct stat* __buf) {
+ssize_t deltafs_write(int __fd, const void* __buf, size_t __sz) {
+  ApiCall call(pdlfs::kApiWrite);
+  call.rec.handle = static_cast<uint64_t>(__fd);
+  call.rec.size = __sz;
+  return call.Done(DoWrite(__fd, __buf, __sz));
+}
+
+static int DoFstat(int __fd, struct stat* __buf) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -327,7 +477,13 @@ int deltafs_fstat(int __fd, struct stat* __buf) {
   }
 }
 
-int deltafs_ftruncate(int __fd, off_t __len) {
+int deltafs_fstat(int __fd, struct stat* __buf) {
+  ApiCall call(pdlfs::kApiFstat);
+  call.rec.handle = static_cast<uint64_t>(__fd);
+  return call.Done(DoFstat(__fd, __buf));
+}
+
+static int DoFtruncate(int __fd, off_t __len) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -345,7 +501,14 @@ int deltafs_ftruncate(int __fd, off_t __len) {
   }
 }
 
-int deltafs_fdatasync(int __fd) {
+int deltafs_ftruncate(int __fd, off_t __len) {
+  ApiCall call(pdlfs::kApiFtruncate);
+  call.rec.handle = static_cast<uint64_t>(__fd);
+  call.rec.size = static_cast<uint64_t>(__len);
+  return call.Done(DoFtruncate(__fd, __len));
+}
+
+static int DoFdatasync(int __fd) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -363,7 +526,13 @@ int deltafs_fdatasync(int __fd) {
   }
 }
 
-int deltafs_epoch_flush(int __fd, void* __arg) {
+int deltafs_fdatasync(int __fd) {
+  ApiCall call(pdlfs::kApiFdatasync);
+  call.rec.handle = static_cast<uint64_t>(__fd);
+  return call.Done(DoFdatasync(__fd));
+}
+
+static int DoEpochFlush(int __fd, void* __arg) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -381,7 +550,13 @@ int deltafs_epoch_flush(int __fd, void* __arg) {
   }
 }
 
-int deltafs_close(int __fd) {
+int deltafs_epoch_flush(int __fd, void* __arg) {
+  ApiCall call(pdlfs::kApiEpochFlush);
+  call.rec.handle = static_cast<uint64_t>(__fd);
+  return call.Done(DoEpochFlush(__fd, __arg));
+}
+
+static int DoClose(int __fd) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
   }
@@ -393,7 +568,13 @@ int deltafs_close(int __fd) {
   }
 }
 
-int deltafs_access(const char* __path, int __mode) {
+int deltafs_close(int __fd) {
+  ApiCall call(pdlfs::kApiClose);
+  call.rec.handle = static_cast<uint64_t>(__fd);
+  return call.Done(DoClose(__fd));
+}
+
+static int DoAccess(const char* __path, int __mode) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -410,7 +591,14 @@ int deltafs_access(const char* __path, int __mode) {
   }
 }
 
-int deltafs_accessdir(const char* __path, int __mode) {
+int deltafs_access(const char* __path, int __mode) {
+  ApiCall call(pdlfs::kApiAccess);
+  call.SetPath(__path);
+  call.rec.mode = static_cast<uint32_t>(__mode);
+  return call.Done(DoAccess(__path, __mode));
+}
+
+static int DoAccessdir(const char* __path, int __mode) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -427,8 +615,15 @@ int deltafs_accessdir(const char* __path, int __mode) {
   }
 }
 
-int deltafs_listdir(const char* __path, deltafs_filler_t __filler,
-                    void* __arg) {
+int deltafs_accessdir(const char* __path, int __mode) {
+  ApiCall call(pdlfs::kApiAccessdir);
+  call.SetPath(__path);
+  call.rec.mode = static_cast<uint32_t>(__mode);
+  return call.Done(DoAccessdir(__path, __mode));
+}
+
+static int DoListdir(const char* __path, deltafs_filler_t __filler,
+                     void* __arg) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -452,7 +647,41 @@ int deltafs_listdir(const char* __path, deltafs_filler_t __filler,
   }
 }
 
-int deltafs_getattr(const char* __path, struct stat* __buf) {
+int deltafs_listdir(const char* __path, deltafs_filler_t __filler,
+                    void* __arg) {
+  ApiCall call(pdlfs::kApiListdir);
+  call.SetPath(__path);
+  return call.Done(DoListdir(__path, __filler, __arg));
+}
+
+int deltafs_listdirplus(const char* __path, deltafs_statfiller_t __filler,
+                        void* __arg) {
+  if (client == NULL) {
+    pdlfs::port::InitOnce(&once, InitClient);
+    if (client == NULL) {
+      return NoClient();
+    }
+  }
+  std::vector<std::string> names;
+  std::vector<pdlfs::Stat> stats;
+  pdlfs::Status s;
+  s = client->Listdir(__path, &names, &stats);
+  if (s.ok()) {
+    struct stat buf;
+    for (size_t i = 0; i < names.size() && i < stats.size(); i++) {
+      pdlfs::__cpstat(stats[i], &buf);
+      if (__filler(names[i].c_str(), &buf, __arg) != 0) {
+        break;
+      }
+    }
+    return 0;
+  } else {
+    SetErrno(s);
+    return -1;
+  }
+}
+
+static int DoGetattr(const char* __path, struct stat* __buf) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -472,7 +701,13 @@ int deltafs_getattr(const char* __path, struct stat* __buf) {
   }
 }
 
-int deltafs_stat(const char* __path, struct stat* __buf) {
+int deltafs_getattr(const char* __path, struct stat* __buf) {
+  ApiCall call(pdlfs::kApiGetattr);
+  call.SetPath(__path);
+  return call.Done(DoGetattr(__path, __buf));
+}
+
+static int DoStat(const char* __path, struct stat* __buf) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -492,7 +727,13 @@ int deltafs_stat(const char* __path, struct stat* __buf) {
   }
 }
 
-int deltafs_mkfile(const char* __path, mode_t __mode) {
+int deltafs_stat(const char* __path, struct stat* __buf) {
+  ApiCall call(pdlfs::kApiStat);
+  call.SetPath(__path);
+  return call.Done(DoStat(__path, __buf));
+}
+
+static int DoMkfile(const char* __path, mode_t __mode) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -509,7 +750,44 @@ int deltafs_mkfile(const char* __path, mode_t __mode) {
   }
 }
 
-int deltafs_mkdirs(const char* __path, mode_t __mode) {
+int deltafs_mkfile(const char* __path, mode_t __mode) {
+  ApiCall call(pdlfs::kApiMkfile);
+  call.SetPath(__path);
+  call.rec.mode = __mode;
+  return call.Done(DoMkfile(__path, __mode));
+}
+
+int deltafs_mkfile_batch(const char* __dir, const char** __names, size_t __n,
+                         mode_t __mode, int* __errs) {
+  if (client == NULL) {
+    pdlfs::port::InitOnce(&once, InitClient);
+    if (client == NULL) {
+      return NoClient();
+    }
+  }
+  std::vector<std::string> names;
+  for (size_t i = 0; i < __n; i++) {
+    names.push_back(__names[i]);
+  }
+  std::vector<pdlfs::Status> statuses;
+  pdlfs::Status s;
+  s = client->Mkfiles(__dir, names, __mode, &statuses);
+  if (s.ok()) {
+    int first_err = 0;
+    for (size_t i = 0; i < statuses.size(); i++) {
+      SetErrno(statuses[i]);
+      if (__errs != NULL) __errs[i] = errno;
+      if (first_err == 0) first_err = errno;
+    }
+    errno = first_err;
+    return first_err == 0 ? 0 : -1;
+  } else {
+    SetErrno(s);
+    return -1;
+  }
+}
+
+static int DoMkdirs(const char* __path, mode_t __mode) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -526,7 +804,14 @@ int deltafs_mkdirs(const char* __path, mode_t __mode) {
   }
 }
 
-int deltafs_mkdir(const char* __path, mode_t __mode) {
+int deltafs_mkdirs(const char* __path, mode_t __mode) {
+  ApiCall call(pdlfs::kApiMkdirs);
+  call.SetPath(__path);
+  call.rec.mode = __mode;
+  return call.Done(DoMkdirs(__path, __mode));
+}
+
+static int DoMkdir(const char* __path, mode_t __mode) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -543,7 +828,14 @@ int deltafs_mkdir(const char* __path, mode_t __mode) {
   }
 }
 
-int deltafs_chmod(const char* __path, mode_t __mode) {
+int deltafs_mkdir(const char* __path, mode_t __mode) {
+  ApiCall call(pdlfs::kApiMkdir);
+  call.SetPath(__path);
+  call.rec.mode = __mode;
+  return call.Done(DoMkdir(__path, __mode));
+}
+
+static int DoChmod(const char* __path, mode_t __mode) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -561,7 +853,14 @@ int deltafs_chmod(const char* __path, mode_t __mode) {
   }
 }
 
-int deltafs_chown(const char* __path, uid_t __usr, gid_t __grp) {
+int deltafs_chmod(const char* __path, mode_t __mode) {
+  ApiCall call(pdlfs::kApiChmod);
+  call.SetPath(__path);
+  call.rec.mode = __mode;
+  return call.Done(DoChmod(__path, __mode));
+}
+
+static int DoChown(const char* __path, uid_t __usr, gid_t __grp) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -579,7 +878,15 @@ int deltafs_chown(const char* __path, uid_t __usr, gid_t __grp) {
   }
 }
 
-int deltafs_unlink(const char* __path) {
+int deltafs_chown(const char* __path, uid_t __usr, gid_t __grp) {
+  ApiCall call(pdlfs::kApiChown);
+  call.SetPath(__path);
+  call.rec.mode = static_cast<uint32_t>(__usr);
+  call.rec.flags = static_cast<uint32_t>(__grp);
+  return call.Done(DoChown(__path, __usr, __grp));
+}
+
+static int DoUnlink(const char* __path) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -597,7 +904,13 @@ int deltafs_unlink(const char* __path) {
   }
 }
 
-int deltafs_truncate(const char* __path, off_t __len) {
+int deltafs_unlink(const char* __path) {
+  ApiCall call(pdlfs::kApiUnlink);
+  call.SetPath(__path);
+  return call.Done(DoUnlink(__path));
+}
+
+static int DoTruncate(const char* __path, off_t __len) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
     if (client == NULL) {
@@ -615,6 +928,13 @@ int deltafs_truncate(const char* __path, off_t __len) {
   }
 }
 
+int deltafs_truncate(const char* __path, off_t __len) {
+  ApiCall call(pdlfs::kApiTruncate);
+  call.SetPath(__path);
+  call.rec.size = static_cast<uint64_t>(__len);
+  return call.Done(DoTruncate(__path, __len));
+}
+
 // XXX: Not inlined so it has a name in *.so which can be dlopened by others
 int deltafs_creat(const char* __path, mode_t __mode) {
   return deltafs_open(__path, O_CREAT | O_WRONLY | O_TRUNC, __mode);
@@ -662,7 +982,9 @@ typedef pdlfs::plfsio::CuckooBlock<PLFSIO_CUCKOO_KEYBITS, PLFSIO_CUCKOO_BITS>
 IMPORT(DirOptions);
 IMPORT(DirWriter);
 IMPORT(DirReader);
+IMPORT(MultiDirReader);
 IMPORT(DirMode);
+IMPORT(CompactDirOp);
 
 IMPORT(BufferedBlockReader);
 IMPORT(BufferedBlockWriter);
@@ -688,6 +1010,56 @@ inline pdlfs::ThreadPool* CreateThreadPool(int num_threads) {
   return pdlfs::ThreadPool::NewFixed(num_threads, true);
 }
 
+// Create a thread pool whose threads are pinned to the cpus of a given NUMA
+// node. The cpus of the node are obtained from sysfs. Return NULL on errors.
+pdlfs::ThreadPool* CreateNodeThreadPool(int num_threads, int node) {
+#if defined(__linux__)
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+           node);
+  FILE* const f = fopen(path, "r");
+  if (f == NULL) {
+    return NULL;
+  }
+  char list[1024];
+  const bool ok = fgets(list, sizeof(list), f) != NULL;
+  fclose(f);
+  if (!ok) {
+    return NULL;
+  }
+  // Parse a cpu list such as "0-7,16-23"
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  const char* p = list;
+  while (*p >= '0' && *p <= '9') {
+    char* end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (*end == '-') {
+      last = strtol(end + 1, &end, 10);
+    }
+    for (long c = first; c <= last && c < CPU_SETSIZE; c++) {
+      CPU_SET(c, &cpus);
+    }
+    p = (*end == ',') ? end + 1 : end;
+  }
+  if (CPU_COUNT(&cpus) == 0) {
+    return NULL;
+  }
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pdlfs::ThreadPool* pool = NULL;
+  if (pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus) == 0) {
+    // Threads are created immediately so attr can be destroyed afterwards
+    pool = pdlfs::ThreadPool::NewFixed(num_threads, true, &attr);
+  }
+  pthread_attr_destroy(&attr);
+  return pool;
+#else
+  return NULL;
+#endif
+}
+
 inline DirOptions ParseOptions(const char* conf) {
   if (conf != NULL) {
     return pdlfs::plfsio::ParseDirOptions(conf);
@@ -706,6 +1078,10 @@ struct deltafs_env {
   // True iff env belongs to the system
   // and should not be deleted
   bool sys;
+  // Shared by all dirs using the env. NULL if writes are not rate limited
+  pdlfs::RateLimiter* rate_limiter;
+  // Shared by all dirs using the env. NULL if each dir has its own budget
+  pdlfs::plfsio::DirMemoryManager* memory_manager;
 };
 
 deltafs_env_t* deltafs_env_init(int __argc, void** __argv) {
@@ -719,6 +1095,8 @@ deltafs_env_t* deltafs_env_init(int __argc, void** __argv) {
     result->is_pfs = true;  // FIXME
     result->sys = sys;
     result->env = env;
+    result->rate_limiter = NULL;
+    result->memory_manager = NULL;
     return result;
   } else {
     SetErrno(BadArgs());
@@ -734,11 +1112,40 @@ int deltafs_env_is_system(deltafs_env_t* __env) {
   }
 }
 
+int deltafs_env_set_rate_limit(deltafs_env_t* __env,
+                               long long __bytes_per_sec) {
+  if (__env != NULL && __bytes_per_sec > 0) {
+    const uint64_t rate = static_cast<uint64_t>(__bytes_per_sec);
+    if (__env->rate_limiter == NULL) {
+      __env->rate_limiter = new pdlfs::RateLimiter(rate);
+    } else {
+      __env->rate_limiter->SetBytesPerSecond(rate);
+    }
+    return 0;
+  } else {
+    SetErrno(BadArgs());
+    return -1;
+  }
+}
+
+int deltafs_env_set_memory_budget(deltafs_env_t* __env, long long __bytes) {
+  if (__env != NULL && __env->memory_manager == NULL && __bytes > 0) {
+    __env->memory_manager =
+        new pdlfs::plfsio::DirMemoryManager(static_cast<size_t>(__bytes));
+    return 0;
+  } else {
+    SetErrno(BadArgs());
+    return -1;
+  }
+}
+
 int deltafs_env_close(deltafs_env_t* __env) {
   if (__env != NULL) {
     if (!__env->sys) {
       delete __env->env;
     }
+    delete __env->rate_limiter;
+    delete __env->memory_manager;
     free(__env);
     return 0;
   } else {
@@ -763,6 +1170,49 @@ deltafs_tp_t* deltafs_tp_init(int __size) {
   }
 }
 
+deltafs_tp_t* deltafs_tp_init_on_node(int __size, int __node) {
+  pdlfs::ThreadPool* pool = NULL;
+  if (__size > 0 && __node >= 0) {
+    pool = CreateNodeThreadPool(__size, __node);
+  }
+  if (pool != NULL) {
+    deltafs_tp_t* result =
+        static_cast<deltafs_tp_t*>(malloc(sizeof(deltafs_tp_t)));
+    result->pool = pool;
+    return result;
+  } else {
+    SetErrno(BadArgs());
+    return NULL;
+  }
+}
+
+deltafs_tp_t* deltafs_tp_init_ws(int __size) {
+  pdlfs::ThreadPool* pool = NULL;
+  if (__size > 0) {
+    pool = pdlfs::ThreadPool::NewWorkStealing(__size, true);
+  }
+  if (pool != NULL) {
+    deltafs_tp_t* result =
+        static_cast<deltafs_tp_t*>(malloc(sizeof(deltafs_tp_t)));
+    result->pool = pool;
+    return result;
+  } else {
+    SetErrno(BadArgs());
+    return NULL;
+  }
+}
+
+long long deltafs_tp_queue_depth(deltafs_tp_t* __tp) {
+  if (__tp != NULL) {
+    pdlfs::ThreadPoolStats stats;
+    __tp->pool->GetStats(&stats);
+    return static_cast<long long>(stats.queued);
+  } else {
+    SetErrno(BadArgs());
+    return -1;
+  }
+}
+
 int deltafs_tp_pause(deltafs_tp_t* __tp) {
   if (__tp != NULL) {
     pdlfs::ThreadPool* pool = __tp->pool;
@@ -797,6 +1247,34 @@ int deltafs_tp_close(deltafs_tp_t* __tp) {
   }
 }
 
+struct deltafs_cache {
+  pdlfs::Cache* cache;
+};
+
+deltafs_cache_t* deltafs_cache_init(size_t __size) {
+  if (__size != 0) {
+    deltafs_cache_t* result =
+        static_cast<deltafs_cache_t*>(malloc(sizeof(deltafs_cache_t)));
+    result->cache = pdlfs::NewLRUCache(__size);
+    return result;
+  } else {
+    SetErrno(BadArgs());
+    return NULL;
+  }
+}
+
+int deltafs_cache_close(deltafs_cache_t* __cache) {
+  if (__cache != NULL) {
+    if (__cache->cache != NULL) {
+      delete __cache->cache;
+    }
+    free(__cache);
+    return 0;
+  } else {
+    return 0;
+  }
+}
+
 }  // extern C
 
 namespace {
@@ -1077,6 +1555,14 @@ pdlfs::Status DirEnvWrapper::NewWritableFile(const char* f,
   return s;
 }
 
+// Encode an integer key as 8 big-endian bytes so that keys compare as
+// integers byte by byte.
+void EncodeIntegerKey(char* dst, uint64_t key) {
+  for (int i = 0; i < 8; i++) {
+    dst[i] = static_cast<char>(key >> (56 - 8 * i));
+  }
+}
+
 }  // namespace
 
 extern "C" {
@@ -1100,6 +1586,7 @@ struct deltafs_plfsdir {
   pdlfs::RandomAccessFile* io_src;
   DirectReader* io_reader;
   DirReader* reader;
+  MultiDirReader* multi_reader;
   bool unordered;  // If the unordered mode should be used
   // If the multi-map mode should be used
   bool multi;
@@ -1111,16 +1598,31 @@ struct deltafs_plfsdir {
   size_t side_io_buf_size;
   size_t side_ft_size;
   DirOptions* io_options;
+  // Per-NUMA-node compaction pools referenced by io_options
+  pdlfs::ThreadPool** numa_pools;
   deltafs_printer_t printer;  // Error printer
   void* printer_arg;
   DirEnvWrapper* io_env;
+  // Latency histograms referenced by io_options
+  pdlfs::plfsio::DirLatencyStats* latency_stats;
+  pdlfs::plfsio::DirTracer* tracer;  // NULL if tracing is off
+  // NULL if cpu counters are off
+  pdlfs::plfsio::DirPerfCounters* perf_counters;
+  // All metrics of the directory, registered at open time
+  pdlfs::MetricsRegistry* metrics;
+  pdlfs::MetricsDumper* metrics_dumper;
   int io_engine;
   // O_WRONLY or O_RDONLY
   int mode;
 };
 
-deltafs_plfsdir_t* deltafs_plfsdir_create_handle(const char* __conf, int __mode,
-                                                 int __io_engine) {
+// Id of a plfsdir handle in API traces.
+static uint64_t DirId(const deltafs_plfsdir_t* dir) {
+  return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(dir));
+}
+
+static deltafs_plfsdir_t* DoPlfsdirCreateHandle(const char* __conf, int __mode,
+                                                int __io_engine) {
   __mode = __mode & O_ACCMODE;
   if (__mode == O_RDONLY || __mode == O_WRONLY) {
     deltafs_plfsdir_t* const dir =
@@ -1129,6 +1631,9 @@ deltafs_plfsdir_t* deltafs_plfsdir_create_handle(const char* __conf, int __mode,
     dir->io_engine = __io_engine;
     dir->db_drain_compactions = true;
     dir->io_options = new DirOptions(ParseOptions(__conf));
+    dir->latency_stats = new pdlfs::plfsio::DirLatencyStats;
+    dir->io_options->latency_stats = dir->latency_stats;
+    dir->metrics = new pdlfs::MetricsRegistry;
     dir->side_io_buf_size = 2 << 20;
     dir->mode = __mode;
     dir->is_env_pfs = true;
@@ -1142,6 +1647,18 @@ deltafs_plfsdir_t* deltafs_plfsdir_create_handle(const char* __conf, int __mode,
   }
 }
 
+deltafs_plfsdir_t* deltafs_plfsdir_create_handle(const char* __conf, int __mode,
+                                                 int __io_engine) {
+  ApiCall call(pdlfs::kApiPlfsdirCreateHandle);
+  call.SetPath(__conf);
+  call.rec.mode = static_cast<uint32_t>(__mode);
+  call.rec.flags = static_cast<uint32_t>(__io_engine);
+  deltafs_plfsdir_t* const dir =
+      DoPlfsdirCreateHandle(__conf, __mode, __io_engine);
+  call.rec.handle = DirId(dir);
+  return call.Done(dir, 0);
+}
+
 int deltafs_plfsdir_set_fixed_kv(deltafs_plfsdir_t* __dir, int __flag) {
   if (__dir && !__dir->opened) {
     __dir->io_options->fixed_kv_length = static_cast<bool>(__flag);
@@ -1211,6 +1728,8 @@ int deltafs_plfsdir_set_env(deltafs_plfsdir_t* __dir, deltafs_env_t* __env) {
   if (__dir && !__dir->opened && __env) {
     __dir->is_env_pfs = __env->is_pfs;
     __dir->env = __env->env;
+    __dir->io_options->rate_limiter = __env->rate_limiter;
+    __dir->io_options->memory_manager = __env->memory_manager;
     return 0;
   } else {
     SetErrno(BadArgs());
@@ -1229,6 +1748,34 @@ int deltafs_plfsdir_set_thread_pool(deltafs_plfsdir_t* __dir,
   }
 }
 
+int deltafs_plfsdir_set_numa_thread_pools(deltafs_plfsdir_t* __dir,
+                                          deltafs_tp_t** __tps, int __n) {
+  if (__dir && !__dir->opened && __tps && __n > 0) {
+    delete[] __dir->numa_pools;
+    __dir->numa_pools = new pdlfs::ThreadPool*[__n];
+    for (int i = 0; i < __n; i++) {
+      __dir->numa_pools[i] = __tps[i] != NULL ? __tps[i]->pool : NULL;
+    }
+    __dir->io_options->numa_pools = __dir->numa_pools;
+    __dir->io_options->num_numa_nodes = __n;
+    return 0;
+  } else {
+    SetErrno(BadArgs());
+    return -1;
+  }
+}
+
+int deltafs_plfsdir_set_index_cache(deltafs_plfsdir_t* __dir,
+                                    deltafs_cache_t* __cache) {
+  if (__dir && !__dir->opened && __cache) {
+    __dir->io_options->index_cache = __cache->cache;
+    return 0;
+  } else {
+    SetErrno(BadArgs());
+    return -1;
+  }
+}
+
 int deltafs_plfsdir_set_rank(deltafs_plfsdir_t* __dir, int __rank) {
   if (__dir && !__dir->opened) {
     __dir->io_options->rank = __rank;
@@ -1278,6 +1825,33 @@ int deltafs_plfsdir_set_side_io_buf_size(deltafs_plfsdir_t* __dir,
   }
 }
 
+int deltafs_plfsdir_enable_tracing(deltafs_plfsdir_t* __dir, int __max_spans) {
+  if (__dir && !__dir->opened && __max_spans > 0) {
+    delete __dir->tracer;
+    __dir->tracer =
+        new pdlfs::plfsio::DirTracer(static_cast<size_t>(__max_spans));
+    __dir->io_options->tracer = __dir->tracer;
+    return 0;
+  } else {
+    SetErrno(BadArgs());
+    return -1;
+  }
+}
+
+int deltafs_plfsdir_enable_perf_counters(deltafs_plfsdir_t* __dir) {
+  if (__dir && !__dir->opened) {
+    if (__dir->perf_counters == NULL) {
+      __dir->perf_counters =
+          new pdlfs::plfsio::DirPerfCounters(__dir->metrics, "plfsdir.perf");
+      __dir->io_options->perf_counters = __dir->perf_counters;
+    }
+    return 0;
+  } else {
+    SetErrno(BadArgs());
+    return -1;
+  }
+}
+
 int deltafs_plfsdir_set_side_filter_size(deltafs_plfsdir_t* __dir,
                                          size_t __sz) {
   if (__dir && !__dir->opened) {
@@ -1340,6 +1914,10 @@ pdlfs::Status OpenAsPdb(deltafs_plfsdir_t* dir, const std::string& parent) {
     dir->io_options->compaction_pool = dir->pool;
     pdlfs::WritableFile* dstfile;
     s = env->NewWritableFile(fname.c_str(), &dstfile);
+    if (s.ok() && dir->io_options->rate_limiter != NULL) {
+      dstfile = new pdlfs::RateLimitedWritableFile(
+          dstfile, dir->io_options->rate_limiter, pdlfs::RateLimiter::kHigh);
+    }
     if (s.ok()) {
       dir->blk_writer_ =
           new BufferedBlockWriter(*dir->io_options, dstfile, bufsz, n);
@@ -1384,6 +1962,7 @@ pdlfs::Status OpenAsLevelDb(deltafs_plfsdir_t* dir, const std::string& parent) {
   dboptions.disable_write_ahead_log = true;
   dboptions.create_if_missing = true;
   dboptions.compaction_pool = dir->pool;
+  dboptions.rate_limiter = dir->io_options->rate_limiter;
   dboptions.write_buffer_size =  //
       dir->io_options->total_memtable_budget / 2;
   if (dir->io_engine == DELTAFS_PLFSDIR_LEVELDB_L0ONLY_BF &&
@@ -1686,6 +2265,135 @@ bool IsSideIoOpened(deltafs_plfsdir_t* dir) {
   }
 }
 
+// Gauges reading the current state of an opened directory. Each takes the
+// directory handle as its argument.
+#define DEF_IO_PROBE(name, expr)                                              \
+  uint64_t Probe_io_##name(void* arg) {                                       \
+    DirEnvWrapper* const env = static_cast<deltafs_plfsdir_t*>(arg)->io_env;  \
+    return static_cast<uint64_t>(env->expr);                                  \
+  }
+DEF_IO_PROBE(total_read_open, TotalFilesOpenedForRead())
+DEF_IO_PROBE(total_bytes_read, TotalBytesRead())
+DEF_IO_PROBE(total_write_open, TotalFilesOpenedForWrite())
+DEF_IO_PROBE(total_bytes_written, TotalBytesWritten())
+DEF_IO_PROBE(total_seeks, TotalRandomSeeks())
+#undef DEF_IO_PROBE
+
+#define DEF_WRITER_PROBE(name, expr)                                          \
+  uint64_t Probe_##name(void* arg) {                                          \
+    DirWriter* const writer = static_cast<deltafs_plfsdir_t*>(arg)->writer;   \
+    return static_cast<uint64_t>(writer->expr);                               \
+  }
+DEF_WRITER_PROBE(total_user_data,
+                 TEST_key_bytes() + writer->TEST_value_bytes())
+DEF_WRITER_PROBE(total_memory_usage, TEST_total_memory_usage())
+DEF_WRITER_PROBE(hugepage_memory_usage, TEST_hugepage_memory_usage())
+DEF_WRITER_PROBE(memtable_budget, TEST_memtable_budget())
+DEF_WRITER_PROBE(num_keys, TEST_num_keys())
+DEF_WRITER_PROBE(num_dropped_keys, TEST_num_dropped_keys())
+DEF_WRITER_PROBE(sstable_filter_bytes, TEST_raw_filter_contents())
+DEF_WRITER_PROBE(sstable_index_bytes, TEST_raw_index_contents())
+DEF_WRITER_PROBE(sstable_data_bytes, TEST_raw_data_contents())
+DEF_WRITER_PROBE(num_data_blocks, TEST_num_data_blocks())
+DEF_WRITER_PROBE(num_sstables, TEST_num_sstables())
+DEF_WRITER_PROBE(write_stall_micros, TEST_write_stall_micros())
+DEF_WRITER_PROBE(spilled_bytes, TEST_spilled_bytes())
+DEF_WRITER_PROBE(spill_merge_micros, TEST_spill_merge_micros())
+DEF_WRITER_PROBE(buffered_bytes, GetWritePressure().buffered_bytes)
+DEF_WRITER_PROBE(buffer_capacity, GetWritePressure().buffer_capacity)
+DEF_WRITER_PROBE(pending_compactions, GetWritePressure().pending_compactions)
+DEF_WRITER_PROBE(stalling_partitions, GetWritePressure().stalling_partitions)
+DEF_WRITER_PROBE(est_drain_micros, GetWritePressure().est_drain_micros)
+DEF_WRITER_PROBE(pending_spilled_bytes, GetWritePressure().spilled_bytes)
+#undef DEF_WRITER_PROBE
+
+#define DEF_LIMITER_PROBE(name, expr)                                         \
+  uint64_t Probe_rate_limiter_##name(void* arg) {                             \
+    pdlfs::RateLimiter* const limiter =                                       \
+        static_cast<deltafs_plfsdir_t*>(arg)->io_options->rate_limiter;       \
+    return limiter->expr;                                                     \
+  }
+DEF_LIMITER_PROBE(bytes_per_sec, GetBytesPerSecond())
+DEF_LIMITER_PROBE(high_bytes, TotalBytes(pdlfs::RateLimiter::kHigh))
+DEF_LIMITER_PROBE(high_requests, TotalRequests(pdlfs::RateLimiter::kHigh))
+DEF_LIMITER_PROBE(high_throttled_requests,
+                  TotalThrottledRequests(pdlfs::RateLimiter::kHigh))
+DEF_LIMITER_PROBE(high_throttled_micros,
+                  TotalThrottledMicros(pdlfs::RateLimiter::kHigh))
+DEF_LIMITER_PROBE(low_bytes, TotalBytes(pdlfs::RateLimiter::kLow))
+DEF_LIMITER_PROBE(low_requests, TotalRequests(pdlfs::RateLimiter::kLow))
+DEF_LIMITER_PROBE(low_throttled_requests,
+                  TotalThrottledRequests(pdlfs::RateLimiter::kLow))
+DEF_LIMITER_PROBE(low_throttled_micros,
+                  TotalThrottledMicros(pdlfs::RateLimiter::kLow))
+#undef DEF_LIMITER_PROBE
+
+uint64_t Probe_fill_percent(void* arg) {
+  const pdlfs::plfsio::DirWritePressure p =
+      static_cast<deltafs_plfsdir_t*>(arg)->writer->GetWritePressure();
+  return p.buffer_capacity != 0 ? 100 * p.buffered_bytes / p.buffer_capacity
+                                : 0;
+}
+
+// Register all metrics of a newly opened directory. Metric names are the
+// property names accepted by deltafs_plfsdir_get_property() prefixed
+// by "plfsdir.".
+void RegisterDirMetrics(deltafs_plfsdir_t* dir) {
+  pdlfs::MetricsRegistry* const r = dir->metrics;
+#define REG(name, probe) r->AddGauge("plfsdir." name, probe, dir)
+  if (dir->io_env != NULL) {
+    REG("io.total_read_open", Probe_io_total_read_open);
+    REG("io.total_bytes_read", Probe_io_total_bytes_read);
+    REG("io.total_write_open", Probe_io_total_write_open);
+    REG("io.total_bytes_written", Probe_io_total_bytes_written);
+    REG("io.total_seeks", Probe_io_total_seeks);
+  }
+  if (dir->writer != NULL) {
+    REG("total_user_data", Probe_total_user_data);
+    REG("total_memory_usage", Probe_total_memory_usage);
+    REG("hugepage_memory_usage", Probe_hugepage_memory_usage);
+    REG("memtable_budget", Probe_memtable_budget);
+    REG("num_keys", Probe_num_keys);
+    REG("num_dropped_keys", Probe_num_dropped_keys);
+    REG("sstable_filter_bytes", Probe_sstable_filter_bytes);
+    REG("sstable_index_bytes", Probe_sstable_index_bytes);
+    REG("sstable_data_bytes", Probe_sstable_data_bytes);
+    REG("num_data_blocks", Probe_num_data_blocks);
+    REG("num_sstables", Probe_num_sstables);
+    REG("write_stall_micros", Probe_write_stall_micros);
+    REG("spilled_bytes", Probe_spilled_bytes);
+    REG("spill_merge_micros", Probe_spill_merge_micros);
+    REG("write_pressure.buffered_bytes", Probe_buffered_bytes);
+    REG("write_pressure.buffer_capacity", Probe_buffer_capacity);
+    REG("write_pressure.fill_percent", Probe_fill_percent);
+    REG("write_pressure.pending_compactions", Probe_pending_compactions);
+    REG("write_pressure.stalling_partitions", Probe_stalling_partitions);
+    REG("write_pressure.est_drain_micros", Probe_est_drain_micros);
+    REG("write_pressure.spilled_bytes", Probe_pending_spilled_bytes);
+  }
+  // Totals of the limiter are shared by all dirs using it
+  if (dir->io_options->rate_limiter != NULL) {
+    REG("rate_limiter.bytes_per_sec", Probe_rate_limiter_bytes_per_sec);
+    REG("rate_limiter.high.bytes", Probe_rate_limiter_high_bytes);
+    REG("rate_limiter.high.requests", Probe_rate_limiter_high_requests);
+    REG("rate_limiter.high.throttled_requests",
+        Probe_rate_limiter_high_throttled_requests);
+    REG("rate_limiter.high.throttled_micros",
+        Probe_rate_limiter_high_throttled_micros);
+    REG("rate_limiter.low.bytes", Probe_rate_limiter_low_bytes);
+    REG("rate_limiter.low.requests", Probe_rate_limiter_low_requests);
+    REG("rate_limiter.low.throttled_requests",
+        Probe_rate_limiter_low_throttled_requests);
+    REG("rate_limiter.low.throttled_micros",
+        Probe_rate_limiter_low_throttled_micros);
+  }
+#undef REG
+  r->AddHistogram("plfsdir.latency.put", &dir->latency_stats->put);
+  r->AddHistogram("plfsdir.latency.get", &dir->latency_stats->get);
+  r->AddHistogram("plfsdir.latency.compaction",
+                  &dir->latency_stats->compaction);
+}
+
 bool IsDirOpened(deltafs_plfsdir_t* dir) {
   if (dir) {
     return dir->opened;
@@ -1694,10 +2402,27 @@ bool IsDirOpened(deltafs_plfsdir_t* dir) {
   }
 }
 
+pdlfs::Status PutBatch(deltafs_plfsdir_t* dir, const pdlfs::Slice* keys,
+                       const pdlfs::Slice* values, size_t n, int epoch) {
+  pdlfs::Status s;
+  if (dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
+    s = dir->writer->AddBatch(keys, values, n, epoch);
+  } else {
+    for (size_t i = 0; i < n && s.ok(); i++) {
+      if (dir->io_engine == DELTAFS_PLFSDIR_PLAINDB) {
+        s = dir->blk_writer_->Add(keys[i], values[i]);
+      } else {
+        s = LevelDbPut(dir, keys[i], values[i]);
+      }
+    }
+  }
+  return s;
+}
+
 }  // namespace
 
 extern "C" {
-int deltafs_plfsdir_open(deltafs_plfsdir_t* __dir, const char* __name) {
+static int DoPlfsdirOpen(deltafs_plfsdir_t* __dir, const char* __name) {
   pdlfs::Status s;
 
   if (!__dir || __dir->opened) {
@@ -1722,6 +2447,7 @@ int deltafs_plfsdir_open(deltafs_plfsdir_t* __dir, const char* __name) {
 
   if (s.ok()) {
     __dir->opened = true;
+    RegisterDirMetrics(__dir);
   }
 
   if (!s.ok()) {
@@ -1731,7 +2457,62 @@ int deltafs_plfsdir_open(deltafs_plfsdir_t* __dir, const char* __name) {
   }
 }
 
-ssize_t deltafs_plfsdir_put(deltafs_plfsdir_t* __dir, const char* __key,
+int deltafs_plfsdir_open(deltafs_plfsdir_t* __dir, const char* __name) {
+  ApiCall call(pdlfs::kApiPlfsdirOpen);
+  call.rec.handle = DirId(__dir);
+  call.SetPath(__name);
+  if (call.tracing() && __dir != NULL) {
+    // Options set before opening the dir are needed to replay it
+    const DirOptions* const options = __dir->io_options;
+    call.rec.size = options->key_size;
+    call.rec.offset = options->value_size;
+    call.rec.mode = static_cast<uint32_t>(options->rank);
+    uint32_t flags = 0;
+    if (options->fixed_kv_length) flags |= pdlfs::kApiTraceFixedKv;
+    if (options->leveldb_compatible) flags |= pdlfs::kApiTraceLevelDbFmt;
+    if (__dir->unordered) flags |= pdlfs::kApiTraceUnordered;
+    if (__dir->multi) flags |= pdlfs::kApiTraceMultimap;
+    call.rec.flags = flags;
+  }
+  return call.Done(DoPlfsdirOpen(__dir, __name));
+}
+
+int deltafs_plfsdir_open_multi(deltafs_plfsdir_t* __dir,
+                               const char* const* __names, const int* __ranks,
+                               int __n) {
+  pdlfs::Status s;
+
+  if (!__dir || __dir->opened) {
+    s = BadArgs();
+  } else if (__dir->io_engine != DELTAFS_PLFSDIR_DEFAULT) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (!__names || !__ranks || __n <= 0) {
+    s = BadArgs();
+  } else {
+    s = OpenDirEnv(__dir);  // OpenDirEnv() always return OK
+    FinalizeDirMode(__dir);
+    __dir->io_options->reader_pool = __dir->pool;
+    __dir->io_options->measure_reads = false;
+    std::vector<std::string> names(__names, __names + __n);
+    MultiDirReader* reader;
+    s = MultiDirReader::Open(*__dir->io_options, &names[0], __ranks,
+                             static_cast<size_t>(__n), &reader);
+    if (s.ok()) {
+      __dir->multi_reader = reader;
+      __dir->opened = true;
+    }
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return 0;
+  }
+}
+
+static ssize_t DoPlfsdirPut(deltafs_plfsdir_t* __dir, const char* __key,
                             size_t __keylen, int __epoch, const char* __value,
                             size_t __sz) {
   pdlfs::Status s;
@@ -1762,7 +2543,88 @@ ssize_t deltafs_plfsdir_put(deltafs_plfsdir_t* __dir, const char* __key,
   }
 }
 
-ssize_t deltafs_plfsdir_append(deltafs_plfsdir_t* __dir, const char* __fname,
+ssize_t deltafs_plfsdir_put(deltafs_plfsdir_t* __dir, const char* __key,
+                            size_t __keylen, int __epoch, const char* __value,
+                            size_t __sz) {
+  ApiCall call(pdlfs::kApiPlfsdirPut);
+  call.rec.handle = DirId(__dir);
+  call.SetKey(__key, __keylen);
+  call.rec.offset = static_cast<uint64_t>(__epoch);
+  call.rec.size = __sz;
+  return call.Done(
+      DoPlfsdirPut(__dir, __key, __keylen, __epoch, __value, __sz));
+}
+
+ssize_t deltafs_plfsdir_put_batch(deltafs_plfsdir_t* __dir,
+                                  const char* const* __keys,
+                                  const size_t* __keylens, int __epoch,
+                                  const char* const* __values,
+                                  const size_t* __sizes, size_t __n) {
+  pdlfs::Status s;
+  ssize_t total = 0;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_WRONLY) {
+    s = BadArgs();
+  } else if (__n != 0 && (!__keys || !__keylens || !__values || !__sizes)) {
+    s = BadArgs();
+  } else {
+    std::vector<pdlfs::Slice> keys(__n), values(__n);
+    for (size_t i = 0; i < __n && s.ok(); i++) {
+      if (!__keys[i] || __keylens[i] == 0) {
+        s = BadArgs();
+      } else {
+        keys[i] = pdlfs::Slice(__keys[i], __keylens[i]);
+        values[i] = pdlfs::Slice(__values[i], __sizes[i]);
+        total += __sizes[i];
+      }
+    }
+    if (s.ok() && __n != 0) {
+      s = PutBatch(__dir, &keys[0], &values[0], __n, __epoch);
+    }
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return total;
+  }
+}
+
+ssize_t deltafs_plfsdir_put_packed(deltafs_plfsdir_t* __dir, const char* __buf,
+                                   size_t __keylen, size_t __valuelen,
+                                   int __epoch, size_t __n) {
+  pdlfs::Status s;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_WRONLY) {
+    s = BadArgs();
+  } else if (__n != 0 && !__buf) {
+    s = BadArgs();
+  } else if (__keylen == 0) {
+    s = BadArgs();
+  } else if (__n != 0) {
+    std::vector<pdlfs::Slice> keys(__n), values(__n);
+    const char* p = __buf;
+    for (size_t i = 0; i < __n; i++) {
+      keys[i] = pdlfs::Slice(p, __keylen);
+      p += __keylen;
+      values[i] = pdlfs::Slice(p, __valuelen);
+      p += __valuelen;
+    }
+    s = PutBatch(__dir, &keys[0], &values[0], __n, __epoch);
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return __n * __valuelen;
+  }
+}
+
+static ssize_t DoPlfsdirAppend(deltafs_plfsdir_t* __dir, const char* __fname,
                                int __ep, const void* __buf, size_t __sz) {
   pdlfs::Status s;
 
@@ -1800,7 +2662,43 @@ ssize_t deltafs_plfsdir_append(deltafs_plfsdir_t* __dir, const char* __fname,
   }
 }
 
-int deltafs_plfsdir_epoch_flush(deltafs_plfsdir_t* __dir, int __epoch) {
+ssize_t deltafs_plfsdir_put_u64(deltafs_plfsdir_t* __dir, uint64_t __key,
+                                int __epoch, const char* __value, size_t __sz) {
+  char key[8];
+  EncodeIntegerKey(key, __key);
+  return deltafs_plfsdir_put(__dir, key, sizeof(key), __epoch, __value, __sz);
+}
+
+ssize_t deltafs_plfsdir_append(deltafs_plfsdir_t* __dir, const char* __fname,
+                               int __ep, const void* __buf, size_t __sz) {
+  ApiCall call(pdlfs::kApiPlfsdirAppend);
+  call.rec.handle = DirId(__dir);
+  call.SetKey(__fname, __fname != NULL ? strlen(__fname) : 0);
+  call.rec.offset = static_cast<uint64_t>(__ep);
+  call.rec.size = __sz;
+  return call.Done(DoPlfsdirAppend(__dir, __fname, __ep, __buf, __sz));
+}
+
+int deltafs_plfsdir_dump_trace(deltafs_plfsdir_t* __dir, const char* __path) {
+  pdlfs::Status s;
+
+  if (!IsDirOpened(__dir) || __dir->tracer == NULL) {
+    s = BadArgs();
+  } else if (!__path || __path[0] == 0) {
+    s = BadArgs();
+  } else {
+    s = __dir->tracer->WriteChromeJson(pdlfs::Env::Default(), __path,
+                                       __dir->io_options->rank);
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return 0;
+  }
+}
+
+static int DoPlfsdirEpochFlush(deltafs_plfsdir_t* __dir, int __epoch) {
   pdlfs::Status s;
 
   if (!IsDirOpened(__dir)) {
@@ -1824,7 +2722,14 @@ int deltafs_plfsdir_epoch_flush(deltafs_plfsdir_t* __dir, int __epoch) {
   }
 }
 
-int deltafs_plfsdir_flush(deltafs_plfsdir_t* __dir, int __epoch) {
+int deltafs_plfsdir_epoch_flush(deltafs_plfsdir_t* __dir, int __epoch) {
+  ApiCall call(pdlfs::kApiPlfsdirEpochFlush);
+  call.rec.handle = DirId(__dir);
+  call.rec.offset = static_cast<uint64_t>(__epoch);
+  return call.Done(DoPlfsdirEpochFlush(__dir, __epoch));
+}
+
+static int DoPlfsdirFlush(deltafs_plfsdir_t* __dir, int __epoch) {
   pdlfs::Status s;
 
   if (!IsDirOpened(__dir)) {
@@ -1848,7 +2753,14 @@ int deltafs_plfsdir_flush(deltafs_plfsdir_t* __dir, int __epoch) {
   }
 }
 
-int deltafs_plfsdir_wait(deltafs_plfsdir_t* __dir) {
+int deltafs_plfsdir_flush(deltafs_plfsdir_t* __dir, int __epoch) {
+  ApiCall call(pdlfs::kApiPlfsdirFlush);
+  call.rec.handle = DirId(__dir);
+  call.rec.offset = static_cast<uint64_t>(__epoch);
+  return call.Done(DoPlfsdirFlush(__dir, __epoch));
+}
+
+static int DoPlfsdirWait(deltafs_plfsdir_t* __dir) {
   pdlfs::Status s;
 
   if (!IsDirOpened(__dir)) {
@@ -1872,7 +2784,100 @@ int deltafs_plfsdir_wait(deltafs_plfsdir_t* __dir) {
   }
 }
 
-int deltafs_plfsdir_sync(deltafs_plfsdir_t* __dir) {
+int deltafs_plfsdir_wait(deltafs_plfsdir_t* __dir) {
+  ApiCall call(pdlfs::kApiPlfsdirWait);
+  call.rec.handle = DirId(__dir);
+  return call.Done(DoPlfsdirWait(__dir));
+}
+
+static long long DoPlfsdirEpochFlushAsync(deltafs_plfsdir_t* __dir,
+                                          int __epoch) {
+  pdlfs::Status s;
+  uint32_t ticket = 0;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_WRONLY) {
+    s = BadArgs();
+  } else {
+    if (__dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
+      s = __dir->writer->EpochFlush(__epoch, &ticket);
+    } else {
+      // Other engines flush synchronously so their tickets are always done
+      if (DoPlfsdirEpochFlush(__dir, __epoch) != 0 ||
+          DoPlfsdirWait(__dir) != 0) {
+        return -1;
+      }
+    }
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return static_cast<long long>(ticket);
+  }
+}
+
+long long deltafs_plfsdir_epoch_flush_async(deltafs_plfsdir_t* __dir,
+                                            int __epoch) {
+  ApiCall call(pdlfs::kApiPlfsdirEpochFlushAsync);
+  call.rec.handle = DirId(__dir);
+  call.rec.offset = static_cast<uint64_t>(__epoch);
+  return call.Done(DoPlfsdirEpochFlushAsync(__dir, __epoch));
+}
+
+static int DoPlfsdirPollFlush(deltafs_plfsdir_t* __dir, long long __ticket) {
+  pdlfs::Status s;
+  bool done = true;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_WRONLY || __ticket < 0) {
+    s = BadArgs();
+  } else if (__dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
+    s = __dir->writer->PollFlush(static_cast<uint32_t>(__ticket), &done);
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return done ? 1 : 0;
+  }
+}
+
+int deltafs_plfsdir_poll_flush(deltafs_plfsdir_t* __dir, long long __ticket) {
+  ApiCall call(pdlfs::kApiPlfsdirPollFlush);
+  call.rec.handle = DirId(__dir);
+  call.rec.size = static_cast<uint64_t>(__ticket);
+  return call.Done(DoPlfsdirPollFlush(__dir, __ticket));
+}
+
+static int DoPlfsdirWaitFlush(deltafs_plfsdir_t* __dir, long long __ticket) {
+  pdlfs::Status s;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_WRONLY || __ticket < 0) {
+    s = BadArgs();
+  } else if (__dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
+    s = __dir->writer->WaitForFlush(static_cast<uint32_t>(__ticket));
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return 0;
+  }
+}
+
+int deltafs_plfsdir_wait_flush(deltafs_plfsdir_t* __dir, long long __ticket) {
+  ApiCall call(pdlfs::kApiPlfsdirWaitFlush);
+  call.rec.handle = DirId(__dir);
+  call.rec.size = static_cast<uint64_t>(__ticket);
+  return call.Done(DoPlfsdirWaitFlush(__dir, __ticket));
+}
+
+static int DoPlfsdirSync(deltafs_plfsdir_t* __dir) {
   pdlfs::Status s;
 
   if (!IsDirOpened(__dir)) {
@@ -1896,7 +2901,13 @@ int deltafs_plfsdir_sync(deltafs_plfsdir_t* __dir) {
   }
 }
 
-int deltafs_plfsdir_finish(deltafs_plfsdir_t* __dir) {
+int deltafs_plfsdir_sync(deltafs_plfsdir_t* __dir) {
+  ApiCall call(pdlfs::kApiPlfsdirSync);
+  call.rec.handle = DirId(__dir);
+  return call.Done(DoPlfsdirSync(__dir));
+}
+
+static int DoPlfsdirFinish(deltafs_plfsdir_t* __dir) {
   pdlfs::Status s;
 
   if (!IsDirOpened(__dir)) {
@@ -1920,6 +2931,45 @@ int deltafs_plfsdir_finish(deltafs_plfsdir_t* __dir) {
   }
 }
 
+int deltafs_plfsdir_finish(deltafs_plfsdir_t* __dir) {
+  ApiCall call(pdlfs::kApiPlfsdirFinish);
+  call.rec.handle = DirId(__dir);
+  return call.Done(DoPlfsdirFinish(__dir));
+}
+
+int deltafs_plfsdir_compact(deltafs_plfsdir_t* __dir, const char* __src,
+                            const char* __dst, int __parallelism) {
+  pdlfs::Status s;
+
+  if (!__dir || __dir->opened) {
+    s = BadArgs();
+  } else if (__dir->io_engine != DELTAFS_PLFSDIR_DEFAULT) {
+    s = BadArgs();
+  } else if (!__src || __src[0] == 0 || !__dst || __dst[0] == 0) {
+    s = BadArgs();
+  } else {
+    s = OpenDirEnv(__dir);  // OpenDirEnv() always return OK
+    FinalizeDirMode(__dir);
+    __dir->io_options->compaction_pool = __dir->pool;
+    __dir->io_options->reader_pool = __dir->pool;
+    __dir->io_options->measure_reads = false;
+    __dir->io_options->measure_writes = false;
+    CompactDirOp op;
+    if (__parallelism > 0) {
+      op.max_parallel_merges = __parallelism;
+    }
+    s = pdlfs::plfsio::CompactDir(*__dir->io_options, __src, __dst, op);
+    // The handle cannot be reused once its env has been set up
+    __dir->opened = true;
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return 0;
+  }
+}
+
 int deltafs_plfsdir_filter_open(deltafs_plfsdir_t* __dir, const char* __name) {
   pdlfs::Status s;
 
@@ -2052,6 +3102,35 @@ ssize_t deltafs_plfsdir_io_append(deltafs_plfsdir_t* __dir, const void* __buf,
   }
 }
 
+ssize_t deltafs_plfsdir_io_appendv(deltafs_plfsdir_t* __dir,
+                                   const struct iovec* __iov, int __iovcnt) {
+  pdlfs::Status s;
+  size_t n = 0;
+
+  if (!IsSideIoOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_WRONLY) {
+    s = BadArgs();
+  } else if (__iovcnt < 0 || (__iovcnt != 0 && !__iov)) {
+    s = BadArgs();
+  } else {
+    std::vector<pdlfs::Slice> data;
+    data.reserve(__iovcnt);
+    for (int i = 0; i < __iovcnt; i++) {
+      const char* base = static_cast<const char*>(__iov[i].iov_base);
+      data.push_back(pdlfs::Slice(base, __iov[i].iov_len));
+      n += __iov[i].iov_len;
+    }
+    s = __dir->io_writer->AppendV(data.empty() ? NULL : &data[0], data.size());
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return n;
+  }
+}
+
 int deltafs_plfsdir_io_flush(deltafs_plfsdir_t* __dir) {
   pdlfs::Status s;
 
@@ -2132,61 +3211,46 @@ char* deltafs_plfsdir_get_property(deltafs_plfsdir_t* __dir,
     return NULL;
   } else {
     pdlfs::Slice k(__key);
-    if (k.starts_with("io.") && __dir->io_env != NULL) {
-      k.remove_prefix(3);
-      if (k == "total_read_open") {
-        size_t tro = __dir->io_env->TotalFilesOpenedForRead();
-        return MakeChar(tro);
-      } else if (k == "total_bytes_read") {
-        uint64_t tbr = __dir->io_env->TotalBytesRead();
-        return MakeChar(tbr);
-      } else if (k == "total_write_open") {
-        size_t two = __dir->io_env->TotalFilesOpenedForWrite();
-        return MakeChar(two);
-      } else if (k == "total_bytes_written") {
-        uint64_t tbw = __dir->io_env->TotalBytesWritten();
-        return MakeChar(tbw);
-      } else if (k == "total_seeks") {
-        uint64_t tsk = __dir->io_env->TotalRandomSeeks();
-        return MakeChar(tsk);
-      }
-    } else if (__dir->writer != NULL) {
-      if (k == "total_user_data") {
-        uint64_t vsz = __dir->writer->TEST_value_bytes();
-        uint64_t ksz = __dir->writer->TEST_key_bytes();
-        return MakeChar(ksz + vsz);
-      } else if (k == "total_memory_usage") {
-        uint64_t mem = __dir->writer->TEST_total_memory_usage();
-        return MakeChar(mem);
-      } else if (k == "num_keys") {
-        uint64_t nks = __dir->writer->TEST_num_keys();
-        return MakeChar(nks);
-      } else if (k == "num_dropped_keys") {
-        uint64_t nds = __dir->writer->TEST_num_dropped_keys();
-        return MakeChar(nds);
-      } else if (k == "sstable_filter_bytes") {
-        uint64_t fsz = __dir->writer->TEST_raw_filter_contents();
-        return MakeChar(fsz);
-      } else if (k == "sstable_index_bytes") {
-        uint64_t isz = __dir->writer->TEST_raw_index_contents();
-        return MakeChar(isz);
-      } else if (k == "sstable_data_bytes") {
-        uint64_t dsz = __dir->writer->TEST_raw_data_contents();
-        return MakeChar(dsz);
-      } else if (k == "num_data_blocks") {
-        uint64_t nbs = __dir->writer->TEST_num_data_blocks();
-        return MakeChar(nbs);
-      } else if (k == "num_sstables") {
-        uint64_t tbs = __dir->writer->TEST_num_sstables();
-        return MakeChar(tbs);
-      }
-    } else if (__dir->reader != NULL) {
-      // TODO
+    if (k == "metrics.json") {
+      return strdup(
+          __dir->metrics->Dump(pdlfs::MetricsRegistry::kJson).c_str());
+    } else if (k == "metrics.prometheus") {
+      return strdup(
+          __dir->metrics->Dump(pdlfs::MetricsRegistry::kPrometheus).c_str());
+    }
+    uint64_t val;
+    if (__dir->metrics->GetValue(std::string("plfsdir.") + __key, &val)) {
+      return MakeChar(val);
     }
     return NULL;
   }
 }
 
+int deltafs_plfsdir_dump_metrics(deltafs_plfsdir_t* __dir, const char* __path,
+                                 int __prometheus, int __interval_secs) {
+  pdlfs::Status s;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (!__path || __path[0] == 0 || __interval_secs <= 0) {
+    s = BadArgs();
+  } else {
+    delete __dir->metrics_dumper;
+    __dir->metrics_dumper = new pdlfs::MetricsDumper(
+        __dir->metrics, pdlfs::Env::Default(), __path,
+        __prometheus ? pdlfs::MetricsRegistry::kPrometheus
+                     : pdlfs::MetricsRegistry::kJson,
+        static_cast<uint64_t>(__interval_secs) * 1000 * 1000);
+    __dir->metrics_dumper->Start();
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return 0;
+  }
+}
+
 long long deltafs_plfsdir_get_integer_property(deltafs_plfsdir_t* __dir,
                                                const char* __key) {
   char* val = deltafs_plfsdir_get_property(__dir, __key);
@@ -2199,7 +3263,7 @@ long long deltafs_plfsdir_get_integer_property(deltafs_plfsdir_t* __dir,
   }
 }
 
-char* deltafs_plfsdir_get(deltafs_plfsdir_t* __dir, const char* __key,
+static char* DoPlfsdirGet(deltafs_plfsdir_t* __dir, const char* __key,
                           size_t __keylen, int __epoch, size_t* __sz,
                           size_t* __table_seeks, size_t* __seeks) {
   pdlfs::Status s;
@@ -2219,7 +3283,12 @@ char* deltafs_plfsdir_get(deltafs_plfsdir_t* __dir, const char* __key,
     op.SetEpoch(__epoch);
     op.table_seeks = __table_seeks;
     op.seeks = __seeks;
-    if (__dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
+    if (__dir->multi_reader != NULL) {
+      MultiDirReader::ReadOp multi_op;
+      multi_op.SetEpoch(__epoch);
+      s = __dir->multi_reader->Read(multi_op, pdlfs::Slice(__key, __keylen),
+                                    &dst);
+    } else if (__dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
       s = __dir->reader->Read(op, pdlfs::Slice(__key, __keylen), &dst);
     } else if (__dir->io_engine == DELTAFS_PLFSDIR_PLAINDB) {
       s = __dir->blk_reader_->Get(pdlfs::Slice(__key, __keylen), &dst);
@@ -2243,7 +3312,150 @@ char* deltafs_plfsdir_get(deltafs_plfsdir_t* __dir, const char* __key,
   }
 }
 
-void* deltafs_plfsdir_read(deltafs_plfsdir_t* __dir, const char* __fname,
+char* deltafs_plfsdir_get(deltafs_plfsdir_t* __dir, const char* __key,
+                          size_t __keylen, int __epoch, size_t* __sz,
+                          size_t* __table_seeks, size_t* __seeks) {
+  ApiCall call(pdlfs::kApiPlfsdirGet);
+  call.rec.handle = DirId(__dir);
+  call.SetKey(__key, __keylen);
+  call.rec.offset = static_cast<uint64_t>(__epoch);
+  size_t sz = 0;
+  char* const result = DoPlfsdirGet(__dir, __key, __keylen, __epoch, &sz,
+                                    __table_seeks, __seeks);
+  if (__sz != NULL && result != NULL) *__sz = sz;
+  return call.Done(result, sz);
+}
+
+char* deltafs_plfsdir_get_u64(deltafs_plfsdir_t* __dir, uint64_t __key,
+                              int __epoch, size_t* __sz,
+                              size_t* __table_seeks, size_t* __seeks) {
+  char key[8];
+  EncodeIntegerKey(key, __key);
+  return deltafs_plfsdir_get(__dir, key, sizeof(key), __epoch, __sz,
+                             __table_seeks, __seeks);
+}
+
+char* deltafs_plfsdir_get_with_stats(deltafs_plfsdir_t* __dir,
+                                     const char* __key, size_t __keylen,
+                                     int __epoch, size_t* __sz,
+                                     deltafs_plfsdir_read_stats_t* __stats) {
+  pdlfs::Status s;
+  std::string dst;
+  char* result = NULL;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (__dir->multi_reader != NULL) {
+    s = pdlfs::Status::NotSupported(pdlfs::Slice());
+  } else if (__dir->io_engine != DELTAFS_PLFSDIR_DEFAULT) {
+    s = BadArgs();
+  } else if (!__key) {
+    s = BadArgs();
+  } else if (__keylen == 0) {
+    s = BadArgs();
+  } else {
+    pdlfs::plfsio::QueryStats costs;
+    size_t table_seeks = 0;
+    size_t seeks = 0;
+    DirReader::ReadOp op;
+    op.SetEpoch(__epoch);
+    op.table_seeks = &table_seeks;
+    op.seeks = &seeks;
+    op.stats = &costs;
+    s = __dir->reader->Read(op, pdlfs::Slice(__key, __keylen), &dst);
+    if (s.ok()) {
+      result = static_cast<char*>(malloc(dst.size()));
+      memcpy(result, dst.data(), dst.size());
+      if (__sz) {
+        *__sz = dst.size();
+      }
+      if (__stats) {
+        __stats->table_seeks = table_seeks;
+        __stats->seeks = seeks;
+        __stats->bytes_read = costs.bytes_read;
+        __stats->filter_probes = costs.filter_probes;
+        __stats->filter_false_positives = costs.filter_false_positives;
+        __stats->cache_hits = costs.cache_hits;
+        __stats->cache_misses = costs.cache_misses;
+        __stats->io_micros = costs.io_micros;
+        __stats->decode_micros = costs.decode_micros;
+        __stats->epochs_skipped = costs.epochs_skipped;
+      }
+    }
+  }
+
+  if (!s.ok()) {
+    DirError(__dir, s);
+    return NULL;
+  } else {
+    return result;
+  }
+}
+
+int deltafs_plfsdir_multiget(deltafs_plfsdir_t* __dir, const char** __keys,
+                             const size_t* __keylens, size_t __n, int __epoch,
+                             char** __values, size_t* __sizes,
+                             size_t* __table_seeks, size_t* __seeks) {
+  pdlfs::Status s;
+  std::vector<std::string> dsts(__n);
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (__dir->multi_reader != NULL) {
+    s = pdlfs::Status::NotSupported(pdlfs::Slice());
+  } else if (__n != 0 && (!__keys || !__keylens || !__values || !__sizes)) {
+    s = BadArgs();
+  } else {
+    std::vector<pdlfs::Slice> keys(__n);
+    for (size_t i = 0; i < __n && s.ok(); i++) {
+      if (!__keys[i] || __keylens[i] == 0) {
+        s = BadArgs();
+      } else {
+        keys[i] = pdlfs::Slice(__keys[i], __keylens[i]);
+      }
+    }
+    if (!s.ok() || __n == 0) {
+      // Skip
+    } else if (__dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
+      DirReader::ReadOp op;
+      op.SetEpoch(__epoch);
+      op.table_seeks = __table_seeks;
+      op.seeks = __seeks;
+      s = __dir->reader->MultiRead(op, &keys[0], __n, &dsts[0]);
+    } else {
+      for (size_t i = 0; i < __n && s.ok(); i++) {
+        if (__dir->io_engine == DELTAFS_PLFSDIR_PLAINDB) {
+          s = __dir->blk_reader_->Get(keys[i], &dsts[i]);
+        } else {
+          s = DbGet(__dir, keys[i], &dsts[i]);
+        }
+      }
+    }
+    if (s.ok()) {
+      for (size_t i = 0; i < __n; i++) {
+        __values[i] = NULL;
+        __sizes[i] = dsts[i].size();
+        if (!dsts[i].empty()) {
+          __values[i] = static_cast<char*>(malloc(dsts[i].size()));
+          memcpy(__values[i], dsts[i].data(), dsts[i].size());
+        }
+      }
+    }
+  }
+
+  if (!s.ok()) {
+    DirError(__dir, s);
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+static void* DoPlfsdirRead(deltafs_plfsdir_t* __dir, const char* __fname,
                            int __epoch, size_t* __sz, size_t* __table_seeks,
                            size_t* __seeks) {
   pdlfs::Status s;
@@ -2254,6 +3466,8 @@ void* deltafs_plfsdir_read(deltafs_plfsdir_t* __dir, const char* __fname,
     s = BadArgs();
   } else if (__dir->mode != O_RDONLY) {
     s = BadArgs();
+  } else if (__dir->multi_reader != NULL) {
+    s = pdlfs::Status::NotSupported(pdlfs::Slice());
   } else if (!__fname) {
     s = BadArgs();
   } else if (__fname[0] == 0) {
@@ -2294,6 +3508,215 @@ void* deltafs_plfsdir_read(deltafs_plfsdir_t* __dir, const char* __fname,
   }
 }
 
+void* deltafs_plfsdir_read(deltafs_plfsdir_t* __dir, const char* __fname,
+                           int __epoch, size_t* __sz, size_t* __table_seeks,
+                           size_t* __seeks) {
+  ApiCall call(pdlfs::kApiPlfsdirRead);
+  call.rec.handle = DirId(__dir);
+  call.SetKey(__fname, __fname != NULL ? strlen(__fname) : 0);
+  call.rec.offset = static_cast<uint64_t>(__epoch);
+  size_t sz = 0;
+  void* const result =
+      DoPlfsdirRead(__dir, __fname, __epoch, &sz, __table_seeks, __seeks);
+  if (__sz != NULL && result != NULL) *__sz = sz;
+  return call.Done(result, sz);
+}
+
+namespace {
+
+// Copy values into a caller-supplied buffer. Bytes that do not fit are
+// counted but dropped so the caller can learn the full size.
+struct BufferSaverState {
+  char* buf;
+  size_t bufsz;
+  size_t size;  // Total size of all values seen so far
+};
+
+int SaveIntoBuffer(void* arg, uint32_t epoch, const pdlfs::Slice& value) {
+  BufferSaverState* const st = reinterpret_cast<BufferSaverState*>(arg);
+  if (st->size < st->bufsz) {
+    memcpy(st->buf + st->size, value.data(),
+           std::min(value.size(), st->bufsz - st->size));
+  }
+  st->size += value.size();
+  return 0;
+}
+
+struct EachSaverState {
+  int (*saver)(void* arg, int epoch, const char* value, size_t sz);
+  void* arg;
+  size_t n;  // Num values reported so far
+};
+
+int SaveEach(void* arg, uint32_t epoch, const pdlfs::Slice& value) {
+  EachSaverState* const st = reinterpret_cast<EachSaverState*>(arg);
+  st->n++;
+  if (st->saver(st->arg, static_cast<int>(epoch), value.data(),
+                value.size()) != 0) {
+    return -1;  // Stop early
+  }
+  return 0;
+}
+
+}  // namespace
+
+// Pass the values of a key to saver without copying them into an
+// intermediate string. Values are streamed block by block from the default
+// engine. Other engines and multi-dir readers obtain the full value first
+// and pass it as a single value tagged with __epoch.
+static pdlfs::Status PlfsdirReadEach(deltafs_plfsdir_t* __dir,
+                                     const pdlfs::Slice& key, int __epoch,
+                                     DirReader::ValueSaver saver, void* arg,
+                                     size_t* __table_seeks, size_t* __seeks) {
+  DirReader::ReadOp op;
+  op.SetEpoch(__epoch);
+  op.table_seeks = __table_seeks;
+  op.seeks = __seeks;
+  if (__dir->multi_reader == NULL &&
+      __dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
+    return __dir->reader->ReadEach(op, key, saver, arg);
+  }
+  pdlfs::Status s;
+  std::string dst;
+  if (__dir->multi_reader != NULL) {
+    MultiDirReader::ReadOp multi_op;
+    multi_op.SetEpoch(__epoch);
+    s = __dir->multi_reader->Read(multi_op, key, &dst);
+  } else if (__dir->io_engine == DELTAFS_PLFSDIR_PLAINDB) {
+    s = __dir->blk_reader_->Get(key, &dst);
+  } else {
+    s = DbGet(__dir, key, &dst);
+  }
+  if (s.ok() && !dst.empty()) {
+    saver(arg, static_cast<uint32_t>(__epoch), dst);
+  }
+  return s;
+}
+
+static ssize_t DoPlfsdirGetInto(deltafs_plfsdir_t* __dir, const char* __key,
+                                size_t __keylen, int __epoch, void* __buf,
+                                size_t __bufsz, size_t* __table_seeks,
+                                size_t* __seeks) {
+  pdlfs::Status s;
+  BufferSaverState state;
+  state.buf = static_cast<char*>(__buf);
+  state.bufsz = __bufsz;
+  state.size = 0;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (!__key || __keylen == 0) {
+    s = BadArgs();
+  } else if (!__buf && __bufsz != 0) {
+    s = BadArgs();
+  } else {
+    s = PlfsdirReadEach(__dir, pdlfs::Slice(__key, __keylen), __epoch,
+                        SaveIntoBuffer, &state, __table_seeks, __seeks);
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return static_cast<ssize_t>(state.size);
+  }
+}
+
+ssize_t deltafs_plfsdir_get_into(deltafs_plfsdir_t* __dir, const char* __key,
+                                 size_t __keylen, int __epoch, void* __buf,
+                                 size_t __bufsz, size_t* __table_seeks,
+                                 size_t* __seeks) {
+  ApiCall call(pdlfs::kApiPlfsdirGet);
+  call.rec.handle = DirId(__dir);
+  call.SetKey(__key, __keylen);
+  call.rec.offset = static_cast<uint64_t>(__epoch);
+  return call.Done(DoPlfsdirGetInto(__dir, __key, __keylen, __epoch, __buf,
+                                    __bufsz, __table_seeks, __seeks));
+}
+
+static ssize_t DoPlfsdirReadInto(deltafs_plfsdir_t* __dir,
+                                 const char* __fname, int __epoch, void* __buf,
+                                 size_t __bufsz, size_t* __table_seeks,
+                                 size_t* __seeks) {
+  pdlfs::Status s;
+  BufferSaverState state;
+  state.buf = static_cast<char*>(__buf);
+  state.bufsz = __bufsz;
+  state.size = 0;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (__dir->multi_reader != NULL) {
+    s = pdlfs::Status::NotSupported(pdlfs::Slice());
+  } else if (!__fname || __fname[0] == 0) {
+    s = BadArgs();
+  } else if (!__buf && __bufsz != 0) {
+    s = BadArgs();
+  } else {
+    char tmp[16];
+#ifdef PLFSIO_HASH_USE_SPOOKY
+    pdlfs::Spooky128(__fname, strlen(__fname), 0, 0, tmp);
+#else
+    pdlfs::murmur_x64_128(__fname, int(strlen(__fname)), 0, tmp);
+#endif
+    pdlfs::Slice k(tmp, __dir->io_options->key_size);
+    s = PlfsdirReadEach(__dir, k, __epoch, SaveIntoBuffer, &state,
+                        __table_seeks, __seeks);
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return static_cast<ssize_t>(state.size);
+  }
+}
+
+ssize_t deltafs_plfsdir_read_into(deltafs_plfsdir_t* __dir,
+                                  const char* __fname, int __epoch,
+                                  void* __buf, size_t __bufsz,
+                                  size_t* __table_seeks, size_t* __seeks) {
+  ApiCall call(pdlfs::kApiPlfsdirRead);
+  call.rec.handle = DirId(__dir);
+  call.SetKey(__fname, __fname != NULL ? strlen(__fname) : 0);
+  call.rec.offset = static_cast<uint64_t>(__epoch);
+  return call.Done(DoPlfsdirReadInto(__dir, __fname, __epoch, __buf, __bufsz,
+                                     __table_seeks, __seeks));
+}
+
+ssize_t deltafs_plfsdir_get_each(deltafs_plfsdir_t* __dir, const char* __key,
+                                 size_t __keylen, int __epoch,
+                                 int (*saver)(void* arg, int __epoch,
+                                              const char* __value, size_t sz),
+                                 void* arg) {
+  pdlfs::Status s;
+  EachSaverState state;
+  state.saver = saver;
+  state.arg = arg;
+  state.n = 0;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (!__key || __keylen == 0) {
+    s = BadArgs();
+  } else if (!saver) {
+    s = BadArgs();
+  } else {
+    s = PlfsdirReadEach(__dir, pdlfs::Slice(__key, __keylen), __epoch,
+                        SaveEach, &state, NULL, NULL);
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return static_cast<ssize_t>(state.n);
+  }
+}
+
 namespace {
 
 struct ScanState {
@@ -2314,6 +3737,16 @@ ssize_t deltafs_plfsdir_scan(deltafs_plfsdir_t* __dir, int __epoch,
                                           size_t __keylen, const char* __value,
                                           size_t sz),
                              void* arg) {
+  return deltafs_plfsdir_range_scan(__dir, __epoch, NULL, 0, NULL, 0, saver,
+                                    arg);
+}
+
+ssize_t deltafs_plfsdir_range_scan(
+    deltafs_plfsdir_t* __dir, int __epoch, const char* __start,
+    size_t __startlen, const char* __end, size_t __endlen,
+    int (*saver)(void* arg, const char* __key, size_t __keylen,
+                 const char* __value, size_t sz),
+    void* arg) {
   pdlfs::Status s;
   ScanState state;
   state.saver = saver;
@@ -2324,9 +3757,13 @@ ssize_t deltafs_plfsdir_scan(deltafs_plfsdir_t* __dir, int __epoch,
     s = BadArgs();
   } else if (__dir->mode != O_RDONLY) {
     s = BadArgs();
+  } else if (__dir->multi_reader != NULL) {
+    s = pdlfs::Status::NotSupported(pdlfs::Slice());
   } else {
     DirReader::ScanOp op;
     op.SetEpoch(__epoch);
+    op.key_start = pdlfs::Slice(__start, __startlen);
+    op.key_end = pdlfs::Slice(__end, __endlen);
     op.n = &n;
     if (__dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
       s = __dir->reader->Scan(op, ScanSaver, &state);
@@ -2342,6 +3779,112 @@ ssize_t deltafs_plfsdir_scan(deltafs_plfsdir_t* __dir, int __epoch,
   }
 }
 
+namespace {
+
+// Entries are copied into a batch buffer that is reused across batches since
+// block iterators may rebuild keys in place as they move.
+struct BatchScanState {
+  int (*saver)(void* arg, size_t n, const char* const* keys,
+               const size_t* keylens, const char* const* values,
+               const size_t* sizes);
+  void* arg;
+  size_t batch_size;
+  // Parallel reads may deliver entries from multiple threads
+  pdlfs::port::Mutex mu;
+  std::string buf;  // Key and value bytes of the current batch
+  std::vector<size_t> offsets;  // Offset of each key, followed by its value
+  std::vector<size_t> keylens;
+  std::vector<size_t> sizes;
+  std::vector<const char*> keys;
+  std::vector<const char*> values;
+  size_t n;  // Total entries reported so far
+  bool stopped;
+
+  // REQUIRES: mu has been locked
+  void Flush() {
+    const size_t k = keylens.size();
+    keys.resize(k);
+    values.resize(k);
+    for (size_t i = 0; i < k; i++) {
+      keys[i] = buf.data() + offsets[i];
+      values[i] = keys[i] + keylens[i];
+    }
+    n += k;
+    if (saver(arg, k, &keys[0], &keylens[0], &values[0], &sizes[0]) != 0) {
+      stopped = true;
+    }
+    buf.clear();
+    offsets.clear();
+    keylens.clear();
+    sizes.clear();
+  }
+};
+
+int BatchScanSaver(void* arg, const pdlfs::Slice& k, const pdlfs::Slice& v) {
+  BatchScanState* const s = reinterpret_cast<BatchScanState*>(arg);
+  pdlfs::MutexLock ml(&s->mu);
+  if (s->stopped) {
+    return -1;
+  }
+  s->offsets.push_back(s->buf.size());
+  s->keylens.push_back(k.size());
+  s->sizes.push_back(v.size());
+  s->buf.append(k.data(), k.size());
+  s->buf.append(v.data(), v.size());
+  if (s->keylens.size() >= s->batch_size) {
+    s->Flush();
+  }
+  return s->stopped ? -1 : 0;
+}
+
+}  // namespace
+
+ssize_t deltafs_plfsdir_batch_scan(
+    deltafs_plfsdir_t* __dir, int __epoch, const char* __start,
+    size_t __startlen, const char* __end, size_t __endlen, size_t __batch_size,
+    int (*saver)(void* arg, size_t __n, const char* const* __keys,
+                 const size_t* __keylens, const char* const* __values,
+                 const size_t* __sizes),
+    void* arg) {
+  pdlfs::Status s;
+  BatchScanState state;
+  state.saver = saver;
+  state.arg = arg;
+  state.batch_size = __batch_size != 0 ? __batch_size : 256;
+  state.n = 0;
+  state.stopped = false;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (__dir->multi_reader != NULL) {
+    s = pdlfs::Status::NotSupported(pdlfs::Slice());
+  } else if (!saver) {
+    s = BadArgs();
+  } else {
+    DirReader::ScanOp op;
+    op.SetEpoch(__epoch);
+    op.key_start = pdlfs::Slice(__start, __startlen);
+    op.key_end = pdlfs::Slice(__end, __endlen);
+    if (__dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
+      s = __dir->reader->Scan(op, BatchScanSaver, &state);
+    } else {
+      // Not implemented
+    }
+    if (s.ok() && !state.stopped && !state.keylens.empty()) {
+      pdlfs::MutexLock ml(&state.mu);
+      state.Flush();
+    }
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return state.n;
+  }
+}
+
 ssize_t deltafs_plfsdir_count(deltafs_plfsdir_t* __dir, int __epoch) {
   pdlfs::Status s;
   size_t n = 0;
@@ -2350,6 +3893,8 @@ ssize_t deltafs_plfsdir_count(deltafs_plfsdir_t* __dir, int __epoch) {
     s = BadArgs();
   } else if (__dir->mode != O_RDONLY) {
     s = BadArgs();
+  } else if (__dir->multi_reader != NULL) {
+    s = pdlfs::Status::NotSupported(pdlfs::Slice());
   } else {
     DirReader::CountOp op;
     op.SetEpoch(__epoch);
@@ -2395,6 +3940,37 @@ ssize_t deltafs_plfsdir_io_pread(deltafs_plfsdir_t* __dir, void* __buf,
   }
 }
 
+ssize_t deltafs_plfsdir_io_preadv(deltafs_plfsdir_t* __dir,
+                                  const struct iovec* __iov, int __iovcnt,
+                                  off_t __off) {
+  pdlfs::Status s;
+  size_t n = 0;
+
+  if (!IsSideIoOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (__iovcnt < 0 || (__iovcnt != 0 && !__iov)) {
+    s = BadArgs();
+  } else if (__iovcnt != 0) {
+    std::vector<char*> bufs;
+    std::vector<size_t> sizes;
+    bufs.reserve(__iovcnt);
+    sizes.reserve(__iovcnt);
+    for (int i = 0; i < __iovcnt; i++) {
+      bufs.push_back(static_cast<char*>(__iov[i].iov_base));
+      sizes.push_back(__iov[i].iov_len);
+    }
+    s = __dir->io_reader->ReadV(__off, &bufs[0], &sizes[0], bufs.size(), &n);
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return n;
+  }
+}
+
 int* deltafs_plfsdir_filter_get(deltafs_plfsdir_t* __dir, const char* __key,
                                 size_t __keylen, size_t* __sz) {
   pdlfs::Status s;
@@ -2443,13 +4019,17 @@ int deltafs_plfsdir_destroy(deltafs_plfsdir_t* __dir, const char* __name) {
   }
 }
 
-int deltafs_plfsdir_free_handle(deltafs_plfsdir_t* __dir) {
+static int DoPlfsdirFreeHandle(deltafs_plfsdir_t* __dir) {
   if (!__dir) return 0;
 
+  delete __dir->metrics_dumper;
+  delete __dir->perf_counters;
+  delete __dir->metrics;
   delete __dir->db;
   delete __dir->db_filter;
   delete __dir->writer;
   delete __dir->reader;
+  delete __dir->multi_reader;
   delete __dir->blk_writer_;
   delete __dir->blk_dst_;
   delete __dir->blk_reader_;
@@ -2462,11 +4042,20 @@ int deltafs_plfsdir_free_handle(deltafs_plfsdir_t* __dir) {
   delete __dir->io_reader;
   delete __dir->io_src;
   delete __dir->io_options;
+  delete[] __dir->numa_pools;
   delete __dir->io_env;
+  delete __dir->latency_stats;
+  delete __dir->tracer;
 
   free(__dir);
 
   return 0;
 }
 
+int deltafs_plfsdir_free_handle(deltafs_plfsdir_t* __dir) {
+  ApiCall call(pdlfs::kApiPlfsdirFreeHandle);
+  call.rec.handle = DirId(__dir);
+  return call.Done(DoPlfsdirFreeHandle(__dir));
+}
+
 }  // extern C
@@ -11,6 +11,7 @@
 
 #include "deltafs/deltafs_api.h"
 
+#include "api_trace.h"
 #include "plfsio/v1/cuckoo.h"
 #include "plfsio/v1/filter.h"
 #include "plfsio/v1/types.h"
@@ -43,14 +44,14 @@ class PlfsDirTest {
     }
   }
 
-  void OpenWriter(int io_engine) {
+  void OpenWriter(int io_engine, size_t key_size = 2) {
     const char* c = dirconf_.c_str();
     wdir_ = deltafs_plfsdir_create_handle(c, O_WRONLY, io_engine);
     ASSERT_TRUE(wdir_ != NULL);
     deltafs_plfsdir_set_unordered(wdir_, 0);
     deltafs_plfsdir_force_leveldb_fmt(wdir_, 0);
     deltafs_plfsdir_set_fixed_kv(wdir_, 1);
-    deltafs_plfsdir_set_key_size(wdir_, 2);
+    deltafs_plfsdir_set_key_size(wdir_, key_size);
     deltafs_plfsdir_set_val_size(wdir_, 2);
     deltafs_plfsdir_set_side_io_buf_size(wdir_, 4096);
     deltafs_plfsdir_destroy(wdir_, dirname_.c_str());
@@ -165,6 +166,322 @@ TEST(PlfsDirTest, SingleEpoch) {
   ASSERT_EQ(Get("k6"), "v6");
 }
 
+TEST(PlfsDirTest, AsyncEpochFlush) {
+  Put("k1", "v1");
+  long long t0 = deltafs_plfsdir_epoch_flush_async(wdir_, epoch_);
+  ASSERT_TRUE(t0 >= 0);
+  epoch_++;
+  Put("k1", "v2");  // Overlaps with the flush of the previous epoch
+  long long t1 = deltafs_plfsdir_epoch_flush_async(wdir_, epoch_);
+  ASSERT_TRUE(t1 > t0);
+  epoch_++;
+  ASSERT_TRUE(deltafs_plfsdir_wait_flush(wdir_, t0) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_poll_flush(wdir_, t0) == 1);
+  ASSERT_TRUE(deltafs_plfsdir_wait_flush(wdir_, t1) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_poll_flush(wdir_, t1) == 1);
+  ASSERT_TRUE(deltafs_plfsdir_poll_flush(wdir_, -1) == -1);
+  ASSERT_EQ(Get("k1"), "v1v2");
+}
+
+TEST(PlfsDirTest, PutBatch) {
+  OpenWriter(kDefEngine);
+  const char* keys[] = {"k1", "k2", "k3"};
+  const char* vals[] = {"v1", "v2", "v3"};
+  const size_t lens[] = {2, 2, 2};
+  ssize_t r =
+      deltafs_plfsdir_put_batch(wdir_, keys, lens, epoch_, vals, lens, 3);
+  ASSERT_TRUE(r == 6);
+  const char packed[] = "k4v4k5v5";
+  r = deltafs_plfsdir_put_packed(wdir_, packed, 2, 2, epoch_, 2);
+  ASSERT_TRUE(r == 4);
+  FinishEpoch();
+  ASSERT_EQ(Get("k1"), "v1");
+  ASSERT_EQ(Get("k2"), "v2");
+  ASSERT_EQ(Get("k3"), "v3");
+  ASSERT_EQ(Get("k4"), "v4");
+  ASSERT_EQ(Get("k5"), "v5");
+}
+
+TEST(PlfsDirTest, IntegerKeys) {
+  OpenWriter(kDefEngine, 8);
+  const uint64_t ids[] = {1ull << 40, 7, 300, 1ull << 40 | 1, 0};
+  char val[3];
+  for (int i = 0; i < 5; i++) {
+    snprintf(val, sizeof(val), "v%d", i);
+    ssize_t r = deltafs_plfsdir_put_u64(wdir_, ids[i], epoch_, val, 2);
+    ASSERT_TRUE(r == 2);
+  }
+  FinishEpoch();
+  Finish();
+  OpenReader(kDefEngine);
+  for (int i = 0; i < 5; i++) {
+    size_t sz = 0;
+    char* result =
+        deltafs_plfsdir_get_u64(rdir_, ids[i], -1, &sz, NULL, NULL);
+    ASSERT_TRUE(result != NULL);
+    snprintf(val, sizeof(val), "v%d", i);
+    ASSERT_EQ(Slice(result, sz), val);
+    free(result);
+  }
+  // Keys are stored big-endian
+  std::string key("\x00\x00\x00\x00\x00\x00\x01\x2c", 8);
+  ASSERT_EQ(Get(key), "v2");
+}
+
+TEST(PlfsDirTest, MultiGet) {
+  Put("k1", "v1");
+  Put("k2", "v2");
+  FinishEpoch();
+  Put("k1", "v3");
+  FinishEpoch();
+  Finish();
+  OpenReader(kDefEngine);
+  const char* keys[] = {"k2", "k1", "k0"};
+  const size_t lens[] = {2, 2, 2};
+  char* vals[3];
+  size_t sizes[3];
+  int r = deltafs_plfsdir_multiget(rdir_, keys, lens, 3, -1, vals, sizes, NULL,
+                                   NULL);
+  ASSERT_TRUE(r == 0);
+  ASSERT_EQ(Slice(vals[0], sizes[0]), "v2");
+  ASSERT_EQ(Slice(vals[1], sizes[1]), "v1v3");
+  ASSERT_TRUE(vals[2] == NULL && sizes[2] == 0);
+  free(vals[0]);
+  free(vals[1]);
+}
+
+namespace {
+int SaveEpochValue(void* arg, int epoch, const char* value, size_t sz) {
+  std::string* const dst = reinterpret_cast<std::string*>(arg);
+  char tmp[20];
+  snprintf(tmp, sizeof(tmp), "%d:", epoch);
+  dst->append(tmp);
+  dst->append(value, sz);
+  dst->append(";");
+  return 0;
+}
+}  // namespace
+
+TEST(PlfsDirTest, GetIntoBuffer) {
+  Put("k1", "v1");
+  FinishEpoch();
+  Put("k1", "v2");
+  FinishEpoch();
+  Finish();
+  OpenReader(kDefEngine);
+  char buf[8];
+  // Probe the size first
+  ssize_t r = deltafs_plfsdir_get_into(rdir_, "k1", 2, -1, NULL, 0, NULL, NULL);
+  ASSERT_TRUE(r == 4);
+  r = deltafs_plfsdir_get_into(rdir_, "k1", 2, -1, buf, 3, NULL, NULL);
+  ASSERT_TRUE(r == 4);
+  ASSERT_EQ(Slice(buf, 3), "v1v");
+  r = deltafs_plfsdir_get_into(rdir_, "k1", 2, -1, buf, sizeof(buf), NULL,
+                               NULL);
+  ASSERT_TRUE(r == 4);
+  ASSERT_EQ(Slice(buf, r), "v1v2");
+  r = deltafs_plfsdir_get_into(rdir_, "k0", 2, -1, buf, sizeof(buf), NULL,
+                               NULL);
+  ASSERT_TRUE(r == 0);
+  std::string values;
+  r = deltafs_plfsdir_get_each(rdir_, "k1", 2, -1, SaveEpochValue, &values);
+  ASSERT_TRUE(r == 2);
+  ASSERT_EQ(values, "0:v1;1:v2;");
+}
+
+TEST(PlfsDirTest, GetWithStats) {
+  Put("k1", "v1");
+  FinishEpoch();
+  Put("k2", "v2");
+  FinishEpoch();
+  Finish();
+  OpenReader(kDefEngine);
+  deltafs_plfsdir_read_stats_t stats;
+  size_t sz = 0;
+  char* result =
+      deltafs_plfsdir_get_with_stats(rdir_, "k2", 2, -1, &sz, &stats);
+  ASSERT_TRUE(result != NULL);
+  ASSERT_EQ(Slice(result, sz), "v2");
+  free(result);
+  ASSERT_TRUE(stats.seeks == 1);
+  ASSERT_TRUE(stats.bytes_read != 0);
+  ASSERT_TRUE(stats.filter_probes != 0);
+}
+
+TEST(PlfsDirTest, Metrics) {
+  Put("k1", "v1");
+  Put("k2", "v2");
+  FinishEpoch();
+  ASSERT_EQ(deltafs_plfsdir_get_integer_property(wdir_, "num_keys"), 2);
+  char* json = deltafs_plfsdir_get_property(wdir_, "metrics.json");
+  ASSERT_TRUE(json != NULL);
+  ASSERT_TRUE(strstr(json, "\"plfsdir.num_keys\":2") != NULL);
+  ASSERT_TRUE(strstr(json, "\"plfsdir.latency.put\":{\"count\":2") != NULL);
+  free(json);
+  char* text = deltafs_plfsdir_get_property(wdir_, "metrics.prometheus");
+  ASSERT_TRUE(text != NULL);
+  ASSERT_TRUE(strstr(text, "plfsdir_num_keys 2\n") != NULL);
+  free(text);
+}
+
+static int AppendValue(void* arg, const char* key, size_t keylen,
+                       const char* value, size_t sz) {
+  reinterpret_cast<std::string*>(arg)->append(value, sz);
+  return 0;
+}
+
+TEST(PlfsDirTest, RangeScan) {
+  Put("k1", "v1");
+  Put("k2", "v2");
+  Put("k3", "v3");
+  FinishEpoch();
+  Put("k4", "v4");
+  FinishEpoch();
+  Finish();
+  OpenReader(kDefEngine);
+  std::string tmp;
+  ssize_t r = deltafs_plfsdir_range_scan(rdir_, -1, "k2", 2, "k4", 2,
+                                         AppendValue, &tmp);
+  ASSERT_TRUE(r == 2);
+  ASSERT_EQ(tmp, "v2v3");
+  tmp.clear();
+  r = deltafs_plfsdir_range_scan(rdir_, -1, "k3", 2, NULL, 0, AppendValue,
+                                 &tmp);
+  ASSERT_TRUE(r == 2);
+  ASSERT_EQ(tmp, "v3v4");
+}
+
+namespace {
+struct BatchList {
+  std::string values;
+  std::vector<size_t> batches;
+  size_t max_batches;
+};
+
+int AppendBatch(void* arg, size_t n, const char* const* keys,
+                const size_t* keylens, const char* const* values,
+                const size_t* sizes) {
+  BatchList* const list = reinterpret_cast<BatchList*>(arg);
+  list->batches.push_back(n);
+  for (size_t i = 0; i < n; i++) {
+    list->values.append(values[i], sizes[i]);
+  }
+  return list->batches.size() >= list->max_batches ? -1 : 0;
+}
+}  // namespace
+
+TEST(PlfsDirTest, BatchScan) {
+  Put("k1", "v1");
+  Put("k2", "v2");
+  Put("k3", "v3");
+  Put("k4", "v4");
+  Put("k5", "v5");
+  FinishEpoch();
+  Finish();
+  OpenReader(kDefEngine);
+  std::string expected;
+  ssize_t r = deltafs_plfsdir_scan(rdir_, -1, AppendValue, &expected);
+  ASSERT_TRUE(r == 5);
+  BatchList list;
+  list.max_batches = 10;
+  r = deltafs_plfsdir_batch_scan(rdir_, -1, NULL, 0, NULL, 0, 2, AppendBatch,
+                                 &list);
+  ASSERT_TRUE(r == 5);
+  ASSERT_EQ(list.values, expected);
+  ASSERT_EQ(list.batches.size(), 3);
+  ASSERT_EQ(list.batches[0], 2);
+  ASSERT_EQ(list.batches[2], 1);
+  // Stop after the first batch
+  list.values.clear();
+  list.batches.clear();
+  list.max_batches = 1;
+  r = deltafs_plfsdir_batch_scan(rdir_, -1, NULL, 0, NULL, 0, 2, AppendBatch,
+                                 &list);
+  ASSERT_TRUE(r == 2);
+  ASSERT_EQ(list.batches.size(), 1);
+}
+
+TEST(PlfsDirTest, IndexCache) {
+  Put("k1", "v1");
+  Put("k2", "v2");
+  FinishEpoch();
+  Finish();
+  deltafs_cache_t* cache = deltafs_cache_init(1 << 20);
+  ASSERT_TRUE(cache != NULL);
+  rdir_ = deltafs_plfsdir_create_handle(dirconf_.c_str(), O_RDONLY, kDefEngine);
+  ASSERT_TRUE(rdir_ != NULL);
+  ASSERT_TRUE(deltafs_plfsdir_set_index_cache(rdir_, cache) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_open(rdir_, dirname_.c_str()) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_io_open(rdir_, dirname_.c_str()) == 0);
+  ASSERT_EQ(Get("k1"), "v1");
+  ASSERT_EQ(Get("k2"), "v2");
+  deltafs_plfsdir_free_handle(rdir_);
+  rdir_ = NULL;
+  deltafs_cache_close(cache);
+}
+
+TEST(PlfsDirTest, IoVec) {
+  OpenWriter(DELTAFS_PLFSDIR_DEFAULT);
+  IoWrite("a");
+  std::string big(8192, 'x');  // Larger than the side io buffer
+  struct iovec iov[3];
+  iov[0].iov_base = const_cast<char*>("hdr");
+  iov[0].iov_len = 3;
+  iov[1].iov_base = &big[0];
+  iov[1].iov_len = big.size();
+  iov[2].iov_base = const_cast<char*>("bc");
+  iov[2].iov_len = 2;
+  ASSERT_EQ(deltafs_plfsdir_io_appendv(wdir_, iov, 3), 8197);
+  ASSERT_EQ(deltafs_plfsdir_io_appendv(wdir_, iov, 1), 3);  // Buffered
+  IoWrite("z");
+  FinishEpoch();
+  Finish();
+  OpenReader(DELTAFS_PLFSDIR_DEFAULT);
+  char b0[4], b1[8192], b2[16];
+  iov[0].iov_base = b0;
+  iov[0].iov_len = sizeof(b0);
+  iov[1].iov_base = b1;
+  iov[1].iov_len = sizeof(b1);
+  iov[2].iov_base = b2;
+  iov[2].iov_len = sizeof(b2);
+  ASSERT_EQ(deltafs_plfsdir_io_preadv(rdir_, iov, 3, 0), 8202);
+  ASSERT_EQ(Slice(b0, 4), "ahdr");
+  ASSERT_EQ(Slice(b1, sizeof(b1)), Slice(big));
+  ASSERT_EQ(Slice(b2, 6), "bchdrz");
+}
+
+TEST(PlfsDirTest, MultiDir) {
+  Put("k1", "v1");
+  Put("k2", "v2");
+  FinishEpoch();
+  Finish();
+  // Rank 1 writes into the same parent directory
+  deltafs_plfsdir_t* dir =
+      deltafs_plfsdir_create_handle(dirconf_.c_str(), O_WRONLY, kDefEngine);
+  ASSERT_TRUE(dir != NULL);
+  deltafs_plfsdir_force_leveldb_fmt(dir, 0);
+  deltafs_plfsdir_set_fixed_kv(dir, 1);
+  deltafs_plfsdir_set_key_size(dir, 2);
+  deltafs_plfsdir_set_val_size(dir, 2);
+  deltafs_plfsdir_set_rank(dir, 1);
+  ASSERT_TRUE(deltafs_plfsdir_open(dir, dirname_.c_str()) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_put(dir, "k2", 2, 0, "w2", 2) == 2);
+  ASSERT_TRUE(deltafs_plfsdir_put(dir, "k3", 2, 0, "w3", 2) == 2);
+  ASSERT_TRUE(deltafs_plfsdir_epoch_flush(dir, 0) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_finish(dir) == 0);
+  deltafs_plfsdir_free_handle(dir);
+  rdir_ = deltafs_plfsdir_create_handle(dirconf_.c_str(), O_RDONLY, kDefEngine);
+  ASSERT_TRUE(rdir_ != NULL);
+  const char* names[2] = {dirname_.c_str(), dirname_.c_str()};
+  const int ranks[2] = {0, 1};
+  ASSERT_TRUE(deltafs_plfsdir_open_multi(rdir_, names, ranks, 2) == 0);
+  ASSERT_EQ(Get("k1"), "v1");
+  ASSERT_EQ(Get("k2"), "v2w2");
+  ASSERT_EQ(Get("k3"), "w3");
+  ASSERT_EQ(Get("k4"), "");
+  ASSERT_TRUE(deltafs_plfsdir_count(rdir_, -1) == -1);
+}
+
 TEST(PlfsDirTest, PdbEmpty) {
   OpenWriter(DELTAFS_PLFSDIR_PLAINDB);
   FinishEpoch();
@@ -201,6 +518,66 @@ TEST(PlfsDirTest, PdbRw) {
   ASSERT_EQ(Get("k6"), "v6");
 }
 
+TEST(PlfsDirTest, PdbBlockCache) {
+  dirconf_ = "block_cache_size=1048576";
+  OpenWriter(DELTAFS_PLFSDIR_PLAINDB);
+  Put("k3", "v3");
+  Put("k1", "v1");
+  Put("k2", "v2");
+  Flush();
+  Put("k5", "v5");
+  Put("k4", "v4");
+  FinishEpoch();
+  Finish();
+  OpenReader(DELTAFS_PLFSDIR_PLAINDB);
+  for (int i = 0; i < 2; i++) {  // The second pass is served by the cache
+    ASSERT_EQ(Get("k1"), "v1");
+    ASSERT_EQ(Get("k2"), "v2");
+    ASSERT_EQ(Get("k3"), "v3");
+    ASSERT_EQ(Get("k4"), "v4");
+    ASSERT_EQ(Get("k5"), "v5");
+    ASSERT_TRUE(Get("k0").empty());
+  }
+}
+
+class ApiTraceTest {};
+
+TEST(ApiTraceTest, WriteAndRead) {
+  Env* const env = Env::Default();
+  const std::string fname = test::TmpDir() + "/apitrace_test.bin";
+  {
+    ApiTraceLog log(env, fname);
+    ASSERT_OK(log.Open());
+    ApiTraceRecord rec;
+    for (int i = 0; i < 3; i++) {
+      rec.op = kApiPlfsdirPut;
+      rec.micros = log.NowMicros();
+      rec.thread = log.ThreadId();
+      rec.result = i == 2 ? -1 : 100;
+      rec.handle = 7;
+      rec.size = 100;
+      rec.offset = i;
+      rec.path = "/p";
+      rec.key = std::string(i + 1, 'k');
+      log.Add(rec);
+    }
+    ASSERT_EQ(log.NumDropped(), 0);
+  }
+  std::vector<std::string> ops;
+  std::vector<ApiTraceRecord> records;
+  ASSERT_OK(ReadApiTrace(env, fname, &ops, &records));
+  ASSERT_EQ(ops.size(), size_t(kNumApiTraceOps));
+  ASSERT_EQ(ops[kApiPlfsdirPut], "plfsdir_put");
+  ASSERT_EQ(records.size(), 3);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(int(records[i].op), int(kApiPlfsdirPut));
+    ASSERT_EQ(records[i].thread, 0);
+    ASSERT_EQ(records[i].result, i == 2 ? -1 : 100);
+    ASSERT_EQ(records[i].offset, i);
+    ASSERT_EQ(records[i].key, std::string(i + 1, 'k'));
+  }
+}
+
 class PlfsWiscBench {
   static int FromEnv(const char* key, int def) {
     const char* env = getenv(key);
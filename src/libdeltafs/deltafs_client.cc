@@ -198,6 +198,13 @@ Client::Client(size_t max_open_files) {
   fds_ = new File*[max_open_fds_]();
   num_open_fds_ = 0;
   fd_slot_ = 0;
+  wb_reserved_ = 0;
+  wb_size_ = 0;
+  wb_budget_ = 0;
+  wb_timeout_ = 0;
+  rb_reserved_ = 0;
+  rb_size_ = 0;
+  rb_budget_ = 0;
 }
 
 Client::~Client() {
@@ -205,6 +212,7 @@ Client::~Client() {
   delete mdscli_;
   delete mdsfty_;
   delete fio_;
+  delete reader_pool_;
   delete env_;
 }
 
@@ -214,30 +222,45 @@ Client::~Client() {
 size_t Client::Alloc(File* f) {
   mutex_.AssertHeld();
   assert(num_open_fds_ < max_open_fds_);
-  while (fds_[fd_slot_] != NULL) {
+  while (true) {
+    MutexLock ml(FdMutex(static_cast<int>(fd_slot_)));
+    if (fds_[fd_slot_] == NULL) {
+      fds_[fd_slot_] = f;
+      break;
+    }
     fd_slot_ = (1 + fd_slot_) % max_open_fds_;
   }
-  fds_[fd_slot_] = f;
   num_open_fds_++;
   return fd_slot_;
 }
 
 // Deallocate a given file descriptor slot.
-// The associated file entry is not un-referenced.
-// REQUIRES: mutex_ has been locked.
+// The associated file entry is not un-referenced. The slot may be reused
+// right away while num_open_fds_ is updated once *mu is released.
+// REQUIRES: *mu, the mutex of the descriptor, has been locked.
 Client::File* Client::Free(size_t index) {
-  mutex_.AssertHeld();
+  port::Mutex* const mu = FdMutex(static_cast<int>(index));
+  mu->AssertHeld();
   File* f = fds_[index];
   assert(f != NULL);
   fds_[index] = NULL;
-  assert(num_open_fds_ > 0);
-  num_open_fds_--;
+  mu->Unlock();
+  {
+    MutexLock ml(&mutex_);
+    assert(num_open_fds_ > 0);
+    num_open_fds_--;
+  }
+  mu->Lock();
   return f;
 }
 
+// If "buffered" is true, writes to the file are buffered and reads from the
+// file may be read ahead, subject to the memory budgets of write-back and
+// read-ahead buffers. Otherwise, all I/O goes straight to storage.
 // REQUIRES: less than "max_open_files_" files have been opened.
 // REQUIRES: mutex_ has been locked.
-size_t Client::Open(const Slice& encoding, int flags, Fio::Handle* fh) {
+size_t Client::Open(const Slice& encoding, int flags, Fio::Handle* fh,
+                    bool buffered) {
   assert(encoding.size() != 0);
   File* file = static_cast<File*>(malloc(sizeof(File) + encoding.size() - 1));
   memcpy(file->encoding_data, encoding.data(), encoding.size());
@@ -251,19 +274,65 @@ size_t Client::Open(const Slice& encoding, int flags, Fio::Handle* fh) {
   file->flags = flags;
   file->refs = 1;
   file->fh = fh;
+  file->wb = NULL;
+  file->rb = NULL;
+  if (buffered && (flags & O_ACCMODE) == O_RDONLY && rb_size_ != 0) {
+    if (rb_reserved_ + rb_size_ <= rb_budget_) {
+      rb_reserved_ += rb_size_;
+      file->rb = new ReadBuffer;
+      file->rb->off = 0;
+      file->rb->pos = 0;
+      file->rb->next_off = 0;
+      file->rb->seq_reads = 0;
+      file->rb->mtime = 0;
+    }
+  } else if (buffered && wb_size_ != 0) {
+    if (wb_reserved_ + wb_size_ <= wb_budget_) {
+      wb_reserved_ += wb_size_;
+      file->wb = new WriteBuffer;
+      file->wb->off = 0;
+      file->wb->append = true;
+      file->wb->birth = 0;
+    }
+  }
   return Alloc(file);
 }
 
-// REQUIRES: mutex_ has been locked.
-void Client::Unref(File* f, const Fentry& fentry) {
-  mutex_.AssertHeld();
+// Drop a reference to a file. The file is closed once it has been removed
+// from the descriptor table and its last reference is dropped.
+// REQUIRES: *mu, the mutex of the descriptor of the file, has been locked.
+void Client::Unref(port::Mutex* mu, File* f, const Fentry& fentry) {
+  mu->AssertHeld();
   assert(f->refs > 0);
   f->refs--;
   if (f->refs == 0) {
+    // The file is no longer reachable through the descriptor table
+    mu->Unlock();
+    {
+      MutexLock ml(&mutex_);
+      Destroy(f, fentry);
+    }
+    mu->Lock();
+  }
+}
+
+// REQUIRES: mutex_ has been locked.
+void Client::Destroy(File* f, const Fentry& fentry) {
+  mutex_.AssertHeld();
+  assert(f->refs == 0);
+  {
     f->next->prev = f->prev;
     f->prev->next = f->next;
     if (!DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
       if (S_ISREG(fentry.file_mode())) {
+        if (f->wb != NULL) {
+          MutexLock ml(&f->wb->mu);
+          // Only left by writes racing with Close(), which reports
+          // the errors of all other buffered writes
+          if (!f->wb->data.empty()) {
+            WriteBack(f->wb, fentry, f->fh);  // Ignore errors
+          }
+        }
         fio_->Close(fentry, f->fh);
       } else {
         assert(f->fh == NULL);
@@ -285,6 +354,16 @@ void Client::Unref(File* f, const Fentry& fentry) {
         assert(false);
       }
     }
+    if (f->wb != NULL) {
+      assert(wb_reserved_ >= wb_size_);
+      wb_reserved_ -= wb_size_;
+      delete f->wb;
+    }
+    if (f->rb != NULL) {
+      assert(rb_reserved_ >= rb_size_);
+      rb_reserved_ -= rb_size_;
+      delete f->rb;
+    }
     free(f);
   }
 }
@@ -349,19 +428,28 @@ Status Client::Fopenat(int fd, const char* path, int flags, mode_t mode,
                        FileInfo* info) {
   Status s;
   Fentry fentry;
-  MutexLock ml(&mutex_);
+  port::Mutex* const mu = FdMutex(fd);
+  MutexLock ml(mu);
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     s = BadDescriptor();
-  } else if (num_open_fds_ < max_open_fds_) {
-    FileAndEntry at;
-    at.ent = &fentry;
-    at.file = file;
-    std::string p = "/";
-    p += path;
-    s = InternalOpen(p, flags, mode, &at, info);
   } else {
-    s = Status::TooManyOpens(Slice());
+    file->refs++;  // Ref
+    mu->Unlock();
+    mutex_.Lock();
+    if (num_open_fds_ < max_open_fds_) {
+      FileAndEntry at;
+      at.ent = &fentry;
+      at.file = file;
+      std::string p = "/";
+      p += path;
+      s = InternalOpen(p, flags, mode, &at, info);
+    } else {
+      s = Status::TooManyOpens(Slice());
+    }
+    mutex_.Unlock();
+    mu->Lock();
+    Unref(mu, file, fentry);
   }
 
 #if VERBOSE >= OP_VERBOSE_LEVEL
@@ -655,7 +743,9 @@ Status Client::InternalOpen(const Slice& path, int flags, mode_t mode,
       fentry.stat.SetFileSize(size);
       fentry.stat.SetModifyTime(mtime);
 
-      info->fd = Open(encoding, flags, fh);  // fh could be NULL
+      const bool buffered = !DELTAFS_DIR_IS_PLFS_STYLE(my_file_mode) &&
+                            S_ISREG(my_file_mode);
+      info->fd = Open(encoding, flags, fh, buffered);  // fh could be NULL
       info->stat = fentry.stat;
     }
   }
@@ -679,7 +769,7 @@ bool Client::IsWriteOk(const File* f) {
   }
 }
 
-// REQUIRES: mutex_ has been locked.
+// REQUIRES: the mutex of the descriptor has been locked.
 Client::File* Client::FetchFile(int fd, Fentry* result) {
   size_t index = fd;
   if (index < max_open_fds_) {
@@ -700,7 +790,8 @@ Client::File* Client::FetchFile(int fd, Fentry* result) {
 }
 
 Status Client::Fstat(int fd, Stat* statbuf) {
-  MutexLock ml(&mutex_);
+  port::Mutex* const mu = FdMutex(fd);
+  MutexLock ml(mu);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
@@ -710,25 +801,36 @@ Status Client::Fstat(int fd, Stat* statbuf) {
     file->refs++;  // Ref
     if (!DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
       if (S_ISREG(fentry.file_mode())) {
-        mutex_.Unlock();
+        mu->Unlock();
         uint64_t mtime = 0;
         uint64_t size = 0;
-        s = fio_->Fstat(fentry, file->fh, &mtime, &size);
+        s = SyncWriteBuffer(file, fentry);
+        if (s.ok()) {
+          s = fio_->Fstat(fentry, file->fh, &mtime, &size);
+        }
+        if (s.ok() && file->rb != NULL) {
+          MutexLock l(&file->rb->mu);
+          if (file->rb->mtime != mtime) {  // Drop potentially stale data
+            file->rb->data.clear();
+            file->rb->mtime = mtime;
+          }
+        }
         if (s.ok()) {
           fentry.stat.SetModifyTime(mtime);
           fentry.stat.SetFileSize(size);
         }
-        mutex_.Lock();
+        mu->Lock();
       }
     }
     if (s.ok()) *statbuf = fentry.stat;
-    Unref(file, fentry);
+    Unref(mu, file, fentry);
     return s;
   }
 }
 
 Status Client::Pwrite(int fd, const Slice& data, uint64_t off) {
-  MutexLock ml(&mutex_);
+  port::Mutex* const mu = FdMutex(fd);
+  MutexLock ml(mu);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
@@ -740,25 +842,28 @@ Status Client::Pwrite(int fd, const Slice& data, uint64_t off) {
   } else {
     Status s;
     file->refs++;  // Ref
-    mutex_.Unlock();
+    mu->Unlock();
     if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
       plfsio::DirWriter* writer = ToWritablePlfsFile(file->fh)->parent->writer;
       assert(writer != NULL);
       s = writer->Add(fentry.nhash, data);
+    } else if (file->wb != NULL) {
+      s = BufferedWrite(file, fentry, data, false, off);
     } else {
       s = fio_->Pwrite(fentry, file->fh, data, off);
     }
-    mutex_.Lock();
+    mu->Lock();
     if (s.ok()) {
       file->seq_write++;
     }
-    Unref(file, fentry);
+    Unref(mu, file, fentry);
     return s;
   }
 }
 
 Status Client::Write(int fd, const Slice& data) {
-  MutexLock ml(&mutex_);
+  port::Mutex* const mu = FdMutex(fd);
+  MutexLock ml(mu);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
@@ -770,25 +875,28 @@ Status Client::Write(int fd, const Slice& data) {
   } else {
     Status s;
     file->refs++;  // Ref
-    mutex_.Unlock();
+    mu->Unlock();
     if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
       plfsio::DirWriter* writer = ToWritablePlfsFile(file->fh)->parent->writer;
       assert(writer != NULL);
       s = writer->Add(fentry.nhash, data);
+    } else if (file->wb != NULL) {
+      s = BufferedWrite(file, fentry, data, true, 0);
     } else {
       s = fio_->Write(fentry, file->fh, data);
     }
-    mutex_.Lock();
+    mu->Lock();
     if (s.ok()) {
       file->seq_write++;
     }
-    Unref(file, fentry);
+    Unref(mu, file, fentry);
     return s;
   }
 }
 
 Status Client::Ftruncate(int fd, uint64_t len) {
-  MutexLock ml(&mutex_);
+  port::Mutex* const mu = FdMutex(fd);
+  MutexLock ml(mu);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
@@ -802,13 +910,16 @@ Status Client::Ftruncate(int fd, uint64_t len) {
   } else {
     Status s;
     file->refs++;  // Ref
-    mutex_.Unlock();
-    s = fio_->Ftrunc(fentry, file->fh, len);
-    mutex_.Lock();
+    mu->Unlock();
+    s = SyncWriteBuffer(file, fentry);
+    if (s.ok()) {
+      s = fio_->Ftrunc(fentry, file->fh, len);
+    }
+    mu->Lock();
     if (s.ok()) {
       file->seq_write++;
     }
-    Unref(file, fentry);
+    Unref(mu, file, fentry);
     return s;
   }
 }
@@ -818,7 +929,8 @@ Status Client::Ftruncate(int fd, uint64_t len) {
 // If fd refers to a normal file, we sync its data and update its metadata.
 // If fd refers to a normal directory, we don't yet have that logic.
 Status Client::Fdatasync(int fd) {
-  MutexLock ml(&mutex_);
+  port::Mutex* const mu = FdMutex(fd);
+  MutexLock ml(mu);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
@@ -828,29 +940,33 @@ Status Client::Fdatasync(int fd) {
     if (S_ISDIR(fentry.file_mode())) {
       plfsio::DirWriter* writer = ToWritablePlfsDir(file->fh)->writer;
       assert(writer != NULL);
-      mutex_.Unlock();
+      mu->Unlock();
       s = writer->Flush();
-      mutex_.Lock();
+      mu->Lock();
     }
     return s;
   } else if (!S_ISREG(fentry.file_mode())) {
     return Status::NotSupported(Slice());
   } else if (IsWriteOk(file)) {
-    return InternalFdatasync(file, fentry);
+    return InternalFdatasync(mu, file, fentry);
   } else {
     return Status::OK();
   }
 }
 
-Status Client::InternalFdatasync(File* file, const Fentry& fentry) {
+Status Client::InternalFdatasync(port::Mutex* mu, File* file,
+                                 const Fentry& fentry) {
   Status s;
   uint64_t mtime;
   uint64_t size;
   uint32_t seq_write = file->seq_write;
   uint32_t seq_flush = file->seq_flush;
   file->refs++;  // Ref
-  mutex_.Unlock();
-  s = fio_->Flush(fentry, file->fh, true /*force*/);
+  mu->Unlock();
+  s = SyncWriteBuffer(file, fentry);
+  if (s.ok()) {
+    s = fio_->Flush(fentry, file->fh, true /*force*/);
+  }
   if (s.ok()) {
     if (seq_flush < seq_write) {
       s = fio_->Fstat(fentry, file->fh, &mtime, &size, true /*skip_cache*/);
@@ -859,19 +975,139 @@ Status Client::InternalFdatasync(File* file, const Fentry& fentry) {
       }
     }
   }
-  mutex_.Lock();
+  mu->Lock();
   if (s.ok()) {
     if (seq_write > file->seq_flush) {
       file->seq_flush = seq_write;
     }
   }
-  Unref(file, fentry);
+  Unref(mu, file, fentry);
+  return s;
+}
+
+// Send the buffered data of a write-back buffer to storage. The buffer is
+// emptied even if the write fails, in which case the error is returned.
+// REQUIRES: wb->mu has been locked.
+Status Client::WriteBack(WriteBuffer* wb, const Fentry& fentry,
+                         Fio::Handle* fh) {
+  wb->mu.AssertHeld();
+  Status s;
+  if (wb->append) {
+    s = fio_->Write(fentry, fh, wb->data);
+  } else {
+    s = fio_->Pwrite(fentry, fh, wb->data, wb->off);
+  }
+  wb->data.clear();
+  return s;
+}
+
+Status Client::SyncWriteBuffer(File* file, const Fentry& fentry) {
+  Status s;
+  WriteBuffer* const wb = file->wb;
+  if (wb != NULL) {
+    MutexLock ml(&wb->mu);
+    if (!wb->data.empty()) {
+      s = WriteBack(wb, fentry, file->fh);
+    }
+  }
+  return s;
+}
+
+// Coalesce a write with the data already in the write-back buffer of a file.
+// Buffered data is written out first if the new write is not contiguous with
+// it or does not fit in the buffer. Writes no smaller than the buffer go
+// straight to storage. Errors from writing out buffered data are reported
+// by the write that triggered the write-back.
+// REQUIRES: file->wb is not NULL.
+Status Client::BufferedWrite(File* file, const Fentry& fentry,
+                             const Slice& data, bool append, uint64_t off) {
+  Status s;
+  WriteBuffer* const wb = file->wb;
+  assert(wb != NULL);
+  MutexLock ml(&wb->mu);
+  if (!wb->data.empty()) {
+    bool contiguous;
+    if (append) {
+      contiguous = wb->append;
+    } else {
+      contiguous = !wb->append && off == wb->off + wb->data.size();
+    }
+    if (!contiguous || wb->data.size() + data.size() > wb_size_) {
+      s = WriteBack(wb, fentry, file->fh);
+    }
+  }
+  if (!s.ok()) {
+    // Error
+  } else if (data.size() >= wb_size_) {
+    if (append) {
+      s = fio_->Write(fentry, file->fh, data);
+    } else {
+      s = fio_->Pwrite(fentry, file->fh, data, off);
+    }
+  } else {
+    const uint64_t now = CurrentMicros();
+    if (wb->data.empty()) {
+      wb->append = append;
+      wb->off = off;
+      wb->birth = now;
+    }
+    wb->data.append(data.data(), data.size());
+    if (wb->data.size() >= wb_size_ || now - wb->birth >= wb_timeout_) {
+      s = WriteBack(wb, fentry, file->fh);
+    }
+  }
+  return s;
+}
+
+// Read from a file through its read-ahead buffer. Reads that are fully
+// covered by the buffer are served from memory. Otherwise, if the last few
+// reads were sequential, a full read-ahead window starting at the requested
+// offset is fetched into the buffer; random reads go straight to storage.
+// REQUIRES: rb->mu has been locked.
+Status Client::CachedPread(ReadBuffer* rb, const Fentry& fentry,
+                           Fio::Handle* fh, Slice* result, uint64_t off,
+                           uint64_t size, char* scratch) {
+  rb->mu.AssertHeld();
+  Status s;
+  if (off >= rb->off && off + size <= rb->off + rb->data.size()) {
+    memcpy(scratch, rb->data.data() + (off - rb->off), size);
+    *result = Slice(scratch, size);
+  } else {
+    if (off == rb->next_off) {
+      rb->seq_reads++;
+    } else {
+      rb->seq_reads = 0;
+    }
+    if (rb->seq_reads >= 2 && size < rb_size_) {
+      rb->data.resize(rb_size_);
+      Slice r;
+      s = fio_->Pread(fentry, fh, &r, off, rb_size_, &rb->data[0]);
+      if (s.ok()) {
+        if (r.data() != rb->data.data()) {
+          memmove(&rb->data[0], r.data(), r.size());
+        }
+        rb->data.resize(r.size());
+        rb->off = off;
+        const size_t n = std::min(static_cast<size_t>(size), rb->data.size());
+        memcpy(scratch, rb->data.data(), n);
+        *result = Slice(scratch, n);
+      } else {
+        rb->data.clear();
+      }
+    } else {
+      s = fio_->Pread(fentry, fh, result, off, size, scratch);
+    }
+  }
+  if (s.ok()) {
+    rb->next_off = off + result->size();
+  }
   return s;
 }
 
 Status Client::Pread(int fd, Slice* result, uint64_t off, uint64_t size,
                      char* scratch) {
-  MutexLock ml(&mutex_);
+  port::Mutex* const mu = FdMutex(fd);
+  MutexLock ml(mu);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
@@ -883,20 +1119,30 @@ Status Client::Pread(int fd, Slice* result, uint64_t off, uint64_t size,
   } else {
     Status s;
     file->refs++;  // Ref
-    mutex_.Unlock();
-    if (!DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
-      s = fio_->Pread(fentry, file->fh, result, off, size, scratch);
-    } else {
+    mu->Unlock();
+    if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
       // TODO
+    } else {
+      s = SyncWriteBuffer(file, fentry);  // Make buffered writes visible
+      if (!s.ok()) {
+        // Error
+      } else if (file->rb != NULL) {
+        MutexLock l(&file->rb->mu);
+        s = CachedPread(file->rb, fentry, file->fh, result, off, size,
+                        scratch);
+      } else {
+        s = fio_->Pread(fentry, file->fh, result, off, size, scratch);
+      }
     }
-    mutex_.Lock();
-    Unref(file, fentry);
+    mu->Lock();
+    Unref(mu, file, fentry);
     return s;
   }
 }
 
 Status Client::Read(int fd, Slice* result, uint64_t size, char* scratch) {
-  MutexLock ml(&mutex_);
+  port::Mutex* const mu = FdMutex(fd);
+  MutexLock ml(mu);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
@@ -908,9 +1154,21 @@ Status Client::Read(int fd, Slice* result, uint64_t size, char* scratch) {
   } else {
     Status s;
     file->refs++;  // Ref
-    mutex_.Unlock();
+    mu->Unlock();
     if (!DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
-      s = fio_->Read(fentry, file->fh, result, size, scratch);
+      s = SyncWriteBuffer(file, fentry);  // Make buffered writes visible
+      if (!s.ok()) {
+        // Error
+      } else if (file->rb != NULL) {
+        ReadBuffer* const rb = file->rb;
+        MutexLock l(&rb->mu);
+        s = CachedPread(rb, fentry, file->fh, result, rb->pos, size, scratch);
+        if (s.ok()) {
+          rb->pos += result->size();
+        }
+      } else {
+        s = fio_->Read(fentry, file->fh, result, size, scratch);
+      }
     } else {
       plfsio::DirReader* reader = ToReadablePlfsFile(file->fh)->parent->reader;
       assert(reader != NULL);
@@ -927,8 +1185,8 @@ Status Client::Read(int fd, Slice* result, uint64_t size, char* scratch) {
         *result = Slice();
       }
     }
-    mutex_.Lock();
-    Unref(file, fentry);
+    mu->Lock();
+    Unref(mu, file, fentry);
     return s;
   }
 }
@@ -938,7 +1196,8 @@ Status Client::Read(int fd, Slice* result, uint64_t size, char* scratch) {
 // If fd refers to a normal file, we flush its data and update its metadata.
 // If fd refers to a normal directory, we don't yet have that logic.
 Status Client::Flush(int fd) {
-  MutexLock ml(&mutex_);
+  port::Mutex* const mu = FdMutex(fd);
+  MutexLock ml(mu);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
@@ -948,29 +1207,33 @@ Status Client::Flush(int fd) {
     if (S_ISDIR(fentry.file_mode())) {
       plfsio::DirWriter* writer = ToWritablePlfsDir(file->fh)->writer;
       assert(writer != NULL);
-      mutex_.Unlock();
+      mu->Unlock();
       s = writer->EpochFlush();
-      mutex_.Lock();
+      mu->Lock();
     }
     return s;
   } else if (!S_ISREG(fentry.file_mode())) {
     return Status::NotSupported(Slice());
   } else if (IsWriteOk(file)) {
-    return InternalFlush(file, fentry);
+    return InternalFlush(mu, file, fentry);
   } else {
     return Status::OK();
   }
 }
 
-Status Client::InternalFlush(File* file, const Fentry& fentry) {
+Status Client::InternalFlush(port::Mutex* mu, File* file,
+                             const Fentry& fentry) {
   Status s;
   uint64_t mtime;
   uint64_t size;
   uint32_t seq_write = file->seq_write;
   uint32_t seq_flush = file->seq_flush;
   file->refs++;  // Ref
-  mutex_.Unlock();
-  s = fio_->Flush(fentry, file->fh);
+  mu->Unlock();
+  s = SyncWriteBuffer(file, fentry);
+  if (s.ok()) {
+    s = fio_->Flush(fentry, file->fh);
+  }
   if (s.ok()) {
     if (seq_flush < seq_write) {
       s = fio_->Fstat(fentry, file->fh, &mtime, &size);
@@ -979,39 +1242,46 @@ Status Client::InternalFlush(File* file, const Fentry& fentry) {
       }
     }
   }
-  mutex_.Lock();
+  mu->Lock();
   if (s.ok()) {
     if (seq_write > file->seq_flush) {
       file->seq_flush = seq_write;
     }
   }
-  Unref(file, fentry);
+  Unref(mu, file, fentry);
   return s;
 }
 
 Status Client::Close(int fd) {
-  MutexLock ml(&mutex_);
+  port::Mutex* const mu = FdMutex(fd);
+  MutexLock ml(mu);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     return BadDescriptor();
   } else {
+    Status s;
     if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
       if (S_ISDIR(fentry.file_mode())) {
         plfsio::DirWriter* writer = ToWritablePlfsDir(file->fh)->writer;
         assert(writer != NULL);
-        mutex_.Unlock();
+        mu->Unlock();
         writer->Finish();
-        mutex_.Lock();
+        mu->Lock();
       } else {
         // Do nothing
       }
     } else {
       if (S_ISREG(fentry.file_mode())) {
+        // Also writes out the write-back buffer so that failures to
+        // store buffered data are reported to the caller
         while (file->seq_flush < file->seq_write) {
-          mutex_.Unlock();
-          Flush(fd);  // Ignore errors
-          mutex_.Lock();
+          mu->Unlock();
+          s = Flush(fd);
+          mu->Lock();
+          if (!s.ok()) {
+            break;  // The file is closed anyway
+          }
         }
       } else {
         // Do nothing
@@ -1020,8 +1290,8 @@ Status Client::Close(int fd) {
 
     Free(fd);  // Release fd slot
 
-    Unref(file, fentry);
-    return Status::OK();
+    Unref(mu, file, fentry);
+    return s;
   }
 }
 
@@ -1057,13 +1327,14 @@ Status Client::Accessdir(const char* path, int mode) {
   return s;
 }
 
-Status Client::Listdir(const char* path, std::vector<std::string>* names) {
+Status Client::Listdir(const char* path, std::vector<std::string>* names,
+                       std::vector<Stat>* stats) {
   Status s;
   Slice p = path;
   std::string tmp;
   s = ExpandPath(&p, &tmp);
   if (s.ok()) {
-    s = mdscli_->Listdir(p, names);
+    s = mdscli_->Listdir(p, names, stats);
   }
 
 #if VERBOSE >= OP_VERBOSE_LEVEL
@@ -1144,6 +1415,27 @@ Status Client::Mkfile(const char* path, mode_t mode) {
   return s;
 }
 
+// Create a batch of files under a given directory. Return OK if the batch has
+// been processed, in which case the result of each name is stored in
+// *statuses.
+Status Client::Mkfiles(const char* dir, const std::vector<std::string>& names,
+                       mode_t mode, std::vector<Status>* statuses) {
+  Status s;
+  Slice p = dir;
+  std::string tmp;
+  s = ExpandPath(&p, &tmp);
+  if (s.ok()) {
+    mode = MaskMode(mode);
+    s = mdscli_->Bcreat(p, names, mode, statuses);
+  }
+
+#if VERBOSE >= OP_VERBOSE_LEVEL
+  OP_VERBOSE(p, s);
+#endif
+
+  return s;
+}
+
 Status Client::Mkdirs(const char* path, mode_t mode) {
   Status s;
   Slice p = path;
@@ -1223,6 +1515,9 @@ Status Client::Truncate(const char* path, uint64_t len) {
     s = mdscli_->Fstat(p, &fentry);
     if (s.ok()) {
       s = fio_->Trunc(fentry, len);
+      if (s.ok()) {
+        s = mdscli_->Ftruncate(fentry, CurrentMicros(), len);
+      }
     }
   }
 
@@ -1347,7 +1642,8 @@ class Client::Builder {
         mdscli_(NULL),
         db_(NULL),
         blkdb_(NULL),
-        fio_(NULL) {}
+        fio_(NULL),
+        reader_pool_(NULL) {}
   ~Builder() {}
 
   Status status() const { return status_; }
@@ -1394,7 +1690,13 @@ class Client::Builder {
   BlkDBOptions blkdbopts_;
   BlkDB* blkdb_;
   Fio* fio_;
+  ThreadPool* reader_pool_;
   size_t max_open_files_;
+  size_t write_buffer_size_;
+  size_t write_buffer_budget_;
+  uint64_t write_buffer_timeout_;
+  size_t read_ahead_size_;
+  size_t read_buffer_budget_;
   int cli_id_;
   int session_id_;
   int uid_;
@@ -1465,6 +1767,7 @@ static void PrintTopology(const MDSTopology& topo) {
 void Client::Builder::LoadMDSTopology() {
   uint64_t num_vir_srvs;
   uint64_t num_srvs;
+  uint64_t num_replicas;
 
   if (ok()) {
     status_ = config::LoadNumOfVirMetadataSrvs(&num_vir_srvs);
@@ -1497,15 +1800,43 @@ void Client::Builder::LoadMDSTopology() {
     }
   }
 
+  if (ok()) {
+    status_ = config::LoadNumOfMetadataReplicas(&num_replicas);
+    if (ok() && num_replicas != 0) {
+      std::string addrs = config::MetadataReplicaAddrs();
+      SplitString(&mdstopo_.replica_addrs, addrs.c_str(), '&');
+      if (mdstopo_.replica_addrs.size() != num_srvs * num_replicas) {
+        status_ = Status::InvalidArgument("bad num of replica addrs");
+      }
+    }
+  }
+
   if (ok()) {
     status_ = config::LoadMDSTracing(&mdstopo_.mds_tracing);
   }
 
+  if (ok()) {
+    status_ = config::LoadMDSTraceSampling(&mdstopo_.mds_trace_sampling);
+    if (ok() && mdstopo_.mds_trace_sampling != 0) {
+      std::string run_dir = config::RunDir();
+      // Ignore error because it may already exist
+      Env::Default()->CreateDir(run_dir.c_str());
+      char tmp[50];
+      snprintf(tmp, sizeof(tmp), "/mdstrace-%d.bin", int(getpid()));
+      mdstopo_.mds_trace_file = run_dir + tmp;
+    }
+  }
+
   if (ok()) {
     mdstopo_.rpc_proto = config::RPCProto();
+    status_ = config::LoadRPCReplyCompression(&mdstopo_.rpc_reply_compression);
+  }
+
+  if (ok()) {
     num_vir_srvs = std::max(num_vir_srvs, num_srvs);
     mdstopo_.num_vir_srvs = num_vir_srvs;
     mdstopo_.num_srvs = num_srvs;
+    mdstopo_.num_replicas = num_replicas;
   }
 
   if (ok()) {
@@ -1536,9 +1867,12 @@ void Client::Builder::OpenSession() {
     if (ok()) {
       session_id_ = ret.session_id;
       env_ = new LazyInitEnv(ret.env_name.c_str(), ret.env_conf.c_str());
-      fio_ = Fio::Open(ret.fio_name.c_str(), ret.fio_conf.c_str());
-      if (fio_ == NULL) {
-        status_ = Status::IOError("cannot open fio");
+      // File data is kept in a per-session BlkDB opened by OpenDB()
+      if (ret.fio_name != "blkdb") {
+        fio_ = Fio::Open(ret.fio_name.c_str(), ret.fio_conf.c_str());
+        if (fio_ == NULL) {
+          status_ = Status::IOError("cannot open fio");
+        }
       }
     }
   }
@@ -1548,7 +1882,10 @@ void Client::Builder::OpenSession() {
 void Client::Builder::OpenDB() {
   blkdb_ = NULL;
   db_ = NULL;
-#if 0
+  if (!ok() || fio_ != NULL) {
+    return;  // File data is not kept in a BlkDB
+  }
+
   std::string output_root;
 
   if (ok()) {
@@ -1564,14 +1901,32 @@ void Client::Builder::OpenDB() {
     }
   }
 
+  bool value_log = false;
   if (ok()) {
     status_ = config::LoadVerifyChecksums(&blkdbopts_.verify_checksum);
+    if (ok()) {
+      status_ = config::LoadCliValueLog(&value_log);
+    }
+    if (ok()) {
+      status_ =
+          config::LoadSizeOfCliBlockWriteBatch(&blkdbopts_.write_batch_size);
+    }
+    uint64_t reader_threads;
+    if (ok()) {
+      status_ = config::LoadNumOfCliReaderThreads(&reader_threads);
+      if (ok() && reader_threads != 0) {
+        reader_pool_ = ThreadPool::NewFixed(static_cast<int>(reader_threads));
+        blkdbopts_.reader_pool = reader_pool_;
+      }
+    }
   }
 
   if (ok()) {
     dbopts_.create_if_missing = true;
     dbopts_.compression = kNoCompression;
     dbopts_.disable_compaction = true;
+    // Lets concurrent synced block writes share log syncs
+    dbopts_.pipelined_wal_sync = blkdbopts_.sync;
     dbopts_.env = env_;
   }
 
@@ -1580,6 +1935,11 @@ void Client::Builder::OpenDB() {
     char tmp[30];
     snprintf(tmp, sizeof(tmp), "/data_%d", session_id_);
     dbhome += tmp;
+    if (value_log) {
+      snprintf(tmp, sizeof(tmp), "/blobs_%d", session_id_);
+      blkdbopts_.value_log_dir = output_root + tmp;
+      blkdbopts_.env = env_;
+    }
     status_ = DB::Open(dbopts_, dbhome, &db_);
     if (ok()) {
       blkdbopts_.db = db_;
@@ -1587,15 +1947,17 @@ void Client::Builder::OpenDB() {
       blkdbopts_.owns_db = true;
       blkdb_ = new BlkDB(blkdbopts_);
       db_ = NULL;
+      fio_ = blkdb_;
+      blkdb_ = NULL;
     }
   }
-#endif
 }
 
 // REQUIRES: OpenSession() has been called.
 void Client::Builder::OpenMDSCli() {
   uint64_t idx_cache_sz;
   uint64_t lookup_cache_sz;
+  uint64_t attr_cache_sz;
   uint64_t max_open_files;
 
   if (ok()) {
@@ -1603,6 +1965,16 @@ void Client::Builder::OpenMDSCli() {
     if (ok()) {
       status_ = config::LoadSizeOfCliLookupCache(&lookup_cache_sz);
     }
+    if (ok()) {
+      status_ = config::LoadSizeOfCliAttrCache(&attr_cache_sz);
+    }
+    if (ok()) {
+      status_ = config::LoadCliAttrLease(&mdscliopts_.attr_lease);
+    }
+    if (ok()) {
+      status_ = config::LoadCliLeaseRenewalWindow(
+          &mdscliopts_.lease_renewal_window);
+    }
   }
 
   if (ok()) {
@@ -1610,8 +1982,54 @@ void Client::Builder::OpenMDSCli() {
     max_open_files_ = max_open_files;
   }
 
+  if (ok()) {
+    uint64_t write_buffer_size;
+    uint64_t write_buffer_budget;
+    status_ = config::LoadSizeOfCliWriteBuffer(&write_buffer_size);
+    if (ok()) {
+      status_ = config::LoadSizeOfCliWriteBuffers(&write_buffer_budget);
+    }
+    if (ok()) {
+      status_ = config::LoadCliWriteBufferTimeout(&write_buffer_timeout_);
+    }
+    if (ok()) {
+      write_buffer_size_ = write_buffer_size;
+      write_buffer_budget_ = write_buffer_budget;
+#if VERBOSE >= 2
+      Verbose(__LOG_ARGS__, 2, "cli.write_buffer -> %llu",
+              static_cast<unsigned long long>(write_buffer_size));
+      Verbose(__LOG_ARGS__, 2, "cli.write_buffer_budget -> %llu",
+              static_cast<unsigned long long>(write_buffer_budget));
+      Verbose(__LOG_ARGS__, 2, "cli.write_buffer_timeout -> %llu ms",
+              static_cast<unsigned long long>(write_buffer_timeout_));
+#endif
+    }
+  }
+
+  if (ok()) {
+    uint64_t read_ahead_size;
+    uint64_t read_buffer_budget;
+    status_ = config::LoadSizeOfCliReadAhead(&read_ahead_size);
+    if (ok()) {
+      status_ = config::LoadSizeOfCliReadBuffers(&read_buffer_budget);
+    }
+    if (ok()) {
+      read_ahead_size_ = read_ahead_size;
+      read_buffer_budget_ = read_buffer_budget;
+#if VERBOSE >= 2
+      Verbose(__LOG_ARGS__, 2, "cli.read_ahead -> %llu",
+              static_cast<unsigned long long>(read_ahead_size));
+      Verbose(__LOG_ARGS__, 2, "cli.read_buffer_budget -> %llu",
+              static_cast<unsigned long long>(read_buffer_budget));
+#endif
+    }
+  }
+
   if (ok()) {
     status_ = config::LoadAtomicPathRes(&mdscliopts_.atomic_path_resolution);
+    if (ok()) {
+      status_ = config::LoadCliNegativeLookups(&mdscliopts_.negative_lookups);
+    }
     if (ok()) {
       status_ = config::LoadParanoidChecks(&mdscliopts_.paranoid_checks);
     }
@@ -1622,6 +2040,7 @@ void Client::Builder::OpenMDSCli() {
     mdscliopts_.factory = mdsfty_;
     mdscliopts_.index_cache_size = idx_cache_sz;
     mdscliopts_.lookup_cache_size = lookup_cache_sz;
+    mdscliopts_.attr_cache_size = attr_cache_sz;
     mdscliopts_.num_virtual_servers = mdstopo_.num_vir_srvs;
     mdscliopts_.num_servers = mdstopo_.num_srvs;
     mdscliopts_.session_id = session_id_;
@@ -1662,7 +2081,13 @@ Client* Client::Builder::BuildClient() {
     cli->mdscli_ = mdscli_;
     cli->mdsfty_ = mdsfty_;
     cli->fio_ = fio_;
+    cli->reader_pool_ = reader_pool_;
     cli->env_ = env_;
+    cli->wb_size_ = write_buffer_size_;
+    cli->wb_budget_ = write_buffer_budget_;
+    cli->wb_timeout_ = write_buffer_timeout_ * 1000;
+    cli->rb_size_ = read_ahead_size_;
+    cli->rb_budget_ = read_buffer_budget_;
     return cli;
   } else {
     delete mdscli_;
@@ -1670,6 +2095,7 @@ Client* Client::Builder::BuildClient() {
     delete fio_;
     delete blkdb_;
     delete db_;
+    delete reader_pool_;
     delete env_;
     return NULL;
   }
@@ -42,11 +42,14 @@ class Client {
 
   Status Access(const char* path, int mode);
   Status Accessdir(const char* path, int mode);
-  Status Listdir(const char* path, std::vector<std::string>* names);
+  Status Listdir(const char* path, std::vector<std::string>* names,
+                 std::vector<Stat>* stats = NULL);
   Status Truncate(const char* path, uint64_t len);
   Status Lstat(const char* path, Stat* result);
   Status Getattr(const char* path, Stat* result);
   Status Mkfile(const char* path, mode_t mode);
+  Status Mkfiles(const char* dir, const std::vector<std::string>& names,
+                 mode_t mode, std::vector<Status>* statuses);
   Status Mkdirs(const char* path, mode_t mode);
   Status Mkdir(const char* path, mode_t mode);
   Status Chmod(const char* path, mode_t mode);
@@ -66,12 +69,40 @@ class Client {
   void operator=(const Client&);
   Client(const Client&);
 
+  // Write-back buffer for small writes to a regular file. Contiguous
+  // writes are coalesced in the buffer and sent to storage once the buffer
+  // fills up, times out, or the file is flushed, synced, or closed.
+  struct WriteBuffer {
+    port::Mutex mu;  // Serializes buffered writes and their write-backs
+    std::string data;  // Buffered data not yet sent to storage
+    uint64_t off;  // Target offset of the buffered data if !append
+    bool append;  // True if buffered data is from Write() instead of Pwrite()
+    uint64_t birth;  // Time (in micros) when data first became non-empty
+  };
+
+  // Read-ahead buffer for a regular file opened for reading. Once a file is
+  // found to be read sequentially, each read that misses the buffer fetches
+  // a full read-ahead window from storage. Subsequent reads are then served
+  // from memory. When read-ahead is enabled, Read() is implemented as a
+  // positional read at a file offset maintained by the client.
+  struct ReadBuffer {
+    port::Mutex mu;  // Protects all fields below
+    std::string data;  // Cached file data
+    uint64_t off;  // File offset of the cached data
+    uint64_t pos;  // Current file offset for Read()
+    uint64_t next_off;  // Expected offset of the next sequential read
+    int seq_reads;  // Number of consecutive sequential reads
+    uint64_t mtime;  // File mtime when the cached data was last validated
+  };
+
   // State for each opened file
   struct File {
     size_t encoding_length;
     File* next;
     File* prev;
     Fio::Handle* fh;
+    WriteBuffer* wb;  // NULL if writes are not buffered
+    ReadBuffer* rb;  // NULL if there is no read-ahead
     int flags;
     uint32_t seq_flush;  // Latest file metadata update
     uint32_t seq_write;  // Latest data write
@@ -90,10 +121,30 @@ class Client {
   // REQUIRES: mutex_ has been locked
   Status InternalOpen(const Slice& p, int flags, mode_t mode, FileAndEntry* at,
                       FileInfo* result);
-  // REQUIRES: mutex_ has been locked
-  Status InternalFdatasync(File* file, const Fentry& ent);
-  // REQUIRES: mutex_ has been locked
-  Status InternalFlush(File* file, const Fentry& ent);
+  // REQUIRES: *mu, the mutex of the file's descriptor, has been locked
+  Status InternalFdatasync(port::Mutex* mu, File* file, const Fentry& ent);
+  // REQUIRES: *mu, the mutex of the file's descriptor, has been locked
+  Status InternalFlush(port::Mutex* mu, File* file, const Fentry& ent);
+  // REQUIRES: wb->mu has been locked
+  Status WriteBack(WriteBuffer* wb, const Fentry& ent, Fio::Handle* fh);
+  // Write the buffered data of a file, if any, to storage
+  Status SyncWriteBuffer(File* file, const Fentry& ent);
+  Status BufferedWrite(File* file, const Fentry& ent, const Slice& data,
+                       bool append, uint64_t off);
+  // REQUIRES: rb->mu has been locked
+  Status CachedPread(ReadBuffer* rb, const Fentry& ent, Fio::Handle* fh,
+                     Slice* result, uint64_t off, uint64_t size, char* scratch);
+
+  // The file descriptor table is partitioned into shards by descriptor
+  // number. Each descriptor slot, and the state of the open file it points
+  // to, is protected by the mutex of its shard so that operations on
+  // different files do not contend on a single lock. When both are needed,
+  // mutex_ is locked before any shard mutex.
+  enum { kFdShards = 16 };
+  port::Mutex fd_mu_[kFdShards];
+  port::Mutex* FdMutex(int fd) {
+    return &fd_mu_[static_cast<size_t>(fd) % kFdShards];
+  }
 
   // State below is protected by mutex_
   port::Mutex mutex_;
@@ -107,20 +158,29 @@ class Client {
   File* FetchFile(int fd, Fentry*);
   size_t Alloc(File*);
   File* Free(size_t idx);
-  size_t Open(const Slice& encoding, int flags, Fio::Handle*);
+  size_t Open(const Slice& encoding, int flags, Fio::Handle*, bool buffered);
   bool IsWriteOk(const File*);
   bool IsReadOk(const File*);
-  void Unref(File*, const Fentry&);
+  void Unref(port::Mutex* mu, File*, const Fentry&);
+  void Destroy(File*, const Fentry&);
   File dummy_;  // File table as a doubly linked list
   File** fds_;  // File descriptor table
   size_t num_open_fds_;
   size_t fd_slot_;
+  size_t wb_reserved_;  // Total memory reserved by write-back buffers
+  size_t rb_reserved_;  // Total memory reserved by read-ahead buffers
 
   // Constant after construction
   size_t max_open_fds_;
+  size_t wb_size_;  // Size of each write-back buffer; 0 if disabled
+  size_t wb_budget_;  // Max memory used by all write-back buffers
+  uint64_t wb_timeout_;  // Max age (in micros) of buffered data
+  size_t rb_size_;  // Size of each read-ahead window; 0 if disabled
+  size_t rb_budget_;  // Max memory used by all read-ahead buffers
   MDSFactoryImpl* mdsfty_;
   MDSClient* mdscli_;
   Fio* fio_;
+  ThreadPool* reader_pool_;  // Fetches blocks for fio_; may be NULL
   Env* env_;
 };
 
@@ -50,19 +50,41 @@ DEFINE_FLAG(NumOfMetadataSrvs, "1")
 DEFINE_FLAG(NumOfVirMetadataSrvs, "1")
 DEFINE_FLAG(InstanceId, "0")
 DEFINE_FLAG(RPCProto, "bmi+tcp")
+DEFINE_FLAG(RPCReplyCompression, "none")
 DEFINE_FLAG(MDSTracing, "false")
+DEFINE_FLAG(MDSTraceSampling, "0")
 DEFINE_FLAG(MetadataSrvAddrs, "")
+DEFINE_FLAG(NumOfMetadataReplicas, "0")
+DEFINE_FLAG(MetadataReplicaAddrs, "")
+DEFINE_FLAG(ReplicaId, "0")
 DEFINE_FLAG(MaxNumOfOpenFiles, "1000")
 DEFINE_FLAG(SizeOfSrvLeaseTable, "4k")
 DEFINE_FLAG(SizeOfSrvDirTable, "1k")
+DEFINE_FLAG(NumOfSrvRpcWorkers, "4")
+DEFINE_FLAG(NumOfSrvShards, "1")
+DEFINE_FLAG(NumOfSrvWarmupDirs, "0")
 DEFINE_FLAG(SizeOfCliLookupCache, "4k")
 DEFINE_FLAG(SizeOfCliIndexCache, "1k")
+DEFINE_FLAG(SizeOfCliAttrCache, "4k")
+DEFINE_FLAG(CliAttrLease, "0")
+DEFINE_FLAG(CliLeaseRenewalWindow, "0")
+DEFINE_FLAG(SizeOfCliWriteBuffer, "0")
+DEFINE_FLAG(SizeOfCliWriteBuffers, "32M")
+DEFINE_FLAG(CliWriteBufferTimeout, "1000")
+DEFINE_FLAG(SizeOfCliReadAhead, "0")
+DEFINE_FLAG(SizeOfCliReadBuffers, "32M")
+DEFINE_FLAG(SizeOfCliBlockWriteBatch, "0")
+DEFINE_FLAG(NumOfCliReaderThreads, "0")
 DEFINE_FLAG(SizeOfMetadataWriteBuffer, "32M")
 DEFINE_FLAG(SizeOfMetadataTables, "32M")
 DEFINE_FLAG(DisableMetadataCompaction, "true")
+DEFINE_FLAG(SyncMetadataWrites, "false")
+DEFINE_FLAG(ScanResistantMetadataCache, "false")
 DEFINE_FLAG(AtomicPathRes, "false")
+DEFINE_FLAG(CliNegativeLookups, "false")
 DEFINE_FLAG(ParanoidChecks, "false")
 DEFINE_FLAG(VerifyChecksums, "false")
+DEFINE_FLAG(CliValueLog, "false")
 DEFINE_FLAG(Inputs, "/tmp/deltafs_inputs")
 DEFINE_FLAG(Outputs, "/tmp/deltafs_outputs")
 DEFINE_FLAG(RunDir, "/tmp/deltafs_run")
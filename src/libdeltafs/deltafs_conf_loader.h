@@ -13,6 +13,7 @@
 
 #include "deltafs_conf_raw.h"
 
+#include "pdlfs-common/compression_type.h"
 #include "pdlfs-common/strutil.h"
 
 #include <ctype.h>
@@ -53,20 +54,55 @@ CONF_LOADER_UI64(NumOfMetadataSrvs)
 CONF_LOADER_UI64(NumOfVirMetadataSrvs)
 CONF_LOADER_UI64(InstanceId)
 CONF_LOADER_BOOL(MDSTracing)
+CONF_LOADER_UI64(MDSTraceSampling)
+CONF_LOADER_UI64(NumOfMetadataReplicas)
+CONF_LOADER_UI64(ReplicaId)
 CONF_LOADER_UI64(MaxNumOfOpenFiles)
 CONF_LOADER_UI64(SizeOfSrvLeaseTable)
 CONF_LOADER_UI64(SizeOfSrvDirTable)
+CONF_LOADER_UI64(NumOfSrvRpcWorkers)
+CONF_LOADER_UI64(NumOfSrvShards)
+CONF_LOADER_UI64(NumOfSrvWarmupDirs)
 CONF_LOADER_UI64(SizeOfCliLookupCache)
 CONF_LOADER_UI64(SizeOfCliIndexCache)
+CONF_LOADER_UI64(SizeOfCliAttrCache)
+CONF_LOADER_UI64(CliAttrLease)
+CONF_LOADER_UI64(CliLeaseRenewalWindow)
+CONF_LOADER_UI64(SizeOfCliWriteBuffer)
+CONF_LOADER_UI64(SizeOfCliWriteBuffers)
+CONF_LOADER_UI64(CliWriteBufferTimeout)
+CONF_LOADER_UI64(SizeOfCliReadAhead)
+CONF_LOADER_UI64(SizeOfCliReadBuffers)
+CONF_LOADER_UI64(SizeOfCliBlockWriteBatch)
+CONF_LOADER_UI64(NumOfCliReaderThreads)
 CONF_LOADER_UI64(SizeOfMetadataWriteBuffer)
 CONF_LOADER_UI64(SizeOfMetadataTables)
 CONF_LOADER_BOOL(DisableMetadataCompaction)
+CONF_LOADER_BOOL(SyncMetadataWrites)
+CONF_LOADER_BOOL(ScanResistantMetadataCache)
 CONF_LOADER_BOOL(AtomicPathRes)
+CONF_LOADER_BOOL(CliNegativeLookups)
 CONF_LOADER_BOOL(ParanoidChecks)
 CONF_LOADER_BOOL(VerifyChecksums)
+CONF_LOADER_BOOL(CliValueLog)
 
 #undef CONF_LOADER_UI64
 #undef CONF_LOADER_BOOL
 
+inline Status LoadRPCReplyCompression(CompressionType* dst) {
+  std::string str = config::RPCReplyCompression();
+  ToLowerCase(&str);
+  if (str.empty() || str == "none") {
+    *dst = kNoCompression;
+  } else if (str == "snappy") {
+    *dst = kSnappyCompression;
+  } else if (str == "lz4") {
+    *dst = kLz4Compression;
+  } else {
+    return Status::InvalidArgument("RPCReplyCompression", str);
+  }
+  return Status::OK();
+}
+
 }  // namespace config
 }  // namespace pdlfs
@@ -28,12 +28,37 @@ extern std::string InstanceId();
 // Return the name of the RPC proto.
 // e.g. bmi+tcp, cci, mpi
 extern std::string RPCProto();
+// Compress large listing and index replies from metadata servers. Clients
+// with this set ask servers to compress and require servers that
+// understand the ask. Servers compress only for clients that ask.
+// e.g. none, snappy, lz4
+extern std::string RPCReplyCompression();
 // Indicate if deltafs should trace calls to metadata server.
 // e.g. true, yes
 extern std::string MDSTracing();
+// Sample one of every N calls to metadata servers into a per-process binary
+// trace at "<run_dir>/mdstrace-<pid>.bin" rather than logging every call as
+// text. Traces can be decoded by deltafs-mdstrace. Set to 0 to disable.
+// e.g. 0, 100
+extern std::string MDSTraceSampling();
 // Return an ordered array of server addrs. Addrs are separated by ','.
 // e.g. 10.0.0.1:10000,10.0.0.1:20000
 extern std::string MetadataSrvAddrs();
+// Return the number of read-only replicas of each metadata server. Clients
+// spread lookups, stats, and listings over each server and its replicas.
+// Replicas follow the db of their server and may lag behind it by a few
+// seconds. Files a replica references must not be garbage collected by
+// its server, so replicas require metadata compaction to be disabled.
+// e.g. 0, 2
+extern std::string NumOfMetadataReplicas();
+// Return an ordered array of replica addrs. Replicas of server 0 go first,
+// followed by those of server 1, and so on.
+// e.g. 10.0.0.2:10000&10.0.0.2:20000
+extern std::string MetadataReplicaAddrs();
+// Return the replica id of myself. 0 for a metadata server itself, and 1
+// to the number of replicas for one of its read-only replicas.
+// e.g. 0, 1
+extern std::string ReplicaId();
 // Return the max number of files that could be opened per client process.
 // e.g. 1024
 extern std::string MaxNumOfOpenFiles();
@@ -43,21 +68,93 @@ extern std::string SizeOfSrvLeaseTable();
 // Return the size of directory table at each metadata server.
 // e.g. 4096, 16k
 extern std::string SizeOfSrvDirTable();
+// Return the number of threads at each metadata server that execute incoming
+// calls. A call waiting for a directory to load holds its thread, so more
+// threads keep such calls from delaying calls to directories already loaded.
+// e.g. 4, 16
+extern std::string NumOfSrvRpcWorkers();
+// Return the number of metadata servers hosted by each metadata server
+// process, starting from the server whose id is the process's instance id.
+// Hosted servers share nothing: each has its own db, its own rpc channel
+// listening on its own address, and its own rpc workers, so a process scales
+// with its number of cores by hosting one server per core with one worker
+// each. Clients steer each call to its owning server by address as usual.
+// e.g. 1, 8
+extern std::string NumOfSrvShards();
+// Return the max number of hot directories each metadata server records at
+// shutdown and preloads in the background at the next start. Set to 0 to
+// disable.
+// e.g. 0, 4096, 16k
+extern std::string NumOfSrvWarmupDirs();
 // Return the size of lookup cache at each metadata client.
 // e.g. 4096, 16k
 extern std::string SizeOfCliLookupCache();
 // Return the size of directory index cache at each metadata client.
 // e.g. 4096, 16k
 extern std::string SizeOfCliIndexCache();
+// Return the size of file attribute cache at each metadata client.
+// e.g. 4096, 16k
+extern std::string SizeOfCliAttrCache();
+// Return the amount of time (in microseconds) each metadata client may serve
+// file attributes from its cache. Set to 0 to disable attribute caching.
+// e.g. 0, 1000000
+extern std::string CliAttrLease();
+// Return the amount of time (in microseconds) before their expiration at
+// which each metadata client renews the leases of cached path lookups as it
+// uses them. Leases due for renewal are renewed in batches, one call per
+// metadata server. Set to 0 to disable renewals.
+// e.g. 0, 500000
+extern std::string CliLeaseRenewalWindow();
+// Return the size of the write-back buffer of each open file at each
+// metadata client. Small writes are coalesced in the buffer before being
+// sent to storage. Set to 0 to disable write-back buffering.
+// e.g. 0, 64k, 1M
+extern std::string SizeOfCliWriteBuffer();
+// Return the max amount of memory used by the write-back buffers of all
+// open files at each metadata client.
+// e.g. 8M, 32M
+extern std::string SizeOfCliWriteBuffers();
+// Return the max amount of time, in milliseconds, data may stay in a
+// write-back buffer before it is written out by a subsequent write.
+// e.g. 100, 1000
+extern std::string CliWriteBufferTimeout();
+// Return the amount of data to read ahead for each file opened for reading
+// at each metadata client once sequential reads are detected. Set to 0 to
+// disable read-ahead.
+// e.g. 0, 256k, 1M
+extern std::string SizeOfCliReadAhead();
+// Return the max amount of memory used by the read-ahead buffers of all
+// open files at each metadata client.
+// e.g. 8M, 32M
+extern std::string SizeOfCliReadBuffers();
+// Return the amount of block writes a client keeping file data in a blkdb
+// may buffer before committing them to the db. 0 commits each write.
+// e.g. 0, 1M
+extern std::string SizeOfCliBlockWriteBatch();
+// Return the number of threads a client keeping file data in a blkdb uses
+// to fetch the blocks of a multi-block read in parallel. 0 fetches them
+// one by one in the reading thread.
+// e.g. 0, 4
+extern std::string NumOfCliReaderThreads();
 // Indicate if deltafs should ensure atomic pathname resolutions.
 // e.g. true, yes
 extern std::string AtomicPathRes();
+// Indicate if deltafs clients should cache lookups of missing directories
+// under server-granted leases. Directories cannot be created while such a
+// lease is held.
+// e.g. true, yes
+extern std::string CliNegativeLookups();
 // Indicate if deltafs should perform paranoid checks.
 // e.g. true, yes
 extern std::string ParanoidChecks();
 // Indicate if deltafs should always verify checksums.
 // e.g. true, yes
 extern std::string VerifyChecksums();
+// True if clients keeping file data in a blkdb should append the data to
+// blob files and only keep pointers to it in the db. Must not change
+// across runs sharing the same output directory.
+// e.g. true, yes
+extern std::string CliValueLog();
 // Set the size of leveldb write buffer that holds metadata updates.
 // e.g. 8M, 32M
 extern std::string SizeOfMetadataWriteBuffer();
@@ -67,6 +164,14 @@ extern std::string SizeOfMetadataTables();
 // True if all background compaction of metadata tables should be disabled.
 // e.g. true, yes
 extern std::string DisableMetadataCompaction();
+// True if metadata updates should be synced to storage before being
+// acknowledged. Syncs of concurrent updates are grouped together.
+// e.g. true, yes
+extern std::string SyncMetadataWrites();
+// True if the cache of metadata table blocks should resist large scans such
+// as full directory listings that would otherwise flush hot blocks.
+// e.g. true, yes
+extern std::string ScanResistantMetadataCache();
 // Return the name of the Env implementation to use.
 // XXX: support running deltafs on multiple Env instances.
 // e.g. rados, hdfs
@@ -74,12 +179,13 @@ extern std::string EnvName();
 // Return the conf string that should be passed to Env loaders.
 // e.g. "rados_conf=/etc/ceph.conf&pool_name=metadata"
 extern std::string EnvConf();
-// Return the name of the Fio implementation to use.
-// XXX: support running deltafs on multiple Fio instances.
-// e.g. rados, hdfs
+// Return the name of the Fio implementation to use. "striped" stripes the
+// data of each file across a set of posix roots by offset. "blkdb" keeps
+// the data of each client session in a db under the output directory.
+// e.g. posix, striped, blkdb
 extern std::string FioName();
 // Return the conf string that should be passed to Fio loaders.
-// e.g. "rados_conf=/etc/ceph.conf&pool_name=data"
+// e.g. "root=/data1;root=/data2;stripe_size=1m;io_threads=2"
 extern std::string FioConf();
 // Return the conf string for input snapshots
 extern std::string Inputs();
@@ -35,33 +35,37 @@ MetadataServer::~MetadataServer() {
 // REQUIRES: can only be called by the main thread.
 Status MetadataServer::Dispose() {
   Status s;
+  metrics_.Remove("mds");
+  metrics_.Remove("mdb");
+  for (size_t i = 0; i < shards_.size(); i++) {
+    char tmp[30];
+    snprintf(tmp, sizeof(tmp), "srv%d", shards_[i].srv_id);
+    metrics_.Remove(tmp);
+  }
   if (rpc_ != NULL) {
     delete rpc_;
     rpc_ = NULL;
   }
-  if (wrapper_ != NULL) {
-    delete wrapper_;
-    wrapper_ = NULL;
-  }
-  if (mds_ != NULL) {
-    delete mds_;
-    mds_ = NULL;
-  }
-  if (mdsmon_ != NULL) {
-    delete mdsmon_;
-    mdsmon_ = NULL;
-  }
-  if (mdb_ != NULL) {
-    delete mdb_;
-    mdb_ = NULL;
-  }
-  if (db_ != NULL) {
-    FlushOptions options;
-    options.wait = true;
-    s = db_->FlushMemTable(options);
-    delete db_;
-    db_ = NULL;
+  for (size_t i = 0; i < shards_.size(); i++) {
+    Shard* const shard = &shards_[i];
+    delete shard->wrapper;
+    delete shard->rpc_latency;
+    delete shard->mds;
+    delete shard->mdsmon;
+    delete shard->mdb;
+    if (shard->db != NULL) {
+      if (shard->replica == NULL) {
+        FlushOptions options;
+        options.wait = true;
+        Status r = shard->db->FlushMemTable(options);
+        if (s.ok()) {
+          s = r;
+        }
+      }
+      delete shard->db;
+    }
   }
+  shards_.clear();
   if (myenv_ != NULL) {
     delete myenv_->fio;
     if (myenv_->env != Env::Default()) {
@@ -73,7 +77,16 @@ Status MetadataServer::Dispose() {
   return s;
 }
 
-void MetadataServer::PrintStatus(const Status& status, const MDSMonitor* mon) {
+void MetadataServer::PrintStatus(const Status& status,
+                                 const std::vector<Shard>& shards) {
+  unsigned long long fcreat = 0, mkdir = 0, fstat = 0, lookup = 0;
+  for (size_t i = 0; i < shards.size(); i++) {
+    const MDSMonitor* const mon = shards[i].mdsmon;
+    fcreat += mon->Get_Fcreat_count();
+    mkdir += mon->Get_Mkdir_count();
+    fstat += mon->Get_Fstat_count();
+    lookup += mon->Get_Lookup_count();
+  }
   Info(__LOG_ARGS__,
        "Deltafs status: %s ["
        "FCRET: %llu"
@@ -85,13 +98,101 @@ void MetadataServer::PrintStatus(const Status& status, const MDSMonitor* mon) {
        "LOKUP: %llu"
        "]",
        status.ToString().c_str(),  //
-       mon->Get_Fcreat_count(),    //
-       mon->Get_Mkdir_count(),     //
-       mon->Get_Fstat_count(),     //
-       mon->Get_Lookup_count()     //
+       fcreat,                     //
+       mkdir,                      //
+       fstat,                      //
+       lookup                      //
   );
 }
 
+#define DEF_OP_PROBE(OP)                                                      \
+  static uint64_t Probe_##OP(void* arg) {                                     \
+    return static_cast<PseudoConcurrentMDSMonitor*>(arg)->Get_##OP##_count(); \
+  }
+DEF_OP_PROBE(Fstat)
+DEF_OP_PROBE(Fcreat)
+DEF_OP_PROBE(Bcreat)
+DEF_OP_PROBE(Bulkin)
+DEF_OP_PROBE(Mkdir)
+DEF_OP_PROBE(Chmod)
+DEF_OP_PROBE(Chown)
+DEF_OP_PROBE(Uperm)
+DEF_OP_PROBE(Utime)
+DEF_OP_PROBE(Trunc)
+DEF_OP_PROBE(Unlink)
+DEF_OP_PROBE(Lookup)
+DEF_OP_PROBE(Listdir)
+#undef DEF_OP_PROBE
+
+#define DEF_MDB_PROBE(FIELD)                     \
+  static uint64_t Probe_mdb_##FIELD(void* arg) { \
+    MDBStats stats;                              \
+    static_cast<MDB*>(arg)->GetStats(&stats);    \
+    return stats.FIELD;                          \
+  }
+DEF_MDB_PROBE(gets)
+DEF_MDB_PROBE(getkeybytes)
+DEF_MDB_PROBE(getbytes)
+DEF_MDB_PROBE(puts)
+DEF_MDB_PROBE(putkeybytes)
+DEF_MDB_PROBE(putbytes)
+#undef DEF_MDB_PROBE
+
+// Metrics of a process hosting multiple servers are prefixed with the id of
+// each server, such as "srv3.mds.ops.fstat".
+void MetadataServer::RegisterMetrics() {
+  for (size_t i = 0; i < shards_.size(); i++) {
+    const Shard& shard = shards_[i];
+    std::string prefix;
+    if (shards_.size() > 1) {
+      char tmp[30];
+      snprintf(tmp, sizeof(tmp), "srv%d.", shard.srv_id);
+      prefix = tmp;
+    }
+#define REG(name, OP) \
+  metrics_.AddGauge(prefix + "mds.ops." name, Probe_##OP, shard.mdsmon)
+    REG("fstat", Fstat);
+    REG("fcreat", Fcreat);
+    REG("bcreat", Bcreat);
+    REG("bulkin", Bulkin);
+    REG("mkdir", Mkdir);
+    REG("chmod", Chmod);
+    REG("chown", Chown);
+    REG("uperm", Uperm);
+    REG("utime", Utime);
+    REG("trunc", Trunc);
+    REG("unlink", Unlink);
+    REG("lookup", Lookup);
+    REG("listdir", Listdir);
+#undef REG
+#define REG(FIELD) \
+  metrics_.AddGauge(prefix + "mdb." #FIELD, Probe_mdb_##FIELD, shard.mdb)
+    REG(gets);
+    REG(getkeybytes);
+    REG(getbytes);
+    REG(puts);
+    REG(putkeybytes);
+    REG(putbytes);
+#undef REG
+    metrics_.AddHistogram(prefix + "mds.rpc.latency", shard.rpc_latency);
+  }
+}
+
+void MetadataServer::DumpMetrics() {
+  if (!metrics_fname_.empty()) {
+    // Write to a temporary file first so that readers never see partial dumps
+    const std::string tmp = metrics_fname_ + ".tmp";
+    Status s = WriteStringToFile(
+        myenv_->env, metrics_.Dump(MetricsRegistry::kJson), tmp.c_str());
+    if (s.ok()) {
+      s = myenv_->env->RenameFile(tmp.c_str(), metrics_fname_.c_str());
+    }
+    if (!s.ok()) {
+      Warn(__LOG_ARGS__, "Cannot dump metrics: %s", s.ToString().c_str());
+    }
+  }
+}
+
 Status MetadataServer::RunTillInterruptionOrError() {
   Status s;
   MutexLock ml(&mutex_);
@@ -106,10 +207,21 @@ Status MetadataServer::RunTillInterruptionOrError() {
         if (rpc_ != NULL) {
           s = rpc_->status();
         }
-        PrintStatus(s, mdsmon_);
+        PrintStatus(s, shards_);
+        DumpMetrics();
         if (!s.ok()) {
           break;
         }
+        for (size_t i = 0; i < shards_.size(); i++) {
+          ReadonlyDB* const replica = shards_[i].replica;
+          if (replica != NULL) {
+            // Catch up with new updates written out by our server
+            Status r = replica->Reload();
+            if (!r.ok()) {
+              Warn(__LOG_ARGS__, "Cannot reload db: %s", r.ToString().c_str());
+            }
+          }
+        }
       }
       if (rpc_ != NULL) {
         Info(__LOG_ARGS__, "Deltafs is shutting down ...");
@@ -131,14 +243,7 @@ void MetadataServer::Interrupt() {
 
 class MetadataServer::Builder {
  public:
-  explicit Builder()
-      : myenv_(NULL),
-        wrapper_(NULL),
-        rpc_(NULL),
-        db_(NULL),
-        mdb_(NULL),
-        mds_(NULL),
-        mdsmon_(NULL) {}
+  explicit Builder() : myenv_(NULL), rpc_(NULL), num_shards_(1) {}
   ~Builder() {}
 
   Status status() const { return status_; }
@@ -158,18 +263,18 @@ class MetadataServer::Builder {
   bool ok() const { return status_.ok(); }
   MDSEnv* myenv_;
   MDSTopology mdstopo_;
-  RPCWrapper* wrapper_;
   RPCServer* rpc_;
   DBOptions dbopts_;
-  DB* db_;
   MDBOptions mdbopts_;
-  MDB* mdb_;
   MDSOptions mdsopts_;
-  MDS* mds_;
-  MDSMonitor* mdsmon_;
+  std::vector<Shard> shards_;
+  std::string metrics_fname_;
   uint64_t snap_id_;  // snapshot id
   uint64_t reg_id_;   // registry id
-  int srv_id_;
+  uint64_t replica_id_;  // 0 unless we are a read-only replica
+  int srv_id_;  // Id of the first server hosted by us
+  uint64_t num_shards_;  // Number of servers hosted by us
+  uint64_t num_rpc_workers_;
 };
 
 void MetadataServer::Builder::LoadIds() {
@@ -182,6 +287,10 @@ void MetadataServer::Builder::LoadIds() {
     }
   }
 
+  if (ok()) {
+    status_ = config::LoadReplicaId(&replica_id_);
+  }
+
   if (ok()) {
     snap_id_ = 0;  // FIXME
     reg_id_ = 0;
@@ -234,6 +343,7 @@ static std::string GetLocalUri(int srv_id) {
 void MetadataServer::Builder::LoadMDSTopology() {
   uint64_t num_vir_srvs;
   uint64_t num_srvs;
+  uint64_t num_replicas;
 
   if (ok()) {
     status_ = config::LoadNumOfVirMetadataSrvs(&num_vir_srvs);
@@ -243,7 +353,14 @@ void MetadataServer::Builder::LoadMDSTopology() {
   }
 
   if (ok()) {
-    if (srv_id_ >= num_srvs) {
+    status_ = config::LoadNumOfSrvShards(&num_shards_);
+    if (ok() && num_shards_ == 0) {
+      status_ = Status::InvalidArgument("bad num of srv shards");
+    }
+  }
+
+  if (ok()) {
+    if (srv_id_ + num_shards_ > num_srvs) {
       status_ = Status::InvalidArgument("bad instance id");
     }
   }
@@ -252,12 +369,15 @@ void MetadataServer::Builder::LoadMDSTopology() {
     std::string addrs = config::MetadataSrvAddrs();
     size_t num_addrs = SplitString(&mdstopo_.srv_addrs, addrs.c_str(), '&');
     if (num_addrs == 0) {
-      std::string uri = GetLocalUri(srv_id_);
-      if (uri.empty()) {
-        status_ = Status::IOError("cannot obtain local uri");
-      } else {
-        mdstopo_.srv_addrs = std::vector<std::string>(num_srvs);
-        mdstopo_.srv_addrs[srv_id_] = uri;
+      mdstopo_.srv_addrs = std::vector<std::string>(num_srvs);
+      const int end = srv_id_ + static_cast<int>(num_shards_);
+      for (int i = srv_id_; ok() && i < end; i++) {
+        std::string uri = GetLocalUri(i);
+        if (uri.empty()) {
+          status_ = Status::IOError("cannot obtain local uri");
+        } else {
+          mdstopo_.srv_addrs[i] = uri;
+        }
       }
     }
   }
@@ -270,15 +390,43 @@ void MetadataServer::Builder::LoadMDSTopology() {
     }
   }
 
+  if (ok()) {
+    status_ = config::LoadNumOfMetadataReplicas(&num_replicas);
+    if (ok() && replica_id_ > num_replicas) {
+      status_ = Status::InvalidArgument("bad replica id");
+    }
+  }
+
+  // A replica listens on its own addr instead of that of its server
+  if (ok() && replica_id_ != 0) {
+    std::string addrs = config::MetadataReplicaAddrs();
+    SplitString(&mdstopo_.replica_addrs, addrs.c_str(), '&');
+    if (mdstopo_.replica_addrs.size() != num_srvs * num_replicas) {
+      status_ = Status::InvalidArgument("bad num of replica addrs");
+    } else {
+      const int end = srv_id_ + static_cast<int>(num_shards_);
+      for (int i = srv_id_; i < end; i++) {
+        mdstopo_.srv_addrs[i] =
+            mdstopo_.replica_addrs[i * num_replicas + replica_id_ - 1];
+      }
+    }
+  }
+
   if (ok()) {
     status_ = config::LoadMDSTracing(&mdstopo_.mds_tracing);
+    mdstopo_.mds_trace_sampling = 0;
   }
 
   if (ok()) {
     mdstopo_.rpc_proto = config::RPCProto();
+    status_ = config::LoadRPCReplyCompression(&mdstopo_.rpc_reply_compression);
+  }
+
+  if (ok()) {
     num_vir_srvs = std::max(num_vir_srvs, num_srvs);
     mdstopo_.num_vir_srvs = num_vir_srvs;
     mdstopo_.num_srvs = num_srvs;
+    mdstopo_.num_replicas = num_replicas;
   }
 }
 
@@ -309,6 +457,7 @@ void MetadataServer::Builder::LoadMDSEnv() {
 void MetadataServer::Builder::OpenDB() {
   std::string output_root;
   bool disable_table_compaction;
+  bool scan_resistant_cache;
   uint64_t write_buffer_size;
   uint64_t table_size;
 
@@ -323,6 +472,14 @@ void MetadataServer::Builder::OpenDB() {
     if (ok()) {
       status_ = config::LoadVerifyChecksums(&mdbopts_.verify_checksums);
     }
+    if (ok()) {
+      status_ = config::LoadSyncMetadataWrites(&mdbopts_.sync);
+    }
+    if (ok()) {
+      status_ = config::LoadScanResistantMetadataCache(&scan_resistant_cache);
+    }
+    // Exported through the metrics registry
+    mdbopts_.collect_stats = true;
   }
 
   if (ok()) {
@@ -338,22 +495,40 @@ void MetadataServer::Builder::OpenDB() {
     dbopts_.compression = kSnappyCompression;
     dbopts_.disable_compaction = disable_table_compaction;
     dbopts_.disable_seek_compaction = disable_table_compaction;
+    dbopts_.scan_resistant_block_cache = scan_resistant_cache;
+    // Synced metadata writes overlap their log syncs with later updates
+    dbopts_.pipelined_wal_sync = mdbopts_.sync;
     dbopts_.write_buffer_size = write_buffer_size;
     dbopts_.table_file_size = table_size;
+    dbopts_.prefix_extractor = MDBPrefixExtractor();
+    dbopts_.data_block_hash_index = true;  // Speeds up stats
     dbopts_.skip_lock_file = true;
     dbopts_.info_log = Logger::Default();
     dbopts_.env = myenv_->env;
   }
 
-  if (ok()) {
+  // Each hosted server has its own db
+  for (uint64_t i = 0; ok() && i < num_shards_; i++) {
+    shards_.push_back(Shard());
+    Shard* const shard = &shards_.back();
+    shard->srv_id = srv_id_ + static_cast<int>(i);
     std::string dbhome = output_root;
     char tmp[30];
-    snprintf(tmp, sizeof(tmp), "/shard-%08d", srv_id_);
+    snprintf(tmp, sizeof(tmp), "/shard-%08d", shard->srv_id);
     dbhome += tmp;
-    status_ = DB::Open(dbopts_, dbhome, &db_);
+    if (replica_id_ != 0) {
+      // Follow the db written by our server
+      status_ = ReadonlyDB::Open(dbopts_, dbhome, &shard->db);
+      if (ok()) {
+        shard->replica = static_cast<ReadonlyDB*>(shard->db);
+      }
+    } else {
+      status_ = DB::Open(dbopts_, dbhome, &shard->db);
+    }
     if (ok()) {
-      mdbopts_.db = db_;
-      mdb_ = new MDB(mdbopts_);
+      MDBOptions mdbopts = mdbopts_;
+      mdbopts.db = shard->db;
+      shard->mdb = new MDB(mdbopts);
     }
   }
 }
@@ -362,12 +537,16 @@ void MetadataServer::Builder::OpenDB() {
 void MetadataServer::Builder::OpenMDS() {
   uint64_t lease_table_size;
   uint64_t dir_table_size;
+  uint64_t warmup_dirs;
 
   if (ok()) {
     status_ = config::LoadSizeOfSrvLeaseTable(&lease_table_size);
     if (ok()) {
       status_ = config::LoadSizeOfSrvDirTable(&dir_table_size);
     }
+    if (ok()) {
+      status_ = config::LoadNumOfSrvWarmupDirs(&warmup_dirs);
+    }
   }
 
   if (ok()) {
@@ -375,41 +554,56 @@ void MetadataServer::Builder::OpenMDS() {
   }
 
   if (ok()) {
-    mdsopts_.mdb = mdb_;
     mdsopts_.mds_env = myenv_;
     mdsopts_.lease_table_size = lease_table_size;
     mdsopts_.dir_table_size = dir_table_size;
+    mdsopts_.warmup_dirs = warmup_dirs;
+    mdsopts_.read_only = (replica_id_ != 0);
     mdsopts_.num_virtual_servers = mdstopo_.num_vir_srvs;
     mdsopts_.num_servers = mdstopo_.num_srvs;
     mdsopts_.snap_id = snap_id_;
     mdsopts_.reg_id = reg_id_;
-    mdsopts_.srv_id = srv_id_;
   }
 
-  if (ok()) {
-    mds_ = MDS::Open(mdsopts_);
-    mdsmon_ = new MDSMonitor(mds_);
+  for (size_t i = 0; ok() && i < shards_.size(); i++) {
+    Shard* const shard = &shards_[i];
+    MDSOptions mdsopts = mdsopts_;
+    mdsopts.mdb = shard->mdb;
+    mdsopts.srv_id = shard->srv_id;
+    shard->mds = MDS::Open(mdsopts);
+    shard->mdsmon = new MDSMonitor(shard->mds);
   }
 }
 
 // REQUIRES: OpenMDS() has been called.
 void MetadataServer::Builder::OpenRPC() {
-  std::string uri;
-
   if (ok()) {
-    Slice srv_addr = mdstopo_.srv_addrs[srv_id_];
-    Slice proto = mdstopo_.rpc_proto;
-    if (!srv_addr.starts_with(proto)) {
-      uri += proto.c_str();
-      uri += "://";
+    status_ = config::LoadNumOfSrvRpcWorkers(&num_rpc_workers_);
+    if (ok() && num_rpc_workers_ == 0) {
+      status_ = Status::InvalidArgument("bad num of rpc workers");
     }
-    uri += srv_addr.c_str();
   }
 
+  // Each hosted server listens on its own address and has its own workers,
+  // so calls are steered to their servers by the transport
   if (ok()) {
-    wrapper_ = new RPCWrapper(mdsmon_);
-    rpc_ = new RPCServer(wrapper_);
-    rpc_->AddChannel(uri, 4);  // FIXME
+    rpc_ = new RPCServer(NULL);
+    for (size_t i = 0; i < shards_.size(); i++) {
+      Shard* const shard = &shards_[i];
+      std::string uri;
+      Slice srv_addr = mdstopo_.srv_addrs[shard->srv_id];
+      Slice proto = mdstopo_.rpc_proto;
+      if (!srv_addr.starts_with(proto)) {
+        uri += proto.c_str();
+        uri += "://";
+      }
+      uri += srv_addr.c_str();
+      shard->wrapper =
+          new RPCWrapper(shard->mdsmon, mdstopo_.rpc_reply_compression);
+      shard->rpc_latency = new ConcurrentHistogram;
+      rpc_->AddChannel(uri, static_cast<int>(num_rpc_workers_),
+                       shard->rpc_latency, shard->wrapper);
+    }
   }
 }
 
@@ -419,6 +613,7 @@ static void PrintRunInfo(const std::string& info, const std::string& fname) {
 #endif
 }
 
+// Write the address of each hosted server into its own uri file.
 // REQUIRES: server has been successfully built
 void MetadataServer::Builder::WriteRunInfo() {
   std::string run_dir = config::RunDir();
@@ -426,24 +621,37 @@ void MetadataServer::Builder::WriteRunInfo() {
     Env* const env = myenv_->env;
     // Ignore error because it may already exist
     env->CreateDir(run_dir.c_str());
-    std::string fname = run_dir;
-    char tmp[30];
-    snprintf(tmp, sizeof(tmp), "/srv-%08d.uri", srv_id_);
-    fname += tmp;
-    WritableFile* f;
-    Status s = env->NewWritableFile(fname.c_str(), &f);
-    if (s.ok()) {
-      const std::string& info = mdstopo_.srv_addrs[srv_id_];
-      assert(info.size() != 0);
-      s = f->Append(info);
+    for (size_t i = 0; i < shards_.size(); i++) {
+      const int srv_id = shards_[i].srv_id;
+      std::string fname = run_dir;
+      char tmp[50];
+      if (replica_id_ != 0) {
+        snprintf(tmp, sizeof(tmp), "/srv-%08d-r%llu.uri", srv_id,
+                 static_cast<unsigned long long>(replica_id_));
+      } else {
+        snprintf(tmp, sizeof(tmp), "/srv-%08d.uri", srv_id);
+      }
+      fname += tmp;
+      if (i == 0) {
+        // Metrics are periodically dumped next to the uri file of the first
+        // server we host
+        metrics_fname_ = fname.substr(0, fname.size() - 4) + ".metrics";
+      }
+      WritableFile* f;
+      Status s = env->NewWritableFile(fname.c_str(), &f);
       if (s.ok()) {
-        s = f->Flush();
+        const std::string& info = mdstopo_.srv_addrs[srv_id];
+        assert(info.size() != 0);
+        s = f->Append(info);
         if (s.ok()) {
-          PrintRunInfo(info, fname);
+          s = f->Flush();
+          if (s.ok()) {
+            PrintRunInfo(info, fname);
+          }
         }
+        f->Close();
+        delete f;
       }
-      f->Close();
-      delete f;
     }
   }
 }
@@ -460,21 +668,23 @@ MetadataServer* MetadataServer::Builder::BuildServer() {
     WriteRunInfo();
     MetadataServer* srv = new MetadataServer;
     srv->rpc_ = rpc_;
-    srv->wrapper_ = wrapper_;
-    srv->mds_ = mds_;
-    srv->mdsmon_ = mdsmon_;
+    srv->shards_.swap(shards_);
+    srv->metrics_fname_ = metrics_fname_;
     srv->myenv_ = myenv_;
-    srv->mdb_ = mdb_;
-    srv->db_ = db_;
+    srv->RegisterMetrics();
     return srv;
   } else {
     delete rpc_;
-    delete wrapper_;
-    delete mdsmon_;
-    delete mds_;
+    for (size_t i = 0; i < shards_.size(); i++) {
+      Shard* const shard = &shards_[i];
+      delete shard->rpc_latency;
+      delete shard->wrapper;
+      delete shard->mdsmon;
+      delete shard->mds;
+      delete shard->mdb;
+      delete shard->db;
+    }
     delete myenv_;
-    delete mdb_;
-    delete db_;
     return NULL;
   }
 }
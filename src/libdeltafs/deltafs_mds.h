@@ -12,9 +12,13 @@
  */
 
 #include "mds_srv.h"
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/metrics.h"
 #include "pdlfs-common/port.h"
 #include "pdlfs-common/rpc.h"
 
+#include <vector>
+
 namespace pdlfs {
 
 class MetadataServer {
@@ -36,8 +40,33 @@ class MetadataServer {
   void operator=(const MetadataServer&);
   MetadataServer(const MetadataServer&);
 
-  MetadataServer() : interrupted_(NULL), cv_(&mutex_), running_(false) {}
-  static void PrintStatus(const Status&, const MDSMonitor*);
+  MetadataServer()
+      : interrupted_(NULL), cv_(&mutex_), running_(false), rpc_(NULL) {}
+  // One of the metadata servers hosted by the process. Shards share nothing
+  // but the rpc server, where each shard has its own channel and workers.
+  struct Shard {
+    Shard()
+        : srv_id(-1),
+          wrapper(NULL),
+          mds(NULL),
+          mdsmon(NULL),
+          mdb(NULL),
+          db(NULL),
+          replica(NULL),
+          rpc_latency(NULL) {}
+    int srv_id;
+    RPCWrapper* wrapper;
+    MDS* mds;
+    MDSMonitor* mdsmon;
+    MDB* mdb;
+    DB* db;
+    ReadonlyDB* replica;  // Same as db if we are a read-only replica
+    // Latency of incoming rpc calls
+    ConcurrentHistogram* rpc_latency;
+  };
+  static void PrintStatus(const Status&, const std::vector<Shard>&);
+  void RegisterMetrics();
+  void DumpMetrics();
   MDSEnv* myenv_;
   port::AtomicPointer interrupted_;
   port::Mutex mutex_;
@@ -45,12 +74,10 @@ class MetadataServer {
   bool running_;
 
   RPCServer* rpc_;
-  RPCWrapper* wrapper_;
+  std::vector<Shard> shards_;
 
-  MDS* mds_;
-  MDSMonitor* mdsmon_;
-  MDB* mdb_;
-  DB* db_;
+  MetricsRegistry metrics_;
+  std::string metrics_fname_;  // Empty if metrics are not dumped
 };
 
 }  // namespace pdlfs
@@ -23,11 +23,16 @@ Slice MDS::EncodeId(const DirId& id, char* scratch) {
   return Slice(scratch, p - scratch);
 }
 
-// Deterministically map directories to their zeroth servers.
+// Deterministically map directories to their zeroth servers. The result is
+// never negative so callers can take it modulo the number of servers. The
+// root is always mapped to server 0, which is where clients look for it.
 int MDS::PickupServer(const DirId& id) {
+  if (id == DirId(0, 0, 0)) {
+    return 0;
+  }
   char tmp[30];
   Slice encoding = EncodeId(id, tmp);
-  int zserver = DirIndex::RandomServer(encoding, 0);
+  int zserver = DirIndex::RandomServer(encoding, 0) & 0x7fffffff;
   return zserver;
 }
 
@@ -37,6 +42,10 @@ MDSOptions::MDSOptions()
       dir_table_size(4096),
       lease_table_size(4096),
       lease_duration(1000 * 1000),
+      ino_batch_size(4096),
+      warmup_dirs(0),
+      warmup_threads(4),
+      read_only(false),
       snap_id(0),
       reg_id(0),
       paranoid_checks(false),
@@ -49,10 +58,19 @@ MDS::SRV::SRV(const MDSOptions& options)
       mdb_(options.mdb),
       paranoid_checks_(options.paranoid_checks),
       lease_duration_(options.lease_duration),
+      ino_batch_size_(std::max<uint64_t>(1, options.ino_batch_size)),
+      warmup_dirs_(options.warmup_dirs),
+      read_only_(options.read_only),
       snap_id_(options.snap_id),
       reg_id_(options.reg_id),
       srv_id_(options.srv_id),
-      loading_cv_(&mutex_),
+      warmup_cv_(&warmup_mu_),
+      warmup_pool_(NULL),
+      warmup_next_(0),
+      warmup_loaded_(0),
+      warmup_start_(0),
+      warmup_running_(0),
+      warmup_cancelled_(false),
       session_(0),
       ino_(0) {
   giga_.num_servers = options.num_servers;
@@ -61,21 +79,57 @@ MDS::SRV::SRV(const MDSOptions& options)
 
   LeaseOptions lease_options;
   lease_options.max_lease_duration = options.lease_duration;
-  lease_options.max_num_leases = options.lease_table_size;
-  leases_ = new LeaseTable(lease_options);
-
-  dirs_ = new DirTable(options.dir_table_size);
+  lease_options.max_num_leases =
+      (options.lease_table_size + kNumPartitions - 1) / kNumPartitions;
+  const size_t dir_table_size =
+      (options.dir_table_size + kNumPartitions - 1) / kNumPartitions;
+  for (int i = 0; i < kNumPartitions; i++) {
+    parts_[i].leases = new LeaseTable(lease_options);
+    parts_[i].dirs = new DirTable(dir_table_size);
+  }
 
   assert(srv_id_ >= 0);
   session_ = srv_id_;
   uint64_t tmp = srv_id_;
   tmp <<= 32;
   ino_ = tmp;
+  // Skip all inode numbers that may have been handed out before
+  uint64_t mark;
+  Status s = mdb_->GetInoMark(&mark);
+  if (s.ok()) {
+    ino_ = std::max(ino_, mark);
+  } else if (!s.IsNotFound()) {
+    status_ = s;
+  }
+  ino_mark_ = ino_;
+
+  if (warmup_dirs_ != 0 && status_.ok()) {
+    StartWarmup(std::max(1, options.warmup_threads));
+  }
 }
 
 MDS::SRV::~SRV() {
-  delete leases_;
-  delete dirs_;
+  StopWarmup();
+  if (warmup_dirs_ != 0 && !read_only_) {
+    SaveWarmupList();
+  }
+#if VERBOSE >= 1
+  LeaseStats total;
+  for (int i = 0; i < kNumPartitions; i++) {
+    const LeaseStats* const stats = parts_[i].leases->stats();
+    total.grants += stats->grants;
+    total.waits += stats->waits;
+    total.evictions += stats->evictions;
+  }
+  Verbose(__LOG_ARGS__, 1,
+          "mds.leases: %llu granted, %llu waited, %llu evicted",
+          (unsigned long long)total.grants, (unsigned long long)total.waits,
+          (unsigned long long)total.evictions);
+#endif
+  for (int i = 0; i < kNumPartitions; i++) {
+    delete parts_[i].leases;
+    delete parts_[i].dirs;
+  }
 }
 
 MDS* MDS::Open(const MDSOptions& options) {
@@ -88,6 +142,12 @@ MDS* MDS::Open(const MDSOptions& options) {
   Verbose(__LOG_ARGS__, 1, "mds.dir_table_size -> %zu", options.dir_table_size);
   Verbose(__LOG_ARGS__, 1, "mds.lease_table_size -> %zu",
           options.lease_table_size);
+  Verbose(__LOG_ARGS__, 1, "mds.ino_batch_size -> %llu",
+          (unsigned long long)options.ino_batch_size);
+  Verbose(__LOG_ARGS__, 1, "mds.warmup_dirs -> %zu", options.warmup_dirs);
+  Verbose(__LOG_ARGS__, 1, "mds.warmup_threads -> %d",
+          options.warmup_threads);
+  Verbose(__LOG_ARGS__, 1, "mds.read_only -> %d", int(options.read_only));
   Verbose(__LOG_ARGS__, 1, "mds.reg_id -> %llu",
           (unsigned long long)options.reg_id);
   Verbose(__LOG_ARGS__, 1, "mds.snap_id -> %llu",
@@ -107,7 +167,13 @@ MDSCliOptions::MDSCliOptions()
       lookup_cache_size(4096),
       paranoid_checks(false),
       atomic_path_resolution(false),
+      negative_lookups(false),
       max_redirects_allowed(20),
+      max_parallel_lists(8),
+      max_lookahead(8),
+      attr_lease(0),
+      lease_renewal_window(0),
+      attr_cache_size(4096),
       num_virtual_servers(1),
       num_servers(1),
       session_id(0),
@@ -120,7 +186,12 @@ MDS::CLI::CLI(const MDSCliOptions& options)
       factory_(options.factory),
       paranoid_checks_(options.paranoid_checks),
       atomic_path_resolution_(options.atomic_path_resolution),
+      negative_lookups_(options.negative_lookups),
       max_redirects_allowed_(options.max_redirects_allowed),
+      max_parallel_lists_(options.max_parallel_lists),
+      max_lookahead_(options.max_lookahead),
+      attr_lease_(options.attr_lease),
+      lease_renewal_window_(options.lease_renewal_window),
       session_id_(options.session_id),
       cli_id_(options.cli_id),
       uid_(options.uid),
@@ -131,9 +202,14 @@ MDS::CLI::CLI(const MDSCliOptions& options)
 
   lookup_cache_ = new LookupCache(options.lookup_cache_size);
   index_cache_ = new IndexCache(options.index_cache_size);
+  attr_cache_ = NULL;
+  if (attr_lease_ != 0) {
+    attr_cache_ = new AttrCache(options.attr_cache_size);
+  }
 }
 
 MDS::CLI::~CLI() {
+  delete attr_cache_;
   delete index_cache_;
   delete lookup_cache_;
 }
@@ -149,6 +225,18 @@ MDS::CLI* MDS::CLI::Open(const MDSCliOptions& options) {
           options.index_cache_size);
   Verbose(__LOG_ARGS__, 1, "mds.cli.lookup_cache_size -> %zu",
           options.lookup_cache_size);
+  Verbose(__LOG_ARGS__, 1, "mds.cli.max_parallel_lists -> %d",
+          options.max_parallel_lists);
+  Verbose(__LOG_ARGS__, 1, "mds.cli.max_lookahead -> %d",
+          options.max_lookahead);
+  Verbose(__LOG_ARGS__, 1, "mds.cli.negative_lookups -> %d",
+          int(options.negative_lookups));
+  Verbose(__LOG_ARGS__, 1, "mds.cli.attr_lease -> %llu (us)",
+          static_cast<unsigned long long>(options.attr_lease));
+  Verbose(__LOG_ARGS__, 1, "mds.cli.lease_renewal_window -> %llu (us)",
+          static_cast<unsigned long long>(options.lease_renewal_window));
+  Verbose(__LOG_ARGS__, 1, "mds.cli.attr_cache_size -> %zu",
+          options.attr_cache_size);
   Verbose(__LOG_ARGS__, 1, "mds.cli.session_id -> %d", options.session_id);
   Verbose(__LOG_ARGS__, 1, "mds.cli.cli_id -> %d", options.cli_id);
   Verbose(__LOG_ARGS__, 1, "mds.cli.uid -> %d", options.uid);
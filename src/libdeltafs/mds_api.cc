@@ -11,10 +11,25 @@
 
 #include "mds_api.h"
 
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
+
 namespace pdlfs {
 
 MDS::~MDS() {}
 
+MDS::CompoundItem::CompoundItem()
+    : op(0),
+      chained(0),
+      flags(0),
+      mode(0),
+      uid(0),
+      gid(0),
+      mtime(0),
+      size(0) {}
+
+MDS::CompoundOptions::CompoundOptions() { dir_id = DirId(0, 0, 0); }
+
 MDS::RPC::CLI::~CLI() {}
 
 MDS::RPC::SRV::~SRV() {}
@@ -27,6 +42,16 @@ MDSWrapper::~MDSWrapper() {}
 
 MDSTracer::~MDSTracer() {}
 
+std::string MDSTracer::OpNames() {
+  std::string result;
+#define ADD_OP_NAME(OP)                \
+  if (!result.empty()) result += ","; \
+  result += #OP;
+  MDS_TRACED_OPS(ADD_OP_NAME)
+#undef ADD_OP_NAME
+  return result;
+}
+
 static char* EncodeDirId(char* dst, const DirId& id) {
   dst = EncodeVarint64(dst, id.reg);
   dst = EncodeVarint64(dst, id.snap);
@@ -66,7 +91,10 @@ enum {
   kUnlink, kLookup, kListdir, kReadidx,
   kOpensession,
   kGetinput,
-  kGetoutput
+  kGetoutput,
+  kBcreat,
+  kCompound,
+  kBulkin
 };
 /* clang-format on */
 }  // namespace
@@ -77,6 +105,79 @@ static inline rpc::If::Message& AddOp(rpc::If::Message& msg, int op) {
   return msg;
 }
 
+// Flags optionally appended to Listdir and Readidx requests.
+// Absent in requests from older clients.
+enum { kCompressedReplies = 1 };
+
+// Listings are split into replies of about this many bytes so that each
+// fits in a single message of every transport we use (e.g., udp).
+static const size_t kListdirReplyBytes = 1000;
+
+// Append "raw" to *dst prefixed by a one-byte compression type. "raw" is
+// compressed using "type" if it is at least "min" bytes and compresses to
+// fewer bytes.
+static void PutReply(std::string* dst, const Slice& raw, CompressionType type,
+                     size_t min) {
+  std::string compressed;
+  bool ok = false;
+  if (raw.size() >= min) {
+    switch (type) {
+      case kSnappyCompression:
+        ok = port::Snappy_Compress(raw.data(), raw.size(), &compressed);
+        break;
+      case kLz4Compression:
+        ok = port::Lz4_Compress(raw.data(), raw.size(), &compressed);
+        break;
+      default:
+        break;
+    }
+  }
+  if (ok && compressed.size() < raw.size()) {
+    dst->push_back(static_cast<char>(type));
+    dst->append(compressed);
+  } else {
+    dst->push_back(static_cast<char>(kNoCompression));
+    dst->append(raw.data(), raw.size());
+  }
+}
+
+// Reverse PutReply(). *result may point to *scratch on success.
+static bool GetReply(const Slice& input, Slice* result, std::string* scratch) {
+  if (input.empty()) {
+    return false;
+  }
+  const char* data = input.data() + 1;
+  const size_t n = input.size() - 1;
+  size_t len;
+  switch (static_cast<unsigned char>(input[0])) {
+    case kNoCompression:
+      *result = Slice(data, n);
+      return true;
+    case kSnappyCompression:
+      if (!port::Snappy_GetUncompressedLength(data, n, &len)) {
+        return false;
+      }
+      scratch->resize(len);
+      if (!port::Snappy_Uncompress(data, n, &(*scratch)[0])) {
+        return false;
+      }
+      break;
+    case kLz4Compression:
+      if (!port::Lz4_GetUncompressedLength(data, n, &len)) {
+        return false;
+      }
+      scratch->resize(len);
+      if (!port::Lz4_Uncompress(data, n, &(*scratch)[0], len)) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+  }
+  *result = Slice(*scratch);
+  return true;
+}
+
 // RPC dispatcher
 Status MDS::RPC::SRV::Call(Msg& in, Msg& out) RPCNOEXCEPT {
   switch (in.op) {
@@ -89,12 +190,21 @@ Status MDS::RPC::SRV::Call(Msg& in, Msg& out) RPCNOEXCEPT {
     case kFcreat:
       FCRET(in, out);
       break;
+    case kBcreat:
+      BCRET(in, out);
+      break;
+    case kBulkin:
+      BULKI(in, out);
+      break;
     case kTrunc:
       TRUNC(in, out);
       break;
     case kUnlink:
       UNLNK(in, out);
       break;
+    case kCompound:
+      CMPND(in, out);
+      break;
     case kMkdir:
       MKDIR(in, out);
       break;
@@ -296,6 +406,162 @@ void MDS::RPC::SRV::FCRET(Msg& in, Msg& out) {
   }
 }
 
+Status MDS::RPC::CLI::Bcreat(const BcreatOptions& options, BcreatRet* ret) {
+  Status s;
+  Msg in;
+  assert(options.names.size() == options.name_hashes.size());
+  PutDirId(&in.extra_buf, options.dir_id);
+  PutVarint32(&in.extra_buf, options.flags);
+  PutVarint32(&in.extra_buf, options.mode);
+  PutVarint32(&in.extra_buf, options.uid);
+  PutVarint32(&in.extra_buf, options.gid);
+  PutVarint32(&in.extra_buf, options.session_id);
+  PutVarint64(&in.extra_buf, options.op_due);
+  PutVarint32(&in.extra_buf, static_cast<uint32_t>(options.names.size()));
+  for (size_t i = 0; i < options.names.size(); i++) {
+    PutLengthPrefixedSlice(&in.extra_buf, options.name_hashes[i]);
+    PutLengthPrefixedSlice(&in.extra_buf, options.names[i]);
+  }
+  in.contents = Slice(in.extra_buf);
+
+  Msg out;
+  s = stub_->Call(AddOp(in, kBcreat), out);
+  if (s.ok()) {
+    Slice contents = out.contents;
+    if (out.err == -1) {
+      Redirect re(contents.data(), contents.size());
+      throw re;
+    } else if (out.err != 0) {
+      s = Status::FromCode(out.err);
+    } else {
+      ret->statuses.clear();
+      uint32_t err;
+      for (size_t i = 0; i < options.names.size(); i++) {
+        if (GetVarint32(&contents, &err)) {
+          ret->statuses.push_back(err == 0 ? Status::OK()
+                                           : Status::FromCode(err));
+        } else {
+          s = Status::Corruption(Slice());
+          break;
+        }
+      }
+    }
+  }
+  return s;
+}
+
+void MDS::RPC::SRV::BCRET(Msg& in, Msg& out) {
+  Status s;
+  BcreatOptions options;
+  BcreatRet ret;
+  assert(in.op == kBcreat);
+  Slice input = in.contents;
+  uint32_t num_names = 0;
+  if (!GetDirId(&input, &options.dir_id) ||
+      !GetVarint32(&input, &options.flags) ||
+      !GetVarint32(&input, &options.mode) ||
+      !GetVarint32(&input, &options.uid) ||
+      !GetVarint32(&input, &options.gid) ||
+      !GetVarint32(&input, &options.session_id) ||
+      !GetVarint64(&input, &options.op_due) ||
+      !GetVarint32(&input, &num_names)) {
+    s = Status::InvalidArgument(Slice());
+  } else {
+    Slice hash;
+    Slice name;
+    for (uint32_t i = 0; i < num_names; i++) {
+      if (!GetLengthPrefixedSlice(&input, &hash) ||
+          !GetLengthPrefixedSlice(&input, &name)) {
+        s = Status::InvalidArgument(Slice());
+        break;
+      } else {
+        options.name_hashes.push_back(hash);
+        options.names.push_back(name);
+      }
+    }
+  }
+  if (s.ok()) {
+    try {
+      s = mds_->Bcreat(options, &ret);
+    } catch (Redirect& re) {
+      out.extra_buf.swap(re);
+      out.contents = Slice(out.extra_buf);
+      out.err = -1;
+      return;
+    }
+  }
+  if (s.ok() && ret.statuses.size() != options.names.size()) {
+    s = Status::Corruption(Slice());
+  }
+  if (s.ok()) {
+    for (size_t i = 0; i < ret.statuses.size(); i++) {
+      PutVarint32(&out.extra_buf, ret.statuses[i].err_code());
+    }
+    out.contents = Slice(out.extra_buf);
+    out.err = 0;
+  } else {
+    out.err = s.err_code();
+  }
+}
+
+Status MDS::RPC::CLI::Bulkin(const BulkinOptions& options, BulkinRet* ret) {
+  Status s;
+  Msg in;
+  PutDirId(&in.extra_buf, options.dir_id);
+  PutLengthPrefixedSlice(&in.extra_buf, options.dir);
+  PutVarint64(&in.extra_buf, options.num_entries);
+  PutVarint32(&in.extra_buf, options.session_id);
+  PutVarint64(&in.extra_buf, options.op_due);
+  in.contents = Slice(in.extra_buf);
+
+  Msg out;
+  s = stub_->Call(AddOp(in, kBulkin), out);
+  if (s.ok()) {
+    Slice contents = out.contents;
+    if (out.err == -1) {
+      Redirect re(contents.data(), contents.size());
+      throw re;
+    } else if (out.err != 0) {
+      s = Status::FromCode(out.err);
+    } else if (!GetVarint64(&contents, &ret->first_ino)) {
+      s = Status::Corruption(Slice());
+    }
+  }
+  return s;
+}
+
+void MDS::RPC::SRV::BULKI(Msg& in, Msg& out) {
+  Status s;
+  BulkinOptions options;
+  BulkinRet ret;
+  assert(in.op == kBulkin);
+  Slice input = in.contents;
+  if (!GetDirId(&input, &options.dir_id) ||
+      !GetLengthPrefixedSlice(&input, &options.dir) ||
+      !GetVarint64(&input, &options.num_entries) ||
+      !GetVarint32(&input, &options.session_id) ||
+      !GetVarint64(&input, &options.op_due)) {
+    s = Status::InvalidArgument(Slice());
+  } else {
+    ret.first_ino = 0;
+    try {
+      s = mds_->Bulkin(options, &ret);
+    } catch (Redirect& re) {
+      out.extra_buf.swap(re);
+      out.contents = Slice(out.extra_buf);
+      out.err = -1;
+      return;
+    }
+  }
+  if (s.ok()) {
+    char* p = EncodeVarint64(out.buf, ret.first_ino);
+    out.contents = Slice(out.buf, p - out.buf);
+    out.err = 0;
+  } else {
+    out.err = s.err_code();
+  }
+}
+
 Status MDS::RPC::CLI::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
   Status s;
   Msg in;
@@ -382,7 +648,16 @@ void MDS::RPC::SRV::MKDIR(Msg& in, Msg& out) {
 Status MDS::RPC::CLI::Lookup(const LookupOptions& options, LookupRet* ret) {
   Status s;
   Msg in;
-  if (!kDebugRPC) {
+  if (!options.rest.empty() || options.negative_lease) {
+    PutDirId(&in.extra_buf, options.dir_id);
+    PutLengthPrefixedSlice(&in.extra_buf, options.name_hash);
+    PutLengthPrefixedSlice(&in.extra_buf, options.name);
+    PutVarint32(&in.extra_buf, options.session_id);
+    PutVarint64(&in.extra_buf, options.op_due);
+    PutLengthPrefixedSlice(&in.extra_buf, options.rest);
+    in.extra_buf.push_back(options.negative_lease);
+    in.contents = Slice(in.extra_buf);
+  } else if (!kDebugRPC) {
     char* scratch = &in.buf[0];
     char* p = scratch;
     p = EncodeDirId(p, options.dir_id);
@@ -407,13 +682,35 @@ Status MDS::RPC::CLI::Lookup(const LookupOptions& options, LookupRet* ret) {
   if (s.ok()) {
     s = stub_->Call(AddOp(in, kLookup), out);
     if (s.ok()) {
+      Slice input = out.contents;
+      uint32_t num_more = 0;
+      uint64_t lease_due = 0;
       if (out.err == -1) {
         Redirect re(out.contents.data(), out.contents.size());
         throw re;
       } else if (out.err != 0) {
         s = Status::FromCode(out.err);
-      } else if (!ret->stat.DecodeFrom(out.contents)) {
+        // A negative result may come with a lease
+        if (s.IsNotFound() && GetVarint64(&input, &lease_due)) {
+          ret->stat.SetLeaseDue(lease_due);
+        } else {
+          ret->stat.SetLeaseDue(0);
+        }
+      } else if (!ret->stat.DecodeFrom(&input)) {
+        s = Status::Corruption(Slice());
+      } else if (!input.empty() &&  // Absent in replies from older servers
+                 !GetVarint32(&input, &num_more)) {
         s = Status::Corruption(Slice());
+      } else {
+        LookupStat stat;
+        for (uint32_t i = 0; i < num_more; i++) {
+          if (!stat.DecodeFrom(&input)) {
+            s = Status::Corruption(Slice());
+            break;
+          } else if (ret->more != NULL) {
+            ret->more->push_back(stat);
+          }
+        }
       }
     }
   }
@@ -423,7 +720,9 @@ Status MDS::RPC::CLI::Lookup(const LookupOptions& options, LookupRet* ret) {
 void MDS::RPC::SRV::LOKUP(Msg& in, Msg& out) {
   Status s;
   LookupOptions options;
+  std::vector<LookupStat> more;
   LookupRet ret;
+  ret.more = &more;
   assert(in.op == kLookup);
   Slice input = in.contents;
   if (!GetDirId(&input, &options.dir_id) ||
@@ -432,7 +731,14 @@ void MDS::RPC::SRV::LOKUP(Msg& in, Msg& out) {
       !GetVarint32(&input, &options.session_id) ||
       !GetVarint64(&input, &options.op_due)) {
     s = Status::InvalidArgument(Slice());
+  } else if (!input.empty() &&  // Absent in requests from older clients
+             !GetLengthPrefixedSlice(&input, &options.rest)) {
+    s = Status::InvalidArgument(Slice());
   } else {
+    if (!input.empty()) {
+      options.negative_lease = static_cast<unsigned char>(input[0]);
+    }
+    ret.stat.SetLeaseDue(0);
     try {
       s = mds_->Lookup(options, &ret);
     } catch (Redirect& re) {
@@ -442,9 +748,24 @@ void MDS::RPC::SRV::LOKUP(Msg& in, Msg& out) {
       return;
     }
   }
-  if (s.ok()) {
+  if (s.ok() && !options.rest.empty()) {
+    char tmp[LookupStat::kMaxEncodedLength];
+    Slice encoding = ret.stat.EncodeTo(tmp);
+    out.extra_buf.append(encoding.data(), encoding.size());
+    PutVarint32(&out.extra_buf, more.size());
+    for (size_t i = 0; i < more.size(); i++) {
+      encoding = more[i].EncodeTo(tmp);
+      out.extra_buf.append(encoding.data(), encoding.size());
+    }
+    out.contents = Slice(out.extra_buf);
+    out.err = 0;
+  } else if (s.ok()) {
     out.contents = ret.stat.EncodeTo(out.buf);
     out.err = 0;
+  } else if (s.IsNotFound() && ret.stat.LeaseDue() != 0) {
+    char* p = EncodeVarint64(out.buf, ret.stat.LeaseDue());
+    out.contents = Slice(out.buf, p - out.buf);
+    out.err = s.err_code();
   } else {
     out.err = s.err_code();
   }
@@ -909,6 +1230,132 @@ void MDS::RPC::SRV::UNLNK(Msg& in, Msg& out) {
   }
 }
 
+Status MDS::RPC::CLI::Compound(const CompoundOptions& options,
+                               CompoundRet* ret) {
+  Status s;
+  Msg in;
+  PutVarint32(&in.extra_buf, options.session_id);
+  PutVarint64(&in.extra_buf, options.op_due);
+  PutVarint32(&in.extra_buf, static_cast<uint32_t>(options.items.size()));
+  for (size_t i = 0; i < options.items.size(); i++) {
+    const CompoundItem& item = options.items[i];
+    in.extra_buf.push_back(static_cast<char>(item.op));
+    in.extra_buf.push_back(static_cast<char>(item.chained));
+    PutDirId(&in.extra_buf, item.dir_id);
+    PutLengthPrefixedSlice(&in.extra_buf, item.name_hash);
+    PutLengthPrefixedSlice(&in.extra_buf, item.name);
+    PutVarint32(&in.extra_buf, item.flags);
+    PutVarint32(&in.extra_buf, item.mode);
+    PutVarint32(&in.extra_buf, item.uid);
+    PutVarint32(&in.extra_buf, item.gid);
+    PutVarint64(&in.extra_buf, item.mtime);
+    PutVarint64(&in.extra_buf, item.size);
+  }
+  in.contents = Slice(in.extra_buf);
+
+  Msg out;
+  s = stub_->Call(AddOp(in, kCompound), out);
+  if (s.ok()) {
+    Slice contents = out.contents;
+    uint32_t num_results = 0;
+    if (out.err != 0) {
+      s = Status::FromCode(out.err);
+    } else if (!GetVarint32(&contents, &num_results) ||
+               num_results > options.items.size()) {
+      s = Status::Corruption(Slice());
+    } else {
+      ret->statuses.clear();
+      ret->stats.clear();
+      ret->lease_dues.clear();
+      uint32_t err;
+      for (uint32_t i = 0; i < num_results; i++) {
+        ret->stats.resize(ret->stats.size() + 1);
+        ret->lease_dues.push_back(0);
+        if (!GetVarint32(&contents, &err)) {
+          s = Status::Corruption(Slice());
+        } else if (err != 0) {
+          ret->statuses.push_back(Status::FromCode(err));
+        } else if (!ret->stats.back().DecodeFrom(&contents)) {
+          s = Status::Corruption(Slice());
+        } else if (options.items[i].op == kLookupOp &&
+                   !GetVarint64(&contents, &ret->lease_dues.back())) {
+          s = Status::Corruption(Slice());
+        } else {
+          ret->statuses.push_back(Status::OK());
+        }
+        if (!s.ok()) {
+          break;
+        }
+      }
+    }
+  }
+  return s;
+}
+
+void MDS::RPC::SRV::CMPND(Msg& in, Msg& out) {
+  Status s;
+  CompoundOptions options;
+  CompoundRet ret;
+  assert(in.op == kCompound);
+  Slice input = in.contents;
+  uint32_t num_items = 0;
+  if (!GetVarint32(&input, &options.session_id) ||
+      !GetVarint64(&input, &options.op_due) ||
+      !GetVarint32(&input, &num_items)) {
+    s = Status::InvalidArgument(Slice());
+  } else {
+    for (uint32_t i = 0; i < num_items; i++) {
+      options.items.push_back(CompoundItem());
+      CompoundItem* const item = &options.items.back();
+      if (input.size() < 2) {
+        s = Status::InvalidArgument(Slice());
+        break;
+      }
+      item->op = static_cast<unsigned char>(input[0]);
+      item->chained = static_cast<unsigned char>(input[1]);
+      input.remove_prefix(2);
+      if (!GetDirId(&input, &item->dir_id) ||
+          !GetLengthPrefixedSlice(&input, &item->name_hash) ||
+          !GetLengthPrefixedSlice(&input, &item->name) ||
+          !GetVarint32(&input, &item->flags) ||
+          !GetVarint32(&input, &item->mode) ||
+          !GetVarint32(&input, &item->uid) ||
+          !GetVarint32(&input, &item->gid) ||
+          !GetVarint64(&input, &item->mtime) ||
+          !GetVarint64(&input, &item->size)) {
+        s = Status::InvalidArgument(Slice());
+        break;
+      }
+    }
+  }
+  if (s.ok()) {
+    s = mds_->Compound(options, &ret);
+  }
+  if (s.ok() && (ret.statuses.size() > options.items.size() ||
+                 ret.stats.size() != ret.statuses.size() ||
+                 ret.lease_dues.size() != ret.statuses.size())) {
+    s = Status::Corruption(Slice());
+  }
+  if (s.ok()) {
+    char tmp[Stat::kMaxEncodedLength];
+    PutVarint32(&out.extra_buf, static_cast<uint32_t>(ret.statuses.size()));
+    for (size_t i = 0; i < ret.statuses.size(); i++) {
+      PutVarint32(&out.extra_buf, ret.statuses[i].err_code());
+      if (ret.statuses[i].ok()) {
+        Slice encoding = ret.stats[i].EncodeTo(tmp);
+        out.extra_buf.append(encoding.data(), encoding.size());
+        if (options.items[i].op == kLookupOp) {
+          PutVarint64(&out.extra_buf, ret.lease_dues[i]);
+        }
+      }
+    }
+    out.contents = Slice(out.extra_buf);
+    out.err = 0;
+  } else {
+    out.err = s.err_code();
+  }
+}
+
 Status MDS::RPC::CLI::Listdir(const ListdirOptions& options, ListdirRet* ret) {
   Status s;
   Msg in;
@@ -917,16 +1364,27 @@ Status MDS::RPC::CLI::Listdir(const ListdirOptions& options, ListdirRet* ret) {
   p = EncodeDirId(p, options.dir_id);
   p = EncodeVarint32(p, options.session_id);
   p = EncodeVarint64(p, options.op_due);
+  p = EncodeLengthPrefixedSlice(p, options.start);
+  *(p++) = static_cast<char>(options.with_stats);
+  if (compressed_replies_) {
+    *(p++) = static_cast<char>(kCompressedReplies);
+  }
   in.contents = Slice(scratch, p - scratch);
   Msg out;
   s = stub_->Call(AddOp(in, kListdir), out);
   if (s.ok()) {
     std::vector<std::string>* names = ret->names;
+    ret->truncated = 0;
+    std::string scratch;
+    Slice encoding = out.contents;
     if (out.err != 0) {
       s = Status::FromCode(out.err);
+    } else if (compressed_replies_ &&
+               !GetReply(out.contents, &encoding, &scratch)) {
+      s = Status::Corruption(Slice());
     } else {
       Slice name;
-      Slice encoding = out.contents;
+      Stat stat;
       if (encoding.size() < 4) {
         s = Status::Corruption(Slice());
       } else {
@@ -939,6 +1397,17 @@ Status MDS::RPC::CLI::Listdir(const ListdirOptions& options, ListdirRet* ret) {
             s = Status::Corruption(Slice());
             break;
           }
+          if (options.with_stats) {
+            if (stat.DecodeFrom(&encoding)) {
+              ret->stats->push_back(stat);
+            } else {
+              s = Status::Corruption(Slice());
+              break;
+            }
+          }
+        }
+        if (s.ok() && !encoding.empty()) {
+          ret->truncated = static_cast<unsigned char>(encoding[0]);
         }
       }
     }
@@ -950,28 +1419,72 @@ void MDS::RPC::SRV::LSDIR(Msg& in, Msg& out) {
   Status s;
   ListdirOptions options;
   std::vector<std::string> names;
+  std::vector<Stat> stats;
   ListdirRet ret;
   ret.names = &names;
+  ret.stats = &stats;
+  unsigned char flags = 0;
   assert(in.op == kListdir);
   Slice input = in.contents;
   if (!GetDirId(&input, &options.dir_id) ||
       !GetVarint32(&input, &options.session_id) ||
       !GetVarint64(&input, &options.op_due)) {
     s = Status::InvalidArgument(Slice());
+  } else if (!input.empty() &&  // Absent in requests from older clients
+             (!GetLengthPrefixedSlice(&input, &options.start) ||
+              input.empty())) {
+    s = Status::InvalidArgument(Slice());
   } else {
+    if (!input.empty()) {
+      options.with_stats = static_cast<unsigned char>(input[0]);
+      input.remove_prefix(1);
+    }
+    if (!input.empty()) {
+      flags = static_cast<unsigned char>(input[0]);
+    }
     s = mds_->Listdir(options, &ret);
   }
+  if (s.ok() && options.with_stats && stats.size() != names.size()) {
+    s = Status::Corruption(Slice());
+  }
   if (s.ok()) {
-    size_t num_entries = 0;
-    for (std::vector<std::string>::iterator it = names.begin();
-         it != names.end(); ++it) {
-      PutLengthPrefixedSlice(&out.extra_buf, *it);
-      num_entries++;
-      if (out.extra_buf.size() >= 1000) {
-        break;  // Silently discard rest entries
+    const bool compressed = (flags & kCompressedReplies) != 0;
+    // Compressed replies start with a larger page of entries in the hope of
+    // still fitting in a regular reply
+    size_t budget = kListdirReplyBytes;
+    if (compressed && reply_compression_ != kNoCompression) {
+      budget *= 4;
+    }
+    std::string listing;
+    char tmp[Stat::kMaxEncodedLength];
+    for (;;) {
+      listing.clear();
+      size_t num_entries = 0;
+      for (; num_entries < names.size(); num_entries++) {
+        if (listing.size() >= budget) {
+          break;  // The rest are left for subsequent calls
+        }
+        PutLengthPrefixedSlice(&listing, names[num_entries]);
+        if (options.with_stats) {
+          Slice encoding = stats[num_entries].EncodeTo(tmp);
+          listing.append(encoding.data(), encoding.size());
+        }
+      }
+      listing.push_back(ret.truncated || num_entries < names.size());
+      PutFixed32(&listing, num_entries);
+      out.extra_buf.clear();
+      if (!compressed) {
+        out.extra_buf.swap(listing);
+        break;
       }
+      PutReply(&out.extra_buf, listing, reply_compression_,
+               min_compressed_reply_);
+      if (budget == kListdirReplyBytes ||
+          out.extra_buf.size() <= kListdirReplyBytes) {
+        break;
+      }
+      budget = kListdirReplyBytes;  // Did not compress well enough
     }
-    PutFixed32(&out.extra_buf, num_entries);
     out.contents = Slice(out.extra_buf);
     out.err = 0;
   } else {
@@ -982,19 +1495,25 @@ void MDS::RPC::SRV::LSDIR(Msg& in, Msg& out) {
 Status MDS::RPC::CLI::Readidx(const ReadidxOptions& options, ReadidxRet* ret) {
   Status s;
   Msg in;
-  char* scratch = &in.buf[0];
-  char* p = scratch;
-  p = EncodeDirId(p, options.dir_id);
-  p = EncodeVarint32(p, options.session_id);
-  p = EncodeVarint64(p, options.op_due);
-  in.contents = Slice(scratch, p - scratch);
+  PutDirId(&in.extra_buf, options.dir_id);
+  PutVarint32(&in.extra_buf, options.session_id);
+  PutVarint64(&in.extra_buf, options.op_due);
+  PutLengthPrefixedSlice(&in.extra_buf, options.idx);
+  if (compressed_replies_) {
+    in.extra_buf.push_back(static_cast<char>(kCompressedReplies));
+  }
+  in.contents = Slice(in.extra_buf);
   Msg out;
   s = stub_->Call(AddOp(in, kReadidx), out);
   if (s.ok()) {
+    std::string scratch;
+    Slice idx = out.contents;
     if (out.err != 0) {
       s = Status::FromCode(out.err);
+    } else if (compressed_replies_ && !GetReply(out.contents, &idx, &scratch)) {
+      s = Status::Corruption(Slice());
     } else {
-      ret->idx.assign(out.contents.data(), out.contents.size());
+      ret->idx.assign(idx.data(), idx.size());
     }
   }
   return s;
@@ -1004,17 +1523,27 @@ void MDS::RPC::SRV::RDIDX(Msg& in, Msg& out) {
   Status s;
   ReadidxOptions options;
   ReadidxRet ret;
+  unsigned char flags = 0;
   assert(in.op == kReadidx);
   Slice input = in.contents;
   if (!GetDirId(&input, &options.dir_id) ||
       !GetVarint32(&input, &options.session_id) ||
-      !GetVarint64(&input, &options.op_due)) {
+      !GetVarint64(&input, &options.op_due) ||
+      !GetLengthPrefixedSlice(&input, &options.idx)) {
     s = Status::InvalidArgument(Slice());
   } else {
+    if (!input.empty()) {  // Absent in requests from older clients
+      flags = static_cast<unsigned char>(input[0]);
+    }
     s = mds_->Readidx(options, &ret);
   }
   if (s.ok()) {
-    out.extra_buf.swap(ret.idx);
+    if ((flags & kCompressedReplies) != 0) {
+      PutReply(&out.extra_buf, ret.idx, reply_compression_,
+               min_compressed_reply_);
+    } else {
+      out.extra_buf.swap(ret.idx);
+    }
     out.contents = Slice(out.extra_buf);
     out.err = 0;
   } else {
@@ -1148,9 +1677,122 @@ void MDS::RPC::SRV::GOUPT(Msg& in, Msg& out) {
   }
 }
 
+struct MDSAsync::Request {
+  enum Op { kFstat, kFcreat, kLookup };
+  MDSAsync* parent;
+  Op op;
+  const void* options;
+  void* ret;
+  bool done;
+  bool redirected;
+  MDS::Redirect re;
+  Status status;
+};
+
+MDSAsync::MDSAsync(MDS* base, ThreadPool* pool)
+    : base_(base), pool_(pool), cv_(&mutex_), next_id_(0) {}
+
+MDSAsync::~MDSAsync() {
+  MutexLock ml(&mutex_);
+  while (true) {
+    bool all_done = true;
+    for (std::map<RequestId, Request*>::iterator it = requests_.begin();
+         it != requests_.end(); ++it) {
+      if (!it->second->done) {
+        all_done = false;
+        break;
+      }
+    }
+    if (all_done) break;
+    cv_.Wait();
+  }
+  for (std::map<RequestId, Request*>::iterator it = requests_.begin();
+       it != requests_.end(); ++it) {
+    delete it->second;
+  }
+}
+
+#define DEF_OP(OP)                                                  \
+  MDSAsync::RequestId MDSAsync::OP(const MDS::OP##Options& options, \
+                                   MDS::OP##Ret* ret) {             \
+    Request* req = new Request;                                     \
+    req->op = Request::k##OP;                                       \
+    req->options = &options;                                        \
+    req->ret = ret;                                                 \
+    return Submit(req);                                             \
+  }
+
+DEF_OP(Fstat)
+DEF_OP(Fcreat)
+DEF_OP(Lookup)
+
+#undef DEF_OP
+
+MDSAsync::RequestId MDSAsync::Submit(Request* req) {
+  req->parent = this;
+  req->done = false;
+  req->redirected = false;
+  mutex_.Lock();
+  const RequestId id = ++next_id_;
+  requests_.insert(std::make_pair(id, req));
+  mutex_.Unlock();
+  pool_->Schedule(RunRequest, req);
+  return id;
+}
+
+void MDSAsync::RunRequest(void* arg) {
+  Request* const req = reinterpret_cast<Request*>(arg);
+  MDS* const base = req->parent->base_;
+  Status s;
+  try {
+    switch (req->op) {
+#define CASE_OP(OP)                                                        \
+  case Request::k##OP:                                                     \
+    s = base->OP(*reinterpret_cast<const MDS::OP##Options*>(req->options), \
+                 reinterpret_cast<MDS::OP##Ret*>(req->ret));               \
+    break;
+      CASE_OP(Fstat)
+      CASE_OP(Fcreat)
+      CASE_OP(Lookup)
+#undef CASE_OP
+    }
+  } catch (MDS::Redirect& re) {
+    req->re.swap(re);
+    req->redirected = true;
+  }
+  MutexLock ml(&req->parent->mutex_);
+  req->status = s;
+  req->done = true;
+  req->parent->cv_.SignalAll();
+}
+
+Status MDSAsync::Wait(RequestId id) {
+  MutexLock ml(&mutex_);
+  std::map<RequestId, Request*>::iterator it = requests_.find(id);
+  if (it == requests_.end()) {
+    return Status::InvalidArgument("no such request");
+  }
+  Request* const req = it->second;
+  while (!req->done) {
+    cv_.Wait();
+  }
+  requests_.erase(it);
+  Status s = req->status;
+  if (req->redirected) {
+    MDS::Redirect re;
+    re.swap(req->re);
+    delete req;
+    throw re;
+  }
+  delete req;
+  return s;
+}
+
 void PseudoConcurrentMDSMonitor::Reset() {
   Reset_Fstat_count();
   Reset_Fcreat_count();
+  Reset_Bcreat_count();
+  Reset_Bulkin_count();
   Reset_Mkdir_count();
   Reset_Chmod_count();
   Reset_Chown_count();
@@ -1158,6 +1800,7 @@ void PseudoConcurrentMDSMonitor::Reset() {
   Reset_Utime_count();
   Reset_Trunc_count();
   Reset_Unlink_count();
+  Reset_Compound_count();
   Reset_Lookup_count();
   Reset_Listdir_count();
   Reset_Readidx_count();
@@ -1166,6 +1809,8 @@ void PseudoConcurrentMDSMonitor::Reset() {
 void SimpleMDSMonitor::Reset() {
   Reset_Fstat_count();
   Reset_Fcreat_count();
+  Reset_Bcreat_count();
+  Reset_Bulkin_count();
   Reset_Mkdir_count();
   Reset_Chmod_count();
   Reset_Chown_count();
@@ -1173,6 +1818,7 @@ void SimpleMDSMonitor::Reset() {
   Reset_Utime_count();
   Reset_Trunc_count();
   Reset_Unlink_count();
+  Reset_Compound_count();
   Reset_Lookup_count();
   Reset_Listdir_count();
   Reset_Readidx_count();
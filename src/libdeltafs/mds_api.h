@@ -11,14 +11,19 @@
 #pragma once
 
 #include "deltafs/deltafs_api.h"
+#include "mds_trace.h"
 #include "util/logging.h"
 
+#include "pdlfs-common/compression_type.h"
 #include "pdlfs-common/fsdbx.h"
 #include "pdlfs-common/fstypes.h"
 #include "pdlfs-common/hash.h"
+#include "pdlfs-common/port.h"
 #include "pdlfs-common/rpc.h"
 #include "pdlfs-common/strutil.h"
+#include "pdlfs-common/xxhash.h"
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -27,6 +32,7 @@ namespace pdlfs {
 class Env;
 class Fio;
 class MDB;
+class ThreadPool;
 
 #define DELTAFS_MAX_MICROS ((uint64_t(1) << 63) - 1) /* Max future */
 
@@ -57,6 +63,25 @@ struct MDSOptions {
   size_t dir_table_size;
   size_t lease_table_size;
   uint64_t lease_duration;
+  // Number of inode numbers reserved at a time. Only the end of each
+  // reserved range is persisted so inode numbers are never reused across
+  // server restarts.
+  // Default: 4096
+  uint64_t ino_batch_size;
+  // Max number of hot directories recorded at server shutdown and preloaded
+  // into the directory table at the next start, so that the first accesses
+  // after a restart do not have to wait for them to load. Set to 0 to
+  // disable.
+  // Default: 0
+  size_t warmup_dirs;
+  // Number of background threads used to preload directories.
+  // Default: 4
+  int warmup_threads;
+  // Serve reads only. Set for replicas opened over a read-only view of
+  // the db of another server. All updates are rejected with a read-only
+  // error and nothing is ever written to the db.
+  // Default: false
+  bool read_only;
   uint64_t snap_id;
   uint64_t reg_id;
   bool paranoid_checks;
@@ -107,6 +132,36 @@ class MDS {
   };
   MDS_OP(Fcreat)
 
+  // Create a batch of regular files under a single parent directory. All
+  // names are committed together by the server and the result of each name
+  // is returned in "statuses". A non-OK return means the batch as a whole
+  // could not be processed. The BaseOptions name and name_hash are unused.
+  MDS_OP_OPTIONS(Bcreat) {
+    std::vector<Slice> names;
+    std::vector<Slice> name_hashes;
+    uint32_t flags;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+  };
+  MDS_OP_RET(Bcreat) { std::vector<Status> statuses; };
+  MDS_OP(Bcreat)
+
+  // Bulk insertion of files created by a client in a local db. If "dir" is
+  // empty, reserve "num_entries" consecutive inode numbers for the client to
+  // assign to its new files and return the first one in ret->first_ino.
+  // Otherwise, insert all table files under "dir", which must be on storage
+  // shared with the server, into the server's db, and add "num_entries" to
+  // the size of the parent directory. Ingested entries replace existing
+  // entries with the same names. The BaseOptions name and name_hash are
+  // unused.
+  MDS_OP_OPTIONS(Bulkin) {
+    Slice dir;
+    uint64_t num_entries;
+  };
+  MDS_OP_RET(Bulkin) { uint64_t first_ino; };
+  MDS_OP(Bulkin)
+
   MDS_OP_OPTIONS(Mkdir) {
     uint32_t flags;
     uint32_t mode;
@@ -153,15 +208,91 @@ class MDS {
   MDS_OP_RET(Unlink) { Stat stat; };
   MDS_OP(Unlink)
 
-  MDS_OP_OPTIONS(Lookup){};
-  MDS_OP_RET(Lookup) { LookupStat stat; };
+  // A single op of a compound call. Only the fields used by the op need to
+  // be set. If "chained" is set, the op runs under the directory whose stat
+  // was returned by the previous op instead of "dir_id". The session_id and
+  // op_due of the compound call apply to all its ops.
+  enum CompoundOpType {
+    kFstatOp = 1,
+    kFcreatOp,
+    kMkdirOp,
+    kChmodOp,
+    kTruncOp,
+    kUnlinkOp,
+    // Look up a directory and renew the lease on it. Only the fields kept by
+    // a LookupStat are set in the returned stat, and the lease is returned
+    // through lease_dues.
+    kLookupOp
+  };
+  struct CompoundItem : public BaseOptions {
+    CompoundItem();
+    unsigned char op;
+    unsigned char chained;
+    uint32_t flags;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t mtime;
+    uint64_t size;
+  };
+
+  // Run a sequence of ops against a single server in one call. Ops run in
+  // order and the call stops at the first op that fails. A single status and
+  // stat are returned for each op run. An op whose entry belongs to another
+  // server fails with TryAgain and should be retried by the caller through
+  // the regular interface. The BaseOptions dir_id, name, and name_hash are
+  // unused.
+  MDS_OP_OPTIONS(Compound) {
+    CompoundOptions();
+    std::vector<CompoundItem> items;
+  };
+  MDS_OP_RET(Compound) {
+    std::vector<Status> statuses;
+    std::vector<Stat> stats;  // Only meaningful for ops that succeeded
+    // Lease due of each op, 0 for ops other than lookups and for lookups
+    // that have not been leased
+    std::vector<uint64_t> lease_dues;
+  };
+  MDS_OP(Compound)
+
+  // Look up a directory. If "rest" is set, the server will try to further
+  // resolve these '/'-separated path components under the directory looked
+  // up, stopping at the first one not served by itself. The stat of each
+  // component resolved this way is appended to ret->more in path order.
+  // If "negative_lease" is set and the directory does not exist, the server
+  // may return a lease on that result through ret->stat.LeaseDue(), during
+  // which the name will not be created.
+  MDS_OP_OPTIONS(Lookup) {
+    LookupOptions() : negative_lease(0) {}
+    Slice rest;
+    unsigned char negative_lease;
+  };
+  MDS_OP_RET(Lookup) {
+    LookupRet() : more(NULL) {}
+    LookupStat stat;
+    std::vector<LookupStat>* more;  // Only set if options.rest is not empty
+  };
   MDS_OP(Lookup)
 
-  MDS_OP_OPTIONS(Listdir){};
-  MDS_OP_RET(Listdir) { std::vector<std::string>* names; };
+  // List a directory partition. Each call returns a bounded number of
+  // entries. If ret->truncated is set, listing may be resumed by setting
+  // "start" to the name hash of the last entry returned.
+  MDS_OP_OPTIONS(Listdir) {
+    ListdirOptions() : with_stats(0) {}
+    Slice start;  // Name hash to resume after, or empty to start from scratch
+    unsigned char with_stats;  // Return the stat of each entry
+  };
+  MDS_OP_RET(Listdir) {
+    ListdirRet() : names(NULL), stats(NULL), truncated(0) {}
+    std::vector<std::string>* names;
+    std::vector<Stat>* stats;  // Only set if options.with_stats
+    unsigned char truncated;  // More entries may follow
+  };
   MDS_OP(Listdir)
 
-  MDS_OP_OPTIONS(Readidx){};
+  MDS_OP_OPTIONS(Readidx) {
+    Slice idx;  // Index already known to the caller, or empty
+  };
   MDS_OP_RET(Readidx) { std::string idx; };
   MDS_OP(Readidx)
 
@@ -221,6 +352,8 @@ class MDSWrapper : public MDS {
 
   DEF_OP(Fstat)
   DEF_OP(Fcreat)
+  DEF_OP(Bcreat)
+  DEF_OP(Bulkin)
   DEF_OP(Mkdir)
   DEF_OP(Chmod)
   DEF_OP(Chown)
@@ -228,6 +361,7 @@ class MDSWrapper : public MDS {
   DEF_OP(Utime)
   DEF_OP(Trunc)
   DEF_OP(Unlink)
+  DEF_OP(Compound)
   DEF_OP(Lookup)
   DEF_OP(Listdir)
   DEF_OP(Readidx)
@@ -265,6 +399,8 @@ class SimpleMDSMonitor : public MDSWrapper {
 
   DEF_OP(Fstat)
   DEF_OP(Fcreat)
+  DEF_OP(Bcreat)
+  DEF_OP(Bulkin)
   DEF_OP(Mkdir)
   DEF_OP(Chmod)
   DEF_OP(Chown)
@@ -272,6 +408,7 @@ class SimpleMDSMonitor : public MDSWrapper {
   DEF_OP(Utime)
   DEF_OP(Trunc)
   DEF_OP(Unlink)
+  DEF_OP(Compound)
   DEF_OP(Lookup)
   DEF_OP(Listdir)
   DEF_OP(Readidx)
@@ -318,6 +455,8 @@ class PseudoConcurrentMDSMonitor : public MDSWrapper {
 
   DEF_OP(Fstat)
   DEF_OP(Fcreat)
+  DEF_OP(Bcreat)
+  DEF_OP(Bulkin)
   DEF_OP(Mkdir)
   DEF_OP(Chmod)
   DEF_OP(Chown)
@@ -325,6 +464,7 @@ class PseudoConcurrentMDSMonitor : public MDSWrapper {
   DEF_OP(Utime)
   DEF_OP(Trunc)
   DEF_OP(Unlink)
+  DEF_OP(Compound)
   DEF_OP(Lookup)
   DEF_OP(Listdir)
   DEF_OP(Readidx)
@@ -335,6 +475,30 @@ class PseudoConcurrentMDSMonitor : public MDSWrapper {
 };
 
 // Log every RPC message to assist debugging.
+#define MDS_TRACED_OPS(X) \
+  X(Opensession)          \
+  X(Getinput)             \
+  X(Getoutput)            \
+  X(Fstat)                \
+  X(Fcreat)               \
+  X(Bcreat)               \
+  X(Mkdir)                \
+  X(Chmod)                \
+  X(Chown)                \
+  X(Uperm)                \
+  X(Utime)                \
+  X(Trunc)                \
+  X(Unlink)               \
+  X(Compound)             \
+  X(Lookup)               \
+  X(Listdir)              \
+  X(Readidx)              \
+  X(Bulkin)
+
+// Trace calls to a metadata server. By default, every call is logged as text,
+// which is only suitable for debugging. If a trace log is given, a sample of
+// the calls is instead recorded in the log as compact binary records that
+// can be decoded by the deltafs-mdstrace tool.
 class MDSTracer : public MDSWrapper {
   void Trace(const char* type, const char* op, const std::string& pid,
              const std::string& hash, const std::string& name,
@@ -346,49 +510,120 @@ class MDSTracer : public MDSWrapper {
 #endif
   }
 
+  void Record(int op, const BaseOptions& options, uint64_t start,
+              const Status& status, bool redirected) {
+    MDSTraceRecord rec;
+    rec.micros = start;
+    rec.path_hash = xxhash64(options.name_hash.data(), options.name_hash.size(),
+                             options.dir_id.ino);
+    rec.latency_micros = static_cast<uint32_t>(CurrentMicros() - start);
+    rec.server = server_;
+    rec.op = static_cast<unsigned char>(op);
+    rec.redirected = redirected;
+    rec.status = static_cast<unsigned char>(status.err_code());
+    log_->Add(rec);
+  }
+
  public:
-  explicit MDSTracer(const std::string& uri, MDS* base)
-      : MDSWrapper(base), uri_(uri) {}
+  // If log is not NULL, calls are sampled into it and tagged with the given
+  // server index. *log must remain alive until the tracer is deleted.
+  explicit MDSTracer(const std::string& uri, MDS* base,
+                     MDSTraceLog* log = NULL, uint32_t server = 0)
+      : MDSWrapper(base), uri_(uri), log_(log), server_(server) {}
   virtual ~MDSTracer();
 
-#define DEF_OP(OP)                                              \
-  virtual Status OP(const OP##Options& options, OP##Ret* ret) { \
-    Status s;                                                   \
-    std::string pid = options.dir_id.DebugString();             \
-    std::string h = EscapeString(options.name_hash);            \
-    std::string n = options.name.ToString();                    \
-    Trace(">>", #OP, pid, h, n, s);                             \
-    try {                                                       \
-      s = base_->OP(options, ret);                              \
-    } catch (Redirect & re) {                                   \
-      s = Status::TryAgain("redirected");                       \
-      Trace("<<", #OP, pid, h, n, s);                           \
-      throw re;                                                 \
-    }                                                           \
-    Trace("<<", #OP, pid, h, n, s);                             \
-    return s;                                                   \
+#define DEF_OP_CODE(OP) k##OP##Op,
+  enum { MDS_TRACED_OPS(DEF_OP_CODE) kNumTracedOps };
+#undef DEF_OP_CODE
+
+  // Return the names of all traced ops in op code order, separated by ','.
+  static std::string OpNames();
+
+#define DEF_OP(OP)                                                  \
+  virtual Status OP(const OP##Options& options, OP##Ret* ret) {     \
+    Status s;                                                       \
+    if (log_ != NULL) {                                             \
+      if (!log_->ShouldSample()) {                                  \
+        return base_->OP(options, ret);                             \
+      }                                                             \
+      const uint64_t start = CurrentMicros();                       \
+      try {                                                         \
+        s = base_->OP(options, ret);                                \
+      } catch (Redirect & re) {                                     \
+        Record(k##OP##Op, options, start, s, true);                 \
+        throw re;                                                   \
+      }                                                             \
+      Record(k##OP##Op, options, start, s, false);                  \
+      return s;                                                     \
+    }                                                               \
+    std::string pid = options.dir_id.DebugString();                 \
+    std::string h = EscapeString(options.name_hash);                \
+    std::string n = options.name.ToString();                        \
+    Trace(">>", #OP, pid, h, n, s);                                 \
+    try {                                                           \
+      s = base_->OP(options, ret);                                  \
+    } catch (Redirect & re) {                                       \
+      s = Status::TryAgain("redirected");                           \
+      Trace("<<", #OP, pid, h, n, s);                               \
+      throw re;                                                     \
+    }                                                               \
+    Trace("<<", #OP, pid, h, n, s);                                 \
+    return s;                                                       \
   }
 
-  DEF_OP(Opensession)
-  DEF_OP(Getinput)
-  DEF_OP(Getoutput)
-  DEF_OP(Fstat)
-  DEF_OP(Fcreat)
-  DEF_OP(Mkdir)
-  DEF_OP(Chmod)
-  DEF_OP(Chown)
-  DEF_OP(Uperm)
-  DEF_OP(Utime)
-  DEF_OP(Trunc)
-  DEF_OP(Unlink)
-  DEF_OP(Lookup)
-  DEF_OP(Listdir)
-  DEF_OP(Readidx)
+  MDS_TRACED_OPS(DEF_OP)
 
 #undef DEF_OP
 
  private:
   std::string uri_;
+  MDSTraceLog* const log_;  // NULL if every call is logged as text
+  const uint32_t server_;
+};
+
+// Issue calls against another MDS without waiting for them to finish, so
+// that many calls may be outstanding at the same time and complete out of
+// order. Each call returns a request id that must later be passed to Wait()
+// to obtain its result. Calls are executed by a thread pool against the
+// base MDS, whose implementations are all thread-safe. Options and results of
+// a call must remain alive until the call is waited for.
+// Implementation is thread-safe.
+class MDSAsync {
+ public:
+  typedef uint64_t RequestId;
+  MDSAsync(MDS* base, ThreadPool* pool);
+  // Wait for all outstanding calls to finish.
+  ~MDSAsync();
+
+#define DEC_OP(OP) \
+  RequestId OP(const MDS::OP##Options& options, MDS::OP##Ret* ret);
+
+  DEC_OP(Fstat)
+  DEC_OP(Fcreat)
+  DEC_OP(Lookup)
+
+#undef DEC_OP
+
+  // Wait for a previously issued call to finish and return its status.
+  // A redirect thrown by the base MDS is rethrown.
+  Status Wait(RequestId id);
+
+ private:
+  struct Request;
+  static void RunRequest(void*);
+  RequestId Submit(Request*);
+  MDS* const base_;
+  ThreadPool* const pool_;
+
+  // State below is protected by mutex_
+  port::Mutex mutex_;
+  port::CondVar cv_;
+  std::map<RequestId, Request*> requests_;  // Outstanding requests
+  RequestId next_id_;
+
+  // No copying allowed
+  void operator=(const MDSAsync&);
+  MDSAsync(const MDSAsync&);
 };
 
 // RPC adaptors
@@ -401,13 +636,18 @@ class MDS::RPC::CLI : public MDS {
   typedef rpc::If::Message Msg;
 
  public:
-  CLI(rpc::If* stub) : stub_(stub) {}
+  // If "compressed_replies" is set, servers are asked to compress large
+  // Listdir and Readidx replies. Requires servers that understand the ask.
+  explicit CLI(rpc::If* stub, bool compressed_replies = false)
+      : stub_(stub), compressed_replies_(compressed_replies) {}
   virtual ~CLI();
 
 #define DEC_OP(OP) virtual Status OP(const OP##Options&, OP##Ret*);
 
   DEC_OP(Fstat)
   DEC_OP(Fcreat)
+  DEC_OP(Bcreat)
+  DEC_OP(Bulkin)
   DEC_OP(Mkdir)
   DEC_OP(Chmod)
   DEC_OP(Chown)
@@ -415,6 +655,7 @@ class MDS::RPC::CLI : public MDS {
   DEC_OP(Utime)
   DEC_OP(Trunc)
   DEC_OP(Unlink)
+  DEC_OP(Compound)
   DEC_OP(Lookup)
   DEC_OP(Listdir)
   DEC_OP(Readidx)
@@ -426,6 +667,7 @@ class MDS::RPC::CLI : public MDS {
 
  private:
   rpc::If* stub_;
+  bool compressed_replies_;
 };
 
 class MDS::RPC::SRV : public rpc::If {
@@ -434,7 +676,13 @@ class MDS::RPC::SRV : public rpc::If {
  public:
   // Always return OK.
   virtual Status Call(Msg& in, Msg& out) RPCNOEXCEPT;
-  SRV(MDS* mds) : mds_(mds) {}
+  // Listdir and Readidx replies of at least "min_compressed_reply" bytes are
+  // compressed using "reply_compression" for clients that ask for it.
+  explicit SRV(MDS* mds, CompressionType reply_compression = kNoCompression,
+               size_t min_compressed_reply = 256)
+      : mds_(mds),
+        reply_compression_(reply_compression),
+        min_compressed_reply_(min_compressed_reply) {}
   virtual ~SRV();
 
 #define DEC_RPC(OP) void OP(Msg& in, Msg& out);
@@ -442,12 +690,15 @@ class MDS::RPC::SRV : public rpc::If {
   DEC_RPC(FSTAT)
   DEC_RPC(MKDIR)
   DEC_RPC(FCRET)
+  DEC_RPC(BCRET)
+  DEC_RPC(BULKI)
   DEC_RPC(CHMOD)
   DEC_RPC(CHOWN)
   DEC_RPC(UPERM)
   DEC_RPC(UTIME)
   DEC_RPC(TRUNC)
   DEC_RPC(UNLNK)
+  DEC_RPC(CMPND)
   DEC_RPC(LOKUP)
   DEC_RPC(LSDIR)
   DEC_RPC(RDIDX)
@@ -459,6 +710,8 @@ class MDS::RPC::SRV : public rpc::If {
 
  private:
   MDS* mds_;
+  CompressionType reply_compression_;
+  size_t min_compressed_reply_;
 };
 
 }  // namespace pdlfs
@@ -10,6 +10,7 @@
  */
 
 #include "mds_api.h"
+#include "pdlfs-common/env.h"
 #include "pdlfs-common/testharness.h"
 #include "pdlfs-common/testutil.h"
 
@@ -92,6 +93,122 @@ TEST(APITest<FstatWrapper>, FstatException) {
   ASSERT_TRUE(false) << "No exception!";
 }
 
+class ReadidxWrapper : public MDSWrapper {
+ public:
+  ReadidxOptions options_;
+  ReadidxRet ret_;
+  Status status_;
+  virtual Status Readidx(const ReadidxOptions& options, ReadidxRet* ret) {
+    ASSERT_TRUE(options.dir_id.compare(options_.dir_id) == 0);
+    ASSERT_EQ(options.idx, options_.idx);
+    *ret = ret_;
+    return status_;
+  }
+};
+
+TEST(APITest<ReadidxWrapper>, Readidx) {
+  t_opts_.dir_id = DirId(31, 13, 301);
+  std::string known(300, 'k');
+  t_opts_.idx = known;
+  t_ret_.idx = "idx";
+  MDS::ReadidxRet ret;
+  ASSERT_OK(mds_->Readidx(t_opts_, &ret));
+  ASSERT_EQ(ret.idx, "idx");
+}
+
+// Return the length of the name as the ino. Names starting with "r" are
+// redirected.
+class InoWrapper : public MDSWrapper {
+ public:
+  virtual Status Fstat(const FstatOptions& options, FstatRet* ret) {
+    if (options.name.starts_with("r")) {
+      throw Redirect("test");
+    }
+    ret->stat.SetInodeNo(options.name.size());
+    return Status::OK();
+  }
+};
+
+class MDSAsyncTest {};
+
+TEST(MDSAsyncTest, OutOfOrderWaits) {
+  InoWrapper base;
+  ThreadPool* pool = ThreadPool::NewFixed(4);
+  {
+    MDSAsync async(&base, pool);
+    std::vector<std::string> names;
+    std::vector<MDS::FstatOptions> options(16);
+    std::vector<MDS::FstatRet> rets(16);
+    std::vector<MDSAsync::RequestId> ids;
+    for (size_t i = 0; i < options.size(); i++) {
+      names.push_back(std::string(i + 1, 'x'));
+    }
+    for (size_t i = 0; i < options.size(); i++) {
+      options[i].name = names[i];
+      ids.push_back(async.Fstat(options[i], &rets[i]));
+    }
+    for (size_t i = ids.size(); i-- != 0;) {
+      ASSERT_OK(async.Wait(ids[i]));
+      ASSERT_EQ(rets[i].stat.InodeNo(), i + 1);
+    }
+    MDS::FstatOptions redirected;
+    redirected.name = "r";
+    MDS::FstatRet ret;
+    MDSAsync::RequestId id = async.Fstat(redirected, &ret);
+    try {
+      async.Wait(id);
+      ASSERT_TRUE(false) << "No exception!";
+    } catch (MDS::Redirect& re) {
+      ASSERT_EQ(re, "test");
+    }
+    ASSERT_TRUE(async.Wait(id).IsInvalidArgument());
+  }
+  delete pool;
+}
+
+class MDSTraceTest {};
+
+TEST(MDSTraceTest, SampledBinaryTrace) {
+  Env* const env = Env::Default();
+  const std::string fname = test::TmpDir() + "/mdstrace_test.bin";
+  InoWrapper base;
+  {
+    MDSTraceLog log(env, fname, 2, MDSTracer::OpNames());
+    ASSERT_OK(log.Open());
+    MDSTracer tracer("test", &base, &log, 7);
+    MDS::FstatOptions options;
+    options.dir_id = DirId(0, 0, 1);
+    options.name_hash = "h";
+    MDS::FstatRet ret;
+    for (int i = 0; i < 8; i++) {
+      options.name = (i == 7) ? "r" : "x";
+      try {
+        ASSERT_OK(tracer.Fstat(options, &ret));
+      } catch (MDS::Redirect& re) {
+        ASSERT_EQ(re, "test");
+      }
+    }
+    ASSERT_EQ(log.NumDropped(), 0);
+  }
+  std::string contents;
+  ASSERT_OK(ReadFileToString(env, fname.c_str(), &contents));
+  const std::string header =
+      std::string(kMDSTraceMagic) + "\n" + MDSTracer::OpNames() + "\n";
+  ASSERT_TRUE(Slice(contents).starts_with(header));
+  Slice input(contents);
+  input.remove_prefix(header.size());
+  ASSERT_EQ(input.size(), 4 * MDSTraceRecord::kEncodedLength);
+  MDSTraceRecord rec;
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(rec.DecodeFrom(input));
+    ASSERT_EQ(int(rec.op), int(MDSTracer::kFstatOp));
+    ASSERT_EQ(rec.server, 7);
+    ASSERT_EQ(int(rec.redirected), i == 3 ? 1 : 0);
+    input.remove_prefix(MDSTraceRecord::kEncodedLength);
+  }
+  env->DeleteFile(fname.c_str());
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
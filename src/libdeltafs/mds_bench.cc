@@ -0,0 +1,654 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+/*
+ * mds_bench: run mdtest-style metadata phases against deltafs. Each client
+ * is a thread. Clients either share a single directory tree or each work
+ * in a tree of their own. Phases run in the following order, each starting
+ * once all clients have finished the previous one:
+ *      tree     -- create the directory tree(s)
+ *      create   -- create FLAGS_num empty files per client, spread across
+ *                  all directories of the tree
+ *      stat     -- stat every file created
+ *      readdir  -- list every directory of the tree
+ *      unlink   -- remove every file created
+ *
+ * With --api=cli, clients drive MDS::CLI directly against in-process
+ * servers with no RPC in between, and the keys and values read and written
+ * by the servers (MDBStats) are reported per phase. With --api=posix,
+ * clients go through the deltafs_* calls instead, using whatever servers
+ * the environment points the deltafs client to. Server-side counts are then
+ * found in the metrics the servers dump. A human-readable report goes to
+ * stderr while one JSON line per phase goes to stdout.
+ */
+
+#include "mds_cli.h"
+#include "mds_srv.h"
+
+#include "deltafs/deltafs_api.h"
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/strutil.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Metadata interface to drive: cli or posix
+static const char* FLAGS_api = "cli";
+
+// Comma-separated list of phases to run. Phases always run in the order
+// listed at the top of this file.
+static const char* FLAGS_phases = "tree,create,stat,readdir,unlink";
+
+// Number of concurrent clients
+static int FLAGS_clients = 4;
+
+// Number of files created by each client
+static int FLAGS_num = 1000;
+
+// Depth of the directory tree. 0 means a single directory.
+static int FLAGS_depth = 0;
+
+// Number of subdirectories of each non-leaf directory of the tree
+static int FLAGS_branch = 2;
+
+// Give each client a tree of its own instead of one shared by all clients
+static bool FLAGS_unique_dir = false;
+
+// Parent of all trees. Created if missing.
+static const char* FLAGS_root = "/mdtest";
+
+// Number of in-process servers (cli only)
+static int FLAGS_servers = 1;
+
+// Duration of the leases granted by servers in microseconds (cli only)
+static int FLAGS_lease_duration = 1000 * 1000;
+
+// Number of entries in each client's lookup and index caches (cli only)
+static int FLAGS_lookup_cache_size = 4096;
+static int FLAGS_index_cache_size = 4096;
+
+// Sync metadata writes (cli only)
+static bool FLAGS_sync = false;
+
+// Use the following path for server dbs. Existing dbs are destroyed.
+// (cli only)
+static const char* FLAGS_db = "/tmp/mds_bench";
+
+namespace pdlfs {
+
+namespace {
+
+void Die(const char* msg, const Status& s) {
+  fprintf(stderr, "%s: %s\n", msg, s.ToString().c_str());
+  exit(1);
+}
+
+void DieIf(bool cond, const char* msg) {
+  if (cond) {
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+  }
+}
+
+enum Phase {
+  kTree = 0,
+  kCreate = 1,
+  kStat = 2,
+  kReaddir = 3,
+  kUnlink = 4,
+  kNumPhases = 5
+};
+
+const char* PhaseName(int phase) {
+  static const char* const names[kNumPhases] = {"tree", "create", "stat",
+                                                "readdir", "unlink"};
+  return names[phase];
+}
+
+// The metadata calls issued by a client
+class BenchClient {
+ public:
+  BenchClient() {}
+  virtual ~BenchClient() {}
+
+  virtual Status Mkdir(const std::string& path, bool error_if_exists) = 0;
+  virtual Status Creat(const std::string& path) = 0;
+  virtual Status Stat(const std::string& path) = 0;
+  virtual Status Listdir(const std::string& path, size_t* entries) = 0;
+  virtual Status Unlink(const std::string& path) = 0;
+
+ private:
+  // No copying allowed
+  void operator=(const BenchClient&);
+  BenchClient(const BenchClient&);
+};
+
+class CliClient : public BenchClient {
+ public:
+  explicit CliClient(MDS::CLI* cli) : cli_(cli) {}
+  virtual ~CliClient() { delete cli_; }
+
+  virtual Status Mkdir(const std::string& path, bool error_if_exists) {
+    return cli_->Mkdir(path, ACCESSPERMS, NULL, false, error_if_exists);
+  }
+
+  virtual Status Creat(const std::string& path) {
+    return cli_->Fcreat(path, DEFFILEMODE);
+  }
+
+  virtual Status Stat(const std::string& path) { return cli_->Fstat(path); }
+
+  virtual Status Listdir(const std::string& path, size_t* entries) {
+    std::vector<std::string> names;
+    Status s = cli_->Listdir(path, &names);
+    *entries = names.size();
+    return s;
+  }
+
+  virtual Status Unlink(const std::string& path) { return cli_->Unlink(path); }
+
+ private:
+  MDS::CLI* cli_;
+};
+
+Status PosixError(const std::string& path) {
+  return Status::IOError(path, strerror(errno));
+}
+
+int CountEntry(const char* name, void* arg) {
+  ++*static_cast<size_t*>(arg);
+  return 0;
+}
+
+class PosixClient : public BenchClient {
+ public:
+  PosixClient() {}
+  virtual ~PosixClient() {}
+
+  virtual Status Mkdir(const std::string& path, bool error_if_exists) {
+    if (deltafs_mkdir(path.c_str(), ACCESSPERMS) != 0) {
+      if (errno != EEXIST || error_if_exists) {
+        return PosixError(path);
+      }
+    }
+    return Status::OK();
+  }
+
+  virtual Status Creat(const std::string& path) {
+    if (deltafs_mkfile(path.c_str(), DEFFILEMODE) != 0) {
+      return PosixError(path);
+    }
+    return Status::OK();
+  }
+
+  virtual Status Stat(const std::string& path) {
+    struct stat buf;
+    if (deltafs_stat(path.c_str(), &buf) != 0) {
+      return PosixError(path);
+    }
+    return Status::OK();
+  }
+
+  virtual Status Listdir(const std::string& path, size_t* entries) {
+    *entries = 0;
+    if (deltafs_listdir(path.c_str(), CountEntry, entries) != 0) {
+      return PosixError(path);
+    }
+    return Status::OK();
+  }
+
+  virtual Status Unlink(const std::string& path) {
+    if (deltafs_unlink(path.c_str()) != 0) {
+      return PosixError(path);
+    }
+    return Status::OK();
+  }
+};
+
+// Hand each client the in-process server it asks for
+class LocalMDSFactory : public MDSFactory {
+ public:
+  explicit LocalMDSFactory(const std::vector<MDS*>& servers)
+      : servers_(servers) {}
+  virtual ~LocalMDSFactory() {}
+  virtual MDS* Get(size_t srv_id) { return servers_[srv_id]; }
+
+ private:
+  std::vector<MDS*> servers_;
+};
+
+// Results of a client in a phase
+struct ClientStats {
+  ClientStats() : ops(0), entries(0), max_micros(0) { latency.Clear(); }
+
+  void Add(uint64_t micros) {
+    latency.Add(static_cast<double>(micros));
+    max_micros = std::max(max_micros, micros);
+    ops++;
+  }
+
+  void Merge(const ClientStats& other) {
+    latency.Merge(other.latency);
+    max_micros = std::max(max_micros, other.max_micros);
+    ops += other.ops;
+    entries += other.entries;
+    if (status.ok()) status = other.status;
+  }
+
+  Histogram latency;
+  uint64_t ops;
+  uint64_t entries;  // Number of directory entries listed
+  uint64_t max_micros;
+  Status status;
+};
+
+class MDSBench {
+ public:
+  MDSBench()
+      : env_(Env::Default()),
+        pool_(NULL),
+        factory_(NULL),
+        phase_(kTree),
+        cv_(&mu_),
+        done_(0) {
+    memset(enabled_, 0, sizeof(enabled_));
+  }
+
+  ~MDSBench() {
+    for (size_t i = 0; i < clients_.size(); i++) {
+      delete clients_[i];
+    }
+    delete factory_;
+    for (size_t i = 0; i < servers_.size(); i++) {
+      delete servers_[i];
+      delete mdbs_[i];
+      delete dbs_[i];
+    }
+    delete pool_;
+  }
+
+  void LogAndApply() {
+    ParsePhases();
+    Open();
+    Status s = clients_[0]->Mkdir(FLAGS_root, false);
+    if (!s.ok()) Die("Cannot create root", s);
+    for (int c = 0; c < FLAGS_clients; c++) {
+      trees_.push_back(std::vector<std::string>());
+      if (FLAGS_unique_dir || c == 0) {
+        char tmp[30];
+        snprintf(tmp, sizeof(tmp), FLAGS_unique_dir ? "/tree.%d" : "/tree", c);
+        AddTree(std::string(FLAGS_root) + tmp, FLAGS_depth, &trees_.back());
+      }
+    }
+    pool_ = ThreadPool::NewFixed(FLAGS_clients, true);
+    for (int p = 0; p < kNumPhases; p++) {
+      if (enabled_[p]) {
+        RunPhase(static_cast<Phase>(p));
+      }
+    }
+  }
+
+ private:
+  void ParsePhases() {
+    std::vector<std::string> names;
+    SplitString(&names, FLAGS_phases, ',');
+    for (size_t i = 0; i < names.size(); i++) {
+      int p = 0;
+      while (p < kNumPhases && names[i] != PhaseName(p)) p++;
+      DieIf(p == kNumPhases, "Unknown phase");
+      enabled_[p] = true;
+    }
+  }
+
+  void Open() {
+    if (strcmp(FLAGS_api, "posix") == 0) {
+      for (int c = 0; c < FLAGS_clients; c++) {
+        clients_.push_back(new PosixClient);
+      }
+      return;
+    }
+    DieIf(strcmp(FLAGS_api, "cli") != 0, "Unknown api");
+    env_->CreateDir(FLAGS_db);
+    mds_env_.env = env_;
+    for (int i = 0; i < FLAGS_servers; i++) {
+      char tmp[30];
+      snprintf(tmp, sizeof(tmp), "/shard-%08d", i);
+      const std::string dbname = std::string(FLAGS_db) + tmp;
+      DBOptions dbopts;
+      dbopts.env = env_;
+      DestroyDB(dbname, dbopts);
+      dbopts.create_if_missing = true;
+      dbopts.prefix_extractor = MDBPrefixExtractor();
+      DB* db;
+      Status s = DB::Open(dbopts, dbname, &db);
+      if (!s.ok()) Die("Cannot open db", s);
+      dbs_.push_back(db);
+      MDBOptions mdbopts;
+      mdbopts.db = db;
+      mdbopts.sync = FLAGS_sync;
+      mdbopts.collect_stats = true;
+      mdbs_.push_back(new MDB(mdbopts));
+      MDSOptions mdsopts;
+      mdsopts.mds_env = &mds_env_;
+      mdsopts.mdb = mdbs_.back();
+      mdsopts.lease_duration = static_cast<uint64_t>(FLAGS_lease_duration);
+      mdsopts.num_virtual_servers = FLAGS_servers;
+      mdsopts.num_servers = FLAGS_servers;
+      mdsopts.srv_id = i;
+      servers_.push_back(MDS::Open(mdsopts));
+    }
+    factory_ = new LocalMDSFactory(servers_);
+    for (int c = 0; c < FLAGS_clients; c++) {
+      MDSCliOptions cliopts;
+      cliopts.env = env_;
+      cliopts.factory = factory_;
+      cliopts.lookup_cache_size = static_cast<size_t>(FLAGS_lookup_cache_size);
+      cliopts.index_cache_size = static_cast<size_t>(FLAGS_index_cache_size);
+      cliopts.num_virtual_servers = FLAGS_servers;
+      cliopts.num_servers = FLAGS_servers;
+      cliopts.session_id = c;
+      cliopts.cli_id = c;
+      clients_.push_back(new CliClient(MDS::CLI::Open(cliopts)));
+    }
+  }
+
+  // Append the paths of all directories of a tree in creation order
+  static void AddTree(const std::string& dir, int depth,
+                      std::vector<std::string>* result) {
+    result->push_back(dir);
+    if (depth > 0) {
+      for (int b = 0; b < FLAGS_branch; b++) {
+        char tmp[30];
+        snprintf(tmp, sizeof(tmp), "/d.%d", b);
+        AddTree(dir + tmp, depth - 1, result);
+      }
+    }
+  }
+
+  // Return the tree client c works in
+  const std::vector<std::string>& Tree(int c) const {
+    return trees_[FLAGS_unique_dir ? c : 0];
+  }
+
+  static std::string FilePath(const std::vector<std::string>& tree, int c,
+                              int j) {
+    char tmp[50];
+    snprintf(tmp, sizeof(tmp), "/f.%d.%d", c, j);
+    return tree[size_t(j) % tree.size()] + tmp;
+  }
+
+  struct ClientArg {
+    MDSBench* bench;
+    int c;
+  };
+
+  static void RunClient(void* arg) {
+    ClientArg* const a = static_cast<ClientArg*>(arg);
+    a->bench->DoPhase(a->c);
+    MutexLock ml(&a->bench->mu_);
+    a->bench->done_++;
+    a->bench->cv_.SignalAll();
+  }
+
+  void DoPhase(int c) {
+    BenchClient* const cli = clients_[c];
+    ClientStats* const stats = &stats_[c];
+    const std::vector<std::string>& tree = Tree(c);
+    Status s;
+    uint64_t start;
+    switch (phase_) {
+      case kTree:
+        // Shared trees are created by client 0 alone
+        if (FLAGS_unique_dir || c == 0) {
+          for (size_t i = 0; s.ok() && i < tree.size(); i++) {
+            start = CurrentMicros();
+            s = cli->Mkdir(tree[i], true);
+            stats->Add(CurrentMicros() - start);
+          }
+        }
+        break;
+      case kCreate:
+      case kStat:
+      case kUnlink:
+        for (int j = 0; s.ok() && j < FLAGS_num; j++) {
+          const std::string path = FilePath(tree, c, j);
+          start = CurrentMicros();
+          if (phase_ == kCreate) {
+            s = cli->Creat(path);
+          } else if (phase_ == kStat) {
+            s = cli->Stat(path);
+          } else {
+            s = cli->Unlink(path);
+          }
+          stats->Add(CurrentMicros() - start);
+        }
+        break;
+      case kReaddir:
+        // Shared trees are listed by all clients in turns
+        for (size_t i = FLAGS_unique_dir ? 0 : size_t(c);
+             s.ok() && i < tree.size();
+             i += FLAGS_unique_dir ? 1 : size_t(FLAGS_clients)) {
+          size_t entries = 0;
+          start = CurrentMicros();
+          s = cli->Listdir(tree[i], &entries);
+          stats->Add(CurrentMicros() - start);
+          stats->entries += entries;
+        }
+        break;
+      default:
+        break;
+    }
+    stats->status = s;
+  }
+
+  MDBStats ServerStats() {
+    MDBStats result;
+    for (size_t i = 0; i < mdbs_.size(); i++) {
+      MDBStats stats;
+      mdbs_[i]->GetStats(&stats);
+      result.putkeybytes += stats.putkeybytes;
+      result.putbytes += stats.putbytes;
+      result.puts += stats.puts;
+      result.getkeybytes += stats.getkeybytes;
+      result.getbytes += stats.getbytes;
+      result.gets += stats.gets;
+    }
+    return result;
+  }
+
+  void RunPhase(Phase phase) {
+    phase_ = phase;
+    stats_.assign(size_t(FLAGS_clients), ClientStats());
+    std::vector<ClientArg> args(static_cast<size_t>(FLAGS_clients));
+    const MDBStats before = ServerStats();
+    const uint64_t start = CurrentMicros();
+    done_ = 0;
+    for (int c = 0; c < FLAGS_clients; c++) {
+      args[c].bench = this;
+      args[c].c = c;
+      pool_->Schedule(RunClient, &args[c]);
+    }
+    {
+      MutexLock ml(&mu_);
+      while (done_ < FLAGS_clients) cv_.Wait();
+    }
+    const uint64_t micros = std::max<uint64_t>(1, CurrentMicros() - start);
+    MDBStats mdb = ServerStats();
+    mdb.putkeybytes -= before.putkeybytes;
+    mdb.putbytes -= before.putbytes;
+    mdb.puts -= before.puts;
+    mdb.getkeybytes -= before.getkeybytes;
+    mdb.getbytes -= before.getbytes;
+    mdb.gets -= before.gets;
+    ClientStats total;
+    for (size_t c = 0; c < stats_.size(); c++) {
+      total.Merge(stats_[c]);
+    }
+    if (!total.status.ok()) Die(PhaseName(phase), total.status);
+    Report(phase, total, micros, mdb);
+  }
+
+  void Report(Phase phase, const ClientStats& s, uint64_t micros,
+              const MDBStats& mdb) {
+    const Histogram& lat = s.latency;
+    fprintf(stderr,
+            "%-8s %10llu ops in %.3f s: %.1f ops/s, latency avg %.1f us, "
+            "p50 %.1f us, p99 %.1f us, max %llu us\n",
+            PhaseName(phase), static_cast<unsigned long long>(s.ops),
+            micros / 1e6, 1e6 * s.ops / micros, lat.Average(),
+            lat.Percentile(50), lat.Percentile(99),
+            static_cast<unsigned long long>(s.max_micros));
+    if (!mdbs_.empty()) {
+      fprintf(stderr, "%-8s mdb: %llu gets (%.1f KiB), %llu puts (%.1f KiB)\n",
+              "", static_cast<unsigned long long>(mdb.gets),
+              (mdb.getkeybytes + mdb.getbytes) / 1024.0,
+              static_cast<unsigned long long>(mdb.puts),
+              (mdb.putkeybytes + mdb.putbytes) / 1024.0);
+    }
+    if (phase == kReaddir) {
+      fprintf(stderr, "%-8s %llu entries listed\n", "",
+              static_cast<unsigned long long>(s.entries));
+    }
+    char tmp[1000];
+    snprintf(tmp, sizeof(tmp),
+             "{\"bench\":\"mds\",\"api\":\"%s\",\"phase\":\"%s\","
+             "\"clients\":%d,\"servers\":%d,\"unique_dir\":%d,\"depth\":%d,"
+             "\"branch\":%d,\"num_ops\":%llu,\"ops_per_sec\":%.3f,"
+             "\"entries\":%llu,\"latency_micros\":{\"avg\":%.3f,"
+             "\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p999\":%.3f,"
+             "\"max\":%llu},\"mdb\":{\"gets\":%llu,\"getkeybytes\":%llu,"
+             "\"getbytes\":%llu,\"puts\":%llu,\"putkeybytes\":%llu,"
+             "\"putbytes\":%llu}}",
+             FLAGS_api, PhaseName(phase), FLAGS_clients,
+             int(mdbs_.size()), int(FLAGS_unique_dir), FLAGS_depth,
+             FLAGS_branch, static_cast<unsigned long long>(s.ops),
+             1e6 * s.ops / micros, static_cast<unsigned long long>(s.entries),
+             lat.Average(), lat.Percentile(50), lat.Percentile(90),
+             lat.Percentile(99), lat.Percentile(99.9),
+             static_cast<unsigned long long>(s.max_micros),
+             static_cast<unsigned long long>(mdb.gets),
+             static_cast<unsigned long long>(mdb.getkeybytes),
+             static_cast<unsigned long long>(mdb.getbytes),
+             static_cast<unsigned long long>(mdb.puts),
+             static_cast<unsigned long long>(mdb.putkeybytes),
+             static_cast<unsigned long long>(mdb.putbytes));
+    fprintf(stdout, "%s\n", tmp);
+    fflush(stdout);
+  }
+
+  Env* const env_;
+  bool enabled_[kNumPhases];
+  // Directories of each client's tree. Clients sharing a tree all use the
+  // first.
+  std::vector<std::vector<std::string> > trees_;
+  std::vector<BenchClient*> clients_;
+  ThreadPool* pool_;
+  // In-process servers. Empty unless api is cli.
+  MDSEnv mds_env_;
+  std::vector<DB*> dbs_;
+  std::vector<MDB*> mdbs_;
+  std::vector<MDS*> servers_;
+  LocalMDSFactory* factory_;
+
+  // State of the current phase
+  Phase phase_;
+  std::vector<ClientStats> stats_;
+  port::Mutex mu_;
+  port::CondVar cv_;
+  int done_;  // Number of clients done with the phase. Protected by mu_.
+};
+
+}  // namespace
+}  // namespace pdlfs
+
+static void Usage(const char* argv0) {
+  fprintf(stderr, "Usage: %s [--flag=value]...\n", argv0);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "--api=cli|posix\n");
+  fprintf(stderr, "--phases=tree,create,stat,readdir,unlink\n");
+  fprintf(stderr, "--clients=<int>\n");
+  fprintf(stderr, "--num=<files per client>\n");
+  fprintf(stderr, "--depth=<int>\n");
+  fprintf(stderr, "--branch=<int>\n");
+  fprintf(stderr, "--unique_dir=0|1\n");
+  fprintf(stderr, "--root=<path>\n");
+  fprintf(stderr, "--servers=<int>\n");
+  fprintf(stderr, "--lease_duration=<micros>\n");
+  fprintf(stderr, "--lookup_cache_size=<int>\n");
+  fprintf(stderr, "--index_cache_size=<int>\n");
+  fprintf(stderr, "--sync=0|1\n");
+  fprintf(stderr, "--db=<path>\n");
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    int n;
+    char junk;
+    pdlfs::Slice arg(argv[i]);
+    if (arg.starts_with("--api=")) {
+      FLAGS_api = argv[i] + strlen("--api=");
+    } else if (arg.starts_with("--phases=")) {
+      FLAGS_phases = argv[i] + strlen("--phases=");
+    } else if (arg.starts_with("--root=")) {
+      FLAGS_root = argv[i] + strlen("--root=");
+    } else if (arg.starts_with("--db=")) {
+      FLAGS_db = argv[i] + strlen("--db=");
+    } else if (sscanf(argv[i], "--clients=%d%c", &n, &junk) == 1) {
+      FLAGS_clients = n;
+    } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
+      FLAGS_num = n;
+    } else if (sscanf(argv[i], "--depth=%d%c", &n, &junk) == 1) {
+      FLAGS_depth = n;
+    } else if (sscanf(argv[i], "--branch=%d%c", &n, &junk) == 1) {
+      FLAGS_branch = n;
+    } else if (sscanf(argv[i], "--unique_dir=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_unique_dir = n;
+    } else if (sscanf(argv[i], "--servers=%d%c", &n, &junk) == 1) {
+      FLAGS_servers = n;
+    } else if (sscanf(argv[i], "--lease_duration=%d%c", &n, &junk) == 1) {
+      FLAGS_lease_duration = n;
+    } else if (sscanf(argv[i], "--lookup_cache_size=%d%c", &n, &junk) == 1) {
+      FLAGS_lookup_cache_size = n;
+    } else if (sscanf(argv[i], "--index_cache_size=%d%c", &n, &junk) == 1) {
+      FLAGS_index_cache_size = n;
+    } else if (sscanf(argv[i], "--sync=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_sync = n;
+    } else {
+      fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      Usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if (FLAGS_clients <= 0 || FLAGS_num < 0 || FLAGS_depth < 0 ||
+      FLAGS_branch <= 0 || FLAGS_servers <= 0) {
+    Usage(argv[0]);
+    exit(1);
+  }
+
+  pdlfs::MDSBench bench;
+  bench.LogAndApply();
+  return 0;
+}
@@ -10,12 +10,15 @@
  */
 
 #include "mds_cli.h"
+#include "util/mdb.h"
 
 #include "pdlfs-common/mutexlock.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <map>
 #include <set>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -23,46 +26,90 @@ namespace pdlfs {
 
 #define MDS_OP_VERBOSE_LEVEL 8
 
+// Servers pre-split every directory to all partitions when the directory is
+// first loaded and never split it afterwards (see MDS::SRV::LoadDir()), so the
+// index of a directory only depends on its zeroth server. Build it locally
+// instead of reading it from the zeroth server. Otherwise, all clients
+// starting to create files in a new directory at the same time would first
+// queue up at its zeroth server. Should an index ever differ from what
+// servers have, calls are redirected and the index gets updated as usual.
 Status MDS::CLI::FetchIndex(const DirId& id, int zserver,
                             IndexHandle** result) {
-  mutex_.AssertHeld();
   Status s;
   IndexHandle* h = index_cache_->Lookup(id);
   if (h == NULL) {
-    mutex_.Unlock();
-
-    DirIndex* idx = new DirIndex(&giga_);
-    ReadidxOptions options;
-    options.op_due = DELTAFS_MAX_MICROS;
-    options.session_id = session_id_;
-    options.dir_id = id;
-    ReadidxRet ret;
     assert(zserver >= 0);
-    size_t server = zserver % giga_.num_servers;
-    s = factory_->Get(server)->Readidx(options, &ret);
-    if (s.ok()) {
-      if (!idx->Update(ret.idx) || idx->ZerothServer() != zserver) {
-        s = Status::Corruption(Slice());
-      }
-    }
-
-    mutex_.Lock();
-    if (s.ok()) {
-      h = index_cache_->Insert(id, idx);
+    if (zserver >= giga_.num_virtual_servers) {
+      s = Status::Corruption(Slice());
     } else {
-      delete idx;
+      DirIndex* idx = new DirIndex(zserver, &giga_);
+      idx->SetAll();
+      h = index_cache_->Insert(id, idx);
     }
   }
   *result = h;
   return s;
 }
 
+// Merge the index piggybacked on a redirect into *tmp_idx, which is created as
+// a copy of "idx" at the first redirect of a call. Return TryAgain if the call
+// should be retried against *tmp_idx. Return Corruption, after discarding
+// *tmp_idx, if the redirect carries no valid index, or, keeping the updated
+// *tmp_idx, if too many redirects have been received.
+Status MDS::CLI::MergeRedirect(const DirIndex* idx, const Redirect& re,
+                               DirIndex** tmp_idx, int* remaining_redirects) {
+  if (*tmp_idx == NULL) {
+    *tmp_idx = new DirIndex(&giga_);
+    (*tmp_idx)->Update(*idx);
+  }
+  if (!(*tmp_idx)->Update(re)) {
+    delete *tmp_idx;
+    *tmp_idx = NULL;
+    return Status::Corruption("bad giga+ index");
+  } else if (--(*remaining_redirects) <= 0) {
+    return Status::Corruption("too many redirects");
+  } else {
+    return Status::TryAgain(Slice());
+  }
+}
+
+// Patch the cached index of a directory with an index updated by redirects,
+// whether or not the redirected call eventually succeeded, so later calls
+// against the directory go to the right servers at once.
+void MDS::CLI::CacheIndex(const DirId& pid, DirIndex* tmp_idx) {
+  index_cache_->Release(index_cache_->Insert(pid, tmp_idx));
+}
+
+// Cached negative lookups are represented by stats without a file type.
+static LookupStat* NewNegativeStat(const LookupStat& ret) {
+  LookupStat* stat = new LookupStat;
+#if defined(DELTAFS)
+  stat->SetRegId(0);
+  stat->SetSnapId(0);
+#endif
+  stat->SetInodeNo(0);
+  stat->SetDirMode(0);
+  stat->SetZerothServer(0);
+  stat->SetUserId(0);
+  stat->SetGroupId(0);
+  stat->SetLeaseDue(ret.LeaseDue());
+  return stat;
+}
+
+static inline bool IsNegativeStat(const LookupStat* stat) {
+  return (stat->DirMode() & S_IFMT) == 0;
+}
+
+// Path components in "ahead" are looked up speculatively along with "name"
+// and cached for use by subsequent lookups. The last component of "ahead" is
+// always left out since it is not necessarily a directory.
 Status MDS::CLI::Lookup(const DirId& pid, const Slice& name, int zserver,
-                        uint64_t op_due, LookupHandle** result) {
+                        uint64_t op_due, LookupHandle** result,
+                        const Slice& ahead,
+                        std::vector<LeaseRenewal>* renewals) {
   Status s;
   char tmp[20];
   Slice nhash = DirIndex::Hash(name, tmp);
-  mutex_.AssertHeld();
 
   uint64_t now = CurrentMicros();
   LookupHandle* h = lookup_cache_->Lookup(pid, nhash);
@@ -71,6 +118,10 @@ Status MDS::CLI::Lookup(const DirId& pid, const Slice& name, int zserver,
   // we don't have one yet or
   // the one we current have has expired
   if (h == NULL || (now + 10) > lookup_cache_->Value(h)->LeaseDue()) {
+    if (h != NULL) {
+      lookup_cache_->Release(h);
+      h = NULL;
+    }
     IndexHandle* idxh = NULL;
     s = FetchIndex(pid, zserver, &idxh);
     if (s.ok()) {
@@ -81,10 +132,21 @@ Status MDS::CLI::Lookup(const DirId& pid, const Slice& name, int zserver,
       options.session_id = session_id_;
       options.dir_id = pid;
       options.name_hash = nhash;
+      options.negative_lease = negative_lookups_;
       if (paranoid_checks_) {
         options.name = name;
       }
+      const char* end = ahead.data();
+      int n = 0;
+      for (size_t i = 0; i < ahead.size(); i++) {
+        if (ahead[i] == '/' && n++ < max_lookahead_) {
+          end = ahead.data() + i;
+        }
+      }
+      options.rest = Slice(ahead.data(), end - ahead.data());
+      std::vector<LookupStat> more;
       LookupRet ret;
+      ret.more = &more;
       s = _Lookup(index_cache_->Value(idxh), options, &ret);
       if (s.ok()) {
         LookupStat* stat = new LookupStat(ret.stat);
@@ -92,42 +154,127 @@ Status MDS::CLI::Lookup(const DirId& pid, const Slice& name, int zserver,
         if (stat->LeaseDue() == 0) {
           lookup_cache_->Erase(pid, nhash);
         }
+        Slice input = options.rest;
+        DirId parent(ret.stat);
+        for (size_t i = 0; i < more.size() && !input.empty(); i++) {
+          const char* p = static_cast<const char*>(
+              memchr(input.data(), '/', input.size()));
+          Slice n = Slice(input.data(), p != NULL ? p - input.data()
+                                                  : input.size());
+          input.remove_prefix(p != NULL ? n.size() + 1 : n.size());
+          char buf[20];
+          Slice h2 = DirIndex::Hash(n, buf);
+          if (more[i].LeaseDue() != 0) {
+            lookup_cache_->Release(
+                lookup_cache_->Insert(parent, h2, new LookupStat(more[i])));
+          }
+          parent = DirId(more[i]);
+        }
+      } else if (s.IsNotFound() && ret.stat.LeaseDue() != 0) {
+        lookup_cache_->Release(
+            lookup_cache_->Insert(pid, nhash, NewNegativeStat(ret.stat)));
       }
     }
+  } else if (IsNegativeStat(lookup_cache_->Value(h))) {
+    lookup_cache_->Release(h);
+    h = NULL;
+    s = Status::NotFound(Slice());
+  } else if (renewals != NULL && now + lease_renewal_window_ >
+                                     lookup_cache_->Value(h)->LeaseDue()) {
+    renewals->resize(renewals->size() + 1);
+    LeaseRenewal* const r = &renewals->back();
+    r->pid = pid;
+    r->zserver = zserver;
+    r->name = name.ToString();
+    r->nhash = nhash.ToString();
   }
 
   *result = h;
   return s;
 }
 
+// Leases are renewed through lookup ops of compound calls, one call for each
+// server. A compound call stops at its first failed op, in which case the ops
+// after it are sent again. Errors are otherwise ignored: lookups that could
+// not be renewed simply expire and are looked up again when next used.
+void MDS::CLI::RenewLeases(const std::vector<LeaseRenewal>& renewals) {
+  std::map<size_t, std::vector<CompoundItem> > items;
+  for (size_t i = 0; i < renewals.size(); i++) {
+    const LeaseRenewal& r = renewals[i];
+    IndexHandle* idxh = NULL;
+    if (!FetchIndex(r.pid, r.zserver, &idxh).ok()) {
+      continue;
+    }
+    assert(idxh != NULL);
+    const size_t server = index_cache_->Value(idxh)->HashToServer(r.nhash);
+    index_cache_->Release(idxh);
+    assert(server < giga_.num_servers);
+    CompoundItem item;
+    item.op = kLookupOp;
+    item.dir_id = r.pid;
+    item.name_hash = r.nhash;
+    if (paranoid_checks_) {
+      item.name = r.name;
+    }
+    items[server].push_back(item);
+  }
+
+  std::map<size_t, std::vector<CompoundItem> >::iterator it;
+  for (it = items.begin(); it != items.end(); ++it) {
+    const std::vector<CompoundItem>& all = it->second;
+    CompoundOptions options;
+    options.op_due = DELTAFS_MAX_MICROS;
+    options.session_id = session_id_;
+    size_t start = 0;
+    while (start < all.size()) {
+      options.items.assign(all.begin() + start, all.end());
+      CompoundRet ret;
+      Status s;
+      try {
+        s = factory_->Get(it->first)->Compound(options, &ret);
+      } catch (Redirect&) {
+        s = Status::TryAgain(Slice());
+      }
+      if (!s.ok() || ret.statuses.empty()) {
+        break;
+      }
+      for (size_t i = 0; i < ret.statuses.size(); i++) {
+        if (ret.statuses[i].ok() && ret.lease_dues[i] != 0) {
+          const CompoundItem& item = all[start + i];
+          LookupStat* const stat = new LookupStat;
+          stat->CopyFrom(ret.stats[i]);
+          stat->SetLeaseDue(ret.lease_dues[i]);
+          lookup_cache_->Release(
+              lookup_cache_->Insert(item.dir_id, item.name_hash, stat));
+        }
+      }
+      start += ret.statuses.size();
+    }
+  }
+}
+
 Status MDS::CLI::_Lookup(const DirIndex* idx, const LookupOptions& options,
                          LookupRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
       assert(latest_idx != NULL);
       size_t server = latest_idx->HashToServer(options.name_hash);
       assert(server < giga_.num_servers);
-      s = factory_->Get(server)->Lookup(options, ret);
-    } catch (Redirect& re) {
-      if (tmp_idx == NULL) {
-        tmp_idx = new DirIndex(&giga_);
-        tmp_idx->Update(*idx);
-      }
-      if (--remaining_redirects == 0 || !tmp_idx->Update(re)) {
-        s = Status::Corruption("bad giga+ index");
-      } else {
-        s = Status::TryAgain(Slice());
+      MDS* const mds = factory_->GetReader(server);
+      s = mds->Lookup(options, ret);
+      if (s.IsNotFound() && mds != factory_->Get(server)) {
+        // Replicas may not have seen the name yet
+        s = factory_->Get(server)->Lookup(options, ret);
       }
-      assert(tmp_idx);
-      latest_idx = tmp_idx;
+    } catch (Redirect& re) {
+      s = MergeRedirect(idx, re, &tmp_idx, &remaining_redirects);
+      latest_idx = tmp_idx != NULL ? tmp_idx : idx;
     }
   } while (s.IsTryAgain());
 
@@ -139,15 +286,8 @@ Status MDS::CLI::_Lookup(const DirIndex* idx, const LookupOptions& options,
     }
   }
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
-    if (s.ok()) {
-      const DirId& pid = options.dir_id;
-      IndexHandle* h = index_cache_->Insert(pid, tmp_idx);
-      index_cache_->Release(h);
-    } else {
-      delete tmp_idx;
-    }
+    CacheIndex(options.dir_id, tmp_idx);
   }
 
   return s;
@@ -203,8 +343,6 @@ bool MDS::CLI::IsLookupOk(const PathInfo* info) {
 
 Status MDS::CLI::ResolvePath(const Slice& path, PathInfo* result,
                              const Fentry* at, std::string* missing_parent) {
-  mutex_.AssertHeld();
-
   Status s;
   Slice input(path);
   assert(input.size() != 0);
@@ -231,6 +369,7 @@ Status MDS::CLI::ResolvePath(const Slice& path, PathInfo* result,
   }
 
   input.remove_prefix(1);
+  std::vector<LeaseRenewal> renewals;
   std::vector<PathInfo> parents(2, *result);
   uint64_t lease_due = result->lease_due;
   int depth = result->depth;
@@ -258,7 +397,8 @@ Status MDS::CLI::ResolvePath(const Slice& path, PathInfo* result,
           result->name = name;
           parents.push_back(*result);
           LookupHandle* lh = NULL;
-          s = Lookup(result->pid, name, result->zserver, lease_due, &lh);
+          s = Lookup(result->pid, name, result->zserver, lease_due, &lh,
+                     input, lease_renewal_window_ != 0 ? &renewals : NULL);
           if (s.ok()) {
             assert(lh != NULL);
             const LookupStat* stat = lookup_cache_->Value(lh);
@@ -309,6 +449,10 @@ Status MDS::CLI::ResolvePath(const Slice& path, PathInfo* result,
     }
   }
 
+  if (!renewals.empty()) {
+    RenewLeases(renewals);
+  }
+
 #if VERBOSE >= MDS_OP_VERBOSE_LEVEL
   if (s.ok()) {
     Verbose(__LOG_ARGS__, MDS_OP_VERBOSE_LEVEL,
@@ -340,7 +484,7 @@ Status MDS::CLI::Fstat(const Slice& p, Fentry* ent, const Fentry* at) {
   }
 
   PathInfo path;
-  MutexLock ml(&mutex_);
+  Stat cached;
   s = ResolvePath(p, &path, at);
   if (s.ok()) {
     if (path.depth == 0) {  // Path is root or pseudo root
@@ -406,6 +550,15 @@ Status MDS::CLI::Fstat(const Slice& p, Fentry* ent, const Fentry* at) {
       stat->SetChangeTime(0);  // XXXZQ: FIX ME
       stat->SetModifyTime(0);
 
+    } else if (attr_cache_ != NULL &&
+               attr_cache_->Lookup(path.pid, path.nhash, CurrentMicros(),
+                                   ent != NULL ? &ent->stat : &cached)) {
+      if (ent != NULL) {
+        ent->pid = path.pid;
+        ent->nhash = path.nhash.ToString();
+        ent->zserver = path.zserver;
+      }
+
     } else {
       IndexHandle* idxh = NULL;
       s = FetchIndex(path.pid, path.zserver, &idxh);
@@ -422,8 +575,19 @@ Status MDS::CLI::Fstat(const Slice& p, Fentry* ent, const Fentry* at) {
           options.name = path.name;
         }
         FstatRet ret;
+        const uint64_t gen =
+            attr_cache_ != NULL ? attr_cache_->Generation(path.pid, path.nhash)
+                                : 0;
+        const uint64_t start = CurrentMicros();
         s = _Fstat(index_cache_->Value(idxh), options, &ret);
         if (s.ok()) {
+          if (attr_cache_ != NULL) {
+            // Leases start before the call so they never outlast the
+            // caching time even when calls take long
+            uint64_t due = start + attr_lease_;
+            if (atomic_path_resolution_) due = std::min(due, path.lease_due);
+            attr_cache_->Insert(path.pid, path.nhash, ret.stat, due, gen);
+          }
           if (ent != NULL) {
             ent->pid = path.pid;
             ent->nhash = path.nhash.ToString();
@@ -441,43 +605,30 @@ Status MDS::CLI::Fstat(const Slice& p, Fentry* ent, const Fentry* at) {
 Status MDS::CLI::_Fstat(const DirIndex* idx, const FstatOptions& options,
                         FstatRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
       assert(latest_idx != NULL);
       size_t server = latest_idx->HashToServer(options.name_hash);
       assert(server < giga_.num_servers);
-      s = factory_->Get(server)->Fstat(options, ret);
-    } catch (Redirect& re) {
-      if (tmp_idx == NULL) {
-        tmp_idx = new DirIndex(&giga_);
-        tmp_idx->Update(*idx);
+      MDS* const mds = factory_->GetReader(server);
+      s = mds->Fstat(options, ret);
+      if (s.IsNotFound() && mds != factory_->Get(server)) {
+        // Replicas may not have seen the name yet
+        s = factory_->Get(server)->Fstat(options, ret);
       }
-      if (--remaining_redirects == 0 || !tmp_idx->Update(re)) {
-        s = Status::Corruption("bad giga+ index");
-      } else {
-        s = Status::TryAgain(Slice());
-      }
-      assert(tmp_idx != NULL);
-      latest_idx = tmp_idx;
+    } catch (Redirect& re) {
+      s = MergeRedirect(idx, re, &tmp_idx, &remaining_redirects);
+      latest_idx = tmp_idx != NULL ? tmp_idx : idx;
     }
   } while (s.IsTryAgain());
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
-    if (s.ok()) {
-      const DirId& pid = options.dir_id;
-      IndexHandle* h = index_cache_->Insert(pid, tmp_idx);
-      index_cache_->Release(h);
-    } else {
-      delete tmp_idx;
-    }
+    CacheIndex(options.dir_id, tmp_idx);
   }
 
   return s;
@@ -494,7 +645,6 @@ Status MDS::CLI::Fcreat(const Slice& p, mode_t mode, Fentry* ent,
 
   Status s;
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(p, &path, at);
   if (s.ok()) {
     if (path.depth == 0) {
@@ -535,6 +685,7 @@ Status MDS::CLI::Fcreat(const Slice& p, mode_t mode, Fentry* ent,
       if (s.ok()) {
         assert(idxh != NULL);
         IndexGuard idxg(index_cache_, idxh);
+        ForgetAttr(path.pid, path.nhash);
         FcreatOptions options;
         options.op_due =
             atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
@@ -548,6 +699,7 @@ Status MDS::CLI::Fcreat(const Slice& p, mode_t mode, Fentry* ent,
         options.name = path.name;
         FcreatRet ret;
         s = _Fcreat(index_cache_->Value(idxh), options, &ret);
+        ForgetAttr(path.pid, path.nhash);
         if (s.ok()) {
           if (created != NULL) *created = ret.created;
           if (ent != NULL) {
@@ -564,15 +716,148 @@ Status MDS::CLI::Fcreat(const Slice& p, mode_t mode, Fentry* ent,
   return s;
 }
 
+Status MDS::CLI::Bcreat(const Slice& p, const std::vector<std::string>& names,
+                        mode_t mode, std::vector<Status>* statuses,
+                        bool error_if_exists) {
+  Status s;
+  assert(p.size() != 0);
+  assert(p.size() == 1 || !p.ends_with("/"));
+  statuses->assign(names.size(), Status::OK());
+  std::string fake_path = p.ToString();
+  fake_path += "/_";
+  PathInfo path;
+  s = ResolvePath(fake_path, &path);
+  if (s.ok()) {
+    if (!IsWriteDirOk(&path)) {
+      s = Status::AccessDenied(Slice());
+    } else if (DELTAFS_DIR_IS_PLFS_STYLE(path.mode)) {
+      s = Status::NotSupported("batch create under plfs dirs");
+    } else {
+      IndexHandle* idxh = NULL;
+      s = FetchIndex(path.pid, path.zserver, &idxh);
+      if (s.ok()) {
+        assert(idxh != NULL);
+        IndexGuard idxg(index_cache_, idxh);
+        if (attr_cache_ != NULL) {
+          char tmp[DELTAFS_NAME_HASH_BUFSIZE];
+          for (size_t i = 0; i < names.size(); i++) {
+            ForgetAttr(path.pid, DirIndex::Hash(names[i], tmp));
+          }
+        }
+        BcreatOptions options;
+        options.op_due =
+            atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
+        options.session_id = session_id_;
+        options.dir_id = path.pid;
+        options.flags = error_if_exists ? O_EXCL : 0;
+        options.mode = mode;
+        options.uid = uid_;
+        options.gid = gid_;
+        s = _Bcreat(index_cache_->Value(idxh), options, names, statuses);
+        if (attr_cache_ != NULL) {
+          char tmp[DELTAFS_NAME_HASH_BUFSIZE];
+          for (size_t i = 0; i < names.size(); i++) {
+            ForgetAttr(path.pid, DirIndex::Hash(names[i], tmp));
+          }
+        }
+      }
+    }
+  }
+
+  return s;
+}
+
+// Max amount of name data sent in a single batch create call.
+static const size_t kMaxBcreatBytes = 1000;
+
+Status MDS::CLI::_Bcreat(const DirIndex* idx, const BcreatOptions& options,
+                         const std::vector<std::string>& names,
+                         std::vector<Status>* statuses) {
+  Status s;
+  std::vector<std::string> hashes(names.size());
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i].empty() || names[i].find('/') != std::string::npos) {
+      (*statuses)[i] = Status::InvalidArgument("bad file name");
+    } else if (names[i].size() > DELTAFS_NAME_MAX) {
+      (*statuses)[i] = FileNameExceeedsLimit();
+    } else {
+      DirIndex::PutHash(&hashes[i], names[i]);
+      pending.push_back(i);
+    }
+  }
+  DirIndex* tmp_idx = NULL;
+  assert(idx != NULL);
+  const DirIndex* latest_idx = idx;
+  int remaining_redirects = max_redirects_allowed_;
+
+  while (s.ok() && !pending.empty()) {
+    typedef std::map<size_t, std::vector<size_t> > Groups;
+    Groups groups;
+    std::vector<Slice> pending_hashes(pending.size());
+    for (size_t i = 0; i < pending.size(); i++) {
+      pending_hashes[i] = hashes[pending[i]];
+    }
+    std::vector<int> servers(pending.size());
+    latest_idx->HashesToServers(&pending_hashes[0], pending.size(),
+                                &servers[0]);
+    for (size_t i = 0; i < pending.size(); i++) {
+      const size_t server = static_cast<size_t>(servers[i]);
+      assert(server < giga_.num_servers);
+      groups[server].push_back(pending[i]);
+    }
+    pending.clear();
+    for (Groups::iterator it = groups.begin(); s.ok() && it != groups.end();
+         ++it) {
+      const std::vector<size_t>& members = it->second;
+      size_t j = 0;
+      while (s.ok() && j < members.size()) {
+        BcreatOptions opts = options;
+        size_t bytes = 0;
+        const size_t begin = j;
+        while (j < members.size() &&
+               (opts.names.empty() || bytes < kMaxBcreatBytes)) {
+          opts.names.push_back(names[members[j]]);
+          opts.name_hashes.push_back(hashes[members[j]]);
+          bytes += names[members[j]].size() + hashes[members[j]].size();
+          j++;
+        }
+        BcreatRet ret;
+        try {
+          Status r = factory_->Get(it->first)->Bcreat(opts, &ret);
+          if (r.ok() && ret.statuses.size() != opts.names.size()) {
+            r = Status::Corruption(Slice());
+          }
+          for (size_t k = begin; k < j; k++) {
+            (*statuses)[members[k]] = r.ok() ? ret.statuses[k - begin] : r;
+          }
+        } catch (Redirect& re) {
+          s = MergeRedirect(idx, re, &tmp_idx, &remaining_redirects);
+          if (s.IsTryAgain()) {
+            s = Status::OK();
+            pending.insert(pending.end(), members.begin() + begin,
+                           members.begin() + j);
+          }
+          latest_idx = tmp_idx != NULL ? tmp_idx : idx;
+        }
+      }
+    }
+  }
+
+  if (tmp_idx != NULL) {
+    CacheIndex(options.dir_id, tmp_idx);
+  }
+
+  return s;
+}
+
 Status MDS::CLI::_Fcreat(const DirIndex* idx, const FcreatOptions& options,
                          FcreatRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -581,17 +866,8 @@ Status MDS::CLI::_Fcreat(const DirIndex* idx, const FcreatOptions& options,
       assert(server < giga_.num_servers);
       s = factory_->Get(server)->Fcreat(options, ret);
     } catch (Redirect& re) {
-      if (tmp_idx == NULL) {
-        tmp_idx = new DirIndex(&giga_);
-        tmp_idx->Update(*idx);
-      }
-      if (--remaining_redirects == 0 || !tmp_idx->Update(re)) {
-        s = Status::Corruption("bad giga+ index");
-      } else {
-        s = Status::TryAgain(Slice());
-      }
-      assert(tmp_idx != NULL);
-      latest_idx = tmp_idx;
+      s = MergeRedirect(idx, re, &tmp_idx, &remaining_redirects);
+      latest_idx = tmp_idx != NULL ? tmp_idx : idx;
     }
   } while (s.IsTryAgain());
 
@@ -603,15 +879,8 @@ Status MDS::CLI::_Fcreat(const DirIndex* idx, const FcreatOptions& options,
     }
   }
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
-    if (s.ok()) {
-      const DirId& pid = options.dir_id;
-      IndexHandle* h = index_cache_->Insert(pid, tmp_idx);
-      index_cache_->Release(h);
-    } else {
-      delete tmp_idx;
-    }
+    CacheIndex(options.dir_id, tmp_idx);
   }
 
   return s;
@@ -628,7 +897,6 @@ Status MDS::CLI::Unlink(const Slice& p, Fentry* ent, bool error_if_absent,
   }
 
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(p, &path, at);
   if (s.ok()) {
     if (path.depth == 0) {
@@ -645,6 +913,7 @@ Status MDS::CLI::Unlink(const Slice& p, Fentry* ent, bool error_if_absent,
       if (s.ok()) {
         assert(idxh != NULL);
         IndexGuard idxg(index_cache_, idxh);
+        ForgetAttr(path.pid, path.nhash);
         UnlinkOptions options;
         options.op_due =
             atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
@@ -657,6 +926,7 @@ Status MDS::CLI::Unlink(const Slice& p, Fentry* ent, bool error_if_absent,
         }
         UnlinkRet ret;
         s = _Unlink(index_cache_->Value(idxh), options, &ret);
+        ForgetAttr(path.pid, path.nhash);
         if (s.ok()) {
           if (ent != NULL) {
             ent->pid = path.pid;
@@ -675,12 +945,10 @@ Status MDS::CLI::Unlink(const Slice& p, Fentry* ent, bool error_if_absent,
 Status MDS::CLI::_Unlink(const DirIndex* idx, const UnlinkOptions& options,
                          UnlinkRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -689,29 +957,13 @@ Status MDS::CLI::_Unlink(const DirIndex* idx, const UnlinkOptions& options,
       assert(server < giga_.num_servers);
       s = factory_->Get(server)->Unlink(options, ret);
     } catch (Redirect& re) {
-      if (tmp_idx == NULL) {
-        tmp_idx = new DirIndex(&giga_);
-        tmp_idx->Update(*idx);
-      }
-      if (--remaining_redirects == 0 || !tmp_idx->Update(re)) {
-        s = Status::Corruption("bad giga+ index");
-      } else {
-        s = Status::TryAgain(Slice());
-      }
-      assert(tmp_idx != NULL);
-      latest_idx = tmp_idx;
+      s = MergeRedirect(idx, re, &tmp_idx, &remaining_redirects);
+      latest_idx = tmp_idx != NULL ? tmp_idx : idx;
     }
   } while (s.IsTryAgain());
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
-    if (s.ok()) {
-      const DirId& pid = options.dir_id;
-      IndexHandle* h = index_cache_->Insert(pid, tmp_idx);
-      index_cache_->Release(h);
-    } else {
-      delete tmp_idx;
-    }
+    CacheIndex(options.dir_id, tmp_idx);
   }
 
   return s;
@@ -724,21 +976,22 @@ Status MDS::CLI::Mkdir(
   Status s;
   PathInfo path;
   std::string missing_parent;
-  MutexLock ml(&mutex_);
   s = ResolvePath(p, &path, NULL, &missing_parent);
   if (s.IsNotFound() && create_if_missing) {
     if (!missing_parent.empty()) {
-      mutex_.Unlock();
-      s = Mkdir(missing_parent,
-                mode & ~DELTAFS_DIR_MASK,  // avoid special directory modes
-                NULL, true,  // recursively creating missing parents
-                false        // okay if exists
-      );
+      const mode_t parent_mode =
+          mode & ~DELTAFS_DIR_MASK;  // avoid special directory modes
+      s = MkdirChain(missing_parent, p, parent_mode);
+      if (!s.ok()) {
+        s = Mkdir(missing_parent, parent_mode, NULL,
+                  true,  // recursively creating missing parents
+                  false  // okay if exists
+        );
+      }
       if (s.ok()) {
         s = Mkdir(p, mode, ent, true,  // retry the original request
                   error_if_exists);
       }
-      mutex_.Lock();
     }
 
   } else if (s.ok()) {
@@ -758,6 +1011,7 @@ Status MDS::CLI::Mkdir(
       if (s.ok()) {
         assert(idxh != NULL);
         IndexGuard idxg(index_cache_, idxh);
+        ForgetAttr(path.pid, path.nhash);
         MkdirOptions options;
         options.op_due =
             atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
@@ -771,6 +1025,7 @@ Status MDS::CLI::Mkdir(
         options.name = path.name;
         MkdirRet ret;
         s = _Mkdir(index_cache_->Value(idxh), options, &ret);
+        ForgetAttr(path.pid, path.nhash);
         if (s.ok()) {
           if (ent != NULL) {
             ent->pid = path.pid;
@@ -786,15 +1041,107 @@ Status MDS::CLI::Mkdir(
   return s;
 }
 
+static const size_t kMaxChainedMkdirs = 16;
+
+// Create a missing parent directory together with as many of the missing
+// directories beneath it on the way to "p" as the parent's server is able to
+// serve, all in a single compound call. Directories not created here are left
+// to the regular path. Return OK iff "missing_parent" has been created.
+Status MDS::CLI::MkdirChain(const Slice& missing_parent, const Slice& p,
+                            mode_t mode) {
+  Status s;
+  PathInfo path;
+  s = ResolvePath(missing_parent, &path);
+  if (!s.ok()) {
+    return s;
+  } else if (path.depth == 0 || !IsWriteDirOk(&path) ||
+             DELTAFS_DIR_IS_PLFS_STYLE(path.mode) ||
+             path.name.size() > DELTAFS_NAME_MAX) {
+    // Let the regular path report the error
+    return Status::NotSupported(Slice());
+  }
+
+  CompoundOptions options;
+  options.op_due =
+      atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
+  options.session_id = session_id_;
+  CompoundItem item;
+  item.op = kMkdirOp;
+  item.mode = mode;
+  item.uid = uid_;
+  item.gid = gid_;
+  item.dir_id = path.pid;
+  item.name_hash = path.nhash;
+  item.name = path.name;
+  options.items.push_back(item);
+  // Directories beneath the new one can only be created if its owner is
+  // allowed to write and search it. The last component of the path is left
+  // to the caller.
+  std::vector<std::string> hashes;
+  const mode_t wx = S_IWUSR | S_IXUSR;
+  if ((mode & wx) == wx) {
+    assert(p.size() > missing_parent.size());
+    Slice rest(p.data() + missing_parent.size() + 1,
+               p.size() - missing_parent.size() - 1);
+    item.chained = 1;
+    while (options.items.size() < kMaxChainedMkdirs) {
+      const char* const slash =
+          static_cast<const char*>(memchr(rest.data(), '/', rest.size()));
+      if (slash == NULL) {
+        break;
+      }
+      Slice name(rest.data(), slash - rest.data());
+      rest.remove_prefix(name.size() + 1);
+      if (name.empty() || name == "." || name == ".." ||
+          name.size() > DELTAFS_NAME_MAX) {
+        break;
+      }
+      hashes.push_back(std::string());
+      DirIndex::PutHash(&hashes.back(), name);
+      item.name = name;
+      options.items.push_back(item);
+    }
+    for (size_t i = 0; i < hashes.size(); i++) {
+      options.items[i + 1].name_hash = hashes[i];
+    }
+  }
+
+  IndexHandle* idxh = NULL;
+  s = FetchIndex(path.pid, path.zserver, &idxh);
+  if (s.ok()) {
+    assert(idxh != NULL);
+    IndexGuard idxg(index_cache_, idxh);
+    size_t server = index_cache_->Value(idxh)->HashToServer(path.nhash);
+    assert(server < giga_.num_servers);
+    CompoundRet ret;
+    try {
+      s = factory_->Get(server)->Compound(options, &ret);
+    } catch (Redirect& re) {
+      // Retried by the caller, by which time the index has been patched
+      DirIndex* tmp_idx = NULL;
+      int remaining_redirects = max_redirects_allowed_;
+      s = MergeRedirect(index_cache_->Value(idxh), re, &tmp_idx,
+                        &remaining_redirects);
+      if (tmp_idx != NULL) {
+        CacheIndex(path.pid, tmp_idx);
+      }
+    }
+    if (s.ok()) {
+      s = ret.statuses.empty() ? Status::Corruption(Slice())
+                               : ret.statuses[0];
+    }
+  }
+
+  return s;
+}
+
 Status MDS::CLI::_Mkdir(const DirIndex* idx, const MkdirOptions& options,
                         MkdirRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -803,17 +1150,8 @@ Status MDS::CLI::_Mkdir(const DirIndex* idx, const MkdirOptions& options,
       assert(server < giga_.num_servers);
       s = factory_->Get(server)->Mkdir(options, ret);
     } catch (Redirect& re) {
-      if (tmp_idx == NULL) {
-        tmp_idx = new DirIndex(&giga_);
-        tmp_idx->Update(*idx);
-      }
-      if (--remaining_redirects == 0 || !tmp_idx->Update(re)) {
-        s = Status::Corruption("bad giga+ index");
-      } else {
-        s = Status::TryAgain(Slice());
-      }
-      assert(tmp_idx != NULL);
-      latest_idx = tmp_idx;
+      s = MergeRedirect(idx, re, &tmp_idx, &remaining_redirects);
+      latest_idx = tmp_idx != NULL ? tmp_idx : idx;
     }
   } while (s.IsTryAgain());
 
@@ -825,15 +1163,8 @@ Status MDS::CLI::_Mkdir(const DirIndex* idx, const MkdirOptions& options,
     }
   }
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
-    if (s.ok()) {
-      const DirId& pid = options.dir_id;
-      IndexHandle* h = index_cache_->Insert(pid, tmp_idx);
-      index_cache_->Release(h);
-    } else {
-      delete tmp_idx;
-    }
+    CacheIndex(options.dir_id, tmp_idx);
   }
 
   return s;
@@ -842,7 +1173,6 @@ Status MDS::CLI::_Mkdir(const DirIndex* idx, const MkdirOptions& options,
 Status MDS::CLI::Chmod(const Slice& p, mode_t mode, Fentry* ent) {
   Status s;
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(p, &path);
   if (s.ok()) {
     if (path.depth == 0) {
@@ -855,6 +1185,7 @@ Status MDS::CLI::Chmod(const Slice& p, mode_t mode, Fentry* ent) {
       if (s.ok()) {
         assert(idxh != NULL);
         IndexGuard idxg(index_cache_, idxh);
+        ForgetAttr(path.pid, path.nhash);
         ChmodOptions options;
         options.op_due =
             atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
@@ -867,6 +1198,7 @@ Status MDS::CLI::Chmod(const Slice& p, mode_t mode, Fentry* ent) {
         }
         ChmodRet ret;
         s = _Chmod(index_cache_->Value(idxh), options, &ret);
+        ForgetAttr(path.pid, path.nhash);
         if (s.ok()) {
           if (ent != NULL) {
             ent->pid = path.pid;
@@ -885,12 +1217,10 @@ Status MDS::CLI::Chmod(const Slice& p, mode_t mode, Fentry* ent) {
 Status MDS::CLI::_Chmod(const DirIndex* idx, const ChmodOptions& options,
                         ChmodRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -899,29 +1229,13 @@ Status MDS::CLI::_Chmod(const DirIndex* idx, const ChmodOptions& options,
       assert(server < giga_.num_servers);
       s = factory_->Get(server)->Chmod(options, ret);
     } catch (Redirect& re) {
-      if (tmp_idx == NULL) {
-        tmp_idx = new DirIndex(&giga_);
-        tmp_idx->Update(*idx);
-      }
-      if (--remaining_redirects == 0 || !tmp_idx->Update(re)) {
-        s = Status::Corruption("bad giga+ index");
-      } else {
-        s = Status::TryAgain(Slice());
-      }
-      assert(tmp_idx != NULL);
-      latest_idx = tmp_idx;
+      s = MergeRedirect(idx, re, &tmp_idx, &remaining_redirects);
+      latest_idx = tmp_idx != NULL ? tmp_idx : idx;
     }
   } while (s.IsTryAgain());
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
-    if (s.ok()) {
-      const DirId& pid = options.dir_id;
-      IndexHandle* h = index_cache_->Insert(pid, tmp_idx);
-      index_cache_->Release(h);
-    } else {
-      delete tmp_idx;
-    }
+    CacheIndex(options.dir_id, tmp_idx);
   }
 
   return s;
@@ -930,7 +1244,6 @@ Status MDS::CLI::_Chmod(const DirIndex* idx, const ChmodOptions& options,
 Status MDS::CLI::Chown(const Slice& p, uid_t usr, gid_t grp, Fentry* ent) {
   Status s;
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(p, &path);
   if (s.ok()) {
     if (path.depth == 0) {
@@ -943,6 +1256,7 @@ Status MDS::CLI::Chown(const Slice& p, uid_t usr, gid_t grp, Fentry* ent) {
       if (s.ok()) {
         assert(idxh != NULL);
         IndexGuard idxg(index_cache_, idxh);
+        ForgetAttr(path.pid, path.nhash);
         ChownOptions options;
         options.op_due =
             atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
@@ -956,6 +1270,7 @@ Status MDS::CLI::Chown(const Slice& p, uid_t usr, gid_t grp, Fentry* ent) {
         }
         ChownRet ret;
         s = _Chown(index_cache_->Value(idxh), options, &ret);
+        ForgetAttr(path.pid, path.nhash);
         if (s.ok()) {
           if (ent != NULL) {
             ent->pid = path.pid;
@@ -974,12 +1289,10 @@ Status MDS::CLI::Chown(const Slice& p, uid_t usr, gid_t grp, Fentry* ent) {
 Status MDS::CLI::_Chown(const DirIndex* idx, const ChownOptions& options,
                         ChownRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -988,29 +1301,13 @@ Status MDS::CLI::_Chown(const DirIndex* idx, const ChownOptions& options,
       assert(server < giga_.num_servers);
       s = factory_->Get(server)->Chown(options, ret);
     } catch (Redirect& re) {
-      if (tmp_idx == NULL) {
-        tmp_idx = new DirIndex(&giga_);
-        tmp_idx->Update(*idx);
-      }
-      if (--remaining_redirects == 0 || !tmp_idx->Update(re)) {
-        s = Status::Corruption("bad giga+ index");
-      } else {
-        s = Status::TryAgain(Slice());
-      }
-      assert(tmp_idx != NULL);
-      latest_idx = tmp_idx;
+      s = MergeRedirect(idx, re, &tmp_idx, &remaining_redirects);
+      latest_idx = tmp_idx != NULL ? tmp_idx : idx;
     }
   } while (s.IsTryAgain());
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
-    if (s.ok()) {
-      const DirId& pid = options.dir_id;
-      IndexHandle* h = index_cache_->Insert(pid, tmp_idx);
-      index_cache_->Release(h);
-    } else {
-      delete tmp_idx;
-    }
+    CacheIndex(options.dir_id, tmp_idx);
   }
 
   return s;
@@ -1028,17 +1325,180 @@ Status MDS::CLI::_Chown(const DirIndex* idx, const ChownOptions& options,
 // conflicts either when the file we want to update no long exists
 // (e.g. concurrently unlinked by others) or is no longer associated
 // with the path (e.g. concurrently renamed by others).
+Status MDS::CLI::Bopen(const Slice& p, const std::string& table_dir,
+                       mode_t mode, Bulk** result) {
+  Status s;
+  assert(p.size() != 0);
+  assert(p.size() == 1 || !p.ends_with("/"));
+  *result = NULL;
+  std::string fake_path = p.ToString();
+  fake_path += "/_";
+  PathInfo path;
+  s = ResolvePath(fake_path, &path);
+  if (s.ok()) {
+    if (!IsWriteDirOk(&path)) {
+      s = Status::AccessDenied(Slice());
+    } else if (DELTAFS_DIR_IS_PLFS_STYLE(path.mode)) {
+      s = Status::NotSupported("bulk insertion under plfs dirs");
+    } else {
+      IndexHandle* idxh = NULL;
+      s = FetchIndex(path.pid, path.zserver, &idxh);
+      if (s.ok()) {
+        assert(idxh != NULL);
+        IndexGuard idxg(index_cache_, idxh);
+        *result = new Bulk(this, path.pid, *index_cache_->Value(idxh),
+                           table_dir, mode);
+      }
+    }
+  }
+
+  return s;
+}
+
+// Number of inode numbers reserved from a server at a time.
+static const uint64_t kBulkInoBatch = 1024;
+
+// Files of a bulk insertion session destined to a single server.
+struct MDS::CLI::Bulk::Part {
+  Part(const DBOptions& dbopts, const std::string& d)
+      : dir(d), loader(dbopts, d), num_entries(0), next_ino(0), ino_limit(0) {}
+  std::string dir;
+  MDBLoader loader;
+  uint64_t num_entries;
+  uint64_t next_ino;
+  uint64_t ino_limit;  // Reserved inode numbers end before this one
+};
+
+MDS::CLI::Bulk::Bulk(CLI* cli, const DirId& pid, const DirIndex& idx,
+                     const std::string& table_dir, mode_t mode)
+    : cli_(cli),
+      pid_(pid),
+      idx_(&cli->giga_),
+      table_dir_(table_dir),
+      mode_(mode),
+      parts_(cli->giga_.num_servers, static_cast<Part*>(NULL)),
+      committed_(false) {
+  idx_.Update(idx);
+  // Must match the options of the servers' dbs
+  dbopts_.env = cli->env_;
+  dbopts_.prefix_extractor = MDBPrefixExtractor();
+  cli->env_->CreateDir(table_dir_.c_str());  // Ignore errors
+}
+
+MDS::CLI::Bulk::~Bulk() {
+  for (size_t i = 0; i < parts_.size(); i++) {
+    delete parts_[i];
+  }
+}
+
+MDS::CLI::Bulk::Part* MDS::CLI::Bulk::GetPart(int srv_id) {
+  assert(srv_id >= 0 && static_cast<size_t>(srv_id) < parts_.size());
+  if (parts_[srv_id] == NULL) {
+    char tmp[30];
+    snprintf(tmp, sizeof(tmp), "/srv-%d", srv_id);
+    parts_[srv_id] = new Part(dbopts_, table_dir_ + tmp);
+  }
+  return parts_[srv_id];
+}
+
+Status MDS::CLI::Bulk::Add(const Slice& name) {
+  if (!status_.ok()) {
+    return status_;
+  } else if (committed_) {
+    return Status::AssertionFailed("bulk insertion already committed");
+  } else if (name.empty() || memchr(name.data(), '/', name.size()) != NULL) {
+    return Status::InvalidArgument("bad file name");
+  } else if (name.size() > DELTAFS_NAME_MAX) {
+    return FileNameExceeedsLimit();
+  }
+  char tmp[DELTAFS_NAME_HASH_BUFSIZE];
+  Slice name_hash = DirIndex::Hash(name, tmp);
+  cli_->ForgetAttr(pid_, name_hash);
+  const int srv_id = idx_.HashToServer(name_hash);
+  Part* const part = GetPart(srv_id);
+  if (part->next_ino == part->ino_limit) {
+    BulkinOptions options;
+    options.op_due = DELTAFS_MAX_MICROS;
+    options.session_id = cli_->session_id_;
+    options.dir_id = pid_;
+    options.num_entries = kBulkInoBatch;
+    BulkinRet ret;
+    try {
+      status_ = cli_->factory_->Get(srv_id)->Bulkin(options, &ret);
+    } catch (Redirect& re) {
+      status_ = Status::Corruption("unexpected redirect");
+    }
+    if (!status_.ok()) {
+      return status_;
+    }
+    part->next_ino = ret.first_ino;
+    part->ino_limit = ret.first_ino + kBulkInoBatch;
+  }
+  const uint64_t my_time = CurrentMicros();
+  Stat stat;
+#if defined(DELTAFS)
+  stat.SetRegId(pid_.reg);
+  stat.SetSnapId(pid_.snap);
+#endif
+  stat.SetInodeNo(part->next_ino++);
+  stat.SetFileSize(0);
+  stat.SetFileMode(S_IFREG | (mode_ & ACCESSPERMS));
+  stat.SetUserId(cli_->uid_);
+  stat.SetGroupId(cli_->gid_);
+  stat.SetZerothServer(0);
+  stat.SetModifyTime(my_time);
+  stat.SetChangeTime(my_time);
+  status_ = part->loader.Add(pid_, name_hash, stat, name);
+  if (status_.ok()) {
+    part->num_entries++;
+  }
+  return status_;
+}
+
+Status MDS::CLI::Bulk::Commit() {
+  if (!status_.ok()) {
+    return status_;
+  } else if (committed_) {
+    return Status::AssertionFailed("bulk insertion already committed");
+  }
+  committed_ = true;
+  for (size_t i = 0; status_.ok() && i < parts_.size(); i++) {
+    Part* const part = parts_[i];
+    if (part == NULL || part->num_entries == 0) continue;
+    status_ = part->loader.Finish();
+    if (status_.ok()) {
+      BulkinOptions options;
+      options.op_due = DELTAFS_MAX_MICROS;
+      options.session_id = cli_->session_id_;
+      options.dir_id = pid_;
+      options.dir = part->dir;
+      options.num_entries = part->num_entries;
+      BulkinRet ret;
+      try {
+        status_ = cli_->factory_->Get(i)->Bulkin(options, &ret);
+      } catch (Redirect& re) {
+        status_ = Status::Corruption("unexpected redirect");
+      }
+    }
+    if (status_.ok()) {
+      cli_->env_->DeleteDir(part->dir.c_str());  // Ignore errors
+    }
+  }
+  if (status_.ok()) {
+    cli_->env_->DeleteDir(table_dir_.c_str());  // Ignore errors
+  }
+  return status_;
+}
+
 Status MDS::CLI::Ftruncate(const Fentry& ent, uint64_t mtime, uint64_t size) {
   Status s;
   IndexHandle* idxh = NULL;
-  MutexLock ml(&mutex_);
   s = FetchIndex(ent.pid, ent.zserver, &idxh);
   if (s.ok()) {
-    mutex_.Unlock();
-
     assert(idxh != NULL);
     const DirIndex* idx = index_cache_->Value(idxh);
     assert(idx != NULL);
+    ForgetAttr(ent.pid, ent.nhash);
     TruncOptions options;  // TODO: add file id to options
     options.op_due = DELTAFS_MAX_MICROS;
     options.session_id = session_id_;
@@ -1058,47 +1518,89 @@ Status MDS::CLI::Ftruncate(const Fentry& ent, uint64_t mtime, uint64_t size) {
         assert(server < giga_.num_servers);
         s = factory_->Get(server)->Trunc(options, &ret);
       } catch (Redirect& re) {
-        if (tmp_idx == NULL) {
-          tmp_idx = new DirIndex(&giga_);
-          tmp_idx->Update(*idx);
-        }
-        if (--remaining_redirects == 0 || !tmp_idx->Update(re)) {
-          s = Status::Corruption("bad giga+ index");
-        } else {
-          s = Status::TryAgain(Slice());
-        }
-        assert(tmp_idx != NULL);
-        latest_idx = tmp_idx;
+        s = MergeRedirect(idx, re, &tmp_idx, &remaining_redirects);
+        latest_idx = tmp_idx != NULL ? tmp_idx : idx;
       }
     } while (s.IsTryAgain());
+    ForgetAttr(ent.pid, ent.nhash);
     if (s.ok()) {
       if (paranoid_checks_ && !S_ISREG(ret.stat.FileMode())) {
         s = Status::Corruption(Slice());
       }
     }
 
-    mutex_.Lock();
     index_cache_->Release(idxh);
     if (tmp_idx != NULL) {
-      if (s.ok()) {
-        index_cache_->Release(index_cache_->Insert(ent.pid, tmp_idx));
-      } else {
-        delete tmp_idx;
-      }
+      CacheIndex(ent.pid, tmp_idx);
     }
   }
 
   return s;
 }
 
-Status MDS::CLI::Listdir(const Slice& p, std::vector<std::string>* names) {
+namespace {
+// State shared by all threads listing the partitions of a directory
+struct ListdirState {
+  explicit ListdirState(const MDS::ListdirOptions& opts)
+      : cv(&mu), next(0), num_running(0), options(opts) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  std::vector<MDS*> servers;  // Servers to list, constant once workers start
+  std::vector<std::vector<std::string> > names;  // Per server
+  std::vector<std::vector<Stat> > stats;  // Per server, if options.with_stats
+  size_t next;  // Index of the next server to be listed
+  int num_running;  // Number of workers that have not finished
+  const MDS::ListdirOptions& options;
+};
+
+// List all entries at a server. Each server returns its entries in chunks;
+// keep asking from the last entry received until all are returned.
+void ListServer(MDS* mds, MDS::ListdirOptions options,
+                std::vector<std::string>* names, std::vector<Stat>* stats) {
+  MDS::ListdirRet ret;
+  ret.names = names;
+  ret.stats = stats;
+  std::string start;
+  options.start = Slice();
+  while (true) {
+    const size_t n = names->size();
+    Status s = mds->Listdir(options, &ret);
+    if (!s.ok() || !ret.truncated || names->size() == n) {
+      break;
+    }
+    start.clear();
+    DirIndex::PutHash(&start, names->back());
+    options.start = start;
+  }
+}
+
+void ListdirWorker(void* arg) {
+  ListdirState* const state = reinterpret_cast<ListdirState*>(arg);
+  MutexLock ml(&state->mu);
+  while (state->next < state->servers.size()) {
+    const size_t i = state->next++;
+    state->mu.Unlock();
+    ListServer(state->servers[i], state->options, &state->names[i],
+               state->options.with_stats ? &state->stats[i] : NULL);
+    state->mu.Lock();
+  }
+  assert(state->num_running > 0);
+  state->num_running--;
+  state->cv.SignalAll();
+}
+}  // namespace
+
+// List a directory by sending requests to all servers holding a partition of
+// it. Up to "max_parallel_lists_" servers are listed concurrently. Results are
+// merged in server order.
+Status MDS::CLI::Listdir(const Slice& p, std::vector<std::string>* names,
+                         std::vector<Stat>* stats) {
   Status s;
   assert(p.size() != 0);
   assert(p.size() == 1 || !p.ends_with("/"));
   std::string fake_path = p.ToString();
   fake_path += "/_";
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(fake_path, &path);
   if (s.ok()) {
     if (!IsReadDirOk(&path)) {
@@ -1109,8 +1611,6 @@ Status MDS::CLI::Listdir(const Slice& p, std::vector<std::string>* names) {
       IndexHandle* idxh = NULL;
       s = FetchIndex(path.pid, path.zserver, &idxh);
       if (s.ok()) {
-        mutex_.Unlock();
-
         assert(idxh != NULL);
         const DirIndex* idx = index_cache_->Value(idxh);
         assert(idx != NULL);
@@ -1119,9 +1619,9 @@ Status MDS::CLI::Listdir(const Slice& p, std::vector<std::string>* names) {
             atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
         options.session_id = session_id_;
         options.dir_id = path.pid;
-        ListdirRet ret;
-        ret.names = names;
+        options.with_stats = (stats != NULL);
 
+        ListdirState state(options);
         std::set<size_t> visited;
         int num_parts = 1 << idx->Radix();
         for (int i = 0; i < num_parts; i++) {
@@ -1129,7 +1629,7 @@ Status MDS::CLI::Listdir(const Slice& p, std::vector<std::string>* names) {
             size_t server = idx->GetServerForIndex(i);
             assert(server < giga_.num_servers);
             if (visited.count(server) == 0) {
-              factory_->Get(server)->Listdir(options, &ret);
+              state.servers.push_back(factory_->GetReader(server));
               visited.insert(server);
               if (visited.size() >= giga_.num_servers) {
                 break;
@@ -1138,7 +1638,32 @@ Status MDS::CLI::Listdir(const Slice& p, std::vector<std::string>* names) {
           }
         }
 
-        mutex_.Lock();
+        const size_t num_servers = state.servers.size();
+        state.names.resize(num_servers);
+        if (stats != NULL) state.stats.resize(num_servers);
+        // The calling thread is one of the workers
+        const size_t num_workers = std::min(
+            num_servers, static_cast<size_t>(std::max(1, max_parallel_lists_)));
+        state.num_running = num_workers;
+        for (size_t i = 1; i < num_workers; i++) {
+          env_->StartThread(ListdirWorker, &state);
+        }
+        ListdirWorker(&state);
+        state.mu.Lock();
+        while (state.num_running != 0) {
+          state.cv.Wait();
+        }
+        state.mu.Unlock();
+
+        for (size_t i = 0; i < num_servers; i++) {
+          names->insert(names->end(), state.names[i].begin(),
+                        state.names[i].end());
+          if (stats != NULL) {
+            stats->insert(stats->end(), state.stats[i].begin(),
+                          state.stats[i].end());
+          }
+        }
+
         index_cache_->Release(idxh);
       }
     }
@@ -1154,7 +1679,6 @@ Status MDS::CLI::Accessdir(const Slice& p, int mode) {
   std::string fake_path = p.ToString();
   fake_path += "/_";
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(fake_path, &path);
   if (s.ok()) {
     if ((mode & R_OK) == R_OK && !IsReadDirOk(&path)) {
@@ -11,11 +11,13 @@
 #pragma once
 
 #include "mds_api.h"
+#include "util/attr_cache.h"
 #include "util/guard.h"
 #include "util/index_cache.h"
 #include "util/lookup_cache.h"
 
 #include "pdlfs-common/fio.h"
+#include "pdlfs-common/leveldb/options.h"
 #include "pdlfs-common/port.h"
 
 namespace pdlfs {
@@ -24,6 +26,11 @@ class MDSFactory {
  public:
   virtual MDS* Get(size_t srv_id) = 0;
 
+  // Return a server for reads against srv_id. The result may be a
+  // read-only replica of that server and may thus miss its most recent
+  // updates. Default implementation always returns Get(srv_id).
+  virtual MDS* GetReader(size_t srv_id) { return Get(srv_id); }
+
  protected:
   virtual ~MDSFactory();
 };
@@ -36,7 +43,37 @@ struct MDSCliOptions {
   size_t lookup_cache_size;
   bool paranoid_checks;
   bool atomic_path_resolution;
+  // Cache lookups of missing directories. These are leased by servers and
+  // will delay the creation of the missing directories until the leases
+  // expire.
+  // Default: false
+  bool negative_lookups;
   int max_redirects_allowed;
+  // Max number of partition servers listed concurrently by Listdir.
+  // Default: 8
+  int max_parallel_lists;
+  // Max number of additional path components each lookup asks a server to
+  // resolve on our behalf. Set to 0 to resolve one component per lookup.
+  // Default: 8
+  int max_lookahead;
+  // Cache the attributes of files and directories obtained through Fstat for
+  // this long (in microseconds) so that repeated stats of the same path are
+  // served locally. Attributes may thus miss updates made by other clients
+  // within that time. Local updates always invalidate cached attributes. Set
+  // to 0 to disable.
+  // Default: 0
+  uint64_t attr_lease;
+  // Renew the leases of cached lookups that expire within this long (in
+  // microseconds) when they are used by path resolution, before they expire.
+  // Leases due for renewal are renewed after the path is resolved through a
+  // single compound call for each server, so hot paths stay cached instead of
+  // being looked up again one component at a time once their leases expire.
+  // Set to 0 to disable.
+  // Default: 0
+  uint64_t lease_renewal_window;
+  // Max number of attributes cached when attr_lease is not 0.
+  // Default: 4096
+  size_t attr_cache_size;
   int num_virtual_servers;
   int num_servers;
   int session_id;
@@ -55,6 +92,22 @@ class MDS::CLI {
   Status Fcreat(const Slice& path, mode_t mode, Fentry* result = NULL,
                 bool error_if_exists = true, bool* created = NULL,
                 const Fentry* at = NULL);
+  // Create a batch of regular files under the directory at "path". The
+  // result of each name is stored in *statuses. Names are grouped by their
+  // target server so each server receives as few calls as possible.
+  Status Bcreat(const Slice& path, const std::vector<std::string>& names,
+                mode_t mode, std::vector<Status>* statuses,
+                bool error_if_exists = true);
+  // Start a bulk insertion of new regular files under the directory at
+  // "path". Files are created in local table files under "table_dir", one
+  // sub-directory per server, using the same key format as the servers' dbs.
+  // Nothing is sent to servers until the session is committed, at which time
+  // each server inserts its tables into its db as a whole. "table_dir" must
+  // be on storage shared with the servers and must not be used by any other
+  // session.
+  class Bulk;
+  Status Bopen(const Slice& path, const std::string& table_dir, mode_t mode,
+               Bulk** result);
   Status Ftruncate(const Fentry&, uint64_t mtime, uint64_t size);
   Status Mkdir(const Slice& path, mode_t mode, Fentry* result = NULL,
                bool create_if_missing = false, bool error_if_exists = true);
@@ -62,7 +115,10 @@ class MDS::CLI {
   Status Chown(const Slice& path, uid_t usr, gid_t grp, Fentry* result = NULL);
   Status Unlink(const Slice& path, Fentry* result = NULL,
                 bool error_if_absent = true, const Fentry* at = NULL);
-  Status Listdir(const Slice& path, std::vector<std::string>* names);
+  // If stats is not NULL, the stat of each entry is returned along with
+  // its name.
+  Status Listdir(const Slice& path, std::vector<std::string>* names,
+                 std::vector<Stat>* stats = NULL);
   Status Accessdir(const Slice& path, int mode);
   Status Access(const Slice& path, int mode);
 
@@ -82,7 +138,6 @@ class MDS::CLI {
 #define HELPER(OP) \
   Status _##OP(const DirIndex*, const OP##Options& opts, OP##Ret* ret)
 
-  // REQUIRES: mutex_ has been locked.
   HELPER(Lookup);
   HELPER(Fstat);
   HELPER(Fcreat);
@@ -93,6 +148,22 @@ class MDS::CLI {
 
 #undef HELPER
 
+  Status _Bcreat(const DirIndex*, const BcreatOptions& opts,
+                 const std::vector<std::string>& names,
+                 std::vector<Status>* statuses);
+  Status MkdirChain(const Slice& missing_parent, const Slice& path,
+                    mode_t mode);
+  Status MergeRedirect(const DirIndex* idx, const Redirect& re,
+                       DirIndex** tmp_idx, int* remaining_redirects);
+  void CacheIndex(const DirId& pid, DirIndex* tmp_idx);
+  // Drop the cached attributes of an entry. Updaters call this both before
+  // and after updating an entry at its server: the first call keeps stale
+  // attributes from being served during the update, and the second drops
+  // those fetched by concurrent lookups while the update was in progress.
+  void ForgetAttr(const DirId& pid, const Slice& nhash) {
+    if (attr_cache_ != NULL) attr_cache_->Erase(pid, nhash);
+  }
+
   // Result of a successful path resolution
   struct PathInfo {
     DirId pid;
@@ -118,9 +189,20 @@ class MDS::CLI {
   bool IsWriteDirOk(const PathInfo*);
   bool IsLookupOk(const PathInfo*);
 
+  // A cached lookup whose lease is about to expire.
+  struct LeaseRenewal {
+    DirId pid;
+    int zserver;
+    std::string name;
+    std::string nhash;
+  };
+  void RenewLeases(const std::vector<LeaseRenewal>& renewals);
+
   typedef LookupCache::Handle LookupHandle;
+  // Cached lookups due for renewal are added to *renewals if it is not NULL.
   Status Lookup(const DirId&, const Slice& name, int zserver, uint64_t op_due,
-                LookupHandle**);
+                LookupHandle**, const Slice& rest = Slice(),
+                std::vector<LeaseRenewal>* renewals = NULL);
   typedef IndexCache::Handle IndexHandle;
   Status FetchIndex(const DirId&, int zserver, IndexHandle**);
   typedef RefGuard<IndexCache, IndexHandle> IndexGuard;
@@ -132,22 +214,67 @@ class MDS::CLI {
   GIGA giga_;
   bool paranoid_checks_;
   bool atomic_path_resolution_;
+  bool negative_lookups_;
   int max_redirects_allowed_;
+  int max_parallel_lists_;
+  int max_lookahead_;
+  uint64_t attr_lease_;
+  uint64_t lease_renewal_window_;
   int session_id_;
   int cli_id_;
   int uid_;
   int gid_;
 
   friend class MDS;
-  // State below is protected by mutex_
-  port::Mutex mutex_;
+  // All caches are sharded and internally synchronized
   LookupCache* lookup_cache_;
   IndexCache* index_cache_;
+  AttrCache* attr_cache_;  // NULL if attributes are not cached
   // No copying allowed
   void operator=(const CLI&);
   CLI(const CLI&);
 };
 
+// A client-side bulk insertion session obtained through MDS::CLI::Bopen().
+// Files are assumed to be new. Servers do not check for existing names, so a
+// file added through a session replaces any existing file with the same name.
+// The directory should not be modified by others until the session is
+// committed. Not thread-safe.
+class MDS::CLI::Bulk {
+ public:
+  // Discard all files not yet committed.
+  ~Bulk();
+
+  // Add a new file to the session. Inode numbers are reserved from the
+  // servers in batches, so most calls involve no server at all.
+  Status Add(const Slice& name);
+
+  // Have each server insert the files added to it and update the size of the
+  // directory. No further files may be added afterwards.
+  Status Commit();
+
+ private:
+  friend class CLI;
+  Bulk(CLI* cli, const DirId& pid, const DirIndex& idx,
+       const std::string& table_dir, mode_t mode);
+  struct Part;
+  Part* GetPart(int srv_id);
+
+  CLI* const cli_;
+  const DirId pid_;
+  DirIndex idx_;
+  DBOptions dbopts_;
+  const std::string table_dir_;
+  const mode_t mode_;
+  std::vector<Part*> parts_;  // One per server, NULL if never used
+  bool committed_;
+  Status status_;
+
+  // No copying allowed
+  void operator=(const Bulk&);
+  Bulk(const Bulk&);
+};
+
 inline Status FileNameExceeedsLimit() {
   return Status::InvalidArgument("file name too long");
 }
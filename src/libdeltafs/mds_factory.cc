@@ -11,6 +11,8 @@
 
 #include "mds_factory.h"
 
+#include "pdlfs-common/mutexlock.h"
+
 namespace pdlfs {
 
 Status MDSFactoryImpl::Init(const MDSTopology& topo) {
@@ -25,9 +27,33 @@ Status MDSFactoryImpl::Init(const MDSTopology& topo) {
     full_uri.append("://");
   }
   size_t prefix = full_uri.size();
-  const std::vector<std::string>* addrs = &topo.srv_addrs;
+  compressed_replies_ = topo.rpc_reply_compression != kNoCompression;
+  num_srvs_ = topo.srv_addrs.size();
+  num_replicas_ = 0;
+  if (topo.num_replicas > 0) {
+    num_replicas_ = static_cast<size_t>(topo.num_replicas);
+    if (topo.replica_addrs.size() != num_srvs_ * num_replicas_) {
+      return Status::InvalidArgument("bad num of replica addrs");
+    }
+  }
+  std::vector<std::string> addrs = topo.srv_addrs;
+  if (num_replicas_ != 0) {
+    addrs.insert(addrs.end(), topo.replica_addrs.begin(),
+                 topo.replica_addrs.end());
+  }
+  if (topo.mds_trace_sampling != 0) {
+    Env* const env = env_ != NULL ? env_ : Env::Default();
+    trace_log_ =
+        new MDSTraceLog(env, topo.mds_trace_file,
+                        static_cast<uint32_t>(topo.mds_trace_sampling),
+                        MDSTracer::OpNames());
+    s = trace_log_->Open();
+    if (!s.ok()) {
+      return s;
+    }
+  }
   std::vector<std::string>::const_iterator it;
-  for (it = addrs->begin(); it != addrs->end(); ++it) {
+  for (it = addrs.begin(); it != addrs.end(); ++it) {
     const std::string* uri = &(*it);
     // Add RPC proto prefix if necessary
     if (!options.uri.empty() && !Slice(*it).starts_with(options.uri)) {
@@ -35,7 +61,8 @@ Status MDSFactoryImpl::Init(const MDSTopology& topo) {
       full_uri.append(*it);
       uri = &full_uri;
     }
-    AddTarget(*uri, topo.mds_tracing);
+    AddTarget(*uri, topo.mds_tracing,
+              static_cast<uint32_t>(it - addrs.begin()));
   }
   return s;
 }
@@ -52,12 +79,15 @@ Status MDSFactoryImpl::Stop() {
   return rpc_->Stop();
 }
 
-void MDSFactoryImpl::AddTarget(const std::string& target_uri, bool trace) {
+void MDSFactoryImpl::AddTarget(const std::string& target_uri, bool trace,
+                               uint32_t idx) {
   StubInfo info;
   assert(rpc_ != NULL);
   info.stub = rpc_->OpenStubFor(target_uri);
-  info.wrapper = new MDSWrapper(info.stub);
-  if (trace) {
+  info.wrapper = new MDSWrapper(info.stub, compressed_replies_);
+  if (trace_log_ != NULL) {
+    info.mds = new MDSTracer(target_uri, info.wrapper, trace_log_, idx);
+  } else if (trace) {
     info.mds = new MDSTracer(target_uri, info.wrapper);
   } else {
     info.mds = info.wrapper;
@@ -70,6 +100,24 @@ MDS* MDSFactoryImpl::Get(size_t srv_id) {
   return stubs_[srv_id].mds;
 }
 
+// Pick the server itself or one of its replicas, in turn.
+MDS* MDSFactoryImpl::GetReader(size_t srv_id) {
+  assert(srv_id < num_srvs_);
+  if (num_replicas_ == 0) {
+    return stubs_[srv_id].mds;
+  }
+  size_t r;
+  {
+    MutexLock ml(&mutex_);
+    r = next_++ % (num_replicas_ + 1);
+  }
+  if (r == 0) {
+    return stubs_[srv_id].mds;
+  } else {
+    return stubs_[num_srvs_ + srv_id * num_replicas_ + r - 1].mds;
+  }
+}
+
 MDSFactoryImpl::~MDSFactoryImpl() {
   std::vector<StubInfo>::iterator it;
   for (it = stubs_.begin(); it != stubs_.end(); ++it) {
@@ -79,6 +127,7 @@ MDSFactoryImpl::~MDSFactoryImpl() {
     delete it->wrapper;
     delete it->stub;
   }
+  delete trace_log_;
   delete rpc_;
 }
 
@@ -17,8 +17,18 @@ namespace pdlfs {
 
 struct MDSTopology {
   bool mds_tracing;
+  // Sample one of every mds_trace_sampling calls into mds_trace_file,
+  // or 0 to disable
+  uint64_t mds_trace_sampling;
+  std::string mds_trace_file;
   std::string rpc_proto;
+  // Compression for large listing and index replies, or kNoCompression
+  CompressionType rpc_reply_compression;
   std::vector<std::string> srv_addrs;
+  // Addrs of read-only replicas, num_replicas per server. Replicas of
+  // server 0 go first, followed by those of server 1, and so on.
+  std::vector<std::string> replica_addrs;
+  int num_replicas;
   int num_vir_srvs;
   int num_srvs;
 };
@@ -33,7 +43,15 @@ class MDSFactoryImpl : public MDSFactory {
 
  public:
   virtual MDS* Get(size_t srv_id);
-  explicit MDSFactoryImpl(Env* env = NULL) : env_(env), rpc_(NULL) {}
+  virtual MDS* GetReader(size_t srv_id);
+  explicit MDSFactoryImpl(Env* env = NULL)
+      : env_(env),
+        rpc_(NULL),
+        trace_log_(NULL),
+        num_srvs_(0),
+        num_replicas_(0),
+        compressed_replies_(false),
+        next_(0) {}
   virtual ~MDSFactoryImpl();
   Status Init(const MDSTopology&);
   Status Start();
@@ -45,9 +63,17 @@ class MDSFactoryImpl : public MDSFactory {
   MDSFactoryImpl(const MDSFactoryImpl&);
 
   Env* env_;  // okay to be NULL
-  void AddTarget(const std::string& uri, bool trace);
-  std::vector<StubInfo> stubs_;
+  void AddTarget(const std::string& uri, bool trace, uint32_t idx);
+  std::vector<StubInfo> stubs_;  // Servers first, followed by replicas
   RPC* rpc_;
+  MDSTraceLog* trace_log_;  // NULL unless calls are sampled
+  size_t num_srvs_;
+  size_t num_replicas_;  // Per server
+  bool compressed_replies_;
+
+  // Spread reads over each server and its replicas in a round-robin fashion
+  port::Mutex mutex_;
+  size_t next_;
 };
 
 }  // namespace pdlfs
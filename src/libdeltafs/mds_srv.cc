@@ -16,23 +16,29 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 namespace pdlfs {
 
-// NOTE: can be called while mutex_ is NOT locked.
+// NOTE: can be called while no partition mutex is locked.
 Status MDS::SRV::LoadDir(const DirId& id, DirInfo* info, DirIndex* index) {
   Status s;
   MDB::Tx* mdb_tx = NULL;
 
-  // Load directory info. Create if missing...
+  // Load directory info. Create if missing... A read-only server only
+  // makes up the initial states in memory as the primary would.
   s = mdb_->GetInfo(id, info, mdb_tx);
   if (s.IsNotFound()) {
-    mdb_tx = mdb_->CreateTx();
     info->mtime = CurrentMicros();
     info->size = 0;
-    s = mdb_->SetInfo(id, *info, mdb_tx);
+    if (read_only_) {
+      s = Status::OK();
+    } else {
+      mdb_tx = mdb_->CreateTx();
+      s = mdb_->SetInfo(id, *info, mdb_tx);
+    }
   }
 
   // Load directory index. Create if missing...
@@ -41,11 +47,19 @@ Status MDS::SRV::LoadDir(const DirId& id, DirInfo* info, DirIndex* index) {
     if (s.IsNotFound()) {
       int zserver = PickupServer(id) % giga_.num_virtual_servers;
       DirIndex tmp(zserver, &giga_);
-      tmp.SetAll();  // Pre-split to all servers
-      if (mdb_tx == NULL) {
-        mdb_tx = mdb_->CreateTx();
+      // Pre-split to all servers. Partitions are never split at runtime,
+      // so no entries ever migrate between servers and creates in huge
+      // directories never wait on a split. Clients rely on this to build
+      // directory indices without asking servers.
+      tmp.SetAll();
+      if (read_only_) {
+        s = Status::OK();
+      } else {
+        if (mdb_tx == NULL) {
+          mdb_tx = mdb_->CreateTx();
+        }
+        s = mdb_->SetDirIdx(id, tmp, mdb_tx);
       }
-      s = mdb_->SetDirIdx(id, tmp, mdb_tx);
       if (s.ok()) {
         index->Swap(tmp);
       }
@@ -68,33 +82,34 @@ Status MDS::SRV::LoadDir(const DirId& id, DirInfo* info, DirIndex* index) {
 // Errors might occur when the directory being searched does not exist, when
 // the LRU-cache is full, when the data read from DB is corrupted, and
 // when there are bugs somewhere in the codebase :-|
-// REQUIRES: mutex_ has been locked.
+// REQUIRES: the mutex of the partition of the dir has been locked.
 Status MDS::SRV::FetchDir(const DirId& id, Dir::Ref** ref) {
   char tmp[30];
   Slice id_encoding = EncodeId(id, tmp);
-  mutex_.AssertHeld();
+  Partition* const part = &parts_[PartitionOf(id)];
+  part->mu.AssertHeld();
   *ref = NULL;
   Status s;
 
   while (s.ok() && (*ref) == NULL) {
-    Dir::Ref* r = dirs_->Lookup(id);
+    Dir::Ref* r = part->dirs->Lookup(id);
     if (r != NULL) {
       *ref = r;
     } else {
       // Prevent multiple threads from loading a same directory at the same time
-      if (loading_dirs_.Contains(id_encoding)) {
+      if (part->loading_dirs.Contains(id_encoding)) {
         do {
-          loading_cv_.Wait();
-        } while (loading_dirs_.Contains(id_encoding));
+          part->loading_cv.Wait();
+        } while (part->loading_dirs.Contains(id_encoding));
       } else {
-        loading_dirs_.Insert(id_encoding);
-        mutex_.Unlock();
+        part->loading_dirs.Insert(id_encoding);
+        part->mu.Unlock();
         DirInfo dir_info;
         DirIndex dir_index(&giga_);
         s = LoadDir(id, &dir_info, &dir_index);
-        mutex_.Lock();
+        part->mu.Lock();
         if (s.ok()) {
-          Dir* d = new Dir(&mutex_, &giga_);
+          Dir* d = new Dir(&part->mu, &giga_);
           d->mtime = dir_info.mtime;
           assert(dir_info.size >= 0);
           d->size = dir_info.size;
@@ -104,7 +119,7 @@ Status MDS::SRV::FetchDir(const DirId& id, Dir::Ref** ref) {
           d->seq = 0;
           d->locked = false;
           try {
-            r = dirs_->Insert(id, d);
+            r = part->dirs->Insert(id, d);
           } catch (int err) {
             // Not expecting errors other than "buffer-full", which happens
             // when the directory cache is full and no entries can be evicted
@@ -119,9 +134,9 @@ Status MDS::SRV::FetchDir(const DirId& id, Dir::Ref** ref) {
           }
         }
 
-        assert(loading_dirs_.Contains(id_encoding));
-        loading_dirs_.Erase(id_encoding);
-        loading_cv_.SignalAll();
+        assert(part->loading_dirs.Contains(id_encoding));
+        part->loading_dirs.Erase(id_encoding);
+        part->loading_cv.SignalAll();
       }
     }
   }
@@ -129,47 +144,199 @@ Status MDS::SRV::FetchDir(const DirId& id, Dir::Ref** ref) {
   return s;
 }
 
+// Preload the directories recorded at the last shutdown in the background.
+// Calls on these directories that arrive meanwhile simply wait for or take
+// over their loading through FetchDir().
+void MDS::SRV::StartWarmup(int num_threads) {
+  std::string list;
+  Status s = mdb_->GetWarmupList(&list);
+  if (!s.ok()) {
+    if (!s.IsNotFound()) {
+      Warn(__LOG_ARGS__, "Cannot read warmup list: %s", s.ToString().c_str());
+    }
+    return;
+  }
+  Slice input = list;
+  DirId id;
+  while (GetVarint64(&input, &id.reg) && GetVarint64(&input, &id.snap) &&
+         GetVarint64(&input, &id.ino)) {
+    warmup_list_.push_back(id);
+  }
+  if (warmup_list_.empty()) {
+    return;
+  }
+  num_threads = std::min<size_t>(num_threads, warmup_list_.size());
+  MutexLock ml(&warmup_mu_);
+  warmup_start_ = CurrentMicros();
+  warmup_pool_ = ThreadPool::NewFixed(num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    warmup_running_++;
+    warmup_pool_->Schedule(RunWarmup, this);
+  }
+}
+
+void MDS::SRV::RunWarmup(void* arg) {
+  SRV* const srv = reinterpret_cast<SRV*>(arg);
+  MutexLock ml(&srv->warmup_mu_);
+  while (!srv->warmup_cancelled_ &&
+         srv->warmup_next_ < srv->warmup_list_.size()) {
+    const DirId id = srv->warmup_list_[srv->warmup_next_++];
+    srv->warmup_mu_.Unlock();
+    Partition* const part = &srv->parts_[PartitionOf(id)];
+    part->mu.Lock();
+    Dir::Ref* ref;
+    Status s = srv->FetchDir(id, &ref);
+    if (s.ok()) {
+      part->dirs->Release(ref);
+    }
+    part->mu.Unlock();
+    srv->warmup_mu_.Lock();
+    if (s.ok()) {
+      srv->warmup_loaded_++;
+    }
+  }
+  assert(srv->warmup_running_ > 0);
+  srv->warmup_running_--;
+  if (srv->warmup_running_ == 0) {
+#if VERBOSE >= 1
+    Verbose(__LOG_ARGS__, 1, "mds.warmup: %llu/%zu dirs loaded in %.3f s",
+            (unsigned long long)srv->warmup_loaded_,
+            srv->warmup_list_.size(),
+            double(CurrentMicros() - srv->warmup_start_) / 1000 / 1000);
+#endif
+    srv->warmup_cv_.SignalAll();
+  }
+}
+
+// Stop preloading directories and wait for all preloading threads to go.
+void MDS::SRV::StopWarmup() {
+  MutexLock ml(&warmup_mu_);
+  warmup_cancelled_ = true;
+  while (warmup_running_ != 0) {
+    warmup_cv_.Wait();
+  }
+  delete warmup_pool_;
+  warmup_pool_ = NULL;
+}
+
+void MDS::SRV::GetWarmupProgress(uint64_t* loaded, uint64_t* total) {
+  MutexLock ml(&warmup_mu_);
+  *loaded = warmup_loaded_;
+  *total = warmup_list_.size();
+}
+
+// Record the hottest directories currently in memory so that they can be
+// preloaded at the next start.
+void MDS::SRV::SaveWarmupList() {
+  std::vector<DirId> ids;
+  const size_t n = (warmup_dirs_ + kNumPartitions - 1) / kNumPartitions;
+  for (int i = 0; i < kNumPartitions; i++) {
+    MutexLock ml(&parts_[i].mu);
+    parts_[i].dirs->GetHotDirs(&ids, n);
+  }
+  std::string list;
+  char tmp[30];
+  for (size_t i = 0; i < ids.size() && i < warmup_dirs_; i++) {
+    Slice encoding = EncodeId(ids[i], tmp);
+    list.append(encoding.data(), encoding.size());
+  }
+  Status s = mdb_->SetWarmupList(list);
+  if (!s.ok()) {
+    Warn(__LOG_ARGS__, "Cannot save warmup list: %s", s.ToString().c_str());
+  }
+}
+
 // Quickly check background status. Return OK on success.
 // Return a non-OK status when the directory (or the server as a whole)
 // contains errors and must be fenced from online operations.
-// REQUIRES: mutex_ has been locked.
+// REQUIRES: the mutex of the partition of the dir has been locked.
 Status MDS::SRV::ProbeDir(const Dir* d) {
-  mutex_.AssertHeld();
-  if (!status_.ok()) {
-    return status_;
-  } else if (!d->status.ok()) {
+  {
+    MutexLock ml(&alloc_mu_);
+    if (!status_.ok()) {
+      return status_;
+    }
+  }
+  if (!d->status.ok()) {
     return d->status;
   } else {
     return Status::OK();
   }
 }
 
-// REQUIRES: mutex_ has been locked.
-uint64_t MDS::SRV::NextIno() {
-  mutex_.AssertHeld();
-  uint64_t result = ++ino_;
+uint64_t MDS::SRV::NextIno() { return NextInos(1); }
+
+// Allocate n consecutive inode numbers and return the first one.
+uint64_t MDS::SRV::NextInos(uint64_t n) {
+  assert(n != 0);
+  MutexLock ml(&alloc_mu_);
+  const uint64_t result = ino_ + 1;
+  ino_ += n;
+  if (ino_ > ino_mark_) {
+    // Reserve a new range of inode numbers by persisting its end
+    const uint64_t mark = ino_ + ino_batch_size_ - 1;
+    Status s = mdb_->SetInoMark(mark);
+    if (s.ok()) {
+      ino_mark_ = mark;
+    } else {
+      status_ = s;
+    }
+  }
   if (paranoid_checks_) {
     assert(srv_id_ >= 0);
     uint64_t limit = srv_id_ + 1;
     limit <<= 32;
-    if (result + 1 >= limit) {
+    if (ino_ + 1 >= limit) {
       status_ = Status::BufferFull("No more free inodes");
     }
   }
   return result;
 }
 
-// REQUIRES: mutex_ has been locked.
 void MDS::SRV::TryReuseIno(uint64_t ino) {
-  mutex_.AssertHeld();
+  MutexLock ml(&alloc_mu_);
   if (ino == ino_) {
     --ino_;
   }
 }
 
-// REQUIRES: mutex_ has been locked.
+// Invalidate any lease that may have been granted on a name that has just
+// been created, which can only be a negative lease, by waiting past its due.
+// Also prevents lookups that started before the creation from granting new
+// negative leases on the name.
+// REQUIRES: the mutex of the partition of the dir has been locked and the dir
+// has been locked for writing.
+void MDS::SRV::WaitForLease(Dir* d, const DirId& dir_id,
+                            const Slice& name_hash) {
+  Partition* const part = &parts_[PartitionOf(dir_id)];
+  part->mu.AssertHeld();
+  d->seq = 1 + d->seq;
+  Lease::Ref* lease_ref = part->leases->Lookup(dir_id, name_hash);
+  if (lease_ref != NULL) {
+    Lease::Guard lguard(part->leases, lease_ref);
+    Lease* const lease = lease_ref->value;
+    assert(lease != NULL && lease->state != kLeaseLocked);
+    uint64_t my_end = CurrentMicros();
+    if (lease->state == kLeaseShared && lease->due > my_end) {
+      part->leases->stats()->waits++;
+    }
+    while (lease->state == kLeaseShared && lease->due > my_end) {
+      lease->state = kLeaseLocked;
+      uint64_t diff = lease->due - my_end + 10;
+      part->mu.Unlock();
+      // Wait past lease due
+      SleepForMicroseconds(diff);
+      part->mu.Lock();
+      my_end = CurrentMicros();
+    }
+    assert(lease->parent == d);
+    lease->seq = d->seq;
+    lease->state = kLeaseFree;
+  }
+}
+
 uint32_t MDS::SRV::NextSession() {
-  mutex_.AssertHeld();
+  MutexLock ml(&alloc_mu_);
   session_ += giga_.num_servers;
   return session_;
 }
@@ -201,24 +368,25 @@ Status MDS::SRV::Fstat(const FstatOptions& options, FstatRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
+    Partition* const part = &parts_[PartitionOf(dir_id)];
+    MutexLock ml(&part->mu);
     s = FetchDir(dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(part->dirs, ref);
       const Dir* const d = ref->value;
       assert(d != NULL);
       s = ProbeDir(d);
       if (s.ok()) {
         int srv_id = d->index.HashToServer(name_hash);
         if (srv_id != srv_id_) {
-          Slice encoding = d->index.Encode();
-          Redirect re(encoding.data(), encoding.size());
+          Redirect re;
+          d->index.EncodeTo(&re);
           throw re;
         }
       }
       if (s.ok()) {
-        mutex_.Unlock();
+        part->mu.Unlock();
 
         MDB::Tx* mdb_tx = NULL;
         tx = reinterpret_cast<Dir::Tx*>(d->tx.Acquire_Load());
@@ -241,7 +409,7 @@ Status MDS::SRV::Fstat(const FstatOptions& options, FstatRet* ret) {
                 name.c_str(), s.ToString().c_str());
         }
 
-        mutex_.Lock();
+        part->mu.Lock();
         if (tx != NULL) {
           bool last_ref = tx->Unref();
           if (!last_ref) {
@@ -276,8 +444,12 @@ Status MDS::SRV::Fstat(const FstatOptions& options, FstatRet* ret) {
 // so they always proceed one after another. Write operations
 // should not block any concurrent read operations.
 Status MDS::SRV::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
+  if (read_only_) {
+    return Status::ReadOnly(Slice());
+  }
   Status s;
   Dir::Tx* tx = NULL;
+  uint64_t ticket = 0;
   Dir::Ref* ref;
   const DirId& dir_id = options.dir_id;
   const Slice& name_hash = options.name_hash;
@@ -292,11 +464,12 @@ Status MDS::SRV::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
+    Partition* const part = &parts_[PartitionOf(dir_id)];
+    MutexLock ml(&part->mu);
     s = FetchDir(dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(part->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
       DirLock dl(d);
@@ -304,8 +477,8 @@ Status MDS::SRV::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
       if (s.ok()) {
         int srv_id = d->index.HashToServer(name_hash);
         if (srv_id != srv_id_) {
-          Slice encoding = d->index.Encode();
-          Redirect re(encoding.data(), encoding.size());
+          Redirect re;
+          d->index.EncodeTo(&re);
           throw re;
         }
       }
@@ -313,7 +486,7 @@ Status MDS::SRV::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
         bool entry_exists = false;
         uint64_t my_time = CurrentMicros();
         uint64_t my_ino = NextIno();
-        mutex_.Unlock();
+        part->mu.Unlock();
 
         tx = new Dir::Tx(mdb_);
         tx->Ref();
@@ -371,15 +544,16 @@ Status MDS::SRV::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
           }
 
           if (s.ok()) {
-            s = mdb_->Commit(mdb_tx);
+            s = mdb_->Commit(mdb_tx, &ticket);
           }
         }
 
-        mutex_.Lock();
+        part->mu.Lock();
         if (s.ok() && !entry_exists) {
           d->size = 1 + d->size;
           assert(my_time >= d->mtime);
           d->mtime = my_time;
+          WaitForLease(d, dir_id, name_hash);
         } else {
           TryReuseIno(my_ino);
         }
@@ -400,6 +574,256 @@ Status MDS::SRV::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
   if (tx != NULL) {
     tx->Dispose(mdb_);
   }
+  if (s.ok()) {
+    s = mdb_->WaitForCommit(ticket);  // Sync after releasing all locks
+  }
+  return s;
+}
+
+// Insert a batch of new files into a parent directory using a single db
+// write. Return OK if the batch has been processed, in which case the result
+// of each name is stored in ret->statuses. Per-name errors are the same as
+// those of Fcreat. A redirect is thrown, and no file is created, if any of
+// the names does not belong to the current server.
+//
+// Write operations against the same parent directory must be serialized
+// so they always proceed one after another. Write operations
+// should not block any concurrent read operations.
+Status MDS::SRV::Bcreat(const BcreatOptions& options, BcreatRet* ret) {
+  if (read_only_) {
+    return Status::ReadOnly(Slice());
+  }
+  Status s;
+  Dir::Tx* tx = NULL;
+  uint64_t ticket = 0;
+  Dir::Ref* ref;
+  const DirId& dir_id = options.dir_id;
+  const size_t num_names = options.names.size();
+  ret->statuses.assign(num_names, Status::OK());
+  if (options.name_hashes.size() != num_names) {
+    s = Status::InvalidArgument("names and hashes don't match");
+  } else {
+    for (size_t i = 0; i < num_names; i++) {
+      const Slice& name_hash = options.name_hashes[i];
+      if (name_hash.empty() || options.names[i].empty()) {
+        ret->statuses[i] = Status::InvalidArgument("empty name and hash");
+      } else if (paranoid_checks_) {
+        std::string tmp;
+        DirIndex::PutHash(&tmp, options.names[i]);
+        if (name_hash.compare(tmp) != 0) {
+          ret->statuses[i] =
+              Status::InvalidArgument("name and hash don't match");
+        }
+      }
+    }
+  }
+
+  if (s.ok() && num_names != 0) {
+    Partition* const part = &parts_[PartitionOf(dir_id)];
+    MutexLock ml(&part->mu);
+    s = FetchDir(dir_id, &ref);
+    if (s.ok()) {
+      assert(ref != NULL);
+      Dir::Guard guard(part->dirs, ref);
+      Dir* const d = ref->value;
+      assert(d != NULL);
+      DirLock dl(d);
+      s = ProbeDir(d);
+      if (s.ok()) {
+        // Resolve all names at once, using a dummy hash for rejected names
+        static const char kNoHash[8] = {0};
+        std::vector<Slice> name_hashes(options.name_hashes);
+        for (size_t i = 0; i < num_names; i++) {
+          if (!ret->statuses[i].ok()) name_hashes[i] = Slice(kNoHash, 8);
+        }
+        std::vector<int> srv_ids(num_names);
+        d->index.HashesToServers(&name_hashes[0], num_names, &srv_ids[0]);
+        for (size_t i = 0; i < num_names; i++) {
+          if (!ret->statuses[i].ok()) continue;
+          int srv_id = srv_ids[i];
+          if (srv_id != srv_id_) {
+            Redirect re;
+            d->index.EncodeTo(&re);
+            throw re;
+          }
+        }
+      }
+      if (s.ok()) {
+        uint64_t my_time = CurrentMicros();
+        std::vector<uint64_t> my_inos;
+        for (size_t i = 0; i < num_names; i++) {
+          my_inos.push_back(NextIno());
+        }
+        part->mu.Unlock();
+
+        tx = new Dir::Tx(mdb_);
+        tx->Ref();
+        assert(d->tx.Acquire_Load() == NULL);
+        d->tx.Release_Store(tx);
+        MDB::Tx* mdb_tx = tx->rep();
+
+        std::vector<bool> created(num_names, false);
+        uint64_t num_created = 0;
+        for (size_t i = 0; s.ok() && i < num_names; i++) {
+          if (!ret->statuses[i].ok()) continue;
+          const Slice& name_hash = options.name_hashes[i];
+          Stat stat;
+          std::string name;
+          Status r = mdb_->GetNode(dir_id, name_hash, &stat, &name, mdb_tx);
+          if (r.ok()) {
+            if ((options.flags & O_EXCL) == O_EXCL) {
+              r = Status::AlreadyExists(Slice());
+            } else if (!S_ISREG(stat.FileMode())) {
+              r = Status::FileExpected(Slice());
+            }
+          } else if (r.IsNotFound()) {
+            r = Status::OK();
+            uint32_t mode = S_IFREG | (options.mode & ACCESSPERMS);
+            stat.SetRegId(reg_id_);
+            stat.SetSnapId(snap_id_);
+            stat.SetInodeNo(my_inos[i]);
+            stat.SetFileSize(0);
+            stat.SetFileMode(mode);
+            stat.SetUserId(options.uid);
+            stat.SetGroupId(options.gid);
+            stat.SetZerothServer(0);
+            stat.SetModifyTime(my_time);
+            stat.SetChangeTime(my_time);
+            s = mdb_->SetNode(dir_id, name_hash, stat, options.names[i],
+                              mdb_tx);
+            if (s.ok()) {
+              created[i] = true;
+              num_created++;
+            }
+          } else {
+            s = r;  // Abort the batch on db errors
+          }
+          ret->statuses[i] = r;
+        }
+
+        if (s.ok() && num_created != 0) {
+          DirInfo dir_info;
+          dir_info.mtime = my_time;
+          dir_info.size = num_created + d->size;
+          s = mdb_->SetInfo(dir_id, dir_info, mdb_tx);
+          if (s.ok()) {
+            s = mdb_->Commit(mdb_tx, &ticket);
+          }
+        }
+
+        part->mu.Lock();
+        if (s.ok() && num_created != 0) {
+          d->size = num_created + d->size;
+          assert(my_time >= d->mtime);
+          d->mtime = my_time;
+          for (size_t i = 0; i < num_names; i++) {
+            if (created[i]) {
+              WaitForLease(d, dir_id, options.name_hashes[i]);
+            }
+          }
+        }
+        for (size_t i = num_names; i-- != 0;) {
+          if (!s.ok() || !created[i]) {
+            TryReuseIno(my_inos[i]);
+          }
+        }
+        assert(d->tx.NoBarrier_Load() == tx);
+        d->tx.NoBarrier_Store(NULL);
+        assert(tx != NULL);
+        bool last_ref = tx->Unref();
+        if (!last_ref) {
+          tx = NULL;
+        }
+      }
+    }
+  }
+
+  if (tx != NULL) {
+    tx->Dispose(mdb_);
+  }
+  if (s.ok()) {
+    s = mdb_->WaitForCommit(ticket);  // Sync after releasing all locks
+  }
+  return s;
+}
+
+// Serve a client-side bulk insertion into a parent directory. Inode numbers
+// are reserved for the client when options.dir is empty. Otherwise, the
+// table files written by the client are inserted into the db as a whole,
+// bypassing the memtable and the write-ahead log. The server does not look
+// into the tables, so it is up to the client to only insert names belonging
+// to the current server. Any lease granted under the parent directory is
+// waited past, since the names being inserted are not known.
+//
+// Write operations against the same parent directory must be serialized
+// so they always proceed one after another.
+Status MDS::SRV::Bulkin(const BulkinOptions& options, BulkinRet* ret) {
+  if (read_only_) {
+    return Status::ReadOnly(Slice());
+  }
+  Status s;
+  Dir::Ref* ref;
+  const DirId& dir_id = options.dir_id;
+  ret->first_ino = 0;
+  if (options.dir.empty()) {
+    if (options.num_entries == 0) {
+      return Status::InvalidArgument("no inode numbers to reserve");
+    }
+    Partition* const part = &parts_[PartitionOf(dir_id)];
+    MutexLock ml(&part->mu);
+    s = FetchDir(dir_id, &ref);
+    if (s.ok()) {
+      assert(ref != NULL);
+      Dir::Guard guard(part->dirs, ref);
+      s = ProbeDir(ref->value);
+      if (s.ok()) {
+        ret->first_ino = NextInos(options.num_entries);
+        s = ProbeDir(ref->value);  // Check for allocation errors
+      }
+    }
+    return s;
+  }
+
+  Partition* const part = &parts_[PartitionOf(dir_id)];
+  MutexLock ml(&part->mu);
+  s = FetchDir(dir_id, &ref);
+  if (s.ok()) {
+    assert(ref != NULL);
+    Dir::Guard guard(part->dirs, ref);
+    Dir* const d = ref->value;
+    assert(d != NULL);
+    DirLock dl(d);
+    s = ProbeDir(d);
+    if (s.ok()) {
+      uint64_t my_time = CurrentMicros();
+      part->mu.Unlock();
+      s = mdb_->BulkInsert(options.dir.ToString());
+      if (s.ok()) {
+        DirInfo dir_info;
+        dir_info.mtime = my_time;
+        dir_info.size = options.num_entries + d->size;
+        MDB::Tx* mdb_tx = mdb_->CreateTx();
+        s = mdb_->SetInfo(dir_id, dir_info, mdb_tx);
+        if (s.ok()) {
+          s = mdb_->Commit(mdb_tx);
+        }
+        mdb_->Release(mdb_tx);
+      }
+      part->mu.Lock();
+      if (s.ok()) {
+        d->size = options.num_entries + d->size;
+        assert(my_time >= d->mtime);
+        d->mtime = my_time;
+        d->seq = 1 + d->seq;
+        if (d->num_leases != 0) {
+          part->mu.Unlock();
+          SleepForMicroseconds(lease_duration_ + 10);
+          part->mu.Lock();
+        }
+      }
+    }
+  }
+
   return s;
 }
 
@@ -416,8 +840,12 @@ Status MDS::SRV::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
 // so they always proceed one after another. Write operations
 // should not block any concurrent read operations.
 Status MDS::SRV::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
+  if (read_only_) {
+    return Status::ReadOnly(Slice());
+  }
   Status s;
   Dir::Tx* tx = NULL;
+  uint64_t ticket = 0;
   Dir::Ref* ref;
   const DirId& dir_id = options.dir_id;
   const Slice& name_hash = options.name_hash;
@@ -432,11 +860,12 @@ Status MDS::SRV::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
+    Partition* const part = &parts_[PartitionOf(dir_id)];
+    MutexLock ml(&part->mu);
     s = FetchDir(dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(part->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
       DirLock dl(d);
@@ -444,15 +873,15 @@ Status MDS::SRV::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
       if (s.ok()) {
         int srv_id = d->index.HashToServer(name_hash);
         if (srv_id != srv_id_) {
-          Slice encoding = d->index.Encode();
-          Redirect re(encoding.data(), encoding.size());
+          Redirect re;
+          d->index.EncodeTo(&re);
           throw re;
         }
       }
       if (s.ok()) {
         bool entry_exists = false;
         uint64_t my_time = CurrentMicros();
-        mutex_.Unlock();
+        part->mu.Unlock();
 
         tx = new Dir::Tx(mdb_);
         tx->Ref();
@@ -508,11 +937,11 @@ Status MDS::SRV::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
           }
 
           if (s.ok()) {
-            s = mdb_->Commit(mdb_tx);
+            s = mdb_->Commit(mdb_tx, &ticket);
           }
         }
 
-        mutex_.Lock();
+        part->mu.Lock();
         if (s.ok() && entry_exists) {
           assert(d->size > 1);
           d->size = -1 + d->size;
@@ -536,6 +965,9 @@ Status MDS::SRV::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
   if (tx != NULL) {
     tx->Dispose(mdb_);
   }
+  if (s.ok()) {
+    s = mdb_->WaitForCommit(ticket);  // Sync after releasing all locks
+  }
   return s;
 }
 
@@ -550,9 +982,155 @@ Status MDS::SRV::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
 // Write operations against the same parent directory must be serialized so
 // they always proceed one after another. Write operations should not block any
 // concurrent read operations.
+// Copy the fields common to all ops from a compound op to its base options.
+static void SetupBaseOptions(MDS::BaseOptions* base, const DirId& dir_id,
+                             const MDS::CompoundItem& item,
+                             const MDS::CompoundOptions& options) {
+  base->dir_id = dir_id;
+  base->session_id = options.session_id;
+  base->op_due = options.op_due;
+  base->name_hash = item.name_hash;
+  base->name = item.name;
+}
+
+// Return a stat carrying the fields of a lookup stat. Fields that lookup
+// stats do not keep are zeroed.
+static void LookupStatToStat(const LookupStat& lstat, Stat* stat) {
+#if defined(DELTAFS)
+  stat->SetRegId(lstat.RegId());
+  stat->SetSnapId(lstat.SnapId());
+#endif
+  stat->SetInodeNo(lstat.InodeNo());
+  stat->SetFileSize(0);
+  stat->SetModifyTime(0);
+  stat->SetChangeTime(0);
+  stat->SetFileMode(lstat.DirMode());
+  stat->SetZerothServer(lstat.ZerothServer());
+  stat->SetUserId(lstat.UserId());
+  stat->SetGroupId(lstat.GroupId());
+}
+
+// Each op is executed through its regular implementation and thus locks the
+// partition it operates on separately. Ops whose entries are served by other
+// servers stop the call with TryAgain instead of a redirect, so that the
+// results of all ops before them are still returned.
+Status MDS::SRV::Compound(const CompoundOptions& options, CompoundRet* ret) {
+  ret->statuses.clear();
+  ret->stats.clear();
+  ret->lease_dues.clear();
+  for (size_t i = 0; i < options.items.size(); i++) {
+    const CompoundItem& item = options.items[i];
+    DirId dir_id = item.dir_id;
+    uint64_t lease_due = 0;
+    Status s;
+    Stat stat;
+    if (item.chained) {
+      if (i == 0) {
+        s = Status::InvalidArgument("nothing to chain to");
+      } else {
+        dir_id = DirId(ret->stats[i - 1]);
+      }
+    }
+    if (s.ok()) {
+      try {
+        switch (item.op) {
+          case kFstatOp: {
+            FstatOptions opts;
+            SetupBaseOptions(&opts, dir_id, item, options);
+            FstatRet r;
+            s = Fstat(opts, &r);
+            stat = r.stat;
+            break;
+          }
+          case kFcreatOp: {
+            FcreatOptions opts;
+            SetupBaseOptions(&opts, dir_id, item, options);
+            opts.flags = item.flags;
+            opts.mode = item.mode;
+            opts.uid = item.uid;
+            opts.gid = item.gid;
+            FcreatRet r;
+            s = Fcreat(opts, &r);
+            stat = r.stat;
+            break;
+          }
+          case kMkdirOp: {
+            MkdirOptions opts;
+            SetupBaseOptions(&opts, dir_id, item, options);
+            opts.flags = item.flags;
+            opts.mode = item.mode;
+            opts.uid = item.uid;
+            opts.gid = item.gid;
+            MkdirRet r;
+            s = Mkdir(opts, &r);
+            stat = r.stat;
+            break;
+          }
+          case kChmodOp: {
+            ChmodOptions opts;
+            SetupBaseOptions(&opts, dir_id, item, options);
+            opts.mode = item.mode;
+            ChmodRet r;
+            s = Chmod(opts, &r);
+            stat = r.stat;
+            break;
+          }
+          case kTruncOp: {
+            TruncOptions opts;
+            SetupBaseOptions(&opts, dir_id, item, options);
+            opts.mtime = item.mtime;
+            opts.size = item.size;
+            TruncRet r;
+            s = Trunc(opts, &r);
+            stat = r.stat;
+            break;
+          }
+          case kUnlinkOp: {
+            UnlinkOptions opts;
+            SetupBaseOptions(&opts, dir_id, item, options);
+            opts.flags = item.flags;
+            UnlinkRet r;
+            s = Unlink(opts, &r);
+            stat = r.stat;
+            break;
+          }
+          case kLookupOp: {
+            LookupOptions opts;
+            SetupBaseOptions(&opts, dir_id, item, options);
+            LookupRet r;
+            s = Lookup(opts, &r);
+            if (s.ok()) {
+              LookupStatToStat(r.stat, &stat);
+              lease_due = r.stat.LeaseDue();
+            }
+            break;
+          }
+          default:
+            s = Status::NotSupported(Slice());
+            break;
+        }
+      } catch (Redirect&) {
+        s = Status::TryAgain(Slice());
+      }
+    }
+    ret->statuses.push_back(s);
+    ret->stats.push_back(stat);
+    ret->lease_dues.push_back(lease_due);
+    if (!s.ok()) {
+      break;
+    }
+  }
+
+  return Status::OK();
+}
+
 Status MDS::SRV::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
+  if (read_only_) {
+    return Status::ReadOnly(Slice());
+  }
   Status s;
   Dir::Tx* tx = NULL;
+  uint64_t ticket = 0;
   Dir::Ref* ref;
   const DirId& dir_id = options.dir_id;
   const Slice& name_hash = options.name_hash;
@@ -567,11 +1145,12 @@ Status MDS::SRV::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
+    Partition* const part = &parts_[PartitionOf(dir_id)];
+    MutexLock ml(&part->mu);
     s = FetchDir(dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(part->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
       DirLock dl(d);
@@ -579,8 +1158,8 @@ Status MDS::SRV::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
       if (s.ok()) {
         int srv_id = d->index.HashToServer(name_hash);
         if (srv_id != srv_id_) {
-          Slice encoding = d->index.Encode();
-          Redirect re(encoding.data(), encoding.size());
+          Redirect re;
+          d->index.EncodeTo(&re);
           throw re;
         }
       }
@@ -589,7 +1168,7 @@ Status MDS::SRV::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
         uint64_t my_time = CurrentMicros();
         uint64_t my_ino = NextIno();
         DirId my_id(reg_id_, snap_id_, my_ino);
-        mutex_.Unlock();
+        part->mu.Unlock();
 
         tx = new Dir::Tx(mdb_);
         tx->Ref();
@@ -649,15 +1228,16 @@ Status MDS::SRV::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
           }
 
           if (s.ok()) {
-            s = mdb_->Commit(mdb_tx);
+            s = mdb_->Commit(mdb_tx, &ticket);
           }
         }
 
-        mutex_.Lock();
+        part->mu.Lock();
         if (s.ok() && !entry_exists) {
           d->size = 1 + d->size;
           assert(my_time >= d->mtime);
           d->mtime = my_time;
+          WaitForLease(d, dir_id, name_hash);
         } else {
           TryReuseIno(my_ino);
         }
@@ -678,6 +1258,9 @@ Status MDS::SRV::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
   if (tx != NULL) {
     tx->Dispose(mdb_);
   }
+  if (s.ok()) {
+    s = mdb_->WaitForCommit(ticket);  // Sync after releasing all locks
+  }
   return s;
 }
 
@@ -690,8 +1273,12 @@ Status MDS::SRV::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
 // when the data read from the DB is corrupted, and when other
 // internal or external errors occur...
 Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
+  if (read_only_) {
+    return Status::ReadOnly(Slice());
+  }
   Status s;
   Dir::Tx* tx = NULL;
+  uint64_t ticket = 0;
   Dir::Ref* ref;
   const DirId& dir_id = options.dir_id;
   const Slice& name_hash = options.name_hash;
@@ -706,11 +1293,12 @@ Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
+    Partition* const part = &parts_[PartitionOf(dir_id)];
+    MutexLock ml(&part->mu);
     s = FetchDir(dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(part->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
       DirLock dl(d);
@@ -718,14 +1306,14 @@ Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
       if (s.ok()) {
         int srv_id = d->index.HashToServer(name_hash);
         if (srv_id != srv_id_) {
-          Slice encoding = d->index.Encode();
-          Redirect re(encoding.data(), encoding.size());
+          Redirect re;
+          d->index.EncodeTo(&re);
           throw re;
         }
       }
       if (s.ok()) {
         uint64_t my_time = CurrentMicros();
-        mutex_.Unlock();
+        part->mu.Unlock();
 
         tx = new Dir::Tx(mdb_);
         tx->Ref();
@@ -744,10 +1332,10 @@ Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
         }
 
         if (s.ok()) {
-          s = mdb_->Commit(mdb_tx);
+          s = mdb_->Commit(mdb_tx, &ticket);
         }
 
-        mutex_.Lock();
+        part->mu.Lock();
         assert(d->tx.NoBarrier_Load() == tx);
         d->tx.NoBarrier_Store(NULL);
         assert(tx != NULL);
@@ -765,6 +1353,9 @@ Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
   if (tx != NULL) {
     tx->Dispose(mdb_);
   }
+  if (s.ok()) {
+    s = mdb_->WaitForCommit(ticket);  // Sync after releasing all locks
+  }
   return s;
 }
 
@@ -777,8 +1368,12 @@ Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
 // execute the call, when the data read from DB is corrupted,
 // and when other internal or external error occur...
 Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
+  if (read_only_) {
+    return Status::ReadOnly(Slice());
+  }
   Status s;
   Dir::Tx* tx = NULL;
+  uint64_t ticket = 0;
   Dir::Ref* ref;
   const DirId& dir_id = options.dir_id;
   const Slice& name_hash = options.name_hash;
@@ -793,11 +1388,12 @@ Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
+    Partition* const part = &parts_[PartitionOf(dir_id)];
+    MutexLock ml(&part->mu);
     s = FetchDir(dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(part->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
       DirLock dl(d);
@@ -805,14 +1401,14 @@ Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
       if (s.ok()) {
         int srv_id = d->index.HashToServer(name_hash);
         if (srv_id != srv_id_) {
-          Slice encoding = d->index.Encode();
-          Redirect re(encoding.data(), encoding.size());
+          Redirect re;
+          d->index.EncodeTo(&re);
           throw re;
         }
       }
       if (s.ok()) {
         uint64_t my_time = CurrentMicros();
-        mutex_.Unlock();
+        part->mu.Unlock();
 
         tx = new Dir::Tx(mdb_);
         tx->Ref();
@@ -836,10 +1432,10 @@ Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
         }
 
         if (s.ok()) {
-          s = mdb_->Commit(mdb_tx);
+          s = mdb_->Commit(mdb_tx, &ticket);
         }
 
-        mutex_.Lock();
+        part->mu.Lock();
         assert(d->tx.NoBarrier_Load() == tx);
         d->tx.NoBarrier_Store(NULL);
         assert(tx != NULL);
@@ -857,6 +1453,9 @@ Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
   if (tx != NULL) {
     tx->Dispose(mdb_);
   }
+  if (s.ok()) {
+    s = mdb_->WaitForCommit(ticket);  // Sync after releasing all locks
+  }
   return s;
 }
 
@@ -919,7 +1518,60 @@ Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
 // directory, when the current server is not the right one for the entry,
 // when the data being read from DB is corrupted, and when other internal
 // or external error occurs...
+// Resolve as many components of options.rest as possible without leaving
+// this server. Errors are not reported; the client will look up whatever
+// remains unresolved by itself.
+void MDS::SRV::LookupAhead(const LookupOptions& options, LookupRet* ret) {
+  static const size_t kMaxLookahead = 16;
+  assert(ret->more != NULL);
+  Slice input = options.rest;
+  LookupStat parent = ret->stat;
+  while (!input.empty() && ret->more->size() < kMaxLookahead) {
+    // Clients won't be able to cache entries without a lease
+    if (parent.LeaseDue() == 0 ||
+        DELTAFS_DIR_IS_PLFS_STYLE(parent.DirMode())) {
+      break;
+    }
+    const char* p =
+        static_cast<const char*>(memchr(input.data(), '/', input.size()));
+    Slice name = Slice(input.data(), p != NULL ? p - input.data()
+                                               : input.size());
+    input.remove_prefix(p != NULL ? name.size() + 1 : name.size());
+    if (name.empty() || name == "." || name == "..") {
+      break;
+    }
+    char tmp[20];
+    LookupOptions opts;
+    opts.op_due = options.op_due;
+    opts.session_id = options.session_id;
+    opts.dir_id = DirId(parent);
+    opts.name_hash = DirIndex::Hash(name, tmp);
+    LookupRet r;
+    Status s;
+    try {
+      s = Lookup(opts, &r);
+    } catch (Redirect& re) {
+      break;
+    }
+    if (!s.ok()) {
+      break;
+    }
+    ret->more->push_back(r.stat);
+    parent = r.stat;
+  }
+}
+
 Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
+  if (!options.rest.empty()) {
+    LookupOptions first = options;
+    first.rest = Slice();
+    Status s = Lookup(first, ret);
+    if (s.ok() && ret->more != NULL) {
+      LookupAhead(options, ret);
+    }
+    return s;
+  }
+
   Status s;
   Dir::Tx* tx = NULL;
   Dir::Ref* ref;
@@ -936,26 +1588,27 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
+    Partition* const part = &parts_[PartitionOf(dir_id)];
+    MutexLock ml(&part->mu);
     s = FetchDir(dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(part->dirs, ref);
       const Dir* const d = ref->value;
       assert(d != NULL);
       s = ProbeDir(d);
       if (s.ok()) {
         int srv_id = d->index.HashToServer(name_hash);
         if (srv_id != srv_id_) {
-          Slice encoding = d->index.Encode();
-          Redirect re(encoding.data(), encoding.size());
+          Redirect re;
+          d->index.EncodeTo(&re);
           throw re;
         }
       }
       if (s.ok()) {
         uint64_t my_start = CurrentMicros();
         uint64_t my_seq = d->seq;
-        mutex_.Unlock();
+        part->mu.Unlock();
 
         MDB::Tx* mdb_tx = NULL;
         tx = reinterpret_cast<Dir::Tx*>(d->tx.Acquire_Load());
@@ -980,11 +1633,15 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
           ret->stat.CopyFrom(stat);
         }
 
-        mutex_.Lock();
+        part->mu.Lock();
         uint64_t my_end = CurrentMicros();
-        // No lease either we timeout or have a negative result, otherwise...
-        if (s.ok() && (my_end - my_start) < (lease_duration_ - 10)) {
-          Lease::Ref* lref = leases_->Lookup(dir_id, name_hash);
+        // Negative results are leased only if asked for and no names have
+        // been created in the dir since we started
+        bool ok = s.ok() || (options.negative_lease && s.IsNotFound() &&
+                             d->seq == my_seq);
+        // No lease either we timeout or have an unleased result, otherwise...
+        if (ok && (my_end - my_start) < (lease_duration_ - 10)) {
+          Lease::Ref* lref = part->leases->Lookup(dir_id, name_hash);
           if (lref == NULL) {
             Lease* new_lease = new Lease;
             new_lease->state = kLeaseFree;
@@ -992,7 +1649,7 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
             new_lease->due = 0;
             new_lease->seq = 0;
             try {
-              lref = leases_->Insert(dir_id, name_hash, new_lease);
+              lref = part->leases->Insert(dir_id, name_hash, new_lease);
             } catch (int err) {
               // Not expecting errors other than ENOBUFS
               assert(err == ENOBUFS);
@@ -1008,7 +1665,7 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
           }
           // No lease will be issued if the lease table is full, otherwise...
           if (lref != NULL) {
-            Lease::Guard lguard(leases_, lref);
+            Lease::Guard lguard(part->leases, lref);
             Lease* const lease = lref->value;
             assert(lease != NULL);
             // No lease if the data is possibly stale, otherwise...
@@ -1023,6 +1680,7 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
                 // able to extend the lease nor change its state
               }
               ret->stat.SetLeaseDue(lease->due);
+              part->leases->stats()->grants++;
             }
           }
         }
@@ -1062,8 +1720,12 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
 // data read from db is corrupted or new data would not go into the db,
 // and when other internal or external errors occur...
 Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
+  if (read_only_) {
+    return Status::ReadOnly(Slice());
+  }
   Status s;
   Dir::Tx* tx = NULL;
+  uint64_t ticket = 0;
   Dir::Ref* ref;
   const DirId& dir_id = options.dir_id;
   const Slice& name_hash = options.name_hash;
@@ -1078,11 +1740,12 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
+    Partition* const part = &parts_[PartitionOf(dir_id)];
+    MutexLock ml(&part->mu);
     s = FetchDir(dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(part->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
       DirLock dl(d);
@@ -1090,14 +1753,14 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
       if (s.ok()) {
         int srv_id = d->index.HashToServer(name_hash);
         if (srv_id != srv_id_) {
-          Slice encoding = d->index.Encode();
-          Redirect re(encoding.data(), encoding.size());
+          Redirect re;
+          d->index.EncodeTo(&re);
           throw re;
         }
       }
       if (s.ok()) {
         uint64_t my_start = CurrentMicros();
-        mutex_.Unlock();
+        part->mu.Unlock();
 
         tx = new Dir::Tx(mdb_);
         tx->Ref();
@@ -1143,14 +1806,14 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
         }
 
         if (s.ok()) {
-          s = mdb_->Commit(mdb_tx);
+          s = mdb_->Commit(mdb_tx, &ticket);
         }
 
-        mutex_.Lock();
+        part->mu.Lock();
         uint64_t my_end = CurrentMicros();
         // Wait until lease expiration if the target is a directory
         if (s.ok() && S_ISDIR(stat->FileMode())) {
-          Lease::Ref* lease_ref = leases_->Lookup(dir_id, name_hash);
+          Lease::Ref* lease_ref = part->leases->Lookup(dir_id, name_hash);
           if (lease_ref == NULL) {
             Lease* new_lease = new Lease;
             new_lease->state = kLeaseFree;
@@ -1159,7 +1822,7 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
             new_lease->seq = 0;
             while (lease_ref == NULL) {
               try {
-                lease_ref = leases_->Insert(dir_id, name_hash, new_lease);
+                lease_ref = part->leases->Insert(dir_id, name_hash, new_lease);
               } catch (int err) {
                 // Not expecting errors other than ENOBUFS
                 assert(err == ENOBUFS);
@@ -1170,25 +1833,28 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
                 // TODO: a possible alternative is too force injecting a
                 // lease entry even when the lease table is full
                 lease_ref = NULL;
-                mutex_.Unlock();
+                part->mu.Unlock();
                 SleepForMicroseconds(lease_duration_ + 10);
-                mutex_.Lock();
+                part->mu.Lock();
                 my_end = CurrentMicros();
               }
             }
             d->num_leases++;
           }
           assert(lease_ref != NULL);
-          Lease::Guard lguard(leases_, lease_ref);
+          Lease::Guard lguard(part->leases, lease_ref);
           Lease* const lease = lease_ref->value;
           assert(lease != NULL && lease->state != kLeaseLocked);
+          if (lease->state == kLeaseShared && lease->due > my_end) {
+            part->leases->stats()->waits++;
+          }
           while (lease->state == kLeaseShared && lease->due > my_end) {
             lease->state = kLeaseLocked;
             uint64_t diff = lease->due - my_end + 10;
-            mutex_.Unlock();
+            part->mu.Unlock();
             // Wait past lease due
             SleepForMicroseconds(diff);
-            mutex_.Lock();
+            part->mu.Lock();
             my_end = CurrentMicros();
           }
           assert(lease->parent == d);
@@ -1219,6 +1885,9 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
   if (tx != NULL) {
     tx->Dispose(mdb_);
   }
+  if (s.ok()) {
+    s = mdb_->WaitForCommit(ticket);  // Sync after releasing all locks
+  }
   return s;
 }
 
@@ -1229,25 +1898,37 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
 // Errors are mostly masked so an empty list is returned in worst case.
 Status MDS::SRV::Listdir(const ListdirOptions& options, ListdirRet* ret) {
   static const size_t kSizeLimit = 1000;
-  mdb_->List(options.dir_id, NULL, ret->names, NULL, kSizeLimit);
+  std::vector<Stat>* const stats = options.with_stats ? ret->stats : NULL;
+  size_t n = mdb_->ListFrom(options.dir_id, options.start, stats, ret->names,
+                            NULL, kSizeLimit);
+  ret->truncated = (n >= kSizeLimit);
   return Status::OK();
 }
 
-// Return the index encoding of a parent directory. Return OK on success
+// Return the index encoding of a parent directory. If the caller has sent
+// the index it already knows, only the partitions missing from it are
+// returned. Return OK on success
 Status MDS::SRV::Readidx(const ReadidxOptions& options, ReadidxRet* ret) {
   Status s;
   Dir::Ref* ref;
-  MutexLock ml(&mutex_);
+  DirIndex base(&giga_);
+  const bool has_base = !options.idx.empty() && base.Update(options.idx);
+  Partition* const part = &parts_[PartitionOf(options.dir_id)];
+  MutexLock ml(&part->mu);
   s = FetchDir(options.dir_id, &ref);
   if (s.ok()) {
     assert(ref != NULL);
-    Dir::Guard guard(dirs_, ref);
+    Dir::Guard guard(part->dirs, ref);
     const Dir* const d = ref->value;
     assert(d != NULL);
     s = ProbeDir(d);
     if (s.ok()) {
-      Slice encoding = d->index.Encode();
-      ret->idx.assign(encoding.data(), encoding.size());
+      ret->idx.clear();
+      if (has_base && base.ZerothServer() == d->index.ZerothServer()) {
+        d->index.EncodeDiffTo(base, &ret->idx);
+      } else {
+        d->index.EncodeTo(&ret->idx);
+      }
     }
   }
 
@@ -1264,9 +1945,7 @@ Status MDS::SRV::Opensession(const OpensessionOptions&, OpensessionRet* ret) {
   ret->env_conf = mds_env_->env_conf;
   ret->fio_name = mds_env_->fio_name;
   ret->fio_conf = mds_env_->fio_conf;
-  mutex_.Lock();
   ret->session_id = NextSession();
-  mutex_.Unlock();
   return s;
 }
 
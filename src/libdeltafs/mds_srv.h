@@ -28,6 +28,8 @@ class MDS::SRV : public MDS {
 
   DEC_OP(Fstat)
   DEC_OP(Fcreat)
+  DEC_OP(Bcreat)
+  DEC_OP(Bulkin)
   DEC_OP(Mkdir)
   DEC_OP(Chmod)
   DEC_OP(Chown)
@@ -35,6 +37,7 @@ class MDS::SRV : public MDS {
   DEC_OP(Utime)
   DEC_OP(Trunc)
   DEC_OP(Unlink)
+  DEC_OP(Compound)
   DEC_OP(Lookup)
   DEC_OP(Listdir)
   DEC_OP(Readidx)
@@ -44,10 +47,19 @@ class MDS::SRV : public MDS {
 
 #undef DEC_OP
 
+  // Report the progress of preloading directories at server start.
+  void GetWarmupProgress(uint64_t* loaded, uint64_t* total);
+
  private:
   Status LoadDir(const DirId& id, DirInfo* info, DirIndex* index);
   Status FetchDir(const DirId& id, Dir::Ref** ref);
   Status ProbeDir(const Dir* dir);
+  void LookupAhead(const LookupOptions& options, LookupRet* ret);
+  void WaitForLease(Dir* dir, const DirId& dir_id, const Slice& name_hash);
+  void StartWarmup(int num_threads);
+  void StopWarmup();
+  void SaveWarmupList();
+  static void RunWarmup(void*);
 
   // Constant after construction
   MDSEnv* mds_env_;
@@ -56,21 +68,50 @@ class MDS::SRV : public MDS {
   GIGA giga_;
   bool paranoid_checks_;
   uint64_t lease_duration_;
+  uint64_t ino_batch_size_;
+  size_t warmup_dirs_;
+  bool read_only_;
   uint64_t snap_id_;
   uint64_t reg_id_;
   int srv_id_;
 
-  // State below is protected by mutex_
-  port::Mutex mutex_;
-  LeaseTable* leases_;
-  HashSet loading_dirs_;  // A set of dirs being loaded into a memory cache
-  port::CondVar loading_cv_;
-  DirTable* dirs_;
+  // Directory states and leases are split into a fixed number of partitions
+  // by directory id. Each partition has its own mutex protecting the states
+  // of its directories and the leases issued below them, so operations on
+  // different directories rarely contend with each other.
+  struct Partition {
+    Partition() : loading_cv(&mu) {}
+    // State below is protected by mu
+    port::Mutex mu;
+    LeaseTable* leases;
+    HashSet loading_dirs;  // A set of dirs being loaded into a memory cache
+    port::CondVar loading_cv;
+    DirTable* dirs;
+  };
+  enum { kNumPartitions = 16 };
+  static size_t PartitionOf(const DirId& id) { return id.ino % kNumPartitions; }
+  Partition parts_[kNumPartitions];
+
+  // State below is protected by warmup_mu_
+  port::Mutex warmup_mu_;
+  port::CondVar warmup_cv_;
+  ThreadPool* warmup_pool_;
+  std::vector<DirId> warmup_list_;  // Directories to preload
+  size_t warmup_next_;  // Index of the next directory to preload
+  uint64_t warmup_loaded_;  // Number of directories preloaded
+  uint64_t warmup_start_;
+  int warmup_running_;  // Number of threads preloading directories
+  bool warmup_cancelled_;
+
+  // State below is protected by alloc_mu_
+  port::Mutex alloc_mu_;
   uint32_t NextSession();
   uint32_t session_;  // The last session id we allocated
   void TryReuseIno(uint64_t ino);
   uint64_t NextIno();
+  uint64_t NextInos(uint64_t n);
   uint64_t ino_;  // The last ino num we allocated
+  uint64_t ino_mark_;  // Inode numbers up to this one have been reserved
   Status status_;
 
   friend class MDS;
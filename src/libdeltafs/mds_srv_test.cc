@@ -11,8 +11,10 @@
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <set>
 
 #include "mds_srv.h"
 #include "pdlfs-common/testharness.h"
@@ -23,32 +25,79 @@ namespace pdlfs {
 class ServerTest {
  private:
   std::string dbname_;
+  DBOptions dbopts_;
   MDSEnv mds_env_;
   MDS* mds_;
   MDB* mdb_;
   DB* db_;
+  MDB* replica_mdb_;
+  DB* replica_db_;
 
  public:
   ServerTest() {
     Env* env = Env::Default();
     dbname_ = test::PrepareTmpDir("mds_srv_test", env);
-    DBOptions dbopts;
-    dbopts.env = env;
-    DestroyDB(dbname_, dbopts);
-    dbopts.create_if_missing = true;
-    ASSERT_OK(DB::Open(dbopts, dbname_, &db_));
+    dbopts_.env = env;
+    DestroyDB(dbname_, dbopts_);
+    dbopts_.create_if_missing = true;
+    dbopts_.prefix_extractor = MDBPrefixExtractor();
+    ASSERT_OK(DB::Open(dbopts_, dbname_, &db_));
     MDBOptions mdbopts;
     mdbopts.db = db_;
     mdb_ = new MDB(mdbopts);
     mds_env_.env = env;
+    replica_mdb_ = NULL;
+    replica_db_ = NULL;
+    mds_ = NULL;
+    Reopen();
+  }
+
+  // Replace the server with a read-only replica following the same db
+  void OpenReplica() {
+    FlushOptions flush_options;
+    flush_options.wait = true;
+    ASSERT_OK(db_->FlushMemTable(flush_options));
+    ASSERT_OK(ReadonlyDB::Open(dbopts_, dbname_, &replica_db_));
+    MDBOptions mdbopts;
+    mdbopts.db = replica_db_;
+    replica_mdb_ = new MDB(mdbopts);
+    delete mds_;
+    MDSOptions mdsopts;
+    mdsopts.mds_env = &mds_env_;
+    mdsopts.mdb = replica_mdb_;
+    mdsopts.read_only = true;
+    mds_ = MDS::Open(mdsopts);
+  }
+
+  // Restart the server on top of the same db
+  void Reopen(size_t warmup_dirs = 0, int num_virtual_servers = 1) {
+    delete mds_;
     MDSOptions mdsopts;
     mdsopts.mds_env = &mds_env_;
     mdsopts.mdb = mdb_;
+    mdsopts.ino_batch_size = 2;
+    mdsopts.warmup_dirs = warmup_dirs;
+    mdsopts.num_virtual_servers = num_virtual_servers;
     mds_ = MDS::Open(mdsopts);
   }
 
+  // Wait for the server to finish preloading directories. Return the number
+  // of directories preloaded.
+  uint64_t WaitForWarmup() {
+    MDS::SRV* const srv = static_cast<MDS::SRV*>(mds_);
+    uint64_t loaded, total;
+    srv->GetWarmupProgress(&loaded, &total);
+    while (loaded != total) {
+      SleepForMicroseconds(1000);
+      srv->GetWarmupProgress(&loaded, &total);
+    }
+    return loaded;
+  }
+
   ~ServerTest() {
     delete mds_;
+    delete replica_mdb_;
+    delete replica_db_;
     delete mdb_;
     delete db_;
   }
@@ -77,6 +126,71 @@ class ServerTest {
     }
   }
 
+  // Read the index of a directory into *idx.
+  Status ReadIndex(int dir_ino, DirIndex* idx) {
+    MDS::ReadidxOptions options;
+    options.dir_id = DirId(0, 0, dir_ino);
+    MDS::ReadidxRet ret;
+    Status s = mds_->Readidx(options, &ret);
+    if (s.ok() && !idx->Update(ret.idx)) {
+      s = Status::Corruption("bad index");
+    }
+    return s;
+  }
+
+  // Reserve inode numbers for a client-side bulk insertion. Return the first
+  // one, or "-err_code" on errors.
+  int ReserveInos(int dir_ino, int num_inos) {
+    MDS::BulkinOptions options;
+    options.dir_id = DirId(0, 0, dir_ino);
+    options.num_entries = num_inos;
+    MDS::BulkinRet ret;
+    Status s = mds_->Bulkin(options, &ret);
+    if (s.ok()) {
+      return static_cast<int>(ret.first_ino);
+    } else {
+      return -1 * s.err_code();
+    }
+  }
+
+  // Load files directly into the db bypassing the server, or have the server
+  // ingest them if "ingest" is true. Use a tiny buffer so that entries are
+  // spread across several table files.
+  void BulkLoad(int dir_ino, int first_nod_no, int num_nods, int first_ino,
+                bool ingest = false) {
+    const std::string dir =
+        test::PrepareTmpDir("mds_srv_test_bulk", dbopts_.env);
+    MDBLoader loader(dbopts_, dir, 256);
+    for (int i = 0; i < num_nods; i++) {
+      std::string name = NodeName(first_nod_no + i);
+      std::string name_hash;
+      DirIndex::PutHash(&name_hash, name);
+      Stat stat;
+      stat.SetRegId(0);
+      stat.SetSnapId(0);
+      stat.SetInodeNo(first_ino + i);
+      stat.SetFileSize(0);
+      stat.SetFileMode(S_IFREG | ACCESSPERMS);
+      stat.SetUserId(0);
+      stat.SetGroupId(0);
+      stat.SetZerothServer(0);
+      stat.SetModifyTime(0);
+      stat.SetChangeTime(0);
+      ASSERT_OK(loader.Add(DirId(0, 0, dir_ino), name_hash, stat, name));
+    }
+    ASSERT_OK(loader.Finish());
+    if (ingest) {
+      MDS::BulkinOptions options;
+      options.dir_id = DirId(0, 0, dir_ino);
+      options.dir = dir;
+      options.num_entries = num_nods;
+      MDS::BulkinRet ret;
+      ASSERT_OK(mds_->Bulkin(options, &ret));
+    } else {
+      ASSERT_OK(mdb_->BulkInsert(dir));
+    }
+  }
+
   // Return the ino of the newly created file, or "-err_code" on errors.
   int Mknod(int dir_ino, int nod_no) {
     MDS::FcreatOptions options;
@@ -99,6 +213,39 @@ class ServerTest {
     }
   }
 
+  // Return the error code of each node, or "-err_code" on batch errors.
+  int Mknods(int dir_ino, int first_nod_no, int num_nods,
+             std::vector<int>* errs) {
+    MDS::BcreatOptions options;
+    options.dir_id = DirId(0, 0, dir_ino);
+    options.flags = O_EXCL;
+    options.mode = ACCESSPERMS;
+    options.uid = 0;
+    options.gid = 0;
+    std::vector<std::string> names;
+    std::vector<std::string> name_hashes;
+    for (int i = 0; i < num_nods; i++) {
+      names.push_back(NodeName(first_nod_no + i));
+      name_hashes.push_back(std::string());
+      DirIndex::PutHash(&name_hashes.back(), names.back());
+    }
+    for (int i = 0; i < num_nods; i++) {
+      options.names.push_back(names[i]);
+      options.name_hashes.push_back(name_hashes[i]);
+    }
+    MDS::BcreatRet ret;
+    Status s = mds_->Bcreat(options, &ret);
+    if (s.ok()) {
+      errs->clear();
+      for (size_t i = 0; i < ret.statuses.size(); i++) {
+        errs->push_back(ret.statuses[i].err_code());
+      }
+      return 0;
+    } else {
+      return -1 * s.err_code();
+    }
+  }
+
   int Mkdir(int dir_ino, int nod_no) {
     MDS::MkdirOptions options;
     options.dir_id = DirId(0, 0, dir_ino);
@@ -120,6 +267,127 @@ class ServerTest {
     }
   }
 
+  // Append an op to a compound call. Name hashes are kept in *hashes, which
+  // must not be modified until the call is done.
+  static void AddItem(MDS::CompoundOptions* options, unsigned char op,
+                      int dir_ino, int nod_no, bool chained,
+                      std::vector<std::string>* hashes) {
+    MDS::CompoundItem item;
+    item.op = op;
+    item.chained = chained;
+    item.dir_id = DirId(0, 0, dir_ino);
+    item.mode = ACCESSPERMS;
+    hashes->push_back(NodeName(nod_no));
+    hashes->push_back(std::string());
+    DirIndex::PutHash(&hashes->back(), (*hashes)[hashes->size() - 2]);
+    options->items.push_back(item);
+  }
+
+  // Run a compound call through the RPC adaptors.
+  Status Compound(MDS::CompoundOptions* options,
+                  const std::vector<std::string>& hashes,
+                  MDS::CompoundRet* ret) {
+    for (size_t i = 0; i < options->items.size(); i++) {
+      options->items[i].name = hashes[2 * i];
+      options->items[i].name_hash = hashes[2 * i + 1];
+    }
+    MDS::RPC::SRV srv(mds_);
+    MDS::RPC::CLI cli(&srv);
+    return cli.Compound(*options, ret);
+  }
+
+  // Return the ino of the dir being searched, or "-err_code" on errors.
+  // The inos of the dirs further resolved from "rest" are stored in *more.
+  int Lookup(int dir_ino, int nod_no, const std::string& rest,
+             std::vector<int>* more) {
+    MDS::LookupOptions options;
+    options.dir_id = DirId(0, 0, dir_ino);
+    std::string name = NodeName(nod_no);
+    options.name = name;
+    std::string name_hash;
+    DirIndex::PutHash(&name_hash, name);
+    options.name_hash = name_hash;
+    options.rest = rest;
+    std::vector<LookupStat> stats;
+    MDS::LookupRet ret;
+    ret.more = &stats;
+    Status s = mds_->Lookup(options, &ret);
+    if (s.ok()) {
+      more->clear();
+      for (size_t i = 0; i < stats.size(); i++) {
+        more->push_back(static_cast<int>(stats[i].InodeNo()));
+      }
+      return static_cast<int>(ret.stat.InodeNo());
+    } else {
+      return -1 * s.err_code();
+    }
+  }
+
+  // Look up a missing dir asking for a negative lease. Return the due of the
+  // lease granted, or 0 if the dir exists or no lease is granted.
+  uint64_t NegativeLookup(int dir_ino, int nod_no) {
+    MDS::LookupOptions options;
+    options.dir_id = DirId(0, 0, dir_ino);
+    std::string name = NodeName(nod_no);
+    options.name = name;
+    std::string name_hash;
+    DirIndex::PutHash(&name_hash, name);
+    options.name_hash = name_hash;
+    options.negative_lease = 1;
+    MDS::LookupRet ret;
+    Status s = mds_->Lookup(options, &ret);
+    if (s.IsNotFound()) {
+      return ret.stat.LeaseDue();
+    } else {
+      return 0;
+    }
+  }
+
+  // Return the number of entries listed, or "-err_code" on errors.
+  int Listdir(int dir_ino, const std::string& start,
+              std::vector<std::string>* names, std::vector<Stat>* stats) {
+    MDS::ListdirOptions options;
+    options.dir_id = DirId(0, 0, dir_ino);
+    options.start = start;
+    options.with_stats = (stats != NULL);
+    MDS::ListdirRet ret;
+    ret.names = names;
+    ret.stats = stats;
+    Status s = mds_->Listdir(options, &ret);
+    if (s.ok()) {
+      return names->size();
+    } else {
+      return -1 * s.err_code();
+    }
+  }
+
+  // List a dir through the RPC adaptors, resuming truncated listings.
+  // Return the number of entries listed, or "-err_code" on errors.
+  int RPCListdir(int dir_ino, CompressionType compression,
+                 bool compressed_replies, std::vector<std::string>* names,
+                 std::vector<Stat>* stats) {
+    MDS::RPC::SRV srv(mds_, compression, 0);
+    MDS::RPC::CLI cli(&srv, compressed_replies);
+    MDS::ListdirOptions options;
+    options.dir_id = DirId(0, 0, dir_ino);
+    options.with_stats = 1;
+    std::string start;
+    for (;;) {
+      options.start = start;
+      MDS::ListdirRet ret;
+      ret.names = names;
+      ret.stats = stats;
+      Status s = cli.Listdir(options, &ret);
+      if (!s.ok()) {
+        return -1 * s.err_code();
+      } else if (!ret.truncated || names->empty()) {
+        return names->size();
+      }
+      start.clear();
+      DirIndex::PutHash(&start, names->back());
+    }
+  }
+
   int Listdir(int dir_ino) {
     MDS::ListdirOptions options;
     options.dir_id = DirId(0, 0, dir_ino);
@@ -150,6 +418,166 @@ TEST(ServerTest, Files) {
   ASSERT_TRUE(r4 == -1 * Status::kAlreadyExists);
 }
 
+TEST(ServerTest, BulkLoad) {
+  int r1 = Mknod(0, 1);
+  ASSERT_TRUE(r1 > 0);
+  BulkLoad(0, 1, 50, 1000);  // Node 1 is overwritten
+  for (int i = 0; i < 50; i++) {
+    ASSERT_EQ(Fstat(0, i + 1), 1000 + i);
+  }
+  BulkLoad(0, 2, 1, 2000);  // Later loads take precedence
+  ASSERT_EQ(Fstat(0, 2), 2000);
+  int r2 = Mknod(0, 3);
+  ASSERT_TRUE(r2 == -1 * Status::kAlreadyExists);
+}
+
+TEST(ServerTest, BulkIngest) {
+  int r1 = Mknod(0, 1);
+  ASSERT_TRUE(r1 > 0);
+  int i1 = ReserveInos(0, 100);
+  ASSERT_EQ(i1, r1 + 1);
+  int r2 = Mknod(0, 2);
+  ASSERT_EQ(r2, i1 + 100);  // Reserved inode numbers are skipped
+  BulkLoad(0, 3, 100, i1, true);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(Fstat(0, i + 3), i1 + i);
+  }
+  ASSERT_EQ(Fstat(0, 1), r1);
+  ASSERT_EQ(Listdir(0), 102);
+  ASSERT_EQ(Mknod(0, 50), -1 * Status::kAlreadyExists);
+  Reopen();
+  ASSERT_EQ(Fstat(0, 50), i1 + 47);
+  ASSERT_TRUE(ReserveInos(0, 10) > r2);
+  ASSERT_EQ(ReserveInos(0, 0), -1 * Status::kInvalidArgument);
+}
+
+TEST(ServerTest, Replica) {
+  int r1 = Mknod(0, 1);
+  ASSERT_TRUE(r1 > 0);
+  OpenReplica();
+  ASSERT_EQ(Fstat(0, 1), r1);
+  ASSERT_EQ(Fstat(0, 2), -1 * Status::kNotFound);
+  ASSERT_EQ(Listdir(0), 1);
+  ASSERT_EQ(Mknod(0, 2), -1 * Status::kReadOnly);
+  ASSERT_EQ(Mkdir(0, 3), -1 * Status::kReadOnly);
+}
+
+TEST(ServerTest, Compound) {
+  MDS::CompoundOptions options;
+  options.session_id = 0;
+  options.op_due = DELTAFS_MAX_MICROS;
+  std::vector<std::string> hashes;
+  AddItem(&options, MDS::kMkdirOp, 0, 1, false, &hashes);
+  AddItem(&options, MDS::kMkdirOp, 0, 2, true, &hashes);
+  AddItem(&options, MDS::kFcreatOp, 0, 3, true, &hashes);
+  AddItem(&options, MDS::kFstatOp, 0, 4, false, &hashes);
+  AddItem(&options, MDS::kMkdirOp, 0, 5, false, &hashes);
+  MDS::CompoundRet ret;
+  ASSERT_OK(Compound(&options, hashes, &ret));
+  // The call stops at the first failed op
+  ASSERT_EQ(ret.statuses.size(), 4);
+  ASSERT_OK(ret.statuses[0]);
+  ASSERT_OK(ret.statuses[1]);
+  ASSERT_OK(ret.statuses[2]);
+  ASSERT_TRUE(ret.statuses[3].IsNotFound());
+  int d1 = ret.stats[0].InodeNo();
+  ASSERT_EQ(Fstat(0, 1), d1);
+  int d2 = ret.stats[1].InodeNo();
+  ASSERT_EQ(Fstat(d1, 2), d2);
+  ASSERT_EQ(Fstat(d2, 3), ret.stats[2].InodeNo());
+  ASSERT_TRUE(Fstat(0, 5) == -1 * Status::kNotFound);
+}
+
+TEST(ServerTest, CompoundLookups) {
+  int d1 = Mkdir(0, 1);
+  ASSERT_TRUE(d1 > 0);
+  int d2 = Mkdir(d1, 2);
+  ASSERT_TRUE(d2 > 0);
+  ASSERT_TRUE(Mknod(0, 3) > 0);
+  MDS::CompoundOptions options;
+  options.session_id = 0;
+  options.op_due = DELTAFS_MAX_MICROS;
+  std::vector<std::string> hashes;
+  AddItem(&options, MDS::kLookupOp, 0, 1, false, &hashes);
+  AddItem(&options, MDS::kLookupOp, 0, 2, true, &hashes);
+  AddItem(&options, MDS::kLookupOp, 0, 3, false, &hashes);
+  MDS::CompoundRet ret;
+  uint64_t start = CurrentMicros();
+  ASSERT_OK(Compound(&options, hashes, &ret));
+  ASSERT_EQ(ret.statuses.size(), 3);
+  ASSERT_EQ(ret.lease_dues.size(), 3);
+  ASSERT_OK(ret.statuses[0]);
+  ASSERT_EQ(int(ret.stats[0].InodeNo()), d1);
+  ASSERT_TRUE(S_ISDIR(ret.stats[0].FileMode()));
+  ASSERT_TRUE(ret.lease_dues[0] > start);
+  ASSERT_OK(ret.statuses[1]);
+  ASSERT_EQ(int(ret.stats[1].InodeNo()), d2);
+  ASSERT_TRUE(ret.lease_dues[1] > start);
+  // Only directories are leased
+  ASSERT_TRUE(ret.statuses[2].IsDirExpected());
+}
+
+TEST(ServerTest, Warmup) {
+  Reopen(16);
+  int d1 = Mkdir(0, 1);
+  ASSERT_TRUE(d1 > 0);
+  int d2 = Mkdir(d1, 2);
+  ASSERT_TRUE(d2 > 0);
+  ASSERT_TRUE(Mknod(d2, 3) > 0);
+  Reopen(16);
+  ASSERT_EQ(WaitForWarmup(), 3);  // Root, d1, and d2
+  ASSERT_TRUE(Fstat(d2, 3) > 0);
+}
+
+TEST(ServerTest, InoRanges) {
+  int r1 = Mknod(0, 1);
+  ASSERT_TRUE(r1 > 0);
+  int r2 = Mknod(0, 2);
+  ASSERT_EQ(r2, r1 + 1);
+  int r3 = Mknod(0, 3);  // Starts a new range
+  ASSERT_EQ(r3, r2 + 1);
+  Reopen();
+  // Inode numbers reserved before the restart are never reused
+  int r4 = Mknod(0, 4);
+  ASSERT_TRUE(r4 > r3 + 1);
+}
+
+// Clients build directory indices locally, which requires servers to always
+// pre-split directories to all partitions.
+TEST(ServerTest, PresplitIndices) {
+  const int kVirtualServers = 8;
+  Reopen(0, kVirtualServers);
+  DirIndexOptions giga;
+  giga.num_servers = 1;
+  giga.num_virtual_servers = kVirtualServers;
+  for (int i = 1; i <= 4; i++) {
+    int d = Mkdir(0, i);
+    ASSERT_TRUE(d > 0);
+    DirIndex idx(&giga);
+    ASSERT_OK(ReadIndex(d, &idx));
+    DirIndex expected(idx.ZerothServer(), &giga);
+    expected.SetAll();
+    ASSERT_EQ(idx.Encode().ToString(), expected.Encode().ToString());
+  }
+}
+
+TEST(ServerTest, BatchFiles) {
+  int r1 = Mknod(0, 3);
+  ASSERT_TRUE(r1 > 0);
+  std::vector<int> errs;
+  ASSERT_EQ(Mknods(0, 1, 5, &errs), 0);
+  ASSERT_EQ(errs.size(), 5);
+  for (int i = 0; i < 5; i++) {
+    if (i + 1 == 3) {
+      ASSERT_EQ(errs[i], Status::kAlreadyExists);
+    } else {
+      ASSERT_EQ(errs[i], 0);
+      ASSERT_TRUE(Fstat(0, i + 1) > 0);
+    }
+  }
+  ASSERT_EQ(Listdir(0), 5);
+}
+
 TEST(ServerTest, Dirs) {
   int r1 = Fstat(0, 1);
   ASSERT_TRUE(r1 == -1 * Status::kNotFound);
@@ -161,6 +589,37 @@ TEST(ServerTest, Dirs) {
   ASSERT_TRUE(r4 == -1 * Status::kAlreadyExists);
 }
 
+TEST(ServerTest, LookupAhead) {
+  int d1 = Mkdir(0, 1);
+  ASSERT_TRUE(d1 > 0);
+  int d2 = Mkdir(d1, 2);
+  ASSERT_TRUE(d2 > 0);
+  int d3 = Mkdir(d2, 3);
+  ASSERT_TRUE(d3 > 0);
+  std::vector<int> more;
+  ASSERT_EQ(Lookup(0, 1, "", &more), d1);
+  ASSERT_TRUE(more.empty());
+  ASSERT_EQ(Lookup(0, 1, "node2/node3", &more), d1);
+  ASSERT_EQ(more.size(), 2);
+  ASSERT_EQ(more[0], d2);
+  ASSERT_EQ(more[1], d3);
+  // Stop at the first component that cannot be resolved
+  ASSERT_EQ(Lookup(0, 1, "node2/node4/node3", &more), d1);
+  ASSERT_EQ(more.size(), 1);
+  ASSERT_EQ(more[0], d2);
+  ASSERT_EQ(Lookup(0, 1, "node2/../node2", &more), d1);
+  ASSERT_EQ(more.size(), 1);
+}
+
+TEST(ServerTest, NegativeLeases) {
+  uint64_t due = NegativeLookup(0, 1);
+  ASSERT_TRUE(due != 0);
+  // Creation must wait until the negative lease expires
+  ASSERT_TRUE(Mkdir(0, 1) > 0);
+  ASSERT_TRUE(CurrentMicros() >= due);
+  ASSERT_EQ(NegativeLookup(0, 1), 0);
+}
+
 TEST(ServerTest, Scan) {
   Mknod(0, 1);
   Mknod(0, 2);
@@ -175,6 +634,54 @@ TEST(ServerTest, Scan) {
   ASSERT_TRUE(r == 9);
 }
 
+TEST(ServerTest, ScanWithStats) {
+  for (int i = 1; i <= 5; i++) {
+    ASSERT_TRUE(Mknod(0, i) > 0);
+  }
+  std::vector<std::string> names;
+  std::vector<Stat> stats;
+  ASSERT_EQ(Listdir(0, "", &names, &stats), 5);
+  ASSERT_EQ(stats.size(), 5);
+  for (size_t i = 0; i < names.size(); i++) {
+    ASSERT_TRUE(S_ISREG(stats[i].FileMode()));
+    ASSERT_EQ(static_cast<int>(stats[i].InodeNo()),
+              Fstat(0, atoi(names[i].c_str() + 4)));
+  }
+  // Resume after the second entry
+  std::string start;
+  DirIndex::PutHash(&start, names[1]);
+  std::vector<std::string> rest;
+  ASSERT_EQ(Listdir(0, start, &rest, NULL), 3);
+  for (size_t i = 0; i < rest.size(); i++) {
+    ASSERT_EQ(rest[i], names[i + 2]);
+  }
+}
+
+TEST(ServerTest, CompressedListings) {
+  const int n = 300;
+  for (int i = 1; i <= n; i++) {
+    ASSERT_TRUE(Mknod(0, i) > 0);
+  }
+  const CompressionType types[] = {kNoCompression, kSnappyCompression,
+                                    kLz4Compression};
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    for (int compressed_replies = 0; compressed_replies < 2;
+         compressed_replies++) {
+      std::vector<std::string> names;
+      std::vector<Stat> stats;
+      ASSERT_EQ(RPCListdir(0, types[i], compressed_replies != 0, &names,
+                           &stats),
+                n);
+      ASSERT_EQ(stats.size(), names.size());
+      std::set<std::string> uniq(names.begin(), names.end());
+      ASSERT_EQ(uniq.size(), names.size());
+      for (size_t j = 0; j < stats.size(); j++) {
+        ASSERT_TRUE(S_ISREG(stats[j].FileMode()));
+      }
+    }
+  }
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char* argv[]) {
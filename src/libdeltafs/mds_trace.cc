@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "mds_trace.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/crc32c.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace pdlfs {
+
+const char kMDSTraceMagic[] = "deltafs-mdstrace-v1";
+
+void MDSTraceRecord::EncodeTo(char* dst) const {
+  EncodeFixed64(dst, micros);
+  EncodeFixed64(dst + 8, path_hash);
+  EncodeFixed32(dst + 16, latency_micros);
+  EncodeFixed32(dst + 20, server);
+  dst[24] = static_cast<char>(op);
+  dst[25] = static_cast<char>(redirected);
+  dst[26] = static_cast<char>(status);
+  dst[27] = 0;
+  EncodeFixed32(dst + 28, crc32c::Mask(crc32c::Value(dst, 28)));
+}
+
+bool MDSTraceRecord::DecodeFrom(const Slice& input) {
+  if (input.size() < kEncodedLength) return false;
+  const char* p = input.data();
+  if (crc32c::Unmask(DecodeFixed32(p + 28)) != crc32c::Value(p, 28)) {
+    return false;
+  }
+  micros = DecodeFixed64(p);
+  path_hash = DecodeFixed64(p + 8);
+  latency_micros = DecodeFixed32(p + 16);
+  server = DecodeFixed32(p + 20);
+  op = static_cast<unsigned char>(p[24]);
+  redirected = static_cast<unsigned char>(p[25]);
+  status = static_cast<unsigned char>(p[26]);
+  return true;
+}
+
+MDSTraceLog::MDSTraceLog(Env* env, const std::string& fname,
+                         uint32_t sample_every, const std::string& op_names,
+                         size_t max_records)
+    : env_(env),
+      fname_(fname),
+      sample_every_(sample_every != 0 ? sample_every : 1),
+      op_names_(op_names),
+      max_records_(max_records != 0 ? max_records : 1),
+      file_(NULL),
+      cv_(&mu_),
+      head_(0),
+      tail_(0),
+      dropped_(0),
+      shutting_down_(false),
+      bg_running_(false) {
+  ring_ = new char[max_records_ * MDSTraceRecord::kEncodedLength];
+}
+
+MDSTraceLog::~MDSTraceLog() {
+  {
+    MutexLock ml(&mu_);
+    shutting_down_ = true;
+    cv_.SignalAll();
+    while (bg_running_) {
+      cv_.Wait();
+    }
+  }
+  if (file_ != NULL) {
+    file_->Close();
+    delete file_;
+  }
+  delete[] ring_;
+}
+
+Status MDSTraceLog::Open() {
+  Status s = env_->NewWritableFile(fname_.c_str(), &file_);
+  if (s.ok()) {
+    std::string header = kMDSTraceMagic;
+    header += "\n" + op_names_ + "\n";
+    s = file_->Append(header);
+  }
+  if (s.ok()) {
+    MutexLock ml(&mu_);
+    bg_running_ = true;
+    env_->StartThread(BGWork, this);
+  }
+  return s;
+}
+
+bool MDSTraceLog::ShouldSample() {
+  // Concurrent callers may occasionally both or neither sample a call, which
+  // is fine for tracing
+  num_calls_.Add();
+  return num_calls_.Value() % sample_every_ == 0;
+}
+
+void MDSTraceLog::Add(const MDSTraceRecord& record) {
+  MutexLock ml(&mu_);
+  if (tail_ - head_ >= max_records_) {
+    dropped_++;
+    return;
+  }
+  record.EncodeTo(ring_ + (tail_ % max_records_) *
+                              MDSTraceRecord::kEncodedLength);
+  tail_++;
+  // Wake up the writer once the buffer is half full
+  if (tail_ - head_ == (max_records_ + 1) / 2) {
+    cv_.SignalAll();
+  }
+}
+
+uint64_t MDSTraceLog::NumDropped() const {
+  MutexLock ml(&mu_);
+  return dropped_;
+}
+
+void MDSTraceLog::BGWork(void* arg) {
+  reinterpret_cast<MDSTraceLog*>(arg)->BGLoop();
+}
+
+void MDSTraceLog::BGLoop() {
+  MutexLock ml(&mu_);
+  while (!shutting_down_) {
+    const uint64_t seconds = 1;
+    cv_.TimedWait(seconds * 1000 * 1000);
+    WritePending();
+  }
+  WritePending();
+  bg_running_ = false;
+  cv_.SignalAll();
+}
+
+// Write out all buffered records. Records stay in the ring buffer while they
+// are being written since only this thread advances head_.
+// REQUIRES: mu_ has been locked.
+void MDSTraceLog::WritePending() {
+  mu_.AssertHeld();
+  while (head_ != tail_) {
+    const size_t start = head_ % max_records_;
+    const size_t n = static_cast<size_t>(
+        std::min<uint64_t>(tail_ - head_, max_records_ - start));
+    const size_t len = MDSTraceRecord::kEncodedLength;
+    mu_.Unlock();
+    Status s = file_->Append(Slice(ring_ + start * len, n * len));
+    if (s.ok()) {
+      s = file_->Flush();
+    }
+    mu_.Lock();
+    head_ += n;  // Records are discarded on errors
+  }
+}
+
+}  // namespace pdlfs
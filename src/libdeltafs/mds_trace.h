@@ -0,0 +1,96 @@
+#pragma once
+
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/metrics.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/status.h"
+
+#include <string>
+
+namespace pdlfs {
+
+// A sampled metadata call. Records are written to trace files as fixed-sized
+// binary entries behind a short text header, so traces can be decoded
+// without knowing the set of ops of the writer. The header consists of two
+// lines: kMDSTraceMagic, followed by the names of all ops in op code order,
+// separated by ','.
+struct MDSTraceRecord {
+  uint64_t micros;          // Time the call started
+  uint64_t path_hash;       // Hash of the parent directory and the name
+  uint32_t latency_micros;  // Time the call took
+  uint32_t server;          // Index of the server that received the call
+  unsigned char op;         // Index into the op names of the file header
+  unsigned char redirected;  // 1 if the call was redirected elsewhere
+  unsigned char status;      // Status::err_code() of the call
+
+  enum { kEncodedLength = 32 };
+  void EncodeTo(char* dst) const;
+  // Return false if the input is not a valid record.
+  bool DecodeFrom(const Slice& input);
+};
+
+extern const char kMDSTraceMagic[];
+
+// A per-process log of sampled metadata calls. Callers add records to an
+// in-memory ring buffer and a background thread writes them out, so tracing
+// never blocks on I/O. Records added while the ring buffer is full are
+// dropped and counted. Implementation is thread-safe.
+class MDSTraceLog {
+ public:
+  // Sample one of every "sample_every" calls. "op_names" lists the names of
+  // all op codes and is written to the file header.
+  MDSTraceLog(Env* env, const std::string& fname, uint32_t sample_every,
+              const std::string& op_names, size_t max_records = 16 << 10);
+  // Write out all buffered records and stop the background thread.
+  ~MDSTraceLog();
+
+  // Create the trace file and start the background thread.
+  Status Open();
+
+  // Return true if the next call should be recorded.
+  bool ShouldSample();
+
+  void Add(const MDSTraceRecord& record);
+
+  // Total number of records dropped due to a full buffer.
+  uint64_t NumDropped() const;
+
+ private:
+  static void BGWork(void* arg);
+  void BGLoop();
+  void WritePending();
+
+  Env* const env_;
+  const std::string fname_;
+  const uint32_t sample_every_;
+  const std::string op_names_;
+  const size_t max_records_;
+  MetricsCounter num_calls_;
+  WritableFile* file_;
+  mutable port::Mutex mu_;
+  port::CondVar cv_;
+  // State below is protected by mu_
+  char* ring_;
+  uint64_t head_;  // Total records written out
+  uint64_t tail_;  // Total records added
+  uint64_t dropped_;
+  bool shutting_down_;
+  bool bg_running_;
+
+  // No copying allowed
+  void operator=(const MDSTraceLog&);
+  MDSTraceLog(const MDSTraceLog&);
+};
+
+}  // namespace pdlfs
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/random.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+// Helpers shared by the plfsdir benchmarking programs.
+namespace pdlfs {
+namespace plfsio {
+
+// Per-op latencies of a benchmark phase.
+class BenchLatency {
+ public:
+  BenchLatency() : max_(0) { hist_.Clear(); }
+
+  void Add(uint64_t micros) {
+    hist_.Add(static_cast<double>(micros));
+    max_ = std::max(max_, micros);
+  }
+
+  double Count() const { return hist_.Count(); }
+
+  // Append latencies as a JSON object.
+  void AppendJson(std::string* dst) const {
+    char tmp[200];
+    snprintf(tmp, sizeof(tmp),
+             "{\"avg\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,"
+             "\"p999\":%.3f,\"max\":%llu}",
+             hist_.Average(), hist_.Percentile(50), hist_.Percentile(90),
+             hist_.Percentile(99), hist_.Percentile(99.9),
+             static_cast<unsigned long long>(max_));
+    dst->append(tmp);
+  }
+
+ private:
+  Histogram hist_;
+  uint64_t max_;
+};
+
+// Generate zipfian ranks in [0,n) using the method of Gray et al.,
+// "Quickly Generating Billion-Record Synthetic Databases", SIGMOD 1994.
+// Rank 0 is the most popular. REQUIRES: 0 < theta < 1.
+class ZipfGenerator {
+ public:
+  ZipfGenerator(uint32_t n, double theta, uint32_t seed)
+      : n_(n), theta_(theta), rnd_(seed) {
+    alpha_ = 1.0 / (1.0 - theta_);
+    zetan_ = Zeta(n_, theta_);
+    const double zeta2 = Zeta(2, theta_);
+    eta_ = (1.0 - pow(2.0 / n_, 1.0 - theta_)) / (1.0 - zeta2 / zetan_);
+  }
+
+  uint32_t Next() {
+    const double u = rnd_.Next() / 2147483647.0;
+    const double uz = u * zetan_;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + pow(0.5, theta_)) return std::min(1u, n_ - 1);
+    const uint32_t r =
+        static_cast<uint32_t>(n_ * pow(eta_ * u - eta_ + 1.0, alpha_));
+    return std::min(r, n_ - 1);
+  }
+
+ private:
+  static double Zeta(uint32_t n, double theta) {
+    double sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      sum += 1.0 / pow(i + 1.0, theta);
+    }
+    return sum;
+  }
+
+  uint32_t n_;
+  double theta_;
+  double alpha_;
+  double zetan_;
+  double eta_;
+  Random rnd_;
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
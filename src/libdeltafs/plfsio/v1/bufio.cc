@@ -47,6 +47,40 @@ Status DirectWriter::Append(const Slice& dat) {
   return __Add<DirectWriter>(dat, Slice(), false);
 }
 
+// Insert a series of data pieces into the writer. Small pieces are buffered
+// as usual. Large ones bypass the write buffer after all buffered data has
+// been written.
+// REQUIRES: Finish() has NOT been called.
+Status DirectWriter::AppendV(const Slice* data, size_t n) {
+  MutexLock ml(&mu_);
+  size_t total = 0;
+  for (size_t i = 0; i < n; i++) total += data[i].size();
+  Status status;
+  if (total < buf_threshold_) {
+    for (size_t i = 0; i < n && status.ok(); i++) {
+      status = __Add<DirectWriter>(data[i], Slice(), false);
+    }
+    return status;
+  }
+
+  // Write out buffered data first so that data stays in order
+  status = __Flush<DirectWriter>(true);
+  if (status.ok()) {
+    status = __Wait();
+  }
+  if (status.ok()) {  // No outstanding compactions, so dst_ is ours
+    assert(dst_);
+    status = dst_->AppendV(data, n);
+    if (status.ok()) {
+      status = dst_->Flush();
+    }
+    if (!status.ok()) {
+      bg_status_ = status;
+    }
+  }
+  return status;
+}
+
 // Force a compaction but do not wait for the compaction to clear.
 // REQUIRES: Finish() has NOT been called.
 Status DirectWriter::Flush() {
@@ -146,5 +180,11 @@ Status DirectReader::Read(uint64_t off, size_t n, Slice* result,
   return src_->Read(off, n, result, scratch);
 }
 
+// Directly read data from the source into a series of buffers.
+Status DirectReader::ReadV(uint64_t off, char* const* bufs, const size_t* sizes,
+                           size_t n, size_t* result) const {
+  return src_->ReadV(off, bufs, sizes, n, result);
+}
+
 }  // namespace plfsio
 }  // namespace pdlfs
@@ -36,6 +36,12 @@ class DirectWriter : public DoubleBuffering {
   // REQUIRES: Finish() has NOT been called.
   // Insert data into the writer.
   Status Append(const Slice& data);
+  // REQUIRES: Finish() has NOT been called.
+  // Insert data[0..n-1] into the writer as a single piece of data. Pieces
+  // that together are no smaller than the write buffer are written directly
+  // to the destination file through a single vectored write and are not
+  // copied into the write buffer. Such writes therefore do not deadlock.
+  Status AppendV(const Slice* data, size_t n);
   // Wait until there is no outstanding compactions.
   Status Wait();
   // Force a compaction.
@@ -86,6 +92,10 @@ class DirectReader {
  public:
   DirectReader(const DirOptions& options, RandomAccessFile* src);
   Status Read(uint64_t offset, size_t n, Slice* result, char* scratch) const;
+  // Read into bufs[0..n-1] through a single vectored read. Set *result to
+  // the total number of bytes read.
+  Status ReadV(uint64_t offset, char* const* bufs, const size_t* sizes,
+               size_t n, size_t* result) const;
 
  private:
   const DirOptions& options_;
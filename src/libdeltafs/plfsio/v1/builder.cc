@@ -10,9 +10,17 @@
  */
 
 #include "builder.h"
+#include "cuckoo.h"
+#include "ectidx.h"
 #include "recov.h"
 
+#include "pdlfs-common/crc32c.h"
+#include "pdlfs-common/mutexlock.h"
+
 #include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
 
 namespace pdlfs {
 namespace plfsio {
@@ -42,6 +50,12 @@ DirBuilder::DirBuilder(const DirOptions& options, DirOutputStats* stats)
 
 DirBuilder::~DirBuilder() {}
 
+DirSpaceStats* DirBuilder::epoch_space_stats() {
+  std::vector<DirSpaceStats>* const epochs = &compac_stats_->epochs;
+  if (epochs->size() <= num_eps_) epochs->resize(num_eps_ + 1);
+  return &epochs->at(num_eps_);
+}
+
 void ArrayBlockBuilder::Add(const Slice& key, const Slice& value) {
   assert(key.size() == key_size_);
   buffer_.append(key.data(), key.size());
@@ -113,24 +127,81 @@ class ArrayBlock::Iter : public Iterator {
   const uint32_t limit_;
   const uint32_t value_size_;
   const uint32_t key_size_;
+  const bool interpolation_;
   // Offset in data_ of current entry.  >= limit_ if !Valid
   uint32_t current_;
 
   Status status_;
 
+  // Max number of interpolated probes before falling back to binary search.
+  enum { kMaxInterpolationProbes = 4 };
+
+  // Return the leading key bytes as an integer, zero-padded if the key is
+  // shorter than 8 bytes.
+  static inline uint64_t KeyPrefix(const Slice& k) {
+    if (k.size() >= 8) return DecodeBigEndian64(k.data());
+    char tmp[8] = {0};
+    memcpy(tmp, k.data(), k.size());
+    return DecodeBigEndian64(tmp);
+  }
+
   inline int Compare(const Slice& a, const Slice& b) const {
     assert(comparator_ == BytewiseComparator());
-    return a.compare(b);
+    return BytewiseCompare()(a, b);
+  }
+
+  inline Slice KeyAt(uint32_t i) const {
+    return Slice(data_ + i * (key_size_ + value_size_), key_size_);
+  }
+
+  // Locate the first entry whose key is >= target using interpolation
+  // search. Probe positions are estimated from the leading key bytes of the
+  // current search range. If keys are not uniformly distributed and
+  // interpolation fails to converge we fall back to bisection.
+  // REQUIRES: num_entries > 0.
+  uint32_t InterpolationSearch(const Slice& target,
+                               uint32_t num_entries) const {
+    uint32_t left = 0;
+    uint32_t right = num_entries - 1;
+    if (Compare(KeyAt(left), target) >= 0) {
+      return left;
+    } else if (Compare(KeyAt(right), target) < 0) {
+      return num_entries;
+    }
+    // Invariant: key[left] < target <= key[right]
+    const uint64_t t = KeyPrefix(target);
+    int probes = 0;
+    while (right - left > 1) {
+      uint32_t mid = left + (right - left) / 2;
+      if (probes < kMaxInterpolationProbes) {
+        const uint64_t lo = KeyPrefix(KeyAt(left));
+        const uint64_t hi = KeyPrefix(KeyAt(right));
+        if (hi > lo && t >= lo) {
+          const double frac = double(t - lo) / double(hi - lo);
+          mid = left + static_cast<uint32_t>(frac * (right - left));
+          if (mid <= left) mid = left + 1;
+          if (mid >= right) mid = right - 1;
+        }
+        probes++;
+      }
+      if (Compare(KeyAt(mid), target) < 0) {
+        left = mid;
+      } else {
+        right = mid;
+      }
+    }
+    return right;
   }
 
  public:
   Iter(const Comparator* comparator, const char* data, uint32_t limit,
-       uint32_t value_size, uint32_t key_size)
+       uint32_t value_size, uint32_t key_size, bool interpolation)
       : comparator_(comparator),
         data_(data),
         limit_(limit),
         value_size_(value_size),
         key_size_(key_size),
+        interpolation_(interpolation),
         current_(limit) {
     assert(limit_ % (key_size_ + value_size_) == 0);
   }
@@ -165,6 +236,15 @@ class ArrayBlock::Iter : public Iterator {
 
   virtual void SeekToFirst() { current_ = 0; }
 
+  void SeekToEntry(uint32_t i) {
+    const uint32_t entry_size = key_size_ + value_size_;
+    if (i < limit_ / entry_size) {
+      current_ = i * entry_size;
+    } else {
+      current_ = limit_;
+    }
+  }
+
   virtual void SeekToLast() {
     if (limit_ >= key_size_ + value_size_) {
       current_ = limit_ - key_size_ - value_size_;
@@ -174,11 +254,14 @@ class ArrayBlock::Iter : public Iterator {
   }
 
   // If comparator_ is not NULL, keys are considered ordered and we use binary
-  // search to find the target. Otherwise, linear search is used.
+  // or interpolation search to find the target. Otherwise, linear search is
+  // used.
   virtual void Seek(const Slice& target) {
     const uint32_t entry_size = key_size_ + value_size_;
     uint32_t num_entries = limit_ / entry_size;
-    if (comparator_ != NULL && num_entries != 0) {
+    if (comparator_ != NULL && num_entries != 0 && interpolation_) {
+      current_ = InterpolationSearch(target, num_entries) * entry_size;
+    } else if (comparator_ != NULL && num_entries != 0) {
       uint32_t left = 0;
       uint32_t right = num_entries - 1;
       while (left < right) {
@@ -209,16 +292,645 @@ class ArrayBlock::Iter : public Iterator {
   }
 };
 
+bool ArrayBlock::SeekToEntry(Iterator* iter, uint32_t i) {
+  Iter* const it = dynamic_cast<Iter*>(iter);
+  if (it == NULL) {
+    return false;
+  }
+  it->SeekToEntry(i);
+  return true;
+}
+
 // Return an iterator to the block contents. The result should be deleted when
 // no longer needed.
-Iterator* ArrayBlock::NewIterator(const Comparator* comparator) {
+Iterator* ArrayBlock::NewIterator(const Comparator* comparator,
+                                  bool interpolation) {
   if (size_ < 2 * sizeof(uint32_t)) {
     return NewErrorIterator(
         Status::Corruption("Cannot understand block contents"));
   } else if (limit_ != 0) {
-    return new Iter(comparator, data_, limit_, value_size_, key_size_);
+    return new Iter(comparator, data_, limit_, value_size_, key_size_,
+                    interpolation);
+  } else {
+    return NewEmptyIterator();
+  }
+}
+
+namespace {
+// Top bit of the trailing key size of a columnar block
+const uint32_t kColumnarBlockFlag = 0x80000000u;
+// Size of the fixed part of a columnar block trailer: number of columns,
+// column width, value size, and key size
+const size_t kColumnarTrailerSize = 4 * sizeof(uint32_t);
+
+// Load w bytes (w <= 8) as a little-endian integer.
+inline uint64_t LoadLittleEndian(const char* p, size_t w) {
+  const unsigned char* const u = reinterpret_cast<const unsigned char*>(p);
+  uint64_t r = 0;
+  for (size_t i = 0; i < w; i++) r |= static_cast<uint64_t>(u[i]) << (8 * i);
+  return r;
+}
+
+inline void StoreLittleEndian(char* p, size_t w, uint64_t v) {
+  for (size_t i = 0; i < w; i++) p[i] = static_cast<char>(v >> (8 * i));
+}
+
+void CleanupArrayBlock(void* arg1, void* arg2) {
+  delete reinterpret_cast<ArrayBlock*>(arg1);
+}
+}  // namespace
+
+ColumnarBlockBuilder::ColumnarBlockBuilder(const DirOptions& options)
+    : AbstractBlockBuilder(BytewiseComparator()),
+      value_size_(options.value_size),
+      key_size_(options.key_size),
+      column_width_(options.value_column_width),
+      num_columns_(0),
+      encoding_(options.column_encoding),
+      n_(0) {
+  if (IsKeyUnOrdered(options.mode)) {
+    cmp_ = NULL;
+  }
+  if (column_width_ == 0 || column_width_ > value_size_) {
+    column_width_ = value_size_;
+  }
+  if (column_width_ != 0) {
+    num_columns_ = (value_size_ + column_width_ - 1) / column_width_;
+  }
+}
+
+void ColumnarBlockBuilder::Add(const Slice& key, const Slice& value) {
+  assert(key.size() == key_size_);
+  buffer_.append(key.data(), key.size());
+  assert(value.size() == value_size_);
+  values_.append(value.data(), value.size());
+  ++n_;
+}
+
+void ColumnarBlockBuilder::Reset() {
+  AbstractBlockBuilder::Reset();
+  values_.clear();
+  n_ = 0;
+}
+
+Slice ColumnarBlockBuilder::Finish(CompressionType compression,
+                                   bool force_compression) {
+  assert(!finished_);
+  std::string encodings;
+  for (size_t c = 0; c < num_columns_; c++) {
+    const size_t off = c * column_width_;
+    const size_t w = std::min(column_width_, value_size_ - off);
+    char enc = static_cast<char>(encoding_);
+    if (encoding_ == kCeDelta && w > 8) {
+      enc = static_cast<char>(kCeXor);  // Too wide for integer deltas
+    }
+    encodings.push_back(enc);
+    const size_t start = buffer_.size();
+    buffer_.resize(start + n_ * w);
+    char* const dst = &buffer_[start];
+    const char* src = values_.data() + off;
+    const char* prev = NULL;
+    for (size_t i = 0; i < n_; i++, src += value_size_) {
+      char* const p = dst + i * w;
+      if (prev == NULL || enc == kCeNone) {
+        memcpy(p, src, w);
+      } else if (enc == kCeXor) {
+        for (size_t j = 0; j < w; j++) p[j] = src[j] ^ prev[j];
+      } else {
+        StoreLittleEndian(
+            p, w, LoadLittleEndian(src, w) - LoadLittleEndian(prev, w));
+      }
+      prev = src;
+    }
+  }
+  buffer_.append(encodings);
+  // Remember column layout and key value sizes for later retrieval
+  PutFixed32(&buffer_, num_columns_);
+  PutFixed32(&buffer_, column_width_);
+  PutFixed32(&buffer_, value_size_);
+  PutFixed32(&buffer_, key_size_ | kColumnarBlockFlag);
+  return AbstractBlockBuilder::Finish(compression, force_compression);
+}
+
+size_t ColumnarBlockBuilder::CurrentSizeEstimate() const {
+  size_t result = buffer_.size() - buffer_start_;
+  if (!finished_) {
+    return result + values_.size() + num_columns_ + kColumnarTrailerSize;
+  } else {
+    return result;
+  }
+}
+
+ColumnarBlock::ColumnarBlock(const BlockContents& contents)
+    : data_(contents.data.data()),
+      size_(contents.data.size()),
+      owned_(contents.heap_allocated),
+      value_size_(0),
+      key_size_(0),
+      column_width_(0),
+      num_columns_(0),
+      num_entries_(0),
+      encodings_(NULL) {
+  if (!Match(contents.data)) {
+    size_ = 0;  // Error marker
+  } else {
+    const char* const trailer = data_ + size_ - kColumnarTrailerSize;
+    num_columns_ = DecodeFixed32(trailer);
+    column_width_ = DecodeFixed32(trailer + 4);
+    value_size_ = DecodeFixed32(trailer + 8);
+    key_size_ = DecodeFixed32(trailer + 12) & ~kColumnarBlockFlag;
+    const size_t limit = size_ - kColumnarTrailerSize;
+    const size_t entry_size = size_t(key_size_) + value_size_;
+    if (key_size_ == 0 || num_columns_ > limit ||
+        (value_size_ != 0 &&
+         (column_width_ == 0 ||
+          num_columns_ != (value_size_ + column_width_ - 1) / column_width_)) ||
+        (limit - num_columns_) % entry_size != 0) {
+      size_ = 0;
+    } else {
+      encodings_ = data_ + limit - num_columns_;
+      num_entries_ =
+          static_cast<uint32_t>((limit - num_columns_) / entry_size);
+    }
+  }
+}
+
+ColumnarBlock::~ColumnarBlock() {
+  if (owned_) {
+    delete[] data_;
+  }
+}
+
+bool ColumnarBlock::Match(const Slice& contents) {
+  return contents.size() >= kColumnarTrailerSize &&
+         (DecodeFixed32(contents.data() + contents.size() - sizeof(uint32_t)) &
+          kColumnarBlockFlag) != 0;
+}
+
+void ColumnarBlock::DecodeColumn(size_t col, size_t from, size_t to,
+                                 char* dst, size_t entry_size) const {
+  const size_t off = col * column_width_;
+  const size_t w = std::min(size_t(column_width_), value_size_ - off);
+  const char* src = data_ + size_t(num_entries_) * key_size_ +
+                    size_t(num_entries_) * off;  // Columns before are full
+  const char enc = encodings_[col];
+  std::string acc;  // Running xor of all column values so far
+  if (enc == kCeXor) acc.resize(w, 0);
+  uint64_t sum = 0;  // Running sum of all column deltas so far
+  char tmp[8];
+  for (size_t i = 0; i < num_entries_; i++, src += w, dst += entry_size) {
+    if (enc == kCeXor) {
+      for (size_t j = 0; j < w; j++) acc[j] ^= src[j];
+      memcpy(dst, acc.data() + from, to - from);
+    } else if (enc == kCeDelta && w <= 8) {
+      sum += LoadLittleEndian(src, w);
+      StoreLittleEndian(tmp, w, sum);
+      memcpy(dst, tmp + from, to - from);
+    } else {
+      memcpy(dst, src + from, to - from);
+    }
+  }
+}
+
+// Values are decoded into a temporary array block with the same key order so
+// that lookups and seeks work as they do for ArrayBlock.
+Iterator* ColumnarBlock::NewIterator(const Comparator* comparator,
+                                     bool interpolation, size_t value_offset,
+                                     size_t value_length) {
+  if (size_ == 0) {
+    return NewErrorIterator(
+        Status::Corruption("Cannot understand block contents"));
+  } else if (num_entries_ == 0) {
+    return NewEmptyIterator();
+  }
+  if (value_length == 0) {
+    value_offset = 0;
+    value_length = value_size_;
+  }
+  value_offset = std::min(value_offset, size_t(value_size_));
+  value_length = std::min(value_length, value_size_ - value_offset);
+  const size_t entry_size = key_size_ + value_length;
+  const size_t n = num_entries_ * entry_size + 2 * sizeof(uint32_t);
+  char* const buf = new char[n];
+  for (size_t i = 0; i < num_entries_; i++) {
+    memcpy(buf + i * entry_size, data_ + i * key_size_, key_size_);
+  }
+  const size_t limit = value_offset + value_length;
+  for (size_t c = 0; c < num_columns_; c++) {
+    const size_t start = c * column_width_;
+    const size_t end = std::min(start + column_width_, size_t(value_size_));
+    if (end <= value_offset || start >= limit) {
+      continue;  // Column not projected
+    }
+    const size_t from = std::max(start, value_offset);
+    const size_t to = std::min(end, limit);
+    DecodeColumn(c, from - start, to - start,
+                 buf + key_size_ + (from - value_offset), entry_size);
+  }
+  EncodeFixed32(buf + n - 2 * sizeof(uint32_t),
+                static_cast<uint32_t>(value_length));
+  EncodeFixed32(buf + n - sizeof(uint32_t), key_size_);
+  BlockContents contents;
+  contents.data = Slice(buf, n);
+  contents.heap_allocated = true;
+  contents.cachable = false;
+  ArrayBlock* const array_block = new ArrayBlock(contents);
+  Iterator* const iter = array_block->NewIterator(comparator, interpolation);
+  iter->RegisterCleanup(CleanupArrayBlock, array_block, NULL);
+  return iter;
+}
+
+namespace {
+// Set in the restart count of blocks built by GroupVarintBlockBuilder.
+const uint32_t kGroupVarintBlockFlag = 0x80000000U;
+const int kGroupVarintRestartInterval = 16;
+
+inline uint32_t GroupVarintWidth(uint32_t v) {
+  return 1 + (v > 0xFFU) + (v > 0xFFFFU) + (v > 0xFFFFFFU);
+}
+
+// Append three lengths as a group varint: a tag byte with the byte width of
+// each length, followed by the lengths using exactly that many bytes each.
+void PutGroupVarint(std::string* dst, uint32_t a, uint32_t b, uint32_t c) {
+  char buf[1 + 3 * sizeof(uint32_t)];
+  const uint32_t na = GroupVarintWidth(a);
+  const uint32_t nb = GroupVarintWidth(b);
+  const uint32_t nc = GroupVarintWidth(c);
+  buf[0] = static_cast<char>((na - 1) | ((nb - 1) << 2) | ((nc - 1) << 4));
+  // Each write may spill zero bytes into the next slot, which are then
+  // overwritten by the next length
+  char* p = buf + 1;
+  EncodeFixed32(p, a);
+  p += na;
+  EncodeFixed32(p, b);
+  p += nb;
+  EncodeFixed32(p, c);
+  p += nc;
+  dst->append(buf, p - buf);
+}
+
+const uint32_t kGroupVarintMasks[4] = {0xFFU, 0xFFFFU, 0xFFFFFFU,
+                                       0xFFFFFFFFU};
+
+inline uint32_t DecodeGroupVarintSlow(const char* p, uint32_t n) {
+  uint32_t result = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    result |= uint32_t(static_cast<unsigned char>(p[i])) << (8 * i);
+  }
+  return result;
+}
+
+// Decode three lengths encoded by PutGroupVarint() starting at "p" without
+// reading past "limit". Return a pointer just past the decoded lengths, or
+// NULL on errors. Whenever at least 12 bytes follow the tag byte, lengths are
+// decoded by three masked 32-bit loads regardless of their widths.
+inline const char* DecodeGroupVarint(const char* p, const char* limit,
+                                     uint32_t* a, uint32_t* b, uint32_t* c) {
+  if (p >= limit) return NULL;
+  const uint32_t tag = static_cast<unsigned char>(*p++);
+  const uint32_t na = (tag & 3) + 1;
+  const uint32_t nb = ((tag >> 2) & 3) + 1;
+  const uint32_t nc = ((tag >> 4) & 3) + 1;
+  if (limit - p >= static_cast<ptrdiff_t>(3 * sizeof(uint32_t))) {
+    *a = DecodeFixed32(p) & kGroupVarintMasks[na - 1];
+    p += na;
+    *b = DecodeFixed32(p) & kGroupVarintMasks[nb - 1];
+    p += nb;
+    *c = DecodeFixed32(p) & kGroupVarintMasks[nc - 1];
+    p += nc;
+  } else if (limit - p >= static_cast<ptrdiff_t>(na + nb + nc)) {
+    *a = DecodeGroupVarintSlow(p, na);
+    p += na;
+    *b = DecodeGroupVarintSlow(p, nb);
+    p += nb;
+    *c = DecodeGroupVarintSlow(p, nc);
+    p += nc;
   } else {
+    return NULL;
+  }
+  return p;
+}
+
+// Decode the next block entry starting at "p". Return a pointer to the key
+// delta, or NULL on errors.
+inline const char* DecodeGroupVarintEntry(const char* p, const char* limit,
+                                          uint32_t* shared,
+                                          uint32_t* non_shared,
+                                          uint32_t* value_length) {
+  p = DecodeGroupVarint(p, limit, shared, non_shared, value_length);
+  if (p == NULL) return NULL;
+  if (static_cast<uint64_t>(limit - p) <
+      uint64_t(*non_shared) + uint64_t(*value_length)) {
+    return NULL;
+  }
+  return p;
+}
+
+}  // namespace
+
+GroupVarintBlockBuilder::GroupVarintBlockBuilder(const DirOptions& options)
+    : AbstractBlockBuilder(BytewiseComparator()), counter_(0) {
+  if (IsKeyUnOrdered(options.mode)) {
+    cmp_ = NULL;
+  }
+  restarts_.push_back(0);  // First restart point is at offset 0
+}
+
+void GroupVarintBlockBuilder::Add(const Slice& key, const Slice& value) {
+  Slice last_key_piece(last_key_);
+  assert(!finished_);
+  assert(counter_ <= kGroupVarintRestartInterval);
+  assert(cmp_ == NULL || empty() || cmp_->Compare(key, last_key_piece) >= 0);
+  size_t shared = 0;
+  if (counter_ < kGroupVarintRestartInterval) {
+    // See how much sharing to do with previous string
+    const size_t min_length = std::min(last_key_piece.size(), key.size());
+    while ((shared < min_length) && (last_key_piece[shared] == key[shared])) {
+      shared++;
+    }
+  } else {
+    // Restart compression
+    restarts_.push_back(static_cast<uint32_t>(buffer_.size() - buffer_start_));
+    counter_ = 0;
+  }
+  const size_t non_shared = key.size() - shared;
+  PutGroupVarint(&buffer_, static_cast<uint32_t>(shared),
+                 static_cast<uint32_t>(non_shared),
+                 static_cast<uint32_t>(value.size()));
+  buffer_.append(key.data() + shared, non_shared);
+  buffer_.append(value.data(), value.size());
+
+  last_key_.resize(shared);
+  last_key_.append(key.data() + shared, non_shared);
+  counter_++;
+}
+
+void GroupVarintBlockBuilder::Reset() {
+  AbstractBlockBuilder::Reset();
+  last_key_.clear();
+  restarts_.clear();
+  restarts_.push_back(0);  // First restart point is at offset 0
+  counter_ = 0;
+}
+
+Slice GroupVarintBlockBuilder::Finish(CompressionType compression,
+                                      bool force_compression) {
+  assert(!finished_);
+  // Append restart array
+  for (size_t i = 0; i < restarts_.size(); i++) {
+    PutFixed32(&buffer_, restarts_[i]);
+  }
+  PutFixed32(&buffer_, static_cast<uint32_t>(restarts_.size()) |
+                           kGroupVarintBlockFlag);
+  return AbstractBlockBuilder::Finish(compression, force_compression);
+}
+
+size_t GroupVarintBlockBuilder::CurrentSizeEstimate() const {
+  size_t result = buffer_.size() - buffer_start_;
+  if (!finished_) {
+    // Plus restart array contents and its length
+    return result + restarts_.size() * sizeof(uint32_t) + sizeof(uint32_t);
+  } else {
+    return result;
+  }
+}
+
+bool GroupVarintBlock::Match(const Slice& contents) {
+  if (contents.size() < sizeof(uint32_t)) return false;
+  const uint32_t n =
+      DecodeFixed32(contents.data() + contents.size() - sizeof(uint32_t));
+  return (n & kGroupVarintBlockFlag) != 0;
+}
+
+GroupVarintBlock::GroupVarintBlock(const BlockContents& contents)
+    : data_(contents.data.data()),
+      size_(contents.data.size()),
+      owned_(contents.heap_allocated),
+      restart_offset_(0),
+      num_restarts_(0) {
+  if (size_ < sizeof(uint32_t)) {
+    size_ = 0;  // Error marker
+  } else {
+    const uint32_t n = DecodeFixed32(data_ + size_ - sizeof(uint32_t));
+    num_restarts_ = n & ~kGroupVarintBlockFlag;
+    size_t max_restarts_allowed = (size_ - sizeof(uint32_t)) / sizeof(uint32_t);
+    if ((n & kGroupVarintBlockFlag) == 0 ||
+        num_restarts_ > max_restarts_allowed) {
+      size_ = 0;  // Not a group varint block, or too small for num_restarts_
+    } else {
+      restart_offset_ = static_cast<uint32_t>(
+          size_ - (1 + num_restarts_) * sizeof(uint32_t));
+    }
+  }
+}
+
+GroupVarintBlock::~GroupVarintBlock() {
+  if (owned_) {
+    delete[] data_;
+  }
+}
+
+// Same iteration logic as that of the LevelDB's block iterator,
+// except that entry lengths are decoded as group varints.
+template <typename Cmp>
+class GroupVarintBlock::Iter : public Iterator {
+ private:
+  const Cmp cmp_;
+  const bool ordered_;           // False if keys are not ordered
+  const char* const data_;       // Underlying block contents
+  uint32_t const restarts_;      // Offset of restart array (list of fixed32)
+  uint32_t const num_restarts_;  // Number of uint32_t entries in restart array
+
+  // current_ is offset in data_ of current entry.  >= restarts_ if !Valid
+  uint32_t current_;
+  uint32_t restart_index_;  // Index of restart block in which current_ falls
+  std::string key_;
+  Slice value_;
+  Status status_;
+
+  int Compare(const Slice& a, const Slice& b) const { return cmp_(a, b); }
+
+  // Return the offset in data_ just past the end of the current entry.
+  uint32_t NextEntryOffset() const {
+    return static_cast<uint32_t>((value_.data() + value_.size()) - data_);
+  }
+
+  uint32_t GetRestartPoint(uint32_t index) const {
+    assert(index < num_restarts_);
+    return DecodeFixed32(data_ + restarts_ + index * sizeof(uint32_t));
+  }
+
+  void SeekToRestartPoint(uint32_t index) {
+    key_.clear();
+    restart_index_ = index;
+    // current_ will be fixed by ParseNextKey();
+    // ParseNextKey() starts at the end of value_, so set value_ accordingly
+    uint32_t offset = GetRestartPoint(index);
+    value_ = Slice(data_ + offset, 0);
+  }
+
+  void CorruptionError() {
+    current_ = restarts_;
+    restart_index_ = num_restarts_;
+    status_ = Status::Corruption("Bad entry in block");
+    key_.clear();
+    value_.clear();
+  }
+
+  bool ParseNextKey() {
+    current_ = NextEntryOffset();
+    const char* p = data_ + current_;
+    const char* limit = data_ + restarts_;  // Restarts come right after data
+    if (p >= limit) {
+      // No more entries to return.  Mark as invalid.
+      current_ = restarts_;
+      restart_index_ = num_restarts_;
+      return false;
+    }
+
+    // Decode next entry
+    uint32_t shared, non_shared, value_length;
+    p = DecodeGroupVarintEntry(p, limit, &shared, &non_shared, &value_length);
+    if (p == NULL || key_.size() < shared) {
+      CorruptionError();
+      return false;
+    } else {
+      key_.resize(shared);
+      key_.append(p, non_shared);
+      value_ = Slice(p + non_shared, value_length);
+      while (restart_index_ + 1 < num_restarts_ &&
+             GetRestartPoint(restart_index_ + 1) < current_) {
+        ++restart_index_;
+      }
+      return true;
+    }
+  }
+
+ public:
+  Iter(const Cmp& cmp, bool ordered, const char* data, uint32_t restarts,
+       uint32_t num_restarts)
+      : cmp_(cmp),
+        ordered_(ordered),
+        data_(data),
+        restarts_(restarts),
+        num_restarts_(num_restarts),
+        current_(restarts_),
+        restart_index_(num_restarts_) {
+    assert(num_restarts_ > 0);
+  }
+
+  virtual ~Iter() {}
+  virtual bool Valid() const { return current_ < restarts_; }
+  virtual Status status() const { return status_; }
+  virtual Slice key() const {
+    assert(Valid());
+    return key_;
+  }
+  virtual Slice value() const {
+    assert(Valid());
+    return value_;
+  }
+
+  virtual void Next() {
+    assert(Valid());
+    ParseNextKey();
+  }
+
+  virtual void Prev() {
+    assert(Valid());
+    // Scan backwards to a restart point before current_
+    const uint32_t original = current_;
+    while (GetRestartPoint(restart_index_) >= original) {
+      if (restart_index_ == 0) {
+        // No more entries
+        current_ = restarts_;
+        restart_index_ = num_restarts_;
+        return;
+      }
+      restart_index_--;
+    }
+
+    SeekToRestartPoint(restart_index_);
+    do {
+      // Loop until end of current entry hits the start of original entry
+    } while (ParseNextKey() && NextEntryOffset() < original);
+  }
+
+  virtual void Seek(const Slice& target) {
+    if (!ordered_) {
+      SeekToFirst();
+      while (Valid() && key_ != target) {
+        ParseNextKey();
+      }
+      return;
+    }
+    // Binary search in restart array to find the last restart point
+    // with a key < target
+    uint32_t left = 0;
+    uint32_t right = num_restarts_ - 1;
+    while (left < right) {
+      uint32_t mid = (left + right + 1) / 2;
+      uint32_t region_offset = GetRestartPoint(mid);
+      uint32_t shared, non_shared, value_length;
+      const char* key_ptr =
+          DecodeGroupVarintEntry(data_ + region_offset, data_ + restarts_,
+                                 &shared, &non_shared, &value_length);
+      if (key_ptr == NULL || (shared != 0)) {
+        CorruptionError();
+        return;
+      }
+      Slice mid_key(key_ptr, non_shared);
+      if (Compare(mid_key, target) < 0) {
+        // Key at "mid" is smaller than "target". Therefore all
+        // blocks before "mid" are uninteresting.
+        left = mid;
+      } else {
+        // Key at "mid" is >= "target". Therefore all blocks at or
+        // after "mid" are uninteresting.
+        right = mid - 1;
+      }
+    }
+
+    // Linear search (within restart block) for first key >= target
+    SeekToRestartPoint(left);
+    while (true) {
+      if (!ParseNextKey()) {
+        return;
+      }
+      if (Compare(key_, target) >= 0) {
+        return;
+      }
+    }
+  }
+
+  virtual void SeekToFirst() {
+    SeekToRestartPoint(0);
+    ParseNextKey();
+  }
+
+  virtual void SeekToLast() {
+    SeekToRestartPoint(num_restarts_ - 1);
+    while (ParseNextKey() && NextEntryOffset() < restarts_) {
+      // Keep skipping
+    }
+  }
+};
+
+// Return an iterator to the block contents. The result should be deleted when
+// no longer needed.
+Iterator* GroupVarintBlock::NewIterator(const Comparator* comparator) {
+  if (size_ < sizeof(uint32_t)) {
+    return NewErrorIterator(
+        Status::Corruption("Cannot understand block contents"));
+  } else if (num_restarts_ == 0) {
     return NewEmptyIterator();
+  } else if (comparator == BytewiseComparator()) {  // Inline key comparisons
+    return new Iter<BytewiseCompare>(BytewiseCompare(), true, data_,
+                                     restart_offset_, num_restarts_);
+  } else {
+    return new Iter<VirtualCompare>(VirtualCompare(comparator),
+                                    comparator != NULL, data_,
+                                    restart_offset_, num_restarts_);
   }
 }
 
@@ -231,8 +943,17 @@ SeqDirBuilder<T>::SeqDirBuilder(const DirOptions& options,
       num_uncommitted_data_(0),
       pending_restart_(false),
       pending_commit_(false),
+      para_compression_(options_.parallel_compression &&
+                        options_.compaction_pool != NULL &&
+                        options_.compression != kNoCompression),
       data_block_(new T(options)),
       indx_block_(1),
+      ect_(HasEctIndex(options_)),
+      key_index_(HasKeyIndex(options_)),
+      tabl_keys_bad_(false),
+      tabl_num_ents_(0),
+      sample_stride_(1),
+      fltr_block_(1),
       epok_block_(1),
       root_block_(1),
       pending_indx_entry_(false),
@@ -259,8 +980,9 @@ SeqDirBuilder<T>::SeqDirBuilder(const DirOptions& options,
   const size_t estimated_root_index = 4 << 10;
   root_block_.Reserve(estimated_root_index);
 
+  block_size_ = options_.block_size;
   block_threshold_ =
-      static_cast<size_t>(floor(options_.block_size * options_.block_util));
+      static_cast<size_t>(floor(block_size_ * options_.block_util));
   uncommitted_indexes_.reserve(1 << 10);
   if (options_.block_batch_size != 0)
     data_block_->buffer_store()->reserve(options_.block_batch_size);
@@ -303,6 +1025,9 @@ void SeqDirBuilder<T>::FinishEpoch(uint32_t ep_seq) {
       epok_block_handle.size() + kBlockTrailerSize;
   compac_stats_->final_meta_index_size += final_meta_index_size;
   compac_stats_->meta_index_size += meta_index_size;
+  DirSpaceStats* const space = epoch_space_stats();
+  space->index_size += epok_block_handle.size();
+  space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
 
   epok_block_.Reset();
   last_epok_info_.set_index_offset(epok_block_handle.offset());
@@ -312,20 +1037,25 @@ void SeqDirBuilder<T>::FinishEpoch(uint32_t ep_seq) {
   assert(!pending_root_entry_);
   pending_root_entry_ = true;
 
-  std::string handle_encoding;
-  last_epok_info_.EncodeTo(&handle_encoding);
-  root_block_.Add(EpochKey(num_eps_), handle_encoding);
+  std::string* const handle_encoding = &scratch_;
+  handle_encoding->clear();
+  last_epok_info_.EncodeTo(handle_encoding);
+  root_block_.Add(EpochKey(num_eps_), *handle_encoding);
   pending_root_entry_ = false;
 
   stone.set_handle(epok_block_handle);
   stone.set_id(num_eps_);
-  std::string epoch_stone;
-  stone.EncodeTo(&epoch_stone);
-  status_ = indx_writter_->SealEpoch(epoch_stone);
+  std::string* const epoch_stone = &scratch_;
+  epoch_stone->clear();
+  stone.EncodeTo(epoch_stone);
+  status_ = indx_writter_->SealEpoch(*epoch_stone);
   if (!ok()) {
     return;
   }
 
+  space->index_size += epoch_stone->size();
+  space->checksum_size += kChunkHeaderSize;
+
   pending_indx_flush_ = indx_sink_->Ltell();
   pending_data_flush_ = data_offset_;
 
@@ -340,6 +1070,35 @@ void SeqDirBuilder<T>::FinishEpoch(uint32_t ep_seq) {
   }
 }
 
+template <typename T>
+void SeqDirBuilder<T>::AddFilterPartition(const Slice& largest_key,
+                                          const Slice& filter_contents,
+                                          ChunkType filter_type) {
+  assert(!finished_);  // Finish() has not been called
+  if (!ok()) {
+    return;
+  }
+
+  BlockHandle filter_handle;
+  status_ = indx_writter_->Write(filter_type, filter_contents, &filter_handle);
+  if (!ok()) {
+    return;
+  }
+
+  const uint64_t filter_size = filter_contents.size();
+  const uint64_t final_filter_size = filter_handle.size() + kBlockTrailerSize;
+  compac_stats_->final_filter_size += final_filter_size;
+  compac_stats_->filter_size += filter_size;
+  DirSpaceStats* const space = epoch_space_stats();
+  space->filter_size += filter_handle.size();
+  space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
+
+  std::string* const handle_encoding = &scratch_;
+  handle_encoding->clear();
+  filter_handle.EncodeTo(handle_encoding);
+  fltr_block_.Add(largest_key, *handle_encoding);
+}
+
 template <typename T>
 void SeqDirBuilder<T>::EndTable(const Slice& filter_contents,
                                 ChunkType filter_type) {
@@ -360,11 +1119,31 @@ void SeqDirBuilder<T>::EndTable(const Slice& filter_contents,
   if (!ok()) {
     return;
   } else if (indx_block_.empty()) {
+    ResetTableKeys();
+    tabl_samples_.clear();
+    tabl_num_ents_ = 0;
+    sample_stride_ = 1;
     return;  // Empty table
   }
 
   BlockHandle index_block_handle;
   Slice index_contents = indx_block_.Finish();
+  if (ect_ || key_index_) {
+    indx_buf_.assign(index_contents.data(), index_contents.size());
+    const size_t trailer_start = indx_buf_.size();
+    if (tabl_keys_bad_) {
+      // Leave the trailer empty
+    } else if (ect_) {
+      BuildEctIndex(options_.key_size, tabl_keys_, tabl_block_ends_,
+                    &indx_buf_);
+    } else if (tabl_block_ends_.size() == 1) {  // Positions are per block
+      BuildKeyIndex();
+    }
+    PutFixed32(&indx_buf_,
+               static_cast<uint32_t>(indx_buf_.size() - trailer_start));
+    index_contents = indx_buf_;
+    ResetTableKeys();
+  }
   status_ =
       indx_writter_->Write(kIdxChunk, index_contents, &index_block_handle);
   if (!ok()) {
@@ -376,9 +1155,27 @@ void SeqDirBuilder<T>::EndTable(const Slice& filter_contents,
       index_block_handle.size() + kBlockTrailerSize;
   compac_stats_->final_index_size += final_index_size;
   compac_stats_->index_size += index_size;
+  DirSpaceStats* const space = epoch_space_stats();
+  space->index_size += index_block_handle.size();
+  space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
 
   BlockHandle filter_handle;
-  if (!filter_contents.empty()) {
+  if (!fltr_block_.empty()) {  // Filter partitions
+    Slice filter_index_contents = fltr_block_.Finish();
+    status_ = indx_writter_->Write(kIdxChunk, filter_index_contents,
+                                   &filter_handle);
+    fltr_block_.Reset();
+    if (!ok()) {
+      return;
+    }
+
+    const uint64_t filter_size = filter_index_contents.size();
+    const uint64_t final_filter_size = filter_handle.size() + kBlockTrailerSize;
+    compac_stats_->final_filter_size += final_filter_size;
+    compac_stats_->filter_size += filter_size;
+    space->filter_size += filter_handle.size();
+    space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
+  } else if (!filter_contents.empty()) {
     status_ =
         indx_writter_->Write(filter_type, filter_contents, &filter_handle);
     if (!ok()) {
@@ -389,6 +1186,8 @@ void SeqDirBuilder<T>::EndTable(const Slice& filter_contents,
     const uint64_t final_filter_size = filter_handle.size() + kBlockTrailerSize;
     compac_stats_->final_filter_size += final_filter_size;
     compac_stats_->filter_size += filter_size;
+    space->filter_size += filter_handle.size();
+    space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
   } else {
     filter_handle.set_offset(0);  // No filter installed
     filter_handle.set_size(0);
@@ -405,12 +1204,23 @@ void SeqDirBuilder<T>::EndTable(const Slice& filter_contents,
   last_tabl_info_.set_smallest_key(smallest_key_);
   BytewiseComparator()->FindShortSuccessor(&largest_key_);
   last_tabl_info_.set_largest_key(largest_key_);
-  std::string handle_encoding;
-  last_tabl_info_.EncodeTo(&handle_encoding);
-  epok_block_.Add(EpochTableKey(num_eps_, num_tabls_), handle_encoding);
+  // Samples of unordered tables are taken in insertion order
+  std::sort(tabl_samples_.begin(), tabl_samples_.end());
+  last_tabl_info_.set_key_samples(&tabl_samples_, tabl_num_ents_);
+  tabl_num_ents_ = 0;
+  sample_stride_ = 1;
+  std::string* const handle_encoding = &scratch_;
+  handle_encoding->clear();
+  if (options_.compact_table_handles) {
+    last_tabl_info_.EncodeCompactTo(handle_encoding);
+  } else {
+    last_tabl_info_.EncodeTo(handle_encoding);
+  }
+  epok_block_.Add(EpochTableKey(num_eps_, num_tabls_), *handle_encoding);
   pending_meta_entry_ = false;
 
   compac_stats_->total_num_tables_++;
+  space->num_tables++;
   num_tabls_++;  // Num of tables within an epoch
   smallest_key_.clear();
   largest_key_.clear();
@@ -418,35 +1228,28 @@ void SeqDirBuilder<T>::EndTable(const Slice& filter_contents,
 }
 
 template <typename T>
-void SeqDirBuilder<T>::Commit() {
-  assert(!finished_);  // Finish() has not been called
-  // Skip empty commit
-  if (data_block_->buffer_store()->empty()) return;
-  if (!ok()) return;  // Abort
+Slice SeqDirBuilder<T>::PrepareCommit(void* arg, uint64_t base) {
+  SeqDirBuilder<T>* const bu = reinterpret_cast<SeqDirBuilder<T>*>(arg);
+  return bu->FinalizeCommit(base);
+}
 
-  assert(num_uncommitted_data_ == num_uncommitted_indx_);
+// A data log file may be rotated so we must index against the
+// physical offset
+template <typename T>
+Slice SeqDirBuilder<T>::FinalizeCommit(uint64_t base) {
   std::string* const buffer = data_block_->buffer_store();
-
   Slice key;
-  data_sink_->Lock();
-  if (options_.block_padding) {
-    assert(buffer->size() % options_.block_size ==
-           0);  // Verify block alignment
-  }
-  // A data log file may be rotated so we must index against the
-  // physical offset
-  const size_t base = data_sink_->Ptell();
   int num_index_committed = 0;
   Slice input = uncommitted_indexes_;
-  std::string handle_encoding;
+  std::string* const handle_encoding = &scratch_;
   BlockHandle handle;
   while (!input.empty()) {
     if (GetLengthPrefixedSlice(&input, &key)) {
       handle.DecodeFrom(&input);
       const uint64_t offset = handle.offset();
       handle.set_offset(base + offset);  // Finalize the block offset
-      handle_encoding.clear();
-      handle.EncodeTo(&handle_encoding);
+      handle_encoding->clear();
+      handle.EncodeTo(handle_encoding);
       assert(offset >= BlockHandle::kMaxEncodedLength);
       assert(
           memcmp(&buffer->at(offset - BlockHandle::kMaxEncodedLength),
@@ -454,13 +1257,13 @@ void SeqDirBuilder<T>::Commit() {
                  BlockHandle::kMaxEncodedLength) == 0);
       // Finalize the leading block handle
       memcpy(&buffer->at(offset - BlockHandle::kMaxEncodedLength),
-             handle_encoding.data(), handle_encoding.size());
+             handle_encoding->data(), handle_encoding->size());
       if (options_.block_padding) {
         assert((base + offset - BlockHandle::kMaxEncodedLength) %
                    options_.block_size ==
                0);  // Verify block alignment
       }
-      indx_block_.Add(key, handle_encoding);
+      indx_block_.Add(key, *handle_encoding);
       num_index_committed++;
     } else {
       break;
@@ -468,9 +1271,203 @@ void SeqDirBuilder<T>::Commit() {
   }
 
   assert(num_index_committed == num_uncommitted_indx_);
-  status_ = data_sink_->Lwrite(*buffer);
+  return *buffer;
+}
+
+namespace {
+// Compress a single data block using the given compression type.
+// Return false if the type is not supported or not compiled in.
+bool CompressBlock(CompressionType type, const Slice& input,
+                   std::string* output) {
+  switch (type) {
+    case kSnappyCompression:
+      return port::Snappy_Compress(input.data(), input.size(), output);
+    case kZstdCompression:
+      return port::Zstd_Compress(input.data(), input.size(), output);
+    case kLz4Compression:
+      return port::Lz4_Compress(input.data(), input.size(), output);
+    default:
+      return false;
+  }
+}
+
+// State shared by the caller and all background jobs of a parallel block
+// compression. Deleted by whoever drops the last reference. The caller
+// returns once all blocks are compressed, so jobs that start late must not
+// touch anything other than this state.
+struct ParaCompressionState {
+  ParaCompressionState() : cv(&mu) {}
+  CompressionType type;
+  const Slice* inputs;
+  std::string* outputs;
+  bool* oks;
+  size_t num_blocks;
+  port::Mutex mu;
+  port::CondVar cv;
+  size_t next_block;  // Next block to compress
+  size_t num_done;    // Number of blocks compressed
+  int refs;
+
+  void CompressBlocks() {
+    MutexLock ml(&mu);
+    while (next_block < num_blocks) {
+      const size_t b = next_block++;
+      mu.Unlock();
+      oks[b] = CompressBlock(type, inputs[b], &outputs[b]);
+      mu.Lock();
+      num_done++;
+      if (num_done == num_blocks) {
+        cv.SignalAll();
+      }
+    }
+  }
+
+  void Unref() {
+    mu.Lock();
+    assert(refs > 0);
+    const bool last = (--refs == 0);
+    mu.Unlock();
+    if (last) {
+      delete this;
+    }
+  }
+
+  static void BGWork(void* arg) {
+    ParaCompressionState* const state =
+        reinterpret_cast<ParaCompressionState*>(arg);
+    state->CompressBlocks();
+    state->Unref();
+  }
+};
+
+const int kMaxParaCompressionJobs = 8;
+}  // namespace
+
+// The calling thread compresses blocks too so we will not be blocked even if
+// all pool threads happen to be busy.
+template <typename T>
+void SeqDirBuilder<T>::CompressBufferedBlocks() {
+  std::string* const buffer = data_block_->buffer_store();
+  std::vector<std::string> keys;
+  std::vector<Slice> inputs;
+  Slice input = uncommitted_indexes_;
+  Slice key;
+  BlockHandle handle;
+  while (!input.empty()) {
+    if (GetLengthPrefixedSlice(&input, &key) &&
+        handle.DecodeFrom(&input).ok()) {
+      keys.push_back(key.ToString());
+      inputs.push_back(Slice(buffer->data() + handle.offset(), handle.size()));
+    } else {
+      break;
+    }
+  }
+  const size_t n = inputs.size();
+  assert(n == num_uncommitted_indx_);
+  if (n == 0) {
+    return;
+  }
+
+  std::vector<std::string> outputs(n);
+  bool* const oks = new bool[n];
+  ParaCompressionState* const state = new ParaCompressionState;
+  state->type = options_.compression;
+  state->inputs = &inputs[0];
+  state->outputs = &outputs[0];
+  state->oks = oks;
+  state->num_blocks = n;
+  state->next_block = 0;
+  state->num_done = 0;
+  const int num_jobs =
+      static_cast<int>(std::min(n - 1, size_t(kMaxParaCompressionJobs)));
+  state->refs = 1 + num_jobs;
+  for (int i = 0; i < num_jobs; i++) {
+    options_.compaction_pool->Schedule(ParaCompressionState::BGWork, state);
+  }
+  state->CompressBlocks();
+  state->mu.Lock();
+  while (state->num_done < n) {
+    state->cv.Wait();
+  }
+  state->mu.Unlock();
+  state->Unref();
+
+  // Reassemble blocks in order
+  DirSpaceStats* const space = epoch_space_stats();
+  std::string result;
+  result.reserve(buffer->size());
+  uncommitted_indexes_.clear();
+  for (size_t i = 0; i < n; i++) {
+    Slice contents = inputs[i];
+    char trailer[kBlockTrailerSize];
+    trailer[0] = kNoCompression;
+    const size_t sz = contents.size();
+    if (oks[i] &&
+        (options_.force_compression || outputs[i].size() < sz - sz / 8u)) {
+      contents = outputs[i];
+      trailer[0] = options_.compression;
+    }
+    if (!options_.skip_checksums) {
+      const ChecksumType cs = options_.checksum_type;
+      uint32_t crc = ExtendChecksum(cs, 0, contents.data(), contents.size());
+      crc = ExtendChecksum(cs, crc, trailer, 1);  // Also cover block type
+      EncodeFixed32(trailer + 1, crc32c::Mask(crc));
+    } else {
+      EncodeFixed32(trailer + 1, 0);
+    }
+    // Reserve space for the leading block handle
+    result.resize(result.size() + BlockHandle::kMaxEncodedLength, 0);
+    const size_t block_offset = result.size();
+    result.append(contents.data(), contents.size());
+    result.append(trailer, sizeof(trailer));
+    if (options_.block_padding) {
+      size_t padding_target =
+          options_.block_size - BlockHandle::kMaxEncodedLength;
+      while (padding_target < contents.size() + kBlockTrailerSize)
+        padding_target += options_.block_size;
+      result.resize(block_offset + padding_target, static_cast<char>(0xff));
+    }
+    compac_stats_->final_data_size += result.size() - block_offset;
+    compac_stats_->data_size += contents.size();
+    space->index_size += BlockHandle::kMaxEncodedLength;
+    space->data_size += contents.size();
+    space->checksum_size += kBlockTrailerSize;
+    space->block_padding_size +=
+        result.size() - block_offset - contents.size() - kBlockTrailerSize;
+
+    handle.set_offset(block_offset);
+    handle.set_size(contents.size());
+    PutLengthPrefixedSlice(&uncommitted_indexes_, keys[i]);
+    handle.EncodeTo(&uncommitted_indexes_);
+  }
+
+  delete[] oks;
+  buffer->swap(result);
+}
+
+template <typename T>
+void SeqDirBuilder<T>::Commit() {
+  assert(!finished_);  // Finish() has not been called
+  // Skip empty commit
+  if (data_block_->buffer_store()->empty()) return;
+  if (!ok()) return;  // Abort
+
+  assert(num_uncommitted_data_ == num_uncommitted_indx_);
+  std::string* const buffer = data_block_->buffer_store();
+  // Blocks buffered for parallel compression are padded only once they are
+  // compressed
+  if (para_compression_) {
+    CompressBufferedBlocks();
+  }
+  if (options_.block_padding) {
+    assert(buffer->size() % options_.block_size ==
+           0);  // Verify block alignment
+  }
+  // Block offsets are finalized by PrepareCommit(), which may be invoked by
+  // another builder sharing the same data log
+  uint64_t base;
+  status_ = data_sink_->GroupCommit(PrepareCommit, this, &base);
   data_offset_ = base + buffer->size();
-  data_sink_->Unlock();
   if (!ok()) return;  // Abort
 
   pending_commit_ = false;
@@ -486,15 +1483,40 @@ void SeqDirBuilder<T>::EndBlock() {
   if (pending_restart_) return;      // Empty block
   if (data_block_->empty()) return;  // Empty block
   if (!ok()) return;                 // Abort
+  if (ect_ || key_index_) {
+    tabl_block_ends_.push_back(
+        static_cast<uint32_t>(tabl_keys_.size() / options_.key_size));
+  }
 
   // | <------------ options_.block_size (e.g. 32KB) ------------> |
   //   block handle   block contents  block trailer  block padding
   //                | <---------- final block contents ----------> |
   //                          (LevelDb compatible layout)
+  if (para_compression_) {
+    // Leave the block uncompressed and without a trailer for now. Both will
+    // be added by CompressBufferedBlocks() at commit time.
+    Slice block_contents = data_block_->Finish(kNoCompression);
+    if (ok()) {
+      compac_stats_->total_num_blocks_++;
+      epoch_space_stats()->num_blocks++;
+      pending_restart_ = true;
+      last_data_info_.set_size(block_contents.size());
+      last_data_info_.set_offset(data_block_->buffer_store()->size() -
+                                 block_contents.size());
+      assert(!pending_indx_entry_);
+      pending_indx_entry_ = true;
+      num_uncommitted_data_++;
+    }
+    return;
+  }
   Slice block_contents =
       data_block_->Finish(options_.compression, options_.force_compression);
   const size_t block_size = block_contents.size();
   Slice final_block_contents;  // With the trailer and any inserted padding
+  // The block builder can only compute crc32c checksums. Other checksums are
+  // filled in below after the block is finalized.
+  const bool crc32c =
+      !options_.skip_checksums && options_.checksum_type == kCsCrc32c;
   if (options_.block_padding) {
     // Target size for the final block contents after padding
     size_t padding_target =
@@ -502,20 +1524,34 @@ void SeqDirBuilder<T>::EndBlock() {
     while (padding_target < block_size + kBlockTrailerSize)
       padding_target += options_.block_size;
     final_block_contents = data_block_->Finalize(
-        !options_.skip_checksums, static_cast<uint32_t>(padding_target),
-        static_cast<char>(0xff));
+        crc32c, static_cast<uint32_t>(padding_target), static_cast<char>(0xff));
   } else {
-    final_block_contents = data_block_->Finalize(!options_.skip_checksums);
+    final_block_contents = data_block_->Finalize(crc32c);
   }
 
   const size_t final_block_size = final_block_contents.size();
   const uint64_t block_offset =
       data_block_->buffer_store()->size() - final_block_size;
+  if (!options_.skip_checksums && !crc32c) {
+    const ChecksumType cs = options_.checksum_type;
+    char* const contents = &(*data_block_->buffer_store())[block_offset];
+    char* const trailer = contents + block_size;
+    uint32_t crc = ExtendChecksum(cs, 0, contents, block_size);
+    crc = ExtendChecksum(cs, crc, trailer, 1);  // Also cover block type
+    EncodeFixed32(trailer + 1, crc32c::Mask(crc));
+  }
   compac_stats_->final_data_size += final_block_size;
   compac_stats_->data_size += block_size;
+  DirSpaceStats* const space = epoch_space_stats();
+  space->index_size += BlockHandle::kMaxEncodedLength;
+  space->data_size += block_size;
+  space->checksum_size += kBlockTrailerSize;
+  space->block_padding_size +=
+      final_block_size - block_size - kBlockTrailerSize;
 
   if (ok()) {
     compac_stats_->total_num_blocks_++;
+    space->num_blocks++;
     pending_restart_ = true;
     last_data_info_.set_size(block_size);
     last_data_info_.set_offset(block_offset);
@@ -533,10 +1569,10 @@ void SeqDirBuilder<T>::Add(const Slice& key, const Slice& value) {
 
   if (IsKeyUnOrdered(options_.mode)) {
     if (smallest_key_.empty() || key < smallest_key_) {
-      smallest_key_ = key.ToString();
+      smallest_key_.assign(key.data(), key.size());
     }
     if (largest_key_.empty() || key > largest_key_) {
-      largest_key_ = key.ToString();
+      largest_key_.assign(key.data(), key.size());
     }
   } else {  // Keys within a single table are inserted in a weakly sorted order
     if (!last_key_.empty()) {
@@ -551,9 +1587,9 @@ void SeqDirBuilder<T>::Add(const Slice& key, const Slice& value) {
       }
     }
     if (smallest_key_.empty()) {
-      smallest_key_ = key.ToString();
+      smallest_key_.assign(key.data(), key.size());
     }
-    largest_key_ = key.ToString();
+    largest_key_.assign(key.data(), key.size());
   }
 
   // Add an index entry if there is one pending insertion
@@ -583,7 +1619,7 @@ void SeqDirBuilder<T>::Add(const Slice& key, const Slice& value) {
     data_block_->Reset();
   }
 
-  last_key_ = key.ToString();
+  last_key_.assign(key.data(), key.size());
   compac_stats_->value_size += value.size();
   compac_stats_->key_size += key.size();
 #ifndef NDEBUG
@@ -593,6 +1629,16 @@ void SeqDirBuilder<T>::Add(const Slice& key, const Slice& value) {
   }
 #endif
 
+  if (ect_ || key_index_) {
+    if (key.size() != options_.key_size) tabl_keys_bad_ = true;
+    tabl_keys_.append(key.data(), key.size());
+  }
+  if (options_.table_key_samples != 0) {
+    SampleKey(key);
+  }
+  if (options_.key_epoch_index) {
+    key_epochs_.push_back(KeyEpochHash(key) | (num_eps_ & 31));
+  }
   data_block_->Add(key, value);
   compac_stats_->total_num_keys_++;
   num_entries_++;  // Num key-value entries within an epoch
@@ -604,7 +1650,7 @@ void SeqDirBuilder<T>::Add(const Slice& key, const Slice& value) {
       block_threshold_) {
     EndBlock();
     // Schedule buffer commit if it is about to full
-    if (data_block_->buffer_store()->size() + options_.block_size >
+    if (data_block_->buffer_store()->size() + block_size_ >
         options_.block_batch_size) {
       pending_commit_ = true;
     }
@@ -629,6 +1675,13 @@ void SeqDirBuilder<T>::Finish(uint32_t ep_seq) {
   assert(!pending_meta_entry_);
   assert(!pending_root_entry_);
 
+  if (options_.key_epoch_index && !key_epochs_.empty()) {
+    BuildKeyEpochIndex();
+    if (!ok()) {
+      return;
+    }
+  }
+
   BlockHandle root_block_handle;
   Slice root_block_contents = root_block_.Finish();
   status_ =
@@ -642,11 +1695,89 @@ void SeqDirBuilder<T>::Finish(uint32_t ep_seq) {
       root_block_handle.size() + kBlockTrailerSize;
   compac_stats_->final_meta_index_size += final_root_block_size;
   compac_stats_->meta_index_size += root_block_size;
+  DirSpaceStats* const space = &compac_stats_->others;
+  space->index_size += root_block_handle.size();
+  space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
 
   footer.set_epoch_index_handle(root_block_handle);
   footer.set_num_epochs(num_eps_);
   footer.EncodeTo(&footer_buf);
+  const uint64_t indx_offset = indx_sink_->Ltell();
   status_ = indx_writter_->Finish(footer_buf);
+  if (!ok()) {
+    return;
+  }
+
+  space->index_size += footer_buf.size();
+  space->checksum_size += kChunkHeaderSize;
+  space->tail_padding_size +=
+      indx_sink_->Ltell() - indx_offset - kChunkHeaderSize - footer_buf.size();
+}
+
+namespace {
+// Add all entries added to "src" so far to "dst" as well. "src" is finished
+// and then rebuilt with the same entries so more may still be added to it.
+// REQUIRES: both blocks use a restart interval of 1.
+void CopyEntries(BlockBuilder* src, BlockBuilder* dst) {
+  if (src->empty()) return;
+  const std::string contents = src->Finish().ToString();
+  src->Reset();
+  BlockContents c;
+  c.data = contents;
+  c.heap_allocated = false;
+  c.cachable = false;
+  Block block(c);
+  Iterator* const iter = block.NewIterator(BytewiseComparator());
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    src->Add(iter->key(), iter->value());
+    dst->Add(iter->key(), iter->value());
+  }
+  assert(iter->status().ok());
+  delete iter;
+}
+}  // namespace
+
+template <typename T>
+Status SeqDirBuilder<T>::Snapshot(std::string* root, uint32_t* num_epochs) {
+  assert(!finished_);  // Finish() has not been called
+  *num_epochs = num_eps_;
+  if (!ok()) return status_;
+  assert(!pending_meta_entry_);
+  assert(!pending_root_entry_);
+  BlockBuilder root_block(1);
+  CopyEntries(&root_block_, &root_block);
+  if (num_tabls_ != 0) {
+    BlockBuilder epok_block(1);
+    CopyEntries(&epok_block_, &epok_block);
+    BlockHandle epok_block_handle;
+    Slice epok_index_contents = epok_block.Finish();
+    status_ = indx_writter_->Write(kMetaChunk, epok_index_contents,
+                                   &epok_block_handle);
+    if (!ok()) {
+      return status_;
+    }
+
+    compac_stats_->final_meta_index_size +=
+        epok_block_handle.size() + kBlockTrailerSize;
+    compac_stats_->meta_index_size += epok_index_contents.size();
+    DirSpaceStats* const space = epoch_space_stats();
+    space->index_size += epok_block_handle.size();
+    space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
+
+    EpochHandle epok_info;
+    epok_info.set_index_offset(epok_block_handle.offset());
+    epok_info.set_index_size(epok_block_handle.size());
+    epok_info.set_num_tables(num_tabls_);
+    epok_info.set_num_ents(num_entries_);
+    std::string* const handle_encoding = &scratch_;
+    handle_encoding->clear();
+    epok_info.EncodeTo(handle_encoding);
+    root_block.Add(EpochKey(num_eps_), *handle_encoding);
+    *num_epochs = num_eps_ + 1;
+  }
+
+  *root = root_block.Finish().ToString();
+  return status_;
 }
 
 template <typename T>
@@ -655,17 +1786,121 @@ size_t SeqDirBuilder<T>::memory_usage() const {
   result += root_block_.memory_usage();
   result += epok_block_.memory_usage();
   result += indx_block_.memory_usage();
+  result += tabl_keys_.capacity();
+  result += key_epochs_.capacity() * sizeof(uint64_t);
+  for (size_t i = 0; i < tabl_samples_.size(); i++) {
+    result += tabl_samples_[i].capacity();
+  }
+  result += indx_buf_.capacity();
+  result += fltr_block_.memory_usage();
+  result += uncommitted_indexes_.capacity();
+  result += scratch_.capacity();
+  result += smallest_key_.capacity();
+  result += largest_key_.capacity();
+  result += last_key_.capacity();
   // XXX: Add index log's LogWriter's memory usage as well
   return result;
 }
 
+template <typename T>
+void SeqDirBuilder<T>::BuildKeyIndex() {
+  const size_t key_size = options_.key_size;
+  const size_t n = tabl_keys_.size() / key_size;
+  CuckooBlock<16, 32> cuckoo(options_, 0);
+  cuckoo.Reset(static_cast<uint32_t>(n));
+  for (size_t i = 0; i < n; i++) {
+    cuckoo.AddKey(Slice(tabl_keys_.data() + i * key_size, key_size),
+                  static_cast<uint32_t>(i));
+  }
+  Slice contents = cuckoo.Finish();
+  indx_buf_.append(contents.data(), contents.size());
+}
+
+template <typename T>
+void SeqDirBuilder<T>::BuildKeyEpochIndex() {
+  std::sort(key_epochs_.begin(), key_epochs_.end());
+  size_t num_keys = 0;
+  for (size_t i = 0; i < key_epochs_.size(); i++) {
+    if (i == 0 || (key_epochs_[i] ^ key_epochs_[i - 1]) > 31) num_keys++;
+  }
+  CuckooBlock<24, 32> cuckoo(options_, 0);
+  cuckoo.Reset(static_cast<uint32_t>(num_keys));
+  char tmp[8];
+  size_t i = 0;
+  while (i < key_epochs_.size()) {
+    const uint64_t ha = key_epochs_[i] & ~static_cast<uint64_t>(31);
+    uint32_t epochs = 0;
+    for (; i < key_epochs_.size() && (key_epochs_[i] ^ ha) <= 31; i++) {
+      epochs |= 1u << (key_epochs_[i] & 31);
+    }
+    EncodeFixed64(tmp, ha);
+    cuckoo.AddKey(Slice(tmp, sizeof(tmp)), epochs);
+  }
+  std::vector<uint64_t>().swap(key_epochs_);
+
+  BlockHandle handle;
+  Slice contents = cuckoo.Finish();
+  status_ = indx_writter_->Write(kIdxChunk, contents, &handle);
+  if (!ok()) {
+    return;
+  }
+
+  compac_stats_->final_meta_index_size += handle.size() + kBlockTrailerSize;
+  compac_stats_->meta_index_size += contents.size();
+  DirSpaceStats* const space = &compac_stats_->others;
+  space->index_size += handle.size();
+  space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
+
+  std::string* const handle_encoding = &scratch_;
+  handle_encoding->clear();
+  handle.EncodeTo(handle_encoding);
+  root_block_.Add(kKeyEpochIndexKey, *handle_encoding);
+}
+
+template <typename T>
+void SeqDirBuilder<T>::SampleKey(const Slice& key) {
+  if (tabl_num_ents_++ % sample_stride_ != 0) {
+    return;
+  }
+  tabl_samples_.push_back(key.ToString());
+  if (tabl_samples_.size() >= 2 * options_.table_key_samples) {
+    size_t n = 0;
+    for (size_t i = 0; i < tabl_samples_.size(); i += 2) {
+      tabl_samples_[n++].swap(tabl_samples_[i]);
+    }
+    tabl_samples_.resize(n);
+    sample_stride_ *= 2;
+  }
+}
+
+template <typename T>
+void SeqDirBuilder<T>::ResetTableKeys() {
+  tabl_keys_bad_ = false;
+  tabl_keys_.clear();
+  tabl_block_ends_.clear();
+}
+
+template <typename T>
+void SeqDirBuilder<T>::SetBlockSize(size_t block_size) {
+  assert(!options_.block_padding);
+  block_size_ = block_size;
+  block_threshold_ =
+      static_cast<size_t>(floor(block_size_ * options_.block_util));
+}
+
 // Use options to determine block formats.
 // Directly return the builder instance. This call won't fail.
 DirBuilder* DirBuilder::Open(const DirOptions& options, DirOutputStats* stats,
                              LogSink* data, LogSink* indx) {
   if (!options.leveldb_compatible) {
-    if (options.fixed_kv_length) {
+    if (options.fixed_kv_length && options.value_column_width != 0) {
+      return new SeqDirBuilder<ColumnarBlockBuilder>(options, stats, data,
+                                                     indx);
+    } else if (options.fixed_kv_length) {
       return new SeqDirBuilder<ArrayBlockBuilder>(options, stats, data, indx);
+    } else {
+      return new SeqDirBuilder<GroupVarintBlockBuilder>(options, stats, data,
+                                                        indx);
     }
   }
 
@@ -674,17 +1909,36 @@ DirBuilder* DirBuilder::Open(const DirOptions& options, DirOutputStats* stats,
 
 namespace {
 
-void CleanupArrayBlock(void* arg1, void* arg2) {
-  delete reinterpret_cast<ArrayBlock*>(arg1);
-}
-
-Iterator* OpenArrayBlock(const Comparator* cmp, const BlockContents& contents) {
+Iterator* OpenArrayBlock(const Comparator* cmp, const BlockContents& contents,
+                         bool interpolation) {
   ArrayBlock* array_block = new ArrayBlock(contents);
-  Iterator* iter = array_block->NewIterator(cmp);
+  Iterator* iter = array_block->NewIterator(cmp, interpolation);
   iter->RegisterCleanup(CleanupArrayBlock, array_block, NULL);
   return iter;
 }
 
+Iterator* OpenColumnarBlock(const Comparator* cmp,
+                            const BlockContents& contents, bool interpolation,
+                            size_t value_offset, size_t value_length) {
+  ColumnarBlock* block = new ColumnarBlock(contents);
+  Iterator* iter =
+      block->NewIterator(cmp, interpolation, value_offset, value_length);
+  delete block;  // Entries have been decoded into a separate buffer
+  return iter;
+}
+
+void CleanupGroupVarintBlock(void* arg1, void* arg2) {
+  delete reinterpret_cast<GroupVarintBlock*>(arg1);
+}
+
+Iterator* OpenGroupVarintBlock(const Comparator* cmp,
+                               const BlockContents& contents) {
+  GroupVarintBlock* block = new GroupVarintBlock(contents);
+  Iterator* iter = block->NewIterator(cmp);
+  iter->RegisterCleanup(CleanupGroupVarintBlock, block, NULL);
+  return iter;
+}
+
 void CleanupBlock(void* arg1, void* arg2) {
   delete reinterpret_cast<Block*>(arg1);
 }
@@ -700,14 +1954,26 @@ Iterator* OpenBlock(const Comparator* cmp, const BlockContents& contents) {
 
 Iterator* OpenDirBlock  // Use options to determine the block format to use
     (const DirOptions& options, const BlockContents& contents) {
+  return OpenDirBlock(options, contents, 0, 0);
+}
+
+Iterator* OpenDirBlock(const DirOptions& options, const BlockContents& contents,
+                       size_t value_offset, size_t value_length) {
   const Comparator* comparator = BytewiseComparator();
   if (IsKeyUnOrdered(options.mode)) {
     comparator = NULL;
   }
   if (!options.leveldb_compatible) {
-    if (options.fixed_kv_length) return OpenArrayBlock(comparator, contents);
-    // XXX: should we provide our own block format
-    // to support variable kv?
+    if (options.fixed_kv_length && ColumnarBlock::Match(contents.data))
+      return OpenColumnarBlock(comparator, contents,
+                               options.interpolation_search, value_offset,
+                               value_length);
+    if (options.fixed_kv_length)
+      return OpenArrayBlock(comparator, contents, options.interpolation_search);
+    // Blocks written before the group varint format was introduced
+    // use the LevelDB format
+    if (GroupVarintBlock::Match(contents.data))
+      return OpenGroupVarintBlock(comparator, contents);
   }
 
   return OpenBlock(comparator, contents);
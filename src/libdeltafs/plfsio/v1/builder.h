@@ -16,6 +16,7 @@
 #include "types.h"
 
 #include <set>
+#include <vector>
 
 namespace pdlfs {
 namespace plfsio {
@@ -47,6 +48,26 @@ static inline bool IsKeyUnOrdered(DirMode mode) {
   return (mode & 0x10) == 0x10;
 }
 
+// Return true iff table index blocks carry ect data for locating data blocks
+// without searching index keys. See ectidx.h.
+static inline bool HasEctIndex(const DirOptions& options) {
+  return options.ect_index && options.fixed_kv_length &&
+         IsKeyUniqueAndOrdered(options.mode);
+}
+
+// Return true iff table index blocks carry a cuckoo hash table that locates
+// each key within the table's only data block. See DirOptions::key_index.
+static inline bool HasKeyIndex(const DirOptions& options) {
+  return options.key_index && options.fixed_kv_length &&
+         options.mode == kDmUniqueUnordered;
+}
+
+// Return true iff table index blocks are followed by a trailer holding
+// either ect data or a key index. See ectidx.h.
+static inline bool HasIndexTrailer(const DirOptions& options) {
+  return HasEctIndex(options) || HasKeyIndex(options);
+}
+
 // A versatile block builder that uses the LevelDB's SST block format.
 // In this format, keys will be prefix-compressed. Both keys and values can have
 // variable length. Each block can be seen as a sorted search tree.
@@ -105,7 +126,15 @@ class ArrayBlock {
 
   ~ArrayBlock();
 
-  Iterator* NewIterator(const Comparator* comparator);
+  // If "interpolation" is true, ordered seeks estimate probe positions from
+  // the leading key bytes instead of always probing the middle entry.
+  Iterator* NewIterator(const Comparator* comparator,
+                        bool interpolation = false);
+
+  // Position an iterator at the i-th entry of its block, or make it invalid
+  // if there is no such entry. Return false if the iterator is not from
+  // an array block, in which case it is left unchanged.
+  static bool SeekToEntry(Iterator* iter, uint32_t i);
 
  private:
   const char* data_;
@@ -118,11 +147,142 @@ class ArrayBlock {
   class Iter;
 };
 
+// A block builder for fixed sized keys and values that stores values column
+// by column. Keys are stored as-is in write order. Each value is then split
+// into columns of options.value_column_width bytes (the last column may be
+// narrower) and all values of a column are stored together, optionally
+// encoded against the previous value of the same column as
+// options.column_encoding specifies. The top bit of the trailing key size is
+// set to tell such blocks apart from ArrayBlockBuilder blocks.
+class ColumnarBlockBuilder : public AbstractBlockBuilder {
+ public:
+  explicit ColumnarBlockBuilder(const DirOptions& options);
+
+  // REQUIRES: Finish() has not been called since the previous Reset().
+  void Add(const Slice& key, const Slice& value);
+
+  // Finish building the block and return a slice that refers to the block
+  // contents.
+  Slice Finish(CompressionType compression = kNoCompression,
+               bool force_compression = false);
+
+  // Return an estimate of the size of the block we are building.
+  size_t CurrentSizeEstimate() const;
+
+  void Reset();
+
+ private:
+  size_t value_size_;
+  size_t key_size_;
+  size_t column_width_;
+  size_t num_columns_;
+  ColumnEncoding encoding_;
+  std::string values_;  // Values of the current block in write order
+  size_t n_;
+};
+
+// Read block contents built by ColumnarBlockBuilder.
+class ColumnarBlock {
+ public:
+  explicit ColumnarBlock(const BlockContents&);  // Open block contents for read
+
+  ~ColumnarBlock();
+
+  // Return an iterator to the block contents. If "value_length" is not 0, only
+  // value bytes [value_offset, value_offset + value_length) are decoded and
+  // reported for each entry. Columns outside the range are not touched.
+  Iterator* NewIterator(const Comparator* comparator,
+                        bool interpolation = false, size_t value_offset = 0,
+                        size_t value_length = 0);
+
+  // Return true iff block contents are built by ColumnarBlockBuilder.
+  static bool Match(const Slice& contents);
+
+ private:
+  // Decode a column into the key value array at *dst using entries of
+  // "entry_size" bytes. Only column bytes [from, to) are copied to dst.
+  void DecodeColumn(size_t col, size_t from, size_t to, char* dst,
+                    size_t entry_size) const;
+
+  const char* data_;
+  size_t size_;
+  bool owned_;  // If data_[] is owned by us
+  uint32_t value_size_;
+  uint32_t key_size_;
+  uint32_t column_width_;
+  uint32_t num_columns_;
+  uint32_t num_entries_;
+  const char* encodings_;  // One encoding byte per column
+};
+
+// A block builder that prefix-compresses keys against restart points like
+// the LevelDB's SST block format but encodes the three lengths of each entry
+// (shared key bytes, non-shared key bytes, and value bytes) as a group varint:
+// a tag byte holding the byte width of each length followed by the lengths in
+// little-endian order. Lengths can therefore be decoded with three masked
+// loads instead of byte by byte. Both keys and values can have variable
+// length. The top bit of the restart count is set to tell such blocks apart
+// from LevelDB blocks.
+class GroupVarintBlockBuilder : public AbstractBlockBuilder {
+ public:
+  explicit GroupVarintBlockBuilder(const DirOptions& options);
+
+  // REQUIRES: Finish() has not been called since the previous Reset().
+  void Add(const Slice& key, const Slice& value);
+
+  // Finish building the block and return a slice that refers to the block
+  // contents.
+  Slice Finish(CompressionType compression = kNoCompression,
+               bool force_compression = false);
+
+  // Return an estimate of the size of the block we are building.
+  size_t CurrentSizeEstimate() const;
+
+  void Reset();
+
+ private:
+  std::vector<uint32_t> restarts_;  // Restart points
+  int counter_;                     // Number of entries emitted since restart
+  std::string last_key_;
+};
+
+// Read block contents built by GroupVarintBlockBuilder.
+class GroupVarintBlock {
+ public:
+  explicit GroupVarintBlock(const BlockContents&);  // Open contents for read
+
+  ~GroupVarintBlock();
+
+  // Return true iff the given block contents is built by
+  // GroupVarintBlockBuilder.
+  static bool Match(const Slice& contents);
+
+  Iterator* NewIterator(const Comparator* comparator);
+
+ private:
+  const char* data_;
+  size_t size_;
+  bool owned_;  // If data_[] is owned by us
+  uint32_t restart_offset_;  // Offset in data_ of restart array
+  uint32_t num_restarts_;
+
+  template <typename Cmp>
+  class Iter;
+};
+
 // Open an iterator on top of a given data block. The returned the iterator
 // should be deleted when no longer needed.
 extern Iterator* OpenDirBlock  // Use options to determine block formats
     (const DirOptions& options, const BlockContents& contents);
 
+// Open an iterator on top of a given data block that only reports value bytes
+// [value_offset, value_offset + value_length) of each entry. Ignored for
+// blocks with variable sized values or if value_length is 0. Columnar
+// blocks only decode the columns that are needed.
+extern Iterator* OpenDirBlock(const DirOptions& options,
+                              const BlockContents& contents,
+                              size_t value_offset, size_t value_length);
+
 // Directory compaction stats
 struct DirOutputStats {  // All final sizes include padding and block trailers
   DirOutputStats();
@@ -151,6 +311,12 @@ struct DirOutputStats {  // All final sizes include padding and block trailers
   // Total size of user data compacted
   size_t value_size;
   size_t key_size;
+
+  // Space taken by each epoch, indexed by epoch number
+  std::vector<DirSpaceStats> epochs;
+  // Space taken by the root meta index block, the footer, and any tail
+  // padding of the index log
+  DirSpaceStats others;
 };
 
 // Directory builder interface.
@@ -165,6 +331,15 @@ class DirBuilder {
 
   virtual void Add(const Slice& key, const Slice& value) = 0;
 
+  // Write a filter partition covering keys of the current table up to and
+  // including "largest_key". Partitions must be added in key order. Once
+  // one or more partitions have been added, the table is finished with a
+  // filter index locating these partitions instead of a single filter.
+  // REQUIRES: Finish() has not been called.
+  virtual void AddFilterPartition(const Slice& largest_key,
+                                  const Slice& filter_contents,
+                                  ChunkType filter_type) = 0;
+
   // Finish building the current table. Optionally, a filter can be specified
   // that is associated with the table.
   // REQUIRES: Finish() has not been called.
@@ -179,9 +354,21 @@ class DirBuilder {
   // No further writes.
   virtual void Finish(uint32_t ep_seq) = 0;
 
+  // Write a meta index block locating the tables finished so far within the
+  // current epoch, if there are any, and set *root to the contents of a root
+  // index block locating all epochs finished so far plus that partial epoch.
+  // Set *num_epochs to the number of epochs covered by the root index. Allows
+  // the directory to be read before it is finished.
+  // REQUIRES: Finish() has not been called.
+  virtual Status Snapshot(std::string* root, uint32_t* num_epochs) = 0;
+
   // Report memory usage.
   virtual size_t memory_usage() const = 0;
 
+  // Change the target size of data blocks built from now on.
+  // REQUIRES: options_.block_padding is false.
+  virtual void SetBlockSize(size_t block_size) = 0;
+
  protected:
   friend class DirCompactor;
   const DirOptions& options_;
@@ -190,6 +377,9 @@ class DirBuilder {
 
   bool ok() const { return status_.ok(); }
 
+  // Return the space stats of the current epoch.
+  DirSpaceStats* epoch_space_stats();
+
   uint32_t num_entries_;  // Number of entries inserted within the current epoch
   uint32_t num_tabls_;    // Number of tables generated within the current epoch
 
@@ -204,6 +394,7 @@ class DirBuilder {
 
 class SortedStringBlockBuilder;
 class ArrayBlockBuilder;
+class GroupVarintBlockBuilder;
 class LogWriter;
 
 // Write directory contents into an index log and a data log object. Directory
@@ -220,6 +411,10 @@ class SeqDirBuilder : public DirBuilder {
 
   virtual void Add(const Slice& key, const Slice& value);
 
+  virtual void AddFilterPartition(const Slice& largest_key,
+                                  const Slice& filter_contents,
+                                  ChunkType filter_type);
+
   // Force the start of a new table.
   // REQUIRES: Finish() has not been called.
   virtual void EndTable(const Slice& filter_contents, ChunkType filter_type);
@@ -232,17 +427,44 @@ class SeqDirBuilder : public DirBuilder {
   // No further writes.
   virtual void Finish(uint32_t ep_seq);
 
+  virtual Status Snapshot(std::string* root, uint32_t* num_epochs);
+
   // Report memory usage.
   virtual size_t memory_usage() const;
 
+  virtual void SetBlockSize(size_t block_size);
+
  private:
   // End the current block and force the start of a new data block.
   // REQUIRES: Finish() has not been called.
   void EndBlock();
 
+  // Append a cuckoo hash table mapping each key of the current table to its
+  // position within the table's data block to indx_buf_.
+  void BuildKeyIndex();
+  // Drop the keys kept for building the current table's index trailer.
+  void ResetTableKeys();
+  // Write a cuckoo hash table mapping the hash of each key of the directory
+  // to a bitmap of the epochs holding the key and locate it in the root
+  // index. Only used when options_.key_epoch_index is true.
+  void BuildKeyEpochIndex();
+  // Sample a key of the current table. Every sample_stride_-th key is kept
+  // and every other kept key is dropped, doubling the stride, whenever twice
+  // options_.table_key_samples keys are kept.
+  void SampleKey(const Slice& key);
+
   // Flush buffered data blocks and finalize their indexes.
   // REQUIRES: Finish() has not been called.
   void Commit();
+  // Compress buffered data blocks concurrently using the compaction pool and
+  // then reassemble them in their original order along with their trailers,
+  // padding, and index entries. Only used when para_compression_ is true.
+  void CompressBufferedBlocks();
+  // Finalize buffered data blocks and their indexes against the physical
+  // data log offset at which the blocks will be written. Invoked through
+  // LogSink::GroupCommit().
+  static Slice PrepareCommit(void* arg, uint64_t base);
+  Slice FinalizeCommit(uint64_t base);
 #ifndef NDEBUG
   // Used to verify the uniqueness of all input keys
   std::set<std::string> keys_;
@@ -251,13 +473,39 @@ class SeqDirBuilder : public DirBuilder {
   std::string smallest_key_;
   std::string largest_key_;
   std::string last_key_;
+  // Scratch space for encoding table and epoch handles. Reused across
+  // tables and epochs to avoid allocating a new string for each of them.
+  std::string scratch_;
   uint32_t num_uncommitted_indx_;  // Number of uncommitted index entries
   uint32_t num_uncommitted_data_;  // Number of uncommitted data blocks
   bool pending_restart_;           // Request to restart the data block buffer
   bool pending_commit_;  // Request to commit buffered data and indexes
+  // True if data blocks are buffered uncompressed and compressed in parallel
+  // right before each commit
+  bool para_compression_;
+  size_t block_size_;  // Target data block size
   size_t block_threshold_;
   T* data_block_;
   BlockBuilder indx_block_;  // Locate the data blocks within a table
+  // Keys of the current table and the number of keys through the end of each
+  // of its data blocks, kept for building the table's index trailer.
+  // Only used when ect_ or key_index_ is true.
+  bool ect_;
+  bool key_index_;
+  bool tabl_keys_bad_;  // Set if a key has an unexpected size
+  std::string tabl_keys_;
+  std::vector<uint32_t> tabl_block_ends_;
+  std::string indx_buf_;  // Index block contents followed by the trailer
+  // Keys sampled from the current table and the number of its entries.
+  // Only used when options_.table_key_samples is not 0.
+  std::vector<std::string> tabl_samples_;
+  uint64_t tabl_num_ents_;
+  uint64_t sample_stride_;
+  // The hash of each key added so far, with the lowest 5 bits replaced by the
+  // key's epoch number modulo 32. Only used when options_.key_epoch_index
+  // is true.
+  std::vector<uint64_t> key_epochs_;
+  BlockBuilder fltr_block_;  // Locate the filter partitions within a table
   BlockBuilder epok_block_;  // Locate the tables within an epoch
   BlockBuilder root_block_;  // Locate each epoch
   bool pending_indx_entry_;
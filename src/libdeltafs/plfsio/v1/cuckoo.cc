@@ -12,7 +12,11 @@
 #include "cuckoo.h"
 #include "types.h"
 
+#include "pdlfs-common/port.h"
+
 #include <math.h>
+#include <string.h>
+#include <algorithm>
 #include <map>
 
 namespace pdlfs {
@@ -61,8 +65,62 @@ struct CuckooReader {
       return x;
   };
 
+  // Return true iff any of the 4 fingerprints of bucket i equals fp.
+  // The bucket is loaded as a whole and its 4 items are compared at once
+  // without branches. Items of at most 16 bits are compared as 4 lanes of a
+  // single 64-bit word. Since k and v are compile-time constants all shifts
+  // and masks are folded for each instantiated width.
+  bool Match(size_t i, uint32_t fp) const {
+    assert(i < num_buckets_);
+    if (!port::kLittleEndian) {  // Bit-field layout differs
+      for (size_t j = 0; j < 4; j++) {
+        if (key(i, j) == fp) return true;
+      }
+      return false;
+    }
+    uint64_t w[4] = {0, 0, 0, 0};  // Up to 4 x 64 bits
+    memcpy(w, &b_[i], sizeof(b_[i]));
+    if (4 * kBits <= 64) {
+      const uint64_t lanes = kOnes * kLaneMask;  // All bits of all items
+      const uint64_t highs = kOnes << (kBits - 1);  // Top bit of each item
+      const uint64_t lows = lanes & ~highs;
+      const uint64_t keys = kOnes * (kLaneMask >> v << v);  // Key bits only
+      // Items equal to fp are zero after the xor
+      const uint64_t y = (w[0] ^ (kOnes * (uint64_t(fp) << v))) & keys;
+      // Set the top bit of each zero item without carrying into other items
+      return (~(((y & lows) + lows) | y | lows) & highs) != 0;
+    } else {
+      const uint64_t x0 = Item(w, 0) >> v;
+      const uint64_t x1 = Item(w, 1) >> v;
+      const uint64_t x2 = Item(w, 2) >> v;
+      const uint64_t x3 = Item(w, 3) >> v;
+      return ((x0 == fp) | (x1 == fp) | (x2 == fp) | (x3 == fp)) != 0;
+    }
+  }
+
   const CuckooBucket<k, v>* const b_;
   const uint32_t num_buckets_;
+
+ private:
+  static const size_t kBits = k + v;  // Bits per item
+  static const uint64_t kLaneMask = (kBits < 64 ? (1ull << kBits) - 1 : ~0ull);
+  // A one at the lowest bit of each item when 4 items fit in 64 bits
+  static const uint64_t kOnes =
+      4 * kBits <= 64 ? 1ull | (1ull << (kBits % 64)) |
+                            (1ull << (2 * kBits % 64)) |
+                            (1ull << (3 * kBits % 64))
+                      : 0;
+
+  // Return the j-th item of a bucket loaded as 64-bit words.
+  static uint64_t Item(const uint64_t* w, size_t j) {
+    const size_t start = j * kBits;
+    const size_t off = start % 64;
+    uint64_t x = w[start / 64] >> off;
+    if (off != 0 && off + kBits > 64) {
+      x |= w[start / 64 + 1] << (64 - off);
+    }
+    return x & kLaneMask;
+  }
 };
 
 template <size_t k = 16, size_t v = 16>
@@ -170,6 +228,10 @@ CuckooBlock<k, v>::CuckooBlock(const DirOptions& options,
                                size_t bytes_to_reserve)
     : max_cuckoo_moves_(options.cuckoo_max_moves),
       finished_(true),  // Reset(num_keys) must be called before inserts
+      scale_(1.0),
+      num_keys_(0),
+      expected_keys_(0),
+      last_num_keys_(0),
       rnd_(options.cuckoo_seed),
       rep_(NULL) {
   rep_ = new Rep(options.cuckoo_frac);
@@ -194,23 +256,54 @@ void CuckooBlock<k, v>::Reset(uint32_t num_keys) {
     delete morereps_[i];
   }
   morereps_.resize(0);
-  rep_->Reset(num_keys);
+  if (num_keys == 0) {
+    num_keys = last_num_keys_;
+  }
+  expected_keys_ = num_keys;
+  num_keys_ = 0;
+  rep_->Reset(static_cast<uint32_t>(ceil(scale_ * num_keys)));
   key_sizes_.resize(0);
   values_.resize(0);
   keys_.resize(0);
   finished_ = false;
 }
 
+// Learn from the batch just finished how far off the caller's key count
+// estimate was. On overflow, the next batch is sized for at least the
+// number of keys actually seen. Otherwise, the multiplier slowly decays
+// toward the observed ratio so that a single burst does not permanently
+// over-allocate the table.
+template <size_t k, size_t v>
+void CuckooBlock<k, v>::AdjustCapacity() {
+  static const double kMaxScale = 4.0;
+  last_num_keys_ = num_keys_;
+  if (expected_keys_ == 0) return;
+  const double ratio = double(num_keys_) / expected_keys_;
+  if (num_victims() != 0) {
+    scale_ = std::max(ratio, scale_);
+  } else {
+    scale_ = 0.5 * (scale_ + ratio);
+  }
+  scale_ = std::min(kMaxScale, std::max(1.0, scale_));
+}
+
 template <size_t k, size_t v>
 void CuckooBlock<k, v>::MaybeBuildMoreTables() {
   const uint32_t limit = static_cast<uint32_t>(key_sizes_.size());
   const char* start = &keys_[0];
 
+  // Size each auxiliary table below the occupancy at which the previous
+  // table failed so that the remaining keys likely fit in a single table
+  const Rep* prev = rep_;
+  uint32_t prev_keys = static_cast<uint32_t>(num_keys_ - limit);
   uint32_t i = 0;
   while (i != limit) {
-    Rep* r = new Rep(0.95);  // This is likely going to accommodate all keys
+    double frac = 0.9 * prev_keys / (4.0 * prev->num_buckets_);
+    if (rep_->frac_ > 0) frac = std::min(frac, rep_->frac_);
+    Rep* r = new Rep(std::max(frac, 0.5));
     r->Resize(limit - i);
 
+    const uint32_t begin = i;
     for (; i < limit; i++) {
       uint64_t ha = CuckooHash(Slice(start, key_sizes_[i]));
       uint32_t fp = CuckooFingerprint(ha, k);
@@ -222,9 +315,12 @@ void CuckooBlock<k, v>::MaybeBuildMoreTables() {
         AddTo(ha, fp, 0, r);
       }
       if (r->full_) {
+        i++;  // The victim is kept in the table's trailer
         break;
       }
     }
+    prev_keys = i - begin;
+    prev = r;
 
     PutFixed32(&r->space_, r->num_buckets_);
     PutFixed32(&r->space_, r->victim_index_);
@@ -246,6 +342,7 @@ Slice CuckooBlock<k, v>::Finish() {
   PutFixed32(&r->space_, r->victim_data_);
   PutFixed32(&r->space_, r->victim_fp_);
   MaybeBuildMoreTables();
+  AdjustCapacity();
   size_t i = 0;
   for (; i < morereps_.size(); i++) {
     r->space_.append(morereps_[i]->space_);
@@ -286,6 +383,7 @@ void CuckooBlock<k, v>::AddKey(const Slice& key, uint32_t value) {
   assert(!finished_);
   uint64_t ha = CuckooHash(key);
   uint32_t fp = CuckooFingerprint(ha, k);
+  num_keys_++;
   // If the main table is full, stage the key at an overflow space
   if (rep_->full_) {
     AddMore(key, value);
@@ -482,11 +580,7 @@ class CuckooKeyTester {
           values->push_back(kv2.second);
         }
       } else {  // Immediately return on first match
-        if (reader.key(i1, j) == fp) {
-          return true;
-        } else if (reader.key(i2, j) == fp) {
-          return true;
-        }
+        return reader.Match(i1, fp) || reader.Match(i2, fp);
       }
     }
 
@@ -31,6 +31,13 @@ inline uint64_t CuckooHash(const Slice& key) {
   return xxhash64(key.data(), key.size(), 0);
 }
 
+// Hash of a key within a directory's key-to-epoch index. The lowest 5 bits
+// are cleared to make room for an epoch number. See
+// DirOptions::key_epoch_index.
+inline uint64_t KeyEpochHash(const Slice& key) {
+  return CuckooHash(key) & ~static_cast<uint64_t>(31);
+}
+
 inline uint32_t CuckooFingerprint(uint64_t ha, size_t bits_per_key) {
   const size_t bits_to_move = 64 - bits_per_key;
   uint32_t fp = static_cast<uint32_t>(ha >> bits_to_move);
@@ -57,6 +64,11 @@ class CuckooBlock {
   CuckooBlock(const DirOptions& options, size_t bytes_to_reserve);
   ~CuckooBlock();
 
+  // Prepare the filter for a new batch of keys. "num_keys" is the expected
+  // number of keys to insert. The actual table capacity is scaled by a
+  // factor learned from previous batches so that a writer whose key counts
+  // are consistently underestimated stops overflowing into auxiliary
+  // tables. Use the previous batch's key count if "num_keys" is 0.
   void Reset(uint32_t num_keys);
 
   // Insert a key into the cuckoo filter. Keys are first inserted to the
@@ -81,6 +93,8 @@ class CuckooBlock {
 
   size_t num_victims() const;  // #keys not inserted to the main table
 
+  double TEST_CapacityScale() const { return scale_; }
+
   size_t TEST_BytesPerCuckooBucket() const;
   size_t TEST_NumCuckooTables() const;
   size_t TEST_NumBuckets() const;
@@ -91,9 +105,16 @@ class CuckooBlock {
   std::string keys_;
   const int max_cuckoo_moves_;
   bool finished_;  // If Finish() has been called
+  // Capacity multiplier applied to the "num_keys" passed to Reset().
+  // Adjusted at the end of each batch from the observed key count.
+  double scale_;
+  uint32_t num_keys_;        // #keys inserted since the last Reset()
+  uint32_t expected_keys_;   // The "num_keys" passed to the last Reset()
+  uint32_t last_num_keys_;   // #keys inserted into the previous batch
   Random rnd_;
 
   void MaybeBuildMoreTables();
+  void AdjustCapacity();
   void AddMore(const Slice& key, uint32_t value);
   typedef CuckooTable<k, v> Rep;
   void operator=(const CuckooBlock& cuckoo);  // No copying allowed
@@ -126,6 +126,51 @@ TEST(CuckooFtTest, AddAndMatch) {
   }
 }
 
+// Insert keys into a cuckoo filter of a given width and check that all
+// inserted keys match and that non-keys match at about the expected rate.
+template <size_t k, size_t v>
+static void TEST_MatchWidth(uint32_t num_keys) {
+  DirOptions options;
+  CuckooBlock<k, v> cf(options, 0);
+  cf.Reset(num_keys);
+  char tmp[4];
+  for (uint32_t i = 0; i < num_keys; i++) {
+    EncodeFixed32(tmp, i);
+    cf.AddKey(Slice(tmp, sizeof(tmp)), i);
+  }
+  const std::string data = cf.TEST_Finish();
+  for (uint32_t i = 0; i < num_keys; i++) {
+    EncodeFixed32(tmp, i);
+    ASSERT_TRUE(CuckooKeyMayMatch(Slice(tmp, sizeof(tmp)), data));
+  }
+  uint32_t fps = 0;
+  for (uint32_t i = num_keys; i < 2 * num_keys; i++) {
+    EncodeFixed32(tmp, i);
+    if (CuckooKeyMayMatch(Slice(tmp, sizeof(tmp)), data)) fps++;
+  }
+  // At most 8 fingerprints are compared per table
+  const double expected = std::min(1.0, 8.0 / (1u << k));
+  fprintf(stderr, "k=%2d v=%2d: %.4f%% false positives (%.4f%% max)\n",
+          int(k), int(v), 100.0 * fps / num_keys, 100.0 * expected);
+  ASSERT_TRUE(fps <= 2 * expected * num_keys + 10);
+  if (k >= 8) {
+    ASSERT_TRUE(fps < num_keys / 2);
+  }
+}
+
+TEST(CuckooFtTest, MatchWidths) {
+  TEST_MatchWidth<16, 0>(64 << 10);
+  TEST_MatchWidth<14, 0>(64 << 10);
+  TEST_MatchWidth<20, 0>(64 << 10);
+  TEST_MatchWidth<28, 0>(64 << 10);
+  TEST_MatchWidth<16, 32>(64 << 10);
+  TEST_MatchWidth<28, 32>(64 << 10);
+  TEST_MatchWidth<8, 24>(64 << 10);
+  TEST_MatchWidth<8, 10>(64 << 10);
+  TEST_MatchWidth<4, 12>(64 << 10);
+  TEST_MatchWidth<4, 10>(64 << 10);
+}
+
 class CuckooAuxTest : public CuckooFtTest {
  public:
   void AddKey(uint32_t k) {
@@ -156,6 +201,38 @@ TEST(CuckooAuxTest, AuxiliaryTables) {
   }
 }
 
+// Key counts consistently larger than the caller's estimate should only
+// spill into auxiliary tables until the filter learns the actual count.
+TEST(CuckooAuxTest, AdaptiveCapacity) {
+  const uint32_t expected_keys = 16 << 10;
+  const uint32_t num_keys = 40 << 10;
+  for (int epoch = 0; epoch < 4; epoch++) {
+    Reset(expected_keys);
+    uint32_t k = 0;
+    for (; k < num_keys; k++) {
+      AddKey(k);
+    }
+    Finish();
+    fprintf(stderr, "Epoch %d: %.2fx capacity, %+d aux tables\n", epoch,
+            cf_->TEST_CapacityScale(), int(cf_->TEST_NumCuckooTables()) - 1);
+    if (epoch == 0) {
+      ASSERT_TRUE(cf_->TEST_NumCuckooTables() > 1);
+    } else {
+      ASSERT_EQ(cf_->TEST_NumCuckooTables(), 1);
+    }
+    for (uint32_t j = 0; j < k; j++) {
+      ASSERT_TRUE(KeyMayMatch(j));
+    }
+  }
+  // A zero estimate reuses the previous batch's key count
+  Reset(0);
+  for (uint32_t k = 0; k < num_keys; k++) {
+    AddKey(k);
+  }
+  Finish();
+  ASSERT_EQ(cf_->TEST_NumCuckooTables(), 1);
+}
+
 class CuckooKvTest : public CuckooTest {
  public:
   CuckooKvTest() {
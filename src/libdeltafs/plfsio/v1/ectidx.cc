@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "ectidx.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/pdlfs_config.h"
+#if defined(PDLFS_SILT_ECT)
+#include "pdlfs-common/ect.h"
+#endif
+
+#include <algorithm>
+
+namespace pdlfs {
+namespace plfsio {
+
+bool SplitTableIndex(const Slice& contents, Slice* index, Slice* ect) {
+  if (contents.size() < 4) {
+    return false;
+  }
+  const uint32_t n = DecodeFixed32(contents.data() + contents.size() - 4);
+  if (n > contents.size() - 4) {
+    return false;
+  }
+  const size_t index_size = contents.size() - 4 - n;
+  *index = Slice(contents.data(), index_size);
+  *ect = Slice(contents.data() + index_size, n);
+  return true;
+}
+
+bool GetRestartEntryValue(const Slice& block, uint32_t i, Slice* value) {
+  if (block.size() < 4) {
+    return false;
+  }
+  const uint32_t num_restarts = DecodeFixed32(block.data() + block.size() - 4);
+  if (i >= num_restarts || (uint64_t(num_restarts) + 1) * 4 > block.size()) {
+    return false;
+  }
+  const size_t restarts = block.size() - (1 + num_restarts) * 4;
+  const uint32_t offset = DecodeFixed32(block.data() + restarts + 4 * i);
+  if (offset >= restarts) {
+    return false;
+  }
+  Slice input(block.data() + offset, restarts - offset);
+  uint32_t shared, non_shared, value_length;
+  if (!GetVarint32(&input, &shared) || !GetVarint32(&input, &non_shared) ||
+      !GetVarint32(&input, &value_length) || shared != 0 ||
+      input.size() < uint64_t(non_shared) + value_length) {
+    return false;
+  }
+  *value = Slice(input.data() + non_shared, value_length);
+  return true;
+}
+
+#if defined(PDLFS_SILT_ECT)
+namespace {
+// Target number of keys per bucket. Lookups decode one bucket's trie so
+// larger buckets save space at the cost of slower lookups.
+const size_t kEctKeysPerBucket = 128;
+const size_t kMaxEctLgBuckets = 20;
+
+// Return the len bits of key starting at bit start. Bits are numbered from
+// the most significant bit of the first byte so that bits of sorted keys
+// compare in key order.
+uint32_t GetBits(const Slice& key, size_t start, size_t len) {
+  uint32_t result = 0;
+  for (size_t i = start; i < start + len; i++) {
+    const unsigned char byte = static_cast<unsigned char>(key[i / 8]);
+    result = (result << 1) | ((byte >> (7 - i % 8)) & 1);
+  }
+  return result;
+}
+
+// Return the number of leading bits shared by two keys of the same size.
+size_t SharedBits(const Slice& a, const Slice& b) {
+  size_t i = 0;
+  while (i < a.size() && a[i] == b[i]) i++;
+  if (i == a.size()) {
+    return 8 * i;
+  }
+  const unsigned char x =
+      static_cast<unsigned char>(a[i]) ^ static_cast<unsigned char>(b[i]);
+  size_t bits = 8 * i;
+  for (unsigned char mask = 0x80; (x & mask) == 0; mask >>= 1) bits++;
+  return bits;
+}
+}  // namespace
+#endif
+
+void BuildEctIndex(size_t key_size, const Slice& keys,
+                   const std::vector<uint32_t>& block_ends, std::string* dst) {
+#if defined(PDLFS_SILT_ECT)
+  const size_t n = key_size != 0 ? keys.size() / key_size : 0;
+  if (n == 0 || block_ends.empty()) {
+    return;
+  }
+  const Slice first(keys.data(), key_size);
+  const Slice last(keys.data() + (n - 1) * key_size, key_size);
+  const size_t skip_bits = SharedBits(first, last);
+  size_t lg_buckets = 0;
+  while ((n >> lg_buckets) > kEctKeysPerBucket &&
+         lg_buckets < kMaxEctLgBuckets &&
+         skip_bits + lg_buckets < 8 * key_size) {
+    lg_buckets++;
+  }
+  const size_t num_buckets = size_t(1) << lg_buckets;
+  PutFixed32(dst, static_cast<uint32_t>(block_ends.size()));
+  PutFixed32(dst, static_cast<uint32_t>(skip_bits));
+  PutFixed32(dst, static_cast<uint32_t>(lg_buckets));
+  uint32_t rank = 0;
+  for (size_t i = 0; i < block_ends.size(); i++) {
+    PutFixed32(dst, rank);
+    rank = block_ends[i];
+  }
+  // Keys share their first skip_bits bits, so the bucket bits that follow
+  // never decrease over sorted keys and each bucket is a range of ranks
+  std::vector<uint32_t> starts(num_buckets + 1);
+  size_t j = 0;
+  for (size_t b = 0; b < num_buckets; b++) {
+    starts[b] = static_cast<uint32_t>(j);
+    while (j < n && GetBits(Slice(keys.data() + j * key_size, key_size),
+                            skip_bits, lg_buckets) == b) {
+      j++;
+    }
+  }
+  starts[num_buckets] = static_cast<uint32_t>(n);
+  std::string tries;
+  std::vector<uint32_t> offsets(num_buckets + 1);
+  std::vector<Slice> tmp;
+  for (size_t b = 0; b < num_buckets; b++) {
+    offsets[b] = static_cast<uint32_t>(tries.size());
+    const size_t m = starts[b + 1] - starts[b];
+    if (m > 1) {  // Single keys have rank 0 and need no trie
+      tmp.resize(m);
+      for (size_t k = 0; k < m; k++) {
+        tmp[k] = Slice(keys.data() + (starts[b] + k) * key_size, key_size);
+      }
+      ECT* const trie = ECT::Default(key_size, m, &tmp[0]);
+      trie->EncodeTo(&tries);
+      delete trie;
+    }
+  }
+  offsets[num_buckets] = static_cast<uint32_t>(tries.size());
+  for (size_t b = 0; b <= num_buckets; b++) {
+    PutFixed32(dst, starts[b]);
+  }
+  for (size_t b = 0; b <= num_buckets; b++) {
+    PutFixed32(dst, offsets[b]);
+  }
+  dst->append(tries);
+#endif
+}
+
+bool EctFindBlock(size_t key_size, const Slice& ect, const Slice& key,
+                  uint32_t* block) {
+#if defined(PDLFS_SILT_ECT)
+  if (key.size() != key_size || ect.size() < 12) {
+    return false;
+  }
+  const char* const p = ect.data();
+  const uint32_t num_blocks = DecodeFixed32(p);
+  const uint32_t skip_bits = DecodeFixed32(p + 4);
+  const uint32_t lg_buckets = DecodeFixed32(p + 8);
+  if (num_blocks == 0 || lg_buckets > kMaxEctLgBuckets ||
+      uint64_t(skip_bits) + lg_buckets > 8 * key_size) {
+    return false;
+  }
+  const size_t num_buckets = size_t(1) << lg_buckets;
+  const uint64_t header =
+      12 + 4 * uint64_t(num_blocks) + 8 * (num_buckets + 1);
+  if (ect.size() < header) {
+    return false;
+  }
+  const char* const block_starts = p + 12;
+  const char* const bucket_starts = block_starts + 4 * num_blocks;
+  const char* const offsets = bucket_starts + 4 * (num_buckets + 1);
+  const uint32_t b = GetBits(key, skip_bits, lg_buckets);
+  uint32_t rank = DecodeFixed32(bucket_starts + 4 * b);
+  const uint32_t limit = DecodeFixed32(bucket_starts + 4 * (b + 1));
+  if (limit < rank) {
+    return false;
+  }
+  const uint32_t m = limit - rank;
+  if (m > 1) {
+    const uint32_t start = DecodeFixed32(offsets + 4 * b);
+    const uint32_t end = DecodeFixed32(offsets + 4 * (b + 1));
+    if (start > end || header + end > ect.size()) {
+      return false;
+    }
+    ECT* const trie =
+        ECT::Decode(key_size, m, Slice(p + header + start, end - start));
+    if (trie == NULL) {
+      return false;
+    }
+    rank += static_cast<uint32_t>(std::min<size_t>(trie->Find(key), m - 1));
+    delete trie;
+  }
+  // Find the last block whose first rank is no greater than the key's rank
+  uint32_t lo = 0;
+  uint32_t hi = num_blocks - 1;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo + 1) / 2;
+    if (DecodeFixed32(block_starts + 4 * mid) <= rank) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  *block = lo;
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
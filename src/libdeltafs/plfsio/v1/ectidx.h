@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "pdlfs-common/slice.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+namespace plfsio {
+
+// When DirOptions::ect_index is in effect, the index block of each table is
+// stored as
+//
+//   index block contents | ect data | ect data size (fixed32)
+//
+// ECT data maps each key of the table to its rank within the table through
+// entropy-coded tries (ECTs), and ranks to data blocks through the rank of
+// the first key of each block. Keys are spread over 2^lg_buckets buckets by
+// the lg_buckets bits following the bits shared by all keys of the table,
+// and each bucket has its own trie so a lookup only decodes a small trie:
+//
+//   num_blocks (fixed32) | skip_bits (fixed32) | lg_buckets (fixed32)
+//   first rank of each data block (fixed32 * num_blocks)
+//   first rank of each bucket (fixed32 * (num_buckets + 1))
+//   offset of each bucket's trie (fixed32 * (num_buckets + 1))
+//   bucket tries
+//
+// ECT data is empty if no tries were built, such as when the writer was not
+// compiled with PDLFS_SILT_ECT.
+//
+// When DirOptions::key_index is in effect, the same trailer layout holds a
+// cuckoo hash table in place of the ect data. See cuckoo.h.
+
+// Split the contents of a table index block into the index block proper and
+// the trailer (ect data or a key index) that follows it. Return false if the
+// contents are malformed.
+extern bool SplitTableIndex(const Slice& contents, Slice* index,
+                            Slice* trailer);
+
+// Append the ect data of a table to *dst. Keys are the n sorted, unique keys
+// of the table, each key_size bytes, stored back to back. block_ends[i] is
+// the rank following the last key of data block i. Nothing is appended if
+// tries are not compiled in.
+extern void BuildEctIndex(size_t key_size, const Slice& keys,
+                          const std::vector<uint32_t>& block_ends,
+                          std::string* dst);
+
+// Find the data block that holds a given key if the key is in the table.
+// If the key is not in the table, an arbitrary block may be returned.
+// REQUIRES: the key is within the key range of the table.
+// Return false if no block can be determined from the ect data.
+extern bool EctFindBlock(size_t key_size, const Slice& ect, const Slice& key,
+                         uint32_t* block);
+
+// Return the value of the i-th entry of a block that has a restart point at
+// every entry, such as a table index block. Return false if there is no such
+// entry.
+extern bool GetRestartEntryValue(const Slice& block, uint32_t i,
+                                 Slice* value);
+
+}  // namespace plfsio
+}  // namespace pdlfs
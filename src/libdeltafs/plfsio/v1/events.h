@@ -17,7 +17,14 @@
 namespace pdlfs {
 namespace plfsio {
 
-enum EventType { kCompactionStart, kCompactionEnd, kIoStart, kIoEnd };
+enum EventType {
+  kCompactionStart,
+  kCompactionEnd,
+  kIoStart,
+  kIoEnd,
+  kWritePressureHigh,
+  kWritePressureLow
+};
 
 struct CompactionEvent {
   EventType type;  // Event type
@@ -35,6 +42,23 @@ struct IoEvent {
   uint64_t micros;
 };
 
+// Reported with kWritePressureHigh when a memtable partition has used up all
+// its spare write buffers, so writers will block once the current buffer is
+// full, and with kWritePressureLow when a compaction frees a buffer again.
+// These events are delivered with the partition lock held. Listeners must
+// return quickly and must not call back into the directory.
+struct WritePressureEvent {
+  EventType type;  // Event type
+
+  size_t part;  // Memtable partition index
+
+  // Number of full write buffers waiting to be, or being, compacted
+  size_t pending_compactions;
+
+  // Current time micros
+  uint64_t micros;
+};
+
 class EventListener {
  public:
   EventListener() {}
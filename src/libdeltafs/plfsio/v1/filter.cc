@@ -13,7 +13,11 @@
 #include "format.h"
 #include "types.h"
 
+#include "pdlfs-common/mutexlock.h"
+
 #include <assert.h>
+#include <math.h>
+#include <string.h>
 #include <algorithm>
 
 #include <typeinfo>  // For operator typeid
@@ -55,8 +59,28 @@ unsigned char LeftMostBit(uint32_t i) {
 #endif
   return result;
 }
+
+// True if bitmap lookups should use the reference byte- and bit-at-a-time
+// decoders instead of the word-at-a-time kernels below.
+bool scalar_bitmap_decoding = false;
+
+// Return true if any of the 8 bytes of w is 0xff.
+inline bool HasFullByte(uint64_t w) {
+  const uint64_t x = ~w;  // Turn 0xff into 0x00
+  return ((x - 0x0101010101010101ull) & ~x & 0x8080808080808080ull) != 0;
+}
+
+// Return the sum of the 8 bytes of w.
+inline uint32_t SumBytes(uint64_t w) {
+  w = (w & 0x00ff00ff00ff00ffull) + ((w >> 8) & 0x00ff00ff00ff00ffull);
+  return static_cast<uint32_t>((w * 0x0001000100010001ull) >> 48);
+}
 }  // namespace
 
+void TEST_SetScalarBitmapDecoding(bool scalar) {
+  scalar_bitmap_decoding = scalar;
+}
+
 BloomBlock::BloomBlock(const DirOptions& options, size_t bytes_to_reserve)
     : bits_per_key_(options.bf_bits_per_key) {
   k_ = static_cast<uint32_t>(bits_per_key_ * 0.69) + 1;  // 0.69 =~ ln(2)
@@ -76,7 +100,13 @@ int BloomBlock::chunk_type() {
 }
 
 void BloomBlock::Reset(uint32_t num_keys) {
-  bits_ = static_cast<uint32_t>(num_keys * bits_per_key_);
+  Reset(num_keys, static_cast<double>(bits_per_key_));
+}
+
+void BloomBlock::Reset(uint32_t num_keys, double bits_per_key) {
+  k_ = static_cast<uint32_t>(bits_per_key * 0.69) + 1;  // 0.69 =~ ln(2)
+  if (k_ > 30) k_ = 30;
+  bits_ = static_cast<uint32_t>(num_keys * bits_per_key);
   // For small n, we can see a very high false positive rate.
   // Fix it by enforcing a minimum bloom filter length.
   if (bits_ < 64) {
@@ -116,6 +146,9 @@ Slice BloomBlock::Finish() {
   return space_;
 }
 
+// Bit in the encoded k that marks a cache-line blocked bloom filter.
+static const unsigned char kBlockedBloomMarker = 0x80;
+
 bool BloomKeyMayMatch(const Slice& key, const Slice& input) {
   const size_t len = input.size();
   if (len < 2) {
@@ -128,6 +161,9 @@ bool BloomKeyMayMatch(const Slice& key, const Slice& input) {
   // bloom filters created using different parameters.
   const uint32_t k = static_cast<unsigned char>(array[len - 1]);
   if (k > 30) {
+    if ((k & kBlockedBloomMarker) != 0) {
+      return BlockedBloomKeyMayMatch(key, input);
+    }
     // Reserved for potentially new encodings for short bloom filters.
     // Consider it a match.
     return true;
@@ -147,6 +183,458 @@ bool BloomKeyMayMatch(const Slice& key, const Slice& input) {
   return true;
 }
 
+BlockedBloomBlock::BlockedBloomBlock(const DirOptions& options,
+                                     size_t bytes_to_reserve)
+    : bits_per_key_(options.bf_bits_per_key) {
+  k_ = static_cast<uint32_t>(bits_per_key_ * 0.69) + 1;  // 0.69 =~ ln(2)
+  if (k_ > 30) k_ = 30;
+  // Reserve an extra byte for storing the k
+  if (bytes_to_reserve != 0) {
+    space_.reserve(bytes_to_reserve + kLineSize + 1);
+  }
+  finished_ = true;  // Pending further initialization
+  lines_ = 0;
+}
+
+BlockedBloomBlock::~BlockedBloomBlock() {}
+
+int BlockedBloomBlock::chunk_type() {
+  return static_cast<int>(kSbfChunk);  // Same layout as standard bloom filters
+}
+
+void BlockedBloomBlock::Reset(uint32_t num_keys) {
+  Reset(num_keys, static_cast<double>(bits_per_key_));
+}
+
+void BlockedBloomBlock::Reset(uint32_t num_keys, double bits_per_key) {
+  k_ = static_cast<uint32_t>(bits_per_key * 0.69) + 1;  // 0.69 =~ ln(2)
+  if (k_ > 30) k_ = 30;
+  const uint32_t bits = static_cast<uint32_t>(num_keys * bits_per_key);
+  lines_ = (bits + kLineSize * 8 - 1) / (kLineSize * 8);
+  if (lines_ == 0) {
+    lines_ = 1;
+  }
+  finished_ = false;
+  space_.clear();
+  space_.resize(lines_ * kLineSize, 0);
+  // Remember # of probes in filter
+  space_.push_back(static_cast<char>(k_ | kBlockedBloomMarker));
+}
+
+namespace {
+// Obtain the cache line of a key and the seed for its in-line bit positions.
+// Lines are picked by a multiply-shift from the low 32 bits of the key hash
+// and bit positions are derived by double-hashing the high 32 bits.
+inline uint32_t BlockedBloomLine(uint64_t hx, uint32_t lines) {
+  return static_cast<uint32_t>((static_cast<uint64_t>(uint32_t(hx)) * lines) >>
+                               32);
+}
+
+// Compute the in-line bitmask of a key.
+inline void BlockedBloomMask(uint64_t hx, uint32_t k, unsigned char* mask) {
+  memset(mask, 0, BlockedBloomBlock::kLineSize);
+  uint32_t h = static_cast<uint32_t>(hx >> 32);
+  const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
+  for (uint32_t j = 0; j < k; j++) {
+    const uint32_t b = h & (BlockedBloomBlock::kLineSize * 8 - 1);
+    mask[b / 8] |= static_cast<unsigned char>(1 << (b % 8));
+    h += delta;
+  }
+}
+}  // namespace
+
+void BlockedBloomBlock::AddKey(const Slice& key) {
+  assert(!finished_);  // Finish() has not been called
+  const uint64_t hx = BloomHash(key);
+  unsigned char mask[kLineSize];
+  BlockedBloomMask(hx, k_, mask);
+  char* const line = &space_[BlockedBloomLine(hx, lines_) * kLineSize];
+  for (size_t i = 0; i < kLineSize; i++) {
+    line[i] |= mask[i];
+  }
+}
+
+Slice BlockedBloomBlock::Finish() {
+  assert(!finished_);
+  finished_ = true;
+  return space_;
+}
+
+bool BlockedBloomKeyMayMatch(const Slice& key, const Slice& input) {
+  const size_t kLineSize = BlockedBloomBlock::kLineSize;
+  const size_t len = input.size();
+  if (len < kLineSize + 1 || (len - 1) % kLineSize != 0) {
+    return true;  // Consider it a match
+  }
+  const uint32_t lines = static_cast<uint32_t>((len - 1) / kLineSize);
+  const unsigned char* const array =
+      reinterpret_cast<const unsigned char*>(input.data());
+  if ((array[len - 1] & kBlockedBloomMarker) == 0) {
+    return BloomKeyMayMatch(key, input);
+  }
+  const uint32_t k = array[len - 1] & ~kBlockedBloomMarker;
+  if (k > 30) {
+    return true;  // Reserved for future encodings
+  }
+
+  const uint64_t hx = BloomHash(key);
+  unsigned char mask[BlockedBloomBlock::kLineSize];
+  BlockedBloomMask(hx, k, mask);
+  const unsigned char* const line =
+      array + BlockedBloomLine(hx, lines) * kLineSize;
+  // Branch-free check of the entire line so that the compiler may vectorize
+  // it into a few wide loads and compares
+  unsigned char missing = 0;
+  for (size_t i = 0; i < kLineSize; i++) {
+    missing |= mask[i] & ~line[i];
+  }
+  return missing == 0;
+}
+
+namespace {
+// Mix a key hash with a construction seed using the 64-bit finalizer of
+// MurmurHash3 so that each seed gives an independent set of slots.
+inline uint64_t XorMix(uint64_t h, uint32_t seed) {
+  h += static_cast<uint64_t>(seed) * 0x9e3779b97f4a7c15ull;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+inline unsigned char XorFingerprint(uint64_t h) {
+  return static_cast<unsigned char>(h ^ (h >> 32));
+}
+
+// Return the slot of a mixed hash in the i-th of the 3 filter segments.
+inline uint32_t XorSlot(uint64_t h, int i, uint32_t block_length) {
+  const uint64_t r = i == 0 ? h : ((h << (21 * i)) | (h >> (64 - 21 * i)));
+  const uint32_t x = static_cast<uint32_t>(r);
+  return static_cast<uint32_t>((static_cast<uint64_t>(x) * block_length) >>
+                               32) +
+         i * block_length;
+}
+}  // namespace
+
+XorFilterBlock::XorFilterBlock(const DirOptions& options,
+                               size_t bytes_to_reserve) {
+  // Reserve extra 9 bytes for storing the filter trailer
+  if (bytes_to_reserve != 0) {
+    space_.reserve(bytes_to_reserve + 9);
+  }
+  finished_ = true;  // Pending further initialization
+}
+
+XorFilterBlock::~XorFilterBlock() {}
+
+int XorFilterBlock::chunk_type() {
+  return static_cast<int>(kXorChunk);  // Xor filters
+}
+
+void XorFilterBlock::Reset(uint32_t num_keys) {
+  finished_ = false;
+  space_.clear();
+  hashes_.clear();
+  hashes_.reserve(num_keys);
+}
+
+void XorFilterBlock::AddKey(const Slice& key) {
+  assert(!finished_);  // Finish() has not been called
+  hashes_.push_back(BloomHash(key));
+}
+
+// Try building the filter using a given seed. Keys are mapped to 3 slots,
+// one per segment, and slots referenced by a single key are repeatedly
+// peeled off. Construction succeeds if all keys are peeled, in which case
+// fingerprints are assigned in the reverse peeling order such that the
+// fingerprints of the 3 slots of each key xor to the key's fingerprint.
+bool XorFilterBlock::Build(uint32_t seed, uint32_t block_length) {
+  const uint32_t capacity = 3 * block_length;
+  slot_hashes_.assign(capacity, 0);
+  slot_counts_.assign(capacity, 0);
+  for (size_t j = 0; j < hashes_.size(); j++) {
+    const uint64_t h = XorMix(hashes_[j], seed);
+    for (int i = 0; i < 3; i++) {
+      const uint32_t s = XorSlot(h, i, block_length);
+      slot_hashes_[s] ^= h;
+      slot_counts_[s]++;
+    }
+  }
+  queue_.clear();
+  for (uint32_t s = 0; s < capacity; s++) {
+    if (slot_counts_[s] == 1) {
+      queue_.push_back(s);
+    }
+  }
+  stack_.clear();
+  while (!queue_.empty()) {
+    const uint32_t s = queue_.back();
+    queue_.pop_back();
+    if (slot_counts_[s] != 1) {
+      continue;
+    }
+    const uint64_t h = slot_hashes_[s];
+    stack_.push_back(std::make_pair(h, s));
+    for (int i = 0; i < 3; i++) {
+      const uint32_t t = XorSlot(h, i, block_length);
+      slot_hashes_[t] ^= h;
+      if (--slot_counts_[t] == 1) {
+        queue_.push_back(t);
+      }
+    }
+  }
+  if (stack_.size() != hashes_.size()) {
+    return false;
+  }
+
+  space_.resize(capacity, 0);
+  unsigned char* const fp = reinterpret_cast<unsigned char*>(&space_[0]);
+  for (size_t j = stack_.size(); j != 0; j--) {
+    const uint64_t h = stack_[j - 1].first;
+    const uint32_t s = stack_[j - 1].second;
+    fp[s] = XorFingerprint(h) ^ fp[XorSlot(h, 0, block_length)] ^
+            fp[XorSlot(h, 1, block_length)] ^ fp[XorSlot(h, 2, block_length)];
+  }
+  return true;
+}
+
+Slice XorFilterBlock::Finish() {
+  assert(!finished_);
+  finished_ = true;
+  // Duplicated keys would prevent the construction from succeeding
+  std::sort(hashes_.begin(), hashes_.end());
+  hashes_.erase(std::unique(hashes_.begin(), hashes_.end()), hashes_.end());
+  uint32_t block_length = 0;
+  uint32_t seed = 0;
+  if (!hashes_.empty()) {
+    block_length = static_cast<uint32_t>(
+        (32 + static_cast<uint64_t>(ceil(1.23 * hashes_.size()))) / 3);
+    while (!Build(seed, block_length)) {
+      seed++;
+      // Each attempt fails with a small constant probability. Enlarge the
+      // filter if we have been unlucky for too long.
+      if (seed % 16 == 0) {
+        block_length += block_length / 16 + 1;
+      }
+    }
+  }
+  PutFixed32(&space_, block_length);
+  PutFixed32(&space_, seed);
+  space_.push_back(8);  // Fingerprint bits
+  return space_;
+}
+
+bool XorKeyMayMatch(const Slice& key, const Slice& input) {
+  const size_t len = input.size();
+  if (len < 9 || input[len - 1] != 8) {
+    return true;  // Consider it a match
+  }
+  const uint32_t block_length = DecodeFixed32(input.data() + len - 9);
+  const uint32_t seed = DecodeFixed32(input.data() + len - 5);
+  if (3 * static_cast<uint64_t>(block_length) + 9 != len) {
+    return true;
+  } else if (block_length == 0) {
+    return false;  // Empty filter
+  }
+
+  const uint64_t h = XorMix(BloomHash(key), seed);
+  const unsigned char* const fp =
+      reinterpret_cast<const unsigned char*>(input.data());
+  return (XorFingerprint(h) ^ fp[XorSlot(h, 0, block_length)] ^
+          fp[XorSlot(h, 1, block_length)] ^
+          fp[XorSlot(h, 2, block_length)]) == 0;
+}
+
+namespace {
+// Return the upper 64 bits of the 128-bit product of a and b.
+inline uint64_t MulHi64(uint64_t a, uint64_t b) {
+  const uint64_t a_lo = static_cast<uint32_t>(a);
+  const uint64_t a_hi = a >> 32;
+  const uint64_t b_lo = static_cast<uint32_t>(b);
+  const uint64_t b_hi = b >> 32;
+  const uint64_t hi_lo = a_hi * b_lo;
+  const uint64_t cross =
+      ((a_lo * b_lo) >> 32) + static_cast<uint32_t>(hi_lo) + a_lo * b_hi;
+  return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+}
+
+// Map a key to [0, range).
+inline uint64_t GcsHash(const Slice& key, uint64_t range) {
+  return MulHi64(XorMix(BloomHash(key), 0), range);
+}
+
+// Append bits to a string, most significant bit first.
+class GcsBitWriter {
+ public:
+  explicit GcsBitWriter(std::string* dst) : dst_(dst), buf_(0), n_(0) {}
+
+  // REQUIRES: n <= 32
+  void Write(uint64_t v, uint32_t n) {
+    buf_ = (buf_ << n) | (v & ((uint64_t(1) << n) - 1));
+    n_ += n;
+    while (n_ >= 8) {
+      n_ -= 8;
+      dst_->push_back(static_cast<char>(buf_ >> n_));
+    }
+  }
+
+  // Write q in unary as q 1s followed by a 0.
+  void WriteUnary(uint64_t q) {
+    for (; q >= 32; q -= 32) Write(~uint64_t(0), 32);
+    Write(((uint64_t(1) << q) - 1) << 1, uint32_t(q) + 1);
+  }
+
+  // Pad the last byte with 0s.
+  void Flush() {
+    if (n_ != 0) Write(0, 8 - n_);
+  }
+
+ private:
+  std::string* dst_;
+  uint64_t buf_;
+  uint32_t n_;  // Number of pending bits in buf_
+};
+
+inline bool GcsBit(const unsigned char* bits, uint64_t i) {
+  return (bits[i >> 3] >> (7 - (i & 7))) & 1;
+}
+}  // namespace
+
+GcsFilterBlock::GcsFilterBlock(const DirOptions& options,
+                               size_t bytes_to_reserve)
+    : fp_bits_(static_cast<uint32_t>(
+          std::max<size_t>(1, std::min<size_t>(options.gcs_fp_bits, 32)))) {
+  // Reserve extra 13 bytes for storing the filter trailer
+  if (bytes_to_reserve != 0) {
+    space_.reserve(bytes_to_reserve + 13);
+  }
+  finished_ = true;  // Pending further initialization
+}
+
+GcsFilterBlock::~GcsFilterBlock() {}
+
+int GcsFilterBlock::chunk_type() {
+  return static_cast<int>(kGcsChunk);  // Golomb-coded sets
+}
+
+void GcsFilterBlock::Reset(uint32_t num_keys) {
+  finished_ = false;
+  space_.clear();
+  hashes_.clear();
+  hashes_.reserve(num_keys);
+}
+
+void GcsFilterBlock::AddKey(const Slice& key) {
+  assert(!finished_);  // Finish() has not been called
+  hashes_.push_back(XorMix(BloomHash(key), 0));
+}
+
+Slice GcsFilterBlock::Finish() {
+  assert(!finished_);
+  finished_ = true;
+  // Duplicated keys would otherwise inflate the hash range
+  std::sort(hashes_.begin(), hashes_.end());
+  hashes_.erase(std::unique(hashes_.begin(), hashes_.end()), hashes_.end());
+  // Spreading keys over about 1.5 * 2^p values rather than 2^p lowers the
+  // false positive rate by more than it adds to Rice-coded gaps
+  const uint64_t range =
+      static_cast<uint64_t>(hashes_.size()) *
+      static_cast<uint64_t>(1.497137 * static_cast<double>(1ull << fp_bits_));
+  // Mapping preserves order but may map different hashes to the same value
+  for (size_t i = 0; i < hashes_.size(); i++) {
+    hashes_[i] = MulHi64(hashes_[i], range);
+  }
+  hashes_.erase(std::unique(hashes_.begin(), hashes_.end()), hashes_.end());
+  const uint32_t lg_width = fp_bits_ + kLgBucketWidth;
+  const uint32_t num_buckets =
+      range != 0 ? static_cast<uint32_t>(((range - 1) >> lg_width) + 1) : 0;
+  offsets_.clear();
+  offsets_.reserve(num_buckets + 1);
+  GcsBitWriter writer(&space_);
+  uint64_t bits = 0;
+  size_t j = 0;
+  for (uint32_t b = 0; b < num_buckets; b++) {
+    offsets_.push_back(static_cast<uint32_t>(bits));
+    // Gaps are taken from the start of the bucket
+    uint64_t prev = static_cast<uint64_t>(b) << lg_width;
+    for (; j < hashes_.size() && (hashes_[j] >> lg_width) == b; j++) {
+      const uint64_t gap = hashes_[j] - prev;
+      const uint64_t q = gap >> fp_bits_;
+      writer.WriteUnary(q);
+      writer.Write(gap, fp_bits_);
+      bits += q + 1 + fp_bits_;
+      prev = hashes_[j];
+    }
+  }
+  offsets_.push_back(static_cast<uint32_t>(bits));
+  writer.Flush();
+  for (size_t i = 0; i < offsets_.size(); i++) {
+    PutFixed32(&space_, offsets_[i]);
+  }
+  PutFixed64(&space_, range);
+  PutFixed32(&space_, num_buckets);
+  space_.push_back(static_cast<char>(fp_bits_));
+  return space_;
+}
+
+bool GcsKeyMayMatch(const Slice& key, const Slice& input) {
+  const size_t len = input.size();
+  if (len < 13) {
+    return true;  // Consider it a match
+  }
+  const uint32_t fp_bits = static_cast<unsigned char>(input[len - 1]);
+  const uint32_t num_buckets = DecodeFixed32(input.data() + len - 5);
+  const uint64_t range = DecodeFixed64(input.data() + len - 13);
+  const uint32_t lg_width = fp_bits + GcsFilterBlock::kLgBucketWidth;
+  if (fp_bits == 0 || fp_bits > 32) {
+    return true;
+  } else if (range == 0) {
+    return false;  // Empty filter
+  } else if (num_buckets != ((range - 1) >> lg_width) + 1) {
+    return true;
+  }
+  const uint64_t offsets_size = 4 * (static_cast<uint64_t>(num_buckets) + 1);
+  if (offsets_size + 13 > len) {
+    return true;
+  }
+  const char* const offsets = input.data() + len - 13 - offsets_size;
+  const size_t bytes = len - 13 - offsets_size;
+
+  const uint64_t h = GcsHash(key, range);
+  const uint64_t b = h >> lg_width;
+  uint64_t pos = DecodeFixed32(offsets + 4 * b);
+  const uint64_t end = DecodeFixed32(offsets + 4 * (b + 1));
+  if (end > 8 * static_cast<uint64_t>(bytes) || pos > end) {
+    return true;
+  }
+  const unsigned char* const bits =
+      reinterpret_cast<const unsigned char*>(input.data());
+  uint64_t v = b << lg_width;
+  while (pos < end) {
+    uint64_t q = 0;
+    while (pos < end && GcsBit(bits, pos)) {
+      q++;
+      pos++;
+    }
+    pos++;  // Skip the terminating 0
+    if (pos + fp_bits > end) {
+      return true;  // Corrupted
+    }
+    uint64_t r = 0;
+    for (uint32_t i = 0; i < fp_bits; i++) {
+      r = (r << 1) | static_cast<uint64_t>(GcsBit(bits, pos++));
+    }
+    v += (q << fp_bits) | r;
+    if (v >= h) {
+      return v == h;
+    }
+  }
+
+  return false;
+}
+
 // Encoding a bitmap as-is, uncompressed. Used for debugging only.
 // Not intended for production.
 class UncompressedFormat {
@@ -204,7 +692,9 @@ class UncompressedFormat {
 class CompressedFormat {
  public:
   CompressedFormat(const DirOptions& options, std::string* space)
-      : bytes_per_bucket_(0),
+      : pool_(options.parallel_sorts ? options.compaction_pool : NULL),
+        presorted_(false),
+        bytes_per_bucket_(0),
         estimated_bucket_size_(0),
         num_keys_(0),
         key_bits_(options.bm_key_bits),
@@ -217,6 +707,7 @@ class CompressedFormat {
   // Use num_keys to estimate bitmap density.
   void Reset(uint32_t num_keys) {
     num_keys_ = num_keys;
+    presorted_ = false;
     extra_keys_.clear();
     working_space_.clear();
     // Estimated number of user keys per bucket. The actual number
@@ -255,6 +746,8 @@ class CompressedFormat {
     size_t result = 0;
     result += working_space_.capacity();
     result += extra_keys_.capacity() * sizeof(uint32_t);
+    result += bucket_keys_.capacity() * sizeof(uint32_t);
+    result += cohort_.capacity() * sizeof(uint32_t);
     result += space_->capacity();
     return result;
   }
@@ -263,12 +756,14 @@ class CompressedFormat {
   class Iter {  // Iterate through all bitmap buckets in working_space_
    public:
     // REQUIRES: parent.extra_keys is sorted
-    explicit Iter(const CompressedFormat& parent)
+    explicit Iter(CompressedFormat& parent)
         : bytes_per_bucket_(parent.bytes_per_bucket_),
           estimated_bucket_size_(parent.estimated_bucket_size_),
           num_buckets_(parent.num_buckets_),
-          working_space_(parent.working_space_.data()) {
-      bucket_keys_.reserve(16);
+          working_space_(parent.working_space_.data()),
+          presorted_(parent.presorted_),
+          bucket_keys_(&parent.bucket_keys_) {
+      bucket_keys_->reserve(16);
       iter_end_ = parent.extra_keys_.end();
       iter_ = parent.extra_keys_.begin();
       bucket_index_ = 0;  // Seek to the first bucket
@@ -282,7 +777,7 @@ class CompressedFormat {
 
     // Return a pointer to the bucket keys
     // Contents valid until the next Next() call.
-    std::vector<uint32_t>* keys() { return &bucket_keys_; }
+    std::vector<uint32_t>* keys() { return bucket_keys_; }
 
     bool Valid() const {  // True iff bucket exists
       return bucket_index_ < num_buckets_;
@@ -299,20 +794,28 @@ class CompressedFormat {
     // Retrieve all keys belonging to the current bucket.
     // Results are not sorted.
     void Fetch() {
-      bucket_keys_.clear();
+      bucket_keys_->clear();
       const uint32_t bucket_size = static_cast<unsigned char>(
           working_space_[bytes_per_bucket_ * bucket_index_]);
       for (uint32_t i = 0; i < bucket_size; i++) {
         if (i < estimated_bucket_size_) {
           uint32_t key_offset = static_cast<unsigned char>(
               working_space_[bytes_per_bucket_ * bucket_index_ + 1 + i]);
-          bucket_keys_.push_back(key_offset + (bucket_index_ << 8));
+          bucket_keys_->push_back(key_offset + (bucket_index_ << 8));
         } else {
           assert(iter_ != iter_end_);
-          bucket_keys_.push_back(*iter_);
+          bucket_keys_->push_back(*iter_);
           ++iter_;
         }
       }
+      // In-place keys are followed by overflowed keys, with each run sorted
+      // if buckets have been sorted in advance
+      if (presorted_ && bucket_size > estimated_bucket_size_ &&
+          estimated_bucket_size_ != 0) {
+        std::inplace_merge(bucket_keys_->begin(),
+                           bucket_keys_->begin() + estimated_bucket_size_,
+                           bucket_keys_->end());
+      }
     }
 
     // Constant after construction
@@ -321,9 +824,11 @@ class CompressedFormat {
     const size_t num_buckets_;
 
     const char* working_space_;
+    const bool presorted_;
 
-    // Temp storage for all keys in the current bucket
-    std::vector<uint32_t> bucket_keys_;
+    // Temp storage for all keys in the current bucket.
+    // Owned by the parent and reused across Finish() calls.
+    std::vector<uint32_t>* const bucket_keys_;
     // Cursor to the extra keys
     std::vector<uint32_t>::const_iterator iter_end_;
     std::vector<uint32_t>::const_iterator iter_;
@@ -336,10 +841,122 @@ class CompressedFormat {
   // Not a virtual function.
   size_t Finish() {
     std::sort(extra_keys_.begin(), extra_keys_.end());
+    if (pool_ != NULL && num_keys_ >= kMinParaSortKeys &&
+        num_buckets_ >= 2 * kParaSortBuckets) {
+      ParaSortBuckets();
+    }
     // To be overridden by subclasses...
     return 0;
   }
 
+  // Exchange the keys inserted so far, along with the state needed for
+  // encoding them, with another format. Swapping twice restores both.
+  void SwapKeys(CompressedFormat* other) {
+    working_space_.swap(other->working_space_);
+    extra_keys_.swap(other->extra_keys_);
+    std::swap(presorted_, other->presorted_);
+    std::swap(bytes_per_bucket_, other->bytes_per_bucket_);
+    std::swap(estimated_bucket_size_, other->estimated_bucket_size_);
+    std::swap(num_keys_, other->num_keys_);
+  }
+
+  // Sort the keys of a bucket obtained through Iter.
+  void SortBucketKeys(std::vector<uint32_t>* bucket_keys) const {
+    if (!presorted_) {
+      std::sort(bucket_keys->begin(), bucket_keys->end());
+    }
+  }
+
+  // Min number of keys for bucket sorting to go parallel
+  static const uint32_t kMinParaSortKeys = 256 << 10;
+  // Number of buckets sorted by a job at a time
+  static const size_t kParaSortBuckets = 4096;
+  // Max number of background jobs used to sort buckets
+  static const int kMaxParaSortJobs = 8;
+
+  // State shared by the caller and all background jobs of a parallel bucket
+  // sort. Deleted by whoever drops the last reference. The caller returns once
+  // all buckets are sorted, so jobs that start late must not touch anything
+  // other than this state.
+  struct BucketSortState {
+    BucketSortState() : cv(&mu) {}
+    char* working_space;
+    size_t bytes_per_bucket;
+    size_t estimated_bucket_size;
+    size_t num_buckets;
+    port::Mutex mu;
+    port::CondVar cv;
+    size_t next_bucket;  // Start of the next range of buckets to sort
+    size_t num_done;     // Number of buckets sorted
+    int refs;
+
+    void SortBuckets() {
+      MutexLock ml(&mu);
+      while (next_bucket < num_buckets) {
+        const size_t start = next_bucket;
+        const size_t end = std::min(start + kParaSortBuckets, num_buckets);
+        next_bucket = end;
+        mu.Unlock();
+        for (size_t b = start; b < end; b++) {
+          unsigned char* const bucket = reinterpret_cast<unsigned char*>(
+              working_space + b * bytes_per_bucket);
+          const size_t n =
+              std::min(static_cast<size_t>(bucket[0]), estimated_bucket_size);
+          std::sort(bucket + 1, bucket + 1 + n);
+        }
+        mu.Lock();
+        num_done += end - start;
+        if (num_done == num_buckets) {
+          cv.SignalAll();
+        }
+      }
+    }
+
+    void Unref() {
+      mu.Lock();
+      assert(refs > 0);
+      const bool last = (--refs == 0);
+      mu.Unlock();
+      if (last) {
+        delete this;
+      }
+    }
+  };
+
+  static void BGSortBuckets(void* arg) {
+    BucketSortState* const state = reinterpret_cast<BucketSortState*>(arg);
+    state->SortBuckets();
+    state->Unref();
+  }
+
+  // Sort the in-place keys of all buckets concurrently using the compaction
+  // pool so that encoding no longer needs to sort each bucket. The calling
+  // thread sorts buckets too so we will not be blocked even if all pool
+  // threads happen to be busy.
+  void ParaSortBuckets() {
+    BucketSortState* const state = new BucketSortState;
+    state->working_space = &working_space_[0];
+    state->bytes_per_bucket = bytes_per_bucket_;
+    state->estimated_bucket_size = estimated_bucket_size_;
+    state->num_buckets = num_buckets_;
+    state->next_bucket = 0;
+    state->num_done = 0;
+    const int jobs = static_cast<int>(std::min<size_t>(
+        kMaxParaSortJobs, num_buckets_ / kParaSortBuckets - 1));
+    state->refs = 1 + jobs;
+    for (int i = 0; i < jobs; i++) {
+      pool_->Schedule(BGSortBuckets, state);
+    }
+    state->SortBuckets();
+    state->mu.Lock();
+    while (state->num_done < num_buckets_) {
+      state->cv.Wait();
+    }
+    state->mu.Unlock();
+    state->Unref();
+    presorted_ = true;
+  }
+
   // Number of user keys for each lookup entry
   static const size_t partition_size_ = 1024;
 
@@ -432,6 +1049,10 @@ class CompressedFormat {
     const Slice& bitmap_;
   };
 
+  // Pool for sorting buckets in parallel. NULL if disabled.
+  ThreadPool* const pool_;
+  // True if the in-place keys of each bucket have been sorted by Finish()
+  bool presorted_;
   // In-memory bitmap storage where the entire bitmap key space
   // is divided into a set of fixed-sized buckets.
   // Each bucket is responsible for a range of 256 keys.
@@ -443,6 +1064,10 @@ class CompressedFormat {
   std::string working_space_;  // Temp bitmap storage
   // For keys that cannot fit into the statically allocated buckets
   std::vector<uint32_t> extra_keys_;
+  // Scratch space reused by Finish() so that finalizing a bitmap
+  // does not allocate new memory for each table
+  std::vector<uint32_t> bucket_keys_;
+  std::vector<uint32_t> cohort_;
   size_t bytes_per_bucket_;  // Use an extra byte for bucket size
   // Estimated number of keys per bucket
   size_t estimated_bucket_size_;
@@ -489,7 +1114,7 @@ class VbFormat : public CompressedFormat {
     Iter bucket_iter(*this);
     for (; bucket_iter.Valid(); bucket_iter.Next()) {
       std::vector<uint32_t>* bucket_keys = bucket_iter.keys();
-      std::sort(bucket_keys->begin(), bucket_keys->end());
+      SortBucketKeys(bucket_keys);
       for (std::vector<uint32_t>::iterator it = bucket_keys->begin();
            it != bucket_keys->end(); ++it) {
         uint32_t dta = *it - last_key;
@@ -556,7 +1181,7 @@ class VbPlusFormat : public VbFormat {
     Iter bucket_iter(*this);
     for (; bucket_iter.Valid(); bucket_iter.Next()) {
       std::vector<uint32_t>* bucket_keys = bucket_iter.keys();
-      std::sort(bucket_keys->begin(), bucket_keys->end());
+      SortBucketKeys(bucket_keys);
       for (std::vector<uint32_t>::iterator it = bucket_keys->begin();
            it != bucket_keys->end(); ++it) {
         uint32_t dta = *it - last_key;
@@ -582,10 +1207,19 @@ class VbPlusFormat : public VbFormat {
     return result;
   }
 
-  static bool Test(uint32_t bit, size_t key_bits, const Slice& bitmap) {
-    uint32_t base = 0;
-    Slice input = bitmap;
+  // Search for a given bit starting from a given base. Runs of single-byte
+  // deltas are skipped 8 at a time as long as they do not reach the target.
+  static bool Search(uint32_t bit, uint32_t base, Slice input) {
     while (!input.empty()) {
+      while (!scalar_bitmap_decoding && input.size() >= 8) {
+        uint64_t w;
+        memcpy(&w, input.data(), sizeof(w));
+        if (HasFullByte(w)) break;
+        const uint32_t sum = SumBytes(w);
+        if (uint64_t(base) + sum >= bit) break;
+        base += sum;
+        input.remove_prefix(8);
+      }
       base += VbPlusDec(&input);
       if (base == bit) {
         return true;
@@ -595,6 +1229,10 @@ class VbPlusFormat : public VbFormat {
     }
     return false;
   }
+
+  static bool Test(uint32_t bit, size_t key_bits, const Slice& bitmap) {
+    return Search(bit, 0, bitmap);
+  }
 };
 
 // Similar to VbPlusFormat but with an extra lookup table for faster queries.
@@ -616,7 +1254,7 @@ class FastVbPlusFormat : public VbPlusFormat {
     Iter bucket_iter(*this);
     for (; bucket_iter.Valid(); bucket_iter.Next()) {
       std::vector<uint32_t>* bucket_keys = bucket_iter.keys();
-      std::sort(bucket_keys->begin(), bucket_keys->end());
+      SortBucketKeys(bucket_keys);
       for (std::vector<uint32_t>::iterator it = bucket_keys->begin();
            it != bucket_keys->end(); ++it) {
         uint32_t dta = *it - last_key;
@@ -636,14 +1274,7 @@ class FastVbPlusFormat : public VbPlusFormat {
     uint32_t base = 0;
     LookupTable table(bitmap);
     if (table.Lookup(bit, &input, &base)) {
-      while (!input.empty()) {
-        base += VbPlusDec(&input);
-        if (base == bit) {
-          return true;
-        } else if (base > bit) {
-          return false;
-        }
-      }
+      return Search(bit, base, input);
     }
 
     return false;
@@ -663,14 +1294,15 @@ class PfDeltaFormat : public CompressedFormat {
   size_t Finish() {
     uint32_t cohort_max = 0;  // No less than the max in a cohort
     // A group of input keys to compress together
-    std::vector<uint32_t> cohort;
+    std::vector<uint32_t>& cohort = cohort_;
+    cohort.clear();
     cohort.reserve(cohort_size_);
     uint32_t last_key = 0;
     CompressedFormat::Finish();  // Sort extra keys
     Iter bucket_iter(*this);
     for (; bucket_iter.Valid(); bucket_iter.Next()) {
       std::vector<uint32_t>* bucket_keys = bucket_iter.keys();
-      std::sort(bucket_keys->begin(), bucket_keys->end());
+      SortBucketKeys(bucket_keys);
       for (std::vector<uint32_t>::iterator it = bucket_keys->begin();
            it != bucket_keys->end(); ++it) {
         uint32_t dta = *it - last_key;
@@ -693,10 +1325,34 @@ class PfDeltaFormat : public CompressedFormat {
   }
 
   static bool Test(uint32_t bit, size_t key_bits, const Slice& bitmap) {
-    uint32_t base = 0;
+    return Search(bit, 0, bitmap);
+  }
+
+ protected:
+  // Search for a given bit starting from a given base.
+  static bool Search(uint32_t bit, uint32_t base, Slice input) {
+    if (scalar_bitmap_decoding) {
+      return ScalarSearch(bit, base, input);
+    }
+    uint32_t cohort[cohort_size_];
+    while (!input.empty()) {
+      size_t num_keys = PfDtaDecFast(&input, cohort);
+      for (size_t i = 0; i < num_keys; i++) {
+        base += cohort[i];
+        if (base == bit) {
+          return true;
+        } else if (base > bit) {
+          return false;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  static bool ScalarSearch(uint32_t bit, uint32_t base, Slice input) {
     std::vector<uint32_t> cohort;
     cohort.reserve(cohort_size_);
-    Slice input = bitmap;
     while (!input.empty()) {
       size_t num_keys = PfDtaDec(&input, &cohort);
       for (size_t i = 0; i < num_keys; i++) {
@@ -712,10 +1368,10 @@ class PfDeltaFormat : public CompressedFormat {
     return false;
   }
 
- protected:
   // Number of user keys per cohort (compression group)
   // REQUIRES: must be a multiple of 8.
   static const size_t cohort_size_ = 128;
+  friend class AutoFormat;  // Estimates encoded sizes by cohort
 
   static size_t PfDtaDec(Slice* input, std::vector<uint32_t>* cohort) {
     cohort->clear();
@@ -750,6 +1406,42 @@ class PfDeltaFormat : public CompressedFormat {
     return cohort->size();
   }
 
+  // Same as PfDtaDec() but extracts each key from a 64-bit bit buffer
+  // refilled a byte at a time instead of moving one bit at a time.
+  // Results are stored in cohort[0, cohort_size_).
+  static size_t PfDtaDecFast(Slice* input, uint32_t* cohort) {
+    if (input->empty()) return 0;
+    const size_t num_bits = static_cast<unsigned char>((*input)[0]);
+    input->remove_prefix(1);
+    if (num_bits == 0) {  // All deltas are zero so only one key is possible
+      cohort[0] = 0;
+      return 1;
+    } else if (num_bits > 32) {  // Corrupted input
+      input->clear();
+      return 0;
+    }
+    size_t num_keys = cohort_size_;
+    if (8 * input->size() / num_bits < num_keys) {
+      num_keys = 8 * input->size() / num_bits;
+    }
+    const unsigned char* const start =
+        reinterpret_cast<const unsigned char*>(input->data());
+    const unsigned char* p = start;
+    const uint64_t mask = (static_cast<uint64_t>(1) << num_bits) - 1;
+    uint64_t buf = 0;
+    size_t avail = 0;  // Number of unconsumed bits in buf
+    for (size_t i = 0; i < num_keys; i++) {
+      while (avail < num_bits) {
+        buf = (buf << 8) | *p++;
+        avail += 8;
+      }
+      avail -= num_bits;
+      cohort[i] = static_cast<uint32_t>((buf >> avail) & mask);
+    }
+    input->remove_prefix(p - start);
+    return num_keys;
+  }
+
   static void PfDtaEnc(std::string* output, const std::vector<uint32_t>& cohort,
                        uint32_t cohort_max) {
     unsigned char num_bits = LeftMostBit(cohort_max);  // Bits per key
@@ -790,7 +1482,8 @@ class FastPfDeltaFormat : public PfDeltaFormat {
   size_t Finish() {
     uint32_t cohort_max = 0;  // No less than the max in a cohort
     // A group of input keys to compress together
-    std::vector<uint32_t> cohort;
+    std::vector<uint32_t>& cohort = cohort_;
+    cohort.clear();
     cohort.reserve(cohort_size_);
     uint32_t last_key = 0;
     LookupTableBuilder table(space_, num_keys_);
@@ -798,7 +1491,7 @@ class FastPfDeltaFormat : public PfDeltaFormat {
     Iter bucket_iter(*this);
     for (; bucket_iter.Valid(); bucket_iter.Next()) {
       std::vector<uint32_t>* bucket_keys = bucket_iter.keys();
-      std::sort(bucket_keys->begin(), bucket_keys->end());
+      SortBucketKeys(bucket_keys);
       for (std::vector<uint32_t>::iterator it = bucket_keys->begin();
            it != bucket_keys->end(); ++it) {
         uint32_t dta = *it - last_key;
@@ -825,22 +1518,10 @@ class FastPfDeltaFormat : public PfDeltaFormat {
 
   static bool Test(uint32_t bit, size_t key_bits, const Slice& bitmap) {
     uint32_t base = 0;
-    std::vector<uint32_t> cohort;
-    cohort.reserve(cohort_size_);
     Slice input = bitmap;
     LookupTable table(bitmap);
     if (table.Lookup(bit, &input, &base)) {
-      while (!input.empty()) {
-        size_t num_keys = PfDtaDec(&input, &cohort);
-        for (size_t i = 0; i < num_keys; i++) {
-          base += cohort[i];
-          if (base == bit) {
-            return true;
-          } else if (base > bit) {
-            return false;
-          }
-        }
-      }
+      return Search(bit, base, input);
     }
 
     return false;
@@ -872,7 +1553,7 @@ class RoaringFormat : public CompressedFormat {
       std::vector<uint32_t>* bucket_keys = bucket_iter.keys();
       (*space_)[4 + bucket_iter.index()] =
           static_cast<char>(bucket_keys->size());
-      std::sort(bucket_keys->begin(), bucket_keys->end());
+      SortBucketKeys(bucket_keys);
       for (std::vector<uint32_t>::iterator it = bucket_keys->begin();
            it != bucket_keys->end(); ++it) {
         space_->push_back(*it & 255);
@@ -923,6 +1604,171 @@ class RoaringFormat : public CompressedFormat {
   }
 };
 
+// AutoFormat: encode each bitmap using whichever of the other formats is
+// estimated to take the least space for it. Sizes are estimated from the
+// number of keys in each bucket alone, as if the keys of a bucket were evenly
+// spread over its range, so keys are only sorted and encoded once. A format
+// answering lookups faster is picked instead of the smallest one if it is
+// no more than 1/16 larger.
+class AutoFormat : public CompressedFormat {
+ public:
+  AutoFormat(const DirOptions& options, std::string* space)
+      : CompressedFormat(options, space),
+        options_(options),
+        fmt_(kFmtRoaring) {}
+
+  // Convert the in-memory bitmap representation to an on-storage
+  // representation using the format picked for it. The in-memory version
+  // is stored at working_space_. The on-storage version will be stored
+  // in *space_.
+  size_t Finish() {
+    fmt_ = PickFormat();
+    switch (fmt_) {
+      case kFmtUncompressed:
+        return FinishUncompressed();
+      case kFmtRoaring:
+        return FinishAs<RoaringFormat>();
+      case kFmtFastVarintPlus:
+        return FinishAs<FastVbPlusFormat>();
+      case kFmtVarintPlus:
+        return FinishAs<VbPlusFormat>();
+      case kFmtFastPfDelta:
+        return FinishAs<FastPfDeltaFormat>();
+      case kFmtPfDelta:
+        return FinishAs<PfDeltaFormat>();
+      default:
+        return FinishAs<VbFormat>();
+    }
+  }
+
+  // Return the format picked by the last Finish() call.
+  int format() const { return fmt_; }
+
+ private:
+  template <typename F>
+  size_t FinishAs() {
+    F f(options_, space_);
+    SwapKeys(&f);
+    const size_t result = f.Finish();
+    SwapKeys(&f);
+    return result;
+  }
+
+  size_t FinishUncompressed() {
+    CompressedFormat::Finish();  // Sort extra keys
+    space_->resize((bits_ + 7) / 8, 0);
+    Iter bucket_iter(*this);
+    for (; bucket_iter.Valid(); bucket_iter.Next()) {
+      std::vector<uint32_t>* bucket_keys = bucket_iter.keys();
+      for (std::vector<uint32_t>::iterator it = bucket_keys->begin();
+           it != bucket_keys->end(); ++it) {
+        (*space_)[*it / 8] |= 1 << (*it % 8);
+      }
+    }
+
+    return space_->size();
+  }
+
+  static size_t VbSize(uint32_t value) {
+    size_t result = 1;
+    while (value > 127) {
+      value >>= 7;
+      result++;
+    }
+    return result;
+  }
+
+  // Estimated encoded sizes of the bitmap
+  struct Estimates {
+    Estimates() : vb(0), vbplus(0), pfd(0), cohort_keys(0), cohort_max(0) {}
+
+    // Account for "n" deltas of a given value.
+    void Add(uint32_t dta, size_t n) {
+      vb += n * VbSize(dta);
+      vbplus += n * (dta < 255 ? 1 : 1 + VbSize(dta - 254));
+      while (n != 0) {
+        const size_t m =
+            std::min(n, PfDeltaFormat::cohort_size_ - cohort_keys);
+        cohort_max |= dta;
+        cohort_keys += m;
+        n -= m;
+        if (cohort_keys == PfDeltaFormat::cohort_size_) {
+          EndCohort();
+        }
+      }
+    }
+
+    void EndCohort() {
+      if (cohort_keys != 0) {
+        pfd += 1 + (cohort_keys * LeftMostBit(cohort_max) + 7) / 8;
+      }
+      cohort_keys = 0;
+      cohort_max = 0;
+    }
+
+    size_t vb;
+    size_t vbplus;
+    size_t pfd;
+    size_t cohort_keys;
+    uint32_t cohort_max;
+  };
+
+  int PickFormat() const {
+    Estimates est;
+    size_t n = 0;  // Total number of keys
+    uint64_t last_key = 0;
+    for (size_t b = 0; b < num_buckets_; b++) {
+      const size_t bucket_size = static_cast<unsigned char>(
+          working_space_[b * bytes_per_bucket_]);
+      if (bucket_size == 0) {
+        continue;
+      }
+      const uint32_t gap = static_cast<uint32_t>(
+          std::max<size_t>(256 / bucket_size, 1));
+      const uint64_t first_key = (uint64_t(b) << 8) + gap / 2;
+      est.Add(static_cast<uint32_t>(first_key - last_key), 1);
+      est.Add(gap, bucket_size - 1);
+      last_key = first_key + uint64_t(gap) * (bucket_size - 1);
+      n += bucket_size;
+    }
+    est.EndCohort();
+    const size_t lookup_table =
+        8 * std::max<size_t>((num_keys_ + partition_size_ - 1) /
+                                 partition_size_,
+                             1);
+    // Candidates in the order of decreasing lookup speed
+    const int fmts[] = {kFmtUncompressed, kFmtRoaring,   kFmtFastVarintPlus,
+                        kFmtFastPfDelta,  kFmtVarintPlus, kFmtPfDelta,
+                        kFmtVarint};
+    const size_t sizes[] = {(bits_ + 7) / 8,
+                            4 + num_buckets_ + n,
+                            est.vbplus + lookup_table,
+                            est.pfd + lookup_table,
+                            est.vbplus,
+                            est.pfd,
+                            est.vb};
+    const size_t num_fmts = sizeof(fmts) / sizeof(fmts[0]);
+    const size_t smallest = *std::min_element(sizes, sizes + num_fmts);
+    for (size_t i = 0; i < num_fmts; i++) {
+      if (sizes[i] <= smallest + smallest / 16) {
+        return fmts[i];
+      }
+    }
+    return kFmtRoaring;  // Not reached
+  }
+
+  const DirOptions& options_;
+  int fmt_;
+};
+
+// Return the format with which a bitmap has been finished.
+template <typename T>
+static int FinishedFormat(const T* fmt) {
+  return BitmapFormatFromType<BitmapBlock<T> >();
+}
+
+static int FinishedFormat(const AutoFormat* fmt) { return fmt->format(); }
+
 template <typename T>
 int BitmapBlock<T>::chunk_type() {
   return static_cast<int>(kBmpChunk);
@@ -985,8 +1831,8 @@ Slice BitmapBlock<T>::Finish() {
   // Remember the size of the domain space
   space_.push_back(static_cast<char>(key_bits_));
   // Remember the bitmap format
-  const int fmt = BitmapFormatFromType<BitmapBlock<T> >();
-  assert(fmt == bm_fmt_);
+  const int fmt = FinishedFormat(fmt_);
+  assert(fmt == bm_fmt_ || bm_fmt_ == kFmtAuto);
   space_.push_back(static_cast<char>(fmt));
   return space_;
 }
@@ -1012,6 +1858,8 @@ template class BitmapBlock<PfDeltaFormat>;
 
 template class BitmapBlock<RoaringFormat>;
 
+template class BitmapBlock<AutoFormat>;
+
 // Return true if the target key is present in the given bitmap by
 // checking its binary representation.
 static bool BitmapTestKey(int fmt, uint32_t k, size_t key_bits,
@@ -1080,6 +1928,8 @@ int BitmapFormatFromType() {
     return static_cast<int>(kFmtPfDelta);
   } else if (typeid(T) == typeid(BitmapBlock<RoaringFormat>)) {
     return static_cast<int>(kFmtRoaring);
+  } else if (typeid(T) == typeid(BitmapBlock<AutoFormat>)) {
+    return static_cast<int>(kFmtAuto);
   } else {
     return -1;
   }
@@ -1095,8 +1945,12 @@ template int BitmapFormatFromType<BitmapBlock<FastPfDeltaFormat> >();
 template int BitmapFormatFromType<BitmapBlock<PfDeltaFormat> >();
 
 template int BitmapFormatFromType<BitmapBlock<RoaringFormat> >();
+template int BitmapFormatFromType<BitmapBlock<AutoFormat> >();
 template int BitmapFormatFromType<EmptyFilterBlock>();
 template int BitmapFormatFromType<BloomBlock>();
+template int BitmapFormatFromType<BlockedBloomBlock>();
+template int BitmapFormatFromType<XorFilterBlock>();
+template int BitmapFormatFromType<GcsFilterBlock>();
 
 int EmptyFilterBlock::chunk_type() {
   return static_cast<int>(kUnknown);  // Dummy block type
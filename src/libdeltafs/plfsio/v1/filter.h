@@ -16,6 +16,9 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace pdlfs {
 namespace plfsio {
@@ -52,6 +55,10 @@ class BloomBlock {
   // The underlying bitmap won't be re-sized before the next reset.
   void Reset(uint32_t num_keys);
 
+  // Same as above, but use "bits_per_key" in place of the configured number
+  // of bits per key, and a matching number of probes, for this filter only.
+  void Reset(uint32_t num_keys, double bits_per_key);
+
   // Insert a key into the bloom filter.
   // REQUIRES: Reset(num_keys) has been called.
   // REQUIRES: Finish() has not been called.
@@ -82,9 +89,177 @@ class BloomBlock {
   uint32_t k_;
 };
 
+// Return false iff the target key is guaranteed to not exist in a given
+// cache-line blocked bloom filter.
+extern bool BlockedBloomKeyMayMatch(const Slice& key, const Slice& input);
+
+// A bloom filter variant that confines all probes of a key to a single
+// 64-byte cache line, trading a slightly higher false positive rate for one
+// cache miss per key at both insertion and query time. Filter contents use
+// the same layout as BloomBlock (a bitmap followed by a one-byte k), with
+// the top bit of k set to mark the blocked encoding.
+class BlockedBloomBlock {
+ public:
+  // Size of each filter block in bytes
+  enum { kLineSize = 64 };
+  // Create a blocked bloom filter using a given set of options.
+  // Memory reservation follows BloomBlock.
+  BlockedBloomBlock(const DirOptions& options, size_t bytes_to_reserve = 0);
+  ~BlockedBloomBlock();
+
+  // Reset the filter for a given number of keys. The bitmap is rounded up to
+  // a multiple of kLineSize bytes.
+  void Reset(uint32_t num_keys);
+
+  // Same as above, but use "bits_per_key" in place of the configured number
+  // of bits per key for this filter only.
+  void Reset(uint32_t num_keys, double bits_per_key);
+
+  // Insert a key into the filter.
+  // REQUIRES: Reset(num_keys) has been called.
+  // REQUIRES: Finish() has not been called.
+  void AddKey(const Slice& key);
+
+  // Finalize the filter and return its contents.
+  Slice Finish();
+
+  // Return the underlying buffer space.
+  size_t memory_usage() const { return space_.capacity(); }
+  static int chunk_type();  // Return the corresponding chunk type
+  size_t num_victims() const { return 0; }
+
+ private:
+  // No copying allowed
+  void operator=(const BlockedBloomBlock&);
+  BlockedBloomBlock(const BlockedBloomBlock&);
+  const size_t bits_per_key_;  // Number of bits for each key
+
+  bool finished_;  // If Finish() has been called
+  std::string space_;
+  // Number of cache lines in the underlying bitmap
+  uint32_t lines_;
+  // Number of hash functions
+  uint32_t k_;
+};
+
+// Return false iff the target key is guaranteed to not exist in a given xor
+// filter.
+extern bool XorKeyMayMatch(const Slice& key, const Slice& input);
+
+// An xor filter with 8-bit fingerprints ("Xor Filters: Faster and Smaller
+// Than Bloom and Cuckoo Filters", JEA '20). Needs about 9.84 bits per key for
+// a false positive rate of about 0.39%, where a bloom filter would need
+// about 11.5 bits per key. Probes read exactly 3 bytes. Since the filter can
+// only be built once all keys are known, key hashes are buffered until
+// Finish() is called.
+class XorFilterBlock {
+ public:
+  // Create an xor filter using a given set of options. Memory reservation
+  // applies to the final filter contents.
+  XorFilterBlock(const DirOptions& options, size_t bytes_to_reserve = 0);
+  ~XorFilterBlock();
+
+  // Reset filter state for a given number of keys.
+  void Reset(uint32_t num_keys);
+
+  // Insert a key into the filter.
+  // REQUIRES: Reset(num_keys) has been called.
+  // REQUIRES: Finish() has not been called.
+  void AddKey(const Slice& key);
+
+  // Build the filter and return its contents.
+  Slice Finish();
+
+  // Report total filter memory usage
+  size_t memory_usage() const {
+    return space_.capacity() + hashes_.capacity() * sizeof(uint64_t);
+  }
+  static int chunk_type();  // Return the corresponding chunk type
+  size_t num_victims() const { return 0; }
+
+ private:
+  // No copying allowed
+  void operator=(const XorFilterBlock&);
+  XorFilterBlock(const XorFilterBlock&);
+  bool Build(uint32_t seed, uint32_t block_length);
+
+  bool finished_;  // If Finish() has been called
+  std::string space_;
+  // Hashes of all keys inserted since the last Reset()
+  std::vector<uint64_t> hashes_;
+  // Scratch space for filter construction
+  std::vector<uint64_t> slot_hashes_;
+  std::vector<uint32_t> slot_counts_;
+  std::vector<uint32_t> queue_;
+  std::vector<std::pair<uint64_t, uint32_t> > stack_;
+};
+
+// Return false iff the target key is guaranteed to not exist in a given
+// golomb-coded set.
+extern bool GcsKeyMayMatch(const Slice& key, const Slice& input);
+
+// A golomb-coded set (GCS) filter. Key hashes are mapped to [0, n * 1.5 * 2^p),
+// where n is the number of keys and p is DirOptions::gcs_fp_bits, sorted, and
+// stored as gaps Rice-coded with parameter p. The false positive rate is about
+// 2^-p / 1.5 at about p + 1.9 bits per key, about 1.5 bits per key more than
+// the minimum that any filter needs for that rate. Hashes are split into
+// buckets of 2^(p + kLgBucketWidth) consecutive values, about 170 keys each,
+// and the bit offset of each bucket is kept so that a probe only decodes the
+// gaps of a single bucket. The filter is stored as
+//
+//   Rice-coded gaps (bit stream padded to bytes)
+//   bit offset of each bucket (fixed32 * (num_buckets + 1))
+//   hash range (fixed64) | num_buckets (fixed32) | p (1 byte)
+//
+// Since gaps can only be coded once all keys are known, key hashes are
+// buffered until Finish() is called.
+class GcsFilterBlock {
+ public:
+  // Number of hash values per bucket is 2^(p + kLgBucketWidth)
+  enum { kLgBucketWidth = 8 };
+  // Create a golomb-coded set using a given set of options. Memory
+  // reservation applies to the final filter contents.
+  GcsFilterBlock(const DirOptions& options, size_t bytes_to_reserve = 0);
+  ~GcsFilterBlock();
+
+  // Reset filter state for a given number of keys.
+  void Reset(uint32_t num_keys);
+
+  // Insert a key into the filter.
+  // REQUIRES: Reset(num_keys) has been called.
+  // REQUIRES: Finish() has not been called.
+  void AddKey(const Slice& key);
+
+  // Build the filter and return its contents.
+  Slice Finish();
+
+  // Report total filter memory usage
+  size_t memory_usage() const {
+    return space_.capacity() + hashes_.capacity() * sizeof(uint64_t);
+  }
+  static int chunk_type();  // Return the corresponding chunk type
+  size_t num_victims() const { return 0; }
+
+ private:
+  // No copying allowed
+  void operator=(const GcsFilterBlock&);
+  GcsFilterBlock(const GcsFilterBlock&);
+  const uint32_t fp_bits_;  // Rice parameter p
+
+  bool finished_;  // If Finish() has been called
+  std::string space_;
+  // Hashes of all keys inserted since the last Reset()
+  std::vector<uint64_t> hashes_;
+  std::vector<uint32_t> offsets_;  // Scratch space for bucket offsets
+};
+
 // Return true if the target key matches a given bitmap filter.
 bool BitmapKeyMustMatch(const Slice& key, const Slice& input);
 
+// Make bitmap lookups use the reference decoders of the compressed formats
+// instead of the default word-at-a-time ones. For testing only.
+extern void TEST_SetScalarBitmapDecoding(bool scalar);
+
 // Bitmap compression formats.
 class UncompressedFormat;
 class CompressedFormat;  // Parent class for all compressed formats
@@ -98,6 +273,8 @@ class RoaringFormat;
 class FastVbPlusFormat;
 class VbPlusFormat;
 class VbFormat;
+// Picks one of the formats above for each bitmap
+class AutoFormat;
 
 template <typename T>
 int BitmapFormatFromType();  // Return the corresponding bitmap format.
@@ -146,6 +146,126 @@ TEST(BloomFilterTest, BloomFormat) {
   }
 }
 
+typedef FilterTest<BlockedBloomBlock, BlockedBloomKeyMayMatch>
+    BlockedBloomFilterTest;
+
+TEST(BlockedBloomFilterTest, BlockedBloomFormat) {
+  Random rnd(301);
+  uint32_t num_keys = 0;
+  while (num_keys <= (64 << 10)) {
+    TEST_LogAndApply(this, &rnd, num_keys, false);
+    if (num_keys == 0) {
+      num_keys = 1;
+    } else {
+      num_keys *= 4;
+    }
+  }
+}
+
+TEST(BlockedBloomFilterTest, FalsePositiveRate) {
+  Reset(10000);
+  for (uint32_t i = 0; i < 10000; i++) {
+    AddKey(i);
+  }
+  Finish();
+  ASSERT_EQ(data_.size() % BlockedBloomBlock::kLineSize, 1);
+  // Blocked filters are also understood by the standard bloom tester
+  char tmp[4];
+  for (uint32_t i = 0; i < 10000; i++) {
+    ASSERT_TRUE(KeyMayMatch(i));
+    EncodeFixed32(tmp, i);
+    ASSERT_TRUE(BloomKeyMayMatch(Slice(tmp, sizeof(tmp)), data_));
+  }
+  uint32_t fp = 0;
+  for (uint32_t i = 10000; i < 20000; i++) {
+    if (KeyMayMatch(i)) fp++;
+  }
+  fprintf(stderr, "False positive rate: %.2f%%\n", fp / 100.0);
+  ASSERT_TRUE(fp < 500);  // < 5% at 10 bits per key
+}
+
+typedef FilterTest<XorFilterBlock, XorKeyMayMatch> XorFilterTest;
+
+TEST(XorFilterTest, XorFormat) {
+  Random rnd(301);
+  uint32_t num_keys = 0;
+  while (num_keys <= (64 << 10)) {
+    TEST_LogAndApply(this, &rnd, num_keys, false);
+    if (num_keys == 0) {
+      num_keys = 1;
+    } else {
+      num_keys *= 4;
+    }
+  }
+}
+
+TEST(XorFilterTest, XorFalsePositiveRate) {
+  Reset(10000);
+  for (uint32_t i = 0; i < 10000; i++) {
+    AddKey(i);
+    AddKey(i);  // Duplicated keys are allowed
+  }
+  Finish();
+  fprintf(stderr, "Bits per key: %.2f\n", 8.0 * data_.size() / 10000);
+  ASSERT_TRUE(data_.size() < 10000 * 10 / 8);
+  for (uint32_t i = 0; i < 10000; i++) {
+    ASSERT_TRUE(KeyMayMatch(i));
+  }
+  uint32_t fp = 0;
+  for (uint32_t i = 10000; i < 110000; i++) {
+    if (KeyMayMatch(i)) fp++;
+  }
+  fprintf(stderr, "False positive rate: %.3f%%\n", fp / 1000.0);
+  ASSERT_TRUE(fp < 1000);  // < 1% with 8-bit fingerprints
+}
+
+TEST(XorFilterTest, XorEmpty) {
+  Reset(0);
+  Finish();
+  ASSERT_FALSE(KeyMayMatch(1));
+}
+
+typedef FilterTest<GcsFilterBlock, GcsKeyMayMatch> GcsFilterTest;
+
+TEST(GcsFilterTest, GcsFormat) {
+  Random rnd(301);
+  uint32_t num_keys = 0;
+  while (num_keys <= (64 << 10)) {
+    TEST_LogAndApply(this, &rnd, num_keys, false);
+    if (num_keys == 0) {
+      num_keys = 1;
+    } else {
+      num_keys *= 4;
+    }
+  }
+}
+
+TEST(GcsFilterTest, GcsFalsePositiveRate) {
+  Reset(10000);
+  for (uint32_t i = 0; i < 10000; i++) {
+    AddKey(i);
+    AddKey(i);  // Duplicated keys are allowed
+  }
+  Finish();
+  fprintf(stderr, "Bits per key: %.2f\n", 8.0 * data_.size() / 10000);
+  ASSERT_TRUE(data_.size() < 10000 * 21 / 16);  // 10.5 bits per key
+  for (uint32_t i = 0; i < 10000; i++) {
+    ASSERT_TRUE(KeyMayMatch(i));
+  }
+  uint32_t fp = 0;
+  for (uint32_t i = 10000; i < 110000; i++) {
+    if (KeyMayMatch(i)) fp++;
+  }
+  fprintf(stderr, "False positive rate: %.3f%%\n", fp / 1000.0);
+  ASSERT_TRUE(fp < 400);  // About 0.26% with 8 fp bits
+}
+
+TEST(GcsFilterTest, GcsEmpty) {
+  Reset(0);
+  Finish();
+  ASSERT_FALSE(KeyMayMatch(1));
+}
+
 typedef FilterTest<BitmapBlock<UncompressedFormat>, BitmapKeyMustMatch>
     UncompressedBitmapFilterTest;
 TEST(UncompressedBitmapFilterTest, UncompressedFormat) {
@@ -251,6 +371,138 @@ TEST(RoaringBitmapFilterTest, RoaringFormat) {
   }
 }
 
+typedef FilterTest<BitmapBlock<AutoFormat>, BitmapKeyMustMatch>
+    AutoBitmapFilterTest;
+TEST(AutoBitmapFilterTest, AutoFormat) {
+  Random rnd(301);
+  uint32_t num_keys = 0;
+  while (num_keys <= (4 << 10)) {
+    TEST_LogAndApply(this, &rnd, num_keys);
+    if (num_keys == 0) {
+      num_keys = 1;
+    } else {
+      num_keys *= 4;
+    }
+  }
+}
+
+// Return the contents of a bitmap of a given format over the first
+// "num_keys" keys drawn from a fixed random sequence.
+template <typename T>
+static std::string TEST_BuildBitmap(size_t key_bits, uint32_t num_keys) {
+  FilterTest<BitmapBlock<T>, BitmapKeyMustMatch> t(key_bits);
+  Random rnd(301);
+  t.Reset(num_keys);
+  for (uint32_t i = 0; i < num_keys; i++) {
+    t.AddKey(rnd.Uniform(1u << key_bits));
+  }
+  return t.Finish().ToString();
+}
+
+TEST(AutoBitmapFilterTest, PicksSmallFormats) {
+  const size_t key_bits = 16;
+  for (uint32_t num_keys = 16; num_keys <= (32 << 10); num_keys *= 4) {
+    size_t sizes[] = {
+        TEST_BuildBitmap<UncompressedFormat>(key_bits, num_keys).size(),
+        TEST_BuildBitmap<RoaringFormat>(key_bits, num_keys).size(),
+        TEST_BuildBitmap<FastVbPlusFormat>(key_bits, num_keys).size(),
+        TEST_BuildBitmap<VbPlusFormat>(key_bits, num_keys).size(),
+        TEST_BuildBitmap<VbFormat>(key_bits, num_keys).size(),
+        TEST_BuildBitmap<FastPfDeltaFormat>(key_bits, num_keys).size(),
+        TEST_BuildBitmap<PfDeltaFormat>(key_bits, num_keys).size()};
+    const size_t smallest =
+        *std::min_element(sizes, sizes + sizeof(sizes) / sizeof(sizes[0]));
+    const std::string contents =
+        TEST_BuildBitmap<AutoFormat>(key_bits, num_keys);
+    const int fmt = contents[contents.size() - 1];
+    fprintf(stderr, "%u keys: format %d, %d bytes (smallest: %d bytes)\n",
+            num_keys, fmt, int(contents.size()), int(smallest));
+    ASSERT_TRUE(fmt != kFmtAuto);
+    ASSERT_LE(contents.size(), smallest + smallest / 4);
+    Random rnd(301);
+    for (uint32_t i = 0; i < num_keys; i++) {
+      char tmp[4];
+      EncodeFixed32(tmp, rnd.Uniform(1u << key_bits));
+      ASSERT_TRUE(BitmapKeyMustMatch(Slice(tmp, sizeof(tmp)), contents));
+    }
+  }
+}
+
+// Check that the default and the reference decoders of a bitmap format give
+// the same answers, and report the time spent by each of them.
+template <typename T>
+static void TEST_CompareDecoders(Random* rnd, uint32_t num_keys) {
+  FilterTest<BitmapBlock<T>, BitmapKeyMustMatch> t;
+  t.Reset(num_keys);
+  const uint32_t key_space = 1u << t.key_bits_;
+  for (uint32_t i = 0; i < num_keys; i++) {
+    t.AddKey(rnd->Uniform(key_space));
+  }
+  t.Finish();
+  std::vector<uint32_t> queries;
+  for (int i = 0; i < 500; i++) {
+    queries.push_back(rnd->Uniform(key_space));
+  }
+  std::vector<bool> answers[2];
+  uint64_t micros[2];
+  for (int scalar = 0; scalar < 2; scalar++) {
+    TEST_SetScalarBitmapDecoding(scalar != 0);
+    const uint64_t start = CurrentMicros();
+    for (size_t i = 0; i < queries.size(); i++) {
+      answers[scalar].push_back(t.KeyMayMatch(queries[i]));
+    }
+    micros[scalar] = CurrentMicros() - start;
+  }
+  TEST_SetScalarBitmapDecoding(false);
+  fprintf(stderr, "%u keys: %.3f us/query (reference: %.3f us/query)\n",
+          num_keys, double(micros[0]) / queries.size(),
+          double(micros[1]) / queries.size());
+  ASSERT_TRUE(answers[0] == answers[1]);
+}
+
+TEST(FastVbPlusBitmapFilterTest, VbPlusDecoders) {
+  Random rnd(301);
+  TEST_CompareDecoders<VbPlusFormat>(&rnd, 1 << 16);
+  TEST_CompareDecoders<FastVbPlusFormat>(&rnd, 1 << 20);
+}
+
+TEST(FastPfDeltaBitmapFilterTest, PfDeltaDecoders) {
+  Random rnd(301);
+  TEST_CompareDecoders<PfDeltaFormat>(&rnd, 1 << 16);
+  TEST_CompareDecoders<FastPfDeltaFormat>(&rnd, 1 << 20);
+}
+
+// Check that bitmaps built with buckets sorted in parallel are identical to
+// those built by a single thread.
+template <typename T>
+static void TEST_ParaSortBuckets(ThreadPool* pool, uint32_t num_keys) {
+  std::string contents[2];
+  for (int para = 0; para < 2; para++) {
+    FilterTest<BitmapBlock<T>, BitmapKeyMustMatch> t;
+    t.options_.parallel_sorts = para != 0;
+    t.options_.compaction_pool = pool;
+    Random rnd(301);
+    t.Reset(num_keys);
+    for (uint32_t i = 0; i < num_keys; i++) {
+      t.AddKey(rnd.Uniform(1u << t.key_bits_));
+    }
+    contents[para] = t.Finish().ToString();
+  }
+  ASSERT_TRUE(contents[0] == contents[1]);
+}
+
+TEST(RoaringBitmapFilterTest, ParaSortBuckets) {
+  ThreadPool* const pool = ThreadPool::NewFixed(4, true);
+  TEST_ParaSortBuckets<VbFormat>(pool, 1 << 20);
+  TEST_ParaSortBuckets<VbPlusFormat>(pool, 1 << 20);
+  TEST_ParaSortBuckets<FastVbPlusFormat>(pool, 1 << 20);
+  TEST_ParaSortBuckets<PfDeltaFormat>(pool, 1 << 20);
+  TEST_ParaSortBuckets<FastPfDeltaFormat>(pool, 1 << 20);
+  TEST_ParaSortBuckets<RoaringFormat>(pool, 1 << 20);
+  TEST_ParaSortBuckets<RoaringFormat>(pool, 4 << 20);  // Overflowed buckets
+  delete pool;
+}
+
 template <typename T>
 class PlfsFilterBench {
   static int FromEnv(const char* key, int def) {
@@ -434,6 +686,9 @@ static void BM_Usage() {
           "Use --bench=ft,<fmt> or --bench=fq,<fmt> to run benchmark.\n\n");
   fprintf(stderr, "== valid fmt are:\n\n");
   fprintf(stderr, " bf     (bloom filter)\n");
+  fprintf(stderr, " bbf    (cache-line blocked bloom filter)\n");
+  fprintf(stderr, " xf     (xor filter)\n");
+  fprintf(stderr, " gcs    (golomb-coded set)\n");
   fprintf(stderr, " bmp    (bitmap, uncompressed)\n");
   fprintf(stderr, " vb     (bitmap, varint)\n");
   fprintf(stderr, " vbp    (bitmap, modified varint)\n");
@@ -472,6 +727,15 @@ static void BM_Parse(const char* bench, const char* fmt) {
   } else if (strcmp(fmt + 1, "bf") == 0) {
     BM_LogAndApply<pdlfs::plfsio::BloomBlock, pdlfs::plfsio::BloomKeyMayMatch>(
         bench);
+  } else if (strcmp(fmt + 1, "bbf") == 0) {
+    BM_LogAndApply<pdlfs::plfsio::BlockedBloomBlock,
+                   pdlfs::plfsio::BlockedBloomKeyMayMatch>(bench);
+  } else if (strcmp(fmt + 1, "xf") == 0) {
+    BM_LogAndApply<pdlfs::plfsio::XorFilterBlock,
+                   pdlfs::plfsio::XorKeyMayMatch>(bench);
+  } else if (strcmp(fmt + 1, "gcs") == 0) {
+    BM_LogAndApply<pdlfs::plfsio::GcsFilterBlock,
+                   pdlfs::plfsio::GcsKeyMayMatch>(bench);
   } else if (strcmp(fmt + 1, "bmp") == 0) {
     BM_Bmp<pdlfs::plfsio::UncompressedFormat>(bench);
   } else if (strcmp(fmt + 1, "r") == 0) {
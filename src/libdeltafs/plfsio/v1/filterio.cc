@@ -12,6 +12,7 @@
 #include "filterio.h"
 
 #include <assert.h>
+#include <algorithm>
 
 //            =============== <---+
 // filters > |   filter 1    |    |
@@ -81,98 +82,198 @@ Status FilterWriter::Finish() {
   return status;
 }
 
-FilterReader::FilterReader(RandomAccessFile* src, uint64_t src_sz)
+namespace {
+// Number of index entries loaded at a time
+const uint32_t kIndexPageEntries = 256;
+const size_t kIndexEntrySize = 12;
+
+void DeleteCachedFilter(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+}  // namespace
+
+FilterReader::FilterReader(RandomAccessFile* src, uint64_t src_sz,
+                           Cache* cache)
     : src_(src),
       src_sz_(src_sz),
-      n_(0)
-
-{}
+      cache_(cache),
+      cache_id_(0),
+      n_(0),
+      footer_loaded_(false),
+      index_offset_(0) {
+  if (cache_ != NULL) {
+    cache_id_ = cache_->NewId();
+  }
+}
 
 // Retrieve the filter corresponding to a specific epoch. Return OK on success,
 // or a non-OK status on errors.
 Status FilterReader::Read(uint32_t const ep, Slice* const result,
                           std::string* scratch) {
-  Status status = MaybeLoadCache();
-  if (!status.ok()) {
+  *result = Slice();
+  if (cache_ != NULL) {
+    Cache::Handle* h;
+    Status status = Get(ep, result, &h);
+    if (status.ok() && h != NULL) {
+      scratch->assign(result->data(), result->size());
+      *result = *scratch;
+      Release(h);
+    }
     return status;
   }
-  assert(indexes_.size() >= 12);
-  if (n_ == 0) {
+
+  uint64_t offset, size;
+  bool found;
+  Status status = Locate(ep, &offset, &size, &found);
+  if (status.ok() && found) {
+    scratch->resize(size);
+    status = src_->Read(offset, size, result, &(*scratch)[0]);
+  }
+
+  return status;
+}
+
+Status FilterReader::Get(uint32_t const ep, Slice* const result,
+                         Cache::Handle** handle) {
+  assert(cache_ != NULL);
+  *result = Slice();
+  *handle = NULL;
+  char tmp[12];
+  EncodeFixed64(tmp, cache_id_);
+  EncodeFixed32(tmp + 8, ep);
+  const Slice key(tmp, sizeof(tmp));
+  Cache::Handle* h = cache_->Lookup(key);
+  if (h == NULL) {
+    uint64_t offset, size;
+    bool found;
+    Status status = Locate(ep, &offset, &size, &found);
+    if (!status.ok() || !found) {
+      return status;
+    }
+    std::string* const filter = new std::string;
+    filter->resize(size);
+    Slice contents;
+    status = src_->Read(offset, size, &contents, &(*filter)[0]);
+    if (status.ok() && contents.size() != size) {
+      status = Status::IOError("Read ret partial data");
+    }
+    if (!status.ok()) {
+      delete filter;
+      return status;
+    }
+    if (contents.data() != filter->data()) {
+      filter->assign(contents.data(), contents.size());
+    }
+    h = cache_->Insert(key, filter, filter->size(), &DeleteCachedFilter);
+  }
+
+  *result = *reinterpret_cast<std::string*>(cache_->Value(h));
+  *handle = h;
+  return Status::OK();
+}
+
+void FilterReader::Release(Cache::Handle* handle) {
+  if (handle != NULL) {
+    cache_->Release(handle);
+  }
+}
+
+// Find the location of the filter of a specific epoch. Set *found to false if
+// there is no such filter.
+Status FilterReader::Locate(uint32_t const ep, uint64_t* offset, uint64_t* size,
+                            bool* found) {
+  *found = false;
+  Status status = MaybeLoadCache();
+  if (!status.ok() || n_ == 0) {
     return status;
   }
 
+  // Find the first filter whose epoch is no less than the target
   uint32_t left = 0;
-  uint32_t right = n_ - 1;
+  uint32_t right = n_;
+  uint32_t epoch;
+  uint64_t off;
   while (left < right) {
-    uint32_t mid = (left + right + 1) / 2;
-    uint32_t midepoch = DecodeFixed32(&indexes_[mid * 12]);
-    if (midepoch < ep) {
-      // Mid is smaller than target
-      left = mid;
+    uint32_t mid = left + (right - left) / 2;
+    status = ReadEntry(mid, &epoch, &off);
+    if (!status.ok()) {
+      return status;
+    } else if (epoch < ep) {
+      left = mid + 1;
     } else {
-      // Mid >= target
-      right = mid - 1;
+      right = mid;
     }
   }
-  uint32_t start = left * 12;
-  uint32_t filterepoch = DecodeFixed32(&indexes_[start]);
-  uint64_t offset = DecodeFixed64(&indexes_[start + 4]);
-  uint32_t next_filterepoch;
-  uint64_t next_offset;
-  const size_t limit = indexes_.size();
-  size_t off = start + 12;
-  for (; off + 11 < limit; off += 12) {
-    next_filterepoch = DecodeFixed32(&indexes_[off]);
-    next_offset = DecodeFixed64(&indexes_[off + 4]);
-    if (filterepoch == ep) {
-      scratch->resize(next_offset - offset);
-      status = src_->Read(offset, next_offset - offset, result, &(*scratch)[0]);
-      break;
+  if (left == n_) {
+    return status;
+  }
+  status = ReadEntry(left, &epoch, &off);
+  if (status.ok() && epoch == ep) {
+    uint32_t ignored_epoch;
+    uint64_t limit;
+    status = ReadEntry(left + 1, &ignored_epoch, &limit);
+    if (status.ok()) {
+      if (limit < off) {
+        status = Status::Corruption("Bad filter indexes");
+      } else {
+        *offset = off;
+        *size = limit - off;
+        *found = true;
+      }
     }
-
-    filterepoch = next_filterepoch;
-    offset = next_offset;
   }
 
   return status;
 }
 
+// Read the i-th index entry. Entry n_ is the footer entry.
+Status FilterReader::ReadEntry(uint32_t const i, uint32_t* epoch,
+                               uint64_t* offset) {
+  assert(i <= n_);
+  std::string* const page = &index_pages_[i / kIndexPageEntries];
+  if (page->empty()) {
+    const uint32_t start = (i / kIndexPageEntries) * kIndexPageEntries;
+    const uint32_t limit = std::min(start + kIndexPageEntries, n_ + 1);
+    const size_t bytes = kIndexEntrySize * (limit - start);
+    std::string buf;
+    buf.resize(bytes);
+    Slice contents;
+    Status status = src_->Read(index_offset_ + kIndexEntrySize * start, bytes,
+                               &contents, &buf[0]);
+    if (status.ok() && contents.size() != bytes) {
+      status = Status::IOError("Read ret partial data");
+    }
+    if (!status.ok()) {
+      return status;
+    }
+    page->assign(contents.data(), contents.size());
+  }
+  const char* const p =
+      page->data() + kIndexEntrySize * (i % kIndexPageEntries);
+  *epoch = DecodeFixed32(p);
+  *offset = DecodeFixed64(p + 4);
+  return Status::OK();
+}
+
 uint32_t FilterReader::TEST_NumEpochs() {
   Status status = MaybeLoadCache();
   if (status.ok()) return n_;
   return 0;
 }
 
-Status FilterReader::LoadFilterIndexes(Slice* footer) {
-  n_ = DecodeFixed32(footer->data());
-
-  if (n_ == 0) {
-    cache_storage_.assign(footer->data(), footer->size());
-    indexes_ = cache_storage_;
-  } else {
-    const size_t indexbytes = 12 * (n_ + 1);
-    cache_storage_.resize(indexbytes);
-    if (src_sz_ < indexbytes) {
-      cache_status_ = Status::Corruption("Input file is too short for indexes");
-    } else {
-      cache_status_ = src_->Read(src_sz_ - indexbytes, indexbytes, &indexes_,
-                                 &cache_storage_[0]);
-      if (cache_status_.ok()) {
-        if (indexes_.size() != indexbytes) {
-          cache_status_ = Status::IOError("Read ret partial data");
-        }
-      }
-    }
+size_t FilterReader::TEST_NumIndexPagesLoaded() const {
+  size_t result = 0;
+  for (size_t i = 0; i < index_pages_.size(); i++) {
+    if (!index_pages_[i].empty()) result++;
   }
-
-  return cache_status_;
+  return result;
 }
 
-// Read and cache filter indexes and the footer.
+// Read the footer. Filter indexes are loaded on demand.
 // Return OK on success, or a non-OK status on errors.
 Status FilterReader::MaybeLoadCache() {
   // Do not repeat prev efforts
-  if (!cache_status_.ok() || !indexes_.empty()) {
+  if (!cache_status_.ok() || footer_loaded_) {
     return cache_status_;
   }
 
@@ -191,10 +292,18 @@ Status FilterReader::MaybeLoadCache() {
   }
 
   if (cache_status_.ok()) {
-    return LoadFilterIndexes(&footer);
-  } else {
-    return cache_status_;
+    n_ = DecodeFixed32(footer.data());
+    const uint64_t indexbytes = kIndexEntrySize * (uint64_t(n_) + 1);
+    if (src_sz_ < indexbytes) {
+      cache_status_ = Status::Corruption("Input file is too short for indexes");
+    } else {
+      index_offset_ = src_sz_ - indexbytes;
+      index_pages_.resize(n_ / kIndexPageEntries + 1);
+      footer_loaded_ = true;
+    }
   }
+
+  return cache_status_;
 }
 
 }  // namespace plfsio
@@ -11,12 +11,14 @@
 
 #pragma once
 
+#include "pdlfs-common/cache.h"
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/status.h"
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 namespace pdlfs {
 namespace plfsio {
@@ -38,25 +40,43 @@ class FilterWriter {
   uint64_t off_;
 };
 
-// Read filter contents from a log file.
+// Read filter contents from a log file. Only the footer is read when the
+// reader is first used. Filter indexes are then loaded a page at a time as
+// lookups reach them. If a cache is given, filters read are kept in the cache
+// so that repeated lookups cost neither I/O nor a copy when done through
+// Get(). The cache may be shared among readers.
 class FilterReader {
  public:
-  FilterReader(RandomAccessFile* src, uint64_t src_sz);
+  FilterReader(RandomAccessFile* src, uint64_t src_sz, Cache* cache = NULL);
 
   Status Read(uint32_t epoch, Slice* result, std::string* scratch);
 
+  // Obtain the filter of a specific epoch without copying it. On success,
+  // *handle is set to a handle that pins the filter and must be passed to
+  // Release() once *result is no longer used. *handle is set to NULL when
+  // the epoch has no filter. REQUIRES: a cache was given to the reader.
+  Status Get(uint32_t epoch, Slice* result, Cache::Handle** handle);
+  void Release(Cache::Handle* handle);
+
   uint32_t TEST_NumEpochs();
+  size_t TEST_NumIndexPagesLoaded() const;
 
  private:
-  Status LoadFilterIndexes(Slice* footer);
+  Status Locate(uint32_t epoch, uint64_t* offset, uint64_t* size, bool* found);
+  Status ReadEntry(uint32_t i, uint32_t* epoch, uint64_t* offset);
   Status MaybeLoadCache();
 
   RandomAccessFile* const src_;
   const uint64_t src_sz_;
+  Cache* const cache_;  // May be NULL
+  uint64_t cache_id_;
   uint32_t n_;  // Total number of filters
   Status cache_status_;
-  std::string cache_storage_;
-  Slice indexes_;  // This includes the footer entry
+  bool footer_loaded_;
+  uint64_t index_offset_;  // Offset of the first index entry
+  // Index pages loaded so far. An empty page has not been loaded.
+  // The last index entry is always the footer entry.
+  std::vector<std::string> index_pages_;
 };
 
 }  // namespace plfsio
@@ -114,6 +114,7 @@ class FilterIoTest {
     env_ = new TestEnv;
     src_sz_ = 0;
     reader_ = NULL;
+    cache_ = NULL;
     src_ = NULL;
     writer_ = NULL;
     dst_ = NULL;
@@ -121,6 +122,7 @@ class FilterIoTest {
 
   ~FilterIoTest() {
     delete reader_;
+    delete cache_;
     delete src_;
     delete writer_;
     delete dst_;
@@ -146,7 +148,7 @@ class FilterIoTest {
   void OpenReader() {
     ASSERT_OK(env_->NewRandomAccessFile("test.ftl", &src_));
     ASSERT_OK(env_->GetFileSize("test.ftl", &src_sz_));
-    reader_ = new FilterReader(src_, src_sz_);
+    reader_ = new FilterReader(src_, src_sz_, cache_);
   }
 
   uint32_t NumPuts() {
@@ -165,6 +167,7 @@ class FilterIoTest {
   RandomAccessFile* src_;
   uint64_t src_sz_;
   FilterReader* reader_;
+  Cache* cache_;
   WritableFile* dst_;
   FilterWriter* writer_;
   Env* env_;
@@ -204,6 +207,44 @@ TEST(FilterIoTest, MoreReadWrite) {
   }
 }
 
+TEST(FilterIoTest, LazyIndexes) {
+  const uint32_t num_puts = 1000;
+  char tmp[4];
+  Slice t(tmp, sizeof(tmp));
+  for (uint32_t i = 0; i < num_puts; i++) {
+    EncodeFixed32(tmp, i);
+    Put(2 * i, t);
+  }
+  Finish();
+  EncodeFixed32(tmp, 7);
+  ASSERT_EQ(Get(14), t);
+  // A single lookup reads no more than a few index pages
+  ASSERT_LT(reader_->TEST_NumIndexPagesLoaded(), 4);
+  ASSERT_EQ(Get(15), Slice());
+  ASSERT_EQ(Get(2 * num_puts), Slice());
+  EncodeFixed32(tmp, num_puts - 1);
+  ASSERT_EQ(Get(2 * (num_puts - 1)), t);
+}
+
+TEST(FilterIoTest, CachedReads) {
+  Put(1, "111");
+  Put(3, "333");
+  Finish();
+  cache_ = NewLRUCache(1 << 20);
+  OpenReader();
+  for (int i = 0; i < 2; i++) {
+    Slice result;
+    Cache::Handle* h;
+    ASSERT_OK(reader_->Get(3, &result, &h));
+    ASSERT_TRUE(h != NULL);
+    ASSERT_EQ(result, "333");
+    reader_->Release(h);
+    ASSERT_OK(reader_->Get(2, &result, &h));
+    ASSERT_TRUE(h == NULL);
+  }
+  ASSERT_EQ(Get(1), "111");
+}
+
 }  // namespace plfsio
 }  // namespace pdlfs
 
@@ -11,6 +11,7 @@
 
 #include "format.h"
 
+#include <algorithm>
 #include <stdio.h>
 #include <string.h>
 
@@ -21,6 +22,17 @@ std::string DirInfoFileName(const std::string& dirname) {
   return dirname + "/DIR.info";
 }
 
+std::string ChecksumName(ChecksumType type) {
+  switch (type) {
+    case kCsCrc32c:
+      return "crc32c";
+    case kCsXxhash64:
+      return "xxhash64";
+    default:
+      return "Unknown";
+  }
+}
+
 std::string DirModeName(DirMode mode) {
   switch (mode) {
     case kDmMultiMap:
@@ -66,6 +78,73 @@ std::string EpochKey(uint32_t epoch) {
   return tmp;
 }
 
+namespace {
+// Leading byte of compact table handles. Regular table handles start with
+// the length of a non-empty smallest key, which is never 0.
+const unsigned char kCompactTableHandle = 0x00;
+
+// Map signed deltas to unsigned integers so that small deltas of either sign
+// encode to short varints.
+inline uint64_t ZigZag(uint64_t delta) {
+  const int64_t sign = static_cast<int64_t>(delta) >> 63;
+  return (delta << 1) ^ static_cast<uint64_t>(sign);
+}
+
+inline uint64_t UnZigZag(uint64_t input) {
+  return (input >> 1) ^ (~(input & 1) + 1);
+}
+
+void PutPrefixCompressedKey(std::string* dst, const Slice& last,
+                            const Slice& key) {
+  size_t shared = 0;
+  const size_t n = std::min(last.size(), key.size());
+  while (shared < n && last[shared] == key[shared]) shared++;
+  PutVarint32(dst, static_cast<uint32_t>(shared));
+  PutLengthPrefixedSlice(dst, Slice(key.data() + shared, key.size() - shared));
+}
+
+bool GetPrefixCompressedKey(Slice* input, const Slice& last,
+                            std::string* key) {
+  uint32_t shared;
+  Slice non_shared;
+  if (!GetVarint32(input, &shared) ||
+      !GetLengthPrefixedSlice(input, &non_shared) || shared > last.size()) {
+    return false;
+  }
+  key->assign(last.data(), shared);
+  key->append(non_shared.data(), non_shared.size());
+  return true;
+}
+}  // namespace
+
+// Samples are prefix compressed against their predecessors. The first
+// sample is compressed against "base".
+void TableHandle::EncodeKeySamples(std::string* dst, const Slice& base) const {
+  PutVarint64(dst, num_entries_);
+  PutVarint32(dst, static_cast<uint32_t>(key_samples_.size()));
+  Slice last = base;
+  for (size_t i = 0; i < key_samples_.size(); i++) {
+    PutPrefixCompressedKey(dst, last, key_samples_[i]);
+    last = key_samples_[i];
+  }
+}
+
+Status TableHandle::DecodeKeySamples(Slice* input, const Slice& base) {
+  uint32_t num_samples;
+  if (!GetVarint64(input, &num_entries_) ||
+      !GetVarint32(input, &num_samples)) {
+    return Status::Corruption("Bad table key samples");
+  }
+  key_samples_.resize(num_samples);
+  for (uint32_t i = 0; i < num_samples; i++) {
+    const Slice last = i != 0 ? Slice(key_samples_[i - 1]) : base;
+    if (!GetPrefixCompressedKey(input, last, &key_samples_[i])) {
+      return Status::Corruption("Bad table key samples");
+    }
+  }
+  return Status::OK();
+}
+
 void TableHandle::EncodeTo(std::string* dst) const {
   assert(filter_offset_ != ~static_cast<uint64_t>(0));
   assert(filter_size_ != ~static_cast<uint64_t>(0));
@@ -80,9 +159,48 @@ void TableHandle::EncodeTo(std::string* dst) const {
   PutVarint64(dst, filter_size_);
   PutVarint64(dst, index_offset_);
   PutVarint64(dst, index_size_);
+  // Key samples are optional and are appended only when present so handles
+  // without them keep their original encoding.
+  if (!key_samples_.empty()) {
+    EncodeKeySamples(dst, Slice());
+  }
+}
+
+// The largest key and the first key sample are prefix compressed against the
+// smallest key. Filter blocks are written right after index blocks so the
+// filter offset is stored as a delta from the end of the index block. Tables
+// without a filter have both a zero filter size and a zero filter offset, in
+// which case the offset is stored as is.
+void TableHandle::EncodeCompactTo(std::string* dst) const {
+  assert(filter_offset_ != ~static_cast<uint64_t>(0));
+  assert(filter_size_ != ~static_cast<uint64_t>(0));
+  assert(index_offset_ != ~static_cast<uint64_t>(0));
+  assert(index_size_ != ~static_cast<uint64_t>(0));
+  assert(!smallest_key_.empty());
+  assert(!largest_key_.empty());
+
+  dst->push_back(static_cast<char>(kCompactTableHandle));
+  PutLengthPrefixedSlice(dst, smallest_key_);
+  PutPrefixCompressedKey(dst, smallest_key_, largest_key_);
+  PutVarint64(dst, index_offset_);
+  PutVarint64(dst, index_size_);
+  PutVarint64(dst, filter_size_);
+  if (filter_size_ != 0) {
+    PutVarint64(dst, ZigZag(filter_offset_ - (index_offset_ + index_size_)));
+  } else {
+    PutVarint64(dst, filter_offset_);
+  }
+  if (!key_samples_.empty()) {
+    EncodeKeySamples(dst, smallest_key_);
+  }
 }
 
 Status TableHandle::DecodeFrom(Slice* input) {
+  if (!input->empty() &&
+      static_cast<unsigned char>((*input)[0]) == kCompactTableHandle) {
+    input->remove_prefix(1);
+    return DecodeCompactFrom(input);
+  }
   Slice smallest_key;
   Slice largest_key;
   if (!GetLengthPrefixedSlice(input, &smallest_key) ||
@@ -92,11 +210,62 @@ Status TableHandle::DecodeFrom(Slice* input) {
       !GetVarint64(input, &index_offset_) ||
       !GetVarint64(input, &index_size_)) {
     return Status::Corruption("Bad table handle");
+  }
+  smallest_key_ = smallest_key.ToString();
+  largest_key_ = largest_key.ToString();
+  key_samples_.clear();
+  num_entries_ = 0;
+  if (!input->empty()) {
+    return DecodeKeySamples(input, Slice());
+  }
+  return Status::OK();
+}
+
+Status TableHandle::DecodeCompactFrom(Slice* input) {
+  Slice smallest_key;
+  uint64_t filter_offset;
+  if (!GetLengthPrefixedSlice(input, &smallest_key) ||
+      !GetPrefixCompressedKey(input, smallest_key, &largest_key_) ||
+      !GetVarint64(input, &index_offset_) ||
+      !GetVarint64(input, &index_size_) ||
+      !GetVarint64(input, &filter_size_) ||
+      !GetVarint64(input, &filter_offset)) {
+    return Status::Corruption("Bad compact table handle");
+  }
+  smallest_key_ = smallest_key.ToString();
+  if (filter_size_ != 0) {
+    filter_offset_ = index_offset_ + index_size_ + UnZigZag(filter_offset);
   } else {
-    smallest_key_ = smallest_key.ToString();
-    largest_key_ = largest_key.ToString();
-    return Status::OK();
+    filter_offset_ = filter_offset;
   }
+  key_samples_.clear();
+  num_entries_ = 0;
+  if (!input->empty()) {
+    return DecodeKeySamples(input, smallest_key_);
+  }
+  return Status::OK();
+}
+
+uint64_t TableHandle::EstimateEntries(const Slice& start,
+                                      const Slice& end) const {
+  assert(!key_samples_.empty());
+  // Each sample stands for an equal share of the entries of the table
+  std::vector<std::string>::const_iterator lo = key_samples_.begin();
+  std::vector<std::string>::const_iterator hi = key_samples_.end();
+  if (!start.empty()) {
+    lo = std::lower_bound(key_samples_.begin(), key_samples_.end(),
+                          start.ToString());
+  }
+  if (!end.empty()) {
+    hi = std::lower_bound(key_samples_.begin(), key_samples_.end(),
+                          end.ToString());
+  }
+  if (hi <= lo) {
+    return 0;
+  }
+  const uint64_t hits = static_cast<uint64_t>(hi - lo);
+  return (hits * num_entries_ + key_samples_.size() - 1) /
+         key_samples_.size();
 }
 
 void EpochHandle::EncodeTo(std::string* dst) const {
@@ -146,11 +315,22 @@ DirOptions ApplyFooter(const DirOptions& options, const Footer& footer) {
   result.num_epochs = int(footer.num_epochs());
   result.value_size = footer.value_size();
   result.key_size = footer.key_size();
-  result.fixed_kv_length = footer.fixed_kv_length();
+  result.fixed_kv_length =
+      (footer.fixed_kv_length() & ~(kKvEctIndex | kKvKeyIndex)) != 0;
+  result.ect_index = (footer.fixed_kv_length() & kKvEctIndex) != 0;
+  result.key_index = (footer.fixed_kv_length() & kKvKeyIndex) != 0;
   result.leveldb_compatible = footer.leveldb_compatible();
   result.epoch_log_rotation = footer.epoch_log_rotation();
-  result.skip_checksums = footer.skip_checksums();
-  result.filter = static_cast<FilterType>(footer.filter_type());
+  result.skip_checksums = footer.skip_checksums() & ~kCkXxhash & 0xFF;
+  result.checksum_type =
+      (footer.skip_checksums() & kCkXxhash) != 0 ? kCsXxhash64 : kCsCrc32c;
+  result.filter = static_cast<FilterType>(footer.filter_type() &
+                                          ~kFtPartitioned & 0xFF);
+  if ((footer.filter_type() & kFtPartitioned) == 0) {
+    result.filter_partition_keys = 0;
+  } else if (result.filter_partition_keys == 0) {
+    result.filter_partition_keys = 1;  // Any non-zero value will do
+  }
   result.mode = static_cast<DirMode>(footer.mode());
   return result;
 }
@@ -160,14 +340,22 @@ Footer Mkfoot(const DirOptions& options) {
   result.set_lg_parts(static_cast<uint32_t>(options.lg_parts));
   result.set_value_size(static_cast<uint32_t>(options.value_size));
   result.set_key_size(static_cast<uint32_t>(options.key_size));
-  result.set_fixed_kv_length(
-      static_cast<unsigned char>(options.fixed_kv_length));
+  unsigned char fixed_kv_length =
+      static_cast<unsigned char>(options.fixed_kv_length);
+  if (options.ect_index) fixed_kv_length |= kKvEctIndex;
+  if (options.key_index) fixed_kv_length |= kKvKeyIndex;
+  result.set_fixed_kv_length(fixed_kv_length);
   result.set_leveldb_compatible(
       static_cast<unsigned char>(options.leveldb_compatible));
   result.set_epoch_log_rotation(
       static_cast<unsigned char>(options.epoch_log_rotation));
-  result.set_skip_checksums(static_cast<unsigned char>(options.skip_checksums));
-  result.set_filter_type(static_cast<unsigned char>(options.filter));
+  unsigned char skip_checksums =
+      static_cast<unsigned char>(options.skip_checksums);
+  if (options.checksum_type == kCsXxhash64) skip_checksums |= kCkXxhash;
+  result.set_skip_checksums(skip_checksums);
+  unsigned char filter_type = static_cast<unsigned char>(options.filter);
+  if (options.filter_partition_keys != 0) filter_type |= kFtPartitioned;
+  result.set_filter_type(filter_type);
   result.set_mode(static_cast<unsigned char>(options.mode));
   return result;
 }
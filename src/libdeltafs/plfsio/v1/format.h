@@ -23,6 +23,10 @@
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/crc32c.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/xxhash.h"
+
+#include <string>
+#include <vector>
 
 namespace pdlfs {
 namespace plfsio {
@@ -34,6 +38,9 @@ extern std::string EpochKey(uint32_t epoch);
 extern std::string EpochTableKey(uint32_t epoch, uint32_t table);
 extern Status ParseEpochKey(const Slice& input, uint32_t* epoch,
                             uint32_t* table);
+// Key of the root index entry locating the directory's key-to-epoch index.
+// Sorts after all epoch keys. See DirOptions::key_epoch_index.
+static const char kKeyEpochIndexKey[] = "~keyepochs";
 
 // Type definition for write ahead log chunks
 enum ChunkType {
@@ -43,6 +50,8 @@ enum ChunkType {
   kIdxChunk = 0x01,  // Standard SST indexes
   kSbfChunk = 0x02,  // Standard bloom filters
   kBmpChunk = 0x03,  // Bitmap filters (w/ different compression fmts)
+  kXorChunk = 0x04,  // Xor filters
+  kGcsChunk = 0x05,  // Golomb-coded sets
 
   // Meta indexing block types
   kMetaChunk = 0x71,  // Meta indexes for each epoch
@@ -53,6 +62,38 @@ enum ChunkType {
   kFooter = 0xfe
 };
 
+// Flag set in the filter type byte of a directory footer when the filter of
+// each table is split into partitions. In such cases, the filter handle of a
+// table points to a filter index block that maps the largest key of each
+// partition to the partition's filter block.
+enum { kFtPartitioned = 0x80 };
+
+// Flag set in the fixed kv length byte of a directory footer when the index
+// block of each table may be followed by an ECT over the keys of the table.
+// See DirOptions::ect_index.
+enum { kKvEctIndex = 0x80 };
+
+// Flag set in the fixed kv length byte of a directory footer when the index
+// block of each table may be followed by a cuckoo hash table locating the
+// keys of the table. See DirOptions::key_index.
+enum { kKvKeyIndex = 0x40 };
+
+// Flag set in the skip checksums byte of a directory footer when blocks and
+// log chunks are protected by xxhash64 rather than crc32c.
+enum { kCkXxhash = 0x80 };
+
+// Return the checksum of data[0,n-1] chained to "init", the checksum of some
+// preceding data. Checksums of the same data must be chained the same way by
+// writers and readers. Results are masked like crc32c before being stored.
+inline uint32_t ExtendChecksum(ChecksumType type, uint32_t init,
+                               const char* data, size_t n) {
+  if (type == kCsXxhash64) {
+    return static_cast<uint32_t>(xxhash64(data, n, init));
+  } else {
+    return crc32c::Extend(init, data, n);
+  }
+}
+
 // Information regarding a table.
 class TableHandle {
  public:
@@ -82,10 +123,35 @@ class TableHandle {
   Slice largest_key() const { return largest_key_; }
   void set_largest_key(const Slice& key) { largest_key_ = key.ToString(); }
 
+  // Keys sampled evenly from the table, in key order, and the total number
+  // of entries of the table. Both are only stored when the directory is
+  // written with a non-zero DirOptions::table_key_samples and are otherwise
+  // empty and 0.
+  const std::vector<std::string>& key_samples() const { return key_samples_; }
+  uint64_t num_entries() const { return num_entries_; }
+  // Take over the keys in *samples. *samples is left empty.
+  void set_key_samples(std::vector<std::string>* samples, uint64_t n) {
+    key_samples_.swap(*samples);
+    samples->clear();
+    num_entries_ = n;
+  }
+
+  // Estimate the number of entries of the table with keys within [start,
+  // end) using key samples. An empty bound is treated as unbounded.
+  // REQUIRES: key_samples() is not empty.
+  uint64_t EstimateEntries(const Slice& start, const Slice& end) const;
+
   void EncodeTo(std::string* dst) const;
+  // Encode the handle in a more compact format. Handles in either format
+  // are decoded by DecodeFrom(). See DirOptions::compact_table_handles.
+  void EncodeCompactTo(std::string* dst) const;
   Status DecodeFrom(Slice* input);
 
  private:
+  void EncodeKeySamples(std::string* dst, const Slice& base) const;
+  Status DecodeKeySamples(Slice* input, const Slice& base);
+  Status DecodeCompactFrom(Slice* input);
+
   // Key range of the table
   std::string smallest_key_;
   std::string largest_key_;
@@ -94,6 +160,9 @@ class TableHandle {
   uint64_t filter_size_;
   uint64_t index_offset_;
   uint64_t index_size_;
+  // Key distribution of the table
+  std::vector<std::string> key_samples_;
+  uint64_t num_entries_;
 };
 
 // Information regarding an epoch.
@@ -220,11 +289,14 @@ extern std::string DirInfoFileName(const std::string& dirname);
 
 extern std::string DirModeName(DirMode mode);
 
+extern std::string ChecksumName(ChecksumType type);
+
 inline TableHandle::TableHandle()
     : filter_offset_(~static_cast<uint64_t>(0) /* Invalid offset */),
       filter_size_(~static_cast<uint64_t>(0) /* Invalid size */),
       index_offset_(~static_cast<uint64_t>(0) /* Invalid offset */),
-      index_size_(~static_cast<uint64_t>(0) /* Invalid size */) {
+      index_size_(~static_cast<uint64_t>(0) /* Invalid size */),
+      num_entries_(0) {
   // Empty
 }
 
@@ -12,15 +12,26 @@
 #include "internal.h"
 
 #include "../../util/logging.h"
+#include "cuckoo.h"
+#include "ectidx.h"
 #include "events.h"
 #include "filter.h"
+#include "perf.h"
+#include "pmem.h"
+#include "sorter.h"
+#include "trace.h"
 
+#include "pdlfs-common/cache.h"
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/strutil.h"
 
 #include <algorithm>
 #include <assert.h>
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 namespace pdlfs {
 extern const char* GetLengthPrefixedSlice(const char* p, const char* limit,
@@ -75,22 +86,41 @@ Compaction::~Compaction() {
 // This overhead is necessary for supporting variable length
 // key-value pairs.
 WriteBuffer::WriteBuffer(const DirOptions& options)
-    : num_entries_(0), finished_(false) {
+    : options_(options),
+      hugepage_bytes_(0),
+      num_entries_(0),
+      key_size_(0),
+      fixed_key_size_(true),
+      finished_(false),
+      full_(false),
+      pmem_(NULL),
+      pmem_slot_(0),
+      pmem_data_(NULL),
+      pmem_size_(0),
+      pmem_part_(0),
+      epoch_(0) {
+  bytes_per_entry_ = BytesPerEntry(options);
+}
+
+size_t WriteBuffer::BytesPerEntry(const DirOptions& options) {
   const size_t entry_size =  // Estimated, actual entry sizes may differ
       options.key_size + options.value_size;
-  bytes_per_entry_ =  // Memory usage per entry
-      static_cast<size_t>(
-          VarintLength(options.key_size)) +  // Varint encoding for key lengths
-      static_cast<size_t>(
-          VarintLength(options.value_size)) +  // For value lengths
-      entry_size;
+  // Plus varint encoding for key and value lengths
+  return static_cast<size_t>(VarintLength(options.key_size)) +
+         static_cast<size_t>(VarintLength(options.value_size)) + entry_size;
+}
+
+size_t WriteBuffer::RecordMemory(const DirOptions& options, size_t memory) {
+  const double bytes_per_entry = static_cast<double>(BytesPerEntry(options));
+  return static_cast<size_t>(memory * bytes_per_entry /
+                             (bytes_per_entry + sizeof(Entry)));
 }
 
 class WriteBuffer::Iter : public Iterator {
  public:
   explicit Iter(const WriteBuffer* write_buffer)
-      : buffer_(write_buffer->buffer_),
-        offsets_(&write_buffer->offsets_[0]),
+      : buffer_(write_buffer->contents()),
+        entries_(&write_buffer->entries_[0]),
         num_entries_(write_buffer->num_entries_),
         cursor_(num_entries_) {}
 
@@ -127,7 +157,7 @@ class WriteBuffer::Iter : public Iterator {
 
   void TryParseNextEntry() {
     if (Valid()) {
-      size_t offset = offsets_[cursor_];
+      size_t offset = entries_[cursor_].offset;
       Slice input = buffer_;
       assert(input.size() >= offset);
       input.remove_prefix(offset);
@@ -153,7 +183,7 @@ class WriteBuffer::Iter : public Iterator {
   Slice value_;  // Cached value
   Slice key_;    // Cached key
   Slice buffer_;
-  const uint32_t* offsets_;
+  const Entry* entries_;
   uint32_t num_entries_;
   uint32_t cursor_;
 };
@@ -163,14 +193,36 @@ Iterator* WriteBuffer::NewIterator() const {
   return new Iter(this);
 }
 
+const size_t WriteBuffer::kKeyPrefixSize;
+
+// Return the first kKeyPrefixSize bytes of a key as a big-endian integer so
+// that key prefixes can be compared as integers. Short keys are zero padded.
+// Zero padding does not affect key ordering: if two prefixes differ, the keys
+// differ in the same byte and compare the same way.
+uint64_t WriteBuffer::KeyPrefix(const Slice& key) {
+  uint64_t result = 0;
+  const size_t n = std::min(key.size(), kKeyPrefixSize);
+  for (size_t i = 0; i < n; i++) {
+    result |= static_cast<uint64_t>(static_cast<unsigned char>(key[i]))
+              << (56 - 8 * i);
+  }
+  return result;
+}
+
+// Key comparisons are first resolved through the key prefixes stored alongside
+// entry offsets. Only entries sharing the same prefix are compared against
+// their full keys, which requires random accesses to the buffer.
 struct WriteBuffer::STLLessThan {
   Slice buffer_;
 
   explicit STLLessThan(const Slice& buffer) : buffer_(buffer) {}
 
-  bool operator()(uint32_t a, uint32_t b) {
-    Slice key_a = GetKey(a);
-    Slice key_b = GetKey(b);
+  bool operator()(const Entry& a, const Entry& b) {
+    if (a.prefix != b.prefix) {
+      return a.prefix < b.prefix;
+    }
+    Slice key_a = GetKey(a.offset);
+    Slice key_b = GetKey(b.offset);
     assert(!key_a.empty() && !key_b.empty());
     return key_a < key_b;
   }
@@ -188,53 +240,425 @@ struct WriteBuffer::STLLessThan {
   }
 };
 
+namespace {
+// Ranges smaller than this are sorted using insertion sort.
+const size_t kRadixSortCutoff = 32;
+// Keys longer than this are sorted by std::sort. This bounds the depth of
+// radix sort recursion (and its stack usage).
+const size_t kMaxRadixSortKeySize = 32;
+// Min number of entries for a buffer to be sorted in parallel.
+const size_t kMinParaSortEntries = 32 << 10;
+// Max number of background sort jobs to schedule for each buffer.
+const int kMaxParaSortJobs = 8;
+}  // namespace
+
+// Return the depth-th byte of an entry's key. The first kKeyPrefixSize bytes
+// are served from the key prefix without touching the buffer.
+inline unsigned char WriteBuffer::KeyByte(const Entry& e, size_t depth) const {
+  if (depth < kKeyPrefixSize) {
+    return static_cast<unsigned char>(e.prefix >> (56 - 8 * depth));
+  } else {
+    return static_cast<unsigned char>(
+        data()[e.offset + VarintLength(key_size_) + depth]);
+  }
+}
+
+// Compare the keys of two entries starting from the depth-th byte, assuming
+// all keys share the same length.
+inline int WriteBuffer::CompareKeys(const Entry& a, const Entry& b,
+                                    size_t depth) const {
+  if (depth < kKeyPrefixSize) {
+    if (a.prefix != b.prefix) {
+      return a.prefix < b.prefix ? -1 : 1;
+    }
+    depth = kKeyPrefixSize;
+  }
+  if (depth >= key_size_) {
+    return 0;
+  }
+  const char* const base = data() + VarintLength(key_size_) + depth;
+  return memcmp(base + a.offset, base + b.offset, key_size_ - depth);
+}
+
+// Sort n entries stored in *a by their keys, assuming that all keys share the
+// same length and are already known to be equal in their first "depth" bytes.
+// Uses a most-significant-digit radix sort with one byte per digit. Each digit
+// is sorted by a stable counting sort so entries with duplicated keys keep
+// their insertion order. *tmp is scratch space that must be able to hold n
+// entries.
+void WriteBuffer::RadixSort(Entry* a, Entry* tmp, size_t n,
+                            size_t depth) const {
+  while (depth < key_size_) {
+    if (n < kRadixSortCutoff) {
+      for (size_t i = 1; i < n; i++) {
+        const Entry x = a[i];
+        size_t j = i;
+        for (; j > 0 && CompareKeys(a[j - 1], x, depth) > 0; j--) {
+          a[j] = a[j - 1];
+        }
+        a[j] = x;
+      }
+      return;
+    }
+    size_t count[257];
+    memset(count, 0, sizeof(count));
+    for (size_t i = 0; i < n; i++) {
+      count[1 + KeyByte(a[i], depth)]++;
+    }
+    // Skip digits shared by all entries
+    if (count[1 + KeyByte(a[0], depth)] == n) {
+      depth++;
+      continue;
+    }
+    for (size_t b = 1; b < 256; b++) {
+      count[b] += count[b - 1];
+    }
+    for (size_t i = 0; i < n; i++) {
+      tmp[count[KeyByte(a[i], depth)]++] = a[i];
+    }
+    memcpy(a, tmp, n * sizeof(Entry));
+    // The end of each bucket is now stored in count[]
+    size_t start = 0;
+    for (size_t b = 0; b < 256; b++) {
+      const size_t end = count[b];
+      if (end - start > 1) {
+        RadixSort(a + start, tmp + start, end - start, depth + 1);
+      }
+      start = end;
+    }
+    return;
+  }
+}
+
+// Sort n entries stored in *a by their key prefixes, assuming all keys fit in
+// their prefixes. Uses a least-significant-digit radix sort with one byte per
+// digit. The counts of all digits are gathered in a single pass and digits
+// shared by all entries are skipped, so each remaining digit takes one
+// scatter pass and no pass ever touches the buffer. Each pass is a stable
+// counting sort so entries with duplicated keys keep their insertion order.
+// *tmp is scratch space that must be able to hold n entries.
+void WriteBuffer::PrefixRadixSort(Entry* a, Entry* tmp, size_t n) {
+  size_t count[kKeyPrefixSize][256];
+  memset(count, 0, sizeof(count));
+  for (size_t i = 0; i < n; i++) {
+    const uint64_t prefix = a[i].prefix;
+    for (size_t d = 0; d < kKeyPrefixSize; d++) {
+      count[d][(prefix >> (8 * d)) & 0xff]++;
+    }
+  }
+  Entry* src = a;
+  Entry* dst = tmp;
+  for (size_t d = 0; d < kKeyPrefixSize; d++) {  // Least significant first
+    size_t* const c = count[d];
+    if (c[(src[0].prefix >> (8 * d)) & 0xff] == n) {
+      continue;
+    }
+    size_t start = 0;
+    for (size_t b = 0; b < 256; b++) {
+      const size_t num = c[b];
+      c[b] = start;
+      start += num;
+    }
+    for (size_t i = 0; i < n; i++) {
+      dst[c[(src[i].prefix >> (8 * d)) & 0xff]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+  if (src != a) {
+    memcpy(a, src, n * sizeof(Entry));
+  }
+}
+
+// State shared by the caller and all background jobs of a parallel sort.
+// Deleted by whoever drops the last reference. The caller returns once all
+// buckets are sorted, so jobs that start late must not touch anything other
+// than this state.
+struct WriteBuffer::RadixSortState {
+  RadixSortState() : cv(&mu) {}
+  const WriteBuffer* wb;
+  Entry* entries;
+  Entry* tmp;
+  size_t depth;
+  size_t ends[256];  // End of each bucket
+  port::Mutex mu;
+  port::CondVar cv;
+  int next_bucket;  // Next bucket to sort
+  int num_done;     // Number of buckets sorted
+  int refs;
+
+  void SortBuckets() {
+    MutexLock ml(&mu);
+    while (next_bucket < 256) {
+      const int b = next_bucket++;
+      mu.Unlock();
+      const size_t start = b != 0 ? ends[b - 1] : 0;
+      if (ends[b] - start > 1) {
+        wb->RadixSort(entries + start, tmp + start, ends[b] - start, depth + 1);
+      }
+      mu.Lock();
+      num_done++;
+      if (num_done == 256) {
+        cv.SignalAll();
+      }
+    }
+  }
+
+  void Unref() {
+    mu.Lock();
+    assert(refs > 0);
+    const bool last = (--refs == 0);
+    mu.Unlock();
+    if (last) {
+      delete this;
+    }
+  }
+};
+
+void WriteBuffer::BGRadixSort(void* arg) {
+  RadixSortState* const state = reinterpret_cast<RadixSortState*>(arg);
+  state->SortBuckets();
+  state->Unref();
+}
+
+// Partition entries by the first key byte that differs among them and then
+// sort the resulting buckets concurrently using the compaction pool. The
+// calling thread sorts buckets too so we will not be blocked even if all pool
+// threads happen to be busy.
+void WriteBuffer::ParaRadixSort() {
+  const size_t n = entries_.size();
+  std::vector<Entry> tmp(n);
+  Entry* const a = &entries_[0];
+  size_t count[257];
+  size_t depth = 0;
+  for (; depth < key_size_; depth++) {
+    memset(count, 0, sizeof(count));
+    for (size_t i = 0; i < n; i++) {
+      count[1 + KeyByte(a[i], depth)]++;
+    }
+    if (count[1 + KeyByte(a[0], depth)] != n) {
+      break;
+    }
+  }
+  if (depth == key_size_) {
+    return;  // All keys are equal
+  }
+  for (size_t b = 1; b < 256; b++) {
+    count[b] += count[b - 1];
+  }
+  for (size_t i = 0; i < n; i++) {
+    tmp[count[KeyByte(a[i], depth)]++] = a[i];
+  }
+  memcpy(a, &tmp[0], n * sizeof(Entry));
+
+  RadixSortState* const state = new RadixSortState;
+  state->wb = this;
+  state->entries = a;
+  state->tmp = &tmp[0];
+  state->depth = depth;
+  memcpy(state->ends, count, sizeof(state->ends));
+  state->next_bucket = 0;
+  state->num_done = 0;
+  state->refs = 1 + kMaxParaSortJobs;
+  for (int i = 0; i < kMaxParaSortJobs; i++) {
+    options_.compaction_pool->Schedule(WriteBuffer::BGRadixSort, state);
+  }
+  state->SortBuckets();
+  state->mu.Lock();
+  while (state->num_done < 256) {
+    state->cv.Wait();
+  }
+  state->mu.Unlock();
+  state->Unref();
+}
+
+// Gather all keys into a dense array for the sorter and apply the permutation
+// it returns to the entries.
+bool WriteBuffer::OffloadedSort() {
+  const size_t n = entries_.size();
+  std::string keys;
+  keys.reserve(n * key_size_);
+  const char* const base = data() + VarintLength(key_size_);
+  for (size_t i = 0; i < n; i++) {
+    keys.append(base + entries_[i].offset, key_size_);
+  }
+  std::vector<uint32_t> perm(n);
+  Status s = options_.key_sorter->Sort(keys.data(), key_size_,
+                                       static_cast<uint32_t>(n), &perm[0]);
+  if (!s.ok()) {
+    return false;
+  }
+  std::vector<Entry> sorted(n);
+  for (size_t i = 0; i < n; i++) {
+    assert(perm[i] < n);
+    sorted[i] = entries_[perm[i]];
+  }
+  memcpy(&entries_[0], &sorted[0], n * sizeof(Entry));
+  return true;
+}
+
 void WriteBuffer::Finish(bool skip_sort) {
   assert(!finished_);
   finished_ = true;
   // Sort entries if not skipped
-  if (!skip_sort) {
-    std::vector<uint32_t>::iterator begin = offsets_.begin();
-    std::vector<uint32_t>::iterator end = offsets_.end();
-    std::sort(begin, end, STLLessThan(buffer_));
+  if (!skip_sort && entries_.size() > 1) {
+    if (fixed_key_size_ && options_.key_sorter != NULL && OffloadedSort()) {
+      // Sorted by the key sorter
+    } else if (fixed_key_size_ && key_size_ <= kMaxRadixSortKeySize) {
+      if (options_.parallel_sorts && options_.compaction_pool != NULL &&
+          entries_.size() >= kMinParaSortEntries) {
+        ParaRadixSort();
+      } else if (key_size_ <= kKeyPrefixSize &&
+                 entries_.size() >= kRadixSortCutoff) {
+        std::vector<Entry> tmp(entries_.size());
+        PrefixRadixSort(&entries_[0], &tmp[0], entries_.size());
+      } else {
+        std::vector<Entry> tmp(entries_.size());
+        RadixSort(&entries_[0], &tmp[0], entries_.size(), 0);
+      }
+    } else {
+      std::vector<Entry>::iterator begin = entries_.begin();
+      std::vector<Entry>::iterator end = entries_.end();
+      std::sort(begin, end, STLLessThan(contents()));
+    }
   }
 }
 
 void WriteBuffer::Reset() {
+  if (pmem_ != NULL && num_entries_ != 0) {
+    pmem_->Release(pmem_slot_);
+  }
+  pmem_size_ = 0;
+  full_ = false;
   num_entries_ = 0;
+  key_size_ = 0;
+  fixed_key_size_ = true;
   finished_ = false;
-  offsets_.clear();
+  entries_.clear();
   buffer_.clear();
 }
 
+namespace {
+// Advise the OS to back the 2MB-aligned interior of [p, p + n) with
+// transparent huge pages. Must be called before the memory is first touched.
+// Return the number of bytes covered, or 0 if huge pages are unavailable.
+size_t AdviseHugePages(const void* p, size_t n) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  const uintptr_t kHugePageSize = 2 << 20;
+  const uintptr_t start =
+      (reinterpret_cast<uintptr_t>(p) + kHugePageSize - 1) &
+      ~(kHugePageSize - 1);
+  const uintptr_t end =
+      (reinterpret_cast<uintptr_t>(p) + n) & ~(kHugePageSize - 1);
+  if (end > start && madvise(reinterpret_cast<void*>(start), end - start,
+                             MADV_HUGEPAGE) == 0) {
+    return end - start;
+  }
+#endif
+  return 0;
+}
+}  // namespace
+
 void WriteBuffer::Reserve(size_t bytes_to_reserve) {
-  // Reserve memory for the write buffer
-  buffer_.reserve(bytes_to_reserve);
+  // Reserve memory for the write buffer. Not needed if records are stored in
+  // persistent memory
+  if (pmem_data_ == NULL) {
+    buffer_.reserve(bytes_to_reserve);
+  }
   const uint32_t num_entries =  // Estimated, actual counts may differ
       static_cast<uint32_t>(ceil(double(bytes_to_reserve) / bytes_per_entry_));
-  // Also reserve memory for the offset array
-  offsets_.reserve(num_entries);
+  // Also reserve memory for the entry array
+  entries_.reserve(num_entries);
+  if (options_.hugepage_buffers && num_entries_ == 0) {
+    hugepage_bytes_ = AdviseHugePages(buffer_.data(), buffer_.capacity());
+    if (entries_.capacity() != 0) {
+      entries_.resize(1);  // So the array can be addressed
+      hugepage_bytes_ +=
+          AdviseHugePages(&entries_[0], sizeof(Entry) * entries_.capacity());
+      entries_.resize(0);
+    }
+  }
+}
+
+void WriteBuffer::Resize(size_t bytes_to_reserve) {
+  assert(num_entries_ == 0);
+  if (buffer_.capacity() > bytes_to_reserve) {
+    std::string().swap(buffer_);
+    std::vector<Entry>().swap(entries_);
+    hugepage_bytes_ = 0;
+  }
+  Reserve(bytes_to_reserve);
+}
+
+void WriteBuffer::AttachPmem(PmemBufferFile* file, size_t slot,
+                             uint32_t part) {
+  assert(num_entries_ == 0);
+  std::string().swap(buffer_);
+  hugepage_bytes_ = 0;
+  pmem_ = file;
+  pmem_slot_ = slot;
+  pmem_data_ = file->data(slot);
+  pmem_size_ = 0;
+  pmem_part_ = part;
+}
+
+void WriteBuffer::TouchReservedMemory() {
+  assert(num_entries_ == 0);
+  buffer_.resize(buffer_.capacity());
+  buffer_.resize(0);
+  entries_.resize(entries_.capacity());
+  entries_.resize(0);
 }
 
 bool WriteBuffer::Add(const Slice& key, const Slice& value) {
   assert(!finished_);       // Finish() has not been called
   assert(key.size() != 0);  // Key cannot be empty
-  const size_t offset = buffer_.size();
-  PutLengthPrefixedSlice(&buffer_, key);
-  PutLengthPrefixedSlice(&buffer_, value);
-  offsets_.push_back(static_cast<uint32_t>(offset));
+  const size_t offset = size();
+  if (pmem_data_ != NULL) {
+    const size_t n = VarintLength(key.size()) + key.size() +
+                     VarintLength(value.size()) + value.size();
+    if (offset + n > pmem_->slot_size()) {
+      full_ = true;
+      return false;
+    } else if (num_entries_ == 0) {
+      pmem_->Begin(pmem_slot_, epoch_, pmem_part_);
+    }
+    char* p = EncodeVarint32(pmem_data_ + offset,
+                             static_cast<uint32_t>(key.size()));
+    memcpy(p, key.data(), key.size());
+    p = EncodeVarint32(p + key.size(), static_cast<uint32_t>(value.size()));
+    memcpy(p, value.data(), value.size());
+    pmem_size_ = offset + n;
+    pmem_->Commit(pmem_slot_, pmem_size_);
+  }
+  if (num_entries_ == 0) {
+    key_size_ = key.size();
+  } else if (key.size() != key_size_) {
+    fixed_key_size_ = false;
+  }
+  if (pmem_data_ == NULL) {
+    PutLengthPrefixedSlice(&buffer_, key);
+    PutLengthPrefixedSlice(&buffer_, value);
+  }
+  Entry entry;
+  entry.prefix = KeyPrefix(key);
+  entry.offset = static_cast<uint32_t>(offset);
+  entries_.push_back(entry);
   num_entries_++;
   return true;
 }
 
 size_t WriteBuffer::memory_usage() const {
   size_t result = 0;
-  result += sizeof(uint32_t) * offsets_.capacity();
+  result += sizeof(Entry) * entries_.capacity();
   result += buffer_.capacity();
   return result;
 }
 
 DirCompactor::DirCompactor(const DirOptions& options, DirBuilder* bu)
-    : options_(options), bu_(bu) {}
+    : options_(options),
+      bu_(bu),
+      direct_table_keys_(1),
+      num_direct_keys_(0) {}
 
 DirCompactor::~DirCompactor() { delete bu_; }
 
@@ -248,15 +672,47 @@ Status DirCompactor::Finish(uint32_t ep_seq) {
   return bu_->status_;
 }
 
+namespace {
+// Reset a filter for a given number of keys. Bloom filters use "bits_per_key"
+// bits for each key. Other filters size themselves as configured.
+template <typename T>
+inline void ResetFilter(T* ft, uint32_t num_keys, double bits_per_key) {
+  ft->Reset(num_keys);
+}
+
+template <>
+inline void ResetFilter(BloomBlock* ft, uint32_t num_keys,
+                        double bits_per_key) {
+  ft->Reset(num_keys, bits_per_key);
+}
+
+template <>
+inline void ResetFilter(BlockedBloomBlock* ft, uint32_t num_keys,
+                        double bits_per_key) {
+  ft->Reset(num_keys, bits_per_key);
+}
+}  // namespace
+
 template <typename T, typename U>
 class FilteredDirCompactor : public DirCompactor {
  public:
   FilteredDirCompactor(const DirOptions& options, DirBuilder* bu, T* filter)
-      : DirCompactor(options, bu), filter_(filter) {}
+      : DirCompactor(options, bu),
+        filter_(filter),
+        num_filter_keys_(0),
+        max_table_keys_(0),
+        lent_bits_(0) {}
   virtual ~FilteredDirCompactor();
 
   virtual void Compact(WriteBuffer* buf);
 
+  virtual void CompactRuns(WriteBuffer* buf,
+                           const std::vector<SpillRun*>& runs);
+
+  virtual void AddDirect(const Slice& key, const Slice& value);
+
+  virtual void EndDirectTable();
+
   virtual Status FinishEpoch(uint32_t ep_seq);
 
   virtual Status Finish(uint32_t ep_seq);
@@ -264,9 +720,63 @@ class FilteredDirCompactor : public DirCompactor {
   virtual size_t memory_usage() const;
 
  private:
+  Slice FinishFilter() {
+    TraceScope trace(options_.tracer, "filter_build");
+    PerfScope perf(options_.perf_counters, kPerfFilterBuild);
+    return filter_->Finish();
+  }
+
+  double TableBitsPerKey(uint32_t num_keys);
+
+  // Build a table from the records of an iterator holding "num_entries"
+  // records. Typed so that calls to the write buffer iterator are statically
+  // linked.
+  template <typename I>
+  void CompactFrom(I* iter, uint32_t num_entries);
+
   T* filter_;
+  // Keys inserted into the current filter partition of the direct table and
+  // the last of them
+  uint32_t num_filter_keys_;
+  std::string last_key_;
+  // Largest table compacted so far and the filter bits given to smaller
+  // tables beyond options_.bf_bits_per_key that are yet to be paid back
+  uint32_t max_table_keys_;
+  double lent_bits_;
 };
 
+// With options_.bf_optimal_bits, filter bits are allocated such that the false
+// positive rate of each table is proportional to its size, which minimizes the
+// expected number of false positives over all tables probed by a lookup for a
+// given amount of filter memory. Tables smaller than the largest table seen so
+// far, such as those flushed at the end of an epoch, get more bits per key.
+// These bits are paid back by subsequent tables so that the directory stays
+// within its filter budget.
+template <typename T, typename U>
+double FilteredDirCompactor<T, U>::TableBitsPerKey(uint32_t num_keys) {
+  const double bits = static_cast<double>(options_.bf_bits_per_key);
+  if (!options_.bf_optimal_bits || num_keys == 0) {
+    return bits;
+  }
+  if (num_keys > max_table_keys_) {
+    max_table_keys_ = num_keys;
+  }
+  static const double kLn2Squared = 0.4804530139182014;  // ln(2) * ln(2)
+  // A bloom filter's false positive rate is about exp(-bits * ln(2)^2)
+  double extra = log(double(max_table_keys_) / num_keys) / kLn2Squared;
+  if (extra > bits) {
+    extra = bits;  // Never more than double the bits
+  }
+  // Pay back at most 1 bit per key at a time
+  const double payback = std::min(lent_bits_ / num_keys, 1.0);
+  const double result = std::max(bits + extra - payback, 1.0);
+  lent_bits_ += (result - bits) * num_keys;
+  if (lent_bits_ < 0) {
+    lent_bits_ = 0;
+  }
+  return result;
+}
+
 template <typename T, typename U>
 FilteredDirCompactor<T, U>::~FilteredDirCompactor() {
   delete filter_;
@@ -292,51 +802,212 @@ size_t FilteredDirCompactor<T, U>::memory_usage() const {
 
 template <typename T, typename U>
 void FilteredDirCompactor<T, U>::Compact(WriteBuffer* buf) {
-  U* const bu = static_cast<U*>(bu_);
   IterType* const iter = static_cast<IterType*>(buf->NewIterator());
+  CompactFrom(iter, buf->NumEntries());
+  delete iter;
+}
+
+template <typename T, typename U>
+void FilteredDirCompactor<T, U>::CompactRuns(
+    WriteBuffer* buf, const std::vector<SpillRun*>& runs) {
+  std::vector<Iterator*> children;
+  uint32_t num_entries = buf->NumEntries();
+  for (size_t i = 0; i < runs.size(); i++) {
+    children.push_back(runs[i]->NewIterator());
+    num_entries += runs[i]->num_entries();
+  }
+  children.push_back(buf->NewIterator());
+  SpillMergeIter* const iter =
+      new SpillMergeIter(children, !IsKeyUnOrdered(options_.mode));
+  CompactFrom(iter, num_entries);
+  delete iter;
+}
+
+template <typename T, typename U>
+template <typename I>
+void FilteredDirCompactor<T, U>::CompactFrom(I* iter, uint32_t num_entries) {
+  U* const bu = static_cast<U*>(bu_);
   T* const ft = filter_;
-  iter->IterType::SeekToFirst();
+  const ChunkType filter_type = static_cast<ChunkType>(T::chunk_type());
+  // With filter partitions, a new filter is started every "partition_keys"
+  // keys so that filter memory does not grow with the size of the table
+  uint32_t partition_keys = num_entries;
+  if (options_.filter_partition_keys != 0 &&
+      options_.filter_partition_keys < num_entries) {
+    partition_keys = static_cast<uint32_t>(options_.filter_partition_keys);
+  }
+  uint32_t num_keys = 0;  // Number of keys inserted into the current filter
+  uint32_t num_remaining = num_entries;
+  Slice last_key;
+  iter->I::SeekToFirst();
+  double bits_per_key = 0;
   if (ft != NULL) {
-    ft->Reset(buf->NumEntries());
+    bits_per_key = TableBitsPerKey(num_entries);
+    ResetFilter(ft, partition_keys, bits_per_key);
   }
-  for (; iter->IterType::Valid(); iter->IterType::Next()) {
-    Slice key(iter->IterType::key());
+  for (; iter->I::Valid(); iter->I::Next()) {
+    Slice key(iter->I::key());
     if (ft != NULL) {
+      if (num_keys == partition_keys) {
+        bu->U::AddFilterPartition(last_key, FinishFilter(), filter_type);
+        ResetFilter(ft, std::min(partition_keys, num_remaining),
+                    bits_per_key);
+        num_keys = 0;
+      }
       ft->AddKey(key);
+      last_key = key;
+      num_remaining--;
+      num_keys++;
     }
-    bu->U::Add(key, iter->IterType::value());
+    bu->U::Add(key, iter->I::value());
     if (!ok()) {
       break;
     }
   }
 
+  if (ok() && !iter->I::status().ok()) {
+    SetError(iter->I::status());  // Never end a table missing records
+  }
   if (!ok()) {
     return;
   }
 
   Slice filter_contents;
   if (ft != NULL) {
-    filter_contents = ft->Finish();
+    filter_contents = FinishFilter();
+    if (options_.filter_partition_keys != 0 && num_keys != 0) {
+      bu->U::AddFilterPartition(last_key, filter_contents, filter_type);
+      filter_contents = Slice();
+    }
+  }
+  bu->U::EndTable(filter_contents, filter_type);
+}
+
+template <typename T, typename U>
+void FilteredDirCompactor<T, U>::AddDirect(const Slice& key,
+                                           const Slice& value) {
+  U* const bu = static_cast<U*>(bu_);
+  T* const ft = filter_;
+  if (ft != NULL) {
+    uint32_t partition_keys = direct_table_keys_;
+    if (options_.filter_partition_keys != 0 &&
+        options_.filter_partition_keys < partition_keys) {
+      partition_keys = static_cast<uint32_t>(options_.filter_partition_keys);
+    }
+    if (num_direct_keys_ == 0) {
+      ft->Reset(partition_keys);
+    } else if (num_filter_keys_ == partition_keys) {
+      const ChunkType filter_type = static_cast<ChunkType>(T::chunk_type());
+      bu->U::AddFilterPartition(last_key_, FinishFilter(), filter_type);
+      ft->Reset(partition_keys);
+      num_filter_keys_ = 0;
+    }
+    ft->AddKey(key);
+    last_key_.assign(key.data(), key.size());
+    num_filter_keys_++;
+  }
+  bu->U::Add(key, value);
+  num_direct_keys_++;
+}
+
+template <typename T, typename U>
+void FilteredDirCompactor<T, U>::EndDirectTable() {
+  if (num_direct_keys_ == 0 || !ok()) {
+    return;
   }
+  U* const bu = static_cast<U*>(bu_);
   const ChunkType filter_type = static_cast<ChunkType>(T::chunk_type());
+  Slice filter_contents;
+  if (filter_ != NULL) {
+    filter_contents = FinishFilter();
+    if (options_.filter_partition_keys != 0) {
+      bu->U::AddFilterPartition(last_key_, filter_contents, filter_type);
+      filter_contents = Slice();
+    }
+  }
   bu->U::EndTable(filter_contents, filter_type);
-  delete iter;
+  num_direct_keys_ = num_filter_keys_ = 0;
+}
+
+DirCompactionScheduler::DirCompactionScheduler(const DirOptions& options,
+                                               port::Mutex* mu,
+                                               port::CondVar* cv)
+    : options_(options), bg_cv_(cv), mu_(mu), num_jobs_(0) {}
+
+DirCompactionScheduler::~DirCompactionScheduler() {
+  mu_->AssertHeld();
+  while (num_jobs_ != 0) {
+    bg_cv_->Wait();
+  }
+  assert(ready_.empty());
+}
+
+void DirCompactionScheduler::Submit(DirIndexer* indexer) {
+  mu_->AssertHeld();
+  assert(std::find(ready_.begin(), ready_.end(), indexer) == ready_.end());
+  ready_.push_back(indexer);
+  if (options_.max_compaction_jobs <= 0 ||
+      num_jobs_ < options_.max_compaction_jobs) {
+    num_jobs_++;
+    options_.compaction_pool->Schedule(DirCompactionScheduler::BGWork, this);
+  }
+}
+
+void DirCompactionScheduler::BGWork(void* arg) {
+  DirCompactionScheduler* sched =
+      reinterpret_cast<DirCompactionScheduler*>(arg);
+  MutexLock ml(sched->mu_);
+  sched->DoWork();
+}
+
+void DirCompactionScheduler::DoWork() {
+  mu_->AssertHeld();
+  while (!ready_.empty()) {
+    // Pick the partition with the most full write buffers. Ties go to the
+    // partition that has waited the longest.
+    size_t pick = 0;
+    for (size_t i = 1; i < ready_.size(); i++) {
+      if (ready_[i]->num_imm_ > ready_[pick]->num_imm_) {
+        pick = i;
+      }
+    }
+    DirIndexer* const indexer = ready_[pick];
+    ready_.erase(ready_.begin() + pick);
+    // May re-submit the partition if it has more full write buffers
+    indexer->DoCompaction();
+  }
+  assert(num_jobs_ > 0);
+  num_jobs_--;
+  bg_cv_->SignalAll();
 }
 
 DirIndexer::DirIndexer(const DirOptions& options, size_t part, port::Mutex* mu,
-                       port::CondVar* cv)
+                       port::CondVar* cv, DirCompactionScheduler* sched)
     : options_(options),
       bg_cv_(cv),
       mu_(mu),
+      sched_(sched),
+      memtable_util_(options.memtable_util),
       part_(part),
+      spill_budget_(options.spill_budget >> options.lg_parts),
       num_flush_requested_(0),
       num_flush_completed_(0),
       has_bg_compaction_(false),
+      stall_micros_(0),
+      compacted_bytes_(0),
+      compaction_micros_(0),
+      inserted_bytes_(0),
+      direct_bytes_(0),
       mem_buf_(NULL),
-      imm_buf_(NULL),
-      imm_compac_(NULL),
-      buf0_(options),
-      buf1_(options),
+      num_bg_sorts_(0),
+      mem_(0),
+      imm_(0),
+      num_imm_(0),
+      spilling_(false),
+      num_spills_(0),
+      pending_spill_bytes_(0),
+      spilled_bytes_(0),
+      spill_merge_micros_(0),
       compactor_(NULL),
       data_(NULL),
       indx_(NULL),
@@ -347,15 +1018,17 @@ DirIndexer::DirIndexer(const DirOptions& options, size_t part, port::Mutex* mu,
           static_cast<uint32_t>(1 << options_.lg_parts) -
       options_.block_batch_size;  // Reserved for compaction
 
-  tb_bytes_ = memory / 2;  // Due to double buffering
-
-  buf_threshold_ =
-      static_cast<size_t>(floor(tb_bytes_ * options_.memtable_util));
-  buf_reserv_ = static_cast<size_t>(ceil(tb_bytes_ * options_.memtable_reserv));
+  const size_t num_bufs = static_cast<size_t>(options_.num_memtables);
+  assert(num_bufs >= 2);
+  tb_bytes_ = memory / num_bufs;  // Due to multi-buffering
+  SetBufferSizes();
 
   // Estimate filter size
   size_t entry_size = options_.key_size + options_.value_size;
   size_t num_keys = tb_bytes_ / entry_size;
+  if (options_.filter_partition_keys != 0) {  // One partition at a time
+    num_keys = std::min(num_keys, options_.filter_partition_keys);
+  }
   ft_bits_ = options_.filter_bits_per_key * num_keys;
 
   ft_bytes_ = (ft_bits_ + 7) / 8;
@@ -371,15 +1044,24 @@ DirIndexer::DirIndexer(const DirOptions& options, size_t part, port::Mutex* mu,
   }
 
   // Allocate memory
-  buf0_.Reserve(buf_reserv_);
-  buf1_.Reserve(buf_reserv_);
+  for (size_t i = 0; i < num_bufs; i++) {
+    WriteBuffer* const buf = new WriteBuffer(options_);
+    if (!options_.direct_writes) {  // Buffers stay empty otherwise
+      buf->Reserve(buf_reserv_);
+    }
+    bufs_.push_back(buf);
+    compacs_.push_back(NULL);
+    sorts_.push_back(kNotSorted);
+    imm_bytes_.push_back(0);
+    runs_.push_back(std::vector<SpillRun*>());
+  }
 
-  mem_buf_ = &buf0_;
+  mem_buf_ = bufs_[mem_];
 }
 
 DirIndexer::~DirIndexer() {
   mu_->AssertHeld();
-  while (has_bg_compaction_) {
+  while (has_bg_compaction_ || num_bg_sorts_ != 0) {
     bg_cv_->Wait();
   }
   if (!compaction_list_.empty())
@@ -387,6 +1069,18 @@ DirIndexer::~DirIndexer() {
   if (data_ != NULL) data_->Unref();
   if (indx_ != NULL) indx_->Unref();
   delete compactor_;
+  for (size_t i = 0; i < bufs_.size(); i++) {
+    for (size_t j = 0; j < runs_[i].size(); j++) {
+      delete runs_[i][j];
+    }
+    delete bufs_[i];
+  }
+  for (size_t i = 0; i < spills_.size(); i++) {
+    delete spills_[i];
+  }
+  for (size_t i = 0; i < epoch_runs_.size(); i++) {
+    delete epoch_runs_[i];
+  }
 }
 
 template <typename U /* extends DirBuilder */>
@@ -417,6 +1111,9 @@ DirCompactor* DirIndexer::OpenBitmapCompactor(DirBuilder* bu) {
     case kFmtPfDelta:
       return OPEN1(PfDeltaFormat);
       break;
+    case kFmtAuto:
+      return OPEN1(AutoFormat);
+      break;
     default:
       return OPEN1(UncompressedFormat);
       break;
@@ -432,6 +1129,9 @@ DirCompactor* DirIndexer::OpenCompactor(DirBuilder* bu) {
 #define T1 FilteredDirCompactor
 #define T2 BloomBlock
 #define T3 EmptyFilterBlock
+#define T4 BlockedBloomBlock
+#define T5 XorFilterBlock
+#define T6 GcsFilterBlock
 #define OPEN0(T, t, a1, a2) new T1<T, U>(a1, a2, t)
 #define OPEN1(T, t) OPEN0(T, t, options_, bu)
 #ifndef NDEBUG
@@ -447,12 +1147,27 @@ DirCompactor* DirIndexer::OpenCompactor(DirBuilder* bu) {
       return OPEN1(T2, bf);
       break;
     }
+    case kFtBlockedBloomFilter: {
+      T4* bf = NULL;
+      if (options_.bf_bits_per_key != 0) bf = new T4(options_, ft_bytes_);
+      return OPEN1(T4, bf);
+      break;
+    }
+    case kFtXorFilter:
+      return OPEN1(T5, new T5(options_, ft_bytes_));
+      break;
+    case kFtGcsFilter:
+      return OPEN1(T6, new T6(options_, ft_bytes_));
+      break;
     default:
       return OPEN1(T3, NULL);
       break;
   }
 #undef OPEN1
 #undef OPEN0
+#undef T6
+#undef T5
+#undef T4
 #undef T3
 #undef T2
 #undef T1
@@ -479,11 +1194,20 @@ Status DirIndexer::Open(LogSink* data, LogSink* indx) {
   // To reduce runtime overhead (e.g. c++ virtual function calls)
   // here we want to statically bind to one specific dir
   // builder type with one specific block format.
-  if (!options_.leveldb_compatible && options_.fixed_kv_length)
+  if (!options_.leveldb_compatible && options_.fixed_kv_length &&
+      options_.value_column_width != 0)
+    compactor_ = OpenCompactor<SeqDirBuilder<ColumnarBlockBuilder> >(bu);
+  if (!options_.leveldb_compatible && options_.fixed_kv_length &&
+      options_.value_column_width == 0)
     compactor_ = OpenCompactor<SeqDirBuilder<ArrayBlockBuilder> >(bu);
+  if (!options_.leveldb_compatible && !options_.fixed_kv_length)
+    compactor_ = OpenCompactor<SeqDirBuilder<GroupVarintBlockBuilder> >(bu);
 
   if (compactor_ == NULL)  // Use the default block format
     compactor_ = OpenCompactor<SeqDirBuilder<> >(bu);
+  const size_t entry_size = options_.key_size + options_.value_size;
+  compactor_->direct_table_keys_ = static_cast<uint32_t>(
+      std::max<size_t>(buf_threshold_ / std::max<size_t>(entry_size, 1), 1));
   // No external I/O so always OK.
   return Status::OK();
 }
@@ -500,6 +1224,13 @@ Status DirIndexer::bg_status() {
   return bg_status_;
 }
 
+Status DirIndexer::Snapshot(std::string* root, uint32_t* num_epochs) {
+  mu_->AssertHeld();
+  assert(opened_);
+  assert(!has_bg_compaction_);
+  return compactor_->bu_->Snapshot(root, num_epochs);
+}
+
 // Sync and pre-close all linked log files.
 // By default, log files are reference-counted and are implicitly closed when
 // de-referenced by the last opener. Optionally, a caller may force data
@@ -526,11 +1257,17 @@ Status DirIndexer::Flush(const FlushOptions& flush_options, Epoch* epoch) {
   mu_->AssertHeld();
   assert(opened_);
   // Wait for buffer space
-  while (imm_buf_ != NULL) {
+  while (num_imm_ + 1 == bufs_.size()) {
     if (flush_options.dry_run) {
       return Status::TryAgain(Slice());
     } else {
+      const uint64_t start = CurrentMicros();
       bg_cv_->Wait();
+      const uint64_t end = CurrentMicros();
+      if (options_.tracer != NULL) {
+        options_.tracer->Record("write_stall", start, end);
+      }
+      stall_micros_ += end - start;
     }
   }
 
@@ -538,6 +1275,15 @@ Status DirIndexer::Flush(const FlushOptions& flush_options, Epoch* epoch) {
   if (flush_options.dry_run) {
     status = bg_status_;  // Status check only
   } else {
+    // Complete the direct table before the compaction of the empty memtable
+    // seals the epoch. No compaction can be running if the table has keys
+    if (options_.direct_writes && compactor_->num_direct_keys_ != 0 &&
+        bg_status_.ok()) {
+      EndDirectTable();
+      if (!compactor_->ok()) {
+        bg_status_ = compactor_->status();
+      }
+    }
     num_flush_requested_++;
     const uint32_t my = num_flush_requested_;
     const bool force = true;
@@ -558,18 +1304,104 @@ Status DirIndexer::Flush(const FlushOptions& flush_options, Epoch* epoch) {
 Status DirIndexer::Add(Epoch* epoch, const Slice& key, const Slice& value) {
   mu_->AssertHeld();
   assert(opened_);
+  if (options_.direct_writes) {
+    return AddDirect(key, value);
+  }
   Status status = Prepare(epoch);
   while (status.ok()) {
+    mem_buf_->SetEpoch(epoch->seq_);
     // Implementation may reject a key-value insertion
     if (!mem_buf_->Add(key, value)) {
+      if (mem_buf_->NumEntries() == 0) {
+        status = Status::InvalidArgument("Record larger than write buffer");
+        break;
+      }
       status = Prepare(epoch);
     } else {
+      inserted_bytes_ += key.size() + value.size();
       break;
     }
   }
   return status;
 }
 
+// Insert a key into the table being built. Tables are ended once they hold a
+// memtable's worth of data, or as many keys as their filter is sized for.
+// REQUIRES: *mu_ has been locked.
+Status DirIndexer::AddDirect(const Slice& key, const Slice& value) {
+  mu_->AssertHeld();
+  // The table builder is shared with compactions scheduled by flushes
+  while (bg_status_.ok() && (num_imm_ != 0 || has_bg_compaction_)) {
+    bg_cv_->Wait();
+  }
+  if (!bg_status_.ok()) {
+    return bg_status_;
+  }
+  if (!IsKeyUnOrdered(options_.mode) && compactor_->num_direct_keys_ != 0 &&
+      key < direct_last_key_) {
+    return Status::InvalidArgument("Keys must be inserted in order");
+  }
+  compactor_->AddDirect(key, value);
+  if (!IsKeyUnOrdered(options_.mode)) {
+    direct_last_key_.assign(key.data(), key.size());
+  }
+  inserted_bytes_ += key.size() + value.size();
+  direct_bytes_ += key.size() + value.size();
+  if (direct_bytes_ >= buf_threshold_ ||
+      (options_.filter_partition_keys == 0 &&
+       compactor_->num_direct_keys_ >= compactor_->direct_table_keys_)) {
+    EndDirectTable();
+  }
+  if (!compactor_->ok()) {
+    bg_status_ = compactor_->status();
+  }
+  return bg_status_;
+}
+
+void DirIndexer::EndDirectTable() {
+  mu_->AssertHeld();
+  compactor_->EndDirectTable();
+  direct_bytes_ = 0;
+}
+
+uint64_t DirIndexer::TakeInsertedBytes() {
+  mu_->AssertHeld();
+  const uint64_t result = inserted_bytes_;
+  inserted_bytes_ = 0;
+  return result;
+}
+
+void DirIndexer::ResizeBuffers(size_t memory) {
+  mu_->AssertHeld();
+  tb_bytes_ = memory / bufs_.size();
+  SetBufferSizes();
+  // Buffers that are immutable are resized once they have been compacted
+  for (size_t i = 0; i < bufs_.size(); i++) {
+    if (compacs_[i] == NULL && bufs_[i]->NumEntries() == 0) {
+      bufs_[i]->Resize(buf_reserv_);
+    }
+  }
+}
+
+void DirIndexer::Retune(size_t block_size, double memtable_util) {
+  mu_->AssertHeld();
+  assert(!has_bg_compaction_);
+  if (block_size != 0) {
+    compactor_->bu_->SetBlockSize(block_size);
+  }
+  memtable_util_ = memtable_util;
+  SetBufferSizes();
+}
+
+// Derive the flush threshold and the memory reserved for each write buffer
+// from tb_bytes_. Part of each buffer's share of memory goes to the entry
+// array kept alongside its records, so only the rest is used for records.
+void DirIndexer::SetBufferSizes() {
+  const size_t bytes = WriteBuffer::RecordMemory(options_, tb_bytes_);
+  buf_threshold_ = static_cast<size_t>(floor(bytes * memtable_util_));
+  buf_reserv_ = static_cast<size_t>(ceil(bytes * options_.memtable_reserv));
+}
+
 Status DirIndexer::Prepare(Epoch* epoch, bool force, bool epoch_flush,
                            bool finalize) {
   mu_->AssertHeld();
@@ -579,16 +1411,26 @@ Status DirIndexer::Prepare(Epoch* epoch, bool force, bool epoch_flush,
     if (!bg_status_.ok()) {
       status = bg_status_;
       break;
+    } else if (spilling_) {
+      // Another writer is spilling the current write buffer
+      const uint64_t start = CurrentMicros();
+      bg_cv_->Wait();
+      stall_micros_ += CurrentMicros() - start;
     } else if (!force && !mem_buf_->NeedCompaction() &&
                mem_buf_->CurrentBufferSize() < buf_threshold_) {
       // There is room in current write buffer
       break;
-    } else if (imm_buf_ != NULL) {
+    } else if (!force && num_imm_ + 1 == bufs_.size() && ShouldSpill()) {
+      // All other write buffers are waiting to be compacted, but the current
+      // one can be emptied into a spilled run
+      SpillMemtable();
+    } else if (num_imm_ + 1 == bufs_.size()) {
+      // All other write buffers are waiting to be compacted
+      const uint64_t start = CurrentMicros();
       bg_cv_->Wait();
+      stall_micros_ += CurrentMicros() - start;
     } else {
       // Attempt to switch to a new write buffer
-      assert(imm_buf_ == NULL);
-      imm_buf_ = mem_buf_;
       Compaction* c = compaction_list_.New(epoch);
       if (force) c->is_forced_ = true;
       force = false;
@@ -596,16 +1438,25 @@ Status DirIndexer::Prepare(Epoch* epoch, bool force, bool epoch_flush,
       epoch_flush = false;
       if (finalize) c->is_final = true;
       finalize = false;
-      assert(imm_compac_ == NULL);
-      imm_compac_ = c;
+      assert(compacs_[mem_] == NULL);
+      compacs_[mem_] = c;
       c->Ref();
-      WriteBuffer* const current_buf = mem_buf_;
-      MaybeScheduleCompaction();
-      if (current_buf == &buf0_) {
-        mem_buf_ = &buf1_;
-      } else {
-        mem_buf_ = &buf0_;
+      num_imm_++;
+      imm_bytes_[mem_] = mem_buf_->CurrentBufferSize();
+      assert(runs_[mem_].empty());
+      runs_[mem_].swap(spills_);
+      // Switch before scheduling so inline compactions, which temporarily
+      // release the lock, never see writers inserting into the buffer being
+      // compacted
+      const size_t imm = mem_;
+      mem_ = (mem_ + 1) % bufs_.size();
+      mem_buf_ = bufs_[mem_];
+      assert(mem_buf_->NumEntries() == 0);
+      if (num_imm_ + 1 == bufs_.size()) {  // No spare buffer left
+        NotifyWritePressure(kWritePressureHigh);
       }
+      MaybeScheduleCompaction();
+      MaybeScheduleSort(imm);
     }
   }
 
@@ -624,13 +1475,15 @@ void DirIndexer::MaybeScheduleCompaction() {
     return;
   }
   // Nothing to be scheduled
-  if (imm_buf_ == NULL) {
+  if (num_imm_ == 0) {
     return;
   }
 
   has_bg_compaction_ = true;
 
-  if (options_.compaction_pool != NULL) {
+  if (sched_ != NULL) {
+    sched_->Submit(this);
+  } else if (options_.compaction_pool != NULL) {
     options_.compaction_pool->Schedule(DirIndexer::BGWork, this);
   } else if (options_.allow_env_threads) {
     Env::Default()->Schedule(DirIndexer::BGWork, this);
@@ -639,38 +1492,219 @@ void DirIndexer::MaybeScheduleCompaction() {
   }
 }
 
-void DirIndexer::BGWork(void* arg) {
-  DirIndexer* ins = reinterpret_cast<DirIndexer*>(arg);
-  MutexLock ml(ins->mu_);
-  ins->DoCompaction();
-}
+struct DirIndexer::SortArg {
+  DirIndexer* indexer;
+  size_t idx;
+};
 
-void DirIndexer::DoCompaction() {
+// Start sorting an immutable write buffer if it has to wait behind the
+// compaction of an earlier buffer.
+void DirIndexer::MaybeScheduleSort(size_t idx) {
   mu_->AssertHeld();
-  assert(has_bg_compaction_);
-  assert(imm_buf_ != NULL);
-  assert(imm_compac_ != NULL);
-  CompactMemtable();
-  imm_compac_->Unref();
-  imm_compac_ = NULL;
-  imm_buf_->Reset();
-  imm_buf_ = NULL;
-  has_bg_compaction_ = false;
-  MaybeScheduleCompaction();
-  bg_cv_->SignalAll();
+  if (!options_.pipelined_compactions || options_.compaction_pool == NULL) {
+    return;
+  }
+  // Skip if the buffer is about to be compacted, or has already been
+  // compacted by an inline compaction
+  if (compacs_[idx] == NULL || idx == imm_) {
+    return;
+  }
+  if (sorts_[idx] != kNotSorted || skip_sort()) {
+    return;
+  }
+  sorts_[idx] = kSortQueued;
+  num_bg_sorts_++;
+  SortArg* const arg = new SortArg;
+  arg->indexer = this;
+  arg->idx = idx;
+  options_.compaction_pool->Schedule(DirIndexer::BGSort, arg);
+}
+
+void DirIndexer::BGSort(void* arg) {
+  SortArg* const sa = reinterpret_cast<SortArg*>(arg);
+  DirIndexer* const ins = sa->indexer;
+  const size_t idx = sa->idx;
+  delete sa;
+  MutexLock ml(ins->mu_);
+  assert(ins->num_bg_sorts_ > 0);
+  // The buffer's compaction may have started before this task and sorted
+  // the buffer itself
+  if (ins->sorts_[idx] != kSortQueued) {
+    ins->num_bg_sorts_--;
+    ins->bg_cv_->SignalAll();
+    return;
+  }
+  ins->sorts_[idx] = kSorting;
+  WriteBuffer* const buffer = ins->bufs_[idx];
+  ins->mu_->Unlock();
+  {
+    TraceScope trace(ins->options_.tracer, "sort");
+    PerfScope perf(ins->options_.perf_counters, kPerfSort);
+    buffer->Finish(false);
+  }
+  ins->mu_->Lock();
+  ins->sorts_[idx] = kSorted;
+  ins->num_bg_sorts_--;
+  ins->bg_cv_->SignalAll();
+}
+
+bool DirIndexer::skip_sort() const {
+  if (options_.skip_sort) {
+    return true;  // Forced by user
+  } else {
+    return IsKeyUnOrdered(options_.mode);
+  }
+}
+
+bool DirIndexer::spill_enabled() const {
+  return options_.spill_dir != NULL && !options_.direct_writes &&
+         options_.pmem_buffer_file == NULL;
+}
+
+// Return a new file name under options_.spill_dir. Names are unique across
+// processes sharing the directory and across partitions.
+// REQUIRES: *mu_ has been locked.
+std::string DirIndexer::NewSpillFileName() {
+  mu_->AssertHeld();
+  char tmp[100];
+  snprintf(tmp, sizeof(tmp), "/spill-%d-%p-%u.run", int(getpid()),
+           static_cast<void*>(this), num_spills_++);
+  return options_.spill_dir + std::string(tmp);
+}
+
+bool DirIndexer::ShouldSpill() const {
+  if (!spill_enabled() || !spill_status_.ok()) {
+    return false;
+  } else if (mem_buf_->NumEntries() == 0) {
+    return false;
+  } else if (spill_budget_ == 0) {
+    return true;
+  } else {
+    const uint64_t bytes = mem_buf_->CurrentBufferSize();
+    return pending_spill_bytes_ + bytes <= spill_budget_;
+  }
+}
+
+// Sort the current write buffer and write it out as a run to be merged into
+// the table of the buffer once it is compacted. The buffer is then emptied.
+// The lock is released while the run is being written, during which writers
+// wait for the spill to finish.
+// REQUIRES: *mu_ has been locked.
+void DirIndexer::SpillMemtable() {
+  mu_->AssertHeld();
+  assert(!spilling_);
+  spilling_ = true;
+  const std::string fname = NewSpillFileName();
+  WriteBuffer* const buffer = mem_buf_;
+  mu_->Unlock();
+  SpillRun* run = NULL;
+  Status status;
+  {
+    TraceScope trace(options_.tracer, "spill");
+    buffer->Finish(skip_sort());
+    Iterator* const iter = buffer->NewIterator();
+    status = SpillRun::Write(Env::Default(), fname, iter, &run);
+    delete iter;
+  }
+  mu_->Lock();
+  spilling_ = false;
+  if (status.ok()) {
+    spills_.push_back(run);
+    pending_spill_bytes_ += run->size();
+    spilled_bytes_ += run->size();
+    buffer->Reset();
+  } else {
+    Warn(__LOG_ARGS__, "Cannot spill write buffer: %s",
+         status.ToString().c_str());
+    spill_status_ = status;
+    sorts_[mem_] = kSorted;  // Already sorted by Finish()
+  }
+  bg_cv_->SignalAll();
+}
+
+void DirIndexer::BGWork(void* arg) {
+  DirIndexer* ins = reinterpret_cast<DirIndexer*>(arg);
+  MutexLock ml(ins->mu_);
+  ins->DoCompaction();
+}
+
+void DirIndexer::DoCompaction() {
+  mu_->AssertHeld();
+  assert(has_bg_compaction_);
+  assert(num_imm_ != 0);
+  assert(compacs_[imm_] != NULL);
+  DirLatencyStats* const lat = options_.latency_stats;
+  const uint64_t start = lat != NULL ? CurrentMicros() : 0;
+  CompactMemtable();
+  if (lat != NULL) {
+    lat->compaction.Add(CurrentMicros() - start);
+  }
+  compacs_[imm_]->Unref();
+  compacs_[imm_] = NULL;
+  sorts_[imm_] = kNotSorted;
+  for (size_t i = 0; i < runs_[imm_].size(); i++) {
+    assert(pending_spill_bytes_ >= runs_[imm_][i]->size());
+    pending_spill_bytes_ -= runs_[imm_][i]->size();
+    delete runs_[imm_][i];  // Removes the run
+  }
+  runs_[imm_].clear();
+  bufs_[imm_]->Reset();
+  if (options_.adaptive_memtables) {
+    bufs_[imm_]->Resize(buf_reserv_);
+  }
+  imm_bytes_[imm_] = 0;
+  imm_ = (imm_ + 1) % bufs_.size();
+  num_imm_--;
+  if (num_imm_ + 2 == bufs_.size()) {  // A spare buffer is available again
+    NotifyWritePressure(kWritePressureLow);
+  }
+  has_bg_compaction_ = false;
+  MaybeScheduleCompaction();
+  bg_cv_->SignalAll();
 }
 
 void DirIndexer::CompactMemtable() {
   mu_->AssertHeld();
-  WriteBuffer* const buffer = imm_buf_;
+  assert(num_imm_ != 0);
+  WriteBuffer* const buffer = bufs_[imm_];
   assert(buffer != NULL);
-  Compaction* const c = imm_compac_;
+  Compaction* const c = compacs_[imm_];
   assert(c != NULL);
   const bool is_final = c->is_final;
   const bool is_epoch_flush = c->is_epoch_flush_;
   const bool is_forced = c->is_forced_;
   Epoch* const ep = c->parent_;
   assert(ep != NULL);
+  // Wait for any background sort of this buffer to finish. A sort that has
+  // yet to start is taken over, since it may be queued behind this
+  // compaction on the same pool thread.
+  while (sorts_[imm_] == kSorting) {
+    bg_cv_->Wait();
+  }
+  if (sorts_[imm_] == kSortQueued) {
+    sorts_[imm_] = kNotSorted;
+  }
+  const bool sorted = (sorts_[imm_] == kSorted);
+  // Runs spilled before the buffer are only touched by this compaction
+  const std::vector<SpillRun*>& runs = runs_[imm_];
+  uint64_t run_bytes = 0;
+  for (size_t i = 0; i < runs.size(); i++) {
+    run_bytes += runs[i]->size();
+  }
+  // With epoch merges, the buffer is kept as a sorted run until the epoch is
+  // flushed, at which point all runs of the epoch are merged into one table.
+  // As with spills, a buffer whose run would exceed the spill budget gets
+  // its table built right away.
+  const bool defer =
+      options_.epoch_merge && spill_enabled() && !is_epoch_flush &&
+      (spill_budget_ == 0 ||
+       pending_spill_bytes_ + buffer->CurrentBufferSize() <= spill_budget_);
+  const std::string run_fname = defer ? NewSpillFileName() : std::string();
+  std::vector<SpillRun*> merged_runs;
+  if (is_epoch_flush) {
+    merged_runs.swap(epoch_runs_);
+  }
+  merged_runs.insert(merged_runs.end(), runs.begin(), runs.end());
   DirCompactor* dir = compactor_;
   mu_->Unlock();
   const uint64_t start = CurrentMicros();
@@ -690,13 +1724,48 @@ void DirIndexer::CompactMemtable() {
   const DirOutputStats prev(compac_stats_);
 #endif
 #endif  // VERBOSE
-  bool skip_sort = IsKeyUnOrdered(options_.mode);
-  if (options_.skip_sort) {
-    skip_sort = true;  // Forced by user
+  if (!sorted) {
+    TraceScope trace(options_.tracer, "sort");
+    PerfScope perf(options_.perf_counters, kPerfSort);
+    buffer->Finish(skip_sort());
+  }
+  SpillRun* run = NULL;
+  bool deferred = false;
+  if (defer && buffer->NumEntries() == 0) {
+    deferred = true;
+  } else if (defer) {
+    TraceScope trace(options_.tracer, "spill");
+    Iterator* const iter = buffer->NewIterator();
+    Status s = SpillRun::Write(Env::Default(), run_fname, iter, &run);
+    delete iter;
+    if (s.ok()) {
+      deferred = true;
+    } else {  // Build the table of the buffer now instead
+      Warn(__LOG_ARGS__, "Cannot keep write buffer for epoch merge: %s",
+           s.ToString().c_str());
+    }
+  }
+  uint64_t merge_micros = 0;
+  if (deferred) {
+    // Left to the epoch merge
+  } else if (merged_runs.empty()) {
+    TraceScope trace(options_.tracer, "table_build");
+    PerfScope perf(options_.perf_counters, kPerfTableBuild);
+    dir->Compact(buffer);
+  } else {
+    TraceScope trace(options_.tracer, "spill_merge");
+    PerfScope perf(options_.perf_counters, kPerfTableBuild);
+    const uint64_t merge_start = CurrentMicros();
+    dir->CompactRuns(buffer, merged_runs);
+    merge_micros = CurrentMicros() - merge_start;
+  }
+  // Runs kept for the epoch merge are merged by now
+  uint64_t epoch_run_bytes = 0;
+  for (size_t i = 0; i < merged_runs.size() - runs.size(); i++) {
+    epoch_run_bytes += merged_runs[i]->size();
+    delete merged_runs[i];
   }
-  buffer->Finish(skip_sort);
-  dir->Compact(buffer);
-  if (dir->ok()) {
+  if (!deferred && dir->ok()) {
 #if VERBOSE >= 3
 #ifndef NDEBUG
     Verbose(__LOG_ARGS__, 3, "\t+ D: %s, I: %s, F: %s",
@@ -716,6 +1785,9 @@ void DirIndexer::CompactMemtable() {
   }
 
   const uint64_t end = CurrentMicros();
+  if (options_.tracer != NULL) {
+    options_.tracer->Record("compaction", start, end);
+  }
   if (options_.listener != NULL) {
     CompactionEvent event;
     event.type = kCompactionEnd;
@@ -731,12 +1803,101 @@ void DirIndexer::CompactMemtable() {
 
   Status status = dir->status();
   mu_->Lock();
+  compacted_bytes_ += imm_bytes_[imm_] + run_bytes;
+  compaction_micros_ += end - start;
+  spill_merge_micros_ += merge_micros;
+  assert(pending_spill_bytes_ >= epoch_run_bytes);
+  pending_spill_bytes_ -= epoch_run_bytes;
+  if (deferred) {
+    // Runs of the buffer now wait for the epoch merge along with the buffer
+    epoch_runs_.insert(epoch_runs_.end(), runs.begin(), runs.end());
+    runs_[imm_].clear();
+    if (run != NULL) {
+      epoch_runs_.push_back(run);
+      pending_spill_bytes_ += run->size();
+      spilled_bytes_ += run->size();
+    }
+  }
   bg_status_ = status;
   if (is_forced) {
     num_flush_completed_++;
   }
 }
 
+uint64_t DirIndexer::stall_micros() const {
+  mu_->AssertHeld();
+  return stall_micros_;
+}
+
+uint64_t DirIndexer::compacted_bytes() const {
+  mu_->AssertHeld();
+  return compacted_bytes_;
+}
+
+uint64_t DirIndexer::compaction_micros() const {
+  mu_->AssertHeld();
+  return compaction_micros_;
+}
+
+uint64_t DirIndexer::spilled_bytes() const {
+  mu_->AssertHeld();
+  return spilled_bytes_;
+}
+
+uint64_t DirIndexer::spill_merge_micros() const {
+  mu_->AssertHeld();
+  return spill_merge_micros_;
+}
+
+void DirIndexer::AddWritePressure(DirWritePressure* result) const {
+  mu_->AssertHeld();
+  uint64_t pending_bytes = 0;
+  for (size_t i = 0; i < imm_bytes_.size(); i++) {
+    pending_bytes += imm_bytes_[i];
+  }
+  result->buffered_bytes += pending_bytes;
+  if (mem_buf_ != NULL) {
+    result->buffered_bytes += mem_buf_->CurrentBufferSize();
+  }
+  result->buffer_capacity += uint64_t(bufs_.size()) * buf_threshold_;
+  result->pending_compactions += static_cast<uint32_t>(num_imm_);
+  result->spilled_bytes += pending_spill_bytes_;
+  if (num_imm_ + 1 == bufs_.size()) {
+    result->stalling_partitions++;
+  }
+  if (compacted_bytes_ != 0) {
+    const uint64_t drain = static_cast<uint64_t>(
+        double(pending_bytes) * compaction_micros_ / compacted_bytes_);
+    result->est_drain_micros = std::max(result->est_drain_micros, drain);
+  }
+}
+
+void DirIndexer::TouchBuffers() {
+  for (size_t i = 0; i < bufs_.size(); i++) {
+    bufs_[i]->TouchReservedMemory();
+  }
+}
+
+void DirIndexer::AttachPmem(PmemBufferFile* file, size_t first_slot) {
+  for (size_t i = 0; i < bufs_.size(); i++) {
+    bufs_[i]->AttachPmem(file, first_slot + i, static_cast<uint32_t>(part_));
+  }
+}
+
+// Report a write pressure change to the listener, if there is one.
+// REQUIRES: *mu_ has been locked.
+void DirIndexer::NotifyWritePressure(EventType type) {
+  mu_->AssertHeld();
+  if (options_.listener != NULL) {
+    WritePressureEvent event;
+    event.type = type;
+    event.part = part_;
+    event.pending_compactions = num_imm_;
+    event.micros = CurrentMicros();
+    options_.listener->OnEvent(type, &event);
+  }
+}
+
 uint32_t DirIndexer::num_epochs() const {
   mu_->AssertHeld();
   if (opened_) {
@@ -747,12 +1908,22 @@ uint32_t DirIndexer::num_epochs() const {
   }
 }
 
+size_t DirIndexer::hugepage_memory_usage() const {
+  mu_->AssertHeld();
+  size_t result = 0;
+  for (size_t i = 0; i < bufs_.size(); i++) {
+    result += bufs_[i]->hugepage_memory_usage();
+  }
+  return result;
+}
+
 size_t DirIndexer::memory_usage() const {
   mu_->AssertHeld();
   if (opened_) {
     size_t result = 0;
-    result += buf0_.memory_usage();
-    result += buf1_.memory_usage();
+    for (size_t i = 0; i < bufs_.size(); i++) {
+      result += bufs_[i]->memory_usage();
+    }
     assert(compactor_ != NULL);
     result += compactor_->memory_usage();
     return result;
@@ -761,10 +1932,83 @@ size_t DirIndexer::memory_usage() const {
   }
 }
 
-static Status ReadBlock(LogSource* source, const DirOptions& options,
-                        const BlockHandle& handle, BlockContents* result,
-                        bool cached = false, uint32_t file_index = 0,
-                        char* tmp = NULL, size_t tmp_length = 0) {
+// Verify and decode the raw contents of a block, including its trailer, as
+// read from storage. Uncompressed block contents point directly into *raw.
+// Return OK on success, or a non-OK status on errors.
+static Status ParseBlock(const DirOptions& options, const Slice& raw,
+                         BlockContents* result) {
+  result->data = Slice();
+  result->heap_allocated = false;
+  result->cachable = false;
+
+  assert(raw.size() >= kBlockTrailerSize);
+  const size_t n = raw.size() - kBlockTrailerSize;
+  const char* data = raw.data();
+  // CRC checks
+  if (!options.skip_checksums && options.verify_checksums) {
+    const uint32_t crc = crc32c::Unmask(DecodeFixed32(data + n + 1));
+    const ChecksumType cs = options.checksum_type;
+    const uint32_t actual =
+        ExtendChecksum(cs, ExtendChecksum(cs, 0, data, n), data + n, 1);
+    if (actual != crc) {
+      return Status::Corruption("Block checksum mismatch");
+    }
+  }
+
+  const CompressionType type = static_cast<CompressionType>(data[n]);
+  if (type == kNoCompression) {
+    result->data = Slice(data, n);
+    return Status::OK();
+  }
+
+  size_t ulen = 0;
+  bool ok;
+  switch (type) {
+    case kSnappyCompression:
+      ok = port::Snappy_GetUncompressedLength(data, n, &ulen);
+      break;
+    case kZstdCompression:
+      ok = port::Zstd_GetUncompressedLength(data, n, &ulen);
+      break;
+    case kLz4Compression:
+      ok = port::Lz4_GetUncompressedLength(data, n, &ulen);
+      break;
+    default:
+      return Status::Corruption("Unknown compression type");
+  }
+  if (!ok) {
+    return Status::Corruption("Cannot uncompress");
+  }
+  char* ubuf = new char[ulen];
+  switch (type) {
+    case kSnappyCompression:
+      ok = port::Snappy_Uncompress(data, n, ubuf);
+      break;
+    case kZstdCompression:
+      ok = port::Zstd_Uncompress(data, n, ubuf, ulen);
+      break;
+    case kLz4Compression:
+      ok = port::Lz4_Uncompress(data, n, ubuf, ulen);
+      break;
+    default:
+      ok = false;
+      break;
+  }
+  if (!ok) {
+    delete[] ubuf;
+    return Status::Corruption("Cannot uncompress");
+  }
+  result->data = Slice(ubuf, ulen);
+  result->heap_allocated = true;
+  result->cachable = true;
+
+  return Status::OK();
+}
+
+Status ReadBlock(LogSource* source, const DirOptions& options,
+                 const BlockHandle& handle, BlockContents* result, bool cached,
+                 uint32_t file_index, char* tmp, size_t tmp_length,
+                 uint64_t deadline) {
   result->data = Slice();
   result->heap_allocated = false;
   result->cachable = false;
@@ -773,67 +2017,40 @@ static Status ReadBlock(LogSource* source, const DirOptions& options,
   size_t n = static_cast<size_t>(handle.size());
   size_t m = n + kBlockTrailerSize;
   char* buf = tmp;
-  if (cached) {
+  if (cached || source->ReadsInPlace(file_index)) {
     buf = NULL;
   } else if (tmp == NULL || tmp_length < m) {
     buf = new char[m];
   }
   Slice contents;
-  Status status = source->Read(handle.offset(), m, &contents, buf, file_index);
+  Status status =
+      source->Read(handle.offset(), m, &contents, buf, file_index, deadline);
   if (status.ok()) {
     if (contents.size() != m) {
       status = Status::Corruption("Truncated block read");
     }
   }
+  if (status.ok()) {
+    status = ParseBlock(options, contents, result);
+  }
   if (!status.ok()) {
     if (buf != tmp) delete[] buf;
     return status;
   }
 
-  // CRC checks
-  const char* data = contents.data();  // Pointer to where read put the data
-  if (!options.skip_checksums && options.verify_checksums) {
-    const uint32_t crc = crc32c::Unmask(DecodeFixed32(data + n + 1));
-    const uint32_t actual = crc32c::Value(data, n + 1);
-    if (actual != crc) {
-      if (buf != tmp) delete[] buf;
-      status = Status::Corruption("Block checksum mismatch");
-      return status;
-    }
-  }
-
-  if (data[n] == kSnappyCompression) {
-    size_t ulen = 0;
-    if (!port::Snappy_GetUncompressedLength(data, n, &ulen)) {
-      if (buf != tmp) delete[] buf;
-      status = Status::Corruption("Cannot compress");
-      return status;
-    }
-    char* ubuf = new char[ulen];
-    if (!port::Snappy_Uncompress(data, n, ubuf)) {
-      if (buf != tmp) delete[] buf;
-      delete[] ubuf;
-      status = Status::Corruption("Cannot compress");
-      return status;
-    }
+  if (result->heap_allocated) {  // Decompressed
     if (buf != tmp) {
       delete[] buf;
     }
-    result->data = Slice(ubuf, ulen);
-    result->heap_allocated = true;
-    result->cachable = true;
-  } else if (data != buf) {
+  } else if (contents.data() != buf) {
     // File implementation has given us pointer to some other data.
     // Use it directly under the assumption that it will be live
     // while the file is open.
     if (buf != tmp) {
       delete[] buf;
     }
-    result->data = Slice(data, n);
-    result->heap_allocated = false;
     result->cachable = false;  // Avoid double cache
   } else {
-    result->data = Slice(buf, n);
     result->heap_allocated = (buf != tmp);
     result->cachable = true;
   }
@@ -841,103 +2058,503 @@ static Status ReadBlock(LogSource* source, const DirOptions& options,
   return status;
 }
 
-// Retrieve all keys from a given data block.
-Status Dir::Iter(const IterOptions& opts, Slice* input) {
-  Status status;
-  BlockHandle handle;
-  status = handle.DecodeFrom(input);
-  if (!status.ok()) {
-    return status;
-  }
-  BlockContents contents;
-  status = ReadBlock(data_, options_, handle, &contents, false, opts.file_index,
-                     opts.tmp, opts.tmp_length);
-  if (!status.ok()) {
-    return status;
-  } else {
-    opts.stats->seeks++;
+static void DeleteCachedBlock(const Slice& key, void* value) {
+  BlockContents* const contents = reinterpret_cast<BlockContents*>(value);
+  delete[] contents->data.data();
+  delete contents;
+}
+
+static void ReleaseCachedBlock(void* arg, void* h) {
+  Cache* const cache = reinterpret_cast<Cache*>(arg);
+  cache->Release(reinterpret_cast<Cache::Handle*>(h));
+}
+
+// Block cache keys are formed by a per-dir cache id, the data log file index,
+// and the block offset.
+static const size_t kBlockCacheKeyLength = 20;
+
+static Slice BlockCacheKey(uint64_t cache_id, uint32_t file_index,
+                           uint64_t offset, char* scratch) {
+  EncodeFixed64(scratch, cache_id);
+  EncodeFixed32(scratch + 8, file_index);
+  EncodeFixed64(scratch + 12, offset);
+  return Slice(scratch, kBlockCacheKeyLength);
+}
+
+// Index cache keys are formed by a per-dir cache id and the block offset.
+static const size_t kIndexCacheKeyLength = 16;
+
+static Slice IndexCacheKey(uint64_t cache_id, uint64_t offset, char* scratch) {
+  EncodeFixed64(scratch, cache_id);
+  EncodeFixed64(scratch + 8, offset);
+  return Slice(scratch, kIndexCacheKeyLength);
+}
+
+// Index and filter blocks are either read from the index log, which is kept
+// in memory in its entirety or in segments, or, if options_.index_cache is set,
+// fetched on demand and kept in the cache. Cached block contents are pinned
+// by *handle until ReleaseIndexBlock() is called. *handle is set to NULL if
+// the block is not cached. Return OK on success, or a non-OK status on errors.
+Status Dir::ReadIndexBlock(const BlockHandle& handle, BlockContents* result,
+                           Cache::Handle** cache_handle) {
+  *cache_handle = NULL;
+  Cache* const cache = options_.index_cache;
+  if (cache == NULL) {
+    // Index logs are either prefetched in their entirety, in which case
+    // there is no need to allocate an additional buffer to store the block
+    // contents, or loaded in segments, in which case block contents are
+    // copied out of the segments into a heap buffer owned by the caller
+    const bool cached = indx_->ReadsInPlace(0);
+    return ReadBlock(indx_, options_, handle, result, cached);
   }
 
-  Iterator* const iter = OpenDirBlock(options_, contents);
-  iter->SeekToFirst();
-  for (; iter->Valid(); iter->Next()) {
-    if (opts.saver(opts.arg, iter->key(), iter->value()) == -1) {
-      // User does not want to continue
-      break;
+  char tmp[kIndexCacheKeyLength];
+  const Slice key = IndexCacheKey(index_cache_id_, handle.offset(), tmp);
+  Cache::Handle* h = cache->Lookup(key);
+  if (h == NULL) {
+    BlockContents contents;
+    Status status = ReadBlock(indx_, options_, handle, &contents);
+    if (!status.ok()) {
+      return status;
+    } else if (!contents.heap_allocated) {
+      // Data is already in memory somewhere else; no need to cache
+      *result = contents;
+      return status;
     }
-    opts.stats->n++;
-  }
-  if (status.ok()) {
-    status = iter->status();
+    BlockContents* const value = new BlockContents(contents);
+    h = cache->Insert(key, value, value->data.size(), &DeleteCachedBlock);
   }
 
-  delete iter;
-  return status;
+  const BlockContents* contents =
+      reinterpret_cast<BlockContents*>(cache->Value(h));
+  result->data = contents->data;
+  result->heap_allocated = false;
+  result->cachable = false;
+  *cache_handle = h;
+  return Status::OK();
 }
 
-// Retrieve all keys from a given table and call "opts.saver" to handle the
-// results. Return OK on success and a non-OK status on errors.
-Status Dir::Iter(const IterOptions& opts, const TableHandle& h) {
-  Status status;
-  // Load the index block
-  BlockContents index_contents;
+Status Dir::ReadTableIndex(const TableHandle& h, BlockContents* result,
+                           Slice* trailer, Cache::Handle** cache_handle) {
   BlockHandle index_handle;
   index_handle.set_offset(h.index_offset());
   index_handle.set_size(h.index_size());
-  // We always prefetch and cache all index blocks in memory
-  // so there is no need to allocate an additional
-  // buffer to store the block contents
-  const bool cached = true;
-  status = ReadBlock(indx_, options_, index_handle, &index_contents, cached);
-  if (!status.ok()) {
-    return status;
-  } else {
-    opts.stats->table_seeks++;
+  Status status = ReadIndexBlock(index_handle, result, cache_handle);
+  if (status.ok() && HasIndexTrailer(options_)) {
+    Slice index, trailer_data;
+    if (!SplitTableIndex(result->data, &index, &trailer_data)) {
+      ReleaseIndexBlock(*cache_handle);
+      if (result->heap_allocated) delete[] result->data.data();
+      *cache_handle = NULL;
+      return Status::Corruption("Bad table index block");
+    }
+    result->data = index;  // Same starting address
+    if (trailer != NULL) {
+      *trailer = trailer_data;
+    }
   }
+  return status;
+}
 
-  Block* index_block = new Block(index_contents);
-  Iterator* const iter = index_block->NewIterator(BytewiseComparator());
-  iter->SeekToFirst();
-  for (; iter->Valid(); iter->Next()) {
-    Slice input = iter->value();
-    status = Iter(opts, &input);
-    if (!status.ok()) {
-      break;
+void Dir::ReleaseIndexBlock(Cache::Handle* cache_handle) {
+  if (cache_handle != NULL) {
+    options_.index_cache->Release(cache_handle);
+  }
+}
+
+static Iterator* OpenCachedDataBlock(const DirOptions& options, Cache* cache,
+                                     Cache::Handle* h,
+                                     size_t value_offset = 0,
+                                     size_t value_length = 0) {
+  const BlockContents* contents =
+      reinterpret_cast<BlockContents*>(cache->Value(h));
+  Iterator* const iter =
+      OpenDirBlock(options, *contents, value_offset, value_length);
+  iter->RegisterCleanup(&ReleaseCachedBlock, cache, h);
+  return iter;
+}
+
+Iterator* Dir::InsertAndOpenDataBlock(const Slice& cache_key,
+                                      const BlockContents& contents,
+                                      size_t value_offset,
+                                      size_t value_length) {
+  assert(contents.heap_allocated);
+  Cache* const cache = options_.block_cache;
+  BlockContents* const cached = new BlockContents(contents);
+  cached->heap_allocated = false;  // Owned by the cache
+  Cache::Handle* const h = cache->Insert(cache_key, cached, cached->data.size(),
+                                         &DeleteCachedBlock);
+  return OpenCachedDataBlock(options_, cache, h, value_offset, value_length);
+}
+
+Status Dir::OpenDataBlock(const BlockHandle& handle, uint32_t file_index,
+                          char* tmp, size_t tmp_length, Iterator** result,
+                          size_t* hits, size_t* misses, size_t value_offset,
+                          size_t value_length, uint64_t deadline) {
+  Status status;
+  BlockContents contents;
+  Cache* const cache = options_.block_cache;
+  if (cache == NULL) {
+    status = ReadBlock(data_, options_, handle, &contents, false, file_index,
+                       tmp, tmp_length, deadline);
+    if (status.ok()) {
+      *result = OpenDirBlock(options_, contents, value_offset, value_length);
     }
+    return status;
   }
-  if (status.ok()) {
-    status = iter->status();
+
+  char key[kBlockCacheKeyLength];
+  const Slice cache_key =
+      BlockCacheKey(cache_id_, file_index, handle.offset(), key);
+  Cache::Handle* const h = cache->Lookup(cache_key);
+  if (h != NULL) {
+    ++*hits;
+    *result =
+        OpenCachedDataBlock(options_, cache, h, value_offset, value_length);
+    return status;
   }
 
-  delete iter;
-  delete index_block;
+  ++*misses;
+  // Read into a heap buffer so the block can be handed to the cache
+  status = ReadBlock(data_, options_, handle, &contents, false, file_index,
+                     NULL, 0, deadline);
+  if (!status.ok()) {
+    return status;
+  } else if (!contents.heap_allocated) {
+    // Data is already in memory somewhere else; no need to cache
+    *result = OpenDirBlock(options_, contents, value_offset, value_length);
+  } else {
+    *result =
+        InsertAndOpenDataBlock(cache_key, contents, value_offset, value_length);
+  }
   return status;
 }
 
-// Retrieve value to a specific key from a given block whose handle is encoded
-// as *input. Call "opts.saver" using the value found and set *found to true.
-// Set *exhausted to true if a key larger than the target is seen so there is
-// no need to check further. *exhausted is always false if keys are not stored
-// ordered. Return OK on success and a non-OK status on errors.
-Status Dir::Fetch(const FetchOptions& opts, const Slice& key, Slice* input,
-                  bool* found, bool* exhausted) {
-  *found = *exhausted = false;
+// Return value bytes [offset, offset + length) if length is not 0 and the
+// value has not already been projected by the block it comes from.
+static inline Slice ProjectValue(const Slice& value, size_t offset,
+                                 size_t length) {
+  if (length == 0 || value.size() <= length) {
+    return value;
+  } else if (offset >= value.size()) {
+    return Slice();
+  } else {
+    return Slice(value.data() + offset,
+                 std::min(length, value.size() - offset));
+  }
+}
+
+// Return true iff key is within [start, end). An empty bound is unbounded.
+static inline bool InKeyRange(const Slice& key, const Slice& start,
+                              const Slice& end) {
+  return (start.empty() || key >= start) && (end.empty() || key < end);
+}
+
+// Return true iff a table may contain keys within [start, end).
+static inline bool TableMayOverlap(const TableHandle& h, const Slice& start,
+                                   const Slice& end) {
+  // Largest keys are rounded up by FindShortSuccessor() so they are merely
+  // upper bounds of the actual keys stored
+  if (!start.empty() && h.largest_key() < start) {
+    return false;
+  } else if (!end.empty() && h.smallest_key() >= end) {
+    return false;
+  } else {
+    return true;
+  }
+}
+
+// Retrieve all keys from a given data block.
+Status Dir::Iter(const IterOptions& opts, Slice* input) {
   Status status;
   BlockHandle handle;
   status = handle.DecodeFrom(input);
   if (!status.ok()) {
     return status;
   }
-  BlockContents contents;
-  status = ReadBlock(data_, options_, handle, &contents, false, opts.file_index,
-                     opts.tmp, opts.tmp_length);
+  Iterator* iter = NULL;
+  status = OpenDataBlock(handle, opts.file_index, opts.tmp, opts.tmp_length,
+                         &iter, &opts.stats->cache_hits,
+                         &opts.stats->cache_misses, opts.value_offset,
+                         opts.value_length);
   if (!status.ok()) {
     return status;
   } else {
     opts.stats->seeks++;
   }
 
-  Iterator* const iter = OpenDirBlock(options_, contents);
+  return Iter(opts, iter);
+}
+
+Status Dir::Iter(const IterOptions& opts, Iterator* iter) {
+  Status status;
+  const bool ordered = !IsKeyUnOrdered(options_.mode);
+  if (ordered && !opts.key_start.empty()) {
+    iter->Seek(opts.key_start);
+  } else {
+    iter->SeekToFirst();
+  }
+  for (; iter->Valid(); iter->Next()) {
+    if (!InKeyRange(iter->key(), opts.key_start, opts.key_end)) {
+      if (ordered && !opts.key_end.empty() && iter->key() >= opts.key_end) {
+        break;  // No more keys in range
+      }
+      continue;
+    }
+    if (opts.saver(opts.arg, iter->key(),
+                   ProjectValue(iter->value(), opts.value_offset,
+                                opts.value_length)) == -1) {
+      // User does not want to continue
+      break;
+    }
+    opts.stats->n++;
+  }
+  if (status.ok()) {
+    status = iter->status();
+  }
+
+  delete iter;
+  return status;
+}
+
+// A group of consecutive data blocks fetched by a single read.
+struct Dir::ReadaheadWindow {
+  // Form a group of up to options_.scan_readahead blocks starting from
+  // handles[i]. Blocks are grouped as long as the gap between two blocks is
+  // small and the total read size is within options_.read_size.
+  // Return the index of the first block not in the group.
+  size_t Reset(Dir* d, uint32_t idx, const std::vector<BlockHandle>& handles,
+               size_t i) {
+    const DirOptions& options = d->options_;
+    // Max gap between two blocks to be fetched by a single read
+    const uint64_t max_gap = options.block_size;
+    const size_t max_blocks = static_cast<size_t>(options.scan_readahead);
+    offset = handles[i].offset();
+    uint64_t limit = offset + handles[i].size() + kBlockTrailerSize;
+    size_t j = i + 1;
+    for (; j < handles.size() && j - i < max_blocks; j++) {
+      const uint64_t off = handles[j].offset();
+      const uint64_t end = off + handles[j].size() + kBlockTrailerSize;
+      if (off < limit || off - limit > max_gap) break;
+      if (end - offset > options.read_size) break;
+      limit = end;
+    }
+    dir = d;
+    file_index = idx;
+    first_block = i;
+    num_blocks = j - i;
+    size = static_cast<size_t>(limit - offset);
+    buf = new char[size];
+    status = Status::OK();
+    done = false;
+    return j;
+  }
+
+  Dir* dir;
+  uint32_t file_index;
+  size_t first_block;  // Index of the first block in the group
+  size_t num_blocks;
+  uint64_t offset;
+  size_t size;
+  char* buf;
+  Slice contents;
+  Status status;
+  // Set to true when the read is done.
+  // Protected by dir->mu_ if the read is in the background
+  bool done;
+};
+
+void Dir::BGReadahead(void* arg) {
+  ReadaheadWindow* const w = reinterpret_cast<ReadaheadWindow*>(arg);
+  Dir* const dir = w->dir;
+  Status s = dir->data_->Read(w->offset, w->size, &w->contents, w->buf,
+                              w->file_index);
+  if (s.ok() && w->contents.size() != w->size) {
+    s = Status::Corruption("Truncated block read");
+  }
+  MutexLock ml(dir->mu_);
+  w->status = s;
+  w->done = true;
+  dir->bg_cv_->SignalAll();
+}
+
+// If "opts.async_readahead" is set, keys are read from one group of blocks
+// while the next group is being fetched in the background. Otherwise, each
+// group is read when needed.
+Status Dir::IterWithReadahead(const IterOptions& opts,
+                              const std::vector<BlockHandle>& handles) {
+  Status status;
+  ReadaheadWindow windows[2];
+  size_t next_block = 0;
+  int pending = -1;  // Window being fetched in the background
+  for (int k = 0; next_block < handles.size() || pending != -1; k ^= 1) {
+    ReadaheadWindow* const w = &windows[k];
+    if (pending == k) {
+      MutexLock ml(mu_);
+      while (!w->done) bg_cv_->Wait();
+      pending = -1;
+    } else {
+      next_block = w->Reset(this, opts.file_index, handles, next_block);
+      BGReadahead(w);
+    }
+
+    // Start fetching the next group before decoding the current one
+    if (status.ok() && w->status.ok() && opts.async_readahead &&
+        next_block < handles.size()) {
+      ReadaheadWindow* const n = &windows[k ^ 1];
+      next_block = n->Reset(this, opts.file_index, handles, next_block);
+      pending = k ^ 1;
+      if (options_.reader_pool != NULL) {
+        options_.reader_pool->Schedule(Dir::BGReadahead, n);
+      } else {
+        Env::Default()->Schedule(Dir::BGReadahead, n);
+      }
+    }
+
+    if (status.ok()) {
+      status = w->status;
+    }
+    for (size_t i = 0; i < w->num_blocks && status.ok(); i++) {
+      const BlockHandle& b = handles[w->first_block + i];
+      const size_t off = static_cast<size_t>(b.offset() - w->offset);
+      BlockContents block;
+      status = ParseBlock(
+          options_,
+          Slice(w->contents.data() + off, b.size() + kBlockTrailerSize),
+          &block);
+      if (status.ok()) {
+        opts.stats->seeks++;
+        status = Iter(opts, OpenDirBlock(options_, block, opts.value_offset,
+                                         opts.value_length));
+      }
+    }
+    delete[] w->buf;
+    if (!status.ok()) {
+      next_block = handles.size();  // Stop issuing more reads
+    }
+  }
+
+  return status;
+}
+
+// Retrieve all keys from a given table that fall within the key range
+// specified by "opts" and call "opts.saver" to handle the results. Tables and
+// data blocks outside the range are skipped. Return OK on success and a
+// non-OK status on errors.
+Status Dir::Iter(const IterOptions& opts, const TableHandle& h) {
+  Status status;
+  if (!TableMayOverlap(h, opts.key_start, opts.key_end)) {
+    return status;  // Skip the entire table
+  }
+  // Load the index block
+  BlockContents index_contents;
+  Cache::Handle* cache_handle = NULL;
+  status = ReadTableIndex(h, &index_contents, NULL, &cache_handle);
+  if (!status.ok()) {
+    return status;
+  } else {
+    opts.stats->table_seeks++;
+  }
+
+  Block* index_block = new Block(index_contents);
+  Iterator* const iter = index_block->NewIterator(BytewiseComparator());
+  // Index keys are separators no smaller than the last key of each block and
+  // smaller than the first key of the next block
+  const bool ordered = !IsKeyUnOrdered(options_.mode);
+  if (ordered && !opts.key_start.empty()) {
+    iter->Seek(opts.key_start);
+  } else {
+    iter->SeekToFirst();
+  }
+  // Blocks are fetched one by one if readahead is disabled or if the block
+  // cache is in use
+  const bool readahead =
+      options_.scan_readahead > 1 && options_.block_cache == NULL;
+  std::vector<BlockHandle> handles;
+  for (; iter->Valid(); iter->Next()) {
+    Slice input = iter->value();
+    if (readahead) {
+      BlockHandle handle;
+      status = handle.DecodeFrom(&input);
+      handles.push_back(handle);
+    } else {
+      status = Iter(opts, &input);
+    }
+    if (!status.ok()) {
+      break;
+    } else if (ordered && !opts.key_end.empty() &&
+               iter->key() >= opts.key_end) {
+      break;  // Remaining blocks are out of range
+    }
+  }
+  if (status.ok()) {
+    status = iter->status();
+  }
+  if (status.ok() && !handles.empty()) {
+    status = IterWithReadahead(opts, handles);
+  }
+
+  delete iter;
+  delete index_block;
+  ReleaseIndexBlock(cache_handle);
+  return status;
+}
+
+// Retrieve value to a specific key from a given block whose handle is encoded
+// as *input. Call "opts.saver" using the value found and set *found to true.
+// Set *exhausted to true if a key larger than the target is seen so there is
+// no need to check further. *exhausted is always false if keys are not stored
+// ordered. Return OK on success and a non-OK status on errors.
+Status Dir::Fetch(const FetchOptions& opts, const Slice& key, Slice* input,
+                  bool* found, bool* exhausted,
+                  const std::vector<uint32_t>* positions) {
+  *found = *exhausted = false;
+  Status status;
+  BlockHandle handle;
+  status = handle.DecodeFrom(input);
+  if (!status.ok()) {
+    return status;
+  }
+  Iterator* iter = NULL;
+  const size_t cache_hits = opts.stats->cache_hits;
+  const uint64_t start = CurrentMicros();
+  {
+    PerfScope perf(options_.perf_counters, kPerfBlockRead);
+    status = OpenDataBlock(handle, opts.file_index, opts.tmp, opts.tmp_length,
+                           &iter, &opts.stats->cache_hits,
+                           &opts.stats->cache_misses, 0, 0, opts.deadline);
+  }
+  const uint64_t fetched = CurrentMicros();
+  opts.stats->io_micros += fetched - start;
+  if (!status.ok()) {
+    return status;
+  } else {
+    opts.stats->seeks++;
+    if (opts.stats->cache_hits == cache_hits) {
+      opts.stats->bytes_read += handle.size() + kBlockTrailerSize;
+    }
+  }
+
+  PerfScope perf(options_.perf_counters, kPerfBlockSearch);
+
+  if (positions != NULL && ArrayBlock::SeekToEntry(iter, 0)) {
+    // Only probe the entries located by the table's key index
+    for (size_t i = 0; i < positions->size() && !*found; i++) {
+      ArrayBlock::SeekToEntry(iter, (*positions)[i]);
+      if (iter->Valid() && iter->key() == key) {  // Hit
+        const int r = opts.saver(opts.arg, key, iter->value());
+        opts.stats->hits++;
+        *found = true;
+        if (r == -1) {  // Saver asks us to stop
+          *exhausted = true;
+        }
+      }
+    }
+    delete iter;
+    opts.stats->decode_micros += CurrentMicros() - fetched;
+    return status;
+  }
+
   if (IsKeyUniqueAndOrdered(options_.mode)) {
     iter->Seek(key);  // Binary search
   } else {
@@ -973,8 +2590,12 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key, Slice* input,
   // Collect all results
   for (; iter->Valid(); iter->Next()) {
     if (iter->key() == key) {  // Hit
-      opts.saver(opts.arg, key, iter->value());
-      if (IsKeyUnique(options_.mode)) {
+      const int r = opts.saver(opts.arg, key, iter->value());
+      opts.stats->hits++;
+      if (r == -1) {  // Saver asks us to stop
+        *found = *exhausted = true;
+        break;
+      } else if (IsKeyUnique(options_.mode)) {
         *found = true;
         break;  // Done
       }
@@ -991,6 +2612,7 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key, Slice* input,
   }
 
   delete iter;
+  opts.stats->decode_micros += CurrentMicros() - fetched;
   return status;
 }
 
@@ -999,15 +2621,18 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key, Slice* input,
 bool Dir::KeyMayMatch(const Slice& key, const BlockHandle& h) {
   Status status;
   BlockContents contents;
-  // We always prefetch and cache all filter blocks in memory
-  // so there is no need to allocate an additional
-  // buffer to store the block contents
-  const bool cached = true;
-  status = ReadBlock(indx_, options_, h, &contents, cached);
+  Cache::Handle* cache_handle = NULL;
+  status = ReadIndexBlock(h, &contents, &cache_handle);
   if (status.ok()) {
     bool r;  // False if key must not match so no need for further access
     if (options_.filter == kFtBloomFilter) {
       r = BloomKeyMayMatch(key, contents.data);
+    } else if (options_.filter == kFtBlockedBloomFilter) {
+      r = BlockedBloomKeyMayMatch(key, contents.data);
+    } else if (options_.filter == kFtXorFilter) {
+      r = XorKeyMayMatch(key, contents.data);
+    } else if (options_.filter == kFtGcsFilter) {
+      r = GcsKeyMayMatch(key, contents.data);
     } else if (options_.filter == kFtBitmap) {
       r = BitmapKeyMustMatch(key, contents.data);
     } else {  // Unknown filter type
@@ -1016,18 +2641,52 @@ bool Dir::KeyMayMatch(const Slice& key, const BlockHandle& h) {
     if (contents.heap_allocated) {
       delete[] contents.data.data();
     }
+    ReleaseIndexBlock(cache_handle);
     return r;
   } else {
     return true;
   }
 }
 
+// Find the only filter partition whose key range may cover the given key in a
+// filter index and check the key against that partition. Keys larger than the
+// largest key of the last partition must not match.
+bool Dir::PartitionKeyMayMatch(const Slice& key, const BlockHandle& h) {
+  Status status;
+  BlockContents contents;
+  Cache::Handle* cache_handle = NULL;
+  status = ReadIndexBlock(h, &contents, &cache_handle);
+  if (!status.ok()) {
+    return true;
+  }
+
+  bool r = true;
+  Block* filter_index = new Block(contents);
+  Iterator* const iter = filter_index->NewIterator(BytewiseComparator());
+  iter->Seek(key);
+  if (iter->Valid()) {
+    BlockHandle partition_handle;
+    Slice input = iter->value();
+    if (partition_handle.DecodeFrom(&input).ok()) {
+      r = KeyMayMatch(key, partition_handle);
+    }
+  } else if (iter->status().ok()) {
+    r = false;
+  }
+
+  delete iter;
+  delete filter_index;
+  ReleaseIndexBlock(cache_handle);
+  return r;
+}
+
 // Retrieve value to a specific key from a given table and call "opts.saver"
 // using the value found. Filter will be consulted if available to avoid
 // unnecessary reads. Return OK on success and a non-OK status on errors.
 Status Dir::Fetch(const FetchOptions& opts, const Slice& key,
                   const TableHandle& h) {
   Status status;
+  bool filter_passed = false;
   // Check table key range and the paired filter
   if (key < h.smallest_key() || key > h.largest_key()) {
     return status;
@@ -1036,34 +2695,62 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key,
     filter_handle.set_offset(h.filter_offset());
     filter_handle.set_size(h.filter_size());
     if (filter_handle.size() != 0) {  // Filter detected
-      if (!KeyMayMatch(key, filter_handle)) {
+      opts.stats->filter_probes++;
+      bool may_match;
+      {
+        PerfScope perf(options_.perf_counters, kPerfFilterProbe);
+        may_match = FilterMayMatch(key, filter_handle);
+      }
+      if (!may_match) {
         // Assuming no false negatives
         return status;
       }
+      filter_passed = true;
     }
   }
 
   // Load the index block
   BlockContents index_contents;
-  BlockHandle index_handle;
-  index_handle.set_offset(h.index_offset());
-  index_handle.set_size(h.index_size());
-  // We always prefetch and cache all index blocks in memory
-  // so there is no need to allocate an additional
-  // buffer to store the block contents
-  const bool cached = true;
-  status = ReadBlock(indx_, options_, index_handle, &index_contents, cached);
+  Slice trailer;
+  Cache::Handle* cache_handle = NULL;
+  status = ReadTableIndex(h, &index_contents, &trailer, &cache_handle);
   if (!status.ok()) {
     return status;
   } else {
     opts.stats->table_seeks++;
   }
 
+  // Positions of the entries within the table's only data block that may
+  // hold the key as located by the table's key index
+  std::vector<uint32_t> positions;
+  if (HasKeyIndex(options_) && !trailer.empty()) {
+    if (!CuckooValues(key, trailer, &positions)) {  // Key must be absent
+      if (filter_passed) {
+        opts.stats->filter_false_positives++;
+      }
+      ReleaseIndexBlock(cache_handle);
+      if (index_contents.heap_allocated) {
+        delete[] index_contents.data.data();
+      }
+      return status;
+    }
+  }
+
   Block* index_block = new Block(index_contents);
-  Iterator* const iter = index_block->NewIterator(BytewiseComparator());
-  if (IsKeyUniqueAndOrdered(options_.mode)) {
+  Iterator* iter = NULL;
+  // Handle of the only data block that may hold the key as located by the
+  // table's ect data without searching the index block
+  Slice ect_handle;
+  uint32_t block;
+  if (IsKeyUniqueAndOrdered(options_.mode) && !trailer.empty() &&
+      EctFindBlock(options_.key_size, trailer, key, &block) &&
+      GetRestartEntryValue(index_contents.data, block, &ect_handle)) {
+    // OK
+  } else if (IsKeyUniqueAndOrdered(options_.mode)) {
+    iter = index_block->NewIterator(BytewiseComparator());
     iter->Seek(key);  // Binary search
   } else {
+    iter = index_block->NewIterator(BytewiseComparator());
     // Keys are non-unique or stored out-of-order.
     // Must start from the beginning
     iter->SeekToFirst();
@@ -1077,34 +2764,45 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key,
   bool found = false;  // True if we found the target key
   // True if a key greater than the target is seen
   bool exhausted = false;
-  for (; iter->Valid(); iter->Next()) {
-    Slice input = iter->value();
-    status = Fetch(opts, key, &input, &found, &exhausted);
-    if (!status.ok()) {
-      break;
+  const size_t hits = opts.stats->hits;
+  if (iter == NULL) {
+    status = Fetch(opts, key, &ect_handle, &found, &exhausted);
+  } else {
+    for (; iter->Valid(); iter->Next()) {
+      Slice input = iter->value();
+      status = Fetch(opts, key, &input, &found, &exhausted,
+                     !positions.empty() ? &positions : NULL);
+      if (!status.ok()) {
+        break;
+      }
+      // Unique?  Ordered?  Found?  Exhausted?
+      //   Y        Y         *       *       >> Break (Always check 1 block)
+      //   Y        N         Y       *       >> Break
+      //   Y        N         N       *       >> Continue
+      //   N        Y         *       Y       >> Break
+      //   N        Y         *       N       >> Continue
+      //   N        N         *       *       >> Continue (Always check all)
+      if (IsKeyUniqueAndOrdered(options_.mode)) {
+        break;
+      } else if (exhausted && !IsKeyUnOrdered(options_.mode)) {
+        break;
+      } else if (found && IsKeyUnique(options_.mode)) {
+        break;
+      } else if (found && exhausted) {  // Stopped by the saver
+        break;
+      }
     }
-    // Unique?  Ordered?  Found?  Exhausted?
-    //   Y        Y         *       *       >> Break (Always check 1 block)
-    //   Y        N         Y       *       >> Break
-    //   Y        N         N       *       >> Continue
-    //   N        Y         *       Y       >> Break
-    //   N        Y         *       N       >> Continue
-    //   N        N         *       *       >> Continue (Always check all)
-    if (IsKeyUniqueAndOrdered(options_.mode)) {
-      break;
-    } else if (exhausted && !IsKeyUnOrdered(options_.mode)) {
-      break;
-    } else if (found && IsKeyUnique(options_.mode)) {
-      break;
+    if (status.ok()) {
+      status = iter->status();
     }
   }
-
-  if (status.ok()) {
-    status = iter->status();
+  if (status.ok() && filter_passed && opts.stats->hits == hits) {
+    opts.stats->filter_false_positives++;
   }
 
   delete iter;
   delete index_block;
+  ReleaseIndexBlock(cache_handle);
   return status;
 }
 
@@ -1117,11 +2815,8 @@ Status Dir::DoList(const BlockHandle& h, uint32_t epoch, ListContext* ctx,
   Status status;
   // Load the meta index for the epoch
   BlockContents meta_index_contents;
-  // We always prefetch and cache all index blocks in memory
-  // so there is no need to allocate an additional
-  // buffer to store the block contents
-  const bool cached = true;
-  status = ReadBlock(indx_, options_, h, &meta_index_contents, cached);
+  Cache::Handle* cache_handle = NULL;
+  status = ReadIndexBlock(h, &meta_index_contents, &cache_handle);
   if (!status.ok()) {
     return status;
   }
@@ -1154,6 +2849,11 @@ Status Dir::DoList(const BlockHandle& h, uint32_t epoch, ListContext* ctx,
       opts.stats = stats;
       opts.tmp_length = ctx->tmp_length;
       opts.tmp = ctx->tmp;
+      opts.key_start = ctx->key_start;
+      opts.key_end = ctx->key_end;
+      opts.value_offset = ctx->value_offset;
+      opts.value_length = ctx->value_length;
+      opts.async_readahead = ctx->async_readahead;
       opts.saver = reinterpret_cast<Saver>(ctx->usr_cb);
       opts.arg = ctx->arg_cb;
       status = Iter(opts, table_handle);
@@ -1169,6 +2869,7 @@ Status Dir::DoList(const BlockHandle& h, uint32_t epoch, ListContext* ctx,
 
   delete iter;
   delete epoch_index_block;
+  ReleaseIndexBlock(cache_handle);
   return status;
 }
 
@@ -1185,20 +2886,20 @@ int SaveValue(void* arg, const Slice& key, const Slice& value) {
   return 0;
 }
 
-struct ParaSaverState : public SaverState {
+struct EpochSaverState : public SaverState {
   uint32_t epoch;
-  std::vector<uint32_t>* offsets;
-  std::string* buffer;
-  port::Mutex* mu;
+  Dir::ValueSaver saver;
+  void* saver_arg;
+  bool stopped;
 };
 
-int ParaSaveValue(void* arg, const Slice& key, const Slice& value) {
-  ParaSaverState* state = reinterpret_cast<ParaSaverState*>(arg);
-  MutexLock ml(state->mu);
-  state->offsets->push_back(static_cast<uint32_t>(state->buffer->size()));
-  PutVarint32(state->buffer, state->epoch);
-  PutLengthPrefixedSlice(state->buffer, value);
+int EpochSaveValue(void* arg, const Slice& key, const Slice& value) {
+  EpochSaverState* state = reinterpret_cast<EpochSaverState*>(arg);
   state->found = true;
+  if (state->saver(state->saver_arg, state->epoch, value) == -1) {
+    state->stopped = true;
+    return -1;
+  }
   return 0;
 }
 
@@ -1213,11 +2914,8 @@ Status Dir::DoGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
   Status status;
   // Load the meta index for the epoch
   BlockContents meta_index_contents;
-  // We always prefetch and cache all index blocks in memory
-  // so there is no need to allocate an additional
-  // buffer to store the block contents
-  const bool cached = true;
-  status = ReadBlock(indx_, options_, h, &meta_index_contents, cached);
+  Cache::Handle* cache_handle = NULL;
+  status = ReadIndexBlock(h, &meta_index_contents, &cache_handle);
   if (!status.ok()) {
     return status;
   }
@@ -1225,6 +2923,7 @@ Status Dir::DoGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
   Iterator* const iter = epoch_index_block->NewIterator(BytewiseComparator());
   iter->SeekToFirst();
   std::string epoch_table_key;
+  const size_t table_seeks = stats->table_seeks;
   uint32_t table = 0;
   for (; status.ok(); table++) {
     epoch_table_key = EpochTableKey(epoch, table);
@@ -1237,12 +2936,17 @@ Status Dir::DoGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
         break;  // No such table
       }
     }
-    ParaSaverState arg;
+    EpochSaverState arg;
     arg.epoch = epoch;
-    arg.offsets = ctx->offsets;
-    arg.buffer = ctx->buffer;
-    arg.mu = mu_;
-    arg.dst = ctx->dst;
+    arg.saver = ctx->saver;
+    arg.saver_arg = ctx->saver_arg;
+    arg.stopped = false;
+    if (ctx->parallel) {
+      assert(epoch >= ctx->epoch_start);
+      arg.dst = &(*ctx->results)[epoch - ctx->epoch_start];
+    } else {
+      arg.dst = ctx->dst;
+    }
     arg.found = false;
     TableHandle table_handle;
     Slice input = iter->value();
@@ -1258,14 +2962,17 @@ Status Dir::DoGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
       opts.stats = stats;
       opts.tmp_length = ctx->tmp_length;
       opts.tmp = ctx->tmp;
-      if (options_.parallel_reads) {
-        opts.saver = ParaSaveValue;
-        opts.arg = &arg;
-        status = Fetch(opts, key, table_handle);
+      if (ctx->saver != NULL) {
+        opts.saver = EpochSaveValue;
       } else {
         opts.saver = SaveValue;
-        opts.arg = &arg;
-        status = Fetch(opts, key, table_handle);
+      }
+      opts.arg = &arg;
+      opts.deadline = ctx->deadline;
+      status = Fetch(opts, key, table_handle);
+      if (status.ok() && arg.stopped) {
+        ctx->stopped = true;
+        break;
       }
       // Each epoch is stored as a set of tables. If we find one match and
       // we know keys are unique, we are done.
@@ -1281,8 +2988,13 @@ Status Dir::DoGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
     status = iter->status();
   }
 
+  if (status.ok() && table != 0 && stats->table_seeks == table_seeks) {
+    stats->epochs_skipped++;
+  }
+
   delete iter;
   delete epoch_index_block;
+  ReleaseIndexBlock(cache_handle);
   return status;
 }
 
@@ -1298,6 +3010,9 @@ static inline Iterator* NewRtIterator(Block* block) {
 void Dir::List(uint32_t epoch, ListContext* ctx) {
   mu_->AssertHeld();
   if (!ctx->status->ok()) {
+    assert(ctx->num_open_lists > 0);
+    ctx->num_open_lists--;
+    bg_cv_->SignalAll();
     return;
   }
   Iterator* rt_iter = ctx->rt_iter;
@@ -1310,6 +3025,7 @@ void Dir::List(uint32_t epoch, ListContext* ctx) {
   // Number of data blocks fetched
   stats.seeks = 0;
   stats.n = 0;
+  stats.cache_hits = stats.cache_misses = 0;
   Status status;
   for (uint32_t dummy = epoch; dummy == epoch; dummy++) {
     std::string epoch_key = EpochKey(epoch);
@@ -1346,6 +3062,8 @@ void Dir::List(uint32_t epoch, ListContext* ctx) {
   ctx->num_table_seeks += stats.table_seeks;
   ctx->num_seeks += stats.seeks;
   ctx->n += stats.n;
+  cache_hits_ += stats.cache_hits;
+  cache_misses_ += stats.cache_misses;
   assert(ctx->num_open_lists > 0);
   ctx->num_open_lists--;
   bg_cv_->SignalAll();
@@ -1354,12 +3072,52 @@ void Dir::List(uint32_t epoch, ListContext* ctx) {
   }
 }
 
+Dir::GetStats::GetStats()
+    : table_seeks(0),
+      seeks(0),
+      cache_hits(0),
+      cache_misses(0),
+      hits(0),
+      bytes_read(0),
+      filter_probes(0),
+      filter_false_positives(0),
+      io_micros(0),
+      decode_micros(0),
+      epochs_skipped(0) {}
+
+void Dir::AddCosts(QueryStats* costs, const GetStats& stats) {
+  costs->bytes_read += stats.bytes_read;
+  costs->filter_probes += stats.filter_probes;
+  costs->filter_false_positives += stats.filter_false_positives;
+  costs->cache_hits += stats.cache_hits;
+  costs->cache_misses += stats.cache_misses;
+  costs->io_micros += stats.io_micros;
+  costs->decode_micros += stats.decode_micros;
+  costs->epochs_skipped += stats.epochs_skipped;
+}
+
+void Dir::AddCosts(QueryStats* costs, const QueryStats& other) {
+  costs->bytes_read += other.bytes_read;
+  costs->filter_probes += other.filter_probes;
+  costs->filter_false_positives += other.filter_false_positives;
+  costs->cache_hits += other.cache_hits;
+  costs->cache_misses += other.cache_misses;
+  costs->io_micros += other.io_micros;
+  costs->decode_micros += other.decode_micros;
+  costs->epochs_skipped += other.epochs_skipped;
+}
+
 // Obtain the value to a specific key at a given directory epoch.
 // GetContext *ctx may be shared among multiple concurrent getter threads.
 // Return OK on success, or a non-OK status on errors.
 void Dir::Get(const Slice& key, uint32_t epoch, GetContext* ctx) {
   mu_->AssertHeld();
-  if (!ctx->status->ok()) {
+  // Skip epochs older than the one in which the key has already been found
+  if (!ctx->status->ok() ||
+      (ctx->latest_first && ctx->found && ctx->found_epoch > epoch)) {
+    assert(ctx->num_open_reads > 0);
+    ctx->num_open_reads--;
+    bg_cv_->SignalAll();
     return;
   }
   Iterator* rt_iter = ctx->rt_iter;
@@ -1368,279 +3126,1657 @@ void Dir::Get(const Slice& key, uint32_t epoch, GetContext* ctx) {
   }
   mu_->Unlock();
   GetStats stats;
-  stats.table_seeks = 0;  // Number of tables touched
-  // Number of data blocks fetched
-  stats.seeks = 0;
+  Status status = GetEpoch(key, epoch, rt_iter, ctx, &stats);
+  mu_->Lock();
+  if (rt_iter != ctx->rt_iter) {
+    delete rt_iter;
+  }
+  // Increase the total seek count
+  ctx->num_table_seeks += stats.table_seeks;
+  ctx->num_seeks += stats.seeks;
+  AddCosts(&ctx->costs, stats);
+  cache_hits_ += stats.cache_hits;
+  cache_misses_ += stats.cache_misses;
+  if (ctx->status->ok()) {
+    *ctx->status = status;
+  }
+  if (status.ok() && stats.hits != 0) {
+    if (!ctx->found || epoch > ctx->found_epoch) {
+      ctx->found_epoch = epoch;
+      ctx->found = true;
+    }
+  }
+  assert(ctx->num_open_reads > 0);
+  ctx->num_open_reads--;
+  bg_cv_->SignalAll();
+}
+
+Status Dir::GetEpoch(const Slice& key, uint32_t epoch, Iterator* rt_iter,
+                     GetContext* ctx, GetStats* stats) {
+  if (((ctx->epoch_mask >> (epoch & 31)) & 1) == 0) {
+    return Status::OK();  // Key absent from the epoch
+  }
+  if (ctx->deadline != 0 && CurrentMicros() >= ctx->deadline) {
+    return Status::TryAgain("Read deadline exceeded");
+  }
   Status status;
-  for (uint32_t dummy = epoch; dummy == epoch; dummy++) {
-    std::string epoch_key = EpochKey(epoch);
-    // Try reusing current iterator position if possible
+  std::string epoch_key = EpochKey(epoch);
+  // Try reusing current iterator position if possible
+  if (!rt_iter->Valid() || rt_iter->key() != epoch_key) {
+    rt_iter->Seek(epoch_key);
     if (!rt_iter->Valid() || rt_iter->key() != epoch_key) {
-      rt_iter->Seek(epoch_key);
-      if (!rt_iter->Valid()) {
-        break;  // EOF
-      } else if (rt_iter->key() != epoch_key) {
-        break;  // No such epoch
-      }
+      return rt_iter->status();  // EOF or no such epoch
     }
-    BlockHandle h;
-    Slice input = rt_iter->value();
-    status = h.DecodeFrom(&input);
-    rt_iter->Next();
-    if (status.ok()) {
-      status = DoGet(key, h, epoch, ctx, &stats);
+  }
+  BlockHandle h;
+  Slice input = rt_iter->value();
+  status = h.DecodeFrom(&input);
+  rt_iter->Next();
+  if (status.ok()) {
+    status = DoGet(key, h, epoch, ctx, stats);
+  }
+  if (status.ok()) {
+    status = rt_iter->status();
+  }
+  return status;
+}
+
+void Dir::StartFetcher(EpochFetcher* f, const Slice& key, uint32_t epoch_end,
+                       GetContext* ctx) {
+  mu_->AssertHeld();
+  assert(ctx->parallel && ctx->epoch_start < epoch_end);
+  f->ctx = ctx;
+  f->dir = this;
+  f->key = key;
+  f->epoch_end = epoch_end;
+  f->next = 0;
+  const uint32_t num_tasks = std::min(
+      epoch_end - ctx->epoch_start,
+      static_cast<uint32_t>(std::max(options_.read_fetchers, 1)));
+  ctx->num_open_reads += num_tasks;
+  for (uint32_t i = 0; i < num_tasks; i++) {
+    if (options_.reader_pool != NULL) {
+      options_.reader_pool->ScheduleUrgent(Dir::BGFetch, f);
     } else {
-      // Skip the epoch
+      Env::Default()->Schedule(Dir::BGFetch, f);
     }
-    break;
   }
+}
 
-  if (status.ok()) {
-    status = rt_iter->status();
+void Dir::Fetch(EpochFetcher* f) {
+  GetContext* const ctx = f->ctx;
+  const uint32_t num_epochs = f->epoch_end - ctx->epoch_start;
+  Iterator* const rt_iter = NewRtIterator(rt_);
+  GetStats stats;
+  Status status;
+  while (status.ok()) {
+    uint32_t epoch;
+    {
+      MutexLock ml(&f->mu);
+      if (!ctx->status->ok() || f->next == num_epochs) {
+        break;
+      } else if (ctx->latest_first && ctx->found) {
+        break;  // Remaining epochs are older
+      }
+      const uint32_t i = f->next++;
+      epoch = ctx->latest_first ? f->epoch_end - 1 - i : ctx->epoch_start + i;
+    }
+    const size_t hits = stats.hits;
+    status = GetEpoch(f->key, epoch, rt_iter, ctx, &stats);
+    MutexLock ml(&f->mu);
+    if (!status.ok()) {
+      if (ctx->status->ok()) {
+        *ctx->status = status;
+      }
+    } else if (stats.hits != hits) {
+      if (!ctx->found || epoch > ctx->found_epoch) {
+        ctx->found_epoch = epoch;
+        ctx->found = true;
+      }
+    }
   }
+  delete rt_iter;
 
   mu_->Lock();
-  if (rt_iter != ctx->rt_iter) {
-    delete rt_iter;
-  }
-  // Increase the total seek count
   ctx->num_table_seeks += stats.table_seeks;
   ctx->num_seeks += stats.seeks;
+  AddCosts(&ctx->costs, stats);
+  cache_hits_ += stats.cache_hits;
+  cache_misses_ += stats.cache_misses;
   assert(ctx->num_open_reads > 0);
   ctx->num_open_reads--;
   bg_cv_->SignalAll();
-  if (ctx->status->ok()) {
-    *ctx->status = status;
-  }
 }
 
-struct Dir::STLLessThan {
-  Slice buffer_;
-
-  explicit STLLessThan(const Slice& buffer) : buffer_(buffer) {}
-
-  bool operator()(uint32_t a, uint32_t b) {
-    const uint32_t epoch_a = GetEpoch(a);
-    const uint32_t epoch_b = GetEpoch(b);
-    return epoch_a < epoch_b;
+// Concatenate per-epoch results in epoch order. Values within each epoch are
+// already in their on-disk order so no sorting is needed.
+void Dir::Merge(GetContext* ctx) {
+  if (ctx->latest_first) {
+    if (ctx->found) {
+      assert(ctx->found_epoch >= ctx->epoch_start);
+      ctx->dst->append((*ctx->results)[ctx->found_epoch - ctx->epoch_start]);
+    }
+    return;
+  }
+  std::vector<std::string>::const_iterator it;
+  size_t total = ctx->dst->size();
+  for (it = ctx->results->begin(); it != ctx->results->end(); ++it) {
+    total += it->size();
+  }
+  ctx->dst->reserve(total);
+  for (it = ctx->results->begin(); it != ctx->results->end(); ++it) {
+    ctx->dst->append(*it);
   }
+}
 
-  uint32_t GetEpoch(uint32_t off) {
-    uint32_t e = 0;
-    const char* p = GetVarint32Ptr(  // Decode epoch number
-        buffer_.data() + off, buffer_.data() + buffer_.size(), &e);
-    if (p != NULL) {
-      return e;
+// Count the total num of keys within a given epoch range.
+// Return OK on success, or a non-OK status on errors.
+Status Dir::Count(const CountOptions& opts, size_t* result) {
+  mu_->AssertHeld();
+  Status status;
+  assert(rt_ != NULL);
+  std::string epoch_key;
+  *result = 0;
+
+  Iterator* rt_iter = NewRtIterator(rt_);
+  if (num_eps_ != 0) {
+    uint32_t epoch = opts.epoch_start;
+    uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
+    for (; epoch < epoch_end; epoch++) {
+      epoch_key = EpochKey(epoch);
+      // Try reusing current iterator position if possible
+      if (!rt_iter->Valid() || rt_iter->key() != epoch_key) {
+        rt_iter->Seek(epoch_key);
+        if (!rt_iter->Valid()) {
+          break;  // EOF
+        } else if (rt_iter->key() != epoch_key) {
+          break;  // No such epoch
+        }
+      }
+      EpochHandle h;  // Handle to the epoch
+      Slice input = rt_iter->value();
+      status = h.DecodeFrom(&input);
+      rt_iter->Next();
+      if (status.ok()) {
+        *result += h.num_ents();
+      } else {
+        break;
+      }
+    }
+  }
+
+  if (status.ok()) {
+    status = rt_iter->status();
+  }
+
+  delete rt_iter;
+  return status;
+}
+
+Status Dir::EstimateCount(const EstimateOptions& opts, size_t* result) {
+  mu_->AssertHeld();
+  Status status;
+  assert(rt_ != NULL);
+  std::string epoch_key;
+  std::string epoch_table_key;
+  *result = 0;
+
+  Iterator* rt_iter = NewRtIterator(rt_);
+  uint32_t epoch = opts.epoch_start;
+  uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
+  for (; epoch < epoch_end; epoch++) {
+    epoch_key = EpochKey(epoch);
+    rt_iter->Seek(epoch_key);
+    if (!rt_iter->Valid() || rt_iter->key() != epoch_key) {
+      continue;  // Empty epoch
+    }
+    EpochHandle h;
+    Slice input = rt_iter->value();
+    status = h.DecodeFrom(&input);
+    if (!status.ok()) {
+      break;
+    } else if (h.num_tables() == 0) {
+      continue;
+    }
+    BlockHandle meta_handle;
+    meta_handle.set_offset(h.index_offset());
+    meta_handle.set_size(h.index_size());
+    BlockContents contents;
+    Cache::Handle* cache_handle = NULL;
+    status = ReadIndexBlock(meta_handle, &contents, &cache_handle);
+    if (!status.ok()) {
+      break;
+    }
+    Block* const epoch_index_block = new Block(contents);
+    Iterator* const iter =
+        epoch_index_block->NewIterator(BytewiseComparator());
+    for (uint32_t table = 0; table < h.num_tables(); table++) {
+      epoch_table_key = EpochTableKey(epoch, table);
+      iter->Seek(epoch_table_key);
+      if (!iter->Valid() || iter->key() != epoch_table_key) {
+        status = Status::Corruption("Missing table in epoch index");
+        break;
+      }
+      TableHandle table_handle;
+      input = iter->value();
+      status = table_handle.DecodeFrom(&input);
+      if (!status.ok()) {
+        break;
+      } else if (!TableMayOverlap(table_handle, opts.key_start,
+                                  opts.key_end)) {
+        continue;
+      } else if (!table_handle.key_samples().empty()) {
+        *result +=
+            table_handle.EstimateEntries(opts.key_start, opts.key_end);
+      } else {
+        *result += h.num_ents() / h.num_tables();
+      }
+    }
+    if (status.ok()) {
+      status = iter->status();
+    }
+    delete iter;
+    delete epoch_index_block;
+    ReleaseIndexBlock(cache_handle);
+    if (!status.ok()) {
+      break;
+    }
+  }
+
+  if (status.ok()) {
+    status = rt_iter->status();
+  }
+
+  delete rt_iter;
+  return status;
+}
+
+// Return the number of bytes a data block of a given size takes in the data
+// log, including its leading block handle, trailer, and any padding.
+static uint64_t FinalDataBlockSize(const DirOptions& options, uint64_t size) {
+  uint64_t result = size + kBlockTrailerSize;
+  if (options.block_padding) {
+    uint64_t padding_target =
+        options.block_size - BlockHandle::kMaxEncodedLength;
+    while (padding_target < result) padding_target += options.block_size;
+    result = padding_target;
+  }
+  return result + BlockHandle::kMaxEncodedLength;
+}
+
+Status Dir::GetTableSpaceStats(const TableHandle& h, bool partitioned,
+                               DirSpaceStats* space) {
+  Status status;
+  space->num_tables++;
+  space->index_size += h.index_size();
+  space->filter_size += h.filter_size();
+  space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
+  if (h.filter_size() != 0) {
+    space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
+  }
+  // Data blocks
+  BlockContents contents;
+  Cache::Handle* cache_handle = NULL;
+  status = ReadTableIndex(h, &contents, NULL, &cache_handle);
+  if (!status.ok()) {
+    return status;
+  }
+  Block* block = new Block(contents);
+  Iterator* iter = block->NewIterator(BytewiseComparator());
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    BlockHandle handle;
+    Slice input = iter->value();
+    status = handle.DecodeFrom(&input);
+    if (!status.ok()) {
+      break;
+    }
+    const uint64_t final_size = FinalDataBlockSize(options_, handle.size());
+    space->num_blocks++;
+    space->data_size += handle.size();
+    space->index_size += BlockHandle::kMaxEncodedLength;
+    space->checksum_size += kBlockTrailerSize;
+    space->block_padding_size += final_size - handle.size() -
+                                 kBlockTrailerSize -
+                                 BlockHandle::kMaxEncodedLength;
+  }
+  if (status.ok()) {
+    status = iter->status();
+  }
+  delete iter;
+  delete block;
+  ReleaseIndexBlock(cache_handle);
+  if (!status.ok() || !partitioned || h.filter_size() == 0) {
+    return status;
+  }
+  // Filter partitions
+  BlockHandle filter_handle;
+  filter_handle.set_offset(h.filter_offset());
+  filter_handle.set_size(h.filter_size());
+  status = ReadIndexBlock(filter_handle, &contents, &cache_handle);
+  if (!status.ok()) {
+    return status;
+  }
+  block = new Block(contents);
+  iter = block->NewIterator(BytewiseComparator());
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    BlockHandle handle;
+    Slice input = iter->value();
+    status = handle.DecodeFrom(&input);
+    if (!status.ok()) {
+      break;
+    }
+    space->filter_size += handle.size();
+    space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
+  }
+  if (status.ok()) {
+    status = iter->status();
+  }
+  delete iter;
+  delete block;
+  ReleaseIndexBlock(cache_handle);
+  return status;
+}
+
+Status Dir::GetSpaceStats(std::vector<DirSpaceStats>* epochs,
+                          DirSpaceStats* others) {
+  mu_->AssertHeld();
+  Status status;
+  assert(rt_ != NULL);
+  // The footer is read again since the number of epochs may have been
+  // truncated by options_.num_epochs when the directory was opened
+  char tmp[Footer::kEncodedLength];
+  Slice input;
+  status = indx_->Read(indx_->Size() - sizeof(tmp), sizeof(tmp), &input, tmp);
+  Footer footer;
+  if (status.ok()) {
+    status = footer.DecodeFrom(&input);
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+  const bool partitioned = (footer.filter_type() & kFtPartitioned) != 0;
+  epochs->clear();
+  epochs->resize(footer.num_epochs());
+  std::string epoch_key;
+  std::string epoch_table_key;
+  std::string stone_encoding;
+  Iterator* rt_iter = NewRtIterator(rt_);
+  for (uint32_t epoch = 0; epoch < footer.num_epochs(); epoch++) {
+    epoch_key = EpochKey(epoch);
+    rt_iter->Seek(epoch_key);
+    if (!rt_iter->Valid() || rt_iter->key() != epoch_key) {
+      continue;  // Empty epoch
+    }
+    EpochHandle h;
+    input = rt_iter->value();
+    status = h.DecodeFrom(&input);
+    if (!status.ok()) {
+      break;
+    }
+    BlockHandle meta_handle;
+    meta_handle.set_offset(h.index_offset());
+    meta_handle.set_size(h.index_size());
+    DirSpaceStats* const space = &(*epochs)[epoch];
+    // Epoch meta index and the epoch stone sealing it
+    EpochStone stone;
+    stone.set_handle(meta_handle);
+    stone.set_id(epoch);
+    stone_encoding.clear();
+    stone.EncodeTo(&stone_encoding);
+    space->index_size += h.index_size() + stone_encoding.size();
+    space->checksum_size += kChunkHeaderSize + kBlockTrailerSize;
+    space->checksum_size += kChunkHeaderSize;
+
+    BlockContents contents;
+    Cache::Handle* cache_handle = NULL;
+    status = ReadIndexBlock(meta_handle, &contents, &cache_handle);
+    if (!status.ok()) {
+      break;
+    }
+    Block* const epoch_index_block = new Block(contents);
+    Iterator* const iter =
+        epoch_index_block->NewIterator(BytewiseComparator());
+    for (uint32_t table = 0; table < h.num_tables(); table++) {
+      epoch_table_key = EpochTableKey(epoch, table);
+      iter->Seek(epoch_table_key);
+      if (!iter->Valid() || iter->key() != epoch_table_key) {
+        status = Status::Corruption("Missing table in epoch index");
+        break;
+      }
+      TableHandle table_handle;
+      input = iter->value();
+      status = table_handle.DecodeFrom(&input);
+      if (status.ok()) {
+        status = GetTableSpaceStats(table_handle, partitioned, space);
+      }
+      if (!status.ok()) {
+        break;
+      }
+    }
+    if (status.ok()) {
+      status = iter->status();
+    }
+    delete iter;
+    delete epoch_index_block;
+    ReleaseIndexBlock(cache_handle);
+    if (!status.ok()) {
+      break;
+    }
+  }
+
+  if (status.ok()) {
+    status = rt_iter->status();
+  }
+  delete rt_iter;
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The root index is the last block written before the footer
+  const BlockHandle& root = footer.epoch_index_handle();
+  const uint64_t root_end = root.offset() + root.size() + kBlockTrailerSize;
+  const uint64_t footer_size = kChunkHeaderSize + Footer::kEncodedLength;
+  *others = DirSpaceStats();
+  others->index_size = root.size() + Footer::kEncodedLength;
+  others->checksum_size = kChunkHeaderSize + kBlockTrailerSize;
+  others->checksum_size += kChunkHeaderSize;
+  if (indx_->Size() >= root_end + footer_size) {
+    others->tail_padding_size = indx_->Size() - root_end - footer_size;
+  }
+  return status;
+}
+
+// Iterate through all keys stored within a given epoch range.
+// Return OK on success, or a non-OK status on errors.
+Status Dir::Scan(const ScanOptions& opts, ScanStats* stats) {
+  mu_->AssertHeld();
+  Status status;
+  assert(rt_ != NULL);
+
+  ListContext ctx;
+  ctx.tmp = opts.tmp;  // User-supplied buffer space
+  ctx.tmp_length = opts.tmp_length;
+  ctx.num_open_lists = 0;  // Number of outstanding list operations
+  ctx.status = &status;
+  ctx.num_table_seeks = 0;  // Total number of tables touched
+  // Total number of data blocks fetched
+  ctx.num_seeks = 0;
+  ctx.n = 0;
+  if (!options_.parallel_reads) {
+    // Pre-create the root iterator for serial reads
+    ctx.rt_iter = NewRtIterator(rt_);
+  } else {
+    ctx.rt_iter = NULL;
+  }
+  ctx.usr_cb = opts.usr_cb;
+  ctx.arg_cb = opts.arg_cb;
+  ctx.key_start = opts.key_start;
+  ctx.key_end = opts.key_end;
+  ctx.value_offset = opts.value_offset;
+  ctx.value_length = opts.value_length;
+  // Fetch blocks ahead in the background only if epochs are listed serially
+  // by the caller's thread so no pool threads will wait on each other
+  ctx.async_readahead =
+      !opts.force_serial_reads && !options_.parallel_reads &&
+      (options_.reader_pool != NULL || options_.allow_env_threads);
+  // Items must outlive their background lists
+  std::vector<BGListItem> items;
+  if (num_eps_ != 0) {
+    uint32_t epoch = opts.epoch_start;
+    uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
+    if (epoch < epoch_end) {
+      items.resize(epoch_end - epoch);
+    }
+    PrefetchDataLogs(epoch, epoch_end);
+    for (size_t i = 0; epoch < epoch_end; epoch++, i++) {
+      ctx.num_open_lists++;
+      BGListItem* const item = &items[i];
+      item->epoch = epoch;
+      item->dir = this;
+      item->ctx = &ctx;
+      if (opts.force_serial_reads || !options_.parallel_reads) {
+        List(item->epoch, item->ctx);
+      } else if (options_.reader_pool != NULL) {
+        options_.reader_pool->Schedule(Dir::BGList, item);
+      } else if (options_.allow_env_threads) {
+        Env::Default()->Schedule(Dir::BGList, item);
+      } else {
+        List(item->epoch, item->ctx);
+      }
+      if (!status.ok()) {
+        break;
+      }
+    }
+  }
+
+  // Wait for all outstanding list operations to conclude
+  while (ctx.num_open_lists > 0) {
+    bg_cv_->Wait();
+  }
+
+  delete ctx.rt_iter;
+  if (status.ok()) {
+    if (stats != NULL) {
+      stats->total_table_seeks += ctx.num_table_seeks;
+      stats->total_seeks += ctx.num_seeks;
+      stats->n += ctx.n;
+    }
+  }
+
+  return status;
+}
+
+// Shared state for background block prefetches issued by table cursors during
+// an ordered scan. Bounds the total number of blocks fetched ahead of the
+// merge.
+struct Dir::Prefetcher {
+  Prefetcher(const DirOptions& options, bool serial)
+      : options(options), cv(&mu), budget(0) {
+    if (!serial && (options.reader_pool != NULL || options.allow_env_threads))
+      budget = options.scan_readahead;
+  }
+
+  // Reserve a prefetch slot. Return false if no slot is available.
+  bool Acquire() {
+    MutexLock ml(&mu);
+    if (budget > 0) {
+      budget--;
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  void Schedule(void (*func)(void*), void* arg) {
+    if (options.reader_pool != NULL) {
+      options.reader_pool->Schedule(func, arg);
+    } else {
+      Env::Default()->Schedule(func, arg);
+    }
+  }
+
+  const DirOptions& options;
+  port::Mutex mu;
+  port::CondVar cv;
+  // State below is protected by mu
+  int budget;  // Number of blocks that may still be fetched ahead
+};
+
+// Iterate through all entries of a single table in key order. Data blocks are
+// read one at a time with the next block prefetched in the background if a
+// prefetch slot is available. Tables with unordered keys are read and sorted
+// in memory when the cursor starts. Until then, a cursor stands at the
+// smallest key of its table and holds no table data.
+class Dir::TableCursor {
+ public:
+  TableCursor(Dir* dir, Prefetcher* pf, uint32_t epoch, uint32_t table,
+              const TableHandle& h)
+      : dir_(dir),
+        pf_(pf),
+        epoch_(epoch),
+        table_(table),
+        file_index_(dir->options_.epoch_log_rotation ? epoch : 0),
+        handle_(h),
+        started_(false),
+        index_block_(NULL),
+        cache_handle_(NULL),
+        index_iter_(NULL),
+        block_iter_(NULL),
+        sorted_(IsKeyUnOrdered(dir->options_.mode)),
+        pos_(0),
+        num_blocks_(0),
+        pf_pending_(false),
+        pf_done_(false) {}
+
+  ~TableCursor() { Close(); }
+
+  // Load the table index and position the cursor at the first entry of the
+  // table, or, for tables with ordered keys, at the first entry of the
+  // first data block that may contain keys no smaller than key_start.
+  Status Start(const Slice& key_start) {
+    assert(!started_);
+    started_ = true;
+    BlockContents index_contents;
+    status_ =
+        dir_->ReadTableIndex(handle_, &index_contents, NULL, &cache_handle_);
+    if (status_.ok()) {
+      index_block_ = new Block(index_contents);
+      index_iter_ = index_block_->NewIterator(BytewiseComparator());
+      if (!sorted_ && !key_start.empty()) {
+        index_iter_->Seek(key_start);
+      } else {
+        index_iter_->SeekToFirst();
+      }
+      if (sorted_) {
+        LoadAndSort();
+      } else {
+        MaybePrefetch();
+        LoadNextBlock();
+      }
+    }
+    return status_;
+  }
+
+  // Release all table data held by the cursor. The cursor is no longer
+  // valid afterwards.
+  void Close() {
+    if (pf_pending_) {
+      MutexLock ml(&pf_->mu);
+      while (!pf_done_) pf_->cv.Wait();
+      pf_pending_ = false;
+      pf_->budget++;
+      if (pf_contents_.heap_allocated) {
+        delete[] pf_contents_.data.data();
+      }
+    }
+    delete block_iter_;
+    block_iter_ = NULL;
+    delete index_iter_;
+    index_iter_ = NULL;
+    delete index_block_;
+    index_block_ = NULL;
+    dir_->ReleaseIndexBlock(cache_handle_);
+    cache_handle_ = NULL;
+    std::string().swap(buffer_);
+    std::vector<uint32_t>().swap(offsets_);
+    pos_ = 0;
+  }
+
+  bool started() const { return started_; }
+
+  bool Valid() const {
+    if (!started_ || !status_.ok()) {
+      return false;
+    } else if (sorted_) {
+      return pos_ < offsets_.size();
+    } else {
+      return block_iter_ != NULL;
+    }
+  }
+
+  // Return the smallest key of the table if the cursor has yet to start.
+  Slice key() const {
+    if (!started_) {
+      return handle_.smallest_key();
+    }
+    assert(Valid());
+    if (sorted_) {
+      Slice input = Entry(pos_);
+      Slice result;
+      GetLengthPrefixedSlice(&input, &result);
+      return result;
+    } else {
+      return block_iter_->key();
+    }
+  }
+
+  Slice value() const {
+    assert(Valid());
+    if (sorted_) {
+      Slice input = Entry(pos_);
+      Slice result;
+      GetLengthPrefixedSlice(&input, &result);  // Skip key
+      GetLengthPrefixedSlice(&input, &result);
+      return result;
+    } else {
+      return block_iter_->value();
+    }
+  }
+
+  void Next() {
+    assert(Valid());
+    if (sorted_) {
+      pos_++;
+    } else {
+      block_iter_->Next();
+      if (!block_iter_->Valid()) {
+        LoadNextBlock();
+      }
+    }
+  }
+
+  const Status& status() const { return status_; }
+  uint32_t epoch() const { return epoch_; }
+  uint32_t table() const { return table_; }
+  // Total number of data blocks fetched
+  size_t num_blocks() const { return num_blocks_; }
+
+ private:
+  Slice Entry(size_t i) const {
+    return Slice(buffer_.data() + offsets_[i], buffer_.size() - offsets_[i]);
+  }
+
+  struct EntryLessThan {
+    explicit EntryLessThan(const TableCursor* c) : c(c) {}
+    bool operator()(uint32_t a, uint32_t b) const {
+      Slice x(c->buffer_.data() + a, c->buffer_.size() - a);
+      Slice y(c->buffer_.data() + b, c->buffer_.size() - b);
+      Slice ka;
+      Slice kb;
+      GetLengthPrefixedSlice(&x, &ka);
+      GetLengthPrefixedSlice(&y, &kb);
+      return ka < kb;
+    }
+    const TableCursor* c;
+  };
+
+  // Read all table entries and sort them by key. Entries sharing a key
+  // stay in their insertion order.
+  void LoadAndSort() {
+    for (; index_iter_->Valid() && status_.ok(); index_iter_->Next()) {
+      BlockHandle h;
+      Slice input = index_iter_->value();
+      status_ = h.DecodeFrom(&input);
+      BlockContents contents;
+      if (status_.ok()) {
+        status_ = ReadBlock(dir_->data_, dir_->options_, h, &contents, false,
+                            file_index_);
+      }
+      if (status_.ok()) {
+        num_blocks_++;
+        Iterator* const iter = OpenDirBlock(dir_->options_, contents);
+        for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+          offsets_.push_back(static_cast<uint32_t>(buffer_.size()));
+          PutLengthPrefixedSlice(&buffer_, iter->key());
+          PutLengthPrefixedSlice(&buffer_, iter->value());
+        }
+        status_ = iter->status();
+        delete iter;
+      }
+    }
+    if (status_.ok()) {
+      status_ = index_iter_->status();
+    }
+    std::stable_sort(offsets_.begin(), offsets_.end(), EntryLessThan(this));
+  }
+
+  // Move to the next non-empty data block. Set block_iter_ to NULL if there
+  // are no more blocks.
+  void LoadNextBlock() {
+    delete block_iter_;
+    block_iter_ = NULL;
+    while (status_.ok() && block_iter_ == NULL) {
+      BlockContents contents;
+      if (pf_pending_) {
+        MutexLock ml(&pf_->mu);
+        while (!pf_done_) pf_->cv.Wait();
+        pf_pending_ = false;
+        pf_->budget++;
+        status_ = pf_status_;
+        contents = pf_contents_;
+      } else if (index_iter_->Valid()) {
+        BlockHandle h;
+        Slice input = index_iter_->value();
+        status_ = h.DecodeFrom(&input);
+        index_iter_->Next();
+        if (status_.ok()) {
+          status_ = ReadBlock(dir_->data_, dir_->options_, h, &contents, false,
+                              file_index_);
+        }
+      } else {
+        status_ = index_iter_->status();
+        return;  // No more blocks
+      }
+      if (status_.ok()) {
+        num_blocks_++;
+        block_iter_ = OpenDirBlock(dir_->options_, contents);
+        block_iter_->SeekToFirst();
+        if (!block_iter_->Valid()) {
+          status_ = block_iter_->status();
+          delete block_iter_;
+          block_iter_ = NULL;
+        }
+      }
+    }
+    if (status_.ok()) {
+      MaybePrefetch();
+    }
+  }
+
+  // Fetch the next data block in the background if possible.
+  void MaybePrefetch() {
+    if (pf_pending_ || !index_iter_->Valid() || !pf_->Acquire()) {
+      return;
+    }
+    Slice input = index_iter_->value();
+    if (!pf_handle_.DecodeFrom(&input).ok()) {
+      MutexLock ml(&pf_->mu);  // Let the error surface through normal reads
+      pf_->budget++;
+      return;
+    }
+    index_iter_->Next();
+    pf_pending_ = true;
+    pf_done_ = false;
+    pf_->Schedule(BGPrefetch, this);
+  }
+
+  static void BGPrefetch(void* arg) {
+    TableCursor* const c = reinterpret_cast<TableCursor*>(arg);
+    BlockContents contents;
+    Status s = ReadBlock(c->dir_->data_, c->dir_->options_, c->pf_handle_,
+                         &contents, false, c->file_index_);
+    MutexLock ml(&c->pf_->mu);
+    c->pf_status_ = s;
+    c->pf_contents_ = contents;
+    c->pf_done_ = true;
+    c->pf_->cv.SignalAll();
+  }
+
+  // No copying allowed
+  void operator=(const TableCursor&);
+  TableCursor(const TableCursor&);
+
+  Dir* const dir_;
+  Prefetcher* const pf_;
+  const uint32_t epoch_;
+  const uint32_t table_;
+  const uint32_t file_index_;
+  const TableHandle handle_;
+  bool started_;
+  Block* index_block_;
+  Cache::Handle* cache_handle_;  // Pins index_block_ in the index cache
+  Iterator* index_iter_;  // Positioned at the next block to fetch
+  Iterator* block_iter_;  // NULL if there are no more blocks
+  // Used when keys are stored out-of-order
+  const bool sorted_;
+  std::string buffer_;
+  std::vector<uint32_t> offsets_;
+  size_t pos_;
+  size_t num_blocks_;
+  Status status_;
+  // Background prefetching state. pf_done_, pf_status_, and
+  // pf_contents_ are protected by pf_->mu.
+  bool pf_pending_;
+  BlockHandle pf_handle_;
+  bool pf_done_;
+  Status pf_status_;
+  BlockContents pf_contents_;
+};
+
+// Order cursors as a min-heap by current key, then epoch, then table.
+struct Dir::CursorGreater {
+  bool operator()(const TableCursor* a, const TableCursor* b) const {
+    const int r = a->key().compare(b->key());
+    if (r != 0) {
+      return r > 0;
+    } else if (a->epoch() != b->epoch()) {
+      return a->epoch() > b->epoch();
+    } else {
+      return a->table() > b->table();
+    }
+  }
+};
+
+Status Dir::AddTableCursors(const ScanOptions& opts, Prefetcher* prefetcher,
+                            std::vector<TableCursor*>* cursors) {
+  Status status;
+  assert(rt_ != NULL);
+  Iterator* const rt_iter = NewRtIterator(rt_);
+  uint32_t epoch = opts.epoch_start;
+  const uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
+  PrefetchDataLogs(epoch, epoch_end);
+  for (; epoch < epoch_end && status.ok(); epoch++) {
+    std::string epoch_key = EpochKey(epoch);
+    rt_iter->Seek(epoch_key);
+    if (!rt_iter->Valid()) {
+      break;  // EOF
+    } else if (rt_iter->key() != epoch_key) {
+      continue;  // No such epoch
+    }
+    BlockHandle h;
+    Slice input = rt_iter->value();
+    status = h.DecodeFrom(&input);
+    BlockContents meta_index_contents;
+    Cache::Handle* cache_handle = NULL;
+    if (status.ok()) {
+      status = ReadIndexBlock(h, &meta_index_contents, &cache_handle);
+    }
+    if (!status.ok()) {
+      break;
+    }
+    Block* epoch_index_block = new Block(meta_index_contents);
+    Iterator* const iter = epoch_index_block->NewIterator(BytewiseComparator());
+    iter->SeekToFirst();
+    for (uint32_t table = 0; status.ok(); table++) {
+      std::string epoch_table_key = EpochTableKey(epoch, table);
+      if (!iter->Valid() || iter->key() != epoch_table_key) {
+        iter->Seek(epoch_table_key);
+        if (!iter->Valid()) {
+          break;  // EOF
+        } else if (iter->key() != epoch_table_key) {
+          break;  // No such table
+        }
+      }
+      TableHandle table_handle;
+      input = iter->value();
+      status = table_handle.DecodeFrom(&input);
+      iter->Next();
+      if (status.ok() &&
+          TableMayOverlap(table_handle, opts.key_start, opts.key_end)) {
+        cursors->push_back(
+            new TableCursor(this, prefetcher, epoch, table, table_handle));
+      }
+    }
+    if (status.ok()) {
+      status = iter->status();
+    }
+    delete iter;
+    delete epoch_index_block;
+    ReleaseIndexBlock(cache_handle);
+  }
+
+  if (status.ok()) {
+    status = rt_iter->status();
+  }
+
+  delete rt_iter;
+  return status;
+}
+
+// Iterate through all keys stored within a given epoch range in key order.
+// Return OK on success, or a non-OK status on errors.
+Status Dir::OrderedScan(Dir** dirs, size_t n, const ScanOptions& opts,
+                        ScanStats* stats) {
+  Status status;
+  if (n == 0) {
+    return status;
+  }
+  Prefetcher prefetcher(dirs[0]->options_, opts.force_serial_reads);
+  std::vector<TableCursor*> cursors;
+  for (size_t i = 0; i < n && status.ok(); i++) {
+    status = dirs[i]->AddTableCursors(opts, &prefetcher, &cursors);
+  }
+
+  // Cursors enter the heap unstarted, standing at the smallest keys of their
+  // tables, and are started only once they reach the top. Tables are thus
+  // loaded, and sorted if necessary, no earlier than the merge needs their
+  // keys, and released as soon as they run out of keys, so only tables
+  // overlapping the current key stay resident.
+  std::vector<TableCursor*> heap;
+  if (status.ok()) {
+    heap = cursors;
+  }
+
+  size_t num_entries = 0;
+  size_t num_tables = 0;
+  Saver const saver = reinterpret_cast<Saver>(opts.usr_cb);
+  CursorGreater greater;
+  std::make_heap(heap.begin(), heap.end(), greater);
+  while (status.ok() && !heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), greater);
+    TableCursor* const c = heap.back();
+    if (!opts.key_end.empty() && c->key() >= opts.key_end) {
+      break;  // All remaining keys are out of range
+    } else if (!c->started()) {
+      num_tables++;
+      status = c->Start(opts.key_start);
+      if (c->Valid()) {
+        std::push_heap(heap.begin(), heap.end(), greater);
+      } else {
+        c->Close();
+        heap.pop_back();
+      }
+      continue;
+    } else if (opts.key_start.empty() || c->key() >= opts.key_start) {
+      if (opts.epoch != NULL) {
+        *opts.epoch = c->epoch();
+      }
+      if (saver(opts.arg_cb, c->key(),
+                ProjectValue(c->value(), opts.value_offset,
+                             opts.value_length)) == -1) {
+        break;  // User does not want to continue
+      }
+      num_entries++;
+    }
+    c->Next();
+    if (c->Valid()) {
+      std::push_heap(heap.begin(), heap.end(), greater);
+    } else {
+      status = c->status();
+      c->Close();
+      heap.pop_back();
+    }
+  }
+
+  size_t num_seeks = 0;
+  for (size_t i = 0; i < cursors.size(); i++) {
+    num_seeks += cursors[i]->num_blocks();
+    delete cursors[i];
+  }
+  if (status.ok()) {
+    if (stats != NULL) {
+      stats->total_table_seeks += num_tables;
+      stats->total_seeks += num_seeks;
+      stats->n += num_entries;
+    }
+  }
+
+  return status;
+}
+
+// Obtain value to a specific key within a given epoch range.
+// Return OK on success, or a non-OK status on errors.
+Status Dir::Read(const ReadOptions& opts, const Slice& key, std::string* dst,
+                 ReadStats* stats) {
+  mu_->AssertHeld();
+  Status status;
+  assert(rt_ != NULL);
+  std::vector<std::string> results;
+  const uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
+
+  GetContext ctx;
+  ctx.async = NULL;
+  // Values passed to a user saver must be delivered in epoch order
+  ctx.parallel = options_.parallel_reads && opts.saver == NULL;
+  ctx.tmp = opts.tmp;  // User-supplied buffer space
+  ctx.tmp_length = opts.tmp_length;
+  ctx.num_open_reads = 0;  // Number of outstanding epoch read operations
+  ctx.status = &status;
+  if (ctx.parallel && opts.epoch_start < epoch_end) {
+    results.resize(epoch_end - opts.epoch_start);
+  }
+  ctx.results = &results;
+  ctx.epoch_start = opts.epoch_start;
+  ctx.saver = opts.saver;
+  ctx.saver_arg = opts.saver_arg;
+  ctx.stopped = false;
+  ctx.latest_first = opts.latest_first;
+  ctx.deadline = opts.deadline;
+  ctx.epoch_mask = EpochMask(key);
+  ctx.found = false;
+  ctx.found_epoch = 0;
+  ctx.num_table_seeks = 0;  // Total number of tables touched
+  // Total number of data blocks fetched
+  ctx.num_seeks = 0;
+  if (!ctx.parallel) {
+    // Pre-create the root iterator for serial reads
+    ctx.rt_iter = NewRtIterator(rt_);
+  } else {
+    ctx.rt_iter = NULL;
+  }
+  ctx.dst = dst;
+  // Must outlive its background tasks
+  EpochFetcher fetcher;
+  if (num_eps_ != 0 && opts.epoch_start < epoch_end && ctx.epoch_mask != 0) {
+    const uint32_t n = epoch_end - opts.epoch_start;
+    PrefetchDataLogs(opts.epoch_start, epoch_end);
+    if (ctx.parallel && !opts.force_serial_reads &&
+        (options_.reader_pool != NULL || options_.allow_env_threads)) {
+      StartFetcher(&fetcher, key, epoch_end, &ctx);
+    } else {
+      for (uint32_t i = 0; i < n; i++) {
+        const uint32_t epoch =
+            opts.latest_first ? epoch_end - 1 - i : opts.epoch_start + i;
+        ctx.num_open_reads++;
+        Get(key, epoch, &ctx);
+        if (!status.ok() || ctx.stopped) {
+          break;
+        } else if (ctx.latest_first && ctx.found) {
+          break;  // Remaining epochs are older
+        }
+      }
+    }
+  }
+
+  // Wait for all outstanding read operations to conclude
+  while (ctx.num_open_reads > 0) {
+    bg_cv_->Wait();
+  }
+
+  delete ctx.rt_iter;
+  // Merge read results
+  if (status.ok()) {
+    if (stats != NULL) {
+      stats->total_table_seeks += ctx.num_table_seeks;
+      stats->total_seeks += ctx.num_seeks;
+      AddCosts(&stats->costs, ctx.costs);
+    }
+    if (ctx.parallel) {
+      Merge(&ctx);
+    }
+  }
+
+  return status;
+}
+
+struct Dir::AsyncRead {
+  GetContext ctx;
+  Status status;
+  std::vector<std::string> results;
+  std::string dst;
+  std::string key;
+  EpochFetcher fetcher;
+  Dir* dir;
+  ReadStats* stats;
+  ReadCallback cb;
+  void* arg;
+};
+
+void Dir::ReadAsync(const ReadOptions& opts, const Slice& key,
+                    ReadStats* stats, ReadCallback cb, void* arg) {
+  mu_->AssertHeld();
+  assert(rt_ != NULL);
+  assert(options_.reader_pool != NULL || options_.allow_env_threads);
+  assert(opts.saver == NULL);
+  AsyncRead* const a = new AsyncRead;
+  a->key = key.ToString();
+  a->dir = this;
+  a->stats = stats;
+  a->cb = cb;
+  a->arg = arg;
+  GetContext* const ctx = &a->ctx;
+  ctx->async = a;
+  ctx->parallel = true;
+  ctx->rt_iter = NULL;
+  ctx->dst = &a->dst;
+  // Held by us until the fetcher is started so that the read cannot finish
+  // before all of its tasks are scheduled
+  ctx->num_open_reads = 1;
+  ctx->results = &a->results;
+  ctx->epoch_start = opts.epoch_start;
+  ctx->saver = NULL;
+  ctx->saver_arg = NULL;
+  ctx->stopped = false;
+  ctx->latest_first = opts.latest_first;
+  ctx->deadline = opts.deadline;
+  ctx->epoch_mask = EpochMask(key);
+  ctx->found = false;
+  ctx->found_epoch = 0;
+  ctx->status = &a->status;
+  ctx->tmp = NULL;  // Epochs are fetched concurrently
+  ctx->tmp_length = 0;
+  ctx->num_table_seeks = 0;
+  ctx->num_seeks = 0;
+  Ref();
+  if (num_eps_ != 0 && ctx->epoch_mask != 0) {
+    uint32_t epoch = opts.epoch_start;
+    uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
+    if (epoch < epoch_end) {
+      a->results.resize(epoch_end - epoch);
+      PrefetchDataLogs(epoch, epoch_end);
+      StartFetcher(&a->fetcher, a->key, epoch_end, ctx);
+    }
+  }
+
+  // The read is never finished by the caller since the callback may delete
+  // the reader, along with mu_, while the caller still holds mu_
+  ctx->num_open_reads--;
+  if (ctx->num_open_reads == 0) {
+    if (options_.reader_pool != NULL) {
+      options_.reader_pool->Schedule(Dir::BGFinishAsyncRead, a);
+    } else {
+      Env::Default()->Schedule(Dir::BGFinishAsyncRead, a);
+    }
+  }
+}
+
+void Dir::BGFinishAsyncRead(void* arg) {
+  AsyncRead* const a = reinterpret_cast<AsyncRead*>(arg);
+  a->dir->mu_->Lock();
+  a->dir->FinishAsyncRead(a);  // Unlocks mu_
+}
+
+// Report the results of an asynchronous read. Unlock mu_ before calling the
+// user callback.
+// REQUIRES: mu_ has been locked.
+void Dir::FinishAsyncRead(AsyncRead* a) {
+  mu_->AssertHeld();
+  assert(a->ctx.num_open_reads == 0);
+  // Merge read results
+  if (a->status.ok()) {
+    if (a->stats != NULL) {
+      a->stats->total_table_seeks += a->ctx.num_table_seeks;
+      a->stats->total_seeks += a->ctx.num_seeks;
+      AddCosts(&a->stats->costs, a->ctx.costs);
+    }
+    Merge(&a->ctx);
+  }
+  const Status status = a->status;
+  const ReadCallback cb = a->cb;
+  void* const arg = a->arg;
+  std::string dst;
+  dst.swap(a->dst);
+  delete a;
+  port::Mutex* const mu = mu_;
+  Unref();  // May delete this
+  // The callback is called last so that the reader may be deleted by it or
+  // right after it
+  mu->Unlock();
+  cb(arg, status, dst);
+}
+
+// Search a data block for a range of candidate keys. Values found are
+// appended to the corresponding destinations. The iterator is deleted before
+// return.
+Status Dir::MultiFetch(MultiGetContext* ctx, const std::vector<size_t>& cands,
+                       const MultiGetBlock& b, Iterator* iter) {
+  ctx->stats->seeks++;
+  for (size_t k = b.begin; k < b.end; k++) {
+    const size_t i = cands[k];
+    const Slice& key = ctx->keys[i];
+    iter->Seek(key);  // Binary search
+    if (iter->Valid() && iter->key() == key) {
+      Slice value = iter->value();
+      ctx->dsts[i]->append(value.data(), value.size());
+      (*ctx->found)[i] = 1;
+      ctx->num_found++;
+    }
+  }
+  Status status = iter->status();
+  delete iter;
+  return status;
+}
+
+// Fetch a series of data blocks and search each of them for its candidate
+// keys. Blocks are given in offset order. Blocks already in the block cache are
+// served from the cache. The rest are fetched from the data log, with fetches
+// of blocks that are close to each other coalesced into a single read of no
+// more than options_.read_size bytes.
+Status Dir::MultiFetch(MultiGetContext* ctx, const std::vector<size_t>& cands,
+                       std::vector<MultiGetBlock>* blocks) {
+  Status status;
+  Cache* const cache = options_.block_cache;
+  char key[kBlockCacheKeyLength];
+  for (size_t i = 0; i < blocks->size(); i++) {
+    MultiGetBlock* const b = &(*blocks)[i];
+    b->cache_handle = NULL;
+    if (cache != NULL) {
+      b->cache_handle = cache->Lookup(
+          BlockCacheKey(cache_id_, ctx->file_index, b->handle.offset(), key));
+      if (b->cache_handle != NULL) {
+        ctx->stats->cache_hits++;
+      } else {
+        ctx->stats->cache_misses++;
+      }
+    }
+  }
+
+  // Max gap between two blocks to be fetched by a single read
+  const uint64_t max_gap = options_.block_size;
+  size_t i = 0;
+  while (i < blocks->size()) {
+    const MultiGetBlock& b = (*blocks)[i];
+    if (b.cache_handle != NULL) {
+      Iterator* const iter =
+          OpenCachedDataBlock(options_, cache, b.cache_handle);
+      (*blocks)[i++].cache_handle = NULL;  // Released by the iterator
+      if (status.ok()) {
+        status = MultiFetch(ctx, cands, b, iter);
+      } else {
+        delete iter;
+      }
+      continue;
+    }
+
+    const uint64_t start = b.handle.offset();
+    uint64_t limit = start + b.handle.size() + kBlockTrailerSize;
+    size_t j = i + 1;
+    for (; j < blocks->size(); j++) {
+      const MultiGetBlock& next = (*blocks)[j];
+      if (next.cache_handle != NULL) break;
+      const uint64_t off = next.handle.offset();
+      const uint64_t end = off + next.handle.size() + kBlockTrailerSize;
+      if (off < limit || off - limit > max_gap) break;
+      if (end - start > options_.read_size) break;
+      limit = end;
+    }
+
+    const size_t m = static_cast<size_t>(limit - start);
+    char* buf = ctx->tmp;
+    if (buf == NULL || ctx->tmp_length < m) {
+      buf = new char[m];
+    }
+    Slice contents;
+    if (status.ok()) {
+      status = data_->Read(start, m, &contents, buf, ctx->file_index);
+      if (status.ok() && contents.size() != m) {
+        status = Status::Corruption("Truncated block read");
+      }
+    }
+
+    for (; i < j; i++) {
+      const MultiGetBlock& r = (*blocks)[i];
+      if (!status.ok()) continue;
+      const size_t off = static_cast<size_t>(r.handle.offset() - start);
+      const size_t n = static_cast<size_t>(r.handle.size());
+      BlockContents block;
+      status = ParseBlock(options_, Slice(contents.data() + off,
+                                          n + kBlockTrailerSize), &block);
+      if (!status.ok()) continue;
+      Iterator* iter;
+      if (cache == NULL || (!block.heap_allocated && contents.data() != buf)) {
+        // Data is not to be cached or is already in memory somewhere else
+        iter = OpenDirBlock(options_, block);
+      } else {
+        if (!block.heap_allocated) {  // Copy it out of the read buffer
+          char* const copy = new char[n];
+          memcpy(copy, block.data.data(), n);
+          block.data = Slice(copy, n);
+          block.heap_allocated = true;
+        }
+        iter = InsertAndOpenDataBlock(
+            BlockCacheKey(cache_id_, ctx->file_index, r.handle.offset(), key),
+            block);
+      }
+      status = MultiFetch(ctx, cands, r, iter);
+    }
+
+    if (buf != ctx->tmp) {
+      delete[] buf;
+    }
+  }
+
+  return status;
+}
+
+// Obtain the values to all target keys from a given table. The table key range
+// and the paired filter are checked once for every key before the index block
+// is consulted. For directories storing unique and ordered keys, each data
+// block is searched once for all keys it may contain. Otherwise, keys are
+// fetched one at a time.
+Status Dir::MultiFetch(MultiGetContext* ctx, const TableHandle& h) {
+  Status status;
+  const bool unique = IsKeyUnique(options_.mode);
+  if (!IsKeyUniqueAndOrdered(options_.mode)) {
+    FetchOptions opts;
+    opts.file_index = ctx->file_index;
+    opts.stats = ctx->stats;
+    opts.tmp_length = ctx->tmp_length;
+    opts.tmp = ctx->tmp;
+    opts.saver = SaveValue;
+    opts.deadline = 0;
+    for (size_t i = 0; i < ctx->n && status.ok(); i++) {
+      if (unique && (*ctx->found)[i]) continue;
+      SaverState arg;
+      arg.dst = ctx->dsts[i];
+      arg.found = false;
+      opts.arg = &arg;
+      status = Fetch(opts, ctx->keys[i], h);
+      if (status.ok() && arg.found) {
+        (*ctx->found)[i] = 1;
+        ctx->num_found++;
+      }
+    }
+    return status;
+  }
+
+  BlockHandle filter_handle;
+  filter_handle.set_offset(h.filter_offset());
+  filter_handle.set_size(h.filter_size());
+  const bool check_filter =
+      !options_.ignore_filters && filter_handle.size() != 0;
+  std::vector<size_t> cands;  // Keys that may be stored in the table
+  for (size_t i = 0; i < ctx->n; i++) {
+    const Slice& key = ctx->keys[i];
+    if ((*ctx->found)[i]) {
+      continue;
+    } else if (key < h.smallest_key()) {
+      continue;
+    } else if (key > h.largest_key()) {
+      break;  // Keys are sorted
+    } else if (check_filter && !FilterMayMatch(key, filter_handle)) {
+      continue;
+    }
+    cands.push_back(i);
+  }
+  if (cands.empty()) {
+    return status;
+  }
+
+  // Load the index block
+  BlockContents index_contents;
+  Cache::Handle* cache_handle = NULL;
+  status = ReadTableIndex(h, &index_contents, NULL, &cache_handle);
+  if (!status.ok()) {
+    return status;
+  } else {
+    ctx->stats->table_seeks++;
+  }
+
+  // Map each candidate key to the only data block that may contain it
+  std::vector<MultiGetBlock> blocks;
+  Block* index_block = new Block(index_contents);
+  Iterator* const iter = index_block->NewIterator(BytewiseComparator());
+  for (size_t k = 0; k < cands.size(); k++) {
+    iter->Seek(ctx->keys[cands[k]]);
+    if (!iter->Valid()) {
+      break;  // All remaining keys are larger than the table
+    }
+    MultiGetBlock b;
+    Slice input = iter->value();
+    status = b.handle.DecodeFrom(&input);
+    if (!status.ok()) {
+      break;
+    } else if (!blocks.empty() &&
+               blocks.back().handle.offset() == b.handle.offset()) {
+      blocks.back().end = k + 1;
     } else {
-      assert(false);
-      return e;
+      b.cache_handle = NULL;
+      b.begin = k;
+      b.end = k + 1;
+      blocks.push_back(b);
     }
   }
-};
+  if (status.ok()) {
+    status = iter->status();
+  }
 
-void Dir::Merge(GetContext* ctx) {
-  std::vector<uint32_t>::iterator begin;
-  begin = ctx->offsets->begin();
-  std::vector<uint32_t>::iterator end;
-  end = ctx->offsets->end();
-  // A key might appear multiple times within each
-  // epoch so the sort must be stable.
-  std::stable_sort(begin, end, STLLessThan(*ctx->buffer));
-
-  uint32_t ignored;
-  Slice value;
-  std::vector<uint32_t>::const_iterator it;
-  for (it = ctx->offsets->begin(); it != ctx->offsets->end(); ++it) {
-    Slice input = *ctx->buffer;
-    input.remove_prefix(*it);
-    bool r1 = GetVarint32(&input, &ignored);
-    bool r2 = GetLengthPrefixedSlice(&input, &value);
-    if (r1 && r2) {
-      ctx->dst->append(value.data(), value.size());
-    } else {
-      assert(false);
-    }
+  delete iter;
+  delete index_block;
+  ReleaseIndexBlock(cache_handle);
+  if (status.ok()) {
+    status = MultiFetch(ctx, cands, &blocks);
   }
+
+  return status;
 }
 
-// Count the total num of keys within a given epoch range.
-// Return OK on success, or a non-OK status on errors.
-Status Dir::Count(const CountOptions& opts, size_t* result) {
-  mu_->AssertHeld();
+// Obtain the values to all target keys within a given directory epoch.
+Status Dir::DoMultiGet(const BlockHandle& h, uint32_t epoch,
+                       MultiGetContext* ctx) {
   Status status;
-  assert(rt_ != NULL);
-  std::string epoch_key;
-  *result = 0;
-
-  Iterator* rt_iter = NewRtIterator(rt_);
-  if (num_eps_ != 0) {
-    uint32_t epoch = opts.epoch_start;
-    uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
-    for (; epoch < epoch_end; epoch++) {
-      epoch_key = EpochKey(epoch);
-      // Try reusing current iterator position if possible
-      if (!rt_iter->Valid() || rt_iter->key() != epoch_key) {
-        rt_iter->Seek(epoch_key);
-        if (!rt_iter->Valid()) {
-          break;  // EOF
-        } else if (rt_iter->key() != epoch_key) {
-          break;  // No such epoch
-        }
+  // Load the meta index for the epoch
+  BlockContents meta_index_contents;
+  Cache::Handle* cache_handle = NULL;
+  status = ReadIndexBlock(h, &meta_index_contents, &cache_handle);
+  if (!status.ok()) {
+    return status;
+  }
+  Block* epoch_index_block = new Block(meta_index_contents);
+  Iterator* const iter = epoch_index_block->NewIterator(BytewiseComparator());
+  iter->SeekToFirst();
+  std::string epoch_table_key;
+  uint32_t table = 0;
+  for (; status.ok(); table++) {
+    epoch_table_key = EpochTableKey(epoch, table);
+    // Try reusing current iterator position if possible
+    if (!iter->Valid() || iter->key() != epoch_table_key) {
+      iter->Seek(epoch_table_key);
+      if (!iter->Valid()) {
+        break;  // EOF
+      } else if (iter->key() != epoch_table_key) {
+        break;  // No such table
       }
-      EpochHandle h;  // Handle to the epoch
-      Slice input = rt_iter->value();
-      status = h.DecodeFrom(&input);
-      rt_iter->Next();
-      if (status.ok()) {
-        *result += h.num_ents();
-      } else {
+    }
+    TableHandle table_handle;
+    Slice input = iter->value();
+    status = table_handle.DecodeFrom(&input);
+    iter->Next();
+    if (status.ok()) {
+      status = MultiFetch(ctx, table_handle);
+      // If keys are unique and all of them have been found, we are done
+      if (IsKeyUnique(options_.mode) && ctx->num_found == ctx->n) {
         break;
       }
     }
   }
 
   if (status.ok()) {
-    status = rt_iter->status();
+    status = iter->status();
   }
 
-  delete rt_iter;
+  delete iter;
+  delete epoch_index_block;
+  ReleaseIndexBlock(cache_handle);
   return status;
 }
 
-// Iterate through all keys stored within a given epoch range.
+// Obtain values to a set of keys within a given epoch range.
 // Return OK on success, or a non-OK status on errors.
-Status Dir::Scan(const ScanOptions& opts, ScanStats* stats) {
+Status Dir::MultiRead(const ReadOptions& opts, const Slice* keys,
+                      std::string** dsts, size_t n, ReadStats* stats) {
   mu_->AssertHeld();
   Status status;
   assert(rt_ != NULL);
-
-  ListContext ctx;
+  Iterator* const rt_iter = NewRtIterator(rt_);
+  mu_->Unlock();
+  GetStats get_stats;
+  std::vector<char> found(n, 0);
+  MultiGetContext ctx;
+  ctx.keys = keys;
+  ctx.dsts = dsts;
+  ctx.n = n;
+  ctx.found = &found;
   ctx.tmp = opts.tmp;  // User-supplied buffer space
   ctx.tmp_length = opts.tmp_length;
-  ctx.num_open_lists = 0;  // Number of outstanding list operations
-  ctx.status = &status;
-  ctx.num_table_seeks = 0;  // Total number of tables touched
-  // Total number of data blocks fetched
-  ctx.num_seeks = 0;
-  ctx.n = 0;
-  if (!options_.parallel_reads) {
-    // Pre-create the root iterator for serial reads
-    ctx.rt_iter = NewRtIterator(rt_);
-  } else {
-    ctx.rt_iter = NULL;
-  }
-  ctx.usr_cb = opts.usr_cb;
-  ctx.arg_cb = opts.arg_cb;
-  if (num_eps_ != 0) {
-    uint32_t epoch = opts.epoch_start;
-    uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
-    for (; epoch < epoch_end; epoch++) {
-      ctx.num_open_lists++;
-      BGListItem item;
-      item.epoch = epoch;
-      item.dir = this;
-      item.ctx = &ctx;
-      if (opts.force_serial_reads || !options_.parallel_reads) {
-        List(item.epoch, item.ctx);
-      } else if (options_.reader_pool != NULL) {
-        options_.reader_pool->Schedule(Dir::BGList, &item);
-      } else if (options_.allow_env_threads) {
-        Env::Default()->Schedule(Dir::BGList, &item);
-      } else {
-        List(item.epoch, item.ctx);
-      }
-      if (!status.ok()) {
-        break;
-      }
+  ctx.stats = &get_stats;
+  uint32_t epoch = opts.epoch_start;
+  const uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
+  PrefetchDataLogs(epoch, epoch_end);
+  for (; epoch < epoch_end && n != 0; epoch++) {
+    std::string epoch_key = EpochKey(epoch);
+    rt_iter->Seek(epoch_key);
+    if (!rt_iter->Valid()) {
+      break;  // EOF
+    } else if (rt_iter->key() != epoch_key) {
+      continue;  // No such epoch
+    }
+    BlockHandle h;
+    Slice input = rt_iter->value();
+    status = h.DecodeFrom(&input);
+    if (!status.ok()) {
+      break;
+    }
+    std::fill(found.begin(), found.end(), 0);
+    ctx.num_found = 0;
+    ctx.file_index = options_.epoch_log_rotation ? epoch : 0;
+    status = DoMultiGet(h, epoch, &ctx);
+    if (!status.ok()) {
+      break;
     }
   }
 
-  // Wait for all outstanding list operations to conclude
-  while (ctx.num_open_lists > 0) {
-    bg_cv_->Wait();
+  if (status.ok()) {
+    status = rt_iter->status();
   }
 
-  delete ctx.rt_iter;
+  delete rt_iter;
+  mu_->Lock();
+  cache_hits_ += get_stats.cache_hits;
+  cache_misses_ += get_stats.cache_misses;
   if (status.ok()) {
     if (stats != NULL) {
-      stats->total_table_seeks += ctx.num_table_seeks;
-      stats->total_seeks += ctx.num_seeks;
-      stats->n += ctx.n;
+      stats->total_table_seeks += get_stats.table_seeks;
+      stats->total_seeks += get_stats.seeks;
     }
   }
 
   return status;
 }
 
-// Obtain value to a specific key within a given epoch range.
-// Return OK on success, or a non-OK status on errors.
-Status Dir::Read(const ReadOptions& opts, const Slice& key, std::string* dst,
-                 ReadStats* stats) {
-  mu_->AssertHeld();
+// Mark "epoch" for every target key that passes the key range and the filter
+// of at least one table within the epoch.
+Status Dir::DoMembership(const BlockHandle& h, uint32_t epoch,
+                         const Slice* keys, std::vector<bool>** dsts,
+                         size_t n) {
   Status status;
-  assert(rt_ != NULL);
-  std::vector<uint32_t> offsets;
-  std::string buffer;
-
-  GetContext ctx;
-  ctx.tmp = opts.tmp;  // User-supplied buffer space
-  ctx.tmp_length = opts.tmp_length;
-  ctx.num_open_reads = 0;  // Number of outstanding epoch read operations
-  ctx.status = &status;
-  ctx.offsets = &offsets;
-  ctx.buffer = &buffer;
-  ctx.num_table_seeks = 0;  // Total number of tables touched
-  // Total number of data blocks fetched
-  ctx.num_seeks = 0;
-  if (!options_.parallel_reads) {
-    // Pre-create the root iterator for serial reads
-    ctx.rt_iter = NewRtIterator(rt_);
-  } else {
-    ctx.rt_iter = NULL;
+  // Load the meta index for the epoch
+  BlockContents meta_index_contents;
+  Cache::Handle* cache_handle = NULL;
+  status = ReadIndexBlock(h, &meta_index_contents, &cache_handle);
+  if (!status.ok()) {
+    return status;
   }
-  ctx.dst = dst;
-  if (num_eps_ != 0) {
-    uint32_t epoch = opts.epoch_start;
-    uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
-    for (; epoch < epoch_end; epoch++) {
-      ctx.num_open_reads++;
-      BGGetItem item;
-      item.epoch = epoch;
-      item.dir = this;
-      item.ctx = &ctx;
-      item.key = key;
-      if (opts.force_serial_reads || !options_.parallel_reads) {
-        Get(item.key, item.epoch, item.ctx);
-      } else if (options_.reader_pool != NULL) {
-        options_.reader_pool->Schedule(Dir::BGGet, &item);
-      } else if (options_.allow_env_threads) {
-        Env::Default()->Schedule(Dir::BGGet, &item);
-      } else {
-        Get(item.key, item.epoch, item.ctx);
-      }
-      if (!status.ok()) {
-        break;
+  Block* epoch_index_block = new Block(meta_index_contents);
+  Iterator* const iter = epoch_index_block->NewIterator(BytewiseComparator());
+  iter->SeekToFirst();
+  size_t num_found = 0;
+  for (; iter->Valid() && num_found != n; iter->Next()) {
+    TableHandle table_handle;
+    Slice input = iter->value();
+    status = table_handle.DecodeFrom(&input);
+    if (!status.ok()) {
+      break;
+    }
+    BlockHandle filter_handle;
+    filter_handle.set_offset(table_handle.filter_offset());
+    filter_handle.set_size(table_handle.filter_size());
+    const bool check_filter =
+        !options_.ignore_filters && filter_handle.size() != 0;
+    for (size_t i = 0; i < n; i++) {
+      const Slice& key = keys[i];
+      if ((*dsts[i])[epoch]) {
+        continue;
+      } else if (key < table_handle.smallest_key()) {
+        continue;
+      } else if (key > table_handle.largest_key()) {
+        break;  // Keys are sorted
+      } else if (check_filter && !FilterMayMatch(key, filter_handle)) {
+        continue;
       }
+      (*dsts[i])[epoch] = true;
+      num_found++;
     }
   }
 
-  // Wait for all outstanding read operations to conclude
-  while (ctx.num_open_reads > 0) {
-    bg_cv_->Wait();
+  if (status.ok()) {
+    status = iter->status();
   }
 
-  delete ctx.rt_iter;
-  // Merge sort read results
-  if (status.ok()) {
-    if (stats != NULL) {
-      stats->total_table_seeks += ctx.num_table_seeks;
-      stats->total_seeks += ctx.num_seeks;
+  delete iter;
+  delete epoch_index_block;
+  ReleaseIndexBlock(cache_handle);
+  return status;
+}
+
+// Find the epochs that may contain each of a set of keys within a given epoch
+// range. Return OK on success, or a non-OK status on errors.
+Status Dir::Membership(const ReadOptions& opts, const Slice* keys,
+                       std::vector<bool>** dsts, size_t n) {
+  mu_->AssertHeld();
+  Status status;
+  assert(rt_ != NULL);
+  Iterator* const rt_iter = NewRtIterator(rt_);
+  mu_->Unlock();
+  uint32_t epoch = opts.epoch_start;
+  const uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
+  for (; epoch < epoch_end && n != 0; epoch++) {
+    std::string epoch_key = EpochKey(epoch);
+    rt_iter->Seek(epoch_key);
+    if (!rt_iter->Valid()) {
+      break;  // EOF
+    } else if (rt_iter->key() != epoch_key) {
+      continue;  // No such epoch
     }
-    if (options_.parallel_reads) {
-      Merge(&ctx);
+    BlockHandle h;
+    Slice input = rt_iter->value();
+    status = h.DecodeFrom(&input);
+    if (!status.ok()) {
+      break;
+    }
+    status = DoMembership(h, epoch, keys, dsts, n);
+    if (!status.ok()) {
+      break;
     }
   }
 
+  if (status.ok()) {
+    status = rt_iter->status();
+  }
+
+  delete rt_iter;
+  mu_->Lock();
   return status;
 }
 
@@ -1650,18 +4786,30 @@ void Dir::BGList(void* arg) {
   item->dir->List(item->epoch, item->ctx);
 }
 
-void Dir::BGGet(void* arg) {
-  BGGetItem* item = reinterpret_cast<BGGetItem*>(arg);
-  MutexLock ml(item->dir->mu_);
-  item->dir->Get(item->key, item->epoch, item->ctx);
+void Dir::BGFetch(void* arg) {
+  EpochFetcher* const f = reinterpret_cast<EpochFetcher*>(arg);
+  Dir* const dir = f->dir;
+  GetContext* const ctx = f->ctx;
+  port::Mutex* const mu = dir->mu_;
+  dir->Fetch(f);
+  // The last task of an asynchronous read finishes the read. mu is held
+  // since Fetch() returns so ctx remains valid for the check.
+  if (ctx->async != NULL && ctx->num_open_reads == 0) {
+    dir->FinishAsyncRead(ctx->async);  // Unlocks mu
+  } else {
+    mu->Unlock();
+  }
 }
 
 Dir::ScanOptions::ScanOptions()
     : force_serial_reads(false),
       epoch_start(0),
       epoch_end(~static_cast<uint32_t>(0)),
+      value_offset(0),
+      value_length(0),
       usr_cb(NULL),
       arg_cb(NULL),
+      epoch(NULL),
       tmp_length(0),
       tmp(NULL) {}
 
@@ -1670,20 +4818,38 @@ Dir::ReadOptions::ReadOptions()
       epoch_start(0),
       epoch_end(~static_cast<uint32_t>(0)),
       tmp_length(0),
-      tmp(NULL) {}
+      tmp(NULL),
+      saver(NULL),
+      saver_arg(NULL),
+      latest_first(false),
+      deadline(0) {}
 
 Dir::CountOptions::CountOptions()
     : epoch_start(0), epoch_end(~static_cast<uint32_t>(0)) {}
 
+Dir::EstimateOptions::EstimateOptions()
+    : epoch_start(0), epoch_end(~static_cast<uint32_t>(0)) {}
+
 Dir::Dir(const DirOptions& options, port::Mutex* mu, port::CondVar* bg_cv)
     : options_(options),
       num_eps_(0),
       data_(NULL),
       indx_(NULL),
+      cache_id_(0),
+      index_cache_id_(0),
       mu_(mu),
       bg_cv_(bg_cv),
+      cache_hits_(0),
+      cache_misses_(0),
       rt_(NULL),
-      refs_(0) {}
+      refs_(0) {
+  if (options_.block_cache != NULL) {
+    cache_id_ = options_.block_cache->NewId();
+  }
+  if (options_.index_cache != NULL) {
+    index_cache_id_ = options_.index_cache->NewId();
+  }
+}
 
 Dir::~Dir() {
   mu_->AssertHeld();
@@ -1692,6 +4858,31 @@ Dir::~Dir() {
   delete rt_;
 }
 
+void Dir::PrefetchDataLogs(uint32_t epoch_start, uint32_t epoch_end) {
+  if (options_.epoch_log_rotation && epoch_start < epoch_end) {
+    data_->Prefetch(epoch_start, epoch_end);
+  }
+}
+
+uint32_t Dir::EpochMask(const Slice& key) const {
+  if (key_epochs_.empty()) {
+    return ~static_cast<uint32_t>(0);
+  }
+  char tmp[8];
+  EncodeFixed64(tmp, KeyEpochHash(key));
+  std::vector<uint32_t> values;
+  if (!CuckooValues(Slice(tmp, sizeof(tmp)), key_epochs_, &values)) {
+    return 0;
+  } else if (values.empty()) {  // Malformed index
+    return ~static_cast<uint32_t>(0);
+  }
+  uint32_t result = 0;
+  for (size_t i = 0; i < values.size(); i++) {
+    result |= values[i];
+  }
+  return result;
+}
+
 void Dir::InstallDataSource(LogSource* data) {
   if (data != data_) {
     if (data_ != NULL) data_->Unref();
@@ -1713,11 +4904,22 @@ static Status VerifyOptions(const DirOptions& options, const Footer& footer) {
   if (UnMatch(options.lg_parts, footer.lg_parts()) ||
       UnMatch(options.key_size, footer.key_size()) ||
       UnMatch(options.value_size, footer.value_size()) ||
-      UnMatch(options.fixed_kv_length, footer.fixed_kv_length()) ||
+      UnMatch(options.fixed_kv_length,
+              footer.fixed_kv_length() & ~(kKvEctIndex | kKvKeyIndex) &
+                  0xFF) ||
+      UnMatch(options.ect_index,
+              (footer.fixed_kv_length() & kKvEctIndex) != 0) ||
+      UnMatch(options.key_index,
+              (footer.fixed_kv_length() & kKvKeyIndex) != 0) ||
       UnMatch(options.leveldb_compatible, footer.leveldb_compatible()) ||
       UnMatch(options.epoch_log_rotation, footer.epoch_log_rotation()) ||
-      UnMatch(options.skip_checksums, footer.skip_checksums()) ||
-      UnMatch(options.filter, footer.filter_type()) ||
+      UnMatch(options.skip_checksums,
+              footer.skip_checksums() & ~kCkXxhash & 0xFF) ||
+      UnMatch(options.checksum_type == kCsXxhash64,
+              (footer.skip_checksums() & kCkXxhash) != 0) ||
+      UnMatch(options.filter, footer.filter_type() & ~kFtPartitioned & 0xFF) ||
+      UnMatch(options.filter_partition_keys != 0,
+              (footer.filter_type() & kFtPartitioned) != 0) ||
       UnMatch(options.mode, footer.mode())) {
     return Status::AssertionFailed("Options does not match footer");
   } else {
@@ -1752,7 +4954,10 @@ Status Dir::Open(LogSource* indx) {
 
   BlockContents contents;
   const BlockHandle& handle = footer.epoch_index_handle();
-  status = ReadBlock(indx, options_, handle, &contents, true);
+  // The root index is kept for the lifetime of the dir. It is only read
+  // in place if the index log is kept in memory in its entirety
+  status = ReadBlock(indx, options_, handle, &contents,
+                     options_.index_cache == NULL && indx->ReadsInPlace(0));
   if (!status.ok()) {
     return status;
   }
@@ -1766,8 +4971,49 @@ Status Dir::Open(LogSource* indx) {
   indx_ = indx;
   indx_->Ref();
 
+  // Load the key-to-epoch index if the directory has one
+  Iterator* const rt_iter = NewRtIterator(rt_);
+  rt_iter->Seek(kKeyEpochIndexKey);
+  if (rt_iter->Valid() && rt_iter->key() == kKeyEpochIndexKey) {
+    BlockContents key_epochs;
+    BlockHandle h;
+    Slice input = rt_iter->value();
+    status = h.DecodeFrom(&input);
+    if (status.ok()) {
+      status = ReadBlock(indx, options_, h, &key_epochs);
+    }
+    if (status.ok()) {
+      key_epochs_ = key_epochs.data.ToString();
+      if (key_epochs.heap_allocated) {
+        delete[] key_epochs.data.data();
+      }
+    }
+  }
+  if (status.ok()) {
+    status = rt_iter->status();
+  }
+  delete rt_iter;
+
   return status;
 }
 
+Status Dir::Open(LogSource* indx, const Slice& root, uint32_t num_epochs) {
+  BlockContents contents;
+  char* const buf = new char[root.size()];
+  memcpy(buf, root.data(), root.size());
+  contents.data = Slice(buf, root.size());
+  contents.heap_allocated = true;
+  contents.cachable = false;
+  num_eps_ = num_epochs;
+  if (options_.num_epochs != -1 && options_.num_epochs < int(num_eps_)) {
+    num_eps_ = static_cast<uint32_t>(options_.num_epochs);
+  }
+  rt_ = new Block(contents);
+  indx_ = indx;
+  indx_->Ref();
+
+  return Status::OK();
+}
+
 }  // namespace plfsio
 }  // namespace pdlfs
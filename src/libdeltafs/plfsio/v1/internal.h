@@ -12,11 +12,14 @@
 #pragma once
 
 #include "builder.h"
+#include "events.h"
 #include "format.h"
 #include "io.h"
 #include "recov.h"
+#include "spill.h"
 #include "types.h"
 
+#include "pdlfs-common/cache.h"
 #include "pdlfs-common/env_files.h"
 #include "pdlfs-common/port.h"
 
@@ -29,6 +32,7 @@ namespace plfsio {
 
 class BloomBlock;
 class CompactionList;
+class PmemBufferFile;
 
 // Status for each epoch.
 class Epoch {
@@ -122,28 +126,99 @@ class WriteBuffer {
   ~WriteBuffer() {}
 
   size_t memory_usage() const;  // Report real memory usage
+  // Return the part of "memory" bytes of write buffer memory left for
+  // records once the entry array indexing them is accounted for, assuming
+  // records of the key and value sizes set in options.
+  static size_t RecordMemory(const DirOptions& options, size_t memory);
+  // Report the amount of reserved memory backed by huge pages
+  size_t hugepage_memory_usage() const { return hugepage_bytes_; }
 
   void Reserve(size_t bytes_to_reserve);
-  size_t CurrentBufferSize() const { return buffer_.size(); }
+  // Release reserved memory beyond a new size and reserve the new size.
+  // REQUIRES: the buffer is empty.
+  void Resize(size_t bytes_to_reserve);
+  // Write to all reserved memory so that its pages are allocated by the OS on
+  // the NUMA node of the calling thread.
+  void TouchReservedMemory();
+  // Store records in slot "slot" of a persistent write buffer file instead of
+  // DRAM. Records are then committed to the file as they are inserted, tagged
+  // with the epoch last set through SetEpoch().
+  // REQUIRES: the buffer is empty.
+  void AttachPmem(PmemBufferFile* file, size_t slot, uint32_t part);
+  void SetEpoch(uint32_t epoch) { epoch_ = epoch; }
+  size_t CurrentBufferSize() const { return size(); }
   uint32_t NumEntries() const { return num_entries_; }
+  // Return false if the buffer is backed by a persistent write buffer slot
+  // that has no room for the record.
   bool Add(const Slice& key, const Slice& value);
-  bool NeedCompaction() const { return false; }
+  // True once a record has been rejected for lack of room.
+  bool NeedCompaction() const { return full_; }
   Iterator* NewIterator() const;
   void Finish(bool skip_sort = false);
   void Reset();
 
  private:
   friend class DirCompactor;
+  // Number of leading key bytes stored along with each entry offset
+  static const size_t kKeyPrefixSize = 8;
+  // Starting offset of an inserted entry and the first kKeyPrefixSize bytes of
+  // its key. Most key comparisons can be resolved through the prefixes alone,
+  // without random accesses to the buffer.
+  struct Entry {
+    uint64_t prefix;
+    uint32_t offset;
+  };
+  static uint64_t KeyPrefix(const Slice& key);
+  static size_t BytesPerEntry(const DirOptions& options);
   struct STLLessThan;
+  struct RadixSortState;
+  static void BGRadixSort(void*);
+  unsigned char KeyByte(const Entry& e, size_t depth) const;
+  int CompareKeys(const Entry& a, const Entry& b, size_t depth) const;
+  // Sort entries through a key-prefix radix sort. Only used when all keys
+  // inserted have the same length.
+  void RadixSort(Entry* entries, Entry* tmp, size_t n, size_t depth) const;
+  // Sort entries by their key prefixes alone. Only used when all keys
+  // inserted have the same length and fit in their prefixes, such as 64-bit
+  // integer keys.
+  static void PrefixRadixSort(Entry* entries, Entry* tmp, size_t n);
+  void ParaRadixSort();
+  // Sort entries through options_.key_sorter. Return false if the sorter
+  // declined to sort them, in which case entries are left untouched.
+  bool OffloadedSort();
+  // Packed records, stored either in buffer_ or in a persistent memory slot
+  const char* data() const {
+    return pmem_data_ != NULL ? pmem_data_ : buffer_.data();
+  }
+  size_t size() const {
+    return pmem_data_ != NULL ? pmem_size_ : buffer_.size();
+  }
+  Slice contents() const { return Slice(data(), size()); }
+  const DirOptions& options_;
   // Estimated memory usage per entry (including overhead due to varint
   // encoding)
   size_t bytes_per_entry_;
 
-  // Starting offsets of inserted entries
-  std::vector<uint32_t> offsets_;
+  // Inserted entries
+  std::vector<Entry> entries_;
   std::string buffer_;
+  // Bytes of reserved memory advised to use huge pages
+  size_t hugepage_bytes_;
   uint32_t num_entries_;
+  // Length of the first key inserted. Keys are considered fixed sized if all
+  // subsequent keys share this length
+  size_t key_size_;
+  bool fixed_key_size_;
   bool finished_;
+  bool full_;
+  // Persistent memory slot holding records instead of buffer_. NULL if
+  // records are stored in DRAM.
+  PmemBufferFile* pmem_;
+  size_t pmem_slot_;
+  char* pmem_data_;
+  size_t pmem_size_;
+  uint32_t pmem_part_;
+  uint32_t epoch_;
 
   // No copying allowed
   void operator=(const WriteBuffer&);
@@ -158,6 +233,16 @@ class DirCompactor {
   DirCompactor(const DirOptions& options, DirBuilder* bu);
   virtual ~DirCompactor();
   virtual void Compact(WriteBuffer* buf) = 0;
+  // Same as above, but the table also takes the records of runs spilled
+  // before the buffer was filled. Records are merged in key order unless
+  // keys are unordered.
+  virtual void CompactRuns(WriteBuffer* buf,
+                           const std::vector<SpillRun*>& runs) = 0;
+  // Add a key straight to the table being built, bypassing write buffers.
+  // Keys must be added in table order. The table is completed by
+  // EndDirectTable().
+  virtual void AddDirect(const Slice& key, const Slice& value) = 0;
+  virtual void EndDirectTable() = 0;
   virtual Status FinishEpoch(uint32_t ep_seq) = 0;
   virtual Status Finish(uint32_t ep_seq) = 0;
   virtual size_t memory_usage() const = 0;
@@ -167,9 +252,14 @@ class DirCompactor {
   typedef WriteBuffer::Iter IterType;
   bool ok() const { return bu_->ok(); }
   Status status() const { return bu_->status_; }
+  void SetError(const Status& s) { bu_->status_ = s; }
   uint32_t num_epochs() const { return bu_->num_eps_; }
   const DirOptions& options_;
   DirBuilder* bu_;
+  // Expected number of keys of each table built through AddDirect()
+  uint32_t direct_table_keys_;
+  // Number of keys of the current direct table
+  uint32_t num_direct_keys_;
 
  private:
   // No copying allowed
@@ -177,20 +267,76 @@ class DirCompactor {
   DirCompactor(const DirCompactor&);
 };
 
+class DirIndexer;
+
+// Read a block at a given handle of a log file along with its trailer, and
+// verify and decode the block. If "cached" is true, the block is read in place
+// if the log source keeps data in memory. The block is also read in place if
+// the log source returns data in place, such as when the log is mapped into
+// memory. Otherwise, "tmp" is used if it can hold the block. If "deadline"
+// is not 0, a hedged read gives up once the clock reaches it. Return OK on
+// success, or a non-OK status on errors.
+extern Status ReadBlock(LogSource* source, const DirOptions& options,
+                        const BlockHandle& handle, BlockContents* result,
+                        bool cached = false, uint32_t file_index = 0,
+                        char* tmp = NULL, size_t tmp_length = 0,
+                        uint64_t deadline = 0);
+
+// Run memtable compactions of all partitions of a directory in the background
+// using the compaction pool. At most options.max_compaction_jobs compactions
+// run at the same time. Whenever a background job is free, it picks the ready
+// partition with the most full write buffers.
+// REQUIRES: external synchronization through the directory mutex.
+class DirCompactionScheduler {
+ public:
+  DirCompactionScheduler(const DirOptions& options, port::Mutex* mu,
+                         port::CondVar* cv);
+  // Wait for all background jobs to exit.
+  // REQUIRES: *mu_ has been locked.
+  ~DirCompactionScheduler();
+
+  // Arrange for a partition to have its pending compactions done.
+  // REQUIRES: *mu_ has been locked.
+  void Submit(DirIndexer* indexer);
+
+ private:
+  // No copying allowed
+  void operator=(const DirCompactionScheduler&);
+  DirCompactionScheduler(const DirCompactionScheduler&);
+
+  static void BGWork(void*);
+  void DoWork();
+
+  // Constant after construction
+  const DirOptions& options_;
+  port::CondVar* const bg_cv_;
+  port::Mutex* const mu_;
+
+  // State below is protected by mutex_
+  std::vector<DirIndexer*> ready_;  // Partitions waiting to be compacted
+  int num_jobs_;                    // Number of background jobs scheduled
+};
+
 // Write directory data as multiple runs of indexed tables.
 // Implementation is thread-safe and
 // uses background threads.
 class DirIndexer {
  public:
+  // If "sched" is not NULL, compactions are scheduled through it.
   DirIndexer(const DirOptions& options, size_t part, port::Mutex* mu,
-             port::CondVar* cv);
+             port::CondVar* cv, DirCompactionScheduler* sched = NULL);
 
   Status Open(LogSink* data, LogSink* indx);
   size_t memory_usage() const;  // Report actual memory usage
+  // Report write buffer memory backed by huge pages
+  size_t hugepage_memory_usage() const;
 
   // REQUIRES: mutex_ has been locked
   bool has_bg_compaction();
   Status bg_status();  // Return latest compaction status
+  // Number of forced compactions requested and finished so far
+  uint32_t num_flush_requested() const { return num_flush_requested_; }
+  uint32_t num_flush_completed() const { return num_flush_completed_; }
   // May trigger a new compaction
   Status Add(Epoch* epoch, const Slice& key, const Slice& value);
 
@@ -218,6 +364,12 @@ class DirIndexer {
   // REQUIRES: *mu_ has been locked and no on-going compactions.
   Status SyncAndClose();
 
+  // Make the tables written so far readable before the directory is finished.
+  // Set *root to the contents of a root index block locating them and
+  // *num_epochs to the number of epochs it covers. See DirBuilder::Snapshot().
+  // REQUIRES: *mu_ has been locked and no on-going compactions.
+  Status Snapshot(std::string* root, uint32_t* num_epochs);
+
   void Ref() { refs_++; }
 
   void Unref() {
@@ -231,6 +383,54 @@ class DirIndexer {
   // Return the number of epochs generated so far.
   uint32_t num_epochs() const;
 
+  // Return the total amount of time writers have been blocked waiting for a
+  // free write buffer.
+  uint64_t stall_micros() const;
+
+  // Return the total number of bytes compacted so far and the time spent
+  // compacting them.
+  uint64_t compacted_bytes() const;
+  uint64_t compaction_micros() const;
+
+  // Return the total number of bytes spilled to options_.spill_dir so far and
+  // the time spent compacting write buffers merged with spilled runs.
+  uint64_t spilled_bytes() const;
+  uint64_t spill_merge_micros() const;
+
+  // Add the write buffer occupancy of this partition to *result.
+  void AddWritePressure(DirWritePressure* result) const;
+
+  // Return the write buffer memory of this partition, not including the
+  // memory reserved for compaction.
+  size_t buffer_memory() const { return tb_bytes_ * bufs_.size(); }
+
+  // Return the number of key and value bytes inserted since the last call
+  // and reset the counter.
+  uint64_t TakeInsertedBytes();
+
+  // Change the write buffer memory of this partition. The table size and the
+  // flush threshold follow at once, so a growing partition may fill its
+  // buffers past their old size right away. Buffers are resized as soon as
+  // they are empty, so memory given up by a shrinking partition is only
+  // released once its full buffers are compacted.
+  // REQUIRES: *mu_ has been locked.
+  void ResizeBuffers(size_t memory);
+
+  // Change the data block size and the write buffer utilization target used
+  // from now on. Block size is left unchanged if block_size is 0.
+  // REQUIRES: *mu_ has been locked and no on-going compactions.
+  void Retune(size_t block_size, double memtable_util);
+
+  // Touch all write buffer memory from the calling thread. Used to place
+  // buffers on the NUMA node the partition is compacted on.
+  // REQUIRES: no insertions have been made.
+  void TouchBuffers();
+
+  // Place the write buffers of this partition in consecutive slots of a
+  // persistent write buffer file, starting at slot "first_slot".
+  // REQUIRES: no insertions have been made.
+  void AttachPmem(PmemBufferFile* file, size_t first_slot);
+
  private:
   WritableFileStats io_stats_;
   DirOutputStats compac_stats_;
@@ -240,6 +440,7 @@ class DirIndexer {
 
   void Bind(LogSink* data, LogSink* indx);
 
+  friend class DirCompactionScheduler;
   friend class DirWriter;
   ~DirIndexer();
 
@@ -253,6 +454,7 @@ class DirIndexer {
   DirCompactor* OpenCompactor(DirBuilder* bu);
   Status Prepare(Epoch* epoch, bool force = false, bool epoch_flush = false,
                  bool finalize = false);
+  void SetBufferSizes();
 
   // No copying allowed
   void operator=(const DirIndexer&);
@@ -262,29 +464,91 @@ class DirIndexer {
   void MaybeScheduleCompaction();
   void CompactMemtable();
   void DoCompaction();
+  // Sort a queued immutable write buffer in the background while an earlier
+  // buffer is being compacted.
+  struct SortArg;
+  static void BGSort(void*);
+  void MaybeScheduleSort(size_t idx);
+  bool skip_sort() const;
+  // Spill the current write buffer to a sorted run in options_.spill_dir
+  // instead of waiting for a free buffer, if spilling is enabled and the
+  // spill budget allows. Spilling is disabled for good after an error, in
+  // which case writers wait for a free buffer as usual.
+  bool ShouldSpill() const;
+  void SpillMemtable();
+  bool spill_enabled() const;
+  std::string NewSpillFileName();
+  void NotifyWritePressure(EventType type);
+  Status AddDirect(const Slice& key, const Slice& value);
+  void EndDirectTable();
 
   // Constant after construction
   const DirOptions& options_;
   port::CondVar* const bg_cv_;
   port::Mutex* const mu_;
+  DirCompactionScheduler* const sched_;
   size_t ft_bits_;
   size_t ft_bytes_;       // Target bloom filter size
   size_t buf_threshold_;  // Threshold for write buffer flush
+  double memtable_util_;  // Initially options_.memtable_util
   size_t buf_reserv_;     // Memory reserved for each write buffer
   size_t tb_bytes_;       // Target table size
   size_t part_;           // Partition index
+  // Bytes of spilled runs allowed to wait for merging, 0 for no limit
+  uint64_t spill_budget_;
 
   // State below is protected by mutex_
   uint32_t num_flush_requested_;
   uint32_t num_flush_completed_;
   bool has_bg_compaction_;
   Status bg_status_;
+  uint64_t stall_micros_;
+  // Total bytes compacted so far and the time spent doing so
+  uint64_t compacted_bytes_;
+  uint64_t compaction_micros_;
+  // Key and value bytes inserted since the last TakeInsertedBytes()
+  uint64_t inserted_bytes_;
+  // Key and value bytes inserted into the current direct table and the last
+  // key inserted. Only used if options_.direct_writes is set
+  size_t direct_bytes_;
+  std::string direct_last_key_;
   WriteBuffer* mem_buf_;
-  WriteBuffer* imm_buf_;
   CompactionList compaction_list_;
-  Compaction* imm_compac_;
-  WriteBuffer buf0_;
-  WriteBuffer buf1_;
+  // Number of on-going background sorts
+  int num_bg_sorts_;
+  // A ring of write buffers. The buffer at mem_ accepts new insertions. The
+  // num_imm_ buffers starting from imm_ are immutable and are waiting to be,
+  // or are being, compacted in ring order. compacs_[i] is the compaction
+  // scheduled for bufs_[i] while it is immutable.
+  std::vector<WriteBuffer*> bufs_;
+  std::vector<Compaction*> compacs_;
+  // A background sort is kSortQueued until it starts running
+  enum SortState { kNotSorted, kSortQueued, kSorting, kSorted };
+  std::vector<SortState> sorts_;
+  // Size of each immutable write buffer when it was made immutable
+  std::vector<size_t> imm_bytes_;
+  size_t mem_;
+  size_t imm_;
+  size_t num_imm_;
+  // Runs spilled from the current write buffer, and runs spilled before each
+  // immutable write buffer, in the order they were spilled. Runs are merged
+  // into the table of the buffer they are attached to.
+  std::vector<SpillRun*> spills_;
+  std::vector<std::vector<SpillRun*> > runs_;
+  // Sorted runs of the current epoch waiting to be merged into a single table
+  // when the epoch is flushed. Only used if options_.epoch_merge is set.
+  // Only touched by compactions, which never overlap within a partition.
+  std::vector<SpillRun*> epoch_runs_;
+  // True while the current write buffer is being spilled, during which
+  // writers must wait
+  bool spilling_;
+  Status spill_status_;
+  uint32_t num_spills_;
+  // Bytes of spilled runs waiting to be merged, total bytes spilled so far,
+  // and the time spent compacting buffers merged with runs
+  uint64_t pending_spill_bytes_;
+  uint64_t spilled_bytes_;
+  uint64_t spill_merge_micros_;
   DirCompactor* compactor_;
   LogSink* data_;
   LogSink* indx_;
@@ -300,6 +564,10 @@ class Dir {
   // Open a directory reader on top of a given directory index partition.
   // Return OK on success, or a non-OK status on errors.
   Status Open(LogSource* indx);
+  // Same as above, but for a partition that is still being written. The
+  // root index, which covers "num_epochs" epochs, is given by the writer
+  // instead of being located through the footer. See DirIndexer::Snapshot().
+  Status Open(LogSource* indx, const Slice& root, uint32_t num_epochs);
 
   // Count the total number of keys within a given epoch range.
   // Return OK on success, or a non-OK status on errors.
@@ -311,10 +579,35 @@ class Dir {
 
   Status Count(const CountOptions& opts, size_t* result);
 
+  struct EstimateOptions {
+    EstimateOptions();
+    uint32_t epoch_start;
+    uint32_t epoch_end;
+    // An empty bound is treated as unbounded.
+    Slice key_start;
+    Slice key_end;
+  };
+
+  // Estimate the number of keys within [key_start, key_end) stored in a given
+  // epoch range by walking the epoch indexes. No data blocks are read. Tables
+  // with key samples contribute their sample-based estimates. Other tables
+  // that may overlap the range contribute an even share of their epoch's
+  // keys. Return OK on success, or a non-OK status on errors.
+  Status EstimateCount(const EstimateOptions& opts, size_t* result);
+
+  // Obtain the space taken by each epoch of the directory partition by
+  // walking its indexes. (*epochs)[e] is set to the space taken by epoch e.
+  // Space taken by the root index, the footer, and the tail padding of the
+  // index log is stored in *others. Return OK on success, or a non-OK status
+  // on errors.
+  Status GetSpaceStats(std::vector<DirSpaceStats>* epochs,
+                       DirSpaceStats* others);
+
   // Obtain the value to a key within a given epoch range. All value found will
   // be appended to "dst". A caller may optionally provide a temporary buffer
   // for storing fetched block contents. Read stats will be accumulated to
   // "*stats". Return OK on success, or a non-OK status on errors.
+  typedef int (*ValueSaver)(void* arg, uint32_t epoch, const Slice& value);
   struct ReadOptions {
     ReadOptions();
     bool force_serial_reads;  // Do not fetch data in parallel
@@ -323,17 +616,67 @@ class Dir {
     // Temporary storage for data blocks
     size_t tmp_length;
     char* tmp;
+    // If not NULL, values are passed to "saver" one at a time, in epoch
+    // order, straight from the data blocks in which they are found instead
+    // of being appended to "dst". Values are only valid during the call.
+    // The read stops early once "saver" returns -1. Epochs are read serially.
+    ValueSaver saver;
+    void* saver_arg;
+    // Probe epochs from the newest to the oldest and only return values from
+    // the newest epoch in which the key is found. Older epochs are skipped
+    // once a hit is seen, including those already scheduled for parallel
+    // fetching but not yet started.
+    bool latest_first;
+    // Give up and return TryAgain once the clock (CurrentMicros()) reaches
+    // this time. Checked before each epoch is fetched and while waiting on
+    // hedged block reads. Set to 0 for no limit.
+    uint64_t deadline;
   };
 
   struct ReadStats {
     size_t total_table_seeks;  // Total tables touched
     // Total data blocks fetched
     size_t total_seeks;
+    // Detailed costs, accumulated like the counters above
+    QueryStats costs;
   };
 
   Status Read(const ReadOptions& opts, const Slice& key, std::string* dst,
               ReadStats* stats);
 
+  typedef void (*ReadCallback)(void* arg, const Status& status,
+                               const Slice& value);
+  // Obtain the value to a specific key within a given epoch range without
+  // blocking the caller. All epochs are fetched in the background through
+  // options_.reader_pool, or env threads, and "cb" is called exactly once by
+  // the thread that finishes the last epoch fetch, or by another background
+  // thread if there is nothing to fetch, but never by the caller. Stats are
+  // added to *stats right before "cb" is called so *stats must remain valid
+  // until then.
+  // REQUIRES: mu_ has been locked and background threads are available.
+  void ReadAsync(const ReadOptions& opts, const Slice& key, ReadStats* stats,
+                 ReadCallback cb, void* arg);
+
+  // Obtain the values to a set of keys within a given epoch range. Values
+  // found for keys[i] will be appended to *dsts[i]. Each table is probed once
+  // for all keys, each data block is fetched once for all keys it may
+  // contain, and fetches of nearby data blocks are coalesced into a single
+  // read. Epochs are read serially. Read stats will be accumulated to
+  // "*stats". Return OK on success, or a non-OK status on errors.
+  // REQUIRES: keys[0..n-1] are sorted and unique.
+  Status MultiRead(const ReadOptions& opts, const Slice* keys,
+                   std::string** dsts, size_t n, ReadStats* stats);
+
+  // Find the epochs within a given epoch range that may contain each of a set
+  // of keys. (*dsts[i])[e] is set to true if keys[i] may be stored in epoch e.
+  // Only table key ranges and filters are consulted so no index or data
+  // blocks are read. False positives are possible while false negatives are
+  // not. Return OK on success, or a non-OK status on errors.
+  // REQUIRES: keys[0..n-1] are sorted and each *dsts[i] has room for all
+  // epochs of the range.
+  Status Membership(const ReadOptions& opts, const Slice* keys,
+                    std::vector<bool>** dsts, size_t n);
+
   // Iterate through all keys within a given epoch range. A caller may
   // optionally provide a temporary buffer for storing fetched block contents.
   // Read stats will be accumulated to "*stats". Return OK on success, or a
@@ -343,9 +686,20 @@ class Dir {
     bool force_serial_reads;  // Do not fetch data in parallel
     uint32_t epoch_start;
     uint32_t epoch_end;
+    // Only keys within [key_start, key_end) are scanned.
+    // An empty bound is treated as unbounded.
+    Slice key_start;
+    Slice key_end;
+    // Only value bytes [value_offset, value_offset + value_length) are
+    // reported if value_length is not 0 and values are fixed sized.
+    size_t value_offset;
+    size_t value_length;
     // User callback to handle fetched data
     void* usr_cb;
     void* arg_cb;
+    // If not NULL, set to the epoch of each entry right before the entry is
+    // delivered to usr_cb. Only honored by OrderedScan().
+    uint32_t* epoch;
     // Temporary storage for data blocks
     size_t tmp_length;
     char* tmp;
@@ -361,6 +715,17 @@ class Dir {
 
   Status Scan(const ScanOptions& opts, ScanStats* stats);
 
+  // Iterate through all keys within a given epoch range across a set of
+  // directory partitions and deliver them to "opts.usr_cb" in key order.
+  // Entries sharing a key are delivered in epoch order. Tables are read
+  // through cursors that are k-way merged. Each cursor keeps one data block
+  // fetched ahead in the background, with at most options.scan_readahead such
+  // blocks in flight. Read stats will be accumulated to "*stats". Return OK on
+  // success, or a non-OK status on errors.
+  // REQUIRES: all dirs share the same options and no dir mutex is held.
+  static Status OrderedScan(Dir** dirs, size_t n, const ScanOptions& opts,
+                            ScanStats* stats);
+
   void InstallDataSource(LogSource* data);
 
   void Ref() { refs_++; }
@@ -394,18 +759,52 @@ class Dir {
     Saver saver;
     // Callback argument
     void* arg;
+    // Time at which hedged block reads give up, or 0 for no limit
+    uint64_t deadline;
   };
 
   // Obtain the value to a specific key from a given table data block.
   // If key is found, "opts.saver" will be called and *found is set to true. In
   // addition, *exhausted is set to true if any key larger than the given one is
   // seen. NOTE: "opts.saver" may be called multiple times. Return OK on
-  // success, or a non-OK status on errors.
+  // success, or a non-OK status on errors. If "positions" is not NULL, only
+  // the entries at these positions within the block are checked as long as
+  // the block format supports positional access.
   Status Fetch(const FetchOptions& opts, const Slice& key, Slice* input,
-               bool* found, bool* exhausted);
+               bool* found, bool* exhausted,
+               const std::vector<uint32_t>* positions = NULL);
+
+  // Open an iterator on top of a given data block. The block is looked up
+  // in the block cache first, if there is one, and is inserted into the cache
+  // after being read from the data log. Cache hits and misses are counted in
+  // *hits and *misses. If value_length is not 0, only value bytes
+  // [value_offset, value_offset + value_length) are reported by the iterator.
+  // A hedged block read gives up at "deadline" unless it is 0.
+  // Return OK on success, or a non-OK status on errors.
+  Status OpenDataBlock(const BlockHandle& handle, uint32_t file_index,
+                       char* tmp, size_t tmp_length, Iterator** result,
+                       size_t* hits, size_t* misses, size_t value_offset = 0,
+                       size_t value_length = 0, uint64_t deadline = 0);
+
+  // Add the space taken by a table to *space. The filter of the table is
+  // a filter index block if "partitioned" is true.
+  Status GetTableSpaceStats(const TableHandle& h, bool partitioned,
+                            DirSpaceStats* space);
 
   // Return true if the given key matches a specific filter block.
   bool KeyMayMatch(const Slice& key, const BlockHandle& h);
+  // Return true if the given key matches the filter partition indexed by a
+  // specific filter index block that may contain the key.
+  bool PartitionKeyMayMatch(const Slice& key, const BlockHandle& h);
+  // Return true if the given key matches the filter of a table, which is
+  // either a single filter block or a filter index block.
+  bool FilterMayMatch(const Slice& key, const BlockHandle& h) {
+    if (options_.filter_partition_keys != 0) {
+      return PartitionKeyMayMatch(key, h);
+    } else {
+      return KeyMayMatch(key, h);
+    }
+  }
 
   // Obtain the value to a specific key from a given table.
   // If key is found, "opts.saver" will be called.
@@ -420,39 +819,174 @@ class Dir {
   // NOTE: a key may appear multiple times within a single epoch.
   // Store an OK status in *ctx->status on success, or a non-OK status on
   // errors.
+  struct AsyncRead;
+  // Finish an asynchronous read and report its results. mu_ is unlocked
+  // when this function returns.
+  // REQUIRES: mu_ has been locked.
+  void FinishAsyncRead(AsyncRead* a);
+  static void BGFinishAsyncRead(void*);
+
   struct GetContext {
+    AsyncRead* async;  // NULL for synchronous reads
+    // True if epochs may be fetched concurrently
+    bool parallel;
     Iterator* rt_iter;  // Only used in serial reads
     std::string* dst;
     int num_open_reads;
-    std::vector<uint32_t>* offsets;  // Only used during parallel reads
-    std::string* buffer;
+    // Per-epoch values, indexed by epoch - epoch_start. Each epoch is fetched
+    // by a single thread so no locking is needed. Only used during parallel
+    // reads
+    std::vector<std::string>* results;
+    uint32_t epoch_start;
+    ValueSaver saver;  // Only used in serial reads
+    void* saver_arg;
+    bool stopped;  // Set once saver returns -1
+    bool latest_first;
+    // True if the key has been found. "found_epoch" is the newest epoch in
+    // which the key has been found so far. Only used if latest_first is set
+    bool found;
+    uint32_t found_epoch;
     Status* status;
+    // Time at which the read gives up, or 0 for no limit
+    uint64_t deadline;
+    // Epochs that may hold the key, as a bitmap indexed by the epoch number
+    // modulo 32. Other epochs are skipped
+    uint32_t epoch_mask;
     char* tmp;  // Temporary storage for block contents
     size_t tmp_length;
     size_t num_table_seeks;  // Total number of tables touched
     // Total number of data blocks fetched
     size_t num_seeks;
+    // Detailed costs accumulated over all epochs
+    QueryStats costs;
   };
   void Get(const Slice& key, uint32_t epoch, GetContext* ctx);
 
   struct GetStats {
+    GetStats();
     size_t table_seeks;  // Total tables touched for a certain epoch
     // Total data blocks fetched for a certain epoch
     size_t seeks;
+    // Data blocks served from or missing the block cache
+    size_t cache_hits;
+    size_t cache_misses;
+    // Total number of matches found
+    size_t hits;
+    uint64_t bytes_read;  // Total bytes of data blocks fetched
+    size_t filter_probes;
+    size_t filter_false_positives;
+    uint64_t io_micros;  // Time spent fetching data blocks
+    // Time spent searching data blocks
+    uint64_t decode_micros;
+    // Number of epochs in which no table was read
+    size_t epochs_skipped;
   };
+  static void AddCosts(QueryStats* costs, const GetStats& stats);
+  static void AddCosts(QueryStats* costs, const QueryStats& other);
   Status DoGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
                GetContext* ctx, GetStats* stats);
 
   // Merge results from concurrent getters.
   static void Merge(GetContext* ctx);
 
-  struct BGGetItem {
+  // Open the data logs of a range of epochs in the background when each
+  // epoch has its own log so that epochs are read from different files in
+  // parallel instead of waiting on each log to open in turn.
+  void PrefetchDataLogs(uint32_t epoch_start, uint32_t epoch_end);
+  // Return a bitmap, indexed by the epoch number modulo 32, of the epochs
+  // that may hold a given key according to the directory's key-to-epoch
+  // index. All bits are set if the directory has no such index.
+  uint32_t EpochMask(const Slice& key) const;
+
+  // Obtain the value to a specific key within a given epoch. Called without
+  // holding mu_. "rt_iter" is an iterator over the root index.
+  Status GetEpoch(const Slice& key, uint32_t epoch, Iterator* rt_iter,
+                  GetContext* ctx, GetStats* stats);
+
+  // The epochs of a parallel read are fetched by a few background tasks
+  // instead of one task per epoch. Tasks claim epochs from a shared cursor,
+  // newest first if the read is latest_first, and fetch them one after
+  // another. While tasks are running, ctx->status, ctx->found, and
+  // ctx->found_epoch are protected by the fetcher's own mutex instead of mu_.
+  // Each task locks mu_ once, to report its costs when no epochs are left.
+  struct EpochFetcher {
     GetContext* ctx;
-    uint32_t epoch;
-    Slice key;
     Dir* dir;
+    Slice key;
+    uint32_t epoch_end;  // Epochs are [ctx->epoch_start, epoch_end)
+    port::Mutex mu;
+    uint32_t next;  // Number of epochs claimed so far. Protected by mu
+  };
+  // Schedule the tasks of a fetcher. Tasks are counted in
+  // ctx->num_open_reads.
+  // REQUIRES: mu_ has been locked.
+  void StartFetcher(EpochFetcher* f, const Slice& key, uint32_t epoch_end,
+                    GetContext* ctx);
+  // Fetch epochs until none is left. Return with mu_ locked.
+  void Fetch(EpochFetcher* f);
+  static void BGFetch(void*);
+
+  struct MultiGetContext {
+    const Slice* keys;  // Sorted target keys
+    std::string** dsts;
+    size_t n;
+    // Keys already found in the current epoch
+    std::vector<char>* found;
+    size_t num_found;
+    // Log rotation #
+    uint32_t file_index;  // For data log only
+    char* tmp;  // Temporary storage for block contents
+    size_t tmp_length;
+    GetStats* stats;
+  };
+  // A data block to be searched for a subset of the target keys.
+  struct MultiGetBlock {
+    BlockHandle handle;
+    Cache::Handle* cache_handle;  // NULL if not cached
+    // Range of key indexes in the candidate list
+    size_t begin;
+    size_t end;
   };
-  static void BGGet(void*);
+  // Mark the current epoch for all target keys that may be stored in any
+  // table of a given directory epoch.
+  Status DoMembership(const BlockHandle& h, uint32_t epoch, const Slice* keys,
+                      std::vector<bool>** dsts, size_t n);
+  // Obtain the values to all target keys within a given directory epoch.
+  Status DoMultiGet(const BlockHandle& h, uint32_t epoch, MultiGetContext* ctx);
+  // Obtain the values to all target keys from a given table.
+  Status MultiFetch(MultiGetContext* ctx, const TableHandle& h);
+  // Fetch a series of data blocks in offset order and search each of them
+  // for its candidate keys.
+  Status MultiFetch(MultiGetContext* ctx, const std::vector<size_t>& cands,
+                    std::vector<MultiGetBlock>* blocks);
+  // Search a data block for a range of candidate keys.
+  Status MultiFetch(MultiGetContext* ctx, const std::vector<size_t>& cands,
+                    const MultiGetBlock& b, Iterator* iter);
+
+  // Return an iterator on top of a given data block, inserting the block
+  // into the block cache.
+  // REQUIRES: options_.block_cache != NULL and contents.heap_allocated.
+  Iterator* InsertAndOpenDataBlock(const Slice& cache_key,
+                                   const BlockContents& contents,
+                                   size_t value_offset = 0,
+                                   size_t value_length = 0);
+
+  Status ReadIndexBlock(const BlockHandle& handle, BlockContents* result,
+                        Cache::Handle** cache_handle);
+  // Read the index block of a given table, stripping any trailer stored
+  // after the block into *trailer if trailer is not NULL. Release through
+  // ReleaseIndexBlock().
+  Status ReadTableIndex(const TableHandle& h, BlockContents* result,
+                        Slice* trailer, Cache::Handle** cache_handle);
+  void ReleaseIndexBlock(Cache::Handle* cache_handle);
+
+  class TableCursor;
+  struct Prefetcher;
+  struct CursorGreater;
+  // Open a cursor for each table within a given epoch range. Cursors are
+  // not started.
+  Status AddTableCursors(const ScanOptions& opts, Prefetcher* prefetcher,
+                         std::vector<TableCursor*>* cursors);
 
   struct ListStats;
   struct IterOptions {
@@ -463,6 +997,14 @@ class Dir {
     char* tmp;
     // Scratch size
     size_t tmp_length;
+    // Key range to scan. Empty bounds are unbounded
+    Slice key_start;
+    Slice key_end;
+    // Value bytes to report. Entire values are reported if value_length is 0
+    size_t value_offset;
+    size_t value_length;
+    // Read the next group of data blocks in the background
+    bool async_readahead;
     // Callback for handling fetched data
     Saver saver;
     // Callback argument
@@ -478,10 +1020,25 @@ class Dir {
   // Return OK on success, or a non-OK status on errors.
   Status Iter(const IterOptions& opts, const TableHandle& h);
 
+  // Iterate through all keys of an opened data block. Delete "iter" when done.
+  Status Iter(const IterOptions& opts, Iterator* iter);
+
+  struct ReadaheadWindow;
+  // Iterate through a series of data blocks of a table, fetching consecutive
+  // blocks in groups of up to options_.scan_readahead blocks per read.
+  Status IterWithReadahead(const IterOptions& opts,
+                           const std::vector<BlockHandle>& handles);
+  static void BGReadahead(void*);
+
   struct ListContext {
     Iterator* rt_iter;  // Only used in serial reads
     void* usr_cb;
     void* arg_cb;
+    Slice key_start;  // Empty for unbounded
+    Slice key_end;
+    size_t value_offset;  // Value projection. Unused if value_length is 0
+    size_t value_length;
+    bool async_readahead;
     int num_open_lists;
     Status* status;
     char* tmp;  // Temporary storage for block contents
@@ -500,6 +1057,9 @@ class Dir {
     size_t seeks;
     // Total number of keys read
     size_t n;
+    // Data blocks served from or missing the block cache
+    size_t cache_hits;
+    size_t cache_misses;
   };
   Status DoList(const BlockHandle& h, uint32_t epoch, ListContext* ctx,
                 ListStats* stats);
@@ -515,15 +1075,21 @@ class Dir {
   void operator=(const Dir&);
   Dir(const Dir&);
 
-  struct STLLessThan;
   // Constant after construction
   const DirOptions& options_;
   uint32_t num_eps_;
   LogSource* data_;
   LogSource* indx_;
+  uint64_t cache_id_;  // Prefix of all our block cache keys
+  uint64_t index_cache_id_;  // Prefix of all our index cache keys
+  // Contents of the key-to-epoch index. Empty if the directory has none
+  std::string key_epochs_;
 
   port::Mutex* mu_;
   port::CondVar* bg_cv_;
+  // State below is protected by mu_
+  uint64_t cache_hits_;
+  uint64_t cache_misses_;
   Block* rt_;
   int refs_;
 };
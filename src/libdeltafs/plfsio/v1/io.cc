@@ -13,11 +13,24 @@
 
 #include "../../util/logging.h"
 #include "format.h"
+#include "trace.h"
 #include "types.h"
 
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/crc32c.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/osd.h"
+#include "pdlfs-common/rate_limiter.h"
 #include "pdlfs-common/strutil.h"
 
 #include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
 namespace pdlfs {
@@ -107,6 +120,712 @@ class RollingLogFile : public WritableFile {
   friend class LogSink;
 };
 
+// Write data to a *base in the background so that callers do not wait for
+// storage I/O. Appended data is copied and queued, and is later written out
+// by a job scheduled on a thread pool. Up to a certain number of writes may be
+// queued before Append() blocks. Write errors are sticky and are reported by
+// subsequent calls. Sync() and Close() wait for all queued writes.
+// Implementation is thread-safe.
+class AsyncWritableFile : public WritableFile {
+ public:
+  // *base must remain alive during the lifetime of this class. *base will be
+  // implicitly closed and deleted by the destructor of this class.
+  AsyncWritableFile(WritableFile* base, ThreadPool* pool, size_t max_pending)
+      : base_(base),
+        pool_(pool),
+        max_pending_(max_pending),
+        cv_(&mu_),
+        bg_scheduled_(false) {
+    assert(max_pending_ != 0);
+  }
+
+  virtual ~AsyncWritableFile() {
+    Close();  // Ignore errors
+  }
+
+  virtual Status Append(const Slice& data) {
+    MutexLock ml(&mu_);
+    while (bg_status_.ok() && pending_.size() >= max_pending_) {
+      cv_.Wait();
+    }
+    if (base_ == NULL) {
+      return Status::Disconnected(Slice());
+    } else if (!bg_status_.ok()) {
+      return bg_status_;
+    }
+    pending_.push_back(new std::string(data.data(), data.size()));
+    if (!bg_scheduled_) {
+      bg_scheduled_ = true;
+      pool_->Schedule(AsyncWritableFile::BGWork, this);
+    }
+    return Status::OK();
+  }
+
+  // Data is written out in the background so there is nothing to flush.
+  virtual Status Flush() {
+    MutexLock ml(&mu_);
+    return bg_status_;
+  }
+
+  virtual Status Sync() {
+    MutexLock ml(&mu_);
+    Status status = WaitForPendingWrites();
+    if (status.ok()) {
+      if (base_ == NULL) {
+        status = Status::Disconnected(Slice());
+      } else {
+        status = base_->Sync();
+      }
+    }
+    return status;
+  }
+
+  virtual Status Close() {
+    MutexLock ml(&mu_);
+    Status status = WaitForPendingWrites();
+    if (base_ != NULL) {
+      Status s = base_->Close();
+      if (status.ok()) status = s;
+      delete base_;
+      base_ = NULL;
+    }
+    return status;
+  }
+
+ private:
+  // REQUIRES: mu_ has been locked.
+  Status WaitForPendingWrites() {
+    mu_.AssertHeld();
+    while (bg_scheduled_) {
+      cv_.Wait();
+    }
+    return bg_status_;
+  }
+
+  static void BGWork(void* arg) {
+    reinterpret_cast<AsyncWritableFile*>(arg)->DoWrites();
+  }
+
+  void DoWrites() {
+    MutexLock ml(&mu_);
+    assert(bg_scheduled_);
+    while (!pending_.empty()) {
+      std::string* const data = pending_.front();
+      Status status = bg_status_;
+      if (status.ok()) {
+        // Only this job touches *base_ while it is scheduled
+        mu_.Unlock();
+        status = base_->Append(*data);
+        if (status.ok()) {
+          status = base_->Flush();
+        }
+        mu_.Lock();
+      }
+      pending_.pop_front();
+      delete data;
+      if (!status.ok() && bg_status_.ok()) {
+        bg_status_ = status;
+      }
+      cv_.SignalAll();
+    }
+    bg_scheduled_ = false;
+    cv_.SignalAll();
+  }
+
+  // No copying allowed
+  void operator=(const AsyncWritableFile& other);
+  AsyncWritableFile(const AsyncWritableFile&);
+
+  WritableFile* base_;  // NULL after Close()
+  ThreadPool* const pool_;
+  const size_t max_pending_;
+  port::Mutex mu_;
+  port::CondVar cv_;
+  // State below is protected by mu_
+  std::deque<std::string*> pending_;
+  bool bg_scheduled_;
+  Status bg_status_;
+};
+
+// Record each write and sync to a *base as a trace span. *base will be
+// implicitly closed and deleted by the destructor of this class.
+class TracedWritableFile : public WritableFile {
+ public:
+  TracedWritableFile(WritableFile* base, DirTracer* tracer, const char* name)
+      : base_(base), tracer_(tracer), name_(name) {}
+
+  virtual ~TracedWritableFile() { delete base_; }
+
+  virtual Status Append(const Slice& data) {
+    TraceScope trace(tracer_, name_);
+    return base_->Append(data);
+  }
+
+  virtual Status Flush() { return base_->Flush(); }
+
+  virtual Status Sync() {
+    TraceScope trace(tracer_, "log_sync");
+    return base_->Sync();
+  }
+
+  virtual Status Close() { return base_->Close(); }
+
+ private:
+  // No copying allowed
+  void operator=(const TracedWritableFile& other);
+  TracedWritableFile(const TracedWritableFile&);
+
+  WritableFile* const base_;
+  DirTracer* const tracer_;
+  const char* const name_;
+};
+
+#if defined(O_DIRECT)
+// Write data to a local file opened with O_DIRECT so that written data does
+// not go through the OS page cache. Data is staged in an aligned buffer and is
+// only written in multiples of kDirectIoAlignment bytes at aligned offsets. A
+// partial tail is written as a zero-padded block, which is rewritten
+// once more data arrives, and the file is then truncated to its logical size.
+// Implementation is not thread-safe.
+class DirectWritableFile : public WritableFile {
+ public:
+  enum { kDirectIoAlignment = 4096 };
+
+  // The file takes the ownership of "fd" and "buf".
+  // REQUIRES: "buf" is aligned and holds "buf_size" bytes, which is a
+  // non-zero multiple of kDirectIoAlignment.
+  DirectWritableFile(const std::string& fname, int fd, char* buf,
+                     size_t buf_size)
+      : fname_(fname),
+        fd_(fd),
+        buf_(buf),
+        buf_size_(buf_size),
+        pos_(0),
+        off_(0),
+        tail_written_(false) {
+    assert(buf_size_ % kDirectIoAlignment == 0);
+  }
+
+  virtual ~DirectWritableFile() {
+    Close();  // Ignore errors
+  }
+
+  virtual Status Append(const Slice& data) {
+    Status status;
+    if (fd_ < 0) {
+      return Status::Disconnected(fname_);
+    }
+    if (!data.empty()) {
+      tail_written_ = false;
+    }
+    Slice chunk = data;
+    while (!chunk.empty()) {
+      const size_t n = std::min(chunk.size(), buf_size_ - pos_);
+      memcpy(buf_ + pos_, chunk.data(), n);
+      pos_ += n;
+      chunk.remove_prefix(n);
+      if (pos_ == buf_size_) {
+        status = WriteBlocks();
+        if (!status.ok()) {
+          break;
+        }
+      }
+    }
+    return status;
+  }
+
+  // Write out all whole blocks. A partial tail stays in memory.
+  virtual Status Flush() {
+    if (fd_ < 0) {
+      return Status::Disconnected(fname_);
+    } else {
+      return WriteBlocks();
+    }
+  }
+
+  virtual Status Sync() {
+    Status status = WriteTail();
+    if (status.ok() && fdatasync(fd_) != 0) {
+      status = IOError(errno);
+    }
+    return status;
+  }
+
+  virtual Status Close() {
+    Status status;
+    if (fd_ >= 0) {
+      status = WriteTail();
+      if (close(fd_) != 0 && status.ok()) {
+        status = IOError(errno);
+      }
+      fd_ = -1;
+      free(buf_);
+      buf_ = NULL;
+    }
+    return status;
+  }
+
+ private:
+  Status IOError(int err) const {
+    return Status::IOError(fname_, strerror(err));
+  }
+
+  Status Write(size_t n) {
+    assert(n % kDirectIoAlignment == 0);
+    size_t done = 0;
+    while (done < n) {
+      ssize_t r = pwrite(fd_, buf_ + done, n - done, off_ + done);
+      if (r < 0) {
+        if (errno == EINTR) continue;
+        return IOError(errno);
+      }
+      done += r;
+    }
+    return Status::OK();
+  }
+
+  // Write whole blocks and move the remaining tail to the buffer head.
+  Status WriteBlocks() {
+    const size_t n = pos_ - pos_ % kDirectIoAlignment;
+    if (n == 0) {
+      return Status::OK();
+    }
+    Status status = Write(n);
+    if (status.ok()) {
+      off_ += n;
+      pos_ -= n;
+      memmove(buf_, buf_ + n, pos_);
+      tail_written_ = false;
+    }
+    return status;
+  }
+
+  // Write all buffered data, padding the tail to a whole block, and set the
+  // file size to the actual amount of data written.
+  Status WriteTail() {
+    if (fd_ < 0) {
+      return Status::Disconnected(fname_);
+    }
+    Status status = WriteBlocks();
+    if (status.ok() && pos_ != 0 && !tail_written_) {
+      memset(buf_ + pos_, 0, kDirectIoAlignment - pos_);
+      status = Write(kDirectIoAlignment);
+      if (status.ok()) {
+        if (ftruncate(fd_, off_ + pos_) != 0) {
+          status = IOError(errno);
+        } else {
+          tail_written_ = true;
+        }
+      }
+    }
+    return status;
+  }
+
+  // No copying allowed
+  void operator=(const DirectWritableFile& other);
+  DirectWritableFile(const DirectWritableFile&);
+
+  const std::string fname_;
+  int fd_;
+  char* buf_;
+  const size_t buf_size_;
+  size_t pos_;     // Number of bytes buffered
+  uint64_t off_;   // File offset of buf_[0], always block aligned
+  bool tail_written_;  // If the buffered tail has been written
+};
+#endif
+
+// Return the name of the object holding the manifest of a log written
+// through an object store in place of a given file. Object stores have a
+// flat namespace so path separators are escaped.
+static std::string LogObjectName(const std::string& fname) {
+  std::string result;
+  for (size_t i = 0; i < fname.size(); i++) {
+    if (fname[i] == '%') {
+      result += "%25";
+    } else if (fname[i] == '/') {
+      result += "%2F";
+    } else {
+      result.push_back(fname[i]);
+    }
+  }
+  return result;
+}
+
+// Return the name of the object holding a given part of a log.
+static std::string LogPartName(const std::string& name, size_t part) {
+  char tmp[20];
+  snprintf(tmp, sizeof(tmp), ".p%06x", static_cast<unsigned>(part));
+  return name + tmp;
+}
+
+// The manifest of a multipart log stores the number of parts, the size of
+// each part, and a checksum of both.
+static void EncodeLogManifest(const std::vector<uint64_t>& sizes,
+                              std::string* dst) {
+  dst->clear();
+  PutFixed32(dst, static_cast<uint32_t>(sizes.size()));
+  for (size_t i = 0; i < sizes.size(); i++) {
+    PutFixed64(dst, sizes[i]);
+  }
+  PutFixed32(dst, crc32c::Mask(crc32c::Value(dst->data(), dst->size())));
+}
+
+static Status DecodeLogManifest(const Slice& input,
+                                std::vector<uint64_t>* sizes) {
+  sizes->clear();
+  if (input.size() < 8) {
+    return Status::Corruption("Log manifest too short");
+  }
+  const uint32_t n = DecodeFixed32(input.data());
+  if (input.size() != 8 + 8 * uint64_t(n)) {
+    return Status::Corruption("Bad log manifest size");
+  }
+  const size_t end = input.size() - 4;
+  if (crc32c::Unmask(DecodeFixed32(input.data() + end)) !=
+      crc32c::Value(input.data(), end)) {
+    return Status::Corruption("Log manifest checksum mismatch");
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    sizes->push_back(DecodeFixed64(input.data() + 4 + 8 * i));
+  }
+  return Status::OK();
+}
+
+// Write a log as a series of objects ("parts") of up to a certain size
+// through an object store so that writes do not serialize on a single
+// ever-growing object. Full parts are queued and uploaded by Osd::Put using a
+// thread pool, or by the writer itself if no pool is given or too many parts
+// are queued. Sync() uploads the partial part buffered so far as a part of
+// its own, waits for all uploads, and rewrites the manifest listing all
+// parts so that everything written so far can be read. Upload errors are
+// sticky and are reported by subsequent calls.
+class MultipartWritableObject : public WritableFile {
+ public:
+  MultipartWritableObject(Osd* osd, const std::string& name, size_t part_size,
+                          ThreadPool* pool)
+      : osd_(osd),
+        name_(name),
+        part_size_(std::max<size_t>(part_size, 1)),
+        pool_(pool),
+        closed_(false),
+        cv_(&mu_),
+        num_uploads_(0),
+        num_tasks_(0) {}
+
+  virtual ~MultipartWritableObject() {
+    Close();  // Ignore errors
+    MutexLock ml(&mu_);
+    while (num_tasks_ != 0) {
+      cv_.Wait();
+    }
+    for (size_t i = 0; i < queue_.size(); i++) {
+      delete queue_[i];
+    }
+  }
+
+  virtual Status Append(const Slice& data) {
+    if (closed_) {
+      return Status::Disconnected(name_);
+    }
+    Slice input = data;
+    while (!input.empty()) {
+      const size_t n = std::min(input.size(), part_size_ - buf_.size());
+      buf_.append(input.data(), n);
+      input.remove_prefix(n);
+      if (buf_.size() == part_size_) {
+        Status status = CutPart();
+        if (!status.ok()) {
+          return status;
+        }
+      }
+    }
+    return Status::OK();
+  }
+
+  // Parts are only uploaded once full or on Sync()
+  virtual Status Flush() {
+    MutexLock ml(&mu_);
+    return bg_status_;
+  }
+
+  virtual Status Sync() {
+    if (closed_) {
+      return Status::Disconnected(name_);
+    }
+    Status status = CutPart();
+    if (status.ok()) {
+      MutexLock ml(&mu_);
+      while (!queue_.empty()) {
+        UploadNext();
+      }
+      while (num_uploads_ != 0) {
+        cv_.Wait();
+      }
+      status = bg_status_;
+    }
+    if (status.ok()) {
+      std::string manifest;
+      EncodeLogManifest(sizes_, &manifest);
+      status = osd_->Put(name_.c_str(), manifest);
+    }
+    return status;
+  }
+
+  virtual Status Close() {
+    if (closed_) {
+      return Status::OK();
+    }
+    Status status = Sync();
+    closed_ = true;
+    return status;
+  }
+
+ private:
+  struct Part {
+    std::string name;
+    std::string data;
+  };
+
+  // Queue the data buffered so far as a new part.
+  Status CutPart() {
+    if (buf_.empty()) {
+      return Status::OK();
+    }
+    Part* const p = new Part;
+    p->name = LogPartName(name_, sizes_.size());
+    p->data.swap(buf_);
+    sizes_.push_back(p->data.size());
+    MutexLock ml(&mu_);
+    if (!bg_status_.ok()) {
+      delete p;
+      return bg_status_;
+    }
+    queue_.push_back(p);
+    if (pool_ != NULL) {
+      num_tasks_++;
+      pool_->Schedule(BGWork, this);
+    }
+    // Bound memory usage by uploading queued parts ourselves
+    while (queue_.size() > (pool_ != NULL ? kMaxQueuedParts : 0)) {
+      UploadNext();
+    }
+    return bg_status_;
+  }
+
+  // Upload the part at the front of the queue.
+  // REQUIRES: mu_ has been locked and the queue is not empty.
+  void UploadNext() {
+    mu_.AssertHeld();
+    assert(!queue_.empty());
+    Part* const p = queue_.front();
+    queue_.pop_front();
+    num_uploads_++;
+    mu_.Unlock();
+    Status status = osd_->Put(p->name.c_str(), p->data);
+    delete p;
+    mu_.Lock();
+    assert(num_uploads_ > 0);
+    num_uploads_--;
+    if (!status.ok() && bg_status_.ok()) {
+      bg_status_ = status;
+    }
+    cv_.SignalAll();
+  }
+
+  static void BGWork(void* arg) {
+    MultipartWritableObject* const f =
+        reinterpret_cast<MultipartWritableObject*>(arg);
+    MutexLock ml(&f->mu_);
+    // Parts may have already been uploaded by the writer
+    if (!f->queue_.empty()) {
+      f->UploadNext();
+    }
+    assert(f->num_tasks_ > 0);
+    f->num_tasks_--;
+    f->cv_.SignalAll();
+  }
+
+  // Max number of parts waiting for a pool thread before the writer starts
+  // uploading parts itself
+  static const size_t kMaxQueuedParts = 4;
+
+  // No copying allowed
+  void operator=(const MultipartWritableObject& other);
+  MultipartWritableObject(const MultipartWritableObject&);
+
+  Osd* const osd_;
+  const std::string name_;  // Name of the manifest object
+  const size_t part_size_;
+  ThreadPool* const pool_;
+  // State below is only accessed by the writer
+  std::string buf_;              // Data of the part being filled
+  std::vector<uint64_t> sizes_;  // Sizes of all parts cut so far
+  bool closed_;
+  // State below is protected by mu_
+  port::Mutex mu_;
+  port::CondVar cv_;
+  std::deque<Part*> queue_;  // Parts waiting to be uploaded
+  int num_uploads_;          // Number of uploads in progress
+  int num_tasks_;            // Number of scheduled background tasks
+  Status bg_status_;
+};
+
+// Read a log written by MultipartWritableObject as if it was a single file.
+// Parts are opened on their first access. Reads spanning multiple parts are
+// assembled in the caller's buffer.
+class MultipartRandomAccessObject : public RandomAccessFile {
+ public:
+  MultipartRandomAccessObject(Osd* osd, const std::string& name,
+                              const std::vector<uint64_t>& sizes)
+      : osd_(osd), name_(name), parts_(sizes.size(), NULL) {
+    offsets_.push_back(0);
+    for (size_t i = 0; i < sizes.size(); i++) {
+      offsets_.push_back(offsets_.back() + sizes[i]);
+    }
+  }
+
+  virtual ~MultipartRandomAccessObject() {
+    for (size_t i = 0; i < parts_.size(); i++) {
+      delete parts_[i];
+    }
+  }
+
+  uint64_t Size() const { return offsets_.back(); }
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    *result = Slice();
+    if (offset >= Size()) {
+      return Status::OK();
+    }
+    n = static_cast<size_t>(std::min<uint64_t>(n, Size() - offset));
+    size_t i = std::upper_bound(offsets_.begin(), offsets_.end(), offset) -
+               offsets_.begin() - 1;
+    RandomAccessFile* part;
+    Status status = OpenPart(i, &part);
+    if (status.ok() && offset + n <= offsets_[i + 1]) {  // Within a part
+      return part->Read(offset - offsets_[i], n, result, scratch);
+    }
+    size_t done = 0;
+    while (status.ok() && done < n) {
+      const uint64_t off = offset + done;
+      const size_t len = static_cast<size_t>(
+          std::min<uint64_t>(n - done, offsets_[i + 1] - off));
+      Slice piece;
+      status = part->Read(off - offsets_[i], len, &piece, scratch + done);
+      if (status.ok()) {
+        if (piece.data() != scratch + done) {
+          memcpy(scratch + done, piece.data(), piece.size());
+        }
+        done += piece.size();
+        if (piece.size() != len) {
+          break;  // Premature end of part
+        } else if (done < n) {
+          status = OpenPart(++i, &part);
+        }
+      }
+    }
+    if (status.ok()) {
+      *result = Slice(scratch, done);
+    }
+    return status;
+  }
+
+ private:
+  Status OpenPart(size_t i, RandomAccessFile** result) const {
+    MutexLock ml(&mu_);
+    if (parts_[i] == NULL) {
+      Status status =
+          osd_->NewRandomAccessObj(LogPartName(name_, i).c_str(), &parts_[i]);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    *result = parts_[i];
+    return Status::OK();
+  }
+
+  // No copying allowed
+  void operator=(const MultipartRandomAccessObject& other);
+  MultipartRandomAccessObject(const MultipartRandomAccessObject&);
+
+  Osd* const osd_;
+  const std::string name_;  // Name of the manifest object
+  std::vector<uint64_t> offsets_;  // Log offset of each part, then the size
+  mutable port::Mutex mu_;
+  mutable std::vector<RandomAccessFile*> parts_;  // NULL until opened
+};
+
+// Open a file for writing, bypassing the OS page cache if "direct_io" is
+// set and supported by the file system. Write it as a multipart object if
+// "osd" is set. Otherwise, open the file through env.
+template <typename T>
+static Status NewLogFile(const std::string& fname, const T& options,
+                         WritableFile** result) {
+  if (options.osd != NULL) {
+    *result = new MultipartWritableObject(
+        options.osd, LogObjectName(fname), options.part_size, options.io_pool);
+    return Status::OK();
+  }
+#if defined(O_DIRECT)
+  if (options.direct_io) {
+    const size_t a = DirectWritableFile::kDirectIoAlignment;
+    const size_t buf_size = std::max((options.max_buf + a - 1) / a * a, a);
+    int err;  // Saved right away since close() may overwrite errno
+    int fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0) {
+      err = errno;
+    } else {
+      void* buf = NULL;
+      err = posix_memalign(&buf, a, buf_size);  // Does not set errno
+      if (err == 0) {
+        *result = new DirectWritableFile(fname, fd, static_cast<char*>(buf),
+                                         buf_size);
+        return Status::OK();
+      }
+      close(fd);
+    }
+#if VERBOSE >= 1
+    Verbose(__LOG_ARGS__, 1, "Cannot open %s with O_DIRECT: %s", fname.c_str(),
+            strerror(err));
+#endif
+  }
+#endif
+  return options.env->NewWritableFile(fname.c_str(), result);
+}
+
+template <typename T>
+static WritableFile* MaybeTrace(WritableFile* base, const T& options) {
+  if (options.tracer != NULL) {
+    return new TracedWritableFile(
+        base, options.tracer,
+        options.type == kIdxIoType ? "index_log_write" : "data_log_write");
+  } else {
+    return base;
+  }
+}
+
+template <typename T>
+static WritableFile* MaybeRateLimit(WritableFile* base, const T& options) {
+  if (options.rate_limiter != NULL) {
+    return new RateLimitedWritableFile(base, options.rate_limiter,
+                                       RateLimiter::kHigh);
+  } else {
+    return base;
+  }
+}
+
+template <typename T>
+static WritableFile* MaybeWriteAsync(WritableFile* base, const T& options) {
+  if (options.io_pool != NULL && options.max_pending_writes != 0) {
+    return new AsyncWritableFile(base, options.io_pool,
+                                 options.max_pending_writes);
+  } else {
+    return base;
+  }
+}
+
 static std::string Lrank(int rank) {
   char tmp[20];
   if (rank != -1) {
@@ -190,8 +909,10 @@ Status LogSink::Lrotate(int index, bool sync) {
       env_->CreateDir(
           p.c_str());  // Ignore error since the directory may exist already
     std::string filename = Lname(prefix_, index, opts_);
-    status = env_->NewWritableFile(filename.c_str(), &new_base);
+    status = NewLogFile(filename, opts_, &new_base);
     if (status.ok()) {
+      new_base = MaybeWriteAsync(
+          MaybeRateLimit(MaybeTrace(new_base, opts_), opts_), opts_);
       status = rlog_->Rotate(new_base);
       if (status.ok()) {
         prev_off_ = off_;  // Remember previous write offset
@@ -206,6 +927,80 @@ Status LogSink::Lrotate(int index, bool sync) {
   }
 }
 
+struct LogSink::CommitRequest {
+  CommitPreparer prepare;
+  void* arg;
+  uint64_t offset;
+  Status status;
+  bool done;
+};
+
+Status LogSink::GroupCommit(CommitPreparer prepare, void* arg,
+                            uint64_t* offset) {
+  if (mu_ == NULL) {  // No concurrent access
+    *offset = Ptell();
+    return Lwrite(prepare(arg, *offset));
+  }
+
+  CommitRequest req;
+  req.prepare = prepare;
+  req.arg = arg;
+  req.offset = 0;
+  req.done = false;
+  commit_mu_.Lock();
+  commit_queue_.push_back(&req);
+  while (!req.done && &req != commit_queue_.front()) {
+    commit_cv_.Wait();
+  }
+  if (req.done) {  // Committed by another thread
+    commit_mu_.Unlock();
+    *offset = req.offset;
+    return req.status;
+  }
+
+  // We are the group leader. Requests queued from now on
+  // will be handled by the next leader.
+  std::vector<CommitRequest*> group(commit_queue_.begin(),
+                                    commit_queue_.end());
+  commit_mu_.Unlock();
+  Status status;
+  mu_->Lock();
+  if (file_ == NULL) {
+    status = Status::Disconnected("Log already closed", filename_);
+  } else {
+    uint64_t off = Ptell();
+    for (size_t i = 0; i < group.size(); i++) {
+      CommitRequest* const r = group[i];
+      r->offset = off;
+      Slice contents = r->prepare(r->arg, off);
+      status = file_->Append(contents);
+      if (!status.ok()) {
+        break;
+      }
+      off_ += contents.size();
+      off += contents.size();
+    }
+    if (status.ok()) {
+      // File implementation may ignore the flush
+      status = file_->Flush();
+    }
+  }
+  mu_->Unlock();
+
+  commit_mu_.Lock();
+  for (size_t i = 0; i < group.size(); i++) {
+    assert(commit_queue_.front() == group[i]);
+    commit_queue_.pop_front();
+    group[i]->status = status;
+    group[i]->done = true;
+  }
+  // Wake up all committed followers and the next leader
+  commit_cv_.SignalAll();
+  commit_mu_.Unlock();
+  *offset = req.offset;
+  return status;
+}
+
 // Return the current physical write offset.
 uint64_t LogSink::Ptell() const {
   uint64_t result = off_ - prev_off_;
@@ -274,12 +1069,21 @@ LogSink::LogOptions::LogOptions()
       type(kDefIoType),
       mu(NULL),
       stats(NULL),
+      io_pool(NULL),
+      max_pending_writes(0),
+      rate_limiter(NULL),
+      direct_io(false),
+      tracer(NULL),
+      osd(NULL),
+      part_size(8 << 20),
       env(Env::Default()) {}
 
 // LogSink
 //   BufferedFile
 //   MeasuredWritableFile
 //   RollingLogFile
+//   AsyncWritableFile (if io_pool is set)
+//   RateLimitedWritableFile (if rate_limiter is set)
 //   WritableFile (from env_)
 // Return OK on success, or a non-OK status on errors.
 Status LogSink::Open(const LogOptions& opts, const std::string& prefix,
@@ -296,11 +1100,12 @@ Status LogSink::Open(const LogOptions& opts, const std::string& prefix,
         p.c_str());  // Ignore error since the directory may exist already
   std::string filename = Lname(prefix, index, opts);
   WritableFile* base = NULL;
-  Status status = env->NewWritableFile(filename.c_str(), &base);
+  Status status = NewLogFile(filename, opts, &base);
   if (!status.ok()) {
     return status;
   }
 
+  base = MaybeWriteAsync(MaybeRateLimit(MaybeTrace(base, opts), opts), opts);
   RollingLogFile* virf = NULL;
   if (opts.rotation != kNoRotation) {
     virf = new RollingLogFile(base);
@@ -344,9 +1149,58 @@ void LogSource::Unref() {
   }
 }
 
+// Number of recent reads of a file from which its hedging threshold is taken.
+static const size_t kLatencyWindow = 128;
+// Reads are not hedged until this many reads of the file have been timed.
+static const size_t kMinLatencySamples = 16;
+
+// Latencies of the most recent reads of a file, in microseconds.
+struct LogSource::ReadLatencies {
+  explicit ReadLatencies(int percentile)
+      : percentile(std::max(0, std::min(percentile, 100))),
+        num_samples(0),
+        threshold(0) {}
+
+  void Add(uint64_t micros) {
+    MutexLock ml(&mu);
+    samples[num_samples % kLatencyWindow] =
+        static_cast<uint32_t>(std::min<uint64_t>(micros, ~uint32_t(0)));
+    num_samples++;
+    // Refresh the threshold every few reads instead of after every read
+    if (num_samples >= kMinLatencySamples &&
+        num_samples % kMinLatencySamples == 0) {
+      const size_t n = std::min(num_samples, kLatencyWindow);
+      uint32_t tmp[kLatencyWindow];
+      std::copy(samples, samples + n, tmp);
+      const size_t i = std::min(n - 1, n * percentile / 100);
+      std::nth_element(tmp, tmp + i, tmp + n);
+      threshold = std::max<uint64_t>(tmp[i], 1);
+    }
+  }
+
+  // Return 0 if too few reads have been timed to tell a straggler.
+  uint64_t Threshold() {
+    MutexLock ml(&mu);
+    return threshold;
+  }
+
+  const size_t percentile;
+  port::Mutex mu;
+  uint32_t samples[kLatencyWindow];
+  size_t num_samples;
+  uint64_t threshold;
+};
+
 LogSource::~LogSource() {
+  {
+    MutexLock ml(&mu_);
+    while (num_pending_ != 0) {
+      cv_.Wait();
+    }
+  }
   for (size_t i = 0; i < num_files_; i++) {
-    delete files_[i].first;
+    delete OpenedFile(i);
+    delete files_[i].latencies;
   }
   delete[] files_;
 }
@@ -360,6 +1214,16 @@ LogSource::LogOptions::LogOptions()
       seq_stats(NULL),
       stats(NULL),
       io_size(4096),
+      mmap(false),
+      on_demand(false),
+      segment_size(0),
+      segment_buf(64 << 20),
+      pool(NULL),
+      lazy(false),
+      log_readahead(4),
+      hedge_pool(NULL),
+      hedge_percentile(95),
+      osd(NULL),
       env(Env::Default()) {}
 
 static Status OpenWithEagerSeqReads(
@@ -399,6 +1263,36 @@ static Status OpenWithEagerSeqReads(
   return status;
 }
 
+// Open a log written through an object store by reading its manifest.
+static Status MultipartOpen(
+    const std::string& filename, Osd* osd, RandomAccessFileStats* stats,
+    std::vector<std::pair<RandomAccessFile*, uint64_t> >* result) {
+  const std::string name = LogObjectName(filename);
+  std::string manifest;
+  std::vector<uint64_t> sizes;
+  Status status = osd->Get(name.c_str(), &manifest);
+  if (status.ok()) {
+    status = DecodeLogManifest(manifest, &sizes);
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+  MultipartRandomAccessObject* const base =
+      new MultipartRandomAccessObject(osd, name, sizes);
+  const uint64_t size = base->Size();
+  RandomAccessFile* file = base;
+  if (stats != NULL) {
+    file = new MonitoredRandomAccessFile(stats, base);
+  }
+#if VERBOSE >= 3
+  Verbose(__LOG_ARGS__, 3, "Reading from %s (%d parts), size=%s",
+          filename.c_str(), int(sizes.size()), PrettySize(size).c_str());
+#endif
+  result->push_back(std::make_pair(file, size));
+  return status;
+}
+
 static Status RandomAccessOpen(
     const std::string& filename, Env* env, RandomAccessFileStats* stats,
     std::vector<std::pair<RandomAccessFile*, uint64_t> >* result) {
@@ -427,41 +1321,363 @@ static Status RandomAccessOpen(
   return status;
 }
 
-// Eagerly pre-fetch the entire file data in case of index logs.
+// Number of segments read ahead when an index log is loaded in segments.
+static const int kSegmentReadahead = 4;
+
+static Status OpenWithSegmentedReads(
+    const std::string& filename, const LogSource::LogOptions& opts,
+    std::vector<std::pair<RandomAccessFile*, uint64_t> >* result) {
+  std::vector<std::pair<RandomAccessFile*, uint64_t> > tmp;
+  Status status = RandomAccessOpen(filename, opts.env, NULL, &tmp);
+  if (!status.ok()) {
+    return status;
+  }
+
+  const uint64_t size = tmp[0].second;
+  SegmentedBufferedRandomAccessFile* const file =
+      new SegmentedBufferedRandomAccessFile(tmp[0].first, size,
+                                            opts.segment_size, opts.segment_buf,
+                                            opts.pool, kSegmentReadahead);
+#if VERBOSE >= 3
+  Verbose(__LOG_ARGS__, 3, "Reading from %s (segmented), size=%s",
+          filename.c_str(), PrettySize(size).c_str());
+#endif
+  result->push_back(std::make_pair(file, size));
+  return status;
+}
+
+#if defined(_POSIX_MAPPED_FILES)
+static port::OnceType mmap_once = PDLFS_ONCE_INIT;
+static Env* mmap_env = NULL;
+
+static void InitMmapEnv() {
+  mmap_env = Env::NewMmapIoEnvWrapper(Env::Default());
+}
+
+// Map an entire file into memory. All reads then return data directly from
+// the mapped region so callers never have to copy it. The number of files
+// mapped at the same time is bounded process-wide. Return a non-OK status
+// if the file cannot be mapped, such as when the bound has been reached.
+static Status OpenWithMmap(
+    const std::string& filename, RandomAccessFileStats* stats,
+    std::vector<std::pair<RandomAccessFile*, uint64_t> >* result) {
+  port::InitOnce(&mmap_once, InitMmapEnv);
+  RandomAccessFile* base = NULL;
+  uint64_t size = 0;
+  Status status = mmap_env->NewRandomAccessFile(filename.c_str(), &base);
+  if (status.ok()) {
+    status = mmap_env->GetFileSize(filename.c_str(), &size);
+  }
+  if (status.ok() && size != 0) {
+    // Files beyond the bound are opened for regular reads instead, which
+    // return data in the caller's buffer
+    char c;
+    Slice probe;
+    status = base->Read(0, 1, &probe, &c);
+    if (status.ok() && probe.data() == &c) {
+      status = Status::BufferFull(filename, "too many mapped files");
+    }
+  }
+  if (!status.ok()) {
+    delete base;
+    return status;
+  }
+
+  RandomAccessFile* file = base;
+  if (stats != NULL) {
+    file = new MonitoredRandomAccessFile(stats, base);
+  }
+#if VERBOSE >= 3
+  Verbose(__LOG_ARGS__, 3, "Reading from %s (mmap), size=%s", filename.c_str(),
+          PrettySize(size).c_str());
+#endif
+  result->push_back(std::make_pair(file, size));
+  return status;
+}
+#endif
+
+// Eagerly pre-fetch, map, or load in segments the entire file data in case of
+// index logs unless they are to be read on demand. Map data logs if requested.
+// Set *in_place to true if reads of the file return data in place.
 // Return OK on success, or a non-OK status on errors.
 static Status TryOpenIt(
     const std::string& f, const LogSource::LogOptions& opts,
-    std::vector<std::pair<RandomAccessFile*, uint64_t> >* r) {
-  if (opts.type == kIdxIoType)
+    std::vector<std::pair<RandomAccessFile*, uint64_t> >* r, bool* in_place) {
+  *in_place = false;
+  if (opts.osd != NULL) {
+    return MultipartOpen(f, opts.osd,
+                         opts.type == kIdxIoType ? NULL : opts.stats, r);
+  }
+  if (opts.type == kIdxIoType && opts.on_demand) {
+    return RandomAccessOpen(f, opts.env, opts.stats, r);
+  }
+#if defined(_POSIX_MAPPED_FILES)
+  if (opts.mmap && opts.env == Env::Default()) {
+    Status status = OpenWithMmap(
+        f, opts.type == kIdxIoType ? NULL : opts.stats, r);
+    if (status.ok()) {
+      *in_place = true;
+      return status;
+    }
+#if VERBOSE >= 1
+    Verbose(__LOG_ARGS__, 1, "Cannot mmap %s: %s", f.c_str(),
+            status.ToString().c_str());
+#endif
+  }
+#endif
+  if (opts.type == kIdxIoType && opts.segment_size != 0) {
+    return OpenWithSegmentedReads(f, opts, r);
+  }
+  if (opts.type == kIdxIoType) {
+    *in_place = true;  // Served from the pre-fetched buffer
     return OpenWithEagerSeqReads(f, opts.io_size, opts.env, opts.seq_stats, r);
+  }
   return RandomAccessOpen(f, opts.env, opts.stats, r);
 }
 
+Status LogSource::OpenFile(size_t index, RandomAccessFile** result,
+                           bool readahead) const {
+  assert(index < num_files_);
+  File* const file = &files_[index];
+  Status status;
+  MutexLock ml(&mu_);
+  // Wait for any concurrent opening of the same file to finish
+  while ((*result = OpenedFile(index)) == NULL && file->opening) {
+    cv_.Wait();
+  }
+  if (*result != NULL) {
+    return status;
+  }
+  file->opening = true;
+  std::vector<std::pair<RandomAccessFile*, uint64_t> > r;
+  bool in_place;
+  // Open without holding the lock so that different files may be opened
+  // at the same time
+  mu_.Unlock();
+  status = TryOpenIt(Lname(prefix_, static_cast<int>(index), opts_), opts_, &r,
+                     &in_place);
+  mu_.Lock();
+  file->opening = false;
+  if (status.ok()) {
+    file->size = r[0].second;
+    file->in_place = in_place;
+    file->file.Release_Store(r[0].first);
+    *result = r[0].first;
+  }
+  cv_.SignalAll();
+  if (status.ok() && readahead && opts_.pool != NULL) {
+    const size_t end = std::min(
+        num_files_, index + 1 + static_cast<size_t>(opts_.log_readahead));
+    mu_.Unlock();
+    Prefetch(index + 1, end);
+    mu_.Lock();
+  }
+  return status;
+}
+
+struct LogSource::PendingOpen {
+  const LogSource* src;
+  size_t index;
+};
+
+void LogSource::DoOpen(void* arg) {
+  PendingOpen* const p = reinterpret_cast<PendingOpen*>(arg);
+  const LogSource* const src = p->src;
+  RandomAccessFile* f;
+  // Errors are reported again when the file is read
+  src->OpenFile(p->index, &f, false);
+  delete p;
+  MutexLock ml(&src->mu_);
+  assert(src->num_pending_ > 0);
+  src->num_pending_--;
+  src->cv_.SignalAll();
+}
+
+void LogSource::Prefetch(size_t begin, size_t end) const {
+  if (opts_.pool == NULL) {
+    return;
+  }
+  end = std::min(end, num_files_);
+  for (size_t i = begin; i < end; i++) {
+    {
+      MutexLock ml(&mu_);
+      if (OpenedFile(i) != NULL || files_[i].opening) {
+        continue;
+      }
+      num_pending_++;
+    }
+    PendingOpen* const p = new PendingOpen;
+    p->src = this;
+    p->index = i;
+    opts_.pool->Schedule(DoOpen, p);
+  }
+}
+
+// A read shared by the caller and all reads issued on its behalf.
+struct LogSource::PendingRead {
+  PendingRead() : cv(&mu), refs(1), done(false), buf(NULL) {}
+  const LogSource* src;
+  RandomAccessFile* file;
+  ReadLatencies* latencies;
+  uint64_t offset;
+  size_t n;
+  port::Mutex mu;
+  port::CondVar cv;
+  int refs;   // The caller plus reads not yet finished, protected by mu
+  bool done;  // Set by the first read to finish, protected by mu
+  Status status;
+  Slice result;
+  char* buf;  // Space holding the winning read's data, if any
+};
+
+void LogSource::ScheduleRead(PendingRead* r) const {
+  {
+    MutexLock ml(&mu_);
+    num_pending_++;
+  }
+  opts_.hedge_pool->Schedule(DoRead, r);
+}
+
+void LogSource::DoRead(void* arg) {
+  PendingRead* const r = reinterpret_cast<PendingRead*>(arg);
+  const LogSource* const src = r->src;
+  char* buf = new char[r->n];
+  Slice result;
+  const uint64_t start = CurrentMicros();
+  Status status = r->file->Read(r->offset, r->n, &result, buf);
+  r->latencies->Add(CurrentMicros() - start);
+  r->mu.Lock();
+  if (!r->done) {
+    r->done = true;
+    r->status = status;
+    r->result = result;
+    r->buf = buf;
+    buf = NULL;
+    r->cv.SignalAll();
+  }
+  const bool last = --r->refs == 0;
+  r->mu.Unlock();
+  delete[] buf;
+  if (last) {
+    delete[] r->buf;
+    delete r;
+  }
+  MutexLock ml(&src->mu_);
+  assert(src->num_pending_ > 0);
+  src->num_pending_--;
+  src->cv_.SignalAll();
+}
+
+// Read through hedge_pool and wait for the first read to finish. Issue a
+// duplicate read if none has finished within the hedging threshold of the
+// file. Reads still running when we return clean up after themselves, and
+// the log source waits for them before closing its files.
+Status LogSource::HedgedRead(size_t index, uint64_t offset, size_t n,
+                             Slice* result, char* scratch,
+                             uint64_t deadline) const {
+  PendingRead* const r = new PendingRead;
+  r->src = this;
+  r->file = OpenedFile(index);
+  r->latencies = files_[index].latencies;
+  r->offset = offset;
+  r->n = n;
+  const uint64_t threshold = r->latencies->Threshold();
+  bool hedged = threshold == 0;  // Too few samples to tell a straggler
+  const uint64_t start = CurrentMicros();
+  r->refs++;
+  ScheduleRead(r);
+  Status status;
+  r->mu.Lock();
+  while (!r->done) {
+    const uint64_t now = CurrentMicros();
+    if (deadline != 0 && now >= deadline) {
+      status = Status::TryAgain("Read deadline exceeded");
+      break;
+    } else if (!hedged && now - start >= threshold) {
+      hedged = true;
+      r->refs++;
+      r->mu.Unlock();
+      ScheduleRead(r);
+      r->mu.Lock();
+      continue;
+    }
+    uint64_t wait = ~static_cast<uint64_t>(0);
+    if (!hedged) wait = start + threshold - now;
+    if (deadline != 0) wait = std::min(wait, deadline - now);
+    if (wait == ~static_cast<uint64_t>(0)) {
+      r->cv.Wait();
+    } else {
+      r->cv.TimedWait(wait);
+    }
+  }
+  if (r->done) {
+    status = r->status;
+    if (status.ok()) {
+      if (r->result.data() == r->buf) {
+        memcpy(scratch, r->buf, r->result.size());
+        *result = Slice(scratch, r->result.size());
+      } else {  // File returned cached data
+        *result = r->result;
+      }
+    }
+  }
+  const bool last = --r->refs == 0;
+  r->mu.Unlock();
+  if (last) {
+    delete[] r->buf;
+    delete r;
+  }
+  return status;
+}
+
 Status LogSource::Open(const LogOptions& opts, const std::string& prefix,
                        LogSource** result) {
   *result = NULL;
   Status status;
   std::vector<std::pair<RandomAccessFile*, uint64_t> > sources;
+  std::vector<bool> in_place;
+  bool b;
+  size_t num_files = 1;
   if (opts.num_rotas == -1) {
-    status = TryOpenIt(Lname(prefix, opts.num_rotas, opts), opts, &sources);
+    status = TryOpenIt(Lname(prefix, opts.num_rotas, opts), opts, &sources, &b);
+    in_place.push_back(b);
+  } else if (opts.num_rotas > 0 && opts.lazy) {
+    // Only the last log is opened now. Others are opened on first access.
+    num_files = static_cast<size_t>(opts.num_rotas);
+    status =
+        TryOpenIt(Lname(prefix, opts.num_rotas - 1, opts), opts, &sources, &b);
+    in_place.push_back(b);
   } else {
     for (int i = 0; i < opts.num_rotas; i++) {
-      status = TryOpenIt(Lname(prefix, i, opts), opts, &sources);
+      status = TryOpenIt(Lname(prefix, i, opts), opts, &sources, &b);
       if (!status.ok()) {
         break;
       }
+      in_place.push_back(b);
     }
+    num_files = sources.size();
   }
 
   if (status.ok()) {
     LogSource* src = new LogSource(opts, prefix);
-    std::pair<RandomAccessFile*, uint64_t>* files =
-        new std::pair<RandomAccessFile*, uint64_t>[sources.size()];
-    for (size_t i = 0; i < sources.size(); i++) {
-      files[i].second = static_cast<uint64_t>(sources[i].second);
-      files[i].first = sources[i].first;
+    File* const files = new File[num_files];
+    const size_t off = num_files - sources.size();  // Files not yet opened
+    for (size_t i = 0; i < num_files; i++) {
+      files[i].opening = false;
+      files[i].latencies =
+          opts.hedge_pool != NULL ? new ReadLatencies(opts.hedge_percentile)
+                                  : NULL;
+      if (i < off) {
+        files[i].file.NoBarrier_Store(NULL);
+        files[i].size = 0;
+        files[i].in_place = false;
+      } else {
+        files[i].file.NoBarrier_Store(sources[i - off].first);
+        files[i].size = sources[i - off].second;
+        files[i].in_place = in_place[i - off];
+      }
     }
-    src->num_files_ = sources.size();
+    src->num_files_ = num_files;
     src->files_ = files;
     src->Ref();
 
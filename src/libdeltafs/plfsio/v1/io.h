@@ -15,16 +15,22 @@
 #include "pdlfs-common/env_files.h"
 #include "pdlfs-common/port.h"
 
+#include <deque>
 #include <map>
 #include <string>
+#include <vector>
 
 // This module provides the abstraction for accessing data stored in
 // an underlying storage using a log-structured format. Data is written,
 // append-only, into a "sink", and is read from a "source".
 
 namespace pdlfs {
+class Osd;
+class RateLimiter;
 namespace plfsio {
 
+class DirTracer;
+
 // Log types
 enum LogType {
   // Default I/O type, for data blocks
@@ -83,6 +89,30 @@ class LogSink {
     // Enable i/o stats monitoring
     WritableFileStats* stats;
 
+    // Thread pool for writing data in the background
+    // Set to NULL to write data synchronously
+    ThreadPool* io_pool;
+
+    // Max number of background writes that may be pending
+    size_t max_pending_writes;
+
+    // Charge writes to this rate limiter at high priority
+    // Set to NULL to disable
+    RateLimiter* rate_limiter;
+
+    // Bypass the OS page cache. Only supported when env is Env::Default()
+    bool direct_io;
+
+    // Record each write to the underlying storage as a trace span
+    // Set to NULL to disable
+    DirTracer* tracer;
+
+    // Write the log as objects of part_size bytes through this object store
+    // instead of as a file through env. Parts are uploaded concurrently
+    // using io_pool if it is not NULL. Set to NULL to disable.
+    Osd* osd;
+    size_t part_size;
+
     // Low-level storage abstraction
     Env* env;
   };
@@ -96,6 +126,7 @@ class LogSink {
         rlog_(vf),
         mu_(opts_.mu),
         env_(opts_.env),
+        commit_cv_(&commit_mu_),
         buf_store_(NULL),
         buf_memory_usage_(0),
         prev_off_(0),
@@ -145,6 +176,20 @@ class LogSink {
     }
   }
 
+  // Invoked to finalize a buffer right before it is appended to the log.
+  // "offset" is the physical log offset at which the returned contents
+  // will be written. The log is locked while the function is executed.
+  typedef Slice (*CommitPreparer)(void* arg, uint64_t offset);
+
+  // Append data into the storage. Concurrent callers are grouped so that a
+  // single thread writes on behalf of the entire group using one lock
+  // acquisition and one flush. The contents to write are obtained by calling
+  // "(*prepare)(arg, offset)", which may run in any thread of the group.
+  // Set *offset to the physical offset at which the contents were written.
+  // Return OK on success, or a non-OK status on errors.
+  // REQUIRES: mu_ has NOT been locked by the caller.
+  Status GroupCommit(CommitPreparer prepare, void* arg, uint64_t* offset);
+
   // Force data to be written to storage.
   // Return OK on success, or a non-OK status on errors.
   // Data previously buffered will be forcefully flushed out.
@@ -202,6 +247,13 @@ class LogSink {
   port::Mutex* const mu_;
   Env* const env_;
 
+  // Pending group commits. The one at the front is the group leader.
+  // Protected by commit_mu_
+  struct CommitRequest;
+  std::deque<CommitRequest*> commit_queue_;
+  port::Mutex commit_mu_;
+  port::CondVar commit_cv_;
+
   // State below is protected by mu_
   std::string* buf_store_;  // NULL after Finish() is called
   size_t buf_memory_usage_;
@@ -247,6 +299,47 @@ class LogSource {
     // Bulk read size
     size_t io_size;
 
+    // Map logs into memory instead of eagerly reading index logs into heap
+    // buffers or reading data logs through regular i/o. Requires env to be
+    // Env::Default(). The number of files mapped at the same time is bounded
+    // process-wide, and logs beyond the bound are read without mapping.
+    // Reads through the mapping are not reflected in seq_stats.
+    bool mmap;
+
+    // Open index logs for random access instead of eagerly fetching their
+    // contents. Used when index blocks are cached by the caller. Reads are
+    // not reflected in seq_stats. Overrides mmap.
+    bool on_demand;
+
+    // Load index logs in segments of this size on first access instead of
+    // eagerly fetching their contents. At most segment_buf bytes of segments
+    // are buffered per log. Following segments are read ahead using pool
+    // if it is not NULL. Reads are not reflected in seq_stats. Set to 0 to
+    // disable. Ignored if index logs are mapped or read on demand.
+    size_t segment_size;
+    size_t segment_buf;
+    ThreadPool* pool;
+
+    // Open rotated logs on their first access instead of opening all of them
+    // up front. The last log is always opened eagerly. Opening a log on
+    // demand also opens up to log_readahead following logs in the background
+    // using pool if it is not NULL. Ignored if the log was never rotated.
+    bool lazy;
+    int log_readahead;
+
+    // Read through tasks of hedge_pool so that a read that has taken longer
+    // than hedge_percentile of the recent reads of the same file can be
+    // hedged by a duplicate read. The first read to finish wins. Reads that
+    // return data in place, or that are given no scratch space, are never
+    // hedged. Set hedge_pool to NULL to disable.
+    ThreadPool* hedge_pool;
+    int hedge_percentile;
+
+    // Read logs written as objects through this object store instead of as
+    // files through env. See LogSink::LogOptions::osd. Set to NULL to
+    // disable.
+    Osd* osd;
+
     // Low-level storage abstraction
     Env* env;
   };
@@ -256,22 +349,37 @@ class LogSource {
   static Status Open(const LogOptions& opts, const std::string& prefix,
                      LogSource** result);
 
+  // Read n bytes from a given file. If "deadline" is not 0, a hedged read
+  // gives up and returns TryAgain once the clock reaches it.
   Status Read(uint64_t offset, size_t n, Slice* result, char* scratch,
-              size_t index = 0) {
+              size_t index = 0, uint64_t deadline = 0) {
     Status status;
     if (index < num_files_) {
-      RandomAccessFile* const f = files_[index].first;
-      status = f->Read(offset, n, result, scratch);  // May return cached data
+      RandomAccessFile* f = OpenedFile(index);
+      if (f == NULL) status = OpenFile(index, &f, true);
+      if (status.ok()) {
+        if (opts_.hedge_pool != NULL && scratch != NULL) {
+          status = HedgedRead(index, offset, n, result, scratch, deadline);
+        } else {  // May return cached data
+          status = f->Read(offset, n, result, scratch);
+        }
+      }
     } else {
       *result = Slice();  // Return empty data
     }
     return status;
   }
 
-  // Return the size of a given file
+  // Return true if reads of a given file return data in place without
+  // using the caller's buffer, such as when the file is mapped into memory.
+  bool ReadsInPlace(size_t index = 0) const {
+    return index < num_files_ && Opened(index) && files_[index].in_place;
+  }
+
+  // Return the size of a given file, or 0 if the file cannot be opened
   uint64_t Size(size_t index = 0) const {
-    if (index < num_files_) {
-      return files_[index].second;
+    if (index < num_files_ && Opened(index)) {
+      return files_[index].size;
     } else {
       return 0;
     }
@@ -289,26 +397,73 @@ class LogSource {
   uint64_t TotalSize() const {
     uint64_t result = 0;
     for (size_t i = 0; i < num_files_; i++) {
-      result += files_[i].second;
+      result += Size(i);
     }
     return result;
   }
 
+  // Open files in [begin, end) that are not yet opened in the background so
+  // that later reads of these files do not wait on their opening. A no-op
+  // unless logs are opened lazily with a thread pool.
+  void Prefetch(size_t begin, size_t end) const;
+
   void Ref() { refs_++; }
   void Unref();
 
  private:
   LogSource(const LogOptions& opts, const std::string& p)
-      : opts_(opts), prefix_(p), files_(NULL), num_files_(0), refs_(0) {}
+      : opts_(opts),
+        prefix_(p),
+        cv_(&mu_),
+        num_pending_(0),
+        files_(NULL),
+        num_files_(0),
+        refs_(0) {}
   ~LogSource();
   // No copying allowed
   void operator=(const LogSource& s);
   LogSource(const LogSource&);
 
+  RandomAccessFile* OpenedFile(size_t index) const {
+    return reinterpret_cast<RandomAccessFile*>(
+        files_[index].file.Acquire_Load());
+  }
+
+  bool Opened(size_t index) const {
+    RandomAccessFile* f;
+    return OpenedFile(index) != NULL || OpenFile(index, &f, true).ok();
+  }
+
+  // Open a given file unless it is already opened. Also schedule the opening
+  // of following files if "readahead" is true.
+  Status OpenFile(size_t index, RandomAccessFile** result,
+                  bool readahead) const;
+  struct PendingOpen;
+  static void DoOpen(void* arg);
+
+  struct ReadLatencies;
+  struct PendingRead;
+  Status HedgedRead(size_t index, uint64_t offset, size_t n, Slice* result,
+                    char* scratch, uint64_t deadline) const;
+  void ScheduleRead(PendingRead* r) const;
+  static void DoRead(void* arg);
+
+  struct File {
+    port::AtomicPointer file;  // NULL if not yet opened
+    uint64_t size;
+    bool in_place;
+    bool opening;  // Protected by mu_
+    ReadLatencies* latencies;  // NULL unless reads are hedged
+  };
+
   // Constant after construction
   const LogOptions opts_;
   const std::string prefix_;  // Parent directory name
-  std::pair<RandomAccessFile*, uint64_t>* files_;
+  mutable port::Mutex mu_;
+  mutable port::CondVar cv_;
+  // Number of scheduled opens and reads, protected by mu_
+  mutable int num_pending_;
+  File* files_;
   size_t num_files_;
   uint32_t refs_;
 };
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "memory.h"
+
+#include "pdlfs-common/mutexlock.h"
+
+#include <assert.h>
+
+namespace pdlfs {
+namespace plfsio {
+
+DirMemoryManager::DirMemoryManager(size_t total_budget)
+    : total_budget_(total_budget), bytes_(0), num_dirs_(0) {}
+
+DirMemoryManager::~DirMemoryManager() {
+  MutexLock ml(&mu_);
+  assert(num_dirs_ == 0);
+}
+
+size_t DirMemoryManager::NumDirs() const {
+  MutexLock ml(&mu_);
+  return num_dirs_;
+}
+
+size_t DirMemoryManager::Budget(int id) const {
+  MutexLock ml(&mu_);
+  assert(id >= 0 && size_t(id) < dirs_.size() && dirs_[id].active);
+  return dirs_[id].budget;
+}
+
+int DirMemoryManager::Register(size_t* budget) {
+  MutexLock ml(&mu_);
+  double total_rate = 0;
+  size_t id = dirs_.size();
+  for (size_t i = 0; i < dirs_.size(); i++) {
+    if (dirs_[i].active) {
+      total_rate += dirs_[i].rate;
+    } else if (id == dirs_.size()) {
+      id = i;
+    }
+  }
+  if (id == dirs_.size()) {
+    dirs_.resize(id + 1);
+  }
+  DirState* const d = &dirs_[id];
+  d->active = true;
+  d->bytes = 0;
+  d->rate = num_dirs_ != 0 ? total_rate / num_dirs_ : 0;
+  num_dirs_++;
+  Rebalance();
+  *budget = d->budget;
+  return static_cast<int>(id);
+}
+
+void DirMemoryManager::Unregister(int id) {
+  MutexLock ml(&mu_);
+  assert(id >= 0 && size_t(id) < dirs_.size() && dirs_[id].active);
+  dirs_[id].active = false;
+  assert(num_dirs_ != 0);
+  num_dirs_--;
+  Rebalance();
+}
+
+size_t DirMemoryManager::Report(int id, uint64_t bytes) {
+  MutexLock ml(&mu_);
+  assert(id >= 0 && size_t(id) < dirs_.size() && dirs_[id].active);
+  dirs_[id].bytes += bytes;
+  bytes_ += bytes;
+  if (bytes_ >= total_budget_) {
+    bytes_ = 0;
+    for (size_t i = 0; i < dirs_.size(); i++) {
+      if (dirs_[i].active) {
+        dirs_[i].rate = 0.5 * dirs_[i].rate + 0.5 * dirs_[i].bytes;
+        dirs_[i].bytes = 0;
+      }
+    }
+    Rebalance();
+  }
+  return dirs_[id].budget;
+}
+
+// Reset the budgets of all registered directories according to their
+// smoothed insertion rates. Budgets are even if no directory has any rate.
+// REQUIRES: mu_ has been locked.
+void DirMemoryManager::Rebalance() {
+  mu_.AssertHeld();
+  if (num_dirs_ == 0) {
+    return;
+  }
+  double total_rate = 0;
+  for (size_t i = 0; i < dirs_.size(); i++) {
+    if (dirs_[i].active) {
+      total_rate += dirs_[i].rate;
+    }
+  }
+  const size_t even_share = total_budget_ / num_dirs_;
+  const size_t min_share = even_share / 4;
+  const double shared_budget =
+      static_cast<double>(total_budget_ - min_share * num_dirs_);
+  for (size_t i = 0; i < dirs_.size(); i++) {
+    if (!dirs_[i].active) {
+      continue;
+    } else if (total_rate == 0) {
+      dirs_[i].budget = even_share;
+    } else {
+      const double share = shared_budget * dirs_[i].rate / total_rate;
+      dirs_[i].budget = min_share + static_cast<size_t>(share);
+    }
+  }
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
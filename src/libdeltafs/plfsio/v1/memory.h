@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "pdlfs-common/port.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace pdlfs {
+namespace plfsio {
+
+// Divide a single memtable budget among all directories registered with it.
+// Directory writers report the bytes they insert and get a new memtable
+// budget in return. Once the directories have inserted as many bytes as the
+// total budget since the last rebalance, each directory's budget is reset in
+// proportion to its smoothed insertion rate, with every directory keeping at
+// least a quarter of its even share. Newly registered directories are given
+// the average rate of the others. Budgets of directories are only reset when
+// they report, so an idle directory shrinks on its next write or epoch flush.
+// Implementation is thread-safe.
+class DirMemoryManager {
+ public:
+  explicit DirMemoryManager(size_t total_budget);
+  // REQUIRES: No directory is registered.
+  ~DirMemoryManager();
+
+  size_t total_budget() const { return total_budget_; }
+  // Number of directories registered.
+  size_t NumDirs() const;
+  // Current budget of a registered directory.
+  size_t Budget(int id) const;
+
+  // Register a new directory. Set *budget to its initial memtable budget and
+  // return an id for the directory's future calls.
+  int Register(size_t* budget);
+  void Unregister(int id);
+
+  // Report that "bytes" have been inserted into a directory since its last
+  // report. Return the directory's current budget.
+  size_t Report(int id, uint64_t bytes);
+
+ private:
+  struct DirState {
+    bool active;
+    uint64_t bytes;  // Bytes inserted since the last rebalance
+    double rate;     // Smoothed bytes inserted per rebalance
+    size_t budget;
+  };
+  void Rebalance();
+
+  const size_t total_budget_;
+  mutable port::Mutex mu_;
+  // State below is protected by mu_
+  uint64_t bytes_;  // Bytes inserted by all directories since last rebalance
+  size_t num_dirs_;
+  std::vector<DirState> dirs_;  // Indexed by id. Slots are reused
+
+  // No copying allowed
+  void operator=(const DirMemoryManager&);
+  DirMemoryManager(const DirMemoryManager&);
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
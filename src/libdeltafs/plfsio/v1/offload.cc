@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "offload.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+
+#include <algorithm>
+
+namespace pdlfs {
+namespace plfsio {
+
+OffloadOptions::OffloadOptions()
+    : dir_id(0),
+      buffer_size(4 << 20),
+      max_inflight_buffers(2),
+      pool(NULL) {}
+
+CompactionServer::~CompactionServer() {}
+
+OffloadDirWriter::~OffloadDirWriter() {}
+
+namespace {
+
+// Offload message types. Like shuffle messages, types are carried in message
+// contents, followed by the directory id and the epoch.
+enum { kData = 1, kEpochFlush = 2, kFinish = 3 };
+
+void PutHeader(std::string* dst, int type, int dir_id, int epoch) {
+  PutVarint32(dst, static_cast<uint32_t>(type));
+  PutVarint32(dst, static_cast<uint32_t>(dir_id));
+  PutVarint32(dst, static_cast<uint32_t>(epoch));
+}
+
+class CompactionServerImpl : public CompactionServer, public rpc::If {
+ public:
+  CompactionServerImpl(DirWriter* const* dirs, int n) : dirs_(dirs, dirs + n) {}
+  virtual ~CompactionServerImpl() {}
+
+  virtual rpc::If* Receiver() { return this; }
+  // Always return OK.
+  virtual Status Call(Message& in, Message& out) RPCNOEXCEPT;
+
+ private:
+  Status HandleMessage(Slice input);
+
+  const std::vector<DirWriter*> dirs_;
+};
+
+Status CompactionServerImpl::HandleMessage(Slice input) {
+  uint32_t type, dir_id, epoch;
+  if (!GetVarint32(&input, &type) || !GetVarint32(&input, &dir_id) ||
+      !GetVarint32(&input, &epoch)) {
+    return Status::InvalidArgument("Bad offload message");
+  } else if (dir_id >= dirs_.size()) {
+    return Status::InvalidArgument("Bad dir id");
+  }
+  DirWriter* const dst = dirs_[dir_id];
+  const int e = static_cast<int>(epoch);
+  if (type == kData) {
+    uint32_t n;
+    // Each record takes at least two bytes for its key and value lengths
+    if (!GetVarint32(&input, &n) || n > input.size() / 2) {
+      return Status::InvalidArgument("Bad offload message");
+    }
+    std::vector<Slice> keys(n), values(n);
+    for (uint32_t i = 0; i < n; i++) {
+      if (!GetLengthPrefixedSlice(&input, &keys[i]) ||
+          !GetLengthPrefixedSlice(&input, &values[i])) {
+        return Status::InvalidArgument("Bad offload message");
+      }
+    }
+    if (n == 0) {
+      return Status::OK();
+    }
+    return dst->AddBatch(&keys[0], &values[0], n, e);
+  } else if (type == kEpochFlush) {
+    return dst->EpochFlush(e);
+  } else if (type == kFinish) {
+    return dst->Finish();
+  } else {
+    return Status::NotSupported(Slice());
+  }
+}
+
+Status CompactionServerImpl::Call(Message& in, Message& out) RPCNOEXCEPT {
+  Status s = HandleMessage(in.contents);
+  char* const p = EncodeVarint32(out.buf, static_cast<uint32_t>(s.err_code()));
+  out.contents = Slice(out.buf, p - out.buf);
+  return Status::OK();
+}
+
+class OffloadDirWriterImpl : public OffloadDirWriter {
+ public:
+  OffloadDirWriterImpl(const OffloadOptions& options, rpc::If* stub);
+  virtual ~OffloadDirWriterImpl();
+
+  virtual Status Add(const Slice& key, const Slice& value, int epoch);
+  virtual Status EpochFlush(int epoch);
+  virtual Status Finish();
+
+ private:
+  struct Buffer;
+  static void BGSend(void*);
+  Status Send(const std::string& msg);
+  Status SendBuffer();
+  Status WaitForSends();
+
+  const OffloadOptions options_;
+  rpc::If* const stub_;
+
+  // State below is only accessed by writers
+  int epoch_;
+  bool finished_;
+  std::string buf_;  // Packed records of the current epoch
+  uint32_t buf_count_;
+
+  port::Mutex mu_;
+  port::CondVar cv_;
+  // State below is protected by mu_
+  int num_inflight_;
+  Status bg_status_;
+};
+
+OffloadDirWriterImpl::OffloadDirWriterImpl(const OffloadOptions& options,
+                                           rpc::If* stub)
+    : options_(options),
+      stub_(stub),
+      epoch_(0),
+      finished_(false),
+      buf_count_(0),
+      cv_(&mu_),
+      num_inflight_(0) {}
+
+OffloadDirWriterImpl::~OffloadDirWriterImpl() {
+  MutexLock ml(&mu_);
+  while (num_inflight_ != 0) {
+    cv_.Wait();
+  }
+}
+
+// Send a message to the server and wait for it to be processed.
+Status OffloadDirWriterImpl::Send(const std::string& msg) {
+  rpc::If::Message in;
+  in.contents = msg;
+  rpc::If::Message out;
+  Status s = stub_->Call(in, out);
+  if (s.ok()) {
+    uint32_t err;
+    Slice reply = out.contents;
+    if (!GetVarint32(&reply, &err)) {
+      s = Status::Corruption("Bad offload reply");
+    } else if (err != 0) {
+      s = Status::FromCode(static_cast<int>(err));
+    }
+  }
+  return s;
+}
+
+struct OffloadDirWriterImpl::Buffer {
+  OffloadDirWriterImpl* writer;
+  std::string msg;
+};
+
+void OffloadDirWriterImpl::BGSend(void* arg) {
+  Buffer* const b = reinterpret_cast<Buffer*>(arg);
+  OffloadDirWriterImpl* const w = b->writer;
+  Status status = w->Send(b->msg);
+  delete b;
+  MutexLock ml(&w->mu_);
+  if (!status.ok() && w->bg_status_.ok()) {
+    w->bg_status_ = status;
+  }
+  assert(w->num_inflight_ > 0);
+  w->num_inflight_--;
+  w->cv_.SignalAll();
+}
+
+// Ship all buffered records to the server. Buffers are sent in the background
+// when a thread pool is available, in which case the caller is blocked while
+// options_.max_inflight_buffers buffers are being sent.
+Status OffloadDirWriterImpl::SendBuffer() {
+  std::string msg;
+  msg.reserve(buf_.size() + 20);
+  PutHeader(&msg, kData, options_.dir_id, epoch_);
+  PutVarint32(&msg, buf_count_);
+  msg.append(buf_);
+  buf_.clear();
+  buf_count_ = 0;
+  if (options_.pool == NULL) {
+    return Send(msg);
+  }
+  MutexLock ml(&mu_);
+  while (bg_status_.ok() &&
+         num_inflight_ >= std::max(options_.max_inflight_buffers, 1)) {
+    cv_.Wait();
+  }
+  if (!bg_status_.ok()) {
+    return bg_status_;
+  }
+  num_inflight_++;
+  Buffer* const b = new Buffer;
+  b->writer = this;
+  b->msg.swap(msg);
+  options_.pool->Schedule(BGSend, b);
+  return Status::OK();
+}
+
+// Wait for all buffers in flight to be processed by the server.
+Status OffloadDirWriterImpl::WaitForSends() {
+  MutexLock ml(&mu_);
+  while (num_inflight_ != 0) {
+    cv_.Wait();
+  }
+  return bg_status_;
+}
+
+Status OffloadDirWriterImpl::Add(const Slice& key, const Slice& value,
+                                 int epoch) {
+  if (finished_) {
+    return Status::AssertionFailed("Plfsdir already finished");
+  } else if (epoch != epoch_) {
+    return Status::AssertionFailed("Bad epoch num");
+  }
+  PutLengthPrefixedSlice(&buf_, key);
+  PutLengthPrefixedSlice(&buf_, value);
+  buf_count_++;
+  if (buf_.size() >= options_.buffer_size) {
+    return SendBuffer();
+  } else {
+    return Status::OK();
+  }
+}
+
+Status OffloadDirWriterImpl::EpochFlush(int epoch) {
+  if (finished_) {
+    return Status::AssertionFailed("Plfsdir already finished");
+  } else if (epoch != epoch_) {
+    return Status::AssertionFailed("Bad epoch num");
+  }
+  Status s;
+  if (buf_count_ != 0) {
+    s = SendBuffer();
+  }
+  // All records of the epoch must reach the server before the epoch is
+  // flushed there
+  if (s.ok()) {
+    s = WaitForSends();
+  }
+  if (s.ok()) {
+    std::string msg;
+    PutHeader(&msg, kEpochFlush, options_.dir_id, epoch_);
+    s = Send(msg);
+  }
+  if (s.ok()) {
+    epoch_++;
+  }
+  return s;
+}
+
+Status OffloadDirWriterImpl::Finish() {
+  if (finished_) {
+    return Status::AssertionFailed("Plfsdir already finished");
+  }
+  Status s;
+  if (buf_count_ != 0) {
+    s = SendBuffer();
+  }
+  if (s.ok()) {
+    s = WaitForSends();
+  }
+  if (s.ok()) {
+    std::string msg;
+    PutHeader(&msg, kFinish, options_.dir_id, epoch_);
+    s = Send(msg);
+  }
+  if (s.ok()) {
+    finished_ = true;
+  }
+  return s;
+}
+
+}  // namespace
+
+Status CompactionServer::Open(DirWriter* const* dirs, int n,
+                              CompactionServer** result) {
+  if (n < 1) {
+    return Status::InvalidArgument("No dirs to serve");
+  }
+  *result = new CompactionServerImpl(dirs, n);
+  return Status::OK();
+}
+
+Status OffloadDirWriter::Open(const OffloadOptions& options, rpc::If* stub,
+                              OffloadDirWriter** result) {
+  if (options.dir_id < 0) {
+    return Status::InvalidArgument("Bad dir id");
+  } else if (stub == NULL) {
+    return Status::InvalidArgument("No compaction server");
+  }
+  *result = new OffloadDirWriterImpl(options, stub);
+  return Status::OK();
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
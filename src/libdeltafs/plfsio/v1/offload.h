@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "v1.h"
+
+#include "pdlfs-common/rpc.h"
+
+#include <vector>
+
+namespace pdlfs {
+class ThreadPool;
+namespace plfsio {
+
+struct OffloadOptions {
+  OffloadOptions();
+
+  // Id of the directory written by the client. Selects one of the directories
+  // hosted by the compaction server.
+  // Default: 0
+  int dir_id;
+
+  // Records are buffered by the client and shipped to the compaction server
+  // once this many bytes have been accumulated. Buffers larger than the
+  // bulk_threshold of the underlying rpc are moved through bulk transfers.
+  // Default: 4MB
+  size_t buffer_size;
+
+  // Max number of buffers that may be in flight at the same time. Writers
+  // are blocked once this many buffers are being sent.
+  // Default: 2
+  int max_inflight_buffers;
+
+  // If not NULL, buffers are sent in the background using this thread pool
+  // so that writers may fill a new buffer while previous ones are being sent.
+  // Otherwise, buffers are sent synchronously by writers.
+  // Default: NULL
+  ThreadPool* pool;
+};
+
+// Runs on a dedicated compaction node and writes the directories of a set of
+// remote clients. Records received from a client are inserted into its
+// directory, where they are sorted, indexed, filtered, and written to the
+// directory's logs by the directory's own compactions. Directories written
+// this way are identical to directories written locally.
+class CompactionServer {
+ public:
+  CompactionServer() {}
+  virtual ~CompactionServer();
+
+  // Create a server writing into "dirs", where dirs[i] is written by the
+  // client whose dir_id is i. Directories are not owned by the server and
+  // must remain alive until the server is deleted.
+  // Return OK on success, or a non-OK status on errors.
+  static Status Open(DirWriter* const* dirs, int n, CompactionServer** result);
+
+  // Return the handler for messages sent by clients. This is to be registered
+  // as the server callback (RPCOptions::fs) of the server's rpc instance.
+  virtual rpc::If* Receiver() = 0;
+
+ private:
+  // No copying allowed
+  void operator=(const CompactionServer&);
+  CompactionServer(const CompactionServer&);
+};
+
+// Writes a directory through a remote compaction server. Records are only
+// buffered locally. Sorting, filter building, block encoding, and log writes
+// are all done by the server, so a writer only pays for copying records into
+// buffers and sending them out.
+class OffloadDirWriter {
+ public:
+  OffloadDirWriter() {}
+  virtual ~OffloadDirWriter();
+
+  // Create a writer sending records to a compaction server through "stub".
+  // The stub is not owned by the writer and must remain alive until the
+  // writer is deleted.
+  // Return OK on success, or a non-OK status on errors.
+  static Status Open(const OffloadOptions& options, rpc::If* stub,
+                     OffloadDirWriter** result);
+
+  // Append a record into the current epoch.
+  // REQUIRES: epoch is the current epoch. External synchronization.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status Add(const Slice& key, const Slice& value, int epoch) = 0;
+
+  // Ship all buffered records of the current epoch and have the server flush
+  // the epoch of the directory.
+  // REQUIRES: External synchronization.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status EpochFlush(int epoch) = 0;
+
+  // Have the server finish the directory. No further writes are accepted.
+  // REQUIRES: External synchronization.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status Finish() = 0;
+
+ private:
+  // No copying allowed
+  void operator=(const OffloadDirWriter&);
+  OffloadDirWriter(const OffloadDirWriter&);
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "offload.h"
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
+
+#include <stdio.h>
+
+namespace pdlfs {
+namespace plfsio {
+
+static const int kClients = 2;
+static const int kEpochs = 2;
+static const int kKeysPerClient = 5000;
+
+class OffloadTest {
+ public:
+  OffloadTest() : server_(NULL) {
+    dirname_ = test::TmpDir() + "/offload_test";
+    options_.env = Env::Default();
+    oopts_.buffer_size = 8 << 10;
+    DestroyDir(dirname_, options_);
+    for (int i = 0; i < kClients; i++) {
+      DirOptions options = options_;
+      options.rank = i;
+      ASSERT_OK(DirWriter::Open(options, dirname_, &dirs_[i]));
+      clients_[i] = NULL;
+    }
+    ASSERT_OK(CompactionServer::Open(dirs_, kClients, &server_));
+  }
+
+  ~OffloadTest() {
+    for (int i = 0; i < kClients; i++) {
+      delete clients_[i];
+    }
+    delete server_;
+    for (int i = 0; i < kClients; i++) {
+      delete dirs_[i];
+    }
+  }
+
+  void OpenClients() {
+    for (int i = 0; i < kClients; i++) {
+      OffloadOptions oopts = oopts_;
+      oopts.dir_id = i;
+      ASSERT_OK(OffloadDirWriter::Open(oopts, server_->Receiver(),
+                                       &clients_[i]));
+    }
+  }
+
+  void Run() {
+    char tmp[20];
+    for (int e = 0; e < kEpochs; e++) {
+      for (int i = 0; i < kKeysPerClient; i++) {
+        for (int c = 0; c < kClients; c++) {
+          snprintf(tmp, sizeof(tmp), "%06d", i * kClients + c);
+          ASSERT_OK(clients_[c]->Add(tmp, std::string(1, 'a' + e), e));
+        }
+      }
+      for (int c = 0; c < kClients; c++) {
+        ASSERT_OK(clients_[c]->EpochFlush(e));
+      }
+    }
+    for (int c = 0; c < kClients; c++) {
+      ASSERT_OK(clients_[c]->Finish());
+    }
+  }
+
+  // Check that every directory holds exactly the records of its client.
+  void Check() {
+    char tmp[20];
+    for (int c = 0; c < kClients; c++) {
+      DirOptions options = options_;
+      options.rank = c;
+      DirReader* reader;
+      ASSERT_OK(DirReader::Open(options, dirname_, &reader));
+      DirReader::CountOp count_op;
+      size_t n = 0;
+      ASSERT_OK(reader->Count(count_op, &n));
+      ASSERT_EQ(n, kEpochs * kKeysPerClient);
+      DirReader::ReadOp read_op;
+      for (int i = 0; i < kKeysPerClient; i += 7) {
+        std::string dst;
+        snprintf(tmp, sizeof(tmp), "%06d", i * kClients + c);
+        ASSERT_OK(reader->Read(read_op, tmp, &dst));
+        ASSERT_EQ(dst, "ab") << tmp;
+      }
+      delete reader;
+    }
+  }
+
+  DirOptions options_;
+  OffloadOptions oopts_;
+  std::string dirname_;
+  DirWriter* dirs_[kClients];
+  CompactionServer* server_;
+  OffloadDirWriter* clients_[kClients];
+};
+
+TEST(OffloadTest, SyncSends) {
+  OpenClients();
+  Run();
+  Check();
+}
+
+TEST(OffloadTest, BackgroundSends) {
+  ThreadPool* const pool = ThreadPool::NewFixed(4);
+  oopts_.pool = pool;
+  oopts_.max_inflight_buffers = 2;
+  OpenClients();
+  Run();
+  Check();
+  for (int i = 0; i < kClients; i++) {
+    delete clients_[i];
+    clients_[i] = NULL;
+  }
+  delete pool;
+}
+
+TEST(OffloadTest, NoWritesAfterFinish) {
+  OpenClients();
+  ASSERT_OK(clients_[0]->Add("k", "v", 0));
+  ASSERT_OK(clients_[0]->Finish());
+  ASSERT_TRUE(clients_[0]->Add("k", "v", 0).IsAssertionFailed());
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
+
+int main(int argc, char* argv[]) {
+  return pdlfs::test::RunAllTests(&argc, &argv);
+}
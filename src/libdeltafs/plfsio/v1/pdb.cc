@@ -11,6 +11,11 @@
 
 #include "pdb.h"
 
+#include "pdlfs-common/cache.h"
+
+#include <algorithm>
+#include <string.h>
+
 namespace pdlfs {
 namespace plfsio {
 
@@ -24,22 +29,24 @@ BufferedBlockWriter::BufferedBlockWriter(const DirOptions& options,
       buf_threshold_(buf_size),
       buf_reserv_(8 + buf_size),
       offset_(0),
-      bbs_(NULL),
+      num_appended_(0),
+      bufs_array_(NULL),
       n_(n) {
   if (n_ < 2) {
     n_ = 2;  // We need at least two buffers
   }
-  bbs_ = new BlockBuf*[n_];  // Allocate a requested amount of block buffers
+  // Allocate a requested amount of write buffers
+  bufs_array_ = new WriteBuf*[n_];
   for (size_t i = 0; i < n_; i++) {
-    bbs_[i] = new BlockBuf(options_, true);  // Force an unordered fmt
-    bbs_[i]->Reserve(buf_reserv_);
-    if (i != 0) {  // bbs_[0] will act as membuf_
-      bufs_.push_back(bbs_[i]);
+    bufs_array_[i] = new WriteBuf(options_);
+    bufs_array_[i]->bb.Reserve(buf_reserv_);
+    if (i != 0) {  // bufs_array_[0] will act as membuf_
+      bufs_.push_back(bufs_array_[i]);
     }
   }
 
   bloomfilter_.reserve(4 << 20);
-  membuf_ = bbs_[0];
+  membuf_ = bufs_array_[0];
 }
 
 // Wait for all outstanding compactions to clear.
@@ -50,9 +57,9 @@ BufferedBlockWriter::~BufferedBlockWriter() {
   }
   mu_.Unlock();
   for (size_t i = 0; i < n_; i++) {
-    delete bbs_[i];
+    delete bufs_array_[i];
   }
-  delete[] bbs_;
+  delete[] bufs_array_;
 }
 
 // Insert data into the writer.
@@ -95,56 +102,87 @@ Status BufferedBlockWriter::Finish() {
   return __Finish<BufferedBlockWriter>();
 }
 
+// Build the data block and the bloom filter of a buffer and then wait for
+// them to be appended. Blocks and filters of different buffers are built
+// concurrently. Appends are done in compaction seq order.
 // REQUIRES: mu_ has been LOCKed.
 Status BufferedBlockWriter::Compact(uint32_t const compac_seq, void* immbuf) {
   mu_.AssertHeld();
   assert(dst_);
-  BlockBuf* const bb = static_cast<BlockBuf*>(immbuf);
-  // Skip empty buffers
-  if (bb->empty() && compac_seq == num_compac_completed_ + 1)
-    return Status::OK();
+  WriteBuf* const buf = static_cast<WriteBuf*>(immbuf);
+  BlockBuf* const bb = &buf->bb;
   mu_.Unlock();  // Unlock as compaction is expensive
-  Slice block_contents;
+  buf->block_contents = Slice();
+  buf->filter_contents = Slice();
   if (!bb->empty()) {
-    block_contents = bb->Finish(kNoCompression);
+    buf->block_contents = bb->Finish(kNoCompression);
   }
-  BloomBuilder bf(options_);  // Filter is built only when requested
-  Slice filter_contents;
   if (!bb->empty() && options_.bf_bits_per_key != 0) {
-    bf.Reset(bb->NumEntries());
+    buf->bf.Reset(bb->NumEntries());
     BlockContents bc;
-    bc.data = block_contents;
+    bc.data = buf->block_contents;
     bc.heap_allocated = false;
     bc.cachable = false;
     Block b(bc);
     IteratorWrapper it(b.NewIterator(NULL));
     it.SeekToFirst();
     for (; it.Valid();) {
-      bf.AddKey(it.key());
+      buf->bf.AddKey(it.key());
       it.Next();
     }
-    filter_contents = bf.Finish();
+    buf->filter_contents = buf->bf.Finish();
   }
-  mu_.Lock();  // All writes are serialized through compac_seq
-  assert(num_compac_completed_ < compac_seq);
-  while (compac_seq != num_compac_completed_ + 1) {
-    bg_cv_.Wait();
+  mu_.Lock();
+  assert(num_appended_ < compac_seq);
+  pending_.insert(std::make_pair(compac_seq, buf));
+  // Append buffers if we are at the head of the line. Otherwise, wait
+  // for the buffer to be appended by the compaction ahead of us.
+  while (num_appended_ < compac_seq) {
+    if (compac_seq == num_appended_ + 1 && pending_.count(compac_seq) != 0) {
+      AppendPending();
+    } else {
+      bg_cv_.Wait();
+    }
   }
-  mu_.Unlock();
-  PutFixed64(&indexes_, bloomfilter_.size());
-  if (!filter_contents.empty())
-    bloomfilter_.append(filter_contents.data(), filter_contents.size());
-  PutFixed64(&indexes_, offset_);
-  Status status;
-  if (!block_contents.empty()) {
-    status = dst_->Append(block_contents);
+  return buf->status;
+}
+
+// Append all built buffers that immediately follow the ones already
+// appended. Only the compaction at the head of the line calls this, so
+// offset_, indexes_, and bloomfilter_ are never updated concurrently. Empty
+// buffers are skipped without an index entry, as an entry would point
+// lookups at a zero-sized block with an empty filter.
+// REQUIRES: mu_ has been LOCKed.
+void BufferedBlockWriter::AppendPending() {
+  mu_.AssertHeld();
+  std::vector<WriteBuf*> batch;
+  while (true) {
+    std::map<uint32_t, WriteBuf*>::iterator it =
+        pending_.find(num_appended_ + 1 + uint32_t(batch.size()));
+    if (it == pending_.end()) break;
+    batch.push_back(it->second);
+    pending_.erase(it);
   }
-  if (status.ok()) {
-    offset_ += block_contents.size();
-    status = dst_->Flush();
+  Status status = bg_status_;
+  mu_.Unlock();
+  for (size_t i = 0; i < batch.size(); i++) {
+    WriteBuf* const buf = batch[i];
+    if (status.ok() && !buf->block_contents.empty()) {
+      PutFixed64(&indexes_, bloomfilter_.size());
+      bloomfilter_.append(buf->filter_contents.data(),
+                          buf->filter_contents.size());
+      PutFixed64(&indexes_, offset_);
+      status = dst_->Append(buf->block_contents);
+      if (status.ok()) {
+        offset_ += buf->block_contents.size();
+        status = dst_->Flush();
+      }
+    }
+    buf->status = status;
   }
   mu_.Lock();
-  return status;
+  num_appended_ += static_cast<uint32_t>(batch.size());
+  bg_cv_.SignalAll();
 }
 
 // REQUIRES: no outstanding background compactions.
@@ -249,25 +287,102 @@ void BufferedBlockWriter::BGWork(void* arg) {
   delete s;
 }
 
+namespace {
+// Order fixed sized entries by their keys.
+struct EntryLess {
+  EntryLess(const char* base, size_t entry_size, size_t key_size)
+      : base_(base), entry_size_(entry_size), key_size_(key_size) {}
+  bool operator()(uint32_t a, uint32_t b) const {
+    return memcmp(base_ + a * entry_size_, base_ + b * entry_size_,
+                  key_size_) < 0;
+  }
+
+  const char* base_;
+  size_t entry_size_;
+  size_t key_size_;
+};
+
+// Copy the contents of an array block into a heap buffer with its entries
+// sorted by key. Entries with equal keys retain their write order. Return NULL
+// if the block is not understood.
+BlockContents* NewSortedBlock(const Slice& raw) {
+  if (raw.size() < 2 * sizeof(uint32_t)) return NULL;
+  const size_t value_size = DecodeFixed32(raw.data() + raw.size() - 8);
+  const size_t key_size = DecodeFixed32(raw.data() + raw.size() - 4);
+  if (key_size == 0) return NULL;
+  const size_t entry_size = key_size + value_size;
+  const size_t n = (raw.size() - 2 * sizeof(uint32_t)) / entry_size;
+  std::vector<uint32_t> order;
+  order.reserve(n);
+  for (size_t i = 0; i < n; i++) order.push_back(static_cast<uint32_t>(i));
+  std::stable_sort(order.begin(), order.end(),
+                   EntryLess(raw.data(), entry_size, key_size));
+  const size_t size = n * entry_size + 2 * sizeof(uint32_t);
+  char* const buf = new char[size];
+  for (size_t i = 0; i < n; i++) {
+    memcpy(buf + i * entry_size, raw.data() + order[i] * entry_size,
+           entry_size);
+  }
+  memcpy(buf + n * entry_size, raw.data() + raw.size() - 8, 8);
+  BlockContents* const result = new BlockContents;
+  result->data = Slice(buf, size);
+  result->heap_allocated = false;  // Owned by the cache
+  result->cachable = true;
+  return result;
+}
+
+void DeleteSortedBlock(const Slice& key, void* value) {
+  BlockContents* const contents = reinterpret_cast<BlockContents*>(value);
+  delete[] contents->data.data();
+  delete contents;
+}
+
+}  // namespace
+
 BufferedBlockReader::BufferedBlockReader(const DirOptions& options,
                                          RandomAccessFile* src, uint64_t src_sz)
-    : options_(options), src_(src), src_sz_(src_sz) {}
+    : options_(options),
+      src_(src),
+      src_sz_(src_sz),
+      block_cache_(options_.block_cache),
+      own_cache_(NULL),
+      cache_id_(0) {
+  if (block_cache_ == NULL && options_.block_cache_size != 0) {
+    own_cache_ = options_.scan_resistant_block_cache
+                     ? NewScanResistantCache(options_.block_cache_size)
+                     : NewLRUCache(options_.block_cache_size);
+    block_cache_ = own_cache_;
+  }
+  if (block_cache_ != NULL) {
+    cache_id_ = block_cache_->NewId();
+  }
+}
+
+BufferedBlockReader::~BufferedBlockReader() { delete own_cache_; }
+
+Status BufferedBlockReader::ReadBlock(uint64_t offset, size_t n,
+                                      std::string* buf, Slice* result) {
+  buf->resize(n);
+  Status status = src_->Read(offset, n, result, &(*buf)[0]);
+  if (status.ok()) {
+    if (result->size() != n) {
+      status = Status::IOError("Read ret partial data");
+    }
+  }
+  return status;
+}
 
 bool BufferedBlockReader::GetFrom(Status* status, const Slice& k,
                                   std::string* result, uint64_t offset,
                                   size_t n) {
+  if (block_cache_ != NULL) {
+    return GetFromCache(status, k, result, offset, n);
+  }
   BlockContents contents;
   contents.heap_allocated = false;
   contents.cachable = false;
   std::string buf;
-  buf.resize(n);
-  *status = src_->Read(offset, n, &contents.data, &buf[0]);
-  if (status->ok()) {
-    if (contents.data.size() != n) {
-      *status = Status::IOError("Read ret partial data");
-    }
-  }
-
+  *status = ReadBlock(offset, n, &buf, &contents.data);
   if (status->ok()) {
     Block block(contents);
     const Comparator* comp = NULL;  // Force linear search
@@ -282,6 +397,48 @@ bool BufferedBlockReader::GetFrom(Status* status, const Slice& k,
   return false;
 }
 
+// Search a block through the block cache. Blocks missing from the cache are
+// read, sorted, and inserted so that they can be binary searched.
+bool BufferedBlockReader::GetFromCache(Status* status, const Slice& k,
+                                       std::string* result, uint64_t offset,
+                                       size_t n) {
+  char tmp[16];
+  EncodeFixed64(tmp, cache_id_);
+  EncodeFixed64(tmp + 8, offset);
+  const Slice key(tmp, sizeof(tmp));
+  Cache::Handle* h = block_cache_->Lookup(key);
+  if (h == NULL) {
+    std::string buf;
+    Slice raw;
+    *status = ReadBlock(offset, n, &buf, &raw);
+    if (!status->ok()) {
+      return false;
+    }
+    BlockContents* const sorted = NewSortedBlock(raw);
+    if (sorted == NULL) {
+      *status = Status::Corruption("Cannot understand block contents");
+      return false;
+    }
+    h = block_cache_->Insert(key, sorted, sorted->data.size(),
+                             &DeleteSortedBlock);
+  }
+
+  bool found = false;
+  {
+    Block block(*reinterpret_cast<BlockContents*>(block_cache_->Value(h)));
+    IteratorWrapper iter(block.NewIterator(BytewiseComparator()));
+    iter.Seek(k);
+    if (iter.Valid() && iter.key() == k) {
+      *result = iter.value().ToString();
+      found = true;
+    } else if (!iter.status().ok()) {
+      *status = iter.status();
+    }
+  }
+  block_cache_->Release(h);
+  return found;
+}
+
 // Get the value for a specific key.
 Status BufferedBlockReader::Get(const Slice& k, std::string* result) {
   Status status = MaybeLoadCache();
@@ -289,27 +446,16 @@ Status BufferedBlockReader::Get(const Slice& k, std::string* result) {
     return status;
   }
 
-  assert(indexes_.size() >= 16);
-  uint64_t bloomoffset = DecodeFixed64(&indexes_[0]);
-  uint64_t offset = DecodeFixed64(&indexes_[8]);
-  uint64_t next_bloomoffset;
-  uint64_t next_offset;
-  const size_t limit = indexes_.size();
-  size_t off = 16;
-  for (; off + 15 < limit; off += 16) {
-    next_bloomoffset = DecodeFixed64(&indexes_[off]);
-    next_offset = DecodeFixed64(&indexes_[off + 8]);
-    Slice bf(bloomfilter_.data() + bloomoffset, next_bloomoffset - bloomoffset);
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    const BlockIndex& b = blocks_[i];
+    Slice bf(bloomfilter_.data() + b.bloom_offset, b.bloom_size);
     if (BloomKeyMayMatch(k, bf)) {
-      if (GetFrom(&status, k, result, offset, next_offset - offset)) {
+      if (GetFrom(&status, k, result, b.offset, b.size)) {
         break;
       } else if (!status.ok()) {
         break;
       }
     }
-
-    bloomoffset = next_bloomoffset;
-    offset = next_offset;
   }
 
   return status;
@@ -345,6 +491,30 @@ Status BufferedBlockReader::LoadIndexesAndFilters(Slice* footer) {
   bloomfilter_.remove_suffix(index_handle.size());
   if (indexes_.size() < 16) {
     cache_status_ = Status::Corruption("Indexes too short to be valid");
+    return cache_status_;
+  }
+
+  // Decode indexes into an array of block locations
+  blocks_.clear();
+  blocks_.reserve(indexes_.size() / 16);
+  uint64_t bloomoffset = DecodeFixed64(&indexes_[0]);
+  uint64_t offset = DecodeFixed64(&indexes_[8]);
+  for (size_t off = 16; off + 15 < indexes_.size(); off += 16) {
+    const uint64_t next_bloomoffset = DecodeFixed64(&indexes_[off]);
+    const uint64_t next_offset = DecodeFixed64(&indexes_[off + 8]);
+    if (next_bloomoffset < bloomoffset || next_offset < offset ||
+        next_bloomoffset > bloomfilter_.size()) {
+      cache_status_ = Status::Corruption("Bad block indexes");
+      return cache_status_;
+    }
+    BlockIndex b;
+    b.bloom_offset = bloomoffset;
+    b.bloom_size = next_bloomoffset - bloomoffset;
+    b.offset = offset;
+    b.size = next_offset - offset;
+    blocks_.push_back(b);
+    bloomoffset = next_bloomoffset;
+    offset = next_offset;
   }
 
   return cache_status_;
@@ -15,6 +15,9 @@
 #include "doublebuf.h"
 #include "filter.h"
 
+#include <map>
+#include <vector>
+
 namespace pdlfs {
 namespace plfsio {
 
@@ -26,7 +29,12 @@ struct DirOptions;
 class ArrayBlockBuilder;
 
 // Directly write data as formatted data blocks.
-// Incoming key-value pairs are assumed to be fixed sized.
+// Incoming key-value pairs are assumed to be fixed sized. Up to n - 1 full
+// buffers may be compacted concurrently, each building its own data block and
+// bloom filter. Built blocks are appended to the destination file in buffer
+// order by whichever compaction is at the head of the line, so compactions
+// that finish early never write out of order. Per-buffer filters are
+// concatenated and written once at the end.
 class BufferedBlockWriter : public DoubleBuffering {
  public:
   BufferedBlockWriter(const DirOptions& options, WritableFile* dst,
@@ -53,6 +61,17 @@ class BufferedBlockWriter : public DoubleBuffering {
   typedef ArrayBlockBuilder BlockBuf;
   typedef ArrayBlock Block;
   typedef BloomBlock BloomBuilder;
+  // A write buffer along with the block and the filter built from it. Built
+  // contents are kept in the buffer until they have been appended.
+  struct WriteBuf {
+    explicit WriteBuf(const DirOptions& options)
+        : bb(options, true /* Force an unordered fmt */), bf(options) {}
+    BlockBuf bb;
+    BloomBuilder bf;
+    Slice block_contents;
+    Slice filter_contents;
+    Status status;  // Result of the append
+  };
   const DirOptions& options_;
   WritableFile* const dst_;
   port::Mutex mu_;
@@ -63,39 +82,48 @@ class BufferedBlockWriter : public DoubleBuffering {
   uint64_t offset_;  // Current write offset
   std::string bloomfilter_;
   std::string indexes_;
+  // Built buffers waiting to be appended, ordered by compaction seq
+  std::map<uint32_t, WriteBuf*> pending_;
+  uint32_t num_appended_;  // Compactions whose buffers have been appended
 
   friend class DoubleBuffering;
   Status Compact(uint32_t seq, void* buf);
+  void AppendPending();
   Status SyncBackend(bool close = false);
   Status DumpIndexesAndFilters();
   Status Close();
   void ScheduleCompaction(uint32_t seq, void* buf);
-  void Clear(void* buf) { static_cast<BlockBuf*>(buf)->Reset(); }
+  void Clear(void* buf) { static_cast<WriteBuf*>(buf)->bb.Reset(); }
   void AddToBuffer(void* buf, const Slice& k, const Slice& v) {
-    static_cast<BlockBuf*>(buf)->Add(k, v);
+    static_cast<WriteBuf*>(buf)->bb.Add(k, v);
   }
   bool HasRoom(const void* buf, const Slice& k, const Slice& v) {
-    return (static_cast<const BlockBuf*>(buf)->CurrentSizeEstimate() +
+    return (static_cast<const WriteBuf*>(buf)->bb.CurrentSizeEstimate() +
                 k.size() + v.size() <=
             buf_threshold_);
   }
   bool IsEmpty(const void* buf) {
-    return static_cast<const BlockBuf*>(buf)->empty();
+    return static_cast<const WriteBuf*>(buf)->bb.empty();
   }
 
   static void BGWork(void*);
 
   BlockHandle bloomfilter_handle_;
   BlockHandle index_handle_;
-  BlockBuf** bbs_;
+  WriteBuf** bufs_array_;
   size_t n_;
 };
 
-// Read data written by a BufferedBlockWriter.
+// Read data written by BufferedBlockWriter. Block indexes are decoded into
+// an in-memory array once when loaded. If options.block_cache is set, or
+// options.block_cache_size is non-zero, blocks are sorted by key once read
+// and kept in an LRU cache so that subsequent lookups into them are
+// binary searches that require no I/O.
 class BufferedBlockReader {
  public:
   BufferedBlockReader(const DirOptions& options, RandomAccessFile* src,
                       uint64_t src_sz);
+  ~BufferedBlockReader();
 
   Status Get(const Slice& k, std::string* result);
 
@@ -110,11 +138,26 @@ class BufferedBlockReader {
 
   bool GetFrom(Status* status, const Slice& k, std::string* result,
                uint64_t off, size_t n);
+  bool GetFromCache(Status* status, const Slice& k, std::string* result,
+                    uint64_t off, size_t n);
+  Status ReadBlock(uint64_t off, size_t n, std::string* buf, Slice* result);
   Status LoadIndexesAndFilters(Slice* footer);
   Status MaybeLoadCache();
 
+  // Location of a data block and its filter
+  struct BlockIndex {
+    uint64_t bloom_offset;
+    uint64_t bloom_size;
+    uint64_t offset;
+    uint64_t size;
+  };
+  std::vector<BlockIndex> blocks_;
   Slice bloomfilter_;
   Slice indexes_;
+
+  Cache* block_cache_;  // May be NULL
+  Cache* own_cache_;    // Private block cache, if options_.block_cache was NULL
+  uint64_t cache_id_;
 };
 
 }  // namespace plfsio
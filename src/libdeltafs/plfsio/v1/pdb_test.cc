@@ -67,6 +67,67 @@ class EmulatedEnv : public EnvWrapper {
 
 }  // namespace
 
+class PdbTest {
+ public:
+  PdbTest() {
+    fname_ = test::TmpDir() + "/pdb_test.tbl";
+    thread_pool_ = ThreadPool::NewFixed(2, true);
+    options_.compaction_pool = thread_pool_;
+    options_.key_size = 8;
+    options_.value_size = 8;
+    options_.bf_bits_per_key = 10;
+  }
+
+  ~PdbTest() {
+    Env::Default()->DeleteFile(fname_.c_str());
+    delete thread_pool_;
+  }
+
+  std::string fname_;
+  ThreadPool* thread_pool_;
+  DirOptions options_;
+};
+
+// Buffers left empty by a forced compaction must not break reads
+TEST(PdbTest, EmptyBuffers) {
+  Env* const env = Env::Default();
+  WritableFile* dst;
+  ASSERT_OK(env->NewWritableFile(fname_.c_str(), &dst));
+  BufferedBlockWriter* pdb =
+      new BufferedBlockWriter(options_, dst, 4 << 10, 4);
+  char tmp[8];
+  Slice key(tmp, sizeof(tmp));
+  for (int i = 0; i < 3000; i++) {
+    EncodeFixed64(tmp, i);
+    ASSERT_OK(pdb->Add(key, key));
+    if (i % 1000 == 999) {
+      ASSERT_OK(pdb->Flush());
+      ASSERT_OK(pdb->Flush());  // Compacts an empty buffer
+    }
+  }
+  ASSERT_OK(pdb->Finish());
+  delete pdb;
+  delete dst;
+
+  uint64_t size;
+  ASSERT_OK(env->GetFileSize(fname_.c_str(), &size));
+  RandomAccessFile* src;
+  ASSERT_OK(env->NewRandomAccessFile(fname_.c_str(), &src));
+  BufferedBlockReader* reader = new BufferedBlockReader(options_, src, size);
+  for (int i = 0; i < 3000; i++) {
+    EncodeFixed64(tmp, i);
+    std::string value;
+    ASSERT_OK(reader->Get(key, &value));
+    ASSERT_EQ(value, key.ToString());
+  }
+  std::string value;
+  EncodeFixed64(tmp, 3000);  // Missing key
+  ASSERT_OK(reader->Get(key, &value));
+  ASSERT_TRUE(value.empty());
+  delete reader;
+  delete src;
+}
+
 // Measure implementation's bandwidth utilization under
 // different configurations.
 class PdbBench {
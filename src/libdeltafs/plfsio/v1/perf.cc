@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "perf.h"
+
+#include "pdlfs-common/metrics.h"
+#include "pdlfs-common/port.h"
+
+#include <stdio.h>
+#include <string.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace pdlfs {
+namespace plfsio {
+
+namespace {
+#if defined(__linux__) && defined(__NR_perf_event_open)
+// Hardware events in the order their counts are read from a counter group
+const uint64_t kHwEvents[4] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,  // Usually last level cache misses
+    PERF_COUNT_HW_BRANCH_MISSES};
+
+struct PerfThreadState {
+  int fds[4];  // fds[0] is the group leader
+  bool ok;
+};
+
+port::OnceType perf_once = PDLFS_ONCE_INIT;
+pthread_key_t perf_key;
+
+void DeletePerfThreadState(void* arg) {
+  PerfThreadState* const state = static_cast<PerfThreadState*>(arg);
+  for (int i = 3; i >= 0; i--) {
+    if (state->fds[i] != -1) {
+      close(state->fds[i]);
+    }
+  }
+  delete state;
+}
+
+void InitPerfKey() { pthread_key_create(&perf_key, DeletePerfThreadState); }
+
+int OpenHwCounter(uint64_t config, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  // Count the calling thread on any cpu
+  return static_cast<int>(
+      syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+// Return the counter group of the calling thread, opening it if this is the
+// first call by the thread.
+PerfThreadState* GetPerfThreadState() {
+  port::InitOnce(&perf_once, InitPerfKey);
+  PerfThreadState* state =
+      static_cast<PerfThreadState*>(pthread_getspecific(perf_key));
+  if (state != NULL) {
+    return state;
+  }
+  state = new PerfThreadState;
+  state->ok = true;
+  for (int i = 0; i < 4; i++) {
+    state->fds[i] = -1;
+  }
+  for (int i = 0; i < 4; i++) {
+    state->fds[i] = OpenHwCounter(kHwEvents[i], i == 0 ? -1 : state->fds[0]);
+    if (state->fds[i] == -1) {  // Counters are used all together or not at all
+      state->ok = false;
+      break;
+    }
+  }
+  pthread_setspecific(perf_key, state);
+  return state;
+}
+
+bool ReadHwCounters(uint64_t* values) {
+  PerfThreadState* const state = GetPerfThreadState();
+  if (!state->ok) {
+    return false;
+  }
+  uint64_t buf[1 + 4];  // Number of counters followed by their values
+  if (read(state->fds[0], buf, sizeof(buf)) !=
+          static_cast<ssize_t>(sizeof(buf)) ||
+      buf[0] != 4) {
+    return false;
+  }
+  memcpy(values, buf + 1, 4 * sizeof(uint64_t));
+  return true;
+}
+#else
+bool ReadHwCounters(uint64_t* values) { return false; }
+#endif
+
+const char* const kCounterNames[] = {
+    "count",        "micros",     "cycles",
+    "instructions", "llc_misses", "branch_misses"};
+
+}  // namespace
+
+DirPerfCounts::DirPerfCounts()
+    : count(0),
+      micros(0),
+      cycles(0),
+      instructions(0),
+      llc_misses(0),
+      branch_misses(0) {}
+
+const char* DirPerfCounters::StageName(DirPerfStage stage) {
+  switch (stage) {
+    case kPerfSort:
+      return "sort";
+    case kPerfTableBuild:
+      return "table_build";
+    case kPerfFilterBuild:
+      return "filter_build";
+    case kPerfFilterProbe:
+      return "filter_probe";
+    case kPerfBlockRead:
+      return "block_read";
+    case kPerfBlockSearch:
+      return "block_search";
+    default:
+      return "unknown";
+  }
+}
+
+bool DirPerfCounters::HardwareCountersAvailable() {
+  uint64_t values[4];
+  return ReadHwCounters(values);
+}
+
+DirPerfCounters::DirPerfCounters(MetricsRegistry* registry,
+                                 const std::string& prefix)
+    : own_registry_(NULL) {
+  if (registry == NULL) {
+    own_registry_ = new MetricsRegistry;
+    registry = own_registry_;
+  }
+  for (int i = 0; i < kNumPerfStages; i++) {
+    const std::string stage =
+        prefix + "." + StageName(static_cast<DirPerfStage>(i)) + ".";
+    for (int j = 0; j < kNumCounters; j++) {
+      counters_[i][j] = registry->GetCounter(stage + kCounterNames[j]);
+    }
+  }
+}
+
+DirPerfCounters::~DirPerfCounters() { delete own_registry_; }
+
+void DirPerfCounters::Add(DirPerfStage stage, const DirPerfCounts& delta) {
+  MetricsCounter* const* const c = counters_[stage];
+  c[0]->Add(delta.count);
+  c[1]->Add(delta.micros);
+  if (delta.cycles != 0 || delta.instructions != 0) {
+    c[2]->Add(delta.cycles);
+    c[3]->Add(delta.instructions);
+    c[4]->Add(delta.llc_misses);
+    c[5]->Add(delta.branch_misses);
+  }
+}
+
+DirPerfCounts DirPerfCounters::Get(DirPerfStage stage) const {
+  MetricsCounter* const* const c = counters_[stage];
+  DirPerfCounts result;
+  result.count = c[0]->Value();
+  result.micros = c[1]->Value();
+  result.cycles = c[2]->Value();
+  result.instructions = c[3]->Value();
+  result.llc_misses = c[4]->Value();
+  result.branch_misses = c[5]->Value();
+  return result;
+}
+
+std::string DirPerfCounters::ToString() const {
+  std::string result;
+  char tmp[200];
+  snprintf(tmp, sizeof(tmp), "%-13s %10s %12s %14s %14s %6s %8s %8s\n",
+           "stage", "count", "micros", "cycles", "instructions", "ipc",
+           "llc_mpki", "br_mpki");
+  result.append(tmp);
+  for (int i = 0; i < kNumPerfStages; i++) {
+    const DirPerfStage stage = static_cast<DirPerfStage>(i);
+    const DirPerfCounts c = Get(stage);
+    const double kinsts = c.instructions / 1000.0;
+    snprintf(tmp, sizeof(tmp),
+             "%-13s %10llu %12llu %14llu %14llu %6.2f %8.2f %8.2f\n",
+             StageName(stage), static_cast<unsigned long long>(c.count),
+             static_cast<unsigned long long>(c.micros),
+             static_cast<unsigned long long>(c.cycles),
+             static_cast<unsigned long long>(c.instructions),
+             c.cycles != 0 ? double(c.instructions) / c.cycles : 0.0,
+             kinsts != 0 ? c.llc_misses / kinsts : 0.0,
+             kinsts != 0 ? c.branch_misses / kinsts : 0.0);
+    result.append(tmp);
+  }
+  return result;
+}
+
+PerfScope::PerfScope(DirPerfCounters* perf, DirPerfStage stage)
+    : perf_(perf), stage_(stage), hw_(false), start_micros_(0) {
+  if (perf_ != NULL) {
+    hw_ = ReadHwCounters(start_);
+    start_micros_ = CurrentMicros();
+  }
+}
+
+PerfScope::~PerfScope() {
+  if (perf_ != NULL) {
+    DirPerfCounts delta;
+    const uint64_t end_micros = CurrentMicros();
+    uint64_t end[4];
+    if (hw_ && ReadHwCounters(end)) {
+      delta.cycles = end[0] - start_[0];
+      delta.instructions = end[1] - start_[1];
+      delta.llc_misses = end[2] - start_[2];
+      delta.branch_misses = end[3] - start_[3];
+    }
+    delta.count = 1;
+    delta.micros = end_micros > start_micros_ ? end_micros - start_micros_ : 0;
+    perf_->Add(stage_, delta);
+  }
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "pdlfs-common/env.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace pdlfs {
+class MetricsCounter;
+class MetricsRegistry;
+namespace plfsio {
+
+// Stages of the write and read paths for which cpu counters are collected.
+enum DirPerfStage {
+  // Write path
+  kPerfSort,         // Sorting a write buffer
+  kPerfTableBuild,   // Building a table, including its filter
+  kPerfFilterBuild,  // Finishing a filter
+  // Read path
+  kPerfFilterProbe,  // Checking a key against a table's filter
+  kPerfBlockRead,    // Obtaining a data block, from the cache or the data log
+  kPerfBlockSearch,  // Searching a data block for a key
+  kNumPerfStages
+};
+
+// Totals accumulated by a stage.
+struct DirPerfCounts {
+  DirPerfCounts();
+
+  uint64_t count;  // Number of times the stage ran
+  uint64_t micros;
+  // Hardware counters. Only counted by threads for which the hardware
+  // counters could be opened.
+  uint64_t cycles;
+  uint64_t instructions;
+  uint64_t llc_misses;
+  uint64_t branch_misses;
+};
+
+// Per-stage cpu counters of a directory. Hardware counters are read through
+// perf_event on Linux, using one counter group per thread that is opened the
+// first time the thread enters a stage. Counters count user-space events of
+// the calling thread only, so stages are measured exactly even when multiple
+// compactions or reads run concurrently. On other platforms, or when perf
+// events are not permitted, only stage counts and times are collected.
+// The object may be shared by multiple directories. Implementation is
+// thread-safe.
+class DirPerfCounters {
+ public:
+  // Counters are kept in *registry as "<prefix>.<stage>.<counter>", or in a
+  // private registry if registry is NULL.
+  // REQUIRES: *registry outlives this object and the counters are not
+  // removed from it.
+  explicit DirPerfCounters(MetricsRegistry* registry = NULL,
+                           const std::string& prefix = "plfsdir.perf");
+  ~DirPerfCounters();
+
+  static const char* StageName(DirPerfStage stage);
+
+  // Return true if hardware counters can be read by the calling thread.
+  static bool HardwareCountersAvailable();
+
+  void Add(DirPerfStage stage, const DirPerfCounts& delta);
+
+  DirPerfCounts Get(DirPerfStage stage) const;
+
+  // Return a table of all stages, including instructions per cycle and
+  // misses per thousand instructions.
+  std::string ToString() const;
+
+ private:
+  enum { kNumCounters = 6 };
+  MetricsRegistry* own_registry_;
+  MetricsCounter* counters_[kNumPerfStages][kNumCounters];
+
+  // No copying allowed
+  void operator=(const DirPerfCounters&);
+  DirPerfCounters(const DirPerfCounters&);
+};
+
+// Add the cpu counters of a scope to a given stage. Does nothing if perf is
+// NULL. Scopes may be nested.
+class PerfScope {
+ public:
+  PerfScope(DirPerfCounters* perf, DirPerfStage stage);
+  ~PerfScope();
+
+ private:
+  DirPerfCounters* const perf_;
+  const DirPerfStage stage_;
+  bool hw_;  // True if hardware counters were read at the start
+  uint64_t start_micros_;
+  uint64_t start_[4];
+
+  // No copying allowed
+  void operator=(const PerfScope&);
+  PerfScope(const PerfScope&);
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
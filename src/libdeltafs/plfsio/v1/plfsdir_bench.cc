@@ -0,0 +1,1431 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+/*
+ * plfsdir_bench: a standalone benchmark for plfsdirs. "io" measures the
+ * write path against an emulated storage link while "qu" writes a dir into
+ * memory and then measures point queries against it. A human-readable
+ * report goes to stderr while a single JSON line per phase goes to stdout so
+ * results can be collected by scripts.
+ */
+
+#include "bench_util.h"
+#include "events.h"
+#include "internal.h"
+#include "v1.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/xxhash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef PDLFS_PLATFORM_POSIX
+#ifdef PDLFS_OS_LINUX
+#include <sched.h>
+#include <sys/types.h>
+#endif
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#if __cplusplus >= 201103
+#define OVERRIDE override
+#else
+#define OVERRIDE
+#endif
+
+// Benchmark to run:
+//      io  -- insert FLAGS_num keys into a dir over an emulated link
+//      qu  -- insert FLAGS_num keys into an in-memory dir and read them back
+static const char* FLAGS_bench = "io";
+
+// Number of keys to insert and, for qu, to read
+static int FLAGS_num = 16 << 20;
+
+// Size of each key and each value in bytes
+static int FLAGS_key_size = 8;
+static int FLAGS_value_size = 40;
+
+// Log2 of the number of memtable partitions
+static int FLAGS_lg_parts = 2;
+
+// Number of background compaction threads. 0 compacts in the foreground.
+static int FLAGS_threads = 4;
+
+// Number of threads for reading epochs in parallel. 0 reads serially.
+static int FLAGS_reader_threads = 0;
+
+// Filter type: bf, bmp, r, fvbp, vbp, vb, fpfd, pfd, or auto
+static const char* FLAGS_filter = "bf";
+
+// Filter memory budget and per-type options
+static int FLAGS_ft_bits = 16;
+static int FLAGS_bf_bits = 14;
+static int FLAGS_bm_key_bits = 24;
+
+// Compression for both data and index blocks: none or snappy
+static const char* FLAGS_compression = "none";
+
+// Key distribution:
+//      uniform     -- each key is inserted once in random order
+//      sequential  -- each key is inserted once in sorted order
+//      zipf        -- keys are drawn from a zipfian distribution, so hot
+//                     keys are inserted many times
+static const char* FLAGS_skew = "uniform";
+
+// Skew of the zipfian distribution. Must be in (0,1).
+static double FLAGS_zipf_theta = 0.99;
+
+// Emulated link speed per log in MiB/s. 0 writes to FLAGS_dir directly.
+static int FLAGS_link_speed = 6;  // Per LANL's configuration
+
+// Memory budgets in MiB, and block sizes in KiB
+static int FLAGS_memtable_size = 48;
+static int FLAGS_block_size = 32;
+static int FLAGS_block_batch_size = 4;
+static double FLAGS_block_util = 0.996;
+static bool FLAGS_block_padding = true;
+static int FLAGS_data_buffer = 8;
+static int FLAGS_min_data_buffer = 6;
+static int FLAGS_index_buffer = 2;
+static int FLAGS_min_index_buffer = 2;
+
+// Table formats
+static bool FLAGS_leveldb_fmt = true;
+static bool FLAGS_fixed_kv = true;
+
+// Store keys out-of-order
+static bool FLAGS_unordered = false;
+
+// Pre-generate keys even if bitmap filters are not used
+static bool FLAGS_prepare_keys = false;
+
+// Query keys that were never inserted
+static bool FLAGS_false_keys = false;
+
+// Run the writer and compaction threads with real-time FIFO scheduling
+static bool FLAGS_force_fifo = false;
+
+// Print background compaction and I/O events
+static bool FLAGS_print_events = false;
+
+// Seed for key shuffling and zipfian draws
+static int FLAGS_seed = 301;
+
+// Use the dir at the following path
+static const char* FLAGS_dir = NULL;
+
+namespace pdlfs {
+namespace plfsio {
+
+namespace {
+
+void Die(const char* msg, const Status& s) {
+  fprintf(stderr, "%s: %s\n", msg, s.ToString().c_str());
+  exit(1);
+}
+
+void DieIf(bool cond, const char* msg) {
+  if (cond) {
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+  }
+}
+
+class WriteLock {
+ public:
+  WriteLock() : cv_(&mu_), on_(false) {}
+
+  void Acquire() {
+    MutexLock ml(&mu_);
+    while (on_) cv_.Wait();
+    on_ = true;
+  }
+
+  void Release() {
+    MutexLock ml(&mu_);
+    on_ = false;
+    cv_.SignalAll();
+  }
+
+ private:
+  port::Mutex mu_;
+  port::CondVar cv_;
+  bool on_;
+};
+
+class EmulatedWritableFile : public WritableFileWrapper {
+ public:
+  explicit EmulatedWritableFile(uint64_t bytes_ps, WriteLock* wl = NULL,
+                                Histogram* hist = NULL,
+                                EventListener* lis = NULL)
+      : lis_(lis),
+        prev_write_micros_(0),
+        hist_(hist),
+        wl_(wl),
+        bytes_ps_(bytes_ps) {}
+  virtual ~EmulatedWritableFile() {}
+
+  void EmulateWrite(const Slice& data) {
+    const uint64_t now_micros = CurrentMicros();
+    if (hist_ != NULL && prev_write_micros_ != 0) {
+      hist_->Add(now_micros - prev_write_micros_);
+    }
+    prev_write_micros_ = now_micros;
+    if (lis_ != NULL) {
+      IoEvent event;
+      event.type = kIoStart;
+      event.micros = now_micros;
+      lis_->OnEvent(event.type, &event);
+    }
+    const int micros_to_delay =
+        static_cast<int>(1000 * 1000 * data.size() / bytes_ps_);
+    SleepForMicroseconds(micros_to_delay);
+    if (lis_ != NULL) {
+      IoEvent event;
+      event.type = kIoEnd;
+      event.micros = CurrentMicros();
+      lis_->OnEvent(event.type, &event);
+    }
+  }
+
+  virtual Status Append(const Slice& data) OVERRIDE {
+    if (!data.empty()) {
+      if (wl_ != NULL) wl_->Acquire();
+      EmulateWrite(data);
+      if (wl_ != NULL) {
+        wl_->Release();
+      }
+    }
+    return status_;
+  }
+
+ private:
+  EventListener* lis_;
+  uint64_t prev_write_micros_;  // Timestamp of the previous write
+  Histogram* hist_;             // Mean time between writes
+  WriteLock* wl_;
+
+  uint64_t bytes_ps_;  // Bytes per second
+  Status status_;
+};
+
+class EmulatedEnv : public EnvWrapper {
+ public:
+  EmulatedEnv(uint64_t bytes_ps, EventListener* lis)
+      : EnvWrapper(Env::Default()), bytes_ps_(bytes_ps), lis_(lis) {}
+
+  virtual ~EmulatedEnv() {
+    HistIter iter = hists_.begin();
+    for (; iter != hists_.end(); ++iter) {
+      delete iter->second;
+    }
+  }
+
+  virtual Status NewWritableFile(const char* f, WritableFile** r) OVERRIDE {
+    Slice fname(f);
+    if (fname.ends_with(".dat")) {
+      Histogram* hist = new Histogram;
+      hists_.insert(std::make_pair(fname.ToString(), hist));
+      *r = new EmulatedWritableFile(bytes_ps_, &wl_, hist, lis_);
+    } else {
+      *r = new EmulatedWritableFile(bytes_ps_, &wl_);
+    }
+    return Status::OK();
+  }
+
+  const Histogram* GetHist(const char* suffix) {
+    HistIter iter = hists_.begin();
+    for (; iter != hists_.end(); ++iter) {
+      if (Slice(iter->first).ends_with(suffix)) {
+        return iter->second;
+      }
+    }
+    return NULL;
+  }
+
+ private:
+  uint64_t bytes_ps_;  // Bytes per second
+
+  EventListener* lis_;
+  typedef std::map<std::string, Histogram*> HistMap;
+  typedef HistMap::iterator HistIter;
+
+  HistMap hists_;
+  WriteLock wl_;
+};
+
+class StringWritableFile : public WritableFileWrapper {
+ public:
+  explicit StringWritableFile(std::string* buffer) : buf_(buffer) {}
+  virtual ~StringWritableFile() {}
+
+  virtual Status Append(const Slice& data) {
+    buf_->append(data.data(), data.size());
+    return Status::OK();
+  }
+
+ private:
+  // Owned by external code
+  std::string* buf_;
+};
+
+class StringFile : public SequentialFile, public RandomAccessFile {
+ public:
+  explicit StringFile(const std::string* buffer) : buf_(buffer), off_(0) {}
+  virtual ~StringFile() {}
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    if (offset > buf_->size()) {
+      offset = buf_->size();
+    }
+    if (n > buf_->size() - offset) {
+      n = buf_->size() - offset;
+    }
+    if (n != 0) {
+      *result = Slice(buf_->data() + offset, n);
+    } else {
+      *result = Slice();
+    }
+    return Status::OK();
+  }
+
+  virtual Status Read(size_t n, Slice* result, char* scratch) {
+    if (n > buf_->size() - off_) {
+      n = buf_->size() - off_;
+    }
+    if (n != 0) {
+      *result = Slice(buf_->data() + off_, n);
+    } else {
+      *result = Slice();
+    }
+    return Skip(n);
+  }
+
+  virtual Status Skip(uint64_t n) {
+    if (n > buf_->size() - off_) {
+      n = buf_->size() - off_;
+    }
+    off_ += n;
+    return Status::OK();
+  }
+
+ private:
+  // Owned by external code
+  const std::string* buf_;
+  size_t off_;
+};
+
+class StringEnv : public EnvWrapper {
+ public:
+  StringEnv() : EnvWrapper(Env::Default()) {}
+
+  virtual ~StringEnv() {
+    FSIter iter = fs_.begin();
+    for (; iter != fs_.end(); ++iter) {
+      delete iter->second;
+    }
+  }
+
+  virtual Status NewWritableFile(const char* f, WritableFile** r) {
+    std::string* buf = new std::string;
+    fs_.insert(std::make_pair(std::string(f), buf));
+    *r = new StringWritableFile(buf);
+    return Status::OK();
+  }
+
+  virtual Status NewRandomAccessFile(const char* f, RandomAccessFile** r) {
+    std::string* buf = Find(f);
+    if (buf == NULL) {
+      *r = NULL;
+      return Status::NotFound(Slice());
+    } else {
+      *r = new StringFile(buf);
+      return Status::OK();
+    }
+  }
+
+  virtual Status NewSequentialFile(const char* f, SequentialFile** r) {
+    std::string* buf = Find(f);
+    if (buf == NULL) {
+      *r = NULL;
+      return Status::NotFound(Slice());
+    } else {
+      *r = new StringFile(buf);
+      return Status::OK();
+    }
+  }
+
+  virtual Status GetFileSize(const char* f, uint64_t* s) {
+    std::string* buf = Find(f);
+    if (buf == NULL) {
+      *s = 0;
+      return Status::NotFound(Slice());
+    } else {
+      *s = buf->size();
+      return Status::OK();
+    }
+  }
+
+ private:
+  typedef std::map<std::string, std::string*> FS;
+  typedef FS::iterator FSIter;
+
+  std::string* Find(const char* f) {
+    FSIter iter = fs_.begin();
+    for (; iter != fs_.end(); ++iter) {
+      if (Slice(iter->first) == f) {
+        return iter->second;
+      }
+    }
+    return NULL;
+  }
+
+  FS fs_;
+};
+
+class Histo {
+ public:
+  Histo() { Clear(); }
+
+  void Add(uint32_t seeks) {
+    sum_ += seeks;
+    max_ = std::max(max_, seeks);
+    if (seeks > 9) {
+      seeks = 9;
+    }
+    histo_[seeks]++;
+    num_++;
+  }
+
+  double CDF(uint32_t seeks) {
+    if (num_ == 0) return 0;
+    double subtotal = 0;
+    for (uint32_t i = 0; i <= seeks; i++) {
+      subtotal += histo_[i];
+    }
+    return subtotal / num_;
+  }
+
+  double Average() const {
+    if (num_ == 0) return 0;
+    return sum_ / num_;
+  }
+
+  void Clear() {
+    memset(histo_, 0, sizeof(histo_));
+    max_ = 0;
+    num_ = 0;
+    sum_ = 0;
+  }
+
+  uint32_t max_;
+  uint32_t num_;  // Total number of seek records
+  // Num of times we get i seeks (0<=i<=9)
+  uint32_t histo_[10];
+  double sum_;
+};
+
+}  // anonymous namespace
+
+class PlfsIoBench {
+ public:
+  static BitmapFormat GetBitmapFilterFormat(BitmapFormat deffmt) {
+    const char* ft = FLAGS_filter;
+    if (strcmp(ft, "bf") == 0) {
+      return deffmt;
+    } else if (strcmp(ft, "bmp") == 0) {
+      return kFmtUncompressed;
+    } else if (strcmp(ft, "r") == 0) {
+      return kFmtRoaring;
+    } else if (strcmp(ft, "fvbp") == 0) {
+      return kFmtFastVarintPlus;
+    } else if (strcmp(ft, "vbp") == 0) {
+      return kFmtVarintPlus;
+    } else if (strcmp(ft, "vb") == 0) {
+      return kFmtVarint;
+    } else if (strcmp(ft, "fpfd") == 0) {
+      return kFmtFastPfDelta;
+    } else if (strcmp(ft, "pfd") == 0) {
+      return kFmtPfDelta;
+    } else if (strcmp(ft, "auto") == 0) {
+      return kFmtAuto;
+    } else {
+      fprintf(stderr, "Bad filter type: %s\n", ft);
+      exit(1);
+    }
+  }
+
+  static FilterType GetFilterType() {
+    if (strcmp(FLAGS_filter, "bf") == 0) {
+      return kFtBloomFilter;
+    } else {
+      GetBitmapFilterFormat(kFmtUncompressed);  // Reject bad types
+      return kFtBitmap;
+    }
+  }
+
+  class EventPrinter : public EventListener {
+   public:
+    EventPrinter() : base_time_(CurrentMicros()) {
+      events_.reserve(1024);
+      iops_.reserve(1024);
+    }
+
+    virtual ~EventPrinter() {}
+
+    virtual void OnEvent(EventType type, void* arg) {
+      switch (type) {
+        case kCompactionStart:
+        case kCompactionEnd: {
+          CompactionEvent* event = static_cast<CompactionEvent*>(arg);
+          event->micros -= base_time_;
+          events_.push_back(*event);
+          break;
+        }
+        case kIoStart:
+        case kIoEnd: {
+          IoEvent* event = static_cast<IoEvent*>(arg);
+          event->micros -= base_time_;
+          iops_.push_back(*event);
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+    static std::string ToString(const CompactionEvent& e) {
+      char tmp[20];
+      snprintf(tmp, sizeof(tmp), "%.3f,%d,%s", 1.0 * e.micros / 1000.0 / 1000.0,
+               static_cast<int>(e.part),
+               e.type == kCompactionStart ? "START" : "END");
+      return tmp;
+    }
+
+    static std::string ToString(const IoEvent& e) {
+      char tmp[20];
+      snprintf(tmp, sizeof(tmp), "%.3f,io,%s", 1.0 * e.micros / 1000.0 / 1000.0,
+               e.type == kIoStart ? "START" : "END");
+      return tmp;
+    }
+
+    void PrintEvents() {
+      fprintf(stderr, "\n\n!!! Background Events !!!\n");
+      fprintf(stderr, "\n-- XXX --\n");
+      for (EventIter iter = events_.begin(); iter != events_.end(); ++iter) {
+        fprintf(stderr, "%s\n", ToString(*iter).c_str());
+      }
+      for (IoIter iter = iops_.begin(); iter != iops_.end(); ++iter) {
+        fprintf(stderr, "%s\n", ToString(*iter).c_str());
+      }
+      fprintf(stderr, "\n-- XXX --\n");
+    }
+
+   private:
+    uint64_t base_time_;
+
+    typedef std::vector<IoEvent> IoQueue;
+    typedef IoQueue::iterator IoIter;
+    typedef std::vector<CompactionEvent> EventQueue;
+    typedef EventQueue::iterator EventIter;
+
+    EventQueue events_;
+    IoQueue iops_;
+  };
+
+  PlfsIoBench() : home_(FLAGS_dir) {
+    mbps_ = FLAGS_link_speed;
+    num_ = FLAGS_num;
+    zipf_ = strcmp(FLAGS_skew, "zipf") == 0;
+    ordered_keys_ = strcmp(FLAGS_skew, "sequential") == 0;
+    DieIf(!zipf_ && !ordered_keys_ && strcmp(FLAGS_skew, "uniform") != 0,
+          "Bad skew: must be uniform, sequential, or zipf");
+    DieIf(zipf_ && (FLAGS_zipf_theta <= 0 || FLAGS_zipf_theta >= 1),
+          "Bad zipf theta: must be in (0,1)");
+    DieIf(num_ <= 0, "Bad num: must be positive");
+
+    num_threads_ = FLAGS_threads;  // Threads for bg compaction
+    // For advanced perf diagnosis
+    print_events_ = FLAGS_print_events;
+    force_fifo_ = FLAGS_force_fifo;
+
+    options_.rank = 0;  // My process id
+    if (zipf_) {  // Hot keys are inserted many times
+      options_.mode = FLAGS_unordered ? kDmMultiMapUnordered : kDmMultiMap;
+    } else if (FLAGS_unordered) {
+      options_.mode = kDmUniqueUnordered;
+    } else {
+#ifndef NDEBUG
+      options_.mode = kDmUniqueKey;
+#else
+      options_.mode = kDmUniqueDrop;
+#endif
+    }
+    options_.lg_parts = FLAGS_lg_parts;
+    options_.skip_sort = ordered_keys_ != 0;
+    options_.leveldb_compatible = FLAGS_leveldb_fmt;
+    options_.fixed_kv_length = FLAGS_fixed_kv;
+    if (strcmp(FLAGS_compression, "snappy") == 0) {
+      options_.compression = kSnappyCompression;
+      options_.index_compression = kSnappyCompression;
+    } else {
+      DieIf(strcmp(FLAGS_compression, "none") != 0,
+            "Bad compression: must be none or snappy");
+      options_.compression = kNoCompression;
+      options_.index_compression = kNoCompression;
+    }
+    options_.force_compression = true;
+    options_.total_memtable_budget =
+        static_cast<size_t>(FLAGS_memtable_size << 20);
+    options_.block_size = static_cast<size_t>(FLAGS_block_size << 10);
+    options_.block_batch_size =
+        static_cast<size_t>(FLAGS_block_batch_size << 20);
+    options_.block_util = FLAGS_block_util;
+    options_.block_padding = FLAGS_block_padding;
+    options_.bf_bits_per_key = static_cast<size_t>(FLAGS_bf_bits);
+    options_.bm_fmt = GetBitmapFilterFormat(kFmtUncompressed);
+    options_.bm_key_bits = static_cast<size_t>(FLAGS_bm_key_bits);
+    options_.filter = GetFilterType();
+    options_.filter_bits_per_key = static_cast<size_t>(FLAGS_ft_bits);
+    options_.value_size = static_cast<size_t>(FLAGS_value_size);
+    options_.key_size = static_cast<size_t>(FLAGS_key_size);
+    options_.data_buffer = static_cast<size_t>(FLAGS_data_buffer << 20);
+    options_.min_data_buffer =
+        static_cast<size_t>(FLAGS_min_data_buffer << 20);
+    options_.index_buffer = static_cast<size_t>(FLAGS_index_buffer << 20);
+    options_.min_index_buffer =
+        static_cast<size_t>(FLAGS_min_index_buffer << 20);
+    options_.listener = &printer_;
+
+    writer_ = NULL;
+
+    env_ = NULL;
+  }
+
+  ~PlfsIoBench() {
+    delete writer_;
+    writer_ = NULL;
+    delete env_;
+    env_ = NULL;
+  }
+
+  void LogAndApply() {
+    DestroyDir(home_, options_);
+    MaybePrepareKeys(FLAGS_prepare_keys);
+    DoIt();
+  }
+
+ protected:
+  // Compare two 32-bit integers according to their binary encoding.
+  // This is different from comparing their values.
+  struct STLLessThan {
+    bool operator()(uint32_t a, uint32_t b) {
+      char tmp1[4];
+      EncodeFixed32(tmp1, a);
+      char tmp2[4];
+      EncodeFixed32(tmp2, b);
+      return memcmp(tmp1, tmp2, 4) < 0;
+    }
+  };
+
+  // Pre-sort all keys so the compaction process
+  // can skip the sort operation.
+  void MaybeSortKeys() {
+    if (options_.skip_sort) {
+      fprintf(stderr, "Sorting keys ...\n");
+      std::sort(keys_.begin(), keys_.end(), STLLessThan());
+      fprintf(stderr, "Done!\n");
+    }
+  }
+
+  // Pre-generate user keys if bitmap filters are used, or if explicitly
+  // requested by user. Otherwise, keys will be lazy generated
+  // using a hashing function.
+  // REQUIRES: file count must honor key space.
+  void MaybePrepareKeys(bool forced) {
+    if (forced || options_.filter == kFtBitmap) {
+      DieIf(options_.bm_key_bits < 32 &&
+                uint64_t(num_) > (uint64_t(1) << options_.bm_key_bits),
+            "Too many keys for the bitmap key space");
+      keys_.clear();
+      fprintf(stderr, "Generating keys ... (%d keys)\n", num_);
+      keys_.reserve(static_cast<size_t>(num_));
+      for (int i = 0; i < num_; i++) {
+        keys_.push_back(static_cast<uint32_t>(i));
+      }
+      srand(FLAGS_seed);
+      std::random_shuffle(keys_.begin(), keys_.end());
+      fprintf(stderr, "Done!\n");
+      MaybeSortKeys();
+    }
+  }
+
+  // Generates the key of each op. Uniform and sequential batches visit
+  // every key once while zipfian batches draw keys by popularity.
+  class BigBatch {
+   public:
+    BigBatch(const DirOptions& options, const std::vector<uint32_t>& keys,
+             int size, bool zipf, uint32_t seed)
+        : key_size_(options.key_size),  // Num bytes for each key
+          dummy_val_(options.value_size, 'x'),
+          options_(options),
+          keys_(keys),  // Pre-generated user keys, optional
+          use_external_keys_(!keys_.empty()),
+          rnd_insertion_(!options_.skip_sort),
+          zipf_(zipf ? new ZipfGenerator(static_cast<uint32_t>(size),
+                                         FLAGS_zipf_theta, seed)
+                     : NULL),
+          size_(static_cast<uint32_t>(size)),  // Batch size
+          offset_(size_) {  // Initialized to be invalid
+      DieIf(key_size_ > sizeof(key_), "Key size too large");
+      // Initialize the buffer space for keys
+      memset(key_, 0, sizeof(key_));
+      if (use_external_keys_) {  // Keys are pre-generated as 32-bit ints
+        DieIf(key_size_ < 4, "Key size must be at least 4");
+      } else {
+        DieIf(key_size_ < 8, "Key size must be at least 8");
+      }
+    }
+
+    ~BigBatch() { delete zipf_; }
+
+    bool Valid() const { return offset_ < size_; }
+    uint32_t offset() const { return offset_; }
+    Slice fid() const { return Slice(key_, key_size_); }
+    Slice data() const { return dummy_val_; }
+
+    void Seek(uint32_t offset) {
+      offset_ = offset;
+      if (Valid()) {
+        MakeKey();
+      }
+    }
+
+    void Next() {
+      offset_++;
+      if (Valid()) {
+        MakeKey();
+      }
+    }
+
+   private:
+    // Constant after construction
+    size_t key_size_;
+    std::string dummy_val_;
+    const DirOptions& options_;
+    const std::vector<uint32_t>& keys_;
+    bool use_external_keys_;
+    bool rnd_insertion_;
+    ZipfGenerator* zipf_;
+    uint32_t size_;
+
+    void MakeKey() {
+      uint32_t index = offset_;
+      if (zipf_ != NULL) {
+        // Scatter popular ranks across the key space so they do not all
+        // fall into the same memtable partition
+        const uint32_t rank = zipf_->Next();
+        index = static_cast<uint32_t>(xxhash64(&rank, sizeof(rank), 0) %
+                                      size_);
+      }
+      if (use_external_keys_) {  // Use pre-generated user keys
+        EncodeFixed32(key_, keys_[index]);
+      } else if (rnd_insertion_) {  // Random insertion
+        // Key collisions are still possible, though very unlikely
+        uint64_t h = xxhash64(&index, sizeof(index), 0);
+        memcpy(key_ + 8, &h, 8);
+        memcpy(key_, &h, 8);
+      } else {
+        // Use big-endian to ensure key ordering
+        uint64_t k = htobe64(index);
+        memcpy(key_ + 8, &k, 8);
+        memcpy(key_, &k, 8);
+      }
+    }
+
+    uint32_t offset_;
+    char key_[20];
+  };
+
+#if defined(PDLFS_PLATFORM_POSIX) && defined(PDLFS_OS_LINUX)
+  void* MaybeForceFifoScheduling(pthread_attr_t* attr) {
+    if (!force_fifo_) return NULL;
+    int min = sched_get_priority_min(SCHED_FIFO);
+    int max = sched_get_priority_max(SCHED_FIFO);
+    struct sched_param param;
+    param.sched_priority = (min + max) / 2 + 1;
+    int r1 = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    DieIf(r1 != 0, "Cannot set FIFO scheduling");
+    int r2 = pthread_attr_init(attr);
+    DieIf(r2 != 0, "Cannot init pthread attr");
+    int r3 = pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    DieIf(r3 != 0, "Cannot set pthread inheritsched");
+    int r4 = pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+    DieIf(r4 != 0, "Cannot set pthread schedpolicy");
+    param.sched_priority = (min + max) / 2 - 1;
+    int r5 = pthread_attr_setschedparam(attr, &param);
+    DieIf(r5 != 0, "Cannot set pthread schedparam");
+    return attr;
+  }
+#endif
+
+  void DoIt() {
+    bool owns_pool = false;
+    if (num_threads_ != 0) {
+#if defined(PDLFS_PLATFORM_POSIX) && defined(PDLFS_OS_LINUX)
+      pthread_attr_t pthread_attr;
+      void* attr = MaybeForceFifoScheduling(&pthread_attr);
+      ThreadPool* pool = ThreadPool::NewFixed(num_threads_, true, attr);
+#else
+      ThreadPool* pool = ThreadPool::NewFixed(num_threads_, true);
+#endif
+      options_.compaction_pool = pool;
+      owns_pool = true;
+    } else {
+      options_.allow_env_threads = false;
+      options_.compaction_pool = NULL;
+    }
+    bool owns_env = false;
+    if (env_ == NULL) {
+      if (mbps_ != 0) {
+        const uint64_t speed = static_cast<uint64_t>(mbps_) << 20;
+        env_ = new EmulatedEnv(speed, &printer_);
+        owns_env = true;
+      } else {
+        Env::Default()->CreateDir(home_.c_str());
+      }
+    }
+    options_.env = env_ != NULL ? env_ : Env::Default();
+    Status s = DirWriter::Open(options_, home_, &writer_);
+    if (!s.ok()) Die("Cannot open dir", s);
+    SleepForMicroseconds(1000);
+#ifdef PDLFS_PLATFORM_POSIX
+    struct rusage tmp_usage;
+    int r0 = getrusage(RUSAGE_SELF, &tmp_usage);
+    DieIf(r0 != 0, "Cannot get rusage");
+#endif
+    const uint64_t start = CurrentMicros();
+    fprintf(stderr, "Inserting data...\n");
+    BigBatch batch(options_, keys_, num_, zipf_, FLAGS_seed);
+    batch.Seek(0);
+    for (int i = 0; i < num_; i++) {
+      // Report progress
+      if ((i & 0x7FFFF) == 0) {
+        fprintf(stderr, "\r%.2f%%", 100.0 * i / num_);
+      }
+      const uint64_t op_start = CurrentMicros();
+      s = writer_->Add(batch.fid(), batch.data(), 0);
+      write_latency_.Add(CurrentMicros() - op_start);
+      if (s.ok()) {
+        batch.Next();
+      } else {
+        break;
+      }
+    }
+    if (!s.ok()) Die("Cannot write", s);
+    fprintf(stderr, "\r100.00%%");
+    fprintf(stderr, "\n");
+
+    s = writer_->EpochFlush(0);
+    if (!s.ok()) Die("Cannot flush epoch", s);
+    s = writer_->Finish();
+    if (!s.ok()) Die("Cannot finish", s);
+
+    fprintf(stderr, "Done!\n");
+    const uint64_t end = CurrentMicros();
+    const uint64_t dura = end - start;
+#ifdef PDLFS_PLATFORM_POSIX
+    PrintStats(tmp_usage, dura, owns_env);
+#else
+    PrintStats(dura, owns_env);
+#endif
+    PrintJson(dura);
+    if (print_events_) {
+      printer_.PrintEvents();
+    }
+
+    delete writer_;
+    writer_ = NULL;
+
+    if (owns_pool) {
+      delete options_.compaction_pool;
+      options_.compaction_pool = NULL;
+    }
+    if (owns_env) {
+      delete options_.env;
+      options_.env = NULL;
+      env_ = NULL;
+    }
+  }
+
+#ifdef PDLFS_PLATFORM_POSIX
+  static inline double ToSecs(const struct timeval* tv) {
+    return tv->tv_sec + tv->tv_usec / 1000.0 / 1000.0;
+  }
+#endif
+
+  static const char* ToString(FilterType type) {
+    switch (type) {
+      case kFtBloomFilter:
+        return "BF (std bloom filter)";
+      case kFtBitmap:
+        return "BM (bitmap)";
+      default:
+        return "Unknown";
+    }
+  }
+
+  static const char* ToString(BitmapFormat type) {
+    switch (type) {
+      case kFmtUncompressed:
+        return "Uncompressed";
+      case kFmtRoaring:
+        return "R";
+      case kFmtFastVarintPlus:
+        return "FAST-VBP";
+      case kFmtVarintPlus:
+        return "VBP";
+      case kFmtVarint:
+        return "VB";
+      case kFmtFastPfDelta:
+        return "FAST-PFD";
+      case kFmtPfDelta:
+        return "PFD";
+      case kFmtAuto:
+        return "AUTO";
+      default:
+        return "Unknown";
+    }
+  }
+
+  // Start a JSON line with the workload shared by all phases.
+  std::string JsonPrefix(const char* phase, uint64_t dura) const {
+    char tmp[500];
+    snprintf(tmp, sizeof(tmp),
+             "{\"bench\":\"%s\",\"phase\":\"%s\",\"num_ops\":%d,"
+             "\"key_size\":%d,\"value_size\":%d,\"lg_parts\":%d,"
+             "\"threads\":%d,\"filter\":\"%s\",\"compression\":\"%s\","
+             "\"skew\":\"%s\",\"link_speed\":%d,\"seconds\":%.6f,"
+             "\"ops_per_sec\":%.3f,",
+             FLAGS_bench, phase, num_, int(options_.key_size),
+             int(options_.value_size), options_.lg_parts, num_threads_,
+             FLAGS_filter, FLAGS_compression, FLAGS_skew, mbps_,
+             dura / 1000.0 / 1000.0, 1000.0 * 1000.0 * num_ / dura);
+    return tmp;
+  }
+
+  void PrintJson(uint64_t dura) const {
+    std::string json = JsonPrefix("write", dura);
+    const double mib_ps = 1000.0 * 1000.0 *
+                          (options_.key_size + options_.value_size) * num_ /
+                          dura / 1024.0 / 1024.0;
+    const IoStats stats = writer_->TEST_iostats();
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp),
+             "\"mib_per_sec\":%.3f,\"write_stall_micros\":%llu,"
+             "\"data_bytes\":%llu,\"index_bytes\":%llu,"
+             "\"latency_micros\":",
+             mib_ps,
+             static_cast<unsigned long long>(
+                 writer_->TEST_write_stall_micros()),
+             static_cast<unsigned long long>(stats.data_bytes),
+             static_cast<unsigned long long>(stats.index_bytes));
+    json += tmp;
+    write_latency_.AppendJson(&json);
+    json += "}";
+    fprintf(stdout, "%s\n", json.c_str());
+    fflush(stdout);
+  }
+
+#ifdef PDLFS_PLATFORM_POSIX
+  void PrintStats(const struct rusage& tmp_usage, uint64_t dura,
+                  bool owns_env) {
+#else
+  void PrintStats(uint64_t dura, bool owns_env) {
+#endif
+    const double k = 1000.0, ki = 1024.0;
+    const double mkeys = num_ / ki / ki;
+    fprintf(stderr, "----------------------------------------\n");
+    const uint64_t total_memory_usage = writer_->TEST_total_memory_usage();
+    fprintf(stderr, "     Total Memory Usage: %.3f MiB\n",
+            total_memory_usage / ki / ki);
+    fprintf(stderr, "             Total Time: %.3f s\n", dura / k / k);
+    const IoStats stats = writer_->TEST_iostats();
+#ifdef PDLFS_PLATFORM_POSIX
+    struct rusage usage;
+    int r1 = getrusage(RUSAGE_SELF, &usage);
+    DieIf(r1 != 0, "Cannot get rusage");
+    double utime = ToSecs(&usage.ru_utime) - ToSecs(&tmp_usage.ru_utime);
+    double stime = ToSecs(&usage.ru_stime) - ToSecs(&tmp_usage.ru_stime);
+    fprintf(stderr, "          User CPU Time: %.3f s\n", utime);
+    fprintf(stderr, "        System CPU Time: %.3f s\n", stime);
+#ifdef PDLFS_OS_LINUX
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    int r2 = sched_getaffinity(getpid(), sizeof(cpu_set), &cpu_set);
+    DieIf(r2 != 0, "Cannot get cpu affinity");
+    fprintf(stderr, "          Num CPU Cores: %d\n", CPU_COUNT(&cpu_set));
+    fprintf(stderr, "              CPU Usage: %.1f%%\n",
+            k * k * (utime + stime) / CPU_COUNT(&cpu_set) / dura * 100);
+#endif
+#endif
+    fprintf(stderr, "               Dir Mode: ordered=%s\n",
+            IsKeyUnOrdered(options_.mode) ? "No" : "Yes");
+    fprintf(stderr,
+            "             Input Keys: pre-generated=%s, pre-sorted=%s, "
+            "skew=%s\n",
+            keys_.empty() ? "No" : "Yes", ordered_keys_ ? "Yes" : "No",
+            FLAGS_skew);
+    fprintf(stderr, "     Snappy Compression: %s\n",
+            options_.index_compression == kSnappyCompression ? "Yes" : "No");
+    fprintf(stderr, "            Blk Padding: %s\n",
+            options_.block_padding ? "Yes" : "No");
+    fprintf(stderr, "                 TB Fmt: %s\n",
+            options_.leveldb_compatible ? "SST" : "CUSTOM");
+    fprintf(stderr, "                FT Type: %s\n", ToString(options_.filter));
+    fprintf(stderr, "          FT Mem Budget: %d (bits per key)\n",
+            int(options_.filter_bits_per_key));
+    if (options_.filter == kFtBloomFilter) {
+      fprintf(stderr, "              BF Budget: %d (bits per key)\n",
+              int(options_.bf_bits_per_key));
+    } else if (options_.filter == kFtBitmap) {
+      fprintf(stderr, "           BM Key Space: 0-2^%d\n",
+              int(options_.bm_key_bits));
+      fprintf(stderr, "                 BM Fmt: %s\n",
+              ToString(options_.bm_fmt));
+    }
+    fprintf(stderr, "     Num Files Inserted: %.2f M\n", mkeys);
+    fprintf(stderr, "        Logic File Data: %.1f MiB\n",
+            (options_.key_size + options_.value_size) * mkeys);
+    fprintf(stderr, "  Total MemTable Budget: %d MiB\n",
+            int(options_.total_memtable_budget) >> 20);
+    fprintf(stderr, "      Estimated TB Size: %.3f MiB\n",
+            writer_->TEST_estimated_sstable_size() / ki / ki);
+    fprintf(stderr, "        Planned FT Size: %.3f KiB\n",
+            writer_->TEST_planned_filter_size() / ki);
+    fprintf(stderr, "     Estimated Blk Size: %d KiB (target util: %.1f%%)\n",
+            int(options_.block_size) >> 10, options_.block_util * 100);
+    fprintf(stderr, "Num MemTable Partitions: %d\n", 1 << options_.lg_parts);
+    fprintf(stderr, "         Num Bg Threads: %d\n", num_threads_);
+    if (owns_env) {
+      fprintf(stderr, "    Emulated Link Speed: %d MiB/s (per log)\n", mbps_);
+    } else {
+      fprintf(stderr, "    Emulated Link Speed: N/A\n");
+    }
+    fprintf(stderr, "            Write Speed: %.3f MiB/s (observed by app)\n",
+            1.0 * k * k * (options_.key_size + options_.value_size) * mkeys /
+                dura);
+    fprintf(stderr, "              Index Buf: %d MiB (x%d)\n",
+            int(options_.index_buffer) >> 20, 1 << options_.lg_parts);
+    fprintf(stderr, "     Min Index I/O Size: %d MiB\n",
+            int(options_.min_index_buffer) >> 20);
+    const uint64_t user_bytes =
+        writer_->TEST_key_bytes() + writer_->TEST_value_bytes();
+    fprintf(stderr, "  Aggregated TB Indexes: %.3f KiB\n",
+            1.0 * writer_->TEST_raw_index_contents() / ki);
+    fprintf(stderr, "          Aggregated FT: %.3f MiB (+%.2f%%)\n",
+            1.0 * writer_->TEST_raw_filter_contents() / ki / ki,
+            1.0 * writer_->TEST_raw_filter_contents() / user_bytes * 100);
+    fprintf(stderr, "      Final Dir Indexes: %.3f MiB (+%.2f%%)\n",
+            1.0 * stats.index_bytes / ki / ki,
+            1.0 * stats.index_bytes / user_bytes * 100);
+    fprintf(stderr, "             Index Cost: %.3f (bits per key)\n",
+            8.0 * stats.index_bytes / double(num_));
+    fprintf(stderr, "         Compaction Buf: %d MiB (x%d)\n",
+            int(options_.block_batch_size) >> 20, 1 << options_.lg_parts);
+    fprintf(stderr, "               Data Buf: %d MiB\n",
+            int(options_.data_buffer) >> 20);
+    fprintf(stderr, "      Min Data I/O Size: %d MiB\n",
+            int(options_.min_data_buffer) >> 20);
+    fprintf(stderr, "        Total User Data: %.3f MiB (K+V)\n",
+            1.0 * user_bytes / ki / ki);
+    fprintf(stderr,
+            "     Aggregated TB Data: %.3f MiB (%+.2f%% due to blk encoding "
+            "and possible compression)\n",
+            1.0 * writer_->TEST_raw_data_contents() / ki / ki,
+            1.0 * writer_->TEST_raw_data_contents() / user_bytes * 100 - 100);
+    fprintf(stderr,
+            "         Final Dir Data: %.3f MiB (%+.2f%% due to performing the "
+            "above plus padding and checksums)\n",
+            1.0 * stats.data_bytes / ki / ki,
+            1.0 * stats.data_bytes / user_bytes * 100 - 100);
+    if (stats.data_bytes >= user_bytes) {
+      fprintf(stderr, "Total Blk Encoding Cost: %.3f (bits per key)\n",
+              8.0 * (stats.data_bytes - user_bytes) / double(num_));
+    } else {
+      fprintf(stderr, "Total Blk Encoding Cost: N/A\n");
+    }
+    fprintf(stderr, "           Avg I/O Size: %.3f MiB\n",
+            1.0 * stats.data_bytes / stats.data_ops / ki / ki);
+    if (owns_env) {
+      const Histogram* hist = static_cast<EmulatedEnv*>(env_)->GetHist(".dat");
+      if (hist != NULL) {
+        fprintf(stderr, "                   MTBW: %.3f s\n",
+                hist->Average() / k / k);
+      }
+    } else {
+      fprintf(stderr, "                   MTBW: N/A\n");
+    }
+    const uint32_t num_tables = writer_->TEST_num_sstables();
+    fprintf(stderr, "               Total TB: %d\n", int(num_tables));
+    fprintf(stderr, "       TB Per Partition: %.1f\n",
+            1.0 * num_tables / (1 << options_.lg_parts));
+    fprintf(stderr, "           Total TB Blk: %d\n",
+            int(writer_->TEST_num_data_blocks()));
+    fprintf(stderr, "   Total Keys Compacted: %.1f M (%d dropped)\n",
+            1.0 * writer_->TEST_num_keys() / ki / ki,
+            int(writer_->TEST_num_dropped_keys()));
+    fprintf(stderr, "             Value Size: %d Bytes\n",
+            int(options_.value_size));
+    fprintf(stderr, "               Key Size: %d Bytes\n",
+            int(options_.key_size));
+  }
+
+  int mbps_;  // Link speed to emulate (in MBps)
+  int ordered_keys_;
+  bool zipf_;         // Draw keys from a zipfian distribution
+  int num_;           // Number of keys to insert
+  int num_threads_;   // Number of bg compaction threads
+  int force_fifo_;    // Force real-time FIFO scheduling
+  int print_events_;  // Dump background events
+  EventPrinter printer_;
+  BenchLatency write_latency_;
+  std::vector<uint32_t> keys_;
+  const std::string home_;
+  DirOptions options_;
+  DirWriter* writer_;
+  Env* env_;
+};
+
+class PlfsQuBench : protected PlfsIoBench {
+ public:
+  PlfsQuBench() : PlfsIoBench() {
+    num_threads_ = 0;
+    mbps_ = 0;
+
+    force_negative_lookups_ = FLAGS_false_keys;
+    num_empty_reads_ = 0;
+    num_reads_ = 0;
+
+    options_.verify_checksums = false;
+    options_.paranoid_checks = true;
+
+    env_ = new StringEnv;
+    reader_ = NULL;
+  }
+
+  ~PlfsQuBench() {
+    delete writer_;
+    writer_ = NULL;
+    delete reader_;
+    reader_ = NULL;
+    delete env_;
+    env_ = NULL;
+  }
+
+  void LogAndApply() {
+    PlfsIoBench::LogAndApply();
+    RunQueries();
+  }
+
+ protected:
+  void RunQueries() {
+    ThreadPool* pool = NULL;
+    if (FLAGS_reader_threads != 0) {
+      pool = ThreadPool::NewFixed(FLAGS_reader_threads);
+      options_.parallel_reads = true;
+    }
+    options_.allow_env_threads = false;
+    options_.reader_pool = pool;
+    options_.env = env_;
+    Status s = DirReader::Open(options_, home_, &reader_);
+    if (!s.ok()) Die("Cannot open dir", s);
+    fprintf(stderr, "Reading dir...\n");
+    const uint64_t start = CurrentMicros();
+    // Zipfian reads draw keys independently of the writes
+    BigBatch batch(options_, keys_, num_, zipf_, FLAGS_seed + 1);
+    batch.Seek(0);
+    uint64_t accumulated_seeks = 0;
+    std::string dummy_buf;
+    char tmp[20];
+    memset(tmp, 0, sizeof(tmp));
+    while (batch.Valid()) {
+      uint32_t i = batch.offset();
+      // Report progress
+      if ((i & 0x3FFFF) == 0) {
+        fprintf(stderr, "\r%.2f%%", 100.0 * i / num_);
+      }
+      dummy_buf.clear();
+      Slice k = batch.fid();
+      if (force_negative_lookups_) {
+        uint64_t h1 = xxhash64(k.data(), k.size(), 301);
+        memcpy(tmp + 8, &h1, 8);
+        uint64_t h2 = xxhash64(k.data(), k.size(), 103);
+        memcpy(tmp, &h2, 8);
+        k = Slice(tmp, options_.key_size);
+      }
+      DirReader::ReadOp op;
+      const uint64_t op_start = CurrentMicros();
+      s = reader_->Read(op, k, &dummy_buf);
+      read_latency_.Add(CurrentMicros() - op_start);
+      if (!s.ok()) {
+        break;
+      }
+      const IoStats stats = reader_->TEST_iostats();
+      seeks_.Add(stats.data_ops - accumulated_seeks);
+      accumulated_seeks = stats.data_ops;
+      num_reads_++;
+      if (dummy_buf.empty()) {
+        num_empty_reads_++;
+      }
+      batch.Next();
+    }
+    if (!s.ok()) Die("Cannot read", s);
+    fprintf(stderr, "\r100.00%%\n");
+    fprintf(stderr, "Done!\n");
+
+    uint64_t dura = CurrentMicros() - start;
+
+    Report(dura);
+    PrintReadJson(dura);
+
+    delete reader_;
+    reader_ = NULL;
+    delete pool;
+    options_.reader_pool = NULL;
+  }
+
+  void PrintReadJson(uint64_t dura) const {
+    std::string json = JsonPrefix("read", dura);
+    const IoStats stats = reader_->TEST_iostats();
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp),
+             "\"reader_threads\":%d,\"empty_reads\":%llu,"
+             "\"avg_seeks\":%.3f,\"data_bytes\":%llu,\"index_bytes\":%llu,"
+             "\"latency_micros\":",
+             FLAGS_reader_threads,
+             static_cast<unsigned long long>(num_empty_reads_),
+             seeks_.Average(),
+             static_cast<unsigned long long>(stats.data_bytes),
+             static_cast<unsigned long long>(stats.index_bytes));
+    json += tmp;
+    read_latency_.AppendJson(&json);
+    json += "}";
+    fprintf(stdout, "%s\n", json.c_str());
+    fflush(stdout);
+  }
+
+  void Report(uint64_t dura) {
+    const double k = 1000.0, ki = 1024.0;
+    fprintf(stderr, "----------------------------------------\n");
+    fprintf(stderr, "             Total Time: %.3f s\n", dura / k / k);
+    fprintf(stderr, "          Avg Read Time: %.3f us\n", 1.0 * dura / num_);
+    fprintf(stderr, "              Num Reads: %.2f M\n", num_reads_ / ki / ki);
+    fprintf(stderr, "          Num Neg Reads: %.2f M (%.2f%%)\n",
+            num_empty_reads_ / ki / ki, 100.0 * num_empty_reads_ / num_reads_);
+    fprintf(stderr, "    Avg Seeks Per Epoch: %.3f, MAX=%d\n", seeks_.Average(),
+            int(seeks_.max_));
+    fprintf(stderr, "            CDF 1 Seeks: %.6f\n", seeks_.CDF(1));
+    fprintf(stderr, "                2 Seeks: %.6f\n", seeks_.CDF(2));
+    fprintf(stderr, "                3 Seeks: %.6f\n", seeks_.CDF(3));
+    fprintf(stderr, "                4 Seeks: %.6f\n", seeks_.CDF(4));
+    fprintf(stderr, "                5 Seeks: %.6f\n", seeks_.CDF(5));
+    fprintf(stderr, "                6 Seeks: %.6f\n", seeks_.CDF(6));
+    fprintf(stderr, "                7 Seeks: %.6f\n", seeks_.CDF(7));
+    fprintf(stderr, "                8 Seeks: %.6f\n", seeks_.CDF(8));
+    fprintf(stderr, "               9+ Seeks: %.6f\n", seeks_.CDF(9));
+    const IoStats stats = reader_->TEST_iostats();
+    fprintf(stderr, "  Total Indexes Fetched: %.3f MB\n",
+            1.0 * stats.index_bytes / ki / ki);
+    fprintf(stderr, "     Total Data Fetched: %.3f GB\n",
+            1.0 * stats.data_bytes / ki / ki / ki);
+    fprintf(stderr, "           Avg I/O size: %.3f KB\n",
+            1.0 * stats.data_bytes / stats.data_ops / ki);
+  }
+
+  int force_negative_lookups_;
+  DirReader* reader_;
+
+  uint64_t num_empty_reads_;
+  uint64_t num_reads_;
+  BenchLatency read_latency_;
+  Histo seeks_;
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
+
+static void Usage(const char* argv0) {
+  fprintf(stderr, "Usage: %s [--flag=value]...\n", argv0);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "== workload\n");
+  fprintf(stderr, "--bench=io|qu\n");
+  fprintf(stderr, "--num=<keys>\n");
+  fprintf(stderr, "--key_size=<bytes>\n");
+  fprintf(stderr, "--value_size=<bytes>\n");
+  fprintf(stderr, "--skew=uniform|sequential|zipf\n");
+  fprintf(stderr, "--zipf_theta=<0-1>\n");
+  fprintf(stderr, "--link_speed=<MiB/s, 0 for no emulation>\n");
+  fprintf(stderr, "--prepare_keys=0|1\n");
+  fprintf(stderr, "--false_keys=0|1\n");
+  fprintf(stderr, "--seed=<int>\n");
+  fprintf(stderr, "--dir=<path>\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "== plfsdir options\n");
+  fprintf(stderr, "--lg_parts=<int>\n");
+  fprintf(stderr, "--threads=<bg compaction threads>\n");
+  fprintf(stderr, "--reader_threads=<int>\n");
+  fprintf(stderr, "--compression=none|snappy\n");
+  fprintf(stderr, "--unordered=0|1\n");
+  fprintf(stderr, "--leveldb_fmt=0|1\n");
+  fprintf(stderr, "--fixed_kv=0|1\n");
+  fprintf(stderr, "--memtable_size=<MiB>\n");
+  fprintf(stderr, "--block_batch_size=<MiB>\n");
+  fprintf(stderr, "--block_size=<KiB>\n");
+  fprintf(stderr, "--block_util=<0-1>\n");
+  fprintf(stderr, "--block_padding=0|1\n");
+  fprintf(stderr, "--data_buffer=<MiB>\n");
+  fprintf(stderr, "--min_data_buffer=<MiB>\n");
+  fprintf(stderr, "--index_buffer=<MiB>\n");
+  fprintf(stderr, "--min_index_buffer=<MiB>\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "== plfsdir filter options\n");
+  fprintf(stderr, "--filter=bf|bmp|r|fvbp|vbp|vb|fpfd|pfd|auto\n");
+  fprintf(stderr, "--ft_bits=<bits per key>\n");
+  fprintf(stderr, "--bf_bits=<bits per key>\n");
+  fprintf(stderr, "--bm_key_bits=<int>\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "== adv. options\n");
+  fprintf(stderr, "--force_fifo=0|1\n");
+  fprintf(stderr, "--print_events=0|1\n");
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+  std::string default_dir;
+
+  for (int i = 1; i < argc; i++) {
+    double d;
+    int n;
+    char junk;
+    pdlfs::Slice arg(argv[i]);
+    if (arg.starts_with("--bench=")) {
+      FLAGS_bench = argv[i] + strlen("--bench=");
+    } else if (arg.starts_with("--filter=")) {
+      FLAGS_filter = argv[i] + strlen("--filter=");
+    } else if (arg.starts_with("--compression=")) {
+      FLAGS_compression = argv[i] + strlen("--compression=");
+    } else if (arg.starts_with("--skew=")) {
+      FLAGS_skew = argv[i] + strlen("--skew=");
+    } else if (arg.starts_with("--dir=")) {
+      FLAGS_dir = argv[i] + strlen("--dir=");
+    } else if (sscanf(argv[i], "--zipf_theta=%lf%c", &d, &junk) == 1) {
+      FLAGS_zipf_theta = d;
+    } else if (sscanf(argv[i], "--block_util=%lf%c", &d, &junk) == 1) {
+      FLAGS_block_util = d;
+    } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
+      FLAGS_num = n;
+    } else if (sscanf(argv[i], "--key_size=%d%c", &n, &junk) == 1) {
+      FLAGS_key_size = n;
+    } else if (sscanf(argv[i], "--value_size=%d%c", &n, &junk) == 1) {
+      FLAGS_value_size = n;
+    } else if (sscanf(argv[i], "--lg_parts=%d%c", &n, &junk) == 1) {
+      FLAGS_lg_parts = n;
+    } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1) {
+      FLAGS_threads = n;
+    } else if (sscanf(argv[i], "--reader_threads=%d%c", &n, &junk) == 1) {
+      FLAGS_reader_threads = n;
+    } else if (sscanf(argv[i], "--ft_bits=%d%c", &n, &junk) == 1) {
+      FLAGS_ft_bits = n;
+    } else if (sscanf(argv[i], "--bf_bits=%d%c", &n, &junk) == 1) {
+      FLAGS_bf_bits = n;
+    } else if (sscanf(argv[i], "--bm_key_bits=%d%c", &n, &junk) == 1) {
+      FLAGS_bm_key_bits = n;
+    } else if (sscanf(argv[i], "--link_speed=%d%c", &n, &junk) == 1) {
+      FLAGS_link_speed = n;
+    } else if (sscanf(argv[i], "--memtable_size=%d%c", &n, &junk) == 1) {
+      FLAGS_memtable_size = n;
+    } else if (sscanf(argv[i], "--block_size=%d%c", &n, &junk) == 1) {
+      FLAGS_block_size = n;
+    } else if (sscanf(argv[i], "--block_batch_size=%d%c", &n, &junk) == 1) {
+      FLAGS_block_batch_size = n;
+    } else if (sscanf(argv[i], "--block_padding=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_block_padding = n;
+    } else if (sscanf(argv[i], "--data_buffer=%d%c", &n, &junk) == 1) {
+      FLAGS_data_buffer = n;
+    } else if (sscanf(argv[i], "--min_data_buffer=%d%c", &n, &junk) == 1) {
+      FLAGS_min_data_buffer = n;
+    } else if (sscanf(argv[i], "--index_buffer=%d%c", &n, &junk) == 1) {
+      FLAGS_index_buffer = n;
+    } else if (sscanf(argv[i], "--min_index_buffer=%d%c", &n, &junk) == 1) {
+      FLAGS_min_index_buffer = n;
+    } else if (sscanf(argv[i], "--leveldb_fmt=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_leveldb_fmt = n;
+    } else if (sscanf(argv[i], "--fixed_kv=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_fixed_kv = n;
+    } else if (sscanf(argv[i], "--unordered=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_unordered = n;
+    } else if (sscanf(argv[i], "--prepare_keys=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_prepare_keys = n;
+    } else if (sscanf(argv[i], "--false_keys=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_false_keys = n;
+    } else if (sscanf(argv[i], "--force_fifo=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_force_fifo = n;
+    } else if (sscanf(argv[i], "--print_events=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_print_events = n;
+    } else if (sscanf(argv[i], "--seed=%d%c", &n, &junk) == 1) {
+      FLAGS_seed = n;
+    } else {
+      fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      Usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  // Choose a location for the dir if none given with --dir=<path>
+  if (FLAGS_dir == NULL) {
+    pdlfs::Env::Default()->GetTestDirectory(&default_dir);
+    default_dir += "/plfsdir_bench";
+    FLAGS_dir = default_dir.c_str();
+  }
+
+  if (strcmp(FLAGS_bench, "io") == 0) {
+    pdlfs::plfsio::PlfsIoBench bench;
+    bench.LogAndApply();
+  } else if (strcmp(FLAGS_bench, "qu") == 0) {
+    pdlfs::plfsio::PlfsQuBench bench;
+    bench.LogAndApply();
+  } else {
+    Usage(argv[0]);
+    exit(1);
+  }
+  return 0;
+}
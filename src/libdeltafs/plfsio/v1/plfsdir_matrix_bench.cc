@@ -0,0 +1,544 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+/*
+ * plfsdir_matrix_bench: replay one recorded insert stream against a matrix
+ * of dir formats so they can be compared side by side. The stream is
+ * generated once and saved to --trace. Later runs that name the same trace
+ * file replay exactly the same keys and values, so results can be tracked
+ * across builds. Each format writes a fresh dir with the stream, then reads
+ * back a sample of inserted keys ("hits") and as many keys that were never
+ * inserted ("misses"). A table comparing all formats goes to stderr while
+ * one JSON line per format goes to stdout.
+ *
+ * Each entry of --matrix is a '+'-separated list of:
+ *      leveldb|array                  -- block format (default: leveldb)
+ *      nofilter|bf|bbf|xor|gcs        -- no filter, bloom, blocked bloom,
+ *                                        xor filters, or golomb-coded sets
+ *                                        (default: bf)
+ *      bmp|r|fvbp|vbp|vb|fpfd|pfd     -- bitmap filters in the given format
+ *      auto                           -- bitmap filters in a format picked
+ *                                        per table
+ *      snappy|zstd|lz4                -- compress data and index blocks.
+ *                                        Formats compiled out of the build
+ *                                        are written uncompressed.
+ */
+
+#include "v1.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/random.h"
+#include "pdlfs-common/strutil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Comma-separated list of dir formats to compare
+static const char* FLAGS_matrix =
+    "leveldb+bf,leveldb+bf+snappy,array+nofilter,array+bf,array+bbf,"
+    "array+xor,array+bmp,array+r,array+pfd,array+bf+snappy";
+
+// Trace file holding the insert stream. Recorded if it does not exist.
+static const char* FLAGS_trace = NULL;
+
+// Number of keys to record. Ignored when replaying an existing trace.
+static int FLAGS_num = 1 << 20;
+
+// Key and value sizes to record. Ignored when replaying an existing trace.
+static int FLAGS_key_size = 8;
+static int FLAGS_value_size = 32;
+
+// Number of epochs the stream is evenly divided into
+static int FLAGS_epochs = 1;
+
+// Number of keys read back per format, half hits and half misses
+static int FLAGS_reads = 100000;
+
+// Number of memtable partitions
+static int FLAGS_lg_parts = 2;
+
+// Number of compaction threads
+static int FLAGS_threads = 4;
+
+// Total memtable budget in MiB
+static int FLAGS_memtable_size = 48;
+
+// Bits per key for bloom, blocked bloom and xor filters
+static int FLAGS_bf_bits = 10;
+
+// Key space of bitmap filters in bits
+static int FLAGS_bm_key_bits = 24;
+
+// Keep the dir written for each format instead of deleting it
+static bool FLAGS_keep = false;
+
+// Seed for recording the stream and sampling reads
+static int FLAGS_seed = 301;
+
+// Parent of the dirs written for each format
+static const char* FLAGS_dir = NULL;
+
+namespace pdlfs {
+namespace plfsio {
+
+namespace {
+
+void Die(const char* msg, const Status& s) {
+  fprintf(stderr, "%s: %s\n", msg, s.ToString().c_str());
+  exit(1);
+}
+
+void DieIf(bool cond, const char* msg) {
+  if (cond) {
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+  }
+}
+
+const char kTraceMagic[] = "plfsdir-trace-v1";
+
+// An insert stream of fixed-size keys and values. Keys are distinct 32-bit
+// ints in [0,num) stored in the first 4 bytes of each key so that bitmap
+// filters can be used. Half of each value is random and the other half
+// repeats it so that compression has something to work with.
+class Trace {
+ public:
+  Trace() : key_size_(0), value_size_(0), num_(0) {}
+
+  // Load the trace from fname, or record a new one to fname if it does not
+  // exist.
+  void Open(Env* env, const char* fname) {
+    if (env->FileExists(fname)) {
+      std::string contents;
+      Status s = ReadFileToString(env, fname, &contents);
+      if (!s.ok()) Die("Cannot read trace", s);
+      Slice input(contents);
+      DieIf(!input.starts_with(kTraceMagic), "Not a trace file");
+      input.remove_prefix(sizeof(kTraceMagic) - 1);
+      DieIf(input.size() < 12, "Truncated trace");
+      key_size_ = DecodeFixed32(input.data());
+      value_size_ = DecodeFixed32(input.data() + 4);
+      num_ = DecodeFixed32(input.data() + 8);
+      input.remove_prefix(12);
+      DieIf(input.size() != size_t(num_) * record_size(), "Truncated trace");
+      records_ = input.ToString();
+      fprintf(stderr, "Replaying %u keys from %s\n", num_, fname);
+    } else {
+      Record(FLAGS_num, FLAGS_key_size, FLAGS_value_size);
+      std::string contents(kTraceMagic);
+      PutFixed32(&contents, key_size_);
+      PutFixed32(&contents, value_size_);
+      PutFixed32(&contents, num_);
+      contents += records_;
+      Status s = WriteStringToFile(env, contents, fname);
+      if (!s.ok()) Die("Cannot write trace", s);
+      fprintf(stderr, "Recorded %u keys to %s\n", num_, fname);
+    }
+  }
+
+  uint32_t key_size() const { return key_size_; }
+  uint32_t value_size() const { return value_size_; }
+  uint32_t num() const { return num_; }
+  size_t record_size() const { return key_size_ + value_size_; }
+
+  Slice key(uint32_t i) const {
+    return Slice(&records_[i * record_size()], key_size_);
+  }
+
+  Slice value(uint32_t i) const {
+    return Slice(&records_[i * record_size() + key_size_], value_size_);
+  }
+
+ private:
+  void Record(int num, int key_size, int value_size) {
+    DieIf(num <= 0 || key_size < 4 || value_size < 0, "Bad trace shape");
+    key_size_ = uint32_t(key_size);
+    value_size_ = uint32_t(value_size);
+    num_ = uint32_t(num);
+    std::vector<uint32_t> ids(num_);
+    for (uint32_t i = 0; i < num_; i++) ids[i] = i;
+    Random rnd(FLAGS_seed);
+    for (uint32_t i = num_ - 1; i > 0; i--) {
+      std::swap(ids[i], ids[rnd.Uniform(i + 1)]);
+    }
+    records_.reserve(num_ * record_size());
+    std::string rec;
+    for (uint32_t i = 0; i < num_; i++) {
+      rec.assign(record_size(), 0);
+      EncodeFixed32(&rec[0], ids[i]);
+      char* const v = &rec[key_size_];
+      const uint32_t half = value_size_ / 2;
+      for (uint32_t j = 0; j < value_size_ - half; j++) {
+        v[j] = static_cast<char>(rnd.Uniform(256));
+      }
+      memcpy(v + value_size_ - half, v, half);
+      records_ += rec;
+    }
+  }
+
+  uint32_t key_size_;
+  uint32_t value_size_;
+  uint32_t num_;
+  std::string records_;
+};
+
+// Results of replaying the trace with one format
+struct FormatStats {
+  FormatStats()
+      : write_micros(0),
+        disk_bytes(0),
+        filter_bytes(0),
+        probes(0),
+        false_positives(0) {
+    hits.Clear();
+    misses.Clear();
+  }
+
+  uint64_t write_micros;
+  uint64_t disk_bytes;
+  uint64_t filter_bytes;
+  Histogram hits;    // Read latency of inserted keys
+  Histogram misses;  // Read latency of keys never inserted
+  uint64_t probes;  // Filter probes by misses
+  uint64_t false_positives;
+};
+
+class PlfsMatrixBench {
+ public:
+  PlfsMatrixBench() : env_(Env::Default()), pool_(NULL) {}
+  ~PlfsMatrixBench() { delete pool_; }
+
+  void LogAndApply() {
+    trace_.Open(env_, FLAGS_trace);
+    if (FLAGS_threads > 0) {
+      pool_ = ThreadPool::NewFixed(FLAGS_threads, true);
+    }
+    std::vector<std::string> formats;
+    SplitString(&formats, FLAGS_matrix, ',');
+    DieIf(formats.empty(), "Empty matrix");
+    std::vector<FormatStats> results(formats.size());
+    env_->CreateDir(FLAGS_dir);
+    for (size_t i = 0; i < formats.size(); i++) {
+      fprintf(stderr, "Running %s...\n", formats[i].c_str());
+      DirOptions options = ParseFormat(formats[i]);
+      char tmp[30];
+      snprintf(tmp, sizeof(tmp), "/%d", int(i));
+      const std::string dirname = std::string(FLAGS_dir) + tmp;
+      DestroyDir(dirname, options);
+      env_->CreateDir(dirname.c_str());
+      Write(options, dirname, &results[i]);
+      Read(options, dirname, &results[i]);
+      if (!FLAGS_keep) {
+        DestroyDir(dirname, options);
+        env_->DeleteDir(dirname.c_str());
+      }
+      PrintJson(formats[i], results[i]);
+    }
+    PrintTable(formats, results);
+  }
+
+ private:
+  DirOptions ParseFormat(const std::string& format) const {
+    DirOptions options;
+    options.mode = kDmUniqueKey;
+    options.lg_parts = FLAGS_lg_parts;
+    options.key_size = trace_.key_size();
+    options.value_size = trace_.value_size();
+    options.fixed_kv_length = true;
+    options.total_memtable_budget =
+        static_cast<size_t>(FLAGS_memtable_size) << 20;
+    options.bf_bits_per_key = static_cast<size_t>(FLAGS_bf_bits);
+    options.filter_bits_per_key = static_cast<size_t>(FLAGS_bf_bits);
+    options.bm_key_bits = static_cast<size_t>(FLAGS_bm_key_bits);
+    options.leveldb_compatible = true;
+    options.filter = kFtBloomFilter;
+    options.compression = kNoCompression;
+    options.index_compression = kNoCompression;
+    options.force_compression = true;
+    options.compaction_pool = pool_;
+    options.allow_env_threads = false;
+    options.env = env_;
+    std::vector<std::string> parts;
+    SplitString(&parts, format.c_str(), '+');
+    for (size_t i = 0; i < parts.size(); i++) {
+      const std::string& p = parts[i];
+      if (p == "leveldb") {
+        options.leveldb_compatible = true;
+      } else if (p == "array") {
+        options.leveldb_compatible = false;
+      } else if (p == "nofilter") {
+        options.filter = kFtNoFilter;
+      } else if (p == "bf") {
+        options.filter = kFtBloomFilter;
+      } else if (p == "bbf") {
+        options.filter = kFtBlockedBloomFilter;
+      } else if (p == "xor") {
+        options.filter = kFtXorFilter;
+      } else if (p == "gcs") {
+        options.filter = kFtGcsFilter;
+      } else if (p == "snappy") {
+        options.compression = kSnappyCompression;
+        options.index_compression = kSnappyCompression;
+      } else if (p == "zstd") {
+        options.compression = kZstdCompression;
+        options.index_compression = kZstdCompression;
+      } else if (p == "lz4") {
+        options.compression = kLz4Compression;
+        options.index_compression = kLz4Compression;
+      } else {
+        options.filter = kFtBitmap;
+        options.bm_fmt = BitmapFormatByName(p);
+      }
+    }
+    if (options.filter == kFtBitmap) {
+      DieIf(FLAGS_bm_key_bits < 32 &&
+                2 * uint64_t(trace_.num()) > (uint64_t(1) << FLAGS_bm_key_bits),
+            "Too many keys for the bitmap key space");
+    }
+    return options;
+  }
+
+  static BitmapFormat BitmapFormatByName(const std::string& name) {
+    if (name == "bmp") {
+      return kFmtUncompressed;
+    } else if (name == "r") {
+      return kFmtRoaring;
+    } else if (name == "fvbp") {
+      return kFmtFastVarintPlus;
+    } else if (name == "vbp") {
+      return kFmtVarintPlus;
+    } else if (name == "vb") {
+      return kFmtVarint;
+    } else if (name == "fpfd") {
+      return kFmtFastPfDelta;
+    } else if (name == "pfd") {
+      return kFmtPfDelta;
+    } else if (name == "auto") {
+      return kFmtAuto;
+    } else {
+      fprintf(stderr, "Bad format: %s\n", name.c_str());
+      exit(1);
+    }
+  }
+
+  void Write(const DirOptions& options, const std::string& dirname,
+             FormatStats* stats) {
+    DirWriter* writer;
+    Status s = DirWriter::Open(options, dirname, &writer);
+    if (!s.ok()) Die("Cannot open dir", s);
+    const uint64_t start = CurrentMicros();
+    const uint32_t n = trace_.num();
+    uint32_t i = 0;
+    for (int e = 0; s.ok() && e < FLAGS_epochs; e++) {
+      const uint32_t end = uint32_t(uint64_t(n) * (e + 1) / FLAGS_epochs);
+      for (; s.ok() && i < end; i++) {
+        s = writer->Add(trace_.key(i), trace_.value(i), e);
+      }
+      if (s.ok()) {
+        s = writer->EpochFlush(e);
+      }
+    }
+    if (s.ok()) {
+      s = writer->Finish();
+    }
+    if (!s.ok()) Die("Cannot write", s);
+    stats->write_micros = std::max<uint64_t>(1, CurrentMicros() - start);
+    stats->filter_bytes = writer->TEST_raw_filter_contents();
+    delete writer;
+    std::vector<std::string> names;
+    s = env_->GetChildren(dirname.c_str(), &names);
+    if (!s.ok()) Die("Cannot list dir", s);
+    for (size_t j = 0; j < names.size(); j++) {
+      uint64_t size;
+      const std::string fname = dirname + "/" + names[j];
+      if (env_->GetFileSize(fname.c_str(), &size).ok()) {
+        stats->disk_bytes += size;
+      }
+    }
+  }
+
+  void Read(const DirOptions& options, const std::string& dirname,
+            FormatStats* stats) {
+    DirReader* reader;
+    Status s = DirReader::Open(options, dirname, &reader);
+    if (!s.ok()) Die("Cannot open dir for reading", s);
+    Random rnd(FLAGS_seed + 1);
+    std::string key(trace_.key_size(), 0);
+    std::string dst;
+    for (int r = 0; r < FLAGS_reads; r++) {
+      const bool hit = (r % 2) == 0;
+      const uint32_t i = rnd.Uniform(trace_.num());
+      if (!hit) {  // Keys in [num,2*num) were never inserted
+        EncodeFixed32(&key[0], trace_.num() + i);
+      }
+      DirReader::ReadOp op;
+      QueryStats qstats;
+      op.stats = &qstats;
+      dst.clear();
+      const uint64_t op_start = CurrentMicros();
+      s = reader->Read(op, hit ? trace_.key(i) : Slice(key), &dst);
+      const uint64_t micros = CurrentMicros() - op_start;
+      if (!s.ok()) Die("Cannot read", s);
+      if (hit) {
+        DieIf(dst != trace_.value(i), "Wrong value read");
+        stats->hits.Add(micros);
+      } else {
+        DieIf(!dst.empty(), "Value read for a key never inserted");
+        stats->misses.Add(micros);
+        stats->probes += qstats.filter_probes;
+        stats->false_positives += qstats.filter_false_positives;
+      }
+    }
+    delete reader;
+  }
+
+  double FalsePositiveRate(const FormatStats& s) const {
+    return s.probes != 0 ? double(s.false_positives) / s.probes : 0;
+  }
+
+  void PrintJson(const std::string& format, const FormatStats& s) {
+    const uint32_t n = trace_.num();
+    char tmp[800];
+    snprintf(tmp, sizeof(tmp),
+             "{\"bench\":\"matrix\",\"format\":\"%s\",\"num_keys\":%u,"
+             "\"key_size\":%u,\"value_size\":%u,\"epochs\":%d,"
+             "\"write_ops_per_sec\":%.3f,\"write_mib_per_sec\":%.3f,"
+             "\"disk_bytes\":%llu,\"filter_bytes_per_key\":%.3f,"
+             "\"hit_avg_micros\":%.3f,\"hit_p99_micros\":%.3f,"
+             "\"miss_avg_micros\":%.3f,\"miss_p99_micros\":%.3f,"
+             "\"filter_probes\":%llu,\"false_positive_rate\":%.6f}",
+             format.c_str(), n, trace_.key_size(), trace_.value_size(),
+             FLAGS_epochs, 1e6 * n / s.write_micros,
+             double(n) * trace_.record_size() / s.write_micros * 1e6 /
+                 1048576,
+             static_cast<unsigned long long>(s.disk_bytes),
+             double(s.filter_bytes) / n, s.hits.Average(),
+             s.hits.Percentile(99), s.misses.Average(),
+             s.misses.Percentile(99),
+             static_cast<unsigned long long>(s.probes), FalsePositiveRate(s));
+    fprintf(stdout, "%s\n", tmp);
+    fflush(stdout);
+  }
+
+  void PrintTable(const std::vector<std::string>& formats,
+                  const std::vector<FormatStats>& results) {
+    const uint32_t n = trace_.num();
+    fprintf(stderr, "%-24s %11s %10s %10s %8s %9s %9s %9s\n", "format",
+            "write MiB/s", "disk MiB", "filter B/k", "FP rate", "hit us",
+            "hit p99", "miss us");
+    for (size_t i = 0; i < formats.size(); i++) {
+      const FormatStats& s = results[i];
+      fprintf(stderr, "%-24s %11.1f %10.2f %10.3f %8.4f %9.2f %9.2f %9.2f\n",
+              formats[i].c_str(),
+              double(n) * trace_.record_size() / s.write_micros * 1e6 /
+                  1048576,
+              s.disk_bytes / 1048576.0, double(s.filter_bytes) / n,
+              FalsePositiveRate(s), s.hits.Average(), s.hits.Percentile(99),
+              s.misses.Average());
+    }
+  }
+
+  Env* const env_;
+  ThreadPool* pool_;
+  Trace trace_;
+};
+
+}  // namespace
+}  // namespace plfsio
+}  // namespace pdlfs
+
+static void Usage(const char* argv0) {
+  fprintf(stderr, "Usage: %s --trace=<path> [--flag=value]...\n", argv0);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "--matrix=<format>[,<format>]...\n");
+  fprintf(stderr, "--num=<keys to record>\n");
+  fprintf(stderr, "--key_size=<bytes to record>\n");
+  fprintf(stderr, "--value_size=<bytes to record>\n");
+  fprintf(stderr, "--epochs=<int>\n");
+  fprintf(stderr, "--reads=<int>\n");
+  fprintf(stderr, "--lg_parts=<int>\n");
+  fprintf(stderr, "--threads=<int>\n");
+  fprintf(stderr, "--memtable_size=<MiB>\n");
+  fprintf(stderr, "--bf_bits=<int>\n");
+  fprintf(stderr, "--bm_key_bits=<int>\n");
+  fprintf(stderr, "--keep=0|1\n");
+  fprintf(stderr, "--seed=<int>\n");
+  fprintf(stderr, "--dir=<path>\n");
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+  std::string default_dir;
+  for (int i = 1; i < argc; i++) {
+    int n;
+    char junk;
+    pdlfs::Slice arg(argv[i]);
+    if (arg.starts_with("--matrix=")) {
+      FLAGS_matrix = argv[i] + strlen("--matrix=");
+    } else if (arg.starts_with("--trace=")) {
+      FLAGS_trace = argv[i] + strlen("--trace=");
+    } else if (arg.starts_with("--dir=")) {
+      FLAGS_dir = argv[i] + strlen("--dir=");
+    } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
+      FLAGS_num = n;
+    } else if (sscanf(argv[i], "--key_size=%d%c", &n, &junk) == 1) {
+      FLAGS_key_size = n;
+    } else if (sscanf(argv[i], "--value_size=%d%c", &n, &junk) == 1) {
+      FLAGS_value_size = n;
+    } else if (sscanf(argv[i], "--epochs=%d%c", &n, &junk) == 1) {
+      FLAGS_epochs = n;
+    } else if (sscanf(argv[i], "--reads=%d%c", &n, &junk) == 1) {
+      FLAGS_reads = n;
+    } else if (sscanf(argv[i], "--lg_parts=%d%c", &n, &junk) == 1) {
+      FLAGS_lg_parts = n;
+    } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1) {
+      FLAGS_threads = n;
+    } else if (sscanf(argv[i], "--memtable_size=%d%c", &n, &junk) == 1) {
+      FLAGS_memtable_size = n;
+    } else if (sscanf(argv[i], "--bf_bits=%d%c", &n, &junk) == 1) {
+      FLAGS_bf_bits = n;
+    } else if (sscanf(argv[i], "--bm_key_bits=%d%c", &n, &junk) == 1) {
+      FLAGS_bm_key_bits = n;
+    } else if (sscanf(argv[i], "--keep=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_keep = n;
+    } else if (sscanf(argv[i], "--seed=%d%c", &n, &junk) == 1) {
+      FLAGS_seed = n;
+    } else {
+      fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      Usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if (FLAGS_trace == NULL || FLAGS_epochs <= 0 || FLAGS_reads < 0) {
+    Usage(argv[0]);
+    exit(1);
+  }
+
+  // Choose a location for the dirs if none given with --dir=<path>
+  if (FLAGS_dir == NULL) {
+    pdlfs::Env::Default()->GetTestDirectory(&default_dir);
+    default_dir += "/plfsdir_matrix_bench";
+    FLAGS_dir = default_dir.c_str();
+  }
+
+  pdlfs::plfsio::PlfsMatrixBench bench;
+  bench.LogAndApply();
+  return 0;
+}
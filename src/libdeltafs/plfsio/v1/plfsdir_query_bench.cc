@@ -0,0 +1,476 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+/*
+ * plfsdir_query_bench: replay a mix of queries against an existing plfsdir,
+ * such as one written by "plfsdir_bench --bench=io --link_speed=0". Keys are
+ * sampled from the dir itself. The same sequence of queries is run twice
+ * against a single reader: first with empty reader caches ("cold"), then
+ * again with whatever the first pass left in them ("warm"). The OS page
+ * cache is not dropped between passes. A human-readable report goes to
+ * stderr while one JSON line per pass and query type goes to stdout.
+ */
+
+#include "bench_util.h"
+#include "v1.h"
+
+#include "pdlfs-common/cache.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/random.h"
+#include "pdlfs-common/strutil.h"
+#include "pdlfs-common/xxhash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Comma-separated list of query types and their relative weights:
+//      point       -- read a key from a single random epoch
+//      trajectory  -- read a key from all epochs
+//      scan        -- list about FLAGS_scan_keys consecutive keys from all
+//                     epochs
+static const char* FLAGS_mix = "point:80,trajectory:15,scan:5";
+
+// Number of queries per pass
+static int FLAGS_num = 100000;
+
+// Key popularity: uniform or zipf
+static const char* FLAGS_skew = "zipf";
+
+// Skew of the zipfian distribution. Must be in (0,1).
+static double FLAGS_zipf_theta = 0.99;
+
+// Approximate number of keys covered by each scan per epoch
+static int FLAGS_scan_keys = 100;
+
+// Max number of keys sampled from the dir for building queries
+static int FLAGS_max_keys = 1 << 20;
+
+// Epoch to sample keys from
+static int FLAGS_key_epoch = 0;
+
+// Capacity of the reader's block cache in MiB. 0 disables block caching.
+static int FLAGS_block_cache_size = 0;
+
+// Load index and filter blocks on first access instead of at open time
+static bool FLAGS_lazy_indexes = false;
+
+// Number of threads for reading epochs in parallel. 0 reads serially.
+static int FLAGS_reader_threads = 0;
+
+// Rank of the writer of the dir
+static int FLAGS_rank = 0;
+
+// Seed for key sampling and query generation
+static int FLAGS_seed = 301;
+
+// Use the dir at the following path
+static const char* FLAGS_dir = NULL;
+
+namespace pdlfs {
+namespace plfsio {
+
+namespace {
+
+void Die(const char* msg, const Status& s) {
+  fprintf(stderr, "%s: %s\n", msg, s.ToString().c_str());
+  exit(1);
+}
+
+void DieIf(bool cond, const char* msg) {
+  if (cond) {
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+  }
+}
+
+enum QueryType { kPoint = 0, kTrajectory = 1, kScan = 2, kNumQueryTypes = 3 };
+
+const char* QueryTypeName(int type) {
+  static const char* const names[kNumQueryTypes] = {"point", "trajectory",
+                                                     "scan"};
+  return names[type];
+}
+
+struct Query {
+  QueryType type;
+  uint32_t key;  // Index into the sorted key sample
+  int epoch;     // Only used by point queries
+};
+
+// Costs of all queries of a type in a pass. Reads report their costs through
+// QueryStats. Scans do not, so their costs are taken from the reader's
+// aggregated I/O stats instead.
+struct QueryTypeStats {
+  QueryTypeStats()
+      : n(0),
+        micros(0),
+        results(0),
+        seeks(0),
+        bytes_read(0),
+        filter_probes(0),
+        filter_false_positives(0),
+        cache_hits(0),
+        cache_misses(0),
+        io_micros(0) {}
+
+  BenchLatency latency;
+  uint64_t n;
+  uint64_t micros;
+  uint64_t results;  // Non-empty reads, or entries scanned
+  uint64_t seeks;
+  uint64_t bytes_read;
+  uint64_t filter_probes;
+  uint64_t filter_false_positives;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t io_micros;
+};
+
+// Keep a uniform sample of up to FLAGS_max_keys keys using reservoir
+// sampling.
+struct KeySampler {
+  KeySampler(std::vector<std::string>* k, uint32_t seed)
+      : keys(k), rnd(seed), seen(0) {}
+  std::vector<std::string>* keys;
+  Random rnd;
+  uint64_t seen;
+};
+
+int CollectKey(void* arg, const Slice& key, const Slice& value) {
+  KeySampler* const s = static_cast<KeySampler*>(arg);
+  s->seen++;
+  if (s->keys->size() < size_t(FLAGS_max_keys)) {
+    s->keys->push_back(key.ToString());
+  } else {
+    const uint64_t r = uint64_t(s->rnd.Next()) << 31 | s->rnd.Next();
+    const uint64_t j = r % s->seen;
+    if (j < s->keys->size()) (*s->keys)[j] = key.ToString();
+  }
+  return 0;
+}
+
+int CountEntry(void* arg, const Slice& key, const Slice& value) {
+  ++*static_cast<uint64_t*>(arg);
+  return 0;
+}
+
+}  // anonymous namespace
+
+class PlfsQueryBench {
+ public:
+  PlfsQueryBench()
+      : num_epochs_(0), reader_(NULL), block_cache_(NULL), pool_(NULL) {
+    options_.rank = FLAGS_rank;
+    if (FLAGS_block_cache_size != 0) {
+      block_cache_ = NewLRUCache(size_t(FLAGS_block_cache_size) << 20);
+    }
+    options_.lazy_indexes = FLAGS_lazy_indexes;
+    options_.allow_env_threads = false;
+    if (FLAGS_reader_threads != 0) {
+      pool_ = ThreadPool::NewFixed(FLAGS_reader_threads);
+      options_.parallel_reads = true;
+    }
+    options_.reader_pool = pool_;
+    ParseMix();
+  }
+
+  ~PlfsQueryBench() {
+    delete reader_;
+    delete block_cache_;
+    delete pool_;
+  }
+
+  void LogAndApply() {
+    SampleKeys();
+    GenerateQueries();
+    // Reader caches start empty
+    options_.block_cache = block_cache_;
+    Status s = DirReader::Open(options_, FLAGS_dir, &reader_);
+    if (!s.ok()) Die("Cannot open dir", s);
+    RunPass("cold");
+    RunPass("warm");
+  }
+
+ private:
+  void ParseMix() {
+    std::vector<std::string> parts;
+    SplitString(&parts, FLAGS_mix, ',');
+    int total = 0;
+    memset(weights_, 0, sizeof(weights_));
+    for (size_t i = 0; i < parts.size(); i++) {
+      const size_t c = parts[i].find(':');
+      DieIf(c == std::string::npos, "Bad mix: must be type:weight,...");
+      const std::string name = parts[i].substr(0, c);
+      int type = 0;
+      while (type < kNumQueryTypes && name != QueryTypeName(type)) type++;
+      DieIf(type == kNumQueryTypes, "Bad mix: unknown query type");
+      weights_[type] = atoi(parts[i].c_str() + c + 1);
+      DieIf(weights_[type] < 0, "Bad mix: negative weight");
+      total += weights_[type];
+    }
+    DieIf(total == 0, "Bad mix: all weights are zero");
+  }
+
+  // Sample keys from an epoch with a dedicated reader so that the sampling
+  // scan does not warm up the reader being measured.
+  void SampleKeys() {
+    DirReader* reader;
+    Status s = DirReader::Open(options_, FLAGS_dir, &reader);
+    if (!s.ok()) Die("Cannot open dir", s);
+    fprintf(stderr, "Sampling keys...\n");
+    KeySampler arg(&keys_, FLAGS_seed);
+    DirReader::ScanOp op;
+    op.SetEpoch(FLAGS_key_epoch);
+    s = reader->Scan(op, CollectKey, &arg);
+    if (!s.ok()) Die("Cannot scan dir", s);
+    DieIf(keys_.empty(), "No keys found in the sampled epoch");
+    std::sort(keys_.begin(), keys_.end());
+    keys_.erase(std::unique(keys_.begin(), keys_.end()), keys_.end());
+    std::vector<bool> epochs;
+    DirReader::ReadOp rop;
+    s = reader->Membership(rop, keys_[0], &epochs);
+    if (!s.ok()) Die("Cannot check membership", s);
+    num_epochs_ = int(epochs.size());
+    delete reader;
+    fprintf(stderr, "Done! (%d keys, %d epochs)\n", int(keys_.size()),
+            num_epochs_);
+  }
+
+  void GenerateQueries() {
+    const uint32_t n = static_cast<uint32_t>(keys_.size());
+    const bool zipf = strcmp(FLAGS_skew, "zipf") == 0;
+    DieIf(!zipf && strcmp(FLAGS_skew, "uniform") != 0,
+          "Bad skew: must be uniform or zipf");
+    DieIf(zipf && (FLAGS_zipf_theta <= 0 || FLAGS_zipf_theta >= 1),
+          "Bad zipf theta: must be in (0,1)");
+    ZipfGenerator zipf_gen(n, FLAGS_zipf_theta, FLAGS_seed);
+    Random rnd(FLAGS_seed + 1);
+    const int total =
+        weights_[kPoint] + weights_[kTrajectory] + weights_[kScan];
+    queries_.resize(static_cast<size_t>(FLAGS_num));
+    for (size_t i = 0; i < queries_.size(); i++) {
+      Query* const q = &queries_[i];
+      const int w = static_cast<int>(rnd.Uniform(total));
+      if (w < weights_[kPoint]) {
+        q->type = kPoint;
+      } else if (w < weights_[kPoint] + weights_[kTrajectory]) {
+        q->type = kTrajectory;
+      } else {
+        q->type = kScan;
+      }
+      if (zipf) {
+        // Scatter popular ranks across the key space so that hot keys are
+        // not all neighbors
+        const uint32_t rank = zipf_gen.Next();
+        q->key = static_cast<uint32_t>(xxhash64(&rank, sizeof(rank), 0) % n);
+      } else {
+        q->key = rnd.Uniform(n);
+      }
+      q->epoch = static_cast<int>(rnd.Uniform(num_epochs_));
+    }
+  }
+
+  void RunQuery(const Query& q, std::string* buf, QueryTypeStats* s) {
+    const Slice key = keys_[q.key];
+    const uint64_t start = CurrentMicros();
+    if (q.type == kScan) {
+      const IoStats before = reader_->TEST_iostats();
+      DirReader::ScanOp op;
+      op.key_start = key;
+      const size_t end = q.key + size_t(FLAGS_scan_keys);
+      if (end < keys_.size()) op.key_end = keys_[end];
+      size_t seeks = 0;
+      op.seeks = &seeks;
+      uint64_t n = 0;
+      Status st = reader_->Scan(op, CountEntry, &n);
+      if (!st.ok()) Die("Cannot scan", st);
+      s->latency.Add(CurrentMicros() - start);
+      const IoStats after = reader_->TEST_iostats();
+      s->results += n;
+      s->seeks += seeks;
+      s->bytes_read += after.data_bytes - before.data_bytes;
+      s->cache_hits += after.cache_hits - before.cache_hits;
+      s->cache_misses += after.cache_misses - before.cache_misses;
+    } else {
+      DirReader::ReadOp op;
+      if (q.type == kPoint) op.SetEpoch(q.epoch);
+      QueryStats stats;
+      op.stats = &stats;
+      size_t seeks = 0;
+      op.seeks = &seeks;
+      buf->clear();
+      Status st = reader_->Read(op, key, buf);
+      if (!st.ok()) Die("Cannot read", st);
+      s->latency.Add(CurrentMicros() - start);
+      if (!buf->empty()) s->results++;
+      s->seeks += seeks;
+      s->bytes_read += stats.bytes_read;
+      s->filter_probes += stats.filter_probes;
+      s->filter_false_positives += stats.filter_false_positives;
+      s->cache_hits += stats.cache_hits;
+      s->cache_misses += stats.cache_misses;
+      s->io_micros += stats.io_micros;
+    }
+    s->micros += CurrentMicros() - start;
+    s->n++;
+  }
+
+  void RunPass(const char* pass) {
+    fprintf(stderr, "Running %s queries...\n", pass);
+    QueryTypeStats stats[kNumQueryTypes];
+    std::string buf;
+    const uint64_t start = CurrentMicros();
+    for (size_t i = 0; i < queries_.size(); i++) {
+      // Report progress
+      if ((i & 0x3FFF) == 0) {
+        fprintf(stderr, "\r%.2f%%", 100.0 * i / queries_.size());
+      }
+      RunQuery(queries_[i], &buf, &stats[queries_[i].type]);
+    }
+    const uint64_t dura = CurrentMicros() - start;
+    fprintf(stderr, "\r100.00%%\n");
+    fprintf(stderr, "Done!\n");
+    Report(pass, dura, stats);
+  }
+
+  void Report(const char* pass, uint64_t dura, const QueryTypeStats* stats) {
+    fprintf(stderr, "----------------------------------------\n");
+    fprintf(stderr, "%s pass: %.3f s, %.1f queries/s\n", pass, dura / 1e6,
+            1e6 * queries_.size() / dura);
+    for (int t = 0; t < kNumQueryTypes; t++) {
+      const QueryTypeStats& s = stats[t];
+      if (s.n == 0) continue;
+      fprintf(stderr,
+              "%12s: %8llu queries, %.3f us avg, %.1f seeks, %.1f KiB read, "
+              "%llu/%llu cache hits/misses\n",
+              QueryTypeName(t), static_cast<unsigned long long>(s.n),
+              double(s.micros) / s.n, double(s.seeks) / s.n,
+              double(s.bytes_read) / s.n / 1024,
+              static_cast<unsigned long long>(s.cache_hits),
+              static_cast<unsigned long long>(s.cache_misses));
+      PrintJson(pass, t, s);
+    }
+  }
+
+  void PrintJson(const char* pass, int type, const QueryTypeStats& s) {
+    std::string json;
+    char tmp[800];
+    snprintf(tmp, sizeof(tmp),
+             "{\"bench\":\"query\",\"pass\":\"%s\",\"type\":\"%s\","
+             "\"mix\":\"%s\",\"skew\":\"%s\",\"num_keys\":%d,"
+             "\"num_epochs\":%d,\"block_cache_mib\":%d,\"lazy_indexes\":%d,"
+             "\"reader_threads\":%d,\"num_ops\":%llu,\"ops_per_sec\":%.3f,"
+             "\"avg_results\":%.3f,\"avg_seeks\":%.3f,\"avg_bytes_read\":%.3f,"
+             "\"avg_filter_probes\":%.3f,\"avg_filter_false_positives\":%.3f,"
+             "\"cache_hits\":%llu,\"cache_misses\":%llu,"
+             "\"avg_io_micros\":%.3f,\"latency_micros\":",
+             pass, QueryTypeName(type), FLAGS_mix, FLAGS_skew,
+             int(keys_.size()), num_epochs_, FLAGS_block_cache_size,
+             int(FLAGS_lazy_indexes), FLAGS_reader_threads,
+             static_cast<unsigned long long>(s.n), 1e6 * s.n / s.micros,
+             double(s.results) / s.n, double(s.seeks) / s.n,
+             double(s.bytes_read) / s.n, double(s.filter_probes) / s.n,
+             double(s.filter_false_positives) / s.n,
+             static_cast<unsigned long long>(s.cache_hits),
+             static_cast<unsigned long long>(s.cache_misses),
+             double(s.io_micros) / s.n);
+    json += tmp;
+    s.latency.AppendJson(&json);
+    json += "}";
+    fprintf(stdout, "%s\n", json.c_str());
+    fflush(stdout);
+  }
+
+  int weights_[kNumQueryTypes];
+  std::vector<std::string> keys_;  // Sorted sample of the keys of the dir
+  std::vector<Query> queries_;
+  int num_epochs_;
+  DirOptions options_;
+  DirReader* reader_;
+  Cache* block_cache_;
+  ThreadPool* pool_;
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
+
+static void Usage(const char* argv0) {
+  fprintf(stderr, "Usage: %s --dir=<path> [--flag=value]...\n", argv0);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "--mix=point:<w>,trajectory:<w>,scan:<w>\n");
+  fprintf(stderr, "--num=<queries per pass>\n");
+  fprintf(stderr, "--skew=uniform|zipf\n");
+  fprintf(stderr, "--zipf_theta=<0-1>\n");
+  fprintf(stderr, "--scan_keys=<keys per scan>\n");
+  fprintf(stderr, "--max_keys=<keys to sample>\n");
+  fprintf(stderr, "--key_epoch=<epoch to sample keys from>\n");
+  fprintf(stderr, "--block_cache_size=<MiB>\n");
+  fprintf(stderr, "--lazy_indexes=0|1\n");
+  fprintf(stderr, "--reader_threads=<int>\n");
+  fprintf(stderr, "--rank=<int>\n");
+  fprintf(stderr, "--seed=<int>\n");
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    double d;
+    int n;
+    char junk;
+    pdlfs::Slice arg(argv[i]);
+    if (arg.starts_with("--mix=")) {
+      FLAGS_mix = argv[i] + strlen("--mix=");
+    } else if (arg.starts_with("--skew=")) {
+      FLAGS_skew = argv[i] + strlen("--skew=");
+    } else if (arg.starts_with("--dir=")) {
+      FLAGS_dir = argv[i] + strlen("--dir=");
+    } else if (sscanf(argv[i], "--zipf_theta=%lf%c", &d, &junk) == 1) {
+      FLAGS_zipf_theta = d;
+    } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
+      FLAGS_num = n;
+    } else if (sscanf(argv[i], "--scan_keys=%d%c", &n, &junk) == 1) {
+      FLAGS_scan_keys = n;
+    } else if (sscanf(argv[i], "--max_keys=%d%c", &n, &junk) == 1) {
+      FLAGS_max_keys = n;
+    } else if (sscanf(argv[i], "--key_epoch=%d%c", &n, &junk) == 1) {
+      FLAGS_key_epoch = n;
+    } else if (sscanf(argv[i], "--block_cache_size=%d%c", &n, &junk) == 1) {
+      FLAGS_block_cache_size = n;
+    } else if (sscanf(argv[i], "--lazy_indexes=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_lazy_indexes = n;
+    } else if (sscanf(argv[i], "--reader_threads=%d%c", &n, &junk) == 1) {
+      FLAGS_reader_threads = n;
+    } else if (sscanf(argv[i], "--rank=%d%c", &n, &junk) == 1) {
+      FLAGS_rank = n;
+    } else if (sscanf(argv[i], "--seed=%d%c", &n, &junk) == 1) {
+      FLAGS_seed = n;
+    } else {
+      fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      Usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if (FLAGS_dir == NULL || FLAGS_num <= 0 || FLAGS_max_keys <= 0) {
+    Usage(argv[0]);
+    exit(1);
+  }
+
+  pdlfs::plfsio::PlfsQueryBench bench;
+  bench.LogAndApply();
+  return 0;
+}
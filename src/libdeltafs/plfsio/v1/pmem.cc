@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "pmem.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/port.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace pdlfs {
+namespace plfsio {
+
+namespace {
+const uint64_t kFileMagic = 0x706c66736275666dull;  // "plfsbufm"
+const uint32_t kSlotMagic = 0x736c6f74u;            // "slot"
+// The file header takes the first page. Slots are page aligned.
+const size_t kPageSize = 4096;
+const size_t kSlotHeaderSize = 64;
+const size_t kCacheLineSize = 64;
+
+size_t SlotStride(size_t slot_size) {
+  const size_t n = kSlotHeaderSize + slot_size;
+  return (n + kPageSize - 1) & ~(kPageSize - 1);
+}
+
+Status IOError(const std::string& fname, int err) {
+  return Status::IOError(fname, strerror(err));
+}
+
+// Stored in native byte order at the beginning of each slot. Write buffer
+// files are only meant to be recovered on the node that wrote them.
+struct SlotHeader {
+  uint32_t magic;  // kSlotMagic if the slot holds records, 0 otherwise
+  uint32_t epoch;
+  uint32_t part;
+  uint32_t unused;
+  uint64_t seq;   // Order in which slots were started
+  uint64_t size;  // Bytes of committed records
+};
+
+SlotHeader* Header(char* slot) { return reinterpret_cast<SlotHeader*>(slot); }
+}  // namespace
+
+PmemBufferFile::PmemBufferFile(int fd, char* base, size_t num_slots,
+                               size_t slot_size, bool dax)
+    : fd_(fd),
+      base_(base),
+      num_slots_(num_slots),
+      slot_size_(slot_size),
+      dax_(dax),
+      next_seq_(1) {}
+
+PmemBufferFile::~PmemBufferFile() {
+  munmap(base_, kPageSize + num_slots_ * SlotStride(slot_size_));
+  close(fd_);
+}
+
+char* PmemBufferFile::slot(size_t i) const {
+  assert(i < num_slots_);
+  return base_ + kPageSize + i * SlotStride(slot_size_);
+}
+
+char* PmemBufferFile::data(size_t i) const {
+  return slot(i) + kSlotHeaderSize;
+}
+
+// Writes to a MAP_SYNC mapping are durable once they leave the CPU caches.
+// Writes to a regular shared mapping reach the page cache as soon as they
+// are made, so only their order needs to be enforced.
+void PmemBufferFile::Persist(const void* p, size_t n) const {
+  if (!dax_ || n == 0) {
+    port::MemoryBarrier();
+    return;
+  }
+#if defined(__SSE2__)
+  uintptr_t line = reinterpret_cast<uintptr_t>(p) & ~(kCacheLineSize - 1);
+  const uintptr_t end = reinterpret_cast<uintptr_t>(p) + n;
+  for (; line < end; line += kCacheLineSize) {
+    _mm_clflush(reinterpret_cast<const void*>(line));
+  }
+  _mm_sfence();
+#else
+  const uintptr_t start =
+      reinterpret_cast<uintptr_t>(p) & ~(static_cast<uintptr_t>(kPageSize) - 1);
+  msync(reinterpret_cast<void*>(start),
+        reinterpret_cast<uintptr_t>(p) + n - start, MS_SYNC);
+#endif
+}
+
+void PmemBufferFile::Begin(size_t i, uint32_t epoch, uint32_t part) {
+  SlotHeader* const h = Header(slot(i));
+  assert(h->magic == 0);
+  h->epoch = epoch;
+  h->part = part;
+  h->seq = next_seq_++;
+  h->size = 0;
+  Persist(h, sizeof(SlotHeader));
+  h->magic = kSlotMagic;
+  Persist(&h->magic, sizeof(h->magic));
+}
+
+void PmemBufferFile::Commit(size_t i, size_t size) {
+  SlotHeader* const h = Header(slot(i));
+  assert(h->magic == kSlotMagic);
+  assert(size >= h->size && size <= slot_size_);
+  Persist(data(i) + h->size, size - h->size);
+  h->size = size;
+  Persist(&h->size, sizeof(h->size));
+}
+
+void PmemBufferFile::Release(size_t i) {
+  SlotHeader* const h = Header(slot(i));
+  h->magic = 0;
+  Persist(&h->magic, sizeof(h->magic));
+  h->size = 0;
+}
+
+Status PmemBufferFile::Open(const std::string& fname, size_t num_slots,
+                            size_t slot_size, PmemBufferFile** result) {
+  *result = NULL;
+  const size_t file_size = kPageSize + num_slots * SlotStride(slot_size);
+  const int fd = open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return IOError(fname, errno);
+  } else if (ftruncate(fd, static_cast<off_t>(file_size)) != 0) {
+    const int err = errno;
+    close(fd);
+    return IOError(fname, err);
+  }
+  void* base = MAP_FAILED;
+  bool dax = false;
+#if defined(MAP_SYNC) && defined(MAP_SHARED_VALIDATE)
+  base = mmap(NULL, file_size, PROT_READ | PROT_WRITE,
+              MAP_SHARED_VALIDATE | MAP_SYNC, fd, 0);
+  dax = base != MAP_FAILED;
+#endif
+  if (base == MAP_FAILED) {  // Not a DAX file system
+    base = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (base == MAP_FAILED) {
+    const int err = errno;
+    close(fd);
+    return IOError(fname, err);
+  }
+  char* const p = static_cast<char*>(base);
+  EncodeFixed64(p, kFileMagic);
+  EncodeFixed64(p + 8, num_slots);
+  EncodeFixed64(p + 16, slot_size);
+  *result = new PmemBufferFile(fd, p, num_slots, slot_size, dax);
+  (*result)->Persist(p, 24);
+  return Status::OK();
+}
+
+namespace {
+struct RecoveredSlot {
+  uint32_t epoch;
+  uint64_t seq;
+  size_t index;
+  bool operator<(const RecoveredSlot& other) const {
+    if (epoch != other.epoch) return epoch < other.epoch;
+    return seq < other.seq;
+  }
+};
+}  // namespace
+
+Status RecoverPmemBuffers(const std::string& fname, PmemRecordSaver saver,
+                          void* arg) {
+  const int fd = open(fname.c_str(), O_RDWR);
+  if (fd == -1) {
+    return IOError(fname, errno);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    const int err = errno;
+    close(fd);
+    return IOError(fname, err);
+  } else if (static_cast<size_t>(st.st_size) < kPageSize) {
+    close(fd);
+    return Status::Corruption(fname, "Write buffer file too short");
+  }
+  const size_t file_size = static_cast<size_t>(st.st_size);
+  void* const base =
+      mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    const int err = errno;
+    close(fd);
+    return IOError(fname, err);
+  }
+  Status status;
+  char* const p = static_cast<char*>(base);
+  const uint64_t num_slots = DecodeFixed64(p + 8);
+  const uint64_t slot_size = DecodeFixed64(p + 16);
+  if (DecodeFixed64(p) != kFileMagic ||
+      kPageSize + num_slots * SlotStride(slot_size) > file_size) {
+    status = Status::Corruption(fname, "Bad write buffer file header");
+  }
+  std::vector<RecoveredSlot> slots;
+  for (size_t i = 0; status.ok() && i < num_slots; i++) {
+    SlotHeader* const h = Header(p + kPageSize + i * SlotStride(slot_size));
+    if (h->magic == kSlotMagic) {
+      RecoveredSlot s;
+      s.epoch = h->epoch;
+      s.seq = h->seq;
+      s.index = i;
+      slots.push_back(s);
+    }
+  }
+  std::sort(slots.begin(), slots.end());
+  bool stopped = false;  // Saver asked to stop
+  for (size_t i = 0; status.ok() && !stopped && i < slots.size(); i++) {
+    char* const slot = p + kPageSize + slots[i].index * SlotStride(slot_size);
+    SlotHeader* const h = Header(slot);
+    const uint32_t part = h->part;
+    const uint64_t size = h->size;
+    if (size > slot_size) {
+      status = Status::Corruption(fname, "Bad write buffer size");
+      break;
+    }
+    Slice input(slot + kSlotHeaderSize, size);
+    Slice key, value;
+    while (!input.empty()) {
+      if (!GetLengthPrefixedSlice(&input, &key) ||
+          !GetLengthPrefixedSlice(&input, &value)) {
+        status = Status::Corruption(fname, "Bad write buffer record");
+        break;
+      } else if (saver(arg, slots[i].epoch, part, key, value) != 0) {
+        stopped = true;
+        break;
+      }
+    }
+    if (status.ok() && !stopped) {
+      h->magic = 0;  // Empty the slot
+    }
+  }
+  msync(base, file_size, MS_SYNC);
+  munmap(base, file_size);
+  close(fd);
+  return status;
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
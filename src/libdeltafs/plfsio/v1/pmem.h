@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "pdlfs-common/slice.h"
+#include "pdlfs-common/status.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace pdlfs {
+namespace plfsio {
+
+// A file mapped into memory to hold write buffers, preferably a file on a DAX
+// file system backed by persistent memory. The file is divided into fixed
+// sized slots, one for each write buffer. Each slot starts with a small
+// header recording the epoch and the partition of the records in the slot and
+// the number of bytes that have been committed. Records are encoded in slots
+// exactly as in DRAM write buffers, so buffers are written in place and
+// compacted from the mapping without being copied.
+//
+// When the file is mapped with MAP_SYNC, committed records are flushed from
+// the CPU caches and survive power failures. Otherwise, committed records live
+// in the OS page cache and only survive crashes of the writing process.
+//
+// Implementation is not thread-safe. External synchronization is needed.
+class PmemBufferFile {
+ public:
+  // Create a new file, or overwrite an existing one, and map it into memory.
+  // Return OK on success, or a non-OK status on errors.
+  static Status Open(const std::string& fname, size_t num_slots,
+                     size_t slot_size, PmemBufferFile** result);
+  ~PmemBufferFile();
+
+  size_t num_slots() const { return num_slots_; }
+  size_t slot_size() const { return slot_size_; }
+  // True iff committed records are durable across power failures.
+  bool is_dax() const { return dax_; }
+
+  // Return the data area of slot i, which holds up to slot_size() bytes.
+  char* data(size_t i) const;
+
+  // Start a new run of records belonging to a given epoch and partition in
+  // slot i. The slot must be empty.
+  void Begin(size_t i, uint32_t epoch, uint32_t part);
+  // Make bytes of slot i written since the last commit durable, and then mark
+  // the first "size" bytes of the slot as committed.
+  void Commit(size_t i, size_t size);
+  // Empty slot i once its records have been compacted.
+  void Release(size_t i);
+
+ private:
+  PmemBufferFile(int fd, char* base, size_t num_slots, size_t slot_size,
+                 bool dax);
+  char* slot(size_t i) const;
+  void Persist(const void* p, size_t n) const;
+
+  const int fd_;
+  char* const base_;
+  const size_t num_slots_;
+  const size_t slot_size_;
+  const bool dax_;
+  uint64_t next_seq_;
+
+  // No copying allowed
+  void operator=(const PmemBufferFile&);
+  PmemBufferFile(const PmemBufferFile&);
+};
+
+// Callback for records recovered from a persistent write buffer file. Return
+// non-zero to stop the recovery, in which case the slot being recovered and
+// all later slots are left untouched.
+typedef int (*PmemRecordSaver)(void* arg, uint32_t epoch, uint32_t part,
+                               const Slice& key, const Slice& value);
+
+// Pass all committed records left in a write buffer file by a crashed writer
+// to "saver", in epoch order and, within each epoch, buffer by buffer in the
+// order buffers were started. Each slot is emptied once all its records have
+// been passed to the saver, so the file can be reused by a new writer
+// afterwards. The directory itself should be salvaged with RepairDir(), which
+// keeps all epochs sealed before the crash. Records of the epoch that was
+// being written are recoverable from the write buffer file as long as their
+// buffers had not been compacted.
+// Return OK on success, or a non-OK status on errors.
+extern Status RecoverPmemBuffers(const std::string& fname,
+                                 PmemRecordSaver saver, void* arg);
+
+}  // namespace plfsio
+}  // namespace pdlfs
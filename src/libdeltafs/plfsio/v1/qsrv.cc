@@ -0,0 +1,646 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "qsrv.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/hash.h"
+#include "pdlfs-common/lru.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <algorithm>
+
+namespace pdlfs {
+namespace plfsio {
+
+DirQuery::~DirQuery() {}
+
+DirQuery::RPC::CLI::~CLI() {}
+
+DirQuery::RPC::SRV::~SRV() {}
+
+namespace {
+
+class DirQueryImpl : public DirQuery {
+ public:
+  explicit DirQueryImpl(const DirOptions& options);
+  virtual ~DirQueryImpl();
+
+  virtual Status Count(const Slice& dirname, int rank,
+                       const DirReader::CountOp& op, size_t* result);
+  virtual Status Read(const Slice& dirname, int rank,
+                      const DirReader::ReadOp& op, const Slice& fid,
+                      std::string* dst);
+  virtual Status MultiRead(const Slice& dirname, int rank,
+                           const DirReader::ReadOp& op, const Slice* fids,
+                           size_t n, std::string* dsts);
+  virtual Status Membership(const Slice& dirname, int rank,
+                            const DirReader::ReadOp& op, const Slice& fid,
+                            std::vector<bool>* dst);
+  virtual Status MultiMembership(const Slice& dirname, int rank,
+                                 const DirReader::ReadOp& op,
+                                 const Slice* fids, size_t n,
+                                 std::vector<bool>* dsts);
+  virtual Status Scan(const Slice& dirname, int rank,
+                      const DirReader::ScanOp& op, DirReader::ScanSaver saver,
+                      void* arg);
+
+ private:
+  typedef LRUEntry<DirReader> DirEntry;
+  Status AcquireDir(const Slice& dirname, int rank, DirEntry** result);
+  void ReleaseDir(DirEntry* e);
+
+  const DirOptions options_;
+  port::Mutex mutex_;
+  // Directories currently open, each charged 1
+  LRUCache<DirEntry> dirs_;
+};
+
+DirQueryImpl::DirQueryImpl(const DirOptions& options)
+    : options_(options),
+      dirs_(static_cast<size_t>(std::max(options.max_open_dirs, 1))) {}
+
+DirQueryImpl::~DirQueryImpl() {
+  // dirs_ closes all directories that are still open
+}
+
+// Obtain the reader of directory "dirname" of rank "rank", opening the
+// directory if it is not already open. Return OK on success, or a non-OK
+// status on errors.
+Status DirQueryImpl::AcquireDir(const Slice& dirname, int rank,
+                                DirEntry** result) {
+  std::string key;
+  PutFixed32(&key, static_cast<uint32_t>(rank));
+  key.append(dirname.data(), dirname.size());
+  const uint32_t hash = Hash(key.data(), key.size(), 0);
+  MutexLock ml(&mutex_);
+  *result = dirs_.Lookup(key, hash);
+  if (*result != NULL) {
+    return Status::OK();
+  }
+  mutex_.Unlock();  // Unlock when opening the directory
+  DirOptions options = options_;
+  options.rank = rank;
+  DirReader* reader;
+  Status status = DirReader::Open(options, dirname.ToString(), &reader);
+  mutex_.Lock();
+  if (status.ok()) {
+    *result = dirs_.Insert(key, hash, reader, 1, LRUValueDeleter<DirReader>);
+  }
+  return status;
+}
+
+void DirQueryImpl::ReleaseDir(DirEntry* e) {
+  MutexLock ml(&mutex_);
+  dirs_.Release(e);
+}
+
+Status DirQueryImpl::Count(const Slice& dirname, int rank,
+                           const DirReader::CountOp& op, size_t* result) {
+  DirEntry* e;
+  Status status = AcquireDir(dirname, rank, &e);
+  if (status.ok()) {
+    status = e->value->Count(op, result);
+    ReleaseDir(e);
+  }
+  return status;
+}
+
+Status DirQueryImpl::Read(const Slice& dirname, int rank,
+                          const DirReader::ReadOp& op, const Slice& fid,
+                          std::string* dst) {
+  DirEntry* e;
+  Status status = AcquireDir(dirname, rank, &e);
+  if (status.ok()) {
+    status = e->value->Read(op, fid, dst);
+    ReleaseDir(e);
+  }
+  return status;
+}
+
+Status DirQueryImpl::MultiRead(const Slice& dirname, int rank,
+                               const DirReader::ReadOp& op, const Slice* fids,
+                               size_t n, std::string* dsts) {
+  DirEntry* e;
+  Status status = AcquireDir(dirname, rank, &e);
+  if (status.ok()) {
+    status = e->value->MultiRead(op, fids, n, dsts);
+    ReleaseDir(e);
+  }
+  return status;
+}
+
+Status DirQueryImpl::Membership(const Slice& dirname, int rank,
+                                const DirReader::ReadOp& op, const Slice& fid,
+                                std::vector<bool>* dst) {
+  DirEntry* e;
+  Status status = AcquireDir(dirname, rank, &e);
+  if (status.ok()) {
+    status = e->value->Membership(op, fid, dst);
+    ReleaseDir(e);
+  }
+  return status;
+}
+
+Status DirQueryImpl::MultiMembership(const Slice& dirname, int rank,
+                                     const DirReader::ReadOp& op,
+                                     const Slice* fids, size_t n,
+                                     std::vector<bool>* dsts) {
+  DirEntry* e;
+  Status status = AcquireDir(dirname, rank, &e);
+  if (status.ok()) {
+    status = e->value->MultiMembership(op, fids, n, dsts);
+    ReleaseDir(e);
+  }
+  return status;
+}
+
+Status DirQueryImpl::Scan(const Slice& dirname, int rank,
+                          const DirReader::ScanOp& op,
+                          DirReader::ScanSaver saver, void* arg) {
+  DirEntry* e;
+  Status status = AcquireDir(dirname, rank, &e);
+  if (status.ok()) {
+    status = e->value->Scan(op, saver, arg);
+    ReleaseDir(e);
+  }
+  return status;
+}
+
+}  // namespace
+
+Status DirQuery::Open(const DirOptions& options, DirQuery** result) {
+  *result = new DirQueryImpl(options);
+  return Status::OK();
+}
+
+// RPC op types. Socket-based rpc does not transmit Message::op and
+// Message::err so op codes and status codes are carried in message contents.
+namespace {
+/* clang-format off */
+enum {
+  kNonop, kCount, kRead, kMultiRead,
+  kMembership, kMultiMembership, kScan
+};
+/* clang-format on */
+
+// Read op flags
+enum { kNoParallelReads = 1, kLatestFirst = 2, kOrdered = 4 };
+
+void PutRequestHeader(std::string* dst, int op, const Slice& dirname,
+                      int rank) {
+  PutVarint32(dst, static_cast<uint32_t>(op));
+  PutLengthPrefixedSlice(dst, dirname);
+  PutVarint32(dst, static_cast<uint32_t>(rank));
+}
+
+void PutReadOp(std::string* dst, const DirReader::ReadOp& op) {
+  PutVarint32(dst, op.epoch_start);
+  PutVarint32(dst, op.epoch_end);
+  dst->push_back(
+      static_cast<char>((op.no_parallel_reads ? kNoParallelReads : 0) |
+                        (op.latest_first ? kLatestFirst : 0)));
+}
+
+bool GetReadOp(Slice* input, DirReader::ReadOp* op) {
+  if (!GetVarint32(input, &op->epoch_start) ||
+      !GetVarint32(input, &op->epoch_end) || input->empty()) {
+    return false;
+  } else {
+    const int flags = static_cast<unsigned char>((*input)[0]);
+    op->no_parallel_reads = (flags & kNoParallelReads) != 0;
+    op->latest_first = (flags & kLatestFirst) != 0;
+    input->remove_prefix(1);
+    return true;
+  }
+}
+
+void PutFids(std::string* dst, const Slice* fids, size_t n) {
+  PutVarint64(dst, n);
+  for (size_t i = 0; i < n; i++) {
+    PutLengthPrefixedSlice(dst, fids[i]);
+  }
+}
+
+bool GetFids(Slice* input, std::vector<Slice>* fids) {
+  uint64_t n;
+  if (!GetVarint64(input, &n) || n > input->size()) {
+    return false;
+  }
+  fids->resize(static_cast<size_t>(n));
+  for (size_t i = 0; i < fids->size(); i++) {
+    if (!GetLengthPrefixedSlice(input, &(*fids)[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void PutBits(std::string* dst, const std::vector<bool>& bits) {
+  PutVarint64(dst, bits.size());
+  for (size_t i = 0; i < bits.size(); i++) {
+    dst->push_back(static_cast<char>(bits[i]));
+  }
+}
+
+bool GetBits(Slice* input, std::vector<bool>* bits) {
+  uint64_t n;
+  if (!GetVarint64(input, &n) || n > input->size()) {
+    return false;
+  }
+  bits->resize(static_cast<size_t>(n));
+  for (size_t i = 0; i < bits->size(); i++) {
+    (*bits)[i] = (*input)[i] != 0;
+  }
+  input->remove_prefix(bits->size());
+  return true;
+}
+
+// Read stats sent back to clients
+void PutReadStats(std::string* dst, size_t table_seeks, size_t seeks) {
+  PutVarint64(dst, table_seeks);
+  PutVarint64(dst, seeks);
+}
+
+bool GetReadStats(Slice* input, size_t* table_seeks, size_t* seeks) {
+  uint64_t ts, s;
+  if (!GetVarint64(input, &ts) || !GetVarint64(input, &s)) {
+    return false;
+  } else {
+    if (table_seeks != NULL) *table_seeks = static_cast<size_t>(ts);
+    if (seeks != NULL) *seeks = static_cast<size_t>(s);
+    return true;
+  }
+}
+
+// Scan results are buffered in a single reply. Savers may be called by
+// multiple threads concurrently when scans run in parallel.
+struct ScanReply {
+  port::Mutex mu;
+  std::string entries;
+  uint64_t n;
+};
+
+int SaveScanEntry(void* arg, const Slice& key, const Slice& value) {
+  ScanReply* const r = reinterpret_cast<ScanReply*>(arg);
+  MutexLock ml(&r->mu);
+  PutLengthPrefixedSlice(&r->entries, key);
+  PutLengthPrefixedSlice(&r->entries, value);
+  r->n++;
+  return 0;
+}
+
+}  // namespace
+
+// Send a request and strip the status code off its reply. Return OK and the
+// rest of the reply in *reply on success, or a non-OK status on errors.
+Status DirQuery::RPC::CLI::Call(Msg& in, Slice* reply, Msg* out) {
+  in.contents = Slice(in.extra_buf);
+  Status s = stub_->Call(in, *out);
+  if (s.ok()) {
+    uint32_t err;
+    *reply = out->contents;
+    if (!GetVarint32(reply, &err)) {
+      s = Status::Corruption(Slice());
+    } else if (err != 0) {
+      s = Status::FromCode(static_cast<int>(err));
+    }
+  }
+  return s;
+}
+
+Status DirQuery::RPC::CLI::Count(const Slice& dirname, int rank,
+                                 const DirReader::CountOp& op,
+                                 size_t* result) {
+  Msg in;
+  PutRequestHeader(&in.extra_buf, kCount, dirname, rank);
+  PutVarint32(&in.extra_buf, op.epoch_start);
+  PutVarint32(&in.extra_buf, op.epoch_end);
+  Msg out;
+  Slice reply;
+  Status s = Call(in, &reply, &out);
+  if (s.ok()) {
+    uint64_t n;
+    if (!GetVarint64(&reply, &n)) {
+      s = Status::Corruption(Slice());
+    } else {
+      *result = static_cast<size_t>(n);
+    }
+  }
+  return s;
+}
+
+Status DirQuery::RPC::CLI::Read(const Slice& dirname, int rank,
+                                const DirReader::ReadOp& op, const Slice& fid,
+                                std::string* dst) {
+  Msg in;
+  PutRequestHeader(&in.extra_buf, kRead, dirname, rank);
+  PutReadOp(&in.extra_buf, op);
+  PutLengthPrefixedSlice(&in.extra_buf, fid);
+  Msg out;
+  Slice reply;
+  Status s = Call(in, &reply, &out);
+  if (s.ok()) {
+    Slice value;
+    if (!GetLengthPrefixedSlice(&reply, &value) ||
+        !GetReadStats(&reply, op.table_seeks, op.seeks)) {
+      s = Status::Corruption(Slice());
+    } else {
+      dst->append(value.data(), value.size());
+    }
+  }
+  return s;
+}
+
+Status DirQuery::RPC::CLI::MultiRead(const Slice& dirname, int rank,
+                                     const DirReader::ReadOp& op,
+                                     const Slice* fids, size_t n,
+                                     std::string* dsts) {
+  Msg in;
+  PutRequestHeader(&in.extra_buf, kMultiRead, dirname, rank);
+  PutReadOp(&in.extra_buf, op);
+  PutFids(&in.extra_buf, fids, n);
+  Msg out;
+  Slice reply;
+  Status s = Call(in, &reply, &out);
+  if (s.ok()) {
+    std::vector<Slice> values;
+    if (!GetFids(&reply, &values) || values.size() != n ||
+        !GetReadStats(&reply, op.table_seeks, op.seeks)) {
+      s = Status::Corruption(Slice());
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        dsts[i].append(values[i].data(), values[i].size());
+      }
+    }
+  }
+  return s;
+}
+
+Status DirQuery::RPC::CLI::Membership(const Slice& dirname, int rank,
+                                      const DirReader::ReadOp& op,
+                                      const Slice& fid,
+                                      std::vector<bool>* dst) {
+  Msg in;
+  PutRequestHeader(&in.extra_buf, kMembership, dirname, rank);
+  PutReadOp(&in.extra_buf, op);
+  PutLengthPrefixedSlice(&in.extra_buf, fid);
+  Msg out;
+  Slice reply;
+  Status s = Call(in, &reply, &out);
+  if (s.ok()) {
+    if (!GetBits(&reply, dst)) {
+      s = Status::Corruption(Slice());
+    }
+  }
+  return s;
+}
+
+Status DirQuery::RPC::CLI::MultiMembership(const Slice& dirname, int rank,
+                                           const DirReader::ReadOp& op,
+                                           const Slice* fids, size_t n,
+                                           std::vector<bool>* dsts) {
+  Msg in;
+  PutRequestHeader(&in.extra_buf, kMultiMembership, dirname, rank);
+  PutReadOp(&in.extra_buf, op);
+  PutFids(&in.extra_buf, fids, n);
+  Msg out;
+  Slice reply;
+  Status s = Call(in, &reply, &out);
+  for (size_t i = 0; s.ok() && i < n; i++) {
+    if (!GetBits(&reply, &dsts[i])) {
+      s = Status::Corruption(Slice());
+    }
+  }
+  return s;
+}
+
+Status DirQuery::RPC::CLI::Scan(const Slice& dirname, int rank,
+                                const DirReader::ScanOp& op,
+                                DirReader::ScanSaver saver, void* arg) {
+  Msg in;
+  PutRequestHeader(&in.extra_buf, kScan, dirname, rank);
+  PutVarint32(&in.extra_buf, op.epoch_start);
+  PutVarint32(&in.extra_buf, op.epoch_end);
+  in.extra_buf.push_back(
+      static_cast<char>((op.no_parallel_reads ? kNoParallelReads : 0) |
+                        (op.ordered ? kOrdered : 0)));
+  PutLengthPrefixedSlice(&in.extra_buf, op.key_start);
+  PutLengthPrefixedSlice(&in.extra_buf, op.key_end);
+  PutVarint64(&in.extra_buf, op.value_offset);
+  PutVarint64(&in.extra_buf, op.value_length);
+  Msg out;
+  Slice reply;
+  Status s = Call(in, &reply, &out);
+  uint64_t n = 0;
+  if (s.ok()) {
+    if (!GetVarint64(&reply, &n) ||
+        !GetReadStats(&reply, op.table_seeks, op.seeks)) {
+      s = Status::Corruption(Slice());
+    } else if (op.n != NULL) {
+      *op.n = static_cast<size_t>(n);
+    }
+  }
+  Slice key, value;
+  for (uint64_t i = 0; s.ok() && i < n; i++) {
+    if (!GetLengthPrefixedSlice(&reply, &key) ||
+        !GetLengthPrefixedSlice(&reply, &value)) {
+      s = Status::Corruption(Slice());
+    } else if (saver(arg, key, value) == -1) {
+      break;  // User does not want to continue
+    }
+  }
+  return s;
+}
+
+// RPC dispatcher
+Status DirQuery::RPC::SRV::Call(Msg& in, Msg& out) RPCNOEXCEPT {
+  Status s;
+  std::string reply;
+  Slice input = in.contents;
+  uint32_t op;
+  Slice dirname;
+  uint32_t rank;
+  if (!GetVarint32(&input, &op)) {
+    s = Status::InvalidArgument(Slice());
+  } else if (op == kNonop) {
+    // Empty reply
+  } else if (!GetLengthPrefixedSlice(&input, &dirname) ||
+             !GetVarint32(&input, &rank)) {
+    s = Status::InvalidArgument(Slice());
+  } else {
+    const int r = static_cast<int>(rank);
+    switch (op) {
+      case kCount:
+        s = COUNT(dirname, r, &input, &reply);
+        break;
+      case kRead:
+        s = RDKEY(dirname, r, &input, &reply);
+        break;
+      case kMultiRead:
+        s = MRKEY(dirname, r, &input, &reply);
+        break;
+      case kMembership:
+        s = MEMBR(dirname, r, &input, &reply);
+        break;
+      case kMultiMembership:
+        s = MMEMB(dirname, r, &input, &reply);
+        break;
+      case kScan:
+        s = SCANK(dirname, r, &input, &reply);
+        break;
+      default:
+        s = Status::NotSupported(Slice());
+    }
+  }
+
+  out.extra_buf.clear();
+  PutVarint32(&out.extra_buf, static_cast<uint32_t>(s.err_code()));
+  if (s.ok()) {
+    out.extra_buf.append(reply);
+  }
+  out.contents = Slice(out.extra_buf);
+  return Status::OK();
+}
+
+Status DirQuery::RPC::SRV::COUNT(const Slice& dirname, int rank, Slice* input,
+                                 std::string* reply) {
+  DirReader::CountOp op;
+  if (!GetVarint32(input, &op.epoch_start) ||
+      !GetVarint32(input, &op.epoch_end)) {
+    return Status::InvalidArgument(Slice());
+  }
+  size_t n = 0;
+  Status s = query_->Count(dirname, rank, op, &n);
+  if (s.ok()) {
+    PutVarint64(reply, n);
+  }
+  return s;
+}
+
+Status DirQuery::RPC::SRV::RDKEY(const Slice& dirname, int rank, Slice* input,
+                                 std::string* reply) {
+  DirReader::ReadOp op;
+  Slice fid;
+  if (!GetReadOp(input, &op) || !GetLengthPrefixedSlice(input, &fid)) {
+    return Status::InvalidArgument(Slice());
+  }
+  size_t table_seeks = 0;
+  size_t seeks = 0;
+  op.table_seeks = &table_seeks;
+  op.seeks = &seeks;
+  std::string value;
+  Status s = query_->Read(dirname, rank, op, fid, &value);
+  if (s.ok()) {
+    PutLengthPrefixedSlice(reply, value);
+    PutReadStats(reply, table_seeks, seeks);
+  }
+  return s;
+}
+
+Status DirQuery::RPC::SRV::MRKEY(const Slice& dirname, int rank, Slice* input,
+                                 std::string* reply) {
+  DirReader::ReadOp op;
+  std::vector<Slice> fids;
+  if (!GetReadOp(input, &op) || !GetFids(input, &fids)) {
+    return Status::InvalidArgument(Slice());
+  }
+  size_t table_seeks = 0;
+  size_t seeks = 0;
+  op.table_seeks = &table_seeks;
+  op.seeks = &seeks;
+  std::vector<std::string> values(fids.size());
+  Status s;
+  if (!fids.empty()) {
+    s = query_->MultiRead(dirname, rank, op, &fids[0], fids.size(),
+                          &values[0]);
+  }
+  if (s.ok()) {
+    PutVarint64(reply, values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      PutLengthPrefixedSlice(reply, values[i]);
+    }
+    PutReadStats(reply, table_seeks, seeks);
+  }
+  return s;
+}
+
+Status DirQuery::RPC::SRV::MEMBR(const Slice& dirname, int rank, Slice* input,
+                                 std::string* reply) {
+  DirReader::ReadOp op;
+  Slice fid;
+  if (!GetReadOp(input, &op) || !GetLengthPrefixedSlice(input, &fid)) {
+    return Status::InvalidArgument(Slice());
+  }
+  std::vector<bool> bits;
+  Status s = query_->Membership(dirname, rank, op, fid, &bits);
+  if (s.ok()) {
+    PutBits(reply, bits);
+  }
+  return s;
+}
+
+Status DirQuery::RPC::SRV::MMEMB(const Slice& dirname, int rank, Slice* input,
+                                 std::string* reply) {
+  DirReader::ReadOp op;
+  std::vector<Slice> fids;
+  if (!GetReadOp(input, &op) || !GetFids(input, &fids)) {
+    return Status::InvalidArgument(Slice());
+  }
+  std::vector<std::vector<bool> > bits(fids.size());
+  Status s;
+  if (!fids.empty()) {
+    s = query_->MultiMembership(dirname, rank, op, &fids[0], fids.size(),
+                                &bits[0]);
+  }
+  for (size_t i = 0; s.ok() && i < bits.size(); i++) {
+    PutBits(reply, bits[i]);
+  }
+  return s;
+}
+
+Status DirQuery::RPC::SRV::SCANK(const Slice& dirname, int rank, Slice* input,
+                                 std::string* reply) {
+  DirReader::ScanOp op;
+  uint64_t value_offset, value_length;
+  if (!GetVarint32(input, &op.epoch_start) ||
+      !GetVarint32(input, &op.epoch_end) || input->empty()) {
+    return Status::InvalidArgument(Slice());
+  }
+  const int flags = static_cast<unsigned char>((*input)[0]);
+  op.no_parallel_reads = (flags & kNoParallelReads) != 0;
+  op.ordered = (flags & kOrdered) != 0;
+  input->remove_prefix(1);
+  if (!GetLengthPrefixedSlice(input, &op.key_start) ||
+      !GetLengthPrefixedSlice(input, &op.key_end) ||
+      !GetVarint64(input, &value_offset) ||
+      !GetVarint64(input, &value_length)) {
+    return Status::InvalidArgument(Slice());
+  }
+  op.value_offset = static_cast<size_t>(value_offset);
+  op.value_length = static_cast<size_t>(value_length);
+  size_t table_seeks = 0;
+  size_t seeks = 0;
+  op.table_seeks = &table_seeks;
+  op.seeks = &seeks;
+  ScanReply r;
+  r.n = 0;
+  Status s = query_->Scan(dirname, rank, op, SaveScanEntry, &r);
+  if (s.ok()) {
+    PutVarint64(reply, r.n);
+    PutReadStats(reply, table_seeks, seeks);
+    reply->append(r.entries);
+  }
+  return s;
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
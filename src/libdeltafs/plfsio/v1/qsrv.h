@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "v1.h"
+
+#include "pdlfs-common/rpc.h"
+
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+namespace plfsio {
+
+// Query plfs-style directories by name. Each directory is identified by its
+// path and the rank that has written it. A query server keeps directories open
+// across queries so that indexes, filters, and footers are loaded only once,
+// and may be put behind the rpc layer through DirQuery::RPC::SRV so that
+// remote processes query directories through DirQuery::RPC::CLI without
+// paying for opening them.
+class DirQuery {
+ public:
+  DirQuery() {}
+  virtual ~DirQuery();
+
+  // Return a query server that opens directories on demand using "options",
+  // with options.rank replaced by the rank of each query. At most
+  // options.max_open_dirs directories are kept open at a time, with the least
+  // recently used ones closed first. Set options.block_cache and
+  // options.index_cache to share caches among all open directories.
+  // Return OK on success, or a non-OK status on errors.
+  static Status Open(const DirOptions& options, DirQuery** result);
+
+  struct RPC;
+
+  // Same as DirReader::Count() against directory "dirname" of rank "rank".
+  virtual Status Count(const Slice& dirname, int rank,
+                       const DirReader::CountOp& op, size_t* result) = 0;
+
+  // Same as DirReader::Read(). op.stats is not supported over rpc.
+  virtual Status Read(const Slice& dirname, int rank,
+                      const DirReader::ReadOp& op, const Slice& fid,
+                      std::string* dst) = 0;
+
+  // Same as DirReader::MultiRead().
+  virtual Status MultiRead(const Slice& dirname, int rank,
+                           const DirReader::ReadOp& op, const Slice* fids,
+                           size_t n, std::string* dsts) = 0;
+
+  // Same as DirReader::Membership().
+  virtual Status Membership(const Slice& dirname, int rank,
+                            const DirReader::ReadOp& op, const Slice& fid,
+                            std::vector<bool>* dst) = 0;
+
+  // Same as DirReader::MultiMembership().
+  virtual Status MultiMembership(const Slice& dirname, int rank,
+                                 const DirReader::ReadOp& op,
+                                 const Slice* fids, size_t n,
+                                 std::vector<bool>* dsts) = 0;
+
+  // Same as DirReader::Scan(). Over rpc, all entries in range are sent back
+  // in a single reply before being passed to "saver" so callers should bound
+  // the key range of each scan.
+  virtual Status Scan(const Slice& dirname, int rank,
+                      const DirReader::ScanOp& op, DirReader::ScanSaver saver,
+                      void* arg) = 0;
+
+ private:
+  // No copying allowed
+  void operator=(const DirQuery&);
+  DirQuery(const DirQuery&);
+};
+
+// RPC adaptors
+struct DirQuery::RPC {
+  class CLI;  // DirQuery on top of RPC
+  class SRV;  // RPC on top of DirQuery
+};
+
+class DirQuery::RPC::CLI : public DirQuery {
+  typedef rpc::If::Message Msg;
+
+ public:
+  CLI(rpc::If* stub) : stub_(stub) {}
+  virtual ~CLI();
+
+  virtual Status Count(const Slice& dirname, int rank,
+                       const DirReader::CountOp& op, size_t* result);
+  virtual Status Read(const Slice& dirname, int rank,
+                      const DirReader::ReadOp& op, const Slice& fid,
+                      std::string* dst);
+  virtual Status MultiRead(const Slice& dirname, int rank,
+                           const DirReader::ReadOp& op, const Slice* fids,
+                           size_t n, std::string* dsts);
+  virtual Status Membership(const Slice& dirname, int rank,
+                            const DirReader::ReadOp& op, const Slice& fid,
+                            std::vector<bool>* dst);
+  virtual Status MultiMembership(const Slice& dirname, int rank,
+                                 const DirReader::ReadOp& op,
+                                 const Slice* fids, size_t n,
+                                 std::vector<bool>* dsts);
+  virtual Status Scan(const Slice& dirname, int rank,
+                      const DirReader::ScanOp& op, DirReader::ScanSaver saver,
+                      void* arg);
+
+ private:
+  Status Call(Msg& in, Slice* reply, Msg* out);
+  rpc::If* stub_;
+};
+
+class DirQuery::RPC::SRV : public rpc::If {
+  typedef rpc::If::Message Msg;
+
+ public:
+  // Always return OK.
+  virtual Status Call(Msg& in, Msg& out) RPCNOEXCEPT;
+  SRV(DirQuery* query) : query_(query) {}
+  virtual ~SRV();
+
+#define DEC_RPC(OP) Status OP(const Slice& dirname, int rank, Slice* input, \
+                              std::string* reply);
+
+  DEC_RPC(COUNT)
+  DEC_RPC(RDKEY)
+  DEC_RPC(MRKEY)
+  DEC_RPC(MEMBR)
+  DEC_RPC(MMEMB)
+  DEC_RPC(SCANK)
+
+#undef DEC_RPC
+
+ private:
+  DirQuery* query_;
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
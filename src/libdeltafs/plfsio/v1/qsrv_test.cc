@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "qsrv.h"
+
+#include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
+
+#include <stdio.h>
+
+namespace pdlfs {
+namespace plfsio {
+
+class DirQueryTest {
+ public:
+  DirQueryTest() {
+    dirname_ = test::TmpDir() + "/dirquery_test";
+    options_.filter = kFtBloomFilter;
+    options_.bf_bits_per_key = 10;
+    options_.env = Env::Default();
+    options_.max_open_dirs = 1;
+    char tmp[20];
+    DestroyDir(dirname_, options_);
+    // Two ranks write into a shared parent directory
+    for (int r = 0; r < 2; r++) {
+      DirOptions options = options_;
+      options.rank = r;
+      DirWriter* writer;
+      ASSERT_OK(DirWriter::Open(options, dirname_, &writer));
+      for (int e = 0; e < 2; e++) {
+        for (int i = 0; i < 100; i++) {
+          snprintf(tmp, sizeof(tmp), "k%d-%03d", e, i);
+          ASSERT_OK(writer->Add(tmp, std::string(1, 'a' + r), e));
+        }
+        ASSERT_OK(writer->EpochFlush(e));
+      }
+      ASSERT_OK(writer->Finish());
+      delete writer;
+    }
+  }
+
+  static int SaveEntry(void* arg, const Slice& key, const Slice& value) {
+    std::string* const dst = reinterpret_cast<std::string*>(arg);
+    dst->append(key.data(), key.size());
+    dst->append(value.data(), value.size());
+    dst->push_back(',');
+    return 0;
+  }
+
+  // Run all queries against "q". Both ranks are queried alternately so that
+  // directories are reopened when only one of them may be kept open.
+  void Check(DirQuery* q) {
+    for (int r = 0; r < 2; r++) {
+      const std::string v(1, 'a' + r);
+      size_t n = 0;
+      DirReader::CountOp count_op;
+      ASSERT_OK(q->Count(dirname_, r, count_op, &n));
+      ASSERT_EQ(n, 200);
+      count_op.SetEpoch(1);
+      ASSERT_OK(q->Count(dirname_, r, count_op, &n));
+      ASSERT_EQ(n, 100);
+      size_t seeks = 0;
+      DirReader::ReadOp op;
+      op.seeks = &seeks;
+      std::string value;
+      ASSERT_OK(q->Read(dirname_, r, op, "k1-042", &value));
+      ASSERT_EQ(value, v);
+      ASSERT_TRUE(seeks > 0);
+      value.clear();
+      ASSERT_OK(q->Read(dirname_, r, op, "k2-042", &value));
+      ASSERT_TRUE(value.empty());
+      Slice fids[3] = {"k0-000", "k9-999", "k1-099"};
+      std::string dsts[3];
+      ASSERT_OK(q->MultiRead(dirname_, r, op, fids, 3, dsts));
+      ASSERT_EQ(dsts[0], v);
+      ASSERT_TRUE(dsts[1].empty());
+      ASSERT_EQ(dsts[2], v);
+      std::vector<bool> bits;
+      ASSERT_OK(q->Membership(dirname_, r, op, "k1-007", &bits));
+      ASSERT_EQ(bits.size(), 2);
+      ASSERT_TRUE(bits[1]);
+      std::vector<bool> multi_bits[3];
+      ASSERT_OK(q->MultiMembership(dirname_, r, op, fids, 3, multi_bits));
+      ASSERT_TRUE(multi_bits[0][0]);
+      ASSERT_TRUE(multi_bits[2][1]);
+      DirReader::ScanOp scan_op;
+      scan_op.ordered = true;
+      scan_op.key_start = "k0-010";
+      scan_op.key_end = "k0-013";
+      scan_op.n = &n;
+      std::string entries;
+      ASSERT_OK(q->Scan(dirname_, r, scan_op, SaveEntry, &entries));
+      ASSERT_EQ(entries, "k0-010" + v + ",k0-011" + v + ",k0-012" + v + ",");
+      ASSERT_EQ(n, 3);
+    }
+    size_t n;
+    DirReader::CountOp count_op;
+    ASSERT_TRUE(
+        q->Count(dirname_ + "/nonexistent", 0, count_op, &n).IsNotFound());
+  }
+
+  DirOptions options_;
+  std::string dirname_;
+};
+
+TEST(DirQueryTest, Local) {
+  DirQuery* q;
+  ASSERT_OK(DirQuery::Open(options_, &q));
+  Check(q);
+  delete q;
+}
+
+TEST(DirQueryTest, RPC) {
+  const char* uri = "tcp://127.0.0.1:22333";
+  DirQuery* q;
+  ASSERT_OK(DirQuery::Open(options_, &q));
+  DirQuery::RPC::SRV srv(q);
+  RPCOptions rpcopts;
+  rpcopts.uri = uri;
+  rpcopts.fs = &srv;
+  RPC* rpc = RPC::Open(rpcopts);
+  ASSERT_TRUE(rpc != NULL);
+  ASSERT_OK(rpc->Start());
+  SleepForMicroseconds(1000);
+  ASSERT_OK(rpc->status());
+  rpc::If* stub = rpc->OpenStubFor(uri);
+  ASSERT_TRUE(stub != NULL);
+  DirQuery::RPC::CLI cli(stub);
+  Check(&cli);
+  ASSERT_OK(rpc->Stop());
+  delete stub;
+  delete rpc;
+  delete q;
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
+
+int main(int argc, char* argv[]) {
+  return pdlfs::test::RunAllTests(&argc, &argv);
+}
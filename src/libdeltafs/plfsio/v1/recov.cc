@@ -10,8 +10,15 @@
  */
 
 #include "recov.h"
+#include "ectidx.h"
+#include "internal.h"
 #include "io.h"
 
+#include "../../util/logging.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <algorithm>
+
 namespace pdlfs {
 namespace plfsio {
 
@@ -47,6 +54,23 @@ Status LogWriter::Write(ChunkType chunk_type, const Slice& block_contents,
         compre_type = kNoCompression;
       }
       break;
+
+    case kZstdCompression:
+    case kLz4Compression:
+      if ((compre_type == kZstdCompression
+               ? port::Zstd_Compress(block_contents.data(),
+                                     block_contents.size(), &compressed_)
+               : port::Lz4_Compress(block_contents.data(),
+                                    block_contents.size(), &compressed_)) &&
+          (options_.force_compression ||
+           compressed_.size() <
+               block_contents.size() - (block_contents.size() / 8u))) {
+        raw_contents = compressed_;
+      } else {
+        raw_contents = block_contents;
+        compre_type = kNoCompression;
+      }
+      break;
   }
   status = LogRaw(chunk_type, compre_type, raw_contents, handle);
   compressed_.clear();
@@ -89,8 +113,9 @@ Status LogWriter::LogSpecial(ChunkType chunk_type, const Slice& contents) {
   header[0] = chunk_type;
   EncodeFixed32(header + 1, static_cast<uint32_t>(contents_size));
   if (!options_.skip_checksums) {
-    uint32_t crc = crc32c::Value(contents.data(), contents_size);
-    crc = crc32c::Extend(crc, header, 5);
+    const ChecksumType cs = options_.checksum_type;
+    uint32_t crc = ExtendChecksum(cs, 0, contents.data(), contents_size);
+    crc = ExtendChecksum(cs, crc, header, 5);
     EncodeFixed32(header + 5, crc32c::Mask(crc));
   } else {
     EncodeFixed32(header + 5, 0);
@@ -117,10 +142,11 @@ Status LogWriter::LogRaw(ChunkType chunk_type, CompressionType compre_type,
   char block_trailer[kBlockTrailerSize];
   block_trailer[0] = compre_type;
   if (!options_.skip_checksums) {
-    uint32_t crc = crc32c::Value(contents.data(), contents_size);
-    crc = crc32c::Extend(crc, block_trailer, 1);
+    const ChecksumType cs = options_.checksum_type;
+    uint32_t crc = ExtendChecksum(cs, 0, contents.data(), contents_size);
+    crc = ExtendChecksum(cs, crc, block_trailer, 1);
     EncodeFixed32(block_trailer + 1, crc32c::Mask(crc));
-    crc = crc32c::Extend(crc, header, 5);
+    crc = ExtendChecksum(cs, crc, header, 5);
     EncodeFixed32(header + 5, crc32c::Mask(crc));
   } else {
     EncodeFixed32(block_trailer + 1, 0);
@@ -144,5 +170,484 @@ Status LogWriter::LogRaw(ChunkType chunk_type, CompressionType compre_type,
   return status;
 }
 
+LogReader::LogReader(const DirOptions& options, LogSource* source)
+    : options_(options), source_(source) {
+  assert(source_ != NULL);
+  source_->Ref();
+}
+
+LogReader::~LogReader() { source_->Unref(); }
+
+static bool IsRegularChunk(unsigned char type) {
+  switch (type) {
+    case kIdxChunk:
+    case kSbfChunk:
+    case kBmpChunk:
+    case kXorChunk:
+    case kGcsChunk:
+    case kMetaChunk:
+    case kRtChunk:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Check if a valid chunk starts at a given log offset. If so, store its
+// location in *chunk and the offset right after the chunk in *next.
+bool LogReader::ParseChunk(uint64_t off, LogChunk* chunk,
+                           uint64_t* next) const {
+  const uint64_t size = log_.size();
+  if (off + kChunkHeaderSize > size) {
+    return false;
+  }
+  const char* const header = log_.data() + off;
+  const unsigned char type = static_cast<unsigned char>(header[0]);
+  const uint64_t n = DecodeFixed32(header + 1);
+  const char* const contents = header + kChunkHeaderSize;
+  uint64_t end = off + kChunkHeaderSize + n;
+  const bool regular = IsRegularChunk(type);
+  if (regular) {
+    end += kBlockTrailerSize;
+  } else if (type != kEpochStone && type != kFooter) {
+    return false;
+  }
+  if (end > size) {
+    return false;  // Truncated
+  }
+  if (!options_.skip_checksums) {
+    const ChecksumType cs = options_.checksum_type;
+    uint32_t crc = ExtendChecksum(cs, 0, contents, n);
+    if (regular) crc = ExtendChecksum(cs, crc, contents + n, 1);
+    crc = ExtendChecksum(cs, crc, header, 5);
+    if (crc32c::Unmask(DecodeFixed32(header + 5)) != crc) {
+      return false;
+    }
+  }
+  chunk->type = static_cast<ChunkType>(type);
+  chunk->offset = off;
+  chunk->size = static_cast<uint32_t>(n);
+  *next = end;
+  return true;
+}
+
+// Follow chunk lengths from a given offset and collect all chunks that start
+// before "limit". Zero bytes between chunks are tail padding and are skipped.
+// Set *next to the offset at which scanning stopped. Return true if all
+// chunks were valid, or false if a damaged chunk was found at *next.
+bool LogReader::Scan(uint64_t off, uint64_t limit,
+                     std::vector<LogChunk>* chunks, uint64_t* next) const {
+  LogChunk chunk;
+  uint64_t end;
+  while (off < limit) {
+    if (log_[off] == 0) {
+      off++;
+    } else if (ParseChunk(off, &chunk, &end)) {
+      chunks->push_back(chunk);
+      off = end;
+    } else {
+      *next = off;
+      return false;
+    }
+  }
+  *next = off;
+  return true;
+}
+
+struct LogReader::Range {
+  const LogReader* reader;
+  uint64_t start;
+  uint64_t limit;
+  uint64_t first;  // Offset of the first chunk found in the range
+  uint64_t next;   // Offset at which the scan stopped
+  bool ok;
+  std::vector<LogChunk> chunks;
+
+  port::Mutex* mu;
+  port::CondVar* cv;
+  size_t* num_pending;
+};
+
+// Locate the first chunk of a range by checking the crc at each offset and
+// then scan the rest of the range from there.
+void LogReader::ScanRange(void* arg) {
+  Range* const r = reinterpret_cast<Range*>(arg);
+  const LogReader* const reader = r->reader;
+  LogChunk chunk;
+  uint64_t end;
+  r->first = r->limit;
+  for (uint64_t off = r->start; off < r->limit; off++) {
+    if (reader->log_[off] != 0 && reader->ParseChunk(off, &chunk, &end)) {
+      r->first = off;
+      break;
+    }
+  }
+  r->ok = reader->Scan(r->first, r->limit, &r->chunks, &r->next);
+  MutexLock ml(r->mu);
+  assert(*r->num_pending > 0);
+  --*r->num_pending;
+  r->cv->SignalAll();
+}
+
+Status LogReader::Recover(size_t split_size, std::vector<LogChunk>* chunks) {
+  chunks->clear();
+  const uint64_t size = source_->Size();
+  scratch_.resize(size);
+  Status status = source_->Read(0, size, &log_, &scratch_[0]);
+  if (!status.ok()) {
+    return status;
+  } else if (log_.size() != size) {
+    return Status::IOError("Cannot read the entire log");
+  }
+
+  size_t num_ranges = 1;
+  if (!options_.skip_checksums && split_size != 0) {
+    num_ranges = static_cast<size_t>((size + split_size - 1) / split_size);
+  }
+  if (num_ranges <= 1 ||
+      (options_.reader_pool == NULL && !options_.allow_env_threads)) {
+    uint64_t ignored_next;
+    Scan(0, size, chunks, &ignored_next);
+    return status;
+  }
+
+  port::Mutex mu;
+  port::CondVar cv(&mu);
+  size_t num_pending = num_ranges;
+  std::vector<Range> ranges(num_ranges);
+  for (size_t i = 0; i < num_ranges; i++) {
+    Range* const r = &ranges[i];
+    r->reader = this;
+    r->start = i * static_cast<uint64_t>(split_size);
+    r->limit = std::min<uint64_t>(r->start + split_size, size);
+    r->mu = &mu;
+    r->cv = &cv;
+    r->num_pending = &num_pending;
+    if (options_.reader_pool != NULL) {
+      options_.reader_pool->Schedule(ScanRange, r);
+    } else {
+      Env::Default()->Schedule(ScanRange, r);
+    }
+  }
+
+  {
+    MutexLock ml(&mu);
+    while (num_pending > 0) {
+      cv.Wait();
+    }
+  }
+
+  uint64_t off = 0;
+  for (size_t i = 0; i < num_ranges; i++) {
+    Range* const r = &ranges[i];
+    if (off >= r->limit) {
+      continue;  // Range covered by a chunk that started earlier
+    }
+    bool ok;
+    if (r->first == off) {
+      chunks->insert(chunks->end(), r->chunks.begin(), r->chunks.end());
+      off = r->next;
+      ok = r->ok;
+    } else {  // Rescan the range from where the previous range left off
+      ok = Scan(off, r->limit, chunks, &off);
+    }
+    if (!ok) {
+      break;
+    }
+  }
+
+  return status;
+}
+
+Slice LogReader::ChunkContents(const LogChunk& chunk) const {
+  return Slice(log_.data() + chunk.offset + kChunkHeaderSize, chunk.size);
+}
+
+namespace {
+// Size of the log ranges scanned in parallel during a repair.
+const size_t kRepairSplitSize = 1 << 20;
+
+// Recovery state of a directory partition.
+struct PartitionRepair {
+  PartitionRepair() : intact(false), end(0) {}
+  bool intact;   // The index log has a valid footer
+  uint64_t end;  // End of the last complete epoch in the index log
+  std::vector<std::pair<uint32_t, EpochHandle> > epochs;
+};
+
+// Count the entries of a table by reading all its data blocks. This also
+// verifies that the data blocks of the table were made durable.
+Status CountTable(const DirOptions& options, LogSource* indx, LogSource* data,
+                  const TableHandle& table, uint32_t* n) {
+  BlockHandle index_handle;
+  index_handle.set_offset(table.index_offset());
+  index_handle.set_size(table.index_size());
+  BlockContents index_contents;
+  Status status = ReadBlock(indx, options, index_handle, &index_contents);
+  if (!status.ok()) {
+    return status;
+  } else if (HasIndexTrailer(options)) {
+    Slice index, trailer;
+    if (!SplitTableIndex(index_contents.data, &index, &trailer)) {
+      if (index_contents.heap_allocated) delete[] index_contents.data.data();
+      return Status::Corruption("Bad table index block");
+    }
+    index_contents.data = index;  // Same starting address
+  }
+
+  Block* const index_block = new Block(index_contents);
+  Iterator* const iter = index_block->NewIterator(BytewiseComparator());
+  for (iter->SeekToFirst(); status.ok() && iter->Valid(); iter->Next()) {
+    BlockHandle handle;
+    Slice input = iter->value();
+    status = handle.DecodeFrom(&input);
+    BlockContents contents;
+    if (status.ok()) {
+      status = ReadBlock(data, options, handle, &contents);
+    }
+    if (status.ok()) {
+      Iterator* const block_iter = OpenDirBlock(options, contents);
+      for (block_iter->SeekToFirst(); block_iter->Valid(); block_iter->Next()) {
+        ++*n;
+      }
+      status = block_iter->status();
+      delete block_iter;
+    }
+  }
+  if (status.ok()) {
+    status = iter->status();
+  }
+
+  delete iter;
+  delete index_block;
+  return status;
+}
+
+// Rebuild the epoch handle of a sealed epoch from its meta index block.
+Status RebuildEpoch(const DirOptions& options, LogSource* indx,
+                    LogSource* data, const EpochStone& stone,
+                    EpochHandle* result) {
+  BlockContents meta_contents;
+  Status status = ReadBlock(indx, options, stone.handle(), &meta_contents);
+  if (!status.ok()) {
+    return status;
+  }
+
+  uint32_t num_tables = 0;
+  uint32_t num_ents = 0;
+  Block* const meta_block = new Block(meta_contents);
+  Iterator* const iter = meta_block->NewIterator(BytewiseComparator());
+  for (iter->SeekToFirst(); status.ok() && iter->Valid(); iter->Next()) {
+    TableHandle table;
+    Slice input = iter->value();
+    status = table.DecodeFrom(&input);
+    if (status.ok()) {
+      status = CountTable(options, indx, data, table, &num_ents);
+      num_tables++;
+    }
+  }
+  if (status.ok()) {
+    status = iter->status();
+  }
+  if (status.ok()) {
+    result->set_index_offset(stone.handle().offset());
+    result->set_index_size(stone.handle().size());
+    result->set_num_tables(num_tables);
+    result->set_num_ents(num_ents);
+  }
+
+  delete iter;
+  delete meta_block;
+  return status;
+}
+
+// Recover the sealed epochs of a partition from its index log.
+Status ScanPartition(const DirOptions& options, LogSource* indx,
+                     LogSource* data, PartitionRepair* p, uint32_t* num_eps) {
+  LogReader reader(options, indx);
+  std::vector<LogChunk> chunks;
+  Status status = reader.Recover(kRepairSplitSize, &chunks);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (!chunks.empty() && chunks.back().type == kFooter) {
+    Footer footer;
+    Slice input = reader.ChunkContents(chunks.back());
+    if (footer.DecodeFrom(&input).ok()) {
+      *num_eps = std::max(*num_eps, footer.num_epochs());
+      p->intact = true;
+      return status;
+    }
+  }
+
+  for (size_t i = 0; i < chunks.size(); i++) {
+    if (chunks[i].type != kEpochStone) {
+      continue;
+    }
+    EpochStone stone;
+    EpochHandle epoch;
+    Slice input = reader.ChunkContents(chunks[i]);
+    Status s = stone.DecodeFrom(&input);
+    if (s.ok()) {
+      s = RebuildEpoch(options, indx, data, stone, &epoch);
+    }
+    if (!s.ok()) {
+      break;  // Discard this and all later epochs
+    }
+    p->epochs.push_back(std::make_pair(stone.id(), epoch));
+    p->end = chunks[i].offset + kChunkHeaderSize + chunks[i].size;
+    *num_eps = std::max(*num_eps, stone.id() + 1);
+  }
+
+  return status;
+}
+
+// Rewrite the index log of a damaged partition as its valid prefix followed
+// by a new root index and a new footer.
+Status RewritePartition(const DirOptions& options, const std::string& dirname,
+                        size_t part, const std::string& prefix,
+                        const PartitionRepair& p, uint32_t num_eps) {
+  LogSink::LogOptions idx_opts;
+  idx_opts.rank = options.rank;
+  idx_opts.sub_partition = static_cast<int>(part);
+  idx_opts.type = kIdxIoType;
+  idx_opts.mu = NULL;
+  idx_opts.osd = options.osd;
+  idx_opts.part_size = options.log_part_size;
+  idx_opts.env = options.env;
+  LogSink* sink = NULL;
+  Status status = LogSink::Open(idx_opts, dirname, &sink);
+  if (!status.ok()) {
+    return status;
+  }
+
+  status = sink->Lwrite(prefix);
+  if (status.ok()) {
+    LogWriter writer(options, sink);
+    BlockBuilder root_block(1);
+    std::string handle_encoding;
+    for (size_t i = 0; i < p.epochs.size(); i++) {
+      handle_encoding.clear();
+      p.epochs[i].second.EncodeTo(&handle_encoding);
+      root_block.Add(EpochKey(p.epochs[i].first), handle_encoding);
+    }
+    BlockHandle root_handle;
+    status = writer.Write(kRtChunk, root_block.Finish(), &root_handle);
+    if (status.ok()) {
+      std::string footer_buf;
+      Footer footer = Mkfoot(options);
+      footer.set_epoch_index_handle(root_handle);
+      footer.set_num_epochs(num_eps);
+      footer.EncodeTo(&footer_buf);
+      status = writer.Finish(footer_buf);
+    }
+  }
+  if (status.ok()) {
+    status = sink->Lclose(true);
+  }
+
+  sink->Unref();
+  return status;
+}
+
+Status WriteDirInfo(const DirOptions& options, const std::string& dirname,
+                    uint32_t num_eps) {
+  std::string contents;
+  Footer footer = Mkfoot(options);
+  BlockHandle dummy_handle;
+  dummy_handle.set_offset(0);
+  dummy_handle.set_size(0);
+  footer.set_epoch_index_handle(dummy_handle);
+  footer.set_num_epochs(num_eps);
+  footer.EncodeTo(&contents);
+  if (options.tail_padding) {
+    const size_t overflow = contents.size() % options.data_buffer;
+    if (overflow != 0) {
+      contents = std::string(options.data_buffer - overflow, 0) + contents;
+    }
+  }
+  return WriteStringToFileSync(options.env, contents,
+                               DirInfoFileName(dirname).c_str());
+}
+}  // namespace
+
+Status RepairDir(const std::string& dirname, const DirOptions& opts) {
+  DirOptions options = opts;
+  if (options.env == NULL) options.env = Env::Default();
+  if (options.epoch_log_rotation) {
+    return Status::NotSupported("Cannot repair rotated logs");
+  } else if (options.lg_parts < 0) {
+    return Status::InvalidArgument("Unknown number of partitions");
+  }
+
+  LogSource* data = NULL;
+  LogSource::LogOptions io_opts;
+  io_opts.rank = options.rank;
+  io_opts.type = kDefIoType;
+  io_opts.sub_partition = -1;
+  io_opts.osd = options.osd;
+  io_opts.env = options.env;
+  Status status = LogSource::Open(io_opts, dirname, &data);
+  if (!status.ok()) {
+    return status;
+  }
+
+  const size_t num_parts = 1u << options.lg_parts;
+  std::vector<PartitionRepair> parts(num_parts);
+  std::vector<LogSource*> index(num_parts, NULL);
+  uint32_t num_eps = 0;
+  for (size_t i = 0; i < num_parts && status.ok(); i++) {
+    LogSource::LogOptions idx_opts;
+    idx_opts.rank = options.rank;
+    idx_opts.sub_partition = static_cast<int>(i);
+    idx_opts.type = kIdxIoType;
+    idx_opts.io_size = options.read_size;
+    idx_opts.osd = options.osd;
+    idx_opts.env = options.env;
+    status = LogSource::Open(idx_opts, dirname, &index[i]);
+    if (status.ok()) {
+      status = ScanPartition(options, index[i], data, &parts[i], &num_eps);
+    }
+  }
+
+  for (size_t i = 0; i < num_parts && status.ok(); i++) {
+    if (parts[i].intact) {
+      continue;
+    }
+    Slice input;
+    std::string prefix;
+    if (parts[i].end != 0) {
+      prefix.resize(parts[i].end);
+      status = index[i]->Read(0, prefix.size(), &input, &prefix[0]);
+      if (status.ok()) {
+        prefix.assign(input.data(), input.size());
+      }
+    }
+    if (status.ok()) {
+#if VERBOSE >= 1
+      Verbose(__LOG_ARGS__, 1, "Repairing %s (rank=%d, part=%d, epochs=%d)",
+              dirname.c_str(), options.rank, int(i),
+              int(parts[i].epochs.size()));
+#endif
+      index[i]->Unref();
+      index[i] = NULL;
+      status = RewritePartition(options, dirname, i, prefix, parts[i], num_eps);
+    }
+  }
+
+  if (status.ok() && options.rank == 0) {
+    status = WriteDirInfo(options, dirname, num_eps);
+  }
+
+  for (size_t i = 0; i < num_parts; i++) {
+    if (index[i] != NULL) {
+      index[i]->Unref();
+    }
+  }
+  data->Unref();
+  return status;
+}
+
 }  // namespace plfsio
 }  // namespace pdlfs
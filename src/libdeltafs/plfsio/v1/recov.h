@@ -15,11 +15,12 @@
 #include "types.h"
 
 #include <string>
+#include <vector>
 
 // Logging facilitates for the write-ahead index log.
 // Each index log consists of a list of log entries that we call chunks.
 // There are different types of chunks. Each chunk is written atomically, with a
-// crc32c checksum.
+// checksum (crc32c by default, see DirOptions::checksum_type).
 
 namespace pdlfs {
 namespace plfsio {
@@ -28,6 +29,7 @@ namespace plfsio {
 static const size_t kChunkHeaderSize = 9;
 
 class LogSink;
+class LogSource;
 
 // Write blocks as log chunks that can be repaired and replayed by a future
 // reader. Each log chunk has the following format:
@@ -80,5 +82,52 @@ class LogWriter {
   LogSink* sink_;
 };
 
+// Location of a log chunk found by a LogReader.
+struct LogChunk {
+  ChunkType type;
+  uint64_t offset;  // Offset of the chunk header
+  uint32_t size;    // Size of the chunk contents
+};
+
+// Recover the chunks of a write-ahead log written by a LogWriter. The log is
+// split into fixed-sized ranges that are scanned in parallel using the reader
+// pool (or env threads, if allowed). Each range resynchronizes to the first
+// chunk whose checksum checks out and then follows chunk lengths. Ranges are
+// stitched together from the head of the log, and ranges found not aligned to
+// the chunk boundary reached by the previous range are rescanned serially.
+// Checksums cannot be used to find chunk boundaries if options.skip_checksums
+// is set; such logs are always scanned serially.
+class LogReader {
+ public:
+  LogReader(const DirOptions& options, LogSource* source);
+  ~LogReader();
+
+  // Store the longest prefix of valid chunks in *chunks. Scanning stops at
+  // the first truncated or corrupted chunk. A log that is damaged in
+  // its middle or at its end is not considered an error.
+  // Return OK on success, or a non-OK status on errors.
+  Status Recover(size_t split_size, std::vector<LogChunk>* chunks);
+
+  // Return the contents of a previously recovered chunk. The result remains
+  // valid until the next Recover() or until the reader is deleted.
+  Slice ChunkContents(const LogChunk& chunk) const;
+
+ private:
+  struct Range;
+  static void ScanRange(void*);
+  bool ParseChunk(uint64_t off, LogChunk* chunk, uint64_t* next) const;
+  bool Scan(uint64_t off, uint64_t limit, std::vector<LogChunk>* chunks,
+            uint64_t* next) const;
+
+  // No copying allowed
+  void operator=(const LogReader&);
+  LogReader(const LogReader&);
+
+  const DirOptions& options_;
+  LogSource* source_;
+  std::string scratch_;
+  Slice log_;  // Contents of the log
+};
+
 }  // namespace plfsio
 }  // namespace pdlfs
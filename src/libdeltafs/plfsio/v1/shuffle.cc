@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "shuffle.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+
+#include <algorithm>
+#include <map>
+
+namespace pdlfs {
+namespace plfsio {
+
+ShuffleOptions::ShuffleOptions()
+    : rank(0),
+      nranks(1),
+      sample_size(1024),
+      batch_size(32 << 10),
+      max_inflight_batches(4),
+      pool(NULL) {}
+
+RangeShuffler::~RangeShuffler() {}
+
+int RangeShuffler::RankOf(const std::vector<std::string>& pivots,
+                          const Slice& key) {
+  // Find the first pivot greater than key
+  size_t left = 0;
+  size_t right = pivots.size();
+  while (left < right) {
+    const size_t mid = (left + right) / 2;
+    if (Slice(pivots[mid]).compare(key) <= 0) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  return static_cast<int>(left);
+}
+
+namespace {
+
+// Shuffle message types. Socket-based rpc does not transmit Message::op so
+// types are carried in message contents, followed by the epoch and the
+// sender's rank.
+enum { kData = 1, kSample = 2, kEnd = 3 };
+
+void PutHeader(std::string* dst, int type, int epoch, int rank) {
+  PutVarint32(dst, static_cast<uint32_t>(type));
+  PutVarint32(dst, static_cast<uint32_t>(epoch));
+  PutVarint32(dst, static_cast<uint32_t>(rank));
+}
+
+class RangeShufflerImpl : public RangeShuffler {
+ public:
+  RangeShufflerImpl(const ShuffleOptions& options, DirWriter* dst);
+  virtual ~RangeShufflerImpl();
+
+  virtual rpc::If* Receiver() { return &receiver_; }
+  virtual void Connect(rpc::If* const* stubs);
+  virtual Status Add(const Slice& key, const Slice& value, int epoch);
+  virtual Status EpochFlush(int epoch);
+  virtual Status GetPivots(int epoch, std::vector<std::string>* pivots);
+
+ private:
+  class ReceiverImpl : public rpc::If {
+   public:
+    explicit ReceiverImpl(RangeShufflerImpl* s) : shuffler_(s) {}
+    // Always return OK.
+    virtual Status Call(Message& in, Message& out) RPCNOEXCEPT;
+
+   private:
+    RangeShufflerImpl* shuffler_;
+  };
+  Status HandleMessage(Slice input);
+  struct Batch;
+  static void BGSend(void*);
+  Status Send(int rank, const std::string& msg);
+  Status SendToAll(const std::string& msg);
+  Status SendBatch(int rank);
+  Status SetPivots();
+  Status Route(const Slice& key, const Slice& value);
+
+  const ShuffleOptions options_;
+  DirWriter* const dst_;
+  std::vector<rpc::If*> stubs_;
+  ReceiverImpl receiver_;
+
+  // State below is only accessed by writers
+  int epoch_;
+  bool has_pivots_;
+  std::vector<std::string> cur_pivots_;
+  // Records written before pivots are set
+  std::string pending_;
+  size_t num_pending_;
+  // Records buffered for each remote rank
+  std::vector<std::string> bufs_;
+  std::vector<uint32_t> buf_counts_;
+
+  port::Mutex mu_;
+  port::CondVar cv_;
+  // State below is protected by mu_
+  std::map<int, std::vector<std::string> > pivots_;
+  std::map<int, std::vector<std::string> > samples_;
+  std::map<int, int> num_samples_;  // Number of ranks sampled
+  std::map<int, int> num_ends_;     // Number of ranks done sending
+  int num_inflight_;
+  Status bg_status_;
+};
+
+RangeShufflerImpl::RangeShufflerImpl(const ShuffleOptions& options,
+                                     DirWriter* dst)
+    : options_(options),
+      dst_(dst),
+      receiver_(this),
+      epoch_(0),
+      has_pivots_(false),
+      num_pending_(0),
+      bufs_(options.nranks),
+      buf_counts_(options.nranks, 0),
+      cv_(&mu_),
+      num_inflight_(0) {}
+
+RangeShufflerImpl::~RangeShufflerImpl() {
+  MutexLock ml(&mu_);
+  while (num_inflight_ != 0) {
+    cv_.Wait();
+  }
+}
+
+void RangeShufflerImpl::Connect(rpc::If* const* stubs) {
+  stubs_.assign(stubs, stubs + options_.nranks);
+}
+
+Status RangeShufflerImpl::GetPivots(int epoch,
+                                    std::vector<std::string>* pivots) {
+  MutexLock ml(&mu_);
+  std::map<int, std::vector<std::string> >::iterator it = pivots_.find(epoch);
+  if (it == pivots_.end()) {
+    return Status::NotFound("Pivots not yet set");
+  } else {
+    *pivots = it->second;
+    return Status::OK();
+  }
+}
+
+// Send a message to a remote rank and wait for it to be processed.
+Status RangeShufflerImpl::Send(int rank, const std::string& msg) {
+  rpc::If::Message in;
+  in.contents = msg;
+  rpc::If::Message out;
+  Status s = stubs_[rank]->Call(in, out);
+  if (s.ok()) {
+    uint32_t err;
+    Slice reply = out.contents;
+    if (!GetVarint32(&reply, &err)) {
+      s = Status::Corruption("Bad shuffle reply");
+    } else if (err != 0) {
+      s = Status::FromCode(static_cast<int>(err));
+    }
+  }
+  return s;
+}
+
+Status RangeShufflerImpl::SendToAll(const std::string& msg) {
+  Status s;
+  for (int i = 0; s.ok() && i < options_.nranks; i++) {
+    if (i != options_.rank) {
+      s = Send(i, msg);
+    }
+  }
+  return s;
+}
+
+struct RangeShufflerImpl::Batch {
+  RangeShufflerImpl* shuffler;
+  int rank;
+  std::string msg;
+};
+
+void RangeShufflerImpl::BGSend(void* arg) {
+  Batch* const b = reinterpret_cast<Batch*>(arg);
+  RangeShufflerImpl* const s = b->shuffler;
+  Status status = s->Send(b->rank, b->msg);
+  delete b;
+  MutexLock ml(&s->mu_);
+  if (!status.ok() && s->bg_status_.ok()) {
+    s->bg_status_ = status;
+  }
+  assert(s->num_inflight_ > 0);
+  s->num_inflight_--;
+  s->cv_.SignalAll();
+}
+
+// Send all records buffered for a remote rank. Batches are sent in the
+// background when a thread pool is available, in which case the caller is
+// blocked while options_.max_inflight_batches batches are being sent.
+Status RangeShufflerImpl::SendBatch(int rank) {
+  std::string msg;
+  PutHeader(&msg, kData, epoch_, options_.rank);
+  PutVarint32(&msg, buf_counts_[rank]);
+  msg.append(bufs_[rank]);
+  bufs_[rank].clear();
+  buf_counts_[rank] = 0;
+  if (options_.pool == NULL) {
+    return Send(rank, msg);
+  }
+  MutexLock ml(&mu_);
+  while (bg_status_.ok() &&
+         num_inflight_ >= std::max(options_.max_inflight_batches, 1)) {
+    cv_.Wait();
+  }
+  if (!bg_status_.ok()) {
+    return bg_status_;
+  }
+  num_inflight_++;
+  Batch* const b = new Batch;
+  b->shuffler = this;
+  b->rank = rank;
+  b->msg.swap(msg);
+  options_.pool->Schedule(BGSend, b);
+  return Status::OK();
+}
+
+Status RangeShufflerImpl::Route(const Slice& key, const Slice& value) {
+  const int rank = RankOf(cur_pivots_, key);
+  if (rank == options_.rank) {
+    return dst_->Add(key, value, epoch_);
+  }
+  PutLengthPrefixedSlice(&bufs_[rank], key);
+  PutLengthPrefixedSlice(&bufs_[rank], value);
+  buf_counts_[rank]++;
+  if (bufs_[rank].size() >= options_.batch_size) {
+    return SendBatch(rank);
+  } else {
+    return Status::OK();
+  }
+}
+
+// Send the keys of all pending records to all ranks as samples, wait for the
+// samples of all other ranks, and derive the pivots of the current epoch from
+// the union of all samples. Every rank derives the same pivots. Pending
+// records are then routed.
+Status RangeShufflerImpl::SetPivots() {
+  std::vector<std::string> sample;
+  std::string msg;
+  PutHeader(&msg, kSample, epoch_, options_.rank);
+  PutVarint64(&msg, num_pending_);
+  Slice input = pending_;
+  Slice key, value;
+  while (GetLengthPrefixedSlice(&input, &key) &&
+         GetLengthPrefixedSlice(&input, &value)) {
+    PutLengthPrefixedSlice(&msg, key);
+    sample.push_back(key.ToString());
+  }
+  Status s = SendToAll(msg);
+  if (!s.ok()) {
+    return s;
+  }
+  std::vector<std::string> keys;
+  {
+    MutexLock ml(&mu_);
+    std::vector<std::string>* const all = &samples_[epoch_];
+    all->insert(all->end(), sample.begin(), sample.end());
+    num_samples_[epoch_]++;
+    while (num_samples_[epoch_] < options_.nranks) {
+      cv_.Wait();
+    }
+    keys.swap(*all);
+    samples_.erase(epoch_);
+    num_samples_.erase(epoch_);
+  }
+  std::sort(keys.begin(), keys.end());
+  cur_pivots_.clear();
+  if (!keys.empty()) {
+    for (int i = 1; i < options_.nranks; i++) {
+      cur_pivots_.push_back(keys[i * keys.size() / options_.nranks]);
+    }
+  }
+  {
+    MutexLock ml(&mu_);
+    pivots_[epoch_] = cur_pivots_;
+  }
+  has_pivots_ = true;
+  std::string pending;
+  pending.swap(pending_);
+  num_pending_ = 0;
+  input = pending;
+  while (s.ok() && GetLengthPrefixedSlice(&input, &key) &&
+         GetLengthPrefixedSlice(&input, &value)) {
+    s = Route(key, value);
+  }
+  return s;
+}
+
+Status RangeShufflerImpl::Add(const Slice& key, const Slice& value,
+                              int epoch) {
+  if (epoch != epoch_) {
+    return Status::AssertionFailed("Bad epoch num");
+  } else if (has_pivots_) {
+    return Route(key, value);
+  }
+  PutLengthPrefixedSlice(&pending_, key);
+  PutLengthPrefixedSlice(&pending_, value);
+  num_pending_++;
+  if (num_pending_ >= options_.sample_size) {
+    return SetPivots();
+  } else {
+    return Status::OK();
+  }
+}
+
+Status RangeShufflerImpl::EpochFlush(int epoch) {
+  if (epoch != epoch_) {
+    return Status::AssertionFailed("Bad epoch num");
+  }
+  Status s;
+  if (!has_pivots_) {
+    s = SetPivots();
+  }
+  for (int i = 0; s.ok() && i < options_.nranks; i++) {
+    if (buf_counts_[i] != 0) {
+      s = SendBatch(i);
+    }
+  }
+  if (s.ok()) {
+    MutexLock ml(&mu_);
+    while (num_inflight_ != 0) {
+      cv_.Wait();
+    }
+    s = bg_status_;
+  }
+  // All our records of the epoch have been received by their owners
+  if (s.ok()) {
+    std::string msg;
+    PutHeader(&msg, kEnd, epoch_, options_.rank);
+    s = SendToAll(msg);
+  }
+  if (s.ok()) {
+    MutexLock ml(&mu_);
+    num_ends_[epoch_]++;
+    while (num_ends_[epoch_] < options_.nranks) {
+      cv_.Wait();
+    }
+    num_ends_.erase(epoch_);
+  }
+  if (s.ok()) {
+    s = dst_->EpochFlush(epoch_);
+  }
+  if (s.ok()) {
+    has_pivots_ = false;
+    cur_pivots_.clear();
+    epoch_++;
+  }
+  return s;
+}
+
+Status RangeShufflerImpl::HandleMessage(Slice input) {
+  uint32_t type, epoch, rank;
+  if (!GetVarint32(&input, &type) || !GetVarint32(&input, &epoch) ||
+      !GetVarint32(&input, &rank)) {
+    return Status::InvalidArgument("Bad shuffle message");
+  }
+  const int e = static_cast<int>(epoch);
+  if (type == kData) {
+    uint32_t n;
+    // Each record takes at least two bytes for its key and value lengths
+    if (!GetVarint32(&input, &n) || n > input.size() / 2) {
+      return Status::InvalidArgument("Bad shuffle message");
+    }
+    std::vector<Slice> keys(n), values(n);
+    for (uint32_t i = 0; i < n; i++) {
+      if (!GetLengthPrefixedSlice(&input, &keys[i]) ||
+          !GetLengthPrefixedSlice(&input, &values[i])) {
+        return Status::InvalidArgument("Bad shuffle message");
+      }
+    }
+    if (n == 0) {
+      return Status::OK();
+    }
+    return dst_->AddBatch(&keys[0], &values[0], n, e);
+  } else if (type == kSample) {
+    uint64_t n;
+    if (!GetVarint64(&input, &n)) {
+      return Status::InvalidArgument("Bad shuffle message");
+    }
+    std::vector<std::string> sample;
+    Slice key;
+    for (uint64_t i = 0; i < n; i++) {
+      if (!GetLengthPrefixedSlice(&input, &key)) {
+        return Status::InvalidArgument("Bad shuffle message");
+      }
+      sample.push_back(key.ToString());
+    }
+    MutexLock ml(&mu_);
+    std::vector<std::string>* const all = &samples_[e];
+    all->insert(all->end(), sample.begin(), sample.end());
+    num_samples_[e]++;
+    cv_.SignalAll();
+    return Status::OK();
+  } else if (type == kEnd) {
+    MutexLock ml(&mu_);
+    num_ends_[e]++;
+    cv_.SignalAll();
+    return Status::OK();
+  } else {
+    return Status::NotSupported(Slice());
+  }
+}
+
+Status RangeShufflerImpl::ReceiverImpl::Call(Message& in,
+                                             Message& out) RPCNOEXCEPT {
+  Status s = shuffler_->HandleMessage(in.contents);
+  char* const p = EncodeVarint32(out.buf, static_cast<uint32_t>(s.err_code()));
+  out.contents = Slice(out.buf, p - out.buf);
+  return Status::OK();
+}
+
+}  // namespace
+
+Status RangeShuffler::Open(const ShuffleOptions& options, DirWriter* dst,
+                           RangeShuffler** result) {
+  if (options.nranks < 1 || options.rank < 0 ||
+      options.rank >= options.nranks) {
+    return Status::InvalidArgument("Bad shuffle ranks");
+  }
+  *result = new RangeShufflerImpl(options, dst);
+  return Status::OK();
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
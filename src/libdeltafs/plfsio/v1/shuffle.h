@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "v1.h"
+
+#include "pdlfs-common/rpc.h"
+
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+class ThreadPool;
+namespace plfsio {
+
+struct ShuffleOptions {
+  ShuffleOptions();
+
+  // Rank of the caller and total number of ranks shuffling data.
+  // Default: 0 and 1
+  int rank;
+  int nranks;
+
+  // Number of records each rank buffers at the beginning of an epoch before
+  // key ranges are determined. Keys of these records are sent to all ranks as
+  // samples and every rank derives the same range pivots from the union of
+  // all samples.
+  // Default: 1024
+  size_t sample_size;
+
+  // Records destined to a remote rank are buffered and sent once this many
+  // bytes have been accumulated.
+  // Default: 32KB
+  size_t batch_size;
+
+  // Max number of batches that may be in flight at the same time. Writers
+  // are blocked once this many batches are being sent.
+  // Default: 4
+  int max_inflight_batches;
+
+  // If not NULL, batches are sent in the background using this thread pool
+  // so that communication overlaps with the writing of local records.
+  // Otherwise, batches are sent synchronously by writers.
+  // Default: NULL
+  ThreadPool* pool;
+};
+
+// Redistribute records written by a set of ranks such that each rank owns a
+// contiguous key range in each epoch and writes all records in that range into
+// its own directory. Range pivots are set per epoch by sampling keys written
+// at the beginning of the epoch. Each rank runs a shuffler and the shufflers
+// talk to each other through the rpc layer.
+class RangeShuffler {
+ public:
+  RangeShuffler() {}
+  virtual ~RangeShuffler();
+
+  // Create a shuffler that writes records owned by this rank into "dst".
+  // "dst" must remain alive until the shuffler is deleted.
+  // Return OK on success, or a non-OK status on errors.
+  static Status Open(const ShuffleOptions& options, DirWriter* dst,
+                     RangeShuffler** result);
+
+  // Return the handler for messages sent by the shufflers of other ranks.
+  // This is to be registered as the server callback (RPCOptions::fs) of this
+  // rank's rpc instance.
+  virtual rpc::If* Receiver() = 0;
+
+  // Set the stubs through which this shuffler reaches other ranks, where
+  // stubs[i] leads to the receiver of rank i. stubs[options.rank] is not
+  // used. Stubs are not owned by the shuffler.
+  // REQUIRES: Must be called once before any other method is called.
+  virtual void Connect(rpc::If* const* stubs) = 0;
+
+  // Route a record to the rank owning its key in the current epoch. Records
+  // written before the pivots of an epoch are set are buffered locally.
+  // REQUIRES: epoch is the current epoch. External synchronization.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status Add(const Slice& key, const Slice& value, int epoch) = 0;
+
+  // Send all buffered records of the current epoch, wait for all ranks to
+  // finish sending their records of the epoch, and then flush the epoch of
+  // the local directory. Must be called by all ranks for every epoch.
+  // REQUIRES: External synchronization.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status EpochFlush(int epoch) = 0;
+
+  // Obtain the pivots of a given epoch. Keys in [(*pivots)[i-1],
+  // (*pivots)[i]) are owned by rank i. Return OK on success, or a non-OK
+  // status if the pivots of the epoch are not yet set.
+  virtual Status GetPivots(int epoch, std::vector<std::string>* pivots) = 0;
+
+  // Return the rank owning "key" according to "pivots". A range query for
+  // keys in [start, end] only needs ranks RankOf(start) to RankOf(end).
+  static int RankOf(const std::vector<std::string>& pivots, const Slice& key);
+
+ private:
+  // No copying allowed
+  void operator=(const RangeShuffler&);
+  RangeShuffler(const RangeShuffler&);
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
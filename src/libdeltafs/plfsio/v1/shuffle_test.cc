@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "shuffle.h"
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
+
+#include <stdio.h>
+
+namespace pdlfs {
+namespace plfsio {
+
+static const int kRanks = 3;
+static const int kEpochs = 2;
+static const int kKeysPerRank = 2000;
+
+class RangeShufflerTest {
+ public:
+  RangeShufflerTest() : cv_(&mu_), num_running_(0) {
+    dirname_ = test::TmpDir() + "/shuffle_test";
+    options_.env = Env::Default();
+    sopts_.nranks = kRanks;
+    sopts_.sample_size = 100;
+    sopts_.batch_size = 1 << 10;
+    DestroyDir(dirname_, options_);
+    for (int r = 0; r < kRanks; r++) {
+      DirOptions options = options_;
+      options.rank = r;
+      ASSERT_OK(DirWriter::Open(options, dirname_, &writers_[r]));
+      ShuffleOptions sopts = sopts_;
+      sopts.rank = r;
+      ASSERT_OK(RangeShuffler::Open(sopts, writers_[r], &shufflers_[r]));
+      stubs_[r] = shufflers_[r]->Receiver();
+    }
+    for (int r = 0; r < kRanks; r++) {
+      shufflers_[r]->Connect(stubs_);
+    }
+  }
+
+  ~RangeShufflerTest() {
+    for (int r = 0; r < kRanks; r++) {
+      delete shufflers_[r];
+      delete writers_[r];
+    }
+  }
+
+  struct RankState {
+    RangeShufflerTest* test;
+    int rank;
+    Status status;
+  };
+
+  // Each rank writes keys interleaved with the keys of other ranks so that
+  // most records have to be shuffled.
+  static void RankBody(void* arg) {
+    RankState* const state = reinterpret_cast<RankState*>(arg);
+    RangeShufflerTest* const t = state->test;
+    RangeShuffler* const shuffler = t->shufflers_[state->rank];
+    char tmp[20];
+    Status s;
+    for (int e = 0; s.ok() && e < kEpochs; e++) {
+      for (int i = 0; s.ok() && i < kKeysPerRank; i++) {
+        snprintf(tmp, sizeof(tmp), "%06d", i * kRanks + state->rank);
+        s = shuffler->Add(tmp, std::string(1, 'a' + e), e);
+      }
+      if (s.ok()) {
+        s = shuffler->EpochFlush(e);
+      }
+    }
+    MutexLock ml(&t->mu_);
+    state->status = s;
+    t->num_running_--;
+    t->cv_.SignalAll();
+  }
+
+  void Run() {
+    RankState states[kRanks];
+    num_running_ = kRanks;
+    for (int r = 0; r < kRanks; r++) {
+      states[r].test = this;
+      states[r].rank = r;
+      Env::Default()->StartThread(RankBody, &states[r]);
+    }
+    {
+      MutexLock ml(&mu_);
+      while (num_running_ != 0) {
+        cv_.Wait();
+      }
+    }
+    for (int r = 0; r < kRanks; r++) {
+      ASSERT_OK(states[r].status);
+      ASSERT_OK(writers_[r]->Finish());
+    }
+  }
+
+  struct ScanState {
+    const std::vector<std::string>* pivots;
+    int rank;
+    size_t num_misplaced;
+  };
+
+  static int CheckKey(void* arg, const Slice& key, const Slice& value) {
+    ScanState* const state = reinterpret_cast<ScanState*>(arg);
+    if (RangeShuffler::RankOf(*state->pivots, key) != state->rank) {
+      state->num_misplaced++;
+    }
+    return 0;
+  }
+
+  // Check that every rank has received exactly the records in its key range.
+  void Check() {
+    for (int e = 0; e < kEpochs; e++) {
+      std::vector<std::string> pivots;
+      ASSERT_OK(shufflers_[0]->GetPivots(e, &pivots));
+      ASSERT_EQ(pivots.size(), kRanks - 1);
+      size_t total = 0;
+      for (int r = 0; r < kRanks; r++) {
+        std::vector<std::string> other;
+        ASSERT_OK(shufflers_[r]->GetPivots(e, &other));
+        ASSERT_TRUE(other == pivots);
+        DirOptions options = options_;
+        options.rank = r;
+        DirReader* reader;
+        ASSERT_OK(DirReader::Open(options, dirname_, &reader));
+        DirReader::CountOp count_op;
+        count_op.SetEpoch(e);
+        size_t n = 0;
+        ASSERT_OK(reader->Count(count_op, &n));
+        ASSERT_TRUE(n > 0);
+        total += n;
+        ScanState state;
+        state.pivots = &pivots;
+        state.rank = r;
+        state.num_misplaced = 0;
+        DirReader::ScanOp scan_op;
+        scan_op.SetEpoch(e);
+        ASSERT_OK(reader->Scan(scan_op, CheckKey, &state));
+        ASSERT_EQ(state.num_misplaced, 0);
+        delete reader;
+      }
+      ASSERT_EQ(total, kRanks * kKeysPerRank);
+    }
+  }
+
+  DirOptions options_;
+  ShuffleOptions sopts_;
+  std::string dirname_;
+  DirWriter* writers_[kRanks];
+  RangeShuffler* shufflers_[kRanks];
+  rpc::If* stubs_[kRanks];
+  port::Mutex mu_;
+  port::CondVar cv_;
+  int num_running_;
+};
+
+TEST(RangeShufflerTest, RankOf) {
+  std::vector<std::string> pivots;
+  ASSERT_EQ(RangeShuffler::RankOf(pivots, "x"), 0);
+  pivots.push_back("b");
+  pivots.push_back("d");
+  ASSERT_EQ(RangeShuffler::RankOf(pivots, "a"), 0);
+  ASSERT_EQ(RangeShuffler::RankOf(pivots, "b"), 1);
+  ASSERT_EQ(RangeShuffler::RankOf(pivots, "c"), 1);
+  ASSERT_EQ(RangeShuffler::RankOf(pivots, "d"), 2);
+  ASSERT_EQ(RangeShuffler::RankOf(pivots, "z"), 2);
+}
+
+TEST(RangeShufflerTest, SyncSends) {
+  Run();
+  Check();
+}
+
+TEST(RangeShufflerTest, BackgroundSends) {
+  ThreadPool* const pool = ThreadPool::NewFixed(4);
+  for (int r = 0; r < kRanks; r++) {
+    delete shufflers_[r];
+    ShuffleOptions sopts = sopts_;
+    sopts.rank = r;
+    sopts.pool = pool;
+    sopts.max_inflight_batches = 2;
+    ASSERT_OK(RangeShuffler::Open(sopts, writers_[r], &shufflers_[r]));
+    stubs_[r] = shufflers_[r]->Receiver();
+  }
+  for (int r = 0; r < kRanks; r++) {
+    shufflers_[r]->Connect(stubs_);
+  }
+  Run();
+  Check();
+  for (int r = 0; r < kRanks; r++) {
+    delete shufflers_[r];
+    shufflers_[r] = NULL;
+  }
+  delete pool;
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
+
+int main(int argc, char* argv[]) {
+  return pdlfs::test::RunAllTests(&argc, &argv);
+}
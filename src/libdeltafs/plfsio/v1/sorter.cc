@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "sorter.h"
+
+#include <string.h>
+#include <vector>
+
+namespace pdlfs {
+namespace plfsio {
+
+KeySorter::~KeySorter() {}
+
+namespace {
+
+// Sort keys one byte at a time starting from the last byte. Each pass is a
+// stable counting sort of the current permutation, so the final permutation
+// is stable too. Passes over bytes that are the same for all keys are
+// skipped.
+class CpuSorter : public KeySorter {
+ public:
+  CpuSorter() {}
+  virtual ~CpuSorter() {}
+
+  virtual Status Sort(const char* keys, size_t key_size, uint32_t n,
+                      uint32_t* perm) {
+    for (uint32_t i = 0; i < n; i++) {
+      perm[i] = i;
+    }
+    if (n < 2) {
+      return Status::OK();
+    }
+    std::vector<uint32_t> tmp(n);
+    uint32_t* src = perm;
+    uint32_t* dst = &tmp[0];
+    size_t count[257];
+    for (size_t depth = key_size; depth-- > 0;) {
+      memset(count, 0, sizeof(count));
+      for (uint32_t i = 0; i < n; i++) {
+        count[1 + KeyByte(keys, key_size, i, depth)]++;
+      }
+      if (count[1 + KeyByte(keys, key_size, 0, depth)] == n) {
+        continue;  // All keys share this byte
+      }
+      for (size_t b = 1; b < 256; b++) {
+        count[b] += count[b - 1];
+      }
+      for (uint32_t i = 0; i < n; i++) {
+        dst[count[KeyByte(keys, key_size, src[i], depth)]++] = src[i];
+      }
+      uint32_t* const t = src;
+      src = dst;
+      dst = t;
+    }
+    if (src != perm) {
+      memcpy(perm, src, n * sizeof(uint32_t));
+    }
+    return Status::OK();
+  }
+
+ private:
+  static unsigned char KeyByte(const char* keys, size_t key_size, uint32_t i,
+                               size_t depth) {
+    return static_cast<unsigned char>(keys[i * key_size + depth]);
+  }
+};
+
+}  // namespace
+
+KeySorter* KeySorter::NewCpuSorter() { return new CpuSorter; }
+
+}  // namespace plfsio
+}  // namespace pdlfs
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "pdlfs-common/status.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace pdlfs {
+namespace plfsio {
+
+// Sorts the keys of full memtables on behalf of directory compactions. This
+// allows memtable sorts to run on devices other than the cpu cores left to
+// compactions, such as an idle GPU on nodes where the application computes
+// on GPUs. Memtables are handed to the sorter as a dense array of
+// fixed-sized keys, a layout that can be copied to a device as is, and the
+// sorter returns the permutation that sorts them. Only memtables whose keys
+// all have the same size are handed to the sorter.
+// Implementations must be thread-safe.
+class KeySorter {
+ public:
+  KeySorter() {}
+  virtual ~KeySorter();
+
+  // Set perm[0..n-1] to the permutation that stably sorts the n keys stored
+  // back to back in "keys", each key_size bytes long, in bytewise order:
+  // perm[i] is the index of the i-th smallest key, and keys that are equal
+  // keep their relative order. Return a non-OK status to have the memtable
+  // sorted by the compaction thread instead, such as when n is too small for
+  // an offload to pay off or when the device is not available.
+  virtual Status Sort(const char* keys, size_t key_size, uint32_t n,
+                      uint32_t* perm) = 0;
+
+  // Return a sorter that sorts keys on the calling thread through a
+  // least-significant-digit radix sort. Serves as a reference for device
+  // sorters and as a fallback for nodes without one.
+  static KeySorter* NewCpuSorter();
+
+ private:
+  // No copying allowed
+  void operator=(const KeySorter&);
+  KeySorter(const KeySorter&);
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "spill.h"
+
+#include "pdlfs-common/coding.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace pdlfs {
+namespace plfsio {
+
+namespace {
+// Records are written in chunks of about this size, each preceded by its
+// length as a fixed32
+const size_t kChunkSize = 64 << 10;
+
+// Read up to n bytes into scratch, stopping early only at the end of the file.
+Status ReadFully(SequentialFile* file, size_t n, char* scratch, size_t* got) {
+  Status status;
+  *got = 0;
+  while (*got < n) {
+    Slice result;
+    status = file->Read(n - *got, &result, scratch + *got);
+    if (!status.ok() || result.empty()) {
+      break;
+    }
+    if (result.data() != scratch + *got) {
+      memmove(scratch + *got, result.data(), result.size());
+    }
+    *got += result.size();
+  }
+  return status;
+}
+}  // namespace
+
+SpillRun::SpillRun(Env* env, const std::string& fname, uint64_t size,
+                   uint32_t num_entries)
+    : env_(env), fname_(fname), size_(size), num_entries_(num_entries) {}
+
+SpillRun::~SpillRun() { env_->DeleteFile(fname_.c_str()); }
+
+Status SpillRun::Write(Env* env, const std::string& fname, Iterator* iter,
+                       SpillRun** result) {
+  *result = NULL;
+  WritableFile* file;
+  Status status = env->NewWritableFile(fname.c_str(), &file);
+  if (!status.ok()) {
+    return status;
+  }
+  uint64_t size = 0;
+  uint32_t num_entries = 0;
+  std::string chunk;
+  chunk.reserve(kChunkSize + 4);
+  chunk.resize(4);  // Room for the chunk length
+  iter->SeekToFirst();
+  while (status.ok()) {
+    const bool done = !iter->Valid();
+    if (!done) {
+      PutLengthPrefixedSlice(&chunk, iter->key());
+      PutLengthPrefixedSlice(&chunk, iter->value());
+      num_entries++;
+      iter->Next();
+    }
+    if (chunk.size() >= kChunkSize || (done && chunk.size() > 4)) {
+      EncodeFixed32(&chunk[0], static_cast<uint32_t>(chunk.size() - 4));
+      status = file->Append(chunk);
+      size += chunk.size();
+      chunk.resize(4);
+    }
+    if (done) {
+      break;
+    }
+  }
+  if (status.ok()) {
+    status = iter->status();
+  }
+  if (status.ok()) {
+    status = file->Close();
+  } else {
+    file->Close();
+  }
+  delete file;
+  if (status.ok()) {
+    *result = new SpillRun(env, fname, size, num_entries);
+  } else {
+    env->DeleteFile(fname.c_str());
+  }
+  return status;
+}
+
+class SpillRun::Iter : public Iterator {
+ public:
+  explicit Iter(const SpillRun* run)
+      : run_(run), file_(NULL), num_read_(0), valid_(false) {}
+
+  virtual ~Iter() { delete file_; }
+
+  virtual bool Valid() const { return valid_; }
+  virtual Status status() const { return status_; }
+
+  virtual void SeekToFirst() {
+    delete file_;
+    file_ = NULL;
+    num_read_ = 0;
+    input_ = Slice();
+    valid_ = false;
+    status_ = run_->env_->NewSequentialFile(run_->fname_.c_str(), &file_);
+    if (status_.ok()) {
+      ParseNextEntry();
+    }
+  }
+
+  virtual void SeekToLast() {
+    valid_ = false;
+    status_ = Status::NotSupported(Slice());
+  }
+
+  virtual void Seek(const Slice& target) {
+    valid_ = false;
+    status_ = Status::NotSupported(Slice());
+  }
+
+  virtual void Next() {
+    assert(Valid());
+    ParseNextEntry();
+  }
+
+  virtual void Prev() {
+    valid_ = false;
+    status_ = Status::NotSupported(Slice());
+  }
+
+  virtual Slice key() const {
+    assert(Valid());
+    return key_;
+  }
+
+  virtual Slice value() const {
+    assert(Valid());
+    return value_;
+  }
+
+ private:
+  // Load the next chunk of the file. The previous chunk is kept so that the
+  // entry parsed from it stays valid.
+  bool ReadChunk() {
+    char tmp[4];
+    size_t n;
+    status_ = ReadFully(file_, sizeof(tmp), tmp, &n);
+    if (!status_.ok() || n == 0) {
+      return false;
+    } else if (n != sizeof(tmp)) {
+      status_ = Status::Corruption("Truncated spill run chunk header");
+      return false;
+    }
+    const size_t chunk_size = DecodeFixed32(tmp);
+    prev_chunk_.swap(chunk_);
+    chunk_.resize(chunk_size);
+    status_ = ReadFully(file_, chunk_size, &chunk_[0], &n);
+    if (!status_.ok()) {
+      return false;
+    } else if (n != chunk_size) {
+      status_ = Status::Corruption("Truncated spill run chunk");
+      return false;
+    }
+    input_ = chunk_;
+    return true;
+  }
+
+  void ParseNextEntry() {
+    valid_ = false;
+    if (num_read_ == run_->num_entries_) {
+      return;
+    }
+    if (input_.empty() && !ReadChunk()) {
+      if (status_.ok()) {
+        status_ = Status::Corruption("Spill run ended early");
+      }
+      return;
+    }
+    if (!GetLengthPrefixedSlice(&input_, &key_) ||
+        !GetLengthPrefixedSlice(&input_, &value_)) {
+      status_ = Status::Corruption("Bad spill run contents");
+      return;
+    }
+    num_read_++;
+    valid_ = true;
+  }
+
+  const SpillRun* const run_;
+  SequentialFile* file_;
+  std::string chunk_;
+  std::string prev_chunk_;
+  Slice input_;  // Unparsed part of chunk_
+  uint32_t num_read_;
+  bool valid_;
+  Status status_;
+  Slice key_;
+  Slice value_;
+};
+
+Iterator* SpillRun::NewIterator() const { return new Iter(this); }
+
+SpillMergeIter::SpillMergeIter(const std::vector<Iterator*>& children,
+                               bool sorted)
+    : children_(children), sorted_(sorted), current_(NULL), current_idx_(0) {}
+
+SpillMergeIter::~SpillMergeIter() {
+  for (size_t i = 0; i < children_.size(); i++) {
+    delete children_[i];
+  }
+}
+
+void SpillMergeIter::SeekToFirst() {
+  status_ = Status::OK();
+  for (size_t i = 0; i < children_.size(); i++) {
+    children_[i]->SeekToFirst();
+  }
+  current_idx_ = 0;
+  FindNext();
+}
+
+void SpillMergeIter::SeekToLast() {
+  current_ = NULL;
+  status_ = Status::NotSupported(Slice());
+}
+
+void SpillMergeIter::Seek(const Slice& target) {
+  current_ = NULL;
+  status_ = Status::NotSupported(Slice());
+}
+
+void SpillMergeIter::Next() {
+  assert(Valid());
+  current_->Next();
+  FindNext();
+}
+
+void SpillMergeIter::Prev() {
+  current_ = NULL;
+  status_ = Status::NotSupported(Slice());
+}
+
+Slice SpillMergeIter::key() const {
+  assert(Valid());
+  return current_->key();
+}
+
+Slice SpillMergeIter::value() const {
+  assert(Valid());
+  return current_->value();
+}
+
+Status SpillMergeIter::status() const { return status_; }
+
+// Position current_ at the child holding the next record. Stop at the first
+// child error. Runs are few, so the smallest key is found by a linear scan.
+void SpillMergeIter::FindNext() {
+  current_ = NULL;
+  for (size_t i = 0; i < children_.size(); i++) {
+    if (!children_[i]->status().ok()) {
+      status_ = children_[i]->status();
+      return;
+    }
+  }
+  if (!sorted_) {
+    while (current_idx_ < children_.size() &&
+           !children_[current_idx_]->Valid()) {
+      current_idx_++;
+    }
+    if (current_idx_ < children_.size()) {
+      current_ = children_[current_idx_];
+    }
+    return;
+  }
+  for (size_t i = 0; i < children_.size(); i++) {
+    Iterator* const child = children_[i];
+    if (child->Valid() &&
+        (current_ == NULL || child->key().compare(current_->key()) < 0)) {
+      current_ = child;
+    }
+  }
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
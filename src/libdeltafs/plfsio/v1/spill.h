@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/leveldb/iterator.h"
+#include "pdlfs-common/status.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+namespace plfsio {
+
+// A run of records spilled from a full write buffer to a local scratch file
+// when no spare write buffer is left. Runs are written once, read back once
+// by the compaction that merges them with a later write buffer, and then
+// deleted. Records are stored in chunks so that reading a run back takes no
+// more memory than a couple of chunks.
+class SpillRun {
+ public:
+  // Write the records of "iter", from its first to its last, to a new file
+  // named "fname". Records are stored in the order the iterator yields them.
+  // Return OK on success, or a non-OK status on errors, in which case the
+  // file is removed.
+  static Status Write(Env* env, const std::string& fname, Iterator* iter,
+                      SpillRun** result);
+  // Remove the file.
+  ~SpillRun();
+
+  // Total number of bytes written to the file.
+  uint64_t size() const { return size_; }
+  uint32_t num_entries() const { return num_entries_; }
+
+  // Return an iterator over the records of the run, which must be deleted by
+  // the caller when it is no longer needed. Only SeekToFirst() and Next() are
+  // supported. The key and the value of the previous position stay valid
+  // after a call to Next().
+  Iterator* NewIterator() const;
+
+ private:
+  SpillRun(Env* env, const std::string& fname, uint64_t size,
+           uint32_t num_entries);
+  class Iter;
+
+  // No copying allowed
+  void operator=(const SpillRun&);
+  SpillRun(const SpillRun&);
+
+  Env* const env_;
+  const std::string fname_;
+  const uint64_t size_;
+  const uint32_t num_entries_;
+};
+
+// Merge the records of a write buffer and of the runs spilled before it. If
+// "sorted" is true, all children must be sorted and records are yielded in
+// bytewise key order, with ties going to earlier children. Otherwise
+// children are yielded one after another. Only SeekToFirst() and Next() are
+// supported. The key and the value of the previous position stay valid after
+// a call to Next() as long as they do for each child.
+class SpillMergeIter : public Iterator {
+ public:
+  // Takes ownership of the children.
+  SpillMergeIter(const std::vector<Iterator*>& children, bool sorted);
+  virtual ~SpillMergeIter();
+
+  virtual bool Valid() const { return current_ != NULL; }
+  virtual void SeekToFirst();
+  virtual void SeekToLast();
+  virtual void Seek(const Slice& target);
+  virtual void Next();
+  virtual void Prev();
+  virtual Slice key() const;
+  virtual Slice value() const;
+  virtual Status status() const;
+
+ private:
+  void FindNext();
+
+  std::vector<Iterator*> children_;
+  const bool sorted_;
+  Iterator* current_;
+  size_t current_idx_;
+  Status status_;
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
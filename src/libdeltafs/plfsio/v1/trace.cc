@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "trace.h"
+
+#include "pdlfs-common/mutexlock.h"
+
+#include <stdio.h>
+
+namespace pdlfs {
+namespace plfsio {
+
+DirTracer::DirTracer(size_t capacity) : total_(0) {
+  ring_.resize(capacity != 0 ? capacity : 1);
+}
+
+DirTracer::~DirTracer() {}
+
+void DirTracer::Record(const char* name, uint64_t start_micros,
+                       uint64_t end_micros) {
+  const uint64_t tid = port::PthreadId();
+  MutexLock ml(&mu_);
+  TraceSpan* const span = &ring_[total_ % ring_.size()];
+  span->name = name;
+  span->tid = tid;
+  span->start_micros = start_micros;
+  span->dur_micros = end_micros > start_micros ? end_micros - start_micros : 0;
+  total_++;
+}
+
+void DirTracer::GetSpans(std::vector<TraceSpan>* result) const {
+  result->clear();
+  MutexLock ml(&mu_);
+  const uint64_t n = total_ < ring_.size() ? total_ : ring_.size();
+  for (uint64_t i = total_ - n; i < total_; i++) {
+    result->push_back(ring_[i % ring_.size()]);
+  }
+}
+
+uint64_t DirTracer::NumDropped() const {
+  MutexLock ml(&mu_);
+  return total_ > ring_.size() ? total_ - ring_.size() : 0;
+}
+
+std::string DirTracer::ToChromeJson(int pid) const {
+  std::vector<TraceSpan> spans;
+  GetSpans(&spans);
+  std::string result = "{\"traceEvents\":[";
+  char tmp[200];
+  for (size_t i = 0; i < spans.size(); i++) {
+    snprintf(tmp, sizeof(tmp),
+             "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%llu,"
+             "\"ts\":%llu,\"dur\":%llu}",
+             i != 0 ? "," : "", spans[i].name, pid,
+             static_cast<unsigned long long>(spans[i].tid),
+             static_cast<unsigned long long>(spans[i].start_micros),
+             static_cast<unsigned long long>(spans[i].dur_micros));
+    result += tmp;
+  }
+  result += "],\"displayTimeUnit\":\"ms\"}";
+  return result;
+}
+
+Status DirTracer::WriteChromeJson(Env* env, const std::string& fname,
+                                  int pid) const {
+  return WriteStringToFile(env, ToChromeJson(pid), fname.c_str());
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/status.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+namespace plfsio {
+
+// A timed stage of the write pipeline, such as sorting a write buffer or
+// appending to a log.
+struct TraceSpan {
+  const char* name;  // Must be a string literal
+  uint64_t tid;      // Id of the thread that ran the stage
+  uint64_t start_micros;
+  uint64_t dur_micros;
+};
+
+// Keep the most recent spans recorded by a directory in a fixed-sized ring
+// buffer so that tracing may be left on for long runs. Spans are only taken
+// at pipeline-stage granularity (per buffer, per table, per log write), so a
+// single lock suffices. Implementation is thread-safe.
+class DirTracer {
+ public:
+  explicit DirTracer(size_t capacity = 64 << 10);
+  ~DirTracer();
+
+  void Record(const char* name, uint64_t start_micros, uint64_t end_micros);
+
+  // Return the spans currently held, oldest first.
+  void GetSpans(std::vector<TraceSpan>* result) const;
+
+  // Total number of spans overwritten before being exported.
+  uint64_t NumDropped() const;
+
+  // Return all spans held in the Chrome trace event format, which can be
+  // loaded by chrome://tracing and Perfetto. Spans are tagged with the given
+  // pid so that traces from multiple ranks can be viewed side by side.
+  std::string ToChromeJson(int pid) const;
+
+  // Write the result of ToChromeJson() to a named file.
+  Status WriteChromeJson(Env* env, const std::string& fname, int pid) const;
+
+ private:
+  mutable port::Mutex mu_;
+  std::vector<TraceSpan> ring_;
+  uint64_t total_;  // Total number of spans recorded
+
+  // No copying allowed
+  void operator=(const DirTracer&);
+  DirTracer(const DirTracer&);
+};
+
+// Record the lifetime of a scope as a span. Does nothing if the tracer is
+// NULL.
+class TraceScope {
+ public:
+  TraceScope(DirTracer* tracer, const char* name)
+      : tracer_(tracer),
+        name_(name),
+        start_(tracer != NULL ? CurrentMicros() : 0) {}
+
+  ~TraceScope() {
+    if (tracer_ != NULL) {
+      tracer_->Record(name_, start_, CurrentMicros());
+    }
+  }
+
+ private:
+  DirTracer* const tracer_;
+  const char* const name_;
+  const uint64_t start_;
+
+  // No copying allowed
+  void operator=(const TraceScope&);
+  TraceScope(const TraceScope&);
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
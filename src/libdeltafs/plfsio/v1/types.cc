@@ -15,26 +15,139 @@
 
 #include "pdlfs-common/strutil.h"
 
+#include <stdio.h>
 #include <string>
 #include <vector>
 
 namespace pdlfs {
 namespace plfsio {
 
-IoStats::IoStats() : index_bytes(0), index_ops(0), data_bytes(0), data_ops(0) {}
+IoStats::IoStats()
+    : index_bytes(0),
+      index_ops(0),
+      data_bytes(0),
+      data_ops(0),
+      cache_hits(0),
+      cache_misses(0) {}
+
+QueryStats::QueryStats()
+    : bytes_read(0),
+      filter_probes(0),
+      filter_false_positives(0),
+      cache_hits(0),
+      cache_misses(0),
+      io_micros(0),
+      decode_micros(0),
+      epochs_skipped(0) {}
+
+DirWritePressure::DirWritePressure()
+    : buffered_bytes(0),
+      buffer_capacity(0),
+      pending_compactions(0),
+      stalling_partitions(0),
+      est_drain_micros(0),
+      spilled_bytes(0) {}
+
+DirSpaceStats::DirSpaceStats()
+    : num_tables(0),
+      num_blocks(0),
+      data_size(0),
+      index_size(0),
+      filter_size(0),
+      checksum_size(0),
+      block_padding_size(0),
+      tail_padding_size(0) {}
+
+void DirSpaceStats::Add(const DirSpaceStats& other) {
+  num_tables += other.num_tables;
+  num_blocks += other.num_blocks;
+  data_size += other.data_size;
+  index_size += other.index_size;
+  filter_size += other.filter_size;
+  checksum_size += other.checksum_size;
+  block_padding_size += other.block_padding_size;
+  tail_padding_size += other.tail_padding_size;
+}
+
+uint64_t DirSpaceStats::TotalSize() const {
+  return data_size + index_size + filter_size + checksum_size +
+         block_padding_size + tail_padding_size;
+}
+
+namespace {
+void AppendSpaceStats(std::string* dst, const char* part, const char* epoch,
+                      const DirSpaceStats& s) {
+  char tmp[200];
+  snprintf(tmp, sizeof(tmp),
+           "%-5s %-6s %7u %9u %12llu %10llu %10llu %9llu %10llu %9llu\n",
+           part, epoch, s.num_tables, s.num_blocks,
+           static_cast<unsigned long long>(s.data_size),
+           static_cast<unsigned long long>(s.index_size),
+           static_cast<unsigned long long>(s.filter_size),
+           static_cast<unsigned long long>(s.checksum_size),
+           static_cast<unsigned long long>(s.block_padding_size),
+           static_cast<unsigned long long>(s.tail_padding_size));
+  dst->append(tmp);
+}
+}  // namespace
+
+std::string DirSpaceReport::ToString() const {
+  std::string result;
+  char tmp[200];
+  snprintf(tmp, sizeof(tmp),
+           "%-5s %-6s %7s %9s %12s %10s %10s %9s %10s %9s\n", "part", "epoch",
+           "tables", "blocks", "data", "index", "filter", "checksum",
+           "block_pad", "tail_pad");
+  result.append(tmp);
+  char part[20];
+  char epoch[20];
+  for (size_t p = 0; p < epochs.size(); p++) {
+    for (size_t e = 0; e < epochs[p].size(); e++) {
+      snprintf(part, sizeof(part), "%d", static_cast<int>(p));
+      snprintf(epoch, sizeof(epoch), "%d", static_cast<int>(e));
+      AppendSpaceStats(&result, part, epoch, epochs[p][e]);
+    }
+  }
+  AppendSpaceStats(&result, "all", "all", total);
+  return result;
+}
 
 DirOptions::DirOptions()
     : total_memtable_budget(4 << 20),
+      num_memtables(2),
       memtable_util(0.97),
       memtable_reserv(1.00),
+      hugepage_buffers(false),
+      pmem_buffer_file(NULL),
+      spill_dir(NULL),
+      spill_budget(0),
+      epoch_merge(false),
+      adaptive_memtables(false),
+      auto_tune(false),
+      staging_buffer(0),
       leveldb_compatible(true),
       skip_sort(false),
+      direct_writes(false),
+      max_compaction_jobs(0),
+      pipelined_compactions(false),
+      parallel_sorts(false),
+      key_sorter(NULL),
       fixed_kv_length(false),
+      ect_index(false),
+      key_index(false),
+      key_epoch_index(false),
+      table_key_samples(0),
+      compact_table_handles(false),
       key_size(8),
       value_size(32),
+      value_column_width(0),
+      column_encoding(kCeNone),
       filter(kFtBloomFilter),
       filter_bits_per_key(0),
+      filter_partition_keys(0),
       bf_bits_per_key(8),
+      bf_optimal_bits(false),
+      gcs_fp_bits(8),
       bm_fmt(kFmtUncompressed),
       bm_key_bits(24),
       cuckoo_seed(301),
@@ -51,16 +164,45 @@ DirOptions::DirOptions()
       epoch_log_rotation(false),
       tail_padding(false),
       compaction_pool(NULL),
+      numa_pools(NULL),
+      num_numa_nodes(0),
+      io_pool(NULL),
+      direct_io(false),
+      max_pending_writes(4),
+      osd(NULL),
+      log_part_size(8 << 20),
+      rate_limiter(NULL),
+      memory_manager(NULL),
       reader_pool(NULL),
+      hedge_pool(NULL),
+      hedge_percentile(95),
+      latency_stats(NULL),
+      tracer(NULL),
+      perf_counters(NULL),
       read_size(8 << 20),
+      block_cache(NULL),
+      block_cache_size(0),
+      scan_resistant_block_cache(false),
+      index_cache(NULL),
+      mmap_indexes(false),
+      mmap_data(false),
+      index_segment_size(0),
+      index_segment_buffer(64 << 20),
+      lazy_indexes(false),
+      max_open_dirs(64),
+      scan_readahead(16),
+      interpolation_search(false),
       parallel_reads(false),
+      read_fetchers(8),
       paranoid_checks(false),
       ignore_filters(false),
       compression(kNoCompression),
       index_compression(kNoCompression),
       force_compression(false),
+      parallel_compression(false),
       verify_checksums(false),
       skip_checksums(false),
+      checksum_type(kCsCrc32c),
       measure_reads(true),
       measure_writes(true),
       num_epochs(-1),
@@ -94,6 +236,24 @@ bool ParseInteger(const Slice& key, const Slice& value, uint64_t* result) {
   }
 }
 
+bool ParseColumnEncoding(const Slice& key, const Slice& value,
+                         ColumnEncoding* result) {
+  if (value == "none") {
+    *result = kCeNone;
+    return true;
+  } else if (value == "xor") {
+    *result = kCeXor;
+    return true;
+  } else if (value == "delta") {
+    *result = kCeDelta;
+    return true;
+  } else {
+    Warn(__LOG_ARGS__, "Unknown column encoding: %s=%s, option ignored",
+         key.c_str(), value.c_str());
+    return false;
+  }
+}
+
 bool ParseBitmapFormat(const Slice& key, const Slice& value,
                        BitmapFormat* result) {
   if (value == "uncompressed") {
@@ -117,6 +277,9 @@ bool ParseBitmapFormat(const Slice& key, const Slice& value,
   } else if (value == "p-f-delta") {
     *result = kFmtPfDelta;
     return true;
+  } else if (value == "auto") {
+    *result = kFmtAuto;
+    return true;
   } else {
     Warn(__LOG_ARGS__, "Unknown bitmap format: %s=%s, option ignored",
          key.c_str(), value.c_str());
@@ -128,6 +291,15 @@ bool ParseFilterType(const Slice& key, const Slice& value, FilterType* result) {
   if (value.starts_with("bloom")) {
     *result = kFtBloomFilter;
     return true;
+  } else if (value.starts_with("blocked")) {
+    *result = kFtBlockedBloomFilter;
+    return true;
+  } else if (value.starts_with("xor")) {
+    *result = kFtXorFilter;
+    return true;
+  } else if (value.starts_with("gcs")) {
+    *result = kFtGcsFilter;
+    return true;
   } else if (value.starts_with("bitmap")) {
     *result = kFtBitmap;
     return true;
@@ -138,11 +310,32 @@ bool ParseFilterType(const Slice& key, const Slice& value, FilterType* result) {
   }
 }
 
+bool ParseChecksumType(const Slice& key, const Slice& value,
+                       ChecksumType* result) {
+  if (value == "crc32c") {
+    *result = kCsCrc32c;
+    return true;
+  } else if (value == "xxhash64") {
+    *result = kCsXxhash64;
+    return true;
+  } else {
+    Warn(__LOG_ARGS__, "Unknown checksum type: %s=%s, option ignored",
+         key.c_str(), value.c_str());
+    return false;
+  }
+}
+
 bool ParseCompressionType(const Slice& key, const Slice& value,
                           CompressionType* result) {
   if (value.starts_with("snappy")) {
     *result = kSnappyCompression;
     return true;
+  } else if (value.starts_with("zstd")) {
+    *result = kZstdCompression;
+    return true;
+  } else if (value.starts_with("lz4")) {
+    *result = kLz4Compression;
+    return true;
   } else if (value.starts_with("no")) {
     *result = kNoCompression;
     return true;
@@ -167,7 +360,9 @@ DirOptions ParseDirOptions(const char* input) {
       continue;
     }
     FilterType filter_type;
+    ChecksumType checksum_type;
     BitmapFormat bm_fmt;
+    ColumnEncoding column_encoding;
     CompressionType compression_type;
     Slice conf_key = conf_pair[0];
     Slice conf_value = conf_pair[1];
@@ -193,10 +388,50 @@ DirOptions ParseDirOptions(const char* input) {
       if (ParseInteger(conf_key, conf_value, &num)) {
         result.total_memtable_budget = num;
       }
+    } else if (conf_key == "num_memtables") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.num_memtables = int(num);
+      }
+    } else if (conf_key == "hugepage_buffers") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.hugepage_buffers = flag;
+      }
+    } else if (conf_key == "spill_budget") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.spill_budget = num;
+      }
+    } else if (conf_key == "epoch_merge") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.epoch_merge = flag;
+      }
+    } else if (conf_key == "adaptive_memtables") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.adaptive_memtables = flag;
+      }
+    } else if (conf_key == "auto_tune") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.auto_tune = flag;
+      }
+    } else if (conf_key == "staging_buffer") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.staging_buffer = num;
+      }
+    } else if (conf_key == "direct_io") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.direct_io = flag;
+      }
+    } else if (conf_key == "max_pending_writes") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.max_pending_writes = int(num);
+      }
     } else if (conf_key == "compaction_buffer") {
       if (ParseInteger(conf_key, conf_value, &num)) {
         result.block_batch_size = num;
       }
+    } else if (conf_key == "log_part_size") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.log_part_size = num;
+      }
     } else if (conf_key == "data_buffer") {
       if (ParseInteger(conf_key, conf_value, &num)) {
         result.data_buffer = num;
@@ -233,14 +468,78 @@ DirOptions ParseDirOptions(const char* input) {
       if (ParseBool(conf_key, conf_value, &flag)) {
         result.skip_checksums = flag;
       }
+    } else if (conf_key == "checksum_type") {
+      if (ParseChecksumType(conf_key, conf_value, &checksum_type)) {
+        result.checksum_type = checksum_type;
+      }
     } else if (conf_key == "skip_sort") {
       if (ParseBool(conf_key, conf_value, &flag)) {
         result.skip_sort = flag;
       }
+    } else if (conf_key == "direct_writes") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.direct_writes = flag;
+      }
+    } else if (conf_key == "max_compaction_jobs") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.max_compaction_jobs = int(num);
+      }
+    } else if (conf_key == "pipelined_compactions") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.pipelined_compactions = flag;
+      }
+    } else if (conf_key == "parallel_sorts") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.parallel_sorts = flag;
+      }
+    } else if (conf_key == "block_cache_size") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.block_cache_size = num;
+      }
+    } else if (conf_key == "scan_resistant_block_cache") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.scan_resistant_block_cache = flag;
+      }
+    } else if (conf_key == "mmap_indexes") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.mmap_indexes = flag;
+      }
+    } else if (conf_key == "mmap_data") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.mmap_data = flag;
+      }
+    } else if (conf_key == "index_segment_size") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.index_segment_size = num;
+      }
+    } else if (conf_key == "index_segment_buffer") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.index_segment_buffer = num;
+      }
+    } else if (conf_key == "lazy_indexes") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.lazy_indexes = flag;
+      }
+    } else if (conf_key == "max_open_dirs") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.max_open_dirs = int(num);
+      }
+    } else if (conf_key == "scan_readahead") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.scan_readahead = int(num);
+      }
     } else if (conf_key == "parallel_reads") {
       if (ParseBool(conf_key, conf_value, &flag)) {
         result.parallel_reads = flag;
       }
+    } else if (conf_key == "read_fetchers") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.read_fetchers = int(num);
+      }
+    } else if (conf_key == "hedge_percentile") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.hedge_percentile = int(num);
+      }
     } else if (conf_key == "paranoid_checks") {
       if (ParseBool(conf_key, conf_value, &flag)) {
         result.paranoid_checks = flag;
@@ -253,10 +552,34 @@ DirOptions ParseDirOptions(const char* input) {
       if (ParseBool(conf_key, conf_value, &flag)) {
         result.ignore_filters = flag;
       }
+    } else if (conf_key == "interpolation_search") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.interpolation_search = flag;
+      }
     } else if (conf_key == "fixed_kv") {
       if (ParseBool(conf_key, conf_value, &flag)) {
         result.fixed_kv_length = flag;
       }
+    } else if (conf_key == "ect_index") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.ect_index = flag;
+      }
+    } else if (conf_key == "key_index") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.key_index = flag;
+      }
+    } else if (conf_key == "key_epoch_index") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.key_epoch_index = flag;
+      }
+    } else if (conf_key == "table_key_samples") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.table_key_samples = num;
+      }
+    } else if (conf_key == "compact_table_handles") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.compact_table_handles = flag;
+      }
     } else if (conf_key == "leveldb_compatible") {
       if (ParseBool(conf_key, conf_value, &flag)) {
         result.leveldb_compatible = flag;
@@ -269,10 +592,22 @@ DirOptions ParseDirOptions(const char* input) {
       if (ParseInteger(conf_key, conf_value, &num)) {
         result.filter_bits_per_key = num;
       }
+    } else if (conf_key == "filter_partition_keys") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.filter_partition_keys = num;
+      }
     } else if (conf_key == "bf_bits_per_key") {
       if (ParseInteger(conf_key, conf_value, &num)) {
         result.bf_bits_per_key = num;
       }
+    } else if (conf_key == "bf_optimal_bits") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.bf_optimal_bits = flag;
+      }
+    } else if (conf_key == "gcs_fp_bits") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.gcs_fp_bits = num;
+      }
     } else if (conf_key == "bm_fmt") {
       if (ParseBitmapFormat(conf_key, conf_value, &bm_fmt)) {
         result.bm_fmt = bm_fmt;
@@ -293,10 +628,22 @@ DirOptions ParseDirOptions(const char* input) {
       if (ParseBool(conf_key, conf_value, &flag)) {
         result.force_compression = flag;
       }
+    } else if (conf_key == "parallel_compression") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.parallel_compression = flag;
+      }
     } else if (conf_key == "value_size") {
       if (ParseInteger(conf_key, conf_value, &num)) {
         result.value_size = num;
       }
+    } else if (conf_key == "value_column_width") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.value_column_width = num;
+      }
+    } else if (conf_key == "column_encoding") {
+      if (ParseColumnEncoding(conf_key, conf_value, &column_encoding)) {
+        result.column_encoding = column_encoding;
+      }
     } else if (conf_key == "key_size") {
       if (ParseInteger(conf_key, conf_value, &num)) {
         result.key_size = num;
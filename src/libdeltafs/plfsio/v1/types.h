@@ -13,15 +13,25 @@
 
 #include "pdlfs-common/compression_type.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/histogram.h"
 #include "pdlfs-common/port.h"
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 namespace pdlfs {
+class Cache;
+class Osd;
+class RateLimiter;
 namespace plfsio {
 
 class EventListener;
+class DirMemoryManager;
+class DirTracer;
+class DirPerfCounters;
+class KeySorter;
 class Compaction;
 class Epoch;
 
@@ -36,6 +46,109 @@ struct IoStats {
   uint64_t data_bytes;
   // Total number of I/O operations for reading or writing data
   uint64_t data_ops;
+  // Total number of data block reads served by the block cache
+  uint64_t cache_hits;
+  // Total number of data block reads that missed the block cache
+  uint64_t cache_misses;
+};
+
+// Cost breakdown of a single read operation.
+struct QueryStats {
+  QueryStats();
+
+  // Total bytes of data blocks fetched from the data log
+  uint64_t bytes_read;
+  // Total number of filter probes
+  uint64_t filter_probes;
+  // Total number of filter probes that passed without the key being found
+  uint64_t filter_false_positives;
+  // Total number of data block reads served by the block cache
+  uint64_t cache_hits;
+  // Total number of data block reads that missed the block cache
+  uint64_t cache_misses;
+  // Total time spent fetching data blocks, including checksum verification
+  // and decompression
+  uint64_t io_micros;
+  // Total time spent searching data blocks for the key
+  uint64_t decode_micros;
+  // Total number of epochs skipped by table key ranges and filters without
+  // reading any table index or data block
+  uint64_t epochs_skipped;
+};
+
+// Latency histograms of directory operations in microseconds. Updating them
+// is cheap and safe from many threads, so they may stay enabled in production
+// runs.
+struct DirLatencyStats {
+  ConcurrentHistogram put;         // Per DirWriter::Add() call
+  ConcurrentHistogram get;         // Per DirReader::Read() call
+  ConcurrentHistogram compaction;  // Per memtable compaction
+};
+
+// Write buffer occupancy of a directory. Writers may poll it to shift work
+// before they are blocked waiting for write buffer space.
+struct DirWritePressure {
+  DirWritePressure();
+
+  // Total bytes held by write buffers, including full buffers waiting to be
+  // compacted
+  uint64_t buffered_bytes;
+  // Total write buffer capacity
+  uint64_t buffer_capacity;
+  // Total number of full write buffers waiting to be, or being, compacted
+  uint32_t pending_compactions;
+  // Number of memtable partitions with no spare write buffer left. Writers to
+  // these partitions block once their current buffer fills up.
+  uint32_t stalling_partitions;
+  // Estimated time to compact all full write buffers at the speed of past
+  // compactions. Maximum over all partitions. 0 if no compaction has finished.
+  uint64_t est_drain_micros;
+  // Total bytes of runs spilled to spill_dir that are waiting to be merged
+  uint64_t spilled_bytes;
+};
+
+// Storage space taken by a directory, broken down by purpose. Blocks are
+// counted at their stored sizes, after any compression. Block trailers and the
+// headers of index log chunks are counted as checksum overhead.
+struct DirSpaceStats {
+  DirSpaceStats();
+
+  void Add(const DirSpaceStats& other);
+
+  // Return the sum of all sizes.
+  uint64_t TotalSize() const;
+
+  // Total number of tables. Each memtable compaction produces one table.
+  uint32_t num_tables;
+  // Total number of data blocks
+  uint32_t num_blocks;
+  // Total size of data blocks
+  uint64_t data_size;
+  // Total size of index blocks, epoch and root indexes, epoch seals, footers,
+  // and the block handles preceding each data block in the data log
+  uint64_t index_size;
+  // Total size of filter blocks, including filter partition indexes
+  uint64_t filter_size;
+  // Total size of block trailers and log chunk headers
+  uint64_t checksum_size;
+  // Bytes added to align data blocks (DirOptions::block_padding)
+  uint64_t block_padding_size;
+  // Bytes added to the end of log files (DirOptions::tail_padding)
+  uint64_t tail_padding_size;
+};
+
+// Space accounting of a directory's data and index logs.
+struct DirSpaceReport {
+  // Space taken by each epoch of each memtable partition: epochs[p][e] covers
+  // epoch e of partition p. Empty epochs take no space.
+  std::vector<std::vector<DirSpaceStats> > epochs;
+  // Space taken by the entire directory. Root indexes, footers, and tail
+  // padding are only counted here since they do not belong to any epoch.
+  DirSpaceStats total;
+
+  // Return a table listing the space taken by each epoch and partition,
+  // followed by the directory total.
+  std::string ToString() const;
 };
 
 // Directory semantics
@@ -62,7 +175,33 @@ enum FilterType {
   // Use bloom filters
   kFtBloomFilter = 0x01,
   // Use bitmap filters
-  kFtBitmap = 0x02
+  kFtBitmap = 0x02,
+  // Use bloom filters that keep all probes of a key in one cache line
+  kFtBlockedBloomFilter = 0x03,
+  // Use xor filters with 8-bit fingerprints
+  kFtXorFilter = 0x04,
+  // Use golomb-coded sets
+  kFtGcsFilter = 0x05
+};
+
+// Checksum functions for block trailers and log chunk headers.
+enum ChecksumType {
+  // Use crc32c, hardware accelerated when the processor supports it
+  kCsCrc32c = 0x00,
+  // Use the lower 32 bits of xxhash64
+  kCsXxhash64 = 0x01
+};
+
+// Encoding of each value column of columnar data blocks.
+enum ColumnEncoding {
+  // Store column values as-is
+  kCeNone = 0x00,
+  // Xor each column value with the previous value of the same column
+  kCeXor = 0x01,
+  // Store each column value as the difference from the previous value of
+  // the same column, both read as little-endian integers. Columns wider than
+  // 8 bytes are xor encoded instead
+  kCeDelta = 0x02
 };
 
 // Bitmap compression format.
@@ -80,7 +219,11 @@ enum BitmapFormat {
   // Use p-for-delta with a lookup table
   kFmtFastPfDelta = 0x05,
   // Use p-for-delta
-  kFmtPfDelta = 0x06
+  kFmtPfDelta = 0x06,
+  // Use whichever of the formats above is estimated to be the smallest for
+  // each table, preferring faster ones when they are nearly as small. The
+  // format picked is stored with the bitmap of each table
+  kFmtAuto = 0x07
 };
 
 struct DirOptions {
@@ -93,6 +236,12 @@ struct DirOptions {
   // Default: 4MB
   size_t total_memtable_budget;
 
+  // Number of memtables the memtable budget of each partition is divided into.
+  // While one memtable accepts new insertions, up to num_memtables - 1 full
+  // memtables may be queued for compaction before writers are blocked.
+  // Default: 2 (double buffering)
+  int num_memtables;
+
   // Flush memtable when its size >= memtable_size * memtable_util
   // Default: 0.97 (97%)
   double memtable_util;
@@ -101,7 +250,89 @@ struct DirOptions {
   // Default: 1.00 (100%)
   double memtable_reserv;
 
-  // Always use LevelDb compatible block formats.
+  // Ask the OS to back reserved memtable memory with transparent huge pages
+  // (2MB on x86-64) to reduce TLB misses when sorting large memtables. Only
+  // the 2MB-aligned interior of each buffer is covered. Silently falls back
+  // to regular pages when huge pages are not available.
+  // Default: false
+  bool hugepage_buffers;
+
+  // If not NULL, write buffers are placed in this file, mapped into memory,
+  // instead of DRAM. Intended for files on a DAX file system backed by
+  // persistent memory, in which case records are durable as soon as they are
+  // inserted and those not yet compacted can be recovered after a crash
+  // through RecoverPmemBuffers(). Any existing file is overwritten. Buffers
+  // do not grow beyond their initial size. Ignored if direct_writes is set.
+  // Default: NULL
+  const char* pmem_buffer_file;
+
+  // If not NULL, an existing directory on a node-local file system, such as
+  // one on a local SSD, to which full write buffers are spilled as sorted
+  // runs when writers would otherwise block waiting for compactions to free
+  // a buffer. Spilled runs are merged with the next write buffer compacted
+  // by the same memtable partition, so bursts larger than
+  // total_memtable_budget are absorbed at local storage speed. Runs are
+  // removed once merged. Ignored if direct_writes is set or
+  // pmem_buffer_file is not NULL.
+  // Default: NULL
+  const char* spill_dir;
+
+  // Maximum number of bytes of spilled runs waiting to be merged, split evenly
+  // among memtable partitions. Writers block as if spill_dir were not set
+  // once a partition reaches its share. Set to 0 for no limit.
+  // Default: 0
+  size_t spill_budget;
+
+  // Merge all memtable compactions of an epoch into a single table per
+  // memtable partition, with a single filter, so that reads probe one table
+  // per epoch instead of one per compaction. Each compaction before the
+  // epoch flush writes its sorted write buffer as a run to spill_dir
+  // instead of building a table. The compaction started by the epoch flush
+  // then merges these runs into the epoch's table before the epoch is
+  // sealed, in the background, while writers insert into the next epoch.
+  // Runs count toward spill_budget, and a compaction whose run would exceed
+  // a partition's share builds a table of its own instead. Until the epoch
+  // is flushed, its records are not seen by snapshot readers. Ignored unless
+  // spill_dir is in use.
+  // Default: false
+  bool epoch_merge;
+
+  // Rebalance write buffer memory among memtable partitions according to
+  // their recent insertion rates, so partitions receiving more keys get
+  // larger memtables and flush fewer, bigger tables. The shares add up to
+  // total_memtable_budget and each partition keeps at least a quarter of its
+  // even share. A partition given more memory starts filling bigger buffers
+  // at once, while one given less keeps its full buffers until they are
+  // compacted, so actual memory use may briefly exceed the budget after a
+  // rebalance. Memory is rebalanced each time total_memtable_budget bytes
+  // have been inserted into the directory.
+  // Default: false
+  bool adaptive_memtables;
+
+  // Tune the directory to the workload observed during the first epoch. At
+  // the end of epoch 0, the first epoch flush waits for all compactions to
+  // finish and then measures insertion rate, average key and value sizes,
+  // compaction throughput, and write stalls. Data block size (only when
+  // block_padding is false) and memtable_util are then adjusted for the
+  // remaining epochs, keeping memory within total_memtable_budget. Options
+  // that are fixed once the directory is open, such as lg_parts,
+  // key_size, value_size, block_batch_size, and data_buffer, are only
+  // recommended for the next run. Each decision is logged and can be
+  // retrieved through DirWriter::GetTuningLog().
+  // Default: false
+  bool auto_tune;
+
+  // Size of the per-thread buffers for staging insertions before they are
+  // handed off to the directory in batches. Staging reduces contention on the
+  // directory lock when many threads insert concurrently. When enabled,
+  // insertion errors may be reported by a later call.
+  // Set to 0 to disable.
+  // Default: 0
+  size_t staging_buffer;
+
+  // Always use LevelDb compatible block formats. If OFF, data blocks either
+  // use a fixed-size array format when "fixed_kv_length" is ON, or a
+  // prefix-compressed format with group varint encoded entry lengths.
   // Default: true
   bool leveldb_compatible;
 
@@ -110,11 +341,104 @@ struct DirOptions {
   // Default: false
   bool skip_sort;
 
+  // Insert keys straight into the table builder and filter of their
+  // partition instead of buffering them in memtables first. This avoids
+  // copying each key-value pair into and out of a memtable when keys arrive
+  // already sorted within each partition, such as when replaying sorted
+  // trace files. Keys must be inserted in order unless the directory is
+  // written in an unordered mode. A table is ended every time its partition
+  // has received a memtable's worth of data. Tables are built by the thread
+  // doing the insertion with the directory mutex held, so insertions into
+  // different partitions do not proceed in parallel.
+  // Default: false
+  bool direct_writes;
+
+  // Max number of memtable compactions that may run concurrently on the
+  // compaction pool, summed over all directory partitions. Partitions with
+  // more full memtables are compacted first. Set to 0 to not limit.
+  // Ignored if compaction_pool is NULL.
+  // Default: 0
+  int max_compaction_jobs;
+
+  // Sort full memtables in the background while they wait behind the
+  // compaction of an earlier memtable of the same partition. This overlaps
+  // memtable sorting with table building and writing. Only effective when
+  // num_memtables is greater than 2.
+  // Ignored if compaction_pool is NULL.
+  // Default: false
+  bool pipelined_compactions;
+
+  // Sort large memtables using multiple threads from the compaction pool.
+  // Only applies when all keys in a memtable have the same size, in which
+  // case memtables are sorted using a key-prefix radix sort. Buckets of large
+  // compressed bitmap filters are also sorted in parallel before encoding.
+  // Ignored if compaction_pool is NULL.
+  // Default: false
+  bool parallel_sorts;
+
+  // If not NULL, memtables whose keys all have the same size are sorted by
+  // this object, which may run sorts on a device such as a GPU so that the
+  // cpu cores left to compactions are spent on building tables. Memtables
+  // the sorter declines are sorted as usual. The sorter may be shared by
+  // multiple directories and must outlive them.
+  // Default: NULL
+  KeySorter* key_sorter;
+
   // If key value length is fixed.
   // This enables alternate block formats when "leveldb_compatible" is OFF.
   // Default: false
   bool fixed_kv_length;
 
+  // Supplement the index block of each table with an entropy-coded trie
+  // (ECT) over the keys of the table. The trie takes a few bits per key and
+  // maps a key to its rank within the table, which points point lookups
+  // straight at the data block holding the key without binary searching the
+  // index block. Only used when "fixed_kv_length" is ON and keys are unique
+  // and ordered. Tries are only built and used when compiled with
+  // PDLFS_SILT_ECT. Otherwise lookups fall back to the index block.
+  // Default: false
+  bool ect_index;
+
+  // Supplement the index block of each table with a cuckoo hash table that
+  // maps each key of the table to the position of its entry within the
+  // table's data block. Point lookups then skip the data block altogether if
+  // the key is absent and otherwise probe only the few entries whose
+  // fingerprints match instead of scanning the block. Only used when
+  // "fixed_kv_length" is ON and the directory is in kDmUniqueUnordered mode,
+  // where keys are stored unsorted in a single data block per table.
+  // Default: false
+  bool key_index;
+
+  // At the end of a directory, write a cuckoo hash table that maps every key
+  // of the directory to the set of epochs in which the key appears, so that
+  // point lookups read only those epochs instead of probing the filters of
+  // all of them. Each key's epochs are kept as a 32-bit bitmap indexed by
+  // the epoch number modulo 32, so directories with more than 32 epochs may
+  // still probe a few epochs that do not hold the key. Requires the writer
+  // to keep an 8-byte hash of each inserted key in memory until the
+  // directory is finished. Readers use the table whenever it is present.
+  // Default: false
+  bool key_epoch_index;
+
+  // Sample between this many and twice this many keys evenly from each
+  // table and store them, along with the number of entries of the table, in
+  // the table's handle in the epoch index. Samples summarize the key
+  // distribution of each table so that readers can estimate how many keys
+  // fall within a key range without reading data blocks (see
+  // DirReader::EstimateCount()). Set to 0 to disable sampling.
+  // Default: 0
+  size_t table_key_samples;
+
+  // Store table handles in the epoch index in a compact format: the largest
+  // key of each table and its first key sample are prefix compressed against
+  // its smallest key, and the filter offset is stored as a delta from the end
+  // of the index block. This shrinks the epoch index blocks readers load and
+  // keep in memory, which matters for epochs with many tables. Readers read
+  // handles in either format, but readers that predate this option can not
+  // read directories written with it.
+  // Default: false
+  bool compact_table_handles;
+
   // Estimated key size.
   // If not known, keep the default.
   // Default: 8 bytes
@@ -125,6 +449,21 @@ struct DirOptions {
   // Default: 32 bytes
   size_t value_size;
 
+  // Store fixed sized values column by column in data blocks by splitting
+  // each value into columns of this many bytes. For example, a value holding
+  // 8 floats may use a column width of 4. Columns compress better than rows
+  // and scans that only need a subset of value bytes (see
+  // DirReader::ScanOp) only decode the columns covering that subset.
+  // Set to 0 to store values row by row.
+  // Only used when "fixed_kv_length" is ON and "leveldb_compatible" is OFF.
+  // Default: 0
+  size_t value_column_width;
+
+  // Encoding applied to each value column. Ignored if "value_column_width"
+  // is 0.
+  // Default: kCeNone
+  ColumnEncoding column_encoding;
+
   // Filter type to be applied to directory storage.
   // Default: kFtBloomFilter
   FilterType filter;
@@ -136,12 +475,39 @@ struct DirOptions {
   // Default: 0 bit
   size_t filter_bits_per_key;
 
+  // Max number of keys covered by a single filter partition.
+  // If not 0, the filter of each table is split into partitions, each
+  // covering a consecutive key range of the table, and a per-table filter
+  // index is written to locate the partitions. Writers only keep one
+  // partition in memory at a time, and readers only load the partitions
+  // that may contain a target key. Ignored when keys are unordered.
+  // Readers learn whether filters are partitioned from the directory footer.
+  // Default: 0 (one filter per table)
+  size_t filter_partition_keys;
+
   // Bloom filter bits per key.
   // This option is only used when bloom filter is enabled.
   // Set to 0 to disable bloom filters.
   // Default: 8 bits
   size_t bf_bits_per_key;
 
+  // If true, bloom filter bits are no longer spent uniformly across tables.
+  // Instead, bf_bits_per_key is the average and smaller tables, such as those
+  // flushed at the end of an epoch, get more bits per key while full tables
+  // get slightly fewer. Since a lookup probes the filter of every table, this
+  // reduces the expected number of false positives per lookup without using
+  // more filter space. Ignored for direct writes, whose table sizes are not
+  // known in advance.
+  // Default: false
+  bool bf_optimal_bits;
+
+  // Golomb-coded set fingerprint bits. The false positive rate is about
+  // 2^-gcs_fp_bits / 1.5 and each key takes about gcs_fp_bits + 2 bits of
+  // filter space.
+  // This option is only used when golomb-coded sets are enabled.
+  // Default: 8 bits
+  size_t gcs_fp_bits;
+
   // Storage format used to encoding the bitmap filter.
   // This option is only used when bitmap filter is enabled.
   // Default: kFmtUncompressed
@@ -228,23 +594,213 @@ struct DirOptions {
   // Default: NULL
   ThreadPool* compaction_pool;
 
+  // Compaction thread pools, one per NUMA node, each expected to have its
+  // threads pinned to its node (see deltafs_tp_init_on_node()). If
+  // num_numa_nodes is non-zero, memtable partition k is compacted by
+  // numa_pools[k % num_numa_nodes] instead of compaction_pool, and its write
+  // buffer memory is first touched by that pool so that the OS places it on
+  // the same node. A NULL entry falls back to compaction_pool.
+  // Default: NULL
+  ThreadPool* const* numa_pools;
+
+  // Number of entries in numa_pools. Set to 0 to disable NUMA placement.
+  // Default: 0
+  int num_numa_nodes;
+
+  // Thread pool used to write data and index logs in the background, so that
+  // compactions do not wait for storage I/O. Each pending write holds a copy
+  // of a full write buffer (data_buffer or index_buffer bytes).
+  // Must not be the same pool as compaction_pool.
+  // If set to NULL, logs are written synchronously.
+  // Default: NULL
+  ThreadPool* io_pool;
+
+  // Write data and index logs with O_DIRECT, bypassing the OS page cache.
+  // Logs are staged in aligned buffers of data_buffer or index_buffer bytes.
+  // Only supported when env is Env::Default(). Ignored otherwise, or if the
+  // underlying file system rejects O_DIRECT.
+  // Default: false
+  bool direct_io;
+
+  // Max number of background writes that may be pending for each log
+  // before further writes block. Ignored if io_pool is NULL.
+  // Default: 4
+  int max_pending_writes;
+
+  // If not NULL, data and index logs are written through this object store
+  // instead of env. Each log is cut into objects of log_part_size bytes
+  // that are uploaded by Osd::Put, concurrently through io_pool if it is
+  // not NULL, and listed by a manifest object rewritten on each log sync
+  // and when the log is closed. Readers must be given the same object store
+  // to read the logs back. Other directory files are still kept in env.
+  // Default: NULL
+  Osd* osd;
+
+  // Size of each object of a log written through osd. Each log buffers up
+  // to a few parts of this size while they are being uploaded.
+  // Default: 8MB
+  size_t log_part_size;
+
+  // If not NULL, data and index log writes are charged to this rate limiter
+  // at high priority. The limiter may be shared by multiple directories and
+  // dbs to bound the total write rate of a process to the underlying storage.
+  // Default: NULL
+  RateLimiter* rate_limiter;
+
+  // If not NULL, total_memtable_budget is ignored and the directory's memtable
+  // budget is instead obtained from this manager, which divides a single
+  // budget among all directories registered with it according to their
+  // insertion rates. The directory registers when opened for writing and
+  // unregisters when closed. The manager must outlive the directory.
+  // Default: NULL
+  DirMemoryManager* memory_manager;
+
   // Thread pool used to run concurrent background reads.
   // If set to NULL, Env::Default() may be used to schedule reads if permitted.
   // Otherwise, the caller's thread context will be used directly.
   // Consider setting parallel_reads to true to take full advantage
-  // of this thread pool.
+  // of this thread pool. Point reads are scheduled as urgent tasks so that
+  // a pool shared with compactions (see ThreadPool::NewWorkStealing()) runs
+  // them ahead of compaction work.
   // Default: NULL
   ThreadPool* reader_pool;
 
+  // Thread pool used to issue hedged data block reads. When set, each data
+  // block is read by a task of this pool, and a duplicate read of the same
+  // block is issued once the original read has taken longer than
+  // hedge_percentile of the recent reads of the same data log. Whichever
+  // read finishes first is used, so a straggling storage target does not
+  // hold up the query. Must not be reader_pool, whose tasks wait on these
+  // reads. Set to NULL to read data blocks in the caller's thread.
+  // Default: NULL
+  ThreadPool* hedge_pool;
+
+  // Latency percentile of recent reads of a data log after which a read of
+  // the same log is hedged. Ignored if hedge_pool is NULL.
+  // Default: 95
+  int hedge_percentile;
+
+  // If not NULL, latencies of writes, reads, and compactions are recorded
+  // here. The stats object may be shared by multiple directories.
+  // Default: NULL
+  DirLatencyStats* latency_stats;
+
+  // If not NULL, the duration of each stage of the write pipeline (write
+  // stalls, buffer sorts, table and filter builds, and log writes) is
+  // recorded here for later export as a Chrome trace.
+  // Default: NULL
+  DirTracer* tracer;
+
+  // If not NULL, cpu counters (cycles, instructions, last level cache misses,
+  // and branch misses) of the compaction stages and the read stages are
+  // accumulated here, per stage.
+  // Default: NULL
+  DirPerfCounters* perf_counters;
+
   // Number of bytes to read when loading the indexes.
   // Default: 8MB
   size_t read_size;
 
+  // Cache for data blocks read from the data log. Blocks are keyed by
+  // data log file index and block offset. The cache may be shared among
+  // multiple readers. If set to NULL, a private cache is created when
+  // block_cache_size is non-zero. Otherwise, data blocks are not cached.
+  // Default: NULL
+  Cache* block_cache;
+
+  // Capacity of the private block cache created when block_cache is NULL.
+  // Set to 0 to disable block caching.
+  // Default: 0
+  size_t block_cache_size;
+
+  // Use a scan-resistant eviction policy (see NewScanResistantCache()) for
+  // the private block cache so that blocks read by large scans do not flush
+  // blocks that are read repeatedly. Ignored if block_cache is set.
+  // Default: false
+  bool scan_resistant_block_cache;
+
+  // Cache for index and filter blocks read from index logs. If set, index
+  // logs are no longer loaded into memory in their entirety when a directory
+  // is opened. Index and filter blocks are instead read on demand and kept
+  // in the cache, which bounds the memory spent on indexes. The cache is
+  // typically shared among all readers of a process so many directories can
+  // be kept open at the same time. Overrides mmap_indexes.
+  // Default: NULL
+  Cache* index_cache;
+
+  // Map index logs into memory when opening a directory for reads instead
+  // of reading them in read_size chunks into heap buffers. Index and filter
+  // blocks are then used directly from the mapped memory. Only supported when
+  // env is Env::Default(). Ignored otherwise.
+  // Default: false
+  bool mmap_indexes;
+
+  // Map data logs into memory when opening a directory for reads. Data
+  // blocks are then used directly from the mapped memory instead of being
+  // read into buffers. The number of files mapped at the same time is bounded
+  // process-wide, and logs beyond the bound are read without mapping. Only
+  // supported when env is Env::Default(). Ignored otherwise.
+  // Default: false
+  bool mmap_data;
+
+  // Load index logs in segments of this size on first access instead of
+  // reading them into memory in their entirety when a directory partition is
+  // opened. Loaded segments are kept in a per-log buffer bounded by
+  // index_segment_buffer, and subsequent segments are read ahead using
+  // reader_pool when it is set. Set to 0 to load index logs eagerly.
+  // Ignored if index_cache is set or index logs are mapped.
+  // Default: 0
+  size_t index_segment_size;
+
+  // Max amount of segments buffered per index log when index_segment_size
+  // is non-zero.
+  // Default: 64MB
+  size_t index_segment_buffer;
+
+  // Do not load index logs into memory when a directory partition is first
+  // opened. Only the footer and the root index are read at that time. Index
+  // and filter blocks of each epoch are instead read on their first access
+  // and are kept in a private cache for the lifetime of the reader, so that
+  // readers of directories with many epochs are ready almost immediately and
+  // queries only pay for the epochs they touch. Ignored if index_cache is set.
+  // Default: false
+  bool lazy_indexes;
+
+  // Max number of directories a MultiDirReader keeps open at the same time.
+  // Consider setting index_cache to further bound the memory spent on
+  // indexes of open directories.
+  // Default: 64
+  int max_open_dirs;
+
+  // Max number of data blocks that may be fetched ahead during scans. During
+  // ordered scans this bounds background block prefetches. During regular
+  // scans consecutive blocks of a table are fetched in groups of up to this
+  // many blocks per read, with the next group read in the background while
+  // the current one is decoded if reads are not already parallel across
+  // epochs. Set to 0 or 1 to fetch one block at a time.
+  // Default: 16
+  int scan_readahead;
+
+  // Use interpolation search instead of binary search to locate keys in
+  // fixed-size array blocks. Probe positions are estimated from the leading
+  // key bytes, which locates keys in one or two probes when keys are
+  // uniformly distributed. Falls back to binary search for skewed blocks.
+  // Only used when "fixed_kv_length" is ON and "leveldb_compatible" is OFF.
+  // Default: false
+  bool interpolation_search;
+
   // Set to true to enable parallel reading across different epochs.
   // Otherwise, reads progress serially over all epochs.
   // Default: false
   bool parallel_reads;
 
+  // Max number of background tasks a parallel read runs to fetch its epochs.
+  // Each task fetches epochs one after another, taking the next epoch not yet
+  // taken by other tasks, so a read touching many epochs does not occupy the
+  // reader pool with one task per epoch.
+  // Default: 8
+  int read_fetchers;
+
   // Perform aggressive checking of the data so we stop early on errors.
   // Default: false
   bool paranoid_checks;
@@ -253,11 +809,13 @@ struct DirOptions {
   // Default: false
   bool ignore_filters;
 
-  // Compression type to be applied to data blocks.
+  // Compression type to be applied to data blocks. Snappy, Zstd, and LZ4
+  // are only effective when compiled in (PDLFS_SNAPPY, PDLFS_ZSTD, and
+  // PDLFS_LZ4). Otherwise, blocks are silently stored uncompressed.
   // Default: kNoCompression
   CompressionType compression;
 
-  // Compression type to be applied to index blocks.
+  // Compression type to be applied to index blocks. Same as above.
   // Default: kNoCompression
   CompressionType index_compression;
 
@@ -265,6 +823,13 @@ struct DirOptions {
   // Default: false
   bool force_compression;
 
+  // Compress the data blocks of each write batch (block_batch_size) using
+  // multiple threads from the compaction pool instead of compressing each
+  // block inline as it is built. Blocks are written in their original order.
+  // Ignored if compaction_pool is NULL or compression is kNoCompression.
+  // Default: false
+  bool parallel_compression;
+
   // True if all data read from underlying storage will be verified
   // against the corresponding checksums stored.
   // Default: false
@@ -274,6 +839,11 @@ struct DirOptions {
   // Default: false
   bool skip_checksums;
 
+  // Checksum function used to protect blocks and log chunks. Recorded in the
+  // directory footer so readers use the same function as the writer.
+  // Default: kCsCrc32c
+  ChecksumType checksum_type;
+
   // True if read I/O should be measured.
   // Default: true
   bool measure_reads;
@@ -330,5 +900,17 @@ extern DirOptions ParseDirOptions(const char* conf);
 // Be very careful using this method.
 extern Status DestroyDir(const std::string& dirname, const DirOptions& options);
 
+// Salvage a directory whose writer did not finish, such as a writer killed in
+// the middle of a dump. The index log of each partition is scanned for the
+// epochs sealed before the crash, and damaged index logs are truncated to the
+// last sealed epoch and finished with a new root index and footer. An epoch
+// is discarded if any of its data blocks did not make it to the data log.
+// Options must match those used to write the directory, and options.lg_parts
+// must be set. Epoch log rotation is not supported. The footer copy of the
+// data log is not restored, so a repaired directory must be opened for reads
+// with options.paranoid_checks set to false.
+// Return OK on success, or a non-OK status on errors.
+extern Status RepairDir(const std::string& dirname, const DirOptions& options);
+
 }  // namespace plfsio
 }  // namespace pdlfs
@@ -14,13 +14,24 @@
 #include "../../util/logging.h"
 #include "filter.h"
 #include "internal.h"
+#include "memory.h"
+#include "pmem.h"
 #include "types.h"
 
+#include "pdlfs-common/cache.h"
+#include "pdlfs-common/coding.h"
 #include "pdlfs-common/env_files.h"
 #include "pdlfs-common/hash.h"
+#include "pdlfs-common/lru.h"
 #include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/rate_limiter.h"
 #include "pdlfs-common/strutil.h"
 
+#include <algorithm>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <string>
 #include <vector>
 
@@ -35,12 +46,44 @@ struct DirWriter::Rep {
   bool HasCompaction();
   Status ObtainCompactionStatus();
   Status WaitForCompaction();
+  Status SyncLogs();
   Status MaybeRotateLogs(Epoch*);
   Status TryFlush(Epoch*, bool ef = false, bool fi = false);
-  Status TryAdd(Epoch*, const Slice& fid, const Slice& data);
+  uint32_t LastFlushTicket() const;
+  bool IsFlushDone(uint32_t ticket) const;
+  // Return the partition a given key belongs to. Keys are hashed once per
+  // insertion, before the directory mutex is taken.
+  uint32_t PartitionOf(const Slice& fid) const {
+    return Hash(fid.data(), fid.size(), 0) & part_mask_;
+  }
+  Status TryAdd(Epoch*, uint32_t part, const Slice& fid, const Slice& data);
+  void MaybeRebalanceMemtables(size_t bytes_inserted);
+  void MaybeUpdateMemoryBudget(size_t bytes_inserted, bool force = false);
+  void ResizeMemtables(size_t budget);
+  Status AutoTune();
+  void AddTuningDecision(const char* fmt, ...);
+  Status BeginWrite(int epoch, Epoch** result);
+  void EndWrite(Epoch*);
+  Status Add(uint32_t part, const Slice& fid, const Slice& data, int epoch);
+  Status AddBatch(const Slice* fids, const uint32_t* parts, const Slice* data,
+                  size_t n, int epoch);
+  Status Stage(uint32_t part, const Slice& fid, const Slice& data, int epoch);
+  Status HandOff(std::string* records);
+  Status DrainStagingBuffers();
   Status EnsureDataPadding(LogSink* sink, size_t footer_size);
   Status InstallDirInfo(const std::string& footer);
   Status Finalize();
+  // Return the options and the compaction scheduler for memtable partition i.
+  // Partitions are spread over NUMA nodes when numa_pools is set.
+  const DirOptions& PartitionOptions(size_t i) const {
+    if (node_options_.empty()) return options_;
+    return *node_options_[i % node_options_.size()];
+  }
+  DirCompactionScheduler* PartitionScheduler(size_t i) const {
+    if (node_options_.empty()) return sched_;
+    return node_scheds_[i % node_scheds_.size()];
+  }
+  void TouchBuffers();
 
   const DirOptions options_;
   mutable port::Mutex io_mutex_;  // Protecting the shared data log
@@ -55,8 +98,40 @@ struct DirWriter::Rep {
   bool finished_;  // If Finish() has been called
   WritableFileStats io_stats_;
   const DirOutputStats** compac_stats_;
+  DirSpaceStats data_footer_stats_;  // Data log footer and tail padding
+  DirCompactionScheduler* sched_;  // NULL if there is no compaction pool
+  // Per-NUMA-node copies of options_ that differ only in compaction_pool,
+  // along with their schedulers. Empty unless options_.numa_pools is set.
+  std::vector<DirOptions*> node_options_;
+  std::vector<DirCompactionScheduler*> node_scheds_;
+  // Buffers for staging insertions before they are handed off to the
+  // directory in batches. Each calling thread is mapped to one of the buffers
+  // according to its thread id. NULL if staging is disabled.
+  struct StagingBuffer {
+    port::Mutex mu;
+    std::string records;  // Packed (epoch, fid, data) tuples
+  };
+  enum { kNumStagingBuffers = 16 };
+  StagingBuffer* staging_;
+  // Bytes inserted since memtable memory was last rebalanced and the smoothed
+  // insertion rate of each partition. Only used when adaptive_memtables is set.
+  uint64_t rebalance_bytes_;
+  std::vector<double> insert_rates_;
+  // Id of the directory at options_.memory_manager, bytes inserted since the
+  // directory last reported to the manager, and the directory's current
+  // memtable budget. mm_id_ is -1 if there is no memory manager.
+  int mm_id_;
+  uint64_t mm_bytes_;
+  size_t memtable_budget_;
+  // Time the directory was opened and the decisions made by AutoTune(). Only
+  // used when auto_tune is set.
+  uint64_t open_micros_;
+  bool tuned_;
+  std::vector<std::string> tuning_log_;
   DirIndexer** idxers_;
   LogSink* data_;
+  // Persistent memory holding write buffers. NULL if buffers are in DRAM.
+  PmemBufferFile* pmem_;
   Env* env_;
 };
 
@@ -70,26 +145,117 @@ DirWriter::Rep::Rep(const DirOptions& o, const std::string& d)
       epoch_(NULL),
       finished_(false),
       compac_stats_(NULL),
+      sched_(NULL),
+      staging_(NULL),
+      rebalance_bytes_(0),
+      mm_id_(-1),
+      mm_bytes_(0),
+      memtable_budget_(options_.total_memtable_budget),
+      open_micros_(CurrentMicros()),
+      tuned_(false),
       idxers_(NULL),
       data_(NULL),
+      pmem_(NULL),
       env_(options_.env) {
   epoch_ = new Epoch(0, &mutex_);
   epoch_->Ref();
+  if (options_.compaction_pool != NULL) {
+    sched_ = new DirCompactionScheduler(options_, &mutex_, &bg_cv_);
+  }
+  if (options_.numa_pools != NULL) {
+    for (int i = 0; i < options_.num_numa_nodes; i++) {
+      DirOptions* const o = new DirOptions(options_);
+      if (options_.numa_pools[i] != NULL) {
+        o->compaction_pool = options_.numa_pools[i];
+      }
+      node_options_.push_back(o);
+      node_scheds_.push_back(
+          o->compaction_pool != NULL
+              ? new DirCompactionScheduler(*o, &mutex_, &bg_cv_)
+              : NULL);
+    }
+  }
+  if (options_.staging_buffer != 0) {
+    staging_ = new StagingBuffer[kNumStagingBuffers];
+  }
+}
+
+namespace {
+// State for touching the write buffers of all memtable partitions from the
+// compaction pools of their NUMA nodes.
+struct TouchState {
+  explicit TouchState(size_t n) : cv(&mu), num_pending(n) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  size_t num_pending;
+};
+
+struct TouchJob {
+  TouchState* state;
+  DirIndexer* indexer;
+};
+
+void BGTouch(void* arg) {
+  TouchJob* const job = reinterpret_cast<TouchJob*>(arg);
+  job->indexer->TouchBuffers();
+  TouchState* const state = job->state;
+  delete job;
+  MutexLock ml(&state->mu);
+  assert(state->num_pending != 0);
+  state->num_pending--;
+  state->cv.SignalAll();
+}
+}  // namespace
+
+// Have each partition's write buffers touched by its node's compaction pool,
+// so that their memory is placed on that node. Return once all are done.
+void DirWriter::Rep::TouchBuffers() {
+  if (node_options_.empty()) {
+    return;
+  }
+  TouchState state(num_parts_);
+  for (size_t i = 0; i < num_parts_; i++) {
+    TouchJob* const job = new TouchJob;
+    job->state = &state;
+    job->indexer = idxers_[i];
+    ThreadPool* const pool = PartitionOptions(i).compaction_pool;
+    if (pool != NULL) {
+      pool->Schedule(BGTouch, job);
+    } else {
+      BGTouch(job);
+    }
+  }
+  MutexLock ml(&state.mu);
+  while (state.num_pending != 0) {
+    state.cv.Wait();
+  }
 }
 
 DirWriter::Rep::~Rep() {
   MutexLock l(&mutex_);
+  if (mm_id_ != -1) {
+    options_.memory_manager->Unregister(mm_id_);
+  }
   for (size_t i = 0; i < num_parts_; i++) {
     if (idxers_[i] != NULL) {
       idxers_[i]->Unref();
     }
   }
   if (epoch_ != NULL) epoch_->Unref();
+  delete sched_;
+  for (size_t i = 0; i < node_scheds_.size(); i++) {
+    delete node_scheds_[i];
+  }
+  for (size_t i = 0; i < node_options_.size(); i++) {
+    delete node_options_[i];
+  }
+  delete[] staging_;
   delete[] compac_stats_;
   delete[] idxers_;
   if (data_ != NULL) {
     data_->Unref();
   }
+  delete pmem_;
 }
 
 Status DirWriter::Rep::EnsureDataPadding(LogSink* sink, size_t footer_size) {
@@ -102,6 +268,9 @@ Status DirWriter::Rep::EnsureDataPadding(LogSink* sink, size_t footer_size) {
   if (overflow != 0) {
     const size_t n = options_.data_buffer - overflow;
     status = sink->Lwrite(std::string(n, 0));
+    if (status.ok()) {
+      data_footer_stats_.tail_padding_size += n;
+    }
   } else {
     // No need to pad
   }
@@ -194,6 +363,9 @@ Status DirWriter::Rep::Finalize() {
     data_->Lock();
     status = data_->Lwrite(ftdata);
     data_->Unlock();
+    if (status.ok()) {
+      data_footer_stats_.index_size += ftdata.size();
+    }
   }
 
   if (status.ok()) {
@@ -253,14 +425,266 @@ Status DirWriter::Rep::WaitForCompaction() {
 
 // Insert data into a directory partition. May be blocked due to potential lack
 // of buffer space. Return OK on success, or a non-OK status on errors.
-Status DirWriter::Rep::TryAdd(Epoch* ep, const Slice& fid, const Slice& data) {
+Status DirWriter::Rep::TryAdd(Epoch* ep, uint32_t part, const Slice& fid,
+                              const Slice& data) {
   mutex_.AssertHeld();
   assert(ep->num_ongoing_ops_ != 0);
   Status status;
-  const uint32_t hash = Hash(fid.data(), fid.size(), 0);
-  const uint32_t part = hash & part_mask_;
+  assert(part == PartitionOf(fid));
   assert(part < num_parts_);
   status = idxers_[part]->Add(ep, fid, data);
+  if (status.ok()) {
+    MaybeRebalanceMemtables(fid.size() + data.size());
+    MaybeUpdateMemoryBudget(fid.size() + data.size());
+  }
+  return status;
+}
+
+// Redistribute write buffer memory among partitions in proportion to their
+// smoothed insertion rates once enough data has been inserted since the last
+// rebalance. Each partition keeps at least a quarter of its even share. New
+// shares add up to the old total, but growing partitions use theirs at once
+// while shrinking ones release memory only as their buffers are compacted.
+// REQUIRES: mutex_ has been locked.
+void DirWriter::Rep::MaybeRebalanceMemtables(size_t bytes_inserted) {
+  mutex_.AssertHeld();
+  if (!options_.adaptive_memtables || num_parts_ < 2) {
+    return;
+  }
+  rebalance_bytes_ += bytes_inserted;
+  if (rebalance_bytes_ < options_.total_memtable_budget) {
+    return;
+  }
+  rebalance_bytes_ = 0;
+  insert_rates_.resize(num_parts_, 0);
+  size_t total_memory = 0;
+  double total_rate = 0;
+  for (size_t i = 0; i < num_parts_; i++) {
+    const double bytes = static_cast<double>(idxers_[i]->TakeInsertedBytes());
+    insert_rates_[i] = 0.5 * insert_rates_[i] + 0.5 * bytes;
+    total_rate += insert_rates_[i];
+    total_memory += idxers_[i]->buffer_memory();
+  }
+  if (total_rate == 0) {
+    return;
+  }
+  const size_t min_memory = total_memory / num_parts_ / 4;
+  const double shared_memory =
+      static_cast<double>(total_memory - min_memory * num_parts_);
+  for (size_t i = 0; i < num_parts_; i++) {
+    const double share = shared_memory * insert_rates_[i] / total_rate;
+    idxers_[i]->ResizeBuffers(min_memory + static_cast<size_t>(share));
+  }
+}
+
+// Report bytes inserted to the memory manager once a quarter of the current
+// memtable budget has been inserted, or immediately if "force" is true, and
+// resize memtables if the manager has changed the directory's budget by more
+// than 1/16. Shrunk budgets take effect as buffers become empty so memory may
+// exceed the new budget until the next compactions complete.
+// REQUIRES: mutex_ has been locked.
+void DirWriter::Rep::MaybeUpdateMemoryBudget(size_t bytes_inserted,
+                                             bool force) {
+  mutex_.AssertHeld();
+  if (mm_id_ == -1) {
+    return;
+  }
+  mm_bytes_ += bytes_inserted;
+  if (!force && mm_bytes_ < memtable_budget_ / 4) {
+    return;
+  }
+  size_t budget = options_.memory_manager->Report(mm_id_, mm_bytes_);
+  mm_bytes_ = 0;
+  // Same range as enforced by SanitizeWriteOptions()
+  budget = std::min<size_t>(std::max<size_t>(budget, 1 << 20), 1 << 30);
+  const size_t diff = budget > memtable_budget_ ? budget - memtable_budget_
+                                                : memtable_budget_ - budget;
+  if (diff > memtable_budget_ / 16) {
+    ResizeMemtables(budget);
+  }
+}
+
+// Set the total write buffer memory of all partitions to match a new memtable
+// budget. Memory is split among partitions as before so that rebalancing done
+// by adaptive_memtables is preserved.
+// REQUIRES: mutex_ has been locked.
+void DirWriter::Rep::ResizeMemtables(size_t budget) {
+  mutex_.AssertHeld();
+  const size_t reserved = options_.block_batch_size * num_parts_;
+  if (budget <= reserved) {
+    return;
+  }
+  size_t total_memory = 0;
+  for (size_t i = 0; i < num_parts_; i++) {
+    total_memory += idxers_[i]->buffer_memory();
+  }
+  if (total_memory == 0) {
+    return;
+  }
+  const double ratio = static_cast<double>(budget - reserved) / total_memory;
+  for (size_t i = 0; i < num_parts_; i++) {
+    const double memory = ratio * idxers_[i]->buffer_memory();
+    idxers_[i]->ResizeBuffers(static_cast<size_t>(memory));
+  }
+  memtable_budget_ = budget;
+}
+
+// Log a tuning decision and keep it for DirWriter::GetTuningLog().
+// REQUIRES: mutex_ has been locked.
+void DirWriter::Rep::AddTuningDecision(const char* fmt, ...) {
+  mutex_.AssertHeld();
+  char tmp[200];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(tmp, sizeof(tmp), fmt, ap);
+  va_end(ap);
+  Info(__LOG_ARGS__, "%s", tmp);
+  tuning_log_.push_back(tmp);
+}
+
+namespace {
+// Minimum number of entries packed per data block before auto tuning enlarges
+// data blocks. Fewer entries make the index large relative to the data.
+const size_t kTuneMinEntriesPerBlock = 64;
+// Approximate write buffer space taken by each entry besides its key and value
+const size_t kTuneEntryOverhead = 16;
+// Fraction of time writers may spend stalled before auto tuning recommends
+// more memtable partitions
+const double kTuneMaxStallRatio = 0.1;
+}  // namespace
+
+// Tune the directory to the workload observed during epoch 0. Data block size
+// and memtable utilization are changed for all later epochs. Options that are
+// fixed once the directory is open are recommended for the next run instead.
+// Invoked by the first epoch flush once the epoch has been scheduled for
+// compaction. Waits for all compactions so the epoch is fully accounted for.
+// REQUIRES: mutex_ has been locked and no writes are on-going.
+Status DirWriter::Rep::AutoTune() {
+  mutex_.AssertHeld();
+  tuned_ = true;
+  Status status = WaitForCompaction();
+  if (!status.ok()) {
+    return status;
+  }
+  uint64_t num_keys = 0;
+  uint64_t key_bytes = 0;
+  uint64_t value_bytes = 0;
+  uint64_t compacted_bytes = 0;
+  uint64_t compaction_micros = 0;
+  uint64_t stall_micros = 0;
+  size_t buffer_memory = 0;
+  for (size_t i = 0; i < num_parts_; i++) {
+    num_keys += compac_stats_[i]->total_num_keys_;
+    key_bytes += compac_stats_[i]->key_size;
+    value_bytes += compac_stats_[i]->value_size;
+    compacted_bytes += idxers_[i]->compacted_bytes();
+    compaction_micros += idxers_[i]->compaction_micros();
+    stall_micros += idxers_[i]->stall_micros();
+    buffer_memory += idxers_[i]->buffer_memory();
+  }
+  if (num_keys == 0) {
+    return status;  // Nothing to learn from
+  }
+  const uint64_t now = CurrentMicros();
+  const double elapsed = static_cast<double>(
+      now > open_micros_ ? now - open_micros_ : 1);  // In micros
+  const double key_size = double(key_bytes) / num_keys;
+  const double value_size = double(value_bytes) / num_keys;
+  const double entry_size = key_size + value_size;
+  const double stall_ratio = stall_micros / elapsed / num_parts_;
+  // Bytes per microsecond equals MB per second
+  AddTuningDecision(
+      "Dfs.plfsdir.auto_tune: epoch 0 has %llu keys (%.1f + %.1f bytes), "
+      "inserted at %.2f MB/s, compacted at %.2f MB/s per partition, "
+      "%.1f%% stalled",
+      static_cast<unsigned long long>(num_keys), key_size, value_size,
+      (key_bytes + value_bytes) / elapsed,
+      compaction_micros != 0 ? double(compacted_bytes) / compaction_micros
+                             : 0.0,
+      100 * stall_ratio);
+
+  // Enlarge data blocks until each holds enough entries of the observed size
+  size_t block_size = 0;
+  size_t target_block_size = options_.block_size;
+  if (!IsKeyUnOrdered(options_.mode)) {
+    while (target_block_size < kTuneMinEntriesPerBlock * entry_size &&
+           target_block_size < (1 << 20)) {
+      target_block_size *= 2;
+    }
+  }
+  if (target_block_size != options_.block_size) {
+    if (!options_.block_padding) {
+      block_size = target_block_size;
+      AddTuningDecision("Dfs.plfsdir.block_size -> %s (was %s)",
+                        PrettySize(block_size).c_str(),
+                        PrettySize(options_.block_size).c_str());
+    } else {
+      AddTuningDecision(
+          "Dfs.plfsdir.block_size: %s recommended for the next run (now %s, "
+          "fixed by block padding)",
+          PrettySize(target_block_size).c_str(),
+          PrettySize(options_.block_size).c_str());
+    }
+  }
+  if (options_.block_batch_size != 0 &&
+      options_.block_batch_size < 4 * target_block_size) {
+    AddTuningDecision(
+        "Dfs.plfsdir.block_batch_size: %s recommended for the next run "
+        "(now %s)",
+        PrettySize(4 * target_block_size).c_str(),
+        PrettySize(options_.block_batch_size).c_str());
+  }
+
+  // Leave room in each write buffer for a few more entries of the observed
+  // size so buffers rarely outgrow the memory reserved for them
+  const double buffer_size = double(buffer_memory) / num_parts_ /
+                             static_cast<size_t>(options_.num_memtables);
+  double memtable_util =
+      1.0 - 4 * (entry_size + kTuneEntryOverhead) / buffer_size;
+  memtable_util = std::min(std::max(memtable_util, 0.5), 0.99);
+  if (fabs(memtable_util - options_.memtable_util) >= 0.005) {
+    AddTuningDecision("Dfs.plfsdir.memtable_util -> %.2f%% (was %.2f%%)",
+                      100 * memtable_util, 100 * options_.memtable_util);
+  } else {
+    memtable_util = options_.memtable_util;
+  }
+  for (size_t i = 0; i < num_parts_; i++) {
+    idxers_[i]->Retune(block_size, memtable_util);
+  }
+
+  // Filters are sized from the configured key and value sizes
+  if (!options_.fixed_kv_length) {
+    const size_t k = static_cast<size_t>(key_size + 0.5);
+    const size_t v = static_cast<size_t>(value_size + 0.5);
+    if (k * 4 < options_.key_size * 3 || k * 4 > options_.key_size * 5) {
+      AddTuningDecision(
+          "Dfs.plfsdir.key_size: %d recommended for the next run (now %d)",
+          static_cast<int>(k), static_cast<int>(options_.key_size));
+    }
+    if (v * 4 < options_.value_size * 3 || v * 4 > options_.value_size * 5) {
+      AddTuningDecision(
+          "Dfs.plfsdir.value_size: %d recommended for the next run (now %d)",
+          static_cast<int>(v), static_cast<int>(options_.value_size));
+    }
+  }
+
+  // Writers stalled on full buffers means compaction cannot keep up with
+  // insertion. More partitions compact in parallel on the compaction pool,
+  // and a larger data buffer absorbs slow log writes.
+  if (stall_ratio > kTuneMaxStallRatio) {
+    if (options_.compaction_pool != NULL && options_.lg_parts < 8) {
+      AddTuningDecision(
+          "Dfs.plfsdir.lg_parts: %d recommended for the next run (now %d)",
+          options_.lg_parts + 1, options_.lg_parts);
+    }
+    const size_t data_buffer = 2 * options_.block_batch_size * num_parts_;
+    if (options_.data_buffer != 0 && options_.data_buffer < data_buffer) {
+      AddTuningDecision(
+          "Dfs.plfsdir.data_buffer: %s recommended for the next run (now %s)",
+          PrettySize(data_buffer).c_str(),
+          PrettySize(options_.data_buffer).c_str());
+    }
+  }
   return status;
 }
 
@@ -323,6 +747,8 @@ Status DirWriter::Rep::TryFlush(Epoch* ep, bool ef, bool fi) {
 Status DirWriter::Finish() {
   Status status;
   Rep* const r = rep_;
+  status = r->DrainStagingBuffers();
+  if (!status.ok()) return status;
   MutexLock ml(&r->mutex_);
   while (true) {
     if (r->finished_) {
@@ -358,9 +784,13 @@ Status DirWriter::Finish() {
 // pending minor compaction currently waiting to be scheduled, wait until it is
 // scheduled (but not necessarily completed) before validating and submitting
 // this one. Return OK on success, or a non-OK status on errors.
-Status DirWriter::EpochFlush(int epoch) {
+Status DirWriter::EpochFlush(int epoch) { return EpochFlush(epoch, NULL); }
+
+Status DirWriter::EpochFlush(int epoch, uint32_t* ticket) {
   Status status;
   Rep* const r = rep_;
+  status = r->DrainStagingBuffers();
+  if (!status.ok()) return status;
   MutexLock ml(&r->mutex_);
   while (true) {
     if (r->finished_) {
@@ -383,6 +813,10 @@ Status DirWriter::EpochFlush(int epoch) {
         cur->cv_.Wait();
       }
       status = r->TryFlush(cur, true /*epoch flush*/);
+      if (status.ok() && ticket != NULL) *ticket = r->LastFlushTicket();
+      if (status.ok()) r->MaybeUpdateMemoryBudget(0, true /*force*/);
+      if (status.ok() && r->options_.auto_tune && !r->tuned_)
+        status = r->AutoTune();  // May temporarily unlock
       if (status.ok())
         status = r->MaybeRotateLogs(cur);  // May temporarily unlock
       Epoch* const nxt = new Epoch(1 + cur->seq_, &r->mutex_);
@@ -397,6 +831,56 @@ Status DirWriter::EpochFlush(int epoch) {
   return status;
 }
 
+// Return the ticket of the latest forced compaction. All partitions are
+// flushed together so they share the same flush counts.
+// REQUIRES: mutex_ has been locked.
+uint32_t DirWriter::Rep::LastFlushTicket() const {
+  mutex_.AssertHeld();
+  uint32_t result = 0;
+  for (size_t i = 0; i < num_parts_; i++) {
+    result = std::max(result, idxers_[i]->num_flush_requested());
+  }
+  return result;
+}
+
+// Return true iff all forced compactions up to ticket have finished.
+// REQUIRES: mutex_ has been locked.
+bool DirWriter::Rep::IsFlushDone(uint32_t ticket) const {
+  mutex_.AssertHeld();
+  for (size_t i = 0; i < num_parts_; i++) {
+    if (idxers_[i]->num_flush_completed() < ticket) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Status DirWriter::PollFlush(uint32_t ticket, bool* done) {
+  Rep* const r = rep_;
+  MutexLock ml(&r->mutex_);
+  if (r->finished_) {
+    *done = true;
+    return r->finish_status_;
+  }
+  *done = r->IsFlushDone(ticket);
+  return r->ObtainCompactionStatus();
+}
+
+Status DirWriter::WaitForFlush(uint32_t ticket) {
+  Status status;
+  Rep* const r = rep_;
+  MutexLock ml(&r->mutex_);
+  while (!r->finished_) {
+    status = r->ObtainCompactionStatus();
+    if (status.ok() && !r->IsFlushDone(ticket)) {
+      r->bg_cv_.Wait();
+    } else {
+      return status;
+    }
+  }
+  return r->finish_status_;
+}
+
 // Force a minor compaction but return immediately without waiting for it
 // to complete. If there happens to be another pending minor compaction
 // currently waiting to be scheduled, wait until it is scheduled (but not
@@ -405,6 +889,8 @@ Status DirWriter::EpochFlush(int epoch) {
 Status DirWriter::Flush(int epoch) {
   Status status;
   Rep* const r = rep_;
+  status = r->DrainStagingBuffers();
+  if (!status.ok()) return status;
   MutexLock ml(&r->mutex_);
   while (true) {
     if (r->finished_) {
@@ -435,19 +921,21 @@ Status DirWriter::Flush(int epoch) {
   return status;
 }
 
-Status DirWriter::Add(const Slice& fid, const Slice& data, int epoch) {
+// Validate the epoch number and register a new write operation against the
+// current epoch. Blocks if the current epoch is being flushed and no epoch
+// number is specified. Return OK on success, or a non-OK status on errors.
+Status DirWriter::Rep::BeginWrite(int epoch, Epoch** result) {
+  mutex_.AssertHeld();
   Status status;
-  Rep* const r = rep_;
-  MutexLock ml(&r->mutex_);
   while (true) {
-    if (r->finished_) {
+    if (finished_) {
       status = Status::AssertionFailed("Plfsdir already finished");
       break;
     }
-    Epoch* const cur = r->epoch_;
+    Epoch* const cur = epoch_;
     assert(cur != NULL);
     if (epoch == -1 && cur->committing_) {
-      r->cv_.Wait();
+      cv_.Wait();
     } else if (epoch != -1 && epoch != int(cur->seq_)) {
       status = Status::AssertionFailed("Bad epoch num");
       break;
@@ -456,15 +944,169 @@ Status DirWriter::Add(const Slice& fid, const Slice& data, int epoch) {
       break;
     } else {
       cur->num_ongoing_ops_++;
-      status = r->TryAdd(cur, fid, data);
-      assert(cur->num_ongoing_ops_ != 0);
-      cur->num_ongoing_ops_--;
-      if (cur->committing_ && cur->num_ongoing_ops_ == 0) {
-        cur->cv_.SignalAll();
-      }
+      *result = cur;
+      break;
+    }
+  }
+  return status;
+}
+
+void DirWriter::Rep::EndWrite(Epoch* cur) {
+  mutex_.AssertHeld();
+  assert(cur->num_ongoing_ops_ != 0);
+  cur->num_ongoing_ops_--;
+  if (cur->committing_ && cur->num_ongoing_ops_ == 0) {
+    cur->cv_.SignalAll();
+  }
+}
+
+// Insert data into the directory after validating the epoch number.
+// Return OK on success, or a non-OK status on errors.
+Status DirWriter::Rep::Add(uint32_t part, const Slice& fid, const Slice& data,
+                           int epoch) {
+  mutex_.AssertHeld();
+  Epoch* cur;
+  Status status = BeginWrite(epoch, &cur);
+  if (status.ok()) {
+    status = TryAdd(cur, part, fid, data);
+    EndWrite(cur);
+  }
+  return status;
+}
+
+// Insert a batch of data into the directory using a single epoch validation.
+// Data is first grouped by partition so that each partition is visited once.
+// Data going to the same partition is inserted in its original order.
+// Processing stops at the first error. parts[i] is the partition of fids[i].
+Status DirWriter::Rep::AddBatch(const Slice* fids, const uint32_t* parts,
+                                const Slice* data, size_t n, int epoch) {
+  mutex_.AssertHeld();
+  Epoch* cur;
+  Status status = BeginWrite(epoch, &cur);
+  if (!status.ok()) {
+    return status;
+  }
+  std::vector<size_t> starts(num_parts_ + 1, 0);
+  for (size_t i = 0; i < n; i++) {
+    assert(parts[i] < num_parts_);
+    starts[parts[i] + 1]++;
+  }
+  for (size_t p = 1; p <= num_parts_; p++) {
+    starts[p] += starts[p - 1];
+  }
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) {
+    order[starts[parts[i]]++] = i;
+  }
+  for (size_t i = 0; i < n; i++) {
+    const size_t j = order[i];
+    status = TryAdd(cur, parts[j], fids[j], data[j]);
+    if (!status.ok()) {
+      break;
+    }
+  }
+  EndWrite(cur);
+  return status;
+}
+
+// Insert all records staged in a staging buffer into the directory.
+// Processing stops at the first error.
+// REQUIRES: mutex_ has NOT been locked.
+Status DirWriter::Rep::HandOff(std::string* records) {
+  Status status;
+  Slice input = *records;
+  Slice fid;
+  Slice data;
+  uint32_t epoch;
+  uint32_t part;
+  MutexLock ml(&mutex_);
+  while (!input.empty()) {
+    if (!GetVarint32(&input, &epoch) || !GetVarint32(&input, &part) ||
+        !GetLengthPrefixedSlice(&input, &fid) ||
+        !GetLengthPrefixedSlice(&input, &data)) {
+      status = Status::Corruption("Bad staging buffer contents");
+      break;
+    }
+    status = Add(part, fid, data, int(epoch) - 1);
+    if (!status.ok()) {
       break;
     }
   }
+  records->clear();
+  return status;
+}
+
+// Append data to the staging buffer of the calling thread. The buffer is
+// handed off to the directory once it is full. Errors, including epoch errors,
+// are reported when staged data is handed off, and may therefore be reported
+// by a later call. Return OK on success, or a non-OK status on errors.
+Status DirWriter::Rep::Stage(uint32_t part, const Slice& fid, const Slice& data,
+                             int epoch) {
+  const pthread_t tid = pthread_self();
+  const uint32_t hash =
+      Hash(reinterpret_cast<const char*>(&tid), sizeof(tid), 0);
+  StagingBuffer* const buf = &staging_[hash % kNumStagingBuffers];
+  Status status;
+  MutexLock ml(&buf->mu);
+  PutVarint32(&buf->records, static_cast<uint32_t>(epoch + 1));
+  PutVarint32(&buf->records, part);
+  PutLengthPrefixedSlice(&buf->records, fid);
+  PutLengthPrefixedSlice(&buf->records, data);
+  if (buf->records.size() >= options_.staging_buffer) {
+    status = HandOff(&buf->records);
+  }
+  return status;
+}
+
+// Hand off all staged data to the directory.
+// REQUIRES: mutex_ has NOT been locked.
+Status DirWriter::Rep::DrainStagingBuffers() {
+  Status status;
+  if (staging_ == NULL) return status;
+  for (int i = 0; i < kNumStagingBuffers; i++) {
+    MutexLock ml(&staging_[i].mu);
+    if (!staging_[i].records.empty()) {
+      Status s = HandOff(&staging_[i].records);
+      if (status.ok()) {
+        status = s;
+      }
+    }
+  }
+  return status;
+}
+
+Status DirWriter::Add(const Slice& fid, const Slice& data, int epoch) {
+  Rep* const r = rep_;
+  DirLatencyStats* const lat = r->options_.latency_stats;
+  const uint64_t start = lat != NULL ? CurrentMicros() : 0;
+  const uint32_t part = r->PartitionOf(fid);
+  Status s;
+  if (r->staging_ != NULL) {
+    s = r->Stage(part, fid, data, epoch);
+  } else {
+    MutexLock ml(&r->mutex_);
+    s = r->Add(part, fid, data, epoch);
+  }
+  if (lat != NULL) {
+    lat->put.Add(CurrentMicros() - start);
+  }
+  return s;
+}
+
+Status DirWriter::AddBatch(const Slice* fids, const Slice* data, size_t n,
+                           int epoch) {
+  Rep* const r = rep_;
+  // Staged data goes first
+  Status status = r->DrainStagingBuffers();
+  if (status.ok()) {
+    std::vector<uint32_t> parts(n);
+    for (size_t i = 0; i < n; i++) {
+      parts[i] = r->PartitionOf(fids[i]);
+    }
+    MutexLock ml(&r->mutex_);
+    status = r->AddBatch(fids, parts.empty() ? NULL : &parts[0], data, n,
+                         epoch);
+  }
   return status;
 }
 
@@ -473,6 +1115,8 @@ Status DirWriter::Add(const Slice& fid, const Slice& data, int epoch) {
 Status DirWriter::Wait() {
   Status status;
   Rep* const r = rep_;
+  status = r->DrainStagingBuffers();
+  if (!status.ok()) return status;
   MutexLock ml(&r->mutex_);
   if (!r->finished_) return r->WaitForCompaction();
   return r->finish_status_;
@@ -483,17 +1127,27 @@ Status DirWriter::Wait() {
 Status DirWriter::Sync() {
   Status status;
   Rep* const r = rep_;
+  status = r->DrainStagingBuffers();
+  if (!status.ok()) return status;
   MutexLock ml(&r->mutex_);
   if (r->finished_) return r->finish_status_;
   status = r->WaitForCompaction();
   if (!status.ok()) return status;
-  LogSink* const sink = r->data_;
+  return r->SyncLogs();
+}
+
+// Sync the data log and all index logs.
+// REQUIRES: mutex_ has been locked.
+Status DirWriter::Rep::SyncLogs() {
+  mutex_.AssertHeld();
+  Status status;
+  LogSink* const sink = data_;
   sink->Lock();
   status = sink->Lsync();
   sink->Unlock();
   if (status.ok()) {
-    for (uint32_t part = 0; part < r->num_parts_; part++) {
-      status = r->idxers_[part]->indx_->Lsync();
+    for (uint32_t part = 0; part < num_parts_; part++) {
+      status = idxers_[part]->indx_->Lsync();
       if (!status.ok()) {
         break;
       }
@@ -587,6 +1241,84 @@ uint64_t DirWriter::TEST_total_memory_usage() const {
   return result;
 }
 
+uint64_t DirWriter::TEST_memtable_budget() const {
+  Rep* const r = rep_;
+  MutexLock ml(&r->mutex_);
+  return r->memtable_budget_;
+}
+
+uint64_t DirWriter::TEST_hugepage_memory_usage() const {
+  Rep* const r = rep_;
+  MutexLock ml(&r->mutex_);
+  uint64_t result = 0;
+  for (size_t i = 0; i < r->num_parts_; i++)
+    result += r->idxers_[i]->hugepage_memory_usage();
+  return result;
+}
+
+uint64_t DirWriter::TEST_write_stall_micros() const {
+  Rep* const r = rep_;
+  MutexLock ml(&r->mutex_);
+  uint64_t result = 0;
+  for (size_t i = 0; i < r->num_parts_; i++) {
+    result += r->idxers_[i]->stall_micros();
+  }
+  return result;
+}
+
+uint64_t DirWriter::TEST_spilled_bytes() const {
+  Rep* const r = rep_;
+  MutexLock ml(&r->mutex_);
+  uint64_t result = 0;
+  for (size_t i = 0; i < r->num_parts_; i++) {
+    result += r->idxers_[i]->spilled_bytes();
+  }
+  return result;
+}
+
+uint64_t DirWriter::TEST_spill_merge_micros() const {
+  Rep* const r = rep_;
+  MutexLock ml(&r->mutex_);
+  uint64_t result = 0;
+  for (size_t i = 0; i < r->num_parts_; i++) {
+    result += r->idxers_[i]->spill_merge_micros();
+  }
+  return result;
+}
+
+DirWritePressure DirWriter::GetWritePressure() const {
+  Rep* const r = rep_;
+  MutexLock ml(&r->mutex_);
+  DirWritePressure result;
+  for (size_t i = 0; i < r->num_parts_; i++) {
+    r->idxers_[i]->AddWritePressure(&result);
+  }
+  return result;
+}
+
+void DirWriter::GetTuningLog(std::vector<std::string>* decisions) const {
+  Rep* const r = rep_;
+  MutexLock ml(&r->mutex_);
+  *decisions = r->tuning_log_;
+}
+
+Status DirWriter::GetSpaceReport(DirSpaceReport* report) const {
+  Rep* const r = rep_;
+  MutexLock ml(&r->mutex_);
+  report->epochs.clear();
+  report->epochs.resize(r->num_parts_);
+  report->total = r->data_footer_stats_;
+  for (size_t i = 0; i < r->num_parts_; i++) {
+    const DirOutputStats* const os = r->compac_stats_[i];
+    report->epochs[i] = os->epochs;
+    for (size_t j = 0; j < os->epochs.size(); j++) {
+      report->total.Add(os->epochs[j]);
+    }
+    report->total.Add(os->others);
+  }
+  return r->finish_status_;
+}
+
 uint64_t DirWriter::TEST_raw_index_contents() const {
   Rep* const r = rep_;
   MutexLock ml(&r->mutex_);
@@ -655,6 +1387,8 @@ static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
 static DirOptions SanitizeWriteOptions(const DirOptions& options) {
   DirOptions result = options;
   ClipToRange(&result.total_memtable_budget, 1 << 20, 1 << 30);
+  ClipToRange(&result.num_memtables, 2, 16);
+  ClipToRange(&result.max_pending_writes, 1, 64);
   ClipToRange(&result.memtable_util, 0.5, 1.0);
   ClipToRange(&result.block_size, 1 << 10, 1 << 20);
   ClipToRange(&result.block_util, 0.5, 1.0);
@@ -668,6 +1402,12 @@ static DirOptions SanitizeWriteOptions(const DirOptions& options) {
   if (result.env == NULL) {
     result.env = Env::Default();
   }
+  if (result.env != Env::Default() || result.osd != NULL) {
+    result.direct_io = false;  // Requires direct access to local files
+  }
+  if (result.filter == kFtNoFilter || IsKeyUnOrdered(result.mode)) {
+    result.filter_partition_keys = 0;  // Partitions require sorted keys
+  }
   return result;
 }
 
@@ -706,6 +1446,10 @@ std::string BitmapFilterOptions(const DirOptions& options) {
       snprintf(tmp, sizeof(tmp), "BMP (p-f-delta, key_bits=%d)",
                int(options.bm_key_bits));
       return tmp;
+    case kFmtAuto:
+      snprintf(tmp, sizeof(tmp), "BMP (auto, key_bits=%d)",
+               int(options.bm_key_bits));
+      return tmp;
     default:
       snprintf(tmp, sizeof(tmp), "BMP (others)");
       return tmp;
@@ -722,6 +1466,15 @@ std::string FilterOptions(const DirOptions& options) {
       snprintf(tmp, sizeof(tmp), "BF (bits_per_key=%d)",
                int(options.bf_bits_per_key));
       return tmp;
+    case kFtBlockedBloomFilter:
+      snprintf(tmp, sizeof(tmp), "BBF (bits_per_key=%d)",
+               int(options.bf_bits_per_key));
+      return tmp;
+    case kFtXorFilter:
+      return "XF (fingerprint_bits=8)";
+    case kFtGcsFilter:
+      snprintf(tmp, sizeof(tmp), "GCS (fp_bits=%d)", int(options.gcs_fp_bits));
+      return tmp;
     case kFtNoFilter:
       return "Dis";
     default:
@@ -755,12 +1508,20 @@ Status DirWriter::TryOpen(Rep* rep) {
   io_opts.mu = &rep->io_mutex_;
   io_opts.min_buf = options->min_data_buffer;
   io_opts.max_buf = options->data_buffer;
+  io_opts.io_pool = options->io_pool;
+  io_opts.max_pending_writes = options->max_pending_writes;
+  io_opts.rate_limiter = options->rate_limiter;
+  io_opts.direct_io = options->direct_io;
+  io_opts.tracer = options->tracer;
+  io_opts.osd = options->osd;
+  io_opts.part_size = options->log_part_size;
   io_opts.env = env;
   status = LogSink::Open(io_opts, rep->dirname_, &data[0]);
   if (status.ok()) {
     for (size_t i = 0; i < num_parts; i++) {
       diridxers[i] =
-          new DirIndexer(rep->options_, i, &rep->mutex_, &rep->bg_cv_);
+          new DirIndexer(rep->PartitionOptions(i), i, &rep->mutex_,
+                         &rep->bg_cv_, rep->PartitionScheduler(i));
       LogSink::LogOptions idx_opts;
       idx_opts.rank = my_rank;
       idx_opts.sub_partition = static_cast<int>(i);
@@ -769,6 +1530,13 @@ Status DirWriter::TryOpen(Rep* rep) {
       idx_opts.mu = NULL;
       idx_opts.min_buf = options->min_index_buffer;
       idx_opts.max_buf = options->index_buffer;
+      idx_opts.io_pool = options->io_pool;
+      idx_opts.max_pending_writes = options->max_pending_writes;
+      idx_opts.rate_limiter = options->rate_limiter;
+      idx_opts.direct_io = options->direct_io;
+      idx_opts.tracer = options->tracer;
+      idx_opts.osd = options->osd;
+      idx_opts.part_size = options->log_part_size;
       idx_opts.env = env;
       status = LogSink::Open(idx_opts, rep->dirname_, &index[i]);
       diridxers[i]->Ref();
@@ -782,6 +1550,21 @@ Status DirWriter::TryOpen(Rep* rep) {
     }
   }
 
+  if (status.ok() && options->pmem_buffer_file != NULL &&
+      !options->direct_writes) {
+    const size_t bufs_per_part = static_cast<size_t>(options->num_memtables);
+    size_t slot_size = 0;
+    for (size_t i = 0; i < num_parts; i++) {
+      slot_size = std::max(slot_size, diridxers[i]->estimated_sstable_size());
+    }
+    status = PmemBufferFile::Open(options->pmem_buffer_file,
+                                  num_parts * bufs_per_part, slot_size,
+                                  &rep->pmem_);
+    for (size_t i = 0; status.ok() && i < num_parts; i++) {
+      diridxers[i]->AttachPmem(rep->pmem_, i * bufs_per_part);
+    }
+  }
+
   if (status.ok()) {
     const DirOutputStats** compac_stats = new const DirOutputStats*[num_parts];
     DirIndexer** idxers = new DirIndexer*[num_parts];
@@ -797,6 +1580,7 @@ Status DirWriter::TryOpen(Rep* rep) {
     rep->part_mask_ = num_parts - 1;
     rep->num_parts_ = num_parts;
     rep->idxers_ = idxers;
+    rep->TouchBuffers();
   }
 
   for (size_t i = 0; i < num_parts; i++) {
@@ -812,33 +1596,116 @@ Status DirWriter::TryOpen(Rep* rep) {
   return status;
 }
 
+#if VERBOSE >= 2
+// Return the name of the compression type for printing.
+static const char* CompressionName(CompressionType type) {
+  switch (type) {
+    case kSnappyCompression:
+      return "Snappy";
+    case kZstdCompression:
+      return "Zstd";
+    case kLz4Compression:
+      return "LZ4";
+    default:
+      return "None";
+  }
+}
+#endif
+
 Status DirWriter::Open(const DirOptions& _opts, const std::string& dirname,
                        DirWriter** result) {
   *result = NULL;
-  DirOptions options = SanitizeWriteOptions(_opts);
+  DirOptions tmp = _opts;
+  int mm_id = -1;
+  if (tmp.memory_manager != NULL) {
+    mm_id = tmp.memory_manager->Register(&tmp.total_memtable_budget);
+  }
+  DirOptions options = SanitizeWriteOptions(tmp);
 #if VERBOSE >= 2
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.name -> %s (mode=write)",
           dirname.c_str());
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.memtable_budget -> %s",
           PrettySize(options.total_memtable_budget).c_str());
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.num_memtables -> %d",
+          options.num_memtables);
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.memtable_util -> %.2f%%",
           100 * options.memtable_util);
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.memtable_reserv -> %.2f%%",
           100 * options.memtable_reserv);
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.hugepage_buffers -> %s",
+          int(options.hugepage_buffers) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.pmem_buffer_file -> %s",
+          options.pmem_buffer_file != NULL ? options.pmem_buffer_file : "OFF");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.spill_dir -> %s",
+          options.spill_dir != NULL ? options.spill_dir : "OFF");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.spill_budget -> %s",
+          options.spill_budget != 0 ? PrettySize(options.spill_budget).c_str()
+                                    : "Unlimited");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.epoch_merge -> %s",
+          int(options.epoch_merge) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.adaptive_memtables -> %s",
+          int(options.adaptive_memtables) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.auto_tune -> %s",
+          int(options.auto_tune) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.staging_buffer -> %s",
+          PrettySize(options.staging_buffer).c_str());
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.leveldb_compatible -> %s",
           int(options.leveldb_compatible) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.skip_sort -> %s",
           int(options.skip_sort) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.direct_writes -> %s",
+          int(options.direct_writes) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.max_compaction_jobs -> %d",
+          options.max_compaction_jobs);
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.direct_io -> %s",
+          int(options.direct_io) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.max_pending_writes -> %d (async=%s)",
+          options.max_pending_writes, options.io_pool != NULL ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.osd -> %s",
+          options.osd != NULL ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.log_part_size -> %s",
+          PrettySize(options.log_part_size).c_str());
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.memory_manager -> %s",
+          options.memory_manager != NULL
+              ? PrettySize(options.memory_manager->total_budget()).c_str()
+              : "OFF");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.rate_limit -> %s",
+          options.rate_limiter != NULL
+              ? PrettySize(options.rate_limiter->GetBytesPerSecond()).c_str()
+              : "OFF");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.pipelined_compactions -> %s",
+          int(options.pipelined_compactions) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.parallel_sorts -> %s",
+          int(options.parallel_sorts) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.fixed_kv_length -> %s",
           int(options.fixed_kv_length) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.ect_index -> %s",
+          int(options.ect_index) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.key_index -> %s",
+          int(options.key_index) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.key_epoch_index -> %s",
+          int(options.key_epoch_index) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.table_key_samples -> %d",
+          int(options.table_key_samples));
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.compact_table_handles -> %s",
+          int(options.compact_table_handles) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.key_size -> %s",
           PrettySize(options.key_size).c_str());
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.value_size -> %s",
           PrettySize(options.value_size).c_str());
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.value_column_width -> %d (%s)",
+          int(options.value_column_width),
+          options.column_encoding == kCeXor
+              ? "xor"
+              : (options.column_encoding == kCeDelta ? "delta" : "none"));
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.filter -> %s",
           FilterOptions(options).c_str());
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.filter_bits_per_key -> %d",
           int(options.filter_bits_per_key));
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.filter_partition_keys -> %d",
+          int(options.filter_partition_keys));
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.bf_optimal_bits -> %s",
+          int(options.bf_optimal_bits) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.block_size -> %s",
           PrettySize(options.block_size).c_str());
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.block_util -> %.2f%%",
@@ -861,14 +1728,20 @@ Status DirWriter::Open(const DirOptions& _opts, const std::string& dirname,
           options.compaction_pool != NULL
               ? options.compaction_pool->ToDebugString().c_str()
               : "None");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.num_numa_nodes -> %d",
+          options.num_numa_nodes);
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.compression -> %s",
-          options.compression == kSnappyCompression ? "Snappy" : "None");
+          CompressionName(options.compression));
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.index_compression -> %s",
-          options.index_compression == kSnappyCompression ? "Snappy" : "None");
+          CompressionName(options.index_compression));
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.force_compression -> %s",
           int(options.force_compression) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.parallel_compression -> %s",
+          int(options.parallel_compression) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.skip_checksums -> %s",
           int(options.skip_checksums) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.checksum_type -> %s",
+          ChecksumName(options.checksum_type).c_str());
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.measure_writes -> %s",
           int(options.measure_writes) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.epoch_log_rotation -> %s",
@@ -885,6 +1758,7 @@ Status DirWriter::Open(const DirOptions& _opts, const std::string& dirname,
 #endif
 
   Rep* rep = new Rep(options, dirname);
+  rep->mm_id_ = mm_id;
   Status status = TryOpen(rep);
   if (status.ok()) {
     *result = new DirWriter(rep);
@@ -902,14 +1776,42 @@ class DirReaderImpl : public DirReader {
 
   virtual Status Count(const CountOp& op, size_t* result);
   virtual Status Read(const ReadOp& op, const Slice& fid, std::string* dst);
+  virtual Status ReadEach(const ReadOp& op, const Slice& fid, ValueSaver saver,
+                          void* arg);
+  virtual Status ReadAsync(const ReadOp& op, const Slice& fid, ReadCallback cb,
+                           void* arg);
+  virtual Status MultiRead(const ReadOp& op, const Slice* fids, size_t n,
+                           std::string* dsts);
+  virtual Status Membership(const ReadOp& op, const Slice& fid,
+                            std::vector<bool>* dst);
+  virtual Status MultiMembership(const ReadOp& op, const Slice* fids, size_t n,
+                                 std::vector<bool>* dsts);
   virtual Status Scan(const ScanOp& op, ScanSaver, void*);
+  virtual Status EstimateCount(const ScanOp& op, size_t* result);
+  virtual Status GetSpaceReport(DirSpaceReport* report);
 
   virtual IoStats TEST_iostats() const;
 
+  // Merge all epochs of a partition into a single epoch of "dst".
+  // Report the number of keys written in *n.
+  Status CompactPartition(uint32_t part, DirWriter* dst, size_t* n);
+  // Write all entries of a partition within a given epoch to the same epoch
+  // of "dst". Report the number of entries written in *n.
+  Status CopyPartition(uint32_t part, uint32_t epoch, DirWriter* dst,
+                       size_t* n);
+  uint32_t num_parts() const { return num_parts_; }
+  const DirOptions& options() const { return options_; }
+
  private:
+  Status OrderedScan(const ScanOp& op, ScanSaver saver, void* arg,
+                     Dir::ScanStats* stats);
   Status OpenDir(size_t part);
+  // Open the data log, which has been rotated "num_rotas" times or never
+  // rotated if "num_rotas" is -1.
+  Status OpenDataLog(int num_rotas);
   RandomAccessFileStats io_stats_;
   friend class DirReader;
+  friend class DirWriter;
 
   DirOptions options_;
   const std::string name_;
@@ -920,7 +1822,17 @@ class DirReaderImpl : public DirReader {
   port::CondVar cond_cv_;
   // Lazily initialized directory partitions
   Dir** dirs_;
+  // Root index contents and the number of epochs of each partition of a
+  // directory still being written. Empty for finished directories, whose
+  // roots are located through their footers.
+  std::vector<std::string> roots_;
+  std::vector<uint32_t> root_epochs_;
   LogSource* data_;
+  // Private block cache, if options_.block_cache was NULL
+  Cache* own_cache_;
+  // Private index cache, if options_.lazy_indexes is set and
+  // options_.index_cache was NULL
+  Cache* own_index_cache_;
 };
 
 DirReaderImpl::DirReaderImpl(const DirOptions& opts, const std::string& name)
@@ -930,7 +1842,21 @@ DirReaderImpl::DirReaderImpl(const DirOptions& opts, const std::string& name)
       part_mask_(~static_cast<uint32_t>(0)),
       cond_cv_(&mutex_),
       dirs_(NULL),
-      data_(NULL) {}
+      data_(NULL),
+      own_cache_(NULL),
+      own_index_cache_(NULL) {
+  if (options_.block_cache == NULL && options_.block_cache_size != 0) {
+    own_cache_ = options_.scan_resistant_block_cache
+                     ? NewScanResistantCache(options_.block_cache_size)
+                     : NewLRUCache(options_.block_cache_size);
+    options_.block_cache = own_cache_;
+  }
+  if (options_.index_cache == NULL && options_.lazy_indexes) {
+    // Practically unbounded so index blocks are never evicted once loaded
+    own_index_cache_ = NewLRUCache(~static_cast<size_t>(0) >> 1);
+    options_.index_cache = own_index_cache_;
+  }
+}
 
 DirReaderImpl::~DirReaderImpl() {
   MutexLock ml(&mutex_);
@@ -943,6 +1869,8 @@ DirReaderImpl::~DirReaderImpl() {
   if (data_ != NULL) {
     data_->Unref();
   }
+  delete own_cache_;
+  delete own_index_cache_;
 }
 
 // Open a directory partition if it has not been opened before.
@@ -963,10 +1891,20 @@ Status DirReaderImpl::OpenDir(size_t part) {
     idx_opts.rank = options_.rank;
     if (options_.measure_reads) idx_opts.seq_stats = &dir->io_stats_;
     idx_opts.io_size = options_.read_size;
+    idx_opts.mmap = options_.mmap_indexes;
+    idx_opts.on_demand = options_.index_cache != NULL;
+    idx_opts.segment_size = options_.index_segment_size;
+    idx_opts.segment_buf = options_.index_segment_buffer;
+    idx_opts.pool = options_.reader_pool;
+    idx_opts.osd = options_.osd;
     idx_opts.env = options_.env;
     status = LogSource::Open(idx_opts, name_, &indx);
     if (status.ok()) {
-      status = dir->Open(indx);
+      if (!roots_.empty()) {
+        status = dir->Open(indx, roots_[part], root_epochs_[part]);
+      } else {
+        status = dir->Open(indx);
+      }
     }
     mutex_.Lock();
     if (status.ok()) {
@@ -1016,6 +1954,86 @@ Status DirReaderImpl::Count(const CountOp& op, size_t* result) {
   return status;
 }
 
+Status DirReaderImpl::EstimateCount(const ScanOp& op, size_t* result) {
+  Status status;
+  MutexLock ml(&mutex_);
+  size_t subtotal;
+
+  *result = 0;
+  for (uint32_t part = 0; part < num_parts_; part++) {
+    status = OpenDir(part);
+    if (status.ok()) {
+      assert(dirs_[part] != NULL);
+      Dir* const dir = dirs_[part];
+      dir->Ref();
+      Dir::EstimateOptions opts;
+      opts.epoch_start = op.epoch_start;
+      opts.epoch_end = op.epoch_end;
+      opts.key_start = op.key_start;
+      opts.key_end = op.key_end;
+
+      status = dirs_[part]->EstimateCount(opts, &subtotal);
+      dir->Unref();
+      if (status.ok()) {
+        *result += subtotal;
+      }
+    }
+
+    if (!status.ok()) {
+      break;
+    }
+  }
+
+  return status;
+}
+
+// Obtain the space taken by all partitions. Bytes of the data log not taken by
+// any data block or the data log footer are reported as tail padding.
+// Return OK on success, or a non-OK status on errors.
+Status DirReaderImpl::GetSpaceReport(DirSpaceReport* report) {
+  Status status;
+  MutexLock ml(&mutex_);
+  DirSpaceStats others;
+  report->epochs.clear();
+  report->epochs.resize(num_parts_);
+  report->total = DirSpaceStats();
+  uint64_t data_bytes = 0;
+  for (uint32_t part = 0; part < num_parts_; part++) {
+    status = OpenDir(part);
+    if (status.ok()) {
+      assert(dirs_[part] != NULL);
+      Dir* const dir = dirs_[part];
+      dir->Ref();
+      status = dir->GetSpaceStats(&report->epochs[part], &others);
+      dir->Unref();
+    }
+
+    if (!status.ok()) {
+      break;
+    }
+
+    const std::vector<DirSpaceStats>& epochs = report->epochs[part];
+    for (size_t i = 0; i < epochs.size(); i++) {
+      data_bytes += epochs[i].data_size + epochs[i].block_padding_size;
+      data_bytes += epochs[i].num_blocks *
+                    (BlockHandle::kMaxEncodedLength + kBlockTrailerSize);
+      report->total.Add(epochs[i]);
+    }
+    report->total.Add(others);
+  }
+
+  if (status.ok()) {
+    data_bytes += Footer::kEncodedLength;
+    report->total.index_size += Footer::kEncodedLength;
+    const uint64_t data_size = data_->TotalSize();
+    if (data_size > data_bytes) {
+      report->total.tail_padding_size += data_size - data_bytes;
+    }
+  }
+
+  return status;
+}
+
 // Perform a scan operation on all partitions.
 // Return OK on success, or a non-OK status on errors.
 Status DirReaderImpl::Scan(const ScanOp& op, ScanSaver saver, void* arg) {
@@ -1026,7 +2044,11 @@ Status DirReaderImpl::Scan(const ScanOp& op, ScanSaver saver, void* arg) {
   stats.total_seeks = 0;
   stats.n = 0;
 
-  for (uint32_t part = 0; part < num_parts_; part++) {
+  if (op.ordered) {
+    status = OrderedScan(op, saver, arg, &stats);
+  }
+
+  for (uint32_t part = 0; part < num_parts_ && !op.ordered; part++) {
     status = OpenDir(part);
     if (status.ok()) {
       assert(dirs_[part] != NULL);
@@ -1035,7 +2057,11 @@ Status DirReaderImpl::Scan(const ScanOp& op, ScanSaver saver, void* arg) {
       Dir::ScanOptions opts;
       opts.epoch_start = op.epoch_start;
       opts.epoch_end = op.epoch_end;
+      opts.key_start = op.key_start;
+      opts.key_end = op.key_end;
       opts.force_serial_reads = op.no_parallel_reads;
+      opts.value_offset = op.value_offset;
+      opts.value_length = options_.fixed_kv_length ? op.value_length : 0;
       Dir::Saver dir_saver = static_cast<Dir::Saver>(saver);
       opts.usr_cb = reinterpret_cast<void*>(dir_saver);
       opts.arg_cb = arg;
@@ -1067,10 +2093,264 @@ Status DirReaderImpl::Scan(const ScanOp& op, ScanSaver saver, void* arg) {
   return status;
 }
 
+namespace {
+// State of an asynchronous read operation.
+struct AsyncReadState {
+  DirReader::ReadOp op;
+  DirReader::ReadCallback cb;
+  void* arg;
+  Dir::ReadStats stats;
+};
+
+void AsyncReadDone(void* arg, const Status& status, const Slice& value) {
+  AsyncReadState* const state = reinterpret_cast<AsyncReadState*>(arg);
+  if (status.ok()) {
+    if (state->op.table_seeks != NULL) {
+      *state->op.table_seeks = state->stats.total_table_seeks;
+    }
+    if (state->op.seeks != NULL) {
+      *state->op.seeks = state->stats.total_seeks;
+    }
+    if (state->op.stats != NULL) {
+      *state->op.stats = state->stats.costs;
+    }
+  }
+  DirReader::ReadCallback const cb = state->cb;
+  void* const cb_arg = state->arg;
+  delete state;
+  cb(cb_arg, status, value);
+}
+}  // namespace
+
+// Return the time at which a read operation gives up, or 0 for no limit.
+static uint64_t ReadDeadline(const DirReader::ReadOp& op) {
+  return op.deadline_micros != 0 ? CurrentMicros() + op.deadline_micros : 0;
+}
+
+// Start a read operation for a key. Results are reported through "cb".
+// Return OK on success, or a non-OK status on errors.
+Status DirReaderImpl::ReadAsync(const ReadOp& op, const Slice& fid,
+                                ReadCallback cb, void* arg) {
+  const uint64_t deadline = ReadDeadline(op);
+  Status status;
+  if (op.no_parallel_reads ||
+      (options_.reader_pool == NULL && !options_.allow_env_threads)) {
+    std::string dst;
+    status = Read(op, fid, &dst);
+    cb(arg, status, dst);
+    return Status::OK();
+  }
+
+  uint32_t hash = Hash(fid.data(), fid.size(), 0);
+  uint32_t part = hash & part_mask_;
+  MutexLock ml(&mutex_);
+  status = OpenDir(part);
+  if (status.ok()) {
+    assert(dirs_[part] != NULL);
+    AsyncReadState* const state = new AsyncReadState;
+    state->op = op;
+    state->cb = cb;
+    state->arg = arg;
+    state->stats.total_table_seeks = 0;
+    state->stats.total_seeks = 0;
+    Dir::ReadOptions opts;
+    opts.epoch_start = op.epoch_start;
+    opts.epoch_end = op.epoch_end;
+    opts.latest_first = op.latest_first;
+    opts.deadline = deadline;
+    dirs_[part]->ReadAsync(opts, fid, &state->stats, AsyncReadDone, state);
+  }
+
+  return status;
+}
+
+// Merge keys from all partitions into a single key-ordered stream.
+// REQUIRES: mutex_ has been locked.
+Status DirReaderImpl::OrderedScan(const ScanOp& op, ScanSaver saver, void* arg,
+                                  Dir::ScanStats* stats) {
+  mutex_.AssertHeld();
+  Status status;
+  std::vector<Dir*> dirs;
+  for (uint32_t part = 0; part < num_parts_; part++) {
+    status = OpenDir(part);
+    if (status.ok()) {
+      assert(dirs_[part] != NULL);
+      dirs.push_back(dirs_[part]);
+      dirs_[part]->Ref();
+    } else {
+      break;
+    }
+  }
+
+  if (status.ok() && !dirs.empty()) {
+    Dir::ScanOptions opts;
+    opts.epoch_start = op.epoch_start;
+    opts.epoch_end = op.epoch_end;
+    opts.key_start = op.key_start;
+    opts.key_end = op.key_end;
+    opts.force_serial_reads = op.no_parallel_reads;
+    opts.value_offset = op.value_offset;
+    opts.value_length = options_.fixed_kv_length ? op.value_length : 0;
+    Dir::Saver dir_saver = static_cast<Dir::Saver>(saver);
+    opts.usr_cb = reinterpret_cast<void*>(dir_saver);
+    opts.arg_cb = arg;
+    mutex_.Unlock();
+    status = Dir::OrderedScan(&dirs[0], dirs.size(), opts, stats);
+    mutex_.Lock();
+  }
+
+  for (size_t i = 0; i < dirs.size(); i++) {
+    dirs[i]->Unref();
+  }
+
+  return status;
+}
+
+namespace {
+// State of merging the entries of a partition into a directory writer.
+// Entries sharing a key are combined into one as they arrive in key order.
+struct PartitionMerger {
+  explicit PartitionMerger(DirWriter* dst) : dst(dst), epoch(0), n(0) {}
+
+  static int Save(void* arg, const Slice& key, const Slice& value) {
+    PartitionMerger* const m = reinterpret_cast<PartitionMerger*>(arg);
+    if (!m->value.empty() && key != m->key) {
+      if (!m->Flush()) {
+        return -1;
+      }
+    }
+    if (m->value.empty()) {
+      m->key.assign(key.data(), key.size());
+    }
+    PutVarint32(&m->value, m->epoch);
+    PutLengthPrefixedSlice(&m->value, value);
+    return 0;
+  }
+
+  // Write out the entry being combined. Return false on errors.
+  bool Flush() {
+    if (!value.empty()) {
+      status = dst->Add(key, value, 0);
+      value.clear();
+      n++;
+    }
+    return status.ok();
+  }
+
+  DirWriter* const dst;
+  uint32_t epoch;  // Epoch of the entry being delivered
+  std::string key;
+  std::string value;
+  Status status;
+  size_t n;
+};
+}  // namespace
+
+Status DirReaderImpl::CompactPartition(uint32_t part, DirWriter* dst,
+                                       size_t* n) {
+  Status status;
+  MutexLock ml(&mutex_);
+  status = OpenDir(part);
+  if (status.ok()) {
+    assert(dirs_[part] != NULL);
+    Dir* dir = dirs_[part];
+    dir->Ref();
+    PartitionMerger merger(dst);
+    Dir::ScanOptions opts;
+    Dir::Saver dir_saver = PartitionMerger::Save;
+    opts.usr_cb = reinterpret_cast<void*>(dir_saver);
+    opts.arg_cb = &merger;
+    opts.epoch = &merger.epoch;
+    Dir::ScanStats stats;
+    stats.total_table_seeks = 0;
+    stats.total_seeks = 0;
+    stats.n = 0;
+    mutex_.Unlock();
+    status = Dir::OrderedScan(&dir, 1, opts, &stats);
+    if (status.ok()) {
+      status = merger.status;
+    }
+    if (status.ok()) {
+      merger.Flush();
+      status = merger.status;
+    }
+    mutex_.Lock();
+    dir->Unref();
+    *n = merger.n;
+  }
+
+  return status;
+}
+
+namespace {
+// State of copying the entries of an epoch into a directory writer.
+struct PartitionCopier {
+  PartitionCopier(DirWriter* dst, uint32_t epoch)
+      : dst(dst), epoch(epoch), n(0) {}
+
+  static int Save(void* arg, const Slice& key, const Slice& value) {
+    PartitionCopier* const c = reinterpret_cast<PartitionCopier*>(arg);
+    if (!c->status.ok()) {
+      return -1;
+    }
+    c->status = c->dst->Add(key, value, static_cast<int>(c->epoch));
+    if (!c->status.ok()) {
+      return -1;
+    }
+    c->n++;
+    return 0;
+  }
+
+  DirWriter* const dst;
+  const uint32_t epoch;
+  Status status;
+  size_t n;
+};
+}  // namespace
+
+Status DirReaderImpl::CopyPartition(uint32_t part, uint32_t epoch,
+                                    DirWriter* dst, size_t* n) {
+  Status status;
+  MutexLock ml(&mutex_);
+  status = OpenDir(part);
+  if (status.ok()) {
+    assert(dirs_[part] != NULL);
+    Dir* const dir = dirs_[part];
+    dir->Ref();
+    PartitionCopier copier(dst, epoch);
+    Dir::ScanOptions opts;
+    opts.epoch_start = epoch;
+    opts.epoch_end = epoch + 1;
+    // Entries are added to "dst" by us one at a time
+    opts.force_serial_reads = true;
+    Dir::Saver dir_saver = PartitionCopier::Save;
+    opts.usr_cb = reinterpret_cast<void*>(dir_saver);
+    opts.arg_cb = &copier;
+    char tmp[256];  // Temporary buffer space for the scan
+    opts.tmp_length = sizeof(tmp);
+    opts.tmp = tmp;
+    Dir::ScanStats stats;
+    stats.total_table_seeks = 0;
+    stats.total_seeks = 0;
+    stats.n = 0;
+    status = dir->Scan(opts, &stats);
+    if (status.ok()) {
+      status = copier.status;
+    }
+    dir->Unref();
+    *n = copier.n;
+  }
+
+  return status;
+}
+
 // Perform a read operation for a key.
 // Return OK on success, or a non-OK status on errors.
 Status DirReaderImpl::Read(const ReadOp& op, const Slice& fid,
                            std::string* dst) {
+  DirLatencyStats* const lat = options_.latency_stats;
+  const uint64_t start = lat != NULL ? CurrentMicros() : 0;
+  const uint64_t deadline = ReadDeadline(op);
   Status status;
   uint32_t hash = Hash(fid.data(), fid.size(), 0);
   uint32_t part = hash & part_mask_;
@@ -1088,6 +2368,8 @@ Status DirReaderImpl::Read(const ReadOp& op, const Slice& fid,
     opts.epoch_start = op.epoch_start;
     opts.epoch_end = op.epoch_end;
     opts.force_serial_reads = op.no_parallel_reads;
+    opts.latest_first = op.latest_first;
+    opts.deadline = deadline;
     char tmp[256];  // Temporary buffer space for the read operation
     opts.tmp_length = sizeof(tmp);
     opts.tmp = tmp;
@@ -1103,6 +2385,214 @@ Status DirReaderImpl::Read(const ReadOp& op, const Slice& fid,
     if (op.seeks != NULL) {
       *op.seeks = stats.total_seeks;
     }
+    if (op.stats != NULL) {
+      *op.stats = stats.costs;
+    }
+  }
+
+  if (lat != NULL) {
+    lat->get.Add(CurrentMicros() - start);
+  }
+  return status;
+}
+
+Status DirReaderImpl::ReadEach(const ReadOp& op, const Slice& fid,
+                               ValueSaver saver, void* arg) {
+  const uint64_t deadline = ReadDeadline(op);
+  Status status;
+  uint32_t hash = Hash(fid.data(), fid.size(), 0);
+  uint32_t part = hash & part_mask_;
+  MutexLock ml(&mutex_);
+  Dir::ReadStats stats;
+  stats.total_table_seeks = 0;
+  stats.total_seeks = 0;
+
+  status = OpenDir(part);
+  if (status.ok()) {
+    assert(dirs_[part] != NULL);
+    Dir* const dir = dirs_[part];
+    dir->Ref();
+    Dir::ReadOptions opts;
+    opts.epoch_start = op.epoch_start;
+    opts.epoch_end = op.epoch_end;
+    opts.force_serial_reads = true;
+    opts.deadline = deadline;
+    opts.saver = saver;
+    opts.saver_arg = arg;
+    char tmp[256];  // Temporary buffer space for the read operation
+    opts.tmp_length = sizeof(tmp);
+    opts.tmp = tmp;
+
+    status = dirs_[part]->Read(opts, fid, NULL, &stats);
+    dir->Unref();
+  }
+
+  if (status.ok()) {
+    if (op.table_seeks != NULL) {
+      *op.table_seeks = stats.total_table_seeks;
+    }
+    if (op.seeks != NULL) {
+      *op.seeks = stats.total_seeks;
+    }
+    if (op.stats != NULL) {
+      *op.stats = stats.costs;
+    }
+  }
+
+  return status;
+}
+
+namespace {
+struct FidLessThan {
+  const Slice* fids;
+
+  explicit FidLessThan(const Slice* fids) : fids(fids) {}
+
+  bool operator()(size_t a, size_t b) const { return fids[a] < fids[b]; }
+};
+
+struct DupFid {
+  size_t index;
+  size_t origin;  // Index of the first copy of the key
+  size_t offset;  // Size of the first copy's dst before the read
+};
+}  // namespace
+
+// Perform a read operation for a set of keys. Keys belonging to the same
+// partition are sorted and looked up together. Duplicated keys are only
+// looked up once.
+// Return OK on success, or a non-OK status on errors.
+Status DirReaderImpl::MultiRead(const ReadOp& op, const Slice* fids, size_t n,
+                                std::string* dsts) {
+  Status status;
+  MutexLock ml(&mutex_);
+  std::vector<std::vector<size_t> > parts(num_parts_);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t hash = Hash(fids[i].data(), fids[i].size(), 0);
+    parts[hash & part_mask_].push_back(i);
+  }
+  Dir::ReadStats stats;
+  stats.total_table_seeks = 0;
+  stats.total_seeks = 0;
+
+  std::vector<DupFid> dups;  // Duplicated keys
+  std::vector<std::string*> dirdsts;
+  std::vector<Slice> dirkeys;
+  for (uint32_t part = 0; part < num_parts_; part++) {
+    std::vector<size_t>* const idxs = &parts[part];
+    if (idxs->empty()) {
+      continue;
+    }
+    std::sort(idxs->begin(), idxs->end(), FidLessThan(fids));
+    dirkeys.clear();
+    dirdsts.clear();
+    size_t origin = 0;
+    for (size_t k = 0; k < idxs->size(); k++) {
+      const size_t i = (*idxs)[k];
+      if (!dirkeys.empty() && dirkeys.back() == fids[i]) {
+        DupFid dup;
+        dup.index = i;
+        dup.origin = origin;
+        dup.offset = dsts[origin].size();
+        dups.push_back(dup);
+      } else {
+        origin = i;
+        dirkeys.push_back(fids[i]);
+        dirdsts.push_back(&dsts[i]);
+      }
+    }
+
+    status = OpenDir(part);
+    if (status.ok()) {
+      assert(dirs_[part] != NULL);
+      Dir* const dir = dirs_[part];
+      dir->Ref();
+      Dir::ReadOptions opts;
+      opts.epoch_start = op.epoch_start;
+      opts.epoch_end = op.epoch_end;
+      opts.force_serial_reads = true;
+      char tmp[256];  // Temporary buffer space for the read operation
+      opts.tmp_length = sizeof(tmp);
+      opts.tmp = tmp;
+
+      status = dirs_[part]->MultiRead(opts, &dirkeys[0], &dirdsts[0],
+                                      dirkeys.size(), &stats);
+      dir->Unref();
+    }
+
+    if (!status.ok()) {
+      break;
+    }
+  }
+
+  if (status.ok()) {
+    for (size_t k = 0; k < dups.size(); k++) {
+      const std::string& origin = dsts[dups[k].origin];
+      dsts[dups[k].index].append(origin, dups[k].offset, std::string::npos);
+    }
+    if (op.table_seeks != NULL) {
+      *op.table_seeks = stats.total_table_seeks;
+    }
+    if (op.seeks != NULL) {
+      *op.seeks = stats.total_seeks;
+    }
+  }
+
+  return status;
+}
+
+Status DirReaderImpl::Membership(const ReadOp& op, const Slice& fid,
+                                 std::vector<bool>* dst) {
+  return MultiMembership(op, &fid, 1, dst);
+}
+
+// Find the epochs that may contain each of a set of keys. Keys belonging to
+// the same partition are sorted and checked together.
+// Return OK on success, or a non-OK status on errors.
+Status DirReaderImpl::MultiMembership(const ReadOp& op, const Slice* fids,
+                                      size_t n, std::vector<bool>* dsts) {
+  Status status;
+  MutexLock ml(&mutex_);
+  const size_t num_epochs =
+      options_.num_epochs > 0 ? static_cast<size_t>(options_.num_epochs) : 0;
+  std::vector<std::vector<size_t> > parts(num_parts_);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t hash = Hash(fids[i].data(), fids[i].size(), 0);
+    parts[hash & part_mask_].push_back(i);
+    dsts[i].assign(num_epochs, false);
+  }
+
+  std::vector<std::vector<bool>*> dirdsts;
+  std::vector<Slice> dirkeys;
+  for (uint32_t part = 0; part < num_parts_; part++) {
+    std::vector<size_t>* const idxs = &parts[part];
+    if (idxs->empty()) {
+      continue;
+    }
+    std::sort(idxs->begin(), idxs->end(), FidLessThan(fids));
+    dirkeys.clear();
+    dirdsts.clear();
+    for (size_t k = 0; k < idxs->size(); k++) {
+      const size_t i = (*idxs)[k];
+      dirkeys.push_back(fids[i]);
+      dirdsts.push_back(&dsts[i]);
+    }
+
+    status = OpenDir(part);
+    if (status.ok()) {
+      assert(dirs_[part] != NULL);
+      Dir* const dir = dirs_[part];
+      dir->Ref();
+      Dir::ReadOptions opts;
+      opts.epoch_start = op.epoch_start;
+      opts.epoch_end = std::min(op.epoch_end, uint32_t(num_epochs));
+      status = dir->Membership(opts, &dirkeys[0], &dirdsts[0], dirkeys.size());
+      dir->Unref();
+    }
+
+    if (!status.ok()) {
+      break;
+    }
   }
 
   return status;
@@ -1115,6 +2605,8 @@ IoStats DirReaderImpl::TEST_iostats() const {
     if (dirs_[i] != NULL) {
       result.index_bytes += dirs_[i]->io_stats_.TotalBytes();
       result.index_ops += dirs_[i]->io_stats_.TotalOps();
+      result.cache_hits += dirs_[i]->cache_hits_;
+      result.cache_misses += dirs_[i]->cache_misses_;
     }
   }
   result.data_bytes = io_stats_.TotalBytes();
@@ -1137,8 +2629,11 @@ DirReader::ReadOp::ReadOp()
     : epoch_start(0),
       epoch_end(~static_cast<uint32_t>(0)),
       no_parallel_reads(false),
+      latest_first(false),
+      deadline_micros(0),
       table_seeks(NULL),
-      seeks(NULL) {}
+      seeks(NULL),
+      stats(NULL) {}
 
 void DirReader::ReadOp::SetEpoch(int epoch) {
   assert(epoch >= -1);
@@ -1152,6 +2647,9 @@ DirReader::ScanOp::ScanOp()
     : epoch_start(0),
       epoch_end(~static_cast<uint32_t>(0)),
       no_parallel_reads(false),
+      ordered(false),
+      value_offset(0),
+      value_length(0),
       table_seeks(NULL),
       seeks(NULL),
       n(NULL) {}
@@ -1173,6 +2671,12 @@ static std::string FilterName(FilterType type) {
       return "Dis";
     case kFtBloomFilter:
       return "Bloom filter";
+    case kFtBlockedBloomFilter:
+      return "Blocked bloom filter";
+    case kFtXorFilter:
+      return "Xor filter";
+    case kFtGcsFilter:
+      return "Golomb-coded set";
     case kFtBitmap:
       return "Bitmap";
     default:
@@ -1194,6 +2698,12 @@ static DirOptions MaybeRewriteOptions(  // Only a subset of options are checked
     Warn(__LOG_ARGS__, "Dfs.plfsdir.fixed_kv_length -> %s (was %s)",
          result.fixed_kv_length ? "Yes" : "No",
          origin.fixed_kv_length ? "Yes" : "No");
+  if (result.ect_index != origin.ect_index)
+    Warn(__LOG_ARGS__, "Dfs.plfsdir.ect_index -> %s (was %s)",
+         result.ect_index ? "Yes" : "No", origin.ect_index ? "Yes" : "No");
+  if (result.key_index != origin.key_index)
+    Warn(__LOG_ARGS__, "Dfs.plfsdir.key_index -> %s (was %s)",
+         result.key_index ? "Yes" : "No", origin.key_index ? "Yes" : "No");
   if (result.leveldb_compatible != origin.leveldb_compatible)
     Warn(__LOG_ARGS__, "Dfs.plfsdir.leveldb_compatible -> %s (was %s)",
          result.leveldb_compatible ? "Yes" : "No",
@@ -1206,9 +2716,18 @@ static DirOptions MaybeRewriteOptions(  // Only a subset of options are checked
     Warn(__LOG_ARGS__, "Dfs.plfsdir.skip_checksums -> %s (was %s)",
          result.skip_checksums ? "Yes" : "No",
          origin.skip_checksums ? "Yes" : "No");
+  if (result.checksum_type != origin.checksum_type)
+    Warn(__LOG_ARGS__, "Dfs.plfsdir.checksum_type -> %s (was %s)",
+         ChecksumName(result.checksum_type).c_str(),
+         ChecksumName(origin.checksum_type).c_str());
   if (result.filter != origin.filter)
     Warn(__LOG_ARGS__, "Dfs.plfsdir.filter -> %s (was %s)",
          FilterName(result.filter).c_str(), FilterName(origin.filter).c_str());
+  if ((result.filter_partition_keys != 0) !=
+      (origin.filter_partition_keys != 0))
+    Warn(__LOG_ARGS__, "Dfs.plfsdir.filter_partitions -> %s (was %s)",
+         result.filter_partition_keys ? "Yes" : "No",
+         origin.filter_partition_keys ? "Yes" : "No");
   if (result.mode != origin.mode)
     Warn(__LOG_ARGS__, "Dfs.plfsdir.mode -> %s (was %s)",
          DirModeName(result.mode).c_str(), DirModeName(origin.mode).c_str());
@@ -1237,7 +2756,6 @@ Status DirReader::Open(const DirOptions& _opts, const std::string& dirname,
   DirOptions options = SanitizeReadOptions(_opts);
   uint32_t num_parts =  // May have to be lazy initialized from the footer
       options.lg_parts == -1 ? 0 : 1u << options.lg_parts;
-  const int my_rank = options.rank;
   Env* const env = options.env;
   Status status;
 #if VERBOSE >= 2
@@ -1249,10 +2767,40 @@ Status DirReader::Open(const DirOptions& _opts, const std::string& dirname,
           options.reader_pool != NULL
               ? options.reader_pool->ToDebugString().c_str()
               : "None");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.hedge_pool -> %s",
+          options.hedge_pool != NULL
+              ? options.hedge_pool->ToDebugString().c_str()
+              : "None");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.hedge_percentile -> %d",
+          options.hedge_percentile);
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.read_size -> %s",
           PrettySize(options.read_size).c_str());
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.block_cache -> %s",
+          options.block_cache != NULL
+              ? "User"
+              : PrettySize(options.block_cache_size).c_str());
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.scan_resistant_block_cache -> %s",
+          int(options.scan_resistant_block_cache) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.index_cache -> %s",
+          options.index_cache != NULL ? "User" : "None");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.mmap_indexes -> %s",
+          int(options.mmap_indexes) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.mmap_data -> %s",
+          int(options.mmap_data) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.index_segment_size -> %s",
+          PrettySize(options.index_segment_size).c_str());
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.index_segment_buffer -> %s",
+          PrettySize(options.index_segment_buffer).c_str());
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.lazy_indexes -> %s",
+          int(options.lazy_indexes) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.scan_readahead -> %d",
+          options.scan_readahead);
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.interpolation_search -> %s",
+          int(options.interpolation_search) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.parallel_reads -> %s",
           int(options.parallel_reads) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.read_fetchers -> %d",
+          options.read_fetchers);
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.paranoid_checks -> %s",
           int(options.paranoid_checks) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.ignore_filters -> %s",
@@ -1261,6 +2809,8 @@ Status DirReader::Open(const DirOptions& _opts, const std::string& dirname,
           int(options.verify_checksums) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.skip_checksums -> %s",
           int(options.skip_checksums) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.checksum_type -> %s",
+          ChecksumName(options.checksum_type).c_str());
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.measure_reads -> %s",
           int(options.measure_reads) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.epoch_log_rotation -> %s",
@@ -1274,7 +2824,7 @@ Status DirReader::Open(const DirOptions& _opts, const std::string& dirname,
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.num_epochs -> %d", options.num_epochs);
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.memtable_parts -> %d (lg_parts=%d)",
           int(num_parts), options.lg_parts);
-  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.my_rank -> %d", my_rank);
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.my_rank -> %d", options.rank);
 #endif
   // We have three copies of the footer stored for each dir.
   // The primary copy is stored in a dedicated per-dir manifest file.
@@ -1305,16 +2855,10 @@ Status DirReader::Open(const DirOptions& _opts, const std::string& dirname,
     num_parts = 1u << options.lg_parts;
   }
 
-  LogSource* data = NULL;
   DirReaderImpl* impl = new DirReaderImpl(options, dirname);
-  LogSource::LogOptions io_opts;
-  io_opts.rank = my_rank;
-  io_opts.type = kDefIoType;
-  io_opts.sub_partition = -1;  // The data file does not have any sub-partitions
-  if (options.epoch_log_rotation) io_opts.num_rotas = options.num_epochs + 1;
-  if (options.measure_reads) io_opts.stats = &impl->io_stats_;
-  io_opts.env = env;
-  status = LogSource::Open(io_opts, dirname, &data);
+  status = impl->OpenDataLog(
+      options.epoch_log_rotation ? options.num_epochs + 1 : -1);
+  LogSource* const data = impl->data_;
   if (!status.ok()) {
     // Error
   } else if (data->Size(data->LastFileIndex()) < Footer::kEncodedLength) {
@@ -1338,18 +2882,512 @@ Status DirReader::Open(const DirOptions& _opts, const std::string& dirname,
     impl->dirs_ = new Dir*[num_parts]();
     impl->part_mask_ = num_parts - 1;
     impl->num_parts_ = num_parts;
-    impl->data_ = data;
-    impl->data_->Ref();
 
     *result = impl;
   } else {
     delete impl;
   }
 
-  if (data != NULL) {
-    data->Unref();
+  return status;
+}
+
+Status DirReaderImpl::OpenDataLog(int num_rotas) {
+  assert(data_ == NULL);
+  LogSource::LogOptions io_opts;
+  io_opts.rank = options_.rank;
+  io_opts.type = kDefIoType;
+  io_opts.sub_partition = -1;  // The data file does not have any sub-partitions
+  io_opts.num_rotas = num_rotas;
+  if (options_.measure_reads) io_opts.stats = &io_stats_;
+  io_opts.mmap = options_.mmap_data;
+  // Rotated logs are opened as their epochs are read
+  io_opts.lazy = true;
+  io_opts.pool = options_.reader_pool;
+  io_opts.hedge_pool = options_.hedge_pool;
+  io_opts.hedge_percentile = options_.hedge_percentile;
+  io_opts.osd = options_.osd;
+  io_opts.env = options_.env;
+  return LogSource::Open(io_opts, name_, &data_);
+}
+
+Status DirWriter::OpenSnapshot(DirReader** result) {
+  *result = NULL;
+  Status status;
+  Rep* const r = rep_;
+  status = r->DrainStagingBuffers();
+  if (!status.ok()) return status;
+  MutexLock ml(&r->mutex_);
+  // Wait for any epoch flush to finish so it is either fully seen or not
+  while (!r->finished_ && r->epoch_->committing_) {
+    r->cv_.Wait();
+  }
+  if (r->finished_) {
+    return Status::AssertionFailed("Plfsdir already finished");
+  }
+  status = r->WaitForCompaction();
+  if (!status.ok()) {
+    return status;
+  }
+  DirReaderImpl* const impl = new DirReaderImpl(r->options_, r->dirname_);
+  impl->roots_.resize(r->num_parts_);
+  impl->root_epochs_.resize(r->num_parts_);
+  for (uint32_t part = 0; part < r->num_parts_; part++) {
+    status = r->idxers_[part]->Snapshot(&impl->roots_[part],
+                                        &impl->root_epochs_[part]);
+    if (!status.ok()) {
+      break;
+    }
+  }
+  // Make written blocks visible to the reader
+  if (status.ok()) {
+    status = r->SyncLogs();
+  }
+  if (status.ok()) {
+    // The data log of the current epoch is the last one if logs are rotated
+    status = impl->OpenDataLog(
+        r->options_.epoch_log_rotation ? int(r->epoch_->seq_) + 1 : -1);
+  }
+  if (status.ok()) {
+    impl->dirs_ = new Dir*[r->num_parts_]();
+    impl->part_mask_ = r->num_parts_ - 1;
+    impl->num_parts_ = r->num_parts_;
+    *result = impl;
+  } else {
+    delete impl;
+  }
+
+  return status;
+}
+
+MultiDirReader::~MultiDirReader() {}
+
+MultiDirReader::ReadOp::ReadOp()
+    : epoch_start(0),
+      epoch_end(~static_cast<uint32_t>(0)),
+      num_candidates(NULL) {}
+
+void MultiDirReader::ReadOp::SetEpoch(int epoch) {
+  assert(epoch >= -1);
+  if (epoch != -1) {
+    epoch_start = static_cast<uint32_t>(epoch);
+    epoch_end = epoch_start + 1;
+  }
+}
+
+class MultiDirReaderImpl : public MultiDirReader {
+ public:
+  MultiDirReaderImpl(const DirOptions& options, const std::string* dirnames,
+                     const int* ranks, size_t n);
+  virtual ~MultiDirReaderImpl();
+
+  virtual Status Read(const ReadOp& op, const Slice& fid, std::string* dst);
+  virtual size_t TEST_num_open_dirs() const;
+
+ private:
+  struct ReadState;
+  struct ReadItem;
+  static void BGRead(void*);
+  Status ReadDir(size_t i, const ReadOp& op, const Slice& fid,
+                 std::string* dst, bool* candidate);
+  typedef LRUEntry<DirReader> DirEntry;
+  Status AcquireDir(size_t i, DirEntry** result);
+  void ReleaseDir(DirEntry* e);
+
+  const DirOptions options_;
+  std::vector<std::string> dirnames_;
+  std::vector<int> ranks_;
+
+  mutable port::Mutex mutex_;
+  // Directories currently open, each charged 1
+  LRUCache<DirEntry> dirs_;
+};
+
+MultiDirReaderImpl::MultiDirReaderImpl(const DirOptions& options,
+                                       const std::string* dirnames,
+                                       const int* ranks, size_t n)
+    : options_(options),
+      dirnames_(dirnames, dirnames + n),
+      ranks_(ranks, ranks + n),
+      dirs_(static_cast<size_t>(std::max(options.max_open_dirs, 1))) {}
+
+MultiDirReaderImpl::~MultiDirReaderImpl() {
+  // dirs_ closes all directories that are still open
+}
+
+size_t MultiDirReaderImpl::TEST_num_open_dirs() const {
+  MutexLock ml(&mutex_);
+  return dirs_.total_usage();
+}
+
+// Obtain the reader of directory "i", opening the directory if it is not
+// already open. Return OK on success, or a non-OK status on errors.
+Status MultiDirReaderImpl::AcquireDir(size_t i, DirEntry** result) {
+  char tmp[4];
+  EncodeFixed32(tmp, static_cast<uint32_t>(i));
+  Slice key(tmp, sizeof(tmp));
+  const uint32_t hash = static_cast<uint32_t>(i);
+  MutexLock ml(&mutex_);
+  *result = dirs_.Lookup(key, hash);
+  if (*result != NULL) {
+    return Status::OK();
+  }
+  mutex_.Unlock();  // Unlock when opening the directory
+  DirOptions options = options_;
+  options.rank = ranks_[i];
+  DirReader* reader;
+  Status status = DirReader::Open(options, dirnames_[i], &reader);
+  mutex_.Lock();
+  if (status.ok()) {
+    *result = dirs_.Insert(key, hash, reader, 1, LRUValueDeleter<DirReader>);
+  }
+  return status;
+}
+
+void MultiDirReaderImpl::ReleaseDir(DirEntry* e) {
+  MutexLock ml(&mutex_);
+  dirs_.Release(e);
+}
+
+// Check the filters of directory "i" for a key and read the key from the
+// directory if it may be stored there. Return OK on success, or a non-OK
+// status on errors.
+Status MultiDirReaderImpl::ReadDir(size_t i, const ReadOp& op,
+                                   const Slice& fid, std::string* dst,
+                                   bool* candidate) {
+  DirEntry* e;
+  Status status = AcquireDir(i, &e);
+  if (status.ok()) {
+    DirReader* const reader = e->value;
+    DirReader::ReadOp dir_op;
+    dir_op.epoch_start = op.epoch_start;
+    dir_op.epoch_end = op.epoch_end;
+    // Directories are already read in parallel
+    dir_op.no_parallel_reads = true;
+    std::vector<bool> maybe;
+    status = reader->Membership(dir_op, fid, &maybe);
+    if (status.ok()) {
+      *candidate = std::find(maybe.begin(), maybe.end(), true) != maybe.end();
+      if (*candidate) {
+        status = reader->Read(dir_op, fid, dst);
+      }
+    }
+    ReleaseDir(e);
+  }
+  return status;
+}
+
+// State shared by all directory probes of a read operation.
+struct MultiDirReaderImpl::ReadState {
+  explicit ReadState(size_t n) : cv(&mu), num_pending(n) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  size_t num_pending;  // Protected by mu
+};
+
+struct MultiDirReaderImpl::ReadItem {
+  MultiDirReaderImpl* reader;
+  ReadState* state;
+  const ReadOp* op;
+  Slice fid;
+  size_t i;
+  std::string dst;
+  bool candidate;
+  Status status;
+};
+
+void MultiDirReaderImpl::BGRead(void* arg) {
+  ReadItem* const item = reinterpret_cast<ReadItem*>(arg);
+  item->status = item->reader->ReadDir(item->i, *item->op, item->fid,
+                                       &item->dst, &item->candidate);
+  ReadState* const state = item->state;
+  MutexLock ml(&state->mu);
+  assert(state->num_pending > 0);
+  state->num_pending--;
+  state->cv.SignalAll();
+}
+
+// Probe all directories for a key and merge the results in directory order.
+// Return OK on success, or a non-OK status on errors.
+Status MultiDirReaderImpl::Read(const ReadOp& op, const Slice& fid,
+                                std::string* dst) {
+  const size_t n = dirnames_.size();
+  std::vector<ReadItem> items(n);
+  ReadState state(n);
+  for (size_t i = 0; i < n; i++) {
+    ReadItem* const item = &items[i];
+    item->reader = this;
+    item->state = &state;
+    item->op = &op;
+    item->fid = fid;
+    item->i = i;
+    item->candidate = false;
+    if (options_.reader_pool != NULL) {
+      options_.reader_pool->ScheduleUrgent(BGRead, item);
+    } else if (options_.allow_env_threads) {
+      Env::Default()->Schedule(BGRead, item);
+    } else {
+      BGRead(item);
+    }
+  }
+
+  {
+    MutexLock ml(&state.mu);
+    while (state.num_pending > 0) {
+      state.cv.Wait();
+    }
+  }
+
+  Status status;
+  size_t num_candidates = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!items[i].status.ok()) {
+      status = items[i].status;
+      break;
+    } else if (items[i].candidate) {
+      dst->append(items[i].dst);
+      num_candidates++;
+    }
+  }
+
+  if (status.ok()) {
+    if (op.num_candidates != NULL) {
+      *op.num_candidates = num_candidates;
+    }
+  }
+
+  return status;
+}
+
+Status MultiDirReader::Open(const DirOptions& options,
+                            const std::string* dirnames, const int* ranks,
+                            size_t n, MultiDirReader** result) {
+  *result = NULL;
+#if VERBOSE >= 2
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.num_dirs -> %d (mode=read)", int(n));
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.max_open_dirs -> %d",
+          options.max_open_dirs);
+#endif
+  if (n == 0) {
+    return Status::InvalidArgument("No directories to read");
+  }
+  *result = new MultiDirReaderImpl(options, dirnames, ranks, n);
+  return Status::OK();
+}
+
+CompactDirOp::CompactDirOp() : max_parallel_merges(4), n(NULL) {}
+
+namespace {
+// State shared by all partition merges of a directory compaction.
+struct CompactDirState {
+  CompactDirState(DirReaderImpl* src, DirWriter* dst)
+      : src(src), dst(dst), cv(&mu), next_part(0), num_running(0), n(0) {}
+  DirReaderImpl* const src;
+  DirWriter* const dst;
+  port::Mutex mu;
+  port::CondVar cv;
+  // State below is protected by mu
+  uint32_t next_part;  // Next partition to merge
+  int num_running;     // Number of merge threads still running
+  Status status;
+  size_t n;
+};
+
+// Keep merging partitions until all partitions are done or an error occurs.
+void CompactPartitions(void* arg) {
+  CompactDirState* const state = reinterpret_cast<CompactDirState*>(arg);
+  MutexLock ml(&state->mu);
+  while (state->status.ok() && state->next_part < state->src->num_parts()) {
+    const uint32_t part = state->next_part++;
+    size_t n = 0;
+    state->mu.Unlock();
+    Status s = state->src->CompactPartition(part, state->dst, &n);
+    state->mu.Lock();
+    state->n += n;
+    if (state->status.ok() && !s.ok()) {
+      state->status = s;
+    }
+  }
+  assert(state->num_running > 0);
+  state->num_running--;
+  state->cv.SignalAll();
+}
+}  // namespace
+
+Status CompactDir(const DirOptions& options, const std::string& src,
+                  const std::string& dst, const CompactDirOp& op) {
+  DirReader* reader = NULL;
+  Status status = DirReader::Open(options, src, &reader);
+  if (!status.ok()) {
+    return status;
+  }
+  DirReaderImpl* const impl = static_cast<DirReaderImpl*>(reader);
+  DirOptions dst_options = impl->options();
+  // Merged values are no longer of a fixed size and each key appears once
+  dst_options.fixed_kv_length = false;
+  dst_options.mode = kDmUniqueKey;
+  dst_options.epoch_log_rotation = false;
+  DirWriter* writer = NULL;
+  status = DirWriter::Open(dst_options, dst, &writer);
+  if (status.ok()) {
+    CompactDirState state(impl, writer);
+    const int num_threads = static_cast<int>(std::min<uint32_t>(
+        std::max(op.max_parallel_merges, 1), impl->num_parts()));
+    MutexLock ml(&state.mu);
+    if (num_threads > 1) {
+      state.num_running = num_threads;
+      for (int i = 0; i < num_threads; i++) {
+        Env::Default()->StartThread(CompactPartitions, &state);
+      }
+    } else {
+      state.num_running = 1;
+      state.mu.Unlock();
+      CompactPartitions(&state);
+      state.mu.Lock();
+    }
+    while (state.num_running > 0) {
+      state.cv.Wait();
+    }
+    status = state.status;
+    if (status.ok()) {
+      state.mu.Unlock();
+      status = writer->EpochFlush(0);
+      if (status.ok()) {
+        status = writer->Finish();
+      }
+      state.mu.Lock();
+    }
+    if (status.ok() && op.n != NULL) {
+      *op.n = state.n;
+    }
+  }
+
+  delete writer;
+  delete reader;
+  return status;
+}
+
+bool GetCompactedValue(Slice* input, uint32_t* epoch, Slice* value) {
+  return GetVarint32(input, epoch) && GetLengthPrefixedSlice(input, value);
+}
+
+SortDirOp::SortDirOp() : max_parallel_scans(4), n(NULL) {}
+
+namespace {
+// State shared by all partition copies of an epoch of a directory sort.
+struct SortDirState {
+  SortDirState(DirReaderImpl* src, DirWriter* dst, uint32_t epoch)
+      : src(src),
+        dst(dst),
+        epoch(epoch),
+        cv(&mu),
+        next_part(0),
+        num_running(0),
+        n(0) {}
+  DirReaderImpl* const src;
+  DirWriter* const dst;
+  const uint32_t epoch;
+  port::Mutex mu;
+  port::CondVar cv;
+  // State below is protected by mu
+  uint32_t next_part;  // Next partition to copy
+  int num_running;     // Number of copy threads still running
+  Status status;
+  size_t n;
+};
+
+// Keep copying partitions until all partitions are done or an error occurs.
+void CopyPartitions(void* arg) {
+  SortDirState* const state = reinterpret_cast<SortDirState*>(arg);
+  MutexLock ml(&state->mu);
+  while (state->status.ok() && state->next_part < state->src->num_parts()) {
+    const uint32_t part = state->next_part++;
+    size_t n = 0;
+    state->mu.Unlock();
+    Status s = state->src->CopyPartition(part, state->epoch, state->dst, &n);
+    state->mu.Lock();
+    state->n += n;
+    if (state->status.ok() && !s.ok()) {
+      state->status = s;
+    }
+  }
+  assert(state->num_running > 0);
+  state->num_running--;
+  state->cv.SignalAll();
+}
+
+// Copy all entries of an epoch from "src" to "dst" and flush the epoch.
+// Add the number of entries copied to *n.
+Status SortEpoch(DirReaderImpl* src, DirWriter* dst, uint32_t epoch,
+                 const SortDirOp& op, size_t* n) {
+  SortDirState state(src, dst, epoch);
+  const int num_threads = static_cast<int>(std::min<uint32_t>(
+      std::max(op.max_parallel_scans, 1), src->num_parts()));
+  MutexLock ml(&state.mu);
+  if (num_threads > 1) {
+    state.num_running = num_threads;
+    for (int i = 0; i < num_threads; i++) {
+      Env::Default()->StartThread(CopyPartitions, &state);
+    }
+  } else {
+    state.num_running = 1;
+    state.mu.Unlock();
+    CopyPartitions(&state);
+    state.mu.Lock();
+  }
+  while (state.num_running > 0) {
+    state.cv.Wait();
+  }
+  Status status = state.status;
+  if (status.ok()) {
+    *n += state.n;
+    state.mu.Unlock();
+    status = dst->EpochFlush(static_cast<int>(epoch));
+    state.mu.Lock();
+  }
+  return status;
+}
+}  // namespace
+
+Status SortDir(const DirOptions& options, const std::string& src,
+               const std::string& dst, const SortDirOp& op) {
+  DirReader* reader = NULL;
+  Status status = DirReader::Open(options, src, &reader);
+  if (!status.ok()) {
+    return status;
+  }
+  DirReaderImpl* const impl = static_cast<DirReaderImpl*>(reader);
+  DirOptions dst_options = impl->options();
+  if (dst_options.mode == kDmUniqueUnordered) {
+    dst_options.mode = kDmUniqueKey;
+  } else if (dst_options.mode == kDmMultiMapUnordered) {
+    dst_options.mode = kDmMultiMap;
+  } else {
+    status = Status::InvalidArgument("Dir is not unordered");
+  }
+  DirWriter* writer = NULL;
+  if (status.ok()) {
+    status = DirWriter::Open(dst_options, dst, &writer);
+  }
+  if (status.ok()) {
+    assert(dst_options.num_epochs >= 0);
+    const uint32_t num_epochs = static_cast<uint32_t>(dst_options.num_epochs);
+    size_t n = 0;
+    for (uint32_t epoch = 0; epoch < num_epochs; epoch++) {
+      status = SortEpoch(impl, writer, epoch, op, &n);
+      if (!status.ok()) {
+        break;
+      }
+    }
+    if (status.ok()) {
+      status = writer->Finish();
+    }
+    if (status.ok() && op.n != NULL) {
+      *op.n = n;
+    }
   }
 
+  delete writer;
+  delete reader;
   return status;
 }
 
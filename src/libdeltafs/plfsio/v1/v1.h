@@ -13,9 +13,13 @@
 
 #include "types.h"
 
+#include <vector>
+
 namespace pdlfs {
 namespace plfsio {
 
+class DirReader;
+
 // Deltafs Plfs Dir Writer
 class DirWriter {
  public:
@@ -63,9 +67,41 @@ class DirWriter {
   // Return the aggregated size of all inserted values.
   uint64_t TEST_value_bytes() const;
 
+  // Return the total amount of time, in microseconds, writers have been
+  // blocked waiting for memtable space. Summed over all partitions.
+  uint64_t TEST_write_stall_micros() const;
+
+  // Return the total number of bytes written to spill_dir so far and the
+  // total amount of time, in microseconds, spent compacting write buffers
+  // merged with spilled runs. Summed over all partitions.
+  uint64_t TEST_spilled_bytes() const;
+  uint64_t TEST_spill_merge_micros() const;
+
   // Return the total amount of memory reserved by this directory.
   uint64_t TEST_total_memory_usage() const;
 
+  // Return the current memtable budget of this directory. May change over
+  // time if the directory is registered with a memory manager.
+  uint64_t TEST_memtable_budget() const;
+
+  // Return the part of the total memory usage that is write buffer memory
+  // backed by huge pages. Only non-zero when hugepage_buffers is set.
+  uint64_t TEST_hugepage_memory_usage() const;
+
+  // Report how full the write buffers of all memtable partitions are.
+  // Writers may poll this to shift work before they are blocked.
+  DirWritePressure GetWritePressure() const;
+
+  // Report the space taken by each epoch of each memtable partition, along
+  // with the directory total. The report only becomes complete once Finish()
+  // returns, and then covers every byte written to the data and index logs.
+  // Return OK on success, or a non-OK status on errors.
+  Status GetSpaceReport(DirSpaceReport* report) const;
+
+  // Return the decisions made by auto tuning, in the order they were made.
+  // Empty unless auto_tune is set and the first epoch has been flushed.
+  void GetTuningLog(std::vector<std::string>* decisions) const;
+
   // Open an I/O writer against a specified plfs-style directory.
   // Return OK on success, or a non-OK status on errors.
   static Status Open(const DirOptions& options, const std::string& dirname,
@@ -76,6 +112,15 @@ class DirWriter {
   // REQUIRES: Finish() has not been called.
   Status Add(const Slice& fid, const Slice& data, int epoch = -1);
 
+  // Append "n" pieces of data to their corresponding files under the
+  // directory, all belonging to the same epoch. Cheaper than calling Add()
+  // repeatedly. Processing stops at the first error, in which case some
+  // of the data may have been inserted.
+  // Set epoch to -1 to disable epoch validation.
+  // REQUIRES: Finish() has not been called.
+  Status AddBatch(const Slice* fids, const Slice* data, size_t n,
+                  int epoch = -1);
+
   // Force a memtable compaction.
   // Set epoch to -1 to disable epoch validation.
   // REQUIRES: Finish() has not been called.
@@ -86,6 +131,23 @@ class DirWriter {
   // REQUIRES: Finish() has not been called.
   Status EpochFlush(int epoch = -1);
 
+  // Same as above, but also set *ticket to a number identifying the
+  // compaction started by this call. The ticket may later be passed to
+  // PollFlush() or WaitForFlush() to check whether the epoch has been
+  // written out without waiting for compactions started after it.
+  // REQUIRES: Finish() has not been called.
+  Status EpochFlush(int epoch, uint32_t* ticket);
+
+  // Set *done to true iff the compactions identified by ticket and all
+  // compactions before it have finished.
+  // Return OK on success, or a non-OK status on errors.
+  Status PollFlush(uint32_t ticket, bool* done);
+
+  // Wait for the compactions identified by ticket and all compactions
+  // before it to finish. Unlike Wait(), will not wait for later compactions.
+  // Return OK on success, or a non-OK status on errors.
+  Status WaitForFlush(uint32_t ticket);
+
   // Wait for all on-going background compactions to finish.
   // Return OK on success, or a non-OK status on errors.
   Status Wait();
@@ -98,6 +160,19 @@ class DirWriter {
   // No further write operation is allowed after this call.
   Status Finish();
 
+  // Open a reader on the data written so far without finishing the
+  // directory. The reader sees all epochs flushed so far and the tables of
+  // the current epoch compacted so far. Compactions in flight, including
+  // those of immutable write buffers, are waited for first. Records still in
+  // the active write buffers are not seen; call Flush() beforehand to include
+  // them. With epoch_merge, no record of the current epoch is seen until the
+  // epoch is flushed. Later writes are not seen by the reader, which must be
+  // deleted by the caller when it is no longer needed. The reader is opened
+  // with the options of the writer.
+  // REQUIRES: Finish() has not been called.
+  // Return OK on success, or a non-OK status on errors.
+  Status OpenSnapshot(DirReader** result);
+
  private:
   struct Rep;
 
@@ -138,14 +213,83 @@ class DirReader {
     uint32_t epoch_start;
     uint32_t epoch_end;
     bool no_parallel_reads;
+    // Probe epochs from the newest to the oldest and stop at the first epoch
+    // in which the key is found. Only values from that epoch are returned.
+    // Suited for keys that are not expected to appear in more than one epoch,
+    // such as in kDmUniqueKey mode, or when only the latest values matter.
+    // Pending parallel probes of older epochs are cancelled on a hit.
+    // Default: false
+    bool latest_first;
+    // Give up the read with a TryAgain status once it has run for this many
+    // microseconds. Checked before each epoch is fetched and, when data block
+    // reads are hedged (see DirOptions::hedge_pool), while waiting on block
+    // reads. Set to 0 for no limit.
+    // Default: 0
+    uint64_t deadline_micros;
     size_t* table_seeks;
     size_t* seeks;
+    // If not NULL, per-query costs are reported here.
+    // Default: NULL
+    QueryStats* stats;
   };
   // Obtain the value to a specific key stored in a given epoch range.
-  // Report operation stats in *table_seeks and *seeks.
+  // Report operation stats in *table_seeks, *seeks, and *stats.
   // Return OK on success, or a non-OK status on errors.
   virtual Status Read(const ReadOp& op, const Slice& fid, std::string* dst) = 0;
 
+  typedef int (*ValueSaver)(void* arg, uint32_t epoch, const Slice& value);
+  // Obtain the values of a specific key stored in a given epoch range one at
+  // a time. Each value is passed to "saver" together with its epoch, in epoch
+  // order, straight from the data block in which it is stored, so no more
+  // than a single block of results is held in memory regardless of how many
+  // values the key has. Values are only valid during the callback. The read
+  // stops early if "saver" returns -1. Epochs are always read serially.
+  // Report operation stats in *table_seeks, *seeks, and *stats.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status ReadEach(const ReadOp& op, const Slice& fid, ValueSaver saver,
+                          void* arg) = 0;
+
+  typedef void (*ReadCallback)(void* arg, const Status& status,
+                               const Slice& value);
+  // Obtain the value to a specific key stored in a given epoch range without
+  // blocking the calling thread. Epochs are fetched through
+  // options.reader_pool, or env threads if allowed, and "cb" is called
+  // exactly once with the final status and value from one of those threads.
+  // Operation stats are written to *table_seeks, *seeks, and *stats before
+  // "cb" is called. Reads fall back to being done synchronously by the
+  // caller, with "cb" called before returning, if no background threads are
+  // available or if op.no_parallel_reads is set. The reader must not be
+  // deleted until all callbacks have been called, though it may be deleted by
+  // the last of them. Return OK if the read has been started, or a non-OK
+  // status on errors, in which case "cb" is never called.
+  virtual Status ReadAsync(const ReadOp& op, const Slice& fid, ReadCallback cb,
+                           void* arg) = 0;
+
+  // Obtain the values to a set of keys stored in a given epoch range. Values
+  // found for fids[i] will be appended to dsts[i]. Keys are grouped by their
+  // partitions and looked up together, so that tables and data blocks are
+  // only accessed once for all keys they may contain. Epochs are always read
+  // serially. Report operation stats in *table_seeks and *seeks.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status MultiRead(const ReadOp& op, const Slice* fids, size_t n,
+                           std::string* dsts) = 0;
+
+  // Find the epochs in which a specific key may be stored. On return,
+  // (*dst)[e] is true if the key may be stored in epoch e, for every epoch e
+  // of the directory, and is always false for epochs outside the given epoch
+  // range. Only table key ranges and filters are checked so no data blocks
+  // are read. False positives are therefore possible, but not false
+  // negatives. Return OK on success, or a non-OK status on errors.
+  virtual Status Membership(const ReadOp& op, const Slice& fid,
+                            std::vector<bool>* dst) = 0;
+
+  // Find the epochs in which each of a set of keys may be stored. Results for
+  // fids[i] are stored in dsts[i]. Keys are grouped by their partitions so
+  // that each table and filter is only loaded once for all keys.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status MultiMembership(const ReadOp& op, const Slice* fids, size_t n,
+                                 std::vector<bool>* dsts) = 0;
+
   // Default: scan all epochs and allow parallel reads
   struct ScanOp {
     ScanOp();
@@ -153,16 +297,44 @@ class DirReader {
     uint32_t epoch_start;
     uint32_t epoch_end;
     bool no_parallel_reads;
+    // Report keys in key order across all epochs, tables, and partitions.
+    // Entries sharing a key are reported by epoch and then table.
+    bool ordered;
+    // Only keys within [key_start, key_end) are reported. Tables and data
+    // blocks outside the range are skipped without being read. An empty
+    // bound is treated as unbounded. Default: unbounded
+    Slice key_start;
+    Slice key_end;
+    // Only report value bytes [value_offset, value_offset + value_length) of
+    // each entry. Only applies to directories with fixed sized values. Data
+    // blocks storing values column by column decode only the columns covering
+    // the range. Set value_length to 0 to report entire values. Default: 0
+    size_t value_offset;
+    size_t value_length;
     size_t* table_seeks;
     size_t* seeks;
     size_t* n;
   };
   typedef int (*ScanSaver)(void* arg, const Slice& key, const Slice& value);
-  // List all keys stored in a given epoch range.
+  // List all keys stored in a given epoch range. Keys are reported in
+  // storage order unless op.ordered is set.
   // Report operation stats in *table_seeks, *seeks, and *n.
   // Return OK on success, or a non-OK status on errors.
   virtual Status Scan(const ScanOp& op, ScanSaver, void*) = 0;
 
+  // Estimate the number of keys a scan of op.key_start to op.key_end over
+  // op's epoch range would report without reading any data blocks. Estimates
+  // are derived from per-table key samples when the directory is written
+  // with DirOptions::table_key_samples, and are otherwise limited to table
+  // key ranges. Useful for ordering or splitting scans by selectivity.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status EstimateCount(const ScanOp& op, size_t* result) = 0;
+
+  // Report the space taken by each epoch of each memtable partition, along
+  // with the directory total, by walking the indexes of all partitions.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status GetSpaceReport(DirSpaceReport* report) = 0;
+
   // Return the aggregated I/O stats accumulated so far.
   virtual IoStats TEST_iostats() const = 0;
 
@@ -172,5 +344,100 @@ class DirReader {
   DirReader(const DirReader&);
 };
 
+// Read a set of plfs-style directories, typically one per writer rank, as
+// a single directory. Directories are opened on demand and at most
+// options.max_open_dirs of them are kept open at a time, with the least
+// recently used ones closed first. Keys are routed to candidate directories
+// using their filters, and candidates are read in parallel.
+class MultiDirReader {
+ public:
+  MultiDirReader() {}
+  virtual ~MultiDirReader();
+
+  // Open a reader against a set of "n" directories, where dirnames[i] has
+  // been written by rank ranks[i]. No directory is opened at this point.
+  // Return OK on success, or a non-OK status on errors.
+  static Status Open(const DirOptions& options, const std::string* dirnames,
+                     const int* ranks, size_t n, MultiDirReader** result);
+
+  // Default: fetch all epochs
+  struct ReadOp {
+    ReadOp();
+    void SetEpoch(int epoch);
+    uint32_t epoch_start;
+    uint32_t epoch_end;
+    // If not NULL, the number of directories whose filters indicate that
+    // they may store the key is reported here.
+    // Default: NULL
+    size_t* num_candidates;
+  };
+  // Obtain the value to a specific key stored in a given epoch range across
+  // all directories. The filters of each directory are checked first, and
+  // only directories that may store the key are read. Directories are
+  // probed through options.reader_pool, or env threads if allowed, and
+  // values found are appended to *dst in directory order.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status Read(const ReadOp& op, const Slice& fid, std::string* dst) = 0;
+
+  // Return the number of directories that are currently open.
+  virtual size_t TEST_num_open_dirs() const = 0;
+
+ private:
+  // No copying allowed
+  void operator=(const MultiDirReader&);
+  MultiDirReader(const MultiDirReader&);
+};
+
+// Default: merge up to 4 partitions at a time
+struct CompactDirOp {
+  CompactDirOp();
+  // Max number of source partitions merged at the same time. Each merge runs
+  // in a dedicated env thread. Set to 1 to merge partitions in the calling
+  // thread one after another.
+  int max_parallel_merges;
+  // If not NULL, the total number of keys written is reported here.
+  size_t* n;
+};
+
+// Rewrite the finished directory at "src" into a new directory at "dst"
+// that stores all of its contents as a single epoch. Keys of each source
+// partition are merged across all epochs and tables in key order and each
+// key is written once, with a value listing every (epoch, value) pair found
+// for it in epoch order. Such values are decoded by GetCompactedValue().
+// Tables and filters of the new directory are built through a regular
+// directory writer using "options", with options stored in the source
+// footer taking precedence. Return OK on success, or a non-OK status on errors.
+extern Status CompactDir(const DirOptions& options, const std::string& src,
+                         const std::string& dst, const CompactDirOp& op);
+
+// Decode the next (epoch, value) pair from "*input", a value written by
+// CompactDir(), and advance "*input" past it. Return false if "*input"
+// is empty or malformed.
+extern bool GetCompactedValue(Slice* input, uint32_t* epoch, Slice* value);
+
+// Default: scan up to 4 partitions at a time
+struct SortDirOp {
+  SortDirOp();
+  // Max number of source partitions scanned at the same time. Each scan runs
+  // in a dedicated env thread. Set to 1 to scan partitions in the calling
+  // thread one after another.
+  int max_parallel_scans;
+  // If not NULL, the total number of entries written is reported here.
+  size_t* n;
+};
+
+// Rewrite the finished kDmUniqueUnordered or kDmMultiMapUnordered directory
+// at "src" into a new directory at "dst" written in the corresponding
+// ordered mode, kDmUniqueKey or kDmMultiMap. Every epoch of the source
+// is written to the same epoch of the new directory, whose tables are
+// sorted and indexed so reads no longer need to scan tables in full.
+// This lets writers keep the cheap ingest of unordered modes and sort
+// their output after the fact. Tables and filters of the new directory are
+// built through a regular directory writer using "options", with options
+// stored in the source footer taking precedence.
+// Return OK on success, or a non-OK status on errors.
+extern Status SortDir(const DirOptions& options, const std::string& src,
+                      const std::string& dst, const SortDirOp& op);
+
 }  // namespace plfsio
 }  // namespace pdlfs
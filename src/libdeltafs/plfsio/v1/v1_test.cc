@@ -12,34 +12,27 @@
 #include "events.h"
 #include "filter.h"
 #include "internal.h"
+#include "memory.h"
+#include "perf.h"
+#include "pmem.h"
+#include "sorter.h"
+#include "trace.h"
 #include "v1.h"
 
+#include "pdlfs-common/hash.h"
 #include "pdlfs-common/histogram.h"
+#include "pdlfs-common/metrics.h"
 #include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/osd.h"
 #include "pdlfs-common/port.h"
+#include "pdlfs-common/rate_limiter.h"
 #include "pdlfs-common/testharness.h"
 #include "pdlfs-common/testutil.h"
-#include "pdlfs-common/xxhash.h"
-
-#include <stdlib.h>
-#ifdef PDLFS_PLATFORM_POSIX
-#ifdef PDLFS_OS_LINUX
-#include <sched.h>
-#include <sys/types.h>
-#endif
-#include <sys/resource.h>
-#include <sys/time.h>
-#endif
 
 #include <algorithm>
 #include <map>
 #include <set>
 #include <vector>
-#if __cplusplus >= 201103
-#define OVERRIDE override
-#else
-#define OVERRIDE
-#endif
 
 namespace pdlfs {
 namespace plfsio {
@@ -91,6 +84,19 @@ class WriteBufTest {
     ASSERT_TRUE(key == kv_.rbegin()->first);
   }
 
+  // Verify that all entries are returned in key order.
+  void CheckOrder(Iterator* iter) {
+    std::map<std::string, std::string>::iterator it = kv_.begin();
+    iter->SeekToFirst();
+    for (; it != kv_.end(); ++it) {
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_TRUE(iter->key() == it->first);
+      ASSERT_TRUE(iter->value() == it->second);
+      iter->Next();
+    }
+    ASSERT_FALSE(iter->Valid());
+  }
+
   std::map<std::string, std::string> kv_;
   DirOptions options_;
   WriteBuffer* buf_;
@@ -111,6 +117,106 @@ TEST(WriteBufTest<>, FixedSizedValue) {
   delete iter;
 }
 
+TEST(WriteBufTest<>, RadixSort) {
+  Random rnd(301);
+  const int num_entries = 10000;
+  for (int i = 0; i < num_entries; i++) {
+    Add(rnd.Next64());
+  }
+  Iterator* iter = Flush();
+  CheckOrder(iter);
+  delete iter;
+}
+
+TEST(WriteBufTest<>, DenseIntegerKeys) {
+  // Sequential ids only vary in their lowest bytes so most digits are skipped
+  const int num_entries = 10000;
+  std::vector<uint64_t> ids;
+  for (int i = 0; i < num_entries; i++) {
+    ids.push_back(1000000 + i);
+  }
+  Random rnd(301);
+  for (int i = num_entries - 1; i > 0; i--) {
+    std::swap(ids[i], ids[rnd.Uniform(i + 1)]);
+  }
+  for (int i = 0; i < num_entries; i++) {
+    Add(ids[i]);
+  }
+  Iterator* iter = Flush();
+  CheckOrder(iter);
+  delete iter;
+}
+
+TEST(WriteBufTest<>, ParaRadixSort) {
+  ThreadPool* const pool = ThreadPool::NewFixed(4, true);
+  options_.compaction_pool = pool;
+  options_.parallel_sorts = true;
+  Random rnd(301);
+  const int num_entries = 64 << 10;
+  for (int i = 0; i < num_entries; i++) {
+    Add(rnd.Next64());
+  }
+  Iterator* iter = Flush();
+  CheckOrder(iter);
+  delete iter;
+  delete pool;
+}
+
+TEST(WriteBufTest<>, KeySorter) {
+  KeySorter* const sorter = KeySorter::NewCpuSorter();
+  options_.key_sorter = sorter;
+  Random rnd(301);
+  const int num_entries = 10000;
+  for (int i = 0; i < num_entries; i++) {
+    Add(rnd.Next64());
+  }
+  Iterator* iter = Flush();
+  CheckOrder(iter);
+  delete iter;
+  delete sorter;
+}
+
+namespace {
+// A sorter that declines all sorts.
+class UnavailableKeySorter : public KeySorter {
+ public:
+  UnavailableKeySorter() : calls(0) {}
+  virtual Status Sort(const char* keys, size_t key_size, uint32_t n,
+                      uint32_t* perm) {
+    calls++;
+    return Status::NotSupported("No device");
+  }
+  int calls;
+};
+}  // namespace
+
+TEST(WriteBufTest<>, DeclinedKeySorter) {
+  UnavailableKeySorter sorter;
+  options_.key_sorter = &sorter;
+  Random rnd(301);
+  const int num_entries = 1000;
+  for (int i = 0; i < num_entries; i++) {
+    Add(rnd.Next64());
+  }
+  Iterator* iter = Flush();
+  CheckOrder(iter);
+  delete iter;
+  ASSERT_EQ(sorter.calls, 1);
+}
+
+TEST(WriteBufTest<>, MemoryBudget) {
+  const size_t budget = 1 << 20;
+  buf_->Reserve(WriteBuffer::RecordMemory(options_, budget));
+  // Both the records and the entry array indexing them fit in the budget
+  ASSERT_LE(buf_->memory_usage(), budget + 64);
+  Random rnd(301);
+  while (buf_->CurrentBufferSize() + 64 <
+         WriteBuffer::RecordMemory(options_, budget)) {
+    Add(rnd.Next64());
+  }
+  ASSERT_LE(buf_->memory_usage(), budget + 64);
+}
+
 class PlfsIoTest {
  public:
   PlfsIoTest() {
@@ -245,6 +351,99 @@ TEST(PlfsIoTest, SingleEpoch) {
   ASSERT_EQ(Count(1), 0);
 }
 
+TEST(PlfsIoTest, LatencyStats) {
+  DirLatencyStats lat;
+  options_.latency_stats = &lat;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  Append("k3", "v3");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1");
+  ASSERT_TRUE(Read("k4").empty());
+  Histogram hist;
+  lat.put.Snapshot(&hist);
+  ASSERT_EQ(hist.Count(), 3);
+  lat.get.Snapshot(&hist);
+  ASSERT_EQ(hist.Count(), 2);
+  lat.compaction.Snapshot(&hist);
+  ASSERT_TRUE(hist.Count() >= 1);
+  delete writer_;
+  writer_ = NULL;
+  delete reader_;
+  reader_ = NULL;
+}
+
+TEST(PlfsIoTest, Tracing) {
+  DirTracer tracer;
+  options_.tracer = &tracer;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1");
+  delete writer_;
+  writer_ = NULL;
+  std::vector<TraceSpan> spans;
+  tracer.GetSpans(&spans);
+  std::set<std::string> names;
+  for (size_t i = 0; i < spans.size(); i++) {
+    names.insert(spans[i].name);
+    ASSERT_TRUE(spans[i].tid != 0);
+  }
+  ASSERT_TRUE(names.count("compaction") != 0);
+  ASSERT_TRUE(names.count("table_build") != 0);
+  ASSERT_TRUE(names.count("data_log_write") != 0);
+  ASSERT_TRUE(names.count("index_log_write") != 0);
+  std::string json = tracer.ToChromeJson(3);
+  ASSERT_TRUE(Slice(json).starts_with("{\"traceEvents\":[{\"name\":"));
+  ASSERT_TRUE(json.find("\"ph\":\"X\",\"pid\":3,") != std::string::npos);
+  delete reader_;
+  reader_ = NULL;
+}
+
+TEST(PlfsIoTest, TraceRing) {
+  DirTracer tracer(2);
+  tracer.Record("a", 1, 2);
+  tracer.Record("b", 2, 4);
+  tracer.Record("c", 4, 8);
+  ASSERT_EQ(tracer.NumDropped(), 1);
+  std::vector<TraceSpan> spans;
+  tracer.GetSpans(&spans);
+  ASSERT_EQ(spans.size(), 2);
+  ASSERT_EQ(std::string(spans[0].name), "b");
+  ASSERT_EQ(spans[1].dur_micros, 4);
+}
+
+TEST(PlfsIoTest, PerfCounters) {
+  MetricsRegistry registry;
+  DirPerfCounters perf(&registry, "test.perf");
+  options_.perf_counters = &perf;
+  options_.bf_bits_per_key = 10;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1");
+  ASSERT_TRUE(Read("k3").empty());
+  // Finishing the directory compacts an empty buffer as well
+  ASSERT_TRUE(perf.Get(kPerfSort).count != 0);
+  ASSERT_TRUE(perf.Get(kPerfTableBuild).count != 0);
+  ASSERT_TRUE(perf.Get(kPerfFilterBuild).count != 0);
+  ASSERT_EQ(perf.Get(kPerfFilterProbe).count, 2);
+  ASSERT_EQ(perf.Get(kPerfBlockRead).count, 1);
+  ASSERT_EQ(perf.Get(kPerfBlockSearch).count, 1);
+  uint64_t val;
+  ASSERT_TRUE(registry.GetValue("test.perf.block_read.count", &val));
+  ASSERT_EQ(val, 1);
+  ASSERT_TRUE(registry.GetValue("test.perf.block_read.cycles", &val));
+  if (DirPerfCounters::HardwareCountersAvailable()) {
+    ASSERT_TRUE(perf.Get(kPerfTableBuild).instructions != 0);
+    ASSERT_TRUE(perf.Get(kPerfBlockSearch).cycles != 0);
+  } else {
+    ASSERT_EQ(perf.Get(kPerfTableBuild).instructions, 0);
+  }
+  delete reader_;
+  reader_ = NULL;
+}
+
 TEST(PlfsIoTest, MultiEpoch) {
   Append("k1", "v1");
   Append("k2", "v2");
@@ -295,6 +494,273 @@ TEST(PlfsIoTest, ArrayBlockFmt) {
   ASSERT_EQ(Count(3), 0);
 }
 
+TEST(PlfsIoTest, ColumnarBlockFmt) {
+  options_.leveldb_compatible = false;
+  options_.fixed_kv_length = true;
+  options_.value_size = 10;
+  options_.key_size = 8;
+  options_.value_column_width = 4;  // 4 + 4 + 2 bytes
+  const ColumnEncoding encodings[] = {kCeNone, kCeXor, kCeDelta};
+  for (size_t e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++) {
+    options_.column_encoding = encodings[e];
+    char k[9], v[10];
+    for (uint32_t i = 0; i < 3000; i++) {
+      snprintf(k, sizeof(k), "k%07u", i);
+      EncodeFixed32(v, i * 3);
+      EncodeFixed32(v + 4, 0xfffff000u + i);
+      v[8] = char(i);
+      v[9] = char(255 - i);
+      Append(Slice(k, 8), Slice(v, 10));
+    }
+    MakeEpoch();
+    for (uint32_t i = 0; i < 3000; i += 13) {
+      snprintf(k, sizeof(k), "k%07u", i);
+      std::string val = Read(Slice(k, 8));
+      ASSERT_EQ(val.size(), 10);
+      ASSERT_EQ(DecodeFixed32(val.data()), i * 3);
+      ASSERT_EQ(DecodeFixed32(val.data() + 4), 0xfffff000u + i);
+      ASSERT_EQ(val[8], char(i));
+      ASSERT_EQ(val[9], char(255 - i));
+    }
+    // Only report bytes 6 through 9 of each value
+    std::string tmp;
+    SaverState state;
+    state.tmp = &tmp;
+    DirReader::ScanOp op;
+    op.SetEpoch(0);
+    op.value_offset = 6;
+    op.value_length = 3;
+    ASSERT_OK(reader_->Scan(op, SaveValue, &state));
+    ASSERT_EQ(tmp.size(), 3000 * 3);
+    for (uint32_t i = 0; i < 3000; i++) {
+      EncodeFixed32(v + 4, 0xfffff000u + i);
+      v[8] = char(i);
+      ASSERT_EQ(Slice(tmp.data() + i * 3, 3), Slice(v + 6, 3));
+    }
+    delete reader_;
+    reader_ = NULL;
+    epoch_ = 0;
+  }
+}
+
+TEST(PlfsIoTest, GroupVarintBlockFmt) {
+  options_.leveldb_compatible = false;
+  options_.fixed_kv_length = false;
+  const std::string v1(300, 'x');      // 2-byte length
+  const std::string v2(70000, 'y');    // 3-byte length
+  char tmp[20];
+  Append("k1", "v1");
+  Append("k2", v1);
+  Append("k3", v2);
+  for (int i = 0; i < 1000; i++) {  // Many restart points
+    snprintf(tmp, sizeof(tmp), "k4.%04d", i);
+    Append(Slice(tmp), Slice(tmp, 4 + i % 3));
+  }
+  MakeEpoch();
+  Append("k1", "v3");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1v3");
+  ASSERT_EQ(Read("k2"), v1);
+  ASSERT_EQ(Read("k3"), v2);
+  ASSERT_TRUE(Read("k1.1").empty());
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "k4.%04d", i);
+    ASSERT_EQ(Read(Slice(tmp)), std::string(tmp, 4 + i % 3));
+  }
+  ASSERT_EQ(Scan(1), "v3");
+  ASSERT_EQ(Count(0), 1003);
+  ASSERT_EQ(Count(1), 1);
+}
+
+TEST(PlfsIoTest, InterpolationSearch) {
+  options_.leveldb_compatible = false;
+  options_.fixed_kv_length = true;
+  options_.interpolation_search = true;
+  options_.value_size = 4;
+  options_.key_size = 8;
+  char tmp[16];
+  for (uint32_t i = 0; i < 4000; i++) {
+    // Uniform keys followed by a skewed tail
+    uint64_t k = i < 3000 ? uint64_t(i) * 7919 : (uint64_t(1) << 40) + i;
+    for (int j = 0; j < 8; j++) tmp[j] = char(k >> (56 - 8 * j));
+    Append(Slice(tmp, 8), Slice(tmp + 4, 4));
+  }
+  MakeEpoch();
+  for (uint32_t i = 0; i < 4000; i += 7) {
+    uint64_t k = i < 3000 ? uint64_t(i) * 7919 : (uint64_t(1) << 40) + i;
+    for (int j = 0; j < 8; j++) tmp[j] = char(k >> (56 - 8 * j));
+    ASSERT_EQ(Read(Slice(tmp, 8)), Slice(tmp + 4, 4));
+    tmp[7]++;  // Missing key
+    if (i < 3000) ASSERT_TRUE(Read(Slice(tmp, 8)).empty());
+  }
+}
+
+TEST(PlfsIoTest, EctIndex) {
+  options_.leveldb_compatible = false;
+  options_.fixed_kv_length = true;
+  options_.ect_index = true;
+  options_.block_size = 1 << 10;
+  options_.value_size = 4;
+  options_.key_size = 8;
+  char tmp[16];
+  for (uint32_t i = 0; i < 5000; i++) {
+    uint64_t k = uint64_t(i) * 2654435761u;
+    for (int j = 0; j < 8; j++) tmp[j] = char(k >> (56 - 8 * j));
+    Append(Slice(tmp, 8), Slice(tmp + 4, 4));
+  }
+  MakeEpoch();
+  for (uint32_t i = 0; i < 5000; i += 3) {
+    uint64_t k = uint64_t(i) * 2654435761u;
+    for (int j = 0; j < 8; j++) tmp[j] = char(k >> (56 - 8 * j));
+    ASSERT_EQ(Read(Slice(tmp, 8)), Slice(tmp + 4, 4));
+    tmp[7]++;  // Missing key
+    ASSERT_TRUE(Read(Slice(tmp, 8)).empty());
+  }
+  ASSERT_TRUE(Read("k1").empty());
+  ASSERT_EQ(Count(0), 5000);
+}
+
+TEST(PlfsIoTest, InterpolationSearch16) {
+  options_.leveldb_compatible = false;
+  options_.fixed_kv_length = true;
+  options_.interpolation_search = true;
+  options_.value_size = 2;
+  options_.key_size = 16;
+  char tmp[20];
+  for (int i = 0; i < 2000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%015d", i * 3);
+    Append(Slice(tmp, 16), Slice(tmp + 14, 2));
+  }
+  MakeEpoch();
+  for (int i = 0; i < 2000; i += 3) {
+    snprintf(tmp, sizeof(tmp), "k%015d", i * 3);
+    ASSERT_EQ(Read(Slice(tmp, 16)), Slice(tmp + 14, 2));
+    snprintf(tmp, sizeof(tmp), "k%015d", i * 3 + 1);
+    ASSERT_TRUE(Read(Slice(tmp, 16)).empty());
+  }
+}
+
+TEST(PlfsIoTest, BlockedBloomFilter) {
+  options_.filter = kFtBlockedBloomFilter;
+  options_.bf_bits_per_key = 10;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k3", "v3");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1");
+  ASSERT_EQ(Read("k2"), "v2");
+  ASSERT_EQ(Read("k3"), "v3");
+  ASSERT_TRUE(Read("k1.1").empty());
+  ASSERT_TRUE(Read("k4").empty());
+}
+
+TEST(PlfsIoTest, XorFilter) {
+  options_.filter = kFtXorFilter;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k3", "v3");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1");
+  ASSERT_EQ(Read("k2"), "v2");
+  ASSERT_EQ(Read("k3"), "v3");
+  ASSERT_TRUE(Read("k1.1").empty());
+  ASSERT_TRUE(Read("k4").empty());
+}
+
+TEST(PlfsIoTest, GcsFilter) {
+  options_.filter = kFtGcsFilter;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k3", "v3");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1");
+  ASSERT_EQ(Read("k2"), "v2");
+  ASSERT_EQ(Read("k3"), "v3");
+  ASSERT_TRUE(Read("k1.1").empty());
+  ASSERT_TRUE(Read("k4").empty());
+}
+
+TEST(PlfsIoTest, PartitionedFilters) {
+  options_.filter_partition_keys = 64;
+  options_.bf_bits_per_key = 10;
+  char tmp[10];
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", 2 * i);
+    Append(Slice(tmp), tmp);
+  }
+  MakeEpoch();
+  Append("k0000001", "v1");
+  MakeEpoch();
+  Finish();
+  // Readers learn from the footer that filters are partitioned
+  options_.filter_partition_keys = 0;
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", 2 * i);
+    ASSERT_EQ(Read(Slice(tmp)), tmp);
+  }
+  ASSERT_EQ(Read("k0000001"), "v1");
+  ASSERT_TRUE(Read("k0000003").empty());
+  ASSERT_TRUE(Read("k9999999").empty());
+  std::string tmp2;
+  QueryStats stats;
+  DirReader::ReadOp op;
+  op.stats = &stats;
+  size_t false_positives = 0;
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", 2 * i + 1);
+    ASSERT_OK(reader_->Read(op, Slice(tmp), &tmp2));
+    false_positives += stats.filter_false_positives;
+  }
+  ASSERT_TRUE(tmp2 == "v1");
+  ASSERT_TRUE(false_positives < 50);
+}
+
+TEST(PlfsIoTest, OptimalFilterBits) {
+  options_.bf_bits_per_key = 8;
+  char tmp[10];
+  size_t false_positives[2];
+  uint64_t filter_size[2];
+  for (int run = 0; run < 2; run++) {
+    options_.bf_optimal_bits = (run == 1);
+    // Full tables interleaved with small epoch tail tables, all covering
+    // the same key range so that lookups probe every filter
+    for (int e = 0; e < 8; e++) {
+      const int stride = (e % 2 == 0) ? 1 : 80;
+      for (int i = 0; i < 4000; i += stride) {
+        snprintf(tmp, sizeof(tmp), "k%07d", 16 * i + 2 * e);
+        Append(Slice(tmp), tmp);
+      }
+      MakeEpoch();
+    }
+    Finish();
+    ASSERT_EQ(Read("k0000000"), "k0000000");
+    ASSERT_EQ(Read("k0063996"), "k0063996");
+    DirSpaceReport report;
+    ASSERT_OK(reader_->GetSpaceReport(&report));
+    filter_size[run] = report.total.filter_size;
+    std::string tmp2;
+    QueryStats stats;
+    DirReader::ReadOp op;
+    op.stats = &stats;
+    false_positives[run] = 0;
+    for (int i = 0; i < 4000; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", 16 * i + 1);
+      ASSERT_OK(reader_->Read(op, Slice(tmp), &tmp2));
+      ASSERT_TRUE(tmp2.empty());
+      false_positives[run] += stats.filter_false_positives;
+    }
+    delete reader_;
+    reader_ = NULL;
+    epoch_ = 0;
+  }
+  // Same filter space, fewer false positives
+  ASSERT_TRUE(filter_size[1] <= filter_size[0] + filter_size[0] / 100);
+  ASSERT_TRUE(false_positives[1] < false_positives[0]);
+}
+
 TEST(PlfsIoTest, Unordered) {
   options_.mode = kDmUniqueUnordered;
   Append("k2", "v2");
@@ -345,6 +811,30 @@ TEST(PlfsIoTest, UnorderedWithArrayBlockFmt) {
   ASSERT_EQ(Count(3), 0);
 }
 
+TEST(PlfsIoTest, UnorderedWithKeyIndex) {
+  options_.mode = kDmUniqueUnordered;
+  options_.leveldb_compatible = false;
+  options_.fixed_kv_length = true;
+  options_.key_index = true;
+  options_.value_size = 4;
+  options_.key_size = 8;
+  char tmp[16];
+  for (uint32_t i = 0; i < 3000; i++) {
+    uint64_t k = uint64_t(i) * 2654435761u;
+    for (int j = 0; j < 8; j++) tmp[j] = char(k >> (56 - 8 * j));
+    Append(Slice(tmp, 8), Slice(tmp + 4, 4));
+  }
+  MakeEpoch();
+  for (uint32_t i = 0; i < 3000; i += 3) {
+    uint64_t k = uint64_t(i) * 2654435761u;
+    for (int j = 0; j < 8; j++) tmp[j] = char(k >> (56 - 8 * j));
+    ASSERT_EQ(Read(Slice(tmp, 8)), Slice(tmp + 4, 4));
+    tmp[7]++;  // Missing key
+    ASSERT_TRUE(Read(Slice(tmp, 8)).empty());
+  }
+  ASSERT_EQ(Count(0), 3000);
+}
+
 TEST(PlfsIoTest, Snappy1) {
   options_.compression = kSnappyCompression;
   options_.force_compression = true;
@@ -393,52 +883,22 @@ TEST(PlfsIoTest, Snappy2) {
   ASSERT_EQ(Count(3), 0);
 }
 
-TEST(PlfsIoTest, LargeBatch) {
-  const std::string dummy_val(32, 'x');
-  const int batch_size = 64 << 10;
-  char tmp[10];
-  for (int i = 0; i < batch_size; i++) {
-    snprintf(tmp, sizeof(tmp), "k%07d", i);
-    Append(Slice(tmp), dummy_val);
-  }
-  MakeEpoch();
-  for (int i = 0; i < batch_size; i++) {
-    snprintf(tmp, sizeof(tmp), "k%07d", i);
-    Append(Slice(tmp), dummy_val);
-  }
-  MakeEpoch();
-  for (int i = 0; i < batch_size; i++) {
-    snprintf(tmp, sizeof(tmp), "k%07d", i);
-    ASSERT_EQ(Read(Slice(tmp)).size(), dummy_val.size() * 2) << tmp;
-    if (i % 1024 == 1023) {
-      fprintf(stderr, "key [%07d-%07d): OK\n", i - 1023, i + 1);
-    }
-  }
-  ASSERT_TRUE(Read("kx").empty());
-}
-
-TEST(PlfsIoTest, NoFilter) {
-  options_.bf_bits_per_key = 0;
+TEST(PlfsIoTest, Zstd) {
+  options_.compression = kZstdCompression;
+  options_.index_compression = kZstdCompression;
+  options_.force_compression = true;
   Append("k1", "v1");
   Append("k2", "v2");
   MakeEpoch();
-  Append("k3", "v3");
-  Append("k4", "v4");
+  Append("k1", "v3");
+  Append("k2", "v4");
   MakeEpoch();
-  Append("k5", "v5");
-  Append("k6", "v6");
+  Append("k1", "v5");
+  Append("k2", "v6");
   MakeEpoch();
-  ASSERT_EQ(Read("k1"), "v1");
+  ASSERT_EQ(Read("k1"), "v1v3v5");
   ASSERT_TRUE(Read("k1.1").empty());
-  ASSERT_EQ(Read("k2"), "v2");
-  ASSERT_TRUE(Read("k2.1").empty());
-  ASSERT_EQ(Read("k3"), "v3");
-  ASSERT_TRUE(Read("k3.1").empty());
-  ASSERT_EQ(Read("k4"), "v4");
-  ASSERT_TRUE(Read("k4.1").empty());
-  ASSERT_EQ(Read("k5"), "v5");
-  ASSERT_TRUE(Read("k5.1").empty());
-  ASSERT_EQ(Read("k6"), "v6");
+  ASSERT_EQ(Read("k2"), "v2v4v6");
   ASSERT_EQ(Scan(0), "v1v2");
   ASSERT_EQ(Scan(1), "v3v4");
   ASSERT_EQ(Scan(2), "v5v6");
@@ -448,1190 +908,2054 @@ TEST(PlfsIoTest, NoFilter) {
   ASSERT_EQ(Count(3), 0);
 }
 
-TEST(PlfsIoTest, LogRotation) {
-  options_.epoch_log_rotation = true;
+TEST(PlfsIoTest, Lz4) {
+  options_.compression = kLz4Compression;
+  options_.index_compression = kLz4Compression;
+  options_.force_compression = true;
   Append("k1", "v1");
+  Append("k2", "v2");
   MakeEpoch();
-  Append("k1", "v1");
+  Append("k1", "v3");
+  Append("k2", "v4");
   MakeEpoch();
-  Append("k1", "v1");
+  Append("k1", "v5");
+  Append("k2", "v6");
   MakeEpoch();
-  Finish();
+  ASSERT_EQ(Read("k1"), "v1v3v5");
+  ASSERT_TRUE(Read("k1.1").empty());
+  ASSERT_EQ(Read("k2"), "v2v4v6");
+  ASSERT_EQ(Scan(0), "v1v2");
+  ASSERT_EQ(Scan(1), "v3v4");
+  ASSERT_EQ(Scan(2), "v5v6");
+  ASSERT_EQ(Count(0), 2);
+  ASSERT_EQ(Count(1), 2);
+  ASSERT_EQ(Count(2), 2);
+  ASSERT_EQ(Count(3), 0);
 }
 
-TEST(PlfsIoTest, MultiMap) {
-  options_.mode = kDmMultiMap;
+TEST(PlfsIoTest, XxhashChecksums) {
+  options_.checksum_type = kCsXxhash64;
+  options_.index_compression = kSnappyCompression;
   Append("k1", "v1");
-  Append("k1", "v2");
-  MakeEpoch();
-  Append("k0", "v3");
-  Append("k1", "v4");
-  Append("k1", "v5");
-  MakeEpoch();
-  Append("k1", "v6");
-  Append("k1", "v7");
-  Append("k5", "v8");
+  Append("k2", "v2");
   MakeEpoch();
-  Append("k1", "v9");
+  Append("k1", "v3");
+  Append("k2", "v4");
   MakeEpoch();
-  ASSERT_EQ(Read("k1"), "v1v2v4v5v6v7v9");
+  Finish();
+  // Readers learn the checksum type from the directory footer
+  options_.checksum_type = kCsCrc32c;
+  ASSERT_EQ(Read("k1"), "v1v3");
+  ASSERT_EQ(Read("k2"), "v2v4");
+  ASSERT_EQ(Scan(1), "v3v4");
+  ASSERT_EQ(Count(0), 2);
 }
 
-namespace {
-
-class WriteLock {
- public:
-  WriteLock() : cv_(&mu_), on_(false) {}
+TEST(PlfsIoTest, LargeBatch) {
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 64 << 10;
+  char tmp[10];
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(Slice(tmp), dummy_val);
+  }
+  MakeEpoch();
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(Slice(tmp), dummy_val);
+  }
+  MakeEpoch();
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)).size(), dummy_val.size() * 2) << tmp;
+    if (i % 1024 == 1023) {
+      fprintf(stderr, "key [%07d-%07d): OK\n", i - 1023, i + 1);
+    }
+  }
+  ASSERT_TRUE(Read("kx").empty());
+}
 
-  void Acquire() {
-    MutexLock ml(&mu_);
-    while (on_) cv_.Wait();
-    on_ = true;
+TEST(PlfsIoTest, MemtableRing) {
+  ThreadPool* const pool = ThreadPool::NewFixed(2, true);
+  options_.compaction_pool = pool;
+  options_.num_memtables = 4;
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 64 << 10;
+  char tmp[10];
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(Slice(tmp), dummy_val);
+  }
+  MakeEpoch();
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val) << tmp;
   }
+  ASSERT_EQ(Count(0), size_t(batch_size));
+  delete pool;
+}
 
-  void Release() {
-    MutexLock ml(&mu_);
-    on_ = false;
-    cv_.SignalAll();
+namespace {
+class PressureListener : public EventListener {
+ public:
+  PressureListener() : num_high(0), num_low(0) {}
+
+  virtual void OnEvent(EventType type, void* event) {
+    MutexLock ml(&mu);
+    if (type == kWritePressureHigh) {
+      num_high++;
+    } else if (type == kWritePressureLow) {
+      num_low++;
+    }
   }
 
- private:
-  port::Mutex mu_;
-  port::CondVar cv_;
-  bool on_;
+  port::Mutex mu;
+  int num_high;
+  int num_low;
 };
-
-class EmulatedWritableFile : public WritableFileWrapper {
- public:
-  explicit EmulatedWritableFile(uint64_t bytes_ps, WriteLock* wl = NULL,
-                                Histogram* hist = NULL,
-                                EventListener* lis = NULL)
-      : lis_(lis),
-        prev_write_micros_(0),
-        hist_(hist),
-        wl_(wl),
-        bytes_ps_(bytes_ps) {}
-  virtual ~EmulatedWritableFile() {}
-
-  void EmulateWrite(const Slice& data) {
-    const uint64_t now_micros = CurrentMicros();
-    if (hist_ != NULL && prev_write_micros_ != 0) {
-      hist_->Add(now_micros - prev_write_micros_);
+}  // namespace
+
+TEST(PlfsIoTest, AdaptiveMemtables) {
+  options_.total_memtable_budget = 4 << 20;
+  options_.lg_parts = 2;
+  options_.adaptive_memtables = true;
+  OpenWriter();
+  const uint64_t even_size = writer_->TEST_estimated_sstable_size();
+  char tmp[20];
+  const std::string value(64, 'x');
+  std::string first_key;
+  size_t n = 0;
+  // Insert keys that all belong to partition 0
+  for (int i = 0; n < 120000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%08d", i);
+    if ((Hash(tmp, strlen(tmp), 0) & 3) == 0) {
+      if (first_key.empty()) first_key = tmp;
+      Append(Slice(tmp), value);
+      n++;
     }
-    prev_write_micros_ = now_micros;
-    if (lis_ != NULL) {
-      IoEvent event;
-      event.type = kIoStart;
-      event.micros = now_micros;
-      lis_->OnEvent(event.type, &event);
+  }
+  ASSERT_TRUE(writer_->TEST_estimated_sstable_size() > 3 * even_size);
+  MakeEpoch();
+  ASSERT_EQ(Read(first_key), value);
+  ASSERT_EQ(Count(0), n);
+}
+
+namespace {
+bool HasTuningDecision(const std::vector<std::string>& log,
+                       const char* prefix) {
+  for (size_t i = 0; i < log.size(); i++) {
+    if (Slice(log[i]).starts_with(prefix)) {
+      return true;
     }
-    const int micros_to_delay =
-        static_cast<int>(1000 * 1000 * data.size() / bytes_ps_);
-    SleepForMicroseconds(micros_to_delay);
-    if (lis_ != NULL) {
-      IoEvent event;
-      event.type = kIoEnd;
-      event.micros = CurrentMicros();
-      lis_->OnEvent(event.type, &event);
+  }
+  return false;
+}
+}  // namespace
+
+TEST(PlfsIoTest, AutoTune) {
+  options_.block_size = 4 << 10;
+  options_.block_padding = false;
+  options_.auto_tune = true;
+  OpenWriter();
+  const std::string value(512, 'x');
+  char tmp[20];
+  for (int i = 0; i < 400; i++) {
+    snprintf(tmp, sizeof(tmp), "k%08d", i);
+    Append(Slice(tmp), value);
+    if (i == 199) {
+      MakeEpoch();
     }
   }
+  std::vector<std::string> log;
+  writer_->GetTuningLog(&log);
+  ASSERT_TRUE(HasTuningDecision(log, "Dfs.plfsdir.auto_tune: epoch 0"));
+  ASSERT_TRUE(HasTuningDecision(log, "Dfs.plfsdir.block_size -> 64"));
+  ASSERT_TRUE(HasTuningDecision(log, "Dfs.plfsdir.value_size: 512"));
+  MakeEpoch();
+  ASSERT_OK(writer_->Wait());
+  // Each epoch takes about 29 blocks of 4KB. Blocks of epoch 1 are 16 times
+  // larger.
+  ASSERT_LT(writer_->TEST_num_data_blocks(), 45);
+  for (int i = 0; i < 400; i += 37) {
+    snprintf(tmp, sizeof(tmp), "k%08d", i);
+    ASSERT_EQ(Read(tmp), value);
+  }
+}
+
+TEST(PlfsIoTest, WritePressure) {
+  PressureListener listener;
+  options_.listener = &listener;
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 64 << 10;
+  char tmp[10];
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(Slice(tmp), dummy_val);
+  }
+  DirWritePressure p = writer_->GetWritePressure();
+  ASSERT_TRUE(p.buffer_capacity != 0);
+  ASSERT_TRUE(p.buffered_bytes != 0);
+  ASSERT_LE(p.buffered_bytes, p.buffer_capacity);
+  // Compactions run inline so no buffer is left waiting
+  ASSERT_EQ(p.pending_compactions, 0);
+  ASSERT_EQ(p.est_drain_micros, 0);
+  MakeEpoch();
+  Finish();
+  // With double buffering every buffer switch uses up the spare buffer
+  ASSERT_TRUE(listener.num_high != 0);
+  ASSERT_EQ(listener.num_high, listener.num_low);
+}
 
-  virtual Status Append(const Slice& data) OVERRIDE {
-    if (!data.empty()) {
-      if (wl_ != NULL) wl_->Acquire();
-      EmulateWrite(data);
-      if (wl_ != NULL) {
-        wl_->Release();
+// Check that space reports account for every byte of the data and index
+// logs and that writers and readers agree on them.
+static void CheckSpaceReport(const DirOptions& options,
+                             const std::string& dirname,
+                             const DirSpaceReport& writer_report,
+                             const DirSpaceReport& reader_report) {
+  std::vector<std::string> names;
+  ASSERT_OK(options.env->GetChildren(dirname.c_str(), &names));
+  uint64_t total_size = 0;
+  for (size_t i = 0; i < names.size(); i++) {
+    const std::string fname = dirname + "/" + names[i];
+    if (!Slice(names[i]).starts_with("L-")) {
+      continue;  // Not a data or an index log
+    }
+    uint64_t size;
+    ASSERT_OK(options.env->GetFileSize(fname.c_str(), &size));
+    total_size += size;
+  }
+  const DirSpaceStats& w = writer_report.total;
+  const DirSpaceStats& r = reader_report.total;
+  ASSERT_EQ(w.TotalSize(), total_size);
+  ASSERT_EQ(r.TotalSize(), total_size);
+  ASSERT_EQ(w.num_tables, r.num_tables);
+  ASSERT_EQ(w.num_blocks, r.num_blocks);
+  ASSERT_EQ(w.data_size, r.data_size);
+  ASSERT_EQ(w.index_size, r.index_size);
+  ASSERT_EQ(w.filter_size, r.filter_size);
+  ASSERT_EQ(w.checksum_size, r.checksum_size);
+  ASSERT_EQ(w.block_padding_size, r.block_padding_size);
+  ASSERT_EQ(w.tail_padding_size, r.tail_padding_size);
+  ASSERT_EQ(writer_report.epochs.size(), reader_report.epochs.size());
+  for (size_t p = 0; p < writer_report.epochs.size(); p++) {
+    const std::vector<DirSpaceStats>& we = writer_report.epochs[p];
+    const std::vector<DirSpaceStats>& re = reader_report.epochs[p];
+    ASSERT_LE(we.size(), re.size());  // Readers also see trailing empty epochs
+    for (size_t e = 0; e < re.size(); e++) {
+      if (e < we.size()) {
+        ASSERT_EQ(we[e].TotalSize(), re[e].TotalSize());
+        ASSERT_EQ(we[e].num_tables, re[e].num_tables);
+      } else {
+        ASSERT_EQ(re[e].TotalSize(), 0);
       }
     }
-    return status_;
   }
+}
 
- private:
-  EventListener* lis_;
-  uint64_t prev_write_micros_;  // Timestamp of the previous write
-  Histogram* hist_;             // Mean time between writes
-  WriteLock* wl_;
-
-  uint64_t bytes_ps_;  // Bytes per second
-  Status status_;
-};
-
-class EmulatedEnv : public EnvWrapper {
- public:
-  EmulatedEnv(uint64_t bytes_ps, EventListener* lis)
-      : EnvWrapper(Env::Default()), bytes_ps_(bytes_ps), lis_(lis) {}
-
-  virtual ~EmulatedEnv() {
-    HistIter iter = hists_.begin();
-    for (; iter != hists_.end(); ++iter) {
-      delete iter->second;
+TEST(PlfsIoTest, SpaceReport) {
+  ThreadPool* const pool = ThreadPool::NewFixed(2, true);
+  options_.lg_parts = 1;
+  options_.block_size = 4 << 10;
+  options_.block_batch_size = 32 << 10;
+  options_.block_padding = true;
+  options_.tail_padding = true;
+  options_.filter_partition_keys = 1000;
+  options_.bf_bits_per_key = 10;
+  const std::string dummy_val(32, 'x');
+  char tmp[10];
+  for (int run = 0; run < 2; run++) {
+    if (run == 1) {
+      options_.compaction_pool = pool;
+      options_.parallel_compression = true;
+    }
+    for (int i = 0; i < 8000; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(Slice(tmp), dummy_val);
+    }
+    MakeEpoch();
+    MakeEpoch();  // Empty epoch
+    for (int i = 0; i < 200; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(Slice(tmp), dummy_val);
+      if (i == 99) {
+        ASSERT_OK(writer_->Flush(epoch_));
+      }
+    }
+    MakeEpoch();
+    ASSERT_OK(writer_->Finish());
+    DirSpaceReport writer_report;
+    ASSERT_OK(writer_->GetSpaceReport(&writer_report));
+    delete writer_;
+    writer_ = NULL;
+    ASSERT_EQ(writer_report.epochs.size(), 2);
+    for (size_t p = 0; p < writer_report.epochs.size(); p++) {
+      const std::vector<DirSpaceStats>& epochs = writer_report.epochs[p];
+      ASSERT_EQ(epochs.size(), 3);
+      ASSERT_TRUE(epochs[0].num_blocks != 0);
+      ASSERT_TRUE(epochs[0].block_padding_size != 0);
+      ASSERT_TRUE(epochs[0].filter_size != 0);
+      ASSERT_EQ(epochs[1].TotalSize(), 0);
     }
+    ASSERT_EQ(writer_report.epochs[0][2].num_tables +
+                  writer_report.epochs[1][2].num_tables,
+              4);  // Two flushes, each with a table in both partitions
+    ASSERT_TRUE(writer_report.total.tail_padding_size != 0);
+    OpenReader();
+    DirSpaceReport reader_report;
+    ASSERT_OK(reader_->GetSpaceReport(&reader_report));
+    delete reader_;
+    reader_ = NULL;
+    CheckSpaceReport(options_, dirname_, writer_report, reader_report);
+    epoch_ = 0;
   }
+  delete pool;
+}
 
-  virtual Status NewWritableFile(const char* f, WritableFile** r) OVERRIDE {
-    Slice fname(f);
-    if (fname.ends_with(".dat")) {
-      Histogram* hist = new Histogram;
-      hists_.insert(std::make_pair(fname.ToString(), hist));
-      *r = new EmulatedWritableFile(bytes_ps_, &wl_, hist, lis_);
-    } else {
-      *r = new EmulatedWritableFile(bytes_ps_, &wl_);
-    }
-    return Status::OK();
+TEST(PlfsIoTest, NumaPools) {
+  ThreadPool* pools[2];
+  pools[0] = ThreadPool::NewFixed(1, true);
+  pools[1] = ThreadPool::NewFixed(1, true);
+  options_.numa_pools = pools;
+  options_.num_numa_nodes = 2;
+  options_.lg_parts = 1;
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 64 << 10;
+  char tmp[10];
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(Slice(tmp), dummy_val);
   }
+  MakeEpoch();
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val) << tmp;
+  }
+  ASSERT_EQ(Count(0), size_t(batch_size));
+  delete pools[0];
+  delete pools[1];
+}
 
-  const Histogram* GetHist(const char* suffix) {
-    HistIter iter = hists_.begin();
-    for (; iter != hists_.end(); ++iter) {
-      if (Slice(iter->first).ends_with(suffix)) {
-        return iter->second;
-      }
-    }
-    return NULL;
+TEST(PlfsIoTest, HugepageBuffers) {
+  options_.total_memtable_budget = 16 << 20;
+  options_.hugepage_buffers = true;
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 64 << 10;
+  char tmp[10];
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(Slice(tmp), dummy_val);
   }
+  // Huge pages may not be available, but never exceed what is reserved
+  ASSERT_LE(writer_->TEST_hugepage_memory_usage(),
+            writer_->TEST_total_memory_usage());
+  MakeEpoch();
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val) << tmp;
+  }
+}
 
- private:
-  uint64_t bytes_ps_;  // Bytes per second
+TEST(PlfsIoTest, PipelinedCompactions) {
+  ThreadPool* const pool = ThreadPool::NewFixed(4, true);
+  options_.compaction_pool = pool;
+  options_.pipelined_compactions = true;
+  options_.num_memtables = 4;
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 64 << 10;
+  char tmp[10];
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", (i * 7919) % batch_size);
+    Append(Slice(tmp), dummy_val);
+  }
+  MakeEpoch();
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val) << tmp;
+  }
+  ASSERT_EQ(Count(0), size_t(batch_size));
+  delete pool;
+}
 
-  EventListener* lis_;
-  typedef std::map<std::string, Histogram*> HistMap;
-  typedef HistMap::iterator HistIter;
+// A sort queued behind a compaction on the only pool thread must not leave
+// that compaction waiting for it
+TEST(PlfsIoTest, PipelinedCompactionsOnOneThread) {
+  ThreadPool* const pool = ThreadPool::NewFixed(1, true);
+  options_.compaction_pool = pool;
+  options_.pipelined_compactions = true;
+  options_.num_memtables = 4;
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 256 << 10;
+  char tmp[10];
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", (i * 7919) % batch_size);
+    Append(Slice(tmp), dummy_val);
+  }
+  MakeEpoch();
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val) << tmp;
+  }
+  ASSERT_EQ(Count(0), size_t(batch_size));
+  delete pool;
+}
 
-  HistMap hists_;
-  WriteLock wl_;
-};
+TEST(PlfsIoTest, SharedCompactionJobs) {
+  ThreadPool* const pool = ThreadPool::NewFixed(4, true);
+  options_.compaction_pool = pool;
+  options_.max_compaction_jobs = 2;
+  options_.num_memtables = 3;
+  options_.lg_parts = 2;
+  options_.total_memtable_budget = 4 << 20;
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 64 << 10;
+  char tmp[10];
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(Slice(tmp), dummy_val);
+  }
+  MakeEpoch();
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val) << tmp;
+  }
+  ASSERT_EQ(Count(0), size_t(batch_size));
+  delete pool;
+}
 
-}  // anonymous namespace
+// Return a compression type compiled into this build, or kNoCompression if
+// there is none.
+static CompressionType SupportedCompression() {
+  std::string out;
+  Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+  if (port::Snappy_Compress(in.data(), in.size(), &out)) {
+    return kSnappyCompression;
+  } else if (port::Zstd_Compress(in.data(), in.size(), &out)) {
+    return kZstdCompression;
+  } else if (port::Lz4_Compress(in.data(), in.size(), &out)) {
+    return kLz4Compression;
+  } else {
+    return kNoCompression;
+  }
+}
 
-class PlfsIoBench {
- public:
-  static BitmapFormat GetBitmapFilterFormat(BitmapFormat deffmt) {
-    const char* env = getenv("FT_TYPE");
-    if (env == NULL) {
-      return deffmt;
-    } else if (env[0] == 0) {
-      return deffmt;
-    } else if (strcmp(env, "bf") == 0) {
-      return deffmt;
-    } else if (strcmp(env, "bmp") == 0) {
-      return kFmtUncompressed;
-    } else if (strcmp(env, "r") == 0) {
-      return kFmtRoaring;
-    } else if (strcmp(env, "fvbp") == 0) {
-      return kFmtFastVarintPlus;
-    } else if (strcmp(env, "vbp") == 0) {
-      return kFmtVarintPlus;
-    } else if (strcmp(env, "vb") == 0) {
-      return kFmtVarint;
-    } else if (strcmp(env, "fpfd") == 0) {
-      return kFmtFastPfDelta;
-    } else if (strcmp(env, "pfd") == 0) {
-      return kFmtPfDelta;
-    } else {
-      fprintf(stderr, "Bad FT_TYPE: %s\n", env);
-      exit(1);
+TEST(PlfsIoTest, ParallelCompression) {
+  const CompressionType compression = SupportedCompression();
+  if (compression == kNoCompression) {
+    fprintf(stderr, "skipping compression tests\n");
+    return;
+  }
+  ThreadPool* const pool = ThreadPool::NewFixed(4, true);
+  options_.compaction_pool = pool;
+  options_.compression = compression;
+  options_.force_compression = true;
+  options_.parallel_compression = true;
+  options_.block_size = 4 << 10;
+  options_.block_batch_size = 64 << 10;
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 16 << 10;
+  char tmp[10];
+  for (int e = 0; e < 2; e++) {
+    for (int i = 0; i < batch_size; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(Slice(tmp), dummy_val);
     }
+    MakeEpoch();
+  }
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val + dummy_val) << tmp;
   }
+  ASSERT_EQ(Count(0), size_t(batch_size));
+  ASSERT_EQ(Count(1), size_t(batch_size));
+  delete pool;
+}
 
-  static FilterType GetFilterType(FilterType deftype) {
-    const char* env = getenv("FT_TYPE");
-    if (env == NULL) {
-      return deftype;
-    } else if (env[0] == 0) {
-      return deftype;
-    } else if (strcmp(env, "bf") == 0) {
-      return kFtBloomFilter;
-    } else if (strcmp(env, "bmp") == 0) {
-      return kFtBitmap;
-    } else if (strcmp(env, "r") == 0) {
-      return kFtBitmap;
-    } else if (strcmp(env, "fvbp") == 0) {
-      return kFtBitmap;
-    } else if (strcmp(env, "vbp") == 0) {
-      return kFtBitmap;
-    } else if (strcmp(env, "vb") == 0) {
-      return kFtBitmap;
-    } else if (strcmp(env, "fpfd") == 0) {
-      return kFtBitmap;
-    } else if (strcmp(env, "pfd") == 0) {
-      return kFtBitmap;
-    } else {
-      fprintf(stderr, "Bad FT_TYPE: %s\n", env);
-      exit(1);
-    }
+TEST(PlfsIoTest, StagedInsertions) {
+  options_.staging_buffer = 4 << 10;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k1", "v3");
+  const std::string dummy_val(32, 'x');
+  char tmp[10];
+  for (int i = 0; i < 10000; i++) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    Append(Slice(tmp), dummy_val);
   }
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1v3");
+  ASSERT_EQ(Read("k2"), "v2");
+  for (int i = 0; i < 10000; i++) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val) << tmp;
+  }
+  ASSERT_EQ(Count(0), 2);
+  ASSERT_EQ(Count(1), 10001);
+}
 
-  static int GetOption(const char* key, int defval) {
-    const char* env = getenv(key);
-    if (env == NULL) {
-      return defval;
-    } else if (strlen(env) == 0) {
-      return defval;
-    } else {
-      return atoi(env);
-    }
+TEST(PlfsIoTest, AddBatch) {
+  options_.lg_parts = 2;
+  options_.total_memtable_budget = 4 << 20;
+  OpenWriter();
+  std::vector<std::string> keys;
+  char tmp[10];
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    keys.push_back(tmp);
   }
+  std::vector<Slice> fids(keys.begin(), keys.end());
+  std::vector<Slice> data(keys.size(), Slice("v"));
+  ASSERT_OK(writer_->AddBatch(&fids[0], &data[0], fids.size(), epoch_));
+  ASSERT_TRUE(writer_->AddBatch(&fids[0], &data[0], 1, epoch_ + 1)
+                  .IsAssertionFailed());
+  MakeEpoch();
+  ASSERT_OK(writer_->AddBatch(&fids[0], &data[0], fids.size(), epoch_));
+  MakeEpoch();
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(Read(keys[i]), "vv") << keys[i];
+  }
+  ASSERT_EQ(Count(0), 1000);
+  ASSERT_EQ(Count(1), 1000);
+}
 
-  class EventPrinter : public EventListener {
-   public:
-    EventPrinter() : base_time_(CurrentMicros()) {
-      events_.reserve(1024);
-      iops_.reserve(1024);
-    }
+TEST(PlfsIoTest, NoFilter) {
+  options_.bf_bits_per_key = 0;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k3", "v3");
+  Append("k4", "v4");
+  MakeEpoch();
+  Append("k5", "v5");
+  Append("k6", "v6");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1");
+  ASSERT_TRUE(Read("k1.1").empty());
+  ASSERT_EQ(Read("k2"), "v2");
+  ASSERT_TRUE(Read("k2.1").empty());
+  ASSERT_EQ(Read("k3"), "v3");
+  ASSERT_TRUE(Read("k3.1").empty());
+  ASSERT_EQ(Read("k4"), "v4");
+  ASSERT_TRUE(Read("k4.1").empty());
+  ASSERT_EQ(Read("k5"), "v5");
+  ASSERT_TRUE(Read("k5.1").empty());
+  ASSERT_EQ(Read("k6"), "v6");
+  ASSERT_EQ(Scan(0), "v1v2");
+  ASSERT_EQ(Scan(1), "v3v4");
+  ASSERT_EQ(Scan(2), "v5v6");
+  ASSERT_EQ(Count(0), 2);
+  ASSERT_EQ(Count(1), 2);
+  ASSERT_EQ(Count(2), 2);
+  ASSERT_EQ(Count(3), 0);
+}
 
-    virtual ~EventPrinter() {}
-
-    virtual void OnEvent(EventType type, void* arg) {
-      switch (type) {
-        case kCompactionStart:
-        case kCompactionEnd: {
-          CompactionEvent* event = static_cast<CompactionEvent*>(arg);
-          event->micros -= base_time_;
-          events_.push_back(*event);
-          break;
-        }
-        case kIoStart:
-        case kIoEnd: {
-          IoEvent* event = static_cast<IoEvent*>(arg);
-          event->micros -= base_time_;
-          iops_.push_back(*event);
-          break;
-        }
-        default:
-          break;
-      }
-    }
+TEST(PlfsIoTest, LogRotation) {
+  options_.epoch_log_rotation = true;
+  Append("k1", "v1");
+  MakeEpoch();
+  Append("k1", "v1");
+  MakeEpoch();
+  Append("k1", "v1");
+  MakeEpoch();
+  Finish();
+}
 
-    static std::string ToString(const CompactionEvent& e) {
-      char tmp[20];
-      snprintf(tmp, sizeof(tmp), "%.3f,%d,%s", 1.0 * e.micros / 1000.0 / 1000.0,
-               static_cast<int>(e.part),
-               e.type == kCompactionStart ? "START" : "END");
-      return tmp;
+TEST(PlfsIoTest, AsyncWrites) {
+  ThreadPool* const pool = ThreadPool::NewFixed(2, true);
+  options_.io_pool = pool;
+  options_.max_pending_writes = 2;
+  options_.epoch_log_rotation = true;
+  const std::string dummy_val(32, 'x');
+  char tmp[10];
+  for (int e = 0; e < 3; e++) {
+    for (int i = 0; i < 10000; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(Slice(tmp), dummy_val);
     }
+    MakeEpoch();
+  }
+  Finish();
+  for (int i = 0; i < 10000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)).size(), dummy_val.size() * 3) << tmp;
+  }
+  delete pool;
+}
 
-    static std::string ToString(const IoEvent& e) {
-      char tmp[20];
-      snprintf(tmp, sizeof(tmp), "%.3f,io,%s", 1.0 * e.micros / 1000.0 / 1000.0,
-               e.type == kIoStart ? "START" : "END");
-      return tmp;
+TEST(PlfsIoTest, RateLimitedWrites) {
+  // 4MB/s with 400KB added every 100ms
+  RateLimiter limiter(4000 << 10);
+  options_.rate_limiter = &limiter;
+  options_.epoch_log_rotation = true;
+  const std::string dummy_val(32, 'x');
+  char tmp[10];
+  const uint64_t start = CurrentMicros();
+  for (int e = 0; e < 2; e++) {
+    for (int i = 0; i < 10000; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(Slice(tmp), dummy_val);
     }
+    MakeEpoch();
+  }
+  Finish();
+  // At least 800KB of keys and values are written beyond the initial burst
+  ASSERT_GE(CurrentMicros() - start, 100000);
+  ASSERT_GE(limiter.TotalBytes(RateLimiter::kHigh), 800000);
+  ASSERT_EQ(limiter.TotalBytes(RateLimiter::kLow), 0);
+  ASSERT_GT(limiter.TotalThrottledMicros(RateLimiter::kHigh), 0);
+  for (int i = 0; i < 10000; i += 7) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)).size(), dummy_val.size() * 2) << tmp;
+  }
+}
 
-    void PrintEvents() {
-      fprintf(stdout, "\n\n!!! Background Events !!!\n");
-      fprintf(stdout, "\n-- XXX --\n");
-      for (EventIter iter = events_.begin(); iter != events_.end(); ++iter) {
-        fprintf(stdout, "%s\n", ToString(*iter).c_str());
-      }
-      for (IoIter iter = iops_.begin(); iter != iops_.end(); ++iter) {
-        fprintf(stdout, "%s\n", ToString(*iter).c_str());
-      }
-      fprintf(stdout, "\n-- XXX --\n");
+TEST(PlfsIoTest, SharedMemoryBudget) {
+  DirMemoryManager mm(8 << 20);
+  options_.memory_manager = &mm;
+  OpenWriter();
+  DirWriter* idle;
+  const std::string idle_dirname = dirname_ + "_idle";
+  DestroyDir(idle_dirname, options_);
+  ASSERT_OK(DirWriter::Open(options_, idle_dirname, &idle));
+  ASSERT_EQ(mm.NumDirs(), 2);
+  // The first directory shrinks to its even share on its next report
+  ASSERT_EQ(writer_->TEST_memtable_budget(), 8 << 20);
+  ASSERT_EQ(idle->TEST_memtable_budget(), 4 << 20);
+  ASSERT_EQ(mm.Budget(0), 4 << 20);
+  const std::string dummy_val(32, 'x');
+  char tmp[10];
+  for (int e = 0; e < 2; e++) {
+    for (int i = 0; i < 200000; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(Slice(tmp), dummy_val);
     }
+    MakeEpoch();
+    ASSERT_OK(idle->EpochFlush(e));
+  }
+  // The idle directory keeps a quarter of its even share
+  ASSERT_EQ(idle->TEST_memtable_budget(), 1 << 20);
+  ASSERT_GT(writer_->TEST_memtable_budget(), 6 << 20);
+  ASSERT_OK(idle->Finish());
+  delete idle;
+  ASSERT_EQ(mm.NumDirs(), 1);
+  Finish();
+  ASSERT_EQ(mm.NumDirs(), 0);
+  for (int i = 0; i < 200000; i += 997) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)).size(), dummy_val.size() * 2) << tmp;
+  }
+  DestroyDir(idle_dirname, options_);
+}
 
-   private:
-    uint64_t base_time_;
-
-    typedef std::vector<IoEvent> IoQueue;
-    typedef IoQueue::iterator IoIter;
-    typedef std::vector<CompactionEvent> EventQueue;
-    typedef EventQueue::iterator EventIter;
+namespace {
+struct PmemRecoveryState {
+  std::map<std::string, std::string> records;
+  uint32_t min_epoch;
+  uint32_t max_epoch;
+};
 
-    EventQueue events_;
-    IoQueue iops_;
-  };
+int SavePmemRecord(void* arg, uint32_t epoch, uint32_t part, const Slice& key,
+                   const Slice& value) {
+  PmemRecoveryState* const state = reinterpret_cast<PmemRecoveryState*>(arg);
+  state->records[key.ToString()] = value.ToString();
+  state->min_epoch = std::min(state->min_epoch, epoch);
+  state->max_epoch = std::max(state->max_epoch, epoch);
+  return 0;
+}
+}  // namespace
+
+TEST(PlfsIoTest, PmemBuffers) {
+  const std::string fname = test::TmpDir() + "/plfsio_test_pmem";
+  options_.pmem_buffer_file = fname.c_str();
+  options_.lg_parts = 1;
+  char tmp[20];
+  for (int i = 0; i < 10000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(tmp, "a");
+  }
+  MakeEpoch();
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(tmp, "b");
+  }
+  // Records of epoch 0 have been compacted. Only those of epoch 1 are left
+  PmemRecoveryState state;
+  state.min_epoch = ~static_cast<uint32_t>(0);
+  state.max_epoch = 0;
+  ASSERT_OK(RecoverPmemBuffers(fname, SavePmemRecord, &state));
+  ASSERT_EQ(state.records.size(), 1000);
+  ASSERT_EQ(state.min_epoch, 1);
+  ASSERT_EQ(state.max_epoch, 1);
+  ASSERT_EQ(state.records["k0000999"], "b");
+  // Slots are emptied by recovery
+  state.records.clear();
+  ASSERT_OK(RecoverPmemBuffers(fname, SavePmemRecord, &state));
+  ASSERT_EQ(state.records.size(), 0);
+  // Records that do not fit in a slot are rejected
+  ASSERT_TRUE(writer_->Add("big", std::string(1 << 20, 'x'), epoch_)
+                  .IsInvalidArgument());
+  MakeEpoch();
+  Finish();
+  for (int i = 0; i < 10000; i += 7) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(tmp), i < 1000 ? "ab" : "a") << tmp;
+  }
+  Env::Default()->DeleteFile(fname.c_str());
+}
 
-  PlfsIoBench() : home_(test::TmpDir() + "/plfsio_test_benchmark") {
-    mbps_ = GetOption("LINK_SPEED", 6);  // per LANL's configuration
-    ordered_keys_ = GetOption("ORDERED_KEYS", false);
-    mfiles_ = GetOption("NUM_FILES", 16);  // 16 million per epoch
+namespace {
+// Keeps the only thread of a compaction pool busy until opened.
+struct PoolGate {
+  PoolGate() : cv(&mu), open(false) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  bool open;
+};
 
-    num_threads_ = GetOption("NUM_THREADS", 4);  // Threads for bg compaction
-    // For advanced perf diagnosis
-    print_events_ = GetOption("PRINT_EVENTS", false);
-    force_fifo_ = GetOption("FORCE_FIFO", false);
+void WaitForGate(void* arg) {
+  PoolGate* const gate = reinterpret_cast<PoolGate*>(arg);
+  MutexLock ml(&gate->mu);
+  while (!gate->open) {
+    gate->cv.Wait();
+  }
+}
+}  // namespace
+
+TEST(PlfsIoTest, SpillBuffers) {
+  const std::string spill_dir = test::TmpDir() + "/plfsio_test_spill";
+  Env::Default()->CreateDir(spill_dir.c_str());
+  ThreadPool* const pool = ThreadPool::NewFixed(1, true);
+  PoolGate gate;
+  pool->Schedule(WaitForGate, &gate);
+  options_.compaction_pool = pool;
+  options_.spill_dir = spill_dir.c_str();
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 64 << 10;
+  char tmp[10];
+  // Compactions cannot start, so writers would block as soon as the spare
+  // buffer is used up. Full buffers are spilled instead.
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", (i * 7919) % batch_size);
+    Append(Slice(tmp), dummy_val);
+  }
+  ASSERT_TRUE(writer_->TEST_spilled_bytes() != 0);
+  ASSERT_EQ(writer_->GetWritePressure().spilled_bytes,
+            writer_->TEST_spilled_bytes());
+  ASSERT_EQ(writer_->TEST_write_stall_micros(), 0);
+  {
+    MutexLock ml(&gate.mu);
+    gate.open = true;
+    gate.cv.SignalAll();
+  }
+  MakeEpoch();
+  ASSERT_OK(writer_->Wait());
+  // Runs are removed once merged
+  ASSERT_EQ(writer_->GetWritePressure().spilled_bytes, 0);
+  std::vector<std::string> names;
+  ASSERT_OK(Env::Default()->GetChildren(spill_dir.c_str(), &names));
+  for (size_t i = 0; i < names.size(); i++) {
+    ASSERT_TRUE(!Slice(names[i]).starts_with("spill-")) << names[i];
+  }
+  // Tables merged from spilled runs hold more than a buffer's worth of keys
+  ASSERT_LT(writer_->TEST_num_sstables(), 4);
+  for (int i = 0; i < batch_size; i += 7) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val) << tmp;
+  }
+  ASSERT_EQ(Count(0), size_t(batch_size));
+  delete pool;
+  Env::Default()->DeleteDir(spill_dir.c_str());
+}
 
-    options_.rank = 0;  // My process id
-    if (GetOption("UNORDERED_MODE", false) != 0) {
-      options_.mode = kDmUniqueUnordered;
-    } else {
-#ifndef NDEBUG
-      options_.mode = kDmUniqueKey;
-#else
-      options_.mode = kDmUniqueDrop;
-#endif
+TEST(PlfsIoTest, EpochMerge) {
+  const std::string spill_dir = test::TmpDir() + "/plfsio_test_spill";
+  Env::Default()->CreateDir(spill_dir.c_str());
+  ThreadPool* const pool = ThreadPool::NewFixed(2, true);
+  options_.compaction_pool = pool;
+  options_.spill_dir = spill_dir.c_str();
+  options_.epoch_merge = true;
+  options_.lg_parts = 1;
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 64 << 10;
+  char tmp[10];
+  for (int e = 0; e < 2; e++) {
+    for (int i = 0; i < batch_size; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", (i * 7919) % batch_size);
+      Append(Slice(tmp), e == 0 ? dummy_val : Slice("y"));
     }
-    options_.lg_parts = GetOption("LG_PARTS", 2);
-    options_.skip_sort = ordered_keys_ != 0;
-    options_.leveldb_compatible = GetOption("LEVELDB_FMT", true) != 0;
-    options_.fixed_kv_length = GetOption("FIXED_KV", true) != 0;
-    options_.compression =
-        GetOption("SNAPPY", false) ? kSnappyCompression : kNoCompression;
-    options_.index_compression =
-        GetOption("SNAPPY", false) ? kSnappyCompression : kNoCompression;
-    options_.force_compression = true;
-    options_.total_memtable_budget =
-        static_cast<size_t>(GetOption("MEMTABLE_SIZE", 48) << 20);
-    options_.block_size =
-        static_cast<size_t>(GetOption("BLOCK_SIZE", 32) << 10);
-    options_.block_batch_size =
-        static_cast<size_t>(GetOption("BLOCK_BATCH_SIZE", 4) << 20);
-    options_.block_util = GetOption("BLOCK_UTIL", 996) / 1000.0;
-    options_.block_padding = GetOption("BLOCK_PADDING", true) != 0;
-    options_.bf_bits_per_key = static_cast<size_t>(GetOption("BF_BITS", 14));
-    options_.bm_fmt = GetBitmapFilterFormat(kFmtUncompressed);
-    options_.bm_key_bits = static_cast<size_t>(GetOption("BM_KEY_BITS", 24));
-    options_.filter = GetFilterType(kFtBloomFilter);
-    options_.filter_bits_per_key =
-        static_cast<size_t>(GetOption("FT_BITS", 16));
-    options_.value_size = static_cast<size_t>(GetOption("VALUE_SIZE", 40));
-    options_.key_size = static_cast<size_t>(GetOption("KEY_SIZE", 8));
-    options_.data_buffer =
-        static_cast<size_t>(GetOption("DATA_BUFFER", 8) << 20);
-    options_.min_data_buffer =
-        static_cast<size_t>(GetOption("MIN_DATA_BUFFER", 6) << 20);
-    options_.index_buffer =
-        static_cast<size_t>(GetOption("INDEX_BUFFER", 2) << 20);
-    options_.min_index_buffer =
-        static_cast<size_t>(GetOption("MIN_INDEX_BUFFER", 2) << 20);
-    options_.listener = &printer_;
-
-    writer_ = NULL;
+    MakeEpoch();
+  }
+  ASSERT_OK(writer_->Wait());
+  // Each partition has one table per epoch
+  ASSERT_EQ(writer_->TEST_num_sstables(), 4);
+  ASSERT_TRUE(writer_->TEST_spilled_bytes() != 0);
+  ASSERT_EQ(writer_->GetWritePressure().spilled_bytes, 0);
+  for (int i = 0; i < batch_size; i += 7) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val + "y") << tmp;
+  }
+  ASSERT_EQ(Count(0), size_t(batch_size));
+  ASSERT_EQ(Count(1), size_t(batch_size));
+  delete pool;
+  Env::Default()->DeleteDir(spill_dir.c_str());
+}
 
-    env_ = NULL;
+// Buffers that do not fit in the spill budget get their tables right away
+TEST(PlfsIoTest, EpochMergeOverBudget) {
+  const std::string spill_dir = test::TmpDir() + "/plfsio_test_spill";
+  Env::Default()->CreateDir(spill_dir.c_str());
+  ThreadPool* const pool = ThreadPool::NewFixed(2, true);
+  options_.compaction_pool = pool;
+  options_.spill_dir = spill_dir.c_str();
+  options_.spill_budget = 2 << 10;
+  options_.epoch_merge = true;
+  options_.lg_parts = 1;
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 64 << 10;
+  char tmp[10];
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", (i * 7919) % batch_size);
+    Append(Slice(tmp), dummy_val);
   }
+  MakeEpoch();
+  ASSERT_OK(writer_->Wait());
+  ASSERT_EQ(writer_->TEST_spilled_bytes(), 0);
+  ASSERT_TRUE(writer_->TEST_num_sstables() > 2);
+  for (int i = 0; i < batch_size; i += 7) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val) << tmp;
+  }
+  ASSERT_EQ(Count(0), size_t(batch_size));
+  delete pool;
+  Env::Default()->DeleteDir(spill_dir.c_str());
+}
 
-  ~PlfsIoBench() {
-    delete writer_;
-    writer_ = NULL;
-    delete env_;
-    env_ = NULL;
-  }
-
-  void LogAndApply() {
-    DestroyDir(home_, options_);
-    MaybePrepareKeys(GetOption("PREPARE_KEYS", 0));
-    DoIt();
-  }
-
- protected:
-  // Compare two 32-bit integers according to their binary encoding.
-  // This is different from comparing their values.
-  struct STLLessThan {
-    bool operator()(uint32_t a, uint32_t b) {
-      char tmp1[4];
-      EncodeFixed32(tmp1, a);
-      char tmp2[4];
-      EncodeFixed32(tmp2, b);
-      return memcmp(tmp1, tmp2, 4) < 0;
+TEST(PlfsIoTest, LogRotationParallelReads) {
+  ThreadPool* const pool = ThreadPool::NewFixed(4, true);
+  options_.reader_pool = pool;
+  options_.parallel_reads = true;
+  options_.epoch_log_rotation = true;
+  char tmp[20];
+  for (int e = 0; e < 6; e++) {
+    for (int i = 0; i < 1000; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(tmp, std::string(1, 'a' + e));
     }
-  };
+    MakeEpoch();
+  }
+  Finish();
+  // Each epoch is read from its own log, opened on first access
+  ASSERT_EQ(Count(4), 1000);
+  ASSERT_EQ(Scan(5).size(), 1000);
+  for (int i = 0; i < 1000; i += 7) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(tmp), "abcdef") << tmp;
+  }
+  ASSERT_TRUE(Read("k9999999").empty());
+  delete reader_;
+  reader_ = NULL;
+  delete pool;
+}
 
-  // Pre-sort all keys so the compaction process
-  // can skip the sort operation.
-  void MaybeSortKeys() {
-    if (options_.skip_sort) {
-      fprintf(stderr, "Sorting keys ...\n");
-      std::sort(keys_.begin(), keys_.end(), STLLessThan());
-      fprintf(stderr, "Done!\n");
+TEST(PlfsIoTest, ParallelReadsOverManyEpochs) {
+  ThreadPool* const pool = ThreadPool::NewFixed(2, true);
+  options_.reader_pool = pool;
+  options_.parallel_reads = true;
+  options_.read_fetchers = 3;  // Fewer tasks than epochs
+  const int kEpochs = 40;
+  std::string expected;
+  char tmp[20];
+  for (int e = 0; e < kEpochs; e++) {
+    for (int i = 0; i < 100; i++) {
+      if (i % 4 == e % 4) {
+        snprintf(tmp, sizeof(tmp), "k%07d", i);
+        Append(tmp, std::string(1, 'A' + e));
+      }
     }
+    MakeEpoch();
   }
+  Finish();
+  for (int i = 0; i < 100; i += 3) {
+    expected.clear();
+    for (int e = i % 4; e < kEpochs; e += 4) {
+      expected.push_back(static_cast<char>('A' + e));
+    }
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(tmp), expected) << tmp;
+    DirReader::ReadOp op;
+    op.latest_first = true;
+    std::string dst;
+    ASSERT_OK(reader_->Read(op, tmp, &dst));
+    ASSERT_EQ(dst, expected.substr(expected.size() - 1)) << tmp;
+  }
+  ASSERT_TRUE(Read("k9999999").empty());
+  delete reader_;
+  reader_ = NULL;
+  delete pool;
+}
 
-  // Pre-generate user keys if bitmap filters are used, or if explicitly
-  // requested by user. Otherwise, keys will be lazy generated
-  // using a hashing function.
-  // REQUIRES: file count must honor key space.
-  void MaybePrepareKeys(bool forced) {
-    if (forced || options_.filter == kFtBitmap) {
-      const int num_files = mfiles_ << 20;
-      ASSERT_TRUE(num_files <= (1 << options_.bm_key_bits));
-      keys_.clear();
-      fprintf(stderr, "Generating keys ... (%d keys)\n", num_files);
-      keys_.reserve(static_cast<size_t>(num_files));
-      for (int i = 0; i < num_files; i++) {
-        keys_.push_back(static_cast<uint32_t>(i));
+TEST(PlfsIoTest, KeyEpochIndex) {
+  options_.key_epoch_index = true;
+  const int kEpochs = 40;  // More epochs than bits in each epoch bitmap
+  std::string expected;
+  char tmp[20];
+  for (int e = 0; e < kEpochs; e++) {
+    for (int i = 0; i < 100; i++) {
+      if (i % 5 == e % 5 || i % 7 == 0) {
+        snprintf(tmp, sizeof(tmp), "k%07d", i);
+        Append(tmp, std::string(1, 'A' + e));
       }
-      std::random_shuffle(keys_.begin(), keys_.end());
-      ASSERT_TRUE(keys_.size() == num_files);
-      fprintf(stderr, "Done!\n");
-      MaybeSortKeys();
     }
+    MakeEpoch();
   }
-
-  class BigBatch {
-   public:
-    BigBatch(const DirOptions& options, const std::vector<uint32_t>& keys,
-             int base_offset, int size)
-        : key_size_(options.key_size),  // Num bytes for each key
-          dummy_val_(options.value_size, 'x'),
-          options_(options),
-          keys_(keys),  // Pre-generated user keys, optional
-          use_external_keys_(!keys_.empty()),
-          rnd_insertion_(!options_.skip_sort),
-          base_offset_(static_cast<uint32_t>(base_offset)),  // Base location
-          size_(static_cast<uint32_t>(size)),                // Batch size
-          offset_(size_) {  // Initialized to be invalid
-      ASSERT_TRUE(key_size_ <= sizeof(key_));
-      // Initialize the buffer space for keys
-      memset(key_, 0, sizeof(key_));
-      if (use_external_keys_) {  // Keys are pre-generated as 32-bit ints
-        ASSERT_TRUE(key_size_ >= 4);
-      } else {
-        ASSERT_TRUE(key_size_ >= 8);
+  Finish();
+  for (int i = 0; i < 100; i++) {
+    expected.clear();
+    for (int e = 0; e < kEpochs; e++) {
+      if (i % 5 == e % 5 || i % 7 == 0) {
+        expected.push_back(static_cast<char>('A' + e));
       }
     }
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(tmp), expected) << tmp;
+  }
+  ASSERT_TRUE(Read("k9999999").empty());
+  ASSERT_TRUE(Read("k0000001.1").empty());
+  // Only epochs whose number modulo 32 matches one holding the key are
+  // probed: 8 epochs holding k0000001 and epochs 33, 36, and 38
+  DirReader::ReadOp op;
+  QueryStats stats;
+  op.stats = &stats;
+  std::string dst;
+  ASSERT_OK(reader_->Read(op, "k0000001", &dst));
+  ASSERT_EQ(dst, "BGLQV[`e");
+  ASSERT_EQ(stats.filter_probes, 11u);
+}
 
-    void Reset(int base_offset, int size) {
-      base_offset_ = static_cast<uint32_t>(base_offset);
-      size_ = static_cast<uint32_t>(size);
-      // Invalid offset, an explicit seek is required
-      // before data can be fetched
-      offset_ = size_;
+TEST(PlfsIoTest, MultipartLogs) {
+  const std::string objs = dirname_ + "_objs";
+  options_.env->CreateDir(objs.c_str());
+  Osd* const osd = Osd::FromEnv(objs.c_str(), options_.env);
+  ThreadPool* const pool = ThreadPool::NewFixed(2, true);
+  options_.osd = osd;
+  options_.log_part_size = 4 << 10;  // Many parts per log
+  options_.io_pool = pool;
+  char tmp[20];
+  for (int e = 0; e < 4; e++) {
+    for (int i = 0; i < 1000; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(tmp, std::string(32, 'a' + e));
     }
-
-    bool Valid() const { return offset_ < size_; }
-    uint32_t offset() const { return offset_; }
-    Slice fid() const { return Slice(key_, key_size_); }
-    Slice data() const { return dummy_val_; }
-
-    void Seek(uint32_t offset) {
-      offset_ = offset;
-      if (Valid()) {
-        MakeKey();
-      }
+    MakeEpoch();
+  }
+  Finish();
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    std::string expected;
+    for (int e = 0; e < 4; e++) expected += std::string(32, 'a' + e);
+    ASSERT_EQ(Read(tmp), expected) << tmp;
+  }
+  ASSERT_TRUE(Read("k9999999").empty());
+  delete reader_;
+  reader_ = NULL;
+  // Logs are held by the object store
+  std::vector<std::string> names;
+  ASSERT_OK(options_.env->GetChildren(objs.c_str(), &names));
+  size_t num_parts = 0;
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i].find(".p") != std::string::npos) {
+      num_parts++;
     }
+    options_.env->DeleteFile((objs + "/" + names[i]).c_str());
+  }
+  ASSERT_GT(num_parts, 30u);
+  delete pool;
+  delete osd;
+}
 
-    void Next() {
-      offset_++;
-      if (Valid()) {
-        MakeKey();
-      }
+TEST(PlfsIoTest, HedgedReads) {
+  ThreadPool* const pool = ThreadPool::NewFixed(2, true);
+  ThreadPool* const hedge_pool = ThreadPool::NewFixed(4, true);
+  options_.reader_pool = pool;
+  options_.hedge_pool = hedge_pool;
+  options_.hedge_percentile = 50;  // Hedge often
+  options_.parallel_reads = true;
+  char tmp[20];
+  for (int e = 0; e < 4; e++) {
+    for (int i = 0; i < 100; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(tmp, std::string(1, 'a' + e));
     }
-
-   private:
-    // Constant after construction
-    size_t key_size_;
-    std::string dummy_val_;
-    const DirOptions& options_;
-    const std::vector<uint32_t>& keys_;
-    bool use_external_keys_;
-    bool rnd_insertion_;
-    uint32_t base_offset_;
-    uint32_t size_;
-
-    void MakeKey() {
-      const uint32_t index = base_offset_ + offset_;
-      if (use_external_keys_) {  // Use pre-generated user keys
-        ASSERT_TRUE(index < keys_.size());
-        EncodeFixed32(key_, keys_[index]);
-      } else if (rnd_insertion_) {  // Random insertion
-        // Key collisions are still possible, though very unlikely
-        uint64_t h = xxhash64(&index, sizeof(index), 0);
-        memcpy(key_ + 8, &h, 8);
-        memcpy(key_, &h, 8);
-      } else {
-        // Use big-endian to ensure key ordering
-        uint64_t k = htobe64(index);
-        memcpy(key_ + 8, &k, 8);
-        memcpy(key_, &k, 8);
-      }
+    MakeEpoch();
+  }
+  Finish();
+  // Enough block reads for hedging thresholds to be set
+  for (int r = 0; r < 5; r++) {
+    for (int i = 0; i < 100; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      ASSERT_EQ(Read(tmp), "abcd") << tmp;
     }
+  }
+  DirReader::ReadOp op;
+  op.deadline_micros = 60 * 1000 * 1000;
+  std::string dst;
+  ASSERT_OK(reader_->Read(op, "k0000042", &dst));
+  ASSERT_EQ(dst, "abcd");
+  delete reader_;
+  reader_ = NULL;
+  delete hedge_pool;
+  delete pool;
+}
 
-    Status status_;
-    uint32_t offset_;
-    char key_[20];
-  };
+TEST(PlfsIoTest, SnapshotReads) {
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k1", "v3");
+  Append("k3", "v4");
+  ASSERT_OK(writer_->Flush(epoch_));
+  Append("k4", "v5");  // Not yet compacted
+  DirReader* snap;
+  ASSERT_OK(writer_->OpenSnapshot(&snap));
+  DirReader::ReadOp op;
+  std::string dst;
+  ASSERT_OK(snap->Read(op, "k1", &dst));
+  ASSERT_EQ(dst, "v1v3");
+  dst.clear();
+  ASSERT_OK(snap->Read(op, "k3", &dst));
+  ASSERT_EQ(dst, "v4");
+  dst.clear();
+  ASSERT_OK(snap->Read(op, "k4", &dst));
+  ASSERT_TRUE(dst.empty());
+  DirReader::CountOp cop;
+  size_t n;
+  ASSERT_OK(snap->Count(cop, &n));
+  ASSERT_EQ(n, 4);
+  // Later writes are not seen by the snapshot
+  Append("k2", "v6");
+  MakeEpoch();
+  dst.clear();
+  ASSERT_OK(snap->Read(op, "k2", &dst));
+  ASSERT_EQ(dst, "v2");
+  delete snap;
+  ASSERT_EQ(Read("k1"), "v1v3");
+  ASSERT_EQ(Read("k2"), "v2v6");
+  ASSERT_EQ(Read("k4"), "v5");
+}
 
-#if defined(PDLFS_PLATFORM_POSIX) && defined(PDLFS_OS_LINUX)
-  void* MaybeForceFifoScheduling(pthread_attr_t* attr) {
-    if (!force_fifo_) return NULL;
-    int min = sched_get_priority_min(SCHED_FIFO);
-    int max = sched_get_priority_max(SCHED_FIFO);
-    struct sched_param param;
-    param.sched_priority = (min + max) / 2 + 1;
-    int r1 = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
-    ASSERT_EQ(r1, 0);
-    int r2 = pthread_attr_init(attr);
-    ASSERT_EQ(r2, 0);
-    int r3 = pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
-    ASSERT_EQ(r3, 0);
-    int r4 = pthread_attr_setschedpolicy(attr, SCHED_FIFO);
-    ASSERT_EQ(r4, 0);
-    param.sched_priority = (min + max) / 2 - 1;
-    int r5 = pthread_attr_setschedparam(attr, &param);
-    ASSERT_EQ(r5, 0);
-    return attr;
-  }
-#endif
-
-  void DoIt() {
-    bool owns_pool = false;
-    if (num_threads_ != 0) {
-#if defined(PDLFS_PLATFORM_POSIX) && defined(PDLFS_OS_LINUX)
-      pthread_attr_t pthread_attr;
-      void* attr = MaybeForceFifoScheduling(&pthread_attr);
-      ThreadPool* pool = ThreadPool::NewFixed(num_threads_, true, attr);
-#else
-      ThreadPool* pool = ThreadPool::NewFixed(num_threads_, true);
-#endif
-      options_.compaction_pool = pool;
-      owns_pool = true;
-    } else {
-      options_.allow_env_threads = false;
-      options_.compaction_pool = NULL;
-    }
-    bool owns_env = false;
-    if (env_ == NULL) {
-      const uint64_t speed = static_cast<uint64_t>(mbps_ << 20);
-      env_ = new EmulatedEnv(speed, &printer_);
-      owns_env = true;
-    }
-    options_.env = env_;
-    Status s = DirWriter::Open(options_, home_, &writer_);
-    ASSERT_OK(s) << "Cannot open dir";
-    SleepForMicroseconds(1000);
-#ifdef PDLFS_PLATFORM_POSIX
-    struct rusage tmp_usage;
-    int r0 = getrusage(RUSAGE_SELF, &tmp_usage);
-    ASSERT_EQ(r0, 0);
-#endif
-    const uint64_t start = CurrentMicros();
-    fprintf(stderr, "Inserting data...\n");
-    const int num_files = (mfiles_ << 20);
-    BigBatch batch(options_, keys_, 0, num_files);
-    batch.Seek(0);
-    for (int i = 0; i < num_files; i++) {
-      // Report progress
-      if ((i & 0x7FFFF) == 0) {
-        fprintf(stderr, "\r%.2f%%", 100.0 * i / num_files);
-      }
-      s = writer_->Add(batch.fid(), batch.data(), 0);
-      if (s.ok()) {
-        batch.Next();
-      } else {
-        break;
-      }
-    }
-    ASSERT_OK(s) << "Cannot write";
-    fprintf(stderr, "\r100.00%%");
-    fprintf(stderr, "\n");
-
-    s = writer_->EpochFlush(0);
-    ASSERT_OK(s) << "Cannot flush epoch";
-    s = writer_->Finish();
-    ASSERT_OK(s) << "Cannot finish";
-
-    fprintf(stderr, "Done!\n");
-    const uint64_t end = CurrentMicros();
-    const uint64_t dura = end - start;
-#ifdef PDLFS_PLATFORM_POSIX
-    PrintStats(tmp_usage, dura, owns_env);
-#else
-    PrintStats(dura, owns_env);
-#endif
-    if (print_events_) {
-      printer_.PrintEvents();
-    }
+TEST(PlfsIoTest, DirectIo) {
+  options_.direct_io = true;
+  options_.epoch_log_rotation = true;
+  const std::string dummy_val(32, 'x');
+  char tmp[10];
+  Append("k1", "v1");
+  MakeEpoch();
+  for (int i = 0; i < 10000; i++) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    Append(Slice(tmp), dummy_val);
+  }
+  ASSERT_OK(writer_->Sync());
+  Append("k1", "v2");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1v2");
+  for (int i = 0; i < 10000; i++) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)), dummy_val) << tmp;
+  }
+}
 
-    delete writer_;
-    writer_ = NULL;
+TEST(PlfsIoTest, MmapIndexes) {
+  options_.mmap_indexes = true;
+  options_.bf_bits_per_key = 10;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k1", "v3");
+  Append("k3", "v4");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1v3");
+  ASSERT_EQ(Read("k2"), "v2");
+  ASSERT_EQ(Read("k3"), "v4");
+  ASSERT_TRUE(Read("k4").empty());
+}
 
-    if (owns_pool) {
-      delete options_.compaction_pool;
-      options_.compaction_pool = NULL;
-    }
-    if (owns_env) {
-      delete options_.env;
-      options_.env = NULL;
-      env_ = NULL;
-    }
+TEST(PlfsIoTest, MmapData) {
+  options_.mmap_data = true;
+  options_.bf_bits_per_key = 10;
+  char tmp[20];
+  for (int i = 0; i < 10000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(tmp, std::string(16, 'a' + i % 26));
   }
-
-#ifdef PDLFS_PLATFORM_POSIX
-  static inline double ToSecs(const struct timeval* tv) {
-    return tv->tv_sec + tv->tv_usec / 1000.0 / 1000.0;
+  MakeEpoch();
+  Append("k0000001", "x");
+  MakeEpoch();
+  for (int i = 0; i < 10000; i += 7) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    std::string expected(16, 'a' + i % 26);
+    if (i == 1) expected += "x";
+    ASSERT_EQ(Read(tmp), expected) << tmp;
   }
-#endif
+  ASSERT_EQ(Read("k0000001"), std::string(16, 'b') + "x");
+  ASSERT_TRUE(Read("k9999999").empty());
+}
 
-  static const char* ToString(FilterType type) {
-    switch (type) {
-      case kFtBloomFilter:
-        return "BF (std bloom filter)";
-      case kFtBitmap:
-        return "BM (bitmap)";
-      default:
-        return "Unknown";
+TEST(PlfsIoTest, SegmentedIndexes) {
+  ThreadPool* const pool = ThreadPool::NewFixed(2, true);
+  options_.reader_pool = pool;
+  options_.index_segment_size = 1 << 10;
+  options_.index_segment_buffer = 8 << 10;
+  options_.bf_bits_per_key = 10;
+  options_.block_size = 1 << 10;
+  char tmp[20];
+  for (int e = 0; e < 3; e++) {
+    for (int i = 0; i < 10000; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(tmp, std::string(1, 'a' + e));
     }
+    MakeEpoch();
   }
+  for (int i = 0; i < 10000; i += 7) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(tmp), "abc") << tmp;
+  }
+  ASSERT_TRUE(Read("k9999999").empty());
+  ASSERT_EQ(Count(2), 10000);
+  delete reader_;
+  reader_ = NULL;
+  delete pool;
+}
 
-  static const char* ToString(BitmapFormat type) {
-    switch (type) {
-      case kFmtUncompressed:
-        return "Uncompressed";
-      case kFmtRoaring:
-        return "R";
-      case kFmtFastVarintPlus:
-        return "FAST-VBP";
-      case kFmtVarintPlus:
-        return "VBP";
-      case kFmtVarint:
-        return "VB";
-      case kFmtFastPfDelta:
-        return "FAST-PFD";
-      case kFmtPfDelta:
-        return "PFD";
-      default:
-        return "Unknown";
+TEST(PlfsIoTest, DirectWrites) {
+  options_.direct_writes = true;
+  options_.bf_bits_per_key = 10;
+  options_.block_batch_size = 64 << 10;
+  options_.block_size = 4 << 10;
+  char tmp[20];
+  for (int e = 0; e < 2; e++) {
+    for (int i = 0; i < 30000; i++) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(tmp, std::string(16, 'a' + e));
     }
+    MakeEpoch();
+  }
+  ASSERT_TRUE(writer_->TEST_num_sstables() > 4);
+  ASSERT_OK(writer_->Add("k0000005", "x", epoch_));
+  ASSERT_TRUE(writer_->Add("k0000001", "x", epoch_).IsInvalidArgument());
+  ASSERT_EQ(Count(0), 30000);
+  ASSERT_EQ(Count(1), 30000);
+  for (int i = 0; i < 30000; i += 997) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(tmp), std::string(16, 'a') + std::string(16, 'b'));
   }
+  ASSERT_TRUE(Read("k10000000").empty());
+}
 
-#ifdef PDLFS_PLATFORM_POSIX
-  void PrintStats(const struct rusage& tmp_usage, uint64_t dura,
-                  bool owns_env) {
-#else
-  void PrintStats(uint64_t dura, bool owns_env) {
-#endif
-    const double k = 1000.0, ki = 1024.0;
-    fprintf(stderr, "----------------------------------------\n");
-    const uint64_t total_memory_usage = writer_->TEST_total_memory_usage();
-    fprintf(stderr, "     Total Memory Usage: %.3f MiB\n",
-            total_memory_usage / ki / ki);
-    fprintf(stderr, "             Total Time: %.3f s\n", dura / k / k);
-    const IoStats stats = writer_->TEST_iostats();
-#ifdef PDLFS_PLATFORM_POSIX
-    struct rusage usage;
-    int r1 = getrusage(RUSAGE_SELF, &usage);
-    ASSERT_EQ(r1, 0);
-    double utime = ToSecs(&usage.ru_utime) - ToSecs(&tmp_usage.ru_utime);
-    double stime = ToSecs(&usage.ru_stime) - ToSecs(&tmp_usage.ru_stime);
-    fprintf(stderr, "          User CPU Time: %.3f s\n", utime);
-    fprintf(stderr, "        System CPU Time: %.3f s\n", stime);
-#ifdef PDLFS_OS_LINUX
-    cpu_set_t cpu_set;
-    CPU_ZERO(&cpu_set);
-    int r2 = sched_getaffinity(getpid(), sizeof(cpu_set), &cpu_set);
-    ASSERT_EQ(r2, 0);
-    fprintf(stderr, "          Num CPU Cores: %d\n", CPU_COUNT(&cpu_set));
-    fprintf(stderr, "              CPU Usage: %.1f%%\n",
-            k * k * (utime + stime) / CPU_COUNT(&cpu_set) / dura * 100);
-#endif
-#endif
-    fprintf(stderr, "               Dir Mode: ordered=%s\n",
-            IsKeyUnOrdered(options_.mode) ? "No" : "Yes");
-    fprintf(stderr,
-            "             Input Keys: pre-generated=%s, pre-sorted=%s\n",
-            keys_.empty() ? "No" : "Yes", ordered_keys_ ? "Yes" : "No");
-    fprintf(stderr, "     Snappy Compression: %s\n",
-            options_.index_compression == kSnappyCompression ? "Yes" : "No");
-    fprintf(stderr, "            Blk Padding: %s\n",
-            options_.block_padding ? "Yes" : "No");
-    fprintf(stderr, "                 TB Fmt: %s\n",
-            options_.leveldb_compatible ? "SST" : "CUSTOM");
-    fprintf(stderr, "                FT Type: %s\n", ToString(options_.filter));
-    fprintf(stderr, "          FT Mem Budget: %d (bits per key)\n",
-            int(options_.filter_bits_per_key));
-    if (options_.filter == kFtBloomFilter) {
-      fprintf(stderr, "              BF Budget: %d (bits per key)\n",
-              int(options_.bf_bits_per_key));
-    } else if (options_.filter == kFtBitmap) {
-      fprintf(stderr, "           BM Key Space: 0-2^%d\n",
-              int(options_.bm_key_bits));
-      fprintf(stderr, "                 BM Fmt: %s\n",
-              ToString(options_.bm_fmt));
-    }
-    fprintf(stderr, "     Num Files Inserted: %d M\n", mfiles_);
-    fprintf(stderr, "        Logic File Data: %d MiB\n",
-            int((options_.key_size + options_.value_size) * mfiles_));
-    fprintf(stderr, "  Total MemTable Budget: %d MiB\n",
-            int(options_.total_memtable_budget) >> 20);
-    fprintf(stderr, "      Estimated TB Size: %.3f MiB\n",
-            writer_->TEST_estimated_sstable_size() / ki / ki);
-    fprintf(stderr, "        Planned FT Size: %.3f KiB\n",
-            writer_->TEST_planned_filter_size() / ki);
-    fprintf(stderr, "     Estimated Blk Size: %d KiB (target util: %.1f%%)\n",
-            int(options_.block_size) >> 10, options_.block_util * 100);
-    fprintf(stderr, "Num MemTable Partitions: %d\n", 1 << options_.lg_parts);
-    fprintf(stderr, "         Num Bg Threads: %d\n", num_threads_);
-    if (owns_env) {
-      fprintf(stderr, "    Emulated Link Speed: %d MiB/s (per log)\n", mbps_);
-    } else {
-      fprintf(stderr, "    Emulated Link Speed: N/A\n");
-    }
-    fprintf(stderr, "            Write Speed: %.3f MiB/s (observed by app)\n",
-            1.0 * k * k * (options_.key_size + options_.value_size) * mfiles_ /
-                dura);
-    fprintf(stderr, "              Index Buf: %d MiB (x%d)\n",
-            int(options_.index_buffer) >> 20, 1 << options_.lg_parts);
-    fprintf(stderr, "     Min Index I/O Size: %d MiB\n",
-            int(options_.min_index_buffer) >> 20);
-    const uint64_t user_bytes =
-        writer_->TEST_key_bytes() + writer_->TEST_value_bytes();
-    fprintf(stderr, "  Aggregated TB Indexes: %.3f KiB\n",
-            1.0 * writer_->TEST_raw_index_contents() / ki);
-    fprintf(stderr, "          Aggregated FT: %.3f MiB (+%.2f%%)\n",
-            1.0 * writer_->TEST_raw_filter_contents() / ki / ki,
-            1.0 * writer_->TEST_raw_filter_contents() / user_bytes * 100);
-    fprintf(stderr, "      Final Dir Indexes: %.3f MiB (+%.2f%%)\n",
-            1.0 * stats.index_bytes / ki / ki,
-            1.0 * stats.index_bytes / user_bytes * 100);
-    fprintf(stderr, "             Index Cost: %.3f (bits per key)\n",
-            8.0 * stats.index_bytes / double(mfiles_ << 20));
-    fprintf(stderr, "         Compaction Buf: %d MiB (x%d)\n",
-            int(options_.block_batch_size) >> 20, 1 << options_.lg_parts);
-    fprintf(stderr, "               Data Buf: %d MiB\n",
-            int(options_.data_buffer) >> 20);
-    fprintf(stderr, "      Min Data I/O Size: %d MiB\n",
-            int(options_.min_data_buffer) >> 20);
-    fprintf(stderr, "        Total User Data: %.3f MiB (K+V)\n",
-            1.0 * user_bytes / ki / ki);
-    fprintf(stderr,
-            "     Aggregated TB Data: %.3f MiB (%+.2f%% due to blk encoding "
-            "and possible compression)\n",
-            1.0 * writer_->TEST_raw_data_contents() / ki / ki,
-            1.0 * writer_->TEST_raw_data_contents() / user_bytes * 100 - 100);
-    fprintf(stderr,
-            "         Final Dir Data: %.3f MiB (%+.2f%% due to performing the "
-            "above plus padding and checksums)\n",
-            1.0 * stats.data_bytes / ki / ki,
-            1.0 * stats.data_bytes / user_bytes * 100 - 100);
-    if (stats.data_bytes >= user_bytes) {
-      fprintf(stderr, "Total Blk Encoding Cost: %.3f (bits per key)\n",
-              8.0 * (stats.data_bytes - user_bytes) / double(mfiles_ << 20));
-    } else {
-      fprintf(stderr, "Total Blk Encoding Cost: N/A\n");
-    }
-    fprintf(stderr, "           Avg I/O Size: %.3f MiB\n",
-            1.0 * stats.data_bytes / stats.data_ops / ki / ki);
-    if (owns_env) {
-      const Histogram* hist = dynamic_cast<EmulatedEnv*>(env_)->GetHist(".dat");
-      ASSERT_TRUE(hist != NULL);
-      fprintf(stderr, "                   MTBW: %.3f s\n",
-              hist->Average() / k / k);
-    } else {
-      fprintf(stderr, "                   MTBW: N/A\n");
+TEST(PlfsIoTest, LatestFirst) {
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k3", "v3");
+  MakeEpoch();
+  Append("k1", "v4");
+  MakeEpoch();
+  MakeEpoch();
+  Finish();
+  for (int i = 0; i < 2; i++) {
+    options_.parallel_reads = options_.allow_env_threads = (i != 0);
+    OpenReader();
+    DirReader::ReadOp op;
+    op.latest_first = true;
+    std::string tmp;
+    ASSERT_OK(reader_->Read(op, "k1", &tmp));
+    ASSERT_EQ(tmp, "v4");
+    tmp.clear();
+    ASSERT_OK(reader_->Read(op, "k2", &tmp));
+    ASSERT_EQ(tmp, "v2");
+    tmp.clear();
+    ASSERT_OK(reader_->Read(op, "k4", &tmp));
+    ASSERT_TRUE(tmp.empty());
+    if (i == 0) {
+      size_t seeks = 0;
+      op.seeks = &seeks;
+      ASSERT_OK(reader_->Read(op, "k1", &tmp));
+      ASSERT_EQ(seeks, 1);
     }
-    const uint32_t num_tables = writer_->TEST_num_sstables();
-    fprintf(stderr, "               Total TB: %d\n", int(num_tables));
-    fprintf(stderr, "       TB Per Partition: %.1f\n",
-            1.0 * num_tables / (1 << options_.lg_parts));
-    fprintf(stderr, "           Total TB Blk: %d\n",
-            int(writer_->TEST_num_data_blocks()));
-    fprintf(stderr, "   Total Keys Compacted: %.1f M (%d dropped)\n",
-            1.0 * writer_->TEST_num_keys() / ki / ki,
-            int(writer_->TEST_num_dropped_keys()));
-    fprintf(stderr, "             Value Size: %d Bytes\n",
-            int(options_.value_size));
-    fprintf(stderr, "               Key Size: %d Bytes\n",
-            int(options_.key_size));
-  }
-
-  int mbps_;  // Link speed to emulate (in MBps)
-  int ordered_keys_;
-  int mfiles_;        // Number of files to insert (in Millions)
-  int num_threads_;   // Number of bg compaction threads
-  int force_fifo_;    // Force real-time FIFO scheduling
-  int print_events_;  // Dump background events
-  EventPrinter printer_;
-  std::vector<uint32_t> keys_;
-  const std::string home_;
-  DirOptions options_;
-  DirWriter* writer_;
-  Env* env_;
-};
-
-namespace {
-
-class StringWritableFile : public WritableFileWrapper {
- public:
-  explicit StringWritableFile(std::string* buffer) : buf_(buffer) {}
-  virtual ~StringWritableFile() {}
-
-  virtual Status Append(const Slice& data) {
-    buf_->append(data.data(), data.size());
-    return Status::OK();
+    ASSERT_EQ(Read("k1"), "v1v4");
+    delete reader_;
+    reader_ = NULL;
   }
+}
 
- private:
-  // Owned by external code
-  std::string* buf_;
-};
+TEST(PlfsIoTest, LazyIndexes) {
+  options_.lazy_indexes = true;
+  options_.bf_bits_per_key = 10;
+  for (int i = 0; i < 16; i++) {
+    Append("k1", "v");
+    char tmp[20];
+    snprintf(tmp, sizeof(tmp), "k%d", i + 2);
+    Append(tmp, "w");
+    MakeEpoch();
+  }
+  DirReader::ReadOp op;
+  op.SetEpoch(15);
+  std::string tmp;
+  Finish();
+  OpenReader();
+  ASSERT_OK(reader_->Read(op, "k17", &tmp));
+  ASSERT_EQ(tmp, "w");
+  ASSERT_EQ(Read("k1"), std::string(16, 'v'));
+  ASSERT_EQ(Read("k1"), std::string(16, 'v'));
+  ASSERT_EQ(Read("k2"), "w");
+  ASSERT_TRUE(Read("k18").empty());
+}
 
-class StringFile : public SequentialFile, public RandomAccessFile {
- public:
-  explicit StringFile(const std::string* buffer) : buf_(buffer), off_(0) {}
-  virtual ~StringFile() {}
+TEST(PlfsIoTest, BlockCache) {
+  options_.env = Env::GetUnBufferedIoEnv();  // Data blocks are not mmapped
+  options_.block_cache_size = 1 << 20;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k1", "v3");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1v3");
+  IoStats stats = reader_->TEST_iostats();
+  ASSERT_EQ(stats.cache_hits, 0);
+  ASSERT_EQ(stats.cache_misses, 2);
+  const uint64_t data_ops = stats.data_ops;
+  ASSERT_EQ(Read("k1"), "v1v3");
+  ASSERT_EQ(Read("k2"), "v2");
+  stats = reader_->TEST_iostats();
+  ASSERT_EQ(stats.cache_hits, 3);
+  ASSERT_EQ(stats.cache_misses, 2);
+  ASSERT_EQ(stats.data_ops, data_ops);
+  ASSERT_EQ(Scan(0), "v1v2");
+  stats = reader_->TEST_iostats();
+  ASSERT_EQ(stats.cache_hits, 4);
+}
 
-  virtual Status Read(uint64_t offset, size_t n, Slice* result,
-                      char* scratch) const {
-    if (offset > buf_->size()) {
-      offset = buf_->size();
-    }
-    if (n > buf_->size() - offset) {
-      n = buf_->size() - offset;
-    }
-    if (n != 0) {
-      *result = Slice(buf_->data() + offset, n);
-    } else {
-      *result = Slice();
+TEST(PlfsIoTest, SharedIndexCache) {
+  options_.env = Env::GetUnBufferedIoEnv();  // Index logs are not mmapped
+  options_.block_size = 4 << 10;
+  char tmp[10];
+  for (int e = 0; e < 3; e++) {
+    for (int i = 0; i < 2000; i++) {
+      snprintf(tmp, sizeof(tmp), "a%07d", i);
+      Append(Slice(tmp), std::string(1, 'a' + e));
     }
-    return Status::OK();
+    MakeEpoch();
   }
+  Finish();
+  // A cache much smaller than the indexes forces blocks to be evicted
+  Cache* const cache = NewLRUCache(4 << 10);
+  options_.index_cache = cache;
+  OpenReader();
+  DirReader* other;
+  ASSERT_OK(DirReader::Open(options_, dirname_, &other));
+  for (int i = 0; i < 2000; i += 37) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    ASSERT_EQ(Read(tmp), "abc");
+    std::string value;
+    DirReader::ReadOp op;
+    ASSERT_OK(other->Read(op, tmp, &value));
+    ASSERT_EQ(value, "abc");
+  }
+  ASSERT_EQ(Scan(1).size(), 2000);
+  ASSERT_TRUE(Read("b").empty());
+  delete other;
+  delete reader_;
+  reader_ = NULL;
+  delete cache;
+}
 
-  virtual Status Read(size_t n, Slice* result, char* scratch) {
-    if (n > buf_->size() - off_) {
-      n = buf_->size() - off_;
-    }
-    if (n != 0) {
-      *result = Slice(buf_->data() + off_, n);
-    } else {
-      *result = Slice();
-    }
-    return Skip(n);
+TEST(PlfsIoTest, MultiRead) {
+  options_.lg_parts = 1;
+  const std::string dummy_val(32, 'x');
+  char tmp[10];
+  for (int i = 0; i < 10000; i++) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    Append(Slice(tmp), dummy_val);
   }
+  MakeEpoch();
+  Append("a0000007", "v2");
+  MakeEpoch();
+  Finish();
+  OpenReader();
+  std::vector<std::string> keys;
+  for (int i = 0; i < 10000; i += 7) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    keys.push_back(tmp);
+  }
+  keys.push_back("a0000007");  // Duplicated key
+  keys.push_back("b0000000");  // Missing key
+  std::vector<Slice> fids(keys.begin(), keys.end());
+  std::vector<std::string> values(fids.size());
+  size_t table_seeks = 0;
+  size_t seeks = 0;
+  DirReader::ReadOp op;
+  op.table_seeks = &table_seeks;
+  op.seeks = &seeks;
+  ASSERT_OK(reader_->MultiRead(op, &fids[0], fids.size(), &values[0]));
+  for (size_t i = 0; i < fids.size(); i++) {
+    std::string expected;
+    DirReader::ReadOp single_op;
+    ASSERT_OK(reader_->Read(single_op, fids[i], &expected));
+    ASSERT_EQ(values[i], expected) << keys[i];
+  }
+  ASSERT_EQ(values[1], dummy_val + "v2");
+  ASSERT_EQ(values[values.size() - 2], values[1]);
+  ASSERT_TRUE(values.back().empty());
+  // Each data block is fetched at most once
+  ASSERT_TRUE(seeks < fids.size() / 4);
+}
+
+TEST(PlfsIoTest, Membership) {
+  options_.lg_parts = 1;
+  options_.bf_bits_per_key = 10;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k3", "v3");
+  MakeEpoch();
+  MakeEpoch();  // Empty epoch
+  Append("k1", "v4");
+  MakeEpoch();
+  Finish();
+  OpenReader();
+  const uint64_t data_ops = reader_->TEST_iostats().data_ops;
+  std::vector<bool> epochs;
+  DirReader::ReadOp op;
+  ASSERT_OK(reader_->Membership(op, "k1", &epochs));
+  ASSERT_EQ(epochs.size(), 4);
+  ASSERT_TRUE(epochs[0]);
+  ASSERT_TRUE(epochs[3]);
+  ASSERT_TRUE(!epochs[2]);
+  ASSERT_OK(reader_->Membership(op, "k0", &epochs));
+  for (size_t e = 0; e < epochs.size(); e++) {
+    ASSERT_TRUE(!epochs[e]);  // Out of every table's key range
+  }
+  op.SetEpoch(1);
+  Slice fids[] = {"k3", "k1", "k2", "k3"};
+  std::vector<bool> dsts[4];
+  ASSERT_OK(reader_->MultiMembership(op, fids, 4, dsts));
+  ASSERT_TRUE(dsts[0][1]);
+  ASSERT_TRUE(dsts[3][1]);
+  for (size_t i = 0; i < 4; i++) {
+    ASSERT_TRUE(!dsts[i][0] && !dsts[i][2] && !dsts[i][3]);
+  }
+  // No data blocks are read
+  ASSERT_EQ(reader_->TEST_iostats().data_ops, data_ops);
+}
 
-  virtual Status Skip(uint64_t n) {
-    if (n > buf_->size() - off_) {
-      n = buf_->size() - off_;
+TEST(PlfsIoTest, MultiReadWithBlockCache) {
+  options_.env = Env::GetUnBufferedIoEnv();  // Data blocks are not mmapped
+  options_.block_cache_size = 4 << 20;
+  const std::string dummy_val(32, 'x');
+  char tmp[10];
+  for (int i = 0; i < 10000; i++) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    Append(Slice(tmp), dummy_val);
+  }
+  MakeEpoch();
+  Finish();
+  OpenReader();
+  std::vector<std::string> keys;
+  for (int i = 0; i < 10000; i += 13) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    keys.push_back(tmp);
+  }
+  std::vector<Slice> fids(keys.begin(), keys.end());
+  for (int r = 0; r < 2; r++) {
+    std::vector<std::string> values(fids.size());
+    DirReader::ReadOp op;
+    ASSERT_OK(reader_->MultiRead(op, &fids[0], fids.size(), &values[0]));
+    for (size_t i = 0; i < fids.size(); i++) {
+      ASSERT_EQ(values[i], dummy_val) << keys[i];
     }
-    off_ += n;
-    return Status::OK();
   }
+  const IoStats stats = reader_->TEST_iostats();
+  ASSERT_EQ(stats.cache_hits, stats.cache_misses);
+  ASSERT_TRUE(stats.data_ops < stats.cache_misses);  // Coalesced reads
+}
 
- private:
-  // Owned by external code
-  const std::string* buf_;
-  size_t off_;
-};
+static int SaveKeyValue(void* arg, const Slice& key, const Slice& value) {
+  std::vector<std::string>* const results =
+      reinterpret_cast<std::vector<std::string>*>(arg);
+  results->push_back(key.ToString() + "=" + value.ToString());
+  return 0;
+}
 
-class StringEnv : public EnvWrapper {
- public:
-  StringEnv() : EnvWrapper(Env::Default()) {}
+static std::vector<std::string> OrderedScan(DirReader* reader, size_t* seeks) {
+  std::vector<std::string> results;
+  DirReader::ScanOp op;
+  op.ordered = true;
+  op.seeks = seeks;
+  ASSERT_OK(reader->Scan(op, SaveKeyValue, &results));
+  return results;
+}
 
-  virtual ~StringEnv() {
-    FSIter iter = fs_.begin();
-    for (; iter != fs_.end(); ++iter) {
-      delete iter->second;
+TEST(PlfsIoTest, OrderedScan) {
+  options_.lg_parts = 1;
+  options_.block_size = 4 << 10;
+  options_.allow_env_threads = true;
+  options_.scan_readahead = 4;
+  char tmp[10];
+  for (int e = 0; e < 3; e++) {
+    for (int i = 2 - e; i < 3000; i += 3) {
+      snprintf(tmp, sizeof(tmp), "a%07d", i);
+      Append(Slice(tmp), std::string(32, 'a' + e));
     }
+    Append("k", std::string(1, 'a' + e));
+    MakeEpoch();
   }
+  Finish();
+  OpenReader();
+  size_t seeks = 0;
+  std::vector<std::string> results = OrderedScan(reader_, &seeks);
+  ASSERT_EQ(results.size(), 3003);
+  for (int i = 0; i < 3000; i++) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    ASSERT_EQ(results[i], std::string(tmp) + "=" +
+                              std::string(32, 'a' + (2 - i % 3)));
+  }
+  // Duplicated keys are reported in epoch order
+  ASSERT_EQ(results[3000], "k=a");
+  ASSERT_EQ(results[3001], "k=b");
+  ASSERT_EQ(results[3002], "k=c");
+  ASSERT_TRUE(seeks > 6);
+}
 
-  virtual Status NewWritableFile(const char* f, WritableFile** r) {
-    std::string* buf = new std::string;
-    fs_.insert(std::make_pair(std::string(f), buf));
-    *r = new StringWritableFile(buf);
-    return Status::OK();
+TEST(PlfsIoTest, OrderedScanUnordered) {
+  options_.mode = kDmUniqueUnordered;
+  options_.lg_parts = 1;
+  options_.block_size = 4 << 10;
+  char tmp[10];
+  for (int i = 2999; i >= 0; i--) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    Append(Slice(tmp), "v");
+    if (i == 1500) MakeEpoch();
   }
+  MakeEpoch();
+  Finish();
+  OpenReader();
+  std::vector<std::string> results = OrderedScan(reader_, NULL);
+  ASSERT_EQ(results.size(), 3000);
+  for (int i = 0; i < 3000; i++) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    ASSERT_EQ(results[i], std::string(tmp) + "=v");
+  }
+}
 
-  virtual Status NewRandomAccessFile(const char* f, RandomAccessFile** r) {
-    std::string* buf = Find(f);
-    if (buf == NULL) {
-      *r = NULL;
-      return Status::NotFound(Slice());
-    } else {
-      *r = new StringFile(buf);
-      return Status::OK();
+static int SaveFirstKeyValue(void* arg, const Slice& key, const Slice& value) {
+  SaveKeyValue(arg, key, value);
+  return -1;
+}
+
+// Tables are only loaded once the merge reaches their keys
+TEST(PlfsIoTest, OrderedScanStartsTablesLazily) {
+  options_.mode = kDmUniqueUnordered;
+  options_.block_size = 4 << 10;
+  char tmp[10];
+  for (int e = 0; e < 3; e++) {
+    for (int i = 999; i >= 0; i--) {
+      snprintf(tmp, sizeof(tmp), "%c%07d", 'a' + e, i);
+      Append(Slice(tmp), "v");
     }
+    MakeEpoch();
   }
+  Finish();
+  OpenReader();
+  std::vector<std::string> results;
+  size_t table_seeks = 0;
+  DirReader::ScanOp op;
+  op.ordered = true;
+  op.table_seeks = &table_seeks;
+  ASSERT_OK(reader_->Scan(op, SaveFirstKeyValue, &results));
+  ASSERT_EQ(results.size(), 1);
+  ASSERT_EQ(results[0], "a0000000=v");
+  ASSERT_EQ(table_seeks, 1);
+  results.clear();
+  op.SetEpoch(2);
+  op.table_seeks = NULL;
+  ASSERT_OK(reader_->Scan(op, SaveKeyValue, &results));
+  ASSERT_EQ(results.size(), 1000);
+  ASSERT_EQ(results[999], "c0000999=v");
+}
 
-  virtual Status NewSequentialFile(const char* f, SequentialFile** r) {
-    std::string* buf = Find(f);
-    if (buf == NULL) {
-      *r = NULL;
-      return Status::NotFound(Slice());
-    } else {
-      *r = new StringFile(buf);
-      return Status::OK();
+TEST(PlfsIoTest, TableKeySamples) {
+  options_.table_key_samples = 16;
+  char tmp[10];
+  for (int e = 0; e < 2; e++) {
+    for (int i = 0; i < 4000; i++) {
+      snprintf(tmp, sizeof(tmp), "a%07d", i);
+      Append(Slice(tmp), std::string(32, 'a' + e));
     }
+    MakeEpoch();
   }
+  Finish();
+  OpenReader();
+  size_t n = 0;
+  DirReader::ScanOp op;
+  ASSERT_OK(reader_->EstimateCount(op, &n));
+  ASSERT_EQ(n, 8000);
+  op.SetEpoch(1);
+  op.key_start = "a0001000";
+  op.key_end = "a0002000";
+  ASSERT_OK(reader_->EstimateCount(op, &n));
+  ASSERT_TRUE(n >= 750 && n <= 1250);
+  op.key_start = "b";
+  op.key_end = "c";
+  ASSERT_OK(reader_->EstimateCount(op, &n));
+  ASSERT_EQ(n, 0);
+  // Directories written without samples still report estimates
+  options_.table_key_samples = 0;
+  delete reader_;
+  reader_ = NULL;
+  epoch_ = 0;
+  Append("k", "v");
+  MakeEpoch();
+  Finish();
+  OpenReader();
+  DirReader::ScanOp all;
+  ASSERT_OK(reader_->EstimateCount(all, &n));
+  ASSERT_EQ(n, 1);
+}
 
-  virtual Status GetFileSize(const char* f, uint64_t* s) {
-    std::string* buf = Find(f);
-    if (buf == NULL) {
-      *s = 0;
-      return Status::NotFound(Slice());
-    } else {
-      *s = buf->size();
-      return Status::OK();
+TEST(PlfsIoTest, CompactTableHandles) {
+  TableHandle h;
+  h.set_smallest_key("a0001000");
+  h.set_largest_key("a0001999");
+  h.set_index_offset(1 << 30);
+  h.set_index_size(700);
+  h.set_filter_offset((1 << 30) + 700 + 9);
+  h.set_filter_size(300);
+  std::string regular;
+  h.EncodeTo(&regular);
+  std::string compact;
+  h.EncodeCompactTo(&compact);
+  ASSERT_TRUE(compact.size() < regular.size());
+  TableHandle decoded;
+  Slice input = compact;
+  ASSERT_OK(decoded.DecodeFrom(&input));
+  ASSERT_TRUE(input.empty());
+  ASSERT_EQ(decoded.smallest_key(), h.smallest_key());
+  ASSERT_EQ(decoded.largest_key(), h.largest_key());
+  ASSERT_EQ(decoded.index_offset(), h.index_offset());
+  ASSERT_EQ(decoded.index_size(), h.index_size());
+  ASSERT_EQ(decoded.filter_offset(), h.filter_offset());
+  ASSERT_EQ(decoded.filter_size(), h.filter_size());
+
+  options_.compact_table_handles = true;
+  options_.table_key_samples = 16;
+  options_.total_memtable_budget = 64 << 10;
+  char tmp[10];
+  for (int e = 0; e < 2; e++) {
+    for (int i = 0; i < 4000; i++) {
+      snprintf(tmp, sizeof(tmp), "a%07d", i);
+      Append(Slice(tmp), std::string(32, 'a' + e));
     }
+    MakeEpoch();
   }
+  Finish();
+  OpenReader();
+  for (int i = 0; i < 4000; i += 397) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    ASSERT_EQ(Read(tmp), std::string(32, 'a') + std::string(32, 'b'));
+  }
+  ASSERT_EQ(Read("a0004000"), "");
+  size_t n = 0;
+  DirReader::ScanOp op;
+  ASSERT_OK(reader_->EstimateCount(op, &n));
+  ASSERT_EQ(n, 8000);
+}
 
- private:
-  typedef std::map<std::string, std::string*> FS;
-  typedef FS::iterator FSIter;
+TEST(PlfsIoTest, CompactDir) {
+  options_.lg_parts = 1;
+  options_.block_size = 4 << 10;
+  char tmp[10];
+  for (int e = 0; e < 3; e++) {
+    for (int i = 2 - e; i < 3000; i += 3) {
+      snprintf(tmp, sizeof(tmp), "a%07d", i);
+      Append(Slice(tmp), std::string(32, 'a' + e));
+    }
+    Append("k", std::string(1, 'a' + e));
+    MakeEpoch();
+  }
+  Finish();
+  const std::string dst = dirname_ + "_compacted";
+  DestroyDir(dst, options_);
+  size_t n = 0;
+  CompactDirOp op;
+  op.n = &n;
+  ASSERT_OK(CompactDir(options_, dirname_, dst, op));
+  ASSERT_EQ(n, 3001);
+  DirReader* reader;
+  ASSERT_OK(DirReader::Open(options_, dst, &reader));
+  DirReader::CountOp count_op;
+  size_t count = 0;
+  ASSERT_OK(reader->Count(count_op, &count));
+  ASSERT_EQ(count, 3001);
+  DirReader::ReadOp read_op;
+  size_t table_seeks = 0;
+  read_op.table_seeks = &table_seeks;
+  std::string value;
+  ASSERT_OK(reader->Read(read_op, "k", &value));
+  ASSERT_TRUE(table_seeks <= 1);
+  Slice input = value;
+  uint32_t epoch;
+  Slice v;
+  for (uint32_t e = 0; e < 3; e++) {
+    ASSERT_TRUE(GetCompactedValue(&input, &epoch, &v));
+    ASSERT_EQ(epoch, e);
+    ASSERT_EQ(v.ToString(), std::string(1, 'a' + e));
+  }
+  ASSERT_TRUE(!GetCompactedValue(&input, &epoch, &v));
+  for (int i = 0; i < 3000; i += 7) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    value.clear();
+    ASSERT_OK(reader->Read(read_op, tmp, &value));
+    input = value;
+    ASSERT_TRUE(GetCompactedValue(&input, &epoch, &v));
+    ASSERT_EQ(epoch, 2 - i % 3);
+    ASSERT_EQ(v.ToString(), std::string(32, 'a' + epoch));
+    ASSERT_TRUE(input.empty());
+  }
+  delete reader;
+  DestroyDir(dst, options_);
+}
 
-  std::string* Find(const char* f) {
-    FSIter iter = fs_.begin();
-    for (; iter != fs_.end(); ++iter) {
-      if (Slice(iter->first) == f) {
-        return iter->second;
+TEST(PlfsIoTest, SortDir) {
+  options_.mode = kDmMultiMapUnordered;
+  options_.lg_parts = 1;
+  options_.block_size = 4 << 10;
+  char tmp[10];
+  for (int e = 0; e < 3; e++) {
+    for (int i = 2999; i >= 0; i--) {
+      if (i % 3 != e) {
+        snprintf(tmp, sizeof(tmp), "a%07d", i);
+        Append(Slice(tmp), std::string(32, 'a' + e));
       }
     }
-    return NULL;
+    MakeEpoch();
   }
+  MakeEpoch();
+  Finish();
+  const std::string dst = dirname_ + "_sorted";
+  DestroyDir(dst, options_);
+  size_t n = 0;
+  SortDirOp op;
+  op.n = &n;
+  ASSERT_OK(SortDir(options_, dirname_, dst, op));
+  ASSERT_EQ(n, 6000);
+  DirReader* reader;
+  options_.mode = kDmMultiMap;
+  ASSERT_OK(DirReader::Open(options_, dst, &reader));
+  for (int e = 0; e < 4; e++) {
+    DirReader::CountOp count_op;
+    count_op.SetEpoch(e);
+    size_t count = 0;
+    ASSERT_OK(reader->Count(count_op, &count));
+    ASSERT_EQ(count, e < 3 ? 2000 : 0);
+  }
+  DirReader::ReadOp read_op;
+  for (int i = 0; i < 3000; i += 7) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    std::string expected;
+    for (int e = 0; e < 3; e++) {
+      if (i % 3 != e) expected += std::string(32, 'a' + e);
+    }
+    std::string value;
+    size_t seeks = 0;
+    read_op.seeks = &seeks;
+    ASSERT_OK(reader->Read(read_op, tmp, &value));
+    ASSERT_EQ(value, expected);
+    ASSERT_TRUE(seeks <= 3);
+  }
+  delete reader;
+  // Directories already sorted are rejected
+  ASSERT_TRUE(SortDir(options_, dst, dirname_, op).IsInvalidArgument());
+  DestroyDir(dst, options_);
+}
 
-  FS fs_;
-};
-
-class Histo {
- public:
-  Histo() { Clear(); }
+TEST(PlfsIoTest, MultiDirReader) {
+  options_.filter = kFtBloomFilter;
+  options_.bf_bits_per_key = 10;
+  options_.allow_env_threads = true;
+  options_.max_open_dirs = 2;
+  std::vector<std::string> dirnames;
+  std::vector<int> ranks;
+  char tmp[20];
+  // All ranks write into a shared parent directory
+  DestroyDir(dirname_, options_);
+  for (int r = 0; r < 4; r++) {
+    dirnames.push_back(dirname_);
+    ranks.push_back(r);
+    DirOptions options = options_;
+    options.rank = r;
+    DirWriter* writer;
+    ASSERT_OK(DirWriter::Open(options, dirnames.back(), &writer));
+    for (int e = 0; e < 2; e++) {
+      for (int i = 0; i < 1000; i++) {
+        snprintf(tmp, sizeof(tmp), "r%d-%d-%05d", r, e, i);
+        ASSERT_OK(writer->Add(tmp, std::string(1, 'a' + r), e));
+      }
+      ASSERT_OK(writer->Add("shared", std::string(1, 'a' + r), e));
+      ASSERT_OK(writer->EpochFlush(e));
+    }
+    ASSERT_OK(writer->Finish());
+    delete writer;
+  }
+  MultiDirReader* reader;
+  ASSERT_OK(MultiDirReader::Open(options_, &dirnames[0], &ranks[0],
+                                 dirnames.size(), &reader));
+  ASSERT_EQ(reader->TEST_num_open_dirs(), 0);
+  size_t num_candidates = 0;
+  MultiDirReader::ReadOp op;
+  op.num_candidates = &num_candidates;
+  std::string value;
+  ASSERT_OK(reader->Read(op, "shared", &value));
+  ASSERT_EQ(value, "aabbccdd");
+  ASSERT_EQ(num_candidates, 4);
+  ASSERT_TRUE(reader->TEST_num_open_dirs() <= 2);
+  size_t total_candidates = 0;
+  for (int i = 0; i < 1000; i += 50) {
+    snprintf(tmp, sizeof(tmp), "r2-1-%05d", i);
+    value.clear();
+    ASSERT_OK(reader->Read(op, tmp, &value));
+    ASSERT_EQ(value, "c");
+    total_candidates += num_candidates;
+  }
+  // Filters route most keys to a single directory
+  ASSERT_TRUE(total_candidates < 25);
+  op.SetEpoch(0);
+  value.clear();
+  ASSERT_OK(reader->Read(op, "r2-1-00000", &value));
+  ASSERT_TRUE(value.empty());
+  ASSERT_TRUE(reader->TEST_num_open_dirs() <= 2);
+  delete reader;
+}
 
-  void Add(uint32_t seeks) {
-    sum_ += seeks;
-    max_ = std::max(max_, seeks);
-    if (seeks > 9) {
-      seeks = 9;
+TEST(PlfsIoTest, RepairDir) {
+  options_.lg_parts = 1;
+  options_.allow_env_threads = true;
+  char tmp[10];
+  for (int e = 0; e < 3; e++) {
+    for (int i = 0; i < 100; i++) {
+      snprintf(tmp, sizeof(tmp), "k%03d", i);
+      Append(Slice(tmp), std::string(1, 'a' + e));
+    }
+    MakeEpoch();
+  }
+  Finish();
+  std::vector<uint64_t> cuts;
+  for (int part = 0; part < 2; part++) {
+    LogSource::LogOptions idx_opts;
+    idx_opts.sub_partition = part;
+    idx_opts.type = kIdxIoType;
+    LogSource* indx;
+    ASSERT_OK(LogSource::Open(idx_opts, dirname_, &indx));
+    std::vector<LogChunk> chunks;
+    LogReader reader(options_, indx);
+    ASSERT_OK(reader.Recover(0, &chunks));
+    ASSERT_EQ(chunks.back().type, kFooter);
+    ASSERT_EQ(chunks.back().offset + kChunkHeaderSize + chunks.back().size,
+              indx->Size());
+    std::vector<LogChunk> para_chunks;
+    ASSERT_OK(reader.Recover(64, &para_chunks));
+    ASSERT_EQ(para_chunks.size(), chunks.size());
+    std::vector<uint64_t> stones;
+    for (size_t i = 0; i < chunks.size(); i++) {
+      ASSERT_EQ(para_chunks[i].offset, chunks[i].offset);
+      if (chunks[i].type == kEpochStone) {
+        stones.push_back(chunks[i].offset);
+      }
+    }
+    ASSERT_EQ(stones.size(), 3);
+    // Cut partition 0 in the middle of the 2nd epoch stone and only
+    // damage the footer of partition 1
+    cuts.push_back(part == 0 ? stones[1] + 3 : indx->Size() - 5);
+    indx->Unref();
+  }
+  for (int part = 0; part < 2; part++) {
+    char name[20];
+    snprintf(name, sizeof(name), "/L-%08x.idx.%02x", 0, part);
+    ASSERT_TRUE(truncate((dirname_ + name).c_str(), cuts[part]) == 0);
+  }
+  options_.env->DeleteFile(DirInfoFileName(dirname_).c_str());
+  ASSERT_OK(RepairDir(dirname_, options_));
+  options_.paranoid_checks = false;
+  OpenReader();
+  size_t n[2] = {0, 0};
+  for (int i = 0; i < 100; i++) {
+    snprintf(tmp, sizeof(tmp), "k%03d", i);
+    std::string value = Read(Slice(tmp));
+    if (value == "a") {
+      n[0]++;
+    } else {
+      ASSERT_EQ(value, "abc");
+      n[1]++;
     }
-    histo_[seeks]++;
-    num_++;
   }
+  ASSERT_TRUE(n[0] != 0 && n[1] != 0);
+  ASSERT_EQ(Count(0), 100);
+  ASSERT_EQ(Count(1), n[1]);
+  ASSERT_EQ(Count(2), n[1]);
+}
 
-  double CDF(uint32_t seeks) {
-    if (num_ == 0) return 0;
-    double subtotal = 0;
-    for (uint32_t i = 0; i <= seeks; i++) {
-      subtotal += histo_[i];
+TEST(PlfsIoTest, RangeScan) {
+  options_.block_size = 4 << 10;
+  char tmp[10];
+  for (int e = 0; e < 2; e++) {
+    for (int i = e * 5000; i < (e + 1) * 5000; i++) {
+      snprintf(tmp, sizeof(tmp), "a%07d", i);
+      Append(Slice(tmp), std::string(32, 'x'));
     }
-    return subtotal / num_;
+    MakeEpoch();
   }
+  Finish();
+  OpenReader();
+  std::vector<std::string> results;
+  size_t table_seeks = 0;
+  size_t seeks = 0;
+  DirReader::ScanOp op;
+  op.key_start = "a0001000";
+  op.key_end = "a0002000";
+  op.table_seeks = &table_seeks;
+  op.seeks = &seeks;
+  ASSERT_OK(reader_->Scan(op, SaveKeyValue, &results));
+  ASSERT_EQ(results.size(), 1000);
+  ASSERT_EQ(results.front(), "a0001000=" + std::string(32, 'x'));
+  ASSERT_EQ(results.back(), "a0001999=" + std::string(32, 'x'));
+  // The second epoch holds no keys in range and is skipped in its entirety
+  ASSERT_EQ(table_seeks, 1);
+  ASSERT_TRUE(seeks < 20);
+  results.clear();
+  op.ordered = true;
+  op.key_start = "a0004990";
+  op.key_end = "a0005010";
+  ASSERT_OK(reader_->Scan(op, SaveKeyValue, &results));
+  ASSERT_EQ(results.size(), 20);
+  ASSERT_EQ(results.front(), "a0004990=" + std::string(32, 'x'));
+  ASSERT_EQ(results.back(), "a0005009=" + std::string(32, 'x'));
+}
 
-  double Average() const {
-    if (num_ == 0) return 0;
-    return sum_ / num_;
+TEST(PlfsIoTest, RangeScanUnordered) {
+  options_.mode = kDmUniqueUnordered;
+  char tmp[10];
+  for (int i = 999; i >= 0; i--) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    Append(Slice(tmp), "v");
   }
+  MakeEpoch();
+  Finish();
+  OpenReader();
+  std::vector<std::string> results;
+  DirReader::ScanOp op;
+  op.key_start = "a0000100";
+  op.key_end = "a0000200";
+  ASSERT_OK(reader_->Scan(op, SaveKeyValue, &results));
+  ASSERT_EQ(results.size(), 100);
+  std::sort(results.begin(), results.end());
+  ASSERT_EQ(results.front(), "a0000100=v");
+  ASSERT_EQ(results.back(), "a0000199=v");
+}
 
-  void Clear() {
-    memset(histo_, 0, sizeof(histo_));
-    max_ = 0;
-    num_ = 0;
-    sum_ = 0;
+TEST(PlfsIoTest, ScanReadahead) {
+  options_.env = Env::GetUnBufferedIoEnv();  // Data blocks are not mmapped
+  options_.block_size = 4 << 10;
+  options_.allow_env_threads = true;
+  options_.scan_readahead = 8;
+  char tmp[10];
+  for (int i = 0; i < 10000; i++) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    Append(Slice(tmp), std::string(32, 'x'));
   }
+  MakeEpoch();
+  Finish();
+  OpenReader();
+  std::vector<std::string> results;
+  size_t seeks = 0;
+  DirReader::ScanOp op;
+  op.seeks = &seeks;
+  ASSERT_OK(reader_->Scan(op, SaveKeyValue, &results));
+  ASSERT_EQ(results.size(), 10000);
+  for (int i = 0; i < 10000; i++) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i);
+    ASSERT_EQ(results[i], std::string(tmp) + "=" + std::string(32, 'x'));
+  }
+  ASSERT_TRUE(seeks > 8);
+  // Same results without background readahead
+  std::vector<std::string> serial_results;
+  op.no_parallel_reads = true;
+  ASSERT_OK(reader_->Scan(op, SaveKeyValue, &serial_results));
+  ASSERT_TRUE(results == serial_results);
+}
 
-  uint32_t max_;
-  uint32_t num_;  // Total number of seek records
-  // Num of times we get i seeks (0<=i<=9)
-  uint32_t histo_[10];
-  double sum_;
+struct AsyncReadResults {
+  AsyncReadResults() : cv(&mu), num_pending(0) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  std::map<std::string, std::string> values;
+  int num_pending;
 };
 
-}  // anonymous namespace
-
-class PlfsQuBench : protected PlfsIoBench {
- public:
-  PlfsQuBench() : PlfsIoBench() {
-    num_threads_ = 0;
-    mbps_ = 0;
-
-    force_negative_lookups_ = GetOption("FALSE_KEYS", false);
-    num_empty_reads_ = 0;
-    num_reads_ = 0;
+struct AsyncReadArg {
+  AsyncReadResults* results;
+  std::string key;
+};
 
-    options_.verify_checksums = false;
-    options_.paranoid_checks = true;
+static void SaveAsyncRead(void* arg, const Status& status, const Slice& value) {
+  AsyncReadArg* const a = reinterpret_cast<AsyncReadArg*>(arg);
+  ASSERT_OK(status);
+  MutexLock ml(&a->results->mu);
+  a->results->values[a->key] = value.ToString();
+  a->results->num_pending--;
+  a->results->cv.SignalAll();
+}
 
-    env_ = new StringEnv;
+TEST(PlfsIoTest, ReadAsync) {
+  options_.allow_env_threads = true;
+  char tmp[10];
+  for (int e = 0; e < 3; e++) {
+    for (int i = 0; i < 1000; i++) {
+      snprintf(tmp, sizeof(tmp), "a%07d", i);
+      Append(Slice(tmp), std::string(1, 'a' + e));
+    }
+    MakeEpoch();
   }
-
-  ~PlfsQuBench() {
-    delete writer_;
-    writer_ = NULL;
-    delete reader_;
-    reader_ = NULL;
-    delete env_;
-    env_ = NULL;
-  }
-
-  void LogAndApply() {
-    PlfsIoBench::LogAndApply();
-    RunQueries();
-  }
-
- protected:
-  void RunQueries() {
-    options_.allow_env_threads = false;
-    options_.reader_pool = NULL;
-    options_.env = env_;
-    Status s = DirReader::Open(options_, home_, &reader_);
-    ASSERT_OK(s) << "Cannot open dir";
-    fprintf(stderr, "Reading dir...\n");
-    const uint64_t start = CurrentMicros();
-    const int num_files = (mfiles_ << 20);
-    BigBatch batch(options_, keys_, 0, num_files);
-    batch.Seek(0);
-    uint64_t accumulated_seeks = 0;
-    std::string dummy_buf;
-    char tmp[20];
-    memset(tmp, 0, sizeof(tmp));
-    while (batch.Valid()) {
-      uint32_t i = batch.offset();
-      // Report progress
-      if ((i & 0x3FFFF) == 0) {
-        fprintf(stderr, "\r%.2f%%", 100.0 * i / num_files);
-      }
-      dummy_buf.clear();
-      Slice k = batch.fid();
-      if (force_negative_lookups_) {
-        uint64_t h1 = xxhash64(k.data(), k.size(), 301);
-        memcpy(tmp + 8, &h1, 8);
-        uint64_t h2 = xxhash64(k.data(), k.size(), 103);
-        memcpy(tmp, &h2, 8);
-        k = Slice(tmp, options_.key_size);
-      }
-      DirReader::ReadOp op;
-      s = reader_->Read(op, k, &dummy_buf);
-      if (!s.ok()) {
-        break;
-      }
-      const IoStats stats = reader_->TEST_iostats();
-      seeks_.Add(stats.data_ops - accumulated_seeks);
-      accumulated_seeks = stats.data_ops;
-      num_reads_++;
-      if (dummy_buf.empty()) {
-        num_empty_reads_++;
-      }
-      batch.Next();
+  Finish();
+  OpenReader();
+  AsyncReadResults results;
+  std::vector<AsyncReadArg> args(200);
+  for (int i = 0; i < 200; i++) {
+    snprintf(tmp, sizeof(tmp), "a%07d", i * 5);
+    args[i].results = &results;
+    args[i].key = tmp;
+  }
+  args.back().key = "b";  // Missing key
+  DirReader::ReadOp op;
+  for (size_t i = 0; i < args.size(); i++) {
+    MutexLock ml(&results.mu);
+    results.num_pending++;
+  }
+  for (size_t i = 0; i < args.size(); i++) {
+    ASSERT_OK(reader_->ReadAsync(op, args[i].key, SaveAsyncRead, &args[i]));
+  }
+  {
+    MutexLock ml(&results.mu);
+    while (results.num_pending != 0) {
+      results.cv.Wait();
     }
-    ASSERT_OK(s) << "Cannot read";
-    fprintf(stderr, "\r100.00%%\n");
-    fprintf(stderr, "Done!\n");
-
-    uint64_t dura = CurrentMicros() - start;
-
-    Report(dura);
+  }
+  ASSERT_EQ(results.values.size(), args.size());
+  for (size_t i = 0; i + 1 < args.size(); i++) {
+    ASSERT_EQ(results.values[args[i].key], "abc");
+  }
+  ASSERT_TRUE(results.values["b"].empty());
+  // Without background threads reads are done by the caller
+  results.num_pending = 1;
+  op.no_parallel_reads = true;
+  ASSERT_OK(reader_->ReadAsync(op, args[0].key, SaveAsyncRead, &args[0]));
+  ASSERT_EQ(results.num_pending, 0);
+}
 
-    delete reader_;
-    reader_ = NULL;
+TEST(PlfsIoTest, QueryStats) {
+  Append("k1", "v1");
+  Append("k3", "v3");
+  MakeEpoch();
+  Append("k4", "v4");
+  Append("k5", "v5");
+  MakeEpoch();
+  Finish();
+  OpenReader();
+  std::string tmp;
+  QueryStats stats;
+  DirReader::ReadOp op;
+  op.stats = &stats;
+  ASSERT_OK(reader_->Read(op, "k1", &tmp));
+  ASSERT_EQ(tmp, "v1");
+  ASSERT_TRUE(stats.bytes_read != 0);
+  ASSERT_TRUE(stats.filter_probes == 1);
+  ASSERT_TRUE(stats.filter_false_positives == 0);
+  ASSERT_TRUE(stats.epochs_skipped == 1);  // Pruned by key range
+  tmp.clear();
+  ASSERT_OK(reader_->Read(op, "k2", &tmp));
+  ASSERT_TRUE(tmp.empty());
+  ASSERT_TRUE(stats.filter_probes == 1);
+  ASSERT_TRUE(stats.filter_false_positives <= 1);
+  if (stats.filter_false_positives == 0) {
+    ASSERT_TRUE(stats.bytes_read == 0);
+    ASSERT_TRUE(stats.epochs_skipped == 2);  // Pruned by filter and key range
   }
+}
 
-  void Report(uint64_t dura) {
-    const double k = 1000.0, ki = 1024.0;
-    fprintf(stderr, "----------------------------------------\n");
-    fprintf(stderr, "             Total Time: %.3f s\n", dura / k / k);
-    fprintf(stderr, "          Avg Read Time: %.3f us\n",
-            1.0 * dura / (mfiles_ << 20));
-    fprintf(stderr, "              Num Reads: %.2f M\n", num_reads_ / ki / ki);
-    fprintf(stderr, "          Num Neg Reads: %.2f M (%.2f%%)\n",
-            num_empty_reads_ / ki / ki, 100.0 * num_empty_reads_ / num_reads_);
-    fprintf(stderr, "    Avg Seeks Per Epoch: %.3f, MAX=%d\n", seeks_.Average(),
-            int(seeks_.max_));
-    fprintf(stderr, "            CDF 1 Seeks: %.6f\n", seeks_.CDF(1));
-    fprintf(stderr, "                2 Seeks: %.6f\n", seeks_.CDF(2));
-    fprintf(stderr, "                3 Seeks: %.6f\n", seeks_.CDF(3));
-    fprintf(stderr, "                4 Seeks: %.6f\n", seeks_.CDF(4));
-    fprintf(stderr, "                5 Seeks: %.6f\n", seeks_.CDF(5));
-    fprintf(stderr, "                6 Seeks: %.6f\n", seeks_.CDF(6));
-    fprintf(stderr, "                7 Seeks: %.6f\n", seeks_.CDF(7));
-    fprintf(stderr, "                8 Seeks: %.6f\n", seeks_.CDF(8));
-    fprintf(stderr, "               9+ Seeks: %.6f\n", seeks_.CDF(9));
-    const IoStats stats = reader_->TEST_iostats();
-    fprintf(stderr, "  Total Indexes Fetched: %.3f MB\n",
-            1.0 * stats.index_bytes / ki / ki);
-    fprintf(stderr, "     Total Data Fetched: %.3f GB\n",
-            1.0 * stats.data_bytes / ki / ki / ki);
-    fprintf(stderr, "           Avg I/O size: %.3f KB\n",
-            1.0 * stats.data_bytes / stats.data_ops / ki);
-  }
-
-  int force_negative_lookups_;
-  DirReader* reader_;
+TEST(PlfsIoTest, MultiMap) {
+  options_.mode = kDmMultiMap;
+  Append("k1", "v1");
+  Append("k1", "v2");
+  MakeEpoch();
+  Append("k0", "v3");
+  Append("k1", "v4");
+  Append("k1", "v5");
+  MakeEpoch();
+  Append("k1", "v6");
+  Append("k1", "v7");
+  Append("k5", "v8");
+  MakeEpoch();
+  Append("k1", "v9");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1v2v4v5v6v7v9");
+}
 
-  uint64_t num_empty_reads_;
-  uint64_t num_reads_;
-  Histo seeks_;
+namespace {
+struct ValueList {
+  std::vector<uint32_t> epochs;
+  std::string values;
+  size_t limit;
 };
 
-}  // namespace plfsio
-}  // namespace pdlfs
-
-#if defined(PDLFS_GFLAGS)
-#include <gflags/gflags.h>
-#endif
-#if defined(PDLFS_GLOG)
-#include <glog/logging.h>
-#endif
-
-static void BM_Usage() {
-  fprintf(stderr, "Use --bench=io or --bench=qu to select a benchmark.\n");
-  fprintf(stderr, "\n");
-  fprintf(stderr, "== workload confs\n");
-  fprintf(stderr, "LINK_SPEED\n");
-  fprintf(stderr, "NUM_FILES\n");
-  fprintf(stderr, "UNORDERED_MODE\n");
-  fprintf(stderr, "PREPARE_KEYS\n");
-  fprintf(stderr, "ORDERED_KEYS\n");
-  fprintf(stderr, "LEVELDB_FMT\n");
-  fprintf(stderr, "FIXED_KV\n");
-  fprintf(stderr, "VALUE_SIZE\n");
-  fprintf(stderr, "KEY_SIZE\n");
-  fprintf(stderr, "\n");
-  fprintf(stderr, "== plfsdir options\n");
-  fprintf(stderr, "LG_PARTS\n");
-  fprintf(stderr, "MIN_DATA_BUFFER\n");
-  fprintf(stderr, "DATA_BUFFER\n");
-  fprintf(stderr, "MIN_INDEX_BUFFER\n");
-  fprintf(stderr, "INDEX_BUFFER\n");
-  fprintf(stderr, "NUM_THREADS\n");
-  fprintf(stderr, "MEMTABLE_SIZE\n");
-  fprintf(stderr, "BLOCK_BATCH_SIZE\n");
-  fprintf(stderr, "BLOCK_SIZE\n");
-  fprintf(stderr, "BLOCK_UTIL\n");
-  fprintf(stderr, "BLOCK_PADDING\n");
-  fprintf(stderr, "SNAPPY\n");
-  fprintf(stderr, "\n");
-  fprintf(stderr, "== plfsdir filter options\n");
-  fprintf(stderr, "FT_TYPE (bf, bmp, r, fvbp, fpfd)\n");
-  fprintf(stderr, "FT_BITS\n");
-  fprintf(stderr, "BM_KEY_BITS\n");
-  fprintf(stderr, "BF_BITS\n");
-  fprintf(stderr, "\n");
-  fprintf(stderr, "== adv. options\n");
-  fprintf(stderr, "FORCE_FIFO\n");
-  fprintf(stderr, "FALSE_KEYS\n");
-  fprintf(stderr, "\n");
-}
-
-static void BM_LogAndApply(const char* bm) {
-  if (strcmp(bm, "io") == 0) {
-    pdlfs::plfsio::PlfsIoBench bench;
-    bench.LogAndApply();
-  } else if (strcmp(bm, "qu") == 0) {
-    pdlfs::plfsio::PlfsQuBench bench;
-    bench.LogAndApply();
-  } else {
-    BM_Usage();
-  }
+int SaveValueTo(void* arg, uint32_t epoch, const Slice& value) {
+  ValueList* const list = reinterpret_cast<ValueList*>(arg);
+  list->epochs.push_back(epoch);
+  list->values.append(value.data(), value.size());
+  return list->epochs.size() < list->limit ? 0 : -1;
 }
+}  // namespace
 
-static void BM_Main(int* argc, char*** argv) {
-#if defined(PDLFS_GFLAGS)
-  google::ParseCommandLineFlags(argc, argv, true);
-#endif
-#if defined(PDLFS_GLOG)
-  google::InitGoogleLogging((*argv)[0]);
-  google::InstallFailureSignalHandler();
-#endif
-  pdlfs::Slice bench_name;
-  if (*argc > 1) {
-    bench_name = pdlfs::Slice((*argv)[*argc - 1]);
-  } else {
-    BM_Usage();
-  }
-  if (bench_name.starts_with("--bench=")) {
-    BM_LogAndApply(bench_name.data() + strlen("--bench="));
-  } else {
-    BM_Usage();
-  }
+TEST(PlfsIoTest, MultiMapReadEach) {
+  options_.mode = kDmMultiMap;
+  options_.parallel_reads = true;
+  Append("k1", "v1");
+  Append("k1", "v2");
+  MakeEpoch();
+  Append("k0", "v3");
+  MakeEpoch();
+  Append("k1", "v4");
+  Append("k1", "v5");
+  Append("k1", "v6");
+  MakeEpoch();
+  Append("k1", "v7");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1v2v4v5v6v7");
+  DirReader::ReadOp op;
+  ValueList list;
+  list.limit = ~static_cast<size_t>(0);
+  ASSERT_OK(reader_->ReadEach(op, "k1", SaveValueTo, &list));
+  ASSERT_EQ(list.values, "v1v2v4v5v6v7");
+  ASSERT_EQ(list.epochs.size(), 6);
+  ASSERT_EQ(list.epochs[0], 0);
+  ASSERT_EQ(list.epochs[2], 2);
+  ASSERT_EQ(list.epochs[5], 3);
+  list.epochs.clear();
+  list.values.clear();
+  list.limit = 3;
+  ASSERT_OK(reader_->ReadEach(op, "k1", SaveValueTo, &list));
+  ASSERT_EQ(list.values, "v1v2v4");
 }
 
+}  // namespace plfsio
+}  // namespace pdlfs
+
 int main(int argc, char* argv[]) {
-  pdlfs::Slice token;
-  if (argc > 1) {
-    token = pdlfs::Slice(argv[argc - 1]);
-  }
-  if (!token.starts_with("--bench")) {
-    return pdlfs::test::RunAllTests(&argc, &argv);
-  } else {
-    BM_Main(&argc, &argv);
-    return 0;
-  }
+  return pdlfs::test::RunAllTests(&argc, &argv);
 }
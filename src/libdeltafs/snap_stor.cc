@@ -13,8 +13,11 @@
 
 #include "util/logging.h"
 
+#include "pdlfs-common/cache.h"
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/fio.h"
+#include "pdlfs-common/leveldb/options.h"
+#include "pdlfs-common/leveldb/readonly.h"
 #include "pdlfs-common/pdlfs_config.h"
 #include "pdlfs-common/pdlfs_platform.h"
 #include "pdlfs-common/strutil.h"
@@ -34,6 +37,8 @@ class StorImpl : public Stor {
     }
 
     delete fio_;
+    delete table_cache_;
+    delete block_cache_;
   }
 
   virtual std::string MetadataHome() const {
@@ -61,6 +66,15 @@ class StorImpl : public Stor {
     return fio_;
   }
 
+  virtual Status OpenMetadata(DB** dbptr) const {
+    DBOptions options;
+    options.env = metadata_env_;
+    options.table_cache = table_cache_;
+    options.share_tables = true;
+    options.block_cache = block_cache_;
+    return ReadonlyDB::Open(options, metadata_home_, dbptr);
+  }
+
   virtual uint64_t IdealReqSize() const { return io_size_; }
 
   virtual bool IsReadOnly() const { return readonly_; }
@@ -77,6 +91,9 @@ class StorImpl : public Stor {
   bool data_env_is_system_;
   Env* data_env_;
   Fio* fio_;
+  // Shared by all metadata dbs opened through this adaptor
+  Cache* table_cache_;
+  Cache* block_cache_;
 };
 
 Stor::~Stor() {}
@@ -89,6 +106,8 @@ StorImpl::StorImpl() {
   data_env_is_system_ = false;
   data_env_ = NULL;
   fio_ = NULL;
+  table_cache_ = NULL;
+  block_cache_ = NULL;
 }
 
 static void LogMetadataPath(const std::string& path) {
@@ -138,6 +157,8 @@ static Status ParseBool(const std::map<std::string, std::string>& options,
 // ---------|-----------------------------------------------
 //  common  |           type=posixfs|rados|hdfs
 //          |             readonly=true|false
+//          |         table_cache_size=num_tables
+//          |         block_cache_size=num_bytes
 // ---------|-----------------------------------------------
 //  posixfs |         mode=unbufferedio|directio
 //          |             root=/path/to/root
@@ -161,6 +182,8 @@ Status Stor::Open(const std::string& conf, Stor** ptr) {
   std::string type = "posixfs";
   bool readonly = false;
   uint64_t io_size = 128 << 10;
+  uint64_t table_cache_size = 1000;
+  uint64_t block_cache_size = 8 << 20;
   if (options.count("type") != 0) {
     type = options["type"];
   }
@@ -176,6 +199,18 @@ Status Stor::Open(const std::string& conf, Stor** ptr) {
       return s;
     }
   }
+  if (options.count("table_cache_size") != 0) {
+    s = ParseNumber(options, "table_cache_size", &table_cache_size);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  if (options.count("block_cache_size") != 0) {
+    s = ParseNumber(options, "block_cache_size", &block_cache_size);
+    if (!s.ok()) {
+      return s;
+    }
+  }
 
 // RADOS
 #if defined(PDLFS_RADOS)
@@ -236,6 +271,8 @@ Status Stor::Open(const std::string& conf, Stor** ptr) {
 
     impl->io_size_ = io_size;
     impl->readonly_ = readonly;
+    impl->table_cache_ = NewLRUCache(table_cache_size);
+    impl->block_cache_ = NewLRUCache(block_cache_size);
 
     impl->fio_ = Fio::Open(fio_type.c_str(), fio_conf.c_str());
     impl->metadata_env_ =
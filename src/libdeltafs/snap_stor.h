@@ -16,6 +16,7 @@
 
 namespace pdlfs {
 
+class DB;
 class Env;
 class Fio;
 
@@ -61,6 +62,14 @@ class Stor {
   // The result of fio() should never be NULL.
   virtual Fio* FileIO() const = 0;
 
+  // Open a readonly db on the raw file system metadata. All dbs opened
+  // through the same adaptor share their open tables and block cache, so
+  // reading multiple snapshots at once neither reopens tables nor caches the
+  // same blocks multiple times. Store the db in *dbptr and return OK on
+  // success. The caller should delete *dbptr when it is no longer needed
+  // and before this adaptor is deleted.
+  virtual Status OpenMetadata(DB** dbptr) const = 0;
+
  private:
   // No copying allowed
   void operator=(const Stor&);
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "attr_cache.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+namespace pdlfs {
+
+AttrCache::~AttrCache() {
+  for (int i = 0; i < kNumShards; i++) {
+#ifndef NDEBUG
+    lru_[i]->Prune();
+    assert(lru_[i]->Empty());
+#endif
+    delete lru_[i];
+  }
+}
+
+AttrCache::AttrCache(size_t capacity) {
+  const size_t per_shard = (capacity + kNumShards - 1) / kNumShards;
+  for (int i = 0; i < kNumShards; i++) {
+    lru_[i] = new LRUCache<AttrEntry>(per_shard);
+    erases_[i] = 0;
+  }
+}
+
+Slice AttrCache::LRUKey(const DirId& pid, const Slice& nhash, char* scratch) {
+  char* p = scratch;
+#if !defined(DELTAFS)
+  EncodeFixed64(p, pid.ino);
+  p += 8;
+#else
+  p = EncodeVarint64(p, pid.reg);
+  p = EncodeVarint64(p, pid.snap);
+  p = EncodeVarint64(p, pid.ino);
+#endif
+  memcpy(p, nhash.data(), nhash.size());
+  return Slice(scratch, p - scratch + nhash.size());
+}
+
+bool AttrCache::Lookup(const DirId& pid, const Slice& nhash, uint64_t now,
+                       Stat* stat) {
+  char tmp[50];
+  Slice key = LRUKey(pid, nhash, tmp);
+  uint32_t hash = Hash(key.data(), key.size(), 0);
+
+  const uint32_t shard = Shard(hash);
+  MutexLock ml(&mu_[shard]);
+  AttrEntry* const e = lru_[shard]->Lookup(key, hash);
+  if (e == NULL) {
+    return false;
+  }
+  const bool valid = e->value->due > now;
+  if (valid) {
+    *stat = e->value->stat;
+  }
+  lru_[shard]->Release(e);
+  return valid;
+}
+
+// Generations are tracked per shard so that no state is kept for entries
+// not in the cache. An erase therefore invalidates the generations of all
+// entries in its shard, which at most causes a few more cache misses.
+uint64_t AttrCache::Generation(const DirId& pid, const Slice& nhash) {
+  char tmp[50];
+  Slice key = LRUKey(pid, nhash, tmp);
+  uint32_t hash = Hash(key.data(), key.size(), 0);
+
+  const uint32_t shard = Shard(hash);
+  MutexLock ml(&mu_[shard]);
+  return erases_[shard];
+}
+
+void AttrCache::Insert(const DirId& pid, const Slice& nhash, const Stat& stat,
+                       uint64_t due, uint64_t gen) {
+  char tmp[50];
+  Slice key = LRUKey(pid, nhash, tmp);
+  uint32_t hash = Hash(key.data(), key.size(), 0);
+
+  const uint32_t shard = Shard(hash);
+  MutexLock ml(&mu_[shard]);
+  if (erases_[shard] != gen) {
+    return;  // Attributes may predate an erase
+  }
+  CachedAttr* const attr = new CachedAttr;
+  attr->stat = stat;
+  attr->due = due;
+  lru_[shard]->Release(lru_[shard]->Insert(key, hash, attr, 1,
+                                           LRUValueDeleter<CachedAttr>));
+}
+
+void AttrCache::Erase(const DirId& pid, const Slice& nhash) {
+  char tmp[50];
+  Slice key = LRUKey(pid, nhash, tmp);
+  uint32_t hash = Hash(key.data(), key.size(), 0);
+
+  const uint32_t shard = Shard(hash);
+  MutexLock ml(&mu_[shard]);
+  lru_[shard]->Erase(key, hash);
+  erases_[shard]++;
+}
+
+}  // namespace pdlfs
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/fsdbx.h"
+#include "pdlfs-common/fstypes.h"
+#include "pdlfs-common/lru.h"
+#include "pdlfs-common/port.h"
+
+namespace pdlfs {
+
+// An LRU-cache of file attributes obtained from servers. Each entry is only
+// valid until a client-side lease due. Expired entries are treated as missing
+// and are eventually evicted. Like LookupCache, the cache is split into a fixed
+// number of independently locked shards and is thread-safe.
+class AttrCache {
+  struct CachedAttr {
+    Stat stat;
+    uint64_t due;
+  };
+  typedef LRUEntry<CachedAttr> AttrEntry;
+
+ public:
+  explicit AttrCache(size_t capacity = 4096);
+  ~AttrCache();
+
+  // Copy the attributes of an entry into *stat and return true if they are
+  // cached with a due later than "now". Otherwise, return false.
+  bool Lookup(const DirId& pid, const Slice& nhash, uint64_t now, Stat* stat);
+  // Return a generation that changes whenever the entry may have been
+  // erased. Callers fetching the attributes of an entry from a server should
+  // obtain it before sending the request and pass it to Insert() so that
+  // attributes fetched concurrently with an update are not cached after the
+  // updater has erased the entry.
+  uint64_t Generation(const DirId& pid, const Slice& nhash);
+  // Cache the attributes of an entry unless the entry has been erased since
+  // "gen" was obtained.
+  void Insert(const DirId& pid, const Slice& nhash, const Stat& stat,
+              uint64_t due, uint64_t gen);
+  void Erase(const DirId& pid, const Slice& nhash);
+
+ private:
+  static Slice LRUKey(const DirId&, const Slice&, char* scratch);
+  enum { kNumShardBits = 4 };
+  enum { kNumShards = 1 << kNumShardBits };
+  static uint32_t Shard(uint32_t hash) { return hash >> (32 - kNumShardBits); }
+  LRUCache<AttrEntry>* lru_[kNumShards];
+  uint64_t erases_[kNumShards];  // Number of erases at each shard
+  port::Mutex mu_[kNumShards];
+
+  // No copying allowed
+  void operator=(const AttrCache&);
+  AttrCache(const AttrCache&);
+};
+
+}  // namespace pdlfs
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "attr_cache.h"
+
+#include "pdlfs-common/testharness.h"
+
+namespace pdlfs {
+
+class AttrCacheTest {
+ public:
+  AttrCacheTest() : pid_(1) {}
+
+  static Stat MakeStat(uint64_t ino, uint64_t size) {
+    Stat stat;
+    stat.SetInodeNo(ino);
+    stat.SetFileSize(size);
+    return stat;
+  }
+
+  void Insert(const Slice& nhash, uint64_t size, uint64_t due) {
+    uint64_t gen = cache_.Generation(pid_, nhash);
+    cache_.Insert(pid_, nhash, MakeStat(2, size), due, gen);
+  }
+
+  // Return the cached size of an entry, or -1 if the entry is not cached.
+  int Lookup(const Slice& nhash, uint64_t now) {
+    Stat stat;
+    if (!cache_.Lookup(pid_, nhash, now, &stat)) {
+      return -1;
+    }
+    return static_cast<int>(stat.FileSize());
+  }
+
+  AttrCache cache_;
+  DirId pid_;
+};
+
+TEST(AttrCacheTest, InsertAndLookup) {
+  ASSERT_EQ(Lookup("a", 0), -1);
+  Insert("a", 10, 100);
+  Insert("b", 20, 100);
+  ASSERT_EQ(Lookup("a", 0), 10);
+  ASSERT_EQ(Lookup("b", 99), 20);
+  Insert("a", 30, 100);  // Replaces the old entry
+  ASSERT_EQ(Lookup("a", 0), 30);
+}
+
+TEST(AttrCacheTest, Expiration) {
+  Insert("a", 10, 100);
+  ASSERT_EQ(Lookup("a", 99), 10);
+  ASSERT_EQ(Lookup("a", 100), -1);
+  ASSERT_EQ(Lookup("a", 200), -1);
+  Insert("a", 20, 300);
+  ASSERT_EQ(Lookup("a", 200), 20);
+}
+
+TEST(AttrCacheTest, Erase) {
+  Insert("a", 10, 100);
+  Insert("b", 20, 100);
+  cache_.Erase(pid_, "a");
+  ASSERT_EQ(Lookup("a", 0), -1);
+  ASSERT_EQ(Lookup("b", 0), 20);
+  cache_.Erase(pid_, "a");  // Already gone
+  ASSERT_EQ(Lookup("a", 0), -1);
+}
+
+TEST(AttrCacheTest, OtherDirs) {
+  Insert("a", 10, 100);
+  Stat stat;
+  ASSERT_TRUE(!cache_.Lookup(DirId(2), "a", 0, &stat));
+  cache_.Erase(DirId(2), "a");
+  ASSERT_EQ(Lookup("a", 0), 10);
+}
+
+TEST(AttrCacheTest, InsertAfterErase) {
+  Insert("a", 10, 100);
+  // A lookup obtains a generation, then an updater erases the entry before
+  // the lookup's stale reply arrives
+  uint64_t gen = cache_.Generation(pid_, "a");
+  cache_.Erase(pid_, "a");
+  cache_.Insert(pid_, "a", MakeStat(2, 20), 100, gen);
+  ASSERT_EQ(Lookup("a", 0), -1);
+  // Lookups started after the erase may cache again
+  Insert("a", 30, 100);
+  ASSERT_EQ(Lookup("a", 0), 30);
+}
+
+TEST(AttrCacheTest, Eviction) {
+  AttrCache cache(16);  // One entry per shard
+  char tmp[20];
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "%d", i);
+    uint64_t gen = cache.Generation(pid_, tmp);
+    cache.Insert(pid_, tmp, MakeStat(2, i), 100, gen);
+  }
+  int num_cached = 0;
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "%d", i);
+    Stat stat;
+    if (cache.Lookup(pid_, tmp, 0, &stat)) {
+      ASSERT_EQ(stat.FileSize(), i);
+      num_cached++;
+    }
+  }
+  ASSERT_TRUE(num_cached <= 16);
+  ASSERT_TRUE(num_cached > 0);
+}
+
+}  // namespace pdlfs
+
+int main(int argc, char* argv[]) {
+  return ::pdlfs::test::RunAllTests(&argc, &argv);
+}
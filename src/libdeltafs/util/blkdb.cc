@@ -14,6 +14,9 @@
 
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/strutil.h"
+
+#include <stdio.h>
 
 namespace pdlfs {
 
@@ -29,6 +32,10 @@ static inline std::string UntypedKeyPrefix(const Fentry& fentry) {
   return fentry.UntypedKeyPrefix();
 }
 
+// Max number of blocks remembered by a stream. Older blocks are forgotten
+// once the limit is reached.
+static const size_t kMaxStreamExtents = 4096;
+
 bool StreamHeader::DecodeFrom(Slice* input) {
   if (!GetVarint64(input, &mtime) || !GetVarint64(input, &size)) {
     return false;
@@ -44,28 +51,356 @@ Slice StreamHeader::EncodeTo(char* scratch) const {
   return Slice(scratch, p - scratch);
 }
 
+namespace {
+// Location of a block of file data in a blob file.
+struct BlobPointer {
+  BlobPointer() {}
+  bool DecodeFrom(Slice* input);
+  void EncodeTo(std::string* dst) const;
+  uint64_t file_number;
+  uint64_t off;
+  uint64_t size;
+};
+
+bool BlobPointer::DecodeFrom(Slice* input) {
+  if (!GetVarint64(input, &file_number) || !GetVarint64(input, &off) ||
+      !GetVarint64(input, &size)) {
+    return false;
+  } else {
+    return true;
+  }
+}
+
+void BlobPointer::EncodeTo(std::string* dst) const {
+  PutVarint64(dst, file_number);
+  PutVarint64(dst, off);
+  PutVarint64(dst, size);
+}
+
+struct BlkInfo {
+  BlkInfo() {}
+  bool ParseFrom(const Slice& k, const Slice& v, bool is_pointer);
+  uint64_t size;
+  uint64_t off;
+  BlobPointer ptr;  // Only set when the block is stored in a blob file
+};
+
+static bool FetchOffset(const Slice& encoding, uint64_t* result) {
+  if (encoding.size() < 8) {
+    return false;
+  } else {
+    memcpy(result, encoding.data(), 8);
+    *result = be64toh(*result);
+    return true;
+  }
+}
+
+bool BlkInfo::ParseFrom(const Slice& k, const Slice& v, bool is_pointer) {
+  uint64_t end;
+  if (!FetchOffset(k, &end)) {
+    return false;
+  } else if (is_pointer) {
+    Slice input = v;
+    if (!ptr.DecodeFrom(&input)) {
+      return false;
+    }
+    size = ptr.size;
+  } else {
+    size = v.size();
+  }
+  off = end - size + 1;
+  return true;
+}
+}  // namespace
+
+// A blob file opened for reading. Readers are shared and reference counted
+// so that a file can be garbage collected while it is being read.
+struct BlkDB::ValueLogReader {
+  RandomAccessFile* file;
+  // Bytes readable through the file. Files may be mapped when opened, so
+  // a reader opened on the blob file being written only sees the data
+  // appended before it was opened.
+  uint64_t size;
+  int refs;
+
+  void Unref() {
+    assert(refs > 0);
+    if (--refs == 0) {
+      delete file;
+      delete this;
+    }
+  }
+};
+
 BlkDBOptions::BlkDBOptions()
     : uniquefier(0),
       sync(false),
       verify_checksum(false),
       owns_db(false),
-      db(NULL) {}
+      db(NULL),
+      write_batch_size(0),
+      value_log_file_size(64 << 20),
+      env(NULL),
+      reader_pool(NULL) {}
 
 BlkDB::BlkDB(const BlkDBOptions& options)
     : uniquefier_(options.uniquefier),
       sync_(options.sync),
       verify_checksum_(options.verify_checksum),
       owns_db_(options.owns_db),
-      db_(options.db) {
+      db_(options.db),
+      write_batch_size_(options.write_batch_size),
+      value_log_dir_(options.value_log_dir),
+      value_log_file_size_(options.value_log_file_size),
+      env_(options.env != NULL ? options.env : Env::Default()),
+      reader_pool_(options.reader_pool),
+      batch_(new WriteBatch),
+      batch_bytes_(0),
+      vlog_(NULL),
+      vlog_number_(0),
+      vlog_off_(0) {
   assert(db_ != NULL);
 }
 
+// Commit all buffered block writes to the db. Commits are serialized so
+// that buffered writes reach the db in the order they were made. All
+// subsequent writes fail once a commit fails. If "sync" is true, the db
+// log is synced even if there is nothing to commit.
+// REQUIRES: mutex_ has been locked.
+Status BlkDB::CommitBatch(bool sync) {
+  mutex_.Unlock();
+  commit_mu_.Lock();
+  mutex_.Lock();
+  WriteBatch* batch = NULL;
+  if (batch_bytes_ != 0) {
+    batch = batch_;
+    batch_ = new WriteBatch;
+    batch_bytes_ = 0;
+  }
+  mutex_.Unlock();
+  Status s;
+  if (batch != NULL) {
+    WriteOptions options;
+    options.sync = sync;
+    s = db_->Write(options, batch);
+    delete batch;
+  } else if (sync) {
+    s = db_->SyncWAL();
+  }
+  commit_mu_.Unlock();
+  mutex_.Lock();
+  if (!s.ok()) {
+    Error(__LOG_ARGS__, s);
+    if (batch_error_.ok()) {
+      batch_error_ = s;
+    }
+  }
+  return s;
+}
+
+Status BlkDB::CommitPendingWrites() {
+  Status s;
+  MutexLock ml(&mutex_);
+  if (batch_bytes_ != 0) {
+    s = CommitBatch(false);
+  }
+  return s;
+}
+
 BlkDB::~BlkDB() {
+  if (!batch_error_.ok()) {
+    // Writes still buffered cannot be committed after the ones lost with
+    // the failed commit, and the failure has already been reported to all
+    // streams flushed or closed since.
+    Error(__LOG_ARGS__, batch_error_);
+  } else if (batch_bytes_ != 0) {
+    WriteOptions options;
+    options.sync = sync_;
+    Status s = db_->Write(options, batch_);
+    if (!s.ok()) {
+      Error(__LOG_ARGS__, s);
+    }
+  }
+  delete batch_;
+  if (vlog_ != NULL) {
+    vlog_->Close();
+    delete vlog_;
+  }
+  std::map<uint64_t, ValueLogReader*>::iterator it;
+  for (it = vlog_readers_.begin(); it != vlog_readers_.end(); ++it) {
+    assert(it->second->refs == 1);
+    delete it->second->file;
+    delete it->second;
+  }
   if (owns_db_) {
     delete db_;
   }
 }
 
+std::string BlkDB::ValueLogFileName(uint64_t file_number) const {
+  char tmp[30];
+  snprintf(tmp, sizeof(tmp), "/%06llu.blob",
+           static_cast<unsigned long long>(file_number));
+  return value_log_dir_ + tmp;
+}
+
+// Start a new blob file. The first file opened by a BlkDB is numbered after
+// all blob files found in the blob directory.
+// REQUIRES: vlog_mu_ has been locked.
+Status BlkDB::OpenValueLog() {
+  assert(vlog_ == NULL);
+  if (vlog_number_ == 0) {
+    env_->CreateDir(value_log_dir_.c_str());  // Ignore errors
+    std::vector<std::string> names;
+    env_->GetChildren(value_log_dir_.c_str(), &names);
+    for (size_t i = 0; i < names.size(); i++) {
+      Slice input = names[i];
+      uint64_t number;
+      if (ConsumeDecimalNumber(&input, &number) && input == ".blob") {
+        vlog_number_ = std::max(vlog_number_, number);
+      }
+    }
+  }
+  vlog_number_++;
+  vlog_off_ = 0;
+  std::string fname = ValueLogFileName(vlog_number_);
+  return env_->NewWritableFile(fname.c_str(), &vlog_);
+}
+
+// Append a block of file data to the current blob file and return its
+// location in *pointer. Data is flushed so it can be read back immediately.
+// REQUIRES: vlog_mu_ has been locked.
+Status BlkDB::AppendToValueLog(const Slice& data, std::string* pointer) {
+  Status s;
+  if (vlog_ != NULL && vlog_off_ >= value_log_file_size_) {
+    s = vlog_->Close();
+    delete vlog_;
+    vlog_ = NULL;
+  }
+  if (s.ok() && vlog_ == NULL) {
+    s = OpenValueLog();
+  }
+  if (s.ok()) {
+    s = vlog_->Append(data);
+    if (s.ok()) {
+      s = sync_ ? vlog_->Sync() : vlog_->Flush();
+    }
+    if (s.ok()) {
+      BlobPointer ptr;
+      ptr.file_number = vlog_number_;
+      ptr.off = vlog_off_;
+      ptr.size = data.size();
+      pointer->clear();
+      ptr.EncodeTo(pointer);
+      vlog_off_ += data.size();
+    } else {
+      // Blob offsets are no longer known after a failed write so
+      // we stop using the file.
+      delete vlog_;
+      vlog_ = NULL;
+    }
+  }
+  return s;
+}
+
+Status BlkDB::SyncValueLog() {
+  MutexLock ml(&vlog_mu_);
+  if (vlog_ != NULL) {
+    return vlog_->Sync();
+  } else {
+    return Status::OK();
+  }
+}
+
+Status BlkDB::ReadFromValueLog(uint64_t file_number, uint64_t off, size_t n,
+                               char* scratch) {
+  Status s;
+  ValueLogReader* r = NULL;
+  vlog_mu_.Lock();
+  std::map<uint64_t, ValueLogReader*>::iterator it =
+      vlog_readers_.find(file_number);
+  if (it != vlog_readers_.end()) {
+    r = it->second;
+    if (off + n > r->size) {  // Reopen to see newly appended data
+      vlog_readers_.erase(it);
+      r->Unref();
+      r = NULL;
+    }
+  }
+  if (r == NULL) {
+    RandomAccessFile* file;
+    std::string fname = ValueLogFileName(file_number);
+    s = env_->NewRandomAccessFile(fname.c_str(), &file);
+    if (!s.ok() && !env_->FileExists(fname.c_str())) {
+      // The file has been reclaimed so the blocks it held are gone
+      s = Status::NotFound(Slice());
+    }
+    if (s.ok()) {
+      r = new ValueLogReader;
+      r->file = file;
+      r->size = (vlog_ != NULL && file_number == vlog_number_) ? vlog_off_
+                                                               : ~uint64_t(0);
+      r->refs = 1;  // For the reader map
+      vlog_readers_.insert(std::make_pair(file_number, r));
+    }
+  }
+  if (r != NULL) {
+    r->refs++;
+  }
+  vlog_mu_.Unlock();
+
+  if (s.ok()) {
+    Slice result;
+    s = r->file->Read(off, n, &result, scratch);
+    if (s.ok()) {
+      if (result.size() != n) {
+        s = Status::Corruption("Truncated blob file");
+      } else if (result.data() != scratch) {
+        memcpy(scratch, result.data(), n);
+      }
+    }
+    vlog_mu_.Lock();
+    r->Unref();
+    vlog_mu_.Unlock();
+  }
+  return s;
+}
+
+// Add blob bytes that are no longer referenced by the db and delete
+// blob files that have become entirely garbage. The file currently being
+// written is never deleted.
+void BlkDB::CollectGarbage(const std::map<uint64_t, uint64_t>& garbage) {
+  MutexLock ml(&vlog_mu_);
+  std::map<uint64_t, uint64_t>::const_iterator it;
+  for (it = garbage.begin(); it != garbage.end(); ++it) {
+    vlog_garbage_[it->first] += it->second;
+  }
+  std::map<uint64_t, uint64_t>::iterator git = vlog_garbage_.begin();
+  while (git != vlog_garbage_.end()) {
+    const uint64_t number = git->first;
+    std::string fname = ValueLogFileName(number);
+    uint64_t file_size;
+    if ((vlog_ != NULL && number == vlog_number_) ||
+        !env_->GetFileSize(fname.c_str(), &file_size).ok() ||
+        git->second < file_size) {
+      ++git;
+      continue;
+    }
+    Status s = env_->DeleteFile(fname.c_str());
+    if (!s.ok()) {
+      Error(__LOG_ARGS__, s);
+    }
+    std::map<uint64_t, ValueLogReader*>::iterator rit =
+        vlog_readers_.find(number);
+    if (rit != vlog_readers_.end()) {
+      ValueLogReader* r = rit->second;
+      vlog_readers_.erase(rit);
+      r->Unref();
+    }
+    vlog_garbage_.erase(git++);
+  }
+}
+
 Status BlkDB::Fstat(const Fentry& fentry, Handle* fh, uint64_t* mtime,
                     uint64_t* size, bool skip_cache) {
   Status s;
@@ -100,13 +435,18 @@ Status BlkDB::Creat(const Fentry& fentry, bool append_only, Handle** fh) {
 
   if (s.ok()) {
     Stream* stream = new Stream;
+    stream->extents_seq = 0;
     stream->iter = NULL;
+    stream->iter_seq = 0;
     stream->mtime = header.mtime;
     stream->size = header.size;
     stream->nwrites = 0;
     stream->nflus = 0;
     stream->off = 0;
+    stream->prefix = UntypedKeyPrefix(fentry);
 
+    MutexLock ml(&mutex_);
+    streams_.insert(stream);
     *fh = stream;
   }
 
@@ -179,12 +519,15 @@ Status BlkDB::Open(const Fentry& fentry, bool create_if_missing,
 
   if (s.ok()) {
     Stream* stream = new Stream;
+    stream->extents_seq = 0;
     stream->iter = NULL;
+    stream->iter_seq = 0;
     stream->mtime = header.mtime;
     stream->size = header.size;
     stream->nwrites = 0;
     stream->nflus = 0;
     stream->off = 0;
+    stream->prefix = UntypedKeyPrefix(fentry);
 
     if (found) {
       // Reuse cursor position
@@ -192,6 +535,8 @@ Status BlkDB::Open(const Fentry& fentry, bool create_if_missing,
       iter = NULL;
     }
 
+    MutexLock ml(&mutex_);
+    streams_.insert(stream);
     *fh = stream;
   }
 
@@ -199,8 +544,137 @@ Status BlkDB::Open(const Fentry& fentry, bool create_if_missing,
   return s;
 }
 
+// Add to *batch the updates that remove all file data beyond "size" along
+// with all header records of a stream. A block crossing "size" is replaced
+// by its head. Blob bytes dropped by the updates are added to *garbage.
+Status BlkDB::PrepareTrunc(const Fentry& fentry, uint64_t size,
+                           WriteBatch* batch,
+                           std::map<uint64_t, uint64_t>* garbage) {
+  Status s;
+  const bool is_pointer = !value_log_dir_.empty();
+  ReadOptions options;
+  options.verify_checksums = verify_checksum_;
+  Iterator* iter = db_->NewIterator(options);
+
+  Key key(UntypedKeyPrefix(fentry));
+  key.SetType(kHeaderType);
+  Slice key_prefix = key.prefix();
+  iter->Seek(key_prefix);
+  for (; iter->Valid(); iter->Next()) {
+    if (!iter->key().starts_with(key_prefix)) break;
+    batch->Delete(iter->key());
+  }
+
+  key.SetType(kDataBlockType);
+  key_prefix = key.prefix();
+  key.SetOffset(size);  // Blocks ending before "size" are not affected
+  // Only the first block crossing "size" is visible to reads. Blocks after
+  // it are hidden by it and are dropped without leaving a head.
+  bool have_head = false;
+  for (iter->Seek(key.Encode()); s.ok() && iter->Valid(); iter->Next()) {
+    Slice k = iter->key();
+    if (!k.starts_with(key_prefix)) break;
+    k.remove_prefix(key_prefix.size());
+    BlkInfo blk;
+    Slice v = iter->value();
+    batch->Delete(iter->key());
+    if (!blk.ParseFrom(k, v, is_pointer)) {
+      continue;  // Drop bad blocks
+    }
+    uint64_t head = 0;
+    if (blk.off < size && !have_head) {
+      have_head = true;
+      Key head_key(key_prefix);
+      head_key.SetOffset(size - 1);
+      std::string ignored;
+      // A block already ending at the new size takes precedence over the
+      // head when read, so the head is simply dropped.
+      s = db_->Get(options, head_key.Encode(), &ignored);
+      if (s.IsNotFound()) {
+        head = size - blk.off;
+        if (is_pointer) {
+          BlobPointer ptr = blk.ptr;
+          ptr.size = head;
+          std::string pointer;
+          ptr.EncodeTo(&pointer);
+          batch->Put(head_key.Encode(), pointer);
+        } else {
+          batch->Put(head_key.Encode(), Slice(v.data(), head));
+        }
+        s = Status::OK();
+      }
+    }
+    if (is_pointer) {
+      (*garbage)[blk.ptr.file_number] += blk.size - head;
+    }
+  }
+  if (s.ok()) {
+    s = iter->status();
+  }
+  delete iter;
+  return s;
+}
+
+// Bring the streams open on a file up to date after the file has been
+// truncated to "size" or dropped. Cursors and written extents are
+// discarded as they may still point to removed data. Dropped streams
+// reject all further updates.
+void BlkDB::ResetStreams(const Fentry& fentry, uint64_t size, bool drop) {
+  const std::string prefix = UntypedKeyPrefix(fentry);
+  const uint64_t mtime = CurrentMicros();
+  MutexLock ml(&mutex_);
+  std::set<Stream*>::iterator it;
+  for (it = streams_.begin(); it != streams_.end(); ++it) {
+    Stream* const stream = *it;
+    if (stream->prefix != prefix) {
+      continue;
+    }
+    delete stream->iter;
+    stream->iter = NULL;
+    // Blocks written before may have been removed or cut short
+    stream->extents.clear();
+    stream->extents_seq = stream->nwrites;
+    stream->size = size;
+    if (mtime > stream->mtime) {
+      stream->mtime = mtime;
+    }
+    if (drop) {
+      stream->nwrites = -1;
+      stream->nflus = -1;
+    }
+  }
+}
+
 Status BlkDB::Trunc(const Fentry& fentry, uint64_t size) {
-  return Status::NotSupported(Slice());
+  Status s = CommitPendingWrites();
+  if (!s.ok()) {
+    return s;
+  }
+  WriteBatch batch;
+  std::map<uint64_t, uint64_t> garbage;
+  s = PrepareTrunc(fentry, size, &batch, &garbage);
+  if (s.ok()) {
+    // Replace all existing header records with a single new one
+    char tmp[20];
+    StreamHeader header;
+    header.mtime = CurrentMicros();
+    header.size = size;
+    Slice header_encoding = header.EncodeTo(tmp);
+    Key key(UntypedKeyPrefix(fentry));
+    key.SetType(kHeaderType);
+    key.SetOffset(uniquefier_);
+    batch.Put(key.Encode(), header_encoding);
+    WriteOptions options;
+    options.sync = sync_;
+    s = db_->Write(options, &batch);
+  }
+  if (s.ok()) {
+    ResetStreams(fentry, size, false);
+  }
+  if (s.ok() && !garbage.empty()) {
+    CollectGarbage(garbage);
+  }
+  return s;
 }
 
 Status BlkDB::Stat(const Fentry& fentry, uint64_t* mtime, uint64_t* size) {
@@ -208,9 +682,25 @@ Status BlkDB::Stat(const Fentry& fentry, uint64_t* mtime, uint64_t* size) {
 }
 
 Status BlkDB::Drop(const Fentry& fentry) {
-  // Dropping a stream involving deleting a whole range of DB
-  // records and we currently don't support it.
-  return Status::NotSupported(Slice());
+  Status s = CommitPendingWrites();
+  if (!s.ok()) {
+    return s;
+  }
+  WriteBatch batch;
+  std::map<uint64_t, uint64_t> garbage;
+  s = PrepareTrunc(fentry, 0, &batch, &garbage);
+  if (s.ok()) {
+    WriteOptions options;
+    options.sync = sync_;
+    s = db_->Write(options, &batch);
+  }
+  if (s.ok()) {
+    ResetStreams(fentry, 0, true);
+  }
+  if (s.ok() && !garbage.empty()) {
+    CollectGarbage(garbage);
+  }
+  return s;
 }
 
 Status BlkDB::Ftrunc(const Fentry& fentry, Handle* fh, uint64_t size) {
@@ -228,6 +718,11 @@ Status BlkDB::Flush(const Fentry& fentry, Handle* fh, bool force_sync) {
   MutexLock ml(&mutex_);
   if (stream->nflus < 0 || stream->nwrites < 0) {
     s = NoMoreUpdates();
+  } else if (!batch_error_.ok()) {
+    // Buffered block writes may have been lost with a failed commit
+    s = batch_error_;
+    stream->nwrites = -1;
+    stream->nflus = -1;
   } else if (force_sync || stream->nflus < stream->nwrites) {
     int32_t nwrites = stream->nwrites;
     int32_t nflus = stream->nflus;
@@ -235,19 +730,34 @@ Status BlkDB::Flush(const Fentry& fentry, Handle* fh, bool force_sync) {
     header.mtime = stream->mtime;
     header.size = stream->size;
     mutex_.Unlock();
-    if (nflus < nwrites) {
-      char tmp[20];
-      Slice header_encoding = header.EncodeTo(tmp);
-      Key key(UntypedKeyPrefix(fentry));
-      key.SetType(kHeaderType);
-      WriteOptions options;
-      options.sync = (force_sync || sync_);
-      key.SetOffset(uniquefier_);
-      s = db_->Put(options, key.Encode(), header_encoding);
+    char tmp[20];
+    Slice header_encoding = header.EncodeTo(tmp);
+    Key key(UntypedKeyPrefix(fentry));
+    key.SetType(kHeaderType);
+    key.SetOffset(uniquefier_);
+    WriteOptions options;
+    options.sync = (force_sync || sync_);
+    if (force_sync && !value_log_dir_.empty()) {
+      s = SyncValueLog();  // Blob data must be durable before the pointers
+    }
+    if (!s.ok()) {
+      mutex_.Lock();
+    } else if (write_batch_size_ != 0) {
+      // The header is committed along with all buffered block writes
+      mutex_.Lock();
+      if (nflus < nwrites) {
+        batch_->Put(key.Encode(), header_encoding);
+        batch_bytes_ += key.size() + header_encoding.size();
+      }
+      s = CommitBatch(options.sync);
     } else {
-      s = db_->SyncWAL();
+      if (nflus < nwrites) {
+        s = db_->Put(options, key.Encode(), header_encoding);
+      } else {
+        s = db_->SyncWAL();
+      }
+      mutex_.Lock();
     }
-    mutex_.Lock();
     if (s.ok()) {
       if (nwrites > stream->nflus) {
         stream->nflus = nwrites;
@@ -261,13 +771,16 @@ Status BlkDB::Flush(const Fentry& fentry, Handle* fh, bool force_sync) {
   return s;
 }
 
+// Flush a stream and free it. The stream is freed even if the flush fails,
+// in which case the error is returned.
 Status BlkDB::Close(const Fentry& fentry, Handle* fh) {
+  Status s;
   assert(fh != NULL);
   Stream* stream = reinterpret_cast<Stream*>(fh);
   MutexLock ml(&mutex_);
   while (stream->nflus < stream->nwrites) {
     mutex_.Unlock();
-    Status s = Flush(fentry, fh);
+    s = Flush(fentry, fh);
     mutex_.Lock();
     if (!s.ok()) {
       break;
@@ -276,8 +789,32 @@ Status BlkDB::Close(const Fentry& fentry, Handle* fh) {
   if (stream->iter != NULL) {
     delete stream->iter;
   }
+  streams_.erase(stream);
   delete stream;
-  return Status::OK();
+  return s;
+}
+
+// Write a data block to the db, or add it to the current write batch.
+// REQUIRES: mutex_ has NOT been locked.
+Status BlkDB::PutBlock(const Slice& key, const Slice& value) {
+  Status s;
+  if (write_batch_size_ != 0) {
+    MutexLock ml(&mutex_);
+    if (!batch_error_.ok()) {
+      s = batch_error_;
+    } else {
+      batch_->Put(key, value);
+      batch_bytes_ += key.size() + value.size();
+      if (batch_bytes_ >= write_batch_size_) {
+        s = CommitBatch(sync_);
+      }
+    }
+  } else {
+    WriteOptions options;
+    options.sync = sync_;
+    s = db_->Put(options, key, value);
+  }
+  return s;
 }
 
 // REQUIRES: mutex_ has been locked.
@@ -288,16 +825,43 @@ Status BlkDB::WriteTo(Stream* stream, const Fentry& fentry, const Slice& data,
   Key key(UntypedKeyPrefix(fentry));
   key.SetType(kDataBlockType);
   key.SetOffset(end - 1);
-  WriteOptions options;
-  options.sync = sync_;
-  Status s = db_->Put(options, key.Encode(), data);
+  Status s;
+  Extent extent;
+  extent.off = off;
+  extent.size = data.size();
+  extent.blob_number = 0;
+  extent.blob_off = 0;
+  if (!value_log_dir_.empty()) {
+    std::string pointer;
+    vlog_mu_.Lock();
+    s = AppendToValueLog(data, &pointer);
+    vlog_mu_.Unlock();
+    if (s.ok()) {
+      s = PutBlock(key.Encode(), pointer);
+    }
+    if (s.ok()) {
+      Slice input = pointer;
+      BlobPointer ptr;
+      ptr.DecodeFrom(&input);
+      extent.blob_number = ptr.file_number;
+      extent.blob_off = ptr.off;
+    }
+  } else {
+    s = PutBlock(key.Encode(), data);
+  }
   mutex_.Lock();
   if (s.ok()) {
-    stream->nwrites++;
-    if (stream->iter != NULL) {
-      delete stream->iter;
-      stream->iter = NULL;
+    // The stream's iterator is kept. Reads check it against the extents
+    // written since its creation.
+    if (extent.size != 0) {
+      if (stream->extents.size() >= kMaxStreamExtents) {
+        stream->extents.clear();
+        stream->extents_seq = stream->nwrites;
+      }
+      extent.seq = stream->nwrites;
+      stream->extents[end - 1] = extent;
     }
+    stream->nwrites++;
     uint64_t mtime = CurrentMicros();
     if (mtime > stream->mtime) {
       stream->mtime = mtime;
@@ -344,57 +908,226 @@ Status BlkDB::Pwrite(const Fentry& fentry, Handle* fh, const Slice& data,
   return s;
 }
 
-namespace {
-struct BlkInfo {
-  BlkInfo() {}
-  bool ParseFrom(const Slice& k, const Slice& v);
-  uint64_t size;
-  uint64_t off;
-};
+// Find the blocks written through a stream that fully cover the range
+// [off, off + size). Return false if the range is not fully covered.
+static bool GetExtents(const Stream* stream, uint64_t off, uint64_t size,
+                       std::vector<Extent>* result) {
+  const uint64_t end = off + size;
+  std::map<uint64_t, Extent>::const_iterator it =
+      stream->extents.lower_bound(off);
+  while (off < end) {
+    if (it == stream->extents.end() || it->second.off > off) {
+      return false;  // Hole or data not written through the stream
+    }
+    result->push_back(it->second);
+    off = it->first + 1;
+    ++it;
+  }
+  return true;
+}
 
-static bool FetchOffset(const Slice& encoding, uint64_t* result) {
-  if (encoding.size() < 8) {
+// Return true if an iterator created at write "iter_seq" may not see
+// some of the data in [off, off + size).
+static bool IsStale(const Stream* stream, int32_t iter_seq, uint64_t off,
+                    uint64_t size) {
+  if (iter_seq >= stream->nwrites) {
     return false;
-  } else {
-    memcpy(result, encoding.data(), 8);
-    *result = be64toh(*result);
+  } else if (iter_seq < stream->extents_seq) {
     return true;
   }
+  std::map<uint64_t, Extent>::const_iterator it =
+      stream->extents.lower_bound(off);
+  for (; it != stream->extents.end(); ++it) {
+    if (it->second.seq >= iter_seq && it->second.off < off + size) {
+      return true;
+    }
+  }
+  return false;
 }
 
-bool BlkInfo::ParseFrom(const Slice& k, const Slice& v) {
-  uint64_t end;
-  if (!FetchOffset(k, &end)) {
-    return false;
+// Part of a read served by a single block, either from a blob file or by
+// getting the block from the db.
+struct BlkDB::ReadPiece {
+  ReadContext* ctx;
+  uint64_t blob_number;  // 0 if the block is kept in the db
+  uint64_t blob_off;
+  uint64_t block_end;  // Last byte of the block
+  uint64_t block_size;
+  uint64_t off;  // Offset within the block
+  uint64_t n;
+  char* dst;
+  Status status;
+};
+
+struct BlkDB::ReadContext {
+  ReadContext(BlkDB* db, const Slice& key_prefix)
+      : db(db), key_prefix(key_prefix), cv(&mu), num_running(0) {}
+  BlkDB* const db;
+  const Slice key_prefix;  // Prefix of the stream's data block keys
+  port::Mutex mu;
+  port::CondVar cv;
+  // State below is protected by mu
+  int num_running;
+};
+
+// Return NotFound if a block kept in the db has since been replaced, or if
+// the blob file holding a block has since been reclaimed.
+Status BlkDB::FetchPiece(const Slice& key_prefix, const ReadPiece& piece) {
+  Status s;
+  if (piece.blob_number != 0) {
+    s = ReadFromValueLog(piece.blob_number, piece.blob_off + piece.off,
+                         piece.n, piece.dst);
   } else {
-    size = v.size();
-    off = end - size + 1;
-    return true;
+    Key key(key_prefix);
+    key.SetOffset(piece.block_end);
+    ReadOptions options;
+    options.verify_checksums = verify_checksum_;
+    std::string data;
+    s = db_->Get(options, key.Encode(), &data);
+    if (s.ok()) {
+      if (data.size() != piece.block_size) {
+        s = Status::NotFound(Slice());
+      } else {
+        memcpy(piece.dst, data.data() + piece.off, piece.n);
+      }
+    }
   }
+  return s;
+}
+
+void BlkDB::BGFetchPiece(void* arg) {
+  ReadPiece* const piece = reinterpret_cast<ReadPiece*>(arg);
+  ReadContext* const ctx = piece->ctx;
+  piece->status = ctx->db->FetchPiece(ctx->key_prefix, *piece);
+  MutexLock ml(&ctx->mu);
+  assert(ctx->num_running > 0);
+  ctx->num_running--;
+  ctx->cv.SignalAll();
+}
+
+// Fetch all pieces of a read. Pieces are fetched concurrently through
+// reader_pool_ if it is set, with the caller's thread fetching the first
+// piece. Return the status of the first piece that failed.
+Status BlkDB::FetchPieces(const Slice& key_prefix,
+                          std::vector<ReadPiece>* pieces) {
+  if (reader_pool_ == NULL || pieces->size() < 2) {
+    for (size_t i = 0; i < pieces->size(); i++) {
+      Status s = FetchPiece(key_prefix, (*pieces)[i]);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    return Status::OK();
+  }
+
+  ReadContext ctx(this, key_prefix);
+  ctx.mu.Lock();
+  ctx.num_running = static_cast<int>(pieces->size() - 1);
+  ctx.mu.Unlock();
+  for (size_t i = 1; i < pieces->size(); i++) {
+    ReadPiece* const piece = &(*pieces)[i];
+    piece->ctx = &ctx;
+    reader_pool_->Schedule(BGFetchPiece, piece);
+  }
+  (*pieces)[0].status = FetchPiece(key_prefix, (*pieces)[0]);
+  ctx.mu.Lock();
+  while (ctx.num_running > 0) {
+    ctx.cv.Wait();
+  }
+  ctx.mu.Unlock();
+  for (size_t i = 0; i < pieces->size(); i++) {
+    if (!(*pieces)[i].status.ok()) {
+      return (*pieces)[i].status;
+    }
+  }
+  return Status::OK();
+}
+
+// Read [off, off + size) from a list of blocks returned by GetExtents().
+// Return NotFound if a block has since been replaced by another stream or
+// is no longer available.
+Status BlkDB::ReadExtents(const Fentry& fentry,
+                          const std::vector<Extent>& extents, uint64_t off,
+                          uint64_t size, char* scratch) {
+  Key key(UntypedKeyPrefix(fentry));
+  key.SetType(kDataBlockType);
+  std::vector<ReadPiece> pieces(extents.size());
+  const uint64_t end = off + size;
+  char* p = scratch;
+  for (size_t i = 0; i < extents.size(); i++) {
+    const Extent& e = extents[i];
+    ReadPiece* const piece = &pieces[i];
+    piece->ctx = NULL;
+    piece->blob_number = e.blob_number;
+    piece->blob_off = e.blob_off;
+    piece->block_end = e.off + e.size - 1;
+    piece->block_size = e.size;
+    piece->off = off - e.off;
+    piece->n = std::min(end, e.off + e.size) - off;
+    piece->dst = p;
+    off += piece->n;
+    p += piece->n;
+  }
+  return FetchPieces(key.prefix(), &pieces);
 }
-}  // namespace
 
 // REQUIRES: mutex_ has been locked.
 Status BlkDB::ReadFrom(Stream* stream, const Fentry& fentry, Slice* result,
                        uint64_t off, uint64_t size, char* scratch) {
   Status s;
+  if (!batch_error_.ok() && stream->nflus < stream->nwrites) {
+    // Writes not yet flushed may have been lost with a failed commit
+    return batch_error_;
+  } else if (batch_bytes_ != 0) {  // Make buffered writes visible to the read
+    s = CommitBatch(false);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  const bool is_pointer = !value_log_dir_.empty();
   uint64_t flen = stream->size;
-  int32_t nwrites = stream->nwrites;
+  if (off < flen && off + size > flen) {
+    size = flen - off;
+  }
+
+  // Blocks written through the stream are read without the iterator
+  std::vector<Extent> extents;
+  if (off < flen && GetExtents(stream, off, size, &extents)) {
+    mutex_.Unlock();
+    s = ReadExtents(fentry, extents, off, size, scratch);
+    mutex_.Lock();
+    if (s.ok()) {
+      *result = Slice(scratch, size);
+      return s;
+    } else if (!s.IsNotFound()) {
+      Error(__LOG_ARGS__, s);
+      return s;
+    } else {
+      s = Status::OK();  // Fall back to the iterator
+    }
+  }
+
   Iterator* iter = stream->iter;
+  int32_t iter_seq = stream->iter_seq;
   stream->iter = NULL;
+  bool stale = iter != NULL && off < flen &&
+               IsStale(stream, iter_seq, off, size);
+  int32_t nwrites = stream->nwrites;
   mutex_.Unlock();
 
+  if (stale) {
+    delete iter;
+    iter = NULL;
+  }
+
   if (iter == NULL) {
     ReadOptions options;
     options.verify_checksums = verify_checksum_;
     iter = db_->NewIterator(options);
+    iter_seq = nwrites;
   }
 
   if (off < flen) {
-    if (off + size > flen) {
-      size = flen - off;
-    }
-
     Key key(UntypedKeyPrefix(fentry));
     key.SetType(kDataBlockType);
     Slice key_prefix = key.prefix();
@@ -404,7 +1137,7 @@ Status BlkDB::ReadFrom(Stream* stream, const Fentry& fentry, Slice* result,
       if (k.starts_with(key_prefix)) {
         BlkInfo blk;
         k.remove_prefix(key_prefix.size());
-        if (blk.ParseFrom(k, iter->value())) {
+        if (blk.ParseFrom(k, iter->value(), is_pointer)) {
           if (off >= blk.off) {
             if (off < blk.off + blk.size) {
               do_seek = false;
@@ -422,6 +1155,8 @@ Status BlkDB::ReadFrom(Stream* stream, const Fentry& fentry, Slice* result,
       iter->Seek(key.Encode());
     }
 
+    // Blob data is fetched once all blocks are located
+    std::vector<ReadPiece> pieces;
     char* p = scratch;
     while (size != 0 && iter->Valid()) {
       BlkInfo blk;
@@ -429,7 +1164,7 @@ Status BlkDB::ReadFrom(Stream* stream, const Fentry& fentry, Slice* result,
       Slice data = iter->value();
       if (k.starts_with(key_prefix)) {
         k.remove_prefix(key_prefix.size());
-        if (!blk.ParseFrom(k, data)) {
+        if (!blk.ParseFrom(k, data, is_pointer)) {
           iter->Next();
           continue;  // Skip bad blocks
         } else {
@@ -452,7 +1187,20 @@ Status BlkDB::ReadFrom(Stream* stream, const Fentry& fentry, Slice* result,
       if (size != 0) {
         if (off < blk.off + blk.size) {
           uint64_t n = std::min(size, blk.off + blk.size - off);
-          memcpy(p, data.data() + off - blk.off, n);
+          if (is_pointer) {
+            ReadPiece piece;
+            piece.ctx = NULL;
+            piece.blob_number = blk.ptr.file_number;
+            piece.blob_off = blk.ptr.off;
+            piece.block_end = blk.off + blk.size - 1;
+            piece.block_size = blk.size;
+            piece.off = off - blk.off;
+            piece.n = n;
+            piece.dst = p;
+            pieces.push_back(piece);
+          } else {
+            memcpy(p, data.data() + off - blk.off, n);
+          }
           size -= n;
           off += n;
           p += n;
@@ -463,24 +1211,28 @@ Status BlkDB::ReadFrom(Stream* stream, const Fentry& fentry, Slice* result,
         iter->Next();
       }
     }
-    *result = Slice(scratch, p - scratch);
     if (!iter->Valid()) {
       s = iter->status();
     }
+    // The rest of the range is within the file size but past all blocks,
+    // such as after a truncation extended the file
+    if (s.ok() && size != 0) {
+      memset(p, 0, size);
+      p += size;
+    }
+    *result = Slice(scratch, p - scratch);
+    if (s.ok() && !pieces.empty()) {
+      s = FetchPieces(key_prefix, &pieces);
+    }
   }
   mutex_.Lock();
   if (s.ok()) {
     if (stream->iter == NULL) {
       stream->iter = iter;
+      stream->iter_seq = iter_seq;
     } else {
       delete iter;
     }
-    if (stream->nwrites > nwrites) {
-      if (stream->iter != NULL) {
-        delete stream->iter;
-        stream->iter = NULL;
-      }
-    }
   } else {
     Error(__LOG_ARGS__, s);
     delete iter;
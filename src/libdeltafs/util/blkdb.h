@@ -12,13 +12,28 @@
 #pragma once
 
 #include "pdlfs-common/leveldb/db.h"
+#include "pdlfs-common/leveldb/write_batch.h"
 
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/fio.h"
 #include "pdlfs-common/status.h"
 
+#include <map>
+#include <set>
+#include <vector>
+
 namespace pdlfs {
 
+// A data block written through a stream.
+struct Extent {
+  Extent() {}
+  uint64_t off;
+  uint64_t size;
+  uint64_t blob_number;  // Blob file holding the data, or 0 if kept in the db
+  uint64_t blob_off;
+  int32_t seq;  // Index of the write that produced the block
+};
+
 // Each file is regarded as a stream of variable-size data blocks with
 // each block having an offset, a size, and an extent of file data.
 struct Stream : public Fio::Handle {
@@ -26,8 +41,16 @@ struct Stream : public Fio::Handle {
   uint64_t mtime;
   uint64_t size;
   uint64_t off;  // Current read/write position
+  std::string prefix;  // Untyped key prefix of the file
+
+  // Blocks written through the stream, keyed by their last byte. Lets reads
+  // of recently written data skip the iterator, and tells whether an
+  // iterator is still current for a given range.
+  std::map<uint64_t, Extent> extents;
+  int32_t extents_seq;  // Writes before this one are no longer tracked
 
   Iterator* iter;   // Cursor to the current data block
+  int32_t iter_seq;  // Writes since this one may not be visible to iter
   int32_t nwrites;  // Number of block writes
   int32_t nflus;    // Number of writes committed to the header
 };
@@ -47,6 +70,30 @@ struct BlkDBOptions {
   bool verify_checksum;
   bool owns_db;
   DB* db;
+  // If not zero, block writes from all streams are buffered in one write
+  // batch, which is committed to the db once it reaches this many bytes,
+  // or when a stream is read, flushed, or closed. With sync on, each
+  // commit costs one sync instead of each write.
+  // Default: 0
+  uint64_t write_batch_size;
+  // If not empty, file data is appended to blob files under this directory
+  // and the db only keeps pointers to it, so that data is not rewritten
+  // by db compactions. A db must always be opened with the same setting.
+  // Blob space is reclaimed as files are truncated or dropped. Blocks
+  // rewritten at the same offset are not accounted for.
+  // Default: ""
+  std::string value_log_dir;
+  // A new blob file is started once the current one reaches this size.
+  // Default: 64MB
+  uint64_t value_log_file_size;
+  // Env used to access blob files. Set to NULL to use Env::Default().
+  // Default: NULL
+  Env* env;
+  // Thread pool used to fetch the blocks of a read concurrently. Only
+  // blocks read from blob files or got from the db one at a time benefit
+  // from it. If set to NULL, blocks are fetched by the caller's thread.
+  // Default: NULL
+  ThreadPool* reader_pool;
 };
 
 class BlkDB : public Fio {
@@ -55,6 +102,28 @@ class BlkDB : public Fio {
 
   Status ReadFrom(Stream*, const Fentry& fentry, Slice* result, uint64_t off,
                   uint64_t size, char* scratch);
+  Status ReadExtents(const Fentry& fentry, const std::vector<Extent>& extents,
+                     uint64_t off, uint64_t size, char* scratch);
+  struct ReadPiece;
+  struct ReadContext;
+  Status FetchPieces(const Slice& key_prefix, std::vector<ReadPiece>* pieces);
+  Status FetchPiece(const Slice& key_prefix, const ReadPiece& piece);
+  static void BGFetchPiece(void*);
+
+  Status PutBlock(const Slice& key, const Slice& value);
+  Status CommitBatch(bool sync);
+  Status CommitPendingWrites();
+
+  Status OpenValueLog();
+  Status AppendToValueLog(const Slice& data, std::string* pointer);
+  Status ReadFromValueLog(uint64_t file_number, uint64_t off, size_t n,
+                          char* scratch);
+  Status SyncValueLog();
+  Status PrepareTrunc(const Fentry& fentry, uint64_t size, WriteBatch* batch,
+                      std::map<uint64_t, uint64_t>* garbage);
+  void ResetStreams(const Fentry& fentry, uint64_t size, bool drop);
+  void CollectGarbage(const std::map<uint64_t, uint64_t>& garbage);
+  std::string ValueLogFileName(uint64_t file_number) const;
 
   static const KeyType kHeaderType = kDataDesType;
 
@@ -95,6 +164,31 @@ class BlkDB : public Fio {
   bool verify_checksum_;
   bool owns_db_;
   DB* db_;
+  const uint64_t write_batch_size_;
+  const std::string value_log_dir_;
+  const uint64_t value_log_file_size_;
+  Env* const env_;
+  ThreadPool* const reader_pool_;
+
+  // State below is protected by mutex_
+  WriteBatch* batch_;  // Block writes not yet committed to the db
+  uint64_t batch_bytes_;
+  Status batch_error_;  // Set once a commit has failed
+  port::Mutex commit_mu_;  // Serializes commits; acquired before mutex_
+  // Streams currently open. Updated by Trunc() and Drop() so that open
+  // streams do not write back a stale file size.
+  std::set<Stream*> streams_;
+
+  // State below is protected by vlog_mu_
+  port::Mutex vlog_mu_;
+  struct ValueLogReader;
+  std::map<uint64_t, ValueLogReader*> vlog_readers_;  // By file number
+  // Bytes no longer referenced by the db, by file number. Only kept in
+  // memory so garbage left behind by earlier sessions is never reclaimed.
+  std::map<uint64_t, uint64_t> vlog_garbage_;
+  WritableFile* vlog_;  // NULL until the first write
+  uint64_t vlog_number_;
+  uint64_t vlog_off_;
 };
 
 }  // namespace pdlfs
@@ -0,0 +1,506 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "blkdb.h"
+
+#include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
+
+#include <vector>
+
+namespace pdlfs {
+
+namespace {
+// A wrapper that allows injection of write errors.
+class ErrorEnv : public EnvWrapper {
+ public:
+  bool writable_file_error_;
+
+  explicit ErrorEnv(Env* base = Env::Default())
+      : EnvWrapper(base), writable_file_error_(false) {}
+
+  virtual Status NewWritableFile(const char* fname, WritableFile** result) {
+    Status s = target()->NewWritableFile(fname, result);
+    if (s.ok()) {
+      *result = new ErrorFile(this, *result);
+    }
+    return s;
+  }
+
+ private:
+  class ErrorFile : public WritableFile {
+   public:
+    ErrorFile(ErrorEnv* env, WritableFile* base) : env_(env), base_(base) {}
+    virtual ~ErrorFile() { delete base_; }
+
+    virtual Status Append(const Slice& data) {
+      if (env_->writable_file_error_) {
+        return Status::IOError("fake error");
+      }
+      return base_->Append(data);
+    }
+
+    virtual Status Close() { return base_->Close(); }
+    virtual Status Flush() { return base_->Flush(); }
+    virtual Status Sync() { return base_->Sync(); }
+
+   private:
+    ErrorEnv* env_;
+    WritableFile* base_;
+  };
+};
+}  // namespace
+
+class BlkDBTest {
+ public:
+  BlkDBTest()
+      : value_log_(false),
+        value_log_file_size_(0),
+        write_batch_size_(0),
+        reader_pool_(NULL),
+        blkdb_(NULL) {
+    env_ = &error_env_;
+    dbname_ = test::PrepareTmpDir("blkdb_test", env_);
+    dbopts_.env = env_;
+    DestroyDB(dbname_, dbopts_);
+    DestroyValueLog();
+    dbopts_.create_if_missing = true;
+  }
+
+  ~BlkDBTest() {
+    delete blkdb_;
+    delete reader_pool_;
+    DestroyDB(dbname_, dbopts_);
+    DestroyValueLog();
+  }
+
+  std::string ValueLogDir() const { return dbname_ + "_blobs"; }
+
+  void DestroyValueLog() {
+    std::vector<std::string> names;
+    std::string dir = ValueLogDir();
+    env_->GetChildren(dir.c_str(), &names);
+    for (size_t i = 0; i < names.size(); i++) {
+      std::string fname = dir + "/" + names[i];
+      env_->DeleteFile(fname.c_str());
+    }
+    env_->DeleteDir(dir.c_str());
+  }
+
+  // Close and reopen the BlkDB on top of the same db
+  void Reopen() {
+    delete blkdb_;
+    blkdb_ = NULL;
+    DB* db;
+    ASSERT_OK(DB::Open(dbopts_, dbname_, &db));
+    BlkDBOptions options;
+    options.uniquefier = 1;
+    options.db = db;
+    options.owns_db = true;
+    if (value_log_) {
+      options.value_log_dir = ValueLogDir();
+    }
+    if (value_log_file_size_ != 0) {
+      options.value_log_file_size = value_log_file_size_;
+    }
+    options.write_batch_size = write_batch_size_;
+    options.reader_pool = reader_pool_;
+    blkdb_ = new BlkDB(options);
+  }
+
+  static Fentry File(uint64_t ino) {
+    Fentry fentry;
+    fentry.stat.SetRegId(0);
+    fentry.stat.SetSnapId(0);
+    fentry.stat.SetInodeNo(ino);
+    return fentry;
+  }
+
+  Fio::Handle* Creat(const Fentry& fentry) {
+    Fio::Handle* fh;
+    ASSERT_OK(blkdb_->Creat(fentry, false, &fh));
+    return fh;
+  }
+
+  Fio::Handle* Open(const Fentry& fentry, uint64_t* size) {
+    Fio::Handle* fh;
+    uint64_t mtime;
+    ASSERT_OK(blkdb_->Open(fentry, false, false, false, &mtime, size, &fh));
+    return fh;
+  }
+
+  void Write(const Fentry& fentry, Fio::Handle* fh, char c, uint64_t off,
+             size_t n) {
+    ASSERT_OK(blkdb_->Pwrite(fentry, fh, std::string(n, c), off));
+  }
+
+  std::string Read(const Fentry& fentry, Fio::Handle* fh, uint64_t off,
+                   size_t n) {
+    std::string scratch(n, 'x');
+    Slice result;
+    ASSERT_OK(blkdb_->Pread(fentry, fh, &result, off, n, &scratch[0]));
+    return result.ToString();
+  }
+
+  uint64_t Size(const Fentry& fentry, Fio::Handle* fh) {
+    uint64_t mtime, size;
+    ASSERT_OK(blkdb_->Fstat(fentry, fh, &mtime, &size));
+    return size;
+  }
+
+  void TestWriteRead() {
+    Fentry file = File(1);
+    Fio::Handle* fh = Creat(file);
+    Write(file, fh, 'a', 0, 100);
+    Write(file, fh, 'b', 100, 100);
+    Write(file, fh, 'c', 300, 50);  // Leaves a hole
+    std::string expected =
+        std::string(100, 'a') + std::string(100, 'b') +
+        std::string(100, '\0') + std::string(50, 'c');
+    ASSERT_EQ(Size(file, fh), 350);
+    ASSERT_EQ(Read(file, fh, 0, 1000), expected);
+    ASSERT_EQ(Read(file, fh, 150, 200), expected.substr(150));
+    ASSERT_OK(blkdb_->Close(file, fh));
+    Reopen();
+    uint64_t size;
+    fh = Open(file, &size);
+    ASSERT_EQ(size, 350);
+    ASSERT_EQ(Read(file, fh, 0, 1000), expected);
+    ASSERT_OK(blkdb_->Close(file, fh));
+  }
+
+  void TestTrunc() {
+    Fentry file = File(1);
+    Fio::Handle* fh = Creat(file);
+    Write(file, fh, 'a', 0, 100);
+    Write(file, fh, 'b', 100, 100);
+    Write(file, fh, 'c', 200, 100);
+    ASSERT_OK(blkdb_->Flush(file, fh));
+    ASSERT_OK(blkdb_->Trunc(file, 150));
+    // The open stream sees the new size
+    ASSERT_EQ(Size(file, fh), 150);
+    std::string expected = std::string(100, 'a') + std::string(50, 'b');
+    ASSERT_EQ(Read(file, fh, 0, 300), expected);
+    // Later updates through the stream do not restore the old size
+    Write(file, fh, 'd', 0, 10);
+    ASSERT_OK(blkdb_->Close(file, fh));
+    expected.replace(0, 10, std::string(10, 'd'));
+    Reopen();
+    uint64_t size;
+    fh = Open(file, &size);
+    ASSERT_EQ(size, 150);
+    ASSERT_EQ(Read(file, fh, 0, 300), expected);
+    ASSERT_OK(blkdb_->Close(file, fh));
+  }
+
+  void TestTruncOverlappingBlocks() {
+    Fentry file = File(1);
+    Fio::Handle* fh = Creat(file);
+    Write(file, fh, 'a', 0, 300);
+    Write(file, fh, 'b', 0, 200);  // Hides the head of the first block
+    ASSERT_OK(blkdb_->Close(file, fh));
+    // Both blocks cross the new size
+    ASSERT_OK(blkdb_->Trunc(file, 100));
+    Reopen();
+    uint64_t size;
+    fh = Open(file, &size);
+    ASSERT_EQ(size, 100);
+    ASSERT_EQ(Read(file, fh, 0, 300), std::string(100, 'b'));
+    ASSERT_OK(blkdb_->Close(file, fh));
+  }
+
+  void TestInterleavedWriteRead() {
+    Fentry file = File(1);
+    Fio::Handle* fh = Creat(file);
+    Write(file, fh, 'a', 0, 100);
+    ASSERT_EQ(Read(file, fh, 0, 100), std::string(100, 'a'));
+    Write(file, fh, 'b', 100, 100);
+    std::string expected = std::string(100, 'a') + std::string(100, 'b');
+    ASSERT_EQ(Read(file, fh, 0, 300), expected);
+    Write(file, fh, 'c', 100, 100);  // Replaces the second block
+    expected.replace(100, 100, std::string(100, 'c'));
+    ASSERT_EQ(Read(file, fh, 50, 100), expected.substr(50, 100));
+    Write(file, fh, 'd', 200, 50);
+    expected += std::string(50, 'd');
+    ASSERT_EQ(Read(file, fh, 0, 300), expected);
+    ASSERT_EQ(Read(file, fh, 150, 100), expected.substr(150));
+    ASSERT_OK(blkdb_->Close(file, fh));
+  }
+
+  void TestReadAfterTrunc() {
+    Fentry file = File(1);
+    Fio::Handle* fh = Creat(file);
+    Write(file, fh, 'a', 0, 100);
+    ASSERT_EQ(Read(file, fh, 0, 100), std::string(100, 'a'));
+    ASSERT_OK(blkdb_->Trunc(file, 50));
+    ASSERT_EQ(Read(file, fh, 0, 100), std::string(50, 'a'));
+    // Data cut by the truncation must not come back
+    Write(file, fh, 'x', 150, 50);
+    std::string expected = std::string(50, 'a') + std::string(100, '\0') +
+                           std::string(50, 'x');
+    ASSERT_EQ(Read(file, fh, 0, 100), expected.substr(0, 100));
+    ASSERT_EQ(Read(file, fh, 0, 200), expected);
+    ASSERT_OK(blkdb_->Close(file, fh));
+  }
+
+  void TestDrop() {
+    Fentry file = File(1);
+    Fentry other = File(2);
+    Fio::Handle* fh = Creat(file);
+    Fio::Handle* other_fh = Creat(other);
+    Write(file, fh, 'a', 0, 100);
+    Write(other, other_fh, 'b', 0, 100);
+    ASSERT_OK(blkdb_->Flush(file, fh));
+    ASSERT_OK(blkdb_->Drop(file));
+    // The open stream no longer accepts updates
+    ASSERT_TRUE(!blkdb_->Flush(file, fh, true).ok());
+    ASSERT_TRUE(!blkdb_->Pwrite(file, fh, "x", 0).ok());
+    ASSERT_EQ(Read(file, fh, 0, 100), "");
+    ASSERT_OK(blkdb_->Close(file, fh));
+    ASSERT_OK(blkdb_->Close(other, other_fh));
+    Reopen();
+    uint64_t mtime, size;
+    Status s = blkdb_->Open(file, false, false, false, &mtime, &size, &fh);
+    ASSERT_TRUE(s.IsNotFound());
+    fh = Creat(file);
+    ASSERT_EQ(Read(file, fh, 0, 100), "");
+    ASSERT_OK(blkdb_->Close(file, fh));
+    other_fh = Open(other, &size);
+    ASSERT_EQ(size, 100);
+    ASSERT_EQ(Read(other, other_fh, 0, 100), std::string(100, 'b'));
+    ASSERT_OK(blkdb_->Close(other, other_fh));
+  }
+
+  void TestBatchedWrites() {
+    Fentry file1 = File(1);
+    Fentry file2 = File(2);
+    Fio::Handle* fh1 = Creat(file1);
+    Fio::Handle* fh2 = Creat(file2);
+    for (int i = 0; i < 10; i++) {  // Writes from both streams share a batch
+      Write(file1, fh1, 'a' + i, 100 * i, 100);
+      Write(file2, fh2, 'A' + i, 50 * i, 50);
+    }
+    std::string expected1, expected2;
+    for (int i = 0; i < 10; i++) {
+      expected1 += std::string(100, 'a' + i);
+      expected2 += std::string(50, 'A' + i);
+    }
+    ASSERT_EQ(Read(file1, fh1, 0, 1000), expected1);
+    ASSERT_EQ(Read(file2, fh2, 0, 500), expected2);
+    ASSERT_OK(blkdb_->Close(file1, fh1));
+    ASSERT_OK(blkdb_->Close(file2, fh2));
+    Reopen();
+    uint64_t size;
+    fh1 = Open(file1, &size);
+    ASSERT_EQ(size, 1000);
+    ASSERT_EQ(Read(file1, fh1, 0, 1000), expected1);
+    ASSERT_OK(blkdb_->Close(file1, fh1));
+    fh2 = Open(file2, &size);
+    ASSERT_EQ(size, 500);
+    ASSERT_EQ(Read(file2, fh2, 0, 500), expected2);
+    ASSERT_OK(blkdb_->Close(file2, fh2));
+  }
+
+  void TestMultiBlockRead() {
+    Fentry file = File(1);
+    Fio::Handle* fh = Creat(file);
+    std::string expected;
+    for (int i = 0; i < 16; i++) {
+      if (i % 5 == 4) {  // Leaves a hole
+        expected += std::string(100, '\0');
+      } else {
+        Write(file, fh, 'a' + i, 100 * i, 100);
+        expected += std::string(100, 'a' + i);
+      }
+    }
+    Write(file, fh, 'z', 1500, 50);  // Hides the head of the last block
+    expected.replace(1500, 50, std::string(50, 'z'));
+    Write(file, fh, 'Z', 200, 100);  // Replaces a block
+    expected.replace(200, 100, std::string(100, 'Z'));
+    ASSERT_EQ(Read(file, fh, 0, 2000), expected);
+    ASSERT_EQ(Read(file, fh, 250, 1000), expected.substr(250, 1000));
+    ASSERT_OK(blkdb_->Close(file, fh));
+    Reopen();
+    uint64_t size;
+    fh = Open(file, &size);
+    ASSERT_EQ(size, expected.size());
+    ASSERT_EQ(Read(file, fh, 0, 2000), expected);
+    ASSERT_EQ(Read(file, fh, 1450, 500), expected.substr(1450));
+    ASSERT_OK(blkdb_->Close(file, fh));
+  }
+
+  std::string dbname_;
+  DBOptions dbopts_;
+  bool value_log_;
+  uint64_t value_log_file_size_;
+  uint64_t write_batch_size_;
+  ThreadPool* reader_pool_;
+  BlkDB* blkdb_;
+  ErrorEnv error_env_;
+  Env* env_;
+};
+
+TEST(BlkDBTest, WriteRead) {
+  Reopen();
+  TestWriteRead();
+}
+
+TEST(BlkDBTest, Trunc) {
+  Reopen();
+  TestTrunc();
+}
+
+TEST(BlkDBTest, TruncOverlappingBlocks) {
+  Reopen();
+  TestTruncOverlappingBlocks();
+}
+
+TEST(BlkDBTest, InterleavedWriteRead) {
+  Reopen();
+  TestInterleavedWriteRead();
+}
+
+TEST(BlkDBTest, ReadAfterTrunc) {
+  Reopen();
+  TestReadAfterTrunc();
+}
+
+TEST(BlkDBTest, Drop) {
+  Reopen();
+  TestDrop();
+}
+
+TEST(BlkDBTest, BlobWriteRead) {
+  value_log_ = true;
+  Reopen();
+  TestWriteRead();
+}
+
+TEST(BlkDBTest, BlobTrunc) {
+  value_log_ = true;
+  Reopen();
+  TestTrunc();
+}
+
+TEST(BlkDBTest, BlobTruncOverlappingBlocks) {
+  value_log_ = true;
+  Reopen();
+  TestTruncOverlappingBlocks();
+}
+
+TEST(BlkDBTest, BlobInterleavedWriteRead) {
+  value_log_ = true;
+  Reopen();
+  TestInterleavedWriteRead();
+}
+
+TEST(BlkDBTest, BlobReadAfterTrunc) {
+  value_log_ = true;
+  Reopen();
+  TestReadAfterTrunc();
+}
+
+TEST(BlkDBTest, BlobReclaimed) {
+  value_log_ = true;
+  value_log_file_size_ = 1;  // One blob file per write
+  Reopen();
+  Fentry file = File(1);
+  Fio::Handle* fh1 = Creat(file);
+  Write(file, fh1, 'a', 0, 100);
+  uint64_t size;
+  Fio::Handle* fh2 = Open(file, &size);
+  Write(file, fh2, 'b', 0, 100);
+  // The first blob file no longer holds live data
+  std::string fname = ValueLogDir() + "/000001.blob";
+  ASSERT_OK(env_->DeleteFile(fname.c_str()));
+  ASSERT_EQ(Read(file, fh1, 0, 100), std::string(100, 'b'));
+  ASSERT_OK(blkdb_->Close(file, fh1));
+  ASSERT_OK(blkdb_->Close(file, fh2));
+}
+
+TEST(BlkDBTest, BlobDrop) {
+  value_log_ = true;
+  Reopen();
+  TestDrop();
+}
+
+TEST(BlkDBTest, MultiBlockRead) {
+  Reopen();
+  TestMultiBlockRead();
+}
+
+TEST(BlkDBTest, ParallelRead) {
+  reader_pool_ = ThreadPool::NewFixed(4, true);
+  Reopen();
+  TestMultiBlockRead();
+}
+
+TEST(BlkDBTest, BlobParallelRead) {
+  value_log_ = true;
+  reader_pool_ = ThreadPool::NewFixed(4, true);
+  Reopen();
+  TestMultiBlockRead();
+}
+
+TEST(BlkDBTest, BatchedWrites) {
+  write_batch_size_ = 1 << 20;
+  Reopen();
+  TestBatchedWrites();
+}
+
+TEST(BlkDBTest, BatchedWritesCommitted) {
+  write_batch_size_ = 512;  // Commits once every few writes
+  Reopen();
+  TestBatchedWrites();
+}
+
+TEST(BlkDBTest, BatchedInterleavedWriteRead) {
+  write_batch_size_ = 1 << 20;
+  Reopen();
+  TestInterleavedWriteRead();
+}
+
+TEST(BlkDBTest, BatchedTrunc) {
+  write_batch_size_ = 1 << 20;
+  Reopen();
+  TestTrunc();
+}
+
+TEST(BlkDBTest, BatchedCommitError) {
+  write_batch_size_ = 1 << 20;
+  Reopen();
+  Fentry file1 = File(1);
+  Fentry file2 = File(2);
+  Fio::Handle* fh1 = Creat(file1);
+  Fio::Handle* fh2 = Creat(file2);
+  Fio::Handle* fh3 = Creat(File(3));
+  Write(file1, fh1, 'a', 0, 100);
+  Write(file2, fh2, 'b', 0, 100);
+  Write(file2, fh2, 'c', 100, 100);
+  error_env_.writable_file_error_ = true;
+  ASSERT_TRUE(!blkdb_->Flush(file2, fh2).ok());
+  error_env_.writable_file_error_ = false;
+  // Writes that went out with the failed commit are reported as lost
+  std::string scratch(100, 'x');
+  Slice result;
+  ASSERT_TRUE(!blkdb_->Pread(file1, fh1, &result, 0, 100, &scratch[0]).ok());
+  ASSERT_TRUE(!blkdb_->Close(file1, fh1).ok());
+  ASSERT_TRUE(!blkdb_->Flush(file2, fh2).ok());
+  ASSERT_OK(blkdb_->Close(file2, fh2));  // Already reported
+  // No more writes are accepted
+  ASSERT_TRUE(!blkdb_->Pwrite(File(3), fh3, "x", 0).ok());
+  ASSERT_OK(blkdb_->Close(File(3), fh3));
+}
+
+}  // namespace pdlfs
+
+int main(int argc, char* argv[]) {
+  return ::pdlfs::test::RunAllTests(&argc, &argv);
+}
@@ -74,6 +74,37 @@ void DirTable::Release(Dir::Ref* ref) {
   }
 }
 
+bool DirTable::ParseLRUKey(const Slice& key, DirId* id) {
+  Slice input = key;
+#if !defined(DELTAFS)
+  if (input.size() != 8) {
+    return false;
+  }
+  *id = DirId(DecodeFixed64(input.data()));
+  return true;
+#else
+  return GetVarint64(&input, &id->reg) && GetVarint64(&input, &id->snap) &&
+         GetVarint64(&input, &id->ino) && input.empty();
+#endif
+}
+
+void DirTable::GetHotDirs(std::vector<DirId>* ids, size_t n) {
+  std::vector<std::string> keys;
+  if (mu_ != NULL) {
+    mu_->Lock();
+  }
+  lru_.GetKeys(&keys, n);
+  if (mu_ != NULL) {
+    mu_->Unlock();
+  }
+  DirId id;
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (ParseLRUKey(keys[i], &id)) {
+      ids->push_back(id);
+    }
+  }
+}
+
 Slice DirTable::LRUKey(const DirId& id, char* scratch) {
   char* p = scratch;
 #if !defined(DELTAFS)
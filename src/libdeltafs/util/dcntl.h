@@ -13,6 +13,7 @@
 #include "guard.h"
 #include "mdb.h"
 
+#include "pdlfs-common/arena.h"
 #include "pdlfs-common/gigaplus.h"
 #include "pdlfs-common/lru.h"
 #include "pdlfs-common/port.h"
@@ -100,6 +101,11 @@ class Dir::Tx {
   explicit Tx(MDB* mdb) : rep_(mdb->CreateTx()), refs_(0) {}
   MDB::Tx* rep() const { return rep_; }
 
+  static void* operator new(size_t size) {
+    return SizeClassPool::Default()->Allocate(size);
+  }
+  static void operator delete(void* p) { SizeClassPool::Free(p); }
+
   void Ref() { ++refs_; }
   bool Unref() {
     --refs_;
@@ -132,10 +138,14 @@ class DirTable {
   Dir::Ref* Lookup(const DirId& id);
   Dir::Ref* Insert(const DirId& id, Dir* dir);
   void Erase(const DirId& id);
+  // Append the ids of up to "n" directories in the table to *ids, starting
+  // from those most likely to be accessed again.
+  void GetHotDirs(std::vector<DirId>* ids, size_t n);
 
  private:
   static Slice LRUKey(const DirId&, char* scratch);
-  LRUCache<Dir::Ref> lru_;
+  static bool ParseLRUKey(const Slice& key, DirId* id);
+  LRUCache<Dir::Ref, FlatHashTable<Dir::Ref> > lru_;
   port::Mutex* mu_;
 
   // No copying allowed
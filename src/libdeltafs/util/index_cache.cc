@@ -11,6 +11,7 @@
 #include "index_cache.h"
 
 #include "pdlfs-common/coding.h"
+#include "pdlfs-common/mutexlock.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -20,23 +21,27 @@ namespace pdlfs {
 static void (*Deleter)(const Slice&, DirIndex*) = LRUValueDeleter<DirIndex>;
 
 IndexCache::~IndexCache() {
+  for (int i = 0; i < kNumShards; i++) {
 #ifndef NDEBUG
-  lru_.Prune();
-  assert(lru_.Empty());
+    lru_[i]->Prune();
+    assert(lru_[i]->Empty());
 #endif
+    delete lru_[i];
+  }
 }
 
-IndexCache::IndexCache(size_t capacity, port::Mutex* mu)
-    : lru_(capacity), mu_(mu) {}
+IndexCache::IndexCache(size_t capacity) {
+  const size_t per_shard = (capacity + kNumShards - 1) / kNumShards;
+  for (int i = 0; i < kNumShards; i++) {
+    lru_[i] = new LRUCache<IndexEntry>(per_shard);
+  }
+}
 
 void IndexCache::Release(Handle* handle) {
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  lru_.Release(reinterpret_cast<IndexEntry*>(handle));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  IndexEntry* const e = reinterpret_cast<IndexEntry*>(handle);
+  const uint32_t shard = Shard(e->hash);
+  MutexLock ml(&mu_[shard]);
+  lru_[shard]->Release(e);
 }
 
 const DirIndex* IndexCache::Value(Handle* handle) {
@@ -61,13 +66,9 @@ IndexCache::Handle* IndexCache::Lookup(const DirId& id) {
   Slice key = LRUKey(id, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  Handle* h = reinterpret_cast<Handle*>(lru_.Lookup(key, hash));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  const uint32_t shard = Shard(hash);
+  MutexLock ml(&mu_[shard]);
+  Handle* h = reinterpret_cast<Handle*>(lru_[shard]->Lookup(key, hash));
   return h;
 }
 
@@ -76,14 +77,10 @@ IndexCache::Handle* IndexCache::Insert(const DirId& id, DirIndex* index) {
   Slice key = LRUKey(id, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  Handle* h =
-      reinterpret_cast<Handle*>(lru_.Insert(key, hash, index, 1, Deleter));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  const uint32_t shard = Shard(hash);
+  MutexLock ml(&mu_[shard]);
+  Handle* h = reinterpret_cast<Handle*>(
+      lru_[shard]->Insert(key, hash, index, 1, Deleter));
   return h;
 }
 
@@ -92,13 +89,9 @@ void IndexCache::Erase(const DirId& id) {
   Slice key = LRUKey(id, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  lru_.Erase(key, hash);
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  const uint32_t shard = Shard(hash);
+  MutexLock ml(&mu_[shard]);
+  lru_[shard]->Erase(key, hash);
 }
 
 }  // namespace pdlfs
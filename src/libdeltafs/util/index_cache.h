@@ -17,15 +17,13 @@
 
 namespace pdlfs {
 
-// An LRU-cache of directory indices.
+// An LRU-cache of directory indices. Like LookupCache, the cache is split
+// into a fixed number of independently locked shards and is thread-safe.
 class IndexCache {
   typedef LRUEntry<DirIndex> IndexEntry;
 
  public:
-  // If mu is NULL, the resulting IndexCache requires external synchronization.
-  // If mu is not NULL, the resulting IndexCache is implicitly synchronized
-  // via it and is thread-safe.
-  explicit IndexCache(size_t capacity = 4096, port::Mutex* mu = NULL);
+  explicit IndexCache(size_t capacity = 4096);
   ~IndexCache();
 
   struct Handle {};
@@ -38,8 +36,11 @@ class IndexCache {
 
  private:
   static Slice LRUKey(const DirId&, char* scratch);
-  LRUCache<IndexEntry> lru_;
-  port::Mutex* mu_;
+  enum { kNumShardBits = 4 };
+  enum { kNumShards = 1 << kNumShardBits };
+  static uint32_t Shard(uint32_t hash) { return hash >> (32 - kNumShardBits); }
+  LRUCache<IndexEntry>* lru_[kNumShards];
+  port::Mutex mu_[kNumShards];
 
   // No copying allowed
   void operator=(const IndexCache&);
@@ -15,6 +15,7 @@
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/status.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <errno.h>
 
@@ -23,6 +24,8 @@ namespace pdlfs {
 LeaseOptions::LeaseOptions()
     : max_lease_duration(1000 * 1000), max_num_leases(4096) {}
 
+LeaseStats::LeaseStats() : grants(0), waits(0), evictions(0) {}
+
 bool Lease::busy() const {
   if (state == kLeaseLocked) {
     return true;
@@ -35,15 +38,66 @@ bool LeaseEntry::is_pinned() const { return value->busy(); }
 
 LeaseTable::~LeaseTable() {
 #ifndef NDEBUG
-  // Wait for all leases to expire
-  SleepForMicroseconds(10 + options_.max_lease_duration);
   lru_.Prune();
+  if (!lru_.Empty()) {
+    // Wait for all leases to expire
+    SleepForMicroseconds(10 + options_.max_lease_duration);
+    lru_.Prune();
+  }
   assert(lru_.Empty());
 #endif
 }
 
 LeaseTable::LeaseTable(const LeaseOptions& options, port::Mutex* mu)
-    : options_(options), lru_(options_.max_num_leases), mu_(mu) {}
+    : options_(options), lru_(options_.max_num_leases), mu_(mu) {
+  // Make the wheel span twice the max lease duration so that a lease is
+  // always filed ahead of the slots currently being swept
+  tick_micros_ = 1 + 2 * options_.max_lease_duration / kWheelSlots;
+  last_tick_ = CurrentMicros() / tick_micros_;
+}
+
+void LeaseTable::File(const Slice& key, uint64_t due) {
+  const uint64_t tick = std::max(due / tick_micros_, last_tick_);
+  wheel_[tick % kWheelSlots].push_back(key.ToString());
+}
+
+// Sweep all slots that are due, evicting expired leases and refiling those
+// that have since been extended or are still in use.
+size_t LeaseTable::EvictExpired() {
+  const uint64_t now = CurrentMicros();
+  const uint64_t now_tick = now / tick_micros_;
+  uint64_t tick = last_tick_;
+  if (tick > now_tick) {
+    return 0;  // Already swept
+  } else if (now_tick - tick >= kWheelSlots) {
+    tick = now_tick - kWheelSlots + 1;
+  }
+  last_tick_ = now_tick + 1;  // New leases will be filed from here on
+  size_t n = 0;
+  std::vector<std::string> keys;
+  for (; tick <= now_tick; tick++) {
+    keys.clear();
+    keys.swap(wheel_[tick % kWheelSlots]);
+    for (size_t i = 0; i < keys.size(); i++) {
+      const Slice key = keys[i];
+      const uint32_t hash = Hash(key.data(), key.size(), 0);
+      Lease::Ref* const r = lru_.Lookup(key, hash);
+      if (r == NULL) {
+        continue;  // Stale key
+      }
+      Lease* const lease = r->value;
+      if (r->refs == 2 && !lease->busy()) {  // The table's and ours
+        lru_.Erase(key, hash);
+        stats_.evictions++;
+        n++;
+      } else {
+        File(key, lease->state == kLeaseLocked ? now : lease->due);
+      }
+      lru_.Release(r);
+    }
+  }
+  return n;
+}
 
 void LeaseTable::Release(Lease::Ref* ref) {
   if (mu_ != NULL) {
@@ -107,8 +161,13 @@ Lease::Ref* LeaseTable::Insert(const DirId& pid, const Slice& nhash,
   if (lru_.Exists(key, hash)) {
     error = true;
     err = EEXIST;
+  } else if (lru_.usage() >= options_.max_num_leases &&
+             EvictExpired() == 0) {
+    error = true;
+    err = ENOBUFS;
   } else {
     r = lru_.Insert(key, hash, lease, 1, DeleteLease);
+    File(key, lease->due);
   }
   if (mu_ != NULL) {
     mu_->Unlock();
@@ -12,9 +12,13 @@
 
 #include "dcntl.h"
 
+#include "pdlfs-common/arena.h"
 #include "pdlfs-common/lru.h"
 #include "pdlfs-common/port.h"
 
+#include <string>
+#include <vector>
+
 namespace pdlfs {
 
 struct Lease;
@@ -25,6 +29,16 @@ struct LeaseOptions {
   size_t max_num_leases;
 };
 
+struct LeaseStats {
+  LeaseStats();
+  // Total number of leases granted or extended.
+  uint64_t grants;
+  // Total number of write operations that had to wait for leases to expire.
+  uint64_t waits;
+  // Total number of expired leases evicted to make room for new ones.
+  uint64_t evictions;
+};
+
 class LeaseTable;
 
 // Lease states
@@ -70,6 +84,13 @@ struct Lease {
   const Dir* parent;
   uint64_t due;
   LeaseState state;
+
+  // Leases come and go with file creates and lookups; recycle them through
+  // the process-wide pool rather than the system allocator
+  static void* operator new(size_t size) {
+    return SizeClassPool::Default()->Allocate(size);
+  }
+  static void operator delete(void* p) { SizeClassPool::Free(p); }
 };
 
 struct LeaseEntry {
@@ -98,7 +119,11 @@ struct LeaseEntry {
   }
 };
 
-// An LRU-cache of directory lookup state leases.
+// A table of directory lookup state leases. Leases that may still be held by
+// clients are never evicted. When the table is full, expired leases are
+// located through a timer wheel that files each lease by its due and are
+// evicted to make room for new ones. If no lease can be evicted, insertion
+// fails with ENOBUFS.
 class LeaseTable {
  public:
   // If mu is NULL, this LeaseTable requires external synchronization.
@@ -112,12 +137,25 @@ class LeaseTable {
   Lease::Ref* Insert(const DirId& pid, const Slice& nhash, Lease* lease);
   void Erase(const DirId& pid, const Slice& nhash);
 
+  // Grants and waits are counted by callers.
+  LeaseStats* stats() { return &stats_; }
+
  private:
   static Slice LRUKey(const DirId&, const Slice&, char* scratch);
+  void File(const Slice& key, uint64_t due);
+  size_t EvictExpired();
   LeaseOptions options_;
-  LRUCache<Lease::Ref> lru_;
+  LeaseStats stats_;
+  LRUCache<Lease::Ref, FlatHashTable<Lease::Ref> > lru_;
   port::Mutex* mu_;
 
+  // Each slot holds the keys of the leases due within one tick. Keys may
+  // be stale and are checked against the table when their slot is swept.
+  enum { kWheelSlots = 64 };
+  std::vector<std::string> wheel_[kWheelSlots];
+  uint64_t tick_micros_;
+  uint64_t last_tick_;  // All slots before this tick have been swept
+
   // No copying allowed
   void operator=(const LeaseTable&);
   LeaseTable(const LeaseTable&);
@@ -11,6 +11,7 @@
 #include "lookup_cache.h"
 
 #include "pdlfs-common/coding.h"
+#include "pdlfs-common/mutexlock.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -21,23 +22,27 @@ namespace pdlfs {
 static void (*Deleter)(const Slice&, LookupStat*) = LRUValueDeleter<LookupStat>;
 
 LookupCache::~LookupCache() {
+  for (int i = 0; i < kNumShards; i++) {
 #ifndef NDEBUG
-  lru_.Prune();
-  assert(lru_.Empty());
+    lru_[i]->Prune();
+    assert(lru_[i]->Empty());
 #endif
+    delete lru_[i];
+  }
 }
 
-LookupCache::LookupCache(size_t capacity, port::Mutex* mu)
-    : lru_(capacity), mu_(mu) {}
+LookupCache::LookupCache(size_t capacity) {
+  const size_t per_shard = (capacity + kNumShards - 1) / kNumShards;
+  for (int i = 0; i < kNumShards; i++) {
+    lru_[i] = new LRUCache<LookupEntry>(per_shard);
+  }
+}
 
 void LookupCache::Release(Handle* handle) {
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  lru_.Release(reinterpret_cast<LookupEntry*>(handle));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  LookupEntry* const e = reinterpret_cast<LookupEntry*>(handle);
+  const uint32_t shard = Shard(e->hash);
+  MutexLock ml(&mu_[shard]);
+  lru_[shard]->Release(e);
 }
 
 LookupStat* LookupCache::Value(Handle* handle) {
@@ -63,13 +68,9 @@ LookupCache::Handle* LookupCache::Lookup(const DirId& pid, const Slice& nhash) {
   Slice key = LRUKey(pid, nhash, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  Handle* h = reinterpret_cast<Handle*>(lru_.Lookup(key, hash));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  const uint32_t shard = Shard(hash);
+  MutexLock ml(&mu_[shard]);
+  Handle* h = reinterpret_cast<Handle*>(lru_[shard]->Lookup(key, hash));
   return h;
 }
 
@@ -79,14 +80,10 @@ LookupCache::Handle* LookupCache::Insert(const DirId& pid, const Slice& nhash,
   Slice key = LRUKey(pid, nhash, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  Handle* h =
-      reinterpret_cast<Handle*>(lru_.Insert(key, hash, stat, 1, Deleter));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  const uint32_t shard = Shard(hash);
+  MutexLock ml(&mu_[shard]);
+  Handle* h = reinterpret_cast<Handle*>(
+      lru_[shard]->Insert(key, hash, stat, 1, Deleter));
   return h;
 }
 
@@ -95,13 +92,9 @@ void LookupCache::Erase(const DirId& pid, const Slice& nhash) {
   Slice key = LRUKey(pid, nhash, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  lru_.Erase(key, hash);
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  const uint32_t shard = Shard(hash);
+  MutexLock ml(&mu_[shard]);
+  lru_[shard]->Erase(key, hash);
 }
 
 }  // namespace pdlfs
@@ -17,15 +17,15 @@
 
 namespace pdlfs {
 
-// An LRU-cache of pathname lookup leases.
+// An LRU-cache of pathname lookup leases. The cache is split into a fixed
+// number of shards, each of which is an independent LRU-cache guarded by its
+// own mutex. The resulting LookupCache is thread-safe and lookups for
+// different entries can proceed in parallel.
 class LookupCache {
   typedef LRUEntry<LookupStat> LookupEntry;
 
  public:
-  // If mu is NULL, the resulting LookupCache requires external synchronization.
-  // If mu is not NULL, the resulting LookupCache is implicitly synchronized
-  // via it and is thread-safe.
-  explicit LookupCache(size_t capacity = 4096, port::Mutex* mu = NULL);
+  explicit LookupCache(size_t capacity = 4096);
   ~LookupCache();
 
   struct Handle {};
@@ -38,8 +38,11 @@ class LookupCache {
 
  private:
   static Slice LRUKey(const DirId&, const Slice&, char* scratch);
-  LRUCache<LookupEntry> lru_;
-  port::Mutex* mu_;
+  enum { kNumShardBits = 4 };
+  enum { kNumShards = 1 << kNumShardBits };
+  static uint32_t Shard(uint32_t hash) { return hash >> (32 - kNumShardBits); }
+  LRUCache<LookupEntry>* lru_[kNumShards];
+  port::Mutex mu_[kNumShards];
 
   // No copying allowed
   void operator=(const LookupCache&);
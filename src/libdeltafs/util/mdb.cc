@@ -12,13 +12,51 @@
 
 #include "dcntl.h"
 
+#include "pdlfs-common/coding.h"
 #include "pdlfs-common/gigaplus.h"
+#include "pdlfs-common/leveldb/filenames.h"
+#include "pdlfs-common/leveldb/table_builder.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <algorithm>
 
 namespace pdlfs {
 // Tablefs has its own MDB definitions, so we won't define it.
 #if defined(DELTAFS) || defined(INDEXFS)
 MDBOptions::MDBOptions()
-    : fill_cache(false), verify_checksums(false), sync(false), db(NULL) {}
+    : fill_cache(false),
+      verify_checksums(false),
+      sync(false),
+      collect_stats(false),
+      db(NULL) {}
+
+namespace {
+class MDBPrefixExtractorImpl : public PrefixExtractor {
+ public:
+  // Directory entry keys are the directory's key prefix (ending with the key
+  // type) followed by an 8-byte name hash
+  virtual bool InDomain(const Slice& key) const {
+    return key.size() > 8 && key[key.size() - 9] == kDirEntType;
+  }
+
+  virtual Slice Transform(const Slice& key) const {
+    return Slice(key.data(), key.size() - 8);
+  }
+
+  virtual const char* Name() const { return "deltafs.MDBPrefixExtractor"; }
+};
+
+port::OnceType once = PDLFS_ONCE_INIT;
+const PrefixExtractor* mdb_prefix;
+
+void InitModule() { mdb_prefix = new MDBPrefixExtractorImpl; }
+
+}  // namespace
+
+const PrefixExtractor* MDBPrefixExtractor() {
+  port::InitOnce(&once, InitModule);
+  return mdb_prefix;
+}
 
 MDBStats::MDBStats()
     : putkeybytes(0),
@@ -28,7 +66,13 @@ MDBStats::MDBStats()
       getbytes(0),
       gets(0) {}
 
-MDB::MDB(const MDBOptions& opts) : MXDB(opts.db) {}
+MDB::MDB(const MDBOptions& opts)
+    : MXDB(opts.db),
+      options_(opts),
+      cv_(&mutex_),
+      commits_(0),
+      synced_(0),
+      syncing_(false) {}
 
 MDB::~MDB() {}
 
@@ -43,7 +87,13 @@ Status MDB::GetNode(const DirId& id, const Slice& hash, Stat* stat,
   ReadOptions read_options;
   read_options.verify_checksums = options_.verify_checksums;
   read_options.fill_cache = options_.fill_cache;
-  return GET<Key>(id, hash, stat, name, &read_options, tx, (MDBStats*)NULL);
+  if (!options_.collect_stats) {
+    return GET<Key>(id, hash, stat, name, &read_options, tx, (MDBStats*)NULL);
+  }
+  MDBStats stats;
+  Status s = GET<Key>(id, hash, stat, name, &read_options, tx, &stats);
+  AddStats(stats);
+  return s;
 }
 
 Status MDB::GetDirIdx(const DirId& id, DirIndex* idx, Tx* tx) {
@@ -85,11 +135,62 @@ Status MDB::GetInfo(const DirId& id, DirInfo* info, Tx* tx) {
   return s;
 }
 
+Status MDB::GetInoMark(uint64_t* ino) {
+  Status s;
+  Key key(0, kSuperBlockType);
+  char tmp[8];
+  ReadOptions read_options;
+  read_options.verify_checksums = options_.verify_checksums;
+  read_options.fill_cache = options_.fill_cache;
+  Slice result;
+  s = dx_->Get(read_options, key.prefix(), &result, tmp, sizeof(tmp));
+  if (s.ok()) {
+    if (result.size() != 8) {
+      s = Status::Corruption(Slice());
+    } else {
+      *ino = DecodeFixed64(result.data());
+    }
+  }
+  return s;
+}
+
+Status MDB::SetInoMark(uint64_t ino) {
+  Key key(0, kSuperBlockType);
+  char tmp[8];
+  EncodeFixed64(tmp, ino);
+  WriteOptions options;
+  options.sync = options_.sync;
+  return dx_->Put(options, key.prefix(), Slice(tmp, sizeof(tmp)));
+}
+
+Status MDB::GetWarmupList(std::string* list) {
+  Key key(0, kSuperBlockType);
+  key.SetOffset(1);  // The ino mark uses the key prefix alone
+  ReadOptions read_options;
+  read_options.verify_checksums = options_.verify_checksums;
+  read_options.fill_cache = options_.fill_cache;
+  return dx_->Get(read_options, key.Encode(), list);
+}
+
+Status MDB::SetWarmupList(const Slice& list) {
+  Key key(0, kSuperBlockType);
+  key.SetOffset(1);  // The ino mark uses the key prefix alone
+  WriteOptions options;
+  options.sync = options_.sync;
+  return dx_->Put(options, key.Encode(), list);
+}
+
 Status MDB::SetNode(const DirId& id, const Slice& hash, const Stat& stat,
                     const Slice& name, Tx* tx) {
   WriteOptions write_options;
   write_options.sync = options_.sync;
-  return PUT<Key>(id, hash, stat, name, &write_options, tx, (MDBStats*)NULL);
+  if (!options_.collect_stats) {
+    return PUT<Key>(id, hash, stat, name, &write_options, tx, (MDBStats*)NULL);
+  }
+  MDBStats stats;
+  Status s = PUT<Key>(id, hash, stat, name, &write_options, tx, &stats);
+  AddStats(stats);
+  return s;
 }
 
 Status MDB::SetDirIdx(const DirId& id, const DirIndex& idx, Tx* tx) {
@@ -152,14 +253,111 @@ Status MDB::DelInfo(const DirId& id, Tx* tx) {
   return s;
 }
 
+Status MDB::Commit(Tx* tx, uint64_t* ticket) {
+  WriteOptions options;
+  Status s = COMMIT<Tx, WriteOptions>(&options, tx);
+  *ticket = 0;
+  if (s.ok() && tx != NULL && options_.sync) {
+    MutexLock ml(&mutex_);
+    *ticket = ++commits_;
+  }
+  return s;
+}
+
+Status MDB::WaitForCommit(uint64_t ticket) {
+  Status s;
+  MutexLock ml(&mutex_);
+  while (s.ok() && synced_ < ticket) {
+    if (syncing_) {
+      cv_.Wait();
+    } else {
+      // Sync on behalf of all writes committed so far
+      const uint64_t target = commits_;
+      syncing_ = true;
+      mutex_.Unlock();
+      s = dx_->SyncWAL();
+      mutex_.Lock();
+      syncing_ = false;
+      if (s.ok() && target > synced_) {
+        synced_ = target;
+      }
+      cv_.SignalAll();
+    }
+  }
+  return s;
+}
+
+void MDB::AddStats(const MDBStats& stats) {
+  MutexLock ml(&mutex_);
+  stats_.putkeybytes += stats.putkeybytes;
+  stats_.putbytes += stats.putbytes;
+  stats_.puts += stats.puts;
+  stats_.getkeybytes += stats.getkeybytes;
+  stats_.getbytes += stats.getbytes;
+  stats_.gets += stats.gets;
+}
+
+void MDB::GetStats(MDBStats* stats) {
+  MutexLock ml(&mutex_);
+  *stats = stats_;
+}
+
 size_t MDB::List(const DirId& id, StatList* stats, NameList* names, Tx* tx,
                  size_t limit) {
   ReadOptions read_options;
   read_options.verify_checksums = options_.verify_checksums;
   read_options.fill_cache = false;
+  Key prefix_key(KEY_INITIALIZER(id, kDirEntType));
+  read_options.prefix = prefix_key.prefix();
   return LIST<Iterator, Key>(id, stats, names, &read_options, tx, limit);
 }
 
+size_t MDB::ListFrom(const DirId& id, const Slice& start, StatList* stats,
+                     NameList* names, Tx* tx, size_t limit) {
+  ReadOptions read_options;
+  read_options.verify_checksums = options_.verify_checksums;
+  read_options.fill_cache = false;
+  if (tx != NULL) {
+    read_options.snapshot = tx->snap;
+  }
+  Key prefix_key(KEY_INITIALIZER(id, kDirEntType));
+  Slice prefix = prefix_key.prefix();
+  read_options.prefix = prefix;
+  Iterator* const iter = dx_->NewIterator(read_options);
+  if (start.empty()) {
+    iter->Seek(prefix);
+  } else {
+    Key key(KEY_INITIALIZER(id, kDirEntType));
+    key.SetSuffix(start);
+    iter->Seek(key.Encode());
+    if (iter->Valid() && iter->key() == key.Encode()) {
+      iter->Next();  // Skip the last entry of the previous call
+    }
+  }
+  Slice name;
+  Stat stat;
+  size_t num_entries = 0;
+  for (; iter->Valid() && num_entries < limit; iter->Next()) {
+    Slice input = iter->value();
+    if (!iter->key().starts_with(prefix))  // Hitting end of directory
+      break;
+    if (stats != NULL ? !stat.DecodeFrom(&input)
+                      : !Stat::SkipEncoding(&input)) {
+      break;  // Error
+    } else if (!GetLengthPrefixedSlice(&input, &name)) {
+      break;  // Error
+    }
+
+    if (names != NULL) names->push_back(name.ToString());
+    if (stats != NULL) stats->push_back(stat);
+
+    num_entries++;
+  }
+
+  delete iter;
+  return num_entries;
+}
+
 bool MDB::Exists(const DirId& id, const Slice& hash, Tx* tx) {
   ReadOptions read_options;
   read_options.verify_checksums = options_.verify_checksums;
@@ -170,5 +368,128 @@ bool MDB::Exists(const DirId& id, const Slice& hash, Tx* tx) {
   return s.ok();
 }
 
+Status MDB::BulkInsert(const std::string& dir) {
+  // Reads check the memtable before any table, so existing entries must
+  // first be flushed for the new tables to take precedence over them
+  Status s = dx_->FlushMemTable(FlushOptions());
+  if (s.ok()) {
+    InsertOptions options(kRename);
+    options.verify_checksums = options_.verify_checksums;
+    s = dx_->AddL0Tables(options, dir);
+  }
+  return s;
+}
+
+MDBLoader::MDBLoader(const DBOptions& options, const std::string& dir,
+                     size_t buffer_size)
+    : icmp_(options.comparator),
+      ipolicy_(NULL),
+      iprefix_(NULL),
+      options_(options),
+      dir_(dir),
+      buffer_size_(buffer_size),
+      bytes_(0),
+      next_file_(1),
+      seq_(0) {
+  options_.comparator = &icmp_;
+  if (options.filter_policy != NULL) {
+    ipolicy_ = new InternalFilterPolicy(options.filter_policy);
+    options_.filter_policy = ipolicy_;
+  }
+  if (options.prefix_extractor != NULL) {
+    iprefix_ = new InternalPrefixExtractor(options.prefix_extractor);
+    options_.prefix_extractor = iprefix_;
+  }
+  options_.env->CreateDir(dir_.c_str());  // Ignore errors
+}
+
+MDBLoader::~MDBLoader() {
+  delete iprefix_;
+  delete ipolicy_;
+}
+
+Status MDBLoader::Add(const DirId& id, const Slice& hash, const Stat& stat,
+                      const Slice& name) {
+  if (!status_.ok()) {
+    return status_;
+  }
+  Key key(KEY_INITIALIZER(id, kDirEntType));
+  key.SetSuffix(hash);
+  char tmp[200];
+  entries_.push_back(Entry());
+  Entry* const e = &entries_.back();
+  e->first.assign(key.data(), key.size());
+  e->second = stat.EncodeTo(tmp).ToString();
+  PutLengthPrefixedSlice(&e->second, name);
+  bytes_ += e->first.size() + e->second.size();
+  if (bytes_ >= buffer_size_) {
+    status_ = Flush();
+  }
+  return status_;
+}
+
+Status MDBLoader::Finish() {
+  if (status_.ok() && !entries_.empty()) {
+    status_ = Flush();
+  }
+  return status_;
+}
+
+namespace {
+struct EntryComparator {
+  explicit EntryComparator(const Comparator* c) : ucmp(c) {}
+  bool operator()(const std::pair<std::string, std::string>& a,
+                  const std::pair<std::string, std::string>& b) const {
+    return ucmp->Compare(a.first, b.first) < 0;
+  }
+  const Comparator* ucmp;
+};
+}  // namespace
+
+// Sort all buffered entries and write them out as a new table file. Each table
+// gets a range of sequence numbers above those of all previous tables so that
+// entries in later tables take precedence once inserted into the db.
+Status MDBLoader::Flush() {
+  std::stable_sort(entries_.begin(), entries_.end(),
+                   EntryComparator(icmp_.user_comparator()));
+  const std::string fname = TableFileName(dir_, next_file_++);
+  WritableFile* file;
+  Status s = options_.env->NewWritableFile(fname.c_str(), &file);
+  if (!s.ok()) {
+    return s;
+  }
+  TableBuilder* const builder = new TableBuilder(options_, file);
+  const SequenceNumber base = seq_;
+  std::string ikey;
+  for (size_t i = 0; i < entries_.size(); i++) {
+    // Skip entries superseded by a later one with the same key
+    if (i + 1 < entries_.size() &&
+        icmp_.user_comparator()->Compare(entries_[i].first,
+                                         entries_[i + 1].first) == 0) {
+      continue;
+    }
+    ikey.clear();
+    AppendInternalKey(&ikey, ParsedInternalKey(entries_[i].first,
+                                               base + 1 + i, kTypeValue));
+    builder->Add(ikey, entries_[i].second);
+  }
+  seq_ = base + entries_.size();
+  s = builder->Finish();
+  delete builder;
+  if (s.ok()) {
+    s = file->Sync();
+  }
+  if (s.ok()) {
+    s = file->Close();
+  }
+  delete file;
+  if (!s.ok()) {
+    options_.env->DeleteFile(fname.c_str());
+  }
+  entries_.clear();
+  bytes_ = 0;
+  return s;
+}
+
 #endif
 }  // namespace pdlfs
@@ -10,15 +10,23 @@
  */
 #pragma once
 
+#include "pdlfs-common/arena.h"
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/fsdbx.h"
 #include "pdlfs-common/fstypes.h"
 #include "pdlfs-common/leveldb/db.h"
+#include "pdlfs-common/leveldb/filter_policy.h"
+#include "pdlfs-common/leveldb/internal_types.h"
 #include "pdlfs-common/leveldb/readonly.h"
 #include "pdlfs-common/leveldb/snapshot.h"
 #include "pdlfs-common/leveldb/write_batch.h"
+#include "pdlfs-common/port.h"
 #include "pdlfs-common/status.h"
 
+#include <string>
+#include <utility>
+#include <vector>
+
 namespace pdlfs {
 // Tablefs has its own MDB definitions, so we won't define it.
 #if defined(DELTAFS) || defined(INDEXFS)
@@ -35,10 +43,20 @@ struct MDBOptions {
   // Always set sync to the following for all WriteOptions.
   // Default: false
   bool sync;
+  // Count the keys and values of all directory entries read and written.
+  // Counts are retrieved by MDB::GetStats().
+  // Default: false
+  bool collect_stats;
   // The underlying KV-store.
   DB* db;
 };
 
+// Return a prefix extractor that maps each directory entry key to the key
+// prefix of its parent directory. Setting it as the db's prefix_extractor
+// lets List() skip tables holding no entries of the listed directory. The
+// result is a builtin singleton and must not be deleted.
+extern const PrefixExtractor* MDBPrefixExtractor();
+
 struct MDBStats {
   MDBStats();
   // Total amount of key bytes pushed to db.
@@ -64,6 +82,12 @@ class MDB : public MXDB<> {
     Tx() {}  // Note that snap is initialized via Create Tx
     const Snapshot* snap;
     WriteBatch bat;
+    // One is created for every server request; recycle them through the
+    // process-wide pool rather than the system allocator
+    static void* operator new(size_t size) {
+      return SizeClassPool::Default()->Allocate(size);
+    }
+    static void operator delete(void* p) { SizeClassPool::Free(p); }
   };
   Tx* CreateTx(bool snap = true) {  // Start a new Tx
     return STARTTX<Tx>(snap);
@@ -81,27 +105,107 @@ class MDB : public MXDB<> {
 
   Status GetInfo(const DirId& id, DirInfo* info, Tx* tx);
   Status SetInfo(const DirId& id, const DirInfo& info, Tx* tx);
+
+  // The highest inode number that may have been allocated by the server.
+  // Return NotFound if none has been stored yet.
+  Status GetInoMark(uint64_t* ino);
+  Status SetInoMark(uint64_t ino);
+  // An opaque list of directories to preload at server start.
+  // Return NotFound if none has been stored yet.
+  Status GetWarmupList(std::string* list);
+  Status SetWarmupList(const Slice& list);
   Status DelInfo(const DirId& id, Tx* tx);
 
   size_t List(const DirId& id, StatList* stats, NameList* names, Tx* tx,
               size_t limit);
+  // Same as List() but only returns entries whose name hash is greater than
+  // "start". Set "start" to the hash of the last entry returned by a
+  // previous call to resume listing a directory. An empty "start" selects
+  // all entries.
+  size_t ListFrom(const DirId& id, const Slice& start, StatList* stats,
+                  NameList* names, Tx* tx, size_t limit);
   bool Exists(const DirId& id, const Slice& hash, Tx* tx);
 
+  // Insert all table files under "dir", such as those written by an
+  // MDBLoader, into the db. Files are moved rather than copied. Entries
+  // loaded this way skip the memtable and the write-ahead log entirely.
+  Status BulkInsert(const std::string& dir);
+
   // Finish a Tx by submitting all its writes
   Status Commit(Tx* tx) {
     WriteOptions options;
+    options.sync = options_.sync;
     return COMMIT<Tx, WriteOptions>(&options, tx);
   }
 
+  // Same as Commit() except that the writes are not synced even if
+  // options.sync is set. Instead, a ticket is returned that the caller
+  // should later pass to WaitForCommit(), preferably after having released
+  // all its locks, to wait for the writes to become durable.
+  Status Commit(Tx* tx, uint64_t* ticket);
+  // Wait until the writes of a previous Commit() have been synced. Concurrent
+  // callers share a single log sync so that a burst of writes from many
+  // threads costs only a few syncs. Each caller gets its own status.
+  Status WaitForCommit(uint64_t ticket);
+
   void Release(Tx* tx) {  // Discard a Tx
     RELEASE<Tx>(tx);
   }
 
+  // Store the directory entry stats collected so far in *stats. All counts
+  // stay zero unless options.collect_stats is set.
+  void GetStats(MDBStats* stats);
+
  private:
+  void AddStats(const MDBStats& stats);
   MDBOptions options_;
+  // State below is protected by mutex_
+  port::Mutex mutex_;
+  MDBStats stats_;
+  port::CondVar cv_;
+  uint64_t commits_;  // Number of writes committed but possibly not synced
+  uint64_t synced_;  // Writes up to this ticket are durable
+  bool syncing_;  // True iff a thread is currently syncing the log
   void operator=(const MDB&);  // No copying allowed
   MDB(const MDB&);
 };
 
+// Write directory entries into sorted table files that can later be inserted
+// into a db via MDB::BulkInsert(). This is much faster than SetNode() when
+// importing a large namespace. Entries may be added in any order, but a later
+// entry replaces an earlier one with the same name. Not thread-safe.
+class MDBLoader {
+ public:
+  // "options" should be the options the target db was opened with. Up to
+  // "buffer_size" bytes of entries are sorted in memory before being written
+  // out as a table file under "dir".
+  MDBLoader(const DBOptions& options, const std::string& dir,
+            size_t buffer_size = 32 << 20);
+  ~MDBLoader();
+
+  Status Add(const DirId& id, const Slice& hash, const Stat& stat,
+             const Slice& name);
+  // Write out all buffered entries. Must be called before the files under
+  // "dir" are inserted into the db.
+  Status Finish();
+
+ private:
+  Status Flush();
+  InternalKeyComparator icmp_;
+  InternalFilterPolicy* ipolicy_;
+  InternalPrefixExtractor* iprefix_;
+  DBOptions options_;
+  std::string dir_;
+  size_t buffer_size_;
+  typedef std::pair<std::string, std::string> Entry;
+  std::vector<Entry> entries_;
+  size_t bytes_;  // Total size of all buffered entries
+  uint64_t next_file_;
+  SequenceNumber seq_;
+  Status status_;
+  void operator=(const MDBLoader&);  // No copying allowed
+  MDBLoader(const MDBLoader&);
+};
+
 #endif
 }  // namespace pdlfs